@@ -16,6 +16,9 @@ zmqSubSocket.setsockopt(zmq.SUBSCRIBE, "hashblock")
 zmqSubSocket.setsockopt(zmq.SUBSCRIBE, "hashtx")
 zmqSubSocket.setsockopt(zmq.SUBSCRIBE, "rawblock")
 zmqSubSocket.setsockopt(zmq.SUBSCRIBE, "rawtx")
+zmqSubSocket.setsockopt(zmq.SUBSCRIBE, "smartnodelist")
+zmqSubSocket.setsockopt(zmq.SUBSCRIBE, "rewardsround")
+zmqSubSocket.setsockopt(zmq.SUBSCRIBE, "spork")
 zmqSubSocket.connect("tcp://127.0.0.1:%i" % port)
 
 try:
@@ -39,6 +42,21 @@ try:
         elif topic == "rawtx":
             print '- RAW TX ('+sequence+') -'
             print binascii.hexlify(body)
+        elif topic == "hashtxlock":
+            print '- HASH TX LOCK ('+sequence+') -'
+            print binascii.hexlify(body)
+        elif topic == "rawtxlock":
+            print '- RAW TX LOCK ('+sequence+') -'
+            print binascii.hexlify(body)
+        elif topic == "smartnodelist":
+            print '- SMARTNODE ' + ('ADDED' if body[36:] == '\x01' else 'REMOVED') + ' ('+sequence+') -'
+            print binascii.hexlify(body[31::-1]) + '-' + str(struct.unpack('<I', body[32:36])[0])
+        elif topic == "rewardsround":
+            print '- REWARDS ROUND ('+sequence+') -'
+            print body
+        elif topic == "spork":
+            print '- SPORK ('+sequence+') -'
+            print binascii.hexlify(body)
 
 except KeyboardInterrupt:
     zmqContext.destroy()
@@ -141,6 +141,9 @@ testScripts = [
     'p2p-segwit.py',
     'segwit.py',
     'importprunedfunds.py',
+    'wallet-rescan.py',
+    'dumptxoutset.py',
+    'metrics.py',
     'signmessages.py',
     'p2p-compactblocks.py',
     'nulldummy.py',
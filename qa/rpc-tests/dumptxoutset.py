@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The SmartCash developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test dumptxoutset and starting a node from its file with -loadtxoutset.
+#
+
+import os
+import shutil
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.authproxy import JSONRPCException
+from test_framework.util import *
+
+class DumpTxOutSetTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+
+    def setup_network(self, split=False):
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir)
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.is_network_split = False
+        self.sync_all()
+
+    def run_test(self):
+        print("Mining blocks...")
+        self.nodes[0].generate(120)
+        self.nodes[0].sendtoaddress(self.nodes[1].getnewaddress(), 10)
+        self.nodes[0].generate(10)
+        self.sync_all()
+
+        result = self.nodes[0].dumptxoutset("utxo.dat")
+        snapshot = result['path']
+        assert_equal(result['height'], 130)
+        assert_equal(result['bestblock'], self.nodes[0].getbestblockhash())
+        assert_equal(result['muhash'], self.nodes[0].gettxoutsetinfo("muhash")['muhash'])
+        assert(os.path.isfile(snapshot))
+        assert_raises(JSONRPCException, self.nodes[0].dumptxoutset, "utxo.dat")
+
+        print("Starting a node from the snapshot...")
+        stop_node(self.nodes[1], 1)
+        datadir = os.path.join(self.options.tmpdir, "node1", "regtest")
+        shutil.rmtree(os.path.join(datadir, "chainstate"))
+        shutil.rmtree(os.path.join(datadir, "rewards"))
+        self.nodes[1] = start_node(1, self.options.tmpdir, ["-loadtxoutset=" + snapshot])
+        assert_equal(self.nodes[1].getbestblockhash(), result['bestblock'])
+        assert_equal(self.nodes[1].gettxoutsetinfo("muhash")['muhash'], result['muhash'])
+
+        # The chain state continues from the block of the snapshot
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.nodes[0].generate(5)
+        self.sync_all()
+        assert_equal(self.nodes[1].gettxoutsetinfo("muhash")['muhash'], self.nodes[0].gettxoutsetinfo("muhash")['muhash'])
+
+        # Once the chain state is there the snapshot is ignored
+        stop_node(self.nodes[1], 1)
+        self.nodes[1] = start_node(1, self.options.tmpdir, ["-loadtxoutset=" + snapshot])
+        assert_equal(self.nodes[1].getblockcount(), 135)
+
+if __name__ == '__main__':
+    DumpTxOutSetTest().main()
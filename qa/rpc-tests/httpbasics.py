@@ -11,6 +11,7 @@ from test_framework.test_framework import BitcoinTestFramework
 from test_framework.util import *
 
 import http.client
+import socket
 import urllib.parse
 
 class HTTPBasicsTest (BitcoinTestFramework):
@@ -108,6 +109,45 @@ class HTTPBasicsTest (BitcoinTestFramework):
         out1 = conn.getresponse()
         assert_equal(out1.status, http.client.BAD_REQUEST)
 
+        # getblocktemplate-style calls run in their own work queue by default
+        queues = dict((q['name'], q) for q in self.nodes[0].getrpcinfo()['queues'])
+        assert_equal(sorted(queues.keys()), ['default', 'mining'])
+        assert_equal(queues['mining']['threads'], 1)
+        self.nodes[0].getmininginfo()
+        queues_after = dict((q['name'], q) for q in self.nodes[0].getrpcinfo()['queues'])
+        assert_equal(queues_after['mining']['processed'], queues['mining']['processed'] + 1)
+        assert_greater_than(queues_after['default']['processed'], queues['default']['processed'])
+
+        # Requests on a kept-alive connection are counted as reused
+        headers = {"Authorization": "Basic " + str_to_b64str(authpair)}
+        connections = self.nodes[2].getrpcinfo()['connections']
+        conn = http.client.HTTPConnection(urlNode2.hostname, urlNode2.port)
+        conn.connect()
+        for i in range(3):
+            conn.request('POST', '/', '{"method": "getblockcount"}', headers)
+            assert(b'"error":null' in conn.getresponse().read())
+        connections_after = self.nodes[2].getrpcinfo()['connections']
+        assert_greater_than(connections_after['accepted'], connections['accepted'])
+        assert_greater_than(connections_after['reused'], connections['reused'] + 1)
+        assert_greater_than(connections_after['open'], 0)
+        conn.close()
+
+        # Pipelined requests are answered in order on the same connection
+        request = 'POST / HTTP/1.1\r\nHost: %s\r\nAuthorization: %s\r\nContent-Length: %d\r\n\r\n%s'
+        body1 = '{"method": "getblockcount", "id": "first"}'
+        body2 = '{"method": "getbestblockhash", "id": "second"}'
+        sock = socket.create_connection((urlNode2.hostname, urlNode2.port))
+        sock.settimeout(30)
+        sock.sendall((request % (urlNode2.hostname, headers["Authorization"], len(body1), body1) +
+                      request % (urlNode2.hostname, headers["Authorization"], len(body2), body2)).encode())
+        out = b''
+        while out.count(b'"error":null') < 2:
+            data = sock.recv(4096)
+            assert(data)
+            out += data
+        sock.close()
+        assert(out.index(b'"id":"first"') < out.index(b'"id":"second"'))
+
 
 if __name__ == '__main__':
     HTTPBasicsTest ().main ()
@@ -0,0 +1,181 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The SmartCash developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Benchmark importing a fixed range of block files into a fresh datadir,
+# either with -loadblock or by copying them in and starting with -reindex.
+#
+# Without --blocksdir a chain of --generate blocks is mined first and its
+# block files are imported. The results are printed as JSON and written to
+# --output if given, e.g.
+#
+#   ibd-bench.py --chain=main --blocksdir=~/.smartcash/blocks --files=0-9 \
+#       --dbcache=1000 --par=4 --nodearg=-txindex --output=ibd.json
+#
+
+import glob
+import json
+import os
+import shutil
+import time
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.authproxy import JSONRPCException
+from test_framework.util import *
+
+CHAIN_ARGS = {
+    "main": ["-regtest=0"],
+    "test": ["-regtest=0", "-testnet"],
+    "regtest": [],
+}
+
+CHAIN_DIRS = {
+    "main": "",
+    "test": "testnet3",
+    "regtest": "regtest",
+}
+
+def get_peak_rss_kb(pid):
+    try:
+        with open("/proc/%d/status" % pid, encoding="utf8") as f:
+            for line in f:
+                if line.startswith("VmHWM:"):
+                    return int(line.split()[1])
+    except IOError:
+        pass
+    return None
+
+class IBDBench(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+
+    def add_options(self, parser):
+        parser.add_option("--mode", dest="mode", default="loadblock", choices=["loadblock", "reindex"],
+                          help="Import with -loadblock or with -reindex (default: %default)")
+        parser.add_option("--chain", dest="chain", default="regtest", choices=list(CHAIN_ARGS.keys()),
+                          help="Chain of the block files (default: %default)")
+        parser.add_option("--blocksdir", dest="blocksdir",
+                          help="Directory with the blk?????.dat files to import")
+        parser.add_option("--files", dest="files",
+                          help="Range of block file numbers to import, e.g. 0-9 (default: all)")
+        parser.add_option("--generate", dest="generate", default=2000, type="int",
+                          help="Blocks to mine when no --blocksdir is given (default: %default)")
+        parser.add_option("--dbcache", dest="dbcache", type="int",
+                          help="-dbcache of the importing node")
+        parser.add_option("--par", dest="par", type="int",
+                          help="-par of the importing node")
+        parser.add_option("--nodearg", dest="nodeargs", default=[], action="append",
+                          help="Extra argument of the importing node, e.g. -txindex, can be repeated")
+        parser.add_option("--interval", dest="interval", default=1000, type="int",
+                          help="Blocks per throughput sample (default: %default)")
+        parser.add_option("--idle", dest="idle", default=30, type="int",
+                          help="Seconds without a new block after which the import is done (default: %default)")
+        parser.add_option("--output", dest="output",
+                          help="File to write the JSON results to")
+
+    def setup_network(self, split=False):
+        self.nodes = []
+
+    def get_block_files(self):
+        if self.options.blocksdir:
+            blocksdir = os.path.expanduser(self.options.blocksdir)
+        else:
+            assert_equal(self.options.chain, "regtest")
+            print("Mining %d blocks..." % self.options.generate)
+            node = start_node(1, self.options.tmpdir)
+            for i in range(0, self.options.generate, 100):
+                node.generate(min(100, self.options.generate - i))
+            stop_node(node, 1)
+            blocksdir = os.path.join(self.options.tmpdir, "node1", "regtest", "blocks")
+
+        files = sorted(glob.glob(os.path.join(blocksdir, "blk[0-9][0-9][0-9][0-9][0-9].dat")))
+        if self.options.files:
+            first, last = [int(n) for n in self.options.files.split("-")]
+            files = [f for f in files if first <= int(os.path.basename(f)[3:8]) <= last]
+        assert(len(files) > 0)
+        return files
+
+    def run_test(self):
+        files = self.get_block_files()
+
+        args = CHAIN_ARGS[self.options.chain] + self.options.nodeargs
+        if self.options.dbcache is not None:
+            args.append("-dbcache=%d" % self.options.dbcache)
+        if self.options.par is not None:
+            args.append("-par=%d" % self.options.par)
+
+        if self.options.mode == "reindex":
+            blocksdir = os.path.join(self.options.tmpdir, "node0", CHAIN_DIRS[self.options.chain], "blocks")
+            os.makedirs(blocksdir)
+            for f in files:
+                shutil.copy(f, blocksdir)
+            args.append("-reindex")
+        else:
+            args += ["-loadblock=" + f for f in files]
+
+        print("Importing %d block files..." % len(files))
+        start = time.time()
+        node = start_node(0, self.options.tmpdir, args, timewait=900)
+        self.nodes.append(node)
+
+        # Time of each block count reached, sampled every interval blocks
+        samples = [(0, start)]
+        height = 0
+        last_change = time.time()
+        while time.time() - last_change < self.options.idle:
+            time.sleep(0.25)
+            count = node.getblockcount()
+            if count != height:
+                height = count
+                last_change = time.time()
+                if height - samples[-1][0] >= self.options.interval:
+                    samples.append((height, last_change))
+        end = last_change
+        if samples[-1][0] != height:
+            samples.append((height, end))
+
+        # The rewards database follows the chain and may still be behind
+        while True:
+            try:
+                node.smartrewards("current")
+                break
+            except JSONRPCException as e:
+                if e.error["code"] != -20:
+                    raise
+                time.sleep(0.25)
+        rewards_end = time.time()
+
+        intervals = []
+        for (h0, t0), (h1, t1) in zip(samples, samples[1:]):
+            intervals.append({
+                "height": h1,
+                "seconds": round(t1 - t0, 3),
+                "blocks_per_second": round((h1 - h0) / max(t1 - t0, 0.001), 2),
+            })
+
+        results = {
+            "mode": self.options.mode,
+            "chain": self.options.chain,
+            "files": [os.path.basename(f) for f in files],
+            "args": [a for a in args if not a.startswith("-loadblock=")],
+            "blocks": height,
+            "seconds": round(end - start, 3),
+            "blocks_per_second": round(height / max(end - start, 0.001), 2),
+            "intervals": intervals,
+            "peak_rss_kb": get_peak_rss_kb(bitcoind_processes[0].pid),
+            "smartrewards_catchup_seconds": round(rewards_end - end, 3),
+        }
+
+        report = json.dumps(results, indent=2)
+        print(report)
+        if self.options.output:
+            with open(self.options.output, "w", encoding="utf8") as f:
+                f.write(report + "\n")
+
+if __name__ == '__main__':
+    IBDBench().main()
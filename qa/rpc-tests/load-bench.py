@@ -0,0 +1,273 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The SmartCash developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Push a configurable transaction load through two regtest nodes and report
+# the latency and throughput seen by the client next to the node's own
+# instrumentation (getmempoolstats, getrpcstats, getblocksizeinfo,
+# getmemoryinfo and the SmartRewards round).
+#
+# Node 0 mines and sends raw transactions (createrawtransaction,
+# signrawtransaction, sendrawtransaction), node 1 sends wallet transactions
+# (sendtoaddress, instantsendtoaddress) and fans payouts out to a pool of
+# addresses with sendmany, so the rewards database grows with it, e.g.
+#
+#   load-bench.py --duration=300 --rate=50 --pattern=burst --addresses=100000 \
+#       --fanout=500 --blockinterval=10 --nodearg=-maxmempool=50 --output=load.json
+#
+
+import json
+import random
+import time
+
+from collections import deque
+from decimal import Decimal
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.authproxy import JSONRPCException
+from test_framework.util import *
+
+# Blocks before a coinbase can be spent, see consensus.h
+COINBASE_MATURITY = 100
+# Unconfirmed ancestors a raw transaction output may have before it waits for a block
+MAX_CHAIN_DEPTH = 20
+
+def get_peak_rss_kb(pid):
+    try:
+        with open("/proc/%d/status" % pid, encoding="utf8") as f:
+            for line in f:
+                if line.startswith("VmHWM:"):
+                    return int(line.split()[1])
+    except IOError:
+        pass
+    return None
+
+def summarize(latencies, errors):
+    """Count, errors and percentiles of latencies in milliseconds"""
+    result = {"count": len(latencies), "errors": errors}
+    if latencies:
+        ordered = sorted(latencies)
+        percentile = lambda p: ordered[min(int(len(ordered) * p), len(ordered) - 1)]
+        result.update({
+            "avg_ms": round(sum(ordered) / len(ordered), 3),
+            "p50_ms": round(percentile(0.5), 3),
+            "p90_ms": round(percentile(0.9), 3),
+            "p99_ms": round(percentile(0.99), 3),
+            "max_ms": round(ordered[-1], 3),
+        })
+    return result
+
+class LoadBench(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+
+    def add_options(self, parser):
+        parser.add_option("--duration", dest="duration", default=60, type="int",
+                          help="Seconds of load (default: %default)")
+        parser.add_option("--rate", dest="rate", default=20, type="float",
+                          help="Average transactions per second (default: %default)")
+        parser.add_option("--pattern", dest="pattern", default="constant", choices=["constant", "ramp", "burst"],
+                          help="constant, ramp from 0 to twice --rate, or burst at four times --rate for the first quarter of every --period (default: %default)")
+        parser.add_option("--period", dest="period", default=20, type="int",
+                          help="Seconds of a burst period (default: %default)")
+        parser.add_option("--rawshare", dest="rawshare", default=0.5, type="float",
+                          help="Share of the transactions sent raw from node 0, the rest come from the wallet of node 1 (default: %default)")
+        parser.add_option("--ixshare", dest="ixshare", default=0.1, type="float",
+                          help="Share of the wallet transactions sent with instantsendtoaddress (default: %default)")
+        parser.add_option("--fanout", dest="fanout", default=100, type="int",
+                          help="Outputs of a sendmany payout (default: %default)")
+        parser.add_option("--payoutinterval", dest="payoutinterval", default=10, type="int",
+                          help="Seconds between sendmany payouts, 0 for none (default: %default)")
+        parser.add_option("--addresses", dest="addresses", default=1000, type="int",
+                          help="Addresses the payouts go to in turn (default: %default)")
+        parser.add_option("--utxos", dest="utxos", default=400, type="int",
+                          help="Confirmed outputs each node starts with (default: %default)")
+        parser.add_option("--fee", dest="fee", default="0.001",
+                          help="Fee of the raw transactions (default: %default)")
+        parser.add_option("--blockinterval", dest="blockinterval", default=5, type="int",
+                          help="Seconds between the blocks node 0 mines (default: %default)")
+        parser.add_option("--interval", dest="interval", default=10, type="int",
+                          help="Seconds per throughput sample (default: %default)")
+        parser.add_option("--nodearg", dest="nodeargs", default=[], action="append",
+                          help="Extra argument of both nodes, e.g. -maxmempool=50, can be repeated")
+        parser.add_option("--output", dest="output",
+                          help="File to write the JSON results to")
+
+    def setup_network(self, split=False):
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir, [self.options.nodeargs] * self.num_nodes, timewait=900)
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.is_network_split = False
+
+    def rate_at(self, elapsed):
+        rate = self.options.rate
+        if self.options.pattern == "ramp":
+            return 2 * rate * elapsed / self.options.duration
+        if self.options.pattern == "burst":
+            return 4 * rate if elapsed % self.options.period < self.options.period / 4 else 0
+        return rate
+
+    def fund(self):
+        """Give both nodes --utxos confirmed outputs"""
+        print("Mining and splitting the funds...")
+        self.nodes[0].generate(COINBASE_MATURITY + 10)
+        balance = self.nodes[0].getbalance()
+        amount = satoshi_round(balance / 3 / self.options.utxos)
+        for node in self.nodes:
+            addresses = [node.getnewaddress() for i in range(self.options.utxos)]
+            for i in range(0, len(addresses), 100):
+                self.nodes[0].sendmany("", {a: amount for a in addresses[i:i + 100]})
+        while self.nodes[0].getmempoolinfo()["size"] > 0:
+            self.nodes[0].generate(1)
+        sync_blocks(self.nodes)
+
+    def refresh_pool(self):
+        self.pool = deque((u["txid"], u["vout"], u["amount"], 0) for u in self.nodes[0].listunspent(1) if u["spendable"])
+
+    def timed(self, kind, func, *args):
+        start = time.time()
+        try:
+            result = func(*args)
+            self.latencies[kind].append((time.time() - start) * 1000)
+            return result
+        except (JSONRPCException, IOError) as e:
+            self.errors[kind] += 1
+            message = e.error["message"] if isinstance(e, JSONRPCException) else str(e)
+            self.error_messages[kind][message] = self.error_messages[kind].get(message, 0) + 1
+            return None
+
+    def send_raw(self):
+        """Split an output of node 0 in two, both go back into the pool"""
+        while self.pool:
+            txid, vout, amount, depth = self.pool.popleft()
+            if depth < MAX_CHAIN_DEPTH and amount > 3 * self.fee:
+                break
+        else:
+            self.errors["raw"] += 1
+            self.error_messages["raw"]["no spendable outputs left"] = self.error_messages["raw"].get("no spendable outputs left", 0) + 1
+            return False
+        half = satoshi_round((amount - self.fee) / 2)
+        outputs = {self.raw_addresses[0]: half, self.raw_addresses[1]: amount - self.fee - half}
+        raw = self.timed("createrawtransaction", self.nodes[0].createrawtransaction, [{"txid": txid, "vout": vout}], outputs)
+        signed = raw and self.timed("signrawtransaction", self.nodes[0].signrawtransaction, raw)
+        sent = signed and self.timed("raw", self.nodes[0].sendrawtransaction, signed["hex"])
+        if not sent:
+            return False
+        decoded = self.nodes[0].decoderawtransaction(signed["hex"])
+        for out in decoded["vout"]:
+            self.pool.append((sent, out["n"], out["value"], depth + 1))
+        return True
+
+    def send_wallet(self):
+        kind = "instantsend" if random.random() < self.options.ixshare else "wallet"
+        func = self.nodes[1].instantsendtoaddress if kind == "instantsend" else self.nodes[1].sendtoaddress
+        return self.timed(kind, func, self.nodes[0].getnewaddress(), Decimal("0.01")) is not None
+
+    def send_payout(self):
+        outputs = {}
+        for i in range(self.options.fanout):
+            outputs[self.payout_addresses[self.next_payout % len(self.payout_addresses)]] = Decimal("0.001")
+            self.next_payout += 1
+        return self.timed("payout", self.nodes[1].sendmany, "", outputs) is not None
+
+    def run_test(self):
+        self.fee = Decimal(self.options.fee)
+        self.fund()
+
+        print("Creating %d payout addresses..." % self.options.addresses)
+        self.payout_addresses = [self.nodes[0].getnewaddress() for i in range(self.options.addresses)]
+        self.raw_addresses = [self.nodes[0].getnewaddress() for i in range(2)]
+        self.next_payout = 0
+        self.refresh_pool()
+
+        kinds = ["raw", "createrawtransaction", "signrawtransaction", "wallet", "instantsend", "payout", "block"]
+        self.latencies = {kind: [] for kind in kinds}
+        self.errors = {kind: 0 for kind in kinds}
+        self.error_messages = {kind: {} for kind in kinds}
+
+        print("Sending load for %d seconds..." % self.options.duration)
+        start = time.time()
+        due = 0.0
+        sent = 0
+        next_block = start + self.options.blockinterval
+        next_payout = start + self.options.payoutinterval
+        samples = []
+        sample = {"second": 0, "sent": 0, "errors": 0, "target": 0.0}
+        last_tick = start
+        while True:
+            now = time.time()
+            elapsed = now - start
+            if elapsed >= self.options.duration:
+                break
+
+            # Transactions due by now at the rate of the pattern
+            due += self.rate_at(elapsed) * (now - last_tick)
+            sample["target"] += self.rate_at(elapsed) * (now - last_tick)
+            last_tick = now
+
+            if now >= next_block:
+                if self.timed("block", self.nodes[0].generate, 1) is not None:
+                    self.refresh_pool()
+                next_block += self.options.blockinterval
+            elif self.options.payoutinterval and now >= next_payout:
+                sample["sent" if self.send_payout() else "errors"] += 1
+                next_payout += self.options.payoutinterval
+            elif due >= 1:
+                due -= 1
+                ok = self.send_raw() if random.random() < self.options.rawshare else self.send_wallet()
+                sample["sent" if ok else "errors"] += 1
+                sent += ok
+            else:
+                time.sleep(min(0.01, (1 - due) / max(self.rate_at(elapsed), 0.001)))
+
+            if time.time() - start >= (len(samples) + 1) * self.options.interval:
+                sample["second"] = (len(samples) + 1) * self.options.interval
+                sample["target"] = round(sample["target"], 1)
+                sample["mempool"] = self.nodes[0].getmempoolinfo()["size"]
+                samples.append(sample)
+                sample = {"second": 0, "sent": 0, "errors": 0, "target": 0.0}
+        end = time.time()
+
+        # Whatever is left confirms before the node's statistics are taken
+        sync_mempools(self.nodes, timeout=300)
+        self.nodes[0].generate(1)
+        sync_blocks(self.nodes)
+
+        try:
+            rewards = self.nodes[0].smartrewards("current")
+        except JSONRPCException as e:
+            rewards = {"error": e.error["message"]}
+
+        results = {
+            "pattern": self.options.pattern,
+            "duration": self.options.duration,
+            "target_rate": self.options.rate,
+            "args": self.options.nodeargs,
+            "sent": sent,
+            "seconds": round(end - start, 3),
+            "transactions_per_second": round(sent / max(end - start, 0.001), 2),
+            "calls": {kind: summarize(self.latencies[kind], self.errors[kind]) for kind in kinds},
+            "errors": {kind: messages for kind, messages in self.error_messages.items() if messages},
+            "intervals": samples,
+            "node": {
+                "mempoolstats": self.nodes[0].getmempoolstats(),
+                "rpcstats": [node.getrpcstats() for node in self.nodes],
+                "blocksizeinfo": self.nodes[0].getblocksizeinfo(),
+                "memoryinfo": self.nodes[0].getmemoryinfo(),
+                "smartrewards": rewards,
+            },
+            "peak_rss_kb": [get_peak_rss_kb(p.pid) for p in bitcoind_processes.values()],
+        }
+
+        report = json.dumps(results, indent=2, default=str)
+        print(report)
+        if self.options.output:
+            with open(self.options.output, "w", encoding="utf8") as f:
+                f.write(report + "\n")
+
+if __name__ == '__main__':
+    LoadBench().main()
@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The SmartCash developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test the /metrics endpoint enabled by -metrics.
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+import http.client
+import urllib.parse
+
+def get_metrics(node):
+    url = urllib.parse.urlparse(node.url)
+    conn = http.client.HTTPConnection(url.hostname, url.port)
+    conn.request('GET', '/metrics')
+    response = conn.getresponse()
+    body = response.read().decode('utf-8')
+    conn.close()
+    if response.status != 200:
+        return response.status, {}
+    metrics = {}
+    for line in body.splitlines():
+        if line and not line.startswith('#'):
+            name, value = line.rsplit(' ', 1)
+            metrics[name] = float(value)
+    return response.status, metrics
+
+class MetricsTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 2
+
+    def setup_network(self, split=False):
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir, [["-metrics"], []])
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.is_network_split = False
+        self.sync_all()
+
+    def run_test(self):
+        print("Mining blocks...")
+        self.nodes[1].generate(101)
+        self.sync_all()
+
+        status, metrics = get_metrics(self.nodes[0])
+        assert_equal(status, 200)
+        assert_equal(metrics['smartcash_tip_height'], 101)
+        assert_equal(metrics['smartcash_peers'], 1)
+        assert_equal(metrics['smartcash_connect_block_seconds_count'], 101)
+        assert_equal(metrics['smartcash_connect_block_seconds_bucket{le="+Inf"}'], 101)
+        assert(metrics['smartcash_received_bytes_total{command="block"}'] > 0)
+        assert(metrics['smartcash_sent_bytes_total{command="version"}'] > 0)
+
+        # The mempool gauges follow transactions in and out
+        self.nodes[1].sendtoaddress(self.nodes[0].getnewaddress(), 1)
+        self.sync_all()
+        status, metrics = get_metrics(self.nodes[0])
+        assert_equal(metrics['smartcash_mempool_transactions'], 1)
+        assert(metrics['smartcash_mempool_bytes'] > 0)
+
+        self.nodes[1].generate(1)
+        self.sync_all()
+        status, metrics = get_metrics(self.nodes[0])
+        assert_equal(metrics['smartcash_mempool_transactions'], 0)
+        assert_equal(metrics['smartcash_tip_height'], 102)
+
+        # Only served when enabled
+        status, metrics = get_metrics(self.nodes[1])
+        assert_equal(status, 404)
+
+if __name__ == '__main__':
+    MetricsTest().main()
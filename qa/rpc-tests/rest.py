@@ -274,6 +274,49 @@ class RESTTest (BitcoinTestFramework):
         json_obj = json.loads(response_header_json_str)
         assert_equal(len(json_obj), 5) #now we should have 5 header objects
 
+        # /rest/blocks/ and /rest/blockheaders/ stream height ranges, cut off at the tip
+        bb_height = self.nodes[0].getblockcount()
+        response = http_get_call(url.hostname, url.port, '/rest/blockheaders/'+str(bb_height-4)+'/10'+self.FORMAT_SEPARATOR+"bin", True)
+        assert_equal(response.status, 200)
+        assert_equal(response.getheader('transfer-encoding'), 'chunked')
+        response_headers_str = response.read()
+        assert_equal(len(response_headers_str), 5*80)
+        for i in range(5):
+            header_hash = self.nodes[0].getblockhash(bb_height-4+i)
+            assert_equal(response_headers_str[i*80:i*80+80], http_get_call(url.hostname, url.port, '/rest/headers/1/'+header_hash+self.FORMAT_SEPARATOR+"bin", True).read())
+            assert_equal(http_get_call(url.hostname, url.port, '/rest/blocks/'+str(bb_height-4+i)+'/1'+self.FORMAT_SEPARATOR+"bin", True).read(),
+                         http_get_call(url.hostname, url.port, '/rest/block/'+header_hash+self.FORMAT_SEPARATOR+"bin", True).read())
+
+        json_obj = json.loads(http_get_call(url.hostname, url.port, '/rest/blocks/0/'+str(bb_height+100)+self.FORMAT_SEPARATOR+"json"))
+        assert_equal(len(json_obj), bb_height+1)
+        assert_equal(json_obj[-1]['hash'], self.nodes[0].getbestblockhash())
+        hex_lines = http_get_call(url.hostname, url.port, '/rest/blocks/1/3'+self.FORMAT_SEPARATOR+"hex").splitlines()
+        assert_equal(len(hex_lines), 3)
+        assert_equal(hex_lines[2], self.nodes[0].getblock(self.nodes[0].getblockhash(3), False))
+
+        response = http_get_call(url.hostname, url.port, '/rest/blocks/'+str(bb_height+1)+'/1'+self.FORMAT_SEPARATOR+"bin", True)
+        assert_equal(response.status, 404)
+        response = http_get_call(url.hostname, url.port, '/rest/blocks/1/0'+self.FORMAT_SEPARATOR+"bin", True)
+        assert_equal(response.status, 400)
+
+        # /rest/smartnodes/ is served from a per block snapshot tagged with an ETag
+        response = http_get_call(url.hostname, url.port, '/rest/smartnodes'+self.FORMAT_SEPARATOR+"json", True)
+        assert_equal(response.status, 200)
+        etag = response.getheader('etag')
+        json_obj = json.loads(response.read().decode('utf-8'))
+        assert_equal(json_obj['blockhash'], self.nodes[0].getbestblockhash())
+        assert_equal(json_obj['count'], len(json_obj['smartnodes']))
+        conn = http.client.HTTPConnection(url.hostname, url.port)
+        conn.request('GET', '/rest/smartnodes'+self.FORMAT_SEPARATOR+"bin", headers={'If-None-Match': etag})
+        assert_equal(conn.getresponse().status, 304)
+        self.nodes[0].generate(1)
+        self.sync_all()
+        conn.request('GET', '/rest/smartnodes'+self.FORMAT_SEPARATOR+"bin", headers={'If-None-Match': etag})
+        response = conn.getresponse()
+        assert_equal(response.status, 200)
+        assert(response.getheader('etag') != etag)
+        response.read()
+
         # do tx test
         tx_hash = block_json_obj['tx'][0]['txid']
         json_string = http_get_call(url.hostname, url.port, '/rest/tx/'+tx_hash+self.FORMAT_SEPARATOR+"json")
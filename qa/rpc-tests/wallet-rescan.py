@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+# Copyright (c) 2018 The SmartCash developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test rescans after importing keys and scripts. The payments are spread over
+# more blocks than a rescan reads at a time.
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import *
+
+class WalletRescanTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.setup_clean_chain = True
+        self.num_nodes = 3
+
+    def setup_network(self, split=False):
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir)
+        connect_nodes_bi(self.nodes, 0, 1)
+        connect_nodes_bi(self.nodes, 0, 2)
+        self.is_network_split = False
+        self.sync_all()
+
+    def run_test(self):
+        print("Mining blocks...")
+        self.nodes[0].generate(101)
+        self.sync_all()
+
+        # A key paid twice and a 1-of-1 multisig, spread over 250 blocks
+        address1 = self.nodes[1].getnewaddress()
+        address2 = self.nodes[1].getnewaddress()
+        pubkey2 = self.nodes[1].validateaddress(address2)['pubkey']
+        multisig = self.nodes[1].createmultisig(1, [pubkey2])
+
+        self.nodes[0].sendtoaddress(address1, 3)
+        self.nodes[0].generate(120)
+        self.nodes[0].sendtoaddress(multisig['address'], 5)
+        self.nodes[0].generate(120)
+        self.nodes[0].sendtoaddress(address1, 2)
+        self.nodes[0].generate(10)
+        self.sync_all()
+
+        print("Importing into a fresh wallet...")
+        self.nodes[2].importprivkey(self.nodes[1].dumpprivkey(address1))
+        assert_equal(self.nodes[2].getbalance(), 5)
+        assert_equal(len(self.nodes[2].listunspent()), 2)
+
+        self.nodes[2].importaddress(multisig['redeemScript'], "", True, True)
+        assert_equal(self.nodes[2].getbalance("*", 1, True), 10)
+
+        # Spending the imported coins and rescanning again keeps them spent
+        self.nodes[2].sendtoaddress(self.nodes[0].getnewaddress(), 4, "", "", True)
+        self.nodes[2].generate(1)
+        self.sync_all()
+        self.nodes[2].importprivkey(self.nodes[1].dumpprivkey(address2), "", True)
+        assert_equal(self.nodes[2].getbalance(), 6)
+
+if __name__ == '__main__':
+    WalletRescanTest().main()
@@ -263,7 +263,14 @@ void CAddrMan::Good_(const CService& addr, int64_t nTime)
     MakeTried(info, nId);
 }
 
-bool CAddrMan::Add_(const CAddress& addr, const CNetAddr& source, int64_t nTimePenalty)
+std::pair<int, int> CAddrMan::NewPosition(const uint256& nKeyIn, const CAddress& addr, const CNetAddr& source)
+{
+    CAddrInfo info(addr, source);
+    int nUBucket = info.GetNewBucket(nKeyIn, source);
+    return std::make_pair(nUBucket, info.GetBucketPosition(nKeyIn, true, nUBucket));
+}
+
+bool CAddrMan::Add_(const CAddress& addr, const CNetAddr& source, int64_t nTimePenalty, const std::pair<int, int>* pPos)
 {
     if (!addr.IsRoutable())
         return false;
@@ -307,8 +314,10 @@ bool CAddrMan::Add_(const CAddress& addr, const CNetAddr& source, int64_t nTimeP
         fNew = true;
     }
 
-    int nUBucket = pinfo->GetNewBucket(nKey, source);
-    int nUBucketPos = pinfo->GetBucketPosition(nKey, true, nUBucket);
+    // Entries are found by IP alone, an earlier one with another port is placed by that port
+    std::pair<int, int> pos = (pPos && (CService)*pinfo == (CService)addr) ? *pPos : NewPosition(nKey, *pinfo, source);
+    int nUBucket = pos.first;
+    int nUBucketPos = pos.second;
     if (vvNew[nUBucket][nUBucketPos] != nId) {
         bool fInsert = vvNew[nUBucket][nUBucketPos] == -1;
         if (!fInsert) {
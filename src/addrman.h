@@ -207,6 +207,10 @@ private:
     //! last time Good was called (memory only)
     int64_t nLastGood;
 
+    //! whether addresses were added or updated since the tables were last written out (memory only),
+    //! refreshed timestamps of known addresses alone don't count
+    bool fDirty;
+
 protected:
     //! secret key to randomize bucket select with
     uint256 nKey;
@@ -233,8 +237,12 @@ protected:
     //! Mark an entry "good", possibly moving it from "new" to "tried".
     void Good_(const CService &addr, int64_t nTime);
 
-    //! Add an entry to the "new" table.
-    bool Add_(const CAddress &addr, const CNetAddr& source, int64_t nTimePenalty);
+    //! Add an entry to the "new" table. pPos is its position there if computed already, see NewPosition.
+    bool Add_(const CAddress &addr, const CNetAddr& source, int64_t nTimePenalty, const std::pair<int, int>* pPos = NULL);
+
+    //! Bucket and position in the "new" table of an address from source. Only reads nKey, so callers
+    //! may hash without holding cs and check nKey is unchanged afterwards.
+    static std::pair<int, int> NewPosition(const uint256& nKeyIn, const CAddress& addr, const CNetAddr& source);
 
     //! Mark an entry as attempted to connect.
     void Attempt_(const CService &addr, int64_t nTime);
@@ -469,6 +477,7 @@ public:
         nTried = 0;
         nNew = 0;
         nLastGood = 1; //Initially at 1 so that "never" is strictly worse.
+        fDirty = false;
     }
 
     CAddrMan()
@@ -508,6 +517,8 @@ public:
             LOCK(cs);
             Check();
             fRet |= Add_(addr, source, nTimePenalty);
+            if (fRet)
+                fDirty = true;
             Check();
         }
         if (fRet)
@@ -515,15 +526,31 @@ public:
         return fRet;
     }
 
-    //! Add multiple addresses.
+    //! Add multiple addresses. Hashing them into the "new" table, the bulk of the work for large addr
+    //! messages, is done before taking cs so that Select isn't held up by it.
     bool Add(const std::vector<CAddress> &vAddr, const CNetAddr& source, int64_t nTimePenalty = 0)
     {
+        uint256 nKeyUsed;
+        {
+            LOCK(cs);
+            nKeyUsed = nKey;
+        }
+        std::vector<std::pair<int, int> > vPos(vAddr.size());
+        for (size_t i = 0; i < vAddr.size(); i++) {
+            if (vAddr[i].IsRoutable())
+                vPos[i] = NewPosition(nKeyUsed, vAddr[i], source);
+        }
+
         int nAdd = 0;
         {
             LOCK(cs);
             Check();
-            for (std::vector<CAddress>::const_iterator it = vAddr.begin(); it != vAddr.end(); it++)
-                nAdd += Add_(*it, source, nTimePenalty) ? 1 : 0;
+            // The positions are of no use if the tables got cleared meanwhile
+            bool fPosValid = nKey == nKeyUsed;
+            for (size_t i = 0; i < vAddr.size(); i++)
+                nAdd += Add_(vAddr[i], source, nTimePenalty, fPosValid ? &vPos[i] : NULL) ? 1 : 0;
+            if (nAdd)
+                fDirty = true;
             Check();
         }
         if (nAdd)
@@ -538,6 +565,7 @@ public:
             LOCK(cs);
             Check();
             Good_(addr, nTime);
+            fDirty = true;
             Check();
         }
     }
@@ -549,6 +577,7 @@ public:
             LOCK(cs);
             Check();
             Attempt_(addr, nTime);
+            fDirty = true;
             Check();
         }
     }
@@ -568,6 +597,24 @@ public:
         return addrRet;
     }
 
+    /**
+     * Choose nCount addresses to connect to, under one lock rather than one per address. Once there's
+     * nothing to select from, the rest are invalid.
+     */
+    std::vector<CAddrInfo> SelectMany(size_t nCount, bool newOnly = false)
+    {
+        std::vector<CAddrInfo> vAddrRet;
+        vAddrRet.reserve(nCount);
+        {
+            LOCK(cs);
+            Check();
+            for (size_t i = 0; i < nCount; i++)
+                vAddrRet.push_back(Select_(newOnly));
+            Check();
+        }
+        return vAddrRet;
+    }
+
     //! Return a bunch of addresses, selected at random.
     std::vector<CAddress> GetAddr()
     {
@@ -588,6 +635,7 @@ public:
             LOCK(cs);
             Check();
             Connected_(addr, nTime);
+            fDirty = true;
             Check();
         }
     }
@@ -597,9 +645,23 @@ public:
         LOCK(cs);
         Check();
         SetServices_(addr, nServices);
+        fDirty = true;
         Check();
     }
 
+    //! Whether anything changed since the last SetDirty(false), to skip rewriting unchanged tables
+    bool IsDirty() const
+    {
+        LOCK(cs);
+        return fDirty;
+    }
+
+    void SetDirty(bool fDirtyIn)
+    {
+        LOCK(cs);
+        fDirty = fDirtyIn;
+    }
+
 };
 
 #endif // BITCOIN_ADDRMAN_H
@@ -0,0 +1,136 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "autotune.h"
+
+#include "policy/policy.h"
+#include "smartrewards/rewards.h"
+#include "smartrewards/rewardsdb.h"
+#include "tinyformat.h"
+#include "txdb.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#include <boost/filesystem.hpp>
+
+//! Synced writes done by the storage probe
+static const int AUTOTUNE_PROBE_WRITES = 16;
+//! Size of each of them (bytes)
+static const size_t AUTOTUNE_PROBE_WRITE_SIZE = 4096;
+
+static int64_t GetPhysicalMemory()
+{
+#ifdef WIN32
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status))
+        return status.ullTotalPhys;
+    return 0;
+#elif defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+    long nPages = sysconf(_SC_PHYS_PAGES);
+    long nPageSize = sysconf(_SC_PAGESIZE);
+    if (nPages <= 0 || nPageSize <= 0)
+        return 0;
+    return int64_t(nPages) * nPageSize;
+#else
+    return 0;
+#endif
+}
+
+/** Average time of a small write followed by a sync, like the undo and block index writes of a block */
+static int64_t ProbeSyncLatency(const boost::filesystem::path& dir)
+{
+    boost::filesystem::path path = dir / "autotune.tmp";
+    FILE* file = fopen(path.string().c_str(), "wb");
+    if (!file)
+        return -1;
+
+    std::vector<char> vData(AUTOTUNE_PROBE_WRITE_SIZE, 0x5a);
+    bool fOk = true;
+    int64_t nStart = GetTimeMicros();
+    for (int i = 0; i < AUTOTUNE_PROBE_WRITES && fOk; i++) {
+        fOk = fwrite(vData.data(), 1, vData.size(), file) == vData.size();
+        FileCommit(file);
+    }
+    int64_t nTime = GetTimeMicros() - nStart;
+
+    fclose(file);
+    boost::system::error_code ec;
+    boost::filesystem::remove(path, ec);
+
+    return fOk ? nTime / AUTOTUNE_PROBE_WRITES : -1;
+}
+
+CHardwareInfo ProbeHardware(const boost::filesystem::path& dir)
+{
+    CHardwareInfo hw;
+    hw.nMemory = GetPhysicalMemory();
+    hw.nCores = std::max(GetNumCores(), 1);
+    hw.nSyncLatency = ProbeSyncLatency(dir);
+    return hw;
+}
+
+CAutotuneProfile GetAutotuneProfile(const CHardwareInfo& hw)
+{
+    CAutotuneProfile profile;
+    profile.nScriptCheckThreads = std::min(hw.nCores, MAX_SCRIPTCHECK_THREADS);
+    profile.nCoinCachePercentAfterIBD = 100;
+    profile.nRewardsEntryCacheAfterIBD = nRewardsEntryCacheSize;
+
+    if (hw.nMemory <= 0) {
+        // Nothing to go by, keep the defaults
+        profile.strName = "default";
+        profile.nDbCache = nDefaultDbCache;
+        profile.nRewardsDbCache = nRewardsDefaultDbCache;
+        profile.nMaxMempool = DEFAULT_MAX_MEMPOOL_SIZE;
+        profile.strDBProfile = profile.strDBProfileAfterIBD = DEFAULT_DB_PROFILE;
+        return profile;
+    }
+
+    int64_t nMemory = hw.nMemory >> 20;
+
+    if (hw.nMemory < AUTOTUNE_LOW_MEMORY) {
+        // Every thread and table costs memory here, leave most of it to the system
+        profile.strName = "lowmem";
+        profile.nScriptCheckThreads = std::min(profile.nScriptCheckThreads, 2);
+        profile.nDbCache = std::max(nMinDbCache, nMemory / 8);
+        profile.nRewardsDbCache = std::max<int64_t>(8, nMemory / 32);
+        profile.nMaxMempool = std::max<int64_t>(50, nMemory / 32);
+        profile.strDBProfile = profile.strDBProfileAfterIBD = "lowmem";
+        return profile;
+    }
+
+    // Coins missing from the cache cost a seek each on rotating disks, give them more memory
+    bool fSlowStorage = hw.nSyncLatency > AUTOTUNE_SLOW_STORAGE_LATENCY;
+    int64_t nBudget = fSlowStorage ? nMemory / 3 : nMemory / 4;
+
+    profile.strName = fSlowStorage ? "hdd" : "ssd";
+    profile.nRewardsDbCache = std::max(nRewardsDefaultDbCache, std::min(nBudget / 8, nRewardsMaxDbCache));
+    profile.nDbCache = std::max(nMinDbCache, std::min(nBudget - profile.nRewardsDbCache, nMaxDbCache));
+    profile.strDBProfile = "ibd";
+    profile.strDBProfileAfterIBD = DEFAULT_DB_PROFILE;
+
+    // No transactions are requested during the initial block download. Once
+    // it is done half of the in-memory coins cache, at most about a quarter
+    // of -dbcache, goes to the mempool and the reward entries instead.
+    profile.nCoinCachePercentAfterIBD = 50;
+    profile.nMaxMempool = std::max<int64_t>(DEFAULT_MAX_MEMPOOL_SIZE, profile.nDbCache / 8);
+    profile.nRewardsEntryCacheAfterIBD = std::max<size_t>(nRewardsEntryCacheSize, nRewardsEntryCacheSize * (profile.nDbCache / 8) / nRewardsDefaultDbCache);
+
+    return profile;
+}
+
+std::string CAutotuneProfile::ToString() const
+{
+    return strprintf("%s profile: -dbcache=%d -rewardsdbcache=%d -maxmempool=%d -par=%d -dbprofile=%s, after the initial block download %d%% of the coins cache, %u reward entries and -dbprofile=%s",
+        strName, nDbCache, nRewardsDbCache, nMaxMempool, nScriptCheckThreads, strDBProfile, nCoinCachePercentAfterIBD, nRewardsEntryCacheAfterIBD, strDBProfileAfterIBD);
+}
@@ -0,0 +1,56 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SMARTCASH_AUTOTUNE_H
+#define SMARTCASH_AUTOTUNE_H
+
+#include <stdint.h>
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+
+//! -autotune default
+static const bool DEFAULT_AUTOTUNE = false;
+//! Average synced write latency above which the data directory counts as a rotating disk (microseconds)
+static const int64_t AUTOTUNE_SLOW_STORAGE_LATENCY = 2000;
+//! Physical memory below which the low memory profile gets used (bytes)
+static const int64_t AUTOTUNE_LOW_MEMORY = int64_t(2048) << 20;
+//! Seconds between the checks whether the initial block download is done
+static const int64_t AUTOTUNE_IBD_CHECK_INTERVAL = 60;
+
+/** What the startup probe of -autotune found out about the machine. */
+struct CHardwareInfo
+{
+    //! Physical memory in bytes, 0 if unknown
+    int64_t nMemory;
+    int nCores;
+    //! Average time of a small synced write to the data directory in microseconds, -1 if unknown
+    int64_t nSyncLatency;
+};
+
+/** Settings picked by -autotune, cache sizes in MiB. */
+struct CAutotuneProfile
+{
+    std::string strName;
+    int64_t nDbCache;
+    int64_t nRewardsDbCache;
+    int64_t nMaxMempool;
+    int nScriptCheckThreads;
+    //! Database profiles until and after the initial block download is done
+    std::string strDBProfile;
+    std::string strDBProfileAfterIBD;
+    //! Share of the in-memory coins cache kept once the initial block download is done (percent)
+    int nCoinCachePercentAfterIBD;
+    //! Reward entries cached once the initial block download is done
+    size_t nRewardsEntryCacheAfterIBD;
+
+    std::string ToString() const;
+};
+
+/** Measure the memory and cores of the machine and the latency of synced writes in dir. */
+CHardwareInfo ProbeHardware(const boost::filesystem::path& dir);
+/** Pick cache sizes and thread counts for hw. */
+CAutotuneProfile GetAutotuneProfile(const CHardwareInfo& hw);
+
+#endif // SMARTCASH_AUTOTUNE_H
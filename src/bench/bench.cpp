@@ -4,12 +4,53 @@
 
 #include "bench.h"
 
+#include <atomic>
+#include <cstdlib>
 #include <iostream>
 #include <iomanip>
+#include <new>
 #include <sys/time.h>
 
 using namespace benchmark;
 
+/** Heap allocations made through operator new by all threads */
+static std::atomic<uint64_t> nAllocations(0);
+
+void* operator new(size_t nSize)
+{
+    ++nAllocations;
+    void* p = malloc(nSize ? nSize : 1);
+    if (p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t nSize)
+{
+    return operator new(nSize);
+}
+
+void* operator new(size_t nSize, const std::nothrow_t&) noexcept
+{
+    ++nAllocations;
+    return malloc(nSize ? nSize : 1);
+}
+
+void* operator new[](size_t nSize, const std::nothrow_t& nt) noexcept
+{
+    return operator new(nSize, nt);
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { free(p); }
+
+uint64_t benchmark::GetAllocationCount()
+{
+    return nAllocations;
+}
+
 std::map<std::string, BenchFunction> BenchRunner::benchmarks;
 
 static double gettimedouble(void) {
@@ -26,7 +67,7 @@ BenchRunner::BenchRunner(std::string name, BenchFunction func)
 void
 BenchRunner::RunAll(double elapsedTimeForOne)
 {
-    std::cout << "#Benchmark" << "," << "count" << "," << "min" << "," << "max" << "," << "average" << "\n";
+    std::cout << "#Benchmark" << "," << "count" << "," << "min" << "," << "max" << "," << "average" << "," << "MB/s" << "," << "ops/s" << "," << "allocs/op" << "\n";
 
     for (std::map<std::string,BenchFunction>::iterator it = benchmarks.begin();
          it != benchmarks.end(); ++it) {
@@ -46,6 +87,7 @@ bool State::KeepRunning()
     double now;
     if (count == 0) {
         lastTime = beginTime = now = gettimedouble();
+        beginAllocations = GetAllocationCount();
     }
     else {
         now = gettimedouble();
@@ -80,7 +122,9 @@ bool State::KeepRunning()
 
     // Output results
     double average = (now-beginTime)/count;
-    std::cout << std::fixed << std::setprecision(15) << name << "," << count << "," << minTime << "," << maxTime << "," << average << "\n";
+    std::cout << std::fixed << std::setprecision(15) << name << "," << count << "," << minTime << "," << maxTime << "," << average << ",";
+    std::cout << std::setprecision(2) << bytesPerIteration / average / 1000000 << "," << itemsPerIteration / average << ",";
+    std::cout << (double)(GetAllocationCount() - beginAllocations) / count << "\n";
 
     return false;
 }
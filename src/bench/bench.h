@@ -6,6 +6,7 @@
 #define BITCOIN_BENCH_BENCH_H
 
 #include <map>
+#include <stdint.h>
 #include <string>
 
 #include <boost/function.hpp>
@@ -24,6 +25,8 @@
 static void CODE_TO_TIME(benchmark::State& state)
 {
     ... do any setup needed...
+    state.SetBytesPerIteration(...); // optional, for the MB/s column
+    state.SetItemsPerIteration(...); // optional, ops/s counts iterations otherwise
     while (state.KeepRunning()) {
        ... do stuff you want to time...
     }
@@ -43,16 +46,23 @@ namespace benchmark {
         double lastTime, minTime, maxTime, countMaskInv;
         int64_t count;
         int64_t countMask;
+        uint64_t bytesPerIteration, itemsPerIteration;
+        uint64_t beginAllocations;
     public:
-        State(std::string _name, double _maxElapsed) : name(_name), maxElapsed(_maxElapsed), count(0) {
+        State(std::string _name, double _maxElapsed) : name(_name), maxElapsed(_maxElapsed), count(0), bytesPerIteration(0), itemsPerIteration(1), beginAllocations(0) {
             minTime = std::numeric_limits<double>::max();
             maxTime = std::numeric_limits<double>::min();
             countMask = 1;
             countMaskInv = 1./(countMask + 1);
         }
         bool KeepRunning();
+        void SetBytesPerIteration(uint64_t bytes) { bytesPerIteration = bytes; }
+        void SetItemsPerIteration(uint64_t items) { itemsPerIteration = items; }
     };
 
+    /** Number of heap allocations made so far, which the allocs/op column is computed from */
+    uint64_t GetAllocationCount();
+
     typedef boost::function<void(State&)> BenchFunction;
 
     class BenchRunner
@@ -4,18 +4,38 @@
 
 #include "bench.h"
 
+#include "chainparams.h"
+#include "crypto/aes.h"
+#include "crypto/keccak256.h"
+#include "crypto/sha256.h"
 #include "key.h"
+#include "random.h"
 #include "validation.h"
 #include "util.h"
+#include "utiltime.h"
+
+#include <boost/filesystem.hpp>
 
 int
 main(int argc, char** argv)
 {
+    SHA256AutoDetect();
+    Keccak256AutoDetect();
+    AESAutoDetect();
     ECC_Start();
+    ECCVerifyHandle globalVerifyHandle;
     SetupEnvironment();
     fPrintToDebugLog = false; // don't want to write to debug.log file
 
+    // The consensus and payment benchmarks run against main net rules, with
+    // their databases in a scratch data directory
+    SelectParams(CBaseChainParams::MAIN);
+    boost::filesystem::path pathTemp = boost::filesystem::temp_directory_path() / strprintf("bench_bitcoin_%lu_%i", (unsigned long)GetTime(), (int)(GetRand(100000)));
+    boost::filesystem::create_directories(pathTemp);
+    mapArgs["-datadir"] = pathTemp.string();
+
     benchmark::BenchRunner::RunAll();
 
+    boost::filesystem::remove_all(pathTemp);
     ECC_Stop();
 }
@@ -0,0 +1,58 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "blocksizecalculator.h"
+#include "chain.h"
+#include "random.h"
+
+#include <vector>
+
+// A chain of twice the median window with random block sizes, the sizes known to the index.
+static std::vector<CBlockIndex> CreateBlockSizeChain()
+{
+    std::vector<CBlockIndex> vChain(2 * NUM_BLOCKS_FOR_MEDIAN_BLOCK);
+    for (size_t i = 0; i < vChain.size(); i++) {
+        vChain[i].nHeight = i;
+        vChain[i].pprev = i ? &vChain[i - 1] : NULL;
+        vChain[i].nStatus = BLOCK_HAVE_SIZE;
+        vChain[i].nSize = 1000 + GetRand(OLD_MAX_BLOCK_SIZE);
+        vChain[i].BuildSkip();
+    }
+    return vChain;
+}
+
+// The limit of each next block, the window slides along by one block.
+static void BlockSizeComputeNext(benchmark::State& state)
+{
+    std::vector<CBlockIndex> vChain = CreateBlockSizeChain();
+    BlockSizeCalculator::Clear();
+
+    size_t nHeight = NUM_BLOCKS_FOR_MEDIAN_BLOCK;
+    while (state.KeepRunning()) {
+        vChain[nHeight].nMaxBlockSize = 0;
+        BlockSizeCalculator::ComputeBlockSize(&vChain[nHeight]);
+        if (++nHeight == vChain.size())
+            nHeight = NUM_BLOCKS_FOR_MEDIAN_BLOCK;
+    }
+    BlockSizeCalculator::Clear();
+}
+
+// The limit of a block the window doesn't cover yet, e.g. after a restart.
+static void BlockSizeComputeRebuild(benchmark::State& state)
+{
+    std::vector<CBlockIndex> vChain = CreateBlockSizeChain();
+    CBlockIndex* pindex = &vChain.back();
+
+    while (state.KeepRunning()) {
+        BlockSizeCalculator::Clear();
+        pindex->nMaxBlockSize = 0;
+        BlockSizeCalculator::ComputeBlockSize(pindex);
+    }
+    BlockSizeCalculator::Clear();
+}
+
+BENCHMARK(BlockSizeComputeNext);
+BENCHMARK(BlockSizeComputeRebuild);
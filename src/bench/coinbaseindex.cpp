@@ -0,0 +1,38 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "pubkey.h"
+#include "script/standard.h"
+#include "smartmining/coinbaseindex.h"
+
+#include <vector>
+
+// A SmartRewards payout block: 500 payouts plus the miner, hive and node outputs.
+static void CoinbaseIndexRewardBlock(benchmark::State& state)
+{
+    CMutableTransaction tx;
+    std::vector<CTxOut> vPayouts;
+
+    for (int i = 0; i < 510; i++) {
+        uint160 hash;
+        hash.begin()[0] = i & 0xff;
+        hash.begin()[1] = i >> 8;
+        CTxOut out(COIN + i, GetScriptForDestination(CKeyID(hash)));
+        tx.vout.push_back(out);
+        if (i >= 10)
+            vPayouts.push_back(out);
+    }
+
+    CTransaction txCoinbase(tx);
+
+    while (state.KeepRunning()) {
+        CCoinbaseIndex coinbase(txCoinbase);
+        for (const CTxOut& out : vPayouts)
+            assert(coinbase.Contains(out.scriptPubKey, out.nValue));
+    }
+}
+
+BENCHMARK(CoinbaseIndexRewardBlock);
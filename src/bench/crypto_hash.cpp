@@ -9,6 +9,8 @@
 #include "hash.h"
 #include "uint256.h"
 #include "utiltime.h"
+#include "crypto/aes.h"
+#include "crypto/keccak256.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
@@ -17,26 +19,29 @@
 /* Number of bytes to hash per iteration */
 static const uint64_t BUFFER_SIZE = 1000*1000;
 
-static void RIPEMD160(benchmark::State& state)
+static void RIPEMD160_1MB(benchmark::State& state)
 {
     uint8_t hash[CRIPEMD160::OUTPUT_SIZE];
     std::vector<uint8_t> in(BUFFER_SIZE,0);
+    state.SetBytesPerIteration(in.size());
     while (state.KeepRunning())
         CRIPEMD160().Write(begin_ptr(in), in.size()).Finalize(hash);
 }
 
-static void SHA1(benchmark::State& state)
+static void SHA1_1MB(benchmark::State& state)
 {
     uint8_t hash[CSHA1::OUTPUT_SIZE];
     std::vector<uint8_t> in(BUFFER_SIZE,0);
+    state.SetBytesPerIteration(in.size());
     while (state.KeepRunning())
         CSHA1().Write(begin_ptr(in), in.size()).Finalize(hash);
 }
 
-static void SHA256(benchmark::State& state)
+static void SHA256_1MB(benchmark::State& state)
 {
     uint8_t hash[CSHA256::OUTPUT_SIZE];
     std::vector<uint8_t> in(BUFFER_SIZE,0);
+    state.SetBytesPerIteration(in.size());
     while (state.KeepRunning())
         CSHA256().Write(begin_ptr(in), in.size()).Finalize(hash);
 }
@@ -44,6 +49,8 @@ static void SHA256(benchmark::State& state)
 static void SHA256_32b(benchmark::State& state)
 {
     std::vector<uint8_t> in(32,0);
+    state.SetBytesPerIteration(32 * 1000000);
+    state.SetItemsPerIteration(1000000);
     while (state.KeepRunning()) {
         for (int i = 0; i < 1000000; i++) {
             CSHA256().Write(begin_ptr(in), in.size()).Finalize(&in[0]);
@@ -51,10 +58,93 @@ static void SHA256_32b(benchmark::State& state)
     }
 }
 
-static void SHA512(benchmark::State& state)
+static void SHA256D64_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(64 * 1024, 0);
+    state.SetBytesPerIteration(in.size());
+    state.SetItemsPerIteration(1024);
+    while (state.KeepRunning()) {
+        SHA256D64(in.data(), in.data(), 1024);
+    }
+}
+
+static void Hash4_1024(benchmark::State& state)
+{
+    // One merkle level of 1024 nodes hashed pair by pair, to compare with SHA256D64_1024
+    std::vector<uint256> in(2 * 1024), out(1024);
+    state.SetBytesPerIteration(in.size() * sizeof(uint256));
+    state.SetItemsPerIteration(out.size());
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < out.size(); i++) {
+            out[i] = Hash4(in[2 * i].begin(), in[2 * i].end(), in[2 * i + 1].begin(), in[2 * i + 1].end());
+        }
+    }
+}
+
+static void Keccak256_80b(benchmark::State& state)
+{
+    std::vector<uint8_t> in(80, 0);
+    state.SetBytesPerIteration(80 * 1000000);
+    state.SetItemsPerIteration(1000000);
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000000; i++) {
+            Keccak256_80(&in[0], &in[0]);
+        }
+    }
+}
+
+static void Keccak256_80Many_2000(benchmark::State& state)
+{
+    // One full headers message
+    std::vector<uint8_t> in(80 * 2000, 0), out(32 * 2000);
+    state.SetBytesPerIteration(in.size());
+    state.SetItemsPerIteration(2000);
+    while (state.KeepRunning()) {
+        Keccak256_80Many(&out[0], &in[0], 2000);
+    }
+}
+
+static void HashKeccak_80b(benchmark::State& state)
+{
+    // A block header through the generic streaming path
+    std::vector<uint8_t> in(80, 0);
+    uint256 hash;
+    state.SetBytesPerIteration(in.size());
+    while (state.KeepRunning()) {
+        hash = HashKeccak(in.begin(), in.end());
+        in[0] = hash.begin()[0];
+    }
+}
+
+static void HashKeccak_1MB(benchmark::State& state)
+{
+    std::vector<uint8_t> in(BUFFER_SIZE, 0);
+    state.SetBytesPerIteration(in.size());
+    while (state.KeepRunning()) {
+        uint256 hash = HashKeccak(in.begin(), in.end());
+        in[0] = hash.begin()[0];
+    }
+}
+
+static void AES256CBCDecrypt_48b(benchmark::State& state)
+{
+    // One encrypted wallet key, with the key schedule set up for each as CCrypter does
+    unsigned char key[32] = {0}, iv[AES_BLOCKSIZE] = {0};
+    std::vector<unsigned char> in(48, 0), out(48);
+    state.SetBytesPerIteration(in.size() * 10000);
+    state.SetItemsPerIteration(10000);
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 10000; i++) {
+            AES256CBCDecrypt(key, iv, false).Decrypt(&in[0], in.size(), &out[0]);
+        }
+    }
+}
+
+static void SHA512_1MB(benchmark::State& state)
 {
     uint8_t hash[CSHA512::OUTPUT_SIZE];
     std::vector<uint8_t> in(BUFFER_SIZE,0);
+    state.SetBytesPerIteration(in.size());
     while (state.KeepRunning())
         CSHA512().Write(begin_ptr(in), in.size()).Finalize(hash);
 }
@@ -62,6 +152,8 @@ static void SHA512(benchmark::State& state)
 static void SipHash_32b(benchmark::State& state)
 {
     uint256 x;
+    state.SetBytesPerIteration(32 * 1000000);
+    state.SetItemsPerIteration(1000000);
     while (state.KeepRunning()) {
         for (int i = 0; i < 1000000; i++) {
             *((uint64_t*)x.begin()) = SipHashUint256(0, i, x);
@@ -69,10 +161,17 @@ static void SipHash_32b(benchmark::State& state)
     }
 }
 
-//BENCHMARK(RIPEMD160);
-//BENCHMARK(SHA1);
-//BENCHMARK(SHA256);
-//BENCHMARK(SHA512);
+BENCHMARK(RIPEMD160_1MB);
+BENCHMARK(SHA1_1MB);
+BENCHMARK(SHA256_1MB);
+BENCHMARK(SHA512_1MB);
 
-//BENCHMARK(SHA256_32b);
-//BENCHMARK(SipHash_32b);
+BENCHMARK(SHA256_32b);
+BENCHMARK(SHA256D64_1024);
+BENCHMARK(Hash4_1024);
+BENCHMARK(Keccak256_80b);
+BENCHMARK(Keccak256_80Many_2000);
+BENCHMARK(HashKeccak_80b);
+BENCHMARK(HashKeccak_1MB);
+BENCHMARK(AES256CBCDecrypt_48b);
+BENCHMARK(SipHash_32b);
@@ -0,0 +1,57 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "random.h"
+#include "txmempool.h"
+#include "validation.h"
+
+#include <limits>
+#include <vector>
+
+// Accept and then evict a chain of nChain transactions, each spending the
+// change of the one before it, the way batched payouts arrive.
+static void MempoolChain(benchmark::State& state, int nChain)
+{
+    std::vector<CMutableTransaction> vChain(nChain);
+    uint256 hashPrev = GetRandHash();
+    for (int i = 0; i < nChain; i++) {
+        CMutableTransaction& tx = vChain[i];
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(hashPrev, 1);
+        tx.vout.resize(2);
+        tx.vout[0].nValue = COIN;
+        tx.vout[1].nValue = (nChain - i) * COIN;
+        hashPrev = tx.GetHash();
+    }
+
+    const uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    while (state.KeepRunning()) {
+        CTxMemPool pool(CFeeRate(0));
+        LOCK(pool.cs);
+        for (int i = 0; i < nChain; i++) {
+            CTxMemPoolEntry entry(vChain[i], 1000, 0, 0, 1, i == 0, 0, false, 1, LockPoints());
+            CTxMemPool::setEntries setAncestors;
+            std::string dummy;
+            pool.CalculateMemPoolAncestors(entry, setAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy);
+            pool.addUnchecked(vChain[i].GetHash(), entry, setAncestors, false);
+        }
+        std::list<CTransaction> removed;
+        pool.remove(vChain[0], removed, true);
+    }
+}
+
+static void MempoolChainDefaultLimit(benchmark::State& state)
+{
+    MempoolChain(state, DEFAULT_ANCESTOR_LIMIT);
+}
+
+static void MempoolChainPayoutBatch(benchmark::State& state)
+{
+    MempoolChain(state, 500);
+}
+
+BENCHMARK(MempoolChainDefaultLimit);
+BENCHMARK(MempoolChainPayoutBatch);
@@ -0,0 +1,29 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "consensus/merkle.h"
+#include "random.h"
+#include "uint256.h"
+
+#include <vector>
+
+static void MerkleRoot(benchmark::State& state, size_t nLeaves)
+{
+    std::vector<uint256> leaves(nLeaves);
+    for (size_t i = 0; i < leaves.size(); i++)
+        leaves[i] = GetRandHash();
+    while (state.KeepRunning()) {
+        bool mutated = false;
+        uint256 root = ComputeMerkleRoot(leaves, &mutated);
+        leaves[mutated] = root;
+    }
+}
+
+// A typical block, and a big adaptive size one whose first levels get split across threads
+static void MerkleRoot9001(benchmark::State& state) { MerkleRoot(state, 9001); }
+static void MerkleRoot100000(benchmark::State& state) { MerkleRoot(state, 100000); }
+BENCHMARK(MerkleRoot9001);
+BENCHMARK(MerkleRoot100000);
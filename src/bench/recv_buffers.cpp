@@ -0,0 +1,42 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "net.h"
+#include "protocol.h"
+#include "streams.h"
+
+#include <vector>
+
+// A message coming in as the socket thread reads it, in chunks of up to 64 KiB
+static void ReceiveMessage(benchmark::State& state, const char* pszCommand, unsigned int nSize)
+{
+    CMessageHeader::MessageStartChars pchMessageStart = {0x5c, 0xa1, 0xab, 0x1e};
+    CDataStream ssMsg(SER_NETWORK, PROTOCOL_VERSION);
+    ssMsg << CMessageHeader(pchMessageStart, pszCommand, nSize);
+    ssMsg.resize(CMessageHeader::HEADER_SIZE + nSize, 0x55);
+    const std::vector<char> vchMsg(ssMsg.begin(), ssMsg.end());
+
+    while (state.KeepRunning()) {
+        CNetMessage msg(pchMessageStart, SER_NETWORK, PROTOCOL_VERSION);
+        const char* pch = vchMsg.data();
+        unsigned int nBytes = vchMsg.size();
+        while (nBytes > 0) {
+            int nHandled = msg.in_data ? msg.readData(pch, std::min(nBytes, 0x10000U)) : msg.readHeader(pch, nBytes);
+            if (nHandled <= 0)
+                return;
+            pch += nHandled;
+            nBytes -= nHandled;
+        }
+        if (!msg.complete())
+            return;
+    }
+}
+
+static void ReceiveTxMessage(benchmark::State& state) { ReceiveMessage(state, "tx", 400); }
+static void ReceiveBlockMessage(benchmark::State& state) { ReceiveMessage(state, "block", 1000 * 1000); }
+
+BENCHMARK(ReceiveTxMessage);
+BENCHMARK(ReceiveBlockMessage);
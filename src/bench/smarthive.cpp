@@ -0,0 +1,48 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "consensus/consensus.h"
+#include "key.h"
+#include "smarthive/hivepayments.h"
+#include "smartmining/coinbaseindex.h"
+#include "smartrewards/rewardspayments.h"
+#include "validation.h"
+
+#include <cassert>
+
+// A coinbase with the hive payments of nHeight among a full block of SmartRewards payouts.
+static void SmartHiveValidate(benchmark::State& state, int nHeight)
+{
+    SmartHivePayments::Init();
+
+    int64_t blockTime = nStartRewardTime + 1;
+    CAmount blockReward = GetBlockValue(nHeight, 0, blockTime);
+
+    CMutableTransaction txNew;
+    for (int i = 0; i < nRewardPayoutsPerBlock; i++) {
+        CKey key;
+        key.MakeNewKey(true);
+        txNew.vout.push_back(CTxOut(COIN, GetScriptForDestination(key.GetPubKey().GetID())));
+    }
+    std::vector<CTxOut> voutSmartHives;
+    SmartHivePayments::FillPayments(txNew, nHeight, blockTime, blockReward, voutSmartHives);
+
+    CTransaction tx(txNew);
+    CCoinbaseIndex coinbase(tx);
+    CAmount hiveReward = 0;
+    SmartHivePayments::Result result = SmartHivePayments::Validate(coinbase, nHeight, blockTime, hiveReward);
+    assert(result == SmartHivePayments::Valid && hiveReward > 0);
+
+    while (state.KeepRunning()) {
+        SmartHivePayments::Validate(coinbase, nHeight, blockTime, hiveReward);
+    }
+}
+
+static void SmartHiveValidateRotation(benchmark::State& state) { SmartHiveValidate(state, HF_V1_2_START_HEIGHT - 1); }
+static void SmartHiveValidateBatch(benchmark::State& state) { SmartHiveValidate(state, HF_V1_2_START_HEIGHT + 50 * 1500); }
+
+BENCHMARK(SmartHiveValidateRotation);
+BENCHMARK(SmartHiveValidateBatch);
@@ -0,0 +1,173 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "arith_uint256.h"
+#include "hash.h"
+#include "key.h"
+#include "messagesigner.h"
+#include "net.h"
+#include "random.h"
+#include "smartnode/activesmartnode.h"
+#include "smartnode/instantx.h"
+#include "smartnode/smartnode.h"
+#include "smartnode/smartnodeman.h"
+#include "smartnode/smartnodesync.h"
+#include "validation.h"
+
+#include <cassert>
+#include <list>
+#include <vector>
+
+static void SmartnodeCalculateScore(benchmark::State& state)
+{
+    CSmartnode mn;
+    mn.vin = CTxIn(COutPoint(GetRandHash(), 1));
+    mn.nCollateralMinConfBlockHash = GetRandHash();
+    uint256 blockHash = GetRandHash();
+    while (state.KeepRunning()) {
+        arith_uint256 score = mn.CalculateScore(blockHash);
+        blockHash = ArithToUint256(score);
+    }
+}
+
+static void SmartnodeCalculateScores_5000(benchmark::State& state)
+{
+    // A full ranking as done for every payment and rank lookup
+    std::list<CSmartnode> listSmartnodes(5000);
+    std::vector<std::pair<arith_uint256, CSmartnode*> > vecScores;
+    for (CSmartnode& mn : listSmartnodes) {
+        mn.vin = CTxIn(COutPoint(GetRandHash(), 1));
+        mn.nCollateralMinConfBlockHash = GetRandHash();
+        vecScores.push_back(std::make_pair(arith_uint256(), &mn));
+    }
+    uint256 blockHash = GetRandHash();
+    state.SetItemsPerIteration(vecScores.size());
+    while (state.KeepRunning()) {
+        CSmartnode::CalculateScores(vecScores, blockHash);
+    }
+}
+
+// Smartnodes known to the global list and a chain for their ranks, removed again on destruction.
+class CBenchSmartnodeList
+{
+    std::vector<CBlockIndex> vChain;
+    std::vector<uint256> vHashes;
+
+public:
+    std::vector<COutPoint> vOutpoints;
+
+    CBenchSmartnodeList(size_t nSmartnodes, const CPubKey& pubKeySmartnode) : vChain(100), vHashes(vChain.size())
+    {
+        LOCK(cs_main);
+        for (size_t i = 0; i < vChain.size(); i++) {
+            vHashes[i] = GetRandHash();
+            vChain[i].nHeight = i;
+            vChain[i].pprev = i ? &vChain[i - 1] : NULL;
+            vChain[i].phashBlock = &vHashes[i];
+        }
+        chainActive.SetTip(&vChain.back());
+
+        for (size_t i = 0; i < nSmartnodes; i++) {
+            CSmartnode mn;
+            mn.vin = CTxIn(COutPoint(GetRandHash(), 0));
+            mn.pubKeySmartnode = pubKeySmartnode;
+            mn.nActiveState = CSmartnode::SMARTNODE_ENABLED;
+            mn.nProtocolVersion = PROTOCOL_VERSION;
+            mn.nCollateralMinConfBlockHash = GetRandHash();
+            mnodeman.Add(mn);
+            vOutpoints.push_back(mn.vin.prevout);
+        }
+
+        // Ranks are only known once the list is synced
+        CConnman connman;
+        smartnodeSync.Reset();
+        while (!smartnodeSync.IsSmartnodeListSynced())
+            smartnodeSync.SwitchToNextAsset(connman);
+    }
+
+    ~CBenchSmartnodeList()
+    {
+        smartnodeSync.Reset();
+        mnodeman.Clear();
+        LOCK(cs_main);
+        chainActive.SetTip(NULL);
+    }
+};
+
+static void SmartnodeGetRanks_5000(benchmark::State& state)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CBenchSmartnodeList list(5000, key.GetPubKey());
+
+    CSmartnodeMan::rank_pair_vec_t vecRanks;
+    state.SetItemsPerIteration(list.vOutpoints.size());
+    while (state.KeepRunning()) {
+        bool fRanked = mnodeman.GetSmartnodeRanks(vecRanks);
+        assert(fRanked);
+    }
+}
+
+// The signature check of every InstantSend vote received, the smartnode looked up in a list of 5000.
+static void TxLockVoteCheckSignature(benchmark::State& state)
+{
+    CKey keyPrev = activeSmartnode.keySmartnode;
+    CPubKey pubKeyPrev = activeSmartnode.pubKeySmartnode;
+    activeSmartnode.keySmartnode.MakeNewKey(true);
+    activeSmartnode.pubKeySmartnode = activeSmartnode.keySmartnode.GetPubKey();
+
+    {
+        CBenchSmartnodeList list(5000, activeSmartnode.pubKeySmartnode);
+        CTxLockVote vote(GetRandHash(), COutPoint(GetRandHash(), 0), list.vOutpoints[GetRand(list.vOutpoints.size())]);
+        bool fSigned = vote.Sign();
+        assert(fSigned);
+
+        while (state.KeepRunning()) {
+            vote.CheckSignature();
+        }
+    }
+
+    activeSmartnode.keySmartnode = keyPrev;
+    activeSmartnode.pubKeySmartnode = pubKeyPrev;
+}
+
+static void MessageSigner(benchmark::State& state, bool fCached)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    std::string strMessage = "smartnode ping " + GetRandHash().ToString();
+    std::vector<unsigned char> vchSig;
+    CMessageSigner::SignMessage(strMessage, vchSig, key);
+    std::string strError;
+
+    if (fCached) {
+        // A message seen again, e.g. relayed by another peer
+        while (state.KeepRunning()) {
+            CMessageSigner::VerifyMessage(pubkey, vchSig, strMessage, strError);
+        }
+        return;
+    }
+
+    // The key recovery a signature not in the cache costs
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << strMessageMagic << strMessage;
+    uint256 hash = ss.GetHash();
+    while (state.KeepRunning()) {
+        CPubKey pubkeyRecovered;
+        pubkeyRecovered.RecoverCompact(hash, vchSig);
+    }
+}
+
+static void VerifyMessage(benchmark::State& state) { MessageSigner(state, false); }
+static void VerifyMessageCached(benchmark::State& state) { MessageSigner(state, true); }
+
+BENCHMARK(SmartnodeCalculateScore);
+BENCHMARK(SmartnodeCalculateScores_5000);
+BENCHMARK(SmartnodeGetRanks_5000);
+BENCHMARK(TxLockVoteCheckSignature);
+BENCHMARK(VerifyMessage);
+BENCHMARK(VerifyMessageCached);
@@ -0,0 +1,137 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "arith_uint256.h"
+#include "chain.h"
+#include "consensus/consensus.h"
+#include "random.h"
+#include "smartrewards/rewards.h"
+#include "smartrewards/rewardsdb.h"
+#include "smartrewards/rewardspayments.h"
+
+#include <cassert>
+#include <memory>
+#include <vector>
+
+/** Number of addresses in the rewards database, ten payout blocks worth of them */
+static const int REWARDS_BENCH_ENTRIES = 10 * nRewardPayoutsPerBlock;
+
+static CSmartAddress RandomSmartAddress()
+{
+    uint256 hash = GetRandHash();
+    return CSmartAddress(CKeyID(uint160(std::vector<unsigned char>(hash.begin(), hash.begin() + 20))));
+}
+
+// Eligible entries for all of ids, written as the rewards of block 1.
+static void WriteRewardEntries(CSmartRewardsDB& db, const std::vector<CSmartAddress>& ids, const CSmartRewardRound& round)
+{
+    CSmartRewardEntryList entries;
+    for (size_t i = 0; i < ids.size(); i++) {
+        CSmartRewardEntry entry(ids[i]);
+        entry.balance = entry.balanceOnStart = SMART_REWARDS_MIN_BALANCE + i * COIN;
+        entry.eligible = true;
+        entries.push_back(entry);
+    }
+
+    std::vector<const CSmartRewardEntry*> vEntries;
+    for (const CSmartRewardEntry& entry : entries)
+        vEntries.push_back(&entry);
+
+    uint256 hash = GetRandHash();
+    CSmartRewardBlockList blocks(1, CSmartRewardBlock(1, hash, 0));
+    bool fWritten = db.SyncBlocks(blocks, round, vEntries, CSmartRewardTransactionList());
+    assert(fWritten);
+}
+
+// A full block of transactions with two inputs and two outputs each, between known addresses.
+static void SmartRewardsUpdate(benchmark::State& state)
+{
+    std::vector<CSmartAddress> ids;
+    for (int i = 0; i < REWARDS_BENCH_ENTRIES; i++)
+        ids.push_back(RandomSmartAddress());
+
+    CSmartRewardRound round;
+    round.number = 1;
+    std::unique_ptr<CSmartRewardsDB> pdb(new CSmartRewardsDB(1 << 24, true, true));
+    WriteRewardEntries(*pdb, ids, round);
+    CSmartRewards rewards(pdb.get());
+
+    CSmartRewardsBlockData data;
+    data.vtx.resize(2000);
+    for (size_t i = 0; i < data.vtx.size(); i++) {
+        CSmartRewardsTxData& tx = data.vtx[i];
+        tx.vin.resize(2);
+        tx.vout.resize(2);
+        for (int n = 0; n < 2; n++) {
+            tx.vin[n].id = ids[GetRand(ids.size())];
+            tx.vin[n].out.nValue = COIN / 100;
+            tx.vin[n].fParsed = true;
+            tx.vout[n].id = ids[GetRand(ids.size())];
+            tx.vout[n].out.nValue = COIN / 100;
+            tx.vout[n].fParsed = true;
+        }
+    }
+
+    CBlockIndex index;
+    index.nHeight = 1;
+    data.pindex = &index;
+
+    uint64_t nTx = 0;
+    state.SetItemsPerIteration(data.vtx.size());
+    while (state.KeepRunning()) {
+        // Each block has transactions never seen before
+        for (CSmartRewardsTxData& tx : data.vtx)
+            tx.hash = ArithToUint256(arith_uint256(++nTx));
+        index.nHeight++;
+        data.blockHash = ArithToUint256(arith_uint256(index.nHeight));
+
+        CSmartRewardsUpdateResult result;
+        bool fUpdated = rewards.Update(data, result);
+        assert(fUpdated);
+    }
+}
+
+// The slices of the payouts of a finished round, one per payout block.
+static void SmartRewardsPaymentsForBlock(benchmark::State& state)
+{
+    std::vector<CSmartAddress> ids;
+    for (int i = 0; i < REWARDS_BENCH_ENTRIES; i++)
+        ids.push_back(RandomSmartAddress());
+
+    CSmartRewardRound current;
+    current.number = 1;
+    current.percent = 0.01;
+    current.endBlockHeight = HF_V1_2_START_HEIGHT;
+    std::unique_ptr<CSmartRewardsDB> pdb(new CSmartRewardsDB(1 << 24, true, true));
+    WriteRewardEntries(*pdb, ids, current);
+
+    CSmartRewardRound next;
+    next.number = 2;
+    CSmartRewardSnapshotList payouts;
+    bool fEvaluated = pdb->EvaluateRound(current, next, payouts);
+    current.eligibleEntries = payouts.size();
+    bool fFinalized = pdb->FinalizeRound(current, next);
+    assert(fEvaluated && fFinalized);
+
+    CSmartRewards* prewardsPrev = prewards;
+    std::unique_ptr<CSmartRewards> prewardsBench(new CSmartRewards(pdb.get()));
+    prewards = prewardsBench.get();
+
+    const int nRewardBlocks = (payouts.size() + nRewardPayoutsPerBlock - 1) / nRewardPayoutsPerBlock;
+    const int nFirstHeight = current.endBlockHeight + nRewardPayoutStartDelay;
+    int nBlock = 0;
+    while (state.KeepRunning()) {
+        SmartRewardPayments::Result result;
+        CSmartRewardSnapshotList blockPayouts = SmartRewardPayments::GetPaymentsForBlock(nFirstHeight + nBlock * nRewardPayoutBlockInterval, 0, result);
+        assert(result == SmartRewardPayments::Valid && !blockPayouts.empty());
+        nBlock = (nBlock + 1) % nRewardBlocks;
+    }
+
+    prewards = prewardsPrev;
+}
+
+BENCHMARK(SmartRewardsUpdate);
+BENCHMARK(SmartRewardsPaymentsForBlock);
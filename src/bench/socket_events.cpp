@@ -0,0 +1,83 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "netpoller.h"
+#include "util.h"
+
+#include <memory>
+#include <vector>
+
+#ifndef WIN32
+#include <sys/socket.h>
+#include <unistd.h>
+
+// One wakeup of ThreadSocketHandler with nPeers connections, of which only
+// one has data waiting, the way most peers of a busy node sit idle.
+static void SocketEvents(benchmark::State& state, const std::string& strMode, int nPeers)
+{
+    std::unique_ptr<CSocketPoller> poller(CreateSocketPoller(strMode));
+    if (!poller)
+        return;
+    RaiseFileDescriptorLimit(2 * nPeers + 64);
+
+    std::vector<int> vLocal, vRemote;
+    CSocketPoller::InterestMap mapInterest;
+    for (int i = 0; i < nPeers; i++) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0 || !poller->CanWait(fds[0])) {
+            LogPrintf("SocketEvents: can't set up %d peers\n", nPeers);
+            break;
+        }
+        vLocal.push_back(fds[0]);
+        vRemote.push_back(fds[1]);
+        mapInterest[fds[0]] = CSocketPoller::Interest(i, CSocketPoller::EVENT_RECV | CSocketPoller::EVENT_ERR);
+    }
+
+    if ((int)vLocal.size() == nPeers) {
+        CSocketPoller::ReadyMap mapReady;
+        char ch = 0;
+        int nPeer = 0;
+        while (state.KeepRunning()) {
+            nPeer = (nPeer + 7919) % nPeers;
+            if (write(vRemote[nPeer], &ch, 1) != 1)
+                break;
+            poller->Wait(mapInterest, 50, mapReady);
+            if (CSocketPoller::GetReadyEvents(mapReady, vLocal[nPeer]) & CSocketPoller::EVENT_RECV) {
+                if (read(vLocal[nPeer], &ch, 1) != 1)
+                    break;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < vLocal.size(); i++) {
+        close(vLocal[i]);
+        close(vRemote[i]);
+    }
+}
+
+static void SocketEventsSelect100(benchmark::State& state) { SocketEvents(state, "select", 100); }
+static void SocketEventsSelect400(benchmark::State& state) { SocketEvents(state, "select", 400); }
+BENCHMARK(SocketEventsSelect100);
+BENCHMARK(SocketEventsSelect400);
+
+#ifdef HAVE_SYS_EPOLL_H
+static void SocketEventsEpoll100(benchmark::State& state) { SocketEvents(state, "epoll", 100); }
+static void SocketEventsEpoll400(benchmark::State& state) { SocketEvents(state, "epoll", 400); }
+static void SocketEventsEpoll2000(benchmark::State& state) { SocketEvents(state, "epoll", 2000); }
+BENCHMARK(SocketEventsEpoll100);
+BENCHMARK(SocketEventsEpoll400);
+BENCHMARK(SocketEventsEpoll2000);
+#endif
+
+#ifdef HAVE_SYS_EVENT_H
+static void SocketEventsKqueue100(benchmark::State& state) { SocketEvents(state, "kqueue", 100); }
+static void SocketEventsKqueue400(benchmark::State& state) { SocketEvents(state, "kqueue", 400); }
+static void SocketEventsKqueue2000(benchmark::State& state) { SocketEvents(state, "kqueue", 2000); }
+BENCHMARK(SocketEventsKqueue100);
+BENCHMARK(SocketEventsKqueue400);
+BENCHMARK(SocketEventsKqueue2000);
+#endif
+#endif
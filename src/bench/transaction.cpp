@@ -0,0 +1,84 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "primitives/transaction.h"
+#include "pubkey.h"
+#include "random.h"
+#include "script/standard.h"
+
+#include <utility>
+#include <vector>
+
+// A P2PKH scriptSig, a 72 byte signature and a compressed public key.
+static CScript CreateScriptSig()
+{
+    std::vector<unsigned char> vchSig(72, 0x30);
+    std::vector<unsigned char> vchPubKey(33, 0x02);
+    return CScript() << vchSig << vchPubKey;
+}
+
+// Two P2PKH inputs, a P2PKH and a P2SH output.
+static CMutableTransaction CreateTransaction()
+{
+    CMutableTransaction mtx;
+    for (int i = 0; i < 2; i++)
+        mtx.vin.push_back(CTxIn(GetRandHash(), i, CreateScriptSig()));
+    mtx.vout.push_back(CTxOut(COIN, GetScriptForDestination(CKeyID(uint160(std::vector<unsigned char>(20, 1))))));
+    mtx.vout.push_back(CTxOut(COIN, GetScriptForDestination(CScriptID(uint160(std::vector<unsigned char>(20, 2))))));
+    return mtx;
+}
+
+// Scripts up to 28 bytes are kept inline, copying a scriptPubKey doesn't allocate.
+// Longer ones get their buffer from malloc, which allocs/op doesn't count.
+static void ScriptCopyScriptPubKey(benchmark::State& state)
+{
+    CScript script = GetScriptForDestination(CKeyID(uint160(std::vector<unsigned char>(20, 1))));
+    while (state.KeepRunning()) {
+        CScript copy(script);
+    }
+}
+
+static void ScriptCopyScriptSig(benchmark::State& state)
+{
+    CScript script = CreateScriptSig();
+    while (state.KeepRunning()) {
+        CScript copy(script);
+    }
+}
+
+static void TransactionCopy(benchmark::State& state)
+{
+    CTransaction tx(CreateTransaction());
+    while (state.KeepRunning()) {
+        CTransaction copy(tx);
+    }
+}
+
+static void TransactionMove(benchmark::State& state)
+{
+    CTransaction tx(CreateTransaction());
+    while (state.KeepRunning()) {
+        CTransaction moved(std::move(tx));
+        tx = std::move(moved);
+    }
+}
+
+// The finished transaction takes over the inputs and outputs instead of copying them.
+static void TransactionFromMutable(benchmark::State& state)
+{
+    CMutableTransaction mtx = CreateTransaction();
+    while (state.KeepRunning()) {
+        CTransaction tx(std::move(mtx));
+        mtx.vin = std::move(tx.vin);
+        mtx.vout = std::move(tx.vout);
+    }
+}
+
+BENCHMARK(ScriptCopyScriptPubKey);
+BENCHMARK(ScriptCopyScriptSig);
+BENCHMARK(TransactionCopy);
+BENCHMARK(TransactionMove);
+BENCHMARK(TransactionFromMutable);
@@ -0,0 +1,123 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "libzerocoin/Zerocoin.h"
+
+#include <cassert>
+#include <memory>
+#include <vector>
+
+using namespace libzerocoin;
+
+/** Coins minted once for all benchmarks, as many as the largest accumulator needs */
+static const size_t MAX_BENCH_COINS = 100;
+
+static const CBigNum& GetBenchModulus()
+{
+    static CBigNum modulus(0);
+    if (!modulus)
+        modulus = CBigNum::generatePrime(1024, false) * CBigNum::generatePrime(1024, false);
+    return modulus;
+}
+
+static const Params* GetBenchParams()
+{
+    static std::unique_ptr<Params> params;
+    if (!params)
+        params.reset(new Params(GetBenchModulus()));
+    return params.get();
+}
+
+static const std::vector<PrivateCoin>& GetBenchCoins()
+{
+    static std::vector<PrivateCoin> vCoins;
+    while (vCoins.size() < MAX_BENCH_COINS)
+        vCoins.push_back(PrivateCoin(GetBenchParams()));
+    return vCoins;
+}
+
+static void ZerocoinParamGen(benchmark::State& state)
+{
+    const CBigNum& modulus = GetBenchModulus();
+    while (state.KeepRunning()) {
+        Params params(modulus);
+    }
+}
+
+static void ZerocoinMint(benchmark::State& state)
+{
+    const Params* params = GetBenchParams();
+    while (state.KeepRunning()) {
+        PrivateCoin coin(params);
+    }
+}
+
+static void ZerocoinAccumulate(benchmark::State& state, size_t nCoins, bool fBatch)
+{
+    const Params* params = GetBenchParams();
+    std::vector<PublicCoin> vPublicCoins;
+    for (size_t i = 0; i < nCoins; i++)
+        vPublicCoins.push_back(GetBenchCoins()[i].getPublicCoin());
+
+    state.SetItemsPerIteration(nCoins);
+    while (state.KeepRunning()) {
+        Accumulator acc(params);
+        if (fBatch) {
+            acc.accumulate(vPublicCoins);
+        } else {
+            for (const PublicCoin& coin : vPublicCoins)
+                acc += coin;
+        }
+    }
+}
+
+static void ZerocoinSpend(benchmark::State& state, size_t nCoins, bool fVerify)
+{
+    const Params* params = GetBenchParams();
+    const std::vector<PrivateCoin>& vCoins = GetBenchCoins();
+
+    // The first coin gets spent, the others are accumulated after it
+    Accumulator acc(params);
+    AccumulatorWitness witness(params, acc, vCoins[0].getPublicCoin());
+    for (size_t i = 0; i < nCoins; i++) {
+        acc += vCoins[i].getPublicCoin();
+        witness += vCoins[i].getPublicCoin();
+    }
+    SpendMetaData metaData(1, 1);
+
+    if (!fVerify) {
+        while (state.KeepRunning()) {
+            CoinSpend spend(params, vCoins[0], acc, witness, metaData);
+        }
+        return;
+    }
+
+    CoinSpend spend(params, vCoins[0], acc, witness, metaData);
+    assert(spend.Verify(acc, metaData));
+    while (state.KeepRunning()) {
+        spend.Verify(acc, metaData);
+    }
+}
+
+static void ZerocoinAccumulate_10(benchmark::State& state) { ZerocoinAccumulate(state, 10, false); }
+static void ZerocoinAccumulate_100(benchmark::State& state) { ZerocoinAccumulate(state, 100, false); }
+static void ZerocoinAccumulateBatch_10(benchmark::State& state) { ZerocoinAccumulate(state, 10, true); }
+static void ZerocoinAccumulateBatch_100(benchmark::State& state) { ZerocoinAccumulate(state, 100, true); }
+static void ZerocoinSpendCreate_10(benchmark::State& state) { ZerocoinSpend(state, 10, false); }
+static void ZerocoinSpendCreate_100(benchmark::State& state) { ZerocoinSpend(state, 100, false); }
+static void ZerocoinSpendVerify_10(benchmark::State& state) { ZerocoinSpend(state, 10, true); }
+static void ZerocoinSpendVerify_100(benchmark::State& state) { ZerocoinSpend(state, 100, true); }
+
+BENCHMARK(ZerocoinParamGen);
+BENCHMARK(ZerocoinMint);
+BENCHMARK(ZerocoinAccumulate_10);
+BENCHMARK(ZerocoinAccumulate_100);
+BENCHMARK(ZerocoinAccumulateBatch_10);
+BENCHMARK(ZerocoinAccumulateBatch_100);
+BENCHMARK(ZerocoinSpendCreate_10);
+BENCHMARK(ZerocoinSpendCreate_100);
+BENCHMARK(ZerocoinSpendVerify_10);
+BENCHMARK(ZerocoinSpendVerify_100);
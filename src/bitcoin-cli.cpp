@@ -14,9 +14,13 @@
 #include "util.h"
 #include "utilstrencodings.h"
 
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
 #include <boost/filesystem/operations.hpp>
 #include <stdio.h>
 
+#include <algorithm>
+
 #include <event2/event.h>
 #include <event2/http.h>
 #include <event2/buffer.h>
@@ -28,6 +32,7 @@ using namespace std;
 
 static const char DEFAULT_RPCCONNECT[] = "127.0.0.1";
 static const int DEFAULT_HTTP_CLIENT_TIMEOUT=900;
+static const int DEFAULT_BATCH_SIZE=100;
 static const int CONTINUE_EXECUTION=-1;
 
 std::string HelpMessageCli()
@@ -45,6 +50,8 @@ std::string HelpMessageCli()
     strUsage += HelpMessageOpt("-rpcpassword=<pw>", _("Password for JSON-RPC connections"));
     strUsage += HelpMessageOpt("-rpcclienttimeout=<n>", strprintf(_("Timeout during HTTP requests (default: %d)"), DEFAULT_HTTP_CLIENT_TIMEOUT));
     strUsage += HelpMessageOpt("-stdin", _("Read extra arguments from standard input, one per line until EOF/Ctrl-D (recommended for sensitive information such as passphrases)"));
+    strUsage += HelpMessageOpt("-batch", _("Read commands from standard input, one per line as the method and its arguments separated by spaces, and send them over one kept-alive connection"));
+    strUsage += HelpMessageOpt("-batchsize=<n>", strprintf(_("Send the commands of -batch in JSON-RPC batch requests of up to <n> commands, 1 sends them one by one (default: %u)"), DEFAULT_BATCH_SIZE));
 
     return strUsage;
 }
@@ -125,6 +132,7 @@ static int AppInitRPC(int argc, char* argv[])
 /** Reply structure for request_done to fill in */
 struct HTTPReply
 {
+    struct event_base *base;
     int status;
     std::string body;
 };
@@ -133,6 +141,9 @@ static void http_request_done(struct evhttp_request *req, void *ctx)
 {
     HTTPReply *reply = static_cast<HTTPReply*>(ctx);
 
+    // A kept-alive connection keeps the event loop busy, return to the caller
+    event_base_loopbreak(reply->base);
+
     if (req == NULL) {
         /* If req is NULL, it means an error occurred while connecting, but
          * I'm not sure how to find out which one. We also don't really care.
@@ -154,29 +165,36 @@ static void http_request_done(struct evhttp_request *req, void *ctx)
     }
 }
 
-UniValue CallRPC(const string& strMethod, const UniValue& params)
+/** A connection to the RPC server. With fKeepAlive it is reused by the calls
+ * made on it, and libevent reconnects if the server closed it in between.
+ */
+class CRPCConnection
 {
-    std::string host = GetArg("-rpcconnect", DEFAULT_RPCCONNECT);
-    int port = GetArg("-rpcport", BaseParams().RPCPort());
+private:
+    std::string host;
+    struct event_base *base;
+    struct evhttp_connection *evcon;
+    bool fKeepAlive;
+    std::string strRPCUserColonPass;
 
-    // Create event base
-    struct event_base *base = event_base_new(); // TODO RAII
-    if (!base)
-        throw runtime_error("cannot create event_base");
+public:
+    CRPCConnection(bool fKeepAliveIn);
+    ~CRPCConnection();
 
-    // Synchronously look up hostname
-    struct evhttp_connection *evcon = evhttp_connection_base_new(base, NULL, host.c_str(), port); // TODO RAII
-    if (evcon == NULL)
-        throw runtime_error("create connection failed");
-    evhttp_connection_set_timeout(evcon, GetArg("-rpcclienttimeout", DEFAULT_HTTP_CLIENT_TIMEOUT));
+    UniValue Call(const string& strMethod, const UniValue& params);
+    //! Send a JSON-RPC batch request, the replies come back in any order
+    UniValue CallBatch(const UniValue& requests);
 
-    HTTPReply response;
-    struct evhttp_request *req = evhttp_request_new(http_request_done, (void*)&response); // TODO RAII
-    if (req == NULL)
-        throw runtime_error("create http request failed");
+private:
+    UniValue Post(const std::string& strRequest);
+};
+
+CRPCConnection::CRPCConnection(bool fKeepAliveIn) : base(NULL), evcon(NULL), fKeepAlive(fKeepAliveIn)
+{
+    host = GetArg("-rpcconnect", DEFAULT_RPCCONNECT);
+    int port = GetArg("-rpcport", BaseParams().RPCPort());
 
     // Get credentials
-    std::string strRPCUserColonPass;
     if (mapArgs["-rpcpassword"] == "") {
         // Try fall back to cookie-based authentication if no password is provided
         if (!GetAuthCookie(&strRPCUserColonPass)) {
@@ -189,28 +207,69 @@ UniValue CallRPC(const string& strMethod, const UniValue& params)
         strRPCUserColonPass = mapArgs["-rpcuser"] + ":" + mapArgs["-rpcpassword"];
     }
 
+    // Create event base
+    base = event_base_new();
+    if (!base)
+        throw runtime_error("cannot create event_base");
+
+    // Synchronously look up hostname
+    evcon = evhttp_connection_base_new(base, NULL, host.c_str(), port);
+    if (evcon == NULL) {
+        event_base_free(base);
+        throw runtime_error("create connection failed");
+    }
+    evhttp_connection_set_timeout(evcon, GetArg("-rpcclienttimeout", DEFAULT_HTTP_CLIENT_TIMEOUT));
+}
+
+CRPCConnection::~CRPCConnection()
+{
+    evhttp_connection_free(evcon);
+    event_base_free(base);
+}
+
+UniValue CRPCConnection::Call(const string& strMethod, const UniValue& params)
+{
+    const UniValue reply = Post(JSONRPCRequest(strMethod, params, 1));
+    if (!reply.isObject() || reply.empty())
+        throw runtime_error("expected reply to have result, error and id properties");
+
+    return reply;
+}
+
+UniValue CRPCConnection::CallBatch(const UniValue& requests)
+{
+    const UniValue reply = Post(requests.write() + "\n");
+    if (!reply.isArray())
+        throw runtime_error("expected reply to be an array");
+
+    return reply;
+}
+
+UniValue CRPCConnection::Post(const std::string& strRequest)
+{
+    HTTPReply response;
+    response.base = base;
+    response.status = 0;
+    struct evhttp_request *req = evhttp_request_new(http_request_done, (void*)&response); // TODO RAII
+    if (req == NULL)
+        throw runtime_error("create http request failed");
+
     struct evkeyvalq *output_headers = evhttp_request_get_output_headers(req);
     assert(output_headers);
     evhttp_add_header(output_headers, "Host", host.c_str());
-    evhttp_add_header(output_headers, "Connection", "close");
+    evhttp_add_header(output_headers, "Connection", fKeepAlive ? "keep-alive" : "close");
     evhttp_add_header(output_headers, "Authorization", (std::string("Basic ") + EncodeBase64(strRPCUserColonPass)).c_str());
 
     // Attach request data
-    std::string strRequest = JSONRPCRequest(strMethod, params, 1);
     struct evbuffer * output_buffer = evhttp_request_get_output_buffer(req);
     assert(output_buffer);
     evbuffer_add(output_buffer, strRequest.data(), strRequest.size());
 
     int r = evhttp_make_request(evcon, req, EVHTTP_REQ_POST, "/");
-    if (r != 0) {
-        evhttp_connection_free(evcon);
-        event_base_free(base);
+    if (r != 0)
         throw CConnectionFailed("send http request failed");
-    }
 
     event_base_dispatch(base);
-    evhttp_connection_free(evcon);
-    event_base_free(base);
 
     if (response.status == 0)
         throw CConnectionFailed("couldn't connect to server");
@@ -225,11 +284,173 @@ UniValue CallRPC(const string& strMethod, const UniValue& params)
     UniValue valReply(UniValue::VSTR);
     if (!valReply.read(response.body))
         throw runtime_error("couldn't parse reply from server");
-    const UniValue& reply = valReply.get_obj();
-    if (reply.empty())
-        throw runtime_error("expected reply to have result, error and id properties");
 
-    return reply;
+    return valReply;
+}
+
+UniValue CallRPC(const string& strMethod, const UniValue& params)
+{
+    CRPCConnection conn(false);
+    return conn.Call(strMethod, params);
+}
+
+/** Format the result or error of a reply, a server in warmup counts as not connected with -rpcwait */
+static int FormatReply(const UniValue& reply, bool fWait, std::string& strPrint)
+{
+    int nRet = 0;
+    const UniValue& result = find_value(reply, "result");
+    const UniValue& error  = find_value(reply, "error");
+
+    if (!error.isNull()) {
+        // Error
+        int code = error["code"].get_int();
+        if (fWait && code == RPC_IN_WARMUP)
+            throw CConnectionFailed("server in warmup");
+        strPrint = "error: " + error.write();
+        nRet = abs(code);
+        if (error.isObject())
+        {
+            UniValue errCode = find_value(error, "code");
+            UniValue errMsg  = find_value(error, "message");
+            strPrint = errCode.isNull() ? "" : "error code: "+errCode.getValStr()+"\n";
+
+            if (errMsg.isStr())
+                strPrint += "error message:\n"+errMsg.get_str();
+        }
+    } else {
+        // Result
+        if (result.isNull())
+            strPrint = "";
+        else if (result.isStr())
+            strPrint = result.get_str();
+        else
+            strPrint = result.write(2);
+    }
+    return nRet;
+}
+
+/** Run one command, waiting for the server with -rpcwait, and format its result or error */
+static int CommandRPC(CRPCConnection& conn, const std::vector<std::string>& args, std::string& strPrint)
+{
+    int nRet = 0;
+    std::string strMethod = args[0];
+    UniValue params = RPCConvertValues(strMethod, std::vector<std::string>(args.begin()+1, args.end()));
+
+    // Execute and handle connection failures with -rpcwait
+    const bool fWait = GetBoolArg("-rpcwait", false);
+    do {
+        try {
+            const UniValue reply = conn.Call(strMethod, params);
+            nRet = FormatReply(reply, fWait, strPrint);
+            // Connection succeeded, no need to retry.
+            break;
+        }
+        catch (const CConnectionFailed&) {
+            if (fWait)
+                MilliSleep(1000);
+            else
+                throw;
+        }
+    } while (fWait);
+    return nRet;
+}
+
+/** Run several commands in one JSON-RPC batch request, their results and errors end up in vPrint and vRet */
+static void BatchRPC(CRPCConnection& conn, const std::vector<std::vector<std::string> >& vCommands, std::vector<std::string>& vPrint, std::vector<int>& vRet)
+{
+    // The index of a command is its request id
+    UniValue requests(UniValue::VARR);
+    for (size_t i = 0; i < vCommands.size(); i++) {
+        const std::vector<std::string>& args = vCommands[i];
+        try {
+            UniValue params = RPCConvertValues(args[0], std::vector<std::string>(args.begin()+1, args.end()));
+            requests.push_back(JSONRPCRequestObj(args[0], params, (int)i));
+            vPrint[i] = "error: no reply from server";
+            vRet[i] = EXIT_FAILURE;
+        }
+        catch (const std::exception& e) {
+            vPrint[i] = string("error: ") + e.what();
+            vRet[i] = EXIT_FAILURE;
+        }
+    }
+    if (requests.empty())
+        return;
+
+    // Execute and handle connection failures with -rpcwait
+    const bool fWait = GetBoolArg("-rpcwait", false);
+    do {
+        try {
+            const UniValue replies = conn.CallBatch(requests);
+            for (size_t i = 0; i < replies.size(); i++) {
+                const UniValue& id = find_value(replies[i], "id");
+                if (!id.isNum() || id.get_int() < 0 || (size_t)id.get_int() >= vCommands.size())
+                    continue;
+                vRet[id.get_int()] = FormatReply(replies[i], fWait, vPrint[id.get_int()]);
+            }
+            // Connection succeeded, no need to retry.
+            break;
+        }
+        catch (const CConnectionFailed&) {
+            if (fWait)
+                MilliSleep(1000);
+            else
+                throw;
+        }
+    } while (fWait);
+}
+
+/** Run the commands read from standard input over one connection, -batchsize of them per request */
+static int CommandLineRPCBatch()
+{
+    int nRet = 0;
+    const size_t nBatchSize = std::max<int64_t>(GetArg("-batchsize", DEFAULT_BATCH_SIZE), 1);
+    CRPCConnection conn(true);
+    std::string line;
+    bool fEOF = false;
+    while (!fEOF) {
+        std::vector<std::vector<std::string> > vCommands;
+        while (vCommands.size() < nBatchSize) {
+            if (!std::getline(std::cin, line)) {
+                fEOF = true;
+                break;
+            }
+            std::vector<std::string> args;
+            boost::split(args, line, boost::is_any_of(" \t"), boost::token_compress_on);
+            args.erase(std::remove(args.begin(), args.end(), std::string()), args.end());
+            if (!args.empty())
+                vCommands.push_back(args);
+        }
+        if (vCommands.empty())
+            break;
+
+        std::vector<std::string> vPrint(vCommands.size());
+        std::vector<int> vRet(vCommands.size(), 0);
+        try {
+            if (nBatchSize == 1)
+                vRet[0] = CommandRPC(conn, vCommands[0], vPrint[0]);
+            else
+                BatchRPC(conn, vCommands, vPrint, vRet);
+        }
+        catch (const boost::thread_interrupted&) {
+            throw;
+        }
+        catch (const std::exception& e) {
+            for (size_t i = 0; i < vCommands.size(); i++) {
+                vPrint[i] = string("error: ") + e.what();
+                vRet[i] = EXIT_FAILURE;
+            }
+        }
+
+        // In the order the commands were read
+        for (size_t i = 0; i < vCommands.size(); i++) {
+            if (vPrint[i] != "")
+                fprintf((vRet[i] == 0 ? stdout : stderr), "%s\n", vPrint[i].c_str());
+            fflush(stdout);
+            if (vRet[i] != 0)
+                nRet = vRet[i];
+        }
+    }
+    return nRet;
 }
 
 int CommandLineRPC(int argc, char *argv[])
@@ -243,6 +464,11 @@ int CommandLineRPC(int argc, char *argv[])
             argv++;
         }
         std::vector<std::string> args = std::vector<std::string>(&argv[1], &argv[argc]);
+        if (GetBoolArg("-batch", false)) {
+            if (!args.empty())
+                throw runtime_error("-batch reads the commands from standard input only");
+            return CommandLineRPCBatch();
+        }
         if (GetBoolArg("-stdin", false)) {
             // Read one arg per line from stdin and append
             std::string line;
@@ -251,54 +477,8 @@ int CommandLineRPC(int argc, char *argv[])
         }
         if (args.size() < 1)
             throw runtime_error("too few parameters (need at least command)");
-        std::string strMethod = args[0];
-        UniValue params = RPCConvertValues(strMethod, std::vector<std::string>(args.begin()+1, args.end()));
-
-        // Execute and handle connection failures with -rpcwait
-        const bool fWait = GetBoolArg("-rpcwait", false);
-        do {
-            try {
-                const UniValue reply = CallRPC(strMethod, params);
-
-                // Parse reply
-                const UniValue& result = find_value(reply, "result");
-                const UniValue& error  = find_value(reply, "error");
-
-                if (!error.isNull()) {
-                    // Error
-                    int code = error["code"].get_int();
-                    if (fWait && code == RPC_IN_WARMUP)
-                        throw CConnectionFailed("server in warmup");
-                    strPrint = "error: " + error.write();
-                    nRet = abs(code);
-                    if (error.isObject())
-                    {
-                        UniValue errCode = find_value(error, "code");
-                        UniValue errMsg  = find_value(error, "message");
-                        strPrint = errCode.isNull() ? "" : "error code: "+errCode.getValStr()+"\n";
-
-                        if (errMsg.isStr())
-                            strPrint += "error message:\n"+errMsg.get_str();
-                    }
-                } else {
-                    // Result
-                    if (result.isNull())
-                        strPrint = "";
-                    else if (result.isStr())
-                        strPrint = result.get_str();
-                    else
-                        strPrint = result.write(2);
-                }
-                // Connection succeeded, no need to retry.
-                break;
-            }
-            catch (const CConnectionFailed&) {
-                if (fWait)
-                    MilliSleep(1000);
-                else
-                    throw;
-            }
-        } while (fWait);
+        CRPCConnection conn(false);
+        nRet = CommandRPC(conn, args, strPrint);
     }
     catch (const boost::thread_interrupted&) {
         throw;
@@ -23,12 +23,15 @@
 
 #include <stdio.h>
 
+#include <iostream>
+
 #include <boost/algorithm/string.hpp>
 #include <boost/assign/list_of.hpp>
 
 using namespace std;
 
 static bool fCreateBlank;
+static bool fStream;
 static map<string,UniValue> registers;
 static const int CONTINUE_EXECUTION=-1;
 
@@ -52,6 +55,7 @@ static int AppInitRawTx(int argc, char* argv[])
     }
 
     fCreateBlank = GetBoolArg("-create", false);
+    fStream = GetBoolArg("-stream", false);
 
     if (argc<2 || mapArgs.count("-?") || mapArgs.count("-h") || mapArgs.count("-help"))
     {
@@ -60,6 +64,7 @@ static int AppInitRawTx(int argc, char* argv[])
             _("Usage:") + "\n" +
               "  smartcash-tx [options] <hex-tx> [commands]  " + _("Update hex-encoded smartcash transaction") + "\n" +
               "  smartcash-tx [options] -create [commands]   " + _("Create hex-encoded smartcash transaction") + "\n" +
+              "  smartcash-tx [options] -stream              " + _("Read <hex-tx>|-create [commands] lines from standard input") + "\n" +
               "\n";
 
         fprintf(stdout, "%s", strUsage.c_str());
@@ -68,6 +73,7 @@ static int AppInitRawTx(int argc, char* argv[])
         strUsage += HelpMessageOpt("-?", _("This help message"));
         strUsage += HelpMessageOpt("-create", _("Create new, empty TX."));
         strUsage += HelpMessageOpt("-json", _("Select JSON output"));
+        strUsage += HelpMessageOpt("-stream", _("Read one transaction per line from standard input, as the hex-encoded transaction or -create followed by the commands separated by spaces, and write one result line for each"));
         strUsage += HelpMessageOpt("-txid", _("Output only the hex-encoded transaction id of the resultant transaction."));
         AppendParamsHelpMessages(strUsage);
 
@@ -564,7 +570,8 @@ static void OutputTxJSON(const CTransaction& tx)
     UniValue entry(UniValue::VOBJ);
     TxToUniv(tx, uint256(), entry);
 
-    string jsonOutput = entry.write(4);
+    // One line per transaction when streaming
+    string jsonOutput = entry.write(fStream ? 0 : 4);
     fprintf(stdout, "%s\n", jsonOutput.c_str());
 }
 
@@ -612,6 +619,58 @@ static string readStdin()
     return ret;
 }
 
+static void MutateTxArgs(CMutableTransaction& tx, const vector<string>& args)
+{
+    BOOST_FOREACH(const string& arg, args) {
+        string key, value;
+        size_t eqpos = arg.find('=');
+        if (eqpos == string::npos)
+            key = arg;
+        else {
+            key = arg.substr(0, eqpos);
+            value = arg.substr(eqpos + 1);
+        }
+
+        MutateTx(tx, key, value);
+    }
+}
+
+/** Handle the lines of standard input like separate invocations, without starting a process for each */
+static int StreamRawTx()
+{
+    int nRet = 0;
+    string line;
+    while (std::getline(std::cin, line)) {
+        vector<string> args;
+        boost::algorithm::trim(line);
+        if (line.empty())
+            continue;
+        boost::split(args, line, boost::is_any_of(" \t"), boost::token_compress_on);
+
+        try {
+            // Nothing carries over from the previous line
+            registers.clear();
+
+            CTransaction txDecodeTmp;
+            if (args[0] != "-create" && !DecodeHexTx(txDecodeTmp, args[0]))
+                throw runtime_error("invalid transaction encoding");
+
+            CMutableTransaction tx(txDecodeTmp);
+            MutateTxArgs(tx, vector<string>(args.begin() + 1, args.end()));
+
+            OutputTx(tx);
+        }
+        catch (const std::exception& e) {
+            // On stdout to keep one result line per input line
+            fprintf(stdout, "error: %s\n", e.what());
+            nRet = EXIT_FAILURE;
+        }
+        fflush(stdout);
+    }
+
+    return nRet;
+}
+
 static int CommandLineRawTx(int argc, char* argv[])
 {
     string strPrint;
@@ -624,6 +683,12 @@ static int CommandLineRawTx(int argc, char* argv[])
             argv++;
         }
 
+        if (fStream) {
+            if (argc > 1 || fCreateBlank)
+                throw runtime_error("-stream reads the transactions from standard input only");
+            return StreamRawTx();
+        }
+
         CTransaction txDecodeTmp;
         int startArg;
 
@@ -645,20 +710,7 @@ static int CommandLineRawTx(int argc, char* argv[])
             startArg = 1;
 
         CMutableTransaction tx(txDecodeTmp);
-
-        for (int i = startArg; i < argc; i++) {
-            string arg = argv[i];
-            string key, value;
-            size_t eqpos = arg.find('=');
-            if (eqpos == string::npos)
-                key = arg;
-            else {
-                key = arg.substr(0, eqpos);
-                value = arg.substr(eqpos + 1);
-            }
-
-            MutateTx(tx, key, value);
-        }
+        MutateTxArgs(tx, vector<string>(argv + startArg, argv + argc));
 
         OutputTx(tx);
     }
@@ -0,0 +1,175 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilecache.h"
+
+#include "util.h"
+
+#include <boost/filesystem/operations.hpp>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CMappedBlockFile::~CMappedBlockFile()
+{
+#ifndef WIN32
+    if( pData ) munmap((void*)pData, nSize);
+#endif
+}
+
+bool CMappedBlockFile::Open(const boost::filesystem::path &path)
+{
+#ifndef WIN32
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if( fd < 0 ) return false;
+
+    struct stat st;
+    if( fstat(fd, &st) != 0 || st.st_size <= 0 ){
+        close(fd);
+        return false;
+    }
+
+    void *pMapped = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if( pMapped == MAP_FAILED ) return false;
+
+    pData = (const unsigned char*)pMapped;
+    nSize = st.st_size;
+
+    return true;
+#else
+    // stdio reads are used instead
+    return false;
+#endif
+}
+
+std::shared_ptr<const CMappedBlockFile> CBlockFileCache::Get(const boost::filesystem::path &path, size_t nMinSize)
+{
+    std::string strPath = path.string();
+
+    LOCK(cs);
+
+    for( auto it = listFiles.begin(); it != listFiles.end(); ++it ){
+        if( it->first != strPath ) continue;
+
+        if( it->second->size() >= nMinSize ){
+            listFiles.splice(listFiles.begin(), listFiles, it);
+            return it->second;
+        }
+
+        // the file has grown since it got mapped
+        listFiles.erase(it);
+        break;
+    }
+
+    std::shared_ptr<CMappedBlockFile> file = std::make_shared<CMappedBlockFile>();
+    if( !file->Open(path) || file->size() < nMinSize ) return nullptr;
+
+    listFiles.push_front(Entry(strPath, file));
+    while( listFiles.size() > nMaxFiles ) listFiles.pop_back();
+
+    return file;
+}
+
+void CBlockFileCache::Erase(const boost::filesystem::path &path)
+{
+    std::string strPath = path.string();
+
+    LOCK(cs);
+    listFiles.remove_if([&strPath](const Entry &entry) { return entry.first == strPath; });
+}
+
+void CBlockFileCache::Clear()
+{
+    LOCK(cs);
+    listFiles.clear();
+}
+
+size_t CBlockFileCache::size()
+{
+    LOCK(cs);
+    return listFiles.size();
+}
+
+CBlockFileWriter::~CBlockFileWriter()
+{
+    Close();
+}
+
+void CBlockFileWriter::CloseFile()
+{
+    if( !file ) return;
+
+    FileCommit(file);
+    fclose(file);
+    file = nullptr;
+    strPath.clear();
+    fDirty = false;
+}
+
+bool CBlockFileWriter::Write(const boost::filesystem::path &path, uint64_t nPosIn, const char *pch, size_t nSize)
+{
+    std::string strPathIn = path.string();
+
+    LOCK(cs);
+
+    if( file && strPath != strPathIn ) CloseFile();
+
+    if( !file ){
+        boost::filesystem::create_directories(path.parent_path());
+        file = fopen(strPathIn.c_str(), "rb+");
+        if( !file ) file = fopen(strPathIn.c_str(), "wb+");
+        if( !file ) return error("%s: Unable to open file %s", __func__, strPathIn);
+
+        vBuffer.resize(BLOCKFILE_WRITE_BUFFER_SIZE);
+        setvbuf(file, vBuffer.data(), _IOFBF, vBuffer.size());
+        strPath = strPathIn;
+        nPos = (uint64_t)-1;
+    }
+
+    if( nPosIn != nPos && fseek(file, nPosIn, SEEK_SET) ){
+        CloseFile();
+        return error("%s: Unable to seek to position %u of %s", __func__, nPosIn, strPathIn);
+    }
+
+    if( fwrite(pch, 1, nSize, file) != nSize ){
+        CloseFile();
+        return error("%s: Write to %s failed", __func__, strPathIn);
+    }
+
+    nPos = nPosIn + nSize;
+    fDirty = true;
+    return true;
+}
+
+void CBlockFileWriter::Flush(const boost::filesystem::path &path)
+{
+    LOCK(cs);
+
+    if( !fDirty || strPath != path.string() ) return;
+
+    fflush(file);
+    fDirty = false;
+}
+
+void CBlockFileWriter::Commit()
+{
+    LOCK(cs);
+
+    if( !file ) return;
+
+    FileCommit(file);
+    fDirty = false;
+}
+
+void CBlockFileWriter::Close()
+{
+    LOCK(cs);
+    CloseFile();
+}
@@ -0,0 +1,104 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SMARTCASH_BLOCKFILECACHE_H
+#define SMARTCASH_BLOCKFILECACHE_H
+
+#include "serialize.h"
+#include "streams.h"
+#include "sync.h"
+
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+//! Number of block and undo files kept mapped by the block file cache
+static const size_t DEFAULT_BLOCKFILE_CACHE_FILES = 8;
+//! Bytes of block or undo data collected by the block file writer before they are written out
+static const size_t BLOCKFILE_WRITE_BUFFER_SIZE = 4 << 20;
+
+/** A block or undo file mapped read-only into memory. */
+class CMappedBlockFile
+{
+private:
+    const unsigned char *pData;
+    size_t nSize;
+
+    CMappedBlockFile(const CMappedBlockFile&);
+    void operator=(const CMappedBlockFile&);
+
+public:
+    CMappedBlockFile() : pData(nullptr), nSize(0) {}
+    ~CMappedBlockFile();
+
+    //! Map the file at path, false if it can't be mapped on this platform or is empty.
+    bool Open(const boost::filesystem::path &path);
+
+    const unsigned char* data() const { return pData; }
+    size_t size() const { return nSize; }
+};
+
+/** Keeps the most recently read block and undo files mapped so reads of blocks
+ *  don't have to open, seek and close the file each time. The least recently used
+ *  mapping is dropped once more than the maximum are mapped. Mappings are shared,
+ *  a reader keeps its mapping alive even if it gets evicted meanwhile.
+ */
+class CBlockFileCache
+{
+private:
+    typedef std::pair<std::string, std::shared_ptr<const CMappedBlockFile> > Entry;
+
+    CCriticalSection cs;
+    std::list<Entry> listFiles; // most recently used first
+    size_t nMaxFiles;
+
+public:
+    explicit CBlockFileCache(size_t nMaxFilesIn = DEFAULT_BLOCKFILE_CACHE_FILES) : nMaxFiles(nMaxFilesIn) {}
+
+    //! Get a mapping of path that covers at least nMinSize bytes, mapping the file again if it has grown.
+    std::shared_ptr<const CMappedBlockFile> Get(const boost::filesystem::path &path, size_t nMinSize);
+    //! Drop the mapping of path, e.g. before the file gets removed.
+    void Erase(const boost::filesystem::path &path);
+    void Clear();
+    size_t size();
+};
+
+/** Appends records to the block or undo file written last, which is kept open with a large
+ *  stdio buffer so the records of consecutive blocks get written together instead of opening,
+ *  seeking and closing the file for each of them. Buffered records are handed to the OS before
+ *  the file gets read and when another file is written, they reach the disk on Commit only.
+ */
+class CBlockFileWriter
+{
+private:
+    CCriticalSection cs;
+    std::string strPath;
+    FILE *file;
+    uint64_t nPos;  // where the next record goes without a seek
+    bool fDirty;    // written since the last flush
+    std::vector<char> vBuffer;
+
+    CBlockFileWriter(const CBlockFileWriter&);
+    void operator=(const CBlockFileWriter&);
+
+    void CloseFile();
+
+public:
+    CBlockFileWriter() : file(nullptr), nPos(0), fDirty(false) {}
+    ~CBlockFileWriter();
+
+    //! Write nSize bytes at nPosIn of the file at path, closing the file written before if it is another one.
+    bool Write(const boost::filesystem::path &path, uint64_t nPosIn, const char *pch, size_t nSize);
+    //! Hand the buffered records of path to the OS, so reading the file returns them.
+    void Flush(const boost::filesystem::path &path);
+    //! Write the buffered records and sync the file to disk.
+    void Commit();
+    //! Commit and close the file, e.g. before it gets truncated or removed.
+    void Close();
+};
+
+#endif // SMARTCASH_BLOCKFILECACHE_H
@@ -8,18 +8,18 @@
 using namespace BlockSizeCalculator;
 using namespace std;
 
-static std::vector<unsigned int> blocksizes;
-static bool sorted = false;
+/** Sizes of the blocks in the current median window, keyed by height */
+static CSlidingMedian<int, unsigned int> blocksizes;
+/** Last block of the branch the window currently covers */
+static CBlockIndex* pindexWindowTip = NULL;
+/** Number of blocks the window was built for */
+static unsigned int nWindowBlocks = 0;
 
-unsigned int BlockSizeCalculator::ComputeBlockSize(CBlockIndex *pblockindex, unsigned int pastblocks) {
+/** Limit for a median block size, 0 if the median is not known */
+static unsigned int GetMaxBlockSizeForMedian(unsigned int proposedMaxBlockSize) {
 
-	unsigned int proposedMaxBlockSize = 0;
 	unsigned int result = OLD_MAX_BLOCK_SIZE;
 
-	LOCK(cs_main);
-
-	proposedMaxBlockSize = ::GetMedianBlockSize(pblockindex, pastblocks);
-
 	if (proposedMaxBlockSize > 0) {
 		//Absolute max block size will be 2^32-1 bytes due to the fact that unsigned int's are 4 bytes
 		result = proposedMaxBlockSize * MAX_BLOCK_SIZE_INCREASE_MULTIPLE;
@@ -35,78 +35,206 @@ unsigned int BlockSizeCalculator::ComputeBlockSize(CBlockIndex *pblockindex, uns
 
 }
 
+/** Mean of the two middle elements (identical for odd windows), rounded down */
+static unsigned int GetMedian(const CSlidingMedian<int, unsigned int>& window) {
+
+	uint64_t median = (uint64_t)window.LowerMedian() + window.UpperMedian();
+	return static_cast<unsigned int>(median / 2);
+
+}
+
+unsigned int BlockSizeCalculator::ComputeBlockSize(CBlockIndex *pblockindex, unsigned int pastblocks) {
+
+	unsigned int proposedMaxBlockSize = 0;
+	unsigned int result = OLD_MAX_BLOCK_SIZE;
+
+	LOCK(cs_main);
+
+	// Block templates checked by TestBlockValidity have no hash and no known size,
+	// they never enter the median window and get the limit of the block they build on
+	if (pblockindex->phashBlock == NULL && !(pblockindex->nStatus & BLOCK_HAVE_SIZE) && pblockindex->pprev != NULL) {
+		return ComputeBlockSize(pblockindex->pprev, pastblocks);
+	}
+
+	// Only the consensus window is remembered per block index
+	bool fCache = pastblocks == NUM_BLOCKS_FOR_MEDIAN_BLOCK;
+	if (fCache && pblockindex->nMaxBlockSize != 0) {
+		return pblockindex->nMaxBlockSize;
+	}
+
+	proposedMaxBlockSize = ::GetMedianBlockSize(pblockindex, pastblocks);
+	result = GetMaxBlockSizeForMedian(proposedMaxBlockSize);
+
+	if (fCache) {
+		pblockindex->nMaxBlockSize = result;
+	}
+
+	return result;
+
+}
+
 inline unsigned int BlockSizeCalculator::GetMedianBlockSize(
 		CBlockIndex *pblockindex, unsigned int pastblocks) {
 
-	blocksizes = ::GetBlockSizes(pblockindex, pastblocks);
-
-	if(!sorted) {
-		std::sort(blocksizes.begin(), blocksizes.end());
-		sorted = true;
+	if (pblockindex == NULL || pblockindex->nHeight < (int)pastblocks) {
+		return 0;
 	}
 
-	unsigned int vsize = blocksizes.size();
-	if (vsize == pastblocks) {
-		double median = 0;
-		if ((vsize % 2) == 0) {
-			median = (blocksizes[vsize / 2] + blocksizes[(vsize / 2) - 1]) / 2.0;
-		} else {
-			median = blocksizes[vsize / 2];
-		}
-		return static_cast<unsigned int>(floor(median));
-	} else {
+	::UpdateBlockSizes(pblockindex, pastblocks);
+
+	if (blocksizes.size() != pastblocks) {
 		return 0;
 	}
 
+	return GetMedian(blocksizes);
+
 }
 
-inline std::vector<unsigned int> BlockSizeCalculator::GetBlockSizes(
-		CBlockIndex *pblockindex, unsigned int pastblocks) {
+static void AddBlockSize(CBlockIndex *pblockindex) {
 
-	if (pblockindex->nHeight < (int)pastblocks) {
-		return blocksizes;
+	int blocksize = ::GetBlockSize(pblockindex);
+	if (blocksize != -1) {
+		blocksizes.Insert(pblockindex->nHeight, blocksize);
 	}
 
+}
+
+static void RebuildBlockSizes(CBlockIndex *pblockindex, unsigned int pastblocks) {
+
+	blocksizes.clear();
+	pindexWindowTip = pblockindex;
+	nWindowBlocks = pastblocks;
+
 	int firstBlock = pblockindex->nHeight - pastblocks;
 
-	if (blocksizes.size() > 0) {
+	while (pblockindex != NULL && pblockindex->nHeight > firstBlock) {
+		AddBlockSize(pblockindex);
+		pblockindex = pblockindex->pprev;
+	}
+
+}
+
+inline void BlockSizeCalculator::UpdateBlockSizes(
+		CBlockIndex *pblockindex, unsigned int pastblocks) {
 
-		int latestBlockSize = ::GetBlockSize(pblockindex);
+	if (pindexWindowTip == NULL || nWindowBlocks != pastblocks) {
+		RebuildBlockSizes(pblockindex, pastblocks);
+		return;
+	}
 
-		if (latestBlockSize != -1) {
+	// Walk the window back to the fork point with the requested branch
+	// (DisconnectTip / reorgs), re-adding the block that slides in at the front
+	unsigned int nSteps = 0;
+	while (pindexWindowTip->nHeight > pblockindex->nHeight ||
+			pblockindex->GetAncestor(pindexWindowTip->nHeight) != pindexWindowTip) {
 
-			CBlockIndex *firstBlockIndex = chainActive[firstBlock];
-			int oldestBlockSize = ::GetBlockSize(firstBlockIndex);
-			if (oldestBlockSize != -1) {
-				std::vector<unsigned int>::iterator it;
-				it = std::find(blocksizes.begin(), blocksizes.end(),
-						oldestBlockSize);
-				if (it != blocksizes.end()) {
-					blocksizes.erase(it);
-					it = std::lower_bound(blocksizes.begin(), blocksizes.end(),
-							latestBlockSize);
-					blocksizes.insert(it, latestBlockSize);
-				}
-			}
+		if (++nSteps > pastblocks || pindexWindowTip->pprev == NULL) {
+			RebuildBlockSizes(pblockindex, pastblocks);
+			return;
+		}
 
+		blocksizes.Erase(pindexWindowTip->nHeight);
+		int frontBlock = pindexWindowTip->nHeight - pastblocks;
+		if (frontBlock >= 0) {
+			AddBlockSize(pindexWindowTip->GetAncestor(frontBlock));
 		}
+		pindexWindowTip = pindexWindowTip->pprev;
+	}
 
-	} else {
+	if (pblockindex->nHeight - pindexWindowTip->nHeight > (int)pastblocks) {
+		RebuildBlockSizes(pblockindex, pastblocks);
+		return;
+	}
 
-		while (pblockindex != NULL && pblockindex->nHeight > firstBlock) {
+	// Then slide it forward along the branch
+	while (pindexWindowTip != pblockindex) {
+		CBlockIndex *pindexNext = pblockindex->GetAncestor(pindexWindowTip->nHeight + 1);
+		blocksizes.Erase(pindexNext->nHeight - pastblocks);
+		AddBlockSize(pindexNext);
+		pindexWindowTip = pindexNext;
+	}
 
-			int blocksize = ::GetBlockSize(pblockindex);
-			if (blocksize != -1) {
+}
 
-				blocksizes.push_back(blocksize);
-			}
+void BlockSizeCalculator::Clear() {
 
-			pblockindex = pblockindex->pprev;
+	LOCK(cs_main);
+	blocksizes.clear();
+	pindexWindowTip = NULL;
+	nWindowBlocks = 0;
+
+}
+
+/** The consensus window ending at pblockindex: a copy of the cached one if it
+ *  ends there, otherwise built from the sizes kept in the block index */
+static void GetWindow(CBlockIndex *pblockindex, CSlidingMedian<int, unsigned int>& window) {
+
+	AssertLockHeld(cs_main);
+
+	if (pindexWindowTip == pblockindex && nWindowBlocks == NUM_BLOCKS_FOR_MEDIAN_BLOCK) {
+		window = blocksizes;
+		return;
+	}
+
+	window.clear();
+
+	int firstBlock = pblockindex->nHeight - NUM_BLOCKS_FOR_MEDIAN_BLOCK;
+
+	while (pblockindex != NULL && pblockindex->nHeight > firstBlock) {
+		if (pblockindex->nStatus & BLOCK_HAVE_SIZE) {
+			window.Insert(pblockindex->nHeight, pblockindex->nSize);
 		}
+		pblockindex = pblockindex->pprev;
+	}
+
+}
 
+BlockSizeCalculator::WindowStats BlockSizeCalculator::GetWindowStats(CBlockIndex *pblockindex) {
+
+	LOCK(cs_main);
+
+	CSlidingMedian<int, unsigned int> window;
+	GetWindow(pblockindex, window);
+
+	WindowStats stats;
+	stats.nHeight = pblockindex->nHeight;
+	stats.nBlocks = window.size();
+	bool fFull = pblockindex->nHeight >= (int)NUM_BLOCKS_FOR_MEDIAN_BLOCK && window.size() == NUM_BLOCKS_FOR_MEDIAN_BLOCK;
+	stats.nMedian = fFull ? GetMedian(window) : 0;
+	stats.nMaxBlockSize = GetMaxBlockSizeForMedian(stats.nMedian);
+	stats.nTotalSize = 0;
+	stats.nLargest = 0;
+
+	for (CSlidingMedian<int, unsigned int>::const_iterator it = window.begin(); it != window.end(); ++it) {
+		stats.nTotalSize += it->second;
+		stats.nLargest = std::max(stats.nLargest, it->second);
 	}
 
-	return blocksizes;
+	return stats;
+
+}
+
+unsigned int BlockSizeCalculator::ForecastBlockSize(CBlockIndex *pblockindex, unsigned int nBlocks, unsigned int nSize) {
+
+	LOCK(cs_main);
+
+	CSlidingMedian<int, unsigned int> window;
+	GetWindow(pblockindex, window);
+
+	// Blocks beyond the window length only replace blocks added here
+	nBlocks = std::min(nBlocks, NUM_BLOCKS_FOR_MEDIAN_BLOCK);
+
+	for (unsigned int i = 1; i <= nBlocks; ++i) {
+		int nHeight = pblockindex->nHeight + i;
+		window.Erase(nHeight - NUM_BLOCKS_FOR_MEDIAN_BLOCK);
+		window.Insert(nHeight, nSize);
+	}
+
+	if (pblockindex->nHeight + (int)nBlocks < (int)NUM_BLOCKS_FOR_MEDIAN_BLOCK || window.size() != NUM_BLOCKS_FOR_MEDIAN_BLOCK) {
+		return OLD_MAX_BLOCK_SIZE;
+	}
+
+	return GetMaxBlockSizeForMedian(GetMedian(window));
 
 }
 
@@ -116,6 +244,12 @@ inline int BlockSizeCalculator::GetBlockSize(CBlockIndex *pblockindex) {
 		return -1;
 	}
 
+	if (pblockindex->nStatus & BLOCK_HAVE_SIZE) {
+		return pblockindex->nSize;
+	}
+
+	// Index entries written before BLOCK_HAVE_SIZE existed: read the size
+	// prefix from the block file once and remember it in the index
 	const CDiskBlockPos& pos = pblockindex->GetBlockPos();
 
 	CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
@@ -129,8 +263,14 @@ inline int BlockSizeCalculator::GetBlockSize(CBlockIndex *pblockindex) {
 	fseek(blockFile, filePos - sizeof(uint32_t), SEEK_SET);
 
 	uint32_t size = 0;
-	fread(&size, sizeof(uint32_t), 1, blockFile);
+	size_t nRead = fread(&size, sizeof(uint32_t), 1, blockFile);
 	fclose(blockFile);
+
+	if (nRead != 1) {
+		return -1;
+	}
+
+	SetBlockIndexSize(pblockindex, size);
 	return (unsigned int) size;
 
 }
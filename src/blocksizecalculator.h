@@ -16,13 +16,30 @@
 #include "consensus/consensus.h"
 #include "chain.h"
 #include "clientversion.h"
+#include "slidingmedian.h"
 
 using namespace std;
 
 namespace BlockSizeCalculator {
     unsigned int ComputeBlockSize(CBlockIndex*, unsigned int pastblocks = NUM_BLOCKS_FOR_MEDIAN_BLOCK);
     inline unsigned int GetMedianBlockSize(CBlockIndex*, unsigned int pastblocks = NUM_BLOCKS_FOR_MEDIAN_BLOCK);
-    inline std::vector<unsigned int> GetBlockSizes(CBlockIndex*, unsigned int pastblocks = NUM_BLOCKS_FOR_MEDIAN_BLOCK);
+    inline void UpdateBlockSizes(CBlockIndex*, unsigned int pastblocks = NUM_BLOCKS_FOR_MEDIAN_BLOCK);
     inline int GetBlockSize(CBlockIndex*);
+    /** Drop the cached median window, e.g. when the block index is unloaded */
+    void Clear();
+
+    /** Block sizes in the consensus median window ending at a block */
+    struct WindowStats {
+        int nHeight;                //!< last block of the window
+        unsigned int nBlocks;       //!< blocks with a known size in the window
+        unsigned int nMedian;       //!< median block size, 0 unless the window is full
+        unsigned int nMaxBlockSize; //!< limit resulting from the median
+        uint64_t nTotalSize;        //!< sum of the block sizes
+        unsigned int nLargest;      //!< size of the largest block
+    };
+    /** Stats of the window ending at pindex. Uses the cached window if it ends there, never reads block files */
+    WindowStats GetWindowStats(CBlockIndex* pindex);
+    /** Limit once nBlocks more blocks of nSize bytes follow pindex */
+    unsigned int ForecastBlockSize(CBlockIndex* pindex, unsigned int nBlocks, unsigned int nSize);
 }
 #endif
@@ -0,0 +1,67 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blocktimeindex.h"
+
+#include "chain.h"
+
+#include <algorithm>
+#include <limits>
+
+static const CBlockIndex* LastCommonAncestor(const CBlockIndex* pa, const CBlockIndex* pb)
+{
+    if (pa == NULL || pb == NULL)
+        return NULL;
+    if (pa->nHeight > pb->nHeight)
+        pa = pa->GetAncestor(pb->nHeight);
+    else if (pb->nHeight > pa->nHeight)
+        pb = pb->GetAncestor(pa->nHeight);
+    while (pa != pb) {
+        pa = pa->pprev;
+        pb = pb->pprev;
+    }
+    return pa;
+}
+
+void CBlockTimeIndex::SetTip(const CBlockIndex* pindexNew)
+{
+    if (pindexNew == pindexTip)
+        return;
+
+    const CBlockIndex* pindexFork = LastCommonAncestor(pindexTip, pindexNew);
+
+    if (pindexFork == NULL) {
+        vEntries.clear();
+    } else {
+        for (const CBlockIndex* pindex = pindexTip; pindex != pindexFork; pindex = pindex->pprev) {
+            std::pair<uint32_t, int> entry(pindex->nTime, pindex->nHeight);
+            vEntries.erase(std::lower_bound(vEntries.begin(), vEntries.end(), entry));
+        }
+    }
+
+    size_t nOld = vEntries.size();
+    for (const CBlockIndex* pindex = pindexNew; pindex != pindexFork; pindex = pindex->pprev)
+        vEntries.push_back(std::make_pair(pindex->nTime, pindex->nHeight));
+
+    if (vEntries.size() - nOld == 1) {
+        // A single new tip, its time is most likely the latest one
+        std::pair<uint32_t, int> entry = vEntries.back();
+        vEntries.pop_back();
+        vEntries.insert(std::upper_bound(vEntries.begin(), vEntries.end(), entry), entry);
+    } else {
+        std::sort(vEntries.begin() + nOld, vEntries.end());
+        std::inplace_merge(vEntries.begin(), vEntries.begin() + nOld, vEntries.end());
+    }
+
+    pindexTip = pindexNew;
+}
+
+void CBlockTimeIndex::FindRange(unsigned int nLow, unsigned int nHigh, std::vector<int>& vHeights) const
+{
+    std::vector<std::pair<uint32_t, int> >::const_iterator it =
+        std::lower_bound(vEntries.begin(), vEntries.end(), std::make_pair((uint32_t)nLow, std::numeric_limits<int>::min()));
+
+    for (; it != vEntries.end() && it->first <= nHigh; ++it)
+        vHeights.push_back(it->second);
+}
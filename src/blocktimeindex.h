@@ -0,0 +1,39 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SMARTCASH_BLOCKTIMEINDEX_H
+#define SMARTCASH_BLOCKTIMEINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+class CBlockIndex;
+
+/**
+ * The blocks of a chain sorted by their time, for timestamp range lookups
+ * without a database. It follows the chain tip by walking back to the fork
+ * point, block times are close to sorted so a new tip is inserted near the
+ * end of the array.
+ */
+class CBlockTimeIndex
+{
+    //! Time and height of every block of the chain, sorted
+    std::vector<std::pair<uint32_t, int> > vEntries;
+    const CBlockIndex* pindexTip;
+
+public:
+    CBlockTimeIndex() : pindexTip(nullptr) {}
+
+    /** Follow the chain to pindexNew, NULL empties the index */
+    void SetTip(const CBlockIndex* pindexNew);
+    const CBlockIndex* Tip() const { return pindexTip; }
+    size_t size() const { return vEntries.size(); }
+
+    /** Heights of the blocks with a time from nLow to nHigh, ordered by time */
+    void FindRange(unsigned int nLow, unsigned int nHigh, std::vector<int>& vHeights) const;
+};
+
+#endif // SMARTCASH_BLOCKTIMEINDEX_H
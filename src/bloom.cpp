@@ -6,6 +6,7 @@
 
 #include "primitives/transaction.h"
 #include "hash.h"
+#include "memusage.h"
 #include "script/script.h"
 #include "script/standard.h"
 #include "random.h"
@@ -52,10 +53,10 @@ CBloomFilter::CBloomFilter(unsigned int nElements, double nFPRate, unsigned int
 {
 }
 
-inline unsigned int CBloomFilter::Hash(unsigned int nHashNum, const std::vector<unsigned char>& vDataToHash) const
+inline unsigned int CBloomFilter::Hash(unsigned int nHashNum, const unsigned char* pDataToHash, size_t nDataSize) const
 {
     // 0xFBA4C795 chosen as it guarantees a reasonable bit difference between nHashNum values.
-    return MurmurHash3(nHashNum * 0xFBA4C795 + nTweak, vDataToHash) % (vData.size() * 8);
+    return MurmurHash3(nHashNum * 0xFBA4C795 + nTweak, pDataToHash, nDataSize) % (vData.size() * 8);
 }
 
 void CBloomFilter::insert(const vector<unsigned char>& vKey)
@@ -64,7 +65,7 @@ void CBloomFilter::insert(const vector<unsigned char>& vKey)
         return;
     for (unsigned int i = 0; i < nHashFuncs; i++)
     {
-        unsigned int nIndex = Hash(i, vKey);
+        unsigned int nIndex = Hash(i, vKey.data(), vKey.size());
         // Sets bit nIndex of vData
         vData[nIndex >> 3] |= (1 << (7 & nIndex));
     }
@@ -86,6 +87,11 @@ void CBloomFilter::insert(const uint256& hash)
 }
 
 bool CBloomFilter::contains(const vector<unsigned char>& vKey) const
+{
+    return contains(vKey.data(), vKey.size());
+}
+
+bool CBloomFilter::contains(const unsigned char* pKey, size_t nKeySize) const
 {
     if (isFull)
         return true;
@@ -93,7 +99,7 @@ bool CBloomFilter::contains(const vector<unsigned char>& vKey) const
         return false;
     for (unsigned int i = 0; i < nHashFuncs; i++)
     {
-        unsigned int nIndex = Hash(i, vKey);
+        unsigned int nIndex = Hash(i, pKey, nKeySize);
         // Checks bit nIndex of vData
         if (!(vData[nIndex >> 3] & (1 << (7 & nIndex))))
             return false;
@@ -203,6 +209,104 @@ bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx)
     return false;
 }
 
+bool CBloomFilter::IsRelevantAndUpdate(const CBlockFilterElements& elements, size_t nTx)
+{
+    // Same matches and updates as for the transaction itself, see above
+    if (isFull)
+        return true;
+    if (isEmpty)
+        return false;
+    const uint256& hash = elements.vHashes[nTx];
+    bool fFound = contains(hash);
+
+    uint32_t i = elements.vTxBegin[nTx];
+    const uint32_t nEnd = elements.vTxBegin[nTx + 1];
+    for (; i < nEnd && elements.vElements[i].nType == CBlockFilterElements::OUTPUT_PUSH; i++)
+    {
+        const CBlockFilterElements::Element& element = elements.vElements[i];
+        if (!contains(&elements.vchData[element.nBegin], element.nSize))
+            continue;
+
+        fFound = true;
+        if ((nFlags & BLOOM_UPDATE_MASK) == BLOOM_UPDATE_ALL ||
+                ((nFlags & BLOOM_UPDATE_MASK) == BLOOM_UPDATE_P2PUBKEY_ONLY && element.fPubKeyOrMultisig))
+            insert(COutPoint(hash, element.nOut));
+
+        // Only the first match of an output counts
+        while (i + 1 < nEnd && elements.vElements[i + 1].nType == CBlockFilterElements::OUTPUT_PUSH &&
+                elements.vElements[i + 1].nOut == element.nOut)
+            i++;
+    }
+
+    if (fFound)
+        return true;
+
+    for (; i < nEnd; i++)
+    {
+        const CBlockFilterElements::Element& element = elements.vElements[i];
+        if (contains(&elements.vchData[element.nBegin], element.nSize))
+            return true;
+    }
+
+    return false;
+}
+
+static void AddScriptPushes(CBlockFilterElements& elements, const CScript& script, uint8_t nType, uint32_t nOut, bool fPubKeyOrMultisig)
+{
+    CScript::const_iterator pc = script.begin();
+    vector<unsigned char> data;
+    while (pc < script.end())
+    {
+        opcodetype opcode;
+        if (!script.GetOp(pc, opcode, data))
+            break;
+        if (data.size() == 0)
+            continue;
+        CBlockFilterElements::Element element = {(uint32_t)elements.vchData.size(), (uint32_t)data.size(), nOut, nType, fPubKeyOrMultisig};
+        elements.vElements.push_back(element);
+        elements.vchData.insert(elements.vchData.end(), data.begin(), data.end());
+    }
+}
+
+CBlockFilterElements::CBlockFilterElements(const std::vector<CTransaction>& vtx)
+{
+    vHashes.reserve(vtx.size());
+    vTxBegin.reserve(vtx.size() + 1);
+
+    for (const CTransaction& tx : vtx)
+    {
+        vHashes.push_back(tx.GetHash());
+        vTxBegin.push_back(vElements.size());
+
+        for (unsigned int i = 0; i < tx.vout.size(); i++)
+        {
+            const CScript& scriptPubKey = tx.vout[i].scriptPubKey;
+            txnouttype type;
+            vector<vector<unsigned char> > vSolutions;
+            bool fPubKeyOrMultisig = Solver(scriptPubKey, type, vSolutions) && (type == TX_PUBKEY || type == TX_MULTISIG);
+            AddScriptPushes(*this, scriptPubKey, OUTPUT_PUSH, i, fPubKeyOrMultisig);
+        }
+
+        for (const CTxIn& txin : tx.vin)
+        {
+            CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+            stream << txin.prevout;
+            Element element = {(uint32_t)vchData.size(), (uint32_t)stream.size(), 0, PREVOUT, false};
+            vElements.push_back(element);
+            vchData.insert(vchData.end(), stream.begin(), stream.end());
+
+            AddScriptPushes(*this, txin.scriptSig, INPUT_PUSH, 0, false);
+        }
+    }
+    vTxBegin.push_back(vElements.size());
+}
+
+size_t CBlockFilterElements::DynamicMemoryUsage() const
+{
+    return memusage::DynamicUsage(vHashes) + memusage::DynamicUsage(vTxBegin) +
+           memusage::DynamicUsage(vElements) + memusage::DynamicUsage(vchData);
+}
+
 void CBloomFilter::UpdateEmptyFull()
 {
     bool full = true;
@@ -6,12 +6,12 @@
 #define BITCOIN_BLOOM_H
 
 #include "serialize.h"
+#include "uint256.h"
 
 #include <vector>
 
 class COutPoint;
 class CTransaction;
-class uint256;
 
 //! 20,000 items with fp rate < 0.1% or 10,000 items and <0.0001%
 static const unsigned int MAX_BLOOM_FILTER_SIZE = 36000; // bytes
@@ -30,6 +30,45 @@ enum bloomflags
     BLOOM_UPDATE_MASK = 3,
 };
 
+/**
+ * The data elements of the transactions of a block that CBloomFilter::IsRelevantAndUpdate looks
+ * at: the pushes of each scriptPubKey, the outpoints each input spends and the pushes of each
+ * scriptSig. They are extracted once per block, so matching the block against the filters of
+ * many peers only hashes the elements instead of parsing the same scripts over and over.
+ */
+class CBlockFilterElements
+{
+public:
+    enum ElementType : uint8_t
+    {
+        OUTPUT_PUSH,
+        PREVOUT,
+        INPUT_PUSH,
+    };
+
+    struct Element
+    {
+        uint32_t nBegin;            //!< offset of the data in vchData
+        uint32_t nSize;
+        uint32_t nOut;              //!< index of the output an OUTPUT_PUSH belongs to
+        uint8_t nType;
+        bool fPubKeyOrMultisig;     //!< whether the output of an OUTPUT_PUSH pays to a pubkey or multisig
+    };
+
+    //! txid of each transaction
+    std::vector<uint256> vHashes;
+    //! index of the first element of each transaction in vElements, followed by the number of elements
+    std::vector<uint32_t> vTxBegin;
+    //! elements of all transactions, those of the outputs of a transaction first
+    std::vector<Element> vElements;
+    std::vector<unsigned char> vchData;
+
+    explicit CBlockFilterElements(const std::vector<CTransaction>& vtx);
+
+    size_t GetTransactionCount() const { return vHashes.size(); }
+    size_t DynamicMemoryUsage() const;
+};
+
 /**
  * BloomFilter is a probabilistic filter which SPV clients provide
  * so that we can filter the transactions we send them.
@@ -51,7 +90,8 @@ private:
     unsigned int nTweak;
     unsigned char nFlags;
 
-    unsigned int Hash(unsigned int nHashNum, const std::vector<unsigned char>& vDataToHash) const;
+    unsigned int Hash(unsigned int nHashNum, const unsigned char* pDataToHash, size_t nDataSize) const;
+    bool contains(const unsigned char* pKey, size_t nKeySize) const;
 
     // Private constructor for CRollingBloomFilter, no restrictions on size
     CBloomFilter(unsigned int nElements, double nFPRate, unsigned int nTweak);
@@ -98,6 +138,9 @@ public:
     //! Also adds any outputs which match the filter to the filter (to match their spending txes)
     bool IsRelevantAndUpdate(const CTransaction& tx);
 
+    //! The same for transaction nTx of the block elements were extracted from
+    bool IsRelevantAndUpdate(const CBlockFilterElements& elements, size_t nTx);
+
     //! Checks for empty and full filters to avoid wasting cpu
     void UpdateEmptyFull();
 };
@@ -11,6 +11,7 @@ using namespace std;
  * CChain implementation
  */
 void CChain::SetTip(CBlockIndex *pindex) {
+    tipLocator.reset();
     if (pindex == NULL) {
         vChain.clear();
         return;
@@ -23,12 +24,13 @@ void CChain::SetTip(CBlockIndex *pindex) {
 }
 
 CBlockLocator CChain::GetLocator(const CBlockIndex *pindex) const {
+    if (!pindex || pindex == Tip())
+        return *GetTipLocator();
+
     int nStep = 1;
     std::vector<uint256> vHave;
     vHave.reserve(32);
 
-    if (!pindex)
-        pindex = Tip();
     while (pindex) {
         vHave.push_back(pindex->GetBlockHash());
         // Stop when we have added the genesis block.
@@ -50,14 +52,39 @@ CBlockLocator CChain::GetLocator(const CBlockIndex *pindex) const {
     return CBlockLocator(vHave);
 }
 
+std::shared_ptr<const CBlockLocator> CChain::GetTipLocator() const {
+    if (!tipLocator) {
+        int nStep = 1;
+        std::vector<uint256> vHave;
+        vHave.reserve(32);
+
+        // All entries are in this chain, so each step is a plain O(1) lookup
+        for (int nHeight = Height(); nHeight >= 0; nHeight = std::max(nHeight - nStep, 0)) {
+            vHave.push_back(vChain[nHeight]->GetBlockHash());
+            if (nHeight == 0)
+                break;
+            if (vHave.size() > 10)
+                nStep *= 2;
+        }
+        tipLocator = std::make_shared<CBlockLocator>(vHave);
+    }
+    return tipLocator;
+}
+
 const CBlockIndex *CChain::FindFork(const CBlockIndex *pindex) const {
     if (pindex == NULL) {
         return NULL;
     }
     if (pindex->nHeight > Height())
         pindex = pindex->GetAncestor(Height());
-    while (pindex && !Contains(pindex))
-        pindex = pindex->pprev;
+    while (pindex && !Contains(pindex)) {
+        // Everything below the fork is in this chain, so a skip target that
+        // isn't lies above it and can be jumped to without passing it.
+        if (pindex->pskip && !Contains(pindex->pskip))
+            pindex = pindex->pskip;
+        else
+            pindex = pindex->pprev;
+    }
     return pindex;
 }
 
@@ -112,6 +139,79 @@ void CBlockIndex::BuildSkip()
         pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
 }
 
+void CBlockIndex::BuildVersionCounts()
+{
+    for (int i = 0; i < NUM_TRACKED_BLOCK_VERSIONS; i++)
+        nVersionCount[i] = (pprev ? pprev->nVersionCount[i] : 0) + (nVersion >= TRACKED_BLOCK_VERSIONS[i] ? 1 : 0);
+}
+
+CBlockIndex* CBlockIndexStore::Allocate(int nHeight)
+{
+    nEntries++;
+
+    if (nHeight >= 0) {
+        size_t nChunk = nHeight / HEIGHT_CHUNK_SIZE;
+        if (nChunk >= vHeightChunks.size()) {
+            vHeightChunks.resize(nChunk + 1);
+            vHeightUsed.resize((nChunk + 1) * HEIGHT_CHUNK_SIZE, false);
+        }
+        if (!vHeightUsed[nHeight]) {
+            if (!vHeightChunks[nChunk])
+                vHeightChunks[nChunk].reset(new CBlockIndex[HEIGHT_CHUNK_SIZE]);
+            vHeightUsed[nHeight] = true;
+            return &vHeightChunks[nChunk][nHeight % HEIGHT_CHUNK_SIZE];
+        }
+    }
+
+    // Another block already has this height's slot (or the height is bogus)
+    if (nOverflowUsed == vOverflowChunks.size() * OVERFLOW_CHUNK_SIZE)
+        vOverflowChunks.emplace_back(new CBlockIndex[OVERFLOW_CHUNK_SIZE]);
+    return &vOverflowChunks.back()[nOverflowUsed++ % OVERFLOW_CHUNK_SIZE];
+}
+
+void CBlockIndexStore::Clear()
+{
+    vHeightChunks.clear();
+    vHeightUsed.clear();
+    vOverflowChunks.clear();
+    nEntries = 0;
+    nOverflowUsed = 0;
+}
+
+size_t CBlockIndexStore::DynamicMemoryUsage() const
+{
+    size_t nChunks = 0;
+    for (const std::unique_ptr<CBlockIndex[]>& chunk : vHeightChunks) {
+        if (chunk)
+            nChunks++;
+    }
+    return nChunks * HEIGHT_CHUNK_SIZE * sizeof(CBlockIndex) + vOverflowChunks.size() * OVERFLOW_CHUNK_SIZE * sizeof(CBlockIndex) +
+           vHeightChunks.capacity() * sizeof(std::unique_ptr<CBlockIndex[]>) + vHeightUsed.capacity() / 8 +
+           vOverflowChunks.capacity() * sizeof(std::unique_ptr<CBlockIndex[]>);
+}
+
+int CountBlocksAtVersion(const CBlockIndex* pindex, int32_t nMinVersion, int nWindow)
+{
+    if (pindex == NULL || nWindow <= 0)
+        return 0;
+
+    for (int i = 0; i < NUM_TRACKED_BLOCK_VERSIONS; i++) {
+        if (TRACKED_BLOCK_VERSIONS[i] == nMinVersion) {
+            const CBlockIndex* pindexBase = pindex->GetAncestor(pindex->nHeight - nWindow);
+            return pindex->nVersionCount[i] - (pindexBase ? pindexBase->nVersionCount[i] : 0);
+        }
+    }
+
+    // Untracked version, walk the window
+    int nFound = 0;
+    for (int i = 0; i < nWindow && pindex != NULL; i++) {
+        if (pindex->nVersion >= nMinVersion)
+            ++nFound;
+        pindex = pindex->pprev;
+    }
+    return nFound;
+}
+
 arith_uint256 GetBlockProof(const CBlockIndex& block)
 {
     arith_uint256 bnTarget;
@@ -12,10 +12,16 @@
 #include "tinyformat.h"
 #include "uint256.h"
 
+#include <memory>
 #include <vector>
 
 static const int64_t MAX_FUTURE_BLOCK_TIME = 15 * 60;
 
+/** Block versions for which CBlockIndex keeps a running count of blocks at or above them (BIP34, BIP66, BIP65 and
+ *  the plain version bits header), so majority checks against them need no walk over the window */
+static const int32_t TRACKED_BLOCK_VERSIONS[] = { 2, 3, 4, 0x20000000 };
+static const int NUM_TRACKED_BLOCK_VERSIONS = sizeof(TRACKED_BLOCK_VERSIONS) / sizeof(TRACKED_BLOCK_VERSIONS[0]);
+
 class CBlockFileInfo
 {
 public:
@@ -148,6 +154,8 @@ enum BlockStatus: uint32_t {
     BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
 
     BLOCK_OPT_WITNESS       =   128, //!< block data in blk*.data was received with a witness-enforcing client
+
+    BLOCK_HAVE_SIZE          =  256, //!< serialized block size known (nSize is valid)
 };
 
 /** The block chain is a tree shaped structure starting with the
@@ -158,8 +166,8 @@ enum BlockStatus: uint32_t {
 class CBlockIndex
 {
 public:
-    //! pointer to the hash of the block, if any. Memory is owned by this CBlockIndex
-    const uint256* phashBlock;
+    // The fields read by walks back along the chain (GetAncestor, retargets, the
+    // block size window, version counts) come first so they share a cache line.
 
     //! pointer to the index of the predecessor of this block
     CBlockIndex* pprev;
@@ -167,43 +175,59 @@ public:
     //! pointer to the index of some further predecessor of this block
     CBlockIndex* pskip;
 
+    //! pointer to the hash of the block, if any. Memory is owned by this CBlockIndex
+    const uint256* phashBlock;
+
     //! height of the entry in the chain. The genesis block has height 0
     int nHeight;
 
-    //! Which # file this block is stored in (blk?????.dat)
-    int nFile;
+    //! block header
+    int nVersion;
+    unsigned int nTime;
+    unsigned int nBits;
 
-    //! Byte offset within blk?????.dat where this block's data is stored
-    unsigned int nDataPos;
+    //! Verification status of this block. See enum BlockStatus
+    unsigned int nStatus;
 
-    //! Byte offset within rev?????.dat where this block's undo data is stored
-    unsigned int nUndoPos;
+    //! Serialized size of this block in bytes, as stored in blk?????.dat.
+    //! Only valid if BLOCK_HAVE_SIZE is set in nStatus
+    unsigned int nSize;
 
-    //! (memory only) Total amount of work (expected number of hashes) in the chain up to and including this block
-    arith_uint256 nChainWork;
+    //! (memory only) Adaptive block size limit computed from the median window ending at this block, 0 if not computed yet
+    unsigned int nMaxBlockSize;
 
     //! Number of transactions in this block.
     //! Note: in a potential headers-first mode, this number cannot be relied upon
     unsigned int nTx;
 
+    //! (memory only) Total amount of work (expected number of hashes) in the chain up to and including this block
+    arith_uint256 nChainWork;
+
     //! (memory only) Number of transactions in the chain up to and including this block.
     //! This value will be non-zero only if and only if transactions for this block and all its parents are available.
     //! Change to 64-bit type when necessary; won't happen before 2030
     unsigned int nChainTx;
 
-    //! Verification status of this block. See enum BlockStatus
-    unsigned int nStatus;
+    //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
+    uint32_t nSequenceId;
 
-    //! block header
-    int nVersion;
+    //! (memory only) Number of blocks in the chain up to and including this block with
+    //! nVersion >= TRACKED_BLOCK_VERSIONS[i]
+    uint32_t nVersionCount[NUM_TRACKED_BLOCK_VERSIONS];
+
+    //! Which # file this block is stored in (blk?????.dat)
+    int nFile;
+
+    //! Byte offset within blk?????.dat where this block's data is stored
+    unsigned int nDataPos;
+
+    //! Byte offset within rev?????.dat where this block's undo data is stored
+    unsigned int nUndoPos;
+
+    //! block header, only needed to serve or store the header
     uint256 hashMerkleRoot;
-    unsigned int nTime;
-    unsigned int nBits;
     unsigned int nNonce;
 
-    //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
-    uint32_t nSequenceId;
-
     void SetNull()
     {
         phashBlock = NULL;
@@ -215,9 +239,13 @@ public:
         nUndoPos = 0;
         nChainWork = arith_uint256();
         nTx = 0;
+        nSize = 0;
         nChainTx = 0;
         nStatus = 0;
         nSequenceId = 0;
+        nMaxBlockSize = 0;
+        for (int i = 0; i < NUM_TRACKED_BLOCK_VERSIONS; i++)
+            nVersionCount[i] = 0;
 
         nVersion       = 0;
         hashMerkleRoot = uint256();
@@ -333,12 +361,17 @@ public:
     //! Build the skiplist pointer for this entry.
     void BuildSkip();
 
+    //! Extend the running version counts of pprev by this entry.
+    void BuildVersionCounts();
+
     //! Efficiently find an ancestor of this block.
     CBlockIndex* GetAncestor(int height);
     const CBlockIndex* GetAncestor(int height) const;
 };
 
 arith_uint256 GetBlockProof(const CBlockIndex& block);
+/** Count the blocks with nVersion >= nMinVersion among the nWindow blocks ending at pindex. */
+int CountBlocksAtVersion(const CBlockIndex* pindex, int32_t nMinVersion, int nWindow);
 /** Return the time it would take to redo the work difference between from and to, assuming the current hashrate corresponds to the difficulty at tip, in seconds. */
 int64_t GetBlockProofEquivalentTime(const CBlockIndex& to, const CBlockIndex& from, const CBlockIndex& tip, const Consensus::Params&);
 
@@ -380,6 +413,10 @@ public:
         READWRITE(nTime);
         READWRITE(nBits);
         READWRITE(nNonce);
+
+        // appended last so that older clients can still parse the entry
+        if (nStatus & BLOCK_HAVE_SIZE)
+            READWRITE(VARINT(nSize));
     }
 
     uint256 GetBlockHash() const
@@ -406,10 +443,48 @@ public:
     }
 };
 
+/**
+ * Storage for block index entries. Entries are kept in chunks of consecutive heights,
+ * the first entry at a height in that height's slot, so walks back along the chain
+ * read neighbouring memory instead of chasing pointers across the heap. Further
+ * entries at a taken height (forks) are put one after another in overflow chunks.
+ * Entries can't be freed one by one, they all live until Clear().
+ */
+class CBlockIndexStore
+{
+public:
+    //! Entries per chunk of heights
+    static const int HEIGHT_CHUNK_SIZE = 4096;
+    //! Entries per chunk of forks
+    static const int OVERFLOW_CHUNK_SIZE = 256;
+
+    CBlockIndexStore() : nEntries(0), nOverflowUsed(0) {}
+
+    //! A new null entry, to be the block at nHeight.
+    CBlockIndex* Allocate(int nHeight);
+    //! Destroy all entries.
+    void Clear();
+
+    size_t size() const { return nEntries; }
+    size_t DynamicMemoryUsage() const;
+
+private:
+    CBlockIndexStore(const CBlockIndexStore&);
+    CBlockIndexStore& operator=(const CBlockIndexStore&);
+
+    std::vector<std::unique_ptr<CBlockIndex[]> > vHeightChunks;
+    std::vector<bool> vHeightUsed;
+    std::vector<std::unique_ptr<CBlockIndex[]> > vOverflowChunks;
+    size_t nEntries;
+    size_t nOverflowUsed;
+};
+
 /** An in-memory indexed chain of blocks. */
 class CChain {
 private:
     std::vector<CBlockIndex*> vChain;
+    //! Locator of the tip, built on first use after each SetTip. Guarded by the same lock as the chain.
+    mutable std::shared_ptr<const CBlockLocator> tipLocator;
 
 public:
     /** Returns the index entry for the genesis block of this chain, or NULL if none. */
@@ -459,6 +534,9 @@ public:
     /** Return a CBlockLocator that refers to a block in this chain (by default the tip). */
     CBlockLocator GetLocator(const CBlockIndex *pindex = NULL) const;
 
+    /** Return the locator of the tip, shared until the tip changes. */
+    std::shared_ptr<const CBlockLocator> GetTipLocator() const;
+
     /** Find the last common block between this chain and a block index entry. */
     const CBlockIndex *FindFork(const CBlockIndex *pindex) const;
 };
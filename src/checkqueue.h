@@ -151,10 +151,14 @@ public:
             check.swap(queue.back());
         }
         nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
+        // wake no more idle workers than there are checks for them, the others would go back to sleep
+        // right away after fighting over the mutex
+        unsigned int nWake = std::min((unsigned int)nIdle, (unsigned int)vChecks.size());
+        if (nWake == (unsigned int)nIdle)
             condWorker.notify_all();
+        else
+            for (unsigned int i = 0; i < nWake; i++)
+                condWorker.notify_one();
     }
 
     ~CCheckQueue()
@@ -172,6 +176,9 @@ public:
 /** 
  * RAII-style controller object for a CCheckQueue that guarantees the passed
  * queue is finished before continuing.
+ * Checks can be collected until nFlushSize of them are pending, so a caller
+ * adding few checks at a time (e.g. per transaction of a block) doesn't take
+ * the queue lock and wake the workers for each of them.
  */
 template <typename T>
 class CCheckQueueControl
@@ -179,9 +186,19 @@ class CCheckQueueControl
 private:
     CCheckQueue<T>* pqueue;
     bool fDone;
+    unsigned int nFlushSize;
+    std::vector<T> vPending;
+
+    void Flush()
+    {
+        if (!vPending.empty()) {
+            pqueue->Add(vPending);
+            vPending.clear();
+        }
+    }
 
 public:
-    CCheckQueueControl(CCheckQueue<T>* pqueueIn) : pqueue(pqueueIn), fDone(false)
+    CCheckQueueControl(CCheckQueue<T>* pqueueIn, unsigned int nFlushSizeIn = 1) : pqueue(pqueueIn), fDone(false), nFlushSize(nFlushSizeIn)
     {
         // passed queue is supposed to be unused, or NULL
         if (pqueue != NULL) {
@@ -194,6 +211,7 @@ public:
     {
         if (pqueue == NULL)
             return true;
+        Flush();
         bool fRet = pqueue->Wait();
         fDone = true;
         return fRet;
@@ -201,8 +219,18 @@ public:
 
     void Add(std::vector<T>& vChecks)
     {
-        if (pqueue != NULL)
+        if (pqueue == NULL)
+            return;
+        if (nFlushSize <= 1) {
             pqueue->Add(vChecks);
+            return;
+        }
+        BOOST_FOREACH (T& check, vChecks) {
+            vPending.push_back(T());
+            check.swap(vPending.back());
+        }
+        if (vPending.size() >= nFlushSize)
+            Flush();
     }
 
     ~CCheckQueueControl()
@@ -14,15 +14,17 @@ static const unsigned int MAX_BLOCK_SERIALIZED_SIZE = 2000000;
 static const unsigned int MAX_BLOCK_SIZE_INCREASE_MULTIPLE = 2;
 /** The number of blocks to consider in the computation of median block size */
 static const unsigned int NUM_BLOCKS_FOR_MEDIAN_BLOCK = 2016;
-/** The maximum allowed size for a serialized block, in bytes (network rule) */
-static unsigned int maxBlockSize = 1000000;
+/** The maximum allowed size for a serialized block, in bytes (network rule).
+ *  Recomputed from the chain by ConnectBlock, so it is shared rather than
+ *  copied into every translation unit. */
+extern unsigned int maxBlockSize;
 /** The old block size limit */
 static const unsigned int OLD_MAX_BLOCK_SIZE = 1000000;
 static const unsigned int MAX_BLOCK_BASE_SIZE = 1000000;
 /** The maximum allowed number of signature check operations in a block (network rule) */
 static const int64_t MAX_BLOCK_SIGOPS_COST = 160000;
 /** The maximum allowed number of signature check operations in a block (network rule) */
-static unsigned int maxBlockSigops = maxBlockSize/50;
+extern unsigned int maxBlockSigops;
 /** Coinbase transaction outputs can only be spent after this number of new blocks (network rule) */
 static const int COINBASE_MATURITY = 100;
 /** Version 1.0 net start block*/
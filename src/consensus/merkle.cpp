@@ -4,8 +4,13 @@
 
 #include "merkle.h"
 #include "hash.h"
+#include "crypto/sha256.h"
 #include "utilstrencodings.h"
 
+#if !defined(BUILD_BITCOIN_INTERNAL)
+#include <thread>
+#endif
+
 /*     WARNING! If you're reading this because you're learning about crypto
        and/or designing a new system that will use merkle trees, keep in mind
        that the following merkle tree algorithm has a serious flaw related to
@@ -130,10 +135,77 @@ static void MerkleComputation(const std::vector<uint256>& leaves, uint256* proot
     if (proot) *proot = h;
 }
 
-uint256 ComputeMerkleRoot(const std::vector<uint256>& leaves, bool* mutated) {
-    uint256 hash;
-    MerkleComputation(leaves, &hash, mutated, -1, NULL);
-    return hash;
+/* Levels with at least this many pairs per core are split across threads */
+static const size_t MERKLE_PAIRS_PER_THREAD = 4096;
+
+/* Hash pairs (in[2i], in[2i+1]) into out[i]. out may be in itself only for a serial run, in
+   which hash i only overwrites pair i, at or before the pairs still to be read. */
+static void MerkleHashPairs(uint256* out, const uint256* in, size_t pairs, bool fParallel) {
+#if !defined(BUILD_BITCOIN_INTERNAL)
+    size_t nThreads = fParallel ? std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1U), pairs / MERKLE_PAIRS_PER_THREAD) : 1;
+    if (nThreads > 1) {
+        size_t nChunk = (pairs + nThreads - 1) / nThreads;
+        std::vector<std::thread> vThreads;
+        for (size_t nBegin = nChunk; nBegin < pairs; nBegin += nChunk) {
+            vThreads.push_back(std::thread(SHA256D64, out[nBegin].begin(), in[2 * nBegin].begin(), std::min(nChunk, pairs - nBegin)));
+        }
+        SHA256D64(out[0].begin(), in[0].begin(), nChunk);
+        for (auto& thread : vThreads) thread.join();
+        return;
+    }
+#endif
+    SHA256D64(out[0].begin(), in[0].begin(), pairs);
+}
+
+static bool MerkleParallel(size_t pairs) {
+    return pairs >= 2 * MERKLE_PAIRS_PER_THREAD;
+}
+
+/* Root-only computation, level by level, hashing all pairs of a level in one batch so the
+   multi-way SHA256 transforms can be used. Same results as MerkleComputation. Levels go
+   in place over the leaves, except for the big ones hashed on several threads, which need
+   a second buffer as the threads would overwrite each other's input. */
+uint256 ComputeMerkleRoot(std::vector<uint256> hashes, bool* mutated) {
+    std::vector<uint256> scratch;
+    bool mutation = false;
+    while (hashes.size() > 1) {
+        if (mutated) {
+            for (size_t pos = 0; pos + 1 < hashes.size(); pos += 2) {
+                if (hashes[pos] == hashes[pos + 1]) mutation = true;
+            }
+        }
+        if (hashes.size() & 1) {
+            hashes.push_back(hashes.back());
+        }
+        size_t pairs = hashes.size() / 2;
+        if (MerkleParallel(pairs)) {
+            scratch.reserve(pairs + 1);
+            scratch.resize(pairs);
+            MerkleHashPairs(scratch.data(), hashes.data(), pairs, true);
+            hashes.swap(scratch);
+        } else {
+            MerkleHashPairs(hashes.data(), hashes.data(), pairs, false);
+            hashes.resize(pairs);
+        }
+    }
+    if (mutated) *mutated = mutation;
+    if (hashes.size() == 0) return uint256();
+    return hashes[0];
+}
+
+std::vector<std::vector<uint256> > ComputeMerkleTree(const std::vector<uint256>& leaves) {
+    std::vector<std::vector<uint256> > tree(1, leaves);
+    while (tree.back().size() > 1) {
+        const std::vector<uint256>& level = tree.back();
+        size_t pairs = level.size() / 2;
+        std::vector<uint256> next((level.size() + 1) / 2);
+        MerkleHashPairs(next.data(), level.data(), pairs, MerkleParallel(pairs));
+        if (level.size() & 1) {
+            CHash256().Write(level.back().begin(), 32).Write(level.back().begin(), 32).Finalize(next.back().begin());
+        }
+        tree.push_back(std::move(next));
+    }
+    return tree;
 }
 
 std::vector<uint256> ComputeMerkleBranch(const std::vector<uint256>& leaves, uint32_t position) {
@@ -158,11 +230,12 @@ uint256 ComputeMerkleRootFromBranch(const uint256& leaf, const std::vector<uint2
 uint256 BlockMerkleRoot(const CBlock& block, bool* mutated)
 {
     std::vector<uint256> leaves;
+    leaves.reserve(block.vtx.size() + 1); // Room for duplicating an odd last leaf
     leaves.resize(block.vtx.size());
     for (size_t s = 0; s < block.vtx.size(); s++) {
         leaves[s] = block.vtx[s].GetHash();
     }
-    return ComputeMerkleRoot(leaves, mutated);
+    return ComputeMerkleRoot(std::move(leaves), mutated);
 }
 
 uint256 BlockWitnessMerkleRoot(const CBlock& block, bool* mutated)
@@ -173,7 +246,7 @@ uint256 BlockWitnessMerkleRoot(const CBlock& block, bool* mutated)
     for (size_t s = 1; s < block.vtx.size(); s++) {
         leaves[s] = block.vtx[s].GetWitnessHash();
     }
-    return ComputeMerkleRoot(leaves, mutated);
+    return ComputeMerkleRoot(std::move(leaves), mutated);
 }
 
 std::vector<uint256> BlockMerkleBranch(const CBlock& block, uint32_t position)
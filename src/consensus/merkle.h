@@ -12,10 +12,17 @@
 #include "primitives/block.h"
 #include "uint256.h"
 
-uint256 ComputeMerkleRoot(const std::vector<uint256>& leaves, bool* mutated = NULL);
+/** Takes the leaves by value to hash the levels in place, callers done with them can move them in */
+uint256 ComputeMerkleRoot(std::vector<uint256> leaves, bool* mutated = NULL);
 std::vector<uint256> ComputeMerkleBranch(const std::vector<uint256>& leaves, uint32_t position);
 uint256 ComputeMerkleRootFromBranch(const uint256& leaf, const std::vector<uint256>& branch, uint32_t position);
 
+/*
+ * Compute all levels of the merkle tree, from the leaves (level 0) up to the root. Only for
+ * when inner nodes are needed, as for partial merkle trees; use ComputeMerkleRoot otherwise.
+ */
+std::vector<std::vector<uint256> > ComputeMerkleTree(const std::vector<uint256>& leaves);
+
 /*
  * Compute the Merkle root of the transactions in a block.
  * *mutated is set to true if a duplicated subtree was found.
@@ -4,16 +4,39 @@
 
 #include "aes.h"
 #include "crypto/common.h"
+#include "crypto/cpuid.h"
 
 #include <assert.h>
 #include <string.h>
 
+#if defined(HAVE_GETCPUID) && defined(ENABLE_AESNI)
+#define HAVE_AESNI_DISPATCH 1
+namespace aes_ni
+{
+void Expand128(unsigned char* rkEncrypt, unsigned char* rkDecrypt, const unsigned char key[16]);
+void Expand256(unsigned char* rkEncrypt, unsigned char* rkDecrypt, const unsigned char key[32]);
+void Encrypt(const unsigned char* rk, int nr, unsigned char* out, const unsigned char* in);
+void Decrypt(const unsigned char* rk, int nr, unsigned char* out, const unsigned char* in);
+}
+#endif
+
+static bool fUseAESNI = false;
+
+// Wiping the ctaes context wipes the AES-NI round keys sharing its memory
+static_assert(sizeof(AES128_ctx) == 11 * AES_BLOCKSIZE && sizeof(AES256_ctx) == 15 * AES_BLOCKSIZE, "unexpected ctaes context size");
+
 extern "C" {
 #include "crypto/ctaes/ctaes.c"
 }
 
-AES128Encrypt::AES128Encrypt(const unsigned char key[16])
+AES128Encrypt::AES128Encrypt(const unsigned char key[16]) : fHardware(fUseAESNI)
 {
+#ifdef HAVE_AESNI_DISPATCH
+    if (fHardware) {
+        aes_ni::Expand128(rk, NULL, key);
+        return;
+    }
+#endif
     AES128_init(&ctx, key);
 }
 
@@ -24,11 +47,23 @@ AES128Encrypt::~AES128Encrypt()
 
 void AES128Encrypt::Encrypt(unsigned char ciphertext[16], const unsigned char plaintext[16]) const
 {
+#ifdef HAVE_AESNI_DISPATCH
+    if (fHardware) {
+        aes_ni::Encrypt(rk, 10, ciphertext, plaintext);
+        return;
+    }
+#endif
     AES128_encrypt(&ctx, 1, ciphertext, plaintext);
 }
 
-AES128Decrypt::AES128Decrypt(const unsigned char key[16])
+AES128Decrypt::AES128Decrypt(const unsigned char key[16]) : fHardware(fUseAESNI)
 {
+#ifdef HAVE_AESNI_DISPATCH
+    if (fHardware) {
+        aes_ni::Expand128(NULL, rk, key);
+        return;
+    }
+#endif
     AES128_init(&ctx, key);
 }
 
@@ -39,11 +74,23 @@ AES128Decrypt::~AES128Decrypt()
 
 void AES128Decrypt::Decrypt(unsigned char plaintext[16], const unsigned char ciphertext[16]) const
 {
+#ifdef HAVE_AESNI_DISPATCH
+    if (fHardware) {
+        aes_ni::Decrypt(rk, 10, plaintext, ciphertext);
+        return;
+    }
+#endif
     AES128_decrypt(&ctx, 1, plaintext, ciphertext);
 }
 
-AES256Encrypt::AES256Encrypt(const unsigned char key[32])
+AES256Encrypt::AES256Encrypt(const unsigned char key[32]) : fHardware(fUseAESNI)
 {
+#ifdef HAVE_AESNI_DISPATCH
+    if (fHardware) {
+        aes_ni::Expand256(rk, NULL, key);
+        return;
+    }
+#endif
     AES256_init(&ctx, key);
 }
 
@@ -54,11 +101,23 @@ AES256Encrypt::~AES256Encrypt()
 
 void AES256Encrypt::Encrypt(unsigned char ciphertext[16], const unsigned char plaintext[16]) const
 {
+#ifdef HAVE_AESNI_DISPATCH
+    if (fHardware) {
+        aes_ni::Encrypt(rk, 14, ciphertext, plaintext);
+        return;
+    }
+#endif
     AES256_encrypt(&ctx, 1, ciphertext, plaintext);
 }
 
-AES256Decrypt::AES256Decrypt(const unsigned char key[32])
+AES256Decrypt::AES256Decrypt(const unsigned char key[32]) : fHardware(fUseAESNI)
 {
+#ifdef HAVE_AESNI_DISPATCH
+    if (fHardware) {
+        aes_ni::Expand256(NULL, rk, key);
+        return;
+    }
+#endif
     AES256_init(&ctx, key);
 }
 
@@ -69,9 +128,48 @@ AES256Decrypt::~AES256Decrypt()
 
 void AES256Decrypt::Decrypt(unsigned char plaintext[16], const unsigned char ciphertext[16]) const
 {
+#ifdef HAVE_AESNI_DISPATCH
+    if (fHardware) {
+        aes_ni::Decrypt(rk, 14, plaintext, ciphertext);
+        return;
+    }
+#endif
     AES256_decrypt(&ctx, 1, plaintext, ciphertext);
 }
 
+#ifdef HAVE_AESNI_DISPATCH
+/** Check the AES-NI code against the AES-256 example vector of FIPS-197 */
+static bool SelfTestAESNI()
+{
+    static const unsigned char key[32] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+        0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f};
+    static const unsigned char plain[16] = {
+        0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
+    static const unsigned char cipher[16] = {
+        0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf, 0xea, 0xfc, 0x49, 0x90, 0x4b, 0x49, 0x60, 0x89};
+    unsigned char rkEncrypt[15 * AES_BLOCKSIZE], rkDecrypt[15 * AES_BLOCKSIZE], out[16], back[16];
+    aes_ni::Expand256(rkEncrypt, rkDecrypt, key);
+    aes_ni::Encrypt(rkEncrypt, 14, out, plain);
+    aes_ni::Decrypt(rkDecrypt, 14, back, out);
+    return memcmp(out, cipher, 16) == 0 && memcmp(back, plain, 16) == 0;
+}
+#endif
+
+std::string AESAutoDetect()
+{
+    fUseAESNI = false;
+#ifdef HAVE_AESNI_DISPATCH
+    uint32_t eax, ebx, ecx, edx;
+    GetCPUID(1, 0, eax, ebx, ecx, edx);
+    bool have_aesni = (ecx >> 25) & 1;
+    if (have_aesni && SelfTestAESNI()) {
+        fUseAESNI = true;
+        return "aesni";
+    }
+#endif
+    return "ctaes";
+}
 
 template <typename T>
 static int CBCEncrypt(const T& enc, const unsigned char iv[AES_BLOCKSIZE], const unsigned char* data, int size, bool pad, unsigned char* out)
@@ -2,7 +2,8 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 //
-// C++ wrapper around ctaes, a constant-time AES implementation
+// C++ wrapper around ctaes, a constant-time AES implementation, and the AES-NI
+// instructions where AESAutoDetect found them
 
 #ifndef BITCOIN_CRYPTO_AES_H
 #define BITCOIN_CRYPTO_AES_H
@@ -11,15 +12,25 @@ extern "C" {
 #include "crypto/ctaes/ctaes.h"
 }
 
+#include <string>
+
 static const int AES_BLOCKSIZE = 16;
 static const int AES128_KEYSIZE = 16;
 static const int AES256_KEYSIZE = 32;
 
+/** Use AES-NI when the CPU has it and it passes a self test, returns the name of the implementation picked.
+ *  Only affects the AES objects constructed after it. */
+std::string AESAutoDetect();
+
 /** An encryption class for AES-128. */
 class AES128Encrypt
 {
 private:
-    AES128_ctx ctx;
+    union {
+        AES128_ctx ctx;
+        unsigned char rk[(10 + 1) * AES_BLOCKSIZE]; // AES-NI round keys
+    };
+    bool fHardware;
 
 public:
     AES128Encrypt(const unsigned char key[16]);
@@ -31,7 +42,11 @@ public:
 class AES128Decrypt
 {
 private:
-    AES128_ctx ctx;
+    union {
+        AES128_ctx ctx;
+        unsigned char rk[(10 + 1) * AES_BLOCKSIZE]; // AES-NI round keys
+    };
+    bool fHardware;
 
 public:
     AES128Decrypt(const unsigned char key[16]);
@@ -43,7 +58,11 @@ public:
 class AES256Encrypt
 {
 private:
-    AES256_ctx ctx;
+    union {
+        AES256_ctx ctx;
+        unsigned char rk[(14 + 1) * AES_BLOCKSIZE]; // AES-NI round keys
+    };
+    bool fHardware;
 
 public:
     AES256Encrypt(const unsigned char key[32]);
@@ -55,7 +74,11 @@ public:
 class AES256Decrypt
 {
 private:
-    AES256_ctx ctx;
+    union {
+        AES256_ctx ctx;
+        unsigned char rk[(14 + 1) * AES_BLOCKSIZE]; // AES-NI round keys
+    };
+    bool fHardware;
 
 public:
     AES256Decrypt(const unsigned char key[32]);
@@ -0,0 +1,107 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+//
+// Key expansion after the Intel AES-NI white paper. Round keys are kept as 16 byte blocks,
+// nr + 1 of them, with the decryption keys in the order they are used.
+
+#ifdef ENABLE_AESNI
+
+#include <stdint.h>
+#include <immintrin.h>
+
+namespace
+{
+/** The next four key words from the previous ones and the aeskeygenassist word */
+__m128i inline ExpandStep(__m128i key, __m128i assist)
+{
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, assist);
+}
+
+// aeskeygenassist needs its round constant as an immediate
+#define EXPAND128(i, rcon) rk[i] = ExpandStep(rk[i - 1], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(rk[i - 1], rcon), 0xff))
+#define EXPAND256A(i, rcon) rk[i] = ExpandStep(rk[i - 2], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(rk[i - 1], rcon), 0xff))
+#define EXPAND256B(i) rk[i] = ExpandStep(rk[i - 2], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(rk[i - 1], 0), 0xaa))
+
+void inline Store(unsigned char* out, const __m128i* rk, int nr)
+{
+    for (int i = 0; i <= nr; i++)
+        _mm_storeu_si128((__m128i*)(out + 16 * i), rk[i]);
+}
+
+void inline StoreDecrypt(unsigned char* out, const __m128i* rk, int nr)
+{
+    _mm_storeu_si128((__m128i*)out, rk[nr]);
+    for (int i = 1; i < nr; i++)
+        _mm_storeu_si128((__m128i*)(out + 16 * i), _mm_aesimc_si128(rk[nr - i]));
+    _mm_storeu_si128((__m128i*)(out + 16 * nr), rk[0]);
+}
+}
+
+namespace aes_ni
+{
+void Expand128(unsigned char* rkEncrypt, unsigned char* rkDecrypt, const unsigned char key[16])
+{
+    __m128i rk[11];
+    rk[0] = _mm_loadu_si128((const __m128i*)key);
+    EXPAND128(1, 0x01);
+    EXPAND128(2, 0x02);
+    EXPAND128(3, 0x04);
+    EXPAND128(4, 0x08);
+    EXPAND128(5, 0x10);
+    EXPAND128(6, 0x20);
+    EXPAND128(7, 0x40);
+    EXPAND128(8, 0x80);
+    EXPAND128(9, 0x1b);
+    EXPAND128(10, 0x36);
+    if (rkEncrypt) Store(rkEncrypt, rk, 10);
+    if (rkDecrypt) StoreDecrypt(rkDecrypt, rk, 10);
+    for (int i = 0; i <= 10; i++)
+        rk[i] = _mm_setzero_si128();
+}
+
+void Expand256(unsigned char* rkEncrypt, unsigned char* rkDecrypt, const unsigned char key[32])
+{
+    __m128i rk[15];
+    rk[0] = _mm_loadu_si128((const __m128i*)key);
+    rk[1] = _mm_loadu_si128((const __m128i*)(key + 16));
+    EXPAND256A(2, 0x01);
+    EXPAND256B(3);
+    EXPAND256A(4, 0x02);
+    EXPAND256B(5);
+    EXPAND256A(6, 0x04);
+    EXPAND256B(7);
+    EXPAND256A(8, 0x08);
+    EXPAND256B(9);
+    EXPAND256A(10, 0x10);
+    EXPAND256B(11);
+    EXPAND256A(12, 0x20);
+    EXPAND256B(13);
+    EXPAND256A(14, 0x40);
+    if (rkEncrypt) Store(rkEncrypt, rk, 14);
+    if (rkDecrypt) StoreDecrypt(rkDecrypt, rk, 14);
+    for (int i = 0; i <= 14; i++)
+        rk[i] = _mm_setzero_si128();
+}
+
+void Encrypt(const unsigned char* rk, int nr, unsigned char* out, const unsigned char* in)
+{
+    __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i*)in), _mm_loadu_si128((const __m128i*)rk));
+    for (int i = 1; i < nr; i++)
+        x = _mm_aesenc_si128(x, _mm_loadu_si128((const __m128i*)(rk + 16 * i)));
+    _mm_storeu_si128((__m128i*)out, _mm_aesenclast_si128(x, _mm_loadu_si128((const __m128i*)(rk + 16 * nr))));
+}
+
+void Decrypt(const unsigned char* rk, int nr, unsigned char* out, const unsigned char* in)
+{
+    __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i*)in), _mm_loadu_si128((const __m128i*)rk));
+    for (int i = 1; i < nr; i++)
+        x = _mm_aesdec_si128(x, _mm_loadu_si128((const __m128i*)(rk + 16 * i)));
+    _mm_storeu_si128((__m128i*)out, _mm_aesdeclast_si128(x, _mm_loadu_si128((const __m128i*)(rk + 16 * nr))));
+}
+}
+
+#endif
@@ -0,0 +1,195 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/keccak256.h"
+
+#include "crypto/common.h"
+#include "crypto/cpuid.h"
+#include "crypto/keccak256_f1600.h"
+
+#include <string.h>
+
+#if defined(ENABLE_BMI2) && !defined(BUILD_BITCOIN_INTERNAL)
+namespace keccak256_bmi2
+{
+void KeccakF1600(uint64_t* st);
+}
+#endif
+
+#if defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL)
+namespace keccak256_avx2
+{
+void Keccak256_80_4way(unsigned char* out, const unsigned char* in);
+}
+#endif
+
+namespace
+{
+/** Generic build of the permutation. */
+void KeccakF1600Generic(uint64_t* st)
+{
+    KeccakF1600Impl(st);
+}
+
+typedef void (*KeccakF1600Type)(uint64_t*);
+typedef void (*Keccak256_80_4wayType)(unsigned char*, const unsigned char*);
+
+KeccakF1600Type KeccakF1600 = KeccakF1600Generic;
+Keccak256_80_4wayType Keccak256_80_4way = NULL;
+
+void inline Absorb(uint64_t* s, const unsigned char* block)
+{
+    for (int i = 0; i < 17; i++)
+        s[i] ^= ReadLE64(block + 8 * i);
+    KeccakF1600(s);
+}
+
+void inline Squeeze(const uint64_t* s, unsigned char* hash)
+{
+    WriteLE64(hash, s[0]);
+    WriteLE64(hash + 8, s[1]);
+    WriteLE64(hash + 16, s[2]);
+    WriteLE64(hash + 24, s[3]);
+}
+
+#if defined(ENABLE_BMI2) && !defined(BUILD_BITCOIN_INTERNAL)
+/** Check an implementation against the generic one before it gets used */
+bool SelfTest(KeccakF1600Type f)
+{
+    uint64_t s1[25], s2[25];
+    for (int i = 0; i < 25; i++)
+        s1[i] = s2[i] = 0x0123456789abcdefull * (i + 1);
+    f(s1);
+    KeccakF1600Generic(s2);
+    return memcmp(s1, s2, sizeof(s1)) == 0;
+}
+#endif
+
+#if defined(ENABLE_AVX2) && !defined(BUILD_BITCOIN_INTERNAL)
+bool SelfTest80(Keccak256_80_4wayType f)
+{
+    unsigned char in[320], out[128], expected[32];
+    for (size_t i = 0; i < sizeof(in); i++)
+        in[i] = (unsigned char)(i * 7 + 13);
+    f(out, in);
+    for (int i = 0; i < 4; i++) {
+        Keccak256_80(expected, in + 80 * i);
+        if (memcmp(out + 32 * i, expected, 32) != 0)
+            return false;
+    }
+    return true;
+}
+#endif
+}
+
+////// Keccak-256
+
+CKeccak256::CKeccak256() : bufsize(0)
+{
+    memset(s, 0, sizeof(s));
+}
+
+CKeccak256& CKeccak256::Write(const unsigned char* data, size_t len)
+{
+    const unsigned char* end = data + len;
+    if (bufsize && bufsize + len >= RATE) {
+        // Fill the buffer, and process it.
+        memcpy(buf + bufsize, data, RATE - bufsize);
+        data += RATE - bufsize;
+        Absorb(s, buf);
+        bufsize = 0;
+    }
+    while (end >= data + RATE) {
+        // Process full blocks directly from the source.
+        Absorb(s, data);
+        data += RATE;
+    }
+    if (end > data) {
+        // Fill the buffer with what remains.
+        memcpy(buf + bufsize, data, end - data);
+        bufsize += end - data;
+    }
+    return *this;
+}
+
+void CKeccak256::Finalize(unsigned char hash[OUTPUT_SIZE])
+{
+    memset(buf + bufsize, 0, RATE - bufsize);
+    buf[bufsize] ^= 0x01;
+    buf[RATE - 1] ^= 0x80;
+    Absorb(s, buf);
+    Squeeze(s, hash);
+}
+
+CKeccak256& CKeccak256::Reset()
+{
+    memset(s, 0, sizeof(s));
+    bufsize = 0;
+    return *this;
+}
+
+void Keccak256_80(unsigned char hash[CKeccak256::OUTPUT_SIZE], const unsigned char* data)
+{
+    // The ten input lanes plus padding fit the 17 lane rate, the remaining state starts zeroed
+    uint64_t s[25];
+    for (int i = 0; i < 10; i++)
+        s[i] = ReadLE64(data + 8 * i);
+    s[10] = 0x01;
+    for (int i = 11; i < 16; i++)
+        s[i] = 0;
+    s[16] = 0x8000000000000000ull;
+    for (int i = 17; i < 25; i++)
+        s[i] = 0;
+    KeccakF1600(s);
+    Squeeze(s, hash);
+}
+
+void Keccak256_80Many(unsigned char* output, const unsigned char* input, size_t blocks)
+{
+    if (Keccak256_80_4way) {
+        while (blocks >= 4) {
+            Keccak256_80_4way(output, input);
+            output += 128;
+            input += 320;
+            blocks -= 4;
+        }
+    }
+    while (blocks) {
+        Keccak256_80(output, input);
+        output += 32;
+        input += 80;
+        --blocks;
+    }
+}
+
+std::string Keccak256AutoDetect()
+{
+    std::string ret = "standard";
+#if defined(HAVE_GETCPUID) && (defined(ENABLE_BMI2) || defined(ENABLE_AVX2)) && !defined(BUILD_BITCOIN_INTERNAL)
+    uint32_t eax, ebx, ecx, edx;
+    GetCPUID(0, 0, eax, ebx, ecx, edx);
+    if (eax >= 7) {
+        GetCPUID(7, 0, eax, ebx, ecx, edx);
+        bool have_bmi1 = (ebx >> 3) & 1;
+        bool have_bmi2 = (ebx >> 8) & 1;
+        bool have_avx2 = (ebx >> 5) & 1;
+#if defined(ENABLE_BMI2)
+        if (have_bmi1 && have_bmi2 && SelfTest(keccak256_bmi2::KeccakF1600)) {
+            KeccakF1600 = keccak256_bmi2::KeccakF1600;
+            ret = "bmi2";
+        }
+#endif
+#if defined(ENABLE_AVX2)
+        if (have_avx2 && AVXEnabled() && SelfTest80(keccak256_avx2::Keccak256_80_4way)) {
+            Keccak256_80_4way = keccak256_avx2::Keccak256_80_4way;
+            ret += ",avx2(4way)";
+        }
+#endif
+        (void)have_bmi1;
+        (void)have_bmi2;
+        (void)have_avx2;
+    }
+#endif
+    return ret;
+}
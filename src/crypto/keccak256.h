@@ -0,0 +1,45 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_KECCAK256_H
+#define BITCOIN_CRYPTO_KECCAK256_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+
+/** A hasher class for Keccak-256, the original Keccak padding as used for block hashes. */
+class CKeccak256
+{
+private:
+    uint64_t s[25];
+    unsigned char buf[136];
+    size_t bufsize;
+
+public:
+    static const size_t OUTPUT_SIZE = 32;
+    static const size_t RATE = 136;
+
+    CKeccak256();
+    CKeccak256& Write(const unsigned char* data, size_t len);
+    void Finalize(unsigned char hash[OUTPUT_SIZE]);
+    CKeccak256& Reset();
+};
+
+/** Keccak-256 of exactly 80 bytes, a serialized block header, in a single permutation. */
+void Keccak256_80(unsigned char hash[CKeccak256::OUTPUT_SIZE], const unsigned char* data);
+
+/** Compute multiple Keccak-256's of 80-byte blobs, such as a run of block headers.
+ *  output:  pointer to a blocks*32 byte output buffer
+ *  input:   pointer to a blocks*80 byte input buffer
+ *  blocks:  the number of hashes to compute.
+ */
+void Keccak256_80Many(unsigned char* output, const unsigned char* input, size_t blocks);
+
+/** Autodetect the best available Keccak-f[1600] implementation.
+ *  Returns the name of the implementation.
+ */
+std::string Keccak256AutoDetect();
+
+#endif // BITCOIN_CRYPTO_KECCAK256_H
@@ -0,0 +1,44 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifdef ENABLE_AVX2
+
+#include "crypto/common.h"
+#include "crypto/keccak256_f1600.h"
+
+namespace keccak256_avx2
+{
+namespace
+{
+/** Four lanes in one AVX2 register, unsigned so the rotations shift in zeroes */
+typedef uint64_t Lanes4 __attribute__((vector_size(32)));
+}
+
+void Keccak256_80_4way(unsigned char* out, const unsigned char* in)
+{
+    Lanes4 st[25];
+    for (int i = 0; i < 10; i++) {
+        Lanes4 lane = {ReadLE64(in + 8 * i), ReadLE64(in + 80 + 8 * i), ReadLE64(in + 160 + 8 * i), ReadLE64(in + 240 + 8 * i)};
+        st[i] = lane;
+    }
+    const Lanes4 zero = {0, 0, 0, 0};
+    const Lanes4 padBegin = {0x01, 0x01, 0x01, 0x01};
+    const Lanes4 padEnd = {0x8000000000000000ull, 0x8000000000000000ull, 0x8000000000000000ull, 0x8000000000000000ull};
+    st[10] = padBegin;
+    for (int i = 11; i < 16; i++)
+        st[i] = zero;
+    st[16] = padEnd;
+    for (int i = 17; i < 25; i++)
+        st[i] = zero;
+
+    KeccakF1600Impl(st);
+
+    for (int j = 0; j < 4; j++) {
+        for (int i = 0; i < 4; i++)
+            WriteLE64(out + 32 * j + 8 * i, st[i][j]);
+    }
+}
+}
+
+#endif
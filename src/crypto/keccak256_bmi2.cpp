@@ -0,0 +1,20 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// The permutation built with BMI1/BMI2 enabled: chi's and-not becomes a single andn and the
+// lane rotations a rorx, which does not clobber its source register.
+
+#ifdef ENABLE_BMI2
+
+#include "crypto/keccak256_f1600.h"
+
+namespace keccak256_bmi2
+{
+void KeccakF1600(uint64_t* st)
+{
+    KeccakF1600Impl(st);
+}
+}
+
+#endif
@@ -0,0 +1,141 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_KECCAK256_F1600_H
+#define BITCOIN_CRYPTO_KECCAK256_F1600_H
+
+// The Keccak-f[1600] permutation, included by each translation unit that builds it for a
+// different instruction set. Everything here has internal linkage, so every such unit keeps
+// its own copy compiled with its own flags.
+
+#include <stdint.h>
+
+namespace
+{
+const uint64_t KeccakRoundConstants[24] = {
+    0x0000000000000001ull, 0x0000000000008082ull, 0x800000000000808aull, 0x8000000080008000ull,
+    0x000000000000808bull, 0x0000000080000001ull, 0x8000000080008081ull, 0x8000000000008009ull,
+    0x000000000000008aull, 0x0000000000000088ull, 0x0000000080008009ull, 0x000000008000000aull,
+    0x000000008000808bull, 0x800000000000008bull, 0x8000000000008089ull, 0x8000000000008003ull,
+    0x8000000000008002ull, 0x8000000000000080ull, 0x000000000000800aull, 0x800000008000000aull,
+    0x8000000080008081ull, 0x8000000000008080ull, 0x0000000080000001ull, 0x8000000080008008ull
+};
+
+template<typename Lane>
+Lane inline Rotl(Lane x, int n) { return (x << n) | (x >> (64 - n)); }
+
+/** Keccak-f[1600] on 25 lanes, lane x + 5 * y holding A[x, y]. The state lives in locals so
+ *  the compiler can keep it in registers across the unrolled steps of each round. Lane is
+ *  uint64_t, or a vector of them to run several independent states side by side. */
+template<typename Lane>
+void inline KeccakF1600Impl(Lane* st)
+{
+    Lane a00 = st[0], a10 = st[1], a20 = st[2], a30 = st[3], a40 = st[4];
+    Lane a01 = st[5], a11 = st[6], a21 = st[7], a31 = st[8], a41 = st[9];
+    Lane a02 = st[10], a12 = st[11], a22 = st[12], a32 = st[13], a42 = st[14];
+    Lane a03 = st[15], a13 = st[16], a23 = st[17], a33 = st[18], a43 = st[19];
+    Lane a04 = st[20], a14 = st[21], a24 = st[22], a34 = st[23], a44 = st[24];
+    Lane c0, c1, c2, c3, c4, d0, d1, d2, d3, d4;
+    Lane b00, b10, b20, b30, b40;
+    Lane b01, b11, b21, b31, b41;
+    Lane b02, b12, b22, b32, b42;
+    Lane b03, b13, b23, b33, b43;
+    Lane b04, b14, b24, b34, b44;
+
+    for (int round = 0; round < 24; ++round) {
+        // Theta
+        c0 = a00 ^ a01 ^ a02 ^ a03 ^ a04;
+        c1 = a10 ^ a11 ^ a12 ^ a13 ^ a14;
+        c2 = a20 ^ a21 ^ a22 ^ a23 ^ a24;
+        c3 = a30 ^ a31 ^ a32 ^ a33 ^ a34;
+        c4 = a40 ^ a41 ^ a42 ^ a43 ^ a44;
+        d0 = c4 ^ Rotl(c1, 1);
+        d1 = c0 ^ Rotl(c2, 1);
+        d2 = c1 ^ Rotl(c3, 1);
+        d3 = c2 ^ Rotl(c4, 1);
+        d4 = c3 ^ Rotl(c0, 1);
+        // Rho and pi
+        b00 = a00 ^ d0;
+        b02 = Rotl(a10 ^ d1, 1);
+        b04 = Rotl(a20 ^ d2, 62);
+        b01 = Rotl(a30 ^ d3, 28);
+        b03 = Rotl(a40 ^ d4, 27);
+        b13 = Rotl(a01 ^ d0, 36);
+        b10 = Rotl(a11 ^ d1, 44);
+        b12 = Rotl(a21 ^ d2, 6);
+        b14 = Rotl(a31 ^ d3, 55);
+        b11 = Rotl(a41 ^ d4, 20);
+        b21 = Rotl(a02 ^ d0, 3);
+        b23 = Rotl(a12 ^ d1, 10);
+        b20 = Rotl(a22 ^ d2, 43);
+        b22 = Rotl(a32 ^ d3, 25);
+        b24 = Rotl(a42 ^ d4, 39);
+        b34 = Rotl(a03 ^ d0, 41);
+        b31 = Rotl(a13 ^ d1, 45);
+        b33 = Rotl(a23 ^ d2, 15);
+        b30 = Rotl(a33 ^ d3, 21);
+        b32 = Rotl(a43 ^ d4, 8);
+        b42 = Rotl(a04 ^ d0, 18);
+        b44 = Rotl(a14 ^ d1, 2);
+        b41 = Rotl(a24 ^ d2, 61);
+        b43 = Rotl(a34 ^ d3, 56);
+        b40 = Rotl(a44 ^ d4, 14);
+        // Chi and iota
+        a00 = b00 ^ (~b10 & b20);
+        a10 = b10 ^ (~b20 & b30);
+        a20 = b20 ^ (~b30 & b40);
+        a30 = b30 ^ (~b40 & b00);
+        a40 = b40 ^ (~b00 & b10);
+        a01 = b01 ^ (~b11 & b21);
+        a11 = b11 ^ (~b21 & b31);
+        a21 = b21 ^ (~b31 & b41);
+        a31 = b31 ^ (~b41 & b01);
+        a41 = b41 ^ (~b01 & b11);
+        a02 = b02 ^ (~b12 & b22);
+        a12 = b12 ^ (~b22 & b32);
+        a22 = b22 ^ (~b32 & b42);
+        a32 = b32 ^ (~b42 & b02);
+        a42 = b42 ^ (~b02 & b12);
+        a03 = b03 ^ (~b13 & b23);
+        a13 = b13 ^ (~b23 & b33);
+        a23 = b23 ^ (~b33 & b43);
+        a33 = b33 ^ (~b43 & b03);
+        a43 = b43 ^ (~b03 & b13);
+        a04 = b04 ^ (~b14 & b24);
+        a14 = b14 ^ (~b24 & b34);
+        a24 = b24 ^ (~b34 & b44);
+        a34 = b34 ^ (~b44 & b04);
+        a44 = b44 ^ (~b04 & b14);
+        a00 ^= KeccakRoundConstants[round];
+    }
+
+    st[0] = a00;
+    st[1] = a10;
+    st[2] = a20;
+    st[3] = a30;
+    st[4] = a40;
+    st[5] = a01;
+    st[6] = a11;
+    st[7] = a21;
+    st[8] = a31;
+    st[9] = a41;
+    st[10] = a02;
+    st[11] = a12;
+    st[12] = a22;
+    st[13] = a32;
+    st[14] = a42;
+    st[15] = a03;
+    st[16] = a13;
+    st[17] = a23;
+    st[18] = a33;
+    st[19] = a43;
+    st[20] = a04;
+    st[21] = a14;
+    st[22] = a24;
+    st[23] = a34;
+    st[24] = a44;
+}
+}
+
+#endif // BITCOIN_CRYPTO_KECCAK256_F1600_H
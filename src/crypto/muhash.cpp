@@ -0,0 +1,173 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/muhash.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+
+#include <string.h>
+
+namespace
+{
+/** The modulus is 2^3072 - MODULUS_C. */
+const uint32_t MODULUS_C = 1103717;
+}
+
+Num3072::Num3072(const unsigned char* data)
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        limbs[i] = ReadLE32(data + 4 * i);
+    }
+    if (IsOverflow()) FullReduce();
+}
+
+void Num3072::SetToOne()
+{
+    limbs[0] = 1;
+    for (int i = 1; i < LIMBS; ++i) {
+        limbs[i] = 0;
+    }
+}
+
+/** Whether the number is at least the modulus, which only leaves values below 2^3072. */
+bool Num3072::IsOverflow() const
+{
+    if (limbs[0] < (uint32_t)-MODULUS_C) return false;
+    for (int i = 1; i < LIMBS; ++i) {
+        if (limbs[i] != 0xffffffff) return false;
+    }
+    return true;
+}
+
+/** Subtract the modulus, that is, add MODULUS_C and drop the 2^3072. */
+void Num3072::FullReduce()
+{
+    uint64_t c = MODULUS_C;
+    for (int i = 0; i < LIMBS; ++i) {
+        c += limbs[i];
+        limbs[i] = (uint32_t)c;
+        c >>= 32;
+    }
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    // Schoolbook multiplication into a 6144 bit product. The 64 bit intermediates can't overflow:
+    // (2^32-1)^2 + 2 * (2^32-1) = 2^64-1.
+    uint32_t tmp[2 * LIMBS] = {0};
+    for (int i = 0; i < LIMBS; ++i) {
+        uint64_t carry = 0;
+        for (int j = 0; j < LIMBS; ++j) {
+            carry += (uint64_t)limbs[i] * a.limbs[j] + tmp[i + j];
+            tmp[i + j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        tmp[i + LIMBS] = (uint32_t)carry;
+    }
+
+    // As 2^3072 = MODULUS_C modulo the prime, the upper half is folded into the lower one
+    // multiplied by MODULUS_C, and so is what carries out of it, until nothing is left above 2^3072.
+    uint64_t carry = 0;
+    for (int i = 0; i < LIMBS; ++i) {
+        carry += (uint64_t)tmp[LIMBS + i] * MODULUS_C + tmp[i];
+        limbs[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    while (carry) {
+        uint64_t c = carry * MODULUS_C;
+        for (int i = 0; i < LIMBS && c; ++i) {
+            c += limbs[i];
+            limbs[i] = (uint32_t)c;
+            c >>= 32;
+        }
+        carry = c;
+    }
+    if (IsOverflow()) FullReduce();
+}
+
+Num3072 Num3072::GetInverse() const
+{
+    // By Fermat's little theorem a^(p-2) is the inverse of a modulo the prime p. In p-2 all bits
+    // but the ones of the lowest limb are set.
+    Num3072 result;
+    for (int i = LIMBS - 1; i >= 0; --i) {
+        const uint32_t exponent = i ? 0xffffffff : (uint32_t)-(MODULUS_C + 2);
+        for (int bit = 31; bit >= 0; --bit) {
+            result.Multiply(result);
+            if ((exponent >> bit) & 1) result.Multiply(*this);
+        }
+    }
+    return result;
+}
+
+void Num3072::ToBytes(unsigned char* out) const
+{
+    for (int i = 0; i < LIMBS; ++i) {
+        WriteLE32(out + 4 * i, limbs[i]);
+    }
+}
+
+Num3072 MuHash3072::ToNum3072(const unsigned char* data, size_t len)
+{
+    unsigned char hash[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(hash);
+
+    // Expand the hash of the element to the size of the modulus.
+    unsigned char bytes[Num3072::BYTE_SIZE];
+    for (size_t i = 0; i < Num3072::BYTE_SIZE / CSHA256::OUTPUT_SIZE; ++i) {
+        unsigned char counter[4];
+        WriteLE32(counter, i);
+        CSHA256().Write(hash, sizeof(hash)).Write(counter, sizeof(counter)).Finalize(bytes + i * CSHA256::OUTPUT_SIZE);
+    }
+    return Num3072(bytes);
+}
+
+MuHash3072& MuHash3072::Insert(const unsigned char* data, size_t len)
+{
+    numerator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(const unsigned char* data, size_t len)
+{
+    denominator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& mul)
+{
+    numerator.Multiply(mul.numerator);
+    denominator.Multiply(mul.denominator);
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator/=(const MuHash3072& div)
+{
+    numerator.Multiply(div.denominator);
+    denominator.Multiply(div.numerator);
+    return *this;
+}
+
+void MuHash3072::Finalize(unsigned char hash[OUTPUT_SIZE])
+{
+    numerator.Multiply(denominator.GetInverse());
+    denominator.SetToOne();
+
+    unsigned char bytes[Num3072::BYTE_SIZE];
+    numerator.ToBytes(bytes);
+    CSHA256().Write(bytes, sizeof(bytes)).Finalize(hash);
+}
+
+void MuHash3072::GetState(unsigned char (&state)[STATE_SIZE]) const
+{
+    numerator.ToBytes(state);
+    denominator.ToBytes(state + Num3072::BYTE_SIZE);
+}
+
+void MuHash3072::SetState(const unsigned char (&state)[STATE_SIZE])
+{
+    numerator = Num3072(state);
+    denominator = Num3072(state + Num3072::BYTE_SIZE);
+}
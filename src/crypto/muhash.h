@@ -0,0 +1,70 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SMARTCASH_CRYPTO_MUHASH_H
+#define SMARTCASH_CRYPTO_MUHASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** A number modulo the prime 2^3072 - 1103717, stored in little endian 32 bit limbs. */
+class Num3072
+{
+public:
+    static const size_t BYTE_SIZE = 384;
+    static const int LIMBS = 96;
+
+    uint32_t limbs[LIMBS];
+
+    Num3072() { SetToOne(); }
+    /** Read BYTE_SIZE little endian bytes. */
+    explicit Num3072(const unsigned char* data);
+
+    void SetToOne();
+    void Multiply(const Num3072& a);
+    Num3072 GetInverse() const;
+    void ToBytes(unsigned char* out) const;
+
+private:
+    bool IsOverflow() const;
+    void FullReduce();
+};
+
+/**
+ * A hash of a set of byte strings that can be updated incrementally: elements can be added and
+ * removed in any order and the result only depends on the elements in the set.
+ *
+ * Every element is hashed to a number modulo a 3072 bit prime and the set is the product of its
+ * elements. Removing an element multiplies the denominator, so that updates stay cheap and only
+ * Finalize() has to compute the (expensive) modular inverse.
+ */
+class MuHash3072
+{
+private:
+    Num3072 numerator;
+    Num3072 denominator;
+
+    static Num3072 ToNum3072(const unsigned char* data, size_t len);
+
+public:
+    static const size_t OUTPUT_SIZE = 32;
+    static const size_t STATE_SIZE = 2 * Num3072::BYTE_SIZE;
+
+    /** The hash of the empty set. */
+    MuHash3072() {}
+
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+    MuHash3072& Remove(const unsigned char* data, size_t len);
+
+    /** Union and difference of the sets the hashes belong to. */
+    MuHash3072& operator*=(const MuHash3072& mul);
+    MuHash3072& operator/=(const MuHash3072& div);
+
+    void Finalize(unsigned char hash[OUTPUT_SIZE]);
+
+    void GetState(unsigned char (&state)[STATE_SIZE]) const;
+    void SetState(const unsigned char (&state)[STATE_SIZE]);
+};
+
+#endif // SMARTCASH_CRYPTO_MUHASH_H
@@ -15,6 +15,8 @@
 #include <memenv.h>
 #include <stdint.h>
 #include <algorithm>
+#include <atomic>
+#include <mutex>
 
 class CBitcoinLevelDBLogger : public leveldb::Logger {
 public:
@@ -73,14 +75,66 @@ public:
     }
 };
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+static const CDBProfile dbProfiles[] = {
+    // Point reads are cached, scans are not
+    { "steady", 50, 25, 64, true,  false },
+    // Most reads are of coins about to be spent, so memory goes to write
+    // buffers instead: larger memtables mean fewer level-0 compactions
+    { "ibd",    25, 37, 64, false, false },
+    // Small write buffers and fewer open tables, whose index blocks stay in memory
+    { "lowmem", 25, 12, 32, true,  false },
+};
+
+static std::atomic<const CDBProfile*> pDBProfile(&dbProfiles[0]);
+
+const CDBProfile& GetDBProfile()
+{
+    return *pDBProfile.load(std::memory_order_relaxed);
+}
+
+bool SetDBProfile(const std::string& strName)
+{
+    for (const CDBProfile& profile : dbProfiles) {
+        if (profile.strName == strName) {
+            pDBProfile = &profile;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string GetDBProfileNames()
+{
+    std::string strNames;
+    for (const CDBProfile& profile : dbProfiles)
+        strNames += (strNames.empty() ? "" : ", ") + profile.strName;
+    return strNames;
+}
+
+static std::mutex csSharedBlockCache;
+static std::shared_ptr<leveldb::Cache> pSharedBlockCache;
+
+void InitSharedBlockCache(size_t nTotalCacheSize)
+{
+    std::lock_guard<std::mutex> lock(csSharedBlockCache);
+    pSharedBlockCache.reset(leveldb::NewLRUCache(nTotalCacheSize * GetDBProfile().nBlockCachePercent / 100));
+}
+
+void ReleaseSharedBlockCache()
+{
+    std::lock_guard<std::mutex> lock(csSharedBlockCache);
+    pSharedBlockCache.reset();
+}
+
+static leveldb::Options GetOptions(size_t nCacheSize, int nFilterBits, leveldb::Cache* pblockcache)
 {
+    const CDBProfile& profile = GetDBProfile();
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+    options.block_cache = pblockcache;
+    options.write_buffer_size = nCacheSize * profile.nWriteBufferPercent / 100; // up to two write buffers may be held in memory simultaneously
+    options.filter_policy = nFilterBits > 0 ? leveldb::NewBloomFilterPolicy(nFilterBits) : NULL;
     options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    options.max_open_files = profile.nMaxOpenFiles;
     options.info_log = new CBitcoinLevelDBLogger();
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
@@ -90,14 +144,20 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate)
+CDBWrapper::CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate, int nFilterBits)
 {
     penv = NULL;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    {
+        std::lock_guard<std::mutex> lock(csSharedBlockCache);
+        pblockcache = pSharedBlockCache;
+    }
+    if (!pblockcache)
+        pblockcache.reset(leveldb::NewLRUCache(nCacheSize * GetDBProfile().nBlockCachePercent / 100));
+    options = GetOptions(nCacheSize, nFilterBits, pblockcache.get());
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -149,8 +209,8 @@ CDBWrapper::~CDBWrapper()
     options.filter_policy = NULL;
     delete options.info_log;
     options.info_log = NULL;
-    delete options.block_cache;
     options.block_cache = NULL;
+    pblockcache.reset();
     delete penv;
     options.env = NULL;
 }
@@ -215,4 +275,25 @@ const std::vector<unsigned char>& GetObfuscateKey(const CDBWrapper &w)
     return w.obfuscate_key;
 }
 
+bool IsObfuscated(const CDBWrapper &w)
+{
+    for (unsigned char c : GetObfuscateKey(w)) {
+        if (c)
+            return true;
+    }
+    return false;
+}
+
+void Xor(char* pch, size_t nSize, const std::vector<unsigned char>& key)
+{
+    if (key.empty())
+        return;
+
+    for (size_t i = 0, j = 0; i != nSize; i++) {
+        pch[i] ^= key[j++];
+        if (j == key.size())
+            j = 0;
+    }
+}
+
 };
@@ -12,6 +12,8 @@
 #include "utilstrencodings.h"
 #include "version.h"
 
+#include <memory>
+
 #include <boost/filesystem/path.hpp>
 
 #include <leveldb/db.h>
@@ -19,6 +21,47 @@
 
 static const size_t DBWRAPPER_PREALLOC_KEY_SIZE = 64;
 static const size_t DBWRAPPER_PREALLOC_VALUE_SIZE = 1024;
+//! Bloom filter bits per key of a database's tables, 0 for no filter
+static const int DEFAULT_DB_FILTER_BITS = 10;
+//! -dbprofile default
+static const char * const DEFAULT_DB_PROFILE = "steady";
+//! -dbsharedcache default
+static const bool DEFAULT_DB_SHARED_CACHE = true;
+
+/** A named set of LevelDB tuning parameters, selected by -dbprofile and setdbprofile. */
+struct CDBProfile
+{
+    std::string strName;
+    //! Share of a database's cache budget given to its block cache (percent)
+    int nBlockCachePercent;
+    //! Share given to each of its up to two write buffers (percent)
+    int nWriteBufferPercent;
+    //! Files LevelDB keeps open per database
+    int nMaxOpenFiles;
+    //! Whether point reads and iterators add the blocks they read to the block cache
+    bool fFillCacheOnRead;
+    bool fFillCacheOnIterate;
+};
+
+/**
+ * The profile in use. Block cache, write buffer and open file settings are
+ * fixed by LevelDB when a database is opened; the cache fill policy applies
+ * to every read from the moment the profile is switched.
+ */
+const CDBProfile& GetDBProfile();
+/** Switch to the named profile. Returns false if there is no such profile. */
+bool SetDBProfile(const std::string& strName);
+/** The names of all profiles, comma separated. */
+std::string GetDBProfileNames();
+
+/**
+ * Have databases opened from now on share one LRU block cache, sized for
+ * nTotalCacheSize bytes of database cache under the current profile,
+ * instead of each keeping its own.
+ */
+void InitSharedBlockCache(size_t nTotalCacheSize);
+/** Stop handing out the shared block cache. It is freed with the last database using it. */
+void ReleaseSharedBlockCache();
 
 class dbwrapper_error : public std::runtime_error
 {
@@ -42,6 +85,12 @@ void HandleError(const leveldb::Status& status);
  */
 const std::vector<unsigned char>& GetObfuscateKey(const CDBWrapper &w);
 
+/** Whether values of the database are obfuscated, i.e. its key isn't all zero. */
+bool IsObfuscated(const CDBWrapper &w);
+
+/** Xor nSize bytes at pch with the repeated key, like CDataStream::Xor. */
+void Xor(char* pch, size_t nSize, const std::vector<unsigned char>& key);
+
 };
 
 /** Batch of changes queued to be written to a CDBWrapper */
@@ -117,15 +166,18 @@ class CDBIterator
 private:
     const CDBWrapper &parent;
     leveldb::Iterator *piter;
+    //! Snapshot the iterator reads, kept until the iterator is gone
+    std::shared_ptr<const leveldb::Snapshot> psnapshot;
 
 public:
 
     /**
      * @param[in] _parent          Parent CDBWrapper instance.
      * @param[in] _piter           The original leveldb iterator.
+     * @param[in] _psnapshot       The snapshot _piter reads, if any.
      */
-    CDBIterator(const CDBWrapper &_parent, leveldb::Iterator *_piter) :
-        parent(_parent), piter(_piter) { };
+    CDBIterator(const CDBWrapper &_parent, leveldb::Iterator *_piter, const std::shared_ptr<const leveldb::Snapshot> &_psnapshot = std::shared_ptr<const leveldb::Snapshot>()) :
+        parent(_parent), piter(_piter), psnapshot(_psnapshot) { };
     ~CDBIterator();
 
     bool Valid();
@@ -145,7 +197,7 @@ public:
     template<typename K> bool GetKey(K& key) {
         leveldb::Slice slKey = piter->key();
         try {
-            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            CSpanReader ssKey(slKey.data(), slKey.size(), SER_DISK, CLIENT_VERSION);
             ssKey >> key;
         } catch (const std::exception&) {
             return false;
@@ -160,9 +212,14 @@ public:
     template<typename V> bool GetValue(V& value) {
         leveldb::Slice slValue = piter->value();
         try {
-            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
-            ssValue.Xor(dbwrapper_private::GetObfuscateKey(parent));
-            ssValue >> value;
+            if (!dbwrapper_private::IsObfuscated(parent)) {
+                CSpanReader(slValue.data(), slValue.size(), SER_DISK, CLIENT_VERSION) >> value;
+                return true;
+            }
+            // The slice belongs to the iterator, deobfuscate a plain copy of it
+            std::vector<char> vValue(slValue.data(), slValue.data() + slValue.size());
+            dbwrapper_private::Xor(vValue.data(), vValue.size(), dbwrapper_private::GetObfuscateKey(parent));
+            CSpanReader(vValue.data(), vValue.size(), SER_DISK, CLIENT_VERSION) >> value;
         } catch (const std::exception&) {
             return false;
         }
@@ -185,6 +242,9 @@ private:
     //! database options used
     leveldb::Options options;
 
+    //! the block cache in options, owned by this database alone unless shared
+    std::shared_ptr<leveldb::Cache> pblockcache;
+
     //! options used when reading from the database
     leveldb::ReadOptions readoptions;
 
@@ -211,6 +271,20 @@ private:
 
     std::vector<unsigned char> CreateObfuscateKey() const;
 
+    leveldb::ReadOptions GetReadOptions() const
+    {
+        leveldb::ReadOptions profileoptions = readoptions;
+        profileoptions.fill_cache = GetDBProfile().fFillCacheOnRead;
+        return profileoptions;
+    }
+
+    leveldb::ReadOptions GetIterOptions() const
+    {
+        leveldb::ReadOptions profileoptions = iteroptions;
+        profileoptions.fill_cache = GetDBProfile().fFillCacheOnIterate;
+        return profileoptions;
+    }
+
 public:
     /**
      * @param[in] path        Location in the filesystem where leveldb data will be stored.
@@ -219,8 +293,9 @@ public:
      * @param[in] fWipe       If true, remove all existing data.
      * @param[in] obfuscate   If true, store data obfuscated via simple XOR. If false, XOR
      *                        with a zero'd byte array.
+     * @param[in] nFilterBits Bloom filter bits per key, 0 for databases only ever scanned.
      */
-    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false);
+    CDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool obfuscate = false, int nFilterBits = DEFAULT_DB_FILTER_BITS);
     ~CDBWrapper();
 
     template <typename K, typename V>
@@ -232,7 +307,7 @@ public:
         leveldb::Slice slKey(ssKey.data(), ssKey.size());
 
         std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        leveldb::Status status = pdb->Get(GetReadOptions(), slKey, &strValue);
         if (!status.ok()) {
             if (status.IsNotFound())
                 return false;
@@ -240,9 +315,9 @@ public:
             dbwrapper_private::HandleError(status);
         }
         try {
-            CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
-            ssValue.Xor(obfuscate_key);
-            ssValue >> value;
+            if (dbwrapper_private::IsObfuscated(*this))
+                dbwrapper_private::Xor(&strValue[0], strValue.size(), obfuscate_key);
+            CSpanReader(strValue.data(), strValue.size(), SER_DISK, CLIENT_VERSION) >> value;
         } catch (const std::exception&) {
             return false;
         }
@@ -266,7 +341,7 @@ public:
         leveldb::Slice slKey(ssKey.data(), ssKey.size());
 
         std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        leveldb::Status status = pdb->Get(GetReadOptions(), slKey, &strValue);
         if (!status.ok()) {
             if (status.IsNotFound())
                 return false;
@@ -300,7 +375,22 @@ public:
 
     CDBIterator *NewIterator()
     {
-        return new CDBIterator(*this, pdb->NewIterator(iteroptions));
+        return new CDBIterator(*this, pdb->NewIterator(GetIterOptions()));
+    }
+
+    /** The state of the database as of now, released when the last user of it is gone. */
+    std::shared_ptr<const leveldb::Snapshot> GetSnapshot() const
+    {
+        leveldb::DB *pdbSnapshot = pdb;
+        return std::shared_ptr<const leveldb::Snapshot>(pdb->GetSnapshot(), [pdbSnapshot](const leveldb::Snapshot *p) { pdbSnapshot->ReleaseSnapshot(p); });
+    }
+
+    /** An iterator over the database as of the snapshot, so that several of them see the same state. */
+    CDBIterator *NewIterator(const std::shared_ptr<const leveldb::Snapshot> &psnapshot)
+    {
+        leveldb::ReadOptions snapshotoptions = GetIterOptions();
+        snapshotoptions.snapshot = psnapshot.get();
+        return new CDBIterator(*this, pdb->NewIterator(snapshotoptions), psnapshot);
     }
 
     /**
@@ -56,5 +56,7 @@ void CDSNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindexNew, con
 void CDSNotificationInterface::SyncTransaction(const CTransaction &tx, const CBlock *pblock)
 {
     instantsend.SyncTransaction(tx, pblock);
+    if (pblock)
+        mnodeman.CheckSpentCollaterals(tx);
     //CPrivateSend::SyncTransaction(tx, pblock);
 }
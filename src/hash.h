@@ -7,6 +7,7 @@
 #define BITCOIN_HASH_H
 
 #include "crypto/ripemd160.h"
+#include "crypto/keccak256.h"
 #include "crypto/sha256.h"
 #include "crypto/sph_keccak.h"
 #include "prevector.h"
@@ -131,15 +132,13 @@ inline uint160 Hash160(const prevector<N, unsigned char>& vch)
 
 template<typename T1>
 inline uint256 HashKeccak(const T1 pbegin, const T1 pend)
-{        {
-    sph_keccak256_context ctx_keccak;
-    static unsigned char pblank[1];
+{
+    static const unsigned char pblank[1] = {};
     uint256 hash;
-    sph_keccak256_init(&ctx_keccak);
-    sph_keccak256 (&ctx_keccak, (pbegin == pend ? pblank : static_cast<const void*>(&pbegin[0])), (pend - pbegin) * sizeof(pbegin[0]));
-    sph_keccak256_close(&ctx_keccak, static_cast<void*>(&hash));
+    CKeccak256().Write(pbegin == pend ? pblank : (const unsigned char*)&pbegin[0], (pend - pbegin) * sizeof(pbegin[0]))
+                .Finalize((unsigned char*)&hash);
     return hash;
-}        }
+}
 
 template<typename T1, typename T2>
 inline uint256 Hash4(const T1 p1begin, const T1 p1end,
@@ -211,7 +210,12 @@ uint256 SerializeHash(const T& obj, int nType=SER_GETHASH, int nVersion=PROTOCOL
     return ss.GetHash();
 }
 
-unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char>& vDataToHash);
+unsigned int MurmurHash3(unsigned int nHashSeed, const unsigned char* pDataToHash, size_t nDataSize);
+
+inline unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char>& vDataToHash)
+{
+    return MurmurHash3(nHashSeed, vDataToHash.data(), vDataToHash.size());
+}
 
 void BIP32Hash(const ChainCode &chainCode, unsigned int nChild, unsigned char header, const unsigned char data[32], unsigned char output[64]);
 
@@ -0,0 +1,72 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "headerscache.h"
+
+#include "chain.h"
+#include "version.h"
+
+#include <vector>
+
+CDataStream CHeadersCache::Encode(const CBlockIndex* pindexLast, int nCount)
+{
+    std::vector<const CBlockIndex*> vBlocks(nCount);
+    for( int i = nCount - 1; i >= 0; --i ){
+        assert(pindexLast);
+        vBlocks[i] = pindexLast;
+        pindexLast = pindexLast->pprev;
+    }
+
+    // Each header goes out as a block without transactions
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss.reserve(GetSizeOfCompactSize(nCount) + nCount * (CBlockHeader::SERIALIZED_SIZE + 1));
+    WriteCompactSize(ss, nCount);
+    for( const CBlockIndex *pindex : vBlocks ){
+        ss << pindex->GetBlockHeader();
+        WriteCompactSize(ss, 0);
+    }
+
+    return ss;
+}
+
+std::shared_ptr<const CRelayMessage> CHeadersCache::Get(const CBlockIndex* pindexLast, int nCount)
+{
+    if( nCount != nMaxHeaders || nMaxReplies == 0 )
+        return std::make_shared<const CRelayMessage>(Encode(pindexLast, nCount));
+
+    uint256 hashLast = pindexLast->GetBlockHash();
+
+    {
+        LOCK(cs);
+        for( auto it = listReplies.begin(); it != listReplies.end(); ++it ){
+            if( it->first != hashLast ) continue;
+            listReplies.splice(listReplies.begin(), listReplies, it);
+            return it->second;
+        }
+    }
+
+    // Encoded outside the lock, a reply requested twice meanwhile just gets encoded twice
+    std::shared_ptr<const CRelayMessage> msg = std::make_shared<const CRelayMessage>(Encode(pindexLast, nCount));
+
+    LOCK(cs);
+    for( const Entry &entry : listReplies )
+        if( entry.first == hashLast ) return entry.second;
+
+    listReplies.push_front(Entry(hashLast, msg));
+    while( listReplies.size() > nMaxReplies ) listReplies.pop_back();
+
+    return msg;
+}
+
+void CHeadersCache::Clear()
+{
+    LOCK(cs);
+    listReplies.clear();
+}
+
+size_t CHeadersCache::size()
+{
+    LOCK(cs);
+    return listReplies.size();
+}
@@ -0,0 +1,48 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SMARTCASH_HEADERSCACHE_H
+#define SMARTCASH_HEADERSCACHE_H
+
+#include "net.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <list>
+#include <memory>
+
+class CBlockIndex;
+
+//! Number of full headers replies kept encoded by the headers cache, about 160 kB each
+static const size_t DEFAULT_HEADERS_CACHE_REPLIES = 32;
+
+/** Keeps encoded and checksummed headers replies of nMaxHeaders headers, so peers syncing
+ *  the same ranges of the chain get them without the headers being serialized again. A
+ *  reply is identified by its last block, its headers are that block and its ancestors.
+ *  Shorter replies, near the tip or up to a hashStop, are encoded each time. The headers
+ *  are read through pprev, so no lock of the chain is needed once the last block is known.
+ */
+class CHeadersCache
+{
+private:
+    typedef std::pair<uint256, std::shared_ptr<const CRelayMessage> > Entry;
+
+    CCriticalSection cs;
+    std::list<Entry> listReplies; // most recently used first
+    size_t nMaxReplies;
+    int nMaxHeaders;
+
+public:
+    CHeadersCache(int nMaxHeadersIn, size_t nMaxRepliesIn = DEFAULT_HEADERS_CACHE_REPLIES) : nMaxReplies(nMaxRepliesIn), nMaxHeaders(nMaxHeadersIn) {}
+
+    //! Encode the headers of the nCount blocks ending at pindexLast as the payload of a headers message.
+    static CDataStream Encode(const CBlockIndex* pindexLast, int nCount);
+
+    //! The headers message of the nCount blocks ending at pindexLast, NULL for none.
+    std::shared_ptr<const CRelayMessage> Get(const CBlockIndex* pindexLast, int nCount);
+    void Clear();
+    size_t size();
+};
+
+#endif // SMARTCASH_HEADERSCACHE_H
@@ -24,6 +24,19 @@
 /** WWW-Authenticate to present with 401 Unauthorized response */
 static const char* WWW_AUTH_HEADER_DATA = "Basic realm=\"jsonrpc\"";
 
+/** Methods run in their own work queue if no -rpcqueuemethod is given */
+static const char* const DEFAULT_RPC_QUEUE_METHODS[] = {
+    "getblocktemplate:mining",
+    "submitblock:mining",
+    "getmininginfo:mining",
+};
+
+/** How much of a request body is searched for its method */
+static const size_t RPC_QUEUE_PEEK_SIZE = 4096;
+
+/** Work queue names by RPC method */
+static std::map<std::string, std::string> mapRPCMethodQueues;
+
 /** Simple one-shot callback timer to be used by the RPC mechanism to e.g.
  * re-lock the wellet.
  */
@@ -188,6 +201,7 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
 
             // Send reply
             strReply = JSONRPCReply(result, NullUniValue, jreq.id);
+            RPCRecordResponseSize(jreq.strMethod, strReply.size());
 
         // array of requests
         } else if (valRequest.isArray())
@@ -225,13 +239,67 @@ static bool InitRPCAuthentication()
     return true;
 }
 
+/**
+ * The method of a JSON-RPC request, or of the first call of a batch, looked up
+ * in the raw body without parsing it. It only decides the work queue, so
+ * finding the wrong one or none at all does no harm.
+ */
+static std::string PeekJSONRPCMethod(HTTPRequest* req)
+{
+    std::string strBody = req->PeekBody(RPC_QUEUE_PEEK_SIZE);
+    size_t pos = strBody.find("\"method\"");
+    if (pos == std::string::npos)
+        return "";
+    pos = strBody.find_first_not_of(" \t\r\n", pos + 8);
+    if (pos == std::string::npos || strBody[pos] != ':')
+        return "";
+    pos = strBody.find_first_not_of(" \t\r\n", pos + 1);
+    if (pos == std::string::npos || strBody[pos] != '"')
+        return "";
+    size_t end = strBody.find('"', pos + 1);
+    if (end == std::string::npos)
+        return "";
+    return strBody.substr(pos + 1, end - pos - 1);
+}
+
+static std::string HTTPReq_JSONRPC_Queue(HTTPRequest* req)
+{
+    if (mapRPCMethodQueues.empty())
+        return "";
+    std::map<std::string, std::string>::const_iterator it = mapRPCMethodQueues.find(PeekJSONRPCMethod(req));
+    return it != mapRPCMethodQueues.end() ? it->second : "";
+}
+
+static bool InitRPCMethodQueues()
+{
+    std::vector<std::string> vRules;
+    if (mapMultiArgs.count("-rpcqueuemethod"))
+        vRules = mapMultiArgs["-rpcqueuemethod"];
+    else
+        vRules.assign(DEFAULT_RPC_QUEUE_METHODS, DEFAULT_RPC_QUEUE_METHODS + ARRAYLEN(DEFAULT_RPC_QUEUE_METHODS));
+
+    // Queues unknown to the HTTP server fall back to the default queue
+    BOOST_FOREACH(const std::string& strRule, vRules) {
+        size_t pos = strRule.find(':');
+        if (pos == std::string::npos || pos == 0 || pos + 1 == strRule.size()) {
+            uiInterface.ThreadSafeMessageBox(strprintf("Invalid -rpcqueuemethod=%s, use <method>:<queue>", strRule),
+                "", CClientUIInterface::MSG_ERROR);
+            return false;
+        }
+        mapRPCMethodQueues[strRule.substr(0, pos)] = strRule.substr(pos + 1);
+    }
+    return true;
+}
+
 bool StartHTTPRPC()
 {
     LogPrint("rpc", "Starting HTTP RPC server\n");
     if (!InitRPCAuthentication())
         return false;
+    if (!InitRPCMethodQueues())
+        return false;
 
-    RegisterHTTPHandler("/", true, HTTPReq_JSONRPC);
+    RegisterHTTPHandler("/", true, HTTPReq_JSONRPC, HTTPReq_JSONRPC_Queue);
 
     assert(EventBase());
     httpRPCTimerInterface = new HTTPRPCTimerInterface(EventBase());
@@ -248,6 +316,7 @@ void StopHTTPRPC()
 {
     LogPrint("rpc", "Stopping HTTP RPC server\n");
     UnregisterHTTPHandler("/", true);
+    mapRPCMethodQueues.clear();
     if (httpRPCTimerInterface) {
         RPCUnregisterTimerInterface(httpRPCTimerInterface);
         delete httpRPCTimerInterface;
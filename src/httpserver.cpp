@@ -11,6 +11,8 @@
 #include "rpc/protocol.h" // For HTTP status codes
 #include "sync.h"
 #include "ui_interface.h"
+#include "utilstrencodings.h"
+#include "utiltime.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -34,11 +36,37 @@
 #endif
 #endif
 
+#include <atomic>
+
 #include <boost/algorithm/string/case_conv.hpp> // for to_lower()
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
 #include <boost/foreach.hpp>
 
 /** Maximum size of http request (request line + headers) */
 static const size_t MAX_HEADERS_SIZE = 8192;
+/** Bytes of a chunked reply that may wait for a slow client before the writer blocks */
+static const size_t MAX_CHUNKED_QUEUED = 4 * 1024 * 1024;
+
+/** State of a chunked reply, shared by the worker writing it and the http thread sending it */
+struct HTTPChunkedReply
+{
+    CWaitableCriticalSection cs;
+    CConditionVariable cond;
+    /** Bytes handed out since libevent last reported the connection's output as written */
+    size_t nQueued;
+    /** The client went away, the rest of the reply is dropped */
+    bool fClosed;
+
+    HTTPChunkedReply() : nQueued(0), fClosed(false) {}
+};
+
+static void http_chunked_closed(HTTPChunkedReply* chunked)
+{
+    boost::lock_guard<boost::mutex> lock(chunked->cs);
+    chunked->fClosed = true;
+    chunked->cond.notify_all();
+}
 
 /** HTTP request work item */
 class HTTPWorkItem : public HTTPClosure
@@ -70,10 +98,18 @@ private:
     /** Mutex protects entire object */
     CWaitableCriticalSection cs;
     CConditionVariable cond;
-    std::deque<std::unique_ptr<WorkItem>> queue;
+    /** Items with the time they were queued at */
+    std::deque<std::pair<int64_t, std::unique_ptr<WorkItem>>> queue;
     bool running;
     size_t maxDepth;
     int numThreads;
+    /** Counters for HTTPWorkQueueStats */
+    int numActive;
+    uint64_t nProcessed;
+    uint64_t nRejected;
+    int64_t nWaitTotal;
+    int64_t nWaitMax;
+    int64_t nRunTotal;
 
     /** RAII object to keep track of number of running worker threads */
     class ThreadCounter
@@ -96,7 +132,13 @@ private:
 public:
     WorkQueue(size_t maxDepth) : running(true),
                                  maxDepth(maxDepth),
-                                 numThreads(0)
+                                 numThreads(0),
+                                 numActive(0),
+                                 nProcessed(0),
+                                 nRejected(0),
+                                 nWaitTotal(0),
+                                 nWaitMax(0),
+                                 nRunTotal(0)
     {
     }
     /** Precondition: worker threads have all stopped
@@ -110,9 +152,10 @@ public:
     {
         boost::unique_lock<boost::mutex> lock(cs);
         if (queue.size() >= maxDepth) {
+            nRejected++;
             return false;
         }
-        queue.emplace_back(std::unique_ptr<WorkItem>(item));
+        queue.emplace_back(GetTimeMicros(), std::unique_ptr<WorkItem>(item));
         cond.notify_one();
         return true;
     }
@@ -128,10 +171,21 @@ public:
                     cond.wait(lock);
                 if (!running)
                     break;
-                i = std::move(queue.front());
+                int64_t nWait = GetTimeMicros() - queue.front().first;
+                nWaitTotal += nWait;
+                nWaitMax = std::max(nWaitMax, nWait);
+                numActive++;
+                i = std::move(queue.front().second);
                 queue.pop_front();
             }
+            int64_t nStart = GetTimeMicros();
             (*i)();
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                nRunTotal += GetTimeMicros() - nStart;
+                nProcessed++;
+                numActive--;
+            }
         }
     }
     /** Interrupt and exit loops */
@@ -155,18 +209,33 @@ public:
         boost::unique_lock<boost::mutex> lock(cs);
         return queue.size();
     }
+
+    void GetStats(HTTPWorkQueueStats& stats)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        stats.nThreads = numThreads;
+        stats.nActive = numActive;
+        stats.nDepth = queue.size();
+        stats.nMaxDepth = maxDepth;
+        stats.nProcessed = nProcessed;
+        stats.nRejected = nRejected;
+        stats.nWaitTotal = nWaitTotal;
+        stats.nWaitMax = nWaitMax;
+        stats.nRunTotal = nRunTotal;
+    }
 };
 
 struct HTTPPathHandler
 {
     HTTPPathHandler() {}
-    HTTPPathHandler(std::string prefix, bool exactMatch, HTTPRequestHandler handler):
-        prefix(prefix), exactMatch(exactMatch), handler(handler)
+    HTTPPathHandler(std::string prefix, bool exactMatch, HTTPRequestHandler handler, HTTPQueueSelector queueSelector):
+        prefix(prefix), exactMatch(exactMatch), handler(handler), queueSelector(queueSelector)
     {
     }
     std::string prefix;
     bool exactMatch;
     HTTPRequestHandler handler;
+    HTTPQueueSelector queueSelector;
 };
 
 /** HTTP module state */
@@ -179,10 +248,34 @@ struct evhttp* eventHTTP = 0;
 static std::vector<CSubNet> rpc_allow_subnets;
 //! Work queue for handling longer requests off the event loop thread
 static WorkQueue<HTTPClosure>* workQueue = 0;
+//! All work queues by name, the default one included, with their number of worker threads
+static std::map<std::string, std::pair<WorkQueue<HTTPClosure>*, int> > mapWorkQueues;
+//! URI prefixes whose requests go to a named work queue
+static std::vector<std::pair<std::string, std::string> > vWorkQueueURIs;
 //! Handlers for (sub)paths
 std::vector<HTTPPathHandler> pathHandlers;
 //! Bound listening sockets
 std::vector<evhttp_bound_socket *> boundSockets;
+//! Set by InterruptHTTPServer, stops workers waiting on slow chunked reply clients
+static std::atomic<bool> fHTTPInterrupted(false);
+
+/** What the http thread knows about an open client connection */
+struct HTTPConnection
+{
+    uint64_t nRequests;
+    //! The chunked reply being sent on the connection, if any
+    std::shared_ptr<HTTPChunkedReply> chunked;
+
+    HTTPConnection() : nRequests(0) {}
+};
+
+//! Open client connections, only touched by the http thread
+static std::map<struct evhttp_connection*, HTTPConnection> mapHTTPConnections;
+//! Counters for HTTPConnectionStats
+static std::atomic<uint64_t> nHTTPConnectionsAccepted(0);
+static std::atomic<uint64_t> nHTTPConnectionsOpen(0);
+static std::atomic<uint64_t> nHTTPRequests(0);
+static std::atomic<uint64_t> nHTTPRequestsReused(0);
 
 /** Check if a network address is allowed to access the HTTP server */
 static bool ClientAllowed(const CNetAddr& netaddr)
@@ -247,9 +340,53 @@ static std::string RequestMethodString(HTTPRequest::RequestMethod m)
     }
 }
 
+/** The work queue a request runs in: the one its handler picks, else the one
+ * for its URI prefix, else the default queue */
+static WorkQueue<HTTPClosure>* SelectWorkQueue(HTTPRequest* req, const std::string& strURI, const HTTPQueueSelector& queueSelector)
+{
+    std::string strQueue;
+    if (queueSelector)
+        strQueue = queueSelector(req);
+    for (unsigned int i = 0; strQueue.empty() && i < vWorkQueueURIs.size(); i++)
+        if (strURI.compare(0, vWorkQueueURIs[i].first.size(), vWorkQueueURIs[i].first) == 0)
+            strQueue = vWorkQueueURIs[i].second;
+    std::map<std::string, std::pair<WorkQueue<HTTPClosure>*, int> >::const_iterator it = mapWorkQueues.find(strQueue);
+    return it != mapWorkQueues.end() ? it->second.first : workQueue;
+}
+
 /** HTTP request callback */
+/** Forget a client connection libevent is freeing, ending a chunked reply on it */
+static void http_connection_close_cb(struct evhttp_connection* evcon, void*)
+{
+    std::map<struct evhttp_connection*, HTTPConnection>::iterator it = mapHTTPConnections.find(evcon);
+    if (it == mapHTTPConnections.end())
+        return;
+    if (it->second.chunked)
+        http_chunked_closed(it->second.chunked.get());
+    mapHTTPConnections.erase(it);
+    nHTTPConnectionsOpen--;
+}
+
+/** Count a request, and its connection if it is the first request on it */
+static void http_track_connection(struct evhttp_request* req)
+{
+    nHTTPRequests++;
+    struct evhttp_connection* evcon = evhttp_request_get_connection(req);
+    if (!evcon)
+        return;
+    HTTPConnection& conn = mapHTTPConnections[evcon];
+    if (conn.nRequests++ == 0) {
+        evhttp_connection_set_closecb(evcon, http_connection_close_cb, NULL);
+        nHTTPConnectionsAccepted++;
+        nHTTPConnectionsOpen++;
+    } else {
+        nHTTPRequestsReused++;
+    }
+}
+
 static void http_request_cb(struct evhttp_request* req, void* arg)
 {
+    http_track_connection(req);
     std::unique_ptr<HTTPRequest> hreq(new HTTPRequest(req));
 
     LogPrint("http", "Received a %s request for %s from %s\n",
@@ -286,12 +423,13 @@ static void http_request_cb(struct evhttp_request* req, void* arg)
 
     // Dispatch to worker thread
     if (i != iend) {
+        WorkQueue<HTTPClosure>* queue = SelectWorkQueue(hreq.get(), strURI, i->queueSelector);
         std::unique_ptr<HTTPWorkItem> item(new HTTPWorkItem(std::move(hreq), path, i->handler));
-        assert(workQueue);
-        if (workQueue->Enqueue(item.get()))
+        assert(queue);
+        if (queue->Enqueue(item.get()))
             item.release(); /* if true, queue took ownership */
         else {
-            LogPrintf("WARNING: request rejected because http work queue depth exceeded, it can be increased with the -rpcworkqueue= setting\n");
+            LogPrintf("WARNING: request rejected because http work queue depth exceeded, it can be increased with the -rpcworkqueue= or -rpcqueue= settings\n");
             item->req->WriteReply(HTTP_INTERNAL, "Work queue depth exceeded");
         }
     } else {
@@ -375,6 +513,49 @@ static void libevent_log_cb(int severity, const char *msg)
         LogPrint("libevent", "libevent: %s\n", msg);
 }
 
+/** Create the default work queue and the ones set up with -rpcqueue, and read -rpcqueueuri */
+static bool InitHTTPWorkQueues()
+{
+    int workQueueDepth = std::max((long)GetArg("-rpcworkqueue", DEFAULT_HTTP_WORKQUEUE), 1L);
+    int rpcThreads = std::max((long)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L);
+    LogPrintf("HTTP: creating work queue of depth %d\n", workQueueDepth);
+    workQueue = new WorkQueue<HTTPClosure>(workQueueDepth);
+    mapWorkQueues["default"] = std::make_pair(workQueue, rpcThreads);
+
+    std::vector<std::string> vQueues;
+    if (mapMultiArgs.count("-rpcqueue"))
+        vQueues = mapMultiArgs["-rpcqueue"];
+    else
+        vQueues.push_back(DEFAULT_HTTP_EXTRA_QUEUE);
+    BOOST_FOREACH (const std::string& strQueue, vQueues) {
+        std::vector<std::string> vParts;
+        boost::split(vParts, strQueue, boost::is_any_of(":"));
+        int32_t nThreads = 0, nDepth = workQueueDepth;
+        if (vParts.size() < 2 || vParts.size() > 3 || vParts[0].empty() || mapWorkQueues.count(vParts[0]) ||
+            !ParseInt32(vParts[1], &nThreads) || nThreads < 1 ||
+            (vParts.size() == 3 && (!ParseInt32(vParts[2], &nDepth) || nDepth < 1))) {
+            uiInterface.ThreadSafeMessageBox(strprintf("Invalid -rpcqueue=%s, use <name>:<threads>[:<depth>] with a new name", strQueue),
+                "", CClientUIInterface::MSG_ERROR);
+            return false;
+        }
+        LogPrintf("HTTP: creating work queue '%s' of depth %d\n", vParts[0], nDepth);
+        mapWorkQueues[vParts[0]] = std::make_pair(new WorkQueue<HTTPClosure>(nDepth), (int)nThreads);
+    }
+
+    if (mapMultiArgs.count("-rpcqueueuri")) {
+        BOOST_FOREACH (const std::string& strRule, mapMultiArgs["-rpcqueueuri"]) {
+            size_t pos = strRule.rfind(':');
+            if (pos == std::string::npos || pos == 0 || !mapWorkQueues.count(strRule.substr(pos + 1))) {
+                uiInterface.ThreadSafeMessageBox(strprintf("Invalid -rpcqueueuri=%s, use <prefix>:<queue> with a known queue", strRule),
+                    "", CClientUIInterface::MSG_ERROR);
+                return false;
+            }
+            vWorkQueueURIs.push_back(std::make_pair(strRule.substr(0, pos), strRule.substr(pos + 1)));
+        }
+    }
+    return true;
+}
+
 bool InitHTTPServer()
 {
     struct evhttp* http = 0;
@@ -383,6 +564,9 @@ bool InitHTTPServer()
     if (!InitHTTPAllowList())
         return false;
 
+    if (!InitHTTPWorkQueues())
+        return false;
+
     if (GetBoolArg("-rpcssl", false)) {
         uiInterface.ThreadSafeMessageBox(
             "SSL mode for RPC (-rpcssl) is no longer supported.",
@@ -433,10 +617,6 @@ bool InitHTTPServer()
     }
 
     LogPrint("http", "Initialized HTTP server\n");
-    int workQueueDepth = std::max((long)GetArg("-rpcworkqueue", DEFAULT_HTTP_WORKQUEUE), 1L);
-    LogPrintf("HTTP: creating work queue of depth %d\n", workQueueDepth);
-
-    workQueue = new WorkQueue<HTTPClosure>(workQueueDepth);
     eventBase = base;
     eventHTTP = http;
     return true;
@@ -447,18 +627,21 @@ boost::thread threadHTTP;
 bool StartHTTPServer()
 {
     LogPrint("http", "Starting HTTP server\n");
-    int rpcThreads = std::max((long)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L);
-    LogPrintf("HTTP: starting %d worker threads\n", rpcThreads);
+    fHTTPInterrupted = false;
     threadHTTP = boost::thread(boost::bind(&ThreadHTTP, eventBase, eventHTTP));
 
-    for (int i = 0; i < rpcThreads; i++)
-        boost::thread(boost::bind(&HTTPWorkQueueRun, workQueue));
+    for (const auto& queue : mapWorkQueues) {
+        LogPrintf("HTTP: starting %d worker threads for work queue '%s'\n", queue.second.second, queue.first);
+        for (int i = 0; i < queue.second.second; i++)
+            boost::thread(boost::bind(&HTTPWorkQueueRun, queue.second.first));
+    }
     return true;
 }
 
 void InterruptHTTPServer()
 {
     LogPrint("http", "Interrupting HTTP server\n");
+    fHTTPInterrupted = true;
     if (eventHTTP) {
         // Unlisten sockets
         BOOST_FOREACH (evhttp_bound_socket *socket, boundSockets) {
@@ -467,17 +650,22 @@ void InterruptHTTPServer()
         // Reject requests on current connections
         evhttp_set_gencb(eventHTTP, http_reject_request_cb, NULL);
     }
-    if (workQueue)
-        workQueue->Interrupt();
+    for (const auto& queue : mapWorkQueues)
+        queue.second.first->Interrupt();
 }
 
 void StopHTTPServer()
 {
     LogPrint("http", "Stopping HTTP server\n");
-    if (workQueue) {
+    if (!mapWorkQueues.empty()) {
         LogPrint("http", "Waiting for HTTP worker threads to exit\n");
-        workQueue->WaitExit();
-        delete workQueue;
+        for (const auto& queue : mapWorkQueues) {
+            queue.second.first->WaitExit();
+            delete queue.second.first;
+        }
+        mapWorkQueues.clear();
+        vWorkQueueURIs.clear();
+        workQueue = 0;
     }
     if (eventBase) {
         LogPrint("http", "Waiting for HTTP event thread to exit\n");
@@ -545,7 +733,10 @@ HTTPRequest::HTTPRequest(struct evhttp_request* req) : req(req),
 }
 HTTPRequest::~HTTPRequest()
 {
-    if (!replySent) {
+    if (!replySent && chunked) {
+        // The status went out already, all that can be done is end the reply
+        WriteReplyEnd();
+    } else if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
         WriteReply(HTTP_INTERNAL, "Unhandled request");
@@ -564,6 +755,17 @@ std::pair<bool, std::string> HTTPRequest::GetHeader(const std::string& hdr)
         return std::make_pair(false, "");
 }
 
+std::string HTTPRequest::PeekBody(size_t nMaxSize)
+{
+    struct evbuffer* buf = evhttp_request_get_input_buffer(req);
+    if (!buf)
+        return "";
+    std::string rv(std::min(evbuffer_get_length(buf), nMaxSize), '\0');
+    if (rv.empty() || evbuffer_copyout(buf, &rv[0], rv.size()) < 0)
+        return "";
+    return rv;
+}
+
 std::string HTTPRequest::ReadBody()
 {
     struct evbuffer* buf = evhttp_request_get_input_buffer(req);
@@ -610,6 +812,118 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     req = 0; // transferred back to main thread
 }
 
+/** The http thread side of chunked replies.
+ * libevent keeps a request whose connection failed around until the reply is
+ * ended, with the connection detached, so the request pointer stays valid.
+ */
+static void http_chunk_written_cb(struct evhttp_connection*, void* arg)
+{
+    HTTPChunkedReply* chunked = (HTTPChunkedReply*)arg;
+    boost::lock_guard<boost::mutex> lock(chunked->cs);
+    chunked->nQueued = 0;
+    chunked->cond.notify_all();
+}
+
+static void http_reply_start(struct evhttp_request* req, int nStatus, std::shared_ptr<HTTPChunkedReply> chunked)
+{
+    struct evhttp_connection* evcon = evhttp_request_get_connection(req);
+    std::map<struct evhttp_connection*, HTTPConnection>::iterator it = mapHTTPConnections.find(evcon);
+    if (!evcon || it == mapHTTPConnections.end()) {
+        http_chunked_closed(chunked.get());
+        return;
+    }
+    it->second.chunked = chunked;
+    evhttp_send_reply_start(req, nStatus, NULL);
+}
+
+static void http_reply_chunk(struct evhttp_request* req, struct evbuffer* buf, std::shared_ptr<HTTPChunkedReply> chunked)
+{
+    if (!evhttp_request_get_connection(req)) {
+        http_chunked_closed(chunked.get());
+    } else {
+#if LIBEVENT_VERSION_NUMBER >= 0x02010100
+        evhttp_send_reply_chunk_with_cb(req, buf, http_chunk_written_cb, chunked.get());
+#else
+        // No way to learn when the client caught up, so don't hold the writer back
+        evhttp_send_reply_chunk(req, buf);
+        http_chunk_written_cb(NULL, chunked.get());
+#endif
+    }
+    evbuffer_free(buf);
+}
+
+static void http_reply_end(struct evhttp_request* req, std::shared_ptr<HTTPChunkedReply> chunked)
+{
+    // The reply state must not outlive the reply, the connection may be kept alive
+    std::map<struct evhttp_connection*, HTTPConnection>::iterator it = mapHTTPConnections.find(evhttp_request_get_connection(req));
+    if (it != mapHTTPConnections.end())
+        it->second.chunked.reset();
+    evhttp_send_reply_end(req);
+}
+
+void HTTPRequest::WriteReplyStart(int nStatus)
+{
+    assert(!replySent && !chunked && req);
+    chunked = std::make_shared<HTTPChunkedReply>();
+    HTTPEvent* ev = new HTTPEvent(eventBase, true,
+        boost::bind(http_reply_start, req, nStatus, chunked));
+    ev->trigger(0);
+}
+
+bool HTTPRequest::WriteReplyChunk(const std::string& strChunk)
+{
+    assert(!replySent && chunked && req);
+    {
+        boost::unique_lock<boost::mutex> lock(chunked->cs);
+        while (!chunked->fClosed && !fHTTPInterrupted && chunked->nQueued > MAX_CHUNKED_QUEUED)
+            chunked->cond.wait_for(lock, boost::chrono::milliseconds(100));
+        if (chunked->fClosed || fHTTPInterrupted)
+            return false;
+        chunked->nQueued += strChunk.size();
+    }
+    // An empty chunk would end the reply
+    if (strChunk.empty())
+        return true;
+    struct evbuffer* buf = evbuffer_new();
+    assert(buf);
+    evbuffer_add(buf, strChunk.data(), strChunk.size());
+    HTTPEvent* ev = new HTTPEvent(eventBase, true,
+        boost::bind(http_reply_chunk, req, buf, chunked));
+    ev->trigger(0);
+    return true;
+}
+
+void HTTPRequest::WriteReplyEnd()
+{
+    assert(!replySent && chunked && req);
+    HTTPEvent* ev = new HTTPEvent(eventBase, true,
+        boost::bind(http_reply_end, req, chunked));
+    ev->trigger(0);
+    replySent = true;
+    req = 0; // transferred back to main thread
+}
+
+std::vector<HTTPWorkQueueStats> GetHTTPWorkQueueStats()
+{
+    std::vector<HTTPWorkQueueStats> vStats;
+    for (const auto& queue : mapWorkQueues) {
+        vStats.push_back(HTTPWorkQueueStats());
+        vStats.back().strName = queue.first;
+        queue.second.first->GetStats(vStats.back());
+    }
+    return vStats;
+}
+
+HTTPConnectionStats GetHTTPConnectionStats()
+{
+    HTTPConnectionStats stats;
+    stats.nAccepted = nHTTPConnectionsAccepted;
+    stats.nOpen = nHTTPConnectionsOpen;
+    stats.nRequests = nHTTPRequests;
+    stats.nReused = nHTTPRequestsReused;
+    return stats;
+}
+
 CService HTTPRequest::GetPeer()
 {
     evhttp_connection* con = evhttp_request_get_connection(req);
@@ -650,10 +964,10 @@ HTTPRequest::RequestMethod HTTPRequest::GetRequestMethod()
     }
 }
 
-void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler)
+void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler, const HTTPQueueSelector &queueSelector)
 {
     LogPrint("http", "Registering HTTP handler for %s (exactmatch %d)\n", prefix, exactMatch);
-    pathHandlers.push_back(HTTPPathHandler(prefix, exactMatch, handler));
+    pathHandlers.push_back(HTTPPathHandler(prefix, exactMatch, handler, queueSelector));
 }
 
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch)
@@ -5,7 +5,9 @@
 #ifndef BITCOIN_HTTPSERVER_H
 #define BITCOIN_HTTPSERVER_H
 
+#include <memory>
 #include <string>
+#include <vector>
 #include <stdint.h>
 #include <boost/thread.hpp>
 #include <boost/scoped_ptr.hpp>
@@ -14,11 +16,14 @@
 static const int DEFAULT_HTTP_THREADS=4;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
 static const int DEFAULT_HTTP_SERVER_TIMEOUT=30;
+/** Work queue set up next to the default one if no -rpcqueue is given */
+static const char* const DEFAULT_HTTP_EXTRA_QUEUE = "mining:1";
 
 struct evhttp_request;
 struct event_base;
 class CService;
 class HTTPRequest;
+struct HTTPChunkedReply;
 
 /** Initialize HTTP server.
  * Call this before RegisterHTTPHandler or EventBase().
@@ -36,14 +41,50 @@ void StopHTTPServer();
 
 /** Handler for requests to a certain HTTP path */
 typedef boost::function<bool(HTTPRequest* req, const std::string &)> HTTPRequestHandler;
+/** Picks the name of the work queue for a request, or "" to leave it to the
+ * -rpcqueueuri rules. Runs in the http thread, so it must be quick.
+ */
+typedef boost::function<std::string(HTTPRequest* req)> HTTPQueueSelector;
 /** Register handler for prefix.
  * If multiple handlers match a prefix, the first-registered one will
  * be invoked.
  */
-void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler);
+void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler, const HTTPQueueSelector &queueSelector = HTTPQueueSelector());
 /** Unregister handler for prefix */
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch);
 
+/** Counters of an HTTP work queue */
+struct HTTPWorkQueueStats
+{
+    std::string strName;
+    int nThreads;
+    int nActive;
+    size_t nDepth;
+    size_t nMaxDepth;
+    uint64_t nProcessed;
+    uint64_t nRejected;
+    //! Microseconds requests spent waiting in the queue, in total and at most
+    int64_t nWaitTotal;
+    int64_t nWaitMax;
+    //! Microseconds spent handling requests, in total
+    int64_t nRunTotal;
+};
+
+/** Counters of all work queues, the default one included */
+std::vector<HTTPWorkQueueStats> GetHTTPWorkQueueStats();
+
+/** Counters of client connections and how many requests reused one */
+struct HTTPConnectionStats
+{
+    uint64_t nAccepted;
+    uint64_t nOpen;
+    uint64_t nRequests;
+    //! Requests that came on a connection kept alive from an earlier request
+    uint64_t nReused;
+};
+
+HTTPConnectionStats GetHTTPConnectionStats();
+
 /** Return evhttp event base. This can be used by submodules to
  * queue timers or custom events.
  */
@@ -57,6 +98,7 @@ class HTTPRequest
 private:
     struct evhttp_request* req;
     bool replySent;
+    std::shared_ptr<HTTPChunkedReply> chunked;
 
 public:
     HTTPRequest(struct evhttp_request* req);
@@ -96,6 +138,12 @@ public:
      */
     std::string ReadBody();
 
+    /**
+     * Return up to nMaxSize bytes from the start of the request body,
+     * without consuming them.
+     */
+    std::string PeekBody(size_t nMaxSize);
+
     /**
      * Write output header.
      *
@@ -112,6 +160,31 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Start a reply sent with chunked transfer encoding, for bodies too
+     * large to build in memory first.
+     * Send the body with WriteReplyChunk and finish with WriteReplyEnd.
+     *
+     * @note call WriteHeader before this, and WriteReply not at all.
+     */
+    void WriteReplyStart(int nStatus);
+
+    /**
+     * Send the next part of a reply started with WriteReplyStart.
+     * Blocks while the client is behind on reading what was sent so far.
+     * Returns false once the client has gone away or the server is
+     * shutting down, the rest of the reply can then be skipped.
+     */
+    bool WriteReplyChunk(const std::string& strChunk);
+
+    /**
+     * Finish a reply started with WriteReplyStart.
+     *
+     * @note As with WriteReply, do not call any other HTTPRequest methods
+     * after calling this.
+     */
+    void WriteReplyEnd();
 };
 
 /** Event handler closure.
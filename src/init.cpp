@@ -11,15 +11,21 @@
 
 #include "addrman.h"
 #include "amount.h"
+#include "autotune.h"
 #include "base58.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "compat/sanity.h"
 #include "consensus/validation.h"
+#include "crypto/aes.h"
+#include "crypto/keccak256.h"
+#include "crypto/sha256.h"
 #include "httpserver.h"
 #include "httprpc.h"
 #include "key.h"
+#include "memorybudget.h"
+#include "metrics.h"
 #include "validation.h"
 #include "miner.h"
 #include "netbase.h"
@@ -31,6 +37,7 @@
 #include "script/standard.h"
 #include "script/sigcache.h"
 #include "scheduler.h"
+#include "support/lockedpool.h"
 #include "txdb.h"
 #include "txmempool.h"
 #include "torcontrol.h"
@@ -38,6 +45,7 @@
 #include "util.h"
 #include "utilmoneystr.h"
 #include "utilstrencodings.h"
+#include "utxosnapshot.h"
 #include "validationinterface.h"
 #include "warnings.h"
 #ifdef ENABLE_WALLET
@@ -79,6 +87,7 @@
 #endif
 
 #include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/algorithm/string/split.hpp>
@@ -92,6 +101,7 @@
 
 #if ENABLE_ZMQ
 #include "zmq/zmqnotificationinterface.h"
+#include "zmq/zmqpublishnotifier.h"
 #endif
 
 using namespace std;
@@ -108,6 +118,8 @@ static const bool DEFAULT_REST_ENABLE = false;
 static const bool DEFAULT_DISABLE_SAFEMODE = false;
 static const bool DEFAULT_STOPAFTERBLOCKIMPORT = false;
 
+CScheduler* pschedulerMain = NULL;
+
 std::unique_ptr<CConnman> g_connman;
 std::unique_ptr<PeerLogicValidation> peerLogic;
 
@@ -218,6 +230,154 @@ void Interrupt(boost::thread_group& threadGroup)
     threadGroup.interrupt_all();
 }
 
+// Seconds between the periodic dumps of the smartnode caches
+static const int64_t SMARTNODE_CACHES_DUMP_INTERVAL = 15 * 60;
+
+static void DumpSmartnodeCaches()
+{
+    CFlatDB<CSmartnodeMan> flatdb1("sncache.dat", "magicSmartnodeCache");
+    flatdb1.Dump(mnodeman);
+    CFlatDB<CSmartnodePayments> flatdb2("snpayments.dat", "magicSmartnodePaymentsCache");
+    flatdb2.Dump(mnpayments);
+    //CFlatDB<CGovernanceManager> flatdb3("governance.dat", "magicGovernanceCache");
+    //flatdb3.Dump(governance);
+    CFlatDB<CNetFulfilledRequestManager> flatdb4("netfulfilled.dat", "magicFulfilledCache");
+    flatdb4.Dump(netfulfilledman);
+}
+
+// Limit of the in-memory UTXO set from -dbcache, -maxmemory lowers nCoinCacheUsage below it while other caches need the memory
+static size_t nCoinCacheUsageConfigured = 0;
+
+// Set by -autotune, applied once the initial block download is done
+static CAutotuneProfile autotuneProfile;
+static bool fAutotuneDBCache = false;
+static bool fAutotuneDBProfile = false;
+static CScheduler::TaskId nAutotuneTaskId;
+
+static void AutotuneAfterInitialBlockDownload(CScheduler& scheduler)
+{
+    if (IsInitialBlockDownload())
+        return;
+    scheduler.cancel(nAutotuneTaskId);
+
+    if (fAutotuneDBCache) {
+        LOCK(cs_main);
+        nCoinCacheUsageConfigured = nCoinCacheUsageConfigured / 100 * autotuneProfile.nCoinCachePercentAfterIBD;
+        nCoinCacheUsage = std::min(nCoinCacheUsage, nCoinCacheUsageConfigured);
+        LogPrintf("Autotune: initial block download done, using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
+    }
+    if (fAutotuneDBProfile && autotuneProfile.strDBProfileAfterIBD != autotuneProfile.strDBProfile && SetDBProfile(autotuneProfile.strDBProfileAfterIBD))
+        LogPrintf("Autotune: using database profile %s\n", autotuneProfile.strDBProfileAfterIBD);
+    if (prewards) {
+        prewards->SetEntryCacheSize(autotuneProfile.nRewardsEntryCacheAfterIBD);
+        LogPrintf("Autotune: caching up to %u reward entries\n", autotuneProfile.nRewardsEntryCacheAfterIBD);
+    }
+}
+
+static size_t GetCoinsCacheUsage()
+{
+    LOCK(cs_main);
+    return pcoinsTip ? pcoinsTip->DynamicMemoryUsage() : 0;
+}
+
+static void ShrinkCoinsCache(size_t nBytes)
+{
+    // The cache only empties as a whole, by writing it. Rather than doing so now lower its limit,
+    // FlushStateToDisk writes it once it grows above, and it refills up to the lower limit only.
+    LOCK(cs_main);
+    if (!pcoinsTip)
+        return;
+    size_t nUsage = pcoinsTip->DynamicMemoryUsage();
+    size_t nLimit = std::max(nUsage > nBytes ? nUsage - nBytes : 0, nCoinCacheUsageConfigured / 4);
+    if (nLimit < nCoinCacheUsage) {
+        nCoinCacheUsage = nLimit;
+        LogPrint("bench", "Memory budget: limiting the in-memory UTXO set to %.1fMiB\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
+    }
+}
+
+static size_t GetMempoolUsage()
+{
+    return mempool.DynamicMemoryUsage();
+}
+
+static void ShrinkMempool(size_t nBytes)
+{
+    LOCK(cs_main);
+    size_t nUsage = mempool.DynamicMemoryUsage();
+    LimitMempoolSize(mempool, nUsage > nBytes ? nUsage - nBytes : 0, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+}
+
+static size_t GetRewardsCacheUsage()
+{
+    return prewards ? prewards->GetEntryCacheUsage() : 0;
+}
+
+static void ShrinkRewardsCache(size_t nBytes)
+{
+    if (prewards)
+        prewards->ShrinkEntryCache(nBytes);
+}
+
+static size_t GetRelayUsage()
+{
+    return g_connman ? g_connman->GetRelayMemoryUsage() : 0;
+}
+
+static void ShrinkRelay(size_t nBytes)
+{
+    if (g_connman)
+        g_connman->ShrinkRelay(nBytes);
+}
+
+static void CheckMemoryBudget()
+{
+    if (memoryBudget.Check())
+        return;
+
+    // Give the coins cache back what the other caches leave unused, up to -dbcache
+    size_t nTotal = 0;
+    for (const auto& usage : memoryBudget.GetUsage())
+        nTotal += usage.second;
+    size_t nLimit = memoryBudget.GetLimit();
+    if (nTotal >= nLimit)
+        return;
+    LOCK(cs_main);
+    if (!pcoinsTip || nCoinCacheUsage >= nCoinCacheUsageConfigured)
+        return;
+    nCoinCacheUsage = std::max(nCoinCacheUsage, std::min(nCoinCacheUsageConfigured, pcoinsTip->DynamicMemoryUsage() + nLimit - nTotal));
+}
+
+/** Run one step of PrepareShutdown, logging how long it took. A failing step doesn't keep the others from running. */
+static void ShutdownStep(const std::string& strName, const boost::function<void()>& func)
+{
+    int64_t nStart = GetTimeMillis();
+    LogPrintf("Shutdown: %s...\n", strName);
+    try {
+        func();
+    } catch (const std::exception& e) {
+        PrintExceptionContinue(&e, strName.c_str());
+    } catch (...) {
+        PrintExceptionContinue(NULL, strName.c_str());
+    }
+    LogPrintf("Shutdown: %s done in %dms\n", strName, GetTimeMillis() - nStart);
+}
+
+static void WriteFeeEstimates()
+{
+    boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
+    CAutoFile est_fileout(fopen(est_path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (!est_fileout.IsNull())
+        mempool.WriteFeeEstimates(est_fileout);
+    else
+        LogPrintf("%s: Failed to write fee estimates to %s\n", __func__, est_path.string());
+}
+
+static void SyncSmartRewards()
+{
+    LOCK(cs_rewardsprocessing);
+    prewards->SyncPrepared();
+}
+
 void PrepareShutdown()
 {
     fRequestShutdown = true; // Needed when we shutdown the wallet
@@ -236,46 +396,53 @@ void PrepareShutdown()
     mempool.AddTransactionsUpdated(1);
     StopHTTPRPC();
     StopREST();
+    StopMetrics();
     StopRPC();
     StopHTTPServer();
+    StopValidationInterfaceQueue();
 #ifdef ENABLE_WALLET
     if (pwalletMain)
         pwalletMain->Flush(false);
 #endif
     //GenerateBitcoins(false, 0, Params(), *g_connman);
     MapPort(false);
+    memoryBudget.UnregisterAll();
     UnregisterValidationInterface(peerLogic.get());
     peerLogic.reset();
     g_connman.reset();
-
-    // STORE DATA CACHES INTO SERIALIZED DAT FILES
-    CFlatDB<CSmartnodeMan> flatdb1("sncache.dat", "magicSmartnodeCache");
-    flatdb1.Dump(mnodeman);
-    CFlatDB<CSmartnodePayments> flatdb2("snpayments.dat", "magicSmartnodePaymentsCache");
-    flatdb2.Dump(mnpayments);
-    //CFlatDB<CGovernanceManager> flatdb3("governance.dat", "magicGovernanceCache");
-    //flatdb3.Dump(governance);
-    CFlatDB<CNetFulfilledRequestManager> flatdb4("netfulfilled.dat", "magicFulfilledCache");
-    flatdb4.Dump(netfulfilledman);
+    pschedulerMain = NULL;
 
     UnregisterNodeSignals(GetNodeSignals());
 
-    if (fFeeEstimatesInitialized)
-    {
-        boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
-        CAutoFile est_fileout(fopen(est_path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
-        if (!est_fileout.IsNull())
-            mempool.WriteFeeEstimates(est_fileout);
-        else
-            LogPrintf("%s: Failed to write fee estimates to %s\n", __func__, est_path.string());
+    // The files written below don't depend on each other, nor on the coins written meanwhile,
+    // so the slowest of them takes about as long as all of them.
+    int64_t nShutdownStart = GetTimeMillis();
+    boost::thread_group shutdownThreads;
+    // STORE DATA CACHES INTO SERIALIZED DAT FILES
+    shutdownThreads.create_thread(boost::bind(&ShutdownStep, "writing the smartnode caches", &DumpSmartnodeCaches));
+    if (mempool.IsLoaded() && GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+        shutdownThreads.create_thread(boost::bind(&ShutdownStep, "writing the mempool", &DumpMempool));
+    }
+    if (fFeeEstimatesInitialized) {
+        shutdownThreads.create_thread(boost::bind(&ShutdownStep, "writing the fee estimates", &WriteFeeEstimates));
         fFeeEstimatesInitialized = false;
     }
+    if (prewards != NULL) {
+        shutdownThreads.create_thread(boost::bind(&ShutdownStep, "writing the rewards database", &SyncSmartRewards));
+    }
 
     {
         LOCK(cs_main);
         if (pcoinsTip != NULL) {
-            FlushStateToDisk();
+            ShutdownStep(strprintf("writing %u coins (%.1fMiB) to the coin database", pcoinsTip->GetCacheSize(), pcoinsTip->DynamicMemoryUsage() * (1.0 / 1024 / 1024)),
+                         boost::bind(&FlushStateToDisk));
         }
+    }
+    shutdownThreads.join_all();
+    LogPrintf("%s: Wrote the caches to disk in %dms\n", __func__, GetTimeMillis() - nShutdownStart);
+
+    {
+        LOCK(cs_main);
         delete pcoinsTip;
         pcoinsTip = NULL;
         delete pcoinscatcher;
@@ -284,8 +451,11 @@ void PrepareShutdown()
         pcoinsdbview = NULL;
         delete pblocktree;
         pblocktree = NULL;
+        delete pindexdb;
+        pindexdb = NULL;
         delete prewards;
         prewards = NULL;
+        ReleaseSharedBlockCache();
     }
 #ifdef ENABLE_WALLET
     if (pwalletMain)
@@ -306,6 +476,9 @@ void PrepareShutdown()
         pdsNotificationInterface = NULL;
     }
 
+    UnregisterValidationInterface(&blockTemplateCache);
+    blockTemplateCache.Clear();
+
 #ifndef WIN32
     try {
         boost::filesystem::remove(GetPidFile());
@@ -395,11 +568,16 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-?", _("Print this help message and exit"));
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-assumevalid=<hex>", strprintf(_("If this block is in the chain assume that it and its ancestors are valid and potentially skip their script verification (0 to verify all, default: %s, testnet: %s)"), Params(CBaseChainParams::MAIN).GetConsensus().defaultAssumeValid.GetHex(), Params(CBaseChainParams::TESTNET).GetConsensus().defaultAssumeValid.GetHex()));
+    strUsage += HelpMessageOpt("-asyncvalidationsignals", strprintf(_("Notify the wallet, ZMQ and the smartnode managers of new blocks and transactions on a separate thread instead of during block connection (default: %u)"), DEFAULT_ASYNC_VALIDATION_SIGNALS));
+    strUsage += HelpMessageOpt("-autotune", strprintf(_("Measure memory, cores and disk latency at startup to pick -dbcache, -rewardsdbcache, -maxmempool, -par and -dbprofile, "
+        "and shrink the coins cache in favour of the mempool and the reward entries once the initial block download is done. Explicit settings are kept (default: %u)"), DEFAULT_AUTOTUNE));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to operate in a blocks only mode (default: %u)"), DEFAULT_BLOCKSONLY));
     strUsage += HelpMessageOpt("-checkblocks=<n>", strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), DEFAULT_CHECKBLOCKS));
     strUsage += HelpMessageOpt("-checklevel=<n>", strprintf(_("How thorough the block verification of -checkblocks is (0-4, default: %u)"), DEFAULT_CHECKLEVEL));
+    strUsage += HelpMessageOpt("-checkblocksbackground", strprintf(_("Verify the -checkblocks blocks on a background thread once the node is running instead of before startup (default: %u)"), DEFAULT_CHECKBLOCKS_BACKGROUND));
     strUsage += HelpMessageOpt("-conf=<file>", strprintf(_("Specify configuration file (default: %s)"), BITCOIN_CONF_FILENAME));
     if (mode == HMM_BITCOIND)
     {
@@ -409,14 +587,22 @@ std::string HelpMessage(HelpMessageMode mode)
     }
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
+    strUsage += HelpMessageOpt("-dbprofile=<name>", strprintf(_("Tune the databases for a workload, one of %s (default: %s)"), GetDBProfileNames(), DEFAULT_DB_PROFILE));
+    strUsage += HelpMessageOpt("-dbsharedcache", strprintf(_("Have all databases share one block cache instead of a fixed share each (default: %u)"), DEFAULT_DB_SHARED_CACHE));
+    strUsage += HelpMessageOpt("-dbsyncinterval=<n>", strprintf(_("Write the coins changed at the tip to disk every <n> minutes while keeping them cached, which shortens the shutdown, 0 to disable (default: %u)"), DEFAULT_DB_SYNC_INTERVAL));
+    strUsage += HelpMessageOpt("-backgroundflush", strprintf(_("Write the coin database cache to disk in the background, which may briefly take up to twice the -dbcache memory (default: %u)"), DEFAULT_BACKGROUND_FLUSH));
     if (showDebug)
         strUsage += HelpMessageOpt("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
+    strUsage += HelpMessageOpt("-loadtxoutset=<file>", _("Start an empty chain state from a file written by dumptxoutset, whose block has to be stored already. Combine with -checkblocksbackground to verify the recent blocks"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+    strUsage += HelpMessageOpt("-maxorphantxsize=<n>", strprintf(_("Keep the unconnectable transactions in memory below <n> kilobytes (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS_SIZE));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
+    strUsage += HelpMessageOpt("-maxmemory=<n>", strprintf(_("Keep the coins, mempool, reward entry, signature and relay caches together below <n> MiB by shrinking the largest ones, the UTXO cache gets a lower limit until there is room again, 0 = no limit (default: %u)"), DEFAULT_MAX_MEMORY));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
+    strUsage += HelpMessageOpt("-persistmempool", strprintf(_("Whether to save the mempool on shutdown and load on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), BITCOIN_PID_FILENAME));
 #endif
@@ -425,6 +611,9 @@ std::string HelpMessage(HelpMessageMode mode)
             "(default: 0 = disable pruning blocks, >%u = target size in MiB to use for block files)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
     strUsage += HelpMessageOpt("-reindex-chainstate", _("Rebuild chain state from the currently indexed blocks"));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild chain state and block index from the blk*.dat files on disk"));
+    strUsage += HelpMessageOpt("-rewardsobserver", strprintf(_("Only follow the chain for the SmartRewards rounds and payouts: implies -blocksonly, -disablewallet, -litemode, -enableinstantsend=0, -persistmempool=0, -par=0 and -dbcache=%d (default: %u)"),
+        nRewardsObserverDbCache, DEFAULT_REWARDS_OBSERVER));
+    strUsage += HelpMessageOpt("-schedulerthreads=<n>", strprintf(_("Set the number of threads running background tasks (1 to %d, default: %d)"), MAX_SCHEDULER_THREADS, DEFAULT_SCHEDULER_THREADS));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
@@ -447,6 +636,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXRECEIVEBUFFER));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXSENDBUFFER));
     strUsage += HelpMessageOpt("-maxtimeadjustment", strprintf(_("Maximum allowed median peer time offset adjustment. Local perspective of time may be influenced by peers forward or backward by this amount. (default: %u seconds)"), DEFAULT_MAX_TIME_ADJUSTMENT));
+    strUsage += HelpMessageOpt("-msghandlerthreads=<n>", strprintf(_("Number of threads processing peer messages, besides the one giving blocks and headers priority (1 to %d, default: %d)"), MAX_MSGHANDLER_THREADS, DEFAULT_MSGHANDLER_THREADS));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), DEFAULT_PERMIT_BAREMULTISIG));
@@ -456,6 +646,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-proxyrandomize", strprintf(_("Randomize credentials for every proxy connection. This enables Tor stream isolation (default: %u)"), DEFAULT_PROXYRANDOMIZE));
     strUsage += HelpMessageOpt("-rpcserialversion", strprintf(_("Sets the serialization of raw transaction or block hex returned in non-verbose mode, non-segwit(0) or segwit(1) (default: %d)"), DEFAULT_RPC_SERIALIZE_VERSION));
     strUsage += HelpMessageOpt("-seednode=<ip>", _("Connect to a node to retrieve peer addresses, and disconnect"));
+    strUsage += HelpMessageOpt("-socketevents=<mode>", strprintf(_("How to wait for socket events, one of: %s (default: %s). Only select limits the number of connections"),
+        boost::algorithm::join(GetSocketPollerModes(), ", "), GetDefaultSocketPollerMode()));
     strUsage += HelpMessageOpt("-timeout=<n>", strprintf(_("Specify connection timeout in milliseconds (minimum: 1, default: %d)"), DEFAULT_CONNECT_TIMEOUT));
     strUsage += HelpMessageOpt("-torcontrol=<ip>:<port>", strprintf(_("Tor control port to use if onion listening enabled (default: %s)"), DEFAULT_TOR_CONTROL));
     strUsage += HelpMessageOpt("-torpassword=<pass>", _("Tor control port password (default: empty)"));
@@ -472,6 +664,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-whitelistrelay", strprintf(_("Accept relayed transactions received from whitelisted peers even when not relaying transactions (default: %d)"), DEFAULT_WHITELISTRELAY));
     strUsage += HelpMessageOpt("-whitelistforcerelay", strprintf(_("Force relay of transactions from whitelisted peers even if they violate local relay policy (default: %d)"), DEFAULT_WHITELISTFORCERELAY));
     strUsage += HelpMessageOpt("-maxuploadtarget=<n>", strprintf(_("Tries to keep outbound traffic under the given target (in MiB per 24h), 0 = no limit (default: %d)"), DEFAULT_MAX_UPLOAD_TARGET));
+    strUsage += HelpMessageOpt("-uploadlimit=<class>:<traffic>:<n>", _("Limit blocks or transactions served to a class of peers to <n> kB per second, 0 = no limit. Classes are inbound, outbound, smartnode and whitelisted, traffic is blocks or tx. Blocks near the tip are never held back. Can be specified multiple times"));
+    strUsage += HelpMessageOpt("-smartnodesyncadaptive", strprintf(_("Finish a smartnode sync step as soon as peers stop sending its data instead of waiting for the timeout (default: %u)"), DEFAULT_SMARTNODE_SYNC_ADAPTIVE));
 
 #ifdef ENABLE_WALLET
     strUsage += CWallet::GetWalletHelpString(showDebug);
@@ -483,6 +677,13 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-zmqpubhashtx=<address>", _("Enable publish hash transaction in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawblock=<address>", _("Enable publish raw block in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawtx=<address>", _("Enable publish raw transaction in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubmempoolstats=<address>", _("Enable publish memory pool acceptance timings in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubhashtxlock=<address>", _("Enable publish hash of InstantSend locked transactions in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubrawtxlock=<address>", _("Enable publish raw InstantSend locked transactions in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubsmartnodelist=<address>", _("Enable publish smartnode list changes in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubrewardsround=<address>", _("Enable publish finalized SmartRewards rounds in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubspork=<address>", _("Enable publish spork changes in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubhwm=<n>", strprintf(_("Set the outbound message high water mark of the publish sockets; messages over it are dropped (default: %d)"), DEFAULT_ZMQ_SNDHWM));
 #endif
 
     strUsage += HelpMessageGroup(_("Debugging/Testing options:"));
@@ -517,9 +718,10 @@ std::string HelpMessage(HelpMessageMode mode)
     {
         strUsage += HelpMessageOpt("-logtimemicros", strprintf("Add microsecond precision to debug timestamps (default: %u)", DEFAULT_LOGTIMEMICROS));
         strUsage += HelpMessageOpt("-mocktime=<n>", "Replace actual time with <n> seconds since epoch (default: 0)");
+        strUsage += HelpMessageOpt("-lockstatsrate=<n>", strprintf("Sample one in <n> lock acquisitions of each thread for getlockstats, 0 to sample none (default: %u)", DEFAULT_LOCK_STATS_RATE));
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default: %u)", DEFAULT_LIMITFREERELAY));
         strUsage += HelpMessageOpt("-relaypriority", strprintf("Require high priority for relaying free or low-fee transactions (default: %u)", DEFAULT_RELAYPRIORITY));
-        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
+        strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit sum of signature cache and script execution cache sizes to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
         strUsage += HelpMessageOpt("-maxtipage=<n>", strprintf("Maximum tip age in seconds to consider node in initial block download (default: %u)", DEFAULT_MAX_TIP_AGE));
     }
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in %s/kB) smaller than this are considered zero fee for relaying, mining and transaction creation (default: %s)"),
@@ -554,6 +756,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands"));
     strUsage += HelpMessageOpt("-rest", strprintf(_("Accept public REST requests (default: %u)"), DEFAULT_REST_ENABLE));
+    strUsage += HelpMessageOpt("-metrics", strprintf(_("Serve metrics in the Prometheus text format at /metrics of the RPC port (default: %u)"), DEFAULT_METRICS_ENABLE));
     strUsage += HelpMessageOpt("-rpcbind=<addr>", _("Bind to given address to listen for JSON-RPC connections. Use [host]:port notation for IPv6. This option can be specified multiple times (default: bind to all interfaces)"));
     strUsage += HelpMessageOpt("-rpccookiefile=<loc>", _("Location of the auth cookie (default: data dir)"));
     strUsage += HelpMessageOpt("-rpcuser=<user>", _("Username for JSON-RPC connections"));
@@ -562,8 +765,13 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-rpcport=<port>", strprintf(_("Listen for JSON-RPC connections on <port> (default: %u or testnet: %u)"), BaseParams(CBaseChainParams::MAIN).RPCPort(), BaseParams(CBaseChainParams::TESTNET).RPCPort()));
     strUsage += HelpMessageOpt("-rpcallowip=<ip>", _("Allow JSON-RPC connections from specified source. Valid for <ip> are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24). This option can be specified multiple times"));
     strUsage += HelpMessageOpt("-rpcthreads=<n>", strprintf(_("Set the number of threads to service RPC calls (default: %d)"), DEFAULT_HTTP_THREADS));
+    strUsage += HelpMessageOpt("-rpcbatchthreads=<n>", strprintf(_("Set the number of threads running the read-only calls of one JSON-RPC batch (default: %d)"), DEFAULT_RPC_BATCH_THREADS));
+    strUsage += HelpMessageOpt("-rpcslowlog=<ms>", strprintf(_("Log RPC calls taking at least <ms> milliseconds, with their parameters, 0 to log none (default: %d)"), DEFAULT_RPC_SLOWLOG));
     if (showDebug) {
         strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of the work queue to service RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
+        strUsage += HelpMessageOpt("-rpcqueue=<name>:<threads>[:<depth>]", strprintf("Add a work queue with its own worker threads, for the calls routed to it by -rpcqueuemethod and -rpcqueueuri. The depth defaults to -rpcworkqueue. This option can be specified multiple times (default: %s)", DEFAULT_HTTP_EXTRA_QUEUE));
+        strUsage += HelpMessageOpt("-rpcqueuemethod=<method>:<name>", "Run JSON-RPC calls of <method> in work queue <name>, or in the default one if there is no such queue. This option can be specified multiple times (default: getblocktemplate, submitblock and getmininginfo in mining)");
+        strUsage += HelpMessageOpt("-rpcqueueuri=<prefix>:<name>", "Run requests for URIs starting with <prefix> in work queue <name>, e.g. /rest/:explorer. This option can be specified multiple times");
         strUsage += HelpMessageOpt("-rpcservertimeout=<n>", strprintf("Timeout during HTTP requests (default: %d)", DEFAULT_HTTP_SERVER_TIMEOUT));
     }
 
@@ -722,6 +930,11 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
         LogPrintf("Stopping after block import\n");
         StartShutdown();
     }
+
+    if (GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+        LoadMempool();
+    }
+    mempool.SetIsLoaded(!ShutdownRequested());
 }
 
 /** Sanity checks
@@ -752,6 +965,8 @@ bool AppInitServers(boost::thread_group& threadGroup)
         return false;
     if (GetBoolArg("-rest", DEFAULT_REST_ENABLE) && !StartREST())
         return false;
+    if (GetBoolArg("-metrics", DEFAULT_METRICS_ENABLE) && !StartMetrics())
+        return false;
     if (!StartHTTPServer())
         return false;
     return true;
@@ -826,6 +1041,27 @@ void InitParameterInteraction()
             LogPrintf("%s: parameter interaction: -zapwallettxes=<mode> -> setting -rescan=1\n", __func__);
     }
 
+    // observers connect blocks into the rewards database and nothing else, let everything else go
+    if (GetBoolArg("-rewardsobserver", DEFAULT_REWARDS_OBSERVER)) {
+        if (SoftSetBoolArg("-blocksonly", true))
+            LogPrintf("%s: parameter interaction: -rewardsobserver=1 -> setting -blocksonly=1\n", __func__);
+        if (SoftSetBoolArg("-persistmempool", false))
+            LogPrintf("%s: parameter interaction: -rewardsobserver=1 -> setting -persistmempool=0\n", __func__);
+#ifdef ENABLE_WALLET
+        if (SoftSetBoolArg("-disablewallet", true))
+            LogPrintf("%s: parameter interaction: -rewardsobserver=1 -> setting -disablewallet=1\n", __func__);
+#endif
+        if (SoftSetBoolArg("-litemode", true))
+            LogPrintf("%s: parameter interaction: -rewardsobserver=1 -> setting -litemode=1\n", __func__);
+        if (SoftSetBoolArg("-enableinstantsend", false))
+            LogPrintf("%s: parameter interaction: -rewardsobserver=1 -> setting -enableinstantsend=0\n", __func__);
+        // all cores for script checks, the rewards database is what the node should wait for
+        if (SoftSetArg("-par", "0"))
+            LogPrintf("%s: parameter interaction: -rewardsobserver=1 -> setting -par=0\n", __func__);
+        if (SoftSetArg("-dbcache", std::to_string(nRewardsObserverDbCache)))
+            LogPrintf("%s: parameter interaction: -rewardsobserver=1 -> setting -dbcache=%d\n", __func__, nRewardsObserverDbCache);
+    }
+
     // disable walletbroadcast and whitelistrelay in blocksonly mode
     if (GetBoolArg("-blocksonly", DEFAULT_BLOCKSONLY)) {
         if (SoftSetBoolArg("-whitelistrelay", false))
@@ -836,6 +1072,12 @@ void InitParameterInteraction()
 #endif
     }
 
+    // The rewards database doesn't need the txindex when it gets the blocks as they are connected.
+    if (GetArg("-prune", 0)) {
+        if (SoftSetBoolArg("-txindex", false))
+            LogPrintf("%s: parameter interaction: -prune set -> setting -txindex=0\n", __func__);
+    }
+
     // Forcing relay from whitelisted hosts implies we will accept relays from them in the first place.
     if (GetBoolArg("-whitelistforcerelay", DEFAULT_WHITELISTFORCERELAY)) {
         if (SoftSetBoolArg("-whitelistrelay", true))
@@ -986,8 +1228,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     int nUserMaxConnections = GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     int nMaxConnections = std::max(nUserMaxConnections, 0);
 
+    std::string strSocketEvents = GetArg("-socketevents", GetDefaultSocketPollerMode());
+    std::vector<std::string> vSocketEventsModes = GetSocketPollerModes();
+    if (std::find(vSocketEventsModes.begin(), vSocketEventsModes.end(), strSocketEvents) == vSocketEventsModes.end())
+        return InitError(strprintf(_("Invalid -socketevents '%s', must be one of: %s"), strSocketEvents, boost::algorithm::join(vSocketEventsModes, ", ")));
+
     // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
+    if (strSocketEvents == "select")
+        nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS)), 0);
     int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return InitError(_("Not enough file descriptors available."));
@@ -1025,6 +1273,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         mempool.setSanityCheck(1.0 / ratio);
     }
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
+    SetLockStatsRate(GetArg("-lockstatsrate", DEFAULT_LOCK_STATS_RATE));
     fCheckpointsEnabled = GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
 
     hashAssumeValid = uint256S(GetArg("-assumevalid", chainparams.GetConsensus().defaultAssumeValid.GetHex()));
@@ -1033,6 +1282,26 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     else
         LogPrintf("Validating signatures for all blocks.\n");
 
+    // -autotune only fills in the settings that are not given explicitly
+    if (GetBoolArg("-autotune", DEFAULT_AUTOTUNE)) {
+        CHardwareInfo hw = ProbeHardware(GetDataDir());
+        autotuneProfile = GetAutotuneProfile(hw);
+        LogPrintf("Autotune: %dMiB of memory, %d cores, %dus per synced write\n", hw.nMemory >> 20, hw.nCores, hw.nSyncLatency);
+        LogPrintf("Autotune: %s\n", autotuneProfile.ToString());
+        fAutotuneDBCache = SoftSetArg("-dbcache", std::to_string(autotuneProfile.nDbCache));
+        if (fAutotuneDBCache)
+            LogPrintf("Autotune: setting -dbcache=%d\n", autotuneProfile.nDbCache);
+        if (SoftSetArg("-rewardsdbcache", std::to_string(autotuneProfile.nRewardsDbCache)))
+            LogPrintf("Autotune: setting -rewardsdbcache=%d\n", autotuneProfile.nRewardsDbCache);
+        if (SoftSetArg("-maxmempool", std::to_string(autotuneProfile.nMaxMempool)))
+            LogPrintf("Autotune: setting -maxmempool=%d\n", autotuneProfile.nMaxMempool);
+        if (SoftSetArg("-par", std::to_string(autotuneProfile.nScriptCheckThreads)))
+            LogPrintf("Autotune: setting -par=%d\n", autotuneProfile.nScriptCheckThreads);
+        fAutotuneDBProfile = SoftSetArg("-dbprofile", autotuneProfile.strDBProfile);
+        if (fAutotuneDBProfile)
+            LogPrintf("Autotune: setting -dbprofile=%s\n", autotuneProfile.strDBProfile);
+    }
+
     // mempool limits
     int64_t nMempoolSizeMax = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
     int64_t nMempoolSizeMin = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000 * 40;
@@ -1174,10 +1443,22 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     // Initialize fast PRNG
     seed_insecure_rand(false);
 
+    // Pick the fastest SHA256, Keccak and AES implementations this CPU supports
+    std::string sha256_algo = SHA256AutoDetect();
+    LogPrintf("Using the '%s' SHA256 implementation\n", sha256_algo);
+    std::string keccak_algo = Keccak256AutoDetect();
+    LogPrintf("Using the '%s' Keccak-256 implementation\n", keccak_algo);
+    std::string aes_algo = AESAutoDetect();
+    LogPrintf("Using the '%s' AES implementation\n", aes_algo);
+
     // Initialize elliptic curve code
     ECC_Start();
     globalVerifyHandle.reset(new ECCVerifyHandle());
 
+    // Size the signature and script execution caches
+    InitSignatureCache();
+    InitScriptExecutionCache();
+
     // Sanity check
     if (!InitSanityCheck())
         return InitError(_("Initialization sanity check failed. Smartcash Core is shutting down."));
@@ -1222,14 +1503,19 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Default data directory %s\n", GetDefaultDataDir().string());
     LogPrintf("Using data directory %s\n", strDataDir);
     LogPrintf("Using config file %s\n", GetConfigFile().string());
-    LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
+    LogPrintf("Using at most %i connections (%i file descriptors available), waiting for sockets with %s\n", nMaxConnections, nFD, strSocketEvents);
     std::ostringstream strErrors;
 
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
-        for (int i=0; i<nScriptCheckThreads-1; i++)
+        for (int i=0; i<nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadSignedMessageVerifier);
+            threadGroup.create_thread(&ThreadBlockTxCheck);
+        }
     }
+    for (int i = 0; i < COINS_PREFETCH_THREADS; i++)
+        threadGroup.create_thread(&ThreadCoinsPrefetch);
 
     if (mapArgs.count("-sporkkey")) // spork priv key
     {
@@ -1237,9 +1523,12 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             return InitError(_("Unable to sign spork message, wrong key?"));
     }
 
-    // Start the lightweight task scheduler thread
+    // Start the lightweight task scheduler threads, more than one keeps a slow task from holding up the others
+    int nSchedulerThreads = std::max(1, std::min((int)GetArg("-schedulerthreads", DEFAULT_SCHEDULER_THREADS), MAX_SCHEDULER_THREADS));
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
-    threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
+    for (int i = 0; i < nSchedulerThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
+    pschedulerMain = &scheduler;
 
     /* Start the RPC server already.  It will be started in "warmup" mode
      * and not really process calls already (but it will signify connections
@@ -1295,7 +1584,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     // need to reindex later.
 
     assert(!g_connman);
-    g_connman = std::unique_ptr<CConnman>(new CConnman());
+    g_connman = std::unique_ptr<CConnman>(new CConnman(strSocketEvents));
     CConnman& connman = *g_connman;
 
     peerLogic.reset(new PeerLogicValidation(&connman));
@@ -1434,10 +1723,30 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     pdsNotificationInterface = new CDSNotificationInterface(connman);
     RegisterValidationInterface(pdsNotificationInterface);
 
+    RegisterValidationInterface(&blockTemplateCache);
+
     if (mapArgs.count("-maxuploadtarget")) {
         connman.SetMaxOutboundTarget(GetArg("-maxuploadtarget", DEFAULT_MAX_UPLOAD_TARGET)*1024*1024);
     }
 
+    if (mapArgs.count("-uploadlimit")) {
+        BOOST_FOREACH(const std::string& strLimit, mapMultiArgs["-uploadlimit"]) {
+            std::vector<std::string> vParts;
+            boost::split(vParts, strLimit, boost::is_any_of(":"));
+            int nClass = PEER_CLASS_MAX;
+            int nTraffic = UPLOAD_TRAFFIC_MAX;
+            int64_t nLimit = -1;
+            if (vParts.size() == 3) {
+                while (nClass > 0 && vParts[0] != GetPeerClassName(nClass - 1)) nClass--;
+                while (nTraffic > 0 && vParts[1] != GetUploadTrafficName(nTraffic - 1)) nTraffic--;
+                if (!ParseInt64(vParts[2], &nLimit)) nLimit = -1;
+            }
+            if (nClass == 0 || nTraffic == 0 || nLimit < 0 || nLimit > std::numeric_limits<int64_t>::max() / 1000)
+                return InitError(strprintf(_("Invalid -uploadlimit: '%s'"), strLimit));
+            connman.SetUploadLimit((PeerClass)(nClass - 1), (UploadTraffic)(nTraffic - 1), nLimit * 1000);
+        }
+    }
+
     // ********************************************************* Step 7: load block chain
 
     fReindex = GetBoolArg("-reindex", false);
@@ -1470,6 +1779,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         }
     }
 
+    std::string strDBProfile = GetArg("-dbprofile", DEFAULT_DB_PROFILE);
+    if (!SetDBProfile(strDBProfile))
+        return InitError(strprintf(_("Unknown database profile specified in -dbprofile: '%s'"), strDBProfile));
+
     // cache size calculations
     int64_t nTotalCache = (GetArg("-dbcache", nDefaultDbCache) << 20);
     nTotalCache = std::max(nTotalCache, nMinDbCache << 20); // total cache cannot be less than nMinDbCache
@@ -1477,19 +1790,34 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     int64_t nBlockTreeDBCache = nTotalCache / 8;
     nBlockTreeDBCache = std::min(nBlockTreeDBCache, (GetBoolArg("-txindex", DEFAULT_TXINDEX) ? nMaxBlockDBAndTxIndexCache : nMaxBlockDBCache) << 20);
     nTotalCache -= nBlockTreeDBCache;
+    bool fAdditionalIndexes =
+        GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX) ||
+        GetBoolArg("-spentindex", DEFAULT_SPENTINDEX) ||
+        GetBoolArg("-timestampindex", DEFAULT_TIMESTAMPINDEX);
+    int64_t nIndexDBCache = std::min(nTotalCache / 8, (fAdditionalIndexes ? nMaxIndexDBCache : nMaxUnusedIndexDBCache) << 20);
+    nTotalCache -= nIndexDBCache;
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nCoinDBCache = std::min(nCoinDBCache, nMaxCoinsDBCache << 20); // cap total coins db cache
     nTotalCache -= nCoinDBCache;
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
+    nCoinCacheUsageConfigured = nCoinCacheUsage;
+    nCoinsSyncInterval = std::max<int64_t>(0, GetArg("-dbsyncinterval", DEFAULT_DB_SYNC_INTERVAL)) * 60;
     nMempoolSizeMax = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
+    LogPrintf("* Using %.1fMiB for address, spent and timestamp index database\n", nIndexDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set (plus up to %.1fMiB of unused mempool space)\n", nCoinCacheUsage * (1.0 / 1024 / 1024), nMempoolSizeMax * (1.0 / 1024 / 1024));
 
 
     int64_t nRewardsCache = (GetArg("-rewardsdbcache", nRewardsDefaultDbCache) << 20);
     LogPrintf("* Using %.1fMiB for smart rewards database\n", nRewardsCache * (1.0 / 1024 / 1024));
+    if (GetBoolArg("-dbsharedcache", DEFAULT_DB_SHARED_CACHE)) {
+        // One cache for the lot, so whichever database is busiest gets the hits
+        InitSharedBlockCache(nBlockTreeDBCache + nIndexDBCache + nCoinDBCache + nRewardsCache);
+        LogPrintf("* Sharing one block cache between the databases\n");
+    }
+    LogPrintf("* Using database profile %s\n", GetDBProfile().strName);
 
     bool fLoaded = false;
     while (!fLoaded && !fRequestShutdown) {
@@ -1506,9 +1834,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                 delete pcoinsdbview;
                 delete pcoinscatcher;
                 delete pblocktree;
+                delete pindexdb;
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
+                // The address and timestamp indexes are only ever scanned, so
+                // bloom filters only pay off for the spent index's lookups
+                pindexdb = new CIndexDB(nIndexDBCache, false, fReindex, GetBoolArg("-spentindex", DEFAULT_SPENTINDEX) ? DEFAULT_DB_FILTER_BITS : 0);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex || fReindexChainState);
+                pcoinsdbview->SetBackgroundWrites(GetBoolArg("-backgroundflush", DEFAULT_BACKGROUND_FLUSH));
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
 
@@ -1523,9 +1856,36 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                         strLoadError = _("Error upgrading chainstate database");
                         break;
                     }
+                    // Older versions kept the address, spent and timestamp indexes with the block index.
+                    if (!pindexdb->MoveFromBlockTree(*pblocktree)) {
+                        strLoadError = _("Error moving the address, spent and timestamp indexes to their own database");
+                        break;
+                    }
                 }
                 if (fRequestShutdown) break;
 
+                if (HasIncompleteUTXOSnapshot(*pcoinsdbview)) {
+                    strLoadError = _("The chain state holds part of a UTXO snapshot");
+                    break;
+                }
+
+                // Instead of connecting all blocks up to the one of the snapshot. The block index
+                // loaded next picks the chain state up from there like after any restart.
+                if (mapArgs.count("-loadtxoutset") && !fReindex) {
+                    if (pcoinsdbview->GetBestBlock().IsNull()) {
+                        uiInterface.InitMessage(_("Loading UTXO snapshot..."));
+                        boost::filesystem::path pathSnapshot = boost::filesystem::absolute(GetArg("-loadtxoutset", ""), GetDataDir());
+                        CUTXOSnapshotHeader header;
+                        std::string strError;
+                        if (!LoadUTXOSnapshot(pathSnapshot, *pcoinsdbview, *pblocktree, nCoinCacheUsage, nRewardsCache, header, strError)) {
+                            strLoadError = strprintf(_("Error loading UTXO snapshot: %s"), strError);
+                            break;
+                        }
+                    } else {
+                        LogPrintf("Ignoring -loadtxoutset, the chain state is not empty\n");
+                    }
+                }
+
                 if (!LoadBlockIndex()) {
                     strLoadError = _("Error loading block database");
                     break;
@@ -1572,7 +1932,8 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     }
                 }
 
-                if (!CVerifyDB().VerifyDB(chainparams, pcoinsdbview, GetArg("-checklevel", DEFAULT_CHECKLEVEL),
+                if (!GetBoolArg("-checkblocksbackground", DEFAULT_CHECKBLOCKS_BACKGROUND) &&
+                    !CVerifyDB().VerifyDB(chainparams, pcoinsdbview, GetArg("-checklevel", DEFAULT_CHECKLEVEL),
                               GetArg("-checkblocks", DEFAULT_CHECKBLOCKS))) {
                     strLoadError = _("Corrupted block database detected");
                     break;
@@ -1645,7 +2006,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
                 if (fRequestShutdown) break;
 
-                prewards->Lock();
+                if( !(fLoaded = prewards->FinishInterruptedRound()) ) throw std::runtime_error(_("Failed to finish the evaluation of the SmartRewards round."));
 
             } catch (const std::runtime_error &e) {
                 if (fDebug) LogPrintf("%s\n", e.what());
@@ -1672,8 +2033,20 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     }
 
+    // The blocks the rewards database didn't process yet are never pruned, but
+    // a database recreated on a pruned node would need them all again.
+    if (fHavePruned && prewards->GetLastHeight() < pLastIndex->nHeight) {
+        LOCK(cs_main);
+        CBlockIndex *pNextIndex = chainActive[std::max(prewards->GetLastHeight(), 0) + 1];
+        if (pNextIndex && !(pNextIndex->nStatus & BLOCK_HAVE_DATA))
+            return InitError(_("Prune: the SmartRewards database is behind the pruned blocks. You need to rebuild the database using -reindex."));
+    }
+
     prewards->CatchUp();
 
+    // Blocks connected from now on are processed by the rewards thread.
+    threadGroup.create_thread(&ThreadSmartRewards);
+
     // As LoadBlockIndex can take several minutes, it's possible the user
     // requested to kill the GUI during the last operation. If so, exit.
     // As the program has not fully started yet, Shutdown() is possibly overkill.
@@ -1805,6 +2178,11 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         LogPrintf("%s", strErrors.str());
         LogPrintf(" wallet      %15dms\n", GetTimeMillis() - nStart);
 
+        LockedPool::Stats lockedStats = LockedPoolManager::Instance().stats();
+        LogPrintf("Locked memory: %u of %u bytes in use, %u bytes locked\n", lockedStats.used, lockedStats.total, lockedStats.locked);
+        if (lockedStats.locked < lockedStats.total)
+            InitWarning(_("Not all memory holding keys could be locked and it could be swapped to disk, consider raising the locked memory limit (ulimit -l)."));
+
         RegisterValidationInterface(pwalletMain);
 
         CBlockIndex *pindexRescan = chainActive.Tip();
@@ -1897,7 +2275,11 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         BOOST_FOREACH(const std::string& strFile, mapMultiArgs["-loadblock"])
             vImportFiles.push_back(strFile);
     }
+    if (GetBoolArg("-asyncvalidationsignals", DEFAULT_ASYNC_VALIDATION_SIGNALS))
+        StartValidationInterfaceQueue();
     threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
+    if (GetBoolArg("-checkblocksbackground", DEFAULT_CHECKBLOCKS_BACKGROUND))
+        threadGroup.create_thread(boost::bind(&ThreadVerifyDB, GetArg("-checklevel", DEFAULT_CHECKLEVEL), GetArg("-checkblocks", DEFAULT_CHECKBLOCKS)));
     if (chainActive.Tip() == NULL) {
         LogPrintf("Waiting for genesis block to be imported...\n");
         while (!fRequestShutdown && chainActive.Tip() == NULL)
@@ -1906,6 +2288,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     // ********************************************************* Step 11a: setup PrivateSend
     fSmartNode = GetBoolArg("-smartnode", false);
+    smartnodeSync.SetAdaptive(GetBoolArg("-smartnodesyncadaptive", DEFAULT_SMARTNODE_SYNC_ADAPTIVE));
     // TODO: smartnode should have no wallet
 
     if((fSmartNode || smartnodeConfig.getCount() > -1) && fTxIndex == false) {
@@ -1967,6 +2350,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     //lite mode disables all Smartnode and Darksend related functionality
     fLiteMode = GetBoolArg("-litemode", false);
+    if(fSmartNode && GetBoolArg("-rewardsobserver", DEFAULT_REWARDS_OBSERVER)){
+        return InitError("You can not start a smartnode as a SmartRewards observer");
+    }
     if(fSmartNode && fLiteMode){
         return InitError("You can not start a smartnode in litemode");
     }
@@ -2020,6 +2406,22 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         return InitError(_("Failed to load fulfilled requests cache from") + "\n" + (pathDB / strDBName).string());
     }
 
+    // dump the caches now and then too, so a crash only loses what changed since the last dump
+    scheduler.scheduleEvery(&DumpSmartnodeCaches, SMARTNODE_CACHES_DUMP_INTERVAL, "dumpsmartnodecaches", CScheduler::PRIORITY_LOW);
+
+    // the caches grow into each other's unused memory, as long as all of them together stay below -maxmemory
+    memoryBudget.Register("coins", &GetCoinsCacheUsage, &ShrinkCoinsCache);
+    memoryBudget.Register("mempool", &GetMempoolUsage, &ShrinkMempool);
+    memoryBudget.Register("rewards", &GetRewardsCacheUsage, &ShrinkRewardsCache);
+    memoryBudget.Register("relay", &GetRelayUsage, &ShrinkRelay);
+    memoryBudget.Register("sigcache", &GetSignatureCacheUsage);
+    memoryBudget.SetLimit(std::max<int64_t>(GetArg("-maxmemory", DEFAULT_MAX_MEMORY), 0) << 20);
+    if (memoryBudget.GetLimit())
+        scheduler.scheduleEvery(&CheckMemoryBudget, MEMORY_BUDGET_CHECK_INTERVAL, "memorybudget", CScheduler::PRIORITY_LOW);
+
+    if (GetBoolArg("-autotune", DEFAULT_AUTOTUNE))
+        nAutotuneTaskId = scheduler.scheduleEvery(boost::bind(&AutotuneAfterInitialBlockDownload, boost::ref(scheduler)), AUTOTUNE_IBD_CHECK_INTERVAL, "autotune", CScheduler::PRIORITY_LOW);
+
     // ********************************************************* Step 11c: update block tip in Smartcash modules
 
     // force UpdatedBlockTip to initialize nCachedBlockHeight for DS, MN payments and budgets
@@ -2075,6 +2477,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     connOptions.uiInterface = &uiInterface;
     connOptions.nSendBufferMaxSize = 1000*GetArg("-maxsendbuffer", DEFAULT_MAXSENDBUFFER);
     connOptions.nReceiveFloodSize = 1000*GetArg("-maxreceivebuffer", DEFAULT_MAXRECEIVEBUFFER);
+    connOptions.nMessageHandlerThreads = std::max(1, std::min((int)GetArg("-msghandlerthreads", DEFAULT_MSGHANDLER_THREADS), MAX_MSGHANDLER_THREADS));
 
     if (!connman.Start(scheduler, strNodeError, connOptions))
         return InitError(strNodeError);
@@ -17,6 +17,8 @@ class thread_group;
 } // namespace boost
 
 extern CWallet* pwalletMain;
+/** The scheduler AppInit2 was started with, NULL until then and after Shutdown */
+extern CScheduler* pschedulerMain;
 
 void StartShutdown();
 bool ShutdownRequested();
@@ -9,6 +9,7 @@
 #include "crypto/hmac_sha512.h"
 #include "pubkey.h"
 #include "random.h"
+#include "support/pagelocker.h"
 
 #include <secp256k1.h>
 #include <secp256k1_recovery.h>
@@ -125,8 +126,8 @@ bool CKey::Check(const unsigned char *vch) {
 
 void CKey::MakeNewKey(bool fCompressedIn) {
     do {
-        GetStrongRandBytes(vch, sizeof(vch));
-    } while (!Check(vch));
+        GetStrongRandBytes(vch.data(), vch.size());
+    } while (!Check(vch.data()));
     fValid = true;
     fCompressed = fCompressedIn;
 }
@@ -10,7 +10,9 @@
  * @license    This project is released under the MIT license.
  **/
 
+#include <algorithm>
 #include <sstream>
+#include <thread>
 #include "Zerocoin.h"
 
 namespace libzerocoin {
@@ -59,6 +61,60 @@ void Accumulator::accumulate(const PublicCoin& coin) {
 	}
 }
 
+// Product of the values of coins[begin, end), halves get multiplied so the
+// factors of each multiplication have about the same size.
+static Bignum ProductOfValues(const std::vector<PublicCoin>& coins, size_t begin, size_t end) {
+	if (end - begin == 1) {
+		return coins[begin].getValue();
+	}
+	size_t middle = begin + (end - begin) / 2;
+	return ProductOfValues(coins, begin, middle) * ProductOfValues(coins, middle, end);
+}
+
+void Accumulator::accumulate(const std::vector<PublicCoin>& coins) {
+	// Make sure we're initialized
+	if(!(this->value)) {
+		throw ZerocoinException("Accumulator is not initialized");
+	}
+
+	for (const PublicCoin& coin : coins) {
+		if(this->denomination != coin.getDenomination()) {
+			throw ZerocoinException("Wrong denomination for coin");
+		}
+	}
+
+	// The primality tests cost about as much as the exponentiations, and
+	// they don't depend on each other
+	size_t nThreads = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), coins.size() / 16));
+	std::vector<char> vValid(coins.size(), 0);
+	std::vector<std::thread> vThreads;
+	for (size_t t = 1; t < nThreads; t++) {
+		vThreads.push_back(std::thread([&coins, &vValid, t, nThreads]() {
+			for (size_t i = t; i < coins.size(); i += nThreads) {
+				vValid[i] = coins[i].validate();
+			}
+		}));
+	}
+	for (size_t i = 0; i < coins.size(); i += nThreads) {
+		vValid[i] = coins[i].validate();
+	}
+	for (std::thread& thread : vThreads) {
+		thread.join();
+	}
+
+	if (std::find(vValid.begin(), vValid.end(), 0) != vValid.end()) {
+		throw ZerocoinException("Coin is not valid");
+	}
+
+	// Compute new accumulator = "old accumulator"^{element_1 * ... * element_n} mod N
+	Bignum newValue = this->value;
+	for (size_t begin = 0; begin < coins.size(); begin += ACCUMULATE_BATCH_SIZE) {
+		size_t end = std::min(begin + ACCUMULATE_BATCH_SIZE, coins.size());
+		newValue = newValue.pow_mod(ProductOfValues(coins, begin, end), this->params->accumulatorModulus);
+	}
+	this->value = newValue;
+}
+
 CoinDenomination Accumulator::getDenomination() const {
 	return static_cast<CoinDenomination> (this->denomination);
 }
@@ -13,6 +13,10 @@
 #define ACCUMULATOR_H_
 
 namespace libzerocoin {
+
+/** Maximum number of coins multiplied into the exponent of one modular exponentiation */
+static const size_t ACCUMULATE_BATCH_SIZE = 256;
+
 /**
  * \brief Implementation of the RSA-based accumulator.
  **/
@@ -58,6 +62,20 @@ public:
 	 **/
     void accumulate(const PublicCoin &coin);
 
+	/**
+	 * Accumulate several coins at once, with the same result as
+	 * accumulating them one by one in any order. The coins get
+	 * validated on several threads and their values multiplied
+	 * up in a product tree, so there is one modular exponentiation
+	 * per ACCUMULATE_BATCH_SIZE coins.
+	 *
+	 * @param coins	The PublicCoins to accumulate.
+	 *
+	 * @throw		Zerocoin exception if one of the coins is not valid,
+	 * 				the accumulator is left unchanged then.
+	 **/
+    void accumulate(const std::vector<PublicCoin> &coins);
+
 	CoinDenomination getDenomination() const;
 	/** Get the accumulator result
 	 *
@@ -144,38 +144,17 @@ namespace libzerocoin {
 
         Bignum c = Bignum(hasher.GetHash()); //this hash should be of length k_prime bits
 
-        Bignum st_1_prime = (valueOfCommitmentToCoin.pow_mod(c, params->accumulatorPoKCommitmentGroup.modulus) *
-                             sg.pow_mod(s_alpha, params->accumulatorPoKCommitmentGroup.modulus) *
-                             sh.pow_mod(s_phi, params->accumulatorPoKCommitmentGroup.modulus)) %
-                            params->accumulatorPoKCommitmentGroup.modulus;
-        Bignum st_2_prime = (sg.pow_mod(c, params->accumulatorPoKCommitmentGroup.modulus) * ((valueOfCommitmentToCoin *
-                                                                                              sg.inverse(
-                                                                                                      params->accumulatorPoKCommitmentGroup.modulus)).pow_mod(
-                s_gamma, params->accumulatorPoKCommitmentGroup.modulus)) *
-                             sh.pow_mod(s_psi, params->accumulatorPoKCommitmentGroup.modulus)) %
-                            params->accumulatorPoKCommitmentGroup.modulus;
-        Bignum st_3_prime = (sg.pow_mod(c, params->accumulatorPoKCommitmentGroup.modulus) *
-                             (sg * valueOfCommitmentToCoin).pow_mod(s_sigma,
-                                                                    params->accumulatorPoKCommitmentGroup.modulus) *
-                             sh.pow_mod(s_xi, params->accumulatorPoKCommitmentGroup.modulus)) %
-                            params->accumulatorPoKCommitmentGroup.modulus;
-
-        Bignum t_1_prime =
-                (C_r.pow_mod(c, params->accumulatorModulus) * h_n.pow_mod(s_zeta, params->accumulatorModulus) *
-                 g_n.pow_mod(s_epsilon, params->accumulatorModulus)) % params->accumulatorModulus;
-        Bignum t_2_prime =
-                (C_e.pow_mod(c, params->accumulatorModulus) * h_n.pow_mod(s_eta, params->accumulatorModulus) *
-                 g_n.pow_mod(s_alpha, params->accumulatorModulus)) % params->accumulatorModulus;
-
-        Bignum t_3_prime = ((a.getValue()).pow_mod(c, params->accumulatorModulus) *
-                            C_u.pow_mod(s_alpha, params->accumulatorModulus) *
-                            ((h_n.inverse(params->accumulatorModulus)).pow_mod(s_beta, params->accumulatorModulus))) %
-                           params->accumulatorModulus;
-
-        Bignum t_4_prime = (C_r.pow_mod(s_alpha, params->accumulatorModulus) *
-                            ((h_n.inverse(params->accumulatorModulus)).pow_mod(s_delta, params->accumulatorModulus)) *
-                            ((g_n.inverse(params->accumulatorModulus)).pow_mod(s_beta, params->accumulatorModulus))) %
-                           params->accumulatorModulus;
+        // Each of them is the product of three powers, two of which are computed together
+        const Bignum& N = params->accumulatorPoKCommitmentGroup.modulus;
+        Bignum st_1_prime = (valueOfCommitmentToCoin.pow_mod(c, N) * Bignum::pow_mod2(sg, s_alpha, sh, s_phi, N)) % N;
+        Bignum st_2_prime = (sg.pow_mod(c, N) * Bignum::pow_mod2(valueOfCommitmentToCoin * sg.inverse(N), s_gamma, sh, s_psi, N)) % N;
+        Bignum st_3_prime = (sg.pow_mod(c, N) * Bignum::pow_mod2(sg * valueOfCommitmentToCoin, s_sigma, sh, s_xi, N)) % N;
+
+        const Bignum& M = params->accumulatorModulus;
+        Bignum t_1_prime = (C_r.pow_mod(c, M) * Bignum::pow_mod2(h_n, s_zeta, g_n, s_epsilon, M)) % M;
+        Bignum t_2_prime = (C_e.pow_mod(c, M) * Bignum::pow_mod2(h_n, s_eta, g_n, s_alpha, M)) % M;
+        Bignum t_3_prime = (a.getValue().pow_mod(c, M) * Bignum::pow_mod2(C_u, s_alpha, h_n.inverse(M), s_beta, M)) % M;
+        Bignum t_4_prime = (C_r.pow_mod(s_alpha, M) * Bignum::pow_mod2(h_n.inverse(M), s_delta, g_n.inverse(M), s_beta, M)) % M;
 
         bool result = false;
 
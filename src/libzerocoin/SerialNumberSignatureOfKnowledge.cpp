@@ -92,7 +92,7 @@ inline Bignum SerialNumberSignatureOfKnowledge::challengeCalculation(const Bignu
 	Bignum exponent = (a.pow_mod(a_exp, params->serialNumberSoKCommitmentGroup.groupOrder)
 	                   * b.pow_mod(b_exp, params->serialNumberSoKCommitmentGroup.groupOrder)) % params->serialNumberSoKCommitmentGroup.groupOrder;
 
-	return (g.pow_mod(exponent, params->serialNumberSoKCommitmentGroup.modulus) * h.pow_mod(h_exp, params->serialNumberSoKCommitmentGroup.modulus)) % params->serialNumberSoKCommitmentGroup.modulus;
+	return Bignum::pow_mod2(g, exponent, h, h_exp, params->serialNumberSoKCommitmentGroup.modulus);
 }
 
 bool SerialNumberSignatureOfKnowledge::Verify(const Bignum& coinSerialNumber, const Bignum& valueOfCommitmentToCoin,
@@ -115,9 +115,7 @@ bool SerialNumberSignatureOfKnowledge::Verify(const Bignum& coinSerialNumber, co
 			tprime[i] = challengeCalculation(coinSerialNumber, s_notprime[i], sprime[i]);
 		} else {
 			Bignum exp = b.pow_mod(s_notprime[i], params->serialNumberSoKCommitmentGroup.groupOrder);
-			tprime[i] = ((valueOfCommitmentToCoin.pow_mod(exp, params->serialNumberSoKCommitmentGroup.modulus) % params->serialNumberSoKCommitmentGroup.modulus) *
-			             (h.pow_mod(sprime[i], params->serialNumberSoKCommitmentGroup.modulus) % params->serialNumberSoKCommitmentGroup.modulus)) %
-			            params->serialNumberSoKCommitmentGroup.modulus;
+			tprime[i] = Bignum::pow_mod2(valueOfCommitmentToCoin, exp, h, sprime[i], params->serialNumberSoKCommitmentGroup.modulus);
 		}
 	}
 	for(uint32_t i = 0; i < params->zkp_iterations; i++) {
@@ -222,6 +222,18 @@ Test_Accumulator()
 			return false;
 		}
 
+		// Accumulating all coins at once gives the same result
+		std::vector<PublicCoin> vCoins;
+		for (uint32_t i = 0; i < TESTS_COINS_TO_ACCUMULATE; i++) {
+			vCoins.push_back(gCoins[i]->getPublicCoin());
+		}
+		Accumulator accBatch(&g_Params->accumulatorParams);
+		accBatch.accumulate(vCoins);
+		if (accOne.getValue() != accBatch.getValue()) {
+			cout << "Batch accumulation doesn't match" << endl;
+			return false;
+		}
+
 		if(accFour.getValue() != wThree.getValue()) {
 			cout << "Witness math not working," << endl;
 			return false;
@@ -5,10 +5,15 @@
 #ifndef BITCOIN_BIGNUM_H
 #define BITCOIN_BIGNUM_H
 
+#include <map>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <vector>
 #include <openssl/bn.h>
 
+#include <boost/thread/tss.hpp>
+
 #include "../../uint256.h" // for uint64
 #include "../../arith_uint256.h"
 #include "../../version.h"
@@ -48,6 +53,77 @@ public:
     bool operator!() { return (pctx == NULL); }
 };
 
+/**
+ * BN_CTX of the calling thread. It's kept for the lifetime of the thread instead of allocating one
+ * for every operation, the operations release what they take from it before returning.
+ */
+inline BN_CTX* GetThreadBN_CTX()
+{
+    static boost::thread_specific_ptr<CAutoBN_CTX> ptrCtx;
+    if (ptrCtx.get() == NULL)
+        ptrCtx.reset(new CAutoBN_CTX());
+    return *ptrCtx;
+}
+
+/** RAII encapsulated BN_MONT_CTX, the precomputed Montgomery form of an odd modulus */
+class CBigNumMontCtx
+{
+private:
+    BN_MONT_CTX* pmont;
+
+    CBigNumMontCtx(const CBigNumMontCtx&);
+    CBigNumMontCtx& operator=(const CBigNumMontCtx&);
+
+public:
+    /** Number of moduli Get keeps the context of, the zerocoin parameters use a handful of them */
+    static const size_t MAX_CACHED = 16;
+
+    explicit CBigNumMontCtx(const BIGNUM* m)
+    {
+        pmont = BN_MONT_CTX_new();
+        if (pmont == NULL)
+            throw bignum_error("CBigNumMontCtx : BN_MONT_CTX_new() returned NULL");
+        if (!BN_MONT_CTX_set(pmont, m, GetThreadBN_CTX())) {
+            BN_MONT_CTX_free(pmont);
+            throw bignum_error("CBigNumMontCtx : BN_MONT_CTX_set failed");
+        }
+    }
+
+    ~CBigNumMontCtx()
+    {
+        BN_MONT_CTX_free(pmont);
+    }
+
+    BN_MONT_CTX* get() const { return pmont; }
+
+    /**
+     * The context of modulus m, computed once and shared by all threads. Returns NULL for even
+     * moduli, which Montgomery multiplication doesn't support. Once MAX_CACHED moduli are known
+     * the context of any other one is computed for the caller only.
+     */
+    static std::shared_ptr<const CBigNumMontCtx> Get(const BIGNUM* m)
+    {
+        if (!BN_is_odd(m))
+            return std::shared_ptr<const CBigNumMontCtx>();
+
+        std::vector<unsigned char> vchKey(BN_num_bytes(m));
+        BN_bn2bin(m, vchKey.data());
+
+        static std::mutex mutex;
+        static std::map<std::vector<unsigned char>, std::shared_ptr<const CBigNumMontCtx> > mapCached;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = mapCached.find(vchKey);
+        if (it != mapCached.end())
+            return it->second;
+
+        std::shared_ptr<const CBigNumMontCtx> pmont = std::make_shared<CBigNumMontCtx>(m);
+        if (mapCached.size() < MAX_CACHED)
+            mapCached.emplace(vchKey, pmont);
+        return pmont;
+    }
+};
+
 
 /** C++ wrapper for BIGNUM (OpenSSL bignum) */
 class CBigNum : public BIGNUM
@@ -506,7 +582,7 @@ public:
      * @param m modulus
      */
     CBigNum mul_mod(const CBigNum& b, const CBigNum& m) const {
-        CAutoBN_CTX pctx;
+        BN_CTX* pctx = GetThreadBN_CTX();
         CBigNum ret;
         if (!BN_mod_mul(&ret, this, &b, &m, pctx))
             throw bignum_error("CBigNum::mul_mod : BN_mod_mul failed");
@@ -520,21 +596,46 @@ public:
      * @param m modulus
      */
     CBigNum pow_mod(const CBigNum& e, const CBigNum& m) const {
-        CAutoBN_CTX pctx;
-        CBigNum ret;
         if( e < 0){
             // g^-x = (g^-1)^x
             CBigNum inv = this->inverse(m);
             CBigNum posE = e * -1;
-            if (!BN_mod_exp(&ret, &inv, &posE, &m, pctx))
-                throw bignum_error("CBigNum::pow_mod: BN_mod_exp failed on negative exponent");
-        }else
-        if (!BN_mod_exp(&ret, this, &e, &m, pctx))
+            return inv.pow_mod(posE, m);
+        }
+
+        CBigNum ret;
+        std::shared_ptr<const CBigNumMontCtx> pmont = CBigNumMontCtx::Get(&m);
+        if (pmont) {
+            if (!BN_mod_exp_mont(&ret, this, &e, &m, GetThreadBN_CTX(), pmont->get()))
+                throw bignum_error("CBigNum::pow_mod : BN_mod_exp_mont failed");
+        } else if (!BN_mod_exp(&ret, this, &e, &m, GetThreadBN_CTX()))
             throw bignum_error("CBigNum::pow_mod : BN_mod_exp failed");
 
         return ret;
     }
 
+    /**
+     * modular multi-exponentiation: (a1^e1 * a2^e2) mod m, both powers computed in one pass
+     * over the exponents
+     * @param m modulus
+     */
+    static CBigNum pow_mod2(const CBigNum& a1, const CBigNum& e1, const CBigNum& a2, const CBigNum& e2, const CBigNum& m) {
+        // g^-x = (g^-1)^x
+        if (e1 < 0)
+            return pow_mod2(a1.inverse(m), e1 * -1, a2, e2, m);
+        if (e2 < 0)
+            return pow_mod2(a1, e1, a2.inverse(m), e2 * -1, m);
+
+        std::shared_ptr<const CBigNumMontCtx> pmont = CBigNumMontCtx::Get(&m);
+        if (!pmont)
+            return a1.pow_mod(e1, m).mul_mod(a2.pow_mod(e2, m), m);
+
+        CBigNum ret;
+        if (!BN_mod_exp2_mont(&ret, &a1, &e1, &a2, &e2, &m, GetThreadBN_CTX(), pmont->get()))
+            throw bignum_error("CBigNum::pow_mod2 : BN_mod_exp2_mont failed");
+        return ret;
+    }
+
     /**
      * Calculates the inverse of this element mod m.
      * i.e. i such this*i = 1 mod m
@@ -542,7 +643,7 @@ public:
      * @return the inverse
      */
     CBigNum inverse(const CBigNum& m) const {
-        CAutoBN_CTX pctx;
+        BN_CTX* pctx = GetThreadBN_CTX();
         CBigNum ret;
         if (!BN_mod_inverse(&ret, this, &m, pctx))
             throw bignum_error("CBigNum::inverse*= :BN_mod_inverse");
@@ -729,7 +830,7 @@ inline const CBigNum operator-(const CBigNum& a)
 
 inline const CBigNum operator*(const CBigNum& a, const CBigNum& b)
 {
-    CAutoBN_CTX pctx;
+    BN_CTX* pctx = GetThreadBN_CTX();
     CBigNum r;
     if (!BN_mul(&r, &a, &b, pctx))
         throw bignum_error("CBigNum::operator* : BN_mul failed");
@@ -738,7 +839,7 @@ inline const CBigNum operator*(const CBigNum& a, const CBigNum& b)
 
 inline const CBigNum operator/(const CBigNum& a, const CBigNum& b)
 {
-    CAutoBN_CTX pctx;
+    BN_CTX* pctx = GetThreadBN_CTX();
     CBigNum r;
     if (!BN_div(&r, NULL, &a, &b, pctx))
         throw bignum_error("CBigNum::operator/ : BN_div failed");
@@ -747,7 +848,7 @@ inline const CBigNum operator/(const CBigNum& a, const CBigNum& b)
 
 inline const CBigNum operator%(const CBigNum& a, const CBigNum& b)
 {
-    CAutoBN_CTX pctx;
+    BN_CTX* pctx = GetThreadBN_CTX();
     CBigNum r;
     if (!BN_nnmod(&r, &a, &b, pctx))
         throw bignum_error("CBigNum::operator% : BN_div failed");
@@ -0,0 +1,107 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "memorybudget.h"
+
+#include "util.h"
+
+#include <algorithm>
+#include <vector>
+
+CMemoryBudget memoryBudget;
+
+void CMemoryBudget::Register(const std::string& strName, const UsageFunction& usage, const ShrinkFunction& shrink)
+{
+    LOCK(cs);
+    Consumer& consumer = mapConsumers[strName];
+    consumer.usage = usage;
+    consumer.shrink = shrink;
+}
+
+void CMemoryBudget::Unregister(const std::string& strName)
+{
+    LOCK(cs);
+    mapConsumers.erase(strName);
+}
+
+void CMemoryBudget::UnregisterAll()
+{
+    LOCK(cs);
+    mapConsumers.clear();
+}
+
+void CMemoryBudget::SetLimit(size_t nLimitIn)
+{
+    LOCK(cs);
+    nLimit = nLimitIn;
+}
+
+size_t CMemoryBudget::GetLimit() const
+{
+    LOCK(cs);
+    return nLimit;
+}
+
+std::map<std::string, size_t> CMemoryBudget::GetUsage() const
+{
+    std::map<std::string, Consumer> mapCopy;
+    {
+        LOCK(cs);
+        mapCopy = mapConsumers;
+    }
+
+    // The caches take their own locks, don't hold ours meanwhile
+    std::map<std::string, size_t> mapUsage;
+    for (const auto& consumer : mapCopy)
+        mapUsage[consumer.first] = consumer.second.usage();
+    return mapUsage;
+}
+
+size_t CMemoryBudget::Check()
+{
+    std::map<std::string, Consumer> mapCopy;
+    size_t nLimitNow;
+    {
+        LOCK(cs);
+        mapCopy = mapConsumers;
+        nLimitNow = nLimit;
+    }
+
+    if (nLimitNow == 0)
+        return 0;
+
+    size_t nTotal = 0;
+    std::vector<std::pair<size_t, std::string> > vShrinkable;
+    for (const auto& consumer : mapCopy) {
+        size_t nUsage = consumer.second.usage();
+        nTotal += nUsage;
+        if (consumer.second.shrink)
+            vShrinkable.push_back(std::make_pair(nUsage, consumer.first));
+    }
+
+    if (nTotal <= nLimitNow)
+        return 0;
+
+    // The largest caches give back their memory first
+    std::sort(vShrinkable.rbegin(), vShrinkable.rend());
+
+    size_t nExcess = nTotal - nLimitNow;
+    size_t nFreed = 0;
+    for (size_t i = 0; i < vShrinkable.size() && nFreed < nExcess; i++) {
+        const Consumer& consumer = mapCopy[vShrinkable[i].second];
+        size_t nBefore = vShrinkable[i].first;
+        consumer.shrink(std::min(nExcess - nFreed, nBefore));
+        size_t nAfter = consumer.usage();
+        if (nAfter < nBefore) {
+            LogPrintf("Memory budget: %s shrunk from %.1fMiB to %.1fMiB\n", vShrinkable[i].second, nBefore * (1.0 / 1024 / 1024), nAfter * (1.0 / 1024 / 1024));
+            nFreed += nBefore - nAfter;
+        }
+    }
+
+    if (nFreed < nExcess)
+        LogPrintf("Memory budget: caches use %.1fMiB, only %.1fMiB could be freed to stay below %.1fMiB\n",
+            nTotal * (1.0 / 1024 / 1024), nFreed * (1.0 / 1024 / 1024), nLimitNow * (1.0 / 1024 / 1024));
+
+    return nFreed;
+}
@@ -0,0 +1,67 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SMARTCASH_MEMORYBUDGET_H
+#define SMARTCASH_MEMORYBUDGET_H
+
+#include "sync.h"
+
+#include <functional>
+#include <map>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+//! -maxmemory default (MiB), 0 doesn't limit the caches
+static const int64_t DEFAULT_MAX_MEMORY = 0;
+//! Seconds between the checks of the memory budget
+static const int64_t MEMORY_BUDGET_CHECK_INTERVAL = 10;
+
+/**
+ * Memory used by the caches of the node, counted like memusage.h does, and a
+ * limit they share. Each cache registers how to get its usage and, if it can
+ * give memory back, how to shrink. Once all of them together get above the
+ * limit the largest ones get asked to shrink first, so a cache can grow into
+ * the memory others leave unused.
+ */
+class CMemoryBudget
+{
+public:
+    //! Bytes currently used
+    typedef std::function<size_t()> UsageFunction;
+    //! Free about the given number of bytes
+    typedef std::function<void(size_t)> ShrinkFunction;
+
+private:
+    struct Consumer
+    {
+        UsageFunction usage;
+        ShrinkFunction shrink;
+    };
+
+    mutable CCriticalSection cs;
+    std::map<std::string, Consumer> mapConsumers;
+    size_t nLimit;
+
+public:
+    CMemoryBudget() : nLimit(0) {}
+
+    /** Add a cache, without shrink it only counts towards the total */
+    void Register(const std::string& strName, const UsageFunction& usage, const ShrinkFunction& shrink = ShrinkFunction());
+    void Unregister(const std::string& strName);
+    void UnregisterAll();
+
+    /** Limit of all caches together in bytes, 0 for none */
+    void SetLimit(size_t nLimitIn);
+    size_t GetLimit() const;
+
+    /** Usage of each cache */
+    std::map<std::string, size_t> GetUsage() const;
+    /** Shrink the caches down to the limit if they are above it, returns the bytes freed */
+    size_t Check();
+};
+
+extern CMemoryBudget memoryBudget;
+
+#endif // SMARTCASH_MEMORYBUDGET_H
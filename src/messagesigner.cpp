@@ -6,9 +6,85 @@
 #include "hash.h"
 #include "validation.h" // For strMessageMagic
 #include "messagesigner.h"
+#include "random.h"
+#include "script/sigcache.h"
 #include "tinyformat.h"
+#include "util.h"
 #include "utilstrencodings.h"
 
+#include "cuckoocache.h"
+#include <boost/thread.hpp>
+
+namespace {
+
+/**
+ * Good message signatures. Smartnode broadcasts, pings and votes reach us from several peers
+ * and get checked again when relayed or stored, mostly with the same few thousand keys.
+ */
+class CMessageSignatureCache
+{
+private:
+    //! Entries are SHA256(nonce || hash || public key || signature)
+    uint256 nonce;
+    CuckooCache::cache<uint256, SignatureCacheHasher> setValid;
+    boost::shared_mutex cs_cache;
+
+public:
+    CMessageSignatureCache()
+    {
+        GetRandBytes(nonce.begin(), 32);
+        setValid.setup_bytes(MESSAGE_SIG_CACHE_SIZE);
+    }
+
+    void ComputeEntry(uint256& entry, const uint256& hash, const CPubKey& pubkey, const std::vector<unsigned char>& vchSig)
+    {
+        CSHA256().Write(nonce.begin(), 32).Write(hash.begin(), 32).Write(pubkey.begin(), pubkey.size()).Write(vchSig.data(), vchSig.size()).Finalize(entry.begin());
+    }
+
+    bool Get(const uint256& entry)
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_cache);
+        return setValid.contains(entry, false);
+    }
+
+    void Set(const uint256& entry)
+    {
+        boost::unique_lock<boost::shared_mutex> lock(cs_cache);
+        setValid.insert(entry);
+    }
+};
+
+static CMessageSignatureCache messageSignatureCache;
+}
+
+CSignedMessageVerifier signedMessageVerifier;
+
+static uint256 GetMessageHash(const std::string& strMessage)
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << strMessageMagic;
+    ss << strMessage;
+    return ss.GetHash();
+}
+
+static bool VerifyRecoveredKey(const uint256& hash, const CPubKey& pubkey, const std::vector<unsigned char>& vchSig, std::string& strErrorRet)
+{
+    CPubKey pubkeyFromSig;
+    if(!pubkeyFromSig.RecoverCompact(hash, vchSig)) {
+        strErrorRet = "Error recovering public key.";
+        return false;
+    }
+
+    if(pubkeyFromSig.GetID() != pubkey.GetID()) {
+        strErrorRet = strprintf("Keys don't match: pubkey=%s, pubkeyFromSig=%s, hash=%s, vchSig=%s",
+                    pubkey.GetID().ToString(), pubkeyFromSig.GetID().ToString(), hash.ToString(),
+                    EncodeBase64(&vchSig[0], vchSig.size()));
+        return false;
+    }
+
+    return true;
+}
+
 bool CMessageSigner::GetKeysFromSecret(const std::string strSecret, CKey& keyRet, CPubKey& pubkeyRet)
 {
     CBitcoinSecret vchSecret;
@@ -23,20 +99,12 @@ bool CMessageSigner::GetKeysFromSecret(const std::string strSecret, CKey& keyRet
 
 bool CMessageSigner::SignMessage(const std::string strMessage, std::vector<unsigned char>& vchSigRet, const CKey key)
 {
-    CHashWriter ss(SER_GETHASH, 0);
-    ss << strMessageMagic;
-    ss << strMessage;
-
-    return CHashSigner::SignHash(ss.GetHash(), key, vchSigRet);
+    return CHashSigner::SignHash(GetMessageHash(strMessage), key, vchSigRet);
 }
 
 bool CMessageSigner::VerifyMessage(const CPubKey pubkey, const std::vector<unsigned char>& vchSig, const std::string strMessage, std::string& strErrorRet)
 {
-    CHashWriter ss(SER_GETHASH, 0);
-    ss << strMessageMagic;
-    ss << strMessage;
-
-    return CHashSigner::VerifyHash(ss.GetHash(), pubkey, vchSig, strErrorRet);
+    return CHashSigner::VerifyHash(GetMessageHash(strMessage), pubkey, vchSig, strErrorRet);
 }
 
 bool CHashSigner::SignHash(const uint256& hash, const CKey key, std::vector<unsigned char>& vchSigRet)
@@ -46,18 +114,84 @@ bool CHashSigner::SignHash(const uint256& hash, const CKey key, std::vector<unsi
 
 bool CHashSigner::VerifyHash(const uint256& hash, const CPubKey pubkey, const std::vector<unsigned char>& vchSig, std::string& strErrorRet)
 {
-    CPubKey pubkeyFromSig;
-    if(!pubkeyFromSig.RecoverCompact(hash, vchSig)) {
-        strErrorRet = "Error recovering public key.";
-        return false;
+    uint256 entry;
+    messageSignatureCache.ComputeEntry(entry, hash, pubkey, vchSig);
+    if(messageSignatureCache.Get(entry)) {
+        return true;
     }
 
-    if(pubkeyFromSig.GetID() != pubkey.GetID()) {
-        strErrorRet = strprintf("Keys don't match: pubkey=%s, pubkeyFromSig=%s, hash=%s, vchSig=%s",
-                    pubkey.GetID().ToString(), pubkeyFromSig.GetID().ToString(), hash.ToString(),
-                    EncodeBase64(&vchSig[0], vchSig.size()));
+    // a worker may be on it right now
+    if(signedMessageVerifier.WaitRunning(entry) && messageSignatureCache.Get(entry)) {
+        return true;
+    }
+
+    if(!VerifyRecoveredKey(hash, pubkey, vchSig, strErrorRet)) {
         return false;
     }
 
+    messageSignatureCache.Set(entry);
     return true;
 }
+
+bool CSignedMessageVerifier::Add(const CPubKey& pubkey, const std::vector<unsigned char>& vchSig, const std::string& strMessage)
+{
+    Job job;
+    job.hash = GetMessageHash(strMessage);
+    job.pubkey = pubkey;
+    job.vchSig = vchSig;
+    messageSignatureCache.ComputeEntry(job.entry, job.hash, pubkey, vchSig);
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (queueJobs.size() >= MAX_SIGNED_MESSAGE_QUEUE)
+        return false;
+    queueJobs.push_back(job);
+    condWork.notify_one();
+    return true;
+}
+
+bool CSignedMessageVerifier::WaitRunning(const uint256& entry)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    if (!setRunning.count(entry))
+        return false;
+    while (setRunning.count(entry))
+        condDone.wait(lock);
+    return true;
+}
+
+size_t CSignedMessageVerifier::GetQueueSize()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    return queueJobs.size();
+}
+
+void CSignedMessageVerifier::Thread()
+{
+    while (true) {
+        Job job;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (queueJobs.empty())
+                condWork.wait(lock); // interruption point
+            job = queueJobs.front();
+            queueJobs.pop_front();
+            // the handler of a message queued twice finds it in the cache or waits for the first run
+            if (!setRunning.insert(job.entry).second)
+                continue;
+        }
+
+        std::string strError;
+        if (!messageSignatureCache.Get(job.entry) && VerifyRecoveredKey(job.hash, job.pubkey, job.vchSig, strError))
+            messageSignatureCache.Set(job.entry);
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        setRunning.erase(job.entry);
+        condDone.notify_all();
+    }
+}
+
+void ThreadSignedMessageVerifier()
+{
+    RenameThread("smartcash-msgsig");
+    signedMessageVerifier.Thread();
+}
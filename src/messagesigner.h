@@ -7,6 +7,17 @@
 
 #include "key.h"
 
+#include <deque>
+#include <set>
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+/** Memory for the cache of good message signatures, 1 MiB holds 32768 of them */
+static const size_t MESSAGE_SIG_CACHE_SIZE = 1 << 20;
+/** Signatures waiting for a CSignedMessageVerifier thread at most, the messages of any more get checked inline */
+static const size_t MAX_SIGNED_MESSAGE_QUEUE = 10000;
+
 /** Helper class for signing messages and checking their signatures
  */
 class CMessageSigner
@@ -27,8 +38,47 @@ class CHashSigner
 public:
     /// Sign the hash, returns true if successful
     static bool SignHash(const uint256& hash, const CKey key, std::vector<unsigned char>& vchSigRet);
-    /// Verify the hash signature, returns true if succcessful
+    /// Verify the hash signature, returns true if succcessful. Good signatures are cached, so
+    /// messages seen again, e.g. relayed by another peer, don't need the pubkey recovered again.
     static bool VerifyHash(const uint256& hash, const CPubKey pubkey, const std::vector<unsigned char>& vchSig, std::string& strErrorRet);
 };
 
+/** Verifies message signatures on worker threads ahead of the handlers of their messages.
+ *
+ *  Good signatures go into the cache of CHashSigner::VerifyHash, where the handler finds them when
+ *  it gets to the message, still in order with the peer's other messages. A handler getting to a
+ *  signature a worker is verifying right then waits for it rather than doing the work twice.
+ */
+class CSignedMessageVerifier
+{
+private:
+    struct Job
+    {
+        uint256 hash;
+        uint256 entry;
+        CPubKey pubkey;
+        std::vector<unsigned char> vchSig;
+    };
+
+    boost::mutex mutex;
+    boost::condition_variable condWork;
+    boost::condition_variable condDone;
+    std::deque<Job> queueJobs;
+    std::set<uint256> setRunning;
+
+public:
+    /// Queue the signature of a message signed by CMessageSigner, false if the queue is full
+    bool Add(const CPubKey& pubkey, const std::vector<unsigned char>& vchSig, const std::string& strMessage);
+    /// Wait for a worker verifying the cache entry, returns whether there was one
+    bool WaitRunning(const uint256& entry);
+    size_t GetQueueSize();
+    /// Worker loop, ends when the thread gets interrupted
+    void Thread();
+};
+
+extern CSignedMessageVerifier signedMessageVerifier;
+
+/** Run an instance of the message signature verification thread */
+void ThreadSignedMessageVerifier();
+
 #endif
@@ -0,0 +1,131 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "metrics.h"
+
+#include "httpserver.h"
+#include "protocol.h"
+#include "rpc/protocol.h"
+#include "tinyformat.h"
+
+CMetricGauge metricTipHeight;
+CMetricHistogram metricConnectBlock({1000, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000});
+CMetricGauge metricMempoolTransactions;
+CMetricGauge metricMempoolBytes;
+CMetricGauge metricPeers;
+CMetricGauge metricCoinsCacheUsage;
+CMetricGauge metricRewardsHeight;
+CMetricGauge metricRewardsLag;
+
+CMetricHistogram::CMetricHistogram(const std::vector<int64_t> &vBoundsIn) :
+    vBounds(vBoundsIn), vBuckets(vBoundsIn.size() + 1), nCount(0), nSum(0)
+{
+}
+
+void CMetricHistogram::Observe(int64_t nMicros)
+{
+    size_t i = 0;
+    while (i < vBounds.size() && nMicros > vBounds[i])
+        i++;
+    vBuckets[i].fetch_add(1, std::memory_order_relaxed);
+    nSum.fetch_add(nMicros, std::memory_order_relaxed);
+    nCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CMetricHistogram::Write(const std::string &strName, std::string &strOut) const
+{
+    // Prometheus buckets are cumulative, the total of the last one is the count
+    uint64_t nTotal = 0;
+    for (size_t i = 0; i < vBounds.size(); i++) {
+        nTotal += vBuckets[i].load(std::memory_order_relaxed);
+        strOut += strprintf("%s_bucket{le=\"%g\"} %u\n", strName, vBounds[i] * 0.000001, nTotal);
+    }
+    nTotal += vBuckets.back().load(std::memory_order_relaxed);
+    strOut += strprintf("%s_bucket{le=\"+Inf\"} %u\n", strName, nTotal);
+    strOut += strprintf("%s_sum %.6f\n", strName, nSum.load(std::memory_order_relaxed) * 0.000001);
+    strOut += strprintf("%s_count %u\n", strName, nTotal);
+}
+
+CMetricCounterFamily::CMetricCounterFamily(const std::vector<std::string> &vLabels, const std::string &strOtherIn) :
+    strOther(strOtherIn)
+{
+    for (const std::string &strLabel : vLabels)
+        mapCounters[strLabel];
+    mapCounters[strOther];
+}
+
+CMetricCounter &CMetricCounterFamily::Get(const std::string &strLabel)
+{
+    std::map<std::string, CMetricCounter>::iterator it = mapCounters.find(strLabel);
+    if (it == mapCounters.end())
+        it = mapCounters.find(strOther);
+    return it->second;
+}
+
+void CMetricCounterFamily::Write(const std::string &strName, const std::string &strLabelName, std::string &strOut) const
+{
+    for (const auto &counter : mapCounters)
+        strOut += strprintf("%s{%s=\"%s\"} %u\n", strName, strLabelName, counter.first, counter.second.Get());
+}
+
+CMetricCounterFamily &MetricBytesReceived()
+{
+    static CMetricCounterFamily bytes(getAllNetMessageTypes(), "*other*");
+    return bytes;
+}
+
+CMetricCounterFamily &MetricBytesSent()
+{
+    static CMetricCounterFamily bytes(getAllNetMessageTypes(), "*other*");
+    return bytes;
+}
+
+static void WriteHeader(const std::string &strName, const std::string &strType, const std::string &strHelp, std::string &strOut)
+{
+    strOut += strprintf("# HELP %s %s\n# TYPE %s %s\n", strName, strHelp, strName, strType);
+}
+
+static void WriteGauge(const std::string &strName, const std::string &strHelp, const CMetricGauge &gauge, std::string &strOut)
+{
+    WriteHeader(strName, "gauge", strHelp, strOut);
+    strOut += strprintf("%s %d\n", strName, gauge.Get());
+}
+
+static bool HTTPReq_Metrics(HTTPRequest* req, const std::string &)
+{
+    if (req->GetRequestMethod() != HTTPRequest::GET) {
+        req->WriteReply(HTTP_BAD_METHOD, "Only GET is supported\r\n");
+        return false;
+    }
+
+    std::string strOut;
+    WriteGauge("smartcash_tip_height", "Height of the active chain tip.", metricTipHeight, strOut);
+    WriteHeader("smartcash_connect_block_seconds", "histogram", "Time taken to connect a block to the tip.", strOut);
+    metricConnectBlock.Write("smartcash_connect_block_seconds", strOut);
+    WriteGauge("smartcash_mempool_transactions", "Transactions in the mempool.", metricMempoolTransactions, strOut);
+    WriteGauge("smartcash_mempool_bytes", "Serialized size of the transactions in the mempool.", metricMempoolBytes, strOut);
+    WriteGauge("smartcash_peers", "Connected peers.", metricPeers, strOut);
+    WriteHeader("smartcash_received_bytes_total", "counter", "Bytes received, by message type.", strOut);
+    MetricBytesReceived().Write("smartcash_received_bytes_total", "command", strOut);
+    WriteHeader("smartcash_sent_bytes_total", "counter", "Bytes sent, by message type.", strOut);
+    MetricBytesSent().Write("smartcash_sent_bytes_total", "command", strOut);
+    WriteGauge("smartcash_coins_cache_bytes", "Memory used by the coins cache, as of the last check whether to flush it.", metricCoinsCacheUsage, strOut);
+    WriteGauge("smartcash_rewards_height", "Last block processed by the rewards.", metricRewardsHeight, strOut);
+    WriteGauge("smartcash_rewards_lag_blocks", "Blocks the rewards are behind the chain.", metricRewardsLag, strOut);
+
+    req->WriteHeader("Content-Type", "text/plain; version=0.0.4");
+    req->WriteReply(HTTP_OK, strOut);
+    return true;
+}
+
+bool StartMetrics()
+{
+    RegisterHTTPHandler("/metrics", true, HTTPReq_Metrics);
+    return true;
+}
+
+void StopMetrics()
+{
+    UnregisterHTTPHandler("/metrics", true);
+}
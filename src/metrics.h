@@ -0,0 +1,103 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SMARTCASH_METRICS_H
+#define SMARTCASH_METRICS_H
+
+#include <atomic>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+static const bool DEFAULT_METRICS_ENABLE = false;
+
+/**
+ * The metrics get updated by their subsystems as things happen, without taking any lock, so that
+ * serving them at /metrics doesn't have to ask cs_main or the mempool for anything.
+ */
+
+/** A value that only goes up, e.g. bytes received. */
+class CMetricCounter
+{
+private:
+    std::atomic<uint64_t> nValue;
+
+public:
+    CMetricCounter() : nValue(0) {}
+
+    void Add(uint64_t n) { nValue.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t Get() const { return nValue.load(std::memory_order_relaxed); }
+};
+
+/** A value that goes up and down, e.g. the size of the mempool. */
+class CMetricGauge
+{
+private:
+    std::atomic<int64_t> nValue;
+
+public:
+    CMetricGauge() : nValue(0) {}
+
+    void Set(int64_t n) { nValue.store(n, std::memory_order_relaxed); }
+    int64_t Get() const { return nValue.load(std::memory_order_relaxed); }
+};
+
+/** Durations in microseconds, counted in buckets up to each of the bounds and one above all of them. */
+class CMetricHistogram
+{
+private:
+    const std::vector<int64_t> vBounds;
+    std::vector<std::atomic<uint64_t> > vBuckets;
+    std::atomic<uint64_t> nCount;
+    std::atomic<int64_t> nSum;
+
+public:
+    explicit CMetricHistogram(const std::vector<int64_t> &vBoundsIn);
+
+    void Observe(int64_t nMicros);
+    /** Append the histogram in seconds as name_bucket, name_sum and name_count. */
+    void Write(const std::string &strName, std::string &strOut) const;
+};
+
+/**
+ * Counters by label, e.g. bytes by message type. The labels are fixed on construction so that
+ * looking one up needs no lock, all other labels count towards strOther.
+ */
+class CMetricCounterFamily
+{
+private:
+    std::map<std::string, CMetricCounter> mapCounters;
+    const std::string strOther;
+
+public:
+    CMetricCounterFamily(const std::vector<std::string> &vLabels, const std::string &strOtherIn);
+
+    CMetricCounter &Get(const std::string &strLabel);
+    /** Append one line per label as name{strLabelName="label"}. */
+    void Write(const std::string &strName, const std::string &strLabelName, std::string &strOut) const;
+};
+
+extern CMetricGauge metricTipHeight;
+extern CMetricHistogram metricConnectBlock;
+extern CMetricGauge metricMempoolTransactions;
+extern CMetricGauge metricMempoolBytes;
+extern CMetricGauge metricPeers;
+extern CMetricGauge metricCoinsCacheUsage;
+extern CMetricGauge metricRewardsHeight;
+extern CMetricGauge metricRewardsLag;
+
+/** Bytes of the messages received and sent, by command. */
+CMetricCounterFamily &MetricBytesReceived();
+CMetricCounterFamily &MetricBytesSent();
+
+/** Serve the metrics in the Prometheus text format at /metrics.
+ * Precondition; HTTP has been started.
+ */
+bool StartMetrics();
+/** Stop serving the metrics.
+ */
+void StopMetrics();
+
+#endif // SMARTCASH_METRICS_H
@@ -53,17 +53,27 @@ uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 uint64_t nLastBlockWeight = 0;
 
-class ScoreCompare
-{
-public:
-    ScoreCompare() {}
+CBlockTemplateCache blockTemplateCache;
 
-    bool operator()(const CTxMemPool::txiter a, const CTxMemPool::txiter b)
-    {
-        return CompareTxMemPoolEntryByScore()(*b,*a); // Convert to less than
-    }
+namespace {
+
+/** Coinbase payments of the last assembled block, keyed by the block it
+ *  builds on. The payees only depend on the previous block, so templates
+ *  rebuilt on the same tip can skip the FillPayments calls. */
+struct CCoinbaseCache
+{
+    uint256 hashPrevBlock;
+    CMutableTransaction coinbaseTx;
+    std::vector<CTxOut> voutSmartHives;
+    std::vector<CTxOut> voutSmartNodes;
+    std::vector<CTxOut> voutSmartRewards;
 };
 
+CCriticalSection cs_coinbaseCache;
+CCoinbaseCache coinbaseCache;
+
+}
+
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev)
 {
     int64_t nOldTime = pblock->nTime;
@@ -83,22 +93,36 @@ BlockAssembler::BlockAssembler(const CChainParams& _chainparams)
     : chainparams(_chainparams)
 {
     // Largest block you're willing to create:
-    unsigned int nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
-
+    nBlockMaxSizeArg = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
+    // How much of the block should be dedicated to high-priority transactions,
+    // included regardless of the fees they pay
+    nBlockPrioritySizeArg = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
     // Check if miner wants to scale the mined/created block size when the max block size changes
-    unsigned int fScaleBlockSizeOptions = GetArg("-scaleblocksizeoptions", DEFAULT_SCALE_BLOCK_SIZE_OPTIONS);
+    fScaleBlockSizeOptions = GetArg("-scaleblocksizeoptions", DEFAULT_SCALE_BLOCK_SIZE_OPTIONS) != 0;
+
+    nBlockMaxSize = nBlockMaxSizeArg;
+    nBlockPrioritySize = nBlockPrioritySizeArg;
+    nBlockMaxSigOps = maxBlockSigops;
+}
+
+void BlockAssembler::UpdateBlockLimits()
+{
+    AssertLockHeld(cs_main);
+
+    // maxBlockSize follows the chain, so it is read here rather than in the
+    // constructor. It never drops below OLD_MAX_BLOCK_SIZE.
     unsigned int nMaxCreatedBlockSize = OLD_MAX_BLOCK_SIZE;
+    nBlockMaxSize = nBlockMaxSizeArg;
     if (fScaleBlockSizeOptions) {
-    	unsigned int nBlockSizeDiff = OLD_MAX_BLOCK_SIZE - maxBlockSize;
-    	assert(nBlockSizeDiff >= 0);
-    	nMaxCreatedBlockSize = maxBlockSize;
-    	nBlockMaxSize = nBlockMaxSize + nBlockSizeDiff;
+        nMaxCreatedBlockSize = maxBlockSize;
+        nBlockMaxSize += maxBlockSize - OLD_MAX_BLOCK_SIZE;
     }
+    nMaxCreatedBlockSize = std::min(nMaxCreatedBlockSize, MAX_BLOCK_SERIALIZED_SIZE);
     // Limit to between 1K and (maxBlockSize or MAX_BLOCK_SIZE)-1K for sanity:
-    nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(nMaxCreatedBlockSize-1000), nBlockMaxSize));
+    nBlockMaxSize = std::max((unsigned int)1000, std::min(nMaxCreatedBlockSize - 1000, nBlockMaxSize));
 
-    // Whether we need to account for byte usage (in addition to weight usage)
-    fNeedSizeAccounting = (nBlockMaxSize < MAX_BLOCK_SERIALIZED_SIZE-1000);
+    nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySizeArg);
+    nBlockMaxSigOps = maxBlockSigops;
 }
 
 void BlockAssembler::resetBlock()
@@ -107,9 +131,7 @@ void BlockAssembler::resetBlock()
 
     // Reserve space for coinbase tx
     nBlockSize = 1000;
-    nBlockWeight = 4000;
-    nBlockSigOpsCost = 100;
-    fIncludeWitness = false;
+    nBlockSigOps = 100;
 
     // These counters do not include coinbase tx
     nBlockTx = 0;
@@ -119,6 +141,48 @@ void BlockAssembler::resetBlock()
     blockFinished = false;
 }
 
+void BlockAssembler::FillCoinbase(CMutableTransaction& coinbaseTx, CBlockIndex* pindexPrev)
+{
+    CCoinbaseCache entry;
+    {
+        LOCK(cs_coinbaseCache);
+        if (coinbaseCache.hashPrevBlock == pindexPrev->GetBlockHash())
+            entry = coinbaseCache;
+    }
+
+    // The payment code takes its own locks, so the cache lock is not held
+    // while filling in a new entry.
+    if (entry.hashPrevBlock != pindexPrev->GetBlockHash()) {
+        entry.hashPrevBlock = pindexPrev->GetBlockHash();
+        entry.coinbaseTx.vin.resize(1);
+        entry.coinbaseTx.vin[0].prevout.SetNull();
+        entry.coinbaseTx.vin[0].scriptSig = CScript() << OP_0 << OP_0;
+        entry.coinbaseTx.vout.resize(1);
+
+        CAmount blockReward = GetBlockValue(nHeight, 0, pindexPrev->GetBlockTime());
+
+        // Add the SmartMining payout for the current block.
+        SmartMining::FillPayment(entry.coinbaseTx, nHeight, pindexPrev,blockReward);
+
+        // Add the SmartHive payout for the current block.
+        SmartHivePayments::FillPayments(entry.coinbaseTx,nHeight, pindexPrev->GetBlockTime(), blockReward, entry.voutSmartHives);
+
+        // Add smartnode payments if there are any pending at the current block.
+        SmartNodePayments::FillPayments(entry.coinbaseTx, nHeight, blockReward, entry.voutSmartNodes);
+
+        // Add SmartReward payments if there are any pending at the current block.
+        SmartRewardPayments::FillPayments(entry.coinbaseTx, nHeight, pindexPrev->GetBlockTime(), entry.voutSmartRewards);
+
+        LOCK(cs_coinbaseCache);
+        coinbaseCache = entry;
+    }
+
+    coinbaseTx = entry.coinbaseTx;
+    pblock->voutSmartHives = entry.voutSmartHives;
+    pblock->voutSmartNodes = entry.voutSmartNodes;
+    pblock->voutSmartRewards = entry.voutSmartRewards;
+}
+
 CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
 {
     resetBlock();
@@ -126,82 +190,24 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
 
     if(!pblocktemplate.get())
         return NULL;
-    CBlock *pblock = &pblocktemplate->block; // pointer for convenience
+    pblock = &pblocktemplate->block; // pointer for convenience
 
     CBlockIndex* pindexPrev = chainActive.Tip();
     nHeight = pindexPrev->nHeight + 1;
 
     CMutableTransaction coinbaseTx;
-    coinbaseTx.vin.resize(1);
-    coinbaseTx.vin[0].prevout.SetNull();
-    coinbaseTx.vin[0].scriptSig = CScript() << OP_0 << OP_0;
-    coinbaseTx.vout.resize(1);
+    FillCoinbase(coinbaseTx, pindexPrev);
     coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
 
-    CAmount blockReward = GetBlockValue(nHeight, 0, pindexPrev->GetBlockTime());
-
-    // Add the SmartMining payout for the current block.
-    SmartMining::FillPayment(coinbaseTx, nHeight, pindexPrev,blockReward);
-
-    // Add the SmartHive payout for the current block.
-    SmartHivePayments::FillPayments(coinbaseTx,nHeight, pindexPrev->GetBlockTime(), blockReward, pblock->voutSmartHives);
-
-    // Add smartnode payments if there are any pending at the current block.
-    SmartNodePayments::FillPayments(coinbaseTx, nHeight, blockReward, pblock->voutSmartNodes);
-
-    // Add SmartReward payments if there are any pending at the current block.
-    SmartRewardPayments::FillPayments(coinbaseTx, nHeight, pindexPrev->GetBlockTime(), pblock->voutSmartRewards);
-
     // Add coinbase tx as first transaction here. Will
     pblock->vtx.push_back(coinbaseTx);
     pblocktemplate->vTxFees.push_back(-1); // updated at end
     pblocktemplate->vTxSigOpsCost.push_back(-1); // updated at end
 
-    // Largest block you're willing to create:
-    unsigned int nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
-    // Limit to between 1K and MAX_BLOCK_SIZE-1K for sanity:
-    nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SERIALIZED_SIZE - 1000), nBlockMaxSize));
-
-    // How much of the block should be dedicated to high-priority transactions,
-    // included regardless of the fees they pay
-    unsigned int nBlockPrioritySize = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
-    nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySize);
-
-    // Minimum block size you want to create; block will be filled with free transactions
-    // until there are no more or the block reaches this size:
-    unsigned int nBlockMinSize = GetArg("-blockminsize", 0);
-    nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
-
-    unsigned int COUNT_SPEND_ZC_TX = 0;
-    unsigned int MAX_SPEND_ZC_TX_PER_BLOCK = 0;
-    // if(fTestNet || nHeight > OLD_LIMIT_SPEND_TXS){
-    //     MAX_SPEND_ZC_TX_PER_BLOCK = 1;
-    // }
-    // if(fTestNet || nHeight > SWITCH_TO_MORE_SPEND_TXS){
-    //     MAX_SPEND_ZC_TX_PER_BLOCK = 5;
-    // }
-
-    // Collect memory pool transactions into the block
-    CTxMemPool::setEntries inBlock;
-    CTxMemPool::setEntries waitSet;
-
-    // This vector will be sorted into a priority queue:
-    vector<TxCoinAgePriority> vecPriority;
-    TxCoinAgePriorityCompare pricomparer;
-    std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash> waitPriMap;
-    typedef std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash>::iterator waitPriIter;
-    double actualPriority = -1;
-
-    std::priority_queue<CTxMemPool::txiter, std::vector<CTxMemPool::txiter>, ScoreCompare> clearedTxs;
-    bool fPrintPriority = GetBoolArg("-printpriority", DEFAULT_PRINTPRIORITY);
-    uint64_t nBlockSize = 1000;
-    uint64_t nBlockTx = 0;
-    unsigned int nBlockSigOps = 100;
-    int lastFewTxs = 0;
-    CAmount nFees = 0;
-
     {
         LOCK2(cs_main, mempool.cs);
+        UpdateBlockLimits();
+
         pblock->nTime = GetAdjustedTime();
         const int64_t nMedianTimePast = pindexPrev->GetMedianTimePast();
 
@@ -211,622 +217,525 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
         if (chainparams.MineBlocksOnDemand())
             pblock->nVersion = GetArg("-blockversion", pblock->nVersion);
 
-        int64_t nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
-                                  ? nMedianTimePast
-                                  : pblock->GetBlockTime();
+        nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                          ? nMedianTimePast
+                          : pblock->GetBlockTime();
 
-        bool fPriorityBlock = nBlockPrioritySize > 0;
-        if (fPriorityBlock) {
-            vecPriority.reserve(mempool.mapTx.size());
-            for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
-                 mi != mempool.mapTx.end(); ++mi)
-            {
-                double dPriority = mi->GetPriority(nHeight);
-                CAmount dummy;
-                mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
-                vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
-            }
-            std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+        addPriorityTxs();
+        addPackageTxs();
+
+        nLastBlockTx = nBlockTx;
+        nLastBlockSize = nBlockSize;
+        LogPrintf("CreateNewBlock(): total size %u txs: %u fees: %ld sigops %d\n", nBlockSize, nBlockTx, nFees, nBlockSigOps);
+
+        // Finally now that we know the fees add them to the mining reward!
+        pblock->vtx[0].vout[0].nValue += nFees;
+
+        // Fill in header
+        pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
+        UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
+        pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
+        pblock->nNonce         = 0;
+        pblocktemplate->vTxSigOpsCost[0] = GetLegacySigOpCount(pblock->vtx[0]);
+        pblocktemplate->vTxFees[0] = -nFees;
+
+        CValidationState state;
+        if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
+            throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
         }
+    }
+    return pblocktemplate.release();
+}
 
-        CTxMemPool::indexed_transaction_set::nth_index<3>::type::iterator mi = mempool.mapTx.get<3>().begin();
-        CTxMemPool::txiter iter;
-
-        while (mi != mempool.mapTx.get<3>().end() || !clearedTxs.empty())
-        {
-            bool priorityTx = false;
-            if (fPriorityBlock && !vecPriority.empty()) { // add a tx from priority queue to fill the blockprioritysize
-                priorityTx = true;
-                iter = vecPriority.front().second;
-                actualPriority = vecPriority.front().first;
-                std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
-                vecPriority.pop_back();
-            }
-            else if (clearedTxs.empty()) { // add tx with next highest score
-                iter = mempool.mapTx.project<0>(mi);
-                mi++;
-            }
-            else {  // try to add a previously postponed child tx
-                iter = clearedTxs.top();
-                clearedTxs.pop();
-            }
+bool BlockAssembler::isStillDependent(CTxMemPool::txiter iter)
+{
+    BOOST_FOREACH(const CTxMemPoolEntry* parent, mempool.GetMemPoolParents(iter))
+    {
+        if (!inBlock.count(mempool.mapTx.iterator_to(*parent))) {
+            return true;
+        }
+    }
+    return false;
+}
 
-            if (inBlock.count(iter)) {
-                LogPrintf("skip, due to exist!\n");
-                continue; // could have been added to the priorityBlock
-            }
+void BlockAssembler::onlyUnconfirmed(CTxMemPool::setEntries& testSet)
+{
+    for (CTxMemPool::setEntries::iterator iit = testSet.begin(); iit != testSet.end(); ) {
+        // Only test txs not already in the block
+        if (inBlock.count(*iit)) {
+            testSet.erase(iit++);
+        }
+        else {
+            iit++;
+        }
+    }
+}
 
-            const CTransaction& tx = iter->GetTx();
-            LogPrintf("Trying to add tx=%s\n", tx.GetHash().ToString());
+bool BlockAssembler::TestPackage(uint64_t packageSize, unsigned int packageSigOps)
+{
+    if (nBlockSize + packageSize >= nBlockMaxSize)
+        return false;
+    if (nBlockSigOps + packageSigOps >= nBlockMaxSigOps)
+        return false;
+    return true;
+}
 
-            bool fOrphan = false;
-            BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(iter))
-            {
-                if (!inBlock.count(parent)) {
-                    fOrphan = true;
-                    break;
-                }
-            }
-            if (fOrphan) {
-                if (priorityTx)
-                    waitPriMap.insert(std::make_pair(iter,actualPriority));
-                else waitSet.insert(iter);
-                LogPrintf("skip tx=%s, due to fOrphan=%s\n", tx.GetHash().ToString(), fOrphan);
-                continue;
-            }
+// Perform transaction-level checks before adding to block:
+// - transaction finality (locktime)
+// - zerocoin spends, which are no longer accepted into blocks
+// - serialized size, summed over the package
+bool BlockAssembler::TestPackageTransactions(const CTxMemPool::setEntries& package)
+{
+    uint64_t nPotentialBlockSize = nBlockSize;
+    BOOST_FOREACH (const CTxMemPool::txiter it, package) {
+        if (!IsFinalTx(it->GetTx(), nHeight, nLockTimeCutoff))
+            return false;
+        if (it->GetTx().IsZerocoinSpend())
+            return false;
+        nPotentialBlockSize += it->GetTxSize();
+        if (nPotentialBlockSize >= nBlockMaxSize)
+            return false;
+    }
+    return true;
+}
 
-            unsigned int nTxSize = iter->GetTxSize();
-            if (fPriorityBlock &&
-                (nBlockSize + nTxSize >= nBlockPrioritySize || !AllowFree(actualPriority))) {
-                fPriorityBlock = false;
-                waitPriMap.clear();
-            }
+bool BlockAssembler::TestForBlock(CTxMemPool::txiter iter)
+{
+    if (nBlockSize + iter->GetTxSize() >= nBlockMaxSize) {
+        // If the block is so close to full that no more txs will fit
+        // or if we've tried more than 50 times to fill remaining space
+        // then flag that the block is finished
+        if (nBlockSize >  nBlockMaxSize - 100 || lastFewTxs > 50) {
+             blockFinished = true;
+             return false;
+        }
+        // Once we're within 1000 bytes of a full block, only look at 50 more txs
+        // to try to fill the remaining space.
+        if (nBlockSize > nBlockMaxSize - 1000) {
+            lastFewTxs++;
+        }
+        return false;
+    }
 
-            if (nBlockSize + nTxSize >= nBlockMaxSize) {
-                if (nBlockSize >  nBlockMaxSize - 100 || lastFewTxs > 50) {
-                    LogPrintf("stop due to size overweight", tx.GetHash().ToString());
-                    LogPrintf("nBlockSize=%s\n", nBlockSize);
-                    LogPrintf("nBlockMaxSize=%s\n", nBlockMaxSize);
-                    break;
-                }
-                // Once we're within 1000 bytes of a full block, only look at 50 more txs
-                // to try to fill the remaining space.
-                if (nBlockSize > nBlockMaxSize - 1000) {
-                    lastFewTxs++;
-                }
-                LogPrintf("skip tx=%s\n", tx.GetHash().ToString());
-                LogPrintf("nBlockSize=%s\n", nBlockSize);
-                LogPrintf("nBlockMaxSize=%s\n", nBlockMaxSize);
+    if (nBlockSigOps + iter->GetSigOpCount() >= nBlockMaxSigOps) {
+        // If the block has room for no more sig ops then
+        // flag that the block is finished
+        if (nBlockSigOps > nBlockMaxSigOps - 2) {
+            blockFinished = true;
+            return false;
+        }
+        // Otherwise attempt to find another tx with fewer sigops
+        // to put in the block.
+        return false;
+    }
+
+    // Must check that lock times are still valid
+    // This can be removed once MTP is always enforced
+    // as long as reorgs keep the mempool consistent.
+    if (!IsFinalTx(iter->GetTx(), nHeight, nLockTimeCutoff))
+        return false;
+
+    if (iter->GetTx().IsZerocoinSpend())
+        return false;
+
+    return true;
+}
+
+void BlockAssembler::AddToBlock(CTxMemPool::txiter iter)
+{
+    pblock->vtx.push_back(iter->GetTx());
+    pblocktemplate->vTxFees.push_back(iter->GetFee());
+    pblocktemplate->vTxSigOpsCost.push_back(iter->GetSigOpCount());
+    nBlockSize += iter->GetTxSize();
+    ++nBlockTx;
+    nBlockSigOps += iter->GetSigOpCount();
+    nFees += iter->GetFee();
+    inBlock.insert(iter);
+
+    bool fPrintPriority = GetBoolArg("-printpriority", DEFAULT_PRINTPRIORITY);
+    if (fPrintPriority) {
+        double dPriority = iter->GetPriority(nHeight);
+        CAmount dummy;
+        mempool.ApplyDeltas(iter->GetTx().GetHash(), dPriority, dummy);
+        LogPrintf("priority %.1f fee %s txid %s\n",
+                  dPriority,
+                  CFeeRate(iter->GetModifiedFee(), iter->GetTxSize()).ToString(),
+                  iter->GetTx().GetHash().ToString());
+    }
+}
+
+void BlockAssembler::UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded,
+        indexed_modified_transaction_set &mapModifiedTx)
+{
+    BOOST_FOREACH(const CTxMemPool::txiter it, alreadyAdded) {
+        CTxMemPool::setEntries descendants;
+        mempool.CalculateDescendants(it, descendants);
+        // Insert all descendants (not yet in block) into the modified set
+        BOOST_FOREACH(CTxMemPool::txiter desc, descendants) {
+            if (alreadyAdded.count(desc))
                 continue;
+            modtxiter mit = mapModifiedTx.find(desc);
+            if (mit == mapModifiedTx.end()) {
+                CTxMemPoolModifiedEntry modEntry(desc);
+                modEntry.nSizeWithAncestors -= it->GetTxSize();
+                modEntry.nModFeesWithAncestors -= it->GetModifiedFee();
+                modEntry.nSigOpCountWithAncestors -= it->GetSigOpCount();
+                mapModifiedTx.insert(modEntry);
+            } else {
+                mapModifiedTx.modify(mit, update_for_parent_inclusion(it));
             }
-            if (tx.IsCoinBase()) {
-                LogPrintf("skip tx=%s, coinbase tx\n", tx.GetHash().ToString());
-                continue;
+        }
+    }
+}
+
+// Skip entries in mapTx that are already in a block or are present
+// in mapModifiedTx (which implies that the mapTx ancestor state is
+// stale due to ancestor inclusion in the block)
+// Also skip transactions that we've already failed to add. This can happen if
+// we consider a transaction in mapModifiedTx and it fails: we can then
+// potentially consider it again while walking mapTx.  It's currently
+// guaranteed to fail again, but as a belt-and-suspenders check we put it in
+// failedTx and avoid re-evaluation, since the re-evaluation would be using
+// cached size/sigops/fee values that are not actually correct.
+bool BlockAssembler::SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set &mapModifiedTx, CTxMemPool::setEntries &failedTx)
+{
+    assert (it != mempool.mapTx.end());
+    if (mapModifiedTx.count(it) || inBlock.count(it) || failedTx.count(it))
+        return true;
+    return false;
+}
+
+void BlockAssembler::SortForBlock(const CTxMemPool::setEntries& package, CTxMemPool::txiter entry, std::vector<CTxMemPool::txiter>& sortedEntries)
+{
+    // Sort package by ancestor count
+    // If a transaction A depends on transaction B, then A's ancestor count
+    // must be greater than B's.  So this is sufficient to validly order the
+    // transactions for block inclusion.
+    sortedEntries.clear();
+    sortedEntries.insert(sortedEntries.begin(), package.begin(), package.end());
+    std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
+}
+
+// This transaction selection algorithm orders the mempool based
+// on feerate of a transaction including all unconfirmed ancestors.
+// Since we don't remove transactions from the mempool as we select them
+// for block inclusion, we need an alternate method of updating the feerate
+// of a transaction with its not-yet-selected ancestors as we go.
+// This is accomplished by walking the in-mempool descendants of selected
+// transactions and storing a temporary modified state in mapModifiedTxs.
+// Each time through the loop, we compare the best transaction in
+// mapModifiedTxs with the next transaction in the mempool to decide what
+// transaction package to work on next.
+void BlockAssembler::addPackageTxs()
+{
+    // mapModifiedTx will store sorted packages after they are modified
+    // because some of their txs are already in the block
+    indexed_modified_transaction_set mapModifiedTx;
+    // Keep track of entries that failed inclusion, to avoid duplicate work
+    CTxMemPool::setEntries failedTx;
+
+    // Start by adding all descendants of previously added txs to mapModifiedTx
+    // and modifying them for their already included ancestors
+    UpdatePackagesForAdded(inBlock, mapModifiedTx);
+
+    CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator mi = mempool.mapTx.get<ancestor_score>().begin();
+    CTxMemPool::txiter iter;
+    while (mi != mempool.mapTx.get<ancestor_score>().end() || !mapModifiedTx.empty())
+    {
+        // First try to find a new transaction in mapTx to evaluate.
+        if (mi != mempool.mapTx.get<ancestor_score>().end() &&
+                SkipMapTxEntry(mempool.mapTx.project<0>(mi), mapModifiedTx, failedTx)) {
+            ++mi;
+            continue;
+        }
+
+        // Now that mi is not stale, determine which transaction to evaluate:
+        // the next entry from mapTx, or the best from mapModifiedTx?
+        bool fUsingModified = false;
+
+        modtxscoreiter modit = mapModifiedTx.get<ancestor_score>().begin();
+        if (mi == mempool.mapTx.get<ancestor_score>().end()) {
+            // We're out of entries in mapTx; use the entry from mapModifiedTx
+            iter = modit->iter;
+            fUsingModified = true;
+        } else {
+            // Try to compare the mapTx entry to the mapModifiedTx entry
+            iter = mempool.mapTx.project<0>(mi);
+            if (modit != mapModifiedTx.get<ancestor_score>().end() &&
+                    CompareModifiedEntry()(*modit, CTxMemPoolModifiedEntry(iter))) {
+                // The best entry in mapModifiedTx has higher score
+                // than the one from mapTx.
+                // Switch which transaction (package) to consider
+                iter = modit->iter;
+                fUsingModified = true;
+            } else {
+                // Either no entry in mapModifiedTx, or it's worse than mapTx.
+                // Increment mi for the next loop iteration.
+                ++mi;
             }
+        }
 
-            if (!IsFinalTx(tx, nHeight, nLockTimeCutoff)) {
-                LogPrintf("skip tx=%s, not IsFinalTx\n", tx.GetHash().ToString());
-                continue;
+        // We skip mapTx entries that are inBlock, and mapModifiedTx shouldn't
+        // contain anything that is inBlock.
+        assert(!inBlock.count(iter));
+
+        uint64_t packageSize = iter->GetSizeWithAncestors();
+        CAmount packageFees = iter->GetModFeesWithAncestors();
+        unsigned int packageSigOps = iter->GetSigOpCountWithAncestors();
+        if (fUsingModified) {
+            packageSize = modit->nSizeWithAncestors;
+            packageFees = modit->nModFeesWithAncestors;
+            packageSigOps = modit->nSigOpCountWithAncestors;
+        }
+
+        if (packageFees < ::minRelayTxFee.GetFee(packageSize)) {
+            // Everything else we might consider has a lower fee rate
+            return;
+        }
+
+        if (!TestPackage(packageSize, packageSigOps)) {
+            if (fUsingModified) {
+                // Since we always look at the best entry in mapModifiedTx,
+                // we must erase failed entries so that we can consider the
+                // next best entry on the next loop iteration
+                mapModifiedTx.get<ancestor_score>().erase(modit);
+                failedTx.insert(iter);
             }
-            
-            unsigned int nTxSigOps = iter->GetSigOpCount();
-            if (nBlockSigOps + nTxSigOps >= maxBlockSigops) {
-                if (nBlockSigOps > maxBlockSigops - 2) {
-                    break;
-                }
-                continue;
+            continue;
+        }
+
+        CTxMemPool::setEntries ancestors;
+        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        std::string dummy;
+        mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+
+        onlyUnconfirmed(ancestors);
+        ancestors.insert(iter);
+
+        // Test if all tx's are Final
+        if (!TestPackageTransactions(ancestors)) {
+            if (fUsingModified) {
+                mapModifiedTx.get<ancestor_score>().erase(modit);
+                failedTx.insert(iter);
             }
+            continue;
+        }
 
-            if (tx.IsZerocoinSpend()) {
-                LogPrintf("try to include zerocoinspend tx=%s\n", tx.GetHash().ToString());
-                LogPrintf("COUNT_SPEND_ZC_TX =%s\n", COUNT_SPEND_ZC_TX);
-                LogPrintf("MAX_SPEND_ZC_TX_PER_BLOCK =%s\n", MAX_SPEND_ZC_TX_PER_BLOCK);
-                if (COUNT_SPEND_ZC_TX >= MAX_SPEND_ZC_TX_PER_BLOCK) {
-                    continue;
-                }
+        // Package can be added. Sort the entries in a valid order.
+        vector<CTxMemPool::txiter> sortedEntries;
+        SortForBlock(ancestors, iter, sortedEntries);
 
-                //mempool.countZCSpend--;
-                // Size limits
-                unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-
-                LogPrintf("\n\n######################################\n");
-                LogPrintf("nBlockMaxSize = %d\n", nBlockMaxSize);
-                LogPrintf("nBlockSize = %d\n", nBlockSize);
-                LogPrintf("nTxSize = %d\n", nTxSize);
-                LogPrintf("nBlockSize + nTxSize  = %d\n", nBlockSize + nTxSize);
-                LogPrintf("nBlockSigOpsCost  = %d\n", nBlockSigOpsCost);
-                LogPrintf("GetLegacySigOpCount  = %d\n", GetLegacySigOpCount(tx));
-                LogPrintf("######################################\n\n\n");
-
-                if (nBlockSize + nTxSize >= nBlockMaxSize) {
-                    LogPrintf("failed by sized\n");
-                    continue;
-                }
+        for (size_t i=0; i<sortedEntries.size(); ++i) {
+            AddToBlock(sortedEntries[i]);
+            // Erase from the modified set, if present
+            mapModifiedTx.erase(sortedEntries[i]);
+        }
 
-                // Legacy limits on sigOps:
-                unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-                if (nBlockSigOpsCost + nTxSigOps >= MAX_BLOCK_SIGOPS_COST) {
-                    LogPrintf("failed by sized\n");
-                    continue;
-                }
+        // Update transactions that depend on each of these
+        UpdatePackagesForAdded(ancestors, mapModifiedTx);
+    }
+}
 
-                int64_t nTxFees = 0;
+void BlockAssembler::addPriorityTxs()
+{
+    if (nBlockPrioritySize == 0) {
+        return;
+    }
 
-                pblock->vtx.push_back(tx);
-                pblocktemplate->vTxFees.push_back(nTxFees);
-                pblocktemplate->vTxSigOpsCost.push_back(nTxSigOps);
-                nBlockSize += nTxSize;
-                ++nBlockTx;
-                nBlockSigOpsCost += nTxSigOps;
-                nFees += nTxFees;
-                COUNT_SPEND_ZC_TX++;
-                continue;
-            }
+    // This vector will be sorted into a priority queue:
+    vector<TxCoinAgePriority> vecPriority;
+    TxCoinAgePriorityCompare pricomparer;
+    std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash> waitPriMap;
+    typedef std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash>::iterator waitPriIter;
+    double actualPriority = -1;
 
-            LogPrintf("nTxSigOps=%s\n", nTxSigOps);
-            LogPrintf("nBlockSigOps=%s\n", nBlockSigOps);
-            LogPrintf("MAX_BLOCK_SIGOPS_COST=%s\n", MAX_BLOCK_SIGOPS_COST);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS_COST) {
-                if (nBlockSigOps > MAX_BLOCK_SIGOPS_COST - 2) {
-                    LogPrintf("stop due to cross fee\n", tx.GetHash().ToString());
-                    break;
-                }
-                LogPrintf("skip tx=%s, nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS_COST\n", tx.GetHash().ToString());
-                continue;
-            }
-            CAmount nTxFees = iter->GetFee();
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOpsCost.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
-            LogPrintf("added to block=%s\n", tx.GetHash().ToString());
-            if (fPrintPriority)
-            {
-                double dPriority = iter->GetPriority(nHeight);
-                CAmount dummy;
-                mempool.ApplyDeltas(tx.GetHash(), dPriority, dummy);
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                          dPriority , CFeeRate(iter->GetModifiedFee(), nTxSize).ToString(), tx.GetHash().ToString());
-            }
+    vecPriority.reserve(mempool.mapTx.size());
+    for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
+         mi != mempool.mapTx.end(); ++mi)
+    {
+        double dPriority = mi->GetPriority(nHeight);
+        CAmount dummy;
+        mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
+        vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
+    }
+    std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+
+    CTxMemPool::txiter iter;
+    while (!vecPriority.empty() && !blockFinished) { // add a tx from priority queue to fill the blockprioritysize
+        iter = vecPriority.front().second;
+        actualPriority = vecPriority.front().first;
+        std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+        vecPriority.pop_back();
+
+        // If tx already in block, skip
+        if (inBlock.count(iter)) {
+            assert(false); // shouldn't happen for priority txs
+            continue;
+        }
 
-            inBlock.insert(iter);
+        // If tx is dependent on other mempool txs which haven't yet been included
+        // then put it in the waitSet
+        if (isStillDependent(iter)) {
+            waitPriMap.insert(std::make_pair(iter, actualPriority));
+            continue;
+        }
+
+        // If this tx fits in the block add it, otherwise keep looping
+        if (TestForBlock(iter)) {
+            AddToBlock(iter);
+
+            // If now that this txs is added we've surpassed our desired priority size
+            // or have dropped below the AllowFreeThreshold, then we're done adding priority txs
+            if (nBlockSize >= nBlockPrioritySize || !AllowFree(actualPriority)) {
+                break;
+            }
 
-            // Add transactions that depend on this one to the priority queue
-            BOOST_FOREACH(CTxMemPool::txiter child, mempool.GetMemPoolChildren(iter))
+            // This tx was successfully added, so
+            // add transactions that depend on this one to the priority queue to try again
+            BOOST_FOREACH(const CTxMemPoolEntry* pchild, mempool.GetMemPoolChildren(iter))
             {
-                if (fPriorityBlock) {
-                    waitPriIter wpiter = waitPriMap.find(child);
-                    if (wpiter != waitPriMap.end()) {
-                        vecPriority.push_back(TxCoinAgePriority(wpiter->second,child));
-                        std::push_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
-                        waitPriMap.erase(wpiter);
-                    }
-                }
-                else {
-                    if (waitSet.count(child)) {
-                        clearedTxs.push(child);
-                        waitSet.erase(child);
-                    }
+                CTxMemPool::txiter child = mempool.mapTx.iterator_to(*pchild);
+                waitPriIter wpiter = waitPriMap.find(child);
+                if (wpiter != waitPriMap.end()) {
+                    vecPriority.push_back(TxCoinAgePriority(wpiter->second,child));
+                    std::push_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+                    waitPriMap.erase(wpiter);
                 }
             }
         }
+    }
+}
 
-        nLastBlockTx = nBlockTx;
-        nLastBlockSize = nBlockSize;
-        LogPrintf("CreateNewBlock(): total size %u txs: %u fees: %ld sigops %d\n", nBlockSize, nBlockTx, nFees, nBlockSigOps);
+CBlockTemplateCache::CBlockTemplateCache()
+    : pindexPrev(NULL), nTransactionsUpdated(0), nTimeBuilt(0), fStale(true),
+      nBlockSize(0), nBlockSigOps(0), nBlockMaxSize(0), nBlockMaxSigOps(0), nLockTimeCutoff(0)
+{
+}
 
-        // Finally now that we know the fees add them to the mining reward!
-        pblock->vtx[0].vout[0].nValue += nFees;
+void CBlockTemplateCache::Clear()
+{
+    LOCK(cs);
+    pblocktemplate.reset();
+    pindexPrev = NULL;
+    setTemplateTx.clear();
+    fStale = true;
+}
 
-        // Fill in header
-        pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
-        UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
-        pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
-        pblock->nNonce         = 0;
-        pblocktemplate->vTxSigOpsCost[0] = GetLegacySigOpCount(pblock->vtx[0]);
-        pblocktemplate->vTxFees[0] = -nFees;
+bool CBlockTemplateCache::Get(const CChainParams& chainparams, CBlockTemplate& blocktemplate, unsigned int& nTransactionsUpdatedRet, int64_t nMaxAge)
+{
+    LOCK2(cs_main, mempool.cs);
+    LOCK(cs);
 
-        CValidationState state;
-        if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
-            throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
-        }
+    // Anything other than an append we were notified about moves the
+    // mempool counter past the one the template accounts for.
+    if (mempool.GetTransactionsUpdated() != nTransactionsUpdated)
+        fStale = true;
+
+    if (!pblocktemplate || pindexPrev != chainActive.Tip() ||
+        (fStale && GetTime() - nTimeBuilt > nMaxAge))
+    {
+        // Drop the old template first so a failed build is retried next time
+        pblocktemplate.reset();
+        pindexPrev = NULL;
+        setTemplateTx.clear();
+
+        unsigned int nTransactionsUpdatedNew = mempool.GetTransactionsUpdated();
+        const CBlockIndex* pindexPrevNew = chainActive.Tip();
+
+        BlockAssembler assembler(chainparams);
+        CScript scriptDummy = CScript() << OP_TRUE;
+        pblocktemplate.reset(assembler.CreateNewBlock(scriptDummy));
+        if (!pblocktemplate)
+            return false;
+
+        pindexPrev = pindexPrevNew;
+        nTransactionsUpdated = nTransactionsUpdatedNew;
+        nTimeBuilt = GetTime();
+        fStale = false;
+
+        nBlockSize = assembler.GetBlockSize();
+        nBlockSigOps = assembler.GetBlockSigOps();
+        nBlockMaxSize = assembler.GetBlockMaxSize();
+        nBlockMaxSigOps = assembler.GetBlockMaxSigOps();
+        nLockTimeCutoff = assembler.GetLockTimeCutoff();
+
+        for (size_t i = 1; i < pblocktemplate->block.vtx.size(); i++)
+            setTemplateTx.insert(pblocktemplate->block.vtx[i].GetHash());
     }
-    return pblocktemplate.release();
+
+    blocktemplate = *pblocktemplate;
+    nTransactionsUpdatedRet = nTransactionsUpdated;
+    return true;
 }
 
-// bool BlockAssembler::isStillDependent(CTxMemPool::txiter iter)
-// {
-//     BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(iter))
-//     {
-//         if (!inBlock.count(parent)) {
-//             return true;
-//         }
-//     }
-//     return false;
-// }
-
-// void BlockAssembler::onlyUnconfirmed(CTxMemPool::setEntries& testSet)
-// {
-//     for (CTxMemPool::setEntries::iterator iit = testSet.begin(); iit != testSet.end(); ) {
-//         // Only test txs not already in the block
-//         if (inBlock.count(*iit)) {
-//             testSet.erase(iit++);
-//         }
-//         else {
-//             iit++;
-//         }
-//     }
-// }
-
-// bool BlockAssembler::TestPackage(uint64_t packageSize, int64_t packageSigOpsCost)
-// {
-//     // TODO: switch to weight-based accounting for packages instead of vsize-based accounting.
-//     if (nBlockWeight + WITNESS_SCALE_FACTOR * packageSize >= nBlockMaxWeight)
-//         return false;
-//     if (nBlockSigOpsCost + packageSigOpsCost >= MAX_BLOCK_SIGOPS_COST)
-//         return false;
-//     return true;
-// }
-
-// // Perform transaction-level checks before adding to block:
-// // - transaction finality (locktime)
-// // - premature witness (in case segwit transactions are added to mempool before
-// //   segwit activation)
-// // - serialized size (in case -blockmaxsize is in use)
-// bool BlockAssembler::TestPackageTransactions(const CTxMemPool::setEntries& package)
-// {
-//     uint64_t nPotentialBlockSize = nBlockSize; // only used with fNeedSizeAccounting
-//     BOOST_FOREACH (const CTxMemPool::txiter it, package) {
-//         if (!IsFinalTx(it->GetTx(), nHeight, nLockTimeCutoff))
-//             return false;
-//         if (!fIncludeWitness && !it->GetTx().wit.IsNull())
-//             return false;
-//         if (fNeedSizeAccounting) {
-//             uint64_t nTxSize = ::GetSerializeSize(it->GetTx(), SER_NETWORK, PROTOCOL_VERSION);
-//             if (nPotentialBlockSize + nTxSize >= nBlockMaxSize) {
-//                 return false;
-//             }
-//             nPotentialBlockSize += nTxSize;
-//         }
-//     }
-//     return true;
-// }
-
-// bool BlockAssembler::TestForBlock(CTxMemPool::txiter iter)
-// {
-//     if (nBlockWeight + iter->GetTxWeight() >= nBlockMaxWeight) {
-//         // If the block is so close to full that no more txs will fit
-//         // or if we've tried more than 50 times to fill remaining space
-//         // then flag that the block is finished
-//         if (nBlockWeight >  nBlockMaxWeight - 400 || lastFewTxs > 50) {
-//              blockFinished = true;
-//              return false;
-//         }
-//         // Once we're within 4000 weight of a full block, only look at 50 more txs
-//         // to try to fill the remaining space.
-//         if (nBlockWeight > nBlockMaxWeight - 4000) {
-//             lastFewTxs++;
-//         }
-//         return false;
-//     }
-
-//     if (fNeedSizeAccounting) {
-//         if (nBlockSize + ::GetSerializeSize(iter->GetTx(), SER_NETWORK, PROTOCOL_VERSION) >= nBlockMaxSize) {
-//             if (nBlockSize >  nBlockMaxSize - 100 || lastFewTxs > 50) {
-//                  blockFinished = true;
-//                  return false;
-//             }
-//             if (nBlockSize > nBlockMaxSize - 1000) {
-//                 lastFewTxs++;
-//             }
-//             return false;
-//         }
-//     }
-
-//     if (nBlockSigOpsCost + iter->GetSigOpCost() >= MAX_BLOCK_SIGOPS_COST) {
-//         // If the block has room for no more sig ops then
-//         // flag that the block is finished
-//         if (nBlockSigOpsCost > MAX_BLOCK_SIGOPS_COST - 8) {
-//             blockFinished = true;
-//             return false;
-//         }
-//         // Otherwise attempt to find another tx with fewer sigops
-//         // to put in the block.
-//         return false;
-//     }
-
-//     // Must check that lock times are still valid
-//     // This can be removed once MTP is always enforced
-//     // as long as reorgs keep the mempool consistent.
-//     if (!IsFinalTx(iter->GetTx(), nHeight, nLockTimeCutoff))
-//         return false;
-
-//     return true;
-// }
-
-// void BlockAssembler::AddToBlock(CTxMemPool::txiter iter)
-// {
-//     pblock->vtx.push_back(iter->GetTx());
-//     pblocktemplate->vTxFees.push_back(iter->GetFee());
-//     pblocktemplate->vTxSigOpsCost.push_back(iter->GetSigOpCost());
-//     if (fNeedSizeAccounting) {
-//         nBlockSize += ::GetSerializeSize(iter->GetTx(), SER_NETWORK, PROTOCOL_VERSION);
-//     }
-//     nBlockWeight += iter->GetTxWeight();
-//     ++nBlockTx;
-//     nBlockSigOpsCost += iter->GetSigOpCost();
-//     nFees += iter->GetFee();
-//     inBlock.insert(iter);
-
-//     bool fPrintPriority = GetBoolArg("-printpriority", DEFAULT_PRINTPRIORITY);
-//     if (fPrintPriority) {
-//         double dPriority = iter->GetPriority(nHeight);
-//         CAmount dummy;
-//         mempool.ApplyDeltas(iter->GetTx().GetHash(), dPriority, dummy);
-//         LogPrintf("priority %.1f fee %s txid %s\n",
-//                   dPriority,
-//                   CFeeRate(iter->GetModifiedFee(), iter->GetTxSize()).ToString(),
-//                   iter->GetTx().GetHash().ToString());
-//     }
-// }
-
-// void BlockAssembler::UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded,
-//         indexed_modified_transaction_set &mapModifiedTx)
-// {
-//     BOOST_FOREACH(const CTxMemPool::txiter it, alreadyAdded) {
-//         CTxMemPool::setEntries descendants;
-//         mempool.CalculateDescendants(it, descendants);
-//         // Insert all descendants (not yet in block) into the modified set
-//         BOOST_FOREACH(CTxMemPool::txiter desc, descendants) {
-//             if (alreadyAdded.count(desc))
-//                 continue;
-//             modtxiter mit = mapModifiedTx.find(desc);
-//             if (mit == mapModifiedTx.end()) {
-//                 CTxMemPoolModifiedEntry modEntry(desc);
-//                 modEntry.nSizeWithAncestors -= it->GetTxSize();
-//                 modEntry.nModFeesWithAncestors -= it->GetModifiedFee();
-//                 modEntry.nSigOpCostWithAncestors -= it->GetSigOpCost();
-//                 mapModifiedTx.insert(modEntry);
-//             } else {
-//                 mapModifiedTx.modify(mit, update_for_parent_inclusion(it));
-//             }
-//         }
-//     }
-// }
-
-// // Skip entries in mapTx that are already in a block or are present
-// // in mapModifiedTx (which implies that the mapTx ancestor state is
-// // stale due to ancestor inclusion in the block)
-// // Also skip transactions that we've already failed to add. This can happen if
-// // we consider a transaction in mapModifiedTx and it fails: we can then
-// // potentially consider it again while walking mapTx.  It's currently
-// // guaranteed to fail again, but as a belt-and-suspenders check we put it in
-// // failedTx and avoid re-evaluation, since the re-evaluation would be using
-// // cached size/sigops/fee values that are not actually correct.
-// bool BlockAssembler::SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set &mapModifiedTx, CTxMemPool::setEntries &failedTx)
-// {
-//     assert (it != mempool.mapTx.end());
-//     if (mapModifiedTx.count(it) || inBlock.count(it) || failedTx.count(it))
-//         return true;
-//     return false;
-// }
-
-// void BlockAssembler::SortForBlock(const CTxMemPool::setEntries& package, CTxMemPool::txiter entry, std::vector<CTxMemPool::txiter>& sortedEntries)
-// {
-//     // Sort package by ancestor count
-//     // If a transaction A depends on transaction B, then A's ancestor count
-//     // must be greater than B's.  So this is sufficient to validly order the
-//     // transactions for block inclusion.
-//     sortedEntries.clear();
-//     sortedEntries.insert(sortedEntries.begin(), package.begin(), package.end());
-//     std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
-// }
-
-// // This transaction selection algorithm orders the mempool based
-// // on feerate of a transaction including all unconfirmed ancestors.
-// // Since we don't remove transactions from the mempool as we select them
-// // for block inclusion, we need an alternate method of updating the feerate
-// // of a transaction with its not-yet-selected ancestors as we go.
-// // This is accomplished by walking the in-mempool descendants of selected
-// // transactions and storing a temporary modified state in mapModifiedTxs.
-// // Each time through the loop, we compare the best transaction in
-// // mapModifiedTxs with the next transaction in the mempool to decide what
-// // transaction package to work on next.
-// void BlockAssembler::addPackageTxs()
-// {
-//     // mapModifiedTx will store sorted packages after they are modified
-//     // because some of their txs are already in the block
-//     indexed_modified_transaction_set mapModifiedTx;
-//     // Keep track of entries that failed inclusion, to avoid duplicate work
-//     CTxMemPool::setEntries failedTx;
-
-//     // Start by adding all descendants of previously added txs to mapModifiedTx
-//     // and modifying them for their already included ancestors
-//     UpdatePackagesForAdded(inBlock, mapModifiedTx);
-
-//     CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator mi = mempool.mapTx.get<ancestor_score>().begin();
-//     CTxMemPool::txiter iter;
-//     while (mi != mempool.mapTx.get<ancestor_score>().end() || !mapModifiedTx.empty())
-//     {
-//         // First try to find a new transaction in mapTx to evaluate.
-//         if (mi != mempool.mapTx.get<ancestor_score>().end() &&
-//                 SkipMapTxEntry(mempool.mapTx.project<0>(mi), mapModifiedTx, failedTx)) {
-//             ++mi;
-//             continue;
-//         }
-
-//         // Now that mi is not stale, determine which transaction to evaluate:
-//         // the next entry from mapTx, or the best from mapModifiedTx?
-//         bool fUsingModified = false;
-
-//         modtxscoreiter modit = mapModifiedTx.get<ancestor_score>().begin();
-//         if (mi == mempool.mapTx.get<ancestor_score>().end()) {
-//             // We're out of entries in mapTx; use the entry from mapModifiedTx
-//             iter = modit->iter;
-//             fUsingModified = true;
-//         } else {
-//             // Try to compare the mapTx entry to the mapModifiedTx entry
-//             iter = mempool.mapTx.project<0>(mi);
-//             if (modit != mapModifiedTx.get<ancestor_score>().end() &&
-//                     CompareModifiedEntry()(*modit, CTxMemPoolModifiedEntry(iter))) {
-//                 // The best entry in mapModifiedTx has higher score
-//                 // than the one from mapTx.
-//                 // Switch which transaction (package) to consider
-//                 iter = modit->iter;
-//                 fUsingModified = true;
-//             } else {
-//                 // Either no entry in mapModifiedTx, or it's worse than mapTx.
-//                 // Increment mi for the next loop iteration.
-//                 ++mi;
-//             }
-//         }
-
-//         // We skip mapTx entries that are inBlock, and mapModifiedTx shouldn't
-//         // contain anything that is inBlock.
-//         assert(!inBlock.count(iter));
-
-//         uint64_t packageSize = iter->GetSizeWithAncestors();
-//         CAmount packageFees = iter->GetModFeesWithAncestors();
-//         int64_t packageSigOpsCost = iter->GetSigOpCostWithAncestors();
-//         if (fUsingModified) {
-//             packageSize = modit->nSizeWithAncestors;
-//             packageFees = modit->nModFeesWithAncestors;
-//             packageSigOpsCost = modit->nSigOpCostWithAncestors;
-//         }
-
-//         if (packageFees < ::minRelayTxFee.GetFee(packageSize)) {
-//             // Everything else we might consider has a lower fee rate
-//             return;
-//         }
-
-//         if (!TestPackage(packageSize, packageSigOpsCost)) {
-//             if (fUsingModified) {
-//                 // Since we always look at the best entry in mapModifiedTx,
-//                 // we must erase failed entries so that we can consider the
-//                 // next best entry on the next loop iteration
-//                 mapModifiedTx.get<ancestor_score>().erase(modit);
-//                 failedTx.insert(iter);
-//             }
-//             continue;
-//         }
-
-//         CTxMemPool::setEntries ancestors;
-//         uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
-//         std::string dummy;
-//         mempool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
-
-//         onlyUnconfirmed(ancestors);
-//         ancestors.insert(iter);
-
-//         // Test if all tx's are Final
-//         if (!TestPackageTransactions(ancestors)) {
-//             if (fUsingModified) {
-//                 mapModifiedTx.get<ancestor_score>().erase(modit);
-//                 failedTx.insert(iter);
-//             }
-//             continue;
-//         }
-
-//         // Package can be added. Sort the entries in a valid order.
-//         vector<CTxMemPool::txiter> sortedEntries;
-//         SortForBlock(ancestors, iter, sortedEntries);
-
-//         for (size_t i=0; i<sortedEntries.size(); ++i) {
-//             AddToBlock(sortedEntries[i]);
-//             // Erase from the modified set, if present
-//             mapModifiedTx.erase(sortedEntries[i]);
-//         }
-
-//         // Update transactions that depend on each of these
-//         UpdatePackagesForAdded(ancestors, mapModifiedTx);
-//     }
-// }
-
-// void BlockAssembler::addPriorityTxs()
-// {
-//     // How much of the block should be dedicated to high-priority transactions,
-//     // included regardless of the fees they pay
-//     unsigned int nBlockPrioritySize = GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE);
-//     nBlockPrioritySize = std::min(nBlockMaxSize, nBlockPrioritySize);
-
-//     if (nBlockPrioritySize == 0) {
-//         return;
-//     }
-
-//     bool fSizeAccounting = fNeedSizeAccounting;
-//     fNeedSizeAccounting = true;
-
-//     // This vector will be sorted into a priority queue:
-//     vector<TxCoinAgePriority> vecPriority;
-//     TxCoinAgePriorityCompare pricomparer;
-//     std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash> waitPriMap;
-//     typedef std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash>::iterator waitPriIter;
-//     double actualPriority = -1;
-
-//     vecPriority.reserve(mempool.mapTx.size());
-//     for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
-//          mi != mempool.mapTx.end(); ++mi)
-//     {
-//         double dPriority = mi->GetPriority(nHeight);
-//         CAmount dummy;
-//         mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
-//         vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
-//     }
-//     std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
-
-//     CTxMemPool::txiter iter;
-//     while (!vecPriority.empty() && !blockFinished) { // add a tx from priority queue to fill the blockprioritysize
-//         iter = vecPriority.front().second;
-//         actualPriority = vecPriority.front().first;
-//         std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
-//         vecPriority.pop_back();
-
-//         // If tx already in block, skip
-//         if (inBlock.count(iter)) {
-//             assert(false); // shouldn't happen for priority txs
-//             continue;
-//         }
-
-//         // cannot accept witness transactions into a non-witness block
-//         if (!fIncludeWitness && !iter->GetTx().wit.IsNull())
-//             continue;
-
-//         // If tx is dependent on other mempool txs which haven't yet been included
-//         // then put it in the waitSet
-//         if (isStillDependent(iter)) {
-//             waitPriMap.insert(std::make_pair(iter, actualPriority));
-//             continue;
-//         }
-
-//         // If this tx fits in the block add it, otherwise keep looping
-//         if (TestForBlock(iter)) {
-//             AddToBlock(iter);
-
-//             // If now that this txs is added we've surpassed our desired priority size
-//             // or have dropped below the AllowFreeThreshold, then we're done adding priority txs
-//             if (nBlockSize >= nBlockPrioritySize || !AllowFree(actualPriority)) {
-//                 break;
-//             }
-
-//             // This tx was successfully added, so
-//             // add transactions that depend on this one to the priority queue to try again
-//             BOOST_FOREACH(CTxMemPool::txiter child, mempool.GetMemPoolChildren(iter))
-//             {
-//                 waitPriIter wpiter = waitPriMap.find(child);
-//                 if (wpiter != waitPriMap.end()) {
-//                     vecPriority.push_back(TxCoinAgePriority(wpiter->second,child));
-//                     std::push_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
-//                     waitPriMap.erase(wpiter);
-//                 }
-//             }
-//         }
-//     }
-//     fNeedSizeAccounting = fSizeAccounting;
-// }
+bool CBlockTemplateCache::AppendTransaction(const CTransaction& tx)
+{
+    AssertLockHeld(mempool.cs);
+    AssertLockHeld(cs);
+
+    CTxMemPool::txiter it = mempool.mapTx.find(tx.GetHash());
+    if (it == mempool.mapTx.end())
+        return false;
+
+    // Every in-mempool parent has to be in the template already
+    BOOST_FOREACH(const CTxMemPoolEntry* parent, mempool.GetMemPoolParents(it)) {
+        if (!setTemplateTx.count(parent->GetTx().GetHash()))
+            return false;
+    }
+
+    // Same checks as addPackageTxs for a package of one
+    if (it->GetModifiedFee() < ::minRelayTxFee.GetFee(it->GetTxSize()))
+        return false;
+    if (nBlockSize + it->GetTxSize() >= nBlockMaxSize)
+        return false;
+    if (nBlockSigOps + it->GetSigOpCount() >= nBlockMaxSigOps)
+        return false;
+    if (!IsFinalTx(tx, pindexPrev->nHeight + 1, nLockTimeCutoff))
+        return false;
+    if (tx.IsZerocoinSpend())
+        return false;
+
+    CBlock& block = pblocktemplate->block;
+    block.vtx.push_back(tx);
+    pblocktemplate->vTxFees.push_back(it->GetFee());
+    pblocktemplate->vTxSigOpsCost.push_back(it->GetSigOpCount());
+
+    CMutableTransaction coinbaseTx(block.vtx[0]);
+    coinbaseTx.vout[0].nValue += it->GetFee();
+    block.vtx[0] = coinbaseTx;
+    pblocktemplate->vTxFees[0] -= it->GetFee();
+
+    nBlockSize += it->GetTxSize();
+    nBlockSigOps += it->GetSigOpCount();
+    setTemplateTx.insert(tx.GetHash());
+    return true;
+}
+
+void CBlockTemplateCache::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+{
+    Clear();
+}
+
+void CBlockTemplateCache::SyncTransaction(const CTransaction &tx, const CBlock *pblock)
+{
+    // Transactions in connected or disconnected blocks come with a new tip
+    if (pblock)
+        return;
+
+    LOCK2(cs_main, mempool.cs);
+    LOCK(cs);
+
+    if (!pblocktemplate || fStale || pindexPrev != chainActive.Tip())
+        return;
+
+    // Only extend the template if this transaction is the one mempool
+    // change since it was last brought up to date.
+    if (mempool.GetTransactionsUpdated() != nTransactionsUpdated + 1 || !AppendTransaction(tx)) {
+        fStale = true;
+        return;
+    }
+    nTransactionsUpdated = mempool.GetTransactionsUpdated();
+}
 
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
@@ -869,8 +778,46 @@ static bool ProcessBlockFound(const CBlock* pblock, const CChainParams& chainpar
     return true;
 }
 
+namespace {
+
+CCriticalSection cs_hashrate;
+uint64_t nHashCounter = 0;
+int64_t nHashCounterStart = 0;
+double dHashesPerSec = 0;
+
+}
+
+/** Add to the hash counter of the miner threads, refreshing the rate every few seconds */
+static void CountHashes(unsigned int nHashes)
+{
+    LOCK(cs_hashrate);
+    int64_t nNow = GetTimeMillis();
+    if (nHashCounterStart == 0)
+        nHashCounterStart = nNow;
+    nHashCounter += nHashes;
+    if (nNow - nHashCounterStart > 4000) {
+        dHashesPerSec = 1000.0 * nHashCounter / (nNow - nHashCounterStart);
+        nHashCounter = 0;
+        nHashCounterStart = nNow;
+    }
+}
+
+static void ResetHashCounter()
+{
+    LOCK(cs_hashrate);
+    nHashCounter = 0;
+    nHashCounterStart = 0;
+    dHashesPerSec = 0;
+}
+
+double GetMinerHashesPerSec()
+{
+    LOCK(cs_hashrate);
+    return dHashesPerSec;
+}
+
 // ***TODO*** that part changed in bitcoin, we are using a mix with old one here for now
-void static BitcoinMiner(const CChainParams& chainparams, CConnman& connman)
+void static BitcoinMiner(const CChainParams& chainparams, CConnman& connman, int nThread, int nThreads)
 {
     LogPrintf("SmartcashMiner -- started\n");
     SetThreadPriority(THREAD_PRIORITY_LOWEST);
@@ -878,6 +825,11 @@ void static BitcoinMiner(const CChainParams& chainparams, CConnman& connman)
 
     unsigned int nExtraNonce = 0;
 
+    // Each thread searches its own slice of the nonce space, so threads
+    // mining the same header never repeat each other's work.
+    const uint32_t nNonceFirst = (uint32_t)(((uint64_t)nThread << 32) / nThreads);
+    const uint32_t nNonceLast = (uint32_t)((((uint64_t)nThread + 1) << 32) / nThreads - 1);
+
     boost::shared_ptr<CReserveScript> coinbaseScript;
     GetMainSignals().ScriptForMining(coinbaseScript);
 
@@ -908,8 +860,8 @@ void static BitcoinMiner(const CChainParams& chainparams, CConnman& connman)
             CBlockIndex* pindexPrev = chainActive.Tip();
             if(!pindexPrev) break;
 
-            static CBlockTemplate* pblocktemplate = BlockAssembler(Params()).CreateNewBlock(coinbaseScript->reserveScript);
-            if (!pblocktemplate)
+            std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(Params()).CreateNewBlock(coinbaseScript->reserveScript));
+            if (!pblocktemplate.get())
             {
                 LogPrintf("SmartcashMiner -- Keypool ran out, please call keypoolrefill before restarting the mining thread\n");
                 return;
@@ -925,6 +877,9 @@ void static BitcoinMiner(const CChainParams& chainparams, CConnman& connman)
             //
             int64_t nStart = GetTime();
             arith_uint256 hashTarget = arith_uint256().SetCompact(pblock->nBits);
+            pblock->nNonce = nNonceFirst;
+            CKeccakHeaderHasher hasher(*pblock);
+            bool fNoncesExhausted = false;
             while (true)
             {
                 unsigned int nHashesDone = 0;
@@ -932,7 +887,8 @@ void static BitcoinMiner(const CChainParams& chainparams, CConnman& connman)
                 uint256 hash;
                 while (true)
                 {
-                    hash = pblock->GetHash();
+                    hash = hasher.Hash(pblock->nNonce);
+                    nHashesDone += 1;
                     if (UintToArith256(hash) <= hashTarget)
                     {
                         // Found a solution
@@ -949,18 +905,22 @@ void static BitcoinMiner(const CChainParams& chainparams, CConnman& connman)
 
                         break;
                     }
+                    if (pblock->nNonce == nNonceLast) {
+                        fNoncesExhausted = true;
+                        break;
+                    }
                     pblock->nNonce += 1;
-                    nHashesDone += 1;
                     if ((pblock->nNonce & 0xFF) == 0)
                         break;
                 }
+                CountHashes(nHashesDone);
 
                 // Check for stop or if block needs to be rebuilt
                 boost::this_thread::interruption_point();
                 // Regtest mode doesn't require peers
                 if (connman.GetNodeCount(CConnman::CONNECTIONS_ALL) == 0 && chainparams.MiningRequiresPeers())
                     break;
-                if (pblock->nNonce >= 0xffff0000)
+                if (fNoncesExhausted)
                     break;
                 if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 60)
                     break;
@@ -976,6 +936,7 @@ void static BitcoinMiner(const CChainParams& chainparams, CConnman& connman)
                     // Changing pblock->nTime can change work required on testnet:
                     hashTarget.SetCompact(pblock->nBits);
                 }
+                hasher = CKeccakHeaderHasher(*pblock);
             }
         }
     }
@@ -1005,10 +966,12 @@ void GenerateBitcoins(bool fGenerate, int nThreads, const CChainParams& chainpar
         minerThreads = NULL;
     }
 
+    ResetHashCounter();
+
     if (nThreads == 0 || !fGenerate)
         return;
 
     minerThreads = new boost::thread_group();
     for (int i = 0; i < nThreads; i++)
-        minerThreads->create_thread(boost::bind(&BitcoinMiner, boost::cref(chainparams), boost::ref(connman)));
+        minerThreads->create_thread(boost::bind(&BitcoinMiner, boost::cref(chainparams), boost::ref(connman), i, nThreads));
 }
@@ -7,7 +7,9 @@
 #define BITCOIN_MINER_H
 
 #include "primitives/block.h"
+#include "sync.h"
 #include "txmempool.h"
+#include "validationinterface.h"
 
 #include <stdint.h>
 #include <memory>
@@ -38,104 +40,133 @@ struct CBlockTemplate
 
 /** Run the miner threads */
 void GenerateBitcoins(bool fGenerate, int nThreads, const CChainParams& chainparams, CConnman& connman);
+/** Hashes per second of the miner threads, 0 when they are not running */
+double GetMinerHashesPerSec();
+
+/** Keccak-256 of a block header for changing nonces. The context is kept
+ *  with everything up to nNonce absorbed, so a nonce only costs copying the
+ *  context, its four bytes and the final permutation. Rebuild it whenever
+ *  another header field changes.
+ */
+class CKeccakHeaderHasher
+{
+private:
+    sph_keccak256_context ctxPrefix;
+
+public:
+    explicit CKeccakHeaderHasher(const CBlockHeader& header)
+    {
+        sph_keccak256_init(&ctxPrefix);
+        sph_keccak256(&ctxPrefix, BEGIN(header.nVersion), BEGIN(header.nNonce) - BEGIN(header.nVersion));
+    }
+
+    /** Same as CBlockHeader::GetHash() with nNonce set to the given value */
+    uint256 Hash(uint32_t nNonce) const
+    {
+        sph_keccak256_context ctx = ctxPrefix;
+        sph_keccak256(&ctx, &nNonce, sizeof(nNonce));
+        uint256 hash;
+        sph_keccak256_close(&ctx, hash.begin());
+        return hash;
+    }
+};
 
 // Container for tracking updates to ancestor feerate as we include (parent)
 // transactions in a block
-// struct CTxMemPoolModifiedEntry {
-//     CTxMemPoolModifiedEntry(CTxMemPool::txiter entry)
-//     {
-//         iter = entry;
-//         nSizeWithAncestors = entry->GetSizeWithAncestors();
-//         nModFeesWithAncestors = entry->GetModFeesWithAncestors();
-//         nSigOpCostWithAncestors = entry->GetSigOpCostWithAncestors();
-//     }
-
-//     CTxMemPool::txiter iter;
-//     uint64_t nSizeWithAncestors;
-//     CAmount nModFeesWithAncestors;
-//     int64_t nSigOpCostWithAncestors;
-// };
+struct CTxMemPoolModifiedEntry {
+    CTxMemPoolModifiedEntry(CTxMemPool::txiter entry)
+    {
+        iter = entry;
+        nSizeWithAncestors = entry->GetSizeWithAncestors();
+        nModFeesWithAncestors = entry->GetModFeesWithAncestors();
+        nSigOpCountWithAncestors = entry->GetSigOpCountWithAncestors();
+    }
+
+    CTxMemPool::txiter iter;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+    unsigned int nSigOpCountWithAncestors;
+};
 
 /** Comparator for CTxMemPool::txiter objects.
  *  It simply compares the internal memory address of the CTxMemPoolEntry object
  *  pointed to. This means it has no meaning, and is only useful for using them
  *  as key in other indexes.
  */
-// struct CompareCTxMemPoolIter {
-//     bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
-//     {
-//         return &(*a) < &(*b);
-//     }
-// };
-
-// struct modifiedentry_iter {
-//     typedef CTxMemPool::txiter result_type;
-//     result_type operator() (const CTxMemPoolModifiedEntry &entry) const
-//     {
-//         return entry.iter;
-//     }
-// };
+struct CompareCTxMemPoolIter {
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        return &(*a) < &(*b);
+    }
+};
+
+struct modifiedentry_iter {
+    typedef CTxMemPool::txiter result_type;
+    result_type operator() (const CTxMemPoolModifiedEntry &entry) const
+    {
+        return entry.iter;
+    }
+};
 
 // This matches the calculation in CompareTxMemPoolEntryByAncestorFee,
 // except operating on CTxMemPoolModifiedEntry.
-// TODO: refactor to avoid duplication of this logic.
-// struct CompareModifiedEntry {
-//     bool operator()(const CTxMemPoolModifiedEntry &a, const CTxMemPoolModifiedEntry &b)
-//     {
-//         double f1 = (double)a.nModFeesWithAncestors * b.nSizeWithAncestors;
-//         double f2 = (double)b.nModFeesWithAncestors * a.nSizeWithAncestors;
-//         if (f1 == f2) {
-//             return CTxMemPool::CompareIteratorByHash()(a.iter, b.iter);
-//         }
-//         return f1 > f2;
-//     }
-// };
+struct CompareModifiedEntry {
+    bool operator()(const CTxMemPoolModifiedEntry &a, const CTxMemPoolModifiedEntry &b) const
+    {
+        double f1 = (double)a.nModFeesWithAncestors * b.nSizeWithAncestors;
+        double f2 = (double)b.nModFeesWithAncestors * a.nSizeWithAncestors;
+        if (f1 == f2) {
+            return CTxMemPool::CompareIteratorByHash()(a.iter, b.iter);
+        }
+        return f1 > f2;
+    }
+};
 
 // A comparator that sorts transactions based on number of ancestors.
 // This is sufficient to sort an ancestor package in an order that is valid
 // to appear in a block.
-// struct CompareTxIterByAncestorCount {
-//     bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b)
-//     {
-//         if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
-//             return a->GetCountWithAncestors() < b->GetCountWithAncestors();
-//         return CTxMemPool::CompareIteratorByHash()(a, b);
-//     }
-// };
-
-// typedef boost::multi_index_container<
-//     CTxMemPoolModifiedEntry,
-//     boost::multi_index::indexed_by<
-//         boost::multi_index::ordered_unique<
-//             modifiedentry_iter,
-//             CompareCTxMemPoolIter
-//         >,
-//         // sorted by modified ancestor fee rate
-//         boost::multi_index::ordered_non_unique<
-//             // Reuse same tag from CTxMemPool's similar index
-//             boost::multi_index::tag<ancestor_score>,
-//             boost::multi_index::identity<CTxMemPoolModifiedEntry>,
-//             CompareModifiedEntry
-//         >
-//     >
-// > indexed_modified_transaction_set;
-
-// typedef indexed_modified_transaction_set::nth_index<0>::type::iterator modtxiter;
-// typedef indexed_modified_transaction_set::index<ancestor_score>::type::iterator modtxscoreiter;
-
-// struct update_for_parent_inclusion
-// {
-//     update_for_parent_inclusion(CTxMemPool::txiter it) : iter(it) {}
-
-//     void operator() (CTxMemPoolModifiedEntry &e)
-//     {
-//         e.nModFeesWithAncestors -= iter->GetFee();
-//         e.nSizeWithAncestors -= iter->GetTxSize();
-//         e.nSigOpCostWithAncestors -= iter->GetSigOpCost();
-//     }
-
-//     CTxMemPool::txiter iter;
-// };
+struct CompareTxIterByAncestorCount {
+    bool operator()(const CTxMemPool::txiter &a, const CTxMemPool::txiter &b) const
+    {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CTxMemPool::CompareIteratorByHash()(a, b);
+    }
+};
+
+typedef boost::multi_index_container<
+    CTxMemPoolModifiedEntry,
+    boost::multi_index::indexed_by<
+        boost::multi_index::ordered_unique<
+            modifiedentry_iter,
+            CompareCTxMemPoolIter
+        >,
+        // sorted by modified ancestor fee rate
+        boost::multi_index::ordered_non_unique<
+            // Reuse same tag from CTxMemPool's similar index
+            boost::multi_index::tag<ancestor_score>,
+            boost::multi_index::identity<CTxMemPoolModifiedEntry>,
+            CompareModifiedEntry
+        >
+    >
+> indexed_modified_transaction_set;
+
+typedef indexed_modified_transaction_set::nth_index<0>::type::iterator modtxiter;
+typedef indexed_modified_transaction_set::index<ancestor_score>::type::iterator modtxscoreiter;
+
+struct update_for_parent_inclusion
+{
+    update_for_parent_inclusion(CTxMemPool::txiter it) : iter(it) {}
+
+    void operator() (CTxMemPoolModifiedEntry &e)
+    {
+        e.nModFeesWithAncestors -= iter->GetModifiedFee();
+        e.nSizeWithAncestors -= iter->GetTxSize();
+        e.nSigOpCountWithAncestors -= iter->GetSigOpCount();
+    }
+
+    CTxMemPool::txiter iter;
+};
 
 /** Generate a new block, without valid proof-of-work */
 class BlockAssembler
@@ -147,15 +178,14 @@ private:
     CBlock* pblock;
 
     // Configuration parameters for the block size
-    bool fIncludeWitness;
-    unsigned int nBlockMaxWeight, nBlockMaxSize;
-    bool fNeedSizeAccounting;
+    unsigned int nBlockMaxSizeArg, nBlockPrioritySizeArg;
+    bool fScaleBlockSizeOptions;
+    unsigned int nBlockMaxSize, nBlockPrioritySize, nBlockMaxSigOps;
 
     // Information on the current status of the block
-    uint64_t nBlockWeight;
     uint64_t nBlockSize;
     uint64_t nBlockTx;
-    uint64_t nBlockSigOpsCost;
+    unsigned int nBlockSigOps;
     CAmount nFees;
     CTxMemPool::setEntries inBlock;
 
@@ -173,10 +203,21 @@ public:
     /** Construct a new block template with coinbase to scriptPubKeyIn */
     CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn);
 
+    // State of the last assembled block, used to extend it later
+    uint64_t GetBlockSize() const { return nBlockSize; }
+    unsigned int GetBlockSigOps() const { return nBlockSigOps; }
+    unsigned int GetBlockMaxSize() const { return nBlockMaxSize; }
+    unsigned int GetBlockMaxSigOps() const { return nBlockMaxSigOps; }
+    int64_t GetLockTimeCutoff() const { return nLockTimeCutoff; }
+
 private:
     // utility functions
     /** Clear the block's state and prepare for assembling a new block */
     void resetBlock();
+    /** Build the coinbase with all payments due on top of pindexPrev */
+    void FillCoinbase(CMutableTransaction& coinbaseTx, CBlockIndex* pindexPrev);
+    /** Derive the size and sigop limits from the current maxBlockSize */
+    void UpdateBlockLimits();
     /** Add a tx to the block */
     void AddToBlock(CTxMemPool::txiter iter);
 
@@ -196,22 +237,66 @@ private:
     /** Remove confirmed (inBlock) entries from given set */
     void onlyUnconfirmed(CTxMemPool::setEntries& testSet);
     /** Test if a new package would "fit" in the block */
-    bool TestPackage(uint64_t packageSize, int64_t packageSigOpsCost);
+    bool TestPackage(uint64_t packageSize, unsigned int packageSigOps);
     /** Perform checks on each transaction in a package:
-      * locktime, premature-witness, serialized size (if necessary)
+      * locktime, zerocoin spends, serialized size
       * These checks should always succeed, and they're here
       * only as an extra check in case of suboptimal node configuration */
     bool TestPackageTransactions(const CTxMemPool::setEntries& package);
     /** Return true if given transaction from mapTx has already been evaluated,
       * or if the transaction's cached data in mapTx is incorrect. */
-    //bool SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set &mapModifiedTx, CTxMemPool::setEntries &failedTx);
+    bool SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set &mapModifiedTx, CTxMemPool::setEntries &failedTx);
     /** Sort the package in an order that is valid to appear in a block */
     void SortForBlock(const CTxMemPool::setEntries& package, CTxMemPool::txiter entry, std::vector<CTxMemPool::txiter>& sortedEntries);
     /** Add descendants of given transactions to mapModifiedTx with ancestor
       * state updated assuming given transactions are inBlock. */
-    //void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
+    void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
+};
+
+/** Keeps the getblocktemplate candidate alive between calls.
+ *  Transactions entering the mempool are appended to it when they fit and
+ *  all their mempool parents are already in it. Any other mempool change
+ *  marks it stale, and a new tip drops it.
+ */
+class CBlockTemplateCache : public CValidationInterface
+{
+private:
+    mutable CCriticalSection cs;
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    const CBlockIndex* pindexPrev;
+    // Mempool update counter the template accounts for
+    unsigned int nTransactionsUpdated;
+    int64_t nTimeBuilt;
+    bool fStale;
+    std::set<uint256> setTemplateTx;
+
+    // Block state and limits carried over from the BlockAssembler
+    uint64_t nBlockSize;
+    unsigned int nBlockSigOps;
+    unsigned int nBlockMaxSize;
+    unsigned int nBlockMaxSigOps;
+    int64_t nLockTimeCutoff;
+
+    bool AppendTransaction(const CTransaction& tx);
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload);
+    void SyncTransaction(const CTransaction &tx, const CBlock *pblock);
+
+public:
+    CBlockTemplateCache();
+
+    /** Copy the current template into blocktemplate, building a new one if
+     *  the tip moved or the cached one is stale and older than nMaxAge
+     *  seconds. The coinbase pays to OP_TRUE, as getblocktemplate only
+     *  reports its outputs. nTransactionsUpdatedRet is set to the mempool
+     *  update counter the template reflects. */
+    bool Get(const CChainParams& chainparams, CBlockTemplate& blocktemplate, unsigned int& nTransactionsUpdatedRet, int64_t nMaxAge);
+    void Clear();
 };
 
+extern CBlockTemplateCache blockTemplateCache;
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
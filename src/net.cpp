@@ -10,14 +10,18 @@
 #include "net.h"
 
 #include "addrman.h"
+#include "arith_uint256.h"
 #include "chainparams.h"
 #include "clientversion.h"
 #include "consensus/consensus.h"
 #include "crypto/common.h"
 #include "crypto/sha256.h"
 #include "hash.h"
+#include "memusage.h"
+#include "metrics.h"
 #include "primitives/transaction.h"
 #include "scheduler.h"
+#include "trace.h"
 #include "ui_interface.h"
 #include "utilstrencodings.h"
 
@@ -49,6 +53,9 @@
 // We add a random period time (0 to 1 seconds) to feeler connections to prevent synchronization.
 #define FEELER_SLEEP_WINDOW 1
 
+// Addresses taken from addrman at a time when looking for an outbound connection
+#define ADDRMAN_SELECT_BATCH 10
+
 #if !defined(HAVE_MSG_NOSIGNAL) && !defined(MSG_NOSIGNAL)
 #define MSG_NOSIGNAL 0
 #endif
@@ -97,7 +104,7 @@ static bool vfLimited[NET_MAX] = {};
 static CNode* pnodeLocalHost = NULL;
 std::string strSubVersion;
 
-std::map<CInv, CDataStream> mapRelay;
+std::unordered_map<CInv, CRelayMessage, SaltedInvHasher> mapRelay;
 std::deque<pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
 limitedmap<uint256, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
@@ -402,7 +409,7 @@ CNode* CConnman::ConnectNode(CAddress addrConnect, const char *pszDest, bool fCo
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed))
     {
-        if (!IsSelectableSocket(hSocket)) {
+        if (!socketPoller->CanWait(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -703,7 +710,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
         // get current incomplete message, or create a new one
         if (vRecvMsg.empty() ||
             vRecvMsg.back().complete())
-            vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION));
+            vRecvMsg.emplace_back(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
 
         CNetMessage& msg = vRecvMsg.back();
 
@@ -734,6 +741,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
                 i = mapRecvBytesPerMsgCmd.find(NET_MESSAGE_COMMAND_OTHER);
             assert(i != mapRecvBytesPerMsgCmd.end());
             i->second += msg.hdr.nMessageSize + CMessageHeader::HEADER_SIZE;
+            MetricBytesReceived().Get(i->first).Add(msg.hdr.nMessageSize + CMessageHeader::HEADER_SIZE);
 
             msg.nTime = nTimeMicros;
             complete = true;
@@ -797,6 +805,11 @@ int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
     // switch state to reading message data
     in_data = true;
 
+    // Room for the whole message if it's small. The size of larger ones is only believed as far
+    // as data comes in, so a peer can't have us allocate megabytes by sending a header.
+    if (hdr.nMessageSize > 0)
+        GrowBuffer(std::min(hdr.nMessageSize, RECV_BUFFER_AHEAD));
+
     return nCopy;
 }
 
@@ -805,17 +818,99 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
-    if (vRecv.size() < nDataPos + nCopy) {
-        // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
+    if (vRecv.capacity() < nDataPos + nCopy) {
+        // Double what came in so far, but never more than the total message size.
+        GrowBuffer(std::min(hdr.nMessageSize, std::max(nDataPos + nCopy, 2 * nDataPos)));
     }
 
+    // resize and copy rather than insert, which goes byte by byte through the allocator
+    vRecv.resize(nDataPos + nCopy);
     memcpy(&vRecv[nDataPos], pch, nCopy);
     nDataPos += nCopy;
 
     return nCopy;
 }
 
+void CNetMessage::GrowBuffer(unsigned int nSize)
+{
+    CSerializeData vch;
+    recvBufferPool.Get(vch, nSize, hdr.nMessageSize);
+    if (!vRecv.empty()) {
+        vch.resize(vRecv.size());
+        memcpy(&vch[0], &vRecv[0], vRecv.size());
+    }
+    vRecv.SwapBuffer(vch);
+    recvBufferPool.Put(vch);
+}
+
+CNetMessage::~CNetMessage()
+{
+    CSerializeData vch;
+    vRecv.SwapBuffer(vch);
+    recvBufferPool.Put(vch);
+}
+
+CRecvBufferPool recvBufferPool;
+
+static unsigned int GetBufferClass(size_t nSize, bool fRoundUp)
+{
+    unsigned int nClass = 0;
+    while (nClass < 8 * sizeof(size_t) - 1 && ((size_t)1 << (nClass + 1)) <= nSize)
+        nClass++;
+    if (fRoundUp && ((size_t)1 << nClass) < nSize)
+        nClass++;
+    return nClass;
+}
+
+void CRecvBufferPool::Get(CSerializeData& vch, size_t nMin, size_t nMax)
+{
+    vch.clear();
+    nMax = std::max(nMin, nMax);
+    if (nMax < ((size_t)1 << MIN_CLASS)) {
+        // Not worth pooling
+        vch.reserve(nMin);
+        return;
+    }
+
+    unsigned int nClassMin = std::max(GetBufferClass(nMin, true), (unsigned int)MIN_CLASS);
+    unsigned int nClassMax = std::min(GetBufferClass(nMax, true), (unsigned int)MAX_CLASS);
+    {
+        LOCK(cs);
+        // The largest one of use, so the message won't have to move to another one halfway
+        for (unsigned int nClass = nClassMax; nClass >= nClassMin; nClass--) {
+            if (!vPooled[nClass].empty()) {
+                vch.swap(vPooled[nClass].back());
+                vPooled[nClass].pop_back();
+                nPooledBytes -= vch.capacity();
+                return;
+            }
+        }
+    }
+    vch.reserve((size_t)1 << nClassMin);
+}
+
+void CRecvBufferPool::Put(CSerializeData& vch)
+{
+    unsigned int nClass = GetBufferClass(vch.capacity(), false);
+    if (nClass < MIN_CLASS || nClass > MAX_CLASS)
+        return;
+
+    LOCK(cs);
+    if (vPooled[nClass].size() >= MAX_POOLED_PER_CLASS || nPooledBytes + vch.capacity() > MAX_POOLED_BYTES)
+        return;
+    // The contents stay behind, they're network data and get overwritten before being read again
+    vch.clear();
+    nPooledBytes += vch.capacity();
+    vPooled[nClass].push_back(CSerializeData());
+    vPooled[nClass].back().swap(vch);
+}
+
+size_t CRecvBufferPool::GetPooledBytes()
+{
+    LOCK(cs);
+    return nPooledBytes;
+}
+
 // requires LOCK(cs_vSend)
 size_t CConnman::SocketSendData(CNode *pnode)
 {
@@ -1063,7 +1158,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket))
+    if (!socketPoller->CanWait(hSocket))
     {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
@@ -1115,6 +1210,22 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     }
 }
 
+/** Whether msg relays blocks, these get a message handler thread of their own */
+static bool IsPriorityMessage(const CNetMessage& msg)
+{
+    std::string strCommand = msg.hdr.GetCommand();
+    return strCommand == NetMsgType::BLOCK || strCommand == NetMsgType::HEADERS ||
+           strCommand == NetMsgType::CMPCTBLOCK || strCommand == NetMsgType::BLOCKTXN ||
+           strCommand == NetMsgType::GETBLOCKTXN;
+}
+
+/** Whether the next message to process from pnode relays blocks */
+static bool HasPriorityMessage(CNode* pnode)
+{
+    LOCK(pnode->cs_vProcessMsg);
+    return !pnode->vProcessMsg.empty() && IsPriorityMessage(pnode->vProcessMsg.front());
+}
+
 void CConnman::ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
@@ -1186,6 +1297,7 @@ void CConnman::ThreadSocketHandler()
         }
         if(vNodesSize != nPrevNodeCount) {
             nPrevNodeCount = vNodesSize;
+            metricPeers.Set(nPrevNodeCount);
             if(clientInterface)
                 clientInterface->NotifyNumConnectionsChanged(nPrevNodeCount);
         }
@@ -1193,34 +1305,23 @@ void CConnman::ThreadSocketHandler()
         //
         // Find which sockets have data to receive
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
+        const int64_t nTimeout = 50; // frequency to poll pnode->vSend
 
+        CSocketPoller::InterestMap mapInterest;
         BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
+            mapInterest[hListenSocket.socket] = CSocketPoller::Interest(-1, CSocketPoller::EVENT_RECV);
         }
 
         {
             LOCK(cs_vNodes);
             BOOST_FOREACH(CNode* pnode, vNodes)
             {
-                if (pnode->hSocket == INVALID_SOCKET)
+                SOCKET hSocket = pnode->hSocket;
+                if (hSocket == INVALID_SOCKET)
                     continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
+                CSocketPoller::Interest& interest = mapInterest[hSocket];
+                interest.nOwner = pnode->id;
+                interest.nEvents = CSocketPoller::EVENT_ERR;
 
                 // Implement the following logic:
                 // * If there is data to send, select() for sending data. As this only
@@ -1236,35 +1337,33 @@ void CConnman::ThreadSocketHandler()
                     TRY_LOCK(pnode->cs_vSend, lockSend);
                     if (lockSend) {
                         if (!pnode->vSendMsg.empty()) {
-                            FD_SET(pnode->hSocket, &fdsetSend);
+                            interest.nEvents |= CSocketPoller::EVENT_SEND;
                             continue;
                         }
                     }
                 }
                 {
                     if (!pnode->fPauseRecv)
-                        FD_SET(pnode->hSocket, &fdsetRecv);
+                        interest.nEvents |= CSocketPoller::EVENT_RECV;
                 }
             }
         }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+        CSocketPoller::ReadyMap mapReady;
+        bool fWaited = socketPoller->Wait(mapInterest, nTimeout, mapReady);
         if (interruptNet)
             return;
 
-        if (nSelect == SOCKET_ERROR)
+        if (!fWaited)
         {
-            if (have_fds)
+            if (!mapInterest.empty())
             {
                 int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
+                LogPrintf("socket %s error %s\n", socketPoller->GetName(), NetworkErrorString(nErr));
+                for (CSocketPoller::InterestMap::const_iterator it = mapInterest.begin(); it != mapInterest.end(); ++it)
+                    mapReady[it->first] = CSocketPoller::EVENT_RECV;
             }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
+            if (!interruptNet.sleep_for(std::chrono::milliseconds(nTimeout)))
                 return;
         }
 
@@ -1273,7 +1372,7 @@ void CConnman::ThreadSocketHandler()
         //
         BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            if (hListenSocket.socket != INVALID_SOCKET && (CSocketPoller::GetReadyEvents(mapReady, hListenSocket.socket) & CSocketPoller::EVENT_RECV))
             {
                 AcceptConnection(hListenSocket);
             }
@@ -1293,7 +1392,8 @@ void CConnman::ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
+            unsigned int nReady = CSocketPoller::GetReadyEvents(mapReady, pnode->hSocket);
+            if (nReady & (CSocketPoller::EVENT_RECV | CSocketPoller::EVENT_ERR))
             {
                 {
                     {
@@ -1308,11 +1408,13 @@ void CConnman::ThreadSocketHandler()
                             RecordBytesRecv(nBytes);
                             if (notify) {
                                 size_t nSizeAdded = 0;
+                                bool fPriority = false;
                                 auto it(pnode->vRecvMsg.begin());
                                 for (; it != pnode->vRecvMsg.end(); ++it) {
                                     if (!it->complete())
                                         break;
                                     nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
+                                    fPriority |= IsPriorityMessage(*it);
                                 }
                                 {
                                     LOCK(pnode->cs_vProcessMsg);
@@ -1321,6 +1423,8 @@ void CConnman::ThreadSocketHandler()
                                     pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
                                 }
                                 WakeMessageHandler();
+                                if (fPriority)
+                                    WakePriorityMessageHandler();
                             }
                         }
                         else if (nBytes == 0)
@@ -1350,7 +1454,7 @@ void CConnman::ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend))
+            if (nReady & CSocketPoller::EVENT_SEND)
             {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
                 if (lockSend) {
@@ -1402,6 +1506,15 @@ void CConnman::WakeMessageHandler()
     condMsgProc.notify_one();
 }
 
+void CConnman::WakePriorityMessageHandler()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutexMsgProc);
+        fPriorityMsgProcWake = true;
+    }
+    condPriorityMsgProc.notify_one();
+}
+
 
 
 
@@ -1564,31 +1677,43 @@ void CConnman::ThreadDNSAddressSeed()
 
     LogPrintf("Loading addresses from DNS seeds (could take a while)\n");
 
-    BOOST_FOREACH(const CDNSSeedData &seed, vSeeds) {
+    // Resolve all seeds at once rather than waiting on each in turn
+    std::vector<std::vector<CNetAddr> > vSeedIPs(vSeeds.size());
+    std::vector<CService> vSeedSources(vSeeds.size());
+    if (!HaveNameProxy()) {
+        std::vector<std::thread> vLookups;
+        for (size_t i = 0; i < vSeeds.size(); i++) {
+            vLookups.push_back(std::thread([&vSeeds, &vSeedIPs, &vSeedSources, i] {
+                RenameThread("smartcash-dnsseed");
+                if (LookupHost(vSeeds[i].host.c_str(), vSeedIPs[i], 0, true) && !vSeedIPs[i].empty())
+                    Lookup(vSeeds[i].name.c_str(), vSeedSources[i], 0, true);
+            }));
+        }
+        BOOST_FOREACH(std::thread& lookup, vLookups)
+            lookup.join();
+    }
+
+    for (size_t i = 0; i < vSeeds.size(); i++) {
+        const CDNSSeedData &seed = vSeeds[i];
         if (HaveNameProxy()) {
             AddOneShot(seed.host);
         } else {
-            std::vector<CNetAddr> vIPs;
+            const std::vector<CNetAddr>& vIPs = vSeedIPs[i];
             std::vector<CAddress> vAdd;
-            if (LookupHost(seed.host.c_str(), vIPs, 0, true))
+            BOOST_FOREACH(const CNetAddr& ip, vIPs)
             {
-                BOOST_FOREACH(const CNetAddr& ip, vIPs)
-                {
-                    int nOneDay = 24*3600;
-                    CAddress addr = CAddress(CService(ip, Params().GetDefaultPort()), NODE_NETWORK);
-                    addr.nTime = GetTime() - 3*nOneDay - GetRand(4*nOneDay); // use a random age between 3 and 7 days old
-                    vAdd.push_back(addr);
-                    found++;
-                }
+                int nOneDay = 24*3600;
+                CAddress addr = CAddress(CService(ip, Params().GetDefaultPort()), NODE_NETWORK);
+                addr.nTime = GetTime() - 3*nOneDay - GetRand(4*nOneDay); // use a random age between 3 and 7 days old
+                vAdd.push_back(addr);
+                found++;
             }
             // TODO: The seed name resolve may fail, yielding an IP of [::], which results in
             // addrman assigning the same source to results from different seeds.
             // This should switch to a hard-coded stable dummy IP for each seed name, so that the
             // resolve is not required at all.
             if (!vIPs.empty()) {
-                CService seedSource;
-                Lookup(seed.name.c_str(), seedSource, 0, true);
-                addrman.Add(vAdd, seedSource);
+                addrman.Add(vAdd, vSeedSources[i]);
             }
         }
     }
@@ -1609,10 +1734,15 @@ void CConnman::ThreadDNSAddressSeed()
 
 void CConnman::DumpAddresses()
 {
+    if (!addrman.IsDirty())
+        return;
+
     int64_t nStart = GetTimeMillis();
 
     CAddrDB adb;
-    adb.Write(addrman);
+    addrman.SetDirty(false);
+    if (!adb.Write(addrman))
+        addrman.SetDirty(true);
 
     LogPrint("net", "Flushed %d addresses to peers.dat  %dms\n",
            addrman.size(), GetTimeMillis() - nStart);
@@ -1711,6 +1841,12 @@ void CConnman::ThreadOpenConnections()
                 }
             }
         }
+        {
+            // Connections still being set up count as made
+            std::lock_guard<std::mutex> lock(mutexPendingConnections);
+            setConnected.insert(setPendingConnectionGroups.begin(), setPendingConnectionGroups.end());
+            nOutbound += setPendingConnectionGroups.size();
+        }
 
         // Feeler Connections
         //
@@ -1737,9 +1873,15 @@ void CConnman::ThreadOpenConnections()
 
         int64_t nANow = GetAdjustedTime();
         int nTries = 0;
+        std::vector<CAddrInfo> vSelected;
+        size_t nSelected = 0;
         while (!interruptNet)
         {
-            CAddrInfo addr = addrman.Select(fFeeler);
+            if (nSelected == vSelected.size()) {
+                vSelected = addrman.SelectMany(ADDRMAN_SELECT_BATCH, fFeeler);
+                nSelected = 0;
+            }
+            CAddrInfo addr = vSelected[nSelected++];
 
             // if we selected an invalid address, restart
             if (!addr.IsValid() || setConnected.count(addr.GetGroup()) || IsLocal(addr))
@@ -1781,8 +1923,41 @@ void CConnman::ThreadOpenConnections()
                 LogPrint("net", "Making feeler connection to %s\n", addrConnect.ToString());
             }
 
-            OpenNetworkConnection(addrConnect, &grant, NULL, false, fFeeler);
+            // Handed to ThreadOpenPendingConnections, so the next address can be tried while this one connects
+            PendingConnection connection;
+            connection.addr = addrConnect;
+            connection.grant = std::make_shared<CSemaphoreGrant>();
+            grant.MoveTo(*connection.grant);
+            connection.fFeeler = fFeeler;
+            {
+                std::lock_guard<std::mutex> lock(mutexPendingConnections);
+                setPendingConnectionGroups.insert(addrConnect.GetGroup());
+                dequePendingConnections.push_back(connection);
+            }
+            condPendingConnections.notify_one();
+        }
+    }
+}
+
+void CConnman::ThreadOpenPendingConnections()
+{
+    while (!interruptNet)
+    {
+        PendingConnection connection;
+        {
+            std::unique_lock<std::mutex> lock(mutexPendingConnections);
+            condPendingConnections.wait(lock, [this] { return interruptNet || !dequePendingConnections.empty(); });
+            if (interruptNet)
+                return;
+            connection = dequePendingConnections.front();
+            dequePendingConnections.pop_front();
         }
+
+        // Takes the grant if connected, otherwise the slot is freed along with connection
+        OpenNetworkConnection(connection.addr, connection.grant.get(), NULL, false, connection.fFeeler);
+
+        std::lock_guard<std::mutex> lock(mutexPendingConnections);
+        setPendingConnectionGroups.erase(connection.addr.GetGroup());
     }
 }
 
@@ -1955,29 +2130,97 @@ void CConnman::ThreadMessageHandler()
             if (pnode->fDisconnect)
                 continue;
 
-            // Receive messages
+            {
+                // Another thread is at this node, it'll take care of what's left
+                TRY_LOCK(pnode->cs_msgProc, lockProc);
+                if (!lockProc)
+                    continue;
+
+                // Receive messages
+                bool fMoreNodeWork = GetNodeSignals().ProcessMessages(pnode, *this, flagInterruptMsgProc);
+                fMoreWork |= (fMoreNodeWork && !pnode->fPauseSend);
+                if (flagInterruptMsgProc)
+                    return;
+
+                // Send messages
+                {
+                    TRY_LOCK(pnode->cs_vSend, lockSend);
+                    if (lockSend)
+                        GetNodeSignals().SendMessages(pnode, *this, flagInterruptMsgProc);
+                }
+                if (flagInterruptMsgProc)
+                    return;
+            }
+
+            // Hand a block that got to the front of the queue to the block relay thread, rather
+            // than leaving it until this thread got through all other nodes
+            if (HasPriorityMessage(pnode))
+                WakePriorityMessageHandler();
+        }
+
+        ReleaseNodeVector(vNodesCopy);
+
+        std::unique_lock<std::mutex> lock(mutexMsgProc);
+        if (!fMoreWork) {
+            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this] { return fMsgProcWake; });
+        }
+        fMsgProcWake = false;
+    }
+}
+
+void CConnman::ThreadPriorityMessageHandler()
+{
+    while (!flagInterruptMsgProc)
+    {
+        std::vector<CNode*> vNodesCopy = CopyNodeVector();
+
+        bool fMoreWork = false;
+        bool fProcessed = false;
+
+        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+        {
+            // Messages of a node are processed in the order they came in, so only
+            // blocks and headers at the front of the queue can be taken here
+            if (pnode->fDisconnect || !HasPriorityMessage(pnode))
+                continue;
+
+            // The node is busy with ThreadMessageHandler, which wakes us up again if
+            // there's still a block at the front when it's done with it
+            TRY_LOCK(pnode->cs_msgProc, lockProc);
+            if (!lockProc)
+                continue;
+
             bool fMoreNodeWork = GetNodeSignals().ProcessMessages(pnode, *this, flagInterruptMsgProc);
-            fMoreWork |= (fMoreNodeWork && !pnode->fPauseSend);
+            fMoreWork |= (fMoreNodeWork && !pnode->fPauseSend && HasPriorityMessage(pnode));
+            fProcessed = true;
             if (flagInterruptMsgProc)
                 return;
+        }
 
-            // Send messages
+        // Announce what came in right away, the message handlers may be busy for a while
+        if (fProcessed) {
+            BOOST_FOREACH(CNode* pnode, vNodesCopy)
             {
+                if (pnode->fDisconnect)
+                    continue;
+                TRY_LOCK(pnode->cs_msgProc, lockProc);
+                if (!lockProc)
+                    continue;
                 TRY_LOCK(pnode->cs_vSend, lockSend);
                 if (lockSend)
                     GetNodeSignals().SendMessages(pnode, *this, flagInterruptMsgProc);
+                if (flagInterruptMsgProc)
+                    return;
             }
-            if (flagInterruptMsgProc)
-                return;
         }
 
         ReleaseNodeVector(vNodesCopy);
 
         std::unique_lock<std::mutex> lock(mutexMsgProc);
         if (!fMoreWork) {
-            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this] { return fMsgProcWake; });
+            condPriorityMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this] { return fPriorityMsgProcWake; });
         }
-        fMsgProcWake = false;
+        fPriorityMsgProcWake = false;
     }
 }
 
@@ -2008,7 +2251,7 @@ bool CConnman::BindListenPort(const CService &addrBind, std::string& strError, b
         LogPrintf("%s\n", strError);
         return false;
     }
-    if (!IsSelectableSocket(hListenSocket))
+    if (!socketPoller->CanWait(hListenSocket))
     {
         strError = "Error: Couldn't create a listenable socket for incoming connections";
         LogPrintf("%s\n", strError);
@@ -2156,8 +2399,13 @@ void CConnman::SetNetworkActive(bool active)
     uiInterface.NotifyNetworkActiveChanged(fNetworkActive);
 }
 
-CConnman::CConnman()
+CConnman::CConnman(const std::string& strSocketEvents)
 {
+    socketPoller.reset(CreateSocketPoller(strSocketEvents));
+    if (!socketPoller) {
+        LogPrintf("Socket events mode %s not available, using select\n", strSocketEvents);
+        socketPoller.reset(CreateSocketPoller("select"));
+    }
     fNetworkActive = true;
     setBannedIsDirty = false;
     fAddressesInitialized = false;
@@ -2171,6 +2419,8 @@ CConnman::CConnman()
     nBestHeight = 0;
     clientInterface = NULL;
     flagInterruptMsgProc = false;
+    nTxRelayOpenSince = 0;
+    nTxRelaySequence = 1; // 0 stands for peers that haven't trickled yet
 }
 
 NodeId CConnman::GetNewNodeId()
@@ -2210,6 +2460,7 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
         else {
             addrman.Clear(); // Addrman can be in an inconsistent state after failure, reset it
             LogPrintf("Invalid or missing peers.dat; recreating\n");
+            addrman.SetDirty(true);
             DumpAddresses();
         }
     }
@@ -2261,6 +2512,7 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
     {
         std::unique_lock<std::mutex> lock(mutexMsgProc);
         fMsgProcWake = false;
+        fPriorityMsgProcWake = false;
     }
 
     // Send and receive from sockets, accept connections
@@ -2276,15 +2528,20 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
 
     // Initiate outbound connections
     threadOpenConnections = std::thread(&TraceThread<std::function<void()> >, "opencon", std::function<void()>(std::bind(&CConnman::ThreadOpenConnections, this)));
+    for (int i = 0; i < MAX_PENDING_OUTBOUND_CONNECTIONS; i++)
+        threadOpenPendingConnections.push_back(std::thread(&TraceThread<std::function<void()> >, "pendcon", std::function<void()>(std::bind(&CConnman::ThreadOpenPendingConnections, this))));
 
     // Initiate smartnode connections
     threadMnbRequestConnections = std::thread(&TraceThread<std::function<void()> >, "mnbcon", std::function<void()>(std::bind(&CConnman::ThreadMnbRequestConnections, this)));
 
     // Process messages
-    threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
+    int nMessageHandlerThreads = std::max(1, std::min(connOptions.nMessageHandlerThreads, MAX_MSGHANDLER_THREADS));
+    for (int i = 0; i < nMessageHandlerThreads; i++)
+        threadMessageHandlers.push_back(std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this))));
+    threadPriorityMessageHandler = std::thread(&TraceThread<std::function<void()> >, "blkmsghand", std::function<void()>(std::bind(&CConnman::ThreadPriorityMessageHandler, this)));
 
     // Dump network addresses
-    scheduler.scheduleEvery(boost::bind(&CConnman::DumpData, this), DUMP_ADDRESSES_INTERVAL);
+    scheduler.scheduleEvery(boost::bind(&CConnman::DumpData, this), DUMP_ADDRESSES_INTERVAL, "dumpaddresses", CScheduler::PRIORITY_LOW);
 
     return true;
 }
@@ -2320,9 +2577,15 @@ void CConnman::Interrupt()
         flagInterruptMsgProc = true;
     }
     condMsgProc.notify_all();
+    condPriorityMsgProc.notify_all();
 
     interruptNet();
     InterruptSocks5(true);
+    {
+        // so no opener is between checking interruptNet and waiting
+        std::lock_guard<std::mutex> lock(mutexPendingConnections);
+    }
+    condPendingConnections.notify_all();
 
     if (semOutbound)
         for (int i=0; i<(nMaxOutbound + nMaxFeeler); i++)
@@ -2331,12 +2594,25 @@ void CConnman::Interrupt()
 
 void CConnman::Stop()
 {
-    if (threadMessageHandler.joinable())
-        threadMessageHandler.join();
+    BOOST_FOREACH(std::thread& threadMessageHandler, threadMessageHandlers) {
+        if (threadMessageHandler.joinable())
+            threadMessageHandler.join();
+    }
+    threadMessageHandlers.clear();
+    if (threadPriorityMessageHandler.joinable())
+        threadPriorityMessageHandler.join();
     if (threadMnbRequestConnections.joinable())
         threadMnbRequestConnections.join();
     if (threadOpenConnections.joinable())
         threadOpenConnections.join();
+    BOOST_FOREACH(std::thread& threadOpenPendingConnection, threadOpenPendingConnections) {
+        if (threadOpenPendingConnection.joinable())
+            threadOpenPendingConnection.join();
+    }
+    threadOpenPendingConnections.clear();
+    // Gives back the grants of connections never set up
+    dequePendingConnections.clear();
+    setPendingConnectionGroups.clear();
     if (threadOpenAddedConnections.joinable())
         threadOpenAddedConnections.join();
     if (threadDNSAddressSeed.joinable())
@@ -2501,10 +2777,15 @@ bool CConnman::DisconnectNode(NodeId id)
 }
 
 void CConnman::RelayTransaction(const CTransaction& tx)
+{
+    RelayTransaction(MakeTransactionRef(tx));
+}
+
+void CConnman::RelayTransaction(const CTransactionRef& ptx)
 {
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
     ss.reserve(10000);
-    uint256 hash = tx.GetHash();
+    uint256 hash = ptx->GetHash();
     CTxLockRequest txLockRequest;
     // CDarksendBroadcastTx dstx = CPrivateSend::GetDSTX(hash);
     // if(dstx) { // MSG_DSTX
@@ -2513,17 +2794,47 @@ void CConnman::RelayTransaction(const CTransaction& tx)
     if(instantsend.GetTxLockRequest(hash, txLockRequest)) { // MSG_TXLOCK_REQUEST
         ss << txLockRequest;
     } else { // MSG_TX
-        ss << tx;
+        ss << *ptx;
     }
-    RelayTransaction(tx, ss);
+    RelayTransaction(ptx, ss);
 }
 
-void CConnman::RelayTransaction(const CTransaction& tx, const CDataStream& ss)
+static size_t RelayMessageUsage(const CRelayMessage& msg)
 {
-    uint256 hash = tx.GetHash();
+    return memusage::MallocUsage(msg.vchMsg.capacity());
+}
+
+size_t CConnman::GetRelayMemoryUsage() const
+{
+    LOCK(cs_mapRelay);
+    size_t nUsage = memusage::DynamicUsage(mapRelay) + memusage::MallocUsage(sizeof(pair<int64_t, CInv>)) * vRelayExpiration.size();
+    for (const auto& relay : mapRelay)
+        nUsage += RelayMessageUsage(relay.second);
+    return nUsage;
+}
+
+void CConnman::ShrinkRelay(size_t nBytes)
+{
+    LOCK(cs_mapRelay);
+    size_t nFreed = 0;
+    while (nFreed < nBytes && !vRelayExpiration.empty())
+    {
+        auto it = mapRelay.find(vRelayExpiration.front().second);
+        if (it != mapRelay.end()) {
+            nFreed += RelayMessageUsage(it->second) + memusage::MallocUsage(sizeof(memusage::unordered_node<std::pair<const CInv, CRelayMessage> >));
+            mapRelay.erase(it);
+        }
+        vRelayExpiration.pop_front();
+    }
+}
+
+void CConnman::RelayTransaction(const CTransactionRef& ptx, const CDataStream& ss)
+{
+    uint256 hash = ptx->GetHash();
     int nInv = //static_cast<bool>(CPrivateSend::GetDSTX(hash)) ? MSG_DSTX :
                 instantsend.HasTxLockRequest(hash) ? MSG_TXLOCK_REQUEST : MSG_TX;
     CInv inv(nInv, hash);
+    CRelayMessage msg(ss);
     {
         LOCK(cs_mapRelay);
         // Expire old relay messages
@@ -2534,9 +2845,17 @@ void CConnman::RelayTransaction(const CTransaction& tx, const CDataStream& ss)
         }
 
         // Save original serialized message so newer versions are preserved
-        mapRelay.insert(std::make_pair(inv, ss));
+        mapRelay.insert(std::make_pair(inv, std::move(msg)));
         vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
     }
+    if (IsTrickledTxInv(hash)) {
+        // Announced with the batch, see GetTxRelayBatches
+        LOCK(cs_txRelayBatches);
+        if (vTxRelayOpen.empty())
+            nTxRelayOpenSince = GetTimeMicros();
+        vTxRelayOpen.push_back(std::make_pair(inv, ptx));
+        return;
+    }
     LOCK(cs_vNodes);
     BOOST_FOREACH(CNode* pnode, vNodes)
     {
@@ -2545,13 +2864,59 @@ void CConnman::RelayTransaction(const CTransaction& tx, const CDataStream& ss)
         LOCK(pnode->cs_filter);
         if (pnode->pfilter)
         {
-            if (pnode->pfilter->IsRelevantAndUpdate(tx))
+            if (pnode->pfilter->IsRelevantAndUpdate(*ptx))
                 pnode->PushInventory(inv);
         } else
             pnode->PushInventory(inv);
     }
 }
 
+uint64_t CConnman::GetTxRelayBatches(uint64_t nSequence, std::vector<std::shared_ptr<const CTxRelayBatch> >& vBatches)
+{
+    vBatches.clear();
+    int64_t nNow = GetTimeMicros();
+    LOCK(cs_txRelayBatches);
+
+    if (!vTxRelayOpen.empty() && nTxRelayOpenSince + TX_RELAY_BATCH_INTERVAL * 1000000LL <= nNow) {
+        // Sorting once here spares every peer doing it. Of duplicates the first relayed is kept, and the
+        // batch stays in relay order.
+        std::vector<std::pair<CInv, size_t> > vSorted;
+        vSorted.reserve(vTxRelayOpen.size());
+        for (size_t i = 0; i < vTxRelayOpen.size(); i++)
+            vSorted.push_back(std::make_pair(vTxRelayOpen[i].first, i));
+        std::sort(vSorted.begin(), vSorted.end());
+        std::vector<bool> vDuplicate(vTxRelayOpen.size(), false);
+        for (size_t i = 1; i < vSorted.size(); i++) {
+            if (!(vSorted[i - 1].first < vSorted[i].first))
+                vDuplicate[vSorted[i].second] = true;
+        }
+
+        std::shared_ptr<CTxRelayBatch> batch = std::make_shared<CTxRelayBatch>();
+        batch->nSequence = ++nTxRelaySequence;
+        batch->nTimeClosed = nNow;
+        batch->vTx.reserve(vTxRelayOpen.size());
+        for (size_t i = 0; i < vTxRelayOpen.size(); i++) {
+            if (!vDuplicate[i])
+                batch->vTx.push_back(std::move(vTxRelayOpen[i]));
+        }
+        vTxRelayOpen.clear();
+        dequeTxRelayBatches.push_back(batch);
+    }
+
+    while (!dequeTxRelayBatches.empty() && dequeTxRelayBatches.front()->nTimeClosed + TX_RELAY_BATCH_EXPIRY * 1000000LL < nNow)
+        dequeTxRelayBatches.pop_front();
+
+    // Peers start out with what's relayed after their first trickle
+    if (nSequence == 0)
+        return nTxRelaySequence;
+
+    BOOST_FOREACH(const std::shared_ptr<const CTxRelayBatch>& batch, dequeTxRelayBatches) {
+        if (batch->nSequence > nSequence)
+            vBatches.push_back(batch);
+    }
+    return nTxRelaySequence;
+}
+
 void CConnman::RelayInv(CInv &inv, const int minProtoVersion) {
     LOCK(cs_vNodes);
     BOOST_FOREACH(CNode* pnode, vNodes)
@@ -2650,6 +3015,105 @@ bool CConnman::OutboundTargetReached(bool historicalBlockServingLimit)
     return false;
 }
 
+const char* GetPeerClassName(int nClass)
+{
+    switch (nClass) {
+    case PEER_CLASS_INBOUND: return "inbound";
+    case PEER_CLASS_OUTBOUND: return "outbound";
+    case PEER_CLASS_SMARTNODE: return "smartnode";
+    case PEER_CLASS_WHITELISTED: return "whitelisted";
+    }
+    return "";
+}
+
+const char* GetUploadTrafficName(int nTraffic)
+{
+    switch (nTraffic) {
+    case UPLOAD_BLOCKS: return "blocks";
+    case UPLOAD_TX: return "tx";
+    }
+    return "";
+}
+
+void CUploadBucket::SetRate(int64_t nRateIn, int64_t nTimeMicros)
+{
+    nRate = nRateIn;
+    nTokens = nRate;
+    nLastRefill = nTimeMicros;
+}
+
+void CUploadBucket::Refill(int64_t nTimeMicros)
+{
+    // a full bucket is one second's worth, so anything longer doesn't count
+    int64_t nElapsed = std::min(nTimeMicros - nLastRefill, (int64_t)1000000);
+    if (nElapsed <= 0)
+        return;
+    nTokens = std::min(nRate, nTokens + nRate * nElapsed / 1000000);
+    nLastRefill = nTimeMicros;
+}
+
+bool CUploadBucket::Allowed(int64_t nTimeMicros)
+{
+    if (nRate == 0)
+        return true;
+    Refill(nTimeMicros);
+    return nTokens > 0;
+}
+
+void CUploadBucket::Consume(uint64_t nBytes, int64_t nTimeMicros)
+{
+    nBytesSent += nBytes;
+    if (nRate == 0)
+        return;
+    Refill(nTimeMicros);
+    nTokens -= nBytes;
+}
+
+PeerClass CConnman::GetPeerClass(const CNode* pnode)
+{
+    if (pnode->fWhitelisted)
+        return PEER_CLASS_WHITELISTED;
+    if (pnode->fSmartnode)
+        return PEER_CLASS_SMARTNODE;
+    return pnode->fInbound ? PEER_CLASS_INBOUND : PEER_CLASS_OUTBOUND;
+}
+
+void CConnman::SetUploadLimit(PeerClass peerClass, UploadTraffic traffic, int64_t nBytesPerSecond)
+{
+    LOCK(cs_uploadBuckets);
+    uploadBuckets[peerClass][traffic].SetRate(nBytesPerSecond, GetTimeMicros());
+}
+
+bool CConnman::UploadAllowed(const CNode* pnode, UploadTraffic traffic)
+{
+    LOCK(cs_uploadBuckets);
+    return uploadBuckets[GetPeerClass(pnode)][traffic].Allowed(GetTimeMicros());
+}
+
+CUploadBucket CConnman::GetUploadBucket(PeerClass peerClass, UploadTraffic traffic)
+{
+    LOCK(cs_uploadBuckets);
+    CUploadBucket& bucket = uploadBuckets[peerClass][traffic];
+    if (bucket.nRate)
+        bucket.Allowed(GetTimeMicros()); // brings nTokens up to date
+    return bucket;
+}
+
+void CConnman::RecordUpload(const CNode* pnode, const std::string& sCommand, uint64_t nBytes)
+{
+    UploadTraffic traffic;
+    if (sCommand == NetMsgType::BLOCK || sCommand == NetMsgType::MERKLEBLOCK ||
+        sCommand == NetMsgType::CMPCTBLOCK || sCommand == NetMsgType::BLOCKTXN)
+        traffic = UPLOAD_BLOCKS;
+    else if (sCommand == NetMsgType::TX || sCommand == NetMsgType::TXLOCKREQUEST)
+        traffic = UPLOAD_TX;
+    else
+        return;
+
+    LOCK(cs_uploadBuckets);
+    uploadBuckets[GetPeerClass(pnode)][traffic].Consume(nBytes, GetTimeMicros());
+}
+
 uint64_t CConnman::GetOutboundTargetBytesLeft()
 {
     LOCK(cs_totalBytesSent);
@@ -2728,6 +3192,7 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nNextLocalAddrSend = 0;
     nNextAddrSend = 0;
     nNextInvSend = 0;
+    nTxRelayBatchSequence = 0;
     fRelayTxes = false;
     pfilter = new CBloomFilter();
     nLastBlockTime = 0;
@@ -2853,9 +3318,38 @@ void CConnman::EndMessage(CDataStream& strm)
     unsigned int nSize = strm.size() - CMessageHeader::HEADER_SIZE;
     WriteLE32((uint8_t*)&strm[CMessageHeader::MESSAGE_SIZE_OFFSET], nSize);
     // Set the checksum
-    uint256 hash = HashKeccak(strm.begin() + CMessageHeader::HEADER_SIZE, strm.end());
-    memcpy((char*)&strm[CMessageHeader::CHECKSUM_OFFSET], hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    GetMessageChecksum(&strm[0] + CMessageHeader::HEADER_SIZE, &strm[0] + strm.size(), (unsigned char*)&strm[CMessageHeader::CHECKSUM_OFFSET]);
+}
+
+void CConnman::GetMessageChecksum(const char* pbegin, const char* pend, unsigned char* pchChecksumRet)
+{
+    uint256 hash = HashKeccak(pbegin, pend);
+    memcpy(pchChecksumRet, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+}
+
+CRelayMessage::CRelayMessage(const CDataStream& ssPayload) : vchMsg(CMessageHeader::HEADER_SIZE)
+{
+    vchMsg.insert(vchMsg.end(), ssPayload.begin(), ssPayload.end());
+    CConnman::GetMessageChecksum(&vchMsg[0] + CMessageHeader::HEADER_SIZE, &vchMsg[0] + vchMsg.size(), pchChecksum);
+}
+
+SaltedInvHasher::SaltedInvHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
+void CConnman::PushRawMessage(CNode* pnode, const std::string& sCommand, CSerializeData&& vchMsg, const unsigned char* pchChecksum)
+{
+    assert(vchMsg.size() >= CMessageHeader::HEADER_SIZE);
+
+    CMessageHeader hdr(Params().MessageStart(), sCommand.c_str(), vchMsg.size() - CMessageHeader::HEADER_SIZE);
+    if (pchChecksum)
+        memcpy(hdr.pchChecksum, pchChecksum, CMessageHeader::CHECKSUM_SIZE);
+    else
+        GetMessageChecksum(&vchMsg[0] + CMessageHeader::HEADER_SIZE, &vchMsg[0] + vchMsg.size(), hdr.pchChecksum);
+
+    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION, hdr);
+    assert(ssHeader.size() == CMessageHeader::HEADER_SIZE);
+    memcpy(&vchMsg[0], &ssHeader[0], CMessageHeader::HEADER_SIZE);
+
+    PushMessage(pnode, std::move(vchMsg), sCommand);
 }
 
 void CConnman::PushMessage(CNode* pnode, CDataStream& strm, const std::string& sCommand)
@@ -2863,8 +3357,18 @@ void CConnman::PushMessage(CNode* pnode, CDataStream& strm, const std::string& s
     if(strm.empty())
         return;
 
-    unsigned int nSize = strm.size() - CMessageHeader::HEADER_SIZE;
+    // hand the buffer over instead of copying it into the send queue
+    CSerializeData vchMsg;
+    strm.GetAndClear(vchMsg);
+    PushMessage(pnode, std::move(vchMsg), sCommand);
+}
+
+void CConnman::PushMessage(CNode* pnode, CSerializeData&& vchMsg, const std::string& sCommand)
+{
+    size_t nMessageSize = vchMsg.size();
+    unsigned int nSize = nMessageSize - CMessageHeader::HEADER_SIZE;
     LogPrint("net", "sending %s (%d bytes) peer=%d\n",  SanitizeString(sCommand.c_str()), nSize, pnode->id);
+    TRACE3(net, outbound_message, pnode->id, sCommand.c_str(), nSize);
 
     size_t nBytesSent = 0;
     {
@@ -2873,15 +3377,18 @@ void CConnman::PushMessage(CNode* pnode, CDataStream& strm, const std::string& s
             return;
         }
         bool optimisticSend(pnode->vSendMsg.empty());
-        pnode->vSendMsg.emplace_back(strm.begin(), strm.end());
+        pnode->vSendMsg.push_back(std::move(vchMsg));
 
         //log total amount of bytes per command
-        pnode->mapSendBytesPerMsgCmd[sCommand] += strm.size();
-        pnode->nSendSize += strm.size();
+        pnode->mapSendBytesPerMsgCmd[sCommand] += nMessageSize;
+        MetricBytesSent().Get(sCommand).Add(nMessageSize);
+        pnode->nSendSize += nMessageSize;
 
         if (pnode->nSendSize > nSendBufferMaxSize)
             pnode->fPauseSend = true;
 
+        RecordUpload(pnode, sCommand, nMessageSize);
+
         // If write queue empty, attempt "optimistic write"
         if (optimisticSend == true)
             nBytesSent = SocketSendData(pnode);
@@ -2916,6 +3423,14 @@ bool CConnman::ForNode(NodeId id, std::function<bool(const CNode* pnode)> cond,
     return found != nullptr && cond(found) && func(found);
 }
 
+bool IsTrickledTxInv(const uint256& hash)
+{
+    static const uint256 hashSalt = GetRandHash();
+    uint256 hashRand = ArithToUint256(UintToArith256(hash) ^ UintToArith256(hashSalt));
+    hashRand = Hash(BEGIN(hashRand), END(hashRand));
+    return (UintToArith256(hashRand) & 3) != 0;
+}
+
 int64_t PoissonNextSend(int64_t nNow, int average_interval_seconds) {
     return nNow + (int64_t)(log1p(GetRand(1ULL << 48) * -0.0000000000000035527136788 /* -1/2^48 */) * average_interval_seconds * -1000000.0 + 0.5);
 }
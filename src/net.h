@@ -10,8 +10,11 @@
 #include "addrman.h"
 #include "bloom.h"
 #include "compat.h"
+#include "hash.h"
 #include "limitedmap.h"
 #include "netaddress.h"
+#include "netpoller.h"
+#include "primitives/transaction.h"
 #include "protocol.h"
 #include "random.h"
 #include "streams.h"
@@ -26,6 +29,7 @@
 #include <memory>
 #include <stdint.h>
 #include <thread>
+#include <unordered_map>
 
 #ifndef WIN32
 #include <arpa/inet.h>
@@ -57,6 +61,8 @@ static const unsigned int MAX_INV_SZ = 50000;
 static const unsigned int MAX_ADDR_TO_SEND = 1000;
 /** Maximum length of incoming protocol messages (no message over 4 MB is currently acceptable). */
 static const unsigned int MAX_PROTOCOL_MESSAGE_LENGTH = 4 * 1000 * 1000;
+/** Receive buffer allocated ahead of the data that came in, messages up to this size get all of it at once */
+static const unsigned int RECV_BUFFER_AHEAD = 256 * 1024;
 /** Maximum length of strSubVer in `version` message */
 static const unsigned int MAX_SUBVERSION_LENGTH = 256;
 /** Maximum number of outgoing nodes */
@@ -85,8 +91,58 @@ static const bool DEFAULT_BLOCKSONLY = false;
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
+/** Default for -msghandlerthreads, the threads handling peer messages besides the block relay one */
+static const int DEFAULT_MSGHANDLER_THREADS = 1;
+/** Maximum for -msghandlerthreads */
+static const int MAX_MSGHANDLER_THREADS = 16;
+/** Outbound connections ThreadOpenConnections has set up at once, so one slow address doesn't hold up the rest */
+static const int MAX_PENDING_OUTBOUND_CONNECTIONS = 4;
 
 static const ServiceFlags REQUIRED_SERVICES = NODE_NETWORK;
+/** Seconds relayed transactions are collected for before they're announced as one batch */
+static const int TX_RELAY_BATCH_INTERVAL = 1;
+/** Seconds a closed batch is kept for peers whose trickle timer hasn't come up yet */
+static const int TX_RELAY_BATCH_EXPIRY = 60;
+
+/** Classes of peers with upload limits of their own, see -uploadlimit */
+enum PeerClass {
+    PEER_CLASS_INBOUND,
+    PEER_CLASS_OUTBOUND,
+    PEER_CLASS_SMARTNODE,   //!< connections made for smartnodes, e.g. by ThreadMnbRequestConnections
+    PEER_CLASS_WHITELISTED,
+    PEER_CLASS_MAX
+};
+
+/** Kinds of upload traffic limited separately */
+enum UploadTraffic {
+    UPLOAD_BLOCKS,          //!< blocks served on request, apart from the ones near the tip
+    UPLOAD_TX,              //!< transactions served on request
+    UPLOAD_TRAFFIC_MAX
+};
+
+const char* GetPeerClassName(int nClass);
+const char* GetUploadTrafficName(int nTraffic);
+
+/** Token bucket limiting one kind of upload traffic to one peer class. Tokens are bytes, refilled at
+ *  nRate per second up to one second's worth. A message may go out while there are tokens left and
+ *  takes what it sends, so one larger than the bucket goes out whole and is paid off afterwards. */
+class CUploadBucket
+{
+public:
+    int64_t nRate;          //!< bytes per second, 0 for unlimited
+    int64_t nTokens;        //!< negative while paying off a large message
+    int64_t nLastRefill;    //!< time in microseconds
+    uint64_t nBytesSent;
+
+    CUploadBucket() : nRate(0), nTokens(0), nLastRefill(0), nBytesSent(0) {}
+
+    void SetRate(int64_t nRateIn, int64_t nTimeMicros);
+    bool Allowed(int64_t nTimeMicros);
+    void Consume(uint64_t nBytes, int64_t nTimeMicros);
+
+private:
+    void Refill(int64_t nTimeMicros);
+};
 
 // NOTE: When adjusting this, update rpcnet:setban's help ("24h")
 static const unsigned int DEFAULT_MISBEHAVING_BANTIME = 60 * 60 * 24;  // Default 24-hour ban
@@ -101,10 +157,20 @@ struct AddedNodeInfo
     bool fInbound;
 };
 
-class CTransaction;
 class CNodeStats;
 class CClientUIInterface;
 
+/** Transactions relayed during one TX_RELAY_BATCH_INTERVAL. Sorted and deduplicated once when the
+ *  batch is closed, then shared by all peers, which only check their own known inventory and bloom
+ *  filter against it when their trickle timer comes up. */
+struct CTxRelayBatch
+{
+    uint64_t nSequence;
+    int64_t nTimeClosed;    //!< time in microseconds
+    //! In relay order, so parents are announced ahead of their children
+    std::vector<std::pair<CInv, CTransactionRef> > vTx;
+};
+
 class CConnman
 {
 public:
@@ -127,14 +193,16 @@ public:
         CClientUIInterface* uiInterface = nullptr;
         unsigned int nSendBufferMaxSize = 0;
         unsigned int nReceiveFloodSize = 0;
+        int nMessageHandlerThreads = DEFAULT_MSGHANDLER_THREADS;
     };
-    CConnman();
+    explicit CConnman(const std::string& strSocketEvents = GetDefaultSocketPollerMode());
     ~CConnman();
     bool Start(CScheduler& scheduler, std::string& strNodeError, Options options);
     void Stop();
     void Interrupt();
     bool BindListenPort(const CService &bindAddr, std::string& strError, bool fWhitelisted = false);
     bool GetNetworkActive() const { return fNetworkActive; };
+    const char* GetSocketEventsMode() const { return socketPoller->GetName(); }
     void SetNetworkActive(bool active);
     bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOutbound = NULL, const char *strDest = NULL, bool fOneShot = false, bool fFeeler = false);
     bool CheckIncomingNonce(uint64_t nonce);
@@ -201,6 +269,13 @@ public:
         PushMessageWithVersionAndFlag(pnode, 0, 0, sCommand, std::forward<Args>(args)...);
     }
 
+    /** Send a message whose payload is serialized already, e.g. a block as it is stored on disk.
+     *  vchMsg starts with CMessageHeader::HEADER_SIZE bytes of room for the header, which gets filled
+     *  in here. The payload checksum is calculated unless pchChecksum passes it in. */
+    void PushRawMessage(CNode* pnode, const std::string& sCommand, CSerializeData&& vchMsg, const unsigned char* pchChecksum = NULL);
+    //! Calculate the checksum of a message payload as it is sent in the message header
+    static void GetMessageChecksum(const char* pbegin, const char* pend, unsigned char* pchChecksumRet);
+
     template<typename Condition, typename Callable>
     bool ForEachNodeContinueIf(const Condition& cond, Callable&& func)
     {
@@ -305,8 +380,17 @@ public:
     void ReleaseNodeVector(const std::vector<CNode*>& vecNodes);
 
     void RelayTransaction(const CTransaction& tx);
-    void RelayTransaction(const CTransaction& tx, const CDataStream& ss);
+    //! Relay a transaction shared with e.g. the mempool instead of a copy of it
+    void RelayTransaction(const CTransactionRef& ptx);
+    void RelayTransaction(const CTransactionRef& ptx, const CDataStream& ss);
     void RelayInv(CInv &inv, const int minProtoVersion = MIN_PEER_PROTO_VERSION);
+    //! Memory used by the messages kept for relay
+    size_t GetRelayMemoryUsage() const;
+    //! Drop the oldest relay messages until about nBytes are freed, peers asking for them get served from the mempool
+    void ShrinkRelay(size_t nBytes);
+    /** Closed transaction relay batches after nSequence, oldest first. Closes the open batch once it's
+     *  TX_RELAY_BATCH_INTERVAL old. Returns the sequence to pass next time. */
+    uint64_t GetTxRelayBatches(uint64_t nSequence, std::vector<std::shared_ptr<const CTxRelayBatch> >& vBatches);
 
     // Addrman functions
     size_t GetAddressCount() const;
@@ -371,6 +455,14 @@ public:
     // response true if the limit for serving historical blocks has been reached
     bool OutboundTargetReached(bool historicalBlockServingLimit);
 
+    //! Peer class the upload limits of pnode come from
+    static PeerClass GetPeerClass(const CNode* pnode);
+    //! Limit traffic to peerClass to nBytesPerSecond, 0 for no limit
+    void SetUploadLimit(PeerClass peerClass, UploadTraffic traffic, int64_t nBytesPerSecond);
+    //! Whether traffic can be sent to pnode now
+    bool UploadAllowed(const CNode* pnode, UploadTraffic traffic);
+    CUploadBucket GetUploadBucket(PeerClass peerClass, UploadTraffic traffic);
+
     //!response the bytes left in the current max outbound cycle
     // in case of no limit, it will always response 0
     uint64_t GetOutboundTargetBytesLeft();
@@ -398,13 +490,16 @@ private:
     void ThreadOpenAddedConnections();
     void ProcessOneShot();
     void ThreadOpenConnections();
+    void ThreadOpenPendingConnections();
     void ThreadMessageHandler();
+    void ThreadPriorityMessageHandler();
     void AcceptConnection(const ListenSocket& hListenSocket);
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
     void ThreadMnbRequestConnections();
 
     void WakeMessageHandler();
+    void WakePriorityMessageHandler();
 
     CNode* FindNode(const CNetAddr& ip);
     CNode* FindNode(const CSubNet& subNet);
@@ -431,11 +526,13 @@ private:
 
     CDataStream BeginMessage(CNode* node, int nVersion, int flags, const std::string& sCommand);
     void PushMessage(CNode* pnode, CDataStream& strm, const std::string& sCommand);
+    void PushMessage(CNode* pnode, CSerializeData&& vchMsg, const std::string& sCommand);
     void EndMessage(CDataStream& strm);
 
     // Network stats
     void RecordBytesRecv(uint64_t bytes);
     void RecordBytesSent(uint64_t bytes);
+    void RecordUpload(const CNode* pnode, const std::string& sCommand, uint64_t nBytes);
 
     // Whether the node should be passed out in ForEach* callbacks
     static bool NodeFullyConnected(const CNode* pnode);
@@ -452,6 +549,17 @@ private:
     uint64_t nMaxOutboundLimit;
     uint64_t nMaxOutboundTimeframe;
 
+    // per peer class upload limits, see -uploadlimit
+    CCriticalSection cs_uploadBuckets;
+    CUploadBucket uploadBuckets[PEER_CLASS_MAX][UPLOAD_TRAFFIC_MAX];
+
+    // transactions to announce, see RelayTransaction and GetTxRelayBatches
+    CCriticalSection cs_txRelayBatches;
+    std::vector<std::pair<CInv, CTransactionRef> > vTxRelayOpen;
+    int64_t nTxRelayOpenSince;
+    uint64_t nTxRelaySequence;
+    std::deque<std::shared_ptr<const CTxRelayBatch> > dequeTxRelayBatches;
+
     // Whitelisted ranges. Any node connecting from these is automatically
     // whitelisted (as well as those connecting to whitelisted binds).
     std::vector<CSubNet> vWhitelistedRange;
@@ -476,6 +584,9 @@ private:
     mutable CCriticalSection cs_vNodes;
     std::atomic<NodeId> nLastNodeId;
 
+    /** Waits for the sockets of ThreadSocketHandler, see -socketevents */
+    std::unique_ptr<CSocketPoller> socketPoller;
+
     /** Services this instance offers */
     ServiceFlags nLocalServices;
 
@@ -492,19 +603,36 @@ private:
 
     /** flag for waking the message processor. */
     bool fMsgProcWake;
+    /** flag for waking the block relay message processor, see ThreadPriorityMessageHandler */
+    bool fPriorityMsgProcWake;
 
     std::condition_variable condMsgProc;
+    std::condition_variable condPriorityMsgProc;
     std::mutex mutexMsgProc;
     std::atomic<bool> flagInterruptMsgProc;
 
+    /** An outbound connection chosen by ThreadOpenConnections, waiting for ThreadOpenPendingConnections */
+    struct PendingConnection {
+        CAddress addr;
+        std::shared_ptr<CSemaphoreGrant> grant;
+        bool fFeeler;
+    };
+    std::condition_variable condPendingConnections;
+    std::mutex mutexPendingConnections;
+    std::deque<PendingConnection> dequePendingConnections;
+    //! network groups of the connections queued or being set up
+    std::set<std::vector<unsigned char> > setPendingConnectionGroups;
+
     CThreadInterrupt interruptNet;
 
     std::thread threadDNSAddressSeed;
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
+    std::vector<std::thread> threadOpenPendingConnections;
     std::thread threadMnbRequestConnections;
-    std::thread threadMessageHandler;
+    std::vector<std::thread> threadMessageHandlers;
+    std::thread threadPriorityMessageHandler;
 };
 extern std::unique_ptr<CConnman> g_connman;
 void Discover(boost::thread_group& threadGroup);
@@ -571,7 +699,31 @@ extern bool fDiscover;
 extern bool fListen;
 extern bool fRelayTxes;
 
-extern std::map<CInv, CDataStream> mapRelay;
+/** A relayed message as served to peers asking for it. The payload is serialized and checksummed
+ *  once, behind CMessageHeader::HEADER_SIZE bytes of room for the header, ready for PushRawMessage. */
+struct CRelayMessage
+{
+    CSerializeData vchMsg;
+    unsigned char pchChecksum[CMessageHeader::CHECKSUM_SIZE];
+
+    explicit CRelayMessage(const CDataStream& ssPayload);
+};
+
+class SaltedInvHasher
+{
+private:
+    /** Salt */
+    const uint64_t k0, k1;
+
+public:
+    SaltedInvHasher();
+
+    size_t operator()(const CInv& inv) const {
+        return SipHashUint256Extra(k0, k1, inv.hash, inv.type);
+    }
+};
+
+extern std::unordered_map<CInv, CRelayMessage, SaltedInvHasher> mapRelay;
 extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
 extern CCriticalSection cs_mapRelay;
 extern limitedmap<uint256, int64_t> mapAlreadyAskedFor;
@@ -631,14 +783,19 @@ public:
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
 
+    bool fSmartnodeSigsQueued;      // looked at by QueueSmartnodeSignatures
+
     CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
         hdrbuf.resize(24);
         in_data = false;
         nHdrPos = 0;
         nDataPos = 0;
         nTime = 0;
+        fSmartnodeSigsQueued = false;
     }
 
+    ~CNetMessage();
+
     bool complete() const
     {
         if (!in_data)
@@ -654,8 +811,42 @@ public:
 
     int readHeader(const char *pch, unsigned int nBytes);
     int readData(const char *pch, unsigned int nBytes);
+
+private:
+    /** Move the data received so far to a buffer with room for at least nSize bytes */
+    void GrowBuffer(unsigned int nSize);
+};
+
+/** Message receive buffers, recycled in power of two size classes. A node downloading blocks
+ *  gets a buffer of the right size handed back rather than allocating, growing and wiping a
+ *  fresh one for every message. */
+class CRecvBufferPool
+{
+private:
+    static const unsigned int MIN_CLASS = 12; // 4 KiB
+    static const unsigned int MAX_CLASS = 22; // 4 MiB, MAX_PROTOCOL_MESSAGE_LENGTH rounded up
+    static const size_t MAX_POOLED_BYTES = 16 * 1024 * 1024;
+    static const size_t MAX_POOLED_PER_CLASS = 64;
+
+    CCriticalSection cs;
+    std::vector<CSerializeData> vPooled[MAX_CLASS + 1];
+    size_t nPooledBytes;
+
+public:
+    CRecvBufferPool() : nPooledBytes(0) {}
+
+    /** Hand out an empty buffer with room for at least nMin bytes. A pooled one of up to nMax bytes
+     *  rounded up is taken if there is one, otherwise nMin rounded up to a power of two is allocated. */
+    void Get(CSerializeData& vch, size_t nMin, size_t nMax);
+
+    /** Take vch back for reuse, leaving it empty. Buffers that don't fit the pool are freed. */
+    void Put(CSerializeData& vch);
+
+    size_t GetPooledBytes();
 };
 
+extern CRecvBufferPool recvBufferPool;
+
 /** Information about a peer */
 class CNode
 {
@@ -675,6 +866,10 @@ public:
     std::list<CNetMessage> vProcessMsg;
     size_t nProcessQueueSize;
 
+    // Held by the message handler thread working on this node, so its messages
+    // get processed in order by one thread at a time
+    CCriticalSection cs_msgProc;
+
     std::deque<CInv> vRecvGetData;
     uint64_t nRecvBytes;
     std::atomic<int> nRecvVersion;
@@ -742,6 +937,9 @@ public:
     std::set<uint256> setAskFor;
     std::multimap<int64_t, CInv> mapAskFor;
     int64_t nNextInvSend;
+    // Last transaction relay batch announced, 0 before the first trickle
+    // Also protected by cs_inventory
+    uint64_t nTxRelayBatchSequence;
     // Used for headers announcements - unfiltered blocks to relay
     // Also protected by cs_inventory
     std::vector<uint256> vBlockHashesToAnnounce;
@@ -912,4 +1110,8 @@ void ReleaseNodeVector(const std::vector<CNode*>& vecNodes);
 /** Return a timestamp in the future (in microseconds) for exponentially distributed events. */
 int64_t PoissonNextSend(int64_t nNow, int average_interval_seconds);
 
+/** Whether a transaction inv waits for the trickle. A random quarter of them, the same for all peers,
+ *  is announced right away. */
+bool IsTrickledTxInv(const uint256& hash);
+
 #endif // BITCOIN_NET_H
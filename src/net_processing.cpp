@@ -8,9 +8,11 @@
 #include "alert.h"
 #include "addrman.h"
 #include "arith_uint256.h"
+#include "blockencodings.h"
 #include "chainparams.h"
 #include "consensus/validation.h"
 #include "hash.h"
+#include "headerscache.h"
 #include "init.h"
 #include "validation.h"
 #include "merkleblock.h"
@@ -22,6 +24,7 @@
 #include "primitives/transaction.h"
 #include "random.h"
 #include "tinyformat.h"
+#include "trace.h"
 #include "txmempool.h"
 #include "ui_interface.h"
 #include "util.h"
@@ -34,6 +37,7 @@
 #include "smartnode/instantx.h"
 #include "smartnode/smartnodeman.h"
 #include "smartnode/smartnodepayments.h"
+#include "smartnode/smartnodesigcheck.h"
 #include "smartnode/smartnodesync.h"
 
 //#ifdef ENABLE_WALLET
@@ -41,6 +45,8 @@
 //#endif // ENABLE_WALLET
 //#include "privatesend-server.h"
 
+#include <unordered_map>
+
 #include <boost/thread.hpp>
 
 using namespace std;
@@ -52,11 +58,16 @@ using namespace std;
 int64_t nTimeBestReceived = 0; // Used only to inform the wallet of when we last received a block
 
 struct COrphanTx {
-    CTransaction tx;
+    CTransactionRef tx;
     NodeId fromPeer;
+    size_t nListPos; //! Position in vOrphanList
 };
-map<uint256, COrphanTx> mapOrphanTransactions GUARDED_BY(cs_main);
-map<uint256, set<uint256> > mapOrphanTransactionsByPrev GUARDED_BY(cs_main);;
+std::unordered_map<uint256, COrphanTx, SaltedTxidHasher> mapOrphanTransactions GUARDED_BY(cs_main);
+std::unordered_map<uint256, set<uint256>, SaltedTxidHasher> mapOrphanTransactionsByPrev GUARDED_BY(cs_main);
+//! Hashes of the orphans in no particular order, for picking one to evict at random
+std::vector<uint256> vOrphanList GUARDED_BY(cs_main);
+//! Serialized size of all orphans
+size_t nOrphanTxSize GUARDED_BY(cs_main) = 0;
 void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
 // Internal stuff
@@ -64,12 +75,19 @@ namespace {
     /** Number of nodes with fSyncStarted. */
     int nSyncStarted = 0;
 
+    /** Held while a smartnode, InstantSend or spork message is processed, so those are handled
+     *  one at a time with several message handler threads. */
+    CCriticalSection cs_smartnodeMessages;
+
     /**
      * Sources of received blocks, saved to be able to send them reject
      * messages or ban them when processing happens afterwards. Protected by
      * cs_main.
+     * Set mapBlockSource[hash].second to false if the node should not be
+     * punished if the block is invalid, as with compact blocks relayed
+     * before they were fully validated (BIP 152).
      */
-    map<uint256, NodeId> mapBlockSource;
+    map<uint256, std::pair<NodeId, bool> > mapBlockSource;
 
     /**
      * Filter for transactions that were recently rejected by
@@ -94,11 +112,15 @@ namespace {
     boost::scoped_ptr<CRollingBloomFilter> recentRejects;
     uint256 hashRecentRejectsChainTip;
 
+    /** Encoded replies to getheaders, shared by the peers syncing the same ranges. Has its own lock. */
+    CHeadersCache headersCache(MAX_HEADERS_RESULTS);
+
     /** Blocks that are in flight, and that are in the queue to be downloaded. Protected by cs_main. */
     struct QueuedBlock {
         uint256 hash;
         CBlockIndex* pindex;     //!< Optional.
         bool fValidatedHeaders;  //!< Whether this block has validated headers at the time of request.
+        std::unique_ptr<PartiallyDownloadedBlock> partialBlock;  //!< Optional, used for CMPCTBLOCK downloads
     };
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
@@ -108,6 +130,60 @@ namespace {
 
     /** Number of peers from which we're downloading blocks. */
     int nPeersWithValidatedDownloads = 0;
+
+    /** Peers asked to announce new blocks to us as compact blocks, at most 3 as per BIP 152. Protected by cs_main. */
+    std::list<NodeId> lNodesAnnouncingHeaderAndIDs;
+
+    /** The compact block built last, announced to or requested by several peers in a row. Protected by cs_main. */
+    std::unique_ptr<CBlockHeaderAndShortTxIDs> mostRecentCompactBlock;
+    uint256 mostRecentCompactBlockHash;
+
+    /** A block served to filtered peers, with the data elements their filters get matched against. */
+    struct FilterableBlock {
+        uint256 hash;
+        CBlock block;
+        CBlockFilterElements elements;
+
+        FilterableBlock(const uint256& hashIn, CBlock&& blockIn) : hash(hashIn), block(std::move(blockIn)), elements(block.vtx) {}
+    };
+
+    /** Number of blocks kept for filtered peers, who mostly sync the same recent blocks. */
+    static const size_t MAX_FILTERABLE_BLOCKS = 8;
+
+    /** The blocks served to filtered peers last, most recently used first. Protected by cs_main. */
+    std::list<std::shared_ptr<const FilterableBlock> > lRecentFilterableBlocks;
+
+    /** Number of block message checksums kept, about 1MB. */
+    static const size_t MAX_BLOCK_CHECKSUMS = 10000;
+
+    /**
+     * Checksums of the block messages served lately, so a block requested
+     * by several peers gets hashed once only. Oldest dropped first.
+     * Protected by cs_main.
+     */
+    unordered_map<uint256, uint32_t, BlockHasher> mapBlockChecksums;
+    deque<uint256> queueBlockChecksums;
+
+    /** Get the checksum of the block message payload in vchMsg, from the cache or by hashing it. */
+    void GetBlockChecksum(const uint256& hash, const CSerializeData& vchMsg, unsigned char* pchChecksumRet)
+    {
+        AssertLockHeld(cs_main);
+        auto it = mapBlockChecksums.find(hash);
+        if (it != mapBlockChecksums.end()) {
+            memcpy(pchChecksumRet, &it->second, CMessageHeader::CHECKSUM_SIZE);
+            return;
+        }
+
+        CConnman::GetMessageChecksum(&vchMsg[0] + CMessageHeader::HEADER_SIZE, &vchMsg[0] + vchMsg.size(), pchChecksumRet);
+        uint32_t nChecksum;
+        memcpy(&nChecksum, pchChecksumRet, CMessageHeader::CHECKSUM_SIZE);
+        mapBlockChecksums.emplace(hash, nChecksum);
+        queueBlockChecksums.push_back(hash);
+        while (queueBlockChecksums.size() > MAX_BLOCK_CHECKSUMS) {
+            mapBlockChecksums.erase(queueBlockChecksums.front());
+            queueBlockChecksums.pop_front();
+        }
+    }
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -161,10 +237,26 @@ struct CNodeState {
     int64_t nDownloadingSince;
     int nBlocksInFlight;
     int nBlocksInFlightValidHeaders;
+    //! Moving average of the time (in microseconds) this peer took per requested block, 0 until it delivered one.
+    int64_t nBlockDownloadTime;
+    //! Number of requested blocks this peer delivered.
+    int nBlocksDownloaded;
+    //! Number of times this peer stalled our block download.
+    int nStallCount;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
     //! Whether this peer wants invs or headers (when possible) for block announcements.
     bool fPreferHeaders;
+    //! Whether this peer wants invs or cmpctblocks (when possible) for block announcements.
+    bool fPreferHeaderAndIDs;
+    //! Whether this peer will send us cmpctblocks if we request them.
+    bool fProvidesHeaderAndIDs;
+    //! The locator of this peer's last getheaders/getblocks and where it forks off chainActive.
+    std::vector<uint256> vLastLocator;
+    CBlockIndex *pindexLastLocatorFork;
+    //! The chainActive tip and block index size the fork was found with, when either changes it is stale.
+    const CBlockIndex *pindexLastLocatorTip;
+    size_t nLastLocatorIndexSize;
 
     CNodeState(CAddress addrIn, std::string addrNameIn) : address(addrIn), name(addrNameIn) {
         fCurrentlyConnected = false;
@@ -180,8 +272,16 @@ struct CNodeState {
         nDownloadingSince = 0;
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
+        nBlockDownloadTime = 0;
+        nBlocksDownloaded = 0;
+        nStallCount = 0;
         fPreferredDownload = false;
         fPreferHeaders = false;
+        fPreferHeaderAndIDs = false;
+        fProvidesHeaderAndIDs = false;
+        pindexLastLocatorFork = NULL;
+        pindexLastLocatorTip = NULL;
+        nLastLocatorIndexSize = 0;
     }
 };
 
@@ -196,6 +296,26 @@ CNodeState *State(NodeId pnode) {
     return &it->second;
 }
 
+// Requires cs_main.
+// The fork of a peer's locator with chainActive. Syncing peers repeat the
+// same locator until they receive something new, so the last answer is
+// reused as long as neither the chain nor the block index changed since.
+CBlockIndex* FindForkForPeer(CNodeState* state, const CBlockLocator& locator)
+{
+    if (state == NULL)
+        return FindForkInGlobalIndex(chainActive, locator);
+
+    if (state->pindexLastLocatorTip == chainActive.Tip() && state->nLastLocatorIndexSize == mapBlockIndex.size() &&
+        state->vLastLocator == locator.vHave)
+        return state->pindexLastLocatorFork;
+
+    state->pindexLastLocatorFork = FindForkInGlobalIndex(chainActive, locator);
+    state->pindexLastLocatorTip = chainActive.Tip();
+    state->nLastLocatorIndexSize = mapBlockIndex.size();
+    state->vLastLocator = locator.vHave;
+    return state->pindexLastLocatorFork;
+}
+
 void UpdatePreferredDownload(CNode* node, CNodeState* state)
 {
     nPreferredDownload -= state->fPreferredDownload;
@@ -280,9 +400,14 @@ bool MarkBlockAsReceived(const uint256& hash) {
             nPeersWithValidatedDownloads--;
         }
         if (state->vBlocksInFlight.begin() == itInFlight->second.second) {
-            // First block on the queue was received, update the start download time for the next one
-            state->nDownloadingSince = std::max(state->nDownloadingSince, GetTimeMicros());
-        }
+            // First block on the queue was received, account for the time it took and update the
+            // start download time for the next one
+            int64_t nNow = GetTimeMicros();
+            int64_t nTime = std::max<int64_t>(nNow - state->nDownloadingSince, 0);
+            state->nBlockDownloadTime = state->nBlockDownloadTime ? (state->nBlockDownloadTime * 7 + nTime) / 8 : nTime;
+            state->nDownloadingSince = std::max(state->nDownloadingSince, nNow);
+        }
+        state->nBlocksDownloaded++;
         state->vBlocksInFlight.erase(itInFlight->second.second);
         state->nBlocksInFlight--;
         state->nStallingSince = 0;
@@ -293,17 +418,27 @@ bool MarkBlockAsReceived(const uint256& hash) {
 }
 
 // Requires cs_main.
-void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Params& consensusParams, CBlockIndex *pindex = NULL) {
+// returns false, still setting pit, if the block was already in flight from the same peer
+// pit will only be valid as long as the same cs_main lock is being held
+bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Params& consensusParams, CBlockIndex *pindex = NULL, list<QueuedBlock>::iterator **pit = NULL) {
     CNodeState *state = State(nodeid);
     assert(state != NULL);
 
+    // Short-circuit most stuff in case its from the same node
+    map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight != mapBlocksInFlight.end() && itInFlight->second.first == nodeid) {
+        if (pit)
+            *pit = &itInFlight->second.second;
+        return false;
+    }
+
     // Make sure it's not listed somewhere already.
     MarkBlockAsReceived(hash);
 
-    QueuedBlock newentry = {hash, pindex, pindex != NULL};
-    list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(), newentry);
+    list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(),
+            {hash, pindex, pindex != NULL, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : NULL)});
     state->nBlocksInFlight++;
-    state->nBlocksInFlightValidHeaders += newentry.fValidatedHeaders;
+    state->nBlocksInFlightValidHeaders += it->fValidatedHeaders;
     if (state->nBlocksInFlight == 1) {
         // We're starting a block download (batch) from this peer.
         state->nDownloadingSince = GetTimeMicros();
@@ -311,7 +446,83 @@ void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Pa
     if (state->nBlocksInFlightValidHeaders == 1 && pindex != NULL) {
         nPeersWithValidatedDownloads++;
     }
-    mapBlocksInFlight[hash] = std::make_pair(nodeid, it);
+    itInFlight = mapBlocksInFlight.insert(std::make_pair(hash, std::make_pair(nodeid, it))).first;
+    if (pit)
+        *pit = &itInFlight->second.second;
+    return true;
+}
+
+// Requires cs_main.
+void MaybeSetPeerAsAnnouncingHeaderAndIDs(NodeId nodeid, CConnman& connman) {
+    CNodeState* nodestate = State(nodeid);
+    if (!nodestate || !nodestate->fProvidesHeaderAndIDs)
+        return;
+    BOOST_FOREACH(const NodeId nodeidAnnouncing, lNodesAnnouncingHeaderAndIDs)
+        if (nodeidAnnouncing == nodeid)
+            return;
+    uint64_t nCMPCTBLOCKVersion = 1;
+    if (lNodesAnnouncingHeaderAndIDs.size() >= 3) {
+        // As per BIP152, we only get 3 of our peers to announce
+        // blocks using compact encodings.
+        connman.ForNode(lNodesAnnouncingHeaderAndIDs.front(), [&connman, nCMPCTBLOCKVersion](CNode* pnodeStop){
+            connman.PushMessage(pnodeStop, NetMsgType::SENDCMPCT, /*fAnnounceUsingCMPCTBLOCK=*/false, nCMPCTBLOCKVersion);
+            return true;
+        });
+        lNodesAnnouncingHeaderAndIDs.pop_front();
+    }
+    connman.ForNode(nodeid, [&connman, nCMPCTBLOCKVersion](CNode* pfrom){
+        connman.PushMessage(pfrom, NetMsgType::SENDCMPCT, /*fAnnounceUsingCMPCTBLOCK=*/true, nCMPCTBLOCKVersion);
+        return true;
+    });
+    lNodesAnnouncingHeaderAndIDs.push_back(nodeid);
+}
+
+// Requires cs_main.
+// The compact block for pindex, built once however many peers it goes to.
+const CBlockHeaderAndShortTxIDs& GetCompactBlock(const CBlockIndex* pindex, const Consensus::Params& consensusParams) {
+    if (!mostRecentCompactBlock || mostRecentCompactBlockHash != pindex->GetBlockHash()) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, consensusParams))
+            assert(!"cannot load block from disk");
+        mostRecentCompactBlock.reset(new CBlockHeaderAndShortTxIDs(block, false));
+        mostRecentCompactBlockHash = pindex->GetBlockHash();
+    }
+    return *mostRecentCompactBlock;
+}
+
+// Requires cs_main.
+// The block of pindex and its filter elements, read from disk and extracted once for all filtered peers.
+static std::shared_ptr<const FilterableBlock> GetFilterableBlock(const CBlockIndex* pindex, const Consensus::Params& consensusParams) {
+    const uint256 hash = pindex->GetBlockHash();
+    for (auto it = lRecentFilterableBlocks.begin(); it != lRecentFilterableBlocks.end(); ++it) {
+        if ((*it)->hash == hash) {
+            lRecentFilterableBlocks.splice(lRecentFilterableBlocks.begin(), lRecentFilterableBlocks, it);
+            return lRecentFilterableBlocks.front();
+        }
+    }
+
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex, consensusParams))
+        assert(!"cannot load block from disk");
+    lRecentFilterableBlocks.push_front(std::make_shared<const FilterableBlock>(hash, std::move(block)));
+    if (lRecentFilterableBlocks.size() > MAX_FILTERABLE_BLOCKS)
+        lRecentFilterableBlocks.pop_back();
+    return lRecentFilterableBlocks.front();
+}
+
+/** Number of blocks we keep in transit from a peer: enough to cover BLOCK_DOWNLOAD_TARGET_TIME at the
+ *  rate it delivered blocks so far. Requires cs_main. */
+int GetBlocksInTransitLimit(const CNodeState *state) {
+    if (state->nBlockDownloadTime == 0)
+        return MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+    int64_t nLimit = 1000000LL * BLOCK_DOWNLOAD_TARGET_TIME / state->nBlockDownloadTime;
+    return std::max<int64_t>(MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER, std::min<int64_t>(nLimit, MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER));
+}
+
+/** How far beyond the last common block we fetch from a peer. Fast peers may look further ahead, so
+ *  they keep downloading while a slower peer holds the front of the window. Requires cs_main. */
+int GetBlockDownloadWindow(const CNodeState *state) {
+    return BLOCK_DOWNLOAD_WINDOW * GetBlocksInTransitLimit(state) / MAX_BLOCKS_IN_TRANSIT_PER_PEER;
 }
 
 /** Check whether the last unknown block a peer advertised is not yet known. */
@@ -414,10 +625,10 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
 
     std::vector<CBlockIndex*> vToFetch;
     CBlockIndex *pindexWalk = state->pindexLastCommonBlock;
-    // Never fetch further than the best block we know the peer has, or more than BLOCK_DOWNLOAD_WINDOW + 1 beyond the last
+    // Never fetch further than the best block we know the peer has, or more than its download window + 1 beyond the last
     // linked block we have in common with this peer. The +1 is so we can detect stalling, namely if we would be able to
     // download that next block if the window were 1 larger.
-    int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
+    int nWindowEnd = state->pindexLastCommonBlock->nHeight + GetBlockDownloadWindow(state);
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
     while (pindexWalk->nHeight < nMaxHeight) {
@@ -476,6 +687,12 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
     stats.nMisbehavior = state->nMisbehavior;
     stats.nSyncHeight = state->pindexBestKnownBlock ? state->pindexBestKnownBlock->nHeight : -1;
     stats.nCommonHeight = state->pindexLastCommonBlock ? state->pindexLastCommonBlock->nHeight : -1;
+    stats.nBlocksInFlight = state->nBlocksInFlight;
+    stats.nBlocksInTransitLimit = GetBlocksInTransitLimit(state);
+    stats.nBlockDownloadWindow = GetBlockDownloadWindow(state);
+    stats.nBlockDownloadTime = state->nBlockDownloadTime;
+    stats.nBlocksDownloaded = state->nBlocksDownloaded;
+    stats.nStallCount = state->nStallCount;
     BOOST_FOREACH(const QueuedBlock& queue, state->vBlocksInFlight) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
@@ -517,50 +734,64 @@ bool AddOrphanTx(const CTransaction& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(c
     // have been mined or received.
     // 10,000 orphans, each of which is at most 5,000 bytes big is
     // at most 500 megabytes of orphans:
-    unsigned int sz = tx.GetSerializeSize(SER_NETWORK, CTransaction::CURRENT_VERSION);
+    unsigned int sz = tx.GetTotalSize();
     if (sz > 5000)
     {
         LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", sz, hash.ToString());
         return false;
     }
 
-    mapOrphanTransactions[hash].tx = tx;
-    mapOrphanTransactions[hash].fromPeer = peer;
+    COrphanTx& orphan = mapOrphanTransactions[hash];
+    orphan.tx = MakeTransactionRef(tx);
+    orphan.fromPeer = peer;
+    orphan.nListPos = vOrphanList.size();
+    vOrphanList.push_back(hash);
+    nOrphanTxSize += sz;
     BOOST_FOREACH(const CTxIn& txin, tx.vin)
         mapOrphanTransactionsByPrev[txin.prevout.hash].insert(hash);
 
-    LogPrint("mempool", "stored orphan tx %s (mapsz %u prevsz %u)\n", hash.ToString(),
-             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size());
+    LogPrint("mempool", "stored orphan tx %s (mapsz %u prevsz %u bytes %u)\n", hash.ToString(),
+             mapOrphanTransactions.size(), mapOrphanTransactionsByPrev.size(), nOrphanTxSize);
     return true;
 }
 
 void static EraseOrphanTx(uint256 hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
-    map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.find(hash);
+    auto it = mapOrphanTransactions.find(hash);
     if (it == mapOrphanTransactions.end())
         return;
-    BOOST_FOREACH(const CTxIn& txin, it->second.tx.vin)
+    BOOST_FOREACH(const CTxIn& txin, it->second.tx->vin)
     {
-        map<uint256, set<uint256> >::iterator itPrev = mapOrphanTransactionsByPrev.find(txin.prevout.hash);
+        auto itPrev = mapOrphanTransactionsByPrev.find(txin.prevout.hash);
         if (itPrev == mapOrphanTransactionsByPrev.end())
             continue;
         itPrev->second.erase(hash);
         if (itPrev->second.empty())
             mapOrphanTransactionsByPrev.erase(itPrev);
     }
+
+    // Move the last orphan of the list into the erased one's place
+    size_t nPos = it->second.nListPos;
+    assert(nPos < vOrphanList.size() && vOrphanList[nPos] == hash);
+    if (nPos + 1 != vOrphanList.size()) {
+        vOrphanList[nPos] = vOrphanList.back();
+        mapOrphanTransactions.at(vOrphanList[nPos]).nListPos = nPos;
+    }
+    vOrphanList.pop_back();
+
+    nOrphanTxSize -= it->second.tx->GetTotalSize();
     mapOrphanTransactions.erase(it);
 }
 
 void EraseOrphansFor(NodeId peer)
 {
     int nErased = 0;
-    map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
-    while (iter != mapOrphanTransactions.end())
+    // Erasing moves the last orphan of the list to the erased position, so walk it backwards
+    for (size_t i = vOrphanList.size(); i-- > 0; )
     {
-        map<uint256, COrphanTx>::iterator maybeErase = iter++; // increment to avoid iterator becoming invalid
-        if (maybeErase->second.fromPeer == peer)
+        if (mapOrphanTransactions.at(vOrphanList[i]).fromPeer == peer)
         {
-            EraseOrphanTx(maybeErase->second.tx.GetHash());
+            EraseOrphanTx(vOrphanList[i]);
             ++nErased;
         }
     }
@@ -568,17 +799,13 @@ void EraseOrphansFor(NodeId peer)
 }
 
 
-unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, size_t nMaxBytes) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     unsigned int nEvicted = 0;
-    while (mapOrphanTransactions.size() > nMaxOrphans)
+    while (mapOrphanTransactions.size() > nMaxOrphans || nOrphanTxSize > nMaxBytes)
     {
         // Evict a random orphan:
-        uint256 randomhash = GetRandHash();
-        map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.lower_bound(randomhash);
-        if (it == mapOrphanTransactions.end())
-            it = mapOrphanTransactions.begin();
-        EraseOrphanTx(it->first);
+        EraseOrphanTx(vOrphanList[GetRand(vOrphanList.size())]);
         ++nEvicted;
     }
     return nEvicted;
@@ -655,16 +882,29 @@ void PeerLogicValidation::BlockChecked(const CBlock& block, const CValidationSta
     LOCK(cs_main);
 
     const uint256 hash(block.GetHash());
-    std::map<uint256, NodeId>::iterator it = mapBlockSource.find(hash);
+    std::map<uint256, std::pair<NodeId, bool> >::iterator it = mapBlockSource.find(hash);
 
     int nDoS = 0;
     if (state.IsInvalid(nDoS)) {
-        if (it != mapBlockSource.end() && State(it->second)) {
+        if (it != mapBlockSource.end() && State(it->second.first)) {
             assert (state.GetRejectCode() < REJECT_INTERNAL); // Blocks are never rejected with internal reject codes
             CBlockReject reject = {(unsigned char)state.GetRejectCode(), state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), hash};
-            State(it->second)->rejects.push_back(reject);
-            if (nDoS > 0)
-                Misbehaving(it->second, nDoS);
+            State(it->second.first)->rejects.push_back(reject);
+            if (nDoS > 0 && it->second.second)
+                Misbehaving(it->second.first, nDoS);
+        }
+    }
+    // Check that:
+    // 1. The block is valid
+    // 2. We're not in initial block download
+    // 3. This is currently the best block we're aware of. We haven't updated
+    //    the tip yet so we have no way to check this directly here. Instead we
+    //    just check that there are currently no other blocks in flight.
+    else if (state.IsValid() &&
+             !IsInitialBlockDownload() &&
+             mapBlocksInFlight.count(hash) == mapBlocksInFlight.size()) {
+        if (it != mapBlockSource.end()) {
+            MaybeSetPeerAsAnnouncingHeaderAndIDs(it->second.first, *connman);
         }
     }
     if (it != mapBlockSource.end())
@@ -723,12 +963,12 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
         return mapSporks.count(inv.hash);
 
     case MSG_SMARTNODE_PAYMENT_VOTE:
-        return mnpayments.mapSmartnodePaymentVotes.count(inv.hash);
+        return mnpayments.HasPaymentVote(inv.hash);
 
     case MSG_SMARTNODE_PAYMENT_BLOCK:
         {
             BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
-            return mi != mapBlockIndex.end() && mnpayments.mapSmartnodeBlocks.find(mi->second->nHeight) != mnpayments.mapSmartnodeBlocks.end();
+            return mi != mapBlockIndex.end() && mnpayments.HasBlockPayees(mi->second->nHeight);
         }
 
     case MSG_SMARTNODE_ANNOUNCE:
@@ -752,9 +992,7 @@ static void RelayAddress(const CAddress& addr, bool fReachable, CConnman& connma
     // Relay to a limited number of other nodes
     // Use deterministic randomness to send to the same nodes for 24 hours
     // at a time so the addrKnowns of the chosen nodes prevent repeats
-    static uint256 hashSalt;
-    if (hashSalt.IsNull())
-        hashSalt = GetRandHash();
+    static const uint256 hashSalt = GetRandHash();
     uint64_t hashAddr = addr.GetHash();
     uint256 hashRand = ArithToUint256(UintToArith256(hashSalt) ^ (hashAddr<<32) ^ ((GetTime()+hashAddr)/(24*60*60)));
     hashRand = HashKeccak(BEGIN(hashRand), END(hashRand));
@@ -778,10 +1016,38 @@ static void RelayAddress(const CAddress& addr, bool fReachable, CConnman& connma
     connman.ForEachNodeThen(std::move(sortfunc), std::move(pushfunc));
 }
 
-void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParams, CConnman& connman, std::atomic<bool>& interruptMsgProc)
+/** Relay a transaction just accepted to the mempool, sharing the mempool's copy of it */
+static void RelayAcceptedTransaction(const CTransaction& tx, CConnman& connman)
+{
+    CTransactionRef ptx = mempool.get(tx.GetHash());
+    if (ptx)
+        connman.RelayTransaction(ptx);
+    else
+        connman.RelayTransaction(tx);
+}
+
+/** Whether the upload limits of pfrom's peer class allow serving inv now. Blocks near the tip
+ *  are always served, so block relay doesn't queue up behind historical blocks. */
+static bool UploadAllowed(CNode* pfrom, const CInv& inv, CConnman& connman)
+{
+    AssertLockHeld(cs_main);
+    if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK) {
+        BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
+        if (mi != mapBlockIndex.end() && mi->second->nHeight > chainActive.Height() - (int)MAX_BLOCKS_TO_ANNOUNCE)
+            return true;
+        return connman.UploadAllowed(pfrom, UPLOAD_BLOCKS);
+    }
+    if (inv.type == MSG_TX || inv.type == MSG_TXLOCK_REQUEST)
+        return connman.UploadAllowed(pfrom, UPLOAD_TX);
+    return true;
+}
+
+/** Serve what pfrom asked for. Returns false if the upload limits held back the rest. */
+bool static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParams, CConnman& connman, std::atomic<bool>& interruptMsgProc)
 {
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
     vector<CInv> vNotFound;
+    bool fAllowed = true;
 
     LOCK(cs_main);
 
@@ -794,11 +1060,18 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
         LogPrint("net", "ProcessGetData -- inv = %s\n", inv.ToString());
         {
             if (interruptMsgProc)
-                return;
+                return true;
+
+            // The rest waits for the peer class to get upload budget again
+            if (!UploadAllowed(pfrom, inv, connman)) {
+                LogPrint("net", "ProcessGetData -- upload limit reached, holding back %s peer=%d\n", inv.ToString(), pfrom->id);
+                fAllowed = false;
+                break;
+            }
 
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
             {
                 bool send = false;
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
@@ -833,18 +1106,38 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 // Pruned nodes may have deleted the block, so check whether
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
+                    // If a peer is asking for old blocks, we're almost guaranteed
+                    // they wont have a useful mempool to match against a compact block,
+                    // and we don't feel like constructing the object for them, so
+                    // instead we respond with the full, non-compact block.
+                    bool fSendCompact = inv.type == MSG_CMPCT_BLOCK && CanDirectFetch(consensusParams) &&
+                        mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
                     // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        connman.PushMessage(pfrom, NetMsgType::BLOCK, block);
+                    if (inv.type == MSG_BLOCK || (inv.type == MSG_CMPCT_BLOCK && !fSendCompact))
+                    {
+                        // pass the block on as it is stored, it gets read right behind the message
+                        // header and handed to the send queue without being deserialized or copied again
+                        CSerializeData vchMsg(CMessageHeader::HEADER_SIZE);
+                        if ((*mi).second->nStatus & BLOCK_HAVE_SIZE)
+                            vchMsg.reserve(CMessageHeader::HEADER_SIZE + (*mi).second->nSize);
+                        if (!ReadRawBlockFromDisk(vchMsg, (*mi).second, Params().MessageStart()))
+                            assert(!"cannot load block from disk");
+                        unsigned char pchChecksum[CMessageHeader::CHECKSUM_SIZE];
+                        GetBlockChecksum(inv.hash, vchMsg, pchChecksum);
+                        connman.PushRawMessage(pfrom, NetMsgType::BLOCK, std::move(vchMsg), pchChecksum);
+                    }
+                    else if (inv.type == MSG_CMPCT_BLOCK)
+                    {
+                        connman.PushMessage(pfrom, NetMsgType::CMPCTBLOCK, GetCompactBlock(mi->second, consensusParams));
+                    }
                     else // MSG_FILTERED_BLOCK)
                     {
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter)
                         {
-                            CMerkleBlock merkleBlock(block, *pfrom->pfilter);
+                            std::shared_ptr<const FilterableBlock> pblock = GetFilterableBlock(mi->second, consensusParams);
+                            const CBlock& block = pblock->block;
+                            CMerkleBlock merkleBlock(block.GetBlockHeader(), pblock->elements, *pfrom->pfilter);
                             connman.PushMessage(pfrom, NetMsgType::MERKLEBLOCK, merkleBlock);
                             // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
                             // This avoids hurting performance by pointlessly requiring a round-trip
@@ -878,17 +1171,20 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 // Send stream from relay memory
                 bool pushed = false;
                 {
-                    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                    // a copy of the message as serialized and checksummed when it was relayed
+                    CSerializeData vchMsg;
+                    unsigned char pchChecksum[CMessageHeader::CHECKSUM_SIZE];
                     {
                         LOCK(cs_mapRelay);
-                        map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
+                        auto mi = mapRelay.find(inv);
                         if (mi != mapRelay.end()) {
-                            ss += (*mi).second;
+                            vchMsg = (*mi).second.vchMsg;
+                            memcpy(pchChecksum, (*mi).second.pchChecksum, CMessageHeader::CHECKSUM_SIZE);
                             pushed = true;
                         }
                     }
                     if(pushed)
-                        connman.PushMessage(pfrom, inv.GetCommand(), ss);
+                        connman.PushRawMessage(pfrom, inv.GetCommand(), std::move(vchMsg), pchChecksum);
                 }
 
                 if (!pushed && inv.type == MSG_TX) {
@@ -935,10 +1231,11 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 }
 
                 if (!pushed && inv.type == MSG_SMARTNODE_PAYMENT_VOTE) {
-                    if(mnpayments.HasVerifiedPaymentVote(inv.hash)) {
+                    CSmartnodePaymentVote vote;
+                    if(mnpayments.GetPaymentVote(inv.hash, vote) && vote.IsVerified()) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << mnpayments.mapSmartnodePaymentVotes[inv.hash];
+                        ss << vote;
                         connman.PushMessage(pfrom, NetMsgType::SMARTNODEPAYMENTVOTE, ss);
                         pushed = true;
                     }
@@ -946,18 +1243,13 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
 
                 if (!pushed && inv.type == MSG_SMARTNODE_PAYMENT_BLOCK) {
                     BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
-                    LOCK(cs_mapSmartnodeBlocks);
-                    if (mi != mapBlockIndex.end() && mnpayments.mapSmartnodeBlocks.count(mi->second->nHeight)) {
-                        BOOST_FOREACH(CSmartnodePayee& payee, mnpayments.mapSmartnodeBlocks[mi->second->nHeight].vecPayees) {
-                            std::vector<uint256> vecVoteHashes = payee.GetVoteHashes();
-                            BOOST_FOREACH(uint256& hash, vecVoteHashes) {
-                                if(mnpayments.HasVerifiedPaymentVote(hash)) {
-                                    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                                    ss.reserve(1000);
-                                    ss << mnpayments.mapSmartnodePaymentVotes[hash];
-                                    connman.PushMessage(pfrom, NetMsgType::SMARTNODEPAYMENTVOTE, ss);
-                                }
-                            }
+                    std::vector<CSmartnodePaymentVote> vecVotes;
+                    if (mi != mapBlockIndex.end() && mnpayments.GetBlockPaymentVotes(mi->second->nHeight, vecVotes)) {
+                        BOOST_FOREACH(const CSmartnodePaymentVote& vote, vecVotes) {
+                            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                            ss.reserve(1000);
+                            ss << vote;
+                            connman.PushMessage(pfrom, NetMsgType::SMARTNODEPAYMENTVOTE, ss);
                         }
                         pushed = true;
                     }
@@ -1017,6 +1309,8 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
         // having to download the entire memory pool.
         connman.PushMessage(pfrom, NetMsgType::NOTFOUND, vNotFound);
     }
+
+    return fAllowed;
 }
 
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived, CConnman& connman, std::atomic<bool>& interruptMsgProc)
@@ -1229,6 +1523,16 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             // nodes)
             connman.PushMessage(pfrom, NetMsgType::SENDHEADERS);
         }
+        if (pfrom->nVersion >= SHORT_IDS_BLOCKS_VERSION) {
+            // Tell our peer we are willing to provide version 1 cmpctblocks.
+            // However, we do not request new block announcements using
+            // cmpctblock messages.
+            // We send this to non-NODE NETWORK peers as well, because
+            // they may wish to request compact blocks from us
+            bool fAnnounceUsingCMPCTBLOCK = false;
+            uint64_t nCMPCTBLOCKVersion = 1;
+            connman.PushMessage(pfrom, NetMsgType::SENDCMPCT, fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion);
+        }
         pfrom->fSuccessfullyConnected = true;
     }
 
@@ -1285,6 +1589,19 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         State(pfrom->GetId())->fPreferHeaders = true;
     }
 
+    else if (strCommand == NetMsgType::SENDCMPCT)
+    {
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        uint64_t nCMPCTBLOCKVersion = 0;
+        vRecv >> fAnnounceUsingCMPCTBLOCK >> nCMPCTBLOCKVersion;
+        // Version 2 is for segwit, which this chain doesn't have
+        if (nCMPCTBLOCKVersion == 1) {
+            LOCK(cs_main);
+            State(pfrom->GetId())->fProvidesHeaderAndIDs = true;
+            State(pfrom->GetId())->fPreferHeaderAndIDs = fAnnounceUsingCMPCTBLOCK;
+        }
+    }
+
 
     else if (strCommand == NetMsgType::INV)
     {
@@ -1349,7 +1666,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                         connman.PushMessage(pfrom, NetMsgType::GETHEADERS, chainActive.GetLocator(pindexBestHeader), inv.hash);
                         CNodeState *nodestate = State(pfrom->GetId());
                         if (CanDirectFetch(chainparams.GetConsensus()) &&
-                            nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+                            nodestate->nBlocksInFlight < GetBlocksInTransitLimit(nodestate)) {
                             vToFetch.push_back(inv);
                             // Mark block as in flight already, even though the actual "getdata" message only goes out
                             // later (within the same cs_main lock, though).
@@ -1407,7 +1724,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         LOCK(cs_main);
 
         // Find the last block the caller has in the main chain
-        CBlockIndex* pindex = FindForkInGlobalIndex(chainActive, locator);
+        CBlockIndex* pindex = FindForkForPeer(State(pfrom->GetId()), locator);
 
         // Send the rest of the chain
         if (pindex)
@@ -1442,52 +1759,107 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
-    else if (strCommand == NetMsgType::GETHEADERS)
+    else if (strCommand == NetMsgType::GETBLOCKTXN)
     {
-        CBlockLocator locator;
-        uint256 hashStop;
-        vRecv >> locator >> hashStop;
+        BlockTransactionsRequest req;
+        vRecv >> req;
 
         LOCK(cs_main);
-        if (IsInitialBlockDownload() && !pfrom->fWhitelisted) {
-            LogPrint("net", "Ignoring getheaders from peer=%d because node is in initial block download\n", pfrom->id);
+
+        BlockMap::iterator it = mapBlockIndex.find(req.blockhash);
+        if (it == mapBlockIndex.end() || !(it->second->nStatus & BLOCK_HAVE_DATA)) {
+            LogPrintf("Peer %d sent us a getblocktxn for a block we don't have\n", pfrom->id);
             return true;
         }
 
-        CNodeState *nodestate = State(pfrom->GetId());
-        CBlockIndex* pindex = NULL;
-        if (locator.IsNull())
-        {
-            // If locator is null, return the hashStop block
-            BlockMap::iterator mi = mapBlockIndex.find(hashStop);
-            if (mi == mapBlockIndex.end())
-                return true;
-            pindex = (*mi).second;
+        if (it->second->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
+            // If an older block is requested (should never happen in practice,
+            // but can happen in tests) send a block response instead of a
+            // blocktxn response. Sending a full block response instead of a
+            // small blocktxn response is preferable in the case where a peer
+            // might maliciously send lots of getblocktxn requests to trigger
+            // expensive disk reads, because it will require the peer to
+            // actually receive all the data read from disk over the network.
+            LogPrint("net", "Peer %d sent us a getblocktxn for a block > %i deep\n", pfrom->id, MAX_BLOCKTXN_DEPTH);
+            pfrom->vRecvGetData.push_back(CInv(MSG_BLOCK, req.blockhash));
+            ProcessGetData(pfrom, chainparams.GetConsensus(), connman, interruptMsgProc);
+            return true;
         }
-        else
-        {
-            // Find the last block the caller has in the main chain
-            pindex = FindForkInGlobalIndex(chainActive, locator);
-            if (pindex)
-                pindex = chainActive.Next(pindex);
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, it->second, chainparams.GetConsensus()))
+            assert(!"cannot load block from disk");
+
+        BlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= block.vtx.size()) {
+                Misbehaving(pfrom->GetId(), 100);
+                LogPrintf("Peer %d sent us a getblocktxn with out-of-bounds tx indices\n", pfrom->id);
+                return true;
+            }
+            resp.txn[i] = block.vtx[req.indexes[i]];
         }
+        connman.PushMessage(pfrom, NetMsgType::BLOCKTXN, resp);
+    }
 
-        // we must use CBlocks, as CBlockHeaders won't include the 0x00 nTx count at the end
-        vector<CBlock> vHeaders;
-        int nLimit = MAX_HEADERS_RESULTS;
-        LogPrint("net", "getheaders %d to %s from peer=%d\n", (pindex ? pindex->nHeight : -1), hashStop.ToString(), pfrom->id);
-        for (; pindex; pindex = chainActive.Next(pindex))
+
+    else if (strCommand == NetMsgType::GETHEADERS)
+    {
+        CBlockLocator locator;
+        uint256 hashStop;
+        vRecv >> locator >> hashStop;
+
+        // The last block of the reply and the number of headers, they get encoded without cs_main
+        CBlockIndex* pindexLast = NULL;
+        int nCount = 0;
         {
-            vHeaders.push_back(pindex->GetBlockHeader());
-            if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop)
-                break;
+            LOCK(cs_main);
+            if (IsInitialBlockDownload() && !pfrom->fWhitelisted) {
+                LogPrint("net", "Ignoring getheaders from peer=%d because node is in initial block download\n", pfrom->id);
+                return true;
+            }
+
+            CNodeState *nodestate = State(pfrom->GetId());
+            CBlockIndex* pindex = NULL;
+            if (locator.IsNull())
+            {
+                // If locator is null, return the hashStop block
+                BlockMap::iterator mi = mapBlockIndex.find(hashStop);
+                if (mi == mapBlockIndex.end())
+                    return true;
+                pindex = (*mi).second;
+                pindexLast = pindex;
+                nCount = 1;
+            }
+            else
+            {
+                // Find the last block the caller has in the main chain
+                pindex = FindForkForPeer(nodestate, locator);
+                if (pindex)
+                    pindex = chainActive.Next(pindex);
+            }
+
+            LogPrint("net", "getheaders %d to %s from peer=%d\n", (pindex ? pindex->nHeight : -1), hashStop.ToString(), pfrom->id);
+            if (pindex && !pindexLast)
+            {
+                // Up to MAX_HEADERS_RESULTS headers of the main chain, ending early at hashStop
+                int nLastHeight = std::min(pindex->nHeight + (int)MAX_HEADERS_RESULTS - 1, chainActive.Height());
+                BlockMap::iterator mi = mapBlockIndex.find(hashStop);
+                if (mi != mapBlockIndex.end() && chainActive.Contains(mi->second) &&
+                    mi->second->nHeight >= pindex->nHeight && mi->second->nHeight < nLastHeight)
+                    nLastHeight = mi->second->nHeight;
+                pindexLast = chainActive[nLastHeight];
+                nCount = nLastHeight - pindex->nHeight + 1;
+            }
+            // pindexLast is NULL if our peer has chainActive.Tip() (and thus
+            // we are sending an empty headers message), so it's safe to update
+            // pindexBestHeaderSent to be our tip.
+            nodestate->pindexBestHeaderSent = pindexLast ? pindexLast : chainActive.Tip();
         }
-        // pindex can be NULL either if we sent chainActive.Tip() OR
-        // if our peer has chainActive.Tip() (and thus we are sending an empty
-        // headers message). In both cases it's safe to update
-        // pindexBestHeaderSent to be our tip.
-        nodestate->pindexBestHeaderSent = pindex ? pindex : chainActive.Tip();
-        connman.PushMessage(pfrom, NetMsgType::HEADERS, vHeaders);
+
+        std::shared_ptr<const CRelayMessage> msg = headersCache.Get(pindexLast, nCount);
+        CSerializeData vchMsg = msg->vchMsg;
+        connman.PushRawMessage(pfrom, NetMsgType::HEADERS, std::move(vchMsg), msg->pchChecksum);
     }
 
 
@@ -1526,6 +1898,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         pfrom->AddInventoryKnown(inv);
         pfrom->setAskFor.erase(inv.hash);
 
+        // Hold cs_main from the lock request checks through AcceptToMemoryPool, so the latter can
+        // reuse the validation ProcessTxLockRequest did at this tip instead of repeating it
+        LOCK(cs_main);
+
         // Process custom logic, no matter if tx will be accepted to mempool later or not
         if (strCommand == NetMsgType::TXLOCKREQUEST) {
             if(!instantsend.ProcessTxLockRequest(txLockRequest, connman)) {
@@ -1564,8 +1940,6 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         //     mnodeman.DisallowMixing(dstx.vin.prevout);
         // }
 
-        LOCK(cs_main);
-
         bool fMissingInputs = false;
         CValidationState state;
 
@@ -1587,7 +1961,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             }
 
             mempool.check(pcoinsTip);
-            connman.RelayTransaction(tx);
+            RelayAcceptedTransaction(tx, connman);
             vWorkQueue.push_back(inv.hash);
 
             pfrom->nLastTXTime = GetTime();
@@ -1601,7 +1975,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             set<NodeId> setMisbehaving;
             for (unsigned int i = 0; i < vWorkQueue.size(); i++)
             {
-                map<uint256, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
+                auto itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
                 if (itByPrev == mapOrphanTransactionsByPrev.end())
                     continue;
                 for (set<uint256>::iterator mi = itByPrev->second.begin();
@@ -1609,8 +1983,9 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                      ++mi)
                 {
                     const uint256& orphanHash = *mi;
-                    const CTransaction& orphanTx = mapOrphanTransactions[orphanHash].tx;
-                    NodeId fromPeer = mapOrphanTransactions[orphanHash].fromPeer;
+                    const COrphanTx& orphan = mapOrphanTransactions.at(orphanHash);
+                    const CTransaction& orphanTx = *orphan.tx;
+                    NodeId fromPeer = orphan.fromPeer;
                     bool fMissingInputs2 = false;
                     // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
                     // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
@@ -1623,7 +1998,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2))
                     {
                         LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
-                        connman.RelayTransaction(orphanTx);
+                        RelayAcceptedTransaction(orphanTx, connman);
                         vWorkQueue.push_back(orphanHash);
                         vEraseQueue.push_back(orphanHash);
                     }
@@ -1653,13 +2028,29 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
         else if (fMissingInputs)
         {
-            AddOrphanTx(tx, pfrom->GetId());
+            // A transaction spending a rejected one can't become valid either, don't keep it around
+            assert(recentRejects);
+            bool fRejectedParents = false;
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                if (recentRejects->contains(txin.prevout.hash)) {
+                    fRejectedParents = true;
+                    break;
+                }
+            }
 
-            // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
-            unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-            unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
-            if (nEvicted > 0)
-                LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
+            if (fRejectedParents) {
+                LogPrint("mempool", "not keeping orphan with rejected parents %s\n", tx.GetHash().ToString());
+                recentRejects->insert(tx.GetHash());
+            } else {
+                AddOrphanTx(tx, pfrom->GetId());
+
+                // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
+                unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+                size_t nMaxOrphanTxSize = std::max((int64_t)0, GetArg("-maxorphantxsize", DEFAULT_MAX_ORPHAN_TRANSACTIONS_SIZE)) * 1000;
+                unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx, nMaxOrphanTxSize);
+                if (nEvicted > 0)
+                    LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
+            }
         } else {
             assert(recentRejects);
             recentRejects->insert(tx.GetHash());
@@ -1788,7 +2179,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             vector<CBlockIndex *> vToFetch;
             CBlockIndex *pindexWalk = pindexLast;
             // Calculate all the blocks we'd need to switch to pindexLast, up to a limit.
-            while (pindexWalk && !chainActive.Contains(pindexWalk) && vToFetch.size() <= MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+            while (pindexWalk && !chainActive.Contains(pindexWalk) && vToFetch.size() <= (unsigned int)GetBlocksInTransitLimit(nodestate)) {
                 if (!(pindexWalk->nStatus & BLOCK_HAVE_DATA) &&
                         !mapBlocksInFlight.count(pindexWalk->GetBlockHash())) {
                     // We don't have this block, and it's not yet in flight.
@@ -1808,7 +2199,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 vector<CInv> vGetData;
                 // Download as much as possible, from earliest to latest.
                 BOOST_REVERSE_FOREACH(CBlockIndex *pindex, vToFetch) {
-                    if (nodestate->nBlocksInFlight >= MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+                    if (nodestate->nBlocksInFlight >= GetBlocksInTransitLimit(nodestate)) {
                         // Can't download any more from this peer
                         break;
                     }
@@ -1822,6 +2213,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                             pindexLast->GetBlockHash().ToString(), pindexLast->nHeight);
                 }
                 if (vGetData.size() > 0) {
+                    if (nodestate->fProvidesHeaderAndIDs && vGetData.size() == 1 && mapBlocksInFlight.size() == 1 && pindexLast->pprev->IsValid(BLOCK_VALID_CHAIN)) {
+                        // In any case, we want to download using a compact block, not a regular one
+                        vGetData[0] = CInv(MSG_CMPCT_BLOCK, vGetData[0].hash);
+                    }
                     connman.PushMessage(pfrom, NetMsgType::GETDATA, vGetData);
                 }
             }
@@ -1829,6 +2224,244 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
     }
 
+    else if (strCommand == NetMsgType::CMPCTBLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+
+        {
+        LOCK(cs_main);
+
+        if (mapBlockIndex.find(cmpctblock.header.hashPrevBlock) == mapBlockIndex.end()) {
+            // Doesn't connect (or is genesis), instead of DoSing in AcceptBlockHeader, request deeper headers
+            if (!IsInitialBlockDownload())
+                connman.PushMessage(pfrom, NetMsgType::GETHEADERS, chainActive.GetLocator(pindexBestHeader), uint256());
+            return true;
+        }
+        }
+
+        CBlockIndex *pindex = NULL;
+        CValidationState state;
+        if (!ProcessNewBlockHeaders(std::vector<CBlockHeader>(1, cmpctblock.header), state, chainparams, &pindex)) {
+            int nDoS;
+            if (state.IsInvalid(nDoS)) {
+                if (nDoS > 0) {
+                    LOCK(cs_main);
+                    Misbehaving(pfrom->GetId(), nDoS);
+                }
+                LogPrintf("Peer %d sent us invalid header via cmpctblock\n", pfrom->id);
+                return true;
+            }
+        }
+
+        // When we succeed in decoding a block's txids from a cmpctblock
+        // message we typically jump to the BLOCKTXN handling code, with a
+        // dummy (empty) BLOCKTXN message, to re-use the logic there in
+        // completing processing of the putative block (without cs_main).
+        bool fProcessBLOCKTXN = false;
+        CDataStream blockTxnMsg(SER_NETWORK, PROTOCOL_VERSION);
+
+        // If we end up treating this as a plain headers message, call that as well
+        // without cs_main.
+        bool fRevertToHeaderProcessing = false;
+        CDataStream vHeadersMsg(SER_NETWORK, PROTOCOL_VERSION);
+
+        // Keep a CBlock for "optimistic" compactblock reconstructions (see
+        // below)
+        CBlock block;
+        bool fBlockReconstructed = false;
+
+        {
+        LOCK(cs_main);
+        // If AcceptBlockHeader returned true, it set pindex
+        assert(pindex);
+        UpdateBlockAvailability(pfrom->GetId(), pindex->GetBlockHash());
+
+        map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator blockInFlightIt = mapBlocksInFlight.find(pindex->GetBlockHash());
+        bool fAlreadyInFlight = blockInFlightIt != mapBlocksInFlight.end();
+
+        if (pindex->nStatus & BLOCK_HAVE_DATA) // Nothing to do here
+            return true;
+
+        if (pindex->nChainWork <= chainActive.Tip()->nChainWork || // We know something better
+                pindex->nTx != 0) { // We had this block at some point, but pruned it
+            if (fAlreadyInFlight) {
+                // We requested this block for some reason, but our mempool will probably be useless
+                // so we just grab the block via normal getdata
+                std::vector<CInv> vInv(1, CInv(MSG_BLOCK, cmpctblock.header.GetHash()));
+                connman.PushMessage(pfrom, NetMsgType::GETDATA, vInv);
+            }
+            return true;
+        }
+
+        // If we're not close to tip yet, give up and let parallel block fetch work its magic
+        if (!fAlreadyInFlight && !CanDirectFetch(chainparams.GetConsensus()))
+            return true;
+
+        CNodeState *nodestate = State(pfrom->GetId());
+
+        // We want to be a bit conservative just to be extra careful about DoS
+        // possibilities in compact block processing...
+        if (pindex->nHeight <= chainActive.Height() + 2) {
+            if ((!fAlreadyInFlight && nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) ||
+                 (fAlreadyInFlight && blockInFlightIt->second.first == pfrom->GetId())) {
+                list<QueuedBlock>::iterator* queuedBlockIt = NULL;
+                if (!MarkBlockAsInFlight(pfrom->GetId(), pindex->GetBlockHash(), chainparams.GetConsensus(), pindex, &queuedBlockIt)) {
+                    if (!(*queuedBlockIt)->partialBlock)
+                        (*queuedBlockIt)->partialBlock.reset(new PartiallyDownloadedBlock(&mempool));
+                    else {
+                        // The block was already in flight using compact blocks from the same peer
+                        LogPrint("net", "Peer sent us compact block we were already syncing!\n");
+                        return true;
+                    }
+                }
+
+                PartiallyDownloadedBlock& partialBlock = *(*queuedBlockIt)->partialBlock;
+                ReadStatus status = partialBlock.InitData(cmpctblock);
+                if (status == READ_STATUS_INVALID) {
+                    MarkBlockAsReceived(pindex->GetBlockHash()); // Reset in-flight state in case of whitelist
+                    Misbehaving(pfrom->GetId(), 100);
+                    LogPrintf("Peer %d sent us invalid compact block\n", pfrom->id);
+                    return true;
+                } else if (status == READ_STATUS_FAILED) {
+                    // Duplicate txindexes, the block is now in-flight, so just request it
+                    std::vector<CInv> vInv(1, CInv(MSG_BLOCK, cmpctblock.header.GetHash()));
+                    connman.PushMessage(pfrom, NetMsgType::GETDATA, vInv);
+                    return true;
+                }
+
+                BlockTransactionsRequest req;
+                for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++) {
+                    if (!partialBlock.IsTxAvailable(i))
+                        req.indexes.push_back(i);
+                }
+                if (req.indexes.empty()) {
+                    // Dirty hack to jump to BLOCKTXN code (TODO: move message handling into their own functions)
+                    BlockTransactions txn;
+                    txn.blockhash = cmpctblock.header.GetHash();
+                    blockTxnMsg << txn;
+                    fProcessBLOCKTXN = true;
+                } else {
+                    req.blockhash = pindex->GetBlockHash();
+                    connman.PushMessage(pfrom, NetMsgType::GETBLOCKTXN, req);
+                }
+            } else {
+                // This block is either already in flight from a different
+                // peer, or this peer has too many blocks outstanding to
+                // download from.
+                // Optimistically try to reconstruct anyway since we might be
+                // able to without any round trips.
+                PartiallyDownloadedBlock tempBlock(&mempool);
+                ReadStatus status = tempBlock.InitData(cmpctblock);
+                if (status != READ_STATUS_OK) {
+                    // TODO: don't ignore failures
+                    return true;
+                }
+                std::vector<CTransaction> dummy;
+                status = tempBlock.FillBlock(block, dummy);
+                if (status == READ_STATUS_OK) {
+                    fBlockReconstructed = true;
+                }
+            }
+        } else {
+            if (fAlreadyInFlight) {
+                // We requested this block, but its far into the future, so our
+                // mempool will probably be useless - request the block normally
+                std::vector<CInv> vInv(1, CInv(MSG_BLOCK, cmpctblock.header.GetHash()));
+                connman.PushMessage(pfrom, NetMsgType::GETDATA, vInv);
+                return true;
+            } else {
+                // If this was an announce-cmpctblock, we want the same treatment as a header message
+                // Dirty hack to process as if it were just a headers message (TODO: move message handling into their own functions)
+                std::vector<CBlock> headers;
+                headers.push_back(cmpctblock.header);
+                vHeadersMsg << headers;
+                fRevertToHeaderProcessing = true;
+            }
+        }
+        } // cs_main
+
+        if (fProcessBLOCKTXN)
+            return ProcessMessage(pfrom, NetMsgType::BLOCKTXN, blockTxnMsg, nTimeReceived, connman, interruptMsgProc);
+
+        if (fRevertToHeaderProcessing)
+            return ProcessMessage(pfrom, NetMsgType::HEADERS, vHeadersMsg, nTimeReceived, connman, interruptMsgProc);
+
+        if (fBlockReconstructed) {
+            // If we got here, we were able to optimistically reconstruct a
+            // block that is in flight from some other peer.
+            {
+                LOCK(cs_main);
+                mapBlockSource.emplace(block.GetHash(), std::make_pair(pfrom->GetId(), false));
+            }
+            bool fNewBlock = false;
+            ProcessNewBlock(chainparams, &block, true, NULL, &fNewBlock);
+            if (fNewBlock)
+                pfrom->nLastBlockTime = GetTime();
+
+            LOCK(cs_main); // hold cs_main for CBlockIndex::IsValid()
+            if (pindex->IsValid(BLOCK_VALID_TRANSACTIONS)) {
+                // Clear download state for this block, which is in
+                // process from some other peer.  We do this after calling
+                // ProcessNewBlock so that a malleated cmpctblock announcement
+                // can't be used to interfere with block relay.
+                MarkBlockAsReceived(block.GetHash());
+            }
+        }
+    }
+
+    else if (strCommand == NetMsgType::BLOCKTXN && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        BlockTransactions resp;
+        vRecv >> resp;
+
+        CBlock block;
+        bool fBlockRead = false;
+        {
+            LOCK(cs_main);
+
+            map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator it = mapBlocksInFlight.find(resp.blockhash);
+            if (it == mapBlocksInFlight.end() || !it->second.second->partialBlock ||
+                    it->second.first != pfrom->GetId()) {
+                LogPrint("net", "Peer %d sent us block transactions for block we weren't expecting\n", pfrom->id);
+                return true;
+            }
+
+            PartiallyDownloadedBlock& partialBlock = *it->second.second->partialBlock;
+            ReadStatus status = partialBlock.FillBlock(block, resp.txn);
+            if (status == READ_STATUS_INVALID) {
+                MarkBlockAsReceived(resp.blockhash); // Reset in-flight state in case of whitelist
+                Misbehaving(pfrom->GetId(), 100);
+                LogPrintf("Peer %d sent us invalid compact block/non-matching block transactions\n", pfrom->id);
+                return true;
+            } else if (status == READ_STATUS_FAILED) {
+                // Might have collided, fall back to getdata now :(
+                std::vector<CInv> invs(1, CInv(MSG_BLOCK, resp.blockhash));
+                connman.PushMessage(pfrom, NetMsgType::GETDATA, invs);
+            } else {
+                // The merkle root matched, whatever else is wrong with the block
+                // ProcessNewBlock finds, the coinbase payments to smartnodes and
+                // hives included.
+                MarkBlockAsReceived(resp.blockhash); // it is now an empty pointer
+                fBlockRead = true;
+                // mapBlockSource is only used for sending reject messages and DoS scores,
+                // so the race between here and cs_main in ProcessNewBlock is fine.
+                // BIP 152 permits peers to relay compact blocks after validating
+                // the header only; we should not punish peers if the block turns
+                // out to be invalid.
+                mapBlockSource.emplace(resp.blockhash, std::make_pair(pfrom->GetId(), false));
+            }
+        } // Don't hold cs_main when we call into ProcessNewBlock
+        if (fBlockRead) {
+            bool fNewBlock = false;
+            // Since we requested this block (it was in mapBlocksInFlight), force it to be processed,
+            // even if it would not be a candidate for new tip (missing previous block, chain not long enough, etc)
+            ProcessNewBlock(chainparams, &block, true, NULL, &fNewBlock);
+            if (fNewBlock)
+                pfrom->nLastBlockTime = GetTime();
+        }
+    }
+
     else if (strCommand == NetMsgType::BLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         CBlock block;
@@ -1852,7 +2485,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             forceProcessing |= MarkBlockAsReceived(hash);
             // mapBlockSource is only used for sending reject messages and DoS scores,
             // so the race between here and cs_main in ProcessNewBlock is fine.
-            mapBlockSource.emplace(hash, pfrom->GetId());
+            mapBlockSource.emplace(hash, std::make_pair(pfrom->GetId(), true));
         }
         bool fNewBlock = false;
         ProcessNewBlock(chainparams, &block, forceProcessing, NULL, &fNewBlock);
@@ -2113,11 +2746,13 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         if (found)
         {
+            LOCK(cs_smartnodeMessages);
             //probably one the extensions
 //#ifdef ENABLE_WALLET
             //privateSendClient.ProcessMessage(pfrom, strCommand, vRecv, connman);
 //#endif // ENABLE_WALLET
             //privateSendServer.ProcessMessage(pfrom, strCommand, vRecv, connman);
+            smartnodeSync.AddAssetMessage(strCommand, vRecv.size());
             mnodeman.ProcessMessage(pfrom, strCommand, vRecv, connman);
             mnpayments.ProcessMessage(pfrom, strCommand, vRecv, connman);
             instantsend.ProcessMessage(pfrom, strCommand, vRecv, connman);
@@ -2147,20 +2782,24 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, std::atomic<bool>& interru
     //  (x) data
     //
     bool fMoreWork = false;
+    bool fUploadAllowed = true;
 
     if (!pfrom->vRecvGetData.empty())
-        ProcessGetData(pfrom, chainparams.GetConsensus(), connman, interruptMsgProc);
+        fUploadAllowed = ProcessGetData(pfrom, chainparams.GetConsensus(), connman, interruptMsgProc);
 
     if (pfrom->fDisconnect)
         return false;
 
-    // this maintains the order of responses
-    if (!pfrom->vRecvGetData.empty()) return true;
+    // this maintains the order of responses, one held back by the upload limits is retried on the next pass
+    if (!pfrom->vRecvGetData.empty()) return fUploadAllowed;
 
         // Don't bother if send buffer is too full to respond anyway
         if (pfrom->fPauseSend)
             return false;
 
+        // Start verifying the signatures of queued smartnode messages while the ones in front are processed
+        QueueSmartnodeSignatures(pfrom);
+
         std::list<CNetMessage> msgs;
         {
             LOCK(pfrom->cs_vProcessMsg);
@@ -2206,6 +2845,8 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, std::atomic<bool>& interru
             return fMoreWork;
         }
 
+        TRACE3(net, inbound_message, pfrom->id, strCommand.c_str(), nMessageSize);
+
         // Process message
         bool fRet = false;
         try
@@ -2399,7 +3040,9 @@ bool SendMessages(CNode* pto, CConnman& connman, std::atomic<bool>& interruptMsg
             // add all to the inv queue.
             LOCK(pto->cs_inventory);
             vector<CBlock> vHeaders;
-            bool fRevertToInv = (!state.fPreferHeaders || pto->vBlockHashesToAnnounce.size() > MAX_BLOCKS_TO_ANNOUNCE);
+            bool fRevertToInv = ((!state.fPreferHeaders &&
+                                 (!state.fPreferHeaderAndIDs || pto->vBlockHashesToAnnounce.size() > 1)) ||
+                                pto->vBlockHashesToAnnounce.size() > MAX_BLOCKS_TO_ANNOUNCE);
             CBlockIndex *pBestIndex = NULL; // last header queued for delivery
             ProcessBlockAvailability(pto->id); // ensure pindexBestKnownBlock is up-to-date
 
@@ -2451,6 +3094,29 @@ bool SendMessages(CNode* pto, CConnman& connman, std::atomic<bool>& interruptMsg
                     }
                 }
             }
+            if (!fRevertToInv && !vHeaders.empty()) {
+                if (vHeaders.size() == 1 && state.fPreferHeaderAndIDs) {
+                    // We only send up to 1 block as header-and-ids, as otherwise
+                    // probably means we're doing an initial-ish-sync or they're slow
+                    LogPrint("net", "%s sending header-and-ids %s to peer=%d\n", __func__,
+                            vHeaders.front().GetHash().ToString(), pto->id);
+                    connman.PushMessage(pto, NetMsgType::CMPCTBLOCK, GetCompactBlock(pBestIndex, consensusParams));
+                    state.pindexBestHeaderSent = pBestIndex;
+                } else if (state.fPreferHeaders) {
+                    if (vHeaders.size() > 1) {
+                        LogPrint("net", "%s: %u headers, range (%s, %s), to peer=%d\n", __func__,
+                                vHeaders.size(),
+                                vHeaders.front().GetHash().ToString(),
+                                vHeaders.back().GetHash().ToString(), pto->id);
+                    } else {
+                        LogPrint("net", "%s: sending header %s to peer=%d\n", __func__,
+                                vHeaders.front().GetHash().ToString(), pto->id);
+                    }
+                    connman.PushMessage(pto, NetMsgType::HEADERS, vHeaders);
+                    state.pindexBestHeaderSent = pBestIndex;
+                } else
+                    fRevertToInv = true;
+            }
             if (fRevertToInv) {
                 // If falling back to using an inv, just try to inv the tip.
                 // The last entry in vBlockHashesToAnnounce was our tip at some point
@@ -2478,18 +3144,6 @@ bool SendMessages(CNode* pto, CConnman& connman, std::atomic<bool>& interruptMsg
                             pto->id, hashToAnnounce.ToString());
                     }
                 }
-            } else if (!vHeaders.empty()) {
-                if (vHeaders.size() > 1) {
-                    LogPrint("net", "%s: %u headers, range (%s, %s), to peer=%d\n", __func__,
-                            vHeaders.size(),
-                            vHeaders.front().GetHash().ToString(),
-                            vHeaders.back().GetHash().ToString(), pto->id);
-                } else {
-                    LogPrint("net", "%s: sending header %s to peer=%d\n", __func__,
-                            vHeaders.front().GetHash().ToString(), pto->id);
-                }
-                connman.PushMessage(pto, NetMsgType::HEADERS, vHeaders);
-                state.pindexBestHeaderSent = pBestIndex;
             }
             pto->vBlockHashesToAnnounce.clear();
         }
@@ -2499,12 +3153,12 @@ bool SendMessages(CNode* pto, CConnman& connman, std::atomic<bool>& interruptMsg
         //
         vector<CInv> vInv;
         vector<CInv> vInvWait;
+        bool fSendTrickle = pto->fWhitelisted;
+        if (pto->nNextInvSend < nNow) {
+            fSendTrickle = true;
+            pto->nNextInvSend = PoissonNextSend(nNow, AVG_INVENTORY_BROADCAST_INTERVAL);
+        }
         {
-            bool fSendTrickle = pto->fWhitelisted;
-            if (pto->nNextInvSend < nNow) {
-                fSendTrickle = true;
-                pto->nNextInvSend = PoissonNextSend(nNow, AVG_INVENTORY_BROADCAST_INTERVAL);
-            }
             LOCK(pto->cs_inventory);
             vInv.reserve(std::min<size_t>(1000, pto->vInventoryToSend.size()));
             vInvWait.reserve(pto->vInventoryToSend.size());
@@ -2513,23 +3167,12 @@ bool SendMessages(CNode* pto, CConnman& connman, std::atomic<bool>& interruptMsg
                 if (inv.type == MSG_TX && pto->filterInventoryKnown.contains(inv.hash))
                     continue;
 
-                // trickle out tx inv to protect privacy
-                if (inv.type == MSG_TX && !fSendTrickle)
+                // trickle out tx inv to protect privacy, 1/4 of tx invs blast to all immediately
+                if (inv.type == MSG_TX && !fSendTrickle && IsTrickledTxInv(inv.hash))
                 {
-                    // 1/4 of tx invs blast to all immediately
-                    static uint256 hashSalt;
-                    if (hashSalt.IsNull())
-                        hashSalt = GetRandHash();
-                    uint256 hashRand = ArithToUint256(UintToArith256(inv.hash) ^ UintToArith256(hashSalt));
-                    hashRand = Hash(BEGIN(hashRand), END(hashRand));
-                    bool fTrickleWait = ((UintToArith256(hashRand) & 3) != 0);
-
-                    if (fTrickleWait)
-                    {
-                        LogPrint("net", "SendMessages -- queued inv(vInvWait): %s  index=%d peer=%d\n", inv.ToString(), vInvWait.size(), pto->id);
-                        vInvWait.push_back(inv);
-                        continue;
-                    }
+                    LogPrint("net", "SendMessages -- queued inv(vInvWait): %s  index=%d peer=%d\n", inv.ToString(), vInvWait.size(), pto->id);
+                    vInvWait.push_back(inv);
+                    continue;
                 }
 
                 pto->filterInventoryKnown.insert(inv.hash);
@@ -2545,6 +3188,29 @@ bool SendMessages(CNode* pto, CConnman& connman, std::atomic<bool>& interruptMsg
             }
             pto->vInventoryToSend = vInvWait;
         }
+        if (fSendTrickle && pto->fRelayTxes) {
+            // Relayed transactions, batched and sorted once for all peers by the connman
+            std::vector<std::shared_ptr<const CTxRelayBatch> > vBatches;
+            LOCK2(pto->cs_filter, pto->cs_inventory);
+            pto->nTxRelayBatchSequence = connman.GetTxRelayBatches(pto->nTxRelayBatchSequence, vBatches);
+            BOOST_FOREACH(const std::shared_ptr<const CTxRelayBatch>& batch, vBatches) {
+                for (size_t i = 0; i < batch->vTx.size(); i++) {
+                    const CInv& inv = batch->vTx[i].first;
+                    if (inv.type == MSG_TX && pto->filterInventoryKnown.contains(inv.hash))
+                        continue;
+                    if (pto->pfilter && !pto->pfilter->IsRelevantAndUpdate(*batch->vTx[i].second))
+                        continue;
+                    pto->filterInventoryKnown.insert(inv.hash);
+                    vInv.push_back(inv);
+                    if (vInv.size() >= 1000)
+                    {
+                        LogPrint("net", "SendMessages -- pushing batched inv's: count=%d peer=%d\n", vInv.size(), pto->id);
+                        connman.PushMessage(pto, NetMsgType::INV, vInv);
+                        vInv.clear();
+                    }
+                }
+            }
+        }
         if (!vInv.empty()) {
             LogPrint("net", "SendMessages -- pushing tailing inv's: count=%d peer=%d\n", vInv.size(), pto->id);
             connman.PushMessage(pto, NetMsgType::INV, vInv);
@@ -2610,10 +3276,11 @@ bool SendMessages(CNode* pto, CConnman& connman, std::atomic<bool>& interruptMsg
         // Message: getdata (blocks)
         //
         vector<CInv> vGetData;
-        if (!pto->fDisconnect && !pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        int nBlocksInTransitLimit = GetBlocksInTransitLimit(&state);
+        if (!pto->fDisconnect && !pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < nBlocksInTransitLimit) {
             vector<CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller, consensusParams);
+            FindNextBlocksToDownload(pto->GetId(), nBlocksInTransitLimit - state.nBlocksInFlight, vToDownload, staller, consensusParams);
             BOOST_FOREACH(CBlockIndex *pindex, vToDownload) {
                 vGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
                 MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), consensusParams, pindex);
@@ -2621,9 +3288,14 @@ bool SendMessages(CNode* pto, CConnman& connman, std::atomic<bool>& interruptMsg
                     pindex->nHeight, pto->id);
             }
             if (state.nBlocksInFlight == 0 && staller != -1) {
-                if (State(staller)->nStallingSince == 0) {
-                    State(staller)->nStallingSince = nNow;
-                    LogPrint("net", "Stall started peer=%d\n", staller);
+                CNodeState *stateStaller = State(staller);
+                if (stateStaller->nStallingSince == 0) {
+                    stateStaller->nStallingSince = nNow;
+                    // Remember the stall, the staller gets fewer blocks and a smaller window until it
+                    // proves to be faster again
+                    stateStaller->nStallCount++;
+                    stateStaller->nBlockDownloadTime = std::max<int64_t>(stateStaller->nBlockDownloadTime * 2, 1000000LL * BLOCK_DOWNLOAD_TARGET_TIME / MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+                    LogPrint("net", "Stall started peer=%d (stalls=%d, inflight limit=%d)\n", staller, stateStaller->nStallCount, GetBlocksInTransitLimit(stateStaller));
                 }
             }
         }
@@ -2668,5 +3340,7 @@ public:
         // orphan transactions
         mapOrphanTransactions.clear();
         mapOrphanTransactionsByPrev.clear();
+        vOrphanList.clear();
+        nOrphanTxSize = 0;
     }
 } instance_of_cnetprocessingcleanup;
@@ -35,6 +35,12 @@ struct CNodeStateStats {
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    int nBlocksInFlight;
+    int nBlocksInTransitLimit;
+    int nBlockDownloadWindow;
+    int64_t nBlockDownloadTime;
+    int nBlocksDownloaded;
+    int nStallCount;
 };
 
 /** Get statistics from node state */
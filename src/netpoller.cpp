@@ -0,0 +1,297 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "netpoller.h"
+
+#include "netbase.h"
+
+#include <algorithm>
+#include <errno.h>
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+#ifdef HAVE_SYS_EVENT_H
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+class CSocketPollerSelect : public CSocketPoller
+{
+public:
+    const char* GetName() const { return "select"; }
+
+    bool CanWait(SOCKET hSocket) const { return IsSelectableSocket(hSocket); }
+
+    bool Wait(const InterestMap& mapInterest, int64_t nTimeoutMillis, ReadyMap& mapReady)
+    {
+        mapReady.clear();
+
+        fd_set fdsetRecv;
+        fd_set fdsetSend;
+        fd_set fdsetError;
+        FD_ZERO(&fdsetRecv);
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        SOCKET hSocketMax = 0;
+        bool have_fds = false;
+
+        for (InterestMap::const_iterator it = mapInterest.begin(); it != mapInterest.end(); ++it) {
+            if (!IsSelectableSocket(it->first))
+                continue;
+            if (it->second.nEvents & EVENT_RECV)
+                FD_SET(it->first, &fdsetRecv);
+            if (it->second.nEvents & EVENT_SEND)
+                FD_SET(it->first, &fdsetSend);
+            if (it->second.nEvents & EVENT_ERR)
+                FD_SET(it->first, &fdsetError);
+            hSocketMax = std::max(hSocketMax, it->first);
+            have_fds = true;
+        }
+
+        struct timeval timeout = MillisToTimeval(nTimeoutMillis);
+        int nSelect = select(have_fds ? hSocketMax + 1 : 0, &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+        if (nSelect == SOCKET_ERROR)
+            return false;
+
+        for (InterestMap::const_iterator it = mapInterest.begin(); nSelect > 0 && it != mapInterest.end(); ++it) {
+            if (!IsSelectableSocket(it->first))
+                continue;
+            unsigned int nEvents = 0;
+            if (FD_ISSET(it->first, &fdsetRecv))
+                nEvents |= EVENT_RECV;
+            if (FD_ISSET(it->first, &fdsetSend))
+                nEvents |= EVENT_SEND;
+            if (FD_ISSET(it->first, &fdsetError))
+                nEvents |= EVENT_ERR;
+            if (nEvents)
+                mapReady[it->first] = nEvents;
+        }
+        return true;
+    }
+};
+
+/** Backends keeping the sockets waited for in the kernel. Reconcile() walks the sockets of interest
+ *  and the registered ones side by side, both sorted, and passes on only what changed. */
+class CSocketPollerRegistered : public CSocketPoller
+{
+protected:
+    InterestMap mapRegistered;
+
+    /** Change the events hSocket is registered for from nOld to nNew, 0 meaning not registered */
+    virtual bool Register(SOCKET hSocket, unsigned int nOld, unsigned int nNew, bool fKnown) = 0;
+
+    void Reconcile(const InterestMap& mapInterest)
+    {
+        InterestMap::iterator itRegistered = mapRegistered.begin();
+        InterestMap::const_iterator itWanted = mapInterest.begin();
+        while (itRegistered != mapRegistered.end() || itWanted != mapInterest.end()) {
+            if (itWanted == mapInterest.end() || (itRegistered != mapRegistered.end() && itRegistered->first < itWanted->first)) {
+                // No longer of interest. Closed sockets are gone from the kernel's set already.
+                Register(itRegistered->first, itRegistered->second.nEvents, 0, true);
+                mapRegistered.erase(itRegistered++);
+            } else if (itRegistered == mapRegistered.end() || itWanted->first < itRegistered->first) {
+                // Fails if the socket got closed meanwhile, it'll be gone by the next call
+                if (Register(itWanted->first, 0, itWanted->second.nEvents, false))
+                    mapRegistered.insert(itRegistered, *itWanted);
+                ++itWanted;
+            } else {
+                if (itRegistered->second.nOwner != itWanted->second.nOwner) {
+                    // The descriptor got reused for another connection
+                    Register(itRegistered->first, itRegistered->second.nEvents, 0, true);
+                    if (Register(itWanted->first, 0, itWanted->second.nEvents, false)) {
+                        itRegistered->second = itWanted->second;
+                        ++itRegistered;
+                    } else {
+                        mapRegistered.erase(itRegistered++);
+                    }
+                } else if (itRegistered->second.nEvents != itWanted->second.nEvents) {
+                    if (Register(itRegistered->first, itRegistered->second.nEvents, itWanted->second.nEvents, true)) {
+                        itRegistered->second.nEvents = itWanted->second.nEvents;
+                        ++itRegistered;
+                    } else {
+                        mapRegistered.erase(itRegistered++);
+                    }
+                } else {
+                    ++itRegistered;
+                }
+                ++itWanted;
+            }
+        }
+    }
+};
+
+#ifdef HAVE_SYS_EPOLL_H
+/** Level triggered, so sockets not drained in one go are reported again like with select() */
+class CSocketPollerEpoll : public CSocketPollerRegistered
+{
+private:
+    int hEpoll;
+    std::vector<struct epoll_event> vEvents;
+
+    bool Register(SOCKET hSocket, unsigned int nOld, unsigned int nNew, bool fKnown)
+    {
+        struct epoll_event event;
+        event.events = ((nNew & EVENT_RECV) ? EPOLLIN : 0) | ((nNew & EVENT_SEND) ? EPOLLOUT : 0);
+        event.data.u64 = 0;
+        event.data.fd = hSocket;
+        // nNew is 0 only for sockets no longer of interest, those waited for errors alone have EVENT_ERR
+        int nOp = !fKnown ? EPOLL_CTL_ADD : (nNew ? EPOLL_CTL_MOD : EPOLL_CTL_DEL);
+        return epoll_ctl(hEpoll, nOp, hSocket, &event) == 0;
+    }
+
+public:
+    CSocketPollerEpoll() : hEpoll(epoll_create1(EPOLL_CLOEXEC)) {}
+    ~CSocketPollerEpoll()
+    {
+        if (hEpoll != -1)
+            close(hEpoll);
+    }
+
+    bool IsValid() const { return hEpoll != -1; }
+
+    const char* GetName() const { return "epoll"; }
+
+    bool CanWait(SOCKET hSocket) const { return true; }
+
+    bool Wait(const InterestMap& mapInterest, int64_t nTimeoutMillis, ReadyMap& mapReady)
+    {
+        mapReady.clear();
+
+        Reconcile(mapInterest);
+
+        vEvents.resize(std::max(mapRegistered.size(), (size_t)1));
+        int nEvents = epoll_wait(hEpoll, vEvents.data(), vEvents.size(), nTimeoutMillis);
+        if (nEvents < 0)
+            return errno == EINTR;
+
+        for (int i = 0; i < nEvents; i++) {
+            const struct epoll_event& event = vEvents[i];
+            unsigned int nReady = 0;
+            if (event.events & EPOLLIN)
+                nReady |= EVENT_RECV;
+            if (event.events & EPOLLOUT)
+                nReady |= EVENT_SEND;
+            if (event.events & (EPOLLERR | EPOLLHUP))
+                nReady |= EVENT_ERR;
+            mapReady[event.data.fd] |= nReady;
+        }
+        return true;
+    }
+};
+#endif
+
+#ifdef HAVE_SYS_EVENT_H
+/** Sockets get a read and a write filter each. Errors and hangups are reported through those,
+ *  so EVENT_ERR is only ever returned together with EVENT_RECV or EVENT_SEND. */
+class CSocketPollerKqueue : public CSocketPollerRegistered
+{
+private:
+    int hKqueue;
+    std::vector<struct kevent> vEvents;
+
+    void Control(SOCKET hSocket, short nFilter, unsigned short nFlags)
+    {
+        // Deleting filters of closed sockets fails, which is fine as they're gone already
+        struct kevent change;
+        EV_SET(&change, hSocket, nFilter, nFlags, 0, 0, 0);
+        kevent(hKqueue, &change, 1, NULL, 0, NULL);
+    }
+
+    bool Register(SOCKET hSocket, unsigned int nOld, unsigned int nNew, bool fKnown)
+    {
+        if ((nOld ^ nNew) & EVENT_RECV)
+            Control(hSocket, EVFILT_READ, (nNew & EVENT_RECV) ? EV_ADD : EV_DELETE);
+        if ((nOld ^ nNew) & EVENT_SEND)
+            Control(hSocket, EVFILT_WRITE, (nNew & EVENT_SEND) ? EV_ADD : EV_DELETE);
+        return true;
+    }
+
+public:
+    CSocketPollerKqueue() : hKqueue(kqueue()) {}
+    ~CSocketPollerKqueue()
+    {
+        if (hKqueue != -1)
+            close(hKqueue);
+    }
+
+    bool IsValid() const { return hKqueue != -1; }
+
+    const char* GetName() const { return "kqueue"; }
+
+    bool CanWait(SOCKET hSocket) const { return true; }
+
+    bool Wait(const InterestMap& mapInterest, int64_t nTimeoutMillis, ReadyMap& mapReady)
+    {
+        mapReady.clear();
+
+        Reconcile(mapInterest);
+
+        vEvents.resize(std::max(2 * mapRegistered.size(), (size_t)1));
+        struct timespec timeout;
+        timeout.tv_sec = nTimeoutMillis / 1000;
+        timeout.tv_nsec = (nTimeoutMillis % 1000) * 1000000;
+        int nEvents = kevent(hKqueue, NULL, 0, vEvents.data(), vEvents.size(), &timeout);
+        if (nEvents < 0)
+            return errno == EINTR;
+
+        for (int i = 0; i < nEvents; i++) {
+            const struct kevent& event = vEvents[i];
+            unsigned int nReady = 0;
+            if (event.filter == EVFILT_READ)
+                nReady |= EVENT_RECV;
+            if (event.filter == EVFILT_WRITE)
+                nReady |= EVENT_SEND;
+            if (event.flags & (EV_EOF | EV_ERROR))
+                nReady |= EVENT_ERR;
+            mapReady[(SOCKET)event.ident] |= nReady;
+        }
+        return true;
+    }
+};
+#endif
+
+std::vector<std::string> GetSocketPollerModes()
+{
+    std::vector<std::string> vModes;
+#ifdef HAVE_SYS_EPOLL_H
+    vModes.push_back("epoll");
+#endif
+#ifdef HAVE_SYS_EVENT_H
+    vModes.push_back("kqueue");
+#endif
+    vModes.push_back("select");
+    return vModes;
+}
+
+std::string GetDefaultSocketPollerMode()
+{
+    return GetSocketPollerModes().front();
+}
+
+CSocketPoller* CreateSocketPoller(const std::string& strMode)
+{
+    if (strMode == "select")
+        return new CSocketPollerSelect();
+#ifdef HAVE_SYS_EPOLL_H
+    if (strMode == "epoll") {
+        CSocketPollerEpoll* poller = new CSocketPollerEpoll();
+        if (poller->IsValid())
+            return poller;
+        delete poller;
+    }
+#endif
+#ifdef HAVE_SYS_EVENT_H
+    if (strMode == "kqueue") {
+        CSocketPollerKqueue* poller = new CSocketPollerKqueue();
+        if (poller->IsValid())
+            return poller;
+        delete poller;
+    }
+#endif
+    return NULL;
+}
@@ -0,0 +1,77 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NETPOLLER_H
+#define BITCOIN_NETPOLLER_H
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include "compat.h"
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/** Waits for sockets to become ready for receiving or sending.
+ *
+ *  Callers pass all sockets they are interested in on every call to Wait(). Backends keeping state
+ *  in the kernel (epoll, kqueue) only apply what changed since the previous call, so a wakeup costs
+ *  the kernel the ready sockets rather than all of them. select() is kept as the portable fallback.
+ */
+class CSocketPoller
+{
+public:
+    enum {
+        EVENT_RECV = (1 << 0),
+        EVENT_SEND = (1 << 1),
+        EVENT_ERR  = (1 << 2),
+    };
+
+    /** What to wait for on a socket. nOwner tells apart sockets getting the same descriptor after
+     *  the previous one was closed, as the kernel forgets closed descriptors by itself. */
+    struct Interest
+    {
+        int64_t nOwner;
+        unsigned int nEvents;
+
+        Interest() : nOwner(0), nEvents(0) {}
+        Interest(int64_t nOwnerIn, unsigned int nEventsIn) : nOwner(nOwnerIn), nEvents(nEventsIn) {}
+    };
+
+    typedef std::map<SOCKET, Interest> InterestMap;
+    typedef std::map<SOCKET, unsigned int> ReadyMap;
+
+    virtual ~CSocketPoller() {}
+
+    /** Name of the backend, as passed to -socketevents */
+    virtual const char* GetName() const = 0;
+
+    /** Whether the socket can be waited for at all. select() only takes sockets below FD_SETSIZE. */
+    virtual bool CanWait(SOCKET hSocket) const = 0;
+
+    /** Wait up to nTimeoutMillis for any socket of mapInterest to become ready and return the
+     *  events of the ready ones in mapReady. Returns false on failure, with the error in errno. */
+    virtual bool Wait(const InterestMap& mapInterest, int64_t nTimeoutMillis, ReadyMap& mapReady) = 0;
+
+    /** Events of hSocket in mapReady */
+    static unsigned int GetReadyEvents(const ReadyMap& mapReady, SOCKET hSocket)
+    {
+        ReadyMap::const_iterator it = mapReady.find(hSocket);
+        return it == mapReady.end() ? 0 : it->second;
+    }
+};
+
+/** Backends available on this system, the preferred one first */
+std::vector<std::string> GetSocketPollerModes();
+
+/** The backend -socketevents defaults to */
+std::string GetDefaultSocketPollerMode();
+
+/** Create the backend called strMode, returns NULL if it isn't available or can't be set up */
+CSocketPoller* CreateSocketPoller(const std::string& strMode);
+
+#endif // BITCOIN_NETPOLLER_H
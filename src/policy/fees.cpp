@@ -13,15 +13,14 @@
 #include "txmempool.h"
 #include "util.h"
 
+#include <algorithm>
+
 void TxConfirmStats::Initialize(std::vector<double>& defaultBuckets,
                                 unsigned int maxConfirms, double _decay, std::string _dataTypeString)
 {
     decay = _decay;
     dataTypeString = _dataTypeString;
-    for (unsigned int i = 0; i < defaultBuckets.size(); i++) {
-        buckets.push_back(defaultBuckets[i]);
-        bucketMap[defaultBuckets[i]] = i;
-    }
+    buckets = defaultBuckets;
     confAvg.resize(maxConfirms);
     curBlockConf.resize(maxConfirms);
     unconfTxs.resize(maxConfirms);
@@ -38,17 +37,23 @@ void TxConfirmStats::Initialize(std::vector<double>& defaultBuckets,
     avg.resize(buckets.size());
 }
 
+unsigned int TxConfirmStats::BucketIndex(double val) const
+{
+    // The last bucket is unbounded, so there always is one
+    return std::lower_bound(buckets.begin(), buckets.end(), val) - buckets.begin();
+}
+
 // Zero out the data for the current block
 void TxConfirmStats::ClearCurrent(unsigned int nBlockHeight)
 {
-    for (unsigned int j = 0; j < buckets.size(); j++) {
-        oldUnconfTxs[j] += unconfTxs[nBlockHeight%unconfTxs.size()][j];
-        unconfTxs[nBlockHeight%unconfTxs.size()][j] = 0;
-        for (unsigned int i = 0; i < curBlockConf.size(); i++)
-            curBlockConf[i][j] = 0;
-        curBlockTxCt[j] = 0;
-        curBlockVal[j] = 0;
-    }
+    std::vector<int>& unconfNow = unconfTxs[nBlockHeight%unconfTxs.size()];
+    for (unsigned int j = 0; j < buckets.size(); j++)
+        oldUnconfTxs[j] += unconfNow[j];
+    std::fill(unconfNow.begin(), unconfNow.end(), 0);
+    for (unsigned int i = 0; i < curBlockConf.size(); i++)
+        std::fill(curBlockConf[i].begin(), curBlockConf[i].end(), 0);
+    std::fill(curBlockTxCt.begin(), curBlockTxCt.end(), 0);
+    std::fill(curBlockVal.begin(), curBlockVal.end(), 0);
 }
 
 
@@ -57,7 +62,7 @@ void TxConfirmStats::Record(int blocksToConfirm, double val)
     // blocksToConfirm is 1-based
     if (blocksToConfirm < 1)
         return;
-    unsigned int bucketindex = bucketMap.lower_bound(val)->second;
+    unsigned int bucketindex = BucketIndex(val);
     for (size_t i = blocksToConfirm; i <= curBlockConf.size(); i++) {
         curBlockConf[i - 1][bucketindex]++;
     }
@@ -65,14 +70,23 @@ void TxConfirmStats::Record(int blocksToConfirm, double val)
     curBlockVal[bucketindex] += val;
 }
 
+// Decay one row of moving averages and add the current block's counts. Each
+// row is a contiguous bucket array, so the compiler can vectorize the loop.
+template <typename T>
+static void DecayRow(std::vector<double>& avgs, const std::vector<T>& cur, double decay)
+{
+    double* p = avgs.data();
+    const T* c = cur.data();
+    for (size_t j = 0, n = avgs.size(); j < n; j++)
+        p[j] = p[j] * decay + c[j];
+}
+
 void TxConfirmStats::UpdateMovingAverages()
 {
-    for (unsigned int j = 0; j < buckets.size(); j++) {
-        for (unsigned int i = 0; i < confAvg.size(); i++)
-            confAvg[i][j] = confAvg[i][j] * decay + curBlockConf[i][j];
-        avg[j] = avg[j] * decay + curBlockVal[j];
-        txCtAvg[j] = txCtAvg[j] * decay + curBlockTxCt[j];
-    }
+    for (unsigned int i = 0; i < confAvg.size(); i++)
+        DecayRow(confAvg[i], curBlockConf[i], decay);
+    DecayRow(avg, curBlockVal, decay);
+    DecayRow(txCtAvg, curBlockTxCt, decay);
 }
 
 // returns -1 on error conditions
@@ -216,13 +230,12 @@ void TxConfirmStats::Read(CAutoFile& filein)
             throw std::runtime_error("Corrupt estimates file. Mismatch in fee/pri conf average bucket count");
     }
     // Now that we've processed the entire fee estimate data file and not
-    // thrown any errors, we can copy it to our data structures
+    // thrown any errors, we can move it into our data structures
     decay = fileDecay;
-    buckets = fileBuckets;
-    avg = fileAvg;
-    confAvg = fileConfAvg;
-    txCtAvg = fileTxCtAvg;
-    bucketMap.clear();
+    buckets.swap(fileBuckets);
+    avg.swap(fileAvg);
+    confAvg.swap(fileConfAvg);
+    txCtAvg.swap(fileTxCtAvg);
 
     // Resize the current block variables which aren't stored in the data file
     // to match the number of confirms and buckets
@@ -239,16 +252,13 @@ void TxConfirmStats::Read(CAutoFile& filein)
     }
     oldUnconfTxs.resize(buckets.size());
 
-    for (unsigned int i = 0; i < buckets.size(); i++)
-        bucketMap[buckets[i]] = i;
-
     LogPrint("estimatefee", "Reading estimates: %u %s buckets counting confirms up to %u blocks\n",
              numBuckets, dataTypeString, maxConfirms);
 }
 
 unsigned int TxConfirmStats::NewTx(unsigned int nBlockHeight, double val)
 {
-    unsigned int bucketindex = bucketMap.lower_bound(val)->second;
+    unsigned int bucketindex = BucketIndex(val);
     unsigned int blockIndex = nBlockHeight % unconfTxs.size();
     unconfTxs[blockIndex][bucketindex]++;
     LogPrint("estimatefee", "adding to %s", dataTypeString);
@@ -323,6 +333,8 @@ CBlockPolicyEstimator::CBlockPolicyEstimator(const CFeeRate& _minRelayFee)
     feeLikely = CFeeRate(INF_FEERATE);
     priUnlikely = 0;
     priLikely = INF_PRIORITY;
+
+    ClearEstimateCache();
 }
 
 bool CBlockPolicyEstimator::isFeeDataPoint(const CFeeRate &fee, double pri)
@@ -446,6 +458,7 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
         return;
     }
     nBestSeenHeight = nBlockHeight;
+    ClearEstimateCache();
 
     // Only want to be updating estimates when our blockchain is synced,
     // otherwise we'll miscalculate how many blocks its taking to get included.
@@ -492,6 +505,20 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
              entries.size(), mapMemPoolTxs.size());
 }
 
+void CBlockPolicyEstimator::ClearEstimateCache()
+{
+    vFeeEstimateCache.assign(feeStats.GetMaxConfirms() + 1, ESTIMATE_NOT_CACHED);
+    vPriEstimateCache.assign(priStats.GetMaxConfirms() + 1, ESTIMATE_NOT_CACHED);
+}
+
+double CBlockPolicyEstimator::CachedMedianVal(TxConfirmStats& stats, std::vector<double>& vCache, int confTarget, double sufficientTxVal)
+{
+    double& median = vCache[confTarget];
+    if (median == ESTIMATE_NOT_CACHED)
+        median = stats.EstimateMedianVal(confTarget, sufficientTxVal, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+    return median;
+}
+
 CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget)
 {
     // Return failure if trying to analyze a target we're not tracking
@@ -499,7 +526,7 @@ CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget)
     if (confTarget <= 1 || (unsigned int)confTarget > feeStats.GetMaxConfirms())
         return CFeeRate(0);
 
-    double median = feeStats.EstimateMedianVal(confTarget, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+    double median = CachedMedianVal(feeStats, vFeeEstimateCache, confTarget, SUFFICIENT_FEETXS);
 
     if (median < 0)
         return CFeeRate(0);
@@ -521,7 +548,7 @@ CFeeRate CBlockPolicyEstimator::estimateSmartFee(int confTarget, int *answerFoun
 
     double median = -1;
     while (median < 0 && (unsigned int)confTarget <= feeStats.GetMaxConfirms()) {
-        median = feeStats.EstimateMedianVal(confTarget++, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+        median = CachedMedianVal(feeStats, vFeeEstimateCache, confTarget++, SUFFICIENT_FEETXS);
     }
 
     if (answerFoundAtTarget)
@@ -544,7 +571,7 @@ double CBlockPolicyEstimator::estimatePriority(int confTarget)
     if (confTarget <= 0 || (unsigned int)confTarget > priStats.GetMaxConfirms())
         return -1;
 
-    return priStats.EstimateMedianVal(confTarget, SUFFICIENT_PRITXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+    return CachedMedianVal(priStats, vPriEstimateCache, confTarget, SUFFICIENT_PRITXS);
 }
 
 double CBlockPolicyEstimator::estimateSmartPriority(int confTarget, int *answerFoundAtTarget, const CTxMemPool& pool)
@@ -562,7 +589,7 @@ double CBlockPolicyEstimator::estimateSmartPriority(int confTarget, int *answerF
 
     double median = -1;
     while (median < 0 && (unsigned int)confTarget <= priStats.GetMaxConfirms()) {
-        median = priStats.EstimateMedianVal(confTarget++, SUFFICIENT_PRITXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+        median = CachedMedianVal(priStats, vPriEstimateCache, confTarget++, SUFFICIENT_PRITXS);
     }
 
     if (answerFoundAtTarget)
@@ -585,6 +612,7 @@ void CBlockPolicyEstimator::Read(CAutoFile& filein)
     feeStats.Read(filein);
     priStats.Read(filein);
     nBestSeenHeight = nFileBestSeenHeight;
+    ClearEstimateCache();
 }
 
 FeeFilterRounder::FeeFilterRounder(const CFeeRate& minIncrementalFee)
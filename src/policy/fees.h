@@ -80,8 +80,7 @@ class TxConfirmStats
 {
 private:
     //Define the buckets we will group transactions into (both fee buckets and priority buckets)
-    std::vector<double> buckets;              // The upper-bound of the range for the bucket (inclusive)
-    std::map<double, unsigned int> bucketMap; // Map of bucket upper-bound to index into all vectors by bucket
+    std::vector<double> buckets;              // The upper-bound of the range for the bucket (inclusive), ascending
 
     // For each bucket X:
     // Count the total # of txs in each bucket
@@ -115,6 +114,9 @@ private:
     // transactions still unconfirmed after MAX_CONFIRMS for each bucket
     std::vector<int> oldUnconfTxs;
 
+    /** Index of the bucket a fee or priority falls in */
+    unsigned int BucketIndex(double val) const;
+
 public:
     /**
      * Initialize the data structures.  This is called by BlockPolicyEstimator's
@@ -193,6 +195,9 @@ static const double SUFFICIENT_FEETXS = 1;
 /** Require only an avg of 1 tx every 5 blocks in the combined pri bucket (way less pri txs) */
 static const double SUFFICIENT_PRITXS = .2;
 
+/** Marks a confirmation target whose estimate has not been computed since the last block */
+static const double ESTIMATE_NOT_CACHED = -2;
+
 // Minimum and Maximum values for tracking fees and priorities
 static const double MIN_FEERATE = 10;
 static const double MAX_FEERATE = 1e7;
@@ -285,6 +290,13 @@ private:
     /** Breakpoints to help determine whether a transaction was confirmed by priority or Fee */
     CFeeRate feeLikely, feeUnlikely;
     double priLikely, priUnlikely;
+
+    /** Estimates by confirmation target, computed on first use after each block.
+     *  Mempool arrivals in between only count towards the next block's answers. */
+    std::vector<double> vFeeEstimateCache, vPriEstimateCache;
+
+    void ClearEstimateCache();
+    double CachedMedianVal(TxConfirmStats& stats, std::vector<double>& vCache, int confTarget, double sufficientTxVal);
 };
 
 class FeeFilterRounder
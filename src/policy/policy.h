@@ -27,7 +27,7 @@ static const unsigned int MAX_STANDARD_TX_WEIGHT = 300000;
 /** Maximum number of signature check operations in an IsStandard() P2SH script */
 static const unsigned int MAX_P2SH_SIGOPS = 15;
 /** The maximum number of sigops we're willing to relay/mine in a single tx */
-static unsigned int maxStandardTxSigops = maxBlockSigops/5;
+extern unsigned int maxStandardTxSigops;
 /** The maximum number of sigops we're willing to relay/mine in a single tx */
 static const unsigned int MAX_STANDARD_TX_SIGOPS_COST = MAX_BLOCK_SIGOPS_COST/5;
 /** Default for -maxmempool, maximum megabytes of mempool memory usage */
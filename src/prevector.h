@@ -238,6 +238,10 @@ public:
         }
     }
 
+    prevector(prevector<N, T, Size, Diff>&& other) : _size(0) {
+        swap(other);
+    }
+
     prevector(const prevector<N, T, Size, Diff>& other) : _size(0) {
         change_capacity(other.size());
         const_iterator it = other.begin();
@@ -248,6 +252,11 @@ public:
         }
     }
 
+    prevector& operator=(prevector<N, T, Size, Diff>&& other) {
+        swap(other);
+        return *this;
+    }
+
     prevector& operator=(const prevector<N, T, Size, Diff>& other) {
         if (&other == this) {
             return *this;
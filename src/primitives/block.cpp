@@ -40,3 +40,58 @@ int64_t GetBlockWeight(const CBlock& block)
     // weight = (stripped_size * 3) + total_size.
     return ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS) * (WITNESS_SCALE_FACTOR - 1) + ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
 }
+
+CBlockHashCache::CBlockHashCache(const CBlockHashCache& other)
+{
+    std::lock_guard<std::mutex> lock(other.cs);
+    fValid = other.fValid;
+    memcpy(vchHeader, other.vchHeader, sizeof(vchHeader));
+    hash = other.hash;
+}
+
+CBlockHashCache& CBlockHashCache::operator=(const CBlockHashCache& other)
+{
+    if (this != &other) {
+        std::unique_lock<std::mutex> lock1(cs, std::defer_lock);
+        std::unique_lock<std::mutex> lock2(other.cs, std::defer_lock);
+        std::lock(lock1, lock2);
+        fValid = other.fValid;
+        memcpy(vchHeader, other.vchHeader, sizeof(vchHeader));
+        hash = other.hash;
+    }
+    return *this;
+}
+
+uint256 CBlockHashCache::Get(const CBlockHeader& header) const
+{
+    const unsigned char* pheader = (const unsigned char*)BEGIN(header.nVersion);
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        if (fValid && memcmp(vchHeader, pheader, sizeof(vchHeader)) == 0)
+            return hash;
+    }
+    uint256 hashNew = header.GetHash();
+    std::lock_guard<std::mutex> lock(cs);
+    memcpy(vchHeader, pheader, sizeof(vchHeader));
+    hash = hashNew;
+    fValid = true;
+    return hashNew;
+}
+
+void CBlockHashCache::Invalidate()
+{
+    std::lock_guard<std::mutex> lock(cs);
+    fValid = false;
+}
+
+std::vector<uint256> GetBlockHeaderHashes(const std::vector<CBlockHeader>& headers)
+{
+    // Laid out back to back the same way CBlockHeader::GetHash reads them
+    std::vector<unsigned char> vData(80 * headers.size());
+    for (size_t i = 0; i < headers.size(); i++)
+        memcpy(&vData[80 * i], BEGIN(headers[i].nVersion), 80);
+    std::vector<uint256> vHashes(headers.size());
+    if (!headers.empty())
+        Keccak256_80Many(vHashes[0].begin(), &vData[0], headers.size());
+    return vHashes;
+}
@@ -12,6 +12,9 @@
 #include "utilstrencodings.h"
 #include "hash.h"
 
+#include <mutex>
+#include <stddef.h>
+
 /** Nodes collect new transactions into a block, hash them into a hash tree,
  * and scan through nonce values to make the block's hash satisfy proof-of-work
  * requirements.  When they solve the proof-of-work, they broadcast the block
@@ -37,16 +40,20 @@ public:
         SetNull();
     }
 
-    ADD_SERIALIZE_METHODS
+    ADD_SERIALIZE_METHODS_FIXED_SIZE(80)
 
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+#ifndef WORDS_BIGENDIAN
+        READWRITE(FLATRANGE(this->nVersion, nNonce));
+#else
         READWRITE(this->nVersion);
         READWRITE(hashPrevBlock);
         READWRITE(hashMerkleRoot);
         READWRITE(nTime);
         READWRITE(nBits);
         READWRITE(nNonce);
+#endif
     }
 
     void SetNull()
@@ -66,7 +73,10 @@ public:
 
     uint256 GetHash() const
     {
-        return HashKeccak(BEGIN(nVersion), END(nNonce));
+        // nVersion through nNonce are the 80 serialized header bytes, back to back in memory
+        uint256 hash;
+        Keccak256_80(hash.begin(), (const unsigned char*)BEGIN(nVersion));
+        return hash;
     }
 
     int64_t GetBlockTime() const
@@ -75,9 +85,37 @@ public:
     }
 };
 
+static_assert(offsetof(CBlockHeader, nNonce) + sizeof(unsigned int) - offsetof(CBlockHeader, nVersion) == CBlockHeader::SERIALIZED_SIZE,
+              "the serialized header fields must be back to back in memory");
+
+
+/**
+ * A block's hash, kept together with the header bytes it was computed from. Those are compared
+ * on every lookup, so changing any header field (as the miner does with nNonce) recomputes the
+ * hash instead of returning a stale one. Safe to use from several threads on a shared block.
+ */
+class CBlockHashCache
+{
+private:
+    mutable std::mutex cs;
+    mutable bool fValid;
+    mutable unsigned char vchHeader[80];
+    mutable uint256 hash;
+
+public:
+    CBlockHashCache() : fValid(false) {}
+    CBlockHashCache(const CBlockHashCache& other);
+    CBlockHashCache& operator=(const CBlockHashCache& other);
+
+    uint256 Get(const CBlockHeader& header) const;
+    void Invalidate();
+};
 
 class CBlock : public CBlockHeader
 {
+private:
+    CBlockHashCache hashCache;
+
 public:
     // network and disk
     std::vector<CTransaction> vtx;
@@ -87,7 +125,6 @@ public:
     mutable std::vector<CTxOut> voutSmartNodes;
     mutable std::vector<CTxOut> voutSmartHives;
     mutable std::vector<CTxOut> voutSmartRewards;
-    mutable std::vector<uint256> vMerkleTree;
 
     CBlock()
     {
@@ -116,6 +153,13 @@ public:
         voutSmartNodes.clear();
         voutSmartRewards.clear();
         fChecked = false;
+        hashCache.Invalidate();
+    }
+
+    /** Hides CBlockHeader::GetHash, computing the hash only once per header contents */
+    uint256 GetHash() const
+    {
+        return hashCache.Get(*this);
     }
 
     CBlockHeader GetBlockHeader() const
@@ -142,27 +186,6 @@ public:
             hashMerkleRoot.ToString().c_str(),
             nTime, nBits, nNonce);        
     }
-
-    uint256 BuildMerkleTree() const
-    {
-        vMerkleTree.clear();
-        for (unsigned int i = 0; i < vtx.size(); ++i){
-            vMerkleTree.push_back(vtx[i].GetHash());
-        }
-        int j = 0;
-        for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
-        {
-            for (int i = 0; i < nSize; i += 2)
-            {
-                int i2 = std::min(i+1, nSize-1);
-//                vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
-                vMerkleTree.push_back(Hash4(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
-                                           BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
-            }
-            j += nSize;
-        }
-        return (vMerkleTree.empty() ? uint256() : vMerkleTree.back());
-    }
 };
 
 /** Describes a place in the block chain to another node such that if the
@@ -203,4 +226,7 @@ struct CBlockLocator
 /** Compute the consensus-critical block weight (see BIP 141). */
 int64_t GetBlockWeight(const CBlock& tx);
 
+/** Compute the hashes of a run of headers, several at a time where the CPU allows it. */
+std::vector<uint256> GetBlockHeaderHashes(const std::vector<CBlockHeader>& headers);
+
 #endif // BITCOIN_PRIMITIVES_BLOCK_H
@@ -11,6 +11,9 @@
 #include "serialize.h"
 #include "uint256.h"
 
+#include <memory>
+#include <stddef.h>
+
 static const int SERIALIZE_TRANSACTION_NO_WITNESS = 0x40000000;
 
 static const int WITNESS_SCALE_FACTOR = 4;
@@ -24,12 +27,16 @@ public:
     COutPoint() { SetNull(); }
     COutPoint(uint256 hashIn, uint32_t nIn) { hash = hashIn; n = nIn; }
 
-    ADD_SERIALIZE_METHODS;
+    ADD_SERIALIZE_METHODS_FIXED_SIZE(36)
 
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+#ifndef WORDS_BIGENDIAN
+        READWRITE(FLATRANGE(hash, n));
+#else
         READWRITE(hash);
         READWRITE(n);
+#endif
     }
 
     void SetNull() { hash.SetNull(); n = (uint32_t) -1; }
@@ -55,6 +62,9 @@ public:
     std::string ToStringShort() const;
 };
 
+static_assert(offsetof(COutPoint, n) + sizeof(uint32_t) == COutPoint::SERIALIZED_SIZE,
+              "the serialized outpoint fields must be back to back in memory");
+
 /** An input of a transaction.  It contains the location of the previous
  * transaction's output that it claims and a signature that matches the
  * output's public key.
@@ -378,6 +388,8 @@ class CTransaction
 private:
     /** Memory only. */
     const uint256 hash;
+    /** Memory only. Serialized size without witness data, cached along with the hash. */
+    const unsigned int nBaseSize;
 
 public:
     // Default transaction version.
@@ -407,8 +419,13 @@ public:
 
     /** Convert a CMutableTransaction into a CTransaction. */
     CTransaction(const CMutableTransaction &tx);
+    CTransaction(CMutableTransaction &&tx);
+
+    CTransaction(const CTransaction &tx) = default;
+    CTransaction(CTransaction &&tx);
 
     CTransaction& operator=(const CTransaction& tx);
+    CTransaction& operator=(CTransaction&& tx);
 
     ADD_SERIALIZE_METHODS;
 
@@ -427,6 +444,15 @@ public:
     const uint256& GetHash() const {
         return hash;
     }
+
+    /** Serialized size without witness data, the same for the network and disk formats */
+    unsigned int GetBaseSize() const {
+        return nBaseSize;
+    }
+
+    /** Serialized size including witness data, ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION) */
+    unsigned int GetTotalSize() const;
+
     int64_t GetMinFee(unsigned int nBlockSize, bool fAllowFree = true, enum GetMinFee_mode mode = GMF_BLOCK) const ;
 
     // Compute a hash that includes both transaction and witness data
@@ -500,6 +526,27 @@ struct CMutableTransaction
     } 
 };
 
+/** A transaction shared by the structures holding it, e.g. the mempool, relay and recent blocks, instead of copied into each of them. */
+typedef std::shared_ptr<const CTransaction> CTransactionRef;
+
+template <typename Tx>
+static inline CTransactionRef MakeTransactionRef(Tx&& txIn) { return std::make_shared<const CTransaction>(std::forward<Tx>(txIn)); }
+
+/** Serialized like the transaction itself, the generic shared_ptr serialization is reserved for auxpow headers.
+ *  Declared in serialize.h so containers of them find these overloads. */
+inline unsigned int GetSerializeSize(const CTransactionRef& tx, int nType, int nVersion) { return tx->GetSerializeSize(nType, nVersion); }
+
+template <typename Stream>
+inline void Serialize(Stream& os, const CTransactionRef& tx, int nType, int nVersion) { tx->Serialize(os, nType, nVersion); }
+
+template <typename Stream>
+inline void Unserialize(Stream& is, CTransactionRef& tx, int nType, int nVersion)
+{
+    CTransaction txNew;
+    txNew.Unserialize(is, nType, nVersion);
+    tx = MakeTransactionRef(std::move(txNew));
+}
+
 /** Compute the weight of a transaction, as defined by BIP 141 */
 int64_t GetTransactionWeight(const CTransaction &tx);
 
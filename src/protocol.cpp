@@ -257,6 +257,11 @@ CInv::CInv(const std::string& strType, const uint256& hashIn)
     hash = hashIn;
 }
 
+bool operator==(const CInv& a, const CInv& b)
+{
+    return a.type == b.type && a.hash == b.hash;
+}
+
 bool operator<(const CInv& a, const CInv& b)
 {
     return (a.type < b.type || (a.type == b.type && a.hash < b.hash));
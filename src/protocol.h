@@ -365,6 +365,7 @@ public:
     }
 
     friend bool operator<(const CInv& a, const CInv& b);
+    friend bool operator==(const CInv& a, const CInv& b);
 
     bool IsKnownType() const;
     const char* GetCommand() const;
@@ -7,10 +7,68 @@
 #include <secp256k1.h>
 #include <secp256k1_recovery.h>
 
+#include <mutex>
+#include <string.h>
+
 namespace
 {
 /* Global secp256k1_context object used for verification. */
 secp256k1_context* secp256k1_context_verify = NULL;
+
+/** Parsed forms of recently verified public keys. Parsing a compressed key takes a square root,
+ *  which is a good part of verifying a signature when the inputs of a transaction share their key,
+ *  e.g. payouts being consolidated. Direct mapped by the x coordinate, a key replaces whatever key
+ *  was in its slot before. The slots are locked in stripes shared by the script check threads. */
+class CParsedPubKeyCache
+{
+private:
+    static const size_t SLOTS = 4096;
+    static const size_t LOCKS = 64;
+
+    struct Slot {
+        unsigned char vch[65];
+        unsigned int nSize;
+        secp256k1_pubkey pubkey;
+    };
+
+    Slot slots[SLOTS];
+    std::mutex locks[LOCKS];
+
+    static size_t GetIndex(const unsigned char* vch)
+    {
+        // the first byte is the key type, the x coordinate that follows is as good as random
+        size_t nIndex;
+        memcpy(&nIndex, vch + 1, sizeof(nIndex));
+        return nIndex % SLOTS;
+    }
+
+public:
+    CParsedPubKeyCache() { memset(slots, 0, sizeof(slots)); }
+
+    bool Parse(secp256k1_pubkey& pubkey, const unsigned char* vch, unsigned int nSize)
+    {
+        size_t nIndex = GetIndex(vch);
+        Slot& slot = slots[nIndex];
+        {
+            std::lock_guard<std::mutex> lock(locks[nIndex % LOCKS]);
+            if (slot.nSize == nSize && memcmp(slot.vch, vch, nSize) == 0) {
+                pubkey = slot.pubkey;
+                return true;
+            }
+        }
+
+        if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, vch, nSize))
+            return false;
+
+        std::lock_guard<std::mutex> lock(locks[nIndex % LOCKS]);
+        memcpy(slot.vch, vch, nSize);
+        slot.nSize = nSize;
+        slot.pubkey = pubkey;
+        return true;
+    }
+};
+
+CParsedPubKeyCache parsedPubKeyCache;
 }
 
 /** This function is taken from the libsecp256k1 distribution and implements
@@ -169,7 +227,7 @@ bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchS
         return false;
     secp256k1_pubkey pubkey;
     secp256k1_ecdsa_signature sig;
-    if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, &(*this)[0], size())) {
+    if (!parsedPubKeyCache.Parse(pubkey, &(*this)[0], size())) {
         return false;
     }
     if (vchSig.size() == 0) {
@@ -30,8 +30,6 @@
 class CBlockIndex;
 
 static const int64_t nClientStartupTime = GetTime();
-static int64_t nLastHeaderTipUpdateNotification = 0;
-static int64_t nLastBlockTipUpdateNotification = 0;
 
 ClientModel::ClientModel(OptionsModel *optionsModel, QObject *parent) :
     QObject(parent),
@@ -39,7 +37,11 @@ ClientModel::ClientModel(OptionsModel *optionsModel, QObject *parent) :
     peerTableModel(0),
     cachedSmartnodeCountString(""),
     banTableModel(0),
-    pollTimer(0)
+    pollTimer(0),
+    pendingChanges(0),
+    pendingBlockTip(0),
+    pendingHeaderTip(0),
+    pendingNumConnections(0)
 {
     cachedBestHeaderHeight = -1;
     cachedBestHeaderTime = -1;
@@ -54,6 +56,11 @@ ClientModel::ClientModel(OptionsModel *optionsModel, QObject *parent) :
     // no need to update as frequent as data for balances/txes/blocks
     pollMnTimer->start(MODEL_UPDATE_DELAY * 4);
 
+    stateTimer = new QTimer(this);
+    stateTimer->setSingleShot(true);
+    connect(stateTimer, SIGNAL(timeout()), this, SLOT(flushState()));
+    lastStateUpdate.start();
+
     subscribeToCoreSignals();
 }
 
@@ -187,9 +194,60 @@ void ClientModel::updateMnTimer()
     }
 }
 
-void ClientModel::updateNumConnections(int numConnections)
+void ClientModel::queueStateChange(unsigned int change, const CBlockIndex *pindex, int numConnections)
+{
+    bool fFirst;
+    {
+        QMutexLocker locker(&pendingMutex);
+        fFirst = pendingChanges == 0;
+        pendingChanges |= change;
+        if (change == STATE_BLOCK_TIP)
+            pendingBlockTip = pindex;
+        else if (change == STATE_HEADER_TIP)
+            pendingHeaderTip = pindex;
+        else if (change == STATE_NUM_CONNECTIONS)
+            pendingNumConnections = numConnections;
+    }
+    // Later changes ride along with the update already on its way
+    if (fFirst)
+        QMetaObject::invokeMethod(this, "updateState", Qt::QueuedConnection);
+}
+
+void ClientModel::updateState()
+{
+    if (stateTimer->isActive())
+        return;
+    qint64 nSinceLast = lastStateUpdate.elapsed();
+    if (nSinceLast < MODEL_UPDATE_DELAY) {
+        stateTimer->start(MODEL_UPDATE_DELAY - nSinceLast);
+        return;
+    }
+    flushState();
+}
+
+void ClientModel::flushState()
 {
-    Q_EMIT numConnectionsChanged(numConnections);
+    unsigned int changes;
+    const CBlockIndex *pBlockTip, *pHeaderTip;
+    int numConnections;
+    {
+        QMutexLocker locker(&pendingMutex);
+        changes = pendingChanges;
+        pBlockTip = pendingBlockTip;
+        pHeaderTip = pendingHeaderTip;
+        numConnections = pendingNumConnections;
+        pendingChanges = 0;
+    }
+    lastStateUpdate.restart();
+
+    if (changes & STATE_NUM_CONNECTIONS)
+        Q_EMIT numConnectionsChanged(numConnections);
+    if (changes & STATE_HEADER_TIP)
+        Q_EMIT numBlocksChanged(pHeaderTip->nHeight, QDateTime::fromTime_t(pHeaderTip->GetBlockTime()), getVerificationProgress(pHeaderTip), true);
+    if (changes & STATE_BLOCK_TIP)
+        Q_EMIT numBlocksChanged(pBlockTip->nHeight, QDateTime::fromTime_t(pBlockTip->GetBlockTime()), getVerificationProgress(pBlockTip), false);
+    if (changes & STATE_SMARTREWARDS)
+        Q_EMIT SmartRewardsUpdated();
 }
 
 void ClientModel::updateNetworkActive(bool networkActive)
@@ -301,8 +359,7 @@ static void ShowProgress(ClientModel *clientmodel, const std::string &title, int
 static void NotifyNumConnectionsChanged(ClientModel *clientmodel, int newNumConnections)
 {
     // Too noisy: qDebug() << "NotifyNumConnectionsChanged: " + QString::number(newNumConnections);
-    QMetaObject::invokeMethod(clientmodel, "updateNumConnections", Qt::QueuedConnection,
-                              Q_ARG(int, newNumConnections));
+    clientmodel->queueStateChange(ClientModel::STATE_NUM_CONNECTIONS, 0, newNumConnections);
 }
 
 static void NotifyNetworkActiveChanged(ClientModel *clientmodel, bool networkActive)
@@ -327,30 +384,14 @@ static void BannedListChanged(ClientModel *clientmodel)
 
 static void BlockTipChanged(ClientModel *clientmodel, bool initialSync, const CBlockIndex *pIndex, bool fHeader)
 {
-    // lock free async UI updates in case we have a new block tip
-    // during initial sync, only update the UI if the last update
-    // was > 250ms (MODEL_UPDATE_DELAY) ago
-    int64_t now = 0;
-    if (initialSync)
-        now = GetTimeMillis();
-
-    int64_t& nLastUpdateNotification = fHeader ? nLastHeaderTipUpdateNotification : nLastBlockTipUpdateNotification;
-
     if (fHeader) {
         // cache best headers time and height to reduce future cs_main locks
         clientmodel->cachedBestHeaderHeight = pIndex->nHeight;
         clientmodel->cachedBestHeaderTime = pIndex->GetBlockTime();
     }
-    // if we are in-sync, update the UI regardless of last update time
-    if (!initialSync || now - nLastUpdateNotification > MODEL_UPDATE_DELAY) {
-        //pass a async signal to the UI thread
-        QMetaObject::invokeMethod(clientmodel, "numBlocksChanged", Qt::QueuedConnection,
-                                  Q_ARG(int, pIndex->nHeight),
-                                  Q_ARG(QDateTime, QDateTime::fromTime_t(pIndex->GetBlockTime())),
-                                  Q_ARG(double, clientmodel->getVerificationProgress(pIndex)),
-                                  Q_ARG(bool, fHeader));
-        nLastUpdateNotification = now;
-    }
+    // lock free async UI update, coalesced with the other tips that come in
+    // before the UI gets to show them, so a sync shows the latest tip only
+    clientmodel->queueStateChange(fHeader ? ClientModel::STATE_HEADER_TIP : ClientModel::STATE_BLOCK_TIP, pIndex);
 }
 
 static void NotifyAdditionalDataSyncProgressChanged(ClientModel *clientmodel, double nSyncProgress)
@@ -361,8 +402,7 @@ static void NotifyAdditionalDataSyncProgressChanged(ClientModel *clientmodel, do
 
 static void NotifySmartRewardsUI(ClientModel *clientmodel)
 {
-    //pass a async signal to the UI thread
-    QMetaObject::invokeMethod(clientmodel, "SmartRewardsUpdated", Qt::QueuedConnection);
+    clientmodel->queueStateChange(ClientModel::STATE_SMARTREWARDS);
 }
 
 void ClientModel::subscribeToCoreSignals()
@@ -7,6 +7,8 @@
 
 #include <QObject>
 #include <QDateTime>
+#include <QElapsedTimer>
+#include <QMutex>
 
 #include <atomic>
 
@@ -88,6 +90,18 @@ public:
     // caches for the best header
     mutable std::atomic<int> cachedBestHeaderHeight;
     mutable std::atomic<int64_t> cachedBestHeaderTime;
+
+    //! Kinds of core state change that are coalesced before they reach the GUI
+    enum StateChange {
+        STATE_BLOCK_TIP       = (1U << 0),
+        STATE_HEADER_TIP      = (1U << 1),
+        STATE_NUM_CONNECTIONS = (1U << 2),
+        STATE_SMARTREWARDS    = (1U << 3),
+    };
+
+    //! Record a state change from a core thread. A burst of changes reaches
+    //! the GUI as one update, at most every MODEL_UPDATE_DELAY milliseconds.
+    void queueStateChange(unsigned int change, const CBlockIndex *pindex = 0, int numConnections = 0);
     
 private:
     OptionsModel *optionsModel;
@@ -98,6 +112,16 @@ private:
     QTimer *pollTimer;
     QTimer *pollMnTimer;
 
+    //! State changes not shown yet, and the latest values they carry
+    QMutex pendingMutex;
+    unsigned int pendingChanges;
+    const CBlockIndex *pendingBlockTip;
+    const CBlockIndex *pendingHeaderTip;
+    int pendingNumConnections;
+    //! Delays showing the pending changes until MODEL_UPDATE_DELAY passed since the last time
+    QTimer *stateTimer;
+    QElapsedTimer lastStateUpdate;
+
     void subscribeToCoreSignals();
     void unsubscribeFromCoreSignals();
 
@@ -122,7 +146,9 @@ Q_SIGNALS:
 public Q_SLOTS:
     void updateTimer();
     void updateMnTimer();
-    void updateNumConnections(int numConnections);
+    //! Show the pending state changes now, or once MODEL_UPDATE_DELAY passed since the last time
+    void updateState();
+    void flushState();
     void updateNetworkActive(bool networkActive);
     void updateAlert();
     void updateBanlist();
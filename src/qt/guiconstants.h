@@ -7,6 +7,8 @@
 
 /* Milliseconds between model updates */
 static const int MODEL_UPDATE_DELAY = 250;
+/* Milliseconds between balance updates for new blocks alone during initial block download */
+static const int MODEL_SYNC_BALANCE_UPDATE_DELAY = 2000;
 
 /* AskPassphraseDialog -- Maximum passphrase length */
 static const int MAX_PASSPHRASE_SIZE = 1024;
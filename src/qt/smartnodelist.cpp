@@ -279,13 +279,10 @@ void SmartnodeList::updateNodeList()
     ui->tableWidgetSmartnodes->setSortingEnabled(false);
     ui->tableWidgetSmartnodes->clearContents();
     ui->tableWidgetSmartnodes->setRowCount(0);
-    std::map<COutPoint, CSmartnode> mapSmartnodes = mnodeman.GetFullSmartnodeMap();
 
     int offsetFromUtc = GetOffsetFromUtc();
 
-    for(auto& mnpair : mapSmartnodes)
-    {
-        CSmartnode mn = mnpair.second;
+    mnodeman.ForEachSmartnode([&](CSmartnode& mn) {
         // populate list
         // Address, Protocol, Status, Active Seconds, Last Seen, Pub Key
         QTableWidgetItem *addressItem = new QTableWidgetItem(QString::fromStdString(mn.addr.ToString()));
@@ -303,7 +300,7 @@ void SmartnodeList::updateNodeList()
                             activeSecondsItem->text() + " " +
                             lastSeenItem->text() + " " +
                             pubkeyItem->text();
-            if (!strToFilter.contains(strCurrentFilter)) continue;
+            if (!strToFilter.contains(strCurrentFilter)) return;
         }
 
         ui->tableWidgetSmartnodes->insertRow(0);
@@ -313,7 +310,7 @@ void SmartnodeList::updateNodeList()
         ui->tableWidgetSmartnodes->setItem(0, 3, activeSecondsItem);
         ui->tableWidgetSmartnodes->setItem(0, 4, lastSeenItem);
         ui->tableWidgetSmartnodes->setItem(0, 5, pubkeyItem);
-    }
+    });
 
     ui->countLabel->setText(QString::number(ui->tableWidgetSmartnodes->rowCount()));
     ui->tableWidgetSmartnodes->setSortingEnabled(true);
@@ -185,11 +185,7 @@ void SmartrewardsList::updateUI()
     // If the rewardlist is synced show the actual SmartRewards view.
     if( prewards->IsSynced() ){
 
-        CSmartRewardRound current;
-        {
-            LOCK(cs_rewardrounds);
-            current = prewards->GetCurrentRound();
-        }
+        CSmartRewardRound current = prewards->GetRounds()->current;
         QString percentText;
         percentText.sprintf("%.2f%%", current.percent * 100);
         ui->percentLabel->setText(percentText);
@@ -25,6 +25,8 @@
 #include <QDebug>
 #include <QIcon>
 #include <QList>
+#include <QMutex>
+#include <QThread>
 
 #include <boost/foreach.hpp>
 
@@ -38,22 +40,84 @@ static int column_alignments[] = {
         Qt::AlignRight|Qt::AlignVCenter /* amount */
     };
 
-// Comparison operator for sort/binary search of model tx list
-struct TxLessThan
+/* Number of wallet transactions the loader decomposes at once, with the core locks held */
+static const int TRANSACTION_LOAD_WINDOW = 500;
+
+/* Decompose the transactions of a wallet into records on a background thread.
+
+   The loader is given the hashes of the wallet's transactions, newest first as
+   in the wallet's ordered transaction index. Each request decomposes the next
+   window of them, taking the core locks for that window only, and leaves the
+   records for the model to take when it receives the windowLoaded() signal.
+   The model requests the next window once it has inserted the previous one, so
+   the GUI thread gets to handle its events between windows.
+*/
+class TransactionTableLoader : public QObject
 {
-    bool operator()(const TransactionRecord &a, const TransactionRecord &b) const
-    {
-        return a.hash < b.hash;
-    }
-    bool operator()(const TransactionRecord &a, const uint256 &b) const
+    Q_OBJECT
+
+public:
+    TransactionTableLoader(CWallet *wallet, const std::vector<uint256> &hashes);
+
+    /* Take the records loaded since the last call; returns whether all transactions are loaded */
+    bool takeLoaded(QList<TransactionRecord> &records);
+
+public Q_SLOTS:
+    void loadWindow();
+
+Q_SIGNALS:
+    void windowLoaded();
+
+private:
+    CWallet *wallet;
+    std::vector<uint256> hashes;
+    size_t next;
+
+    QMutex mutex;
+    QList<TransactionRecord> loaded;
+    bool done;
+};
+
+#include "transactiontablemodel.moc"
+
+TransactionTableLoader::TransactionTableLoader(CWallet *wallet, const std::vector<uint256> &hashes) :
+    wallet(wallet),
+    hashes(hashes),
+    next(0),
+    done(hashes.empty())
+{
+}
+
+bool TransactionTableLoader::takeLoaded(QList<TransactionRecord> &records)
+{
+    QMutexLocker locker(&mutex);
+    records.swap(loaded);
+    loaded.clear();
+    return done;
+}
+
+void TransactionTableLoader::loadWindow()
+{
+    QList<TransactionRecord> records;
+    size_t end = std::min(next + TRANSACTION_LOAD_WINDOW, hashes.size());
     {
-        return a.hash < b;
+        LOCK2(cs_main, wallet->cs_wallet);
+        for(; next < end; next++)
+        {
+            // Transactions removed since the hashes were taken are skipped
+            std::map<uint256, CWalletTx>::iterator mi = wallet->mapWallet.find(hashes[next]);
+            if(mi != wallet->mapWallet.end() && TransactionRecord::showTransaction(mi->second))
+                records.append(TransactionRecord::decomposeTransaction(wallet, mi->second));
+        }
     }
-    bool operator()(const uint256 &a, const TransactionRecord &b) const
+
     {
-        return a < b.hash;
+        QMutexLocker locker(&mutex);
+        loaded.append(records);
+        done = next == hashes.size();
     }
-};
+    Q_EMIT windowLoaded();
+}
 
 // Private implementation
 class TransactionTablePriv
@@ -68,26 +132,69 @@ public:
     CWallet *wallet;
     TransactionTableModel *parent;
 
-    /* Local cache of wallet.
-     * As it is in the same order as the CWallet, by definition
-     * this is sorted by sha256.
+    /* Local cache of wallet, in the order the records were added: the
+     * transactions present at startup newest first, then the ones that
+     * came in after. The records of a transaction are adjacent.
      */
     QList<TransactionRecord> cachedWallet;
+    /* Row of the first record of each transaction in cachedWallet */
+    std::map<uint256, int> mapFirstRow;
 
-    /* Query entire wallet anew from core.
+    /* Hashes of the transactions in the wallet, newest first, for the loader.
+     * Only the hashes are taken here, the decomposition is left to the loader
+     * so that a large wallet doesn't hold up the GUI at startup.
      */
-    void refreshWallet()
+    std::vector<uint256> walletHashes()
     {
-        qDebug() << "TransactionTablePriv::refreshWallet";
-        cachedWallet.clear();
+        qDebug() << "TransactionTablePriv::walletHashes";
+        std::vector<uint256> hashes;
         {
             LOCK2(cs_main, wallet->cs_wallet);
-            for(std::map<uint256, CWalletTx>::iterator it = wallet->mapWallet.begin(); it != wallet->mapWallet.end(); ++it)
+            hashes.reserve(wallet->mapWallet.size());
+            for(CWallet::TxItems::const_reverse_iterator it = wallet->wtxOrdered.rbegin(); it != wallet->wtxOrdered.rend(); ++it)
             {
-                if(TransactionRecord::showTransaction(it->second))
-                    cachedWallet.append(TransactionRecord::decomposeTransaction(wallet, it->second));
+                if(it->second.first)
+                    hashes.push_back(it->second.first->GetHash());
             }
         }
+        return hashes;
+    }
+
+    /* Append records at the end of the model, skipping transactions a
+     * notification already added while they were being loaded.
+     */
+    void appendRecords(const QList<TransactionRecord> &records)
+    {
+        QList<TransactionRecord> toInsert;
+        Q_FOREACH(const TransactionRecord &rec, records)
+        {
+            std::map<uint256, int>::const_iterator mi = mapFirstRow.find(rec.hash);
+            if(mi == mapFirstRow.end() || mi->second >= cachedWallet.size())
+            {
+                mapFirstRow.insert(std::make_pair(rec.hash, cachedWallet.size() + toInsert.size()));
+                toInsert.append(rec);
+            }
+        }
+        if(toInsert.isEmpty())
+            return;
+
+        parent->beginInsertRows(QModelIndex(), cachedWallet.size(), cachedWallet.size() + toInsert.size() - 1);
+        cachedWallet.append(toInsert);
+        parent->endInsertRows();
+    }
+
+    /* Remove the records of a transaction, rows [lowerIndex, upperIndex) */
+    void removeRecords(int lowerIndex, int upperIndex)
+    {
+        parent->beginRemoveRows(QModelIndex(), lowerIndex, upperIndex-1);
+        mapFirstRow.erase(cachedWallet[lowerIndex].hash);
+        cachedWallet.erase(cachedWallet.begin() + lowerIndex, cachedWallet.begin() + upperIndex);
+        for(std::map<uint256, int>::iterator it = mapFirstRow.begin(); it != mapFirstRow.end(); ++it)
+        {
+            if(it->second > lowerIndex)
+                it->second -= upperIndex - lowerIndex;
+        }
+        parent->endRemoveRows();
     }
 
     /* Update our model of the wallet incrementally, to synchronize our model of the wallet
@@ -100,13 +207,16 @@ public:
         qDebug() << "TransactionTablePriv::updateWallet: " + QString::fromStdString(hash.ToString()) + " " + QString::number(status);
 
         // Find bounds of this transaction in model
-        QList<TransactionRecord>::iterator lower = qLowerBound(
-            cachedWallet.begin(), cachedWallet.end(), hash, TxLessThan());
-        QList<TransactionRecord>::iterator upper = qUpperBound(
-            cachedWallet.begin(), cachedWallet.end(), hash, TxLessThan());
-        int lowerIndex = (lower - cachedWallet.begin());
-        int upperIndex = (upper - cachedWallet.begin());
-        bool inModel = (lower != upper);
+        int lowerIndex = cachedWallet.size();
+        int upperIndex = lowerIndex;
+        std::map<uint256, int>::const_iterator mi = mapFirstRow.find(hash);
+        if(mi != mapFirstRow.end())
+        {
+            lowerIndex = upperIndex = mi->second;
+            while(upperIndex < cachedWallet.size() && cachedWallet[upperIndex].hash == hash)
+                upperIndex++;
+        }
+        bool inModel = (lowerIndex != upperIndex);
 
         if(status == CT_UPDATED)
         {
@@ -130,28 +240,20 @@ public:
             }
             if(showTransaction)
             {
-                LOCK2(cs_main, wallet->cs_wallet);
-                // Find transaction in wallet
-                std::map<uint256, CWalletTx>::iterator mi = wallet->mapWallet.find(hash);
-                if(mi == wallet->mapWallet.end())
-                {
-                    qWarning() << "TransactionTablePriv::updateWallet: Warning: Got CT_NEW, but transaction is not in wallet";
-                    break;
-                }
-                // Added -- insert at the right position
-                QList<TransactionRecord> toInsert =
-                        TransactionRecord::decomposeTransaction(wallet, mi->second);
-                if(!toInsert.isEmpty()) /* only if something to insert */
+                QList<TransactionRecord> toInsert;
                 {
-                    parent->beginInsertRows(QModelIndex(), lowerIndex, lowerIndex+toInsert.size()-1);
-                    int insert_idx = lowerIndex;
-                    Q_FOREACH(const TransactionRecord &rec, toInsert)
+                    LOCK2(cs_main, wallet->cs_wallet);
+                    // Find transaction in wallet
+                    std::map<uint256, CWalletTx>::iterator mi = wallet->mapWallet.find(hash);
+                    if(mi == wallet->mapWallet.end())
                     {
-                        cachedWallet.insert(insert_idx, rec);
-                        insert_idx += 1;
+                        qWarning() << "TransactionTablePriv::updateWallet: Warning: Got CT_NEW, but transaction is not in wallet";
+                        break;
                     }
-                    parent->endInsertRows();
+                    toInsert = TransactionRecord::decomposeTransaction(wallet, mi->second);
                 }
+                // Added -- append at the end, the view sorts the rows
+                appendRecords(toInsert);
             }
             break;
         case CT_DELETED:
@@ -161,9 +263,7 @@ public:
                 break;
             }
             // Removed -- remove entire transaction from table
-            parent->beginRemoveRows(QModelIndex(), lowerIndex, upperIndex-1);
-            cachedWallet.erase(lower, upper);
-            parent->endRemoveRows();
+            removeRecords(lowerIndex, upperIndex);
             break;
         case CT_UPDATED:
             // Miscellaneous updates -- nothing to do, status update will take care of this, and is only computed for
@@ -244,19 +344,43 @@ TransactionTableModel::TransactionTableModel(const PlatformStyle *platformStyle,
         platformStyle(platformStyle)
 {
     columns << QString() << QString() << tr("Date") << tr("Type") << tr("Label") << BitcoinUnits::getAmountColumnTitle(walletModel->getOptionsModel()->getDisplayUnit());
-    priv->refreshWallet();
 
     connect(walletModel->getOptionsModel(), SIGNAL(displayUnitChanged(int)), this, SLOT(updateDisplayUnit()));
 
+    // Subscribe before taking the hashes, so no transaction slips between the two
     subscribeToCoreSignals();
+
+    loaderThread = new QThread(this);
+    loader = new TransactionTableLoader(wallet, priv->walletHashes());
+    loader->moveToThread(loaderThread);
+    connect(this, SIGNAL(requestLoadWindow()), loader, SLOT(loadWindow()));
+    connect(loader, SIGNAL(windowLoaded()), this, SLOT(loadedWindow()));
+    loaderThread->start();
+    Q_EMIT requestLoadWindow();
 }
 
 TransactionTableModel::~TransactionTableModel()
 {
     unsubscribeFromCoreSignals();
+    // Let a window being loaded finish, the loader is deleted with no thread left to run it
+    loaderThread->quit();
+    loaderThread->wait();
+    delete loader;
     delete priv;
 }
 
+void TransactionTableModel::loadedWindow()
+{
+    QList<TransactionRecord> records;
+    bool fDone = loader->takeLoaded(records);
+    priv->appendRecords(records);
+
+    if(fDone)
+        qDebug() << "TransactionTableModel::loadedWindow: all transactions loaded, " + QString::number(priv->size()) + " records";
+    else
+        Q_EMIT requestLoadWindow();
+}
+
 /** Updates the column title to "Amount (DisplayUnit)" and emits headerDataChanged() signal for table headers to react. */
 void TransactionTableModel::updateAmountColumnTitle()
 {
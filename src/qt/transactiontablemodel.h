@@ -9,9 +9,11 @@
 
 #include <QAbstractTableModel>
 #include <QStringList>
+#include <QThread>
 
 class PlatformStyle;
 class TransactionRecord;
+class TransactionTableLoader;
 class TransactionTablePriv;
 class WalletModel;
 
@@ -86,6 +88,8 @@ private:
     WalletModel *walletModel;
     QStringList columns;
     TransactionTablePriv *priv;
+    TransactionTableLoader *loader;
+    QThread *loaderThread;
     bool fProcessingQueuedTransactions;
     const PlatformStyle *platformStyle;
 
@@ -113,8 +117,14 @@ public Q_SLOTS:
     void updateAmountColumnTitle();
     /* Needed to update fProcessingQueuedTransactions through a QueuedConnection */
     void setProcessingQueuedTransactions(bool value) { fProcessingQueuedTransactions = value; }
+    /* Insert the records of a window the loader finished and request the next one */
+    void loadedWindow();
 
     friend class TransactionTablePriv;
+
+Q_SIGNALS:
+    /* Ask the loader thread to decompose the next window of wallet transactions */
+    void requestLoadWindow();
 };
 
 #endif // BITCOIN_QT_TRANSACTIONTABLEMODEL_H
@@ -35,7 +35,8 @@ WalletModel::WalletModel(const PlatformStyle *platformStyle, CWallet *wallet, Op
     recentRequestsTableModel(0),
     cachedBalance(0), cachedUnconfirmedBalance(0), cachedImmatureBalance(0),
     cachedEncryptionStatus(Unencrypted),
-    cachedNumBlocks(0)
+    cachedNumBlocks(0),
+    nLastBalanceCheck(0)
 {
     fHaveWatchOnly = wallet->HaveWatchOnly();
     fForceCheckBalanceChanged = false;
@@ -126,6 +127,11 @@ void WalletModel::pollBalanceChanged()
 
     if(fForceCheckBalanceChanged || chainActive.Height() != cachedNumBlocks)
     {
+        // While syncing a new block rarely changes the balance, don't recompute it for each of them
+        int64_t now = GetTimeMillis();
+        if(!fForceCheckBalanceChanged && IsInitialBlockDownload() && now - nLastBalanceCheck < MODEL_SYNC_BALANCE_UPDATE_DELAY)
+            return;
+        nLastBalanceCheck = now;
         fForceCheckBalanceChanged = false;
 
         // Balance and number of transactions might have changed
@@ -501,7 +507,9 @@ static void NotifyTransactionChanged(WalletModel *walletmodel, CWallet *wallet,
     Q_UNUSED(wallet);
     Q_UNUSED(hash);
     Q_UNUSED(status);
-    QMetaObject::invokeMethod(walletmodel, "updateTransaction", Qt::QueuedConnection);
+    // Only raises a flag for the next poll, so no event is queued per
+    // transaction when a block or a rescan touches many of them
+    walletmodel->updateTransaction();
 }
 
 static void ShowProgress(WalletModel *walletmodel, const std::string &title, int nProgress)
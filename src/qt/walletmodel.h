@@ -13,6 +13,7 @@
 #endif // ENABLE_WALLET
 #include "support/allocators/secure.h"
 
+#include <atomic>
 #include <map>
 #include <vector>
 
@@ -216,7 +217,8 @@ public:
 private:
     CWallet *wallet;
     bool fHaveWatchOnly;
-    bool fForceCheckBalanceChanged;
+    //! Set from core threads when a transaction changed, picked up by the next poll
+    std::atomic<bool> fForceCheckBalanceChanged;
 
     // Wallet has an options model for wallet-specific options
     // (transaction fee, for example)
@@ -235,6 +237,7 @@ private:
     CAmount cachedWatchImmatureBalance;
     EncryptionStatus cachedEncryptionStatus;
     int cachedNumBlocks;
+    int64_t nLastBalanceCheck;
 
     QTimer *pollTimer;
 
@@ -270,7 +273,7 @@ Q_SIGNALS:
 public Q_SLOTS:
     /* Wallet status might have changed */
     void updateStatus();
-    /* New transaction, or transaction changed status */
+    /* New transaction, or transaction changed status. Safe to call from any thread */
     void updateTransaction();
     /* New, updated or removed address book entry */
     void updateAddressBook(const QString &address, const QString &label, bool isMine, const QString &purpose, int status);
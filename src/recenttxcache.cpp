@@ -0,0 +1,73 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "recenttxcache.h"
+
+void CRecentTxCache::EraseBlock(std::list<BlockEntry>::iterator it)
+{
+    for( const uint256 &txid : it->vTxids ){
+        auto itTx = mapTxs.find(txid);
+        // A later block may contain the same txid again, keep its entry
+        if( itTx != mapTxs.end() && itTx->second.itBlock == it ) mapTxs.erase(itTx);
+    }
+    listBlocks.erase(it);
+}
+
+void CRecentTxCache::AddBlock(const uint256& hashBlock, const std::vector<CTransactionRef>& vtx)
+{
+    LOCK(cs);
+
+    if( nMaxBlocks == 0 ) return;
+
+    listBlocks.push_front(BlockEntry());
+    BlockEntry &entry = listBlocks.front();
+    entry.hashBlock = hashBlock;
+    entry.vTxids.reserve(vtx.size());
+
+    for( const CTransactionRef &ptx : vtx ){
+        TxEntry &txEntry = mapTxs[ptx->GetHash()];
+        txEntry.tx = ptx;
+        txEntry.itBlock = listBlocks.begin();
+        entry.vTxids.push_back(ptx->GetHash());
+    }
+
+    while( listBlocks.size() > nMaxBlocks ) EraseBlock(std::prev(listBlocks.end()));
+}
+
+void CRecentTxCache::EraseBlock(const uint256& hashBlock)
+{
+    LOCK(cs);
+
+    for( auto it = listBlocks.begin(); it != listBlocks.end(); ++it ){
+        if( it->hashBlock == hashBlock ){
+            EraseBlock(it);
+            return;
+        }
+    }
+}
+
+CTransactionRef CRecentTxCache::Get(const uint256& txid, uint256& hashBlock)
+{
+    LOCK(cs);
+
+    auto it = mapTxs.find(txid);
+    if( it == mapTxs.end() ) return nullptr;
+
+    listBlocks.splice(listBlocks.begin(), listBlocks, it->second.itBlock);
+    hashBlock = it->second.itBlock->hashBlock;
+    return it->second.tx;
+}
+
+void CRecentTxCache::Clear()
+{
+    LOCK(cs);
+    mapTxs.clear();
+    listBlocks.clear();
+}
+
+size_t CRecentTxCache::size()
+{
+    LOCK(cs);
+    return listBlocks.size();
+}
@@ -0,0 +1,61 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SMARTCASH_RECENTTXCACHE_H
+#define SMARTCASH_RECENTTXCACHE_H
+
+#include "primitives/transaction.h"
+#include "sync.h"
+#include "txmempool.h"
+#include "uint256.h"
+
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+//! Number of recently connected blocks whose transactions are kept by the recent transaction cache
+static const size_t DEFAULT_RECENT_TX_CACHE_BLOCKS = 16;
+
+/** Keeps the transactions of the most recently connected blocks so lookups of freshly
+ *  confirmed transactions don't have to go through the transaction index and the block
+ *  files. Blocks are dropped least recently used first, a lookup counts as a use of the
+ *  block the transaction is in. Disconnected blocks have to be erased by the caller.
+ */
+class CRecentTxCache
+{
+private:
+    struct BlockEntry
+    {
+        uint256 hashBlock;
+        std::vector<uint256> vTxids;
+    };
+
+    struct TxEntry
+    {
+        CTransactionRef tx;
+        std::list<BlockEntry>::iterator itBlock;
+    };
+
+    CCriticalSection cs;
+    std::list<BlockEntry> listBlocks; // most recently used first
+    std::unordered_map<uint256, TxEntry, SaltedTxidHasher> mapTxs;
+    size_t nMaxBlocks;
+
+    void EraseBlock(std::list<BlockEntry>::iterator it);
+
+public:
+    explicit CRecentTxCache(size_t nMaxBlocksIn = DEFAULT_RECENT_TX_CACHE_BLOCKS) : nMaxBlocks(nMaxBlocksIn) {}
+
+    //! Add the transactions of a block that just got connected.
+    void AddBlock(const uint256& hashBlock, const std::vector<CTransactionRef>& vtx);
+    //! Drop the transactions of a block, e.g. when it gets disconnected.
+    void EraseBlock(const uint256& hashBlock);
+    //! Look up txid, the transaction is shared with the cache.
+    CTransactionRef Get(const uint256& txid, uint256& hashBlock);
+    void Clear();
+    size_t size();
+};
+
+#endif // SMARTCASH_RECENTTXCACHE_H
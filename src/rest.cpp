@@ -3,13 +3,17 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "base58.h"
 #include "chain.h"
 #include "chainparams.h"
+#include "hash.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "validation.h"
 #include "httpserver.h"
 #include "rpc/server.h"
+#include "smartnode/smartnodeman.h"
+#include "smartrewards/rewards.h"
 #include "streams.h"
 #include "sync.h"
 #include "txmempool.h"
@@ -24,6 +28,8 @@
 using namespace std;
 
 static const size_t MAX_GETUTXOS_OUTPOINTS = 15; //allow a max of 15 outpoints to be queried at once
+static const size_t MAX_SENDTXS_TRANSACTIONS = 1000; //allow a max of 1000 transactions to be submitted at once
+static const size_t REST_CHUNK_SIZE = 1024 * 1024; //range replies are sent on in parts of about 1 MB
 
 enum RetFormat {
     RF_UNDEF,
@@ -67,6 +73,7 @@ extern UniValue mempoolInfoToJSON();
 extern UniValue mempoolToJSON(bool fVerbose = false);
 extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 extern UniValue blockheaderToJSON(const CBlockIndex* blockindex);
+extern UniValue SendRawTransactions(const std::vector<CTransaction>& vtx, bool fRejectAbsurdFee);
 
 static bool RESTERR(HTTPRequest* req, enum HTTPStatusCode status, string message)
 {
@@ -276,6 +283,130 @@ static bool rest_block_notxdetails(HTTPRequest* req, const std::string& strURIPa
     return rest_block(req, strURIPart, false);
 }
 
+/**
+ * Stream the blocks or headers at heights <start> to <start>+<count>-1 of the
+ * active chain, with chunked transfer encoding so neither the range nor the
+ * reply is limited by memory. A range past the tip ends at the tip.
+ */
+static bool rest_range(HTTPRequest* req,
+                       const std::string& strURIPart,
+                       bool fHeaders)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    vector<string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+
+    int32_t nStart, nCount;
+    if (path.size() != 2 || !ParseInt32(path[0], &nStart) || !ParseInt32(path[1], &nCount))
+        return RESTERR(req, HTTP_BAD_REQUEST, strprintf("No range specified. Use /rest/%s/<start>/<count>.<ext>.", fHeaders ? "blockheaders" : "blocks"));
+    if (nStart < 0 || nCount < 1)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Range out of bounds: " + param);
+    if (rf != RF_BINARY && rf != RF_HEX && rf != RF_JSON)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+
+    // Walk back from the last block of the range, so a reorg while the reply
+    // is being sent can't mix blocks of two chains into it
+    const CBlockIndex* pindexLast;
+    {
+        LOCK(cs_main);
+        if (nStart > chainActive.Height())
+            return RESTERR(req, HTTP_NOT_FOUND, "Block height out of range: " + path[0]);
+        pindexLast = chainActive[std::min((int64_t)chainActive.Height(), (int64_t)nStart + nCount - 1)];
+        if (!fHeaders && fHavePruned) {
+            for (const CBlockIndex* pindex = pindexLast; pindex && pindex->nHeight >= nStart; pindex = pindex->pprev)
+                if (!(pindex->nStatus & BLOCK_HAVE_DATA) && pindex->nTx > 0)
+                    return RESTERR(req, HTTP_NOT_FOUND, pindex->GetBlockHash().GetHex() + " not available (pruned data)");
+        }
+    }
+
+    // Blocks are passed on as they are stored unless the RPC serialization asks for something else
+    const bool fRaw = !fHeaders && rf != RF_JSON && RPCSerializationFlags() == 0;
+
+    req->WriteHeader("Content-Type", rf == RF_BINARY ? "application/octet-stream" : rf == RF_HEX ? "text/plain" : "application/json");
+    req->WriteReplyStart(HTTP_OK);
+
+    bool fComplete = true;
+    std::string strOut;
+    if (rf == RF_JSON)
+        strOut += "[";
+    for (int nHeight = nStart; nHeight <= pindexLast->nHeight; nHeight++) {
+        const CBlockIndex* pindex = pindexLast->GetAncestor(nHeight);
+        if (rf == RF_JSON && nHeight != nStart)
+            strOut += ",";
+
+        if (fHeaders) {
+            if (rf == RF_JSON) {
+                strOut += blockheaderToJSON(pindex).write();
+            } else {
+                CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+                ssHeader << pindex->GetBlockHeader();
+                strOut += rf == RF_BINARY ? ssHeader.str() : HexStr(ssHeader.begin(), ssHeader.end());
+            }
+        } else if (fRaw) {
+            CSerializeData vchBlock;
+            {
+                LOCK(cs_main);
+                fComplete = ReadRawBlockFromDisk(vchBlock, pindex, Params().MessageStart());
+            }
+            if (!fComplete)
+                break;
+            if (rf == RF_BINARY)
+                strOut.append(vchBlock.begin(), vchBlock.end());
+            else
+                strOut += HexStr(vchBlock.begin(), vchBlock.end()) + "\n";
+        } else {
+            CBlock block;
+            {
+                LOCK(cs_main);
+                fComplete = ReadBlockFromDisk(block, pindex, Params().GetConsensus());
+            }
+            if (!fComplete)
+                break;
+            if (rf == RF_JSON) {
+                strOut += blockToJSON(block, pindex, true).write();
+            } else {
+                CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
+                ssBlock << block;
+                strOut += rf == RF_BINARY ? ssBlock.str() : HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
+            }
+        }
+
+        if (strOut.size() >= REST_CHUNK_SIZE) {
+            fComplete = req->WriteReplyChunk(strOut);
+            if (!fComplete)
+                break;
+            strOut.clear();
+        }
+    }
+
+    // The status has gone out already, so a block that can't be read only
+    // shows as a reply cut short: unterminated JSON, missing blocks otherwise
+    if (fComplete) {
+        if (rf == RF_JSON)
+            strOut += "]\n";
+        else if (fHeaders && rf == RF_HEX)
+            strOut += "\n";
+        req->WriteReplyChunk(strOut);
+    } else {
+        LogPrint("http", "%s: reply for %s cut short\n", __func__, strURIPart);
+    }
+    req->WriteReplyEnd();
+    return true;
+}
+
+static bool rest_blocks(HTTPRequest* req, const std::string& strURIPart)
+{
+    return rest_range(req, strURIPart, false);
+}
+
+static bool rest_blockheaders(HTTPRequest* req, const std::string& strURIPart)
+{
+    return rest_range(req, strURIPart, true);
+}
+
 // A bit of a hack - dependency on a function defined in rpc/blockchain.cpp
 UniValue getblockchaininfo(const UniValue& params, bool fHelp);
 
@@ -590,6 +721,270 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+static bool rest_sendtxs(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    if (req->GetRequestMethod() != HTTPRequest::POST)
+        return RESTERR(req, HTTP_BAD_METHOD, "Error: transactions have to be posted");
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+
+    std::string strRequest = req->ReadBody();
+    if (strRequest.length() == 0)
+        return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, "Error: empty request");
+
+    // input-format is bin or hex, the result is always json
+    switch (rf) {
+    case RF_HEX: {
+        boost::trim(strRequest);
+        if (!IsHex(strRequest))
+            return RESTERR(req, HTTP_BAD_REQUEST, "Parse error");
+        std::vector<unsigned char> strRequestV = ParseHex(strRequest);
+        strRequest.assign(strRequestV.begin(), strRequestV.end());
+        break;
+    }
+    case RF_BINARY:
+        break;
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "input format not found (available: .bin, .hex)");
+    }
+    }
+
+    std::vector<CTransaction> vtx;
+    try {
+        CDataStream ssRequest(strRequest.data(), strRequest.data() + strRequest.size(), SER_NETWORK, PROTOCOL_VERSION);
+        ssRequest >> vtx;
+    } catch (const std::exception&) {
+        // abort in case of unreadable binary data
+        return RESTERR(req, HTTP_BAD_REQUEST, "Parse error");
+    }
+
+    if (vtx.size() > MAX_SENDTXS_TRANSACTIONS)
+        return RESTERR(req, HTTP_BAD_REQUEST, strprintf("Error: max transactions exceeded (max: %d, tried: %d)", MAX_SENDTXS_TRANSACTIONS, vtx.size()));
+
+    string strJSON = SendRawTransactions(vtx, true).write() + "\n";
+    req->WriteHeader("Content-Type", "application/json");
+    req->WriteReply(HTTP_OK, strJSON);
+    return true;
+}
+
+/** One smartnode as listed by /rest/smartnodes */
+struct CRESTSmartnode {
+    COutPoint outpoint;
+    CService addr;
+    CKeyID collateralAddress;
+    int nActiveState;
+    int nProtocolVersion;
+    int64_t nLastSeen;
+    int64_t nActiveSeconds;
+    int64_t nLastPaidTime;
+    int nLastPaidBlock;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(outpoint);
+        READWRITE(addr);
+        READWRITE(collateralAddress);
+        READWRITE(nActiveState);
+        READWRITE(nProtocolVersion);
+        READWRITE(nLastSeen);
+        READWRITE(nActiveSeconds);
+        READWRITE(nLastPaidTime);
+        READWRITE(nLastPaidBlock);
+    }
+};
+
+/**
+ * SmartRewards and smartnode state for public clients, rendered at most once
+ * per block so any number of polls can be served without taking cs_main
+ * or mnodeman.cs.
+ */
+struct CRESTStateSnapshot {
+    uint256 hashBlock;
+    int nHeight;
+    bool fRewardsSynced;
+    CSmartRewardRound round;
+
+    std::string strRoundJSON, strRoundETag;
+    std::string strSmartnodesBin, strSmartnodesJSON, strSmartnodesETag;
+};
+
+static std::shared_ptr<const CRESTStateSnapshot> restStateSnapshot;
+static CCriticalSection cs_restStateRebuild;
+
+static std::string ETagFor(const std::string& strBody)
+{
+    return "\"" + Hash(strBody.begin(), strBody.end()).GetHex() + "\"";
+}
+
+static void RenderRESTStateSnapshot(CRESTStateSnapshot& state, const CChainTipSnapshot& tip)
+{
+    state.hashBlock = tip.hashBlock;
+    state.nHeight = tip.nHeight;
+    state.fRewardsSynced = prewards && prewards->IsSynced();
+    if (state.fRewardsSynced)
+        state.round = prewards->GetRounds()->current;
+
+    const CSmartRewardRound& round = state.round;
+    UniValue objRound(UniValue::VOBJ);
+    objRound.push_back(Pair("height", state.nHeight));
+    objRound.push_back(Pair("blockhash", state.hashBlock.GetHex()));
+    objRound.push_back(Pair("rewards_cycle", round.number));
+    objRound.push_back(Pair("start_blockheight", round.startBlockHeight));
+    objRound.push_back(Pair("start_blocktime", round.startBlockTime));
+    objRound.push_back(Pair("end_blockheight", round.endBlockHeight));
+    objRound.push_back(Pair("end_blocktime", round.endBlockTime));
+    objRound.push_back(Pair("eligible_addresses", round.eligibleEntries - round.disqualifiedEntries));
+    objRound.push_back(Pair("eligible_smart", ValueFromAmount(round.eligibleSmart - round.disqualifiedSmart)));
+    objRound.push_back(Pair("disqualified_addresses", round.disqualifiedEntries));
+    objRound.push_back(Pair("disqualified_smart", ValueFromAmount(round.disqualifiedSmart)));
+    objRound.push_back(Pair("estimated_rewards", ValueFromAmount(round.rewards)));
+    objRound.push_back(Pair("estimated_percent", round.percent));
+    state.strRoundJSON = objRound.write() + "\n";
+    state.strRoundETag = ETagFor(state.strRoundJSON);
+
+    std::vector<CRESTSmartnode> vSmartnodes;
+    vSmartnodes.reserve(mnodeman.size());
+    mnodeman.UpdateLastPaid(tip.pindex);
+    mnodeman.ForEachSmartnode([&](CSmartnode& mn) {
+        CRESTSmartnode entry;
+        entry.outpoint = mn.vin.prevout;
+        entry.addr = mn.addr;
+        entry.collateralAddress = mn.pubKeyCollateralAddress.GetID();
+        entry.nActiveState = mn.nActiveState;
+        entry.nProtocolVersion = mn.nProtocolVersion;
+        entry.nLastSeen = mn.lastPing.sigTime;
+        entry.nActiveSeconds = mn.lastPing.sigTime - mn.sigTime;
+        entry.nLastPaidTime = mn.GetLastPaidTime();
+        entry.nLastPaidBlock = mn.GetLastPaidBlock();
+        vSmartnodes.push_back(entry);
+    });
+
+    CDataStream ssSmartnodes(SER_NETWORK, PROTOCOL_VERSION);
+    ssSmartnodes << state.hashBlock << state.nHeight << vSmartnodes;
+    state.strSmartnodesBin = ssSmartnodes.str();
+    state.strSmartnodesETag = ETagFor(state.strSmartnodesBin);
+
+    int nEnabled = 0;
+    UniValue arrSmartnodes(UniValue::VARR);
+    for (const CRESTSmartnode& entry : vSmartnodes) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("outpoint", entry.outpoint.ToStringShort()));
+        obj.push_back(Pair("addr", entry.addr.ToString()));
+        obj.push_back(Pair("payee", CBitcoinAddress(entry.collateralAddress).ToString()));
+        obj.push_back(Pair("status", CSmartnode::StateToString(entry.nActiveState)));
+        obj.push_back(Pair("protocol", entry.nProtocolVersion));
+        obj.push_back(Pair("lastseen", entry.nLastSeen));
+        obj.push_back(Pair("activeseconds", entry.nActiveSeconds));
+        obj.push_back(Pair("lastpaidtime", entry.nLastPaidTime));
+        obj.push_back(Pair("lastpaidblock", entry.nLastPaidBlock));
+        arrSmartnodes.push_back(std::move(obj));
+        if (entry.nActiveState == CSmartnode::SMARTNODE_ENABLED)
+            nEnabled++;
+    }
+    UniValue objSmartnodes(UniValue::VOBJ);
+    objSmartnodes.push_back(Pair("height", state.nHeight));
+    objSmartnodes.push_back(Pair("blockhash", state.hashBlock.GetHex()));
+    objSmartnodes.push_back(Pair("count", (int64_t)vSmartnodes.size()));
+    objSmartnodes.push_back(Pair("enabled", nEnabled));
+    objSmartnodes.push_back(Pair("smartnodes", std::move(arrSmartnodes)));
+    state.strSmartnodesJSON = objSmartnodes.write() + "\n";
+}
+
+/** The state snapshot for the current tip, rendering it first if the tip moved on */
+static std::shared_ptr<const CRESTStateSnapshot> GetRESTStateSnapshot()
+{
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    if (!tip)
+        return nullptr;
+
+    std::shared_ptr<const CRESTStateSnapshot> state = std::atomic_load(&restStateSnapshot);
+    if (state && state->hashBlock == tip->hashBlock)
+        return state;
+
+    // One request renders, the others arriving meanwhile wait for its result
+    LOCK(cs_restStateRebuild);
+    state = std::atomic_load(&restStateSnapshot);
+    if (state && state->hashBlock == tip->hashBlock)
+        return state;
+
+    std::shared_ptr<CRESTStateSnapshot> stateNew = std::make_shared<CRESTStateSnapshot>();
+    RenderRESTStateSnapshot(*stateNew, *tip);
+    state = stateNew;
+    std::atomic_store(&restStateSnapshot, state);
+    return state;
+}
+
+/** Reply with a body of the state snapshot, or with 304 if the client's copy is current */
+static bool RESTReplyCached(HTTPRequest* req, const std::string& strContentType, const std::string& strBody, const std::string& strETag)
+{
+    req->WriteHeader("ETag", strETag);
+    // Caches may keep it, but have to check back since it changes with every block
+    req->WriteHeader("Cache-Control", "public, no-cache");
+
+    std::pair<bool, std::string> ifNoneMatch = req->GetHeader("If-None-Match");
+    if (ifNoneMatch.first && (ifNoneMatch.second == "*" || ifNoneMatch.second.find(strETag) != std::string::npos)) {
+        req->WriteReply(HTTP_NOT_MODIFIED);
+        return true;
+    }
+
+    req->WriteHeader("Content-Type", strContentType);
+    req->WriteReply(HTTP_OK, strBody);
+    return true;
+}
+
+static bool rest_smartrewards_round(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    if (!param.empty())
+        return RESTERR(req, HTTP_NOT_FOUND, "Use /rest/smartrewards/round.json");
+    if (rf != RF_JSON)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json)");
+
+    std::shared_ptr<const CRESTStateSnapshot> state = GetRESTStateSnapshot();
+    if (!state)
+        return RESTERR(req, HTTP_SERVICE_UNAVAILABLE, "No chain tip yet");
+    if (!fDebug && !state->fRewardsSynced)
+        return RESTERR(req, HTTP_SERVICE_UNAVAILABLE, "Rewards database is not up to date");
+    if (!state->round.number)
+        return RESTERR(req, HTTP_NOT_FOUND, "No active reward round available yet.");
+
+    return RESTReplyCached(req, "application/json", state->strRoundJSON, state->strRoundETag);
+}
+
+static bool rest_smartnodes(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    if (!param.empty())
+        return RESTERR(req, HTTP_NOT_FOUND, "Use /rest/smartnodes.<ext>");
+
+    std::shared_ptr<const CRESTStateSnapshot> state = GetRESTStateSnapshot();
+    if (!state)
+        return RESTERR(req, HTTP_SERVICE_UNAVAILABLE, "No chain tip yet");
+
+    // All formats hold the same list, so they share the tag of the binary form
+    switch (rf) {
+    case RF_BINARY:
+        return RESTReplyCached(req, "application/octet-stream", state->strSmartnodesBin, state->strSmartnodesETag);
+    case RF_HEX:
+        return RESTReplyCached(req, "text/plain", HexStr(state->strSmartnodesBin.begin(), state->strSmartnodesBin.end()) + "\n", state->strSmartnodesETag);
+    case RF_JSON:
+        return RESTReplyCached(req, "application/json", state->strSmartnodesJSON, state->strSmartnodesETag);
+    default:
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+}
+
 static const struct {
     const char* prefix;
     bool (*handler)(HTTPRequest* req, const std::string& strReq);
@@ -601,7 +996,12 @@ static const struct {
       {"/rest/mempool/info", rest_mempool_info},
       {"/rest/mempool/contents", rest_mempool_contents},
       {"/rest/headers/", rest_headers},
+      {"/rest/blocks/", rest_blocks},
+      {"/rest/blockheaders/", rest_blockheaders},
       {"/rest/getutxos", rest_getutxos},
+      {"/rest/sendtxs", rest_sendtxs},
+      {"/rest/smartrewards/round", rest_smartrewards_round},
+      {"/rest/smartnodes", rest_smartnodes},
 };
 
 bool StartREST()
@@ -4,6 +4,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "amount.h"
+#include "blocksizecalculator.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
@@ -13,18 +14,23 @@
 #include "policy/policy.h"
 #include "primitives/transaction.h"
 #include "rpc/server.h"
+#include "smartrewards/rewards.h"
 #include "streams.h"
 #include "sync.h"
 #include "txdb.h"
 #include "txmempool.h"
 #include "util.h"
 #include "utilstrencodings.h"
+#include "utxosnapshot.h"
+#include "utxostats.h"
 #include "hash.h"
 
+#include <memory>
 #include <stdint.h>
 
 #include <univalue.h>
 
+#include <boost/filesystem.hpp>
 #include <boost/thread/thread.hpp> // boost::thread::interrupt
 
 using namespace std;
@@ -32,22 +38,14 @@ using namespace std;
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
 void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 
-double GetDifficulty(const CBlockIndex* blockindex)
+static double GetDifficultyFromBits(uint32_t nBits)
 {
     // Floating point number that is a multiple of the minimum difficulty,
     // minimum difficulty = 1.0.
-    if (blockindex == NULL)
-    {
-        if (chainActive.Tip() == NULL)
-            return 1.0;
-        else
-            blockindex = chainActive.Tip();
-    }
-
-    int nShift = (blockindex->nBits >> 24) & 0xff;
+    int nShift = (nBits >> 24) & 0xff;
 
     double dDiff =
-        (double)0x0000ffff / (double)(blockindex->nBits & 0x00ffffff);
+        (double)0x0000ffff / (double)(nBits & 0x00ffffff);
 
     while (nShift < 29)
     {
@@ -63,6 +61,19 @@ double GetDifficulty(const CBlockIndex* blockindex)
     return dDiff;
 }
 
+double GetDifficulty(const CBlockIndex* blockindex)
+{
+    if (blockindex == NULL)
+    {
+        if (chainActive.Tip() == NULL)
+            return 1.0;
+        else
+            blockindex = chainActive.Tip();
+    }
+
+    return GetDifficultyFromBits(blockindex->nBits);
+}
+
 UniValue blockheaderToJSON(const CBlockIndex* blockindex)
 {
     UniValue result(UniValue::VOBJ);
@@ -114,12 +125,12 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
         {
             UniValue objTx(UniValue::VOBJ);
             TxToJSON(tx, uint256(), objTx);
-            txs.push_back(objTx);
+            txs.push_back(std::move(objTx));
         }
         else
             txs.push_back(tx.GetHash().GetHex());
     }
-    result.push_back(Pair("tx", txs));
+    result.push_back(Pair("tx", std::move(txs)));
     result.push_back(Pair("time", block.GetBlockTime()));
     result.push_back(Pair("mediantime", (int64_t)blockindex->GetMedianTimePast()));
     result.push_back(Pair("nonce", (uint64_t)block.nNonce));
@@ -148,8 +159,8 @@ UniValue getblockcount(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockcount", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Height();
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    return tip ? tip->nHeight : -1;
 }
 
 UniValue getbestblockhash(const UniValue& params, bool fHelp)
@@ -165,8 +176,10 @@ UniValue getbestblockhash(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getbestblockhash", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Tip()->GetBlockHash().GetHex();
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    if (!tip)
+        throw JSONRPCError(RPC_MISC_ERROR, "No blocks loaded");
+    return tip->hashBlock.GetHex();
 }
 
 UniValue getdifficulty(const UniValue& params, bool fHelp)
@@ -182,8 +195,8 @@ UniValue getdifficulty(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getdifficulty", "")
         );
 
-    LOCK(cs_main);
-    return GetDifficulty();
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    return tip ? GetDifficultyFromBits(tip->nBits) : 1.0;
 }
 
 std::string EntryDescriptionString()
@@ -240,8 +253,8 @@ UniValue mempoolToJSON(bool fVerbose = false)
                 depends.push_back(dep);
             }
 
-            info.push_back(Pair("depends", depends));
-            o.push_back(Pair(hash.ToString(), info));
+            info.push_back(Pair("depends", std::move(depends)));
+            o.push_back(Pair(hash.ToString(), std::move(info)));
         }
         return o;
     }
@@ -294,7 +307,7 @@ UniValue getblockhashes(const UniValue& params, bool fHelp)
     if (fHelp || params.size() != 2)
         throw runtime_error(
             "getblockhashes timestamp\n"
-            "\nReturns array of hashes of blocks within the timestamp range provided.\n"
+            "\nReturns array of hashes of blocks in the best chain within the timestamp range provided, ordered by time.\n"
             "\nArguments:\n"
             "1. high         (numeric, required) The newer block timestamp\n"
             "2. low          (numeric, required) The older block timestamp\n"
@@ -636,30 +649,96 @@ static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
     return true;
 }
 
+//! Threads to scan the UTXO set with, if its statistics are not known
+static const int MAX_UTXO_SCAN_THREADS = 8;
+
+//! Compute the statistics of the UTXO set kept while connecting blocks by scanning it, for when they are not known
+static bool ScanUTXOStats(CCoinsViewDB *view, CUTXOStats &stats)
+{
+    // The hash of the set doesn't depend on the order of the coins, so parts of it can be scanned in parallel.
+    std::vector<CUTXOStats> vStats(std::max(1, std::min(GetNumCores(), MAX_UTXO_SCAN_THREADS)));
+    bool fOk = ParallelCoinsScan(*view, vStats, [](CCoinsViewCursor &cursor, CUTXOStats &statsPart) {
+        statsPart.hashBlock = cursor.GetBestBlock();
+        for (; cursor.Valid(); cursor.Next()) {
+            COutPoint key;
+            Coin coin;
+            if (!cursor.GetKey(key) || !cursor.GetValue(coin))
+                return false;
+            statsPart.AddCoin(key, coin);
+        }
+        return true;
+    });
+    if (!fOk)
+        return error("%s: unable to read value", __func__);
+
+    stats = CUTXOStats();
+    stats.hashBlock = vStats[0].hashBlock;
+    for (const CUTXOStats &statsPart : vStats)
+        stats.Add(statsPart);
+    return true;
+}
+
 UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time, unless hash_type is muhash or none: those are answered from\n"
+            "statistics kept up to date with every block, once they are known.\n"
+            "\nArguments:\n"
+            "1. \"hash_type\"   (string, optional, default=hash_serialized_2) Which hash of the set to compute: hash_serialized_2, muhash or none\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) the best block hash hex\n"
-            "  \"transactions\": n,      (numeric) The number of transactions\n"
+            "  \"transactions\": n,      (numeric) The number of transactions, with hash_serialized_2 only\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"bogosize\": n,          (numeric) A database independent measure of the size of the set, not with hash_serialized_2\n"
+            "  \"hash_serialized_2\": \"hash\",   (string) The serialized hash, with hash_serialized_2 only\n"
+            "  \"muhash\": \"hash\",      (string) The order independent hash of the set, with muhash only\n"
             "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
-            + HelpExampleRpc("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "\"muhash\"")
+            + HelpExampleRpc("gettxoutsetinfo", "\"muhash\"")
         );
 
     UniValue ret(UniValue::VOBJ);
 
+    std::string strHashType = params.size() > 0 ? params[0].get_str() : "hash_serialized_2";
+    if (strHashType != "hash_serialized_2" && strHashType != "muhash" && strHashType != "none")
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown hash_type " + strHashType);
+
+    if (strHashType != "hash_serialized_2") {
+        CUTXOStats stats;
+        if (!GetTipUTXOStats(stats)) {
+            FlushStateToDisk();
+            if (!pcoinsdbview->Sync() || !ScanUTXOStats(pcoinsdbview, stats))
+                return ret;
+            // Keep the result, so that the next calls are fast
+            SetTipUTXOStats(stats);
+        }
+
+        int nHeight;
+        {
+            LOCK(cs_main);
+            BlockMap::const_iterator it = mapBlockIndex.find(stats.hashBlock);
+            nHeight = it != mapBlockIndex.end() ? it->second->nHeight : -1;
+        }
+        ret.push_back(Pair("height", (int64_t)nHeight));
+        ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+        ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
+        ret.push_back(Pair("bogosize", (int64_t)stats.nBogoSize));
+        if (strHashType == "muhash")
+            ret.push_back(Pair("muhash", stats.GetHash().GetHex()));
+        ret.push_back(Pair("disk_size", (uint64_t)pcoinsdbview->EstimateSize()));
+        ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+        return ret;
+    }
+
     CCoinsStats stats;
     FlushStateToDisk();
     if (GetUTXOStats(pcoinsdbview, stats)) {
@@ -674,6 +753,71 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
     return ret;
 }
 
+UniValue dumptxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrites the unspent transaction output set and the SmartRewards database to a file.\n"
+            "Other nodes which have the blocks up to the current tip can start from it with -loadtxoutset\n"
+            "instead of connecting all blocks and processing all rewards again.\n"
+            "\nArguments:\n"
+            "1. \"path\"      (string, required) The file to write, relative to the data directory unless absolute. It must not exist yet\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"path\": \"path\",          (string) The absolute path of the file written\n"
+            "  \"height\": n,              (numeric) The height of the block the set is as of\n"
+            "  \"bestblock\": \"hex\",       (string) The hash of that block\n"
+            "  \"txouts\": n,              (numeric) The number of unspent transaction outputs written\n"
+            "  \"muhash\": \"hash\",         (string) The hash of the set, the same as gettxoutsetinfo muhash\n"
+            "  \"rewards_height\": n,      (numeric) The last block the SmartRewards database written is as of\n"
+            "  \"rewards_records\": n      (numeric) The number of records of the SmartRewards database written\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    boost::filesystem::path path = boost::filesystem::absolute(params[0].get_str(), GetDataDir());
+    if (boost::filesystem::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+
+    CUTXOSnapshotHeader header;
+    std::unique_ptr<CCoinsViewCursor> pcursor;
+    std::unique_ptr<CDBIterator> prewardsCursor;
+    CSmartRewardBlock rewardsBlock;
+    {
+        // Both cursors see their database as it is when they get created, which no
+        // block connected in between may change. They get read without any lock.
+        LOCK(cs_main);
+        FlushStateToDisk();
+        pcursor.reset(pcoinsdbview->Cursor());
+        header.hashBlock = pcursor->GetBestBlock();
+        header.nHeight = chainActive.Height();
+        if (header.hashBlock != chainActive.Tip()->GetBlockHash())
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to write the coin database");
+        prewardsCursor.reset(prewards->NewSyncedIterator(rewardsBlock));
+        if (!prewardsCursor)
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to write the SmartRewards database");
+    }
+
+    CUTXOStats stats;
+    uint64_t nRewardsRecords = 0;
+    std::string strError;
+    if (!WriteUTXOSnapshot(path, header, *pcursor, *prewardsCursor, stats, nRewardsRecords, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("path", path.string()));
+    ret.push_back(Pair("height", (int64_t)header.nHeight));
+    ret.push_back(Pair("bestblock", header.hashBlock.GetHex()));
+    ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
+    ret.push_back(Pair("muhash", stats.GetHash().GetHex()));
+    ret.push_back(Pair("rewards_height", (int64_t)rewardsBlock.nHeight));
+    ret.push_back(Pair("rewards_records", (int64_t)nRewardsRecords));
+    return ret;
+}
+
 UniValue gettxout(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -782,17 +926,50 @@ UniValue verifychain(const UniValue& params, bool fHelp)
     return CVerifyDB().VerifyDB(Params(), pcoinsTip, nCheckLevel, nCheckDepth);
 }
 
+UniValue setdbprofile(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "setdbprofile \"profile\"\n"
+            "\nSwitches the database tuning profile.\n"
+            "Whether reads fill the block cache changes right away. Cache and write buffer sizes and the\n"
+            "number of open files are fixed when a database is opened: they follow the new profile from the\n"
+            "next start, given the same profile with -dbprofile.\n"
+            "\nArguments:\n"
+            "1. \"profile\"     (string, required) One of " + GetDBProfileNames() + "\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"profile\": \"name\",          (string) The profile now in use\n"
+            "  \"blockcache\": n,            (numeric) Percent of a database's cache used as block cache, once reopened\n"
+            "  \"writebuffer\": n,           (numeric) Percent of it used per write buffer, once reopened\n"
+            "  \"maxopenfiles\": n,          (numeric) Files kept open per database, once reopened\n"
+            "  \"fillcacheonread\": true|false,     (boolean) Whether reads add blocks to the cache\n"
+            "  \"fillcacheoniterate\": true|false   (boolean) Whether iterators add blocks to the cache\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("setdbprofile", "\"ibd\"")
+            + HelpExampleRpc("setdbprofile", "\"ibd\"")
+        );
+
+    std::string strProfile = params[0].get_str();
+    if (!SetDBProfile(strProfile))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown database profile: " + strProfile);
+
+    const CDBProfile& profile = GetDBProfile();
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("profile", profile.strName));
+    ret.push_back(Pair("blockcache", profile.nBlockCachePercent));
+    ret.push_back(Pair("writebuffer", profile.nWriteBufferPercent));
+    ret.push_back(Pair("maxopenfiles", profile.nMaxOpenFiles));
+    ret.push_back(Pair("fillcacheonread", profile.fFillCacheOnRead));
+    ret.push_back(Pair("fillcacheoniterate", profile.fFillCacheOnIterate));
+    return ret;
+}
+
 /** Implementation of IsSuperMajority with better feedback */
 static UniValue SoftForkMajorityDesc(int minVersion, CBlockIndex* pindex, int nRequired, const Consensus::Params& consensusParams)
 {
-    int nFound = 0;
-    CBlockIndex* pstart = pindex;
-    for (int i = 0; i < consensusParams.nMajorityWindow && pstart != NULL; i++)
-    {
-        if (pstart->nVersion >= minVersion)
-            ++nFound;
-        pstart = pstart->pprev;
-    }
+    int nFound = CountBlocksAtVersion(pindex, minVersion, consensusParams.nMajorityWindow);
 
     UniValue rv(UniValue::VOBJ);
     rv.push_back(Pair("status", nFound >= nRequired));
@@ -922,6 +1099,113 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
     return obj;
 }
 
+//! Max. number of past median windows getblocksizeinfo reports
+static const int MAX_BLOCK_SIZE_INFO_WINDOWS = 100;
+
+static UniValue blockSizeWindowToJSON(const BlockSizeCalculator::WindowStats& stats)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("height", stats.nHeight));
+    obj.push_back(Pair("blocks", (uint64_t)stats.nBlocks));
+    obj.push_back(Pair("median", (uint64_t)stats.nMedian));
+    obj.push_back(Pair("limit", (uint64_t)stats.nMaxBlockSize));
+    obj.push_back(Pair("average", stats.nBlocks ? stats.nTotalSize / stats.nBlocks : 0));
+    obj.push_back(Pair("largest", (uint64_t)stats.nLargest));
+    return obj;
+}
+
+UniValue getblocksizeinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 2)
+        throw runtime_error(
+            "getblocksizeinfo ( windows forecastblocks )\n"
+            "\nReturns the state of the adaptive block size limit. It is taken from the sizes kept in the\n"
+            "block index, no block gets read from disk.\n"
+            "\nArguments:\n"
+            "1. windows          (numeric, optional, default=10) Number of past median windows to report, at most "
+            + strprintf("%d", MAX_BLOCK_SIZE_INFO_WINDOWS) + "\n"
+            "2. forecastblocks   (numeric, optional, default=144) Number of upcoming blocks the forecast assumes\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"height\": xxxxxx,              (numeric) The current number of blocks\n"
+            "  \"maxblocksize\": xxxxxx,        (numeric) Block size limit in effect for the last connected block\n"
+            "  \"maxblocksigops\": xxxxxx,      (numeric) Block sigops limit in effect\n"
+            "  \"maxstandardtxsigops\": xxxxxx, (numeric) Sigops limit of standard transactions in effect\n"
+            "  \"window\": xxxxxx,              (numeric) Number of blocks the median is taken over\n"
+            "  \"current\": {                   (json object) The window ending at the tip\n"
+            "    \"height\": xxxxxx,            (numeric) Last block of the window\n"
+            "    \"blocks\": xxxxxx,            (numeric) Blocks of the window with a known size\n"
+            "    \"median\": xxxxxx,            (numeric) Median block size, 0 until the window is full\n"
+            "    \"limit\": xxxxxx,             (numeric) Block size limit resulting from the median\n"
+            "    \"average\": xxxxxx,           (numeric) Average block size\n"
+            "    \"largest\": xxxxxx            (numeric) Size of the largest block\n"
+            "  },\n"
+            "  \"forecast\": {                  (json object) Limit if the upcoming blocks are as large as the recent ones\n"
+            "    \"blocks\": xxxxxx,            (numeric) Number of upcoming blocks\n"
+            "    \"size\": xxxxxx,              (numeric) Average size of the same number of blocks up to the tip\n"
+            "    \"limit\": xxxxxx              (numeric) Block size limit after the upcoming blocks\n"
+            "  },\n"
+            "  \"history\": [                   (json array) Past windows, ending every window length before the tip, newest first\n"
+            "    { ... }                        (json object) Same fields as \"current\"\n"
+            "    ,...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblocksizeinfo", "")
+            + HelpExampleCli("getblocksizeinfo", "20 2016")
+            + HelpExampleRpc("getblocksizeinfo", "20, 2016")
+        );
+
+    int nWindows = 10;
+    if (params.size() > 0)
+        nWindows = params[0].get_int();
+    if (nWindows < 0 || nWindows > MAX_BLOCK_SIZE_INFO_WINDOWS)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("windows must be between 0 and %d", MAX_BLOCK_SIZE_INFO_WINDOWS));
+
+    int nForecastBlocks = 144;
+    if (params.size() > 1)
+        nForecastBlocks = params[1].get_int();
+    if (nForecastBlocks < 1)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "forecastblocks must be positive");
+
+    LOCK(cs_main);
+
+    CBlockIndex* pindexTip = chainActive.Tip();
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("height", pindexTip->nHeight));
+    obj.push_back(Pair("maxblocksize", (uint64_t)maxBlockSize));
+    obj.push_back(Pair("maxblocksigops", (uint64_t)maxBlockSigops));
+    obj.push_back(Pair("maxstandardtxsigops", (uint64_t)maxStandardTxSigops));
+    obj.push_back(Pair("window", (uint64_t)NUM_BLOCKS_FOR_MEDIAN_BLOCK));
+    obj.push_back(Pair("current", blockSizeWindowToJSON(BlockSizeCalculator::GetWindowStats(pindexTip))));
+
+    uint64_t nRecentSize = 0;
+    int nRecentBlocks = 0;
+    for (CBlockIndex* pindex = pindexTip; pindex && nRecentBlocks < nForecastBlocks; pindex = pindex->pprev, nRecentBlocks++) {
+        if (pindex->nStatus & BLOCK_HAVE_SIZE)
+            nRecentSize += pindex->nSize;
+    }
+    unsigned int nForecastSize = nRecentBlocks ? nRecentSize / nRecentBlocks : 0;
+
+    UniValue forecast(UniValue::VOBJ);
+    forecast.push_back(Pair("blocks", nForecastBlocks));
+    forecast.push_back(Pair("size", (uint64_t)nForecastSize));
+    forecast.push_back(Pair("limit", (uint64_t)BlockSizeCalculator::ForecastBlockSize(pindexTip, nForecastBlocks, nForecastSize)));
+    obj.push_back(Pair("forecast", forecast));
+
+    UniValue history(UniValue::VARR);
+    for (int i = 1; i <= nWindows; i++) {
+        int nHeight = pindexTip->nHeight - i * (int)NUM_BLOCKS_FOR_MEDIAN_BLOCK;
+        if (nHeight < 0)
+            break;
+        history.push_back(blockSizeWindowToJSON(BlockSizeCalculator::GetWindowStats(chainActive[nHeight])));
+    }
+    obj.push_back(Pair("history", history));
+
+    return obj;
+}
+
 /** Comparison function for sorting the getchaintips heads.  */
 struct CompareBlocksByHeight
 {
@@ -1075,6 +1359,105 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
     return mempoolInfoToJSON();
 }
 
+static UniValue mempoolStageStatsToJSON(const CMempoolStageStats& stats)
+{
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("count", (uint64_t)stats.nCount));
+    ret.push_back(Pair("total_us", stats.nTotalMicros));
+    ret.push_back(Pair("avg_us", stats.nCount ? (double)stats.nTotalMicros / stats.nCount : 0.0));
+    ret.push_back(Pair("max_us", stats.nMaxMicros));
+    UniValue histogram(UniValue::VARR);
+    for (int i = 0; i < MEMPOOL_STATS_BUCKETS; i++)
+        histogram.push_back((uint64_t)stats.vHistogram[i]);
+    ret.push_back(Pair("histogram", histogram));
+    return ret;
+}
+
+UniValue mempoolStatsToJSON(bool fReset)
+{
+    std::vector<CMempoolStageStats> vStages;
+    CMempoolStageStats total;
+    uint64_t nAccepted, nRejected;
+    GetMempoolAcceptStats(vStages, total, nAccepted, nRejected, fReset);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("accepted", nAccepted));
+    ret.push_back(Pair("rejected", nRejected));
+    ret.push_back(Pair("total", mempoolStageStatsToJSON(total)));
+    UniValue stages(UniValue::VOBJ);
+    for (size_t i = 0; i < vStages.size(); i++)
+        stages.push_back(Pair(GetMempoolAcceptStageName(i), mempoolStageStatsToJSON(vStages[i])));
+    ret.push_back(Pair("stages", stages));
+    return ret;
+}
+
+UniValue getmempoolstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getmempoolstats ( reset )\n"
+            "\nReturns where accepting transactions to the memory pool spends its time, since startup or the last reset.\n"
+            "\nArguments:\n"
+            "1. reset          (boolean, optional, default=false) Reset the statistics after returning them\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"accepted\": n,                 (numeric) Transactions accepted\n"
+            "  \"rejected\": n,                 (numeric) Transactions rejected\n"
+            "  \"total\": {                     (json object) Timings of whole acceptance attempts\n"
+            "    \"count\": n,                  (numeric) Number of timings\n"
+            "    \"total_us\": n,               (numeric) Sum of the timings in microseconds\n"
+            "    \"avg_us\": n.nnn,             (numeric) Average timing in microseconds\n"
+            "    \"max_us\": n,                 (numeric) Longest timing in microseconds\n"
+            "    \"histogram\": [n,...]         (array) Entry i counts timings below 2^i microseconds, the last one all longer\n"
+            "  },\n"
+            "  \"stages\": {                    (json object) Timings of the stages of acceptance, like \"total\". A rejected\n"
+            "                                    transaction counts towards the stages up to and including the rejecting one\n"
+            "    \"prechecks\": {...},          (json object) Context free checks, finality and standardness\n"
+            "    \"instantsend\": {...},        (json object) InstantSend lock request and lock conflict checks\n"
+            "    \"conflicts\": {...},          (json object) Conflicts with memory pool transactions\n"
+            "    \"coins\": {...},              (json object) Coin lookups and sequence locks\n"
+            "    \"policy\": {...},             (json object) Input standardness, sigops, fees and free relay limits\n"
+            "    \"ancestors\": {...},          (json object) In-mempool ancestors and their limits\n"
+            "    \"replacement\": {...},        (json object) Fee checks against replaced transactions\n"
+            "    \"scripts\": {...},            (json object) Script verification\n"
+            "    \"insert\": {...},             (json object) Removing replaced transactions and adding the new one\n"
+            "    \"index\": {...},              (json object) Address and spent index\n"
+            "    \"trim\": {...},               (json object) Expiry and limiting the memory pool size\n"
+            "    \"notify\": {...}              (json object) Transaction notifications\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmempoolstats", "")
+            + HelpExampleRpc("getmempoolstats", "true")
+        );
+
+    bool fReset = false;
+    if (params.size() > 0)
+        fReset = params[0].get_bool();
+
+    return mempoolStatsToJSON(fReset);
+}
+
+UniValue savemempool(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "savemempool\n"
+            "\nDumps the mempool to disk. It will fail until the previous dump is fully loaded.\n"
+            "\nExamples:\n"
+            + HelpExampleCli("savemempool", "")
+            + HelpExampleRpc("savemempool", "")
+        );
+
+    if (!mempool.IsLoaded())
+        throw JSONRPCError(RPC_MISC_ERROR, "The mempool was not loaded yet");
+
+    if (!DumpMempool())
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to dump mempool to disk");
+
+    return NullUniValue;
+}
+
 UniValue invalidateblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -54,6 +54,8 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getbalance", 1 },
     { "getbalance", 2 },
     { "getbalance", 3 },
+    { "getblocksizeinfo", 0 },
+    { "getblocksizeinfo", 1 },
     { "getchaintips", 0 },
     { "getchaintips", 1 },
     { "getblockhash", 0 },
@@ -90,6 +92,9 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getblockheader", 1 },
     { "getblockheaders", 1 },
     { "getblockheaders", 2 },
+    { "getrpcstats", 0 },
+    { "getlockstats", 0 },
+    { "getlockstats", 1 },
     { "gettransaction", 1 },
     { "getrawtransaction", 1 },
     { "createrawtransaction", 0 },
@@ -99,6 +104,8 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "signrawtransaction", 2 },
     { "sendrawtransaction", 1 },
     { "sendrawtransaction", 2 },    
+    { "sendrawtransactions", 0 },
+    { "sendrawtransactions", 1 },
     { "fundrawtransaction", 1 },
     { "gettxout", 1 },
     { "gettxout", 2 },
@@ -114,6 +121,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "verifychain", 1 },
     { "keypoolrefill", 0 },
     { "getrawmempool", 0 },
+    { "getmempoolstats", 0 },
     { "estimatefee", 0 },
     { "estimatepriority", 0 },
     { "estimatesmartfee", 0 },
@@ -123,6 +131,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "setban", 2 },
     { "setban", 3 },
     { "setnetworkactive", 0 },
+    { "smartnodelist", 2 },
     { "spork", 1 },
     { "voteraw", 1 },
     { "voteraw", 5 },
@@ -6,10 +6,13 @@
 #include "base58.h"
 #include "clientversion.h"
 #include "init.h"
+#include "memorybudget.h"
 #include "validation.h"
 #include "net.h"
 #include "netbase.h"
 #include "rpc/server.h"
+#include "streams.h"
+#include "support/lockedpool.h"
 #include "timedata.h"
 #include "util.h"
 #include "utilstrencodings.h"
@@ -362,6 +365,63 @@ UniValue debug(const UniValue& params, bool fHelp)
     return "Debug mode: " + (fDebug ? strMode : "off");
 }
 
+UniValue getmemoryinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getmemoryinfo\n"
+            "Returns an object containing information about memory usage.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"locked\": {               (json object) Information about locked memory manager\n"
+            "    \"used\": xxxxx,          (numeric) Number of bytes used\n"
+            "    \"free\": xxxxx,          (numeric) Number of bytes available in current arenas\n"
+            "    \"total\": xxxxxxx,       (numeric) Total number of bytes managed\n"
+            "    \"locked\": xxxxxx,       (numeric) Amount of bytes that succeeded locking. If this number is smaller than total, locking pages failed at some point and key data could be swapped to disk.\n"
+            "    \"arenas\": xxxxx,        (numeric) Number of arenas the memory is managed in\n"
+            "    \"chunks_used\": xxxxx,   (numeric) Number allocated chunks\n"
+            "    \"chunks_free\": xxxxx,   (numeric) Number unused chunks\n"
+            "  },\n"
+            "  \"caches\": {               (json object) Estimated memory usage of the caches in bytes\n"
+            "    \"coins\": xxxxx,         (numeric) In-memory UTXO set\n"
+            "    \"mempool\": xxxxx,       (numeric) Transaction memory pool\n"
+            "    \"relay\": xxxxx,         (numeric) Transactions kept for relay\n"
+            "    \"rewards\": xxxxx,       (numeric) Cached reward entries\n"
+            "    \"sigcache\": xxxxx,      (numeric) Signature cache\n"
+            "    \"total\": xxxxx,         (numeric) All of the above\n"
+            "    \"limit\": xxxxx,         (numeric) The -maxmemory they get shrunk to, 0 for none\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getmemoryinfo", "")
+            + HelpExampleRpc("getmemoryinfo", "")
+        );
+
+    LockedPool::Stats stats = LockedPoolManager::Instance().stats();
+    UniValue locked(UniValue::VOBJ);
+    locked.push_back(Pair("used", uint64_t(stats.used)));
+    locked.push_back(Pair("free", uint64_t(stats.free)));
+    locked.push_back(Pair("total", uint64_t(stats.total)));
+    locked.push_back(Pair("locked", uint64_t(stats.locked)));
+    locked.push_back(Pair("arenas", uint64_t(stats.arenas)));
+    locked.push_back(Pair("chunks_used", uint64_t(stats.chunks_used)));
+    locked.push_back(Pair("chunks_free", uint64_t(stats.chunks_free)));
+
+    UniValue caches(UniValue::VOBJ);
+    uint64_t nTotal = 0;
+    for (const auto& usage : memoryBudget.GetUsage()) {
+        caches.push_back(Pair(usage.first, uint64_t(usage.second)));
+        nTotal += usage.second;
+    }
+    caches.push_back(Pair("total", nTotal));
+    caches.push_back(Pair("limit", uint64_t(memoryBudget.GetLimit())));
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("locked", locked));
+    obj.push_back(Pair("caches", caches));
+    return obj;
+}
+
 UniValue snsync(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -382,6 +442,8 @@ UniValue snsync(const UniValue& params, bool fHelp)
         objStatus.push_back(Pair("IsWinnersListSynced", smartnodeSync.IsWinnersListSynced()));
         objStatus.push_back(Pair("IsSynced", smartnodeSync.IsSynced()));
         objStatus.push_back(Pair("IsFailed", smartnodeSync.IsFailed()));
+        objStatus.push_back(Pair("IsAdaptive", smartnodeSync.IsAdaptive()));
+        objStatus.push_back(Pair("Assets", smartnodeSync.GetAssetStatsJSON()));
         return objStatus;
     }
 
@@ -624,6 +686,83 @@ bool timestampSort(std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> a,
     return a.second.time < b.second.time;
 }
 
+//! Maximum number of entries a page of getaddressdeltas or getaddressutxos can hold
+static const int MAX_ADDRESS_PAGE_SIZE = 100000;
+
+/**
+ * Read the paging arguments of getaddressdeltas and getaddressutxos: a page holds at most "limit"
+ * entries and starts after the entry "cursor" refers to, which is what the previous page returned.
+ * Returns false if no limit is given, that is, everything is asked for at once.
+ */
+template <typename K>
+bool getPageFromParams(const UniValue& params, size_t &nLimit, bool &fCursor, K &keyCursor)
+{
+    if (!params[0].isObject())
+        return false;
+
+    UniValue limitValue = find_value(params[0].get_obj(), "limit");
+    if (limitValue.isNull())
+        return false;
+    int limit = limitValue.get_int();
+    if (limit <= 0 || limit > MAX_ADDRESS_PAGE_SIZE) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Limit is expected to be between 1 and %d", MAX_ADDRESS_PAGE_SIZE));
+    }
+    nLimit = limit;
+
+    UniValue cursorValue = find_value(params[0].get_obj(), "cursor");
+    fCursor = !cursorValue.isNull();
+    if (fCursor) {
+        CDataStream ss(ParseHexV(cursorValue, "cursor"), SER_DISK, CLIENT_VERSION);
+        try {
+            ss >> keyCursor;
+        } catch (const std::exception&) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+        }
+        if (!ss.empty()) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+        }
+    }
+    return true;
+}
+
+template <typename K>
+std::string getCursor(const K &key)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << key;
+    return HexStr(ss.begin(), ss.end());
+}
+
+/**
+ * Read a page of entries of addresses with read(address, entries, limit, keyAfter), which appends
+ * at most limit entries of the address after keyAfter (if it's not NULL) in the order of the index.
+ * Returns whether there are entries after the page.
+ */
+template <typename K, typename V, typename Fn>
+bool getAddressPage(const std::vector<std::pair<uint160, int> > &addresses, size_t nLimit, bool fCursor, const K &keyCursor,
+                    std::vector<std::pair<K, V> > &entries, Fn read)
+{
+    std::vector<std::pair<uint160, int> >::const_iterator it = addresses.begin();
+    if (fCursor) {
+        it = std::find(addresses.begin(), addresses.end(), std::make_pair(keyCursor.hashBytes, (int)keyCursor.type));
+        if (it == addresses.end()) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Cursor is not for one of the addresses");
+        }
+    }
+
+    // Read one entry more than fits the page to know whether there is another page
+    for (const K *pkeyAfter = fCursor ? &keyCursor : NULL; it != addresses.end() && entries.size() <= nLimit; it++, pkeyAfter = NULL) {
+        if (!read(*it, entries, nLimit + 1 - entries.size(), pkeyAfter)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+        }
+    }
+
+    if (entries.size() <= nLimit)
+        return false;
+    entries.resize(nLimit);
+    return true;
+}
+
 UniValue getaddressmempool(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -708,6 +847,8 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
             "      \"address\"  (string) The base58check encoded address\n"
             "      ,...\n"
             "    ]\n"
+            "  \"limit\" (number, optional) Return a page of at most this many outputs, in the order of the index\n"
+            "  \"cursor\" (string, optional) Where the page starts, the cursor of the previous page\n"
             "}\n"
             "\nResult\n"
             "[\n"
@@ -720,8 +861,14 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
             "    \"height\"  (number) The block height\n"
             "  }\n"
             "]\n"
+            "\nResult (with a limit):\n"
+            "{\n"
+            "  \"utxos\": [ ... ]  (array) The outputs of the page, as above\n"
+            "  \"cursor\"  (string) The cursor of the next page, not there for the last one\n"
+            "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddressutxos", "'{\"addresses\": [\"SwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"]}'")
+            + HelpExampleCli("getaddressutxos", "'{\"addresses\": [\"SwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"], \"limit\": 1000}'")
             + HelpExampleRpc("getaddressutxos", "{\"addresses\": [\"SwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"]}")
         );
 
@@ -733,13 +880,27 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
 
     std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
 
-    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (!GetAddressUnspent((*it).first, (*it).second, unspentOutputs)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+    size_t nLimit = 0;
+    bool fCursor = false;
+    CAddressUnspentKey keyCursor;
+    bool fPaged = getPageFromParams(params, nLimit, fCursor, keyCursor);
+    bool fMore = false;
+
+    if (fPaged) {
+        fMore = getAddressPage(addresses, nLimit, fCursor, keyCursor, unspentOutputs,
+            [](const std::pair<uint160, int> &address, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &entries,
+               size_t nLimitAddress, const CAddressUnspentKey *pkeyAfter) {
+                return GetAddressUnspent(address.first, address.second, entries, nLimitAddress, pkeyAfter);
+            });
+    } else {
+        for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
+            if (!GetAddressUnspent((*it).first, (*it).second, unspentOutputs)) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+            }
         }
-    }
 
-    std::sort(unspentOutputs.begin(), unspentOutputs.end(), heightSort);
+        std::sort(unspentOutputs.begin(), unspentOutputs.end(), heightSort);
+    }
 
     UniValue result(UniValue::VARR);
 
@@ -759,6 +920,14 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
         result.push_back(output);
     }
 
+    if (fPaged) {
+        UniValue page(UniValue::VOBJ);
+        page.push_back(Pair("utxos", result));
+        if (fMore)
+            page.push_back(Pair("cursor", getCursor(unspentOutputs.back().first)));
+        return page;
+    }
+
     return result;
 }
 
@@ -777,6 +946,8 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
             "    ]\n"
             "  \"start\" (number) The start block height\n"
             "  \"end\" (number) The end block height\n"
+            "  \"limit\" (number, optional) Return a page of at most this many changes\n"
+            "  \"cursor\" (string, optional) Where the page starts, the cursor of the previous page\n"
             "}\n"
             "\nResult:\n"
             "[\n"
@@ -789,8 +960,14 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
             "    \"address\"  (string) The base58check encoded address\n"
             "  }\n"
             "]\n"
+            "\nResult (with a limit):\n"
+            "{\n"
+            "  \"deltas\": [ ... ]  (array) The changes of the page, as above\n"
+            "  \"cursor\"  (string) The cursor of the next page, not there for the last one\n"
+            "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddressdeltas", "'{\"addresses\": [\"SwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"]}'")
+            + HelpExampleCli("getaddressdeltas", "'{\"addresses\": [\"SwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"], \"limit\": 1000}'")
             + HelpExampleRpc("getaddressdeltas", "{\"addresses\": [\"SwnLY9Tf7Zsef8gMGL2fhWA9ZmMjt4KPwg\"]}")
         );
 
@@ -817,14 +994,28 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
 
     std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
 
-    for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
-        if (start > 0 && end > 0) {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex, start, end)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-            }
-        } else {
-            if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
-                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+    size_t nLimit = 0;
+    bool fCursor = false;
+    CAddressIndexKey keyCursor;
+    bool fPaged = getPageFromParams(params, nLimit, fCursor, keyCursor);
+    bool fMore = false;
+
+    if (fPaged) {
+        fMore = getAddressPage(addresses, nLimit, fCursor, keyCursor, addressIndex,
+            [start, end](const std::pair<uint160, int> &address, std::vector<std::pair<CAddressIndexKey, CAmount> > &entries,
+                         size_t nLimitAddress, const CAddressIndexKey *pkeyAfter) {
+                return GetAddressIndex(address.first, address.second, entries, start, end, nLimitAddress, pkeyAfter);
+            });
+    } else {
+        for (std::vector<std::pair<uint160, int> >::iterator it = addresses.begin(); it != addresses.end(); it++) {
+            if (start > 0 && end > 0) {
+                if (!GetAddressIndex((*it).first, (*it).second, addressIndex, start, end)) {
+                    throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+                }
+            } else {
+                if (!GetAddressIndex((*it).first, (*it).second, addressIndex)) {
+                    throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+                }
             }
         }
     }
@@ -847,6 +1038,14 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
         result.push_back(delta);
     }
 
+    if (fPaged) {
+        UniValue page(UniValue::VOBJ);
+        page.push_back(Pair("deltas", result));
+        if (fMore)
+            page.push_back(Pair("cursor", getCursor(addressIndex.back().first)));
+        return page;
+    }
+
     return result;
 }
 
@@ -101,6 +101,12 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
             "    ]\n"
+            "    \"blocks_inflight\": n,      (numeric) The number of blocks we're currently asking from this peer\n"
+            "    \"inflight_limit\": n,       (numeric) The number of blocks we ask from this peer at once, adapted to its download speed\n"
+            "    \"download_window\": n,      (numeric) How many blocks beyond the last common block we fetch from this peer\n"
+            "    \"blockdownloadtime\": n,    (numeric) Average time in seconds this peer took to deliver a requested block, if known\n"
+            "    \"blocks_downloaded\": n,    (numeric) The number of requested blocks this peer delivered\n"
+            "    \"stalls\": n,               (numeric) The number of times this peer stalled our block download\n"
             "    \"bytessent_per_msg\": {\n"
             "       \"addr\": n,             (numeric) The total bytes sent aggregated by message type\n"
             "       ...\n"
@@ -163,6 +169,13 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
                 heights.push_back(height);
             }
             obj.push_back(Pair("inflight", heights));
+            obj.push_back(Pair("blocks_inflight", statestats.nBlocksInFlight));
+            obj.push_back(Pair("inflight_limit", statestats.nBlocksInTransitLimit));
+            obj.push_back(Pair("download_window", statestats.nBlockDownloadWindow));
+            if (statestats.nBlockDownloadTime > 0)
+                obj.push_back(Pair("blockdownloadtime", statestats.nBlockDownloadTime / 1e6));
+            obj.push_back(Pair("blocks_downloaded", statestats.nBlocksDownloaded));
+            obj.push_back(Pair("stalls", statestats.nStallCount));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
 
@@ -340,6 +353,18 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
             "    \"serve_historical_blocks\": true|false,  (boolean) True if serving historical blocks\n"
             "    \"bytes_left_in_cycle\": t,               (numeric) Bytes left in current time cycle\n"
             "    \"time_left_in_cycle\": t                 (numeric) Seconds left in current time cycle\n"
+            "  },\n"
+            "  \"uploadlimits\":               (json object) Limits set with -uploadlimit, by peer class\n"
+            "  {\n"
+            "    \"inbound\": {              (json object) Also outbound, smartnode and whitelisted\n"
+            "      \"blocks\": {             (json object) Also tx\n"
+            "        \"limit\": n,           (numeric) Limit in bytes per second, 0 for none\n"
+            "        \"bytes_sent\": n,      (numeric) Bytes sent to this class of peers\n"
+            "        \"available\": n        (numeric) Bytes that can be sent right now, negative while paying off a large message\n"
+            "      },\n"
+            "      ...\n"
+            "    },\n"
+            "    ...\n"
             "  }\n"
             "}\n"
             "\nExamples:\n"
@@ -360,6 +385,21 @@ UniValue getnettotals(const UniValue& params, bool fHelp)
     outboundLimit.push_back(Pair("bytes_left_in_cycle", g_connman->GetOutboundTargetBytesLeft()));
     outboundLimit.push_back(Pair("time_left_in_cycle", g_connman->GetMaxOutboundTimeLeftInCycle()));
     obj.push_back(Pair("uploadtarget", outboundLimit));
+
+    UniValue uploadLimits(UniValue::VOBJ);
+    for (int nClass = 0; nClass < PEER_CLASS_MAX; nClass++) {
+        UniValue classLimits(UniValue::VOBJ);
+        for (int nTraffic = 0; nTraffic < UPLOAD_TRAFFIC_MAX; nTraffic++) {
+            CUploadBucket bucket = g_connman->GetUploadBucket((PeerClass)nClass, (UploadTraffic)nTraffic);
+            UniValue limit(UniValue::VOBJ);
+            limit.push_back(Pair("limit", bucket.nRate));
+            limit.push_back(Pair("bytes_sent", bucket.nBytesSent));
+            limit.push_back(Pair("available", bucket.nTokens));
+            classLimits.push_back(Pair(GetUploadTrafficName(nTraffic), limit));
+        }
+        uploadLimits.push_back(Pair(GetPeerClassName(nClass), classLimits));
+    }
+    obj.push_back(Pair("uploadlimits", uploadLimits));
     return obj;
 }
 
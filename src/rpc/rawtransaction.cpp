@@ -57,14 +57,14 @@ void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fInclud
     UniValue a(UniValue::VARR);
     BOOST_FOREACH(const CTxDestination& addr, addresses)
         a.push_back(CBitcoinAddress(addr).ToString());
-    out.push_back(Pair("addresses", a));
+    out.push_back(Pair("addresses", std::move(a)));
 }
 
 void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
 {
     uint256 txid = tx.GetHash();
     entry.push_back(Pair("txid", txid.GetHex()));
-    entry.push_back(Pair("size", (int)::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION)));
+    entry.push_back(Pair("size", (int)tx.GetTotalSize()));
     entry.push_back(Pair("version", tx.nVersion));
     entry.push_back(Pair("locktime", (int64_t)tx.nLockTime));
     UniValue vin(UniValue::VARR);
@@ -78,7 +78,7 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
             UniValue o(UniValue::VOBJ);
             o.push_back(Pair("asm", ScriptToAsmStr(txin.scriptSig, true)));
             o.push_back(Pair("hex", HexStr(txin.scriptSig.begin(), txin.scriptSig.end())));
-            in.push_back(Pair("scriptSig", o));
+            in.push_back(Pair("scriptSig", std::move(o)));
 
             // Add address and value info if spentindex enabled
             CSpentIndexValue spentInfo;
@@ -95,9 +95,9 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
 
         }
         in.push_back(Pair("sequence", (int64_t)txin.nSequence));
-        vin.push_back(in);
+        vin.push_back(std::move(in));
     }
-    entry.push_back(Pair("vin", vin));
+    entry.push_back(Pair("vin", std::move(vin)));
     UniValue vout(UniValue::VARR);
     for (unsigned int i = 0; i < tx.vout.size(); i++) {
         const CTxOut& txout = tx.vout[i];
@@ -107,7 +107,7 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
         out.push_back(Pair("n", (int64_t)i));
         UniValue o(UniValue::VOBJ);
         ScriptPubKeyToJSON(txout.scriptPubKey, o, true);
-        out.push_back(Pair("scriptPubKey", o));
+        out.push_back(Pair("scriptPubKey", std::move(o)));
 
         // Add spent information if spentindex is enabled
         CSpentIndexValue spentInfo;
@@ -118,9 +118,9 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
             out.push_back(Pair("spentHeight", spentInfo.blockHeight));
         }
 
-        vout.push_back(out);
+        vout.push_back(std::move(out));
     }
-    entry.push_back(Pair("vout", vout));
+    entry.push_back(Pair("vout", std::move(vout)));
 
     if (!hashBlock.IsNull()) {
         entry.push_back(Pair("blockhash", hashBlock.GetHex()));
@@ -913,4 +913,75 @@ UniValue sendrawtransaction(const UniValue& params, bool fHelp)
     g_connman->RelayTransaction(tx);
 
     return hashTx.GetHex();
-}
\ No newline at end of file
+}
+
+UniValue SendRawTransactions(const std::vector<CTransaction>& vtx, bool fRejectAbsurdFee)
+{
+    std::vector<CValidationState> vStates;
+    std::vector<bool> vfAccepted, vfMissingInputs;
+    AcceptToMemoryPoolBatch(mempool, vtx, vStates, vfAccepted, vfMissingInputs, fRejectAbsurdFee);
+
+    UniValue result(UniValue::VARR);
+    for (size_t i = 0; i < vtx.size(); i++) {
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("txid", vtx[i].GetHash().GetHex()));
+        entry.push_back(Pair("accepted", (bool)vfAccepted[i]));
+        if (vfAccepted[i]) {
+            if (g_connman)
+                g_connman->RelayTransaction(vtx[i]);
+        } else if (vStates[i].IsInvalid()) {
+            entry.push_back(Pair("error", strprintf("%i: %s", vStates[i].GetRejectCode(), vStates[i].GetRejectReason())));
+        } else if (vfMissingInputs[i]) {
+            entry.push_back(Pair("error", "Missing inputs"));
+        } else {
+            entry.push_back(Pair("error", vStates[i].GetRejectReason()));
+        }
+        result.push_back(entry);
+    }
+    return result;
+}
+
+UniValue sendrawtransactions(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "sendrawtransactions [\"hexstring\",...] ( allowhighfees )\n"
+            "\nSubmits a batch of raw transactions (serialized, hex-encoded) to local node and network.\n"
+            "The batch is validated under a single lock, transactions spending outputs of others in the\n"
+            "batch are accepted after them. Rejected transactions don't affect the rest of the batch.\n"
+            "\nArguments:\n"
+            "1. [\"hexstring\",...] (array, required) The hex strings of the raw transactions\n"
+            "2. allowhighfees    (boolean, optional, default=false) Allow high fees\n"
+            "\nResult:\n"
+            "[                   (array) One entry per transaction, in the order given\n"
+            "  {\n"
+            "    \"txid\" : \"id\",     (string) The transaction hash in hex\n"
+            "    \"accepted\" : true|false, (boolean) If the transaction was added to the memory pool\n"
+            "    \"error\" : \"text\"   (string) Why the transaction was rejected, if it was\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("sendrawtransactions", "\"[\\\"signedhex\\\",\\\"signedhex\\\"]\"") +
+            "\nAs a json rpc call\n"
+            + HelpExampleRpc("sendrawtransactions", "[\"signedhex\",\"signedhex\"]")
+        );
+
+    RPCTypeCheck(params, boost::assign::list_of(UniValue::VARR)(UniValue::VBOOL));
+
+    const UniValue& hexTxs = params[0].get_array();
+    std::vector<CTransaction> vtx(hexTxs.size());
+    for (size_t i = 0; i < hexTxs.size(); i++) {
+        if (!hexTxs[i].isStr() || !DecodeHexTx(vtx[i], hexTxs[i].get_str()))
+            throw JSONRPCError(RPC_DESERIALIZATION_ERROR, strprintf("TX decode failed at index %u", i));
+    }
+
+    bool fOverrideFees = false;
+    if (params.size() > 1)
+        fOverrideFees = params[1].get_bool();
+
+    if(!g_connman)
+        throw JSONRPCError(RPC_CLIENT_P2P_DISABLED, "Error: Peer-to-peer functionality missing or disabled");
+
+    return SendRawTransactions(vtx, !fOverrideFees);
+}
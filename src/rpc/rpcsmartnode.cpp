@@ -203,13 +203,10 @@ UniValue smartnode(const UniValue& params, bool fHelp)
         int nCount;
         int nHeight;
         CSmartNodeWinners mnInfos;
-        CBlockIndex* pindex = NULL;
-        {
-            LOCK(cs_main);
-            pindex = chainActive.Tip();
-        }
-        nHeight = pindex->nHeight + (strCommand == "current" ? 1 : 10);
-        mnodeman.UpdateLastPaid(pindex);
+        std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+        if (!tip) return "unknown";
+        nHeight = tip->nHeight + (strCommand == "current" ? 1 : 10);
+        mnodeman.UpdateLastPaid(tip->pindex);
 
         if(!mnodeman.GetNextSmartnodesInQueueForPayment(nHeight, true, nCount, mnInfos))
             return "unknown";
@@ -407,14 +404,9 @@ UniValue smartnode(const UniValue& params, bool fHelp)
 
     if (strCommand == "winners")
     {
-        int nHeight;
-        {
-            LOCK(cs_main);
-            CBlockIndex* pindex = chainActive.Tip();
-            if(!pindex) return NullUniValue;
-
-            nHeight = pindex->nHeight;
-        }
+        std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+        if(!tip) return NullUniValue;
+        int nHeight = tip->nHeight;
 
         int nLast = 10;
         std::string strFilter = "";
@@ -450,21 +442,31 @@ UniValue smartnodelist(const UniValue& params, bool fHelp)
     std::string strFilter = "";
 
     if (params.size() >= 1) strMode = params[0].get_str();
-    if (params.size() == 2) strFilter = params[1].get_str();
+    if (params.size() >= 2) strFilter = params[1].get_str();
 
-    if (fHelp || (
+    if (fHelp || params.size() > 3 || (
                 strMode != "activeseconds" && strMode != "addr" && strMode != "full" && strMode != "info" &&
                 strMode != "lastseen" && strMode != "lastpaidtime" && strMode != "lastpaidblock" &&
                 strMode != "protocol" && strMode != "payee" && strMode != "pubkey" &&
                 strMode != "rank" && strMode != "status"))
     {
         throw std::runtime_error(
-                "smartnodelist ( \"mode\" \"filter\" )\n"
+                "smartnodelist ( \"mode\" \"filter\" {\"status\":\"...\",\"protocol\":n,\"payee\":\"...\",\"since\":n} )\n"
                 "Get a list of smartnodes in different modes\n"
                 "\nArguments:\n"
                 "1. \"mode\"      (string, optional/required to use filter, defaults = status) The mode to run list in\n"
                 "2. \"filter\"    (string, optional) Filter results. Partial match by outpoint by default in all modes,\n"
                 "                                    additional matches in some modes are also available\n"
+                "3. options     (object, optional, not in rank mode)\n"
+                "   {\n"
+                "     \"status\"    (string) Only smartnodes with exactly this status, e.g. \"ENABLED\"\n"
+                "     \"protocol\"  (numeric) Only smartnodes with exactly this protocol version\n"
+                "     \"payee\"     (string) Only smartnodes whose payee address starts with this\n"
+                "     \"since\"     (numeric) Only smartnodes that changed after the list of this height, and the\n"
+                "                            ones removed since. The result is {\"height\":n,\"nodes\":{...},\"removed\":[...]},\n"
+                "                            pass its height as since to the next call to get the next changes\n"
+                "   }\n"
+                "\nThe list is taken once per block, so changes are seen with the next block.\n"
                 "\nAvailable modes:\n"
                 "  activeseconds  - Print number of seconds smartnode recognized by the network as enabled\n"
                 "                   (since latest issued \"smartnode start/start-many/start-alias\")\n"
@@ -483,20 +485,17 @@ UniValue smartnodelist(const UniValue& params, bool fHelp)
                 "  rank           - Print rank of a smartnode based on current block\n"
                 "  status         - Print smartnode status: PRE_ENABLED / ENABLED / EXPIRED / WATCHDOG_EXPIRED / NEW_START_REQUIRED /\n"
                 "                   UPDATE_REQUIRED / POSE_BAN / OUTPOINT_SPENT (can be additionally filtered, partial match)\n"
+                "\nExamples:\n"
+                + HelpExampleCli("smartnodelist", "payee \"\" '{\"status\":\"ENABLED\"}'")
+                + HelpExampleCli("smartnodelist", "full \"\" '{\"since\":500000}'")
+                + HelpExampleRpc("smartnodelist", "\"status\", \"\", {\"protocol\":90026}")
                 );
     }
 
-    if (strMode == "full" || strMode == "lastpaidtime" || strMode == "lastpaidblock") {
-        CBlockIndex* pindex = NULL;
-        {
-            LOCK(cs_main);
-            pindex = chainActive.Tip();
-        }
-        mnodeman.UpdateLastPaid(pindex);
-    }
-
     UniValue obj(UniValue::VOBJ);
     if (strMode == "rank") {
+        if (params.size() > 2)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Options are not available in rank mode");
         CSmartnodeMan::rank_pair_vec_t vSmartnodeRanks;
         mnodeman.GetSmartnodeRanks(vSmartnodeRanks);
         BOOST_FOREACH(PAIRTYPE(int, CSmartnode)& s, vSmartnodeRanks) {
@@ -504,80 +503,95 @@ UniValue smartnodelist(const UniValue& params, bool fHelp)
             if (strFilter !="" && strOutpoint.find(strFilter) == std::string::npos) continue;
             obj.push_back(Pair(strOutpoint, s.first));
         }
-    } else {
-        std::map<COutPoint, CSmartnode> mapSmartnodes = mnodeman.GetFullSmartnodeMap();
-        for (auto& mnpair : mapSmartnodes) {
-            CSmartnode mn = mnpair.second;
-            std::string strOutpoint = mnpair.first.ToStringShort();
-            if (strMode == "activeseconds") {
-                if (strFilter !="" && strOutpoint.find(strFilter) == std::string::npos) continue;
-                obj.push_back(Pair(strOutpoint, (int64_t)(mn.lastPing.sigTime - mn.sigTime)));
-            } else if (strMode == "addr") {
-                std::string strAddress = mn.addr.ToString();
-                if (strFilter !="" && strAddress.find(strFilter) == std::string::npos &&
-                    strOutpoint.find(strFilter) == std::string::npos) continue;
-                obj.push_back(Pair(strOutpoint, strAddress));
-            } else if (strMode == "full") {
-                std::ostringstream streamFull;
-                streamFull << std::setw(18) <<
-                               mn.GetStatus() << " " <<
-                               mn.nProtocolVersion << " " <<
-                               CBitcoinAddress(mn.pubKeyCollateralAddress.GetID()).ToString() << " " <<
-                               (int64_t)mn.lastPing.sigTime << " " << std::setw(8) <<
-                               (int64_t)(mn.lastPing.sigTime - mn.sigTime) << " " << std::setw(10) <<
-                               mn.GetLastPaidTime() << " "  << std::setw(6) <<
-                               mn.GetLastPaidBlock() << " " <<
-                               mn.addr.ToString();
-                std::string strFull = streamFull.str();
-                if (strFilter !="" && strFull.find(strFilter) == std::string::npos &&
-                    strOutpoint.find(strFilter) == std::string::npos) continue;
-                obj.push_back(Pair(strOutpoint, strFull));
-            } else if (strMode == "info") {
-                std::ostringstream streamInfo;
-                streamInfo << std::setw(18) <<
-                               mn.GetStatus() << " " <<
-                               mn.nProtocolVersion << " " <<
-                               CBitcoinAddress(mn.pubKeyCollateralAddress.GetID()).ToString() << " " <<
-                               (int64_t)mn.lastPing.sigTime << " " << std::setw(8) <<
-                               (int64_t)(mn.lastPing.sigTime - mn.sigTime) << " " <<
-                               SafeIntVersionToString(mn.lastPing.nSentinelVersion) << " "  <<
-                               (mn.lastPing.fSentinelIsCurrent ? "current" : "expired") << " " <<
-                               mn.addr.ToString();
-                std::string strInfo = streamInfo.str();
-                if (strFilter !="" && strInfo.find(strFilter) == std::string::npos &&
-                    strOutpoint.find(strFilter) == std::string::npos) continue;
-                obj.push_back(Pair(strOutpoint, strInfo));
-            } else if (strMode == "lastpaidblock") {
-                if (strFilter !="" && strOutpoint.find(strFilter) == std::string::npos) continue;
-                obj.push_back(Pair(strOutpoint, mn.GetLastPaidBlock()));
-            } else if (strMode == "lastpaidtime") {
-                if (strFilter !="" && strOutpoint.find(strFilter) == std::string::npos) continue;
-                obj.push_back(Pair(strOutpoint, mn.GetLastPaidTime()));
-            } else if (strMode == "lastseen") {
-                if (strFilter !="" && strOutpoint.find(strFilter) == std::string::npos) continue;
-                obj.push_back(Pair(strOutpoint, (int64_t)mn.lastPing.sigTime));
-            } else if (strMode == "payee") {
-                CBitcoinAddress address(mn.pubKeyCollateralAddress.GetID());
-                std::string strPayee = address.ToString();
-                if (strFilter !="" && strPayee.find(strFilter) == std::string::npos &&
-                    strOutpoint.find(strFilter) == std::string::npos) continue;
-                obj.push_back(Pair(strOutpoint, strPayee));
-            } else if (strMode == "protocol") {
-                if (strFilter !="" && strFilter != strprintf("%d", mn.nProtocolVersion) &&
-                    strOutpoint.find(strFilter) == std::string::npos) continue;
-                obj.push_back(Pair(strOutpoint, (int64_t)mn.nProtocolVersion));
-            } else if (strMode == "pubkey") {
-                if (strFilter !="" && strOutpoint.find(strFilter) == std::string::npos) continue;
-                obj.push_back(Pair(strOutpoint, HexStr(mn.pubKeySmartnode)));
-            } else if (strMode == "status") {
-                std::string strStatus = mn.GetStatus();
-                if (strFilter !="" && strStatus.find(strFilter) == std::string::npos &&
-                    strOutpoint.find(strFilter) == std::string::npos) continue;
-                obj.push_back(Pair(strOutpoint, strStatus));
-            }
+        return obj;
+    }
+
+    std::string strStatus, strPayee;
+    int nProtocol = -1;
+    bool fSince = false;
+    int nSince = 0;
+    if (params.size() > 2) {
+        RPCTypeCheckObj(params[2].get_obj(),
+            {
+                {"status", UniValueType(UniValue::VSTR)},
+                {"protocol", UniValueType(UniValue::VNUM)},
+                {"payee", UniValueType(UniValue::VSTR)},
+                {"since", UniValueType(UniValue::VNUM)},
+            },
+            true, true);
+        const UniValue& options = params[2];
+        if (options.exists("status")) strStatus = options["status"].get_str();
+        if (options.exists("protocol")) nProtocol = options["protocol"].get_int();
+        if (options.exists("payee")) strPayee = options["payee"].get_str();
+        if (options.exists("since")) {
+            fSince = true;
+            nSince = options["since"].get_int();
+        }
+    }
+
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    std::shared_ptr<const CSmartnodeListSnapshot> snapshot = mnodeman.GetListSnapshot(tip ? tip->pindex : NULL);
+
+    if (fSince && nSince < snapshot->nRemovedSince)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Changes are only known since height %d, request the full list", snapshot->nRemovedSince));
+
+    for (const CSmartnodeListEntry& entry : snapshot->vEntries) {
+        if (!strStatus.empty() && entry.strStatus != strStatus) continue;
+        if (nProtocol >= 0 && entry.nProtocolVersion != nProtocol) continue;
+        if (!strPayee.empty() && entry.strPayee.compare(0, strPayee.size(), strPayee) != 0) continue;
+        if (fSince && entry.nChangedHeight <= nSince) continue;
+
+        // The modes that match the filter against more than the outpoint
+        if (strFilter != "" && entry.strOutpoint.find(strFilter) == std::string::npos) {
+            bool fMatch = false;
+            if (strMode == "addr") fMatch = entry.strAddr.find(strFilter) != std::string::npos;
+            else if (strMode == "full") fMatch = entry.strFull.find(strFilter) != std::string::npos;
+            else if (strMode == "info") fMatch = entry.strInfo.find(strFilter) != std::string::npos;
+            else if (strMode == "payee") fMatch = entry.strPayee.find(strFilter) != std::string::npos;
+            else if (strMode == "protocol") fMatch = strFilter == strprintf("%d", entry.nProtocolVersion);
+            else if (strMode == "status") fMatch = entry.strStatus.find(strFilter) != std::string::npos;
+            if (!fMatch) continue;
+        }
+
+        if (strMode == "activeseconds") {
+            obj.push_back(Pair(entry.strOutpoint, entry.nActiveSeconds));
+        } else if (strMode == "addr") {
+            obj.push_back(Pair(entry.strOutpoint, entry.strAddr));
+        } else if (strMode == "full") {
+            obj.push_back(Pair(entry.strOutpoint, entry.strFull));
+        } else if (strMode == "info") {
+            obj.push_back(Pair(entry.strOutpoint, entry.strInfo));
+        } else if (strMode == "lastpaidblock") {
+            obj.push_back(Pair(entry.strOutpoint, entry.nLastPaidBlock));
+        } else if (strMode == "lastpaidtime") {
+            obj.push_back(Pair(entry.strOutpoint, entry.nLastPaidTime));
+        } else if (strMode == "lastseen") {
+            obj.push_back(Pair(entry.strOutpoint, entry.nLastSeen));
+        } else if (strMode == "payee") {
+            obj.push_back(Pair(entry.strOutpoint, entry.strPayee));
+        } else if (strMode == "protocol") {
+            obj.push_back(Pair(entry.strOutpoint, (int64_t)entry.nProtocolVersion));
+        } else if (strMode == "pubkey") {
+            obj.push_back(Pair(entry.strOutpoint, entry.strPubKey));
+        } else if (strMode == "status") {
+            obj.push_back(Pair(entry.strOutpoint, entry.strStatus));
         }
     }
-    return obj;
+
+    if (!fSince)
+        return obj;
+
+    UniValue removed(UniValue::VARR);
+    for (const auto& entry : snapshot->mapRemoved) {
+        if (entry.second > nSince)
+            removed.push_back(entry.first.ToStringShort());
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("height", snapshot->nHeight));
+    result.push_back(Pair("nodes", obj));
+    result.push_back(Pair("removed", removed));
+    return result;
 }
 
 bool DecodeHexVecMnb(std::vector<CSmartnodeBroadcast>& vecMnb, std::string strHexMnb) {
@@ -17,6 +17,8 @@
 #include <iomanip>
 #include <univalue.h>
 
+#include <boost/filesystem.hpp>
+
 
 UniValue smartrewards(const UniValue& params, bool fHelp)
 {
@@ -31,7 +33,7 @@ UniValue smartrewards(const UniValue& params, bool fHelp)
 
     if (fHelp  ||
         (
-         strCommand != "current" && strCommand != "snapshot" && strCommand != "history" && strCommand != "check" && strCommand != "payouts"))
+         strCommand != "current" && strCommand != "snapshot" && strCommand != "history" && strCommand != "check" && strCommand != "payouts" && strCommand != "export"))
             throw std::runtime_error(
                 "smartrewards \"command\"...\n"
                 "Set of commands to execute smartreward related actions\n"
@@ -42,27 +44,21 @@ UniValue smartrewards(const UniValue& params, bool fHelp)
                 "  history           - Print the results of all past SmartReward cycles.\n"
                 "  payouts  :round   - Print a list of all paid rewards in the past cycle :round\n"
                 "  snapshot :round   - Print a list of all addresses with their balances from the end of the past cycle :round.\n"
+                "  snapshot :round :address - Print the balance and reward of :address from the end of the past cycle :round.\n"
                 "  check :address    - Check the given :address for eligibility in the current rewards cycle.\n"
+                "  check [:address,...] - Check a JSON array of addresses at once, prints one result per address.\n"
+                "  export :round :file - Write the snapshot of the past cycle :round to :file as CSV.\n"
+                "  export entries :file - Write the balances and eligibility of all addresses in the current cycle to :file as CSV.\n"
                 );
 
     if( !fDebug && !prewards->IsSynced() )
         throw JSONRPCError(RPC_DATABASE_ERROR, strprintf("Rewards database is not up to date. Current progress %d%%",int(prewards->GetProgress() * 100)));
 
-    TRY_LOCK(cs_rewardsdb, lockRewardsDb);
-
-    if (!lockRewardsDb) {
-        throw JSONRPCError(RPC_DATABASE_ERROR, "Rewards database is busy..Try it again!");
-    }
-
     if (strCommand == "current")
     {
         UniValue obj(UniValue::VOBJ);
 
-        TRY_LOCK(cs_rewardrounds,roundsLocked);
-
-        if(!roundsLocked) throw JSONRPCError(RPC_DATABASE_ERROR, "Rewards database is busy..Try it again!");
-
-        const CSmartRewardRound& current = prewards->GetCurrentRound();
+        CSmartRewardRound current = prewards->GetRounds()->current;
 
         if( !current.number ) throw JSONRPCError(RPC_DATABASE_ERROR, "No active reward round available yet.");
 
@@ -85,11 +81,8 @@ UniValue smartrewards(const UniValue& params, bool fHelp)
     {
         UniValue obj(UniValue::VARR);
 
-        TRY_LOCK(cs_rewardrounds,roundsLocked);
-
-        if(!roundsLocked) throw JSONRPCError(RPC_DATABASE_ERROR, "Rewards database is busy..Try it again!");
-
-        const CSmartRewardRoundList& history = prewards->GetRewardRounds();
+        std::shared_ptr<const CSmartRewardRoundList> finished = prewards->GetRounds()->finished;
+        const CSmartRewardRoundList& history = *finished;
 
         if(!history.size()) throw JSONRPCError(RPC_DATABASE_ERROR, "No finished reward round available yet.");
 
@@ -117,11 +110,7 @@ UniValue smartrewards(const UniValue& params, bool fHelp)
 
     if(strCommand == "payouts")
     {
-        TRY_LOCK(cs_rewardrounds,roundsLocked);
-
-        if(!roundsLocked) throw JSONRPCError(RPC_DATABASE_ERROR, "Rewards database is busy..Try it again!");
-
-        const CSmartRewardRound& current = prewards->GetCurrentRound();
+        CSmartRewardRound current = prewards->GetRounds()->current;
 
         if( !current.number ) throw JSONRPCError(RPC_DATABASE_ERROR, "No active reward round available yet.");
 
@@ -145,8 +134,17 @@ UniValue smartrewards(const UniValue& params, bool fHelp)
         if(round < 1 || round >= current.number) throw JSONRPCError(RPC_INVALID_PARAMETER, err);
 
         CSmartRewardSnapshotList payouts;
+        std::shared_ptr<const CSmartRewardSnapshotFile> file = prewards->GetSnapshotFile(round);
+
+        if( file ){
 
-        if( !prewards->GetRewardPayouts(round,payouts) )
+            for( uint64_t n = 0; n < file->size(); ++n ){
+                if( !file->IsPaid(n) ) continue;
+                payouts.push_back(CSmartRewardSnapshot());
+                file->Get(n, payouts.back());
+            }
+
+        }else if( !prewards->GetRewardPayouts(round,payouts) )
             throw JSONRPCError(RPC_DATABASE_ERROR, "Couldn't fetch the list from the database.");
 
         UniValue obj(UniValue::VARR);
@@ -165,18 +163,14 @@ UniValue smartrewards(const UniValue& params, bool fHelp)
 
     if(strCommand == "snapshot")
     {
-        TRY_LOCK(cs_rewardrounds,roundsLocked);
-
-        if(!roundsLocked) throw JSONRPCError(RPC_DATABASE_ERROR, "Rewards database is busy..Try it again!");
-
-        const CSmartRewardRound& current = prewards->GetCurrentRound();
+        CSmartRewardRound current = prewards->GetRounds()->current;
 
         if( !current.number ) throw JSONRPCError(RPC_DATABASE_ERROR, "No active reward round available yet.");
 
         int round = 0;
         std::string err = strprintf("Past SmartReward round required: 1 - %d ",current.number - 1 );
 
-        if (params.size() != 2) throw JSONRPCError(RPC_INVALID_PARAMETER, err);
+        if (params.size() != 2 && params.size() != 3) throw JSONRPCError(RPC_INVALID_PARAMETER, err);
 
         try {
              int n = std::stoi(params[1].get_str());
@@ -192,9 +186,39 @@ UniValue smartrewards(const UniValue& params, bool fHelp)
 
         if(round < 1 || round >= current.number) throw JSONRPCError(RPC_INVALID_PARAMETER, err);
 
+        // Finished rounds are served from their snapshot file, only fall back
+        // to the database if it can't be written.
+        std::shared_ptr<const CSmartRewardSnapshotFile> file = prewards->GetSnapshotFile(round);
+
+        if( params.size() == 3 ){
+
+            std::string addressString = params[2].get_str();
+            CSmartAddress id = CSmartAddress(addressString);
+
+            if( !id.IsValid() ) throw JSONRPCError(RPC_DATABASE_ERROR, strprintf("Invalid SMART address provided: %s",addressString));
+
+            CSmartRewardSnapshot s;
+
+            if( !file ) throw JSONRPCError(RPC_DATABASE_ERROR, "Couldn't open the snapshot file of this round.");
+            if( !file->Find(id, s) ) throw JSONRPCError(RPC_DATABASE_ERROR, "Couldn't find this SMART address in the snapshot!");
+
+            UniValue addrObj(UniValue::VOBJ);
+            addrObj.push_back(Pair("address", s.id.ToString()));
+            addrObj.push_back(Pair("balance", format(s.balance)));
+            addrObj.push_back(Pair("reward", format(s.reward)));
+
+            return addrObj;
+        }
+
         CSmartRewardSnapshotList snapshot;
 
-        if( !prewards->GetRewardSnapshots(round,snapshot) )
+        if( file ){
+
+            snapshot.resize(file->size());
+
+            for( uint64_t n = 0; n < file->size(); ++n ) file->Get(n, snapshot[n]);
+
+        }else if( !prewards->GetRewardSnapshots(round,snapshot) )
             throw JSONRPCError(RPC_DATABASE_ERROR, "Couldn't fetch the list from the database.");
 
         UniValue obj(UniValue::VARR);
@@ -211,26 +235,116 @@ UniValue smartrewards(const UniValue& params, bool fHelp)
         return obj;
     }
 
+    if(strCommand == "export")
+    {
+        CSmartRewardRound current = prewards->GetRounds()->current;
+
+        if( !current.number ) throw JSONRPCError(RPC_DATABASE_ERROR, "No active reward round available yet.");
+
+        int round = 0;
+        std::string err = strprintf("Past SmartReward round (1 - %d) or \"entries\" and a file required",current.number - 1 );
+
+        if (params.size() != 3) throw JSONRPCError(RPC_INVALID_PARAMETER, err);
+
+        if( params[1].get_str() != "entries" ){
+
+            try {
+                 int n = std::stoi(params[1].get_str());
+                 round = n;
+            }
+            catch (const std::invalid_argument& ia) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER, err);
+            }
+            catch (const std::out_of_range& oor) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER, err);
+            }
+            catch (...) {}
+
+            if(round < 1 || round >= current.number) throw JSONRPCError(RPC_INVALID_PARAMETER, err);
+        }
+
+        boost::filesystem::path path = boost::filesystem::absolute(params[2].get_str(), GetDataDir());
+
+        if( boost::filesystem::exists(path) )
+            throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists.");
+
+        uint64_t nRecords = 0;
+        int nHeight = -1;
+
+        if( !prewards->ExportCSV(round, path, nRecords, nHeight) )
+            throw JSONRPCError(RPC_DATABASE_ERROR, "Couldn't export the records, see debug.log for details.");
+
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("path", path.string()));
+        obj.push_back(Pair("records", nRecords));
+        if( round ) obj.push_back(Pair("round", round));
+        else obj.push_back(Pair("height", nHeight));
+
+        return obj;
+    }
+
     if (strCommand == "check")
     {
         if (params.size() != 2) throw JSONRPCError(RPC_INVALID_PARAMETER, "SMART address required.");
 
-        std::string addressString = params[1].get_str();
-        CSmartAddress id = CSmartAddress(addressString);
+        std::function<CSmartAddress (const std::string&)> parse = [](const std::string &addressString) {
+            CSmartAddress id = CSmartAddress(addressString);
+            if( !id.IsValid() ) throw JSONRPCError(RPC_DATABASE_ERROR, strprintf("Invalid SMART address provided: %s",addressString));
+            return id;
+        };
 
-        if( !id.IsValid() ) throw JSONRPCError(RPC_DATABASE_ERROR, strprintf("Invalid SMART address provided: %s",addressString));
+        std::function<UniValue (const CSmartAddress&, const CSmartRewardEntry&)> toObj = [format](const CSmartAddress &id, const CSmartRewardEntry &entry) {
+            UniValue obj(UniValue::VOBJ);
 
-        CSmartRewardEntry entry;
+            obj.push_back(Pair("address",id.ToString()));
+            obj.push_back(Pair("balance",format(entry.balance)));
+            obj.push_back(Pair("balance_eligible", format(entry.eligible ? entry.balanceOnStart : 0)));
 
-        if( !prewards->GetRewardEntry(id, entry) ) throw JSONRPCError(RPC_DATABASE_ERROR, "Couldn't find this SMART address in the databse!");
+            return obj;
+        };
 
-        UniValue obj(UniValue::VOBJ);
+        // The address list comes as JSON array through RPC and as string from the command line.
+        UniValue addresses = params[1];
 
-        obj.push_back(Pair("address",id.ToString()));
-        obj.push_back(Pair("balance",format(entry.balance)));
-        obj.push_back(Pair("balance_eligible", format(entry.eligible ? entry.balanceOnStart : 0)));
+        if( addresses.isStr() && !addresses.get_str().empty() && addresses.get_str()[0] == '[' ){
+            if( !addresses.read(params[1].get_str()) || !addresses.isArray() )
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid SMART address list provided.");
+        }
 
-        return obj;
+        if( !addresses.isArray() ){
+            CSmartAddress id = parse(addresses.get_str());
+            CSmartRewardEntry entry;
+
+            if( !prewards->GetRewardEntry(id, entry) ) throw JSONRPCError(RPC_DATABASE_ERROR, "Couldn't find this SMART address in the databse!");
+
+            return toObj(id, entry);
+        }
+
+        std::vector<CSmartAddress> ids;
+        std::map<CSmartAddress, CSmartRewardEntry> entries;
+
+        for( size_t i = 0; i < addresses.size(); ++i ){
+            ids.push_back(parse(addresses[i].get_str()));
+        }
+
+        if( !prewards->GetRewardEntries(ids, entries) ) throw JSONRPCError(RPC_DATABASE_ERROR, "Couldn't read the SMART addresses from the database!");
+
+        UniValue arr(UniValue::VARR);
+
+        BOOST_FOREACH(const CSmartAddress &id, ids) {
+            auto it = entries.find(id);
+
+            if( it != entries.end() ){
+                arr.push_back(toObj(id, it->second));
+            }else{
+                UniValue obj(UniValue::VOBJ);
+                obj.push_back(Pair("address",id.ToString()));
+                obj.push_back(Pair("error","Couldn't find this SMART address in the database!"));
+                arr.push_back(obj);
+            }
+        }
+
+        return arr;
     }
 
     return NullUniValue;
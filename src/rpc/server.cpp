@@ -6,8 +6,10 @@
 #include "rpc/server.h"
 
 #include "base58.h"
+#include "httpserver.h"
 #include "init.h"
 #include "random.h"
+#include "scheduler.h"
 #include "sync.h"
 #include "ui_interface.h"
 #include "util.h"
@@ -15,6 +17,12 @@
 
 #include <univalue.h>
 
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <set>
+#include <thread>
+
 #include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/foreach.hpp>
@@ -38,6 +46,113 @@ static std::vector<RPCTimerInterface*> timerInterfaces;
  * @note Can be changed to std::unique_ptr when C++11 */
 static std::map<std::string, boost::shared_ptr<RPCTimerBase> > deadlineTimers;
 
+/** Latency histogram buckets, bucket i counts the calls that took [2^i, 2^(i+1)) microseconds */
+static const int RPC_LATENCY_BUCKETS = 32;
+
+/** Counters of the calls of one RPC method, for getrpcstats */
+struct CRPCMethodStats
+{
+    uint64_t nCalls;
+    uint64_t nErrors;
+    //! Microseconds spent in the calls, in total and at most
+    int64_t nTimeTotal;
+    int64_t nTimeMax;
+    uint64_t vLatency[RPC_LATENCY_BUCKETS];
+    //! Microseconds the calls waited for cs_main and cs_wallet
+    int64_t nWaitMain;
+    int64_t nWaitWallet;
+    uint64_t nResponses;
+    uint64_t nResponseBytes;
+    uint64_t nResponseMax;
+
+    CRPCMethodStats() : nCalls(0), nErrors(0), nTimeTotal(0), nTimeMax(0), nWaitMain(0), nWaitWallet(0), nResponses(0), nResponseBytes(0), nResponseMax(0)
+    {
+        std::fill(vLatency, vLatency + RPC_LATENCY_BUCKETS, 0);
+    }
+};
+
+static CCriticalSection cs_rpcStats;
+static std::map<std::string, CRPCMethodStats> mapRPCStats;
+//! Calls taking at least this many microseconds are logged, 0 to log none
+static std::atomic<int64_t> nRPCSlowLogMicros(0);
+
+/** Methods whose parameters may hold secrets and are not logged */
+static const std::set<std::string> setRPCSensitiveMethods = {
+    "encryptwallet", "importprivkey", "signmessagewithprivkey", "signrawtransaction",
+    "walletpassphrase", "walletpassphrasechange"
+};
+
+/** Times an RPC call and records it in the statistics, also when it throws */
+class CRPCCallRecorder
+{
+private:
+    const CRPCCommand& cmd;
+    const UniValue& params;
+    int64_t nStart;
+    CLockWaitStats lockWaits;
+    CLockWaitScope lockWaitScope;
+    bool fSuccess;
+
+public:
+    CRPCCallRecorder(const CRPCCommand& cmdIn, const UniValue& paramsIn) : cmd(cmdIn), params(paramsIn), nStart(GetTimeMicros()), lockWaitScope(lockWaits), fSuccess(false) {}
+    void Success() { fSuccess = true; }
+    ~CRPCCallRecorder();
+};
+
+CRPCCallRecorder::~CRPCCallRecorder()
+{
+    int64_t nTime = GetTimeMicros() - nStart;
+    int nBucket = 0;
+    while (nBucket + 1 < RPC_LATENCY_BUCKETS && (nTime >> (nBucket + 1)) != 0)
+        nBucket++;
+
+    {
+        LOCK(cs_rpcStats);
+        CRPCMethodStats& stats = mapRPCStats[cmd.name];
+        stats.nCalls++;
+        if (!fSuccess)
+            stats.nErrors++;
+        stats.nTimeTotal += nTime;
+        stats.nTimeMax = std::max(stats.nTimeMax, nTime);
+        stats.vLatency[nBucket]++;
+        stats.nWaitMain += lockWaits.nWaitMain;
+        stats.nWaitWallet += lockWaits.nWaitWallet;
+    }
+
+    int64_t nSlowLog = nRPCSlowLogMicros;
+    if (nSlowLog > 0 && nTime >= nSlowLog) {
+        std::string strParams = setRPCSensitiveMethods.count(cmd.name) ? "<hidden>" : SanitizeString(params.write());
+        if (strParams.size() > 1000)
+            strParams = strParams.substr(0, 1000) + "...";
+        LogPrintf("Slow RPC call %s took %.2fms (waited %.2fms for cs_main, %.2fms for cs_wallet)%s params=%s\n",
+            cmd.name, nTime * 0.001, lockWaits.nWaitMain * 0.001, lockWaits.nWaitWallet * 0.001, fSuccess ? "" : " and failed", strParams);
+    }
+}
+
+void RPCRecordResponseSize(const std::string& strMethod, size_t nSize)
+{
+    LOCK(cs_rpcStats);
+    std::map<std::string, CRPCMethodStats>::iterator it = mapRPCStats.find(strMethod);
+    if (it == mapRPCStats.end())
+        return;
+    it->second.nResponses++;
+    it->second.nResponseBytes += nSize;
+    it->second.nResponseMax = std::max<uint64_t>(it->second.nResponseMax, nSize);
+}
+
+/** The upper bound, in milliseconds, of the latency bucket holding the given fraction of the calls */
+static double RPCLatencyPercentile(const CRPCMethodStats& stats, double dFraction)
+{
+    uint64_t nRank = std::max<uint64_t>(1, std::ceil(stats.nCalls * dFraction));
+    uint64_t nSeen = 0;
+    for (int i = 0; i < RPC_LATENCY_BUCKETS; i++) {
+        nSeen += stats.vLatency[i];
+        if (nSeen >= nRank)
+            return std::min<int64_t>(int64_t(2) << i, stats.nTimeMax) / 1000.0;
+    }
+    return stats.nTimeMax / 1000.0;
+}
+
 static struct CRPCSignals
 {
     boost::signals2::signal<void ()> Started;
@@ -262,161 +377,428 @@ UniValue stop(const UniValue& params, bool fHelp)
     return "Smartcash server stopping";
 }
 
+UniValue getrpcinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrpcinfo\n"
+            "\nReturns the state of the HTTP work queues the RPC and REST requests run in, and of the client connections.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"queues\": [\n"
+            "    {\n"
+            "      \"name\": \"xxxx\",          (string) The queue name, see -rpcqueue\n"
+            "      \"threads\": n,            (numeric) Worker threads of the queue\n"
+            "      \"active\": n,             (numeric) Requests being handled right now\n"
+            "      \"depth\": n,              (numeric) Requests waiting for a worker\n"
+            "      \"max_depth\": n,          (numeric) Requests the queue holds before it rejects more\n"
+            "      \"processed\": n,          (numeric) Requests handled since startup\n"
+            "      \"rejected\": n,           (numeric) Requests rejected since startup because the queue was full\n"
+            "      \"wait_avg_ms\": x.xxx,    (numeric) Average time handled requests waited for a worker\n"
+            "      \"wait_max_ms\": x.xxx,    (numeric) Longest time a request waited for a worker\n"
+            "      \"run_avg_ms\": x.xxx      (numeric) Average time a worker spent on a request\n"
+            "    }\n"
+            "    ,...\n"
+            "  ],\n"
+            "  \"connections\": {\n"
+            "    \"accepted\": n,           (numeric) Client connections that sent a request since startup\n"
+            "    \"open\": n,               (numeric) Client connections open right now\n"
+            "    \"requests\": n,           (numeric) Requests received since startup\n"
+            "    \"reused\": n              (numeric) Requests that came on a connection kept alive from an earlier one\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getrpcinfo", "")
+            + HelpExampleRpc("getrpcinfo", "")
+        );
+
+    UniValue queues(UniValue::VARR);
+    BOOST_FOREACH(const HTTPWorkQueueStats& stats, GetHTTPWorkQueueStats()) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("name", stats.strName));
+        obj.push_back(Pair("threads", stats.nThreads));
+        obj.push_back(Pair("active", stats.nActive));
+        obj.push_back(Pair("depth", (uint64_t)stats.nDepth));
+        obj.push_back(Pair("max_depth", (uint64_t)stats.nMaxDepth));
+        obj.push_back(Pair("processed", stats.nProcessed));
+        obj.push_back(Pair("rejected", stats.nRejected));
+        obj.push_back(Pair("wait_avg_ms", stats.nProcessed ? stats.nWaitTotal / 1000.0 / stats.nProcessed : 0.0));
+        obj.push_back(Pair("wait_max_ms", stats.nWaitMax / 1000.0));
+        obj.push_back(Pair("run_avg_ms", stats.nProcessed ? stats.nRunTotal / 1000.0 / stats.nProcessed : 0.0));
+        queues.push_back(std::move(obj));
+    }
+
+    HTTPConnectionStats connStats = GetHTTPConnectionStats();
+    UniValue connections(UniValue::VOBJ);
+    connections.push_back(Pair("accepted", connStats.nAccepted));
+    connections.push_back(Pair("open", connStats.nOpen));
+    connections.push_back(Pair("requests", connStats.nRequests));
+    connections.push_back(Pair("reused", connStats.nReused));
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("queues", std::move(queues)));
+    ret.push_back(Pair("connections", std::move(connections)));
+    return ret;
+}
+
+UniValue getrpcstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getrpcstats ( reset )\n"
+            "\nReturns call counts, latencies, lock waits and response sizes of the RPC methods called since startup.\n"
+            "Latency percentiles are the upper bounds of power of two histogram buckets.\n"
+            "\nArguments:\n"
+            "1. reset          (boolean, optional, default=false) Clear the statistics after returning them\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"method\": {                (string) The RPC method\n"
+            "    \"calls\": n,                (numeric) Calls made\n"
+            "    \"errors\": n,               (numeric) Calls that returned an error\n"
+            "    \"avg_ms\": x.xxx,           (numeric) Average call time\n"
+            "    \"p50_ms\": x.xxx,           (numeric) Median call time\n"
+            "    \"p99_ms\": x.xxx,           (numeric) 99th percentile call time\n"
+            "    \"max_ms\": x.xxx,           (numeric) Longest call time\n"
+            "    \"cs_main_wait_ms\": x.xxx,  (numeric) Total time the calls waited for cs_main\n"
+            "    \"cs_wallet_wait_ms\": x.xxx,(numeric) Total time the calls waited for cs_wallet\n"
+            "    \"response_avg_bytes\": n,   (numeric) Average JSON-RPC response size\n"
+            "    \"response_max_bytes\": n    (numeric) Largest JSON-RPC response size\n"
+            "  }\n"
+            "  ,...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getrpcstats", "")
+            + HelpExampleRpc("getrpcstats", "true")
+        );
+
+    bool fReset = params.size() > 0 && params[0].get_bool();
+
+    std::map<std::string, CRPCMethodStats> mapStats;
+    {
+        LOCK(cs_rpcStats);
+        if (fReset)
+            mapStats.swap(mapRPCStats);
+        else
+            mapStats = mapRPCStats;
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    for (const auto& entry : mapStats) {
+        const CRPCMethodStats& stats = entry.second;
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("calls", stats.nCalls));
+        obj.push_back(Pair("errors", stats.nErrors));
+        obj.push_back(Pair("avg_ms", stats.nCalls ? stats.nTimeTotal / 1000.0 / stats.nCalls : 0.0));
+        obj.push_back(Pair("p50_ms", RPCLatencyPercentile(stats, 0.5)));
+        obj.push_back(Pair("p99_ms", RPCLatencyPercentile(stats, 0.99)));
+        obj.push_back(Pair("max_ms", stats.nTimeMax / 1000.0));
+        obj.push_back(Pair("cs_main_wait_ms", stats.nWaitMain / 1000.0));
+        obj.push_back(Pair("cs_wallet_wait_ms", stats.nWaitWallet / 1000.0));
+        obj.push_back(Pair("response_avg_bytes", stats.nResponses ? stats.nResponseBytes / stats.nResponses : 0));
+        obj.push_back(Pair("response_max_bytes", stats.nResponseMax));
+        ret.push_back(Pair(entry.first, std::move(obj)));
+    }
+    return ret;
+}
+
+static UniValue LockStatsToJSON(const CLockStats& stats)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("samples", (uint64_t)stats.nSamples));
+    obj.push_back(Pair("contended", (uint64_t)stats.nContended));
+    obj.push_back(Pair("wait_ms", stats.nWaitTotal / 1000.0));
+    obj.push_back(Pair("max_wait_ms", stats.nWaitMax / 1000.0));
+    obj.push_back(Pair("hold_ms", stats.nHoldTotal / 1000.0));
+    obj.push_back(Pair("max_hold_ms", stats.nHoldMax / 1000.0));
+    return obj;
+}
+
+UniValue getlockstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 2)
+        throw runtime_error(
+            "getlockstats ( reset rate )\n"
+            "\nReturns how long sampled lock acquisitions waited for their lock and held it, per lock and per place it is taken at.\n"
+            "Only one in -lockstatsrate acquisitions of each thread is sampled, none unless it is set. Times are totals of the samples,\n"
+            "multiply them by the rate for an estimate of all acquisitions. Failed TRY_LOCKs are not sampled.\n"
+            "\nArguments:\n"
+            "1. reset          (boolean, optional, default=false) Clear the statistics after returning them\n"
+            "2. rate           (numeric, optional) Sample one in rate acquisitions from now on, 0 to stop sampling\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"rate\": n,                   (numeric) One in how many acquisitions get sampled, 0 if none\n"
+            "  \"locks\": {\n"
+            "    \"name\": {                  (string) The lock, as passed to LOCK\n"
+            "      \"samples\": n,            (numeric) Sampled acquisitions\n"
+            "      \"contended\": n,          (numeric) Sampled acquisitions that found the lock held by another thread\n"
+            "      \"wait_ms\": x.xxx,        (numeric) Total time the samples waited for the lock\n"
+            "      \"max_wait_ms\": x.xxx,    (numeric) Longest wait of a sample\n"
+            "      \"hold_ms\": x.xxx,        (numeric) Total time the samples held the lock\n"
+            "      \"max_hold_ms\": x.xxx     (numeric) Longest time a sample held the lock\n"
+            "    }\n"
+            "    ,...\n"
+            "  },\n"
+            "  \"sites\": {\n"
+            "    \"file:line\": {             (string) Where the lock is taken\n"
+            "      \"lock\": \"name\",          (string) The lock\n"
+            "      ...                        The same as for the locks\n"
+            "    }\n"
+            "    ,...\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getlockstats", "")
+            + HelpExampleCli("getlockstats", "true 1000")
+            + HelpExampleRpc("getlockstats", "false, 1000")
+        );
+
+    bool fReset = params.size() > 0 && params[0].get_bool();
+
+    std::vector<CLockSiteStats> vSites;
+    GetLockStats(vSites, fReset);
+    if (params.size() > 1) {
+        int nRate = params[1].get_int();
+        if (nRate < 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "rate must not be negative");
+        SetLockStatsRate(nRate);
+    }
+
+    std::map<std::string, CLockStats> mapLocks;
+    UniValue sites(UniValue::VOBJ);
+    for (const CLockSiteStats& site : vSites) {
+        mapLocks[site.strName].Add(site.stats);
+        UniValue obj = LockStatsToJSON(site.stats);
+        obj.push_back(Pair("lock", site.strName));
+        sites.push_back(Pair(strprintf("%s:%d", site.strFile, site.nLine), obj));
+    }
+
+    UniValue locks(UniValue::VOBJ);
+    for (const auto& entry : mapLocks)
+        locks.push_back(Pair(entry.first, LockStatsToJSON(entry.second)));
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("rate", nLockStatsRate.load()));
+    ret.push_back(Pair("locks", locks));
+    ret.push_back(Pair("sites", sites));
+    return ret;
+}
+
+UniValue getschedulerinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getschedulerinfo\n"
+            "\nReturns the state of the queue of background tasks and how long the tasks took so far.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"threads\": n,                (numeric) Threads servicing the queue\n"
+            "  \"queued\": n,                 (numeric) Tasks waiting for their time\n"
+            "  \"tasks\": {\n"
+            "    \"name\": {                  (string) The task\n"
+            "      \"runs\": n,               (numeric) Times it was run\n"
+            "      \"total_ms\": x.xxx,       (numeric) Total time of the runs\n"
+            "      \"max_ms\": x.xxx,         (numeric) Longest run\n"
+            "      \"max_late_ms\": x.xxx     (numeric) Longest a run waited for a thread after its time\n"
+            "    }\n"
+            "    ,...\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getschedulerinfo", "")
+            + HelpExampleRpc("getschedulerinfo", "")
+        );
+
+    if (!pschedulerMain)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "The scheduler is not running");
+
+    std::map<std::string, CScheduler::TaskStats> mapStats;
+    int nThreads = pschedulerMain->getTaskStats(mapStats);
+    boost::chrono::system_clock::time_point first, last;
+    size_t nQueued = pschedulerMain->getQueueInfo(first, last);
+
+    UniValue tasks(UniValue::VOBJ);
+    for (const auto& entry : mapStats) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("runs", entry.second.nRuns));
+        obj.push_back(Pair("total_ms", entry.second.nTotalMicros * 0.001));
+        obj.push_back(Pair("max_ms", entry.second.nMaxMicros * 0.001));
+        obj.push_back(Pair("max_late_ms", entry.second.nMaxLateMicros * 0.001));
+        tasks.push_back(Pair(entry.first.empty() ? "unnamed" : entry.first, obj));
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("threads", nThreads));
+    ret.push_back(Pair("queued", (uint64_t)nQueued));
+    ret.push_back(Pair("tasks", tasks));
+    return ret;
+}
+
 /**
  * Call Table
  */
 static const CRPCCommand vRPCCommands[] =
-{ //  category              name                      actor (function)         okSafeMode
-  //  --------------------- ------------------------  -----------------------  ----------
+{ //  category              name                      actor (function)         okSafeMode okParallelBatch
+  //  --------------------- ------------------------  -----------------------  ---------- ---------------
     /* Overall control/query calls */
-    { "control",            "getinfo",                &getinfo,                true  }, /* uses wallet if enabled */
-    { "control",            "debug",                  &debug,                  true  },
-    { "control",            "help",                   &help,                   true  },
-    { "control",            "stop",                   &stop,                   true  },
+    { "control",            "getinfo",                &getinfo,                true,      false }, /* uses wallet if enabled */
+    { "control",            "debug",                  &debug,                  true,      false },
+    { "control",            "getmemoryinfo",          &getmemoryinfo,          true,      false },
+    { "control",            "help",                   &help,                   true,      false },
+    { "control",            "stop",                   &stop,                   true,      false },
+    { "control",            "getrpcinfo",             &getrpcinfo,             true,      false },
+    { "control",            "getrpcstats",            &getrpcstats,            true,      false },
+    { "control",            "getlockstats",           &getlockstats,           true,      false },
+    { "control",            "getschedulerinfo",       &getschedulerinfo,       true,      false },
 
     /* P2P networking */
-    { "network",            "getnetworkinfo",         &getnetworkinfo,         true  },
-    { "network",            "addnode",                &addnode,                true  },
-    { "network",            "disconnectnode",         &disconnectnode,         true  },
-    { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true  },
-    { "network",            "getconnectioncount",     &getconnectioncount,     true  },
-    { "network",            "getnettotals",           &getnettotals,           true  },
-    { "network",            "getpeerinfo",            &getpeerinfo,            true  },
-    { "network",            "ping",                   &ping,                   true  },
-    { "network",            "setban",                 &setban,                 true  },
-    { "network",            "listbanned",             &listbanned,             true  },
-    { "network",            "clearbanned",            &clearbanned,            true  },
-    { "network",            "setnetworkactive",       &setnetworkactive,       true  },
+    { "network",            "getnetworkinfo",         &getnetworkinfo,         true,      false },
+    { "network",            "addnode",                &addnode,                true,      false },
+    { "network",            "disconnectnode",         &disconnectnode,         true,      false },
+    { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true,      false },
+    { "network",            "getconnectioncount",     &getconnectioncount,     true,      false },
+    { "network",            "getnettotals",           &getnettotals,           true,      false },
+    { "network",            "getpeerinfo",            &getpeerinfo,            true,      false },
+    { "network",            "ping",                   &ping,                   true,      false },
+    { "network",            "setban",                 &setban,                 true,      false },
+    { "network",            "listbanned",             &listbanned,             true,      false },
+    { "network",            "clearbanned",            &clearbanned,            true,      false },
+    { "network",            "setnetworkactive",       &setnetworkactive,       true,      false },
 
     /* Block chain and UTXO */
-    { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true  },
-    { "blockchain",         "getbestblockhash",       &getbestblockhash,       true  },
-    { "blockchain",         "getblockcount",          &getblockcount,          true  },
-    { "blockchain",         "getblock",               &getblock,               true  },
-    { "blockchain",         "getblockhashes",         &getblockhashes,         true  },
-    { "blockchain",         "getblockhash",           &getblockhash,           true  },
-    { "blockchain",         "getblockheader",         &getblockheader,         true  },
-    { "blockchain",         "getblockheaders",        &getblockheaders,        true  },
-    { "blockchain",         "getchaintips",           &getchaintips,           true  },
-    { "blockchain",         "getdifficulty",          &getdifficulty,          true  },
-    { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true  },
-    { "blockchain",         "getrawmempool",          &getrawmempool,          true  },
-    { "blockchain",         "gettxout",               &gettxout,               true  },
-    { "blockchain",         "gettxoutproof",          &gettxoutproof,          true  },
-    { "blockchain",         "verifytxoutproof",       &verifytxoutproof,       true  },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true  },
-    { "blockchain",         "verifychain",            &verifychain,            true  },
-    { "blockchain",         "getspentinfo",           &getspentinfo,           false },
+    { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true,      false },
+    { "blockchain",         "getbestblockhash",       &getbestblockhash,       true,      true  },
+    { "blockchain",         "getblockcount",          &getblockcount,          true,      true  },
+    { "blockchain",         "getblock",               &getblock,               true,      true  },
+    { "blockchain",         "getblockhashes",         &getblockhashes,         true,      true  },
+    { "blockchain",         "getblockhash",           &getblockhash,           true,      true  },
+    { "blockchain",         "getblockheader",         &getblockheader,         true,      true  },
+    { "blockchain",         "getblockheaders",        &getblockheaders,        true,      true  },
+    { "blockchain",         "getblocksizeinfo",       &getblocksizeinfo,       true,      false },
+    { "blockchain",         "getchaintips",           &getchaintips,           true,      false },
+    { "blockchain",         "getdifficulty",          &getdifficulty,          true,      true  },
+    { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,      false },
+    { "blockchain",         "getmempoolstats",        &getmempoolstats,        true,      false },
+    { "blockchain",         "getrawmempool",          &getrawmempool,          true,      false },
+    { "blockchain",         "savemempool",            &savemempool,            true,      false },
+    { "blockchain",         "gettxout",               &gettxout,               true,      true  },
+    { "blockchain",         "gettxoutproof",          &gettxoutproof,          true,      true  },
+    { "blockchain",         "verifytxoutproof",       &verifytxoutproof,       true,      true  },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,      false },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           true,      false },
+    { "blockchain",         "verifychain",            &verifychain,            true,      false },
+    { "blockchain",         "setdbprofile",           &setdbprofile,           true,      false },
+    { "blockchain",         "getspentinfo",           &getspentinfo,           false,     true  },
 
     /* Mining */
-    { "mining",             "getblocktemplate",       &getblocktemplate,       true  },
-    { "mining",             "getmininginfo",          &getmininginfo,          true  },
-    { "mining",             "getnetworkhashps",       &getnetworkhashps,       true  },
-    { "mining",             "prioritisetransaction",  &prioritisetransaction,  true  },
-    { "mining",             "submitblock",            &submitblock,            true  },
+    { "mining",             "getblocktemplate",       &getblocktemplate,       true,      false },
+    { "mining",             "getmininginfo",          &getmininginfo,          true,      false },
+    { "mining",             "getnetworkhashps",       &getnetworkhashps,       true,      false },
+    { "mining",             "prioritisetransaction",  &prioritisetransaction,  true,      false },
+    { "mining",             "submitblock",            &submitblock,            true,      false },
 
     /* Coin generation */
-    { "generating",         "getgenerate",            &getgenerate,            true  },
-    { "generating",         "setgenerate",            &setgenerate,            true  },
-    { "generating",         "generate",               &generate,               true  },
+    { "generating",         "getgenerate",            &getgenerate,            true,      false },
+    { "generating",         "setgenerate",            &setgenerate,            true,      false },
+    { "generating",         "generate",               &generate,               true,      false },
 
     /* Raw transactions */
-    { "rawtransactions",    "createrawtransaction",   &createrawtransaction,   true  },
-    { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   true  },
-    { "rawtransactions",    "decodescript",           &decodescript,           true  },
-    { "rawtransactions",    "getrawtransaction",      &getrawtransaction,      true  },
-    { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     false },
-    { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     false }, /* uses wallet if enabled */
+    { "rawtransactions",    "createrawtransaction",   &createrawtransaction,   true,      false },
+    { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   true,      true  },
+    { "rawtransactions",    "decodescript",           &decodescript,           true,      true  },
+    { "rawtransactions",    "getrawtransaction",      &getrawtransaction,      true,      true  },
+    { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     false,     false },
+    { "rawtransactions",    "sendrawtransactions",    &sendrawtransactions,    false,     false },
+    { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     false,     false }, /* uses wallet if enabled */
 #ifdef ENABLE_WALLET
-    { "rawtransactions",    "fundrawtransaction",     &fundrawtransaction,     false },
+    { "rawtransactions",    "fundrawtransaction",     &fundrawtransaction,     false,     false },
 #endif
 
     /* Address index */
-    { "addressindex",       "getaddressmempool",      &getaddressmempool,      true  },
-    { "addressindex",       "getaddressutxos",        &getaddressutxos,        false },
-    { "addressindex",       "getaddressdeltas",       &getaddressdeltas,       false },
-    { "addressindex",       "getaddresstxids",        &getaddresstxids,        false },
-    { "addressindex",       "getaddressbalance",      &getaddressbalance,      false },
+    { "addressindex",       "getaddressmempool",      &getaddressmempool,      true,      true  },
+    { "addressindex",       "getaddressutxos",        &getaddressutxos,        false,     true  },
+    { "addressindex",       "getaddressdeltas",       &getaddressdeltas,       false,     true  },
+    { "addressindex",       "getaddresstxids",        &getaddresstxids,        false,     true  },
+    { "addressindex",       "getaddressbalance",      &getaddressbalance,      false,     true  },
 
     /* Utility functions */
-    { "util",               "createmultisig",         &createmultisig,         true  },
-    { "util",               "validateaddress",        &validateaddress,        true  }, /* uses wallet if enabled */
-    { "util",               "verifymessage",          &verifymessage,          true  },
-    { "util",               "estimatefee",            &estimatefee,            true  },
-    { "util",               "estimatepriority",       &estimatepriority,       true  },
-    { "util",               "estimatesmartfee",       &estimatesmartfee,       true  },
-    { "util",               "estimatesmartpriority",  &estimatesmartpriority,  true  },
+    { "util",               "createmultisig",         &createmultisig,         true,      false },
+    { "util",               "validateaddress",        &validateaddress,        true,      false }, /* uses wallet if enabled */
+    { "util",               "verifymessage",          &verifymessage,          true,      true  },
+    { "util",               "estimatefee",            &estimatefee,            true,      false },
+    { "util",               "estimatepriority",       &estimatepriority,       true,      false },
+    { "util",               "estimatesmartfee",       &estimatesmartfee,       true,      false },
+    { "util",               "estimatesmartpriority",  &estimatesmartpriority,  true,      false },
 
     /* Not shown in help */
-    { "hidden",             "invalidateblock",        &invalidateblock,        true  },
-    { "hidden",             "reconsiderblock",        &reconsiderblock,        true  },
-    { "hidden",             "setmocktime",            &setmocktime,            true  },
+    { "hidden",             "invalidateblock",        &invalidateblock,        true,      false },
+    { "hidden",             "reconsiderblock",        &reconsiderblock,        true,      false },
+    { "hidden",             "setmocktime",            &setmocktime,            true,      false },
 #ifdef ENABLE_WALLET
-    { "hidden",             "resendwallettransactions", &resendwallettransactions, true},
+    { "hidden",             "resendwallettransactions", &resendwallettransactions, true,      false },
 #endif
 
     /* Smartcash features */
-    { "smartcash",               "smartnode",             &smartnode,             true  },
-    { "smartcash",               "smartnodelist",         &smartnodelist,         true  },
-    { "smartcash",               "smartnodebroadcast",    &smartnodebroadcast,    true  },
-    //{ "smartcash",               "gobject",                &gobject,                true  },
-    //{ "smartcash",               "getgovernanceinfo",      &getgovernanceinfo,      true  },
-    //{ "smartcash",               "getsuperblockbudget",    &getsuperblockbudget,    true  },
-    //{ "smartcash",               "voteraw",                &voteraw,                true  },
-    { "smartcash",               "snsync",                 &snsync,                 true  },
-    { "smartcash",               "spork",                  &spork,                  true  },
-    //{ "smartcash",               "getpoolinfo",            &getpoolinfo,            true  },
-    { "smartcash",               "sentinelping",           &sentinelping,           true  },
-    { "smartcash",               "smartrewards",           &smartrewards,             true  },
+    { "smartcash",               "smartnode",             &smartnode,             true,      false },
+    { "smartcash",               "smartnodelist",         &smartnodelist,         true,      false },
+    { "smartcash",               "smartnodebroadcast",    &smartnodebroadcast,    true,      false },
+    //{ "smartcash",               "gobject",                &gobject,                true,      false },
+    //{ "smartcash",               "getgovernanceinfo",      &getgovernanceinfo,      true,      false },
+    //{ "smartcash",               "getsuperblockbudget",    &getsuperblockbudget,    true,      false },
+    //{ "smartcash",               "voteraw",                &voteraw,                true,      false },
+    { "smartcash",               "snsync",                 &snsync,                 true,      false },
+    { "smartcash",               "spork",                  &spork,                  true,      false },
+    //{ "smartcash",               "getpoolinfo",            &getpoolinfo,            true,      false },
+    { "smartcash",               "sentinelping",           &sentinelping,           true,      false },
+    { "smartcash",               "smartrewards",           &smartrewards,             true,      false },
 #ifdef ENABLE_WALLET
-    //{ "smartcash",               "privatesend",            &privatesend,            false },
+    //{ "smartcash",               "privatesend",            &privatesend,            false,     false },
 
     /* Wallet */
-    //{ "wallet",             "keepass",                &keepass,                true },
-    { "wallet",             "instantsendtoaddress",   &instantsendtoaddress,   false },
-    { "wallet",             "addmultisigaddress",     &addmultisigaddress,     true  },
-    { "wallet",             "backupwallet",           &backupwallet,           true  },
-    { "wallet",             "dumpprivkey",            &dumpprivkey,            true  },
-    { "wallet",             "dumphdinfo",             &dumphdinfo,             true  },
-    { "wallet",             "dumpwallet",             &dumpwallet,             true  },
-    { "wallet",             "encryptwallet",          &encryptwallet,          true  },
-    { "wallet",             "getaccountaddress",      &getaccountaddress,      true  },
-    { "wallet",             "getaccount",             &getaccount,             true  },
-    { "wallet",             "getaddressesbyaccount",  &getaddressesbyaccount,  true  },
-    { "wallet",             "getbalance",             &getbalance,             false },
-    { "wallet",             "getnewaddress",          &getnewaddress,          true  },
-    { "wallet",             "getrawchangeaddress",    &getrawchangeaddress,    true  },
-    { "wallet",             "getreceivedbyaccount",   &getreceivedbyaccount,   false },
-    { "wallet",             "getreceivedbyaddress",   &getreceivedbyaddress,   false },
-    { "wallet",             "gettransaction",         &gettransaction,         false },
-    { "wallet",             "abandontransaction",     &abandontransaction,     false },
-    { "wallet",             "getunconfirmedbalance",  &getunconfirmedbalance,  false },
-    { "wallet",             "getwalletinfo",          &getwalletinfo,          false },
-    { "wallet",             "importprivkey",          &importprivkey,          true  },
-    { "wallet",             "importwallet",           &importwallet,           true  },
-    { "wallet",             "importelectrumwallet",   &importelectrumwallet,   true  },
-    { "wallet",             "importaddress",          &importaddress,          true  },
-    { "wallet",             "importpubkey",           &importpubkey,           true  },
-    { "wallet",             "keypoolrefill",          &keypoolrefill,          true  },
-    { "wallet",             "listaccounts",           &listaccounts,           false },
-    { "wallet",             "listaddressgroupings",   &listaddressgroupings,   false },
-    { "wallet",             "listlockunspent",        &listlockunspent,        false },
-    { "wallet",             "listreceivedbyaccount",  &listreceivedbyaccount,  false },
-    { "wallet",             "listreceivedbyaddress",  &listreceivedbyaddress,  false },
-    { "wallet",             "listsinceblock",         &listsinceblock,         false },
-    { "wallet",             "listtransactions",       &listtransactions,       false },
-    { "wallet",             "listunspent",            &listunspent,            false },
-    { "wallet",             "lockunspent",            &lockunspent,            true  },
-    { "wallet",             "move",                   &movecmd,                false },
-    { "wallet",             "sendfrom",               &sendfrom,               false },
-    { "wallet",             "sendmany",               &sendmany,               false },
-    { "wallet",             "sendtoaddress",          &sendtoaddress,          false },
-    { "wallet",             "setaccount",             &setaccount,             true  },
-    { "wallet",             "settxfee",               &settxfee,               true  },
-    { "wallet",             "signmessage",            &signmessage,            true  },
-    { "wallet",             "walletlock",             &walletlock,             true  },
-    { "wallet",             "walletpassphrasechange", &walletpassphrasechange, true  },
-    { "wallet",             "walletpassphrase",       &walletpassphrase,       true  },
+    //{ "wallet",             "keepass",                &keepass,                true,      false },
+    { "wallet",             "instantsendtoaddress",   &instantsendtoaddress,   false,     false },
+    { "wallet",             "addmultisigaddress",     &addmultisigaddress,     true,      false },
+    { "wallet",             "backupwallet",           &backupwallet,           true,      false },
+    { "wallet",             "dumpprivkey",            &dumpprivkey,            true,      false },
+    { "wallet",             "dumphdinfo",             &dumphdinfo,             true,      false },
+    { "wallet",             "dumpwallet",             &dumpwallet,             true,      false },
+    { "wallet",             "encryptwallet",          &encryptwallet,          true,      false },
+    { "wallet",             "getaccountaddress",      &getaccountaddress,      true,      false },
+    { "wallet",             "getaccount",             &getaccount,             true,      false },
+    { "wallet",             "getaddressesbyaccount",  &getaddressesbyaccount,  true,      false },
+    { "wallet",             "getbalance",             &getbalance,             false,     false },
+    { "wallet",             "getnewaddress",          &getnewaddress,          true,      false },
+    { "wallet",             "getrawchangeaddress",    &getrawchangeaddress,    true,      false },
+    { "wallet",             "getreceivedbyaccount",   &getreceivedbyaccount,   false,     false },
+    { "wallet",             "getreceivedbyaddress",   &getreceivedbyaddress,   false,     false },
+    { "wallet",             "gettransaction",         &gettransaction,         false,     false },
+    { "wallet",             "abandontransaction",     &abandontransaction,     false,     false },
+    { "wallet",             "getunconfirmedbalance",  &getunconfirmedbalance,  false,     false },
+    { "wallet",             "getwalletinfo",          &getwalletinfo,          false,     false },
+    { "wallet",             "importprivkey",          &importprivkey,          true,      false },
+    { "wallet",             "importwallet",           &importwallet,           true,      false },
+    { "wallet",             "importelectrumwallet",   &importelectrumwallet,   true,      false },
+    { "wallet",             "importaddress",          &importaddress,          true,      false },
+    { "wallet",             "importpubkey",           &importpubkey,           true,      false },
+    { "wallet",             "keypoolrefill",          &keypoolrefill,          true,      false },
+    { "wallet",             "listaccounts",           &listaccounts,           false,     false },
+    { "wallet",             "listaddressgroupings",   &listaddressgroupings,   false,     false },
+    { "wallet",             "listlockunspent",        &listlockunspent,        false,     false },
+    { "wallet",             "listreceivedbyaccount",  &listreceivedbyaccount,  false,     false },
+    { "wallet",             "listreceivedbyaddress",  &listreceivedbyaddress,  false,     false },
+    { "wallet",             "listsinceblock",         &listsinceblock,         false,     false },
+    { "wallet",             "listtransactions",       &listtransactions,       false,     false },
+    { "wallet",             "listunspent",            &listunspent,            false,     false },
+    { "wallet",             "lockunspent",            &lockunspent,            true,      false },
+    { "wallet",             "move",                   &movecmd,                false,     false },
+    { "wallet",             "sendfrom",               &sendfrom,               false,     false },
+    { "wallet",             "sendmany",               &sendmany,               false,     false },
+    { "wallet",             "sendtoaddress",          &sendtoaddress,          false,     false },
+    { "wallet",             "setaccount",             &setaccount,             true,      false },
+    { "wallet",             "settxfee",               &settxfee,               true,      false },
+    { "wallet",             "signmessage",            &signmessage,            true,      false },
+    { "wallet",             "walletlock",             &walletlock,             true,      false },
+    { "wallet",             "walletpassphrasechange", &walletpassphrasechange, true,      false },
+    { "wallet",             "walletpassphrase",       &walletpassphrase,       true,      false },
 #endif // ENABLE_WALLET
 };
 
@@ -457,6 +839,7 @@ bool CRPCTable::appendCommand(const std::string& name, const CRPCCommand* pcmd)
 bool StartRPC()
 {
     LogPrint("rpc", "Starting RPC\n");
+    nRPCSlowLogMicros = GetArg("-rpcslowlog", DEFAULT_RPC_SLOWLOG) * 1000;
     fRPCRunning = true;
     g_rpcSignals.Started();
     return true;
@@ -532,7 +915,7 @@ void JSONRequest::parse(const UniValue& valRequest)
         throw JSONRPCError(RPC_INVALID_REQUEST, "Params must be an array");
 }
 
-static UniValue JSONRPCExecOne(const UniValue& req)
+static std::string JSONRPCExecOne(const UniValue& req)
 {
     UniValue rpc_result(UniValue::VOBJ);
 
@@ -553,16 +936,73 @@ static UniValue JSONRPCExecOne(const UniValue& req)
                                      JSONRPCError(RPC_PARSE_ERROR, e.what()), jreq.id);
     }
 
-    return rpc_result;
+    std::string strReply = rpc_result.write();
+    RPCRecordResponseSize(jreq.strMethod, strReply.size());
+    return strReply;
+}
+
+static bool IsParallelBatchItem(const UniValue& req)
+{
+    if (!req.isObject())
+        return false;
+    const UniValue& valMethod = find_value(req, "method");
+    if (!valMethod.isStr())
+        return false;
+    const CRPCCommand *pcmd = tableRPC[valMethod.get_str()];
+    return pcmd && pcmd->okParallelBatch;
+}
+
+static void JSONRPCExecRange(const UniValue& vReq, std::vector<std::string>& vResults, std::atomic<size_t>& nNext, size_t nEnd, std::exception_ptr& error)
+{
+    try {
+        for (size_t reqIdx = nNext++; reqIdx < nEnd; reqIdx = nNext++)
+            vResults[reqIdx] = JSONRPCExecOne(vReq[reqIdx]);
+    } catch (...) {
+        // Anything JSONRPCExecOne doesn't turn into an error reply ends the batch, like when run serially
+        error = std::current_exception();
+        nNext = nEnd;
+    }
 }
 
 std::string JSONRPCExecBatch(const UniValue& vReq)
 {
-    UniValue ret(UniValue::VARR);
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    size_t nMaxThreads = std::max<int64_t>(GetArg("-rpcbatchthreads", DEFAULT_RPC_BATCH_THREADS), 1);
+    std::vector<std::string> vResults(vReq.size());
+
+    size_t reqIdx = 0;
+    while (reqIdx < vReq.size()) {
+        // Items that may change state run alone, in order, so later items see their effects
+        size_t nEnd = reqIdx;
+        while (nEnd < vReq.size() && IsParallelBatchItem(vReq[nEnd]))
+            nEnd++;
+        if (nEnd - reqIdx < 2 || nMaxThreads < 2) {
+            vResults[reqIdx] = JSONRPCExecOne(vReq[reqIdx]);
+            reqIdx++;
+            continue;
+        }
 
-    return ret.write() + "\n";
+        std::atomic<size_t> nNext(reqIdx);
+        std::vector<std::exception_ptr> vErrors(std::min(nMaxThreads, nEnd - reqIdx));
+        std::vector<std::thread> vThreads;
+        for (size_t i = 1; i < vErrors.size(); i++)
+            vThreads.push_back(std::thread(JSONRPCExecRange, std::cref(vReq), std::ref(vResults), std::ref(nNext), nEnd, std::ref(vErrors[i])));
+        JSONRPCExecRange(vReq, vResults, nNext, nEnd, vErrors[0]);
+        for (std::thread& thread : vThreads)
+            thread.join();
+        for (const std::exception_ptr& error : vErrors)
+            if (error)
+                std::rethrow_exception(error);
+        reqIdx = nEnd;
+    }
+
+    // The replies were written as they were made, so their sizes could be counted
+    std::string strReply = "[";
+    for (size_t i = 0; i < vResults.size(); i++) {
+        if (i > 0)
+            strReply += ",";
+        strReply += vResults[i];
+    }
+    return strReply + "]\n";
 }
 
 UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params) const
@@ -581,10 +1021,13 @@ UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params
 
     g_rpcSignals.PreCommand(*pcmd);
 
+    CRPCCallRecorder recorder(*pcmd, params);
     try
     {
         // Execute
-        return pcmd->actor(params, false);
+        UniValue result = pcmd->actor(params, false);
+        recorder.Success();
+        return result;
     }
     catch (const std::exception& e)
     {
@@ -6,11 +6,12 @@
 
 #include "reverselock.h"
 
+#include <algorithm>
 #include <assert.h>
 #include <boost/bind.hpp>
 #include <utility>
 
-CScheduler::CScheduler() : nThreadsServicingQueue(0), stopRequested(false), stopWhenEmpty(false)
+CScheduler::CScheduler() : nNextTaskId(0), nThreadsServicingQueue(0), stopRequested(false), stopWhenEmpty(false)
 {
 }
 
@@ -36,6 +37,7 @@ void CScheduler::serviceQueue()
     // when the thread is waiting or when the user's function
     // is called.
     while (!shouldStop()) {
+        TaskId idRunning = 0;
         try {
             while (!shouldStop() && taskQueue.empty()) {
                 // Wait until there is something to do.
@@ -61,20 +63,40 @@ void CScheduler::serviceQueue()
             }
 #endif
             // If there are multiple threads, the queue can empty while we're waiting (another
-            // thread may service the task we were waiting on).
-            if (shouldStop() || taskQueue.empty())
+            // thread may service the task we were waiting on). The task may also have been
+            // cancelled, leaving one that isn't due yet in front.
+            boost::chrono::system_clock::time_point now = boost::chrono::system_clock::now();
+            if (shouldStop() || taskQueue.empty() || taskQueue.begin()->first > now)
                 continue;
 
-            Function f = taskQueue.begin()->second;
-            taskQueue.erase(taskQueue.begin());
+            TaskQueue::iterator it = nextTask(now);
+            Task task = it->second;
+            int64_t nLateMicros = boost::chrono::duration_cast<boost::chrono::microseconds>(now - it->first).count();
+            mapQueuedTasks.erase(task.id);
+            taskQueue.erase(it);
+            setRunningTasks.insert(task.id);
+            idRunning = task.id;
 
+            boost::chrono::steady_clock::time_point start = boost::chrono::steady_clock::now();
             {
                 // Unlock before calling f, so it can reschedule itself or another task
                 // without deadlocking:
                 reverse_lock<boost::unique_lock<boost::mutex> > rlock(lock);
-                f();
+                task.f();
             }
+            int64_t nMicros = boost::chrono::duration_cast<boost::chrono::microseconds>(boost::chrono::steady_clock::now() - start).count();
+
+            setRunningTasks.erase(task.id);
+            setCancelledTasks.erase(task.id);
+
+            TaskStats& stats = mapTaskStats[task.strName];
+            stats.nRuns++;
+            stats.nTotalMicros += nMicros;
+            stats.nMaxMicros = std::max(stats.nMaxMicros, nMicros);
+            stats.nMaxLateMicros = std::max(stats.nMaxLateMicros, nLateMicros);
         } catch (...) {
+            setRunningTasks.erase(idRunning);
+            setCancelledTasks.erase(idRunning);
             --nThreadsServicingQueue;
             throw;
         }
@@ -83,6 +105,17 @@ void CScheduler::serviceQueue()
     newTaskScheduled.notify_one();
 }
 
+CScheduler::TaskQueue::iterator CScheduler::nextTask(boost::chrono::system_clock::time_point now)
+{
+    // Of the tasks that are due the earliest one of the highest priority
+    TaskQueue::iterator best = taskQueue.begin();
+    for (TaskQueue::iterator it = best; it != taskQueue.end() && it->first <= now; ++it) {
+        if (it->second.priority < best->second.priority)
+            best = it;
+    }
+    return best;
+}
+
 void CScheduler::stop(bool drain)
 {
     {
@@ -95,29 +128,82 @@ void CScheduler::stop(bool drain)
     newTaskScheduled.notify_all();
 }
 
-void CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t)
+void CScheduler::queueTask(const Task& task, boost::chrono::system_clock::time_point t)
+{
+    if (setCancelledTasks.count(task.id))
+        return;
+    mapQueuedTasks[task.id] = taskQueue.insert(std::make_pair(t, task));
+}
+
+CScheduler::TaskId CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t,
+                                        const std::string& strName, Priority priority)
 {
+    Task task;
+    task.f = f;
+    task.strName = strName;
+    task.priority = priority;
     {
         boost::unique_lock<boost::mutex> lock(newTaskMutex);
-        taskQueue.insert(std::make_pair(t, f));
+        task.id = ++nNextTaskId;
+        queueTask(task, t);
     }
     newTaskScheduled.notify_one();
+    return task.id;
 }
 
-void CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaSeconds)
+CScheduler::TaskId CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaSeconds,
+                                               const std::string& strName, Priority priority)
 {
-    schedule(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds));
+    return schedule(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds), strName, priority);
 }
 
-static void Repeat(CScheduler* s, CScheduler::Function f, int64_t deltaSeconds)
+void CScheduler::repeat(CScheduler::Function f, int64_t deltaSeconds, TaskId id, const std::string& strName, Priority priority)
 {
     f();
-    s->scheduleFromNow(boost::bind(&Repeat, s, f, deltaSeconds), deltaSeconds);
+
+    Task task;
+    task.f = boost::bind(&CScheduler::repeat, this, f, deltaSeconds, id, strName, priority);
+    task.id = id;
+    task.strName = strName;
+    task.priority = priority;
+    {
+        boost::unique_lock<boost::mutex> lock(newTaskMutex);
+        queueTask(task, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds));
+    }
+    newTaskScheduled.notify_one();
 }
 
-void CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaSeconds)
+CScheduler::TaskId CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaSeconds,
+                                             const std::string& strName, Priority priority)
 {
-    scheduleFromNow(boost::bind(&Repeat, this, f, deltaSeconds), deltaSeconds);
+    Task task;
+    task.strName = strName;
+    task.priority = priority;
+    {
+        boost::unique_lock<boost::mutex> lock(newTaskMutex);
+        task.id = ++nNextTaskId;
+        task.f = boost::bind(&CScheduler::repeat, this, f, deltaSeconds, task.id, strName, priority);
+        queueTask(task, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds));
+    }
+    newTaskScheduled.notify_one();
+    return task.id;
+}
+
+bool CScheduler::cancel(TaskId id)
+{
+    boost::unique_lock<boost::mutex> lock(newTaskMutex);
+    std::map<TaskId, TaskQueue::iterator>::iterator it = mapQueuedTasks.find(id);
+    if (it != mapQueuedTasks.end()) {
+        taskQueue.erase(it->second);
+        mapQueuedTasks.erase(it);
+        return true;
+    }
+    // The next run of a repeating task gets queued by the current one
+    if (setRunningTasks.count(id)) {
+        setCancelledTasks.insert(id);
+        return true;
+    }
+    return false;
 }
 
 size_t CScheduler::getQueueInfo(boost::chrono::system_clock::time_point &first,
@@ -131,3 +217,10 @@ size_t CScheduler::getQueueInfo(boost::chrono::system_clock::time_point &first,
     }
     return result;
 }
+
+int CScheduler::getTaskStats(std::map<std::string, TaskStats> &mapStatsRet) const
+{
+    boost::unique_lock<boost::mutex> lock(newTaskMutex);
+    mapStatsRet = mapTaskStats;
+    return nThreadsServicingQueue;
+}
@@ -14,6 +14,11 @@
 #include <boost/chrono/chrono.hpp>
 #include <boost/thread.hpp>
 #include <map>
+#include <set>
+#include <string>
+
+static const int DEFAULT_SCHEDULER_THREADS = 2;
+static const int MAX_SCHEDULER_THREADS = 16;
 
 //
 // Simple class for background tasks that should be run
@@ -32,6 +37,9 @@
 // delete t;
 // delete s; // Must be done after thread is interrupted/joined.
 //
+// More than one thread can service the queue, so that a slow task doesn't
+// hold up the others.
+//
 
 class CScheduler
 {
@@ -40,21 +48,47 @@ public:
     ~CScheduler();
 
     typedef boost::function<void(void)> Function;
+    typedef uint64_t TaskId;
+
+    // Of the tasks that are due, those of a higher priority run first
+    enum Priority {
+        PRIORITY_HIGH,
+        PRIORITY_NORMAL,
+        PRIORITY_LOW,
+    };
+
+    // Runtime statistics of the tasks of one name
+    struct TaskStats {
+        uint64_t nRuns;
+        int64_t nTotalMicros;
+        int64_t nMaxMicros;
+        // Longest a task waited for a thread after its time
+        int64_t nMaxLateMicros;
+
+        TaskStats() : nRuns(0), nTotalMicros(0), nMaxMicros(0), nMaxLateMicros(0) {}
+    };
 
     // Call func at/after time t
-    void schedule(Function f, boost::chrono::system_clock::time_point t);
+    TaskId schedule(Function f, boost::chrono::system_clock::time_point t,
+                    const std::string& strName = "", Priority priority = PRIORITY_NORMAL);
 
     // Convenience method: call f once deltaSeconds from now
-    void scheduleFromNow(Function f, int64_t deltaSeconds);
+    TaskId scheduleFromNow(Function f, int64_t deltaSeconds,
+                           const std::string& strName = "", Priority priority = PRIORITY_NORMAL);
 
     // Another convenience method: call f approximately
     // every deltaSeconds forever, starting deltaSeconds from now.
     // To be more precise: every time f is finished, it
     // is rescheduled to run deltaSeconds later. If you
     // need more accurate scheduling, don't use this method.
-    void scheduleEvery(Function f, int64_t deltaSeconds);
+    // All runs share the returned id.
+    TaskId scheduleEvery(Function f, int64_t deltaSeconds,
+                         const std::string& strName = "", Priority priority = PRIORITY_NORMAL);
 
-    // To keep things as simple as possible, there is no unschedule.
+    // Remove a task from the queue, or keep a repeating one that is running
+    // from being scheduled again. Returns false if the task is neither queued
+    // nor running.
+    bool cancel(TaskId id);
 
     // Services the queue 'forever'. Should be run in a thread,
     // and interrupted using boost::interrupt_thread
@@ -70,14 +104,38 @@ public:
     size_t getQueueInfo(boost::chrono::system_clock::time_point &first,
                         boost::chrono::system_clock::time_point &last) const;
 
+    // Returns the number of threads servicing the queue and the statistics
+    // of the tasks run so far by name, unnamed ones are listed as ""
+    int getTaskStats(std::map<std::string, TaskStats> &mapStatsRet) const;
+
 private:
-    std::multimap<boost::chrono::system_clock::time_point, Function> taskQueue;
+    struct Task {
+        Function f;
+        TaskId id;
+        std::string strName;
+        Priority priority;
+    };
+    typedef std::multimap<boost::chrono::system_clock::time_point, Task> TaskQueue;
+
+    TaskQueue taskQueue;
+    std::map<TaskId, TaskQueue::iterator> mapQueuedTasks;
+    // Tasks being serviced, and those of them cancelled while running
+    std::set<TaskId> setRunningTasks;
+    std::set<TaskId> setCancelledTasks;
+    TaskId nNextTaskId;
+    std::map<std::string, TaskStats> mapTaskStats;
     boost::condition_variable newTaskScheduled;
     mutable boost::mutex newTaskMutex;
     int nThreadsServicingQueue;
     bool stopRequested;
     bool stopWhenEmpty;
     bool shouldStop() { return stopRequested || (stopWhenEmpty && taskQueue.empty()); }
+
+    // Queue task unless it was cancelled while running. Requires newTaskMutex.
+    void queueTask(const Task& task, boost::chrono::system_clock::time_point t);
+    // Take the task to run next off the queue. Requires newTaskMutex.
+    TaskQueue::iterator nextTask(boost::chrono::system_clock::time_point now);
+    void repeat(Function f, int64_t deltaSeconds, TaskId id, const std::string& strName, Priority priority);
 };
 
 #endif
@@ -10,6 +10,11 @@
 #include "script/interpreter.h"
 #include "version.h"
 
+#include <algorithm>
+#include <system_error>
+#include <thread>
+#include <vector>
+
 namespace {
 
 /** A class that deserializes a single CTransaction one time. */
@@ -91,6 +96,60 @@ static int verify_script(const unsigned char *scriptPubKey, unsigned int scriptP
     }
 }
 
+/** Verify inputs [nBegin, nEnd) of tx, writing 1 or 0 per input to vResults */
+static void verify_input_range(const CTransaction& tx, const smartcashconsensus_spent_output *spentOutputs, unsigned int flags,
+                               size_t nBegin, size_t nEnd, std::vector<int>& vResults)
+{
+    for (size_t nIn = nBegin; nIn < nEnd; nIn++) {
+        const smartcashconsensus_spent_output& output = spentOutputs[nIn];
+        CScript scriptPubKey(output.scriptPubKey, output.scriptPubKey + output.scriptPubKeyLen);
+        vResults[nIn] = VerifyScript(tx.vin[nIn].scriptSig, scriptPubKey, flags, TransactionSignatureChecker(&tx, nIn), NULL) ? 1 : 0;
+    }
+}
+
+int smartcashconsensus_verify_transaction(const unsigned char *txTo, unsigned int txToLen,
+                                    const smartcashconsensus_spent_output *spentOutputs, unsigned int spentOutputsLen,
+                                    unsigned int flags, unsigned int nThreads, int *results, smartcashconsensus_error* err)
+{
+    try {
+        TxInputStream stream(SER_NETWORK, PROTOCOL_VERSION, txTo, txToLen);
+        CTransaction tx;
+        stream >> tx;
+        if (tx.GetSerializeSize(SER_NETWORK, PROTOCOL_VERSION) != txToLen)
+            return set_error(err, smartcashconsensus_ERR_TX_SIZE_MISMATCH);
+        if (spentOutputsLen != tx.vin.size() || (spentOutputsLen > 0 && spentOutputs == NULL))
+            return set_error(err, smartcashconsensus_ERR_SPENT_OUTPUTS_MISMATCH);
+
+        // no point in threads that would get less than one input each
+        size_t nInputs = tx.vin.size();
+        size_t nChunks = std::max<size_t>(1, std::min<size_t>(nThreads, nInputs));
+        size_t nChunk = nInputs == 0 ? 0 : (nInputs + nChunks - 1) / nChunks;
+
+        std::vector<int> vResults(nInputs, 0);
+        std::vector<std::thread> vecThreads;
+        for (size_t nBegin = nChunk; nBegin < nInputs; nBegin += nChunk) {
+            size_t nEnd = std::min(nBegin + nChunk, nInputs);
+            try {
+                vecThreads.push_back(std::thread(verify_input_range, std::cref(tx), spentOutputs, flags, nBegin, nEnd, std::ref(vResults)));
+            } catch (const std::system_error&) {
+                // out of threads, verify this part here
+                verify_input_range(tx, spentOutputs, flags, nBegin, nEnd, vResults);
+            }
+        }
+        verify_input_range(tx, spentOutputs, flags, 0, std::min(nChunk, nInputs), vResults);
+        for (auto& thread : vecThreads) thread.join();
+
+        // Regardless of the verification result, the tx did not error.
+        set_error(err, smartcashconsensus_ERR_OK);
+
+        if (results)
+            std::copy(vResults.begin(), vResults.end(), results);
+        return std::count(vResults.begin(), vResults.end(), 0) == 0 ? 1 : 0;
+    } catch (const std::exception&) {
+        return set_error(err, smartcashconsensus_ERR_TX_DESERIALIZE); // Error deserializing
+    }
+}
+
 int smartcashconsensus_verify_script_with_amount(const unsigned char *scriptPubKey, unsigned int scriptPubKeyLen, int64_t amount,
                                     const unsigned char *txTo        , unsigned int txToLen,
                                     unsigned int nIn, unsigned int flags, smartcashconsensus_error* err)
@@ -33,7 +33,7 @@
 extern "C" {
 #endif
 
-#define SMARTCASHCONSENSUS_API_VER 1
+#define SMARTCASHCONSENSUS_API_VER 2
 
 typedef enum smartcashconsensus_error_t
 {
@@ -42,8 +42,17 @@ typedef enum smartcashconsensus_error_t
     smartcashconsensus_ERR_TX_SIZE_MISMATCH,
     smartcashconsensus_ERR_TX_DESERIALIZE,
     smartcashconsensus_ERR_AMOUNT_REQUIRED,
+    smartcashconsensus_ERR_SPENT_OUTPUTS_MISMATCH,
 } smartcashconsensus_error;
 
+/** An output spent by the transaction passed to smartcashconsensus_verify_transaction */
+typedef struct smartcashconsensus_spent_output
+{
+    const unsigned char *scriptPubKey;
+    unsigned int scriptPubKeyLen;
+    int64_t amount;
+} smartcashconsensus_spent_output;
+
 /** Script verification flags */
 enum
 {
@@ -68,6 +77,18 @@ EXPORT_SYMBOL int smartcashconsensus_verify_script_with_amount(const unsigned ch
                                     const unsigned char *txTo        , unsigned int txToLen,
                                     unsigned int nIn, unsigned int flags, smartcashconsensus_error* err);
 
+/// Verifies every input of the serialized transaction pointed to by txTo,
+/// deserializing it once: input i must correctly spend spentOutputs[i] under
+/// the constraints specified by flags, spentOutputsLen must equal the number
+/// of inputs. If not NULL, results[i] is set to 1 if input i verified and to
+/// 0 if not. The inputs are split over up to nThreads threads, 0 or 1 verifies
+/// them on the calling thread.
+/// Returns 1 if all inputs verified, if not NULL err will contain an
+/// error/success code for the operation
+EXPORT_SYMBOL int smartcashconsensus_verify_transaction(const unsigned char *txTo, unsigned int txToLen,
+                                    const smartcashconsensus_spent_output *spentOutputs, unsigned int spentOutputsLen,
+                                    unsigned int flags, unsigned int nThreads, int *results, smartcashconsensus_error* err);
+
 EXPORT_SYMBOL unsigned int smartcashconsensus_version();
 
 #ifdef __cplusplus
@@ -17,6 +17,7 @@
 #include <stdint.h>
 #include <string>
 #include <string.h>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 #include "prevector.h"
@@ -206,6 +207,25 @@ enum
         SerializationOp(s, CSerActionUnserialize(), nType, nVersion);                \
     }
 
+/**
+ * Like ADD_SERIALIZE_METHODS, for types that always serialize to nBytes bytes.
+ * GetSerializeSize returns the compile-time constant SERIALIZED_SIZE instead of
+ * walking the fields with a CSizeComputer.
+ */
+#define ADD_SERIALIZE_METHODS_FIXED_SIZE(nBytes)                                       \
+    static const size_t SERIALIZED_SIZE = nBytes;                                    \
+    size_t GetSerializeSize(int, int) const {                                        \
+        return SERIALIZED_SIZE;                                                      \
+    }                                                                                \
+    template<typename Stream>                                                        \
+    void Serialize(Stream& s, int nType, int nVersion) const {                       \
+        NCONST_PTR(this)->SerializationOp(s, CSerActionSerialize(), nType, nVersion);\
+    }                                                                                \
+    template<typename Stream>                                                        \
+    void Unserialize(Stream& s, int nType, int nVersion) {                           \
+        SerializationOp(s, CSerActionUnserialize(), nType, nVersion);                \
+    }
+
 /*
  * Basic Types
  */
@@ -395,6 +415,13 @@ I ReadVarInt(Stream& is)
 }
 
 #define FLATDATA(obj) REF(CFlatData((char*)&(obj), (char*)&(obj) + sizeof(obj)))
+/**
+ * The fields first through last as one blob, read or written with a single call on the
+ * stream (one hash update for a CHashWriter). They must be fixed-size and laid out back
+ * to back in memory exactly as they are serialized, which for integers only holds on
+ * little-endian hosts (see WORDS_BIGENDIAN).
+ */
+#define FLATRANGE(first, last) REF(CFlatData((char*)&(first), (char*)(&(last) + 1)))
 #define VARINT(obj) REF(WrapVarInt(REF(obj)))
 #define COMPACTSIZE(obj) REF(CCompactSize(REF(obj)))
 #define LIMITED_STRING(obj,n) REF(LimitedString< n >(REF(obj)))
@@ -594,6 +621,13 @@ template<typename K, typename T, typename Pred, typename A> unsigned int GetSeri
 template<typename Stream, typename K, typename T, typename Pred, typename A> void Serialize(Stream& os, const std::map<K, T, Pred, A>& m, int nType, int nVersion);
 template<typename Stream, typename K, typename T, typename Pred, typename A> void Unserialize(Stream& is, std::map<K, T, Pred, A>& m, int nType, int nVersion);
 
+/**
+ * unordered_map
+ */
+template<typename K, typename T, typename H, typename Pred, typename A> unsigned int GetSerializeSize(const std::unordered_map<K, T, H, Pred, A>& m, int nType, int nVersion);
+template<typename Stream, typename K, typename T, typename H, typename Pred, typename A> void Serialize(Stream& os, const std::unordered_map<K, T, H, Pred, A>& m, int nType, int nVersion);
+template<typename Stream, typename K, typename T, typename H, typename Pred, typename A> void Unserialize(Stream& is, std::unordered_map<K, T, H, Pred, A>& m, int nType, int nVersion);
+
 /**
  * set
  */
@@ -615,6 +649,14 @@ void Serialize(Stream &s, const std::shared_ptr <T> &item, int nType, int nVersi
 template<typename Stream, typename T>
 void Unserialize(Stream &s, std::shared_ptr <T> &item, int nType, int nVersion);
 
+/**
+ * shared transaction (CTransactionRef), defined in primitives/transaction.h
+ */
+class CTransaction;
+inline unsigned int GetSerializeSize(const std::shared_ptr<const CTransaction>& tx, int nType, int nVersion);
+template<typename Stream> void Serialize(Stream& os, const std::shared_ptr<const CTransaction>& tx, int nType, int nVersion);
+template<typename Stream> void Unserialize(Stream& is, std::shared_ptr<const CTransaction>& tx, int nType, int nVersion);
+
 
 /**
  * If none of the specialized versions above matched, default to calling member function.
@@ -972,6 +1014,41 @@ void Unserialize(Stream& is, std::map<K, T, Pred, A>& m, int nType, int nVersion
 }
 
 
+/**
+ * unordered_map, same format as map but in no particular order
+ */
+template<typename K, typename T, typename H, typename Pred, typename A>
+unsigned int GetSerializeSize(const std::unordered_map<K, T, H, Pred, A>& m, int nType, int nVersion)
+{
+    unsigned int nSize = GetSizeOfCompactSize(m.size());
+    for (typename std::unordered_map<K, T, H, Pred, A>::const_iterator mi = m.begin(); mi != m.end(); ++mi)
+        nSize += GetSerializeSize((*mi), nType, nVersion);
+    return nSize;
+}
+
+template<typename Stream, typename K, typename T, typename H, typename Pred, typename A>
+void Serialize(Stream& os, const std::unordered_map<K, T, H, Pred, A>& m, int nType, int nVersion)
+{
+    WriteCompactSize(os, m.size());
+    for (typename std::unordered_map<K, T, H, Pred, A>::const_iterator mi = m.begin(); mi != m.end(); ++mi)
+        Serialize(os, (*mi), nType, nVersion);
+}
+
+template<typename Stream, typename K, typename T, typename H, typename Pred, typename A>
+void Unserialize(Stream& is, std::unordered_map<K, T, H, Pred, A>& m, int nType, int nVersion)
+{
+    m.clear();
+    unsigned int nSize = ReadCompactSize(is);
+    m.reserve(nSize);
+    for (unsigned int i = 0; i < nSize; i++)
+    {
+        std::pair<K, T> item;
+        Unserialize(is, item, nType, nVersion);
+        m.insert(item);
+    }
+}
+
+
 
 /**
  * set
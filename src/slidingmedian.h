@@ -0,0 +1,101 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SMARTCASH_SLIDINGMEDIAN_H
+#define SMARTCASH_SLIDINGMEDIAN_H
+
+#include <assert.h>
+#include <map>
+#include <set>
+
+/**
+ * Keyed window of values that keeps its median available at all times.
+ *
+ * Values are stored in insertion key order (e.g. block height) so either end of
+ * the window can be dropped, and split over two ordered halves so that insert,
+ * erase and median lookups are all O(log n). The lower half always holds the
+ * smaller values and is never smaller than the upper half.
+ */
+template <typename K, typename T>
+class CSlidingMedian
+{
+public:
+    typedef typename std::map<K, T>::size_type size_type;
+    typedef typename std::map<K, T>::const_iterator const_iterator;
+
+private:
+    std::map<K, T> mapWindow;
+    std::multiset<T> setLower;
+    std::multiset<T> setUpper;
+
+    void Rebalance()
+    {
+        while (setLower.size() > setUpper.size() + 1) {
+            typename std::multiset<T>::iterator it = --setLower.end();
+            setUpper.insert(*it);
+            setLower.erase(it);
+        }
+        while (setUpper.size() > setLower.size()) {
+            typename std::multiset<T>::iterator it = setUpper.begin();
+            setLower.insert(*it);
+            setUpper.erase(it);
+        }
+    }
+
+public:
+    const_iterator begin() const { return mapWindow.begin(); }
+    const_iterator end() const { return mapWindow.end(); }
+    size_type size() const { return mapWindow.size(); }
+    bool empty() const { return mapWindow.empty(); }
+    size_type count(const K& key) const { return mapWindow.count(key); }
+
+    /** Smallest and largest key currently in the window. Window must not be empty. */
+    const K& FrontKey() const { assert(!empty()); return mapWindow.begin()->first; }
+    const K& BackKey() const { assert(!empty()); return mapWindow.rbegin()->first; }
+
+    /** Add a value under a key that is not yet in the window. Returns false if the key exists. */
+    bool Insert(const K& key, const T& value)
+    {
+        if (!mapWindow.insert(std::make_pair(key, value)).second)
+            return false;
+        if (setLower.empty() || !(*setLower.rbegin() < value))
+            setLower.insert(value);
+        else
+            setUpper.insert(value);
+        Rebalance();
+        return true;
+    }
+
+    /** Remove the value stored under key. Returns false if the key is not in the window. */
+    bool Erase(const K& key)
+    {
+        typename std::map<K, T>::iterator itKey = mapWindow.find(key);
+        if (itKey == mapWindow.end())
+            return false;
+        const T& value = itKey->second;
+        if (!(*setLower.rbegin() < value))
+            setLower.erase(setLower.find(value));
+        else
+            setUpper.erase(setUpper.find(value));
+        mapWindow.erase(itKey);
+        Rebalance();
+        return true;
+    }
+
+    void PopFront() { Erase(FrontKey()); }
+    void PopBack() { Erase(BackKey()); }
+
+    void clear()
+    {
+        mapWindow.clear();
+        setLower.clear();
+        setUpper.clear();
+    }
+
+    /** Lower and upper middle element; both are the same for odd sized windows. Window must not be empty. */
+    const T& LowerMedian() const { assert(!empty()); return *setLower.rbegin(); }
+    const T& UpperMedian() const { assert(!empty()); return size() % 2 ? *setLower.rbegin() : *setUpper.begin(); }
+};
+
+#endif // SMARTCASH_SLIDINGMEDIAN_H
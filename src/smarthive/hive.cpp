@@ -5,11 +5,57 @@
 #include "smarthive/hive.h"
 #include "validation.h"
 
+#include <algorithm>
+
 static std::map<SmartHive::Payee, const CSmartAddress*> addressesMainnet;
 static std::map<SmartHive::Payee, const CScript*> scriptsMainnet;
 static std::map<SmartHive::Payee, const CSmartAddress*> addressesTestnet;
 static std::map<SmartHive::Payee, const CScript*> scriptsTestnet;
 
+// Sorted keys of the hive addresses and scripts for the IsHive lookups. An
+// address key is its version byte and hash, a script key is 1 for P2SH or
+// 0 for P2PKH and the hash.
+typedef std::pair<unsigned char, uint160> HiveKey;
+static std::vector<HiveKey> addressKeysMainnet;
+static std::vector<HiveKey> scriptKeysMainnet;
+static std::vector<HiveKey> addressKeysTestnet;
+static std::vector<HiveKey> scriptKeysTestnet;
+
+static bool GetScriptKey(const CScript &script, HiveKey &key)
+{
+    if( script.size() == 25 && script[0] == OP_DUP && script[1] == OP_HASH160 && script[2] == 20 &&
+        script[23] == OP_EQUALVERIFY && script[24] == OP_CHECKSIG ){
+        key.first = 0;
+        memcpy(key.second.begin(), &script[3], 20);
+        return true;
+    }
+
+    if( script.IsPayToScriptHash() ){
+        key.first = 1;
+        memcpy(key.second.begin(), &script[2], 20);
+        return true;
+    }
+
+    return false;
+}
+
+static void BuildKeys(const std::map<SmartHive::Payee, const CSmartAddress*> &addresses,
+                      const std::map<SmartHive::Payee, const CScript*> &scripts,
+                      std::vector<HiveKey> &addressKeys, std::vector<HiveKey> &scriptKeys)
+{
+    HiveKey key;
+
+    for (auto it = addresses.begin(); it != addresses.end(); ++it )
+        if( it->second->GetRaw(key.first, key.second) ) addressKeys.push_back(key);
+
+    // Only the scripts of the active network are valid.
+    for (auto it = scripts.begin(); it != scripts.end(); ++it )
+        if( GetScriptKey(*it->second, key) ) scriptKeys.push_back(key);
+
+    std::sort(addressKeys.begin(), addressKeys.end());
+    std::sort(scriptKeys.begin(), scriptKeys.end());
+}
+
 void SmartHive::Init()
 {
     static bool init = false;
@@ -59,34 +105,31 @@ void SmartHive::Init()
         { SmartHive::Quality,          new CScript(std::move(addressesTestnet.at(SmartHive::Quality)->GetScript())) } // New hive 3
     };
 
+    BuildKeys(addressesMainnet, scriptsMainnet, addressKeysMainnet, scriptKeysMainnet);
+    BuildKeys(addressesTestnet, scriptsTestnet, addressKeysTestnet, scriptKeysTestnet);
+
     init = true;
 }
 
 
 bool SmartHive::IsHive(const CSmartAddress &address)
 {
-    std::map<SmartHive::Payee, const CSmartAddress*> * ptr;
-
-    if( MainNet() ) ptr = &addressesMainnet;
-    else           ptr = &addressesTestnet;
+    HiveKey key;
+    if( !address.GetRaw(key.first, key.second) ) return false;
 
-    for (auto it = ptr->begin(); it != ptr->end(); ++it )
-        if( *it->second == address ) return true;
+    const std::vector<HiveKey> &keys = MainNet() ? addressKeysMainnet : addressKeysTestnet;
 
-    return false;
+    return std::binary_search(keys.begin(), keys.end(), key);
 }
 
 bool SmartHive::IsHive(const CScript &script)
 {
-    std::map<SmartHive::Payee, const CScript*> * ptr;
-
-    if( MainNet() ) ptr = &scriptsMainnet;
-    else           ptr = &scriptsTestnet;
+    HiveKey key;
+    if( !GetScriptKey(script, key) ) return false;
 
-    for (auto it = ptr->begin(); it != ptr->end(); ++it )
-        if( *it->second == script ) return true;
+    const std::vector<HiveKey> &keys = MainNet() ? scriptKeysMainnet : scriptKeysTestnet;
 
-    return false;
+    return std::binary_search(keys.begin(), keys.end(), key);
 }
 
 const CScript* SmartHive::ScriptPtr(SmartHive::Payee payee)
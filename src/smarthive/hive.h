@@ -37,6 +37,15 @@ struct CSmartAddress : public CBitcoinAddress
     }
 
     CScript GetScript() const { return GetScriptForDestination(Get()); }
+
+    //! Version byte and hash160 of the address, false if it has another layout.
+    bool GetRaw(unsigned char &version, uint160 &hash) const
+    {
+        if( vchVersion.size() != 1 || vchData.size() != 20 ) return false;
+        version = vchVersion[0];
+        memcpy(hash.begin(), vchData.data(), 20);
+        return true;
+    }
 };
 
 namespace SmartHive{
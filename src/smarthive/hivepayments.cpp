@@ -8,12 +8,25 @@
 #include "consensus/validation.h"
 #include "validation.h"
 
+#include <algorithm>
+#include <climits>
+
 static CSmartHiveSplit *hiveSplitInitial = nullptr;
 static CSmartHiveSplit *hiveSplit_1_0 = nullptr;
 static CSmartHiveSplit *hiveSplit_1_1 = nullptr;
 static CSmartHiveSplit *hiveSplit_1_2 = nullptr;
 static CSmartHiveSplit *hiveSplitDisabled = nullptr;
 
+// Split in use from nStartHeight on until the next range starts.
+struct CSmartHiveSplitRange
+{
+    int nStartHeight;
+    const CSmartHiveSplit *split;
+};
+
+// Hive split schedule of the active network, sorted by height and built once in Init.
+static std::vector<CSmartHiveSplitRange> vecHiveSchedule;
+
 void SmartHivePayments::Init()
 {
     static bool init = false;
@@ -73,45 +86,42 @@ void SmartHivePayments::Init()
 
     hiveSplitDisabled = new CSmartHiveSplitDisabled();
 
-    init = true;
-}
-
-const CSmartHiveSplit * GetHiveSplit(int nHeight, int64_t blockTime)
-{
-
     if( MainNet() ){
-
-        if ( nHeight > 1 && nHeight < HF_V1_0_START_HEIGHT ) {
-            return hiveSplitInitial;
-        }else if ( nHeight >= HF_V1_0_START_HEIGHT && nHeight < HF_V1_1_SMARTNODE_HEIGHT ) {
+        vecHiveSchedule = {
+            {INT_MIN, hiveSplitDisabled},
+            {2, hiveSplitInitial},
+            {HF_V1_0_START_HEIGHT, hiveSplit_1_0},
             // We have a lot blocks with missing hive payments in this range. Just accept them.
-            if( nHeight >= 227898 && nHeight <= 259345) return hiveSplitDisabled;
+            {227898, hiveSplitDisabled},
             // Out of this range use the v1.0 split.
-            return hiveSplit_1_0;
-        }else if ( nHeight >= HF_V1_1_SMARTNODE_HEIGHT && nHeight < HF_V1_2_START_HEIGHT ) {
-            return hiveSplit_1_1;
-        }else if ( (nHeight >= HF_V1_2_START_HEIGHT) && nHeight < HF_CHAIN_REWARD_END_HEIGHT ) {
-            return hiveSplit_1_2;
-        }else if(nHeight <= 1 || nHeight >= HF_CHAIN_REWARD_END_HEIGHT){
-            return hiveSplitDisabled;
-        }
-
+            {259346, hiveSplit_1_0},
+            {HF_V1_1_SMARTNODE_HEIGHT, hiveSplit_1_1},
+            {HF_V1_2_START_HEIGHT, hiveSplit_1_2},
+            {HF_CHAIN_REWARD_END_HEIGHT, hiveSplitDisabled}
+        };
     }else{
+        vecHiveSchedule = {
+            {INT_MIN, hiveSplit_1_1},
+            {TESTNET_V1_2_PAYMENTS_HEIGHT + 1, hiveSplit_1_2},
+            {HF_CHAIN_REWARD_END_HEIGHT, hiveSplitDisabled}
+        };
+    }
 
-        if ( nHeight <= TESTNET_V1_2_PAYMENTS_HEIGHT ) {
-            return hiveSplit_1_1;
-        }else if ( nHeight > TESTNET_V1_2_PAYMENTS_HEIGHT && nHeight < HF_CHAIN_REWARD_END_HEIGHT ) {
-            return hiveSplit_1_2;
-        }else if(nHeight >= HF_CHAIN_REWARD_END_HEIGHT){
-            return hiveSplitDisabled;
-        }
+    init = true;
+}
 
-    }
+const CSmartHiveSplit * GetHiveSplit(int nHeight, int64_t blockTime)
+{
+    auto it = std::upper_bound(vecHiveSchedule.begin(), vecHiveSchedule.end(), nHeight,
+                               [](int nHeight, const CSmartHiveSplitRange &range) { return nHeight < range.nStartHeight; });
+
+    // Only before Init.
+    if( it == vecHiveSchedule.begin() ) return nullptr;
 
-    return nullptr;
+    return (--it)->split;
 }
 
-SmartHivePayments::Result SmartHivePayments::Validate(const CTransaction& txCoinbase, int nHeight, int64_t blockTime, CAmount& hiveReward)
+SmartHivePayments::Result SmartHivePayments::Validate(const CCoinbaseIndex& coinbase, int nHeight, int64_t blockTime, CAmount& hiveReward)
 {
 
     CAmount blockReward = GetBlockValue(nHeight, 0, blockTime);
@@ -125,7 +135,7 @@ SmartHivePayments::Result SmartHivePayments::Validate(const CTransaction& txCoin
     // If we got an invalid height. Should not happen.
     if( ptrHiveSplit == nullptr ) return SmartHivePayments::InvalidBlockHeight;
     // If there is no hive payment in the coinbase.
-    if( !ptrHiveSplit->Valididate(txCoinbase.vout,nHeight,blockReward, hiveReward)) return SmartHivePayments::HiveAddressMissing;
+    if( !ptrHiveSplit->Valididate(coinbase,nHeight,blockReward, hiveReward)) return SmartHivePayments::HiveAddressMissing;
 
     // There we go! Correct hive payments found..
     return SmartHivePayments::Valid;
@@ -141,45 +151,59 @@ void SmartHivePayments::FillPayments(CMutableTransaction& txNew, int nHeight, in
 
 }
 
-bool CSmartHiveClassicSplit::Valididate(const std::vector<CTxOut> &outputs, int nHeight, CAmount blockReward, CAmount& hiveReward) const
+bool CSmartHiveSplit::Valididate(const CCoinbaseIndex &coinbase, int nHeight, CAmount blockReward, CAmount& hiveReward) const
 {
+    std::vector<CSmartHivePayment> payments;
+    GetPayments(nHeight, blockReward, payments);
+
     size_t found = 0;
 
     hiveReward = 0;
 
-    BOOST_FOREACH(const CTxOut& output, outputs){
-    BOOST_FOREACH(CSmartHiveRewardBase *hive, hives){
+    // Each output can only match the payment with its script.
+    BOOST_FOREACH(const CSmartHivePayment& payment, payments){
 
-            if( hive->GetScript() != output.scriptPubKey ) continue;
-            if( abs( output.nValue - ( blockReward * hive->GetRatio() ) ) >= 2) continue;
+        auto range = coinbase.Find(*payment.script);
+
+        for( auto it = range.first; it != range.second; ++it ){
+
+            const CTxOut& output = coinbase.GetOutput(*it);
+
+            if( abs( output.nValue - payment.amount ) >= 2) continue;
 
             hiveReward += output.nValue;
 
             // We found a valid hive payment here!
             ++found;
-            break; // Break the inner loop.
-    }}
+        }
+    }
 
-    return hives.size() == found;
+    return payments.size() == found;
 }
 
-void CSmartHiveClassicSplit::FillPayment(std::vector<CTxOut> &outputs, int nHeight, CAmount blockReward, std::vector<CTxOut>& voutSmartHives) const
+void CSmartHiveSplit::FillPayment(std::vector<CTxOut> &outputs, int nHeight, CAmount blockReward, std::vector<CTxOut>& voutSmartHives) const
 {
-    CSmartHiveSplit::FillPayment(outputs,nHeight,blockReward,voutSmartHives);
+    std::vector<CSmartHivePayment> payments;
+    GetPayments(nHeight, blockReward, payments);
 
-    CAmount calcReward;
+    voutSmartHives.clear();
 
-    BOOST_FOREACH(CSmartHiveRewardBase *hive, hives){
-        calcReward = (CAmount)(blockReward * hive->GetRatio());
-        voutSmartHives.push_back(CTxOut(calcReward, hive->GetScript()));
-        outputs.push_back(CTxOut(calcReward, hive->GetScript()));
+    BOOST_FOREACH(const CSmartHivePayment& payment, payments){
+        CTxOut out = CTxOut((CAmount)payment.amount, *payment.script);
+        outputs.push_back(out);
+        voutSmartHives.push_back(out);
     }
 }
 
-void CSmartHiveRotationSplit::FillPayment(std::vector<CTxOut> &outputs, int nHeight, CAmount blockReward, std::vector<CTxOut>& voutSmartHives) const
+void CSmartHiveClassicSplit::GetPayments(int nHeight, CAmount blockReward, std::vector<CSmartHivePayment> &payments) const
 {
-    CSmartHiveSplit::FillPayment(outputs,nHeight,blockReward,voutSmartHives);
+    BOOST_FOREACH(CSmartHiveRewardBase *hive, hives){
+        payments.push_back(CSmartHivePayment(hive->GetScript(), blockReward * hive->GetRatio()));
+    }
+}
 
+void CSmartHiveRotationSplit::GetPayments(int nHeight, CAmount blockReward, std::vector<CSmartHivePayment> &payments) const
+{
     int rotation = nHeight - allocation * (nHeight/allocation);
 
     CSmartHiveRotation * ptrHive;
@@ -190,95 +214,66 @@ void CSmartHiveRotationSplit::FillPayment(std::vector<CTxOut> &outputs, int nHei
 
         if( rotation < ptrHive->start || rotation > ptrHive->end) continue;
 
-        // We found a valid hive payment here!
-        CAmount hiveReward = (CAmount)(blockReward * percent);
-        CTxOut out = CTxOut(hiveReward, ptrHive->GetScript());
-        outputs.push_back(out);
-        voutSmartHives.push_back(out);
+        payments.push_back(CSmartHivePayment(ptrHive->GetScript(), (CAmount)(blockReward * percent)));
         return;
     }
 }
 
-bool CSmartHiveRotationSplit::Valididate(const std::vector<CTxOut> &outputs, int nHeight, CAmount blockReward, CAmount& hiveReward) const
+// The hive in turn only needs one valid output.
+bool CSmartHiveRotationSplit::Valididate(const CCoinbaseIndex &coinbase, int nHeight, CAmount blockReward, CAmount& hiveReward) const
 {
     // We have no more hive payouts in fee only mode.
     if( !hives.size() ) return true;
 
-    CAmount expected = blockReward * percent;
-    int rotation = nHeight - allocation * (nHeight/allocation);
+    std::vector<CSmartHivePayment> payments;
+    GetPayments(nHeight, blockReward, payments);
 
-    CSmartHiveRotation * ptrHive;
+    BOOST_FOREACH(const CSmartHivePayment& payment, payments){
 
-    BOOST_FOREACH(CSmartHiveRewardBase *hive, hives){
-    BOOST_FOREACH(const CTxOut& output, outputs){
+        auto range = coinbase.Find(*payment.script);
+        const CTxOut* pFirst = nullptr;
+        uint32_t nFirst = 0;
 
-        ptrHive = static_cast<CSmartHiveRotation*> (hive);
+        // Use the first valid output of the transaction.
+        for( auto it = range.first; it != range.second; ++it ){
 
-        if( rotation < ptrHive->start || rotation > ptrHive->end) continue;
-        if( ptrHive->GetScript() != output.scriptPubKey ) continue;
-        if( abs( output.nValue - expected ) >= 2) continue;
+            const CTxOut& output = coinbase.GetOutput(*it);
+
+            if( abs( output.nValue - (CAmount)payment.amount ) >= 2) continue;
+
+            if( !pFirst || *it < nFirst ){
+                pFirst = &output;
+                nFirst = *it;
+            }
+        }
 
-        hiveReward = output.nValue;
+        if( pFirst ){
+            hiveReward = pFirst->nValue;
 
-        // We found a valid hive payment here!
-        return true;
-    }}
+            // We found a valid hive payment here!
+            return true;
+        }
+    }
 
     return false;
 }
 
 CAmount CSmartHiveBatchSplit::GetBatchReward(int nHeight) const
 {
-    CAmount reward = 0;
-    int block = nHeight - trigger - 1;
-    while (++block < nHeight) {
-        reward += GetBlockValue(block, 0, INT_MAX);
-    }
-
-    return reward;
+    // All blocks since the last payout.
+    return GetBlockValueRange(nHeight - trigger, nHeight - 1);
 }
 
-void CSmartHiveBatchSplit::FillPayment(std::vector<CTxOut> &outputs, int nHeight, CAmount blockReward, std::vector<CTxOut> &voutSmartHives) const
+void CSmartHiveBatchSplit::GetPayments(int nHeight, CAmount blockReward, std::vector<CSmartHivePayment> &payments) const
 {
     // Only add the payouts each "trigger" blocks
     if( (nHeight % trigger) ) return;
 
     CAmount batchReward = GetBatchReward(nHeight);
 
-    BOOST_FOREACH(CSmartHiveRewardBase *hive, hives)
-    {
-        CAmount hiveReward = (CAmount)(batchReward * hive->GetRatio() );
-        CTxOut out = CTxOut(hiveReward, hive->GetScript());
-        outputs.push_back(out);
-        voutSmartHives.push_back(out);
-    }
-
-}
-
-bool CSmartHiveBatchSplit::Valididate(const std::vector<CTxOut> &outputs, int nHeight, CAmount blockReward, CAmount& hiveReward) const
-{
-    hiveReward = 0;
-
-    // Only validate the payouts each "trigger" blocks
-    if( (nHeight % trigger) ) return true;
-
-    size_t found = 0;
-    CAmount batchReward = GetBatchReward(nHeight);
-
     BOOST_FOREACH(CSmartHiveRewardBase *hive, hives){
-    BOOST_FOREACH(const CTxOut& output, outputs){
-
-            if( hive->GetScript() != output.scriptPubKey ) continue;
-            if( abs( output.nValue - ( batchReward * hive->GetRatio() ) ) >= 2) continue;
-
-            hiveReward += output.nValue;
-
-            // We found a valid hive payment here!
-            ++found;
-            break; // Break the inner loop.
-    }}
-
-    return hives.size() == found;
+        payments.push_back(CSmartHivePayment(hive->GetScript(), batchReward * hive->GetRatio()));
+    }
 }
 
 int SmartHivePayments::RejectionCode(SmartHivePayments::Result result)
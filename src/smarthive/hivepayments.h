@@ -6,8 +6,11 @@
 #define HIVEPAYMENTS_H
 
 #include "smarthive/hive.h"
+#include "smartmining/coinbaseindex.h"
 #include "chain.h"
 
+#include <set>
+
 namespace SmartHivePayments{
 
 typedef enum{
@@ -19,7 +22,7 @@ typedef enum{
 
 void Init();
 
-SmartHivePayments::Result Validate(const CTransaction& txCoinbase, int nHeight, int64_t blockTime, CAmount& hiveReward);
+SmartHivePayments::Result Validate(const CCoinbaseIndex& coinbase, int nHeight, int64_t blockTime, CAmount& hiveReward);
 void FillPayments(CMutableTransaction& txNew, int nHeight, int64_t blockTime, CAmount blockReward, std::vector<CTxOut>& voutSmartHives);
 
 int RejectionCode(SmartHivePayments::Result result);
@@ -62,22 +65,36 @@ public:
 };
 
 
+/** Hive output a coinbase has to contain, the paid amount may be off by less than 2. */
+struct CSmartHivePayment
+{
+    const CScript *script;
+    double amount;
+    CSmartHivePayment(const CScript &script, double amount) : script(&script), amount(amount) {}
+};
+
 struct CSmartHiveSplit
 {
     std::vector<CSmartHiveRewardBase*> hives;
     int allocation;
     double percent;
 
-    virtual bool Valididate(const std::vector<CTxOut> &outputs, int nHeight, CAmount blockReward, CAmount& hiveReward) const = 0;
-    virtual void FillPayment(std::vector<CTxOut> &outputs, int nHeight, CAmount blockReward, std::vector<CTxOut>& voutSmartHives) const {voutSmartHives.clear();}
+    //! Hive outputs expected in the coinbase of the block at nHeight.
+    virtual void GetPayments(int nHeight, CAmount blockReward, std::vector<CSmartHivePayment> &payments) const = 0;
+    //! True if all expected payments are in the coinbase. Hives of a split have different scripts.
+    virtual bool Valididate(const CCoinbaseIndex &coinbase, int nHeight, CAmount blockReward, CAmount& hiveReward) const;
+    void FillPayment(std::vector<CTxOut> &outputs, int nHeight, CAmount blockReward, std::vector<CTxOut>& voutSmartHives) const;
     CSmartHiveSplit() : hives(), allocation(0) {}
     CSmartHiveSplit(int allocation, std::vector<CSmartHiveRewardBase*> hives) : hives(hives), allocation(allocation) {
         percent = allocation / 100.0;
 
         double ratioCheck = 0;
+        std::set<SmartHive::Payee> payees;
         BOOST_FOREACH(CSmartHiveRewardBase *hive, hives)
         {
             ratioCheck += hive->GetRatio();
+            // The validation counts the outputs per hive script.
+            if( !payees.insert(hive->payee).second ) throw std::runtime_error("Duplicated hive in allocation!");
         }
 
         if( abs(percent - ratioCheck) > 0.00001 ) throw std::runtime_error(strprintf("Invalid hive allocation! %f <> %f",percent, ratioCheck));
@@ -86,16 +103,15 @@ struct CSmartHiveSplit
 
 struct CSmartHiveClassicSplit : public CSmartHiveSplit
 {
-    bool Valididate(const std::vector<CTxOut> &outputs, int nHeight, CAmount blockReward, CAmount& hiveReward) const final;
-    void FillPayment(std::vector<CTxOut> &outputs, int nHeight, CAmount blockReward, std::vector<CTxOut>& voutSmartHives) const final;
+    void GetPayments(int nHeight, CAmount blockReward, std::vector<CSmartHivePayment> &payments) const final;
     CSmartHiveClassicSplit() : CSmartHiveSplit() {}
     CSmartHiveClassicSplit(int allocation, std::vector<CSmartHiveRewardBase*> hives) : CSmartHiveSplit(allocation, hives) {}
 };
 
 struct CSmartHiveRotationSplit : public CSmartHiveSplit
 {
-    bool Valididate(const std::vector<CTxOut> &outputs, int nHeight, CAmount blockReward, CAmount& hiveReward) const final;
-    void FillPayment(std::vector<CTxOut> &outputs, int nHeight, CAmount blockReward, std::vector<CTxOut>& voutSmartHives) const final;
+    void GetPayments(int nHeight, CAmount blockReward, std::vector<CSmartHivePayment> &payments) const final;
+    bool Valididate(const CCoinbaseIndex &coinbase, int nHeight, CAmount blockReward, CAmount& hiveReward) const final;
     CSmartHiveRotationSplit() : CSmartHiveSplit() {}
     CSmartHiveRotationSplit(int allocation, std::vector<CSmartHiveRewardBase*> hives) : CSmartHiveSplit(allocation, hives) {}
 };
@@ -103,8 +119,7 @@ struct CSmartHiveRotationSplit : public CSmartHiveSplit
 struct CSmartHiveBatchSplit : public CSmartHiveSplit
 {
     int trigger;
-    bool Valididate(const std::vector<CTxOut> &outputs, int nHeight, CAmount blockReward, CAmount& hiveReward) const final;
-    void FillPayment(std::vector<CTxOut> &outputs, int nHeight, CAmount blockReward, std::vector<CTxOut>& voutSmartHives) const final;
+    void GetPayments(int nHeight, CAmount blockReward, std::vector<CSmartHivePayment> &payments) const final;
     CAmount GetBatchReward(int nHeight) const;
     CSmartHiveBatchSplit() : CSmartHiveSplit() {}
     CSmartHiveBatchSplit(int allocation, int trigger, std::vector<CSmartHiveRewardBase*> hives) : CSmartHiveSplit(allocation, hives), trigger(trigger) {}
@@ -112,8 +127,7 @@ struct CSmartHiveBatchSplit : public CSmartHiveSplit
 
 struct CSmartHiveSplitDisabled : public CSmartHiveSplit
 {
-    bool Valididate(const std::vector<CTxOut> &outputs, int nHeight, CAmount blockReward, CAmount& hiveReward) const final {hiveReward = 0; return true;}
-    void FillPayment(std::vector<CTxOut> &outputs, int nHeight, CAmount blockReward, std::vector<CTxOut>& voutSmartHives) const final {voutSmartHives.clear();}
+    void GetPayments(int nHeight, CAmount blockReward, std::vector<CSmartHivePayment> &payments) const final {}
     CSmartHiveSplitDisabled() : CSmartHiveSplit() {}
 };
 
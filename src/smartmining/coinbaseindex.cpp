@@ -0,0 +1,45 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "smartmining/coinbaseindex.h"
+
+#include <algorithm>
+
+CCoinbaseIndex::CCoinbaseIndex(const CTransaction &tx) : tx(tx)
+{
+    vSorted.resize(tx.vout.size());
+
+    for( uint32_t n = 0; n < vSorted.size(); ++n ) vSorted[n] = n;
+
+    std::sort(vSorted.begin(), vSorted.end(), [&tx](uint32_t a, uint32_t b) {
+        const CTxOut &outA = tx.vout[a], &outB = tx.vout[b];
+        if( outA.scriptPubKey != outB.scriptPubKey ) return outA.scriptPubKey < outB.scriptPubKey;
+        if( outA.nValue != outB.nValue ) return outA.nValue < outB.nValue;
+        return a < b;
+    });
+}
+
+std::pair<CCoinbaseIndex::const_iterator, CCoinbaseIndex::const_iterator> CCoinbaseIndex::Find(const CScript &script) const
+{
+    const_iterator itLower = std::lower_bound(vSorted.begin(), vSorted.end(), script, [this](uint32_t n, const CScript &s) {
+        return tx.vout[n].scriptPubKey < s;
+    });
+
+    const_iterator itUpper = std::upper_bound(itLower, vSorted.end(), script, [this](const CScript &s, uint32_t n) {
+        return s < tx.vout[n].scriptPubKey;
+    });
+
+    return std::make_pair(itLower, itUpper);
+}
+
+bool CCoinbaseIndex::Contains(const CScript &script, CAmount nValue) const
+{
+    std::pair<const_iterator, const_iterator> range = Find(script);
+
+    const_iterator it = std::lower_bound(range.first, range.second, nValue, [this](uint32_t n, CAmount nValue) {
+        return tx.vout[n].nValue < nValue;
+    });
+
+    return it != range.second && tx.vout[*it].nValue == nValue;
+}
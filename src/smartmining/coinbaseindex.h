@@ -0,0 +1,43 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef COINBASEINDEX_H
+#define COINBASEINDEX_H
+
+#include "amount.h"
+#include "primitives/transaction.h"
+
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+/** Outputs of a coinbase transaction sorted by script and value.
+ *
+ *  Built once per block and handed to the hive, smartnode and SmartRewards
+ *  payment checks, so each expected payment is a binary search instead of a
+ *  scan over all outputs. The transaction must outlive the index.
+ */
+class CCoinbaseIndex
+{
+public:
+    typedef std::vector<uint32_t>::const_iterator const_iterator;
+
+private:
+    const CTransaction &tx;
+    // Positions in tx.vout
+    std::vector<uint32_t> vSorted;
+
+public:
+    explicit CCoinbaseIndex(const CTransaction &tx);
+
+    const CTransaction &GetTransaction() const { return tx; }
+    const CTxOut &GetOutput(uint32_t n) const { return tx.vout[n]; }
+
+    //! Positions of all outputs paying to script, lowest value first.
+    std::pair<const_iterator, const_iterator> Find(const CScript &script) const;
+    //! True if an output pays exactly nValue to script.
+    bool Contains(const CScript &script, CAmount nValue) const;
+};
+
+#endif // COINBASEINDEX_H
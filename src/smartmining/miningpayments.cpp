@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "smartmining/miningpayments.h"
+#include "smartmining/coinbaseindex.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
 
@@ -24,37 +25,44 @@ void SmartMining::FillPayment(CMutableTransaction& coinbaseTx, int nHeight, CBlo
     coinbaseTx.vout[0].nValue = GetMiningReward(pindexPrev, blockReward);
 }
 
+// All payment checks run on the same index of the coinbase outputs. Every
+// mismatch gets logged before the block is rejected for the first one.
 bool SmartMining::Validate(const CBlock &block, CBlockIndex *pindex, CValidationState& state, CAmount nFees)
 {
     const CChainParams& chainparams = Params();
-    CAmount coinbase = block.vtx[0].GetValueOut();
+    const CTransaction& txCoinbase = block.vtx[0];
+    CCoinbaseIndex coinbase(txCoinbase);
+    CAmount coinbaseValue = txCoinbase.GetValueOut();
     CAmount blockReward = GetBlockSubsidy(pindex->nHeight, chainparams.GetConsensus());
     CAmount miningReward = GetMiningReward(pindex, blockReward);
     CAmount hiveReward = 0, nodeReward = 0, smartReward = 0;
+    bool fValid = true;
 
-    SmartHivePayments::Result result = SmartHivePayments::Validate(block.vtx[0],pindex->nHeight, pindex->GetBlockTime(), hiveReward);
-    if( result != SmartHivePayments::Valid ){
-        LogPrintf("SmartMining::Validate - Invalid hive payment %s\n", block.vtx[0].ToString());
-        return state.DoS(100, false, SmartHivePayments::RejectionCode(result),
-                                     SmartHivePayments::RejectionMessage(result));
+    SmartHivePayments::Result hiveResult = SmartHivePayments::Validate(coinbase, pindex->nHeight, pindex->GetBlockTime(), hiveReward);
+    if( hiveResult != SmartHivePayments::Valid ){
+        LogPrintf("SmartMining::Validate - Invalid hive payment %s\n", txCoinbase.ToString());
+        fValid = state.DoS(100, false, SmartHivePayments::RejectionCode(hiveResult),
+                                       SmartHivePayments::RejectionMessage(hiveResult));
     }
 
-    if (!SmartNodePayments::IsPaymentValid(block.vtx[0], pindex->nHeight, blockReward, nodeReward)) {
-        LogPrintf("SmartMining::Validate - Invalid node payment %s\n", block.vtx[0].ToString());
-        return state.DoS(0, error("ConnectBlock(SMARTCASH): couldn't find smartnode payments"),
-                                REJECT_INVALID, "bad-cb-payee");
+    if (!SmartNodePayments::IsPaymentValid(coinbase, pindex->nHeight, blockReward, nodeReward)) {
+        LogPrintf("SmartMining::Validate - Invalid node payment %s\n", txCoinbase.ToString());
+        if( fValid ) fValid = state.DoS(0, error("ConnectBlock(SMARTCASH): couldn't find smartnode payments"),
+                                           REJECT_INVALID, "bad-cb-payee");
     }
 
-    if( SmartRewardPayments::Validate(block,pindex->nHeight, smartReward) != SmartRewardPayments::Valid ){
-         LogPrintf("SmartMining::Validate - Invalid smartreward payment %s\n", block.vtx[0].ToString());
-        return state.DoS(100, false, REJECT_INVALID_SMARTREWARD_PAYMENTS,
-                     "CTransaction::CheckTransaction() : SmartReward payment list is invalid");
+    if( SmartRewardPayments::Validate(coinbase, pindex->nHeight, block.GetBlockTime(), smartReward) != SmartRewardPayments::Valid ){
+        LogPrintf("SmartMining::Validate - Invalid smartreward payment %s\n", txCoinbase.ToString());
+        if( fValid ) fValid = state.DoS(100, false, REJECT_INVALID_SMARTREWARD_PAYMENTS,
+                                           "CTransaction::CheckTransaction() : SmartReward payment list is invalid");
     }
 
+    if( !fValid ) return false;
+
     if( ( MainNet() && pindex->nHeight >= HF_V1_2_START_VALIDATION_HEIGHT && pindex->nHeight <= HF_CHAIN_REWARD_END_HEIGHT ) ||
         ( TestNet() )){
-        if( coinbase > (nFees + nodeReward + hiveReward + smartReward + miningReward) ){
-             LogPrintf("SmartMining::Validate - Coinbase too high! %s\n", block.vtx[0].ToString());
+        if( coinbaseValue > (nFees + nodeReward + hiveReward + smartReward + miningReward) ){
+             LogPrintf("SmartMining::Validate - Coinbase too high! %s\n", txCoinbase.ToString());
             return state.DoS(100, false, REJECT_INVALID,
                          "CTransaction::CheckTransaction() : Coinbase value too high");
         }
@@ -7,8 +7,10 @@
 
 #include "chainparams.h"
 #include "clientversion.h"
+#include "crypto/sha256.h"
 #include "hash.h"
 #include "streams.h"
+#include "sync.h"
 #include "util.h"
 
 #include <boost/filesystem.hpp>
@@ -16,8 +18,18 @@
 /** 
 *   Generic Dumping and Loading
 *   ---------------------------
+*
+*   Files start with FLATDB_FILE_MAGIC and the format version, followed by the
+*   header section (magic message, network magic, size of the data section) and
+*   its SHA256. The data section holds the serialized object followed by its own
+*   SHA256, so a file can be recognized without hashing the data. Files written
+*   before the format was versioned start with the magic message instead and are
+*   still read.
 */
 
+static const unsigned char FLATDB_FILE_MAGIC[4] = {'S', 'F', 'D', 'B'};
+static const uint32_t FLATDB_VERSION = 1;
+
 template<typename T>
 class CFlatDB
 {
@@ -37,55 +49,123 @@ private:
     std::string strFilename;
     std::string strMagicMessage;
 
+    static uint256 Checksum(const CDataStream& ss)
+    {
+        uint256 hash;
+        CSHA256().Write((const unsigned char*)ss.data(), ss.size()).Finalize(hash.begin());
+        return hash;
+    }
+
     bool Write(const T& objToSave)
     {
-        // LOCK(objToSave.cs);
+        // periodic and shutdown dumps must not write the temporary file at the same time
+        static CCriticalSection cs_write;
+        LOCK(cs_write);
 
         int64_t nStart = GetTimeMillis();
 
-        // serialize, checksum data up to that point, then append checksum
         CDataStream ssObj(SER_DISK, CLIENT_VERSION);
-        ssObj << strMagicMessage; // specific magic message for this type of object
-        ssObj << FLATDATA(Params().MessageStart()); // network specific magic number
         ssObj << objToSave;
-        uint256 hash = Hash(ssObj.begin(), ssObj.end());
-        ssObj << hash;
 
-        // open output file, and associate with CAutoFile
-        FILE *file = fopen(pathDB.string().c_str(), "wb");
+        CDataStream ssHeader(SER_DISK, CLIENT_VERSION);
+        ssHeader << FLATDATA(FLATDB_FILE_MAGIC) << FLATDB_VERSION;
+        ssHeader << strMagicMessage; // specific magic message for this type of object
+        ssHeader << FLATDATA(Params().MessageStart()); // network specific magic number
+        ssHeader << (uint64_t)ssObj.size();
+        ssHeader << Checksum(ssHeader);
+
+        // write everything to a temporary file first so a crash never leaves a partial file behind
+        boost::filesystem::path pathTmp = pathDB;
+        pathTmp += ".new";
+
+        FILE *file = fopen(pathTmp.string().c_str(), "wb");
         CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
         if (fileout.IsNull())
-            return error("%s: Failed to open file %s", __func__, pathDB.string());
+            return error("%s: Failed to open file %s", __func__, pathTmp.string());
 
-        // Write and commit header, data
         try {
-            fileout << ssObj;
+            fileout.write(ssHeader.data(), ssHeader.size());
+            fileout.write(ssObj.data(), ssObj.size());
+            fileout << Checksum(ssObj);
         }
         catch (std::exception &e) {
             return error("%s: Serialize or I/O error - %s", __func__, e.what());
         }
+        FileCommit(fileout.Get());
         fileout.fclose();
 
+        if (!RenameOver(pathTmp, pathDB))
+            return error("%s: Failed to rename %s", __func__, pathTmp.string());
+
         LogPrintf("Written info to %s  %dms\n", strFilename, GetTimeMillis() - nStart);
         LogPrintf("     %s\n", objToSave.ToString());
 
         return true;
     }
 
-    ReadResult Read(T& objToLoad, bool fDryRun = false)
+    /// Read and check the header of filein, fLegacyRet is set for files without FLATDB_FILE_MAGIC
+    ReadResult ReadHeader(CAutoFile& filein, bool& fLegacyRet, uint64_t& nDataSizeRet)
     {
-        //LOCK(objToLoad.cs);
+        unsigned char pchFileMagic[4];
+        uint32_t nVersion = 0;
+        std::string strMagicMessageTmp;
+        unsigned char pchMsgTmp[4];
+        uint256 hashIn;
 
-        int64_t nStart = GetTimeMillis();
-        // open input file, and associate with CAutoFile
-        FILE *file = fopen(pathDB.string().c_str(), "rb");
-        CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
-        if (filein.IsNull())
+        try {
+            filein >> FLATDATA(pchFileMagic);
+            fLegacyRet = memcmp(pchFileMagic, FLATDB_FILE_MAGIC, sizeof(pchFileMagic)) != 0;
+
+            if (fLegacyRet) {
+                // files of the legacy format start with the magic message right away
+                rewind(filein.Get());
+                filein >> strMagicMessageTmp;
+                filein >> FLATDATA(pchMsgTmp);
+            } else {
+                filein >> nVersion >> strMagicMessageTmp >> FLATDATA(pchMsgTmp) >> nDataSizeRet >> hashIn;
+            }
+        }
+        catch (std::exception &e) {
+            error("%s: Deserialize or I/O error - %s", __func__, e.what());
+            return HashReadError;
+        }
+
+        if (!fLegacyRet) {
+            CDataStream ssHeader(SER_DISK, CLIENT_VERSION);
+            ssHeader << FLATDATA(pchFileMagic) << nVersion << strMagicMessageTmp << FLATDATA(pchMsgTmp) << nDataSizeRet;
+            if (hashIn != Checksum(ssHeader))
+            {
+                error("%s: Header checksum mismatch, data corrupted", __func__);
+                return IncorrectHash;
+            }
+        }
+
+        // verify the message matches predefined one
+        if (strMagicMessage != strMagicMessageTmp)
         {
-            error("%s: Failed to open file %s", __func__, pathDB.string());
-            return FileError;
+            error("%s: Invalid magic message", __func__);
+            return IncorrectMagicMessage;
         }
 
+        // verify the network matches ours
+        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp)))
+        {
+            error("%s: Invalid network magic number", __func__);
+            return IncorrectMagicNumber;
+        }
+
+        if (!fLegacyRet && nVersion != FLATDB_VERSION)
+        {
+            error("%s: Unknown format version %d", __func__, nVersion);
+            return IncorrectFormat;
+        }
+
+        return Ok;
+    }
+
+    /// Read the data section of a legacy file, its checksum is a double SHA256 over header and data
+    ReadResult ReadLegacyData(CAutoFile& filein, CDataStream& ssObj)
+    {
         // use file size to size memory buffer
         int fileSize = boost::filesystem::file_size(pathDB);
         int dataSize = fileSize - sizeof(uint256);
@@ -98,6 +178,7 @@ private:
 
         // read data and checksum from file
         try {
+            rewind(filein.Get());
             filein.read((char *)&vchData[0], dataSize);
             filein >> hashIn;
         }
@@ -105,43 +186,78 @@ private:
             error("%s: Deserialize or I/O error - %s", __func__, e.what());
             return HashReadError;
         }
-        filein.fclose();
-
-        CDataStream ssObj(vchData, SER_DISK, CLIENT_VERSION);
 
         // verify stored checksum matches input data
-        uint256 hashTmp = Hash(ssObj.begin(), ssObj.end());
+        uint256 hashTmp = Hash(vchData.begin(), vchData.end());
         if (hashIn != hashTmp)
         {
             error("%s: Checksum mismatch, data corrupted", __func__);
             return IncorrectHash;
         }
 
-
-        unsigned char pchMsgTmp[4];
+        // skip the header, ReadHeader checked it already
         std::string strMagicMessageTmp;
+        unsigned char pchMsgTmp[4];
+        ssObj.write((const char*)vchData.data(), vchData.size());
         try {
-            // de-serialize file header (file specific magic message) and ..
-            ssObj >> strMagicMessageTmp;
+            ssObj >> strMagicMessageTmp >> FLATDATA(pchMsgTmp);
+        }
+        catch (std::exception &e) {
+            error("%s: Deserialize or I/O error - %s", __func__, e.what());
+            return IncorrectFormat;
+        }
 
-            // ... verify the message matches predefined one
-            if (strMagicMessage != strMagicMessageTmp)
-            {
-                error("%s: Invalid magic message", __func__);
-                return IncorrectMagicMessage;
-            }
+        return Ok;
+    }
+
+    ReadResult Read(T& objToLoad)
+    {
+        //LOCK(objToLoad.cs);
+
+        int64_t nStart = GetTimeMillis();
+        // open input file, and associate with CAutoFile
+        FILE *file = fopen(pathDB.string().c_str(), "rb");
+        CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+        {
+            error("%s: Failed to open file %s", __func__, pathDB.string());
+            return FileError;
+        }
 
+        bool fLegacy;
+        uint64_t nDataSize = 0;
+        ReadResult result = ReadHeader(filein, fLegacy, nDataSize);
+        if (result != Ok)
+            return result;
 
-            // de-serialize file header (network specific magic number) and ..
-            ssObj >> FLATDATA(pchMsgTmp);
+        CDataStream ssObj(SER_DISK, CLIENT_VERSION);
+        if (fLegacy) {
+            result = ReadLegacyData(filein, ssObj);
+            if (result != Ok)
+                return result;
+        } else {
+            uint256 hashIn;
+            try {
+                if (nDataSize > boost::filesystem::file_size(pathDB))
+                    throw std::ios_base::failure("data size too large");
+                ssObj.resize(nDataSize);
+                filein.read(ssObj.data(), nDataSize);
+                filein >> hashIn;
+            }
+            catch (std::exception &e) {
+                error("%s: Deserialize or I/O error - %s", __func__, e.what());
+                return HashReadError;
+            }
 
-            // ... verify the network matches ours
-            if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp)))
+            if (hashIn != Checksum(ssObj))
             {
-                error("%s: Invalid network magic number", __func__);
-                return IncorrectMagicNumber;
+                error("%s: Checksum mismatch, data corrupted", __func__);
+                return IncorrectHash;
             }
+        }
+        filein.fclose();
 
+        try {
             // de-serialize data into T object
             ssObj >> objToLoad;
         }
@@ -153,15 +269,26 @@ private:
 
         LogPrintf("Loaded info from %s  %dms\n", strFilename, GetTimeMillis() - nStart);
         LogPrintf("     %s\n", objToLoad.ToString());
-        if(!fDryRun) {
-            LogPrintf("%s: Cleaning....\n", __func__);
-            objToLoad.CheckAndRemove();
-            LogPrintf("     %s\n", objToLoad.ToString());
-        }
+        LogPrintf("%s: Cleaning....\n", __func__);
+        objToLoad.CheckAndRemove();
+        LogPrintf("     %s\n", objToLoad.ToString());
 
         return Ok;
     }
 
+    /// Only looks at the header of an existing file
+    ReadResult Check()
+    {
+        FILE *file = fopen(pathDB.string().c_str(), "rb");
+        CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return FileError;
+
+        bool fLegacy;
+        uint64_t nDataSize = 0;
+        return ReadHeader(filein, fLegacy, nDataSize);
+    }
+
 
 public:
     CFlatDB(std::string strFilenameIn, std::string strMagicMessageIn)
@@ -198,8 +325,7 @@ public:
         int64_t nStart = GetTimeMillis();
 
         LogPrintf("Verifying %s format...\n", strFilename);
-        T tmpObjToLoad;
-        ReadResult readResult = Read(tmpObjToLoad, true);
+        ReadResult readResult = Check();
 
         // there was an error and it was not an error on file opening => do not proceed
         if (readResult == FileError)
@@ -5,6 +5,7 @@
 #include "activesmartnode.h"
 #include "instantx.h"
 #include "../key.h"
+#include "../memusage.h"
 #include "../validation.h"
 #include "smartnodesync.h"
 #include "smartnodeman.h"
@@ -68,11 +69,7 @@ void CInstantSend::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataSt
         // Ignore any InstantSend messages until smartnode list is synced
         if(!smartnodeSync.IsSmartnodeListSynced()) return;
 
-        {
-            LOCK(cs_instantsend);
-            auto ret = mapTxLockVotes.emplace(nVoteHash, vote);
-            if (!ret.second) return;
-        }
+        if (!AddTxLockVote(nVoteHash, vote)) return;
 
         ProcessTxLockVote(pfrom, vote, connman);
 
@@ -92,7 +89,7 @@ bool CInstantSend::ProcessTxLockRequest(const CTxLockRequest& txLockRequest, CCo
 
     // Check to see if we conflict with existing completed lock
     BOOST_FOREACH(const CTxIn& txin, txLockRequest.vin) {
-        std::map<COutPoint, uint256>::iterator it = mapLockedOutpoints.find(txin.prevout);
+        auto it = mapLockedOutpoints.find(txin.prevout);
         if(it != mapLockedOutpoints.end() && it->second != txLockRequest.GetHash()) {
             // Conflicting with complete lock, proceed to see if we should cancel them both
             LogPrintf("CInstantSend::ProcessTxLockRequest -- WARNING: Found conflicting completed Transaction Lock, txid=%s, completed lock txid=%s\n",
@@ -103,7 +100,7 @@ bool CInstantSend::ProcessTxLockRequest(const CTxLockRequest& txLockRequest, CCo
     // Check to see if there are votes for conflicting request,
     // if so - do not fail, just warn user
     BOOST_FOREACH(const CTxIn& txin, txLockRequest.vin) {
-        std::map<COutPoint, std::set<uint256> >::iterator it = mapVotedOutpoints.find(txin.prevout);
+        auto it = mapVotedOutpoints.find(txin.prevout);
         if(it != mapVotedOutpoints.end()) {
             BOOST_FOREACH(const uint256& hash, it->second) {
                 if(hash != txLockRequest.GetHash()) {
@@ -125,8 +122,8 @@ bool CInstantSend::ProcessTxLockRequest(const CTxLockRequest& txLockRequest, CCo
     // Masternodes will sometimes propagate votes before the transaction is known to the client.
     // If this just happened - process orphan votes, lock inputs, resolve conflicting locks,
     // update transaction status forcing external script/zmq notifications.
-    ProcessOrphanTxLockVotes();
-    std::map<uint256, CTxLockCandidate>::iterator itLockCandidate = mapTxLockCandidates.find(txHash);
+    ProcessOrphanTxLockVotes(txHash);
+    auto itLockCandidate = mapTxLockCandidates.find(txHash);
     TryToFinalizeLockCandidate(itLockCandidate->second);
 
     return true;
@@ -140,7 +137,11 @@ bool CInstantSend::CreateTxLockCandidate(const CTxLockRequest& txLockRequest)
 
     uint256 txHash = txLockRequest.GetHash();
 
-    std::map<uint256, CTxLockCandidate>::iterator itLockCandidate = mapTxLockCandidates.find(txHash);
+    // AcceptToMemoryPool checks the request again right after us under the same cs_main hold
+    txHashLastValidated = txHash;
+    pindexLastValidated = chainActive.Tip();
+
+    auto itLockCandidate = mapTxLockCandidates.find(txHash);
     if(itLockCandidate == mapTxLockCandidates.end()) {
         LogPrintf("CInstantSend::CreateTxLockCandidate -- new, txid=%s\n", txHash.ToString());
 
@@ -179,6 +180,15 @@ void CInstantSend::CreateEmptyTxLockCandidate(const uint256& txHash)
     mapTxLockCandidates.insert(std::make_pair(txHash, CTxLockCandidate(txLockRequest)));
 }
 
+void CInstantSend::SetTxLockCandidateConfirmedHeight(CTxLockCandidate& txLockCandidate, int nConfirmedHeight)
+{
+    AssertLockHeld(cs_instantsend);
+    if(txLockCandidate.GetConfirmedHeight() == nConfirmedHeight) return;
+    txLockCandidate.SetConfirmedHeight(nConfirmedHeight);
+    if(nConfirmedHeight != -1)
+        mapTxLockCandidatesByHeight.insert(std::make_pair(nConfirmedHeight, txLockCandidate.GetHash()));
+}
+
 void CInstantSend::Vote(const uint256& txHash, CConnman& connman)
 {
     AssertLockHeld(cs_main);
@@ -241,14 +251,14 @@ void CInstantSend::Vote(CTxLockCandidate& txLockCandidate, CConnman& connman)
 
         LogPrint("instantsend", "CInstantSend::Vote -- In the top %d (%d)\n", nSignaturesTotal, nRank);
 
-        std::map<COutPoint, std::set<uint256> >::iterator itVoted = mapVotedOutpoints.find(itOutpointLock->first);
+        auto itVoted = mapVotedOutpoints.find(itOutpointLock->first);
 
         // Check to see if we already voted for this outpoint,
         // refuse to vote twice or to include the same outpoint in another tx
         bool fAlreadyVoted = false;
         if(itVoted != mapVotedOutpoints.end()) {
             BOOST_FOREACH(const uint256& hash, itVoted->second) {
-                std::map<uint256, CTxLockCandidate>::iterator it2 = mapTxLockCandidates.find(hash);
+                auto it2 = mapTxLockCandidates.find(hash);
                 if(it2->second.HasSmartnodeVoted(itOutpointLock->first, activeSmartnode.outpoint)) {
                     // we already voted for this outpoint to be included either in the same tx or in a competing one,
                     // skip it anyway
@@ -278,8 +288,8 @@ void CInstantSend::Vote(CTxLockCandidate& txLockCandidate, CConnman& connman)
 
         // vote constructed sucessfully, let's store and relay it
         uint256 nVoteHash = vote.GetHash();
-        mapTxLockVotes.insert(std::make_pair(nVoteHash, vote));
-        if(itOutpointLock->second.AddVote(vote)) {
+        AddTxLockVote(nVoteHash, vote);
+        if(txLockCandidate.AddVote(vote)) {
             LogPrintf("CInstantSend::Vote -- Vote created successfully, relaying: txHash=%s, outpoint=%s, vote=%s\n",
                     txHash.ToString(), itOutpointLock->first.ToStringShort(), nVoteHash.ToString());
 
@@ -309,8 +319,7 @@ bool CInstantSend::ProcessTxLockVote(CNode* pfrom, CTxLockVote& vote, CConnman&
     uint256 txHash = vote.GetTxHash();
     uint256 voteHash = vote.GetHash();
 
-    LOCK(cs_main);
-
+    // IsValid takes the locks it needs itself, keep the signature check out of cs_main
     if(!vote.IsValid(pfrom, connman)) {
         // could be because of missing MN
         LogPrint("instantsend", "CInstantSend::ProcessTxLockVote -- Vote is invalid, txid=%s\n", txHash.ToString());
@@ -320,6 +329,7 @@ bool CInstantSend::ProcessTxLockVote(CNode* pfrom, CTxLockVote& vote, CConnman&
     // relay valid vote asap
     vote.Relay(connman);
 
+    LOCK(cs_main);
 #ifdef ENABLE_WALLET
     LOCK(pwalletMain ? &pwalletMain->cs_wallet : NULL);
 #endif
@@ -328,7 +338,7 @@ bool CInstantSend::ProcessTxLockVote(CNode* pfrom, CTxLockVote& vote, CConnman&
     // Smartnodes will sometimes propagate votes before the transaction is known to the client,
     // will actually process only after the lock request itself has arrived
 
-    std::map<uint256, CTxLockCandidate>::iterator it = mapTxLockCandidates.find(txHash);
+    auto it = mapTxLockCandidates.find(txHash);
     if(it == mapTxLockCandidates.end() || !it->second.txLockRequest) {
 
         if(it == mapTxLockCandidates.end()) {
@@ -336,8 +346,8 @@ bool CInstantSend::ProcessTxLockVote(CNode* pfrom, CTxLockVote& vote, CConnman&
             CreateEmptyTxLockCandidate(txHash);
         }
 
-        bool fInserted = mapTxLockVotesOrphan.emplace(voteHash, vote).second;
-                LogPrint("instantsend", "CInstantSend::%s -- Orphan vote: txid=%s  masternode=%s %s\n",
+        bool fInserted = AddOrphanTxLockVote(voteHash, vote);
+        LogPrint("instantsend", "CInstantSend::%s -- Orphan vote: txid=%s  masternode=%s %s\n",
                         __func__, txHash.ToString(), vote.GetSmartnodeOutpoint().ToStringShort(), fInserted ? "new" : "seen");
 
         // This tracks those messages and allows only the same rate as of the rest of the network
@@ -400,7 +410,7 @@ bool CInstantSend::ProcessOrphanTxLockVote(const CTxLockVote& vote)
     uint256 txHash = vote.GetTxHash();
 
     // We shouldn't process orphan votes without a valid tx lock candidate
-    std::map<uint256, CTxLockCandidate>::iterator it = mapTxLockCandidates.find(txHash);
+    auto it = mapTxLockCandidates.find(txHash);
     if(it == mapTxLockCandidates.end() || !it->second.txLockRequest)
         return false; // this shouldn never happen
 
@@ -434,14 +444,14 @@ void CInstantSend::UpdateVotedOutpoints(const CTxLockVote& vote, CTxLockCandidat
 
     uint256 txHash = vote.GetTxHash();
 
-    std::map<COutPoint, std::set<uint256> >::iterator it1 = mapVotedOutpoints.find(vote.GetOutpoint());
+    auto it1 = mapVotedOutpoints.find(vote.GetOutpoint());
     if(it1 != mapVotedOutpoints.end()) {
         for (const auto& hash : it1->second) {
             if(hash != txHash) {
                 // same outpoint was already voted to be locked by another tx lock request,
                 // let's see if it was the same masternode who voted on this outpoint
                 // for another tx lock request
-                std::map<uint256, CTxLockCandidate>::iterator it2 = mapTxLockCandidates.find(hash);
+                auto it2 = mapTxLockCandidates.find(hash);
                 if(it2 !=mapTxLockCandidates.end() && it2->second.HasSmartnodeVoted(vote.GetOutpoint(), vote.GetSmartnodeOutpoint())) {
                     // yes, it was the same masternode
                     LogPrintf("CInstantSend::%s -- masternode sent conflicting votes! %s\n", __func__, vote.GetSmartnodeOutpoint().ToStringShort());
@@ -465,21 +475,84 @@ void CInstantSend::UpdateVotedOutpoints(const CTxLockVote& vote, CTxLockCandidat
     }
 }
 
-void CInstantSend::ProcessOrphanTxLockVotes()
+void CInstantSend::ProcessOrphanTxLockVotes(const uint256& txHash)
 {
     AssertLockHeld(cs_main);
     AssertLockHeld(cs_instantsend);
 
-    std::map<uint256, CTxLockVote>::iterator it = mapTxLockVotesOrphan.begin();
-    while(it != mapTxLockVotesOrphan.end()) {
-        if(ProcessOrphanTxLockVote(it->second)) {
-            mapTxLockVotesOrphan.erase(it++);
-        } else {
-            ++it;
+    auto itByTx = mapTxLockVotesOrphanByTx.find(txHash);
+    if(itByTx == mapTxLockVotesOrphanByTx.end()) return;
+
+    // copy, processed votes are erased from the index
+    std::set<uint256> setVoteHashes = itByTx->second;
+    for (const auto& voteHash : setVoteHashes) {
+        if(ProcessOrphanTxLockVote(*mapTxLockVotesOrphan.at(voteHash))) {
+            EraseOrphanTxLockVote(voteHash);
         }
     }
 }
 
+// Rough heap usage of an orphan vote: the list node, both index entries and the signature
+static size_t GetOrphanTxLockVoteUsage(const CTxLockVote& vote)
+{
+    return memusage::MallocUsage(sizeof(CTxLockVote) + 2 * sizeof(void*)) +
+            memusage::MallocUsage(sizeof(uint256) + 2 * sizeof(void*)) +
+            memusage::MallocUsage(sizeof(uint256) + 4 * sizeof(void*)) +
+            ::GetSerializeSize(vote, SER_NETWORK, PROTOCOL_VERSION);
+}
+
+bool CInstantSend::AddOrphanTxLockVote(const uint256& voteHash, const CTxLockVote& vote)
+{
+    AssertLockHeld(cs_instantsend);
+
+    auto it = mapTxLockVotesOrphan.find(voteHash);
+    if(it != mapTxLockVotesOrphan.end()) {
+        // seen again, move it to the back of the eviction queue
+        listTxLockVotesOrphan.splice(listTxLockVotesOrphan.end(), listTxLockVotesOrphan, it->second);
+        return false;
+    }
+
+    mapTxLockVotesOrphan.emplace(voteHash, listTxLockVotesOrphan.insert(listTxLockVotesOrphan.end(), vote));
+    mapTxLockVotesOrphanByTx[vote.GetTxHash()].insert(voteHash);
+    nOrphanVotesUsage += GetOrphanTxLockVoteUsage(vote);
+
+    while(nOrphanVotesUsage > INSTANTSEND_MAX_ORPHAN_VOTES_USAGE) {
+        const CTxLockVote& voteOldest = listTxLockVotesOrphan.front();
+        uint256 voteHashOldest = voteOldest.GetHash();
+        LogPrint("instantsend", "CInstantSend::%s -- Evicting orphan vote: txid=%s  smartnode=%s\n",
+                __func__, voteOldest.GetTxHash().ToString(), voteOldest.GetSmartnodeOutpoint().ToStringShort());
+        // forget we saw it too, so it can be accepted again once its lock request is known
+        {
+            CTxLockVoteShard& shard = GetVoteShard(voteHashOldest);
+            LOCK(shard.cs);
+            shard.mapTxLockVotes.erase(voteHashOldest);
+        }
+        EraseOrphanTxLockVote(voteHashOldest);
+        nOrphanVotesEvicted++;
+    }
+
+    return true;
+}
+
+void CInstantSend::EraseOrphanTxLockVote(const uint256& voteHash)
+{
+    AssertLockHeld(cs_instantsend);
+
+    auto it = mapTxLockVotesOrphan.find(voteHash);
+    if(it == mapTxLockVotesOrphan.end()) return;
+
+    const CTxLockVote& vote = *it->second;
+    auto itByTx = mapTxLockVotesOrphanByTx.find(vote.GetTxHash());
+    if(itByTx != mapTxLockVotesOrphanByTx.end()) {
+        itByTx->second.erase(voteHash);
+        if(itByTx->second.empty()) mapTxLockVotesOrphanByTx.erase(itByTx);
+    }
+
+    nOrphanVotesUsage -= GetOrphanTxLockVoteUsage(vote);
+    listTxLockVotesOrphan.erase(it->second);
+    mapTxLockVotesOrphan.erase(it);
+}
+
 void CInstantSend::TryToFinalizeLockCandidate(const CTxLockCandidate& txLockCandidate)
 {
     if(!sporkManager.IsSporkActive(SPORK_2_INSTANTSEND_ENABLED)) return;
@@ -552,7 +625,7 @@ void CInstantSend::LockTransactionInputs(const CTxLockCandidate& txLockCandidate
 bool CInstantSend::GetLockedOutPointTxHash(const COutPoint& outpoint, uint256& hashRet)
 {
     LOCK(cs_instantsend);
-    std::map<COutPoint, uint256>::iterator it = mapLockedOutpoints.find(outpoint);
+    auto it = mapLockedOutpoints.find(outpoint);
     if(it == mapLockedOutpoints.end()) return false;
     hashRet = it->second;
     return true;
@@ -575,8 +648,8 @@ bool CInstantSend::ResolveConflicts(const CTxLockCandidate& txLockCandidate)
         if(GetLockedOutPointTxHash(txin.prevout, hashConflicting) && txHash != hashConflicting) {
             // completed lock which conflicts with another completed one?
             // this means that majority of MNs in the quorum for this specific tx input are malicious!
-            std::map<uint256, CTxLockCandidate>::iterator itLockCandidate = mapTxLockCandidates.find(txHash);
-            std::map<uint256, CTxLockCandidate>::iterator itLockCandidateConflicting = mapTxLockCandidates.find(hashConflicting);
+            auto itLockCandidate = mapTxLockCandidates.find(txHash);
+            auto itLockCandidateConflicting = mapTxLockCandidates.find(hashConflicting);
             if(itLockCandidate == mapTxLockCandidates.end() || itLockCandidateConflicting == mapTxLockCandidates.end()) {
                 // safety check, should never really happen
                 LogPrintf("CInstantSend::ResolveConflicts -- ERROR: Found conflicting completed Transaction Lock, but one of txLockCandidate-s is missing, txid=%s, conflicting txid=%s\n",
@@ -587,8 +660,8 @@ bool CInstantSend::ResolveConflicts(const CTxLockCandidate& txLockCandidate)
                     txHash.ToString(), hashConflicting.ToString());
             CTxLockRequest txLockRequest = itLockCandidate->second.txLockRequest;
             CTxLockRequest txLockRequestConflicting = itLockCandidateConflicting->second.txLockRequest;
-            itLockCandidate->second.SetConfirmedHeight(0); // expired
-            itLockCandidateConflicting->second.SetConfirmedHeight(0); // expired
+            SetTxLockCandidateConfirmedHeight(itLockCandidate->second, 0); // expired
+            SetTxLockCandidateConfirmedHeight(itLockCandidateConflicting->second, 0); // expired
             CheckAndRemove(); // clean up
             // AlreadyHave should still return "true" for both of them
             mapLockRequestRejected.insert(make_pair(txHash, txLockRequest));
@@ -640,7 +713,7 @@ int64_t CInstantSend::GetAverageSmartnodeOrphanVoteTime()
     // NOTE: should never actually call this function when mapSmartnodeOrphanVotes is empty
     if(mapSmartnodeOrphanVotes.empty()) return 0;
 
-    std::map<COutPoint, int64_t>::iterator it = mapSmartnodeOrphanVotes.begin();
+    auto it = mapSmartnodeOrphanVotes.begin();
     int64_t total = 0;
 
     while(it != mapSmartnodeOrphanVotes.end()) {
@@ -657,67 +730,65 @@ void CInstantSend::CheckAndRemove()
 
     LOCK(cs_instantsend);
 
-    std::map<uint256, CTxLockCandidate>::iterator itLockCandidate = mapTxLockCandidates.begin();
-
-    // remove expired candidates
-    while(itLockCandidate != mapTxLockCandidates.end()) {
+    // remove expired candidates, only the ones confirmed deep enough can be
+    int nKeepLock = Params().GetConsensus().nInstantSendKeepLock;
+    while(!mapTxLockCandidatesByHeight.empty() && nCachedBlockHeight - mapTxLockCandidatesByHeight.begin()->first > nKeepLock) {
+        uint256 txHash = mapTxLockCandidatesByHeight.begin()->second;
+        mapTxLockCandidatesByHeight.erase(mapTxLockCandidatesByHeight.begin());
+        auto itLockCandidate = mapTxLockCandidates.find(txHash);
+        // gone already or confirmed at another height since
+        if(itLockCandidate == mapTxLockCandidates.end() || !itLockCandidate->second.IsExpired(nCachedBlockHeight)) continue;
         CTxLockCandidate &txLockCandidate = itLockCandidate->second;
-        uint256 txHash = txLockCandidate.GetHash();
-        if(txLockCandidate.IsExpired(nCachedBlockHeight)) {
-            LogPrintf("CInstantSend::CheckAndRemove -- Removing expired Transaction Lock Candidate: txid=%s\n", txHash.ToString());
-            std::map<COutPoint, COutPointLock>::iterator itOutpointLock = txLockCandidate.mapOutPointLocks.begin();
-            while(itOutpointLock != txLockCandidate.mapOutPointLocks.end()) {
-                mapLockedOutpoints.erase(itOutpointLock->first);
-                mapVotedOutpoints.erase(itOutpointLock->first);
-                ++itOutpointLock;
-            }
-            mapLockRequestAccepted.erase(txHash);
-            mapLockRequestRejected.erase(txHash);
-            mapTxLockCandidates.erase(itLockCandidate++);
-        } else {
-            ++itLockCandidate;
+        LogPrintf("CInstantSend::CheckAndRemove -- Removing expired Transaction Lock Candidate: txid=%s\n", txHash.ToString());
+        std::map<COutPoint, COutPointLock>::iterator itOutpointLock = txLockCandidate.mapOutPointLocks.begin();
+        while(itOutpointLock != txLockCandidate.mapOutPointLocks.end()) {
+            mapLockedOutpoints.erase(itOutpointLock->first);
+            mapVotedOutpoints.erase(itOutpointLock->first);
+            ++itOutpointLock;
         }
+        mapLockRequestAccepted.erase(txHash);
+        mapLockRequestRejected.erase(txHash);
+        mapTxLockCandidates.erase(itLockCandidate);
     }
 
-    // remove expired votes
-    std::map<uint256, CTxLockVote>::iterator itVote = mapTxLockVotes.begin();
-    while(itVote != mapTxLockVotes.end()) {
-        if(itVote->second.IsExpired(nCachedBlockHeight)) {
-            LogPrint("instantsend", "CInstantSend::CheckAndRemove -- Removing expired vote: txid=%s  smartnode=%s\n",
-                    itVote->second.GetTxHash().ToString(), itVote->second.GetSmartnodeOutpoint().ToStringShort());
-            mapTxLockVotes.erase(itVote++);
-        } else {
-            ++itVote;
+    // remove expired votes, invalid votes and votes for failed lock attempts
+    for (auto& shard : vecVoteShards) {
+        LOCK(shard.cs);
+        auto itVote = shard.mapTxLockVotes.begin();
+        while(itVote != shard.mapTxLockVotes.end()) {
+            if(itVote->second.IsExpired(nCachedBlockHeight)) {
+                LogPrint("instantsend", "CInstantSend::CheckAndRemove -- Removing expired vote: txid=%s  smartnode=%s\n",
+                        itVote->second.GetTxHash().ToString(), itVote->second.GetSmartnodeOutpoint().ToStringShort());
+                shard.mapTxLockVotes.erase(itVote++);
+            } else if(itVote->second.IsFailed()) {
+                LogPrint("instantsend", "CInstantSend::CheckAndRemove -- Removing vote for failed lock attempt: txid=%s  smartnode=%s\n",
+                        itVote->second.GetTxHash().ToString(), itVote->second.GetSmartnodeOutpoint().ToStringShort());
+                shard.mapTxLockVotes.erase(itVote++);
+            } else {
+                ++itVote;
+            }
         }
     }
 
     // remove timed out orphan votes
-    std::map<uint256, CTxLockVote>::iterator itOrphanVote = mapTxLockVotesOrphan.begin();
-    while(itOrphanVote != mapTxLockVotesOrphan.end()) {
-        if(itOrphanVote->second.IsTimedOut()) {
+    auto itOrphanVote = listTxLockVotesOrphan.begin();
+    while(itOrphanVote != listTxLockVotesOrphan.end()) {
+        const CTxLockVote& vote = *itOrphanVote++;
+        if(vote.IsTimedOut()) {
             LogPrint("instantsend", "CInstantSend::CheckAndRemove -- Removing timed out orphan vote: txid=%s  smartnode=%s\n",
-                    itOrphanVote->second.GetTxHash().ToString(), itOrphanVote->second.GetSmartnodeOutpoint().ToStringShort());
-            mapTxLockVotes.erase(itOrphanVote->first);
-            mapTxLockVotesOrphan.erase(itOrphanVote++);
-        } else {
-            ++itOrphanVote;
-        }
-    }
-
-    // remove invalid votes and votes for failed lock attempts
-    itVote = mapTxLockVotes.begin();
-    while(itVote != mapTxLockVotes.end()) {
-        if(itVote->second.IsFailed()) {
-            LogPrint("instantsend", "CInstantSend::CheckAndRemove -- Removing vote for failed lock attempt: txid=%s  smartnode=%s\n",
-                    itVote->second.GetTxHash().ToString(), itVote->second.GetSmartnodeOutpoint().ToStringShort());
-            mapTxLockVotes.erase(itVote++);
-        } else {
-            ++itVote;
+                    vote.GetTxHash().ToString(), vote.GetSmartnodeOutpoint().ToStringShort());
+            uint256 voteHash = vote.GetHash();
+            {
+                CTxLockVoteShard& shard = GetVoteShard(voteHash);
+                LOCK(shard.cs);
+                shard.mapTxLockVotes.erase(voteHash);
+            }
+            EraseOrphanTxLockVote(voteHash);
         }
     }
 
     // remove timed out smartnode orphan votes (DOS protection)
-    std::map<COutPoint, int64_t>::iterator itSmartnodeOrphan = mapSmartnodeOrphanVotes.begin();
+    auto itSmartnodeOrphan = mapSmartnodeOrphanVotes.begin();
     while(itSmartnodeOrphan != mapSmartnodeOrphanVotes.end()) {
         if(itSmartnodeOrphan->second < GetTime()) {
             LogPrint("instantsend", "CInstantSend::CheckAndRemove -- Removing timed out orphan smartnode vote: smartnode=%s\n",
@@ -732,10 +803,15 @@ void CInstantSend::CheckAndRemove()
 
 bool CInstantSend::AlreadyHave(const uint256& hash)
 {
+    {
+        CTxLockVoteShard& shard = GetVoteShard(hash);
+        LOCK(shard.cs);
+        if(shard.mapTxLockVotes.count(hash)) return true;
+    }
+
     LOCK(cs_instantsend);
     return mapLockRequestAccepted.count(hash) ||
-            mapLockRequestRejected.count(hash) ||
-            mapTxLockVotes.count(hash);
+            mapLockRequestRejected.count(hash);
 }
 
 void CInstantSend::AcceptLockRequest(const CTxLockRequest& txLockRequest)
@@ -756,11 +832,26 @@ bool CInstantSend::HasTxLockRequest(const uint256& txHash)
     return GetTxLockRequest(txHash, txLockRequestTmp);
 }
 
+bool CInstantSend::CheckTxLockRequest(const CTransaction& tx)
+{
+    AssertLockHeld(cs_main);
+
+    uint256 txHash = tx.GetHash();
+    {
+        LOCK(cs_instantsend);
+        if(mapTxLockCandidates.find(txHash) == mapTxLockCandidates.end()) return true;
+        // validated by ProcessTxLockRequest and no block connected since
+        if(txHash == txHashLastValidated && pindexLastValidated == chainActive.Tip()) return true;
+    }
+
+    return CTxLockRequest(tx).IsValid();
+}
+
 bool CInstantSend::GetTxLockRequest(const uint256& txHash, CTxLockRequest& txLockRequestRet)
 {
     LOCK(cs_instantsend);
 
-    std::map<uint256, CTxLockCandidate>::iterator it = mapTxLockCandidates.find(txHash);
+    auto it = mapTxLockCandidates.find(txHash);
     if(it == mapTxLockCandidates.end()) return false;
     txLockRequestRet = it->second.txLockRequest;
 
@@ -769,15 +860,34 @@ bool CInstantSend::GetTxLockRequest(const uint256& txHash, CTxLockRequest& txLoc
 
 bool CInstantSend::GetTxLockVote(const uint256& hash, CTxLockVote& txLockVoteRet)
 {
-    LOCK(cs_instantsend);
+    CTxLockVoteShard& shard = GetVoteShard(hash);
+    LOCK(shard.cs);
 
-    std::map<uint256, CTxLockVote>::iterator it = mapTxLockVotes.find(hash);
-    if(it == mapTxLockVotes.end()) return false;
+    auto it = shard.mapTxLockVotes.find(hash);
+    if(it == shard.mapTxLockVotes.end()) return false;
     txLockVoteRet = it->second;
 
     return true;
 }
 
+bool CInstantSend::AddTxLockVote(const uint256& hash, const CTxLockVote& vote)
+{
+    CTxLockVoteShard& shard = GetVoteShard(hash);
+    LOCK(shard.cs);
+    return shard.mapTxLockVotes.emplace(hash, vote).second;
+}
+
+void CInstantSend::SetTxLockVoteConfirmedHeight(const uint256& hash, int nConfirmedHeight)
+{
+    CTxLockVoteShard& shard = GetVoteShard(hash);
+    LOCK(shard.cs);
+
+    auto it = shard.mapTxLockVotes.find(hash);
+    if(it != shard.mapTxLockVotes.end()) {
+        it->second.SetConfirmedHeight(nConfirmedHeight);
+    }
+}
+
 bool CInstantSend::IsInstantSendReadyToLock(const uint256& txHash)
 {
     if(!fEnableInstantSend || GetfLargeWorkForkFound() || GetfLargeWorkInvalidChainFound() ||
@@ -786,7 +896,7 @@ bool CInstantSend::IsInstantSendReadyToLock(const uint256& txHash)
     LOCK(cs_instantsend);
     // There must be a successfully verified lock request
     // and all outputs must be locked (i.e. have enough signatures)
-    std::map<uint256, CTxLockCandidate>::iterator it = mapTxLockCandidates.find(txHash);
+    auto it = mapTxLockCandidates.find(txHash);
     return it != mapTxLockCandidates.end() && it->second.IsAllOutPointsReady();
 }
 
@@ -798,7 +908,7 @@ bool CInstantSend::IsLockedInstantSendTransaction(const uint256& txHash)
     LOCK(cs_instantsend);
 
     // there must be a lock candidate
-    std::map<uint256, CTxLockCandidate>::iterator itLockCandidate = mapTxLockCandidates.find(txHash);
+    auto itLockCandidate = mapTxLockCandidates.find(txHash);
     if(itLockCandidate == mapTxLockCandidates.end()) return false;
 
     // which should have outpoints
@@ -823,7 +933,7 @@ int CInstantSend::GetTransactionLockSignatures(const uint256& txHash)
 
     LOCK(cs_instantsend);
 
-    std::map<uint256, CTxLockCandidate>::iterator itLockCandidate = mapTxLockCandidates.find(txHash);
+    auto itLockCandidate = mapTxLockCandidates.find(txHash);
     if(itLockCandidate != mapTxLockCandidates.end()) {
         return itLockCandidate->second.CountVotes();
     }
@@ -842,7 +952,7 @@ bool CInstantSend::IsTxLockCandidateTimedOut(const uint256& txHash)
 
     LOCK(cs_instantsend);
 
-    std::map<uint256, CTxLockCandidate>::iterator itLockCandidate = mapTxLockCandidates.find(txHash);
+    auto itLockCandidate = mapTxLockCandidates.find(txHash);
     if (itLockCandidate != mapTxLockCandidates.end()) {
         return !itLockCandidate->second.IsAllOutPointsReady() &&
                 itLockCandidate->second.IsTimedOut();
@@ -855,7 +965,7 @@ void CInstantSend::Relay(const uint256& txHash, CConnman& connman)
 {
     LOCK(cs_instantsend);
 
-    std::map<uint256, CTxLockCandidate>::const_iterator itLockCandidate = mapTxLockCandidates.find(txHash);
+    auto itLockCandidate = mapTxLockCandidates.find(txHash);
     if (itLockCandidate != mapTxLockCandidates.end()) {
         itLockCandidate->second.Relay(connman);
     }
@@ -894,26 +1004,22 @@ void CInstantSend::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
     LogPrint("instantsend", "CInstantSend::SyncTransaction -- txid=%s nHeightNew=%d\n", txHash.ToString(), nHeightNew);
 
     // Check lock candidates
-    std::map<uint256, CTxLockCandidate>::iterator itLockCandidate = mapTxLockCandidates.find(txHash);
+    auto itLockCandidate = mapTxLockCandidates.find(txHash);
     if(itLockCandidate != mapTxLockCandidates.end()) {
         LogPrint("instantsend", "CInstantSend::SyncTransaction -- txid=%s nHeightNew=%d lock candidate updated\n",
                 txHash.ToString(), nHeightNew);
-        itLockCandidate->second.SetConfirmedHeight(nHeightNew);
+        SetTxLockCandidateConfirmedHeight(itLockCandidate->second, nHeightNew);
         // Loop through outpoint locks
         std::map<COutPoint, COutPointLock>::iterator itOutpointLock = itLockCandidate->second.mapOutPointLocks.begin();
         while(itOutpointLock != itLockCandidate->second.mapOutPointLocks.end()) {
             // Check corresponding lock votes
             std::vector<CTxLockVote> vVotes = itOutpointLock->second.GetVotes();
             std::vector<CTxLockVote>::iterator itVote = vVotes.begin();
-            std::map<uint256, CTxLockVote>::iterator it;
             while(itVote != vVotes.end()) {
                 uint256 nVoteHash = itVote->GetHash();
                 LogPrint("instantsend", "CInstantSend::SyncTransaction -- txid=%s nHeightNew=%d vote %s updated\n",
                         txHash.ToString(), nHeightNew, nVoteHash.ToString());
-                it = mapTxLockVotes.find(nVoteHash);
-                if(it != mapTxLockVotes.end()) {
-                    it->second.SetConfirmedHeight(nHeightNew);
-                }
+                SetTxLockVoteConfirmedHeight(nVoteHash, nHeightNew);
                 ++itVote;
             }
             ++itOutpointLock;
@@ -921,28 +1027,44 @@ void CInstantSend::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
     }
 
     // check orphan votes
-    std::map<uint256, CTxLockVote>::iterator itOrphanVote = mapTxLockVotesOrphan.begin();
-    while(itOrphanVote != mapTxLockVotesOrphan.end()) {
-        if(itOrphanVote->second.GetTxHash() == txHash) {
+    auto itByTx = mapTxLockVotesOrphanByTx.find(txHash);
+    if(itByTx != mapTxLockVotesOrphanByTx.end()) {
+        for (const auto& voteHash : itByTx->second) {
             LogPrint("instantsend", "CInstantSend::SyncTransaction -- txid=%s nHeightNew=%d vote %s updated\n",
-                    txHash.ToString(), nHeightNew, itOrphanVote->first.ToString());
-            mapTxLockVotes[itOrphanVote->first].SetConfirmedHeight(nHeightNew);
+                    txHash.ToString(), nHeightNew, voteHash.ToString());
+            CTxLockVoteShard& shard = GetVoteShard(voteHash);
+            LOCK(shard.cs);
+            shard.mapTxLockVotes[voteHash].SetConfirmedHeight(nHeightNew);
         }
-        ++itOrphanVote;
     }
 }
 
+void CInstantSend::GetOrphanVoteStats(size_t& nCountRet, size_t& nUsageRet, uint64_t& nEvictedRet)
+{
+    LOCK(cs_instantsend);
+    nCountRet = mapTxLockVotesOrphan.size();
+    nUsageRet = nOrphanVotesUsage;
+    nEvictedRet = nOrphanVotesEvicted;
+}
+
 std::string CInstantSend::ToString()
 {
+    size_t nVotes = 0;
+    for (auto& shard : vecVoteShards) {
+        LOCK(shard.cs);
+        nVotes += shard.mapTxLockVotes.size();
+    }
+
     LOCK(cs_instantsend);
-    return strprintf("Lock Candidates: %llu, Votes %llu", mapTxLockCandidates.size(), mapTxLockVotes.size());
+    return strprintf("Lock Candidates: %llu, Votes %llu, Orphan Votes %llu (%llu bytes, %llu evicted)",
+            mapTxLockCandidates.size(), nVotes, mapTxLockVotesOrphan.size(), nOrphanVotesUsage, nOrphanVotesEvicted);
 }
 
 //
 // CTxLockRequest
 //
 
-bool CTxLockRequest::IsValid() const
+bool CTxLockRequest::IsValid(const CCoinsViewCache* pview) const
 {
     if(vout.size() < 1) return false;
 
@@ -958,11 +1080,14 @@ bool CTxLockRequest::IsValid() const
 
     CAmount nValueIn = 0;
 
+    // look the coins up in place, copying their scripts is not needed here
+    const CCoinsViewCache& view = pview ? *pview : *pcoinsTip;
+
     BOOST_FOREACH(const CTxIn& txin, vin) {
 
-        Coin coin;
+        const Coin& coin = view.AccessCoin(txin.prevout);
 
-        if(!GetUTXOCoin(txin.prevout, coin)) {
+        if(coin.IsSpent()) {
             LogPrint("instantsend", "CTxLockRequest::IsValid -- Failed to find UTXO %s\n", txin.prevout.ToStringShort());
             return false;
         }
@@ -1058,10 +1183,15 @@ uint256 CTxLockVote::GetHash() const
     return ss.GetHash();
 }
 
+std::string CTxLockVote::GetSignatureMessage() const
+{
+    return txHash.ToString() + outpoint.ToStringShort();
+}
+
 bool CTxLockVote::CheckSignature() const
 {
     std::string strError;
-    std::string strMessage = txHash.ToString() + outpoint.ToStringShort();
+    std::string strMessage = GetSignatureMessage();
 
     smartnode_info_t infoMn;
 
@@ -1081,7 +1211,7 @@ bool CTxLockVote::CheckSignature() const
 bool CTxLockVote::Sign()
 {
     std::string strError;
-    std::string strMessage = txHash.ToString() + outpoint.ToStringShort();
+    std::string strMessage = GetSignatureMessage();
 
     if(!CMessageSigner::SignMessage(strMessage, vchSmartnodeSignature, activeSmartnode.keySmartnode)) {
         LogPrintf("CTxLockVote::Sign -- SignMessage() failed\n");
@@ -1167,26 +1297,21 @@ void CTxLockCandidate::AddOutPointLock(const COutPoint& outpoint)
 void CTxLockCandidate::MarkOutpointAsAttacked(const COutPoint& outpoint)
 {
     std::map<COutPoint, COutPointLock>::iterator it = mapOutPointLocks.find(outpoint);
-    if(it != mapOutPointLocks.end())
-        it->second.MarkAsAttacked();
+    if(it == mapOutPointLocks.end()) return;
+    if(it->second.IsReady()) --nReadyOutPoints;
+    nVotes -= it->second.CountVotes();
+    it->second.MarkAsAttacked();
 }
 
 bool CTxLockCandidate::AddVote(const CTxLockVote& vote)
 {
     std::map<COutPoint, COutPointLock>::iterator it = mapOutPointLocks.find(vote.GetOutpoint());
     if(it == mapOutPointLocks.end()) return false;
-    return it->second.AddVote(vote);
-}
-
-bool CTxLockCandidate::IsAllOutPointsReady() const
-{
-    if(mapOutPointLocks.empty()) return false;
-
-    std::map<COutPoint, COutPointLock>::const_iterator it = mapOutPointLocks.begin();
-    while(it != mapOutPointLocks.end()) {
-        if(!it->second.IsReady()) return false;
-        ++it;
-    }
+    bool fWasReady = it->second.IsReady();
+    int nVotesBefore = it->second.CountVotes();
+    if(!it->second.AddVote(vote)) return false;
+    nVotes += it->second.CountVotes() - nVotesBefore;
+    if(!fWasReady && it->second.IsReady()) ++nReadyOutPoints;
     return true;
 }
 
@@ -1196,18 +1321,6 @@ bool CTxLockCandidate::HasSmartnodeVoted(const COutPoint& outpointIn, const COut
     return it !=mapOutPointLocks.end() && it->second.HasSmartnodeVoted(outpointSmartnodeIn);
 }
 
-int CTxLockCandidate::CountVotes() const
-{
-    // Note: do NOT use vote count to figure out if tx is locked, use IsAllOutPointsReady() instead
-    int nCountVotes = 0;
-    std::map<COutPoint, COutPointLock>::const_iterator it = mapOutPointLocks.begin();
-    while(it != mapOutPointLocks.end()) {
-        nCountVotes += it->second.CountVotes();
-        ++it;
-    }
-    return nCountVotes;
-}
-
 bool CTxLockCandidate::IsExpired(int nHeight) const
 {
     // Locks and votes expire nInstantSendKeepLock blocks after the block corresponding tx was included into.
@@ -6,9 +6,14 @@
 
 #include "../net.h"
 #include "../chain.h"
+#include "../coins.h"
+#include "../txmempool.h"
 #include "../utiltime.h"
 #include "primitives/transaction.h"
 
+#include <list>
+#include <unordered_map>
+
 class CTxLockVote;
 class COutPointLock;
 class CTxLockRequest;
@@ -39,6 +44,11 @@ static const int INSTANTSEND_LOCK_TIMEOUT_SECONDS   = 15;
 // For how long we are going to keep invalid votes and votes for failed lock attempts,
 // must be greater than INSTANTSEND_LOCK_TIMEOUT_SECONDS
 static const int INSTANTSEND_FAILED_TIMEOUT_SECONDS = 60;
+// Number of independently locked parts the seen votes are split into
+static const int INSTANTSEND_VOTE_SHARDS            = 16;
+// Memory we are willing to spend on votes for unknown lock requests,
+// the least recently seen ones are evicted first
+static const size_t INSTANTSEND_MAX_ORPHAN_VOTES_USAGE = 10 * 1000 * 1000;
 
 extern bool fEnableInstantSend;
 extern int nInstantSendDepth;
@@ -50,29 +60,58 @@ private:
     // Keep track of current block height
     int nCachedBlockHeight;
 
+    // seen votes only need their own shard's lock, so lookups from the network don't wait for cs_instantsend
+    struct CTxLockVoteShard {
+        CCriticalSection cs;
+        std::unordered_map<uint256, CTxLockVote, SaltedTxidHasher> mapTxLockVotes; // vote hash - vote
+    };
+    CTxLockVoteShard vecVoteShards[INSTANTSEND_VOTE_SHARDS];
+    SaltedTxidHasher hasherVoteShards;
+
     // maps for AlreadyHave
-    std::map<uint256, CTxLockRequest> mapLockRequestAccepted; // tx hash - tx
-    std::map<uint256, CTxLockRequest> mapLockRequestRejected; // tx hash - tx
-    std::map<uint256, CTxLockVote> mapTxLockVotes; // vote hash - vote
-    std::map<uint256, CTxLockVote> mapTxLockVotesOrphan; // vote hash - vote
+    std::unordered_map<uint256, CTxLockRequest, SaltedTxidHasher> mapLockRequestAccepted; // tx hash - tx
+    std::unordered_map<uint256, CTxLockRequest, SaltedTxidHasher> mapLockRequestRejected; // tx hash - tx
 
-    std::map<uint256, CTxLockCandidate> mapTxLockCandidates; // tx hash - lock candidate
+    // orphan votes in LRU order, indexed by vote hash and by tx hash
+    std::list<CTxLockVote> listTxLockVotesOrphan; // oldest first
+    std::unordered_map<uint256, std::list<CTxLockVote>::iterator, SaltedTxidHasher> mapTxLockVotesOrphan; // vote hash - vote
+    std::unordered_map<uint256, std::set<uint256>, SaltedTxidHasher> mapTxLockVotesOrphanByTx; // tx hash - vote hash set
+    size_t nOrphanVotesUsage;
+    uint64_t nOrphanVotesEvicted;
 
-    std::map<COutPoint, std::set<uint256> > mapVotedOutpoints; // utxo - tx hash set
-    std::map<COutPoint, uint256> mapLockedOutpoints; // utxo - tx hash
+    std::unordered_map<uint256, CTxLockCandidate, SaltedTxidHasher> mapTxLockCandidates; // tx hash - lock candidate
+    // confirmed candidates by the height they were confirmed at, so CheckAndRemove only visits the expiring ones;
+    // entries are not removed when a candidate's height changes, stale ones are skipped when they come up
+    std::multimap<int, uint256> mapTxLockCandidatesByHeight; // confirmed height - tx hash
+
+    std::unordered_map<COutPoint, std::set<uint256>, SaltedOutpointHasher> mapVotedOutpoints; // utxo - tx hash set
+    std::unordered_map<COutPoint, uint256, SaltedOutpointHasher> mapLockedOutpoints; // utxo - tx hash
 
     //track smartnodes who voted with no txreq (for DOS protection)
-    std::map<COutPoint, int64_t> mapSmartnodeOrphanVotes; // mn outpoint - time
+    std::unordered_map<COutPoint, int64_t, SaltedOutpointHasher> mapSmartnodeOrphanVotes; // mn outpoint - time
+
+    // last lock request found valid and the tip it was checked at, lets AcceptToMemoryPool skip the second check
+    uint256 txHashLastValidated;
+    const CBlockIndex* pindexLastValidated;
+
+    CTxLockVoteShard& GetVoteShard(const uint256& hash) { return vecVoteShards[hasherVoteShards(hash) % INSTANTSEND_VOTE_SHARDS]; }
+    /// Remember a seen vote, false if it was known already
+    bool AddTxLockVote(const uint256& hash, const CTxLockVote& vote);
+    void SetTxLockVoteConfirmedHeight(const uint256& hash, int nConfirmedHeight);
 
     bool CreateTxLockCandidate(const CTxLockRequest& txLockRequest);
     void CreateEmptyTxLockCandidate(const uint256& txHash);
+    void SetTxLockCandidateConfirmedHeight(CTxLockCandidate& txLockCandidate, int nConfirmedHeight);
     void Vote(CTxLockCandidate& txLockCandidate, CConnman& connman);
 
     //process consensus vote message
     bool ProcessTxLockVote(CNode* pfrom, CTxLockVote& vote, CConnman& connman);
     bool ProcessOrphanTxLockVote(const CTxLockVote& vote);
     void UpdateVotedOutpoints(const CTxLockVote& vote, CTxLockCandidate& txLockCandidate);
-    void ProcessOrphanTxLockVotes();
+    void ProcessOrphanTxLockVotes(const uint256& txHash);
+    /// Store an orphan vote or refresh it if we have it already, false if it was known
+    bool AddOrphanTxLockVote(const uint256& voteHash, const CTxLockVote& vote);
+    void EraseOrphanTxLockVote(const uint256& voteHash);
     int64_t GetAverageSmartnodeOrphanVoteTime();
 
     void TryToFinalizeLockCandidate(const CTxLockCandidate& txLockCandidate);
@@ -86,6 +125,8 @@ private:
 public:
     CCriticalSection cs_instantsend;
 
+    CInstantSend() : nCachedBlockHeight(0), nOrphanVotesUsage(0), nOrphanVotesEvicted(0), pindexLastValidated(NULL) {}
+
     void ProcessMessage(CNode* pfrom, std::string& strCommand, CDataStream& vRecv, CConnman& connman);
 
     bool ProcessTxLockRequest(const CTxLockRequest& txLockRequest, CConnman& connman);
@@ -96,6 +137,8 @@ public:
     void AcceptLockRequest(const CTxLockRequest& txLockRequest);
     void RejectLockRequest(const CTxLockRequest& txLockRequest);
     bool HasTxLockRequest(const uint256& txHash);
+    /// True if tx is not a lock request or is a valid one, reusing the check done by ProcessTxLockRequest at the same tip
+    bool CheckTxLockRequest(const CTransaction& tx);
     bool GetTxLockRequest(const uint256& txHash, CTxLockRequest& txLockRequestRet);
 
     bool GetTxLockVote(const uint256& hash, CTxLockVote& txLockVoteRet);
@@ -119,6 +162,9 @@ public:
     void UpdatedBlockTip(const CBlockIndex *pindex);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
 
+    // number, approximate memory usage and evictions of orphan votes
+    void GetOrphanVoteStats(size_t& nCountRet, size_t& nUsageRet, uint64_t& nEvictedRet);
+
     std::string ToString();
 };
 
@@ -133,7 +179,8 @@ public:
     CTxLockRequest() = default;
     CTxLockRequest(const CTransaction& tx) : CTransaction(tx) {};
 
-    bool IsValid() const;
+    /// Check inputs, value and fee against pview (pcoinsTip if NULL), cs_main must be held
+    bool IsValid(const CCoinsViewCache* pview = NULL) const;
     CAmount GetMinFee() const;
     int GetMaxSignatures() const;
 
@@ -188,6 +235,7 @@ public:
     uint256 GetTxHash() const { return txHash; }
     COutPoint GetOutpoint() const { return outpoint; }
     COutPoint GetSmartnodeOutpoint() const { return outpointSmartnode; }
+    const std::vector<unsigned char>& GetSignature() const { return vchSmartnodeSignature; }
 
     bool IsValid(CNode* pnode, CConnman& connman) const;
     void SetConfirmedHeight(int nConfirmedHeightIn) { nConfirmedHeight = nConfirmedHeightIn; }
@@ -195,6 +243,7 @@ public:
     bool IsTimedOut() const;
     bool IsFailed() const;
 
+    std::string GetSignatureMessage() const;
     bool Sign();
     bool CheckSignature() const;
 
@@ -234,16 +283,22 @@ class CTxLockCandidate
 private:
     int nConfirmedHeight; // when corresponding tx is 0-confirmed or conflicted, nConfirmedHeight is -1
     int64_t nTimeCreated;
+    // kept up to date by AddVote and MarkOutpointAsAttacked, so lock checks don't walk mapOutPointLocks
+    int nReadyOutPoints; // outpoint locks with SIGNATURES_REQUIRED votes
+    int nVotes; // votes over all outpoint locks, not counting attacked ones
 
 public:
     CTxLockCandidate(const CTxLockRequest& txLockRequestIn) :
         nConfirmedHeight(-1),
         nTimeCreated(GetTime()),
+        nReadyOutPoints(0),
+        nVotes(0),
         txLockRequest(txLockRequestIn),
         mapOutPointLocks()
         {}
 
     CTxLockRequest txLockRequest;
+    // modify the outpoint locks through the methods below only, they maintain the vote counters
     std::map<COutPoint, COutPointLock> mapOutPointLocks;
 
     uint256 GetHash() const { return txLockRequest.GetHash(); }
@@ -251,12 +306,14 @@ public:
     void AddOutPointLock(const COutPoint& outpoint);
     void MarkOutpointAsAttacked(const COutPoint& outpoint);
     bool AddVote(const CTxLockVote& vote);
-    bool IsAllOutPointsReady() const;
+    bool IsAllOutPointsReady() const { return !mapOutPointLocks.empty() && nReadyOutPoints == (int)mapOutPointLocks.size(); }
 
     bool HasSmartnodeVoted(const COutPoint& outpointIn, const COutPoint& outpointSmartnodeIn);
-    int CountVotes() const;
+    // Note: do NOT use vote count to figure out if tx is locked, use IsAllOutPointsReady() instead
+    int CountVotes() const { return nVotes; }
 
     void SetConfirmedHeight(int nConfirmedHeightIn) { nConfirmedHeight = nConfirmedHeightIn; }
+    int GetConfirmedHeight() const { return nConfirmedHeight; }
     bool IsExpired(int nHeight) const;
     bool IsTimedOut() const;
 
@@ -8,60 +8,97 @@
 
 CNetFulfilledRequestManager netfulfilledman;
 
-void CNetFulfilledRequestManager::AddFulfilledRequest(CAddress addr, std::string strRequest)
+std::string FulfilledRequestName(FulfilledRequest request)
+{
+    switch (request) {
+        case FULFILLED_FULL_SYNC:               return "full-sync";
+        case FULFILLED_SPORK_SYNC:              return "spork-sync";
+        case FULFILLED_SMARTNODE_LIST_SYNC:     return "smartnode-list-sync";
+        case FULFILLED_SMARTNODE_PAYMENT_SYNC:  return "smartnode-payment-sync";
+        case FULFILLED_PAYMENT_VOTES_REQUEST:   return NetMsgType::SMARTNODEPAYMENTSYNC;
+        case FULFILLED_MNVERIFY_REQUEST:        return strprintf("%s-request", NetMsgType::MNVERIFY);
+        case FULFILLED_MNVERIFY_REPLY:          return strprintf("%s-reply", NetMsgType::MNVERIFY);
+        case FULFILLED_MNVERIFY_DONE:           return strprintf("%s-done", NetMsgType::MNVERIFY);
+        case FULFILLED_REQUEST_COUNT:           break;
+    }
+    return "unknown";
+}
+
+void CNetFulfilledRequestManager::AddFulfilledRequest(const CNetAddr& addr, FulfilledRequest request)
 {
     LOCK(cs_mapFulfilledRequests);
-    mapFulfilledRequests[addr][strRequest] = GetTime() + Params().FulfilledRequestExpireTime();
+    int64_t now = GetTime();
+    RemoveExpired(now);
+    AddFulfilledRequest(addr, request, now + Params().FulfilledRequestExpireTime());
 }
 
-bool CNetFulfilledRequestManager::HasFulfilledRequest(CAddress addr, std::string strRequest)
+void CNetFulfilledRequestManager::AddFulfilledRequest(const CNetAddr& addr, FulfilledRequest request, int64_t nExpire)
+{
+    CPeerRequests& peer = mapFulfilledRequests[addr];
+    peer.nExpire[request] = nExpire;
+
+    // Queue the peer once per bucket, at the end of the bucket so it is only looked at when all of it expired
+    int64_t nBucket = (nExpire / EXPIRY_BUCKET_SECONDS + 1) * EXPIRY_BUCKET_SECONDS;
+    if (nBucket > peer.nLastBucket) {
+        peer.nLastBucket = nBucket;
+        queueExpiry.push_back(std::make_pair(nBucket, addr));
+    }
+
+    // Make room by dropping the peers that were added to longest ago
+    while (mapFulfilledRequests.size() > MAX_PEERS && !queueExpiry.empty()) {
+        RemoveQueuedPeer();
+    }
+}
+
+bool CNetFulfilledRequestManager::HasFulfilledRequest(const CNetAddr& addr, FulfilledRequest request)
 {
     LOCK(cs_mapFulfilledRequests);
-    fulfilledreqmap_t::iterator it = mapFulfilledRequests.find(addr);
+    fulfilledreqmap_t::const_iterator it = mapFulfilledRequests.find(addr);
 
-    return  it != mapFulfilledRequests.end() &&
-            it->second.find(strRequest) != it->second.end() &&
-            it->second[strRequest] > GetTime();
+    return it != mapFulfilledRequests.end() && it->second.nExpire[request] > GetTime();
 }
 
-void CNetFulfilledRequestManager::RemoveFulfilledRequest(CAddress addr, std::string strRequest)
+void CNetFulfilledRequestManager::RemoveFulfilledRequest(const CNetAddr& addr, FulfilledRequest request)
 {
     LOCK(cs_mapFulfilledRequests);
     fulfilledreqmap_t::iterator it = mapFulfilledRequests.find(addr);
 
     if (it != mapFulfilledRequests.end()) {
-        it->second.erase(strRequest);
+        it->second.nExpire[request] = 0;
     }
 }
 
-void CNetFulfilledRequestManager::CheckAndRemove()
+void CNetFulfilledRequestManager::RemoveExpired(int64_t now)
 {
-    LOCK(cs_mapFulfilledRequests);
+    AssertLockHeld(cs_mapFulfilledRequests);
 
-    int64_t now = GetTime();
-    fulfilledreqmap_t::iterator it = mapFulfilledRequests.begin();
-
-    while(it != mapFulfilledRequests.end()) {
-        fulfilledreqmapentry_t::iterator it_entry = it->second.begin();
-        while(it_entry != it->second.end()) {
-            if(now > it_entry->second) {
-                it->second.erase(it_entry++);
-            } else {
-                ++it_entry;
-            }
-        }
-        if(it->second.size() == 0) {
-            mapFulfilledRequests.erase(it++);
-        } else {
-            ++it;
-        }
+    // Buckets are queued in the order they expire in, as all requests live equally long
+    while (!queueExpiry.empty() && queueExpiry.front().first <= now) {
+        RemoveQueuedPeer();
+    }
+}
+
+void CNetFulfilledRequestManager::RemoveQueuedPeer()
+{
+    fulfilledreqmap_t::iterator it = mapFulfilledRequests.find(queueExpiry.front().second);
+    // Only the entry for the last bucket of a peer drops it, earlier ones are outdated
+    if (it != mapFulfilledRequests.end() && it->second.nLastBucket == queueExpiry.front().first) {
+        mapFulfilledRequests.erase(it);
     }
+    queueExpiry.pop_front();
+}
+
+void CNetFulfilledRequestManager::CheckAndRemove()
+{
+    LOCK(cs_mapFulfilledRequests);
+    RemoveExpired(GetTime());
 }
 
 void CNetFulfilledRequestManager::Clear()
 {
     LOCK(cs_mapFulfilledRequests);
     mapFulfilledRequests.clear();
+    queueExpiry.clear();
 }
 
 std::string CNetFulfilledRequestManager::ToString() const
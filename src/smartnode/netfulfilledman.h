@@ -10,21 +10,70 @@
 #include "../serialize.h"
 #include "../sync.h"
 
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
+
 // Fulfilled requests are used to prevent nodes from asking for the same data on sync
 // and from being banned for doing so too often.
 class CNetFulfilledRequestManager;
 extern CNetFulfilledRequestManager netfulfilledman;
 
+/** The requests whose fulfillment is tracked per peer */
+enum FulfilledRequest {
+    FULFILLED_FULL_SYNC = 0,
+    FULFILLED_SPORK_SYNC,
+    FULFILLED_SMARTNODE_LIST_SYNC,
+    FULFILLED_SMARTNODE_PAYMENT_SYNC,
+    // a peer asked us for the payment votes
+    FULFILLED_PAYMENT_VOTES_REQUEST,
+    FULFILLED_MNVERIFY_REQUEST,
+    FULFILLED_MNVERIFY_REPLY,
+    FULFILLED_MNVERIFY_DONE,
+    FULFILLED_REQUEST_COUNT
+};
+
+/** Name of a request, as stored in netfulfilled.dat */
+std::string FulfilledRequestName(FulfilledRequest request);
+
 class CNetFulfilledRequestManager
 {
 private:
-    typedef std::map<std::string, int64_t> fulfilledreqmapentry_t;
-    typedef std::map<CNetAddr, fulfilledreqmapentry_t> fulfilledreqmap_t;
+    // at most this many peers are tracked, the ones that were added to longest ago are dropped first
+    static const size_t MAX_PEERS = 10000;
+    // expiry times are grouped into buckets of this many seconds, one queue entry per peer and bucket
+    static const int64_t EXPIRY_BUCKET_SECONDS = 60;
+
+    struct CPeerRequests
+    {
+        // expiry time of each request, 0 if it isn't fulfilled
+        int64_t nExpire[FULFILLED_REQUEST_COUNT];
+        // last expiry bucket the peer was queued for
+        int64_t nLastBucket;
+
+        CPeerRequests() : nLastBucket(0) { std::fill(nExpire, nExpire + FULFILLED_REQUEST_COUNT, 0); }
+    };
+
+    struct CNetAddrHasher
+    {
+        size_t operator()(const CNetAddr& addr) const { return addr.GetHash(); }
+    };
+
+    typedef std::unordered_map<CNetAddr, CPeerRequests, CNetAddrHasher> fulfilledreqmap_t;
 
     //keep track of what node has/was asked for and when
     fulfilledreqmap_t mapFulfilledRequests;
+    // peers by the bucket their requests expire in, oldest first
+    std::deque<std::pair<int64_t, CNetAddr> > queueExpiry;
     CCriticalSection cs_mapFulfilledRequests;
 
+    /// Drop the peers whose requests all expired
+    void RemoveExpired(int64_t now);
+    /// Pop the front of queueExpiry, dropping its peer unless the peer was queued again since
+    void RemoveQueuedPeer();
+    /// Add a request expiring at nExpire
+    void AddFulfilledRequest(const CNetAddr& addr, FulfilledRequest request, int64_t nExpire);
+
 public:
     CNetFulfilledRequestManager() {}
 
@@ -33,12 +82,34 @@ public:
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
         LOCK(cs_mapFulfilledRequests);
-        READWRITE(mapFulfilledRequests);
+        // Stored by request name, as always, so the file doesn't depend on the order of the enum
+        std::map<CNetAddr, std::map<std::string, int64_t> > mapStored;
+        if (!ser_action.ForRead()) {
+            for (const auto& peer : mapFulfilledRequests) {
+                for (int i = 0; i < FULFILLED_REQUEST_COUNT; i++) {
+                    if (peer.second.nExpire[i])
+                        mapStored[peer.first][FulfilledRequestName((FulfilledRequest)i)] = peer.second.nExpire[i];
+                }
+            }
+        }
+        READWRITE(mapStored);
+        if (ser_action.ForRead()) {
+            Clear();
+            for (const auto& peer : mapStored) {
+                for (int i = 0; i < FULFILLED_REQUEST_COUNT; i++) {
+                    std::map<std::string, int64_t>::const_iterator it = peer.second.find(FulfilledRequestName((FulfilledRequest)i));
+                    if (it != peer.second.end())
+                        AddFulfilledRequest(peer.first, (FulfilledRequest)i, it->second);
+                }
+            }
+            // Unlike requests added as they are fulfilled, the stored ones come in any order
+            std::sort(queueExpiry.begin(), queueExpiry.end());
+        }
     }
 
-    void AddFulfilledRequest(CAddress addr, std::string strRequest); // expire after 1 hour by default
-    bool HasFulfilledRequest(CAddress addr, std::string strRequest);
-    void RemoveFulfilledRequest(CAddress addr, std::string strRequest);
+    void AddFulfilledRequest(const CNetAddr& addr, FulfilledRequest request); // expire after FulfilledRequestExpireTime
+    bool HasFulfilledRequest(const CNetAddr& addr, FulfilledRequest request);
+    void RemoveFulfilledRequest(const CNetAddr& addr, FulfilledRequest request);
 
     void CheckAndRemove();
     void Clear();
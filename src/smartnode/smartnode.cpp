@@ -4,6 +4,8 @@
 
 #include "activesmartnode.h"
 #include "consensus/validation.h"
+#include "crypto/common.h"
+#include "crypto/sha256.h"
 #include "../init.h"
 #include "instantx.h"
 #include "../messagesigner.h"
@@ -17,6 +19,8 @@
 #include "wallet/wallet.h"
 #endif // ENABLE_WALLET
 
+#include <thread>
+
 #include <boost/lexical_cast.hpp>
 
 
@@ -40,7 +44,8 @@ CSmartnode::CSmartnode(const CSmartnode& other) :
     nPoSeBanScore(other.nPoSeBanScore),
     nPoSeBanHeight(other.nPoSeBanHeight),
     fAllowMixingTx(other.fAllowMixingTx),
-    fUnitTest(other.fUnitTest)
+    fUnitTest(other.fUnitTest),
+    fCollateralChecked(other.fCollateralChecked)
 {}
 
 CSmartnode::CSmartnode(const CSmartnodeBroadcast& mnb) :
@@ -64,6 +69,7 @@ bool CSmartnode::UpdateFromNewBroadcast(CSmartnodeBroadcast& mnb, CConnman& conn
     vchSig = mnb.vchSig;
     nProtocolVersion = mnb.nProtocolVersion;
     addr = mnb.addr;
+    mnodeman.InvalidateRanks();
     nPoSeBanScore = 0;
     nPoSeBanHeight = 0;
     nTimeLastChecked = 0;
@@ -101,33 +107,133 @@ arith_uint256 CSmartnode::CalculateScore(const uint256& blockHash)
     return UintToArith256(ss.GetHash());
 }
 
+static void CalculateScoreRange(std::vector<std::pair<arith_uint256, CSmartnode*> >& vecScores, size_t nBegin, size_t nEnd, const uint256& blockHash)
+{
+    // outpoint, nCollateralMinConfBlockHash and blockHash as serialized by CalculateScore()
+    unsigned char buf[36 + 32 + 32];
+    memcpy(buf + 68, blockHash.begin(), 32);
+
+    uint256 hash;
+
+    for (size_t i = nBegin; i < nEnd; i++) {
+        const CSmartnode* pmn = vecScores[i].second;
+        memcpy(buf, pmn->vin.prevout.hash.begin(), 32);
+        WriteLE32(buf + 32, pmn->vin.prevout.n);
+        memcpy(buf + 36, pmn->nCollateralMinConfBlockHash.begin(), 32);
+        CSHA256().Write(buf, sizeof(buf)).Finalize(hash.begin());
+        vecScores[i].first = UintToArith256(hash);
+    }
+}
+
+void CSmartnode::CalculateScores(std::vector<std::pair<arith_uint256, CSmartnode*> >& vecScores, const uint256& blockHash)
+{
+    size_t nThreads = std::min<size_t>(std::max(GetNumCores(), 1), vecScores.size() / SMARTNODE_SCORES_PER_THREAD);
+
+    if (nThreads <= 1) {
+        CalculateScoreRange(vecScores, 0, vecScores.size(), blockHash);
+        return;
+    }
+
+    size_t nChunk = (vecScores.size() + nThreads - 1) / nThreads;
+    std::vector<std::thread> vecThreads;
+
+    for (size_t nBegin = nChunk; nBegin < vecScores.size(); nBegin += nChunk) {
+        size_t nEnd = std::min(nBegin + nChunk, vecScores.size());
+        vecThreads.push_back(std::thread(CalculateScoreRange, std::ref(vecScores), nBegin, nEnd, std::cref(blockHash)));
+    }
+
+    CalculateScoreRange(vecScores, 0, nChunk, blockHash);
+
+    for (auto& thread : vecThreads) thread.join();
+}
+
 CSmartnode::CollateralStatus CSmartnode::CheckCollateral(const COutPoint& outpoint)
 {
     int nHeight;
     return CheckCollateral(outpoint, nHeight);
 }
 
+// collateral lookups at pindexCollateralCache, guarded by cs_main
+static const CBlockIndex* pindexCollateralCache = NULL;
+static std::unordered_map<COutPoint, std::pair<CSmartnode::CollateralStatus, int>, SaltedOutpointHasher> mapCollateralCache;
+
 CSmartnode::CollateralStatus CSmartnode::CheckCollateral(const COutPoint& outpoint, int& nHeightRet)
 {
     AssertLockHeld(cs_main);
 
-    Coin coin;
-    if(!GetUTXOCoin(outpoint, coin)) {
-        return COLLATERAL_UTXO_NOT_FOUND;
+    // the UTXO set only changes together with the tip
+    if(pindexCollateralCache != chainActive.Tip() || mapCollateralCache.size() >= SMARTNODE_COLLATERAL_CACHE_SIZE) {
+        mapCollateralCache.clear();
+        pindexCollateralCache = chainActive.Tip();
     }
 
-    if(coin.out.nValue != SMARTNODE_COIN_REQUIRED * COIN) {
-        return COLLATERAL_INVALID_AMOUNT;
+    auto it = mapCollateralCache.find(outpoint);
+    if(it == mapCollateralCache.end()) {
+        // read the coin in place, its script is not needed
+        const Coin& coin = pcoinsTip->AccessCoin(outpoint);
+        CollateralStatus status = COLLATERAL_OK;
+        if(coin.IsSpent()) {
+            status = COLLATERAL_UTXO_NOT_FOUND;
+        } else if(coin.out.nValue != SMARTNODE_COIN_REQUIRED * COIN) {
+            status = COLLATERAL_INVALID_AMOUNT;
+        }
+        it = mapCollateralCache.emplace(outpoint, std::make_pair(status, coin.IsSpent() ? -1 : (int)coin.nHeight)).first;
     }
 
-    nHeightRet = coin.nHeight;
-    return COLLATERAL_OK;
+    if(it->second.first != COLLATERAL_UTXO_NOT_FOUND) nHeightRet = it->second.second;
+    return it->second.first;
+}
+
+void CSmartnode::CheckCollaterals(const std::vector<COutPoint>& vecOutpoints, std::vector<CollateralStatus>& vecStatusRet, std::vector<int>& vecHeightRet)
+{
+    AssertLockHeld(cs_main);
+
+    vecStatusRet.assign(vecOutpoints.size(), COLLATERAL_UTXO_NOT_FOUND);
+    vecHeightRet.assign(vecOutpoints.size(), -1);
+    for (size_t i = 0; i < vecOutpoints.size(); i++) {
+        vecStatusRet[i] = CheckCollateral(vecOutpoints[i], vecHeightRet[i]);
+    }
 }
 
 void CSmartnode::Check(bool fForce)
 {
     LOCK(cs);
 
+    int nActiveStateOld = nActiveState;
+
+    CheckState(fForce);
+
+    // ranks only count enabled smartnodes
+    if(nActiveState != nActiveStateOld) mnodeman.InvalidateRanks();
+}
+
+void CSmartnode::SetCollateralStatus(CollateralStatus status)
+{
+    LOCK(cs);
+
+    if(fCollateralChecked || IsOutpointSpent()) return;
+
+    if(status == COLLATERAL_UTXO_NOT_FOUND) {
+        nActiveState = SMARTNODE_OUTPOINT_SPENT;
+        LogPrint("smartnode", "CSmartnode::SetCollateralStatus -- Failed to find Smartnode UTXO, smartnode=%s\n", vin.prevout.ToStringShort());
+        return;
+    }
+
+    fCollateralChecked = true;
+}
+
+void CSmartnode::SetCollateralSpent()
+{
+    LOCK(cs);
+
+    if(IsOutpointSpent()) return;
+
+    nActiveState = SMARTNODE_OUTPOINT_SPENT;
+    LogPrint("smartnode", "CSmartnode::SetCollateralSpent -- Smartnode UTXO spent, smartnode=%s\n", vin.prevout.ToStringShort());
+}
+
+void CSmartnode::CheckState(bool fForce)
+{
     if(ShutdownRequested()) return;
 
     if(!fForce && (GetTime() - nTimeLastChecked < SMARTNODE_CHECK_SECONDS)) return;
@@ -138,8 +244,8 @@ void CSmartnode::Check(bool fForce)
     //once spent, stop doing the checks
     if(IsOutpointSpent()) return;
 
-    int nHeight = 0;
-    if(!fUnitTest) {
+    // only look the collateral up once, blocks spending it are reported after that
+    if(!fUnitTest && !fCollateralChecked) {
         TRY_LOCK(cs_main, lockMain);
         if(!lockMain) return;
 
@@ -150,6 +256,13 @@ void CSmartnode::Check(bool fForce)
             return;
         }
 
+        fCollateralChecked = true;
+    }
+
+    int nHeight = 0;
+    if(!fUnitTest && (IsPoSeBanned() || nPoSeBanScore >= SMARTNODE_POSE_BAN_MAX_SCORE)) {
+        TRY_LOCK(cs_main, lockMain);
+        if(!lockMain) return;
         nHeight = chainActive.Height();
     }
 
@@ -251,7 +364,7 @@ bool CSmartnode::IsInputAssociatedWithPubkey()
     CTransaction tx;
     uint256 hash;
     if(GetTransaction(vin.prevout.hash, tx, Params().GetConsensus(), hash, true)) {
-        BOOST_FOREACH(CTxOut out, tx.vout)
+        BOOST_FOREACH(const CTxOut& out, tx.vout)
             if(out.nValue == SMARTNODE_COIN_REQUIRED*COIN && out.scriptPubKey == payee) return true;
     }
 
@@ -314,11 +427,8 @@ void CSmartnode::UpdateLastPaid(const CBlockIndex *pindex, int nMaxBlocksToScanB
     CScript mnpayee = GetScriptForDestination(pubKeyCollateralAddress.GetID());
     // LogPrint("smartnode", "CSmartnode::UpdateLastPaidBlock -- searching for block with payment to %s\n", vin.prevout.ToStringShort());
 
-    LOCK(cs_mapSmartnodeBlocks);
-
     for (int i = 0; BlockReading && BlockReading->nHeight > nBlockLastPaid && i < nMaxBlocksToScanBack; i++) {
-        if(mnpayments.mapSmartnodeBlocks.count(BlockReading->nHeight) &&
-            mnpayments.mapSmartnodeBlocks[BlockReading->nHeight].HasPayeeWithVotes(mnpayee, 2))
+        if(mnpayments.HasPayeeWithVotes(BlockReading->nHeight, mnpayee, 2))
         {
             CBlock block;
             if(!ReadBlockFromDisk(block, BlockReading, Params().GetConsensus())) // shouldn't really happen
@@ -326,7 +436,7 @@ void CSmartnode::UpdateLastPaid(const CBlockIndex *pindex, int nMaxBlocksToScanB
 
             CAmount nSmartnodePayment = SmartNodePayments::Payment(BlockReading->nHeight) / SmartNodePayments::PayoutsPerBlock(BlockReading->nHeight);
 
-            BOOST_FOREACH(CTxOut txout, block.vtx[0].vout)
+            BOOST_FOREACH(const CTxOut& txout, block.vtx[0].vout)
                 if(mnpayee == txout.scriptPubKey && nSmartnodePayment == txout.nValue) {
                     nBlockLastPaid = BlockReading->nHeight;
                     nTimeLastPaid = BlockReading->nTime;
@@ -607,16 +717,20 @@ bool CSmartnodeBroadcast::CheckOutpoint(int& nDos)
     return true;
 }
 
+std::string CSmartnodeBroadcast::GetSignatureMessage() const
+{
+    return addr.ToString(false) + boost::lexical_cast<std::string>(sigTime) +
+            pubKeyCollateralAddress.GetID().ToString() + pubKeySmartnode.GetID().ToString() +
+            boost::lexical_cast<std::string>(nProtocolVersion);
+}
+
 bool CSmartnodeBroadcast::Sign(const CKey& keyCollateralAddress)
 {
     std::string strError;
-    std::string strMessage;
 
     sigTime = GetAdjustedTime();
 
-    strMessage = addr.ToString(false) + boost::lexical_cast<std::string>(sigTime) +
-                    pubKeyCollateralAddress.GetID().ToString() + pubKeySmartnode.GetID().ToString() +
-                    boost::lexical_cast<std::string>(nProtocolVersion);
+    std::string strMessage = GetSignatureMessage();
 
     if(!CMessageSigner::SignMessage(strMessage, vchSig, keyCollateralAddress)) {
         LogPrintf("CSmartnodeBroadcast::Sign -- SignMessage() failed\n");
@@ -633,14 +747,10 @@ bool CSmartnodeBroadcast::Sign(const CKey& keyCollateralAddress)
 
 bool CSmartnodeBroadcast::CheckSignature(int& nDos)
 {
-    std::string strMessage;
+    std::string strMessage = GetSignatureMessage();
     std::string strError = "";
     nDos = 0;
 
-    strMessage = addr.ToString(false) + boost::lexical_cast<std::string>(sigTime) +
-                    pubKeyCollateralAddress.GetID().ToString() + pubKeySmartnode.GetID().ToString() +
-                    boost::lexical_cast<std::string>(nProtocolVersion);
-
     LogPrint("smartnode", "CSmartnodeBroadcast::CheckSignature -- strMessage: %s  pubKeyCollateralAddress address: %s  sig: %s\n", strMessage, CBitcoinAddress(pubKeyCollateralAddress.GetID()).ToString(), EncodeBase64(&vchSig[0], vchSig.size()));
 
     if(!CMessageSigner::VerifyMessage(pubKeyCollateralAddress, vchSig, strMessage, strError)){
@@ -674,14 +784,19 @@ CSmartnodePing::CSmartnodePing(const COutPoint& outpoint)
     sigTime = GetAdjustedTime();
 }
 
+std::string CSmartnodePing::GetSignatureMessage() const
+{
+    // TODO: add sentinel data
+    return vin.ToString() + blockHash.ToString() + boost::lexical_cast<std::string>(sigTime);
+}
+
 bool CSmartnodePing::Sign(const CKey& keySmartnode, const CPubKey& pubKeySmartnode)
 {
     std::string strError;
     std::string strSmartNodeSignMessage;
 
-    // TODO: add sentinel data
     sigTime = GetAdjustedTime();
-    std::string strMessage = vin.ToString() + blockHash.ToString() + boost::lexical_cast<std::string>(sigTime);
+    std::string strMessage = GetSignatureMessage();
 
     if(!CMessageSigner::SignMessage(strMessage, vchSig, keySmartnode)) {
         LogPrintf("CSmartnodePing::Sign -- SignMessage() failed\n");
@@ -698,8 +813,7 @@ bool CSmartnodePing::Sign(const CKey& keySmartnode, const CPubKey& pubKeySmartno
 
 bool CSmartnodePing::CheckSignature(CPubKey& pubKeySmartnode, int &nDos)
 {
-    // TODO: add sentinel data
-    std::string strMessage = vin.ToString() + blockHash.ToString() + boost::lexical_cast<std::string>(sigTime);
+    std::string strMessage = GetSignatureMessage();
     std::string strError = "";
     nDos = 0;
 
@@ -898,8 +1012,11 @@ void ThreadSmartnode(CConnman& connman)
 
             nTick++;
 
-            // make sure to check all smartnodes first
-            mnodeman.Check();
+            // pings and spent collaterals update a smartnode right away, only
+            // the expiry times need these checks, each node waits SMARTNODE_CHECK_SECONDS
+            // between them anyway
+            if(nTick % SMARTNODE_CHECK_SECONDS == 1)
+                mnodeman.Check();
 
             // check if we should activate or ping every few minutes,
             // slightly postpone first run to give net thread a chance to connect to some peers
@@ -23,6 +23,11 @@ static const int SMARTNODE_COIN_REQUIRED  = 10000;
 
 static const int SMARTNODE_POSE_BAN_MAX_SCORE          = 5;
 
+// smallest share of a score batch worth its own thread
+static const size_t SMARTNODE_SCORES_PER_THREAD        = 1000;
+// collateral lookups remembered for the current tip, the cache starts over when it grows past this
+static const size_t SMARTNODE_COLLATERAL_CACHE_SIZE     = 100000;
+
 //
 // The Smartnode Ping Class : Contains a different serialize method for sending pings from smartnodes throughout the network
 //
@@ -73,6 +78,7 @@ public:
 
     bool IsExpired() const { return GetAdjustedTime() - sigTime > SMARTNODE_NEW_START_REQUIRED_SECONDS; }
 
+    std::string GetSignatureMessage() const;
     bool Sign(const CKey& keySmartnode, const CPubKey& pubKeySmartnode);
     bool CheckSignature(CPubKey& pubKeySmartnode, int &nDos);
     bool SimpleCheck(int& nDos);
@@ -135,6 +141,8 @@ private:
     // critical section to protect the inner data structures
     mutable CCriticalSection cs;
 
+    void CheckState(bool fForce);
+
 public:
     enum state {
         SMARTNODE_PRE_ENABLED,
@@ -163,6 +171,8 @@ public:
     int nPoSeBanHeight{};
     bool fAllowMixingTx{};
     bool fUnitTest = false;
+    // collateral found in the UTXO set, spends after that get reported by CSmartnodeMan::CheckSpentCollaterals
+    bool fCollateralChecked = false;
 
     // KEEP TRACK OF GOVERNANCE ITEMS EACH SMARTNODE HAS VOTE UPON FOR RECALCULATION
     std::map<uint256, int> mapGovernanceObjectsVotedOn;
@@ -201,12 +211,21 @@ public:
 
     // CALCULATE A RANK AGAINST OF GIVEN BLOCK
     arith_uint256 CalculateScore(const uint256& blockHash);
+    // CalculateScore() for the smartnode of every pair, large batches get split over all cores
+    static void CalculateScores(std::vector<std::pair<arith_uint256, CSmartnode*> >& vecScores, const uint256& blockHash);
 
     bool UpdateFromNewBroadcast(CSmartnodeBroadcast& mnb, CConnman& connman);
 
+    // results are cached until the tip changes, nHeightRet is set whenever the UTXO is found
     static CollateralStatus CheckCollateral(const COutPoint& outpoint);
     static CollateralStatus CheckCollateral(const COutPoint& outpoint, int& nHeightRet);
+    // CheckCollateral() for every outpoint, cs_main must be held so they are all resolved in one acquisition
+    static void CheckCollaterals(const std::vector<COutPoint>& vecOutpoints, std::vector<CollateralStatus>& vecStatusRet, std::vector<int>& vecHeightRet);
     void Check(bool fForce = false);
+    void SetCollateralSpent();
+    bool IsCollateralCheckPending() { LOCK(cs); return !fUnitTest && !fCollateralChecked && !IsOutpointSpent(); }
+    // take the result of a collateral lookup done for this smartnode by CSmartnodeMan::Check
+    void SetCollateralStatus(CollateralStatus status);
 
     bool IsBroadcastedWithin(int nSeconds) { return GetAdjustedTime() - sigTime < nSeconds; }
 
@@ -292,6 +311,7 @@ public:
         nPoSeBanHeight = from.nPoSeBanHeight;
         fAllowMixingTx = from.fAllowMixingTx;
         fUnitTest = from.fUnitTest;
+        fCollateralChecked = from.fCollateralChecked;
         mapGovernanceObjectsVotedOn = from.mapGovernanceObjectsVotedOn;
         return *this;
     }
@@ -353,6 +373,7 @@ public:
     bool Update(CSmartnode* pmn, int& nDos, CConnman& connman);
     bool CheckOutpoint(int& nDos);
 
+    std::string GetSignatureMessage() const;
     bool Sign(const CKey& keyCollateralAddress);
     bool CheckSignature(int& nDos);
     void Relay(CConnman& connman);
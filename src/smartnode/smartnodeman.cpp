@@ -4,6 +4,7 @@
 
 #include "activesmartnode.h"
 #include "../addrman.h"
+#include "../base58.h"
 //#include "governance.h"
 #include "../messagesigner.h"
 #include "script/standard.h"
@@ -11,22 +12,17 @@
 #include "smartnodesync.h"
 #include "smartnodeman.h"
 #include "netfulfilledman.h"
+#include "../trace.h"
 #include "../util.h"
+#include "../validationinterface.h"
+
+#include <iomanip>
 
 /** Smartnode manager */
 CSmartnodeMan mnodeman;
 
 const std::string CSmartnodeMan::SERIALIZATION_VERSION_STRING = "CSmartnodeMan-Version-4";
 
-struct CompareLastPaidBlock
-{
-    bool operator()(const std::pair<int, CSmartnode*>& t1,
-                    const std::pair<int, CSmartnode*>& t2) const
-    {
-        return (t1.first != t2.first) ? (t1.first < t2.first) : (t1.second->vin < t2.second->vin);
-    }
-};
-
 struct CompareScoreMN
 {
     bool operator()(const std::pair<arith_uint256, CSmartnode*>& t1,
@@ -69,6 +65,11 @@ CSmartnodeMan::CSmartnodeMan()
   fSmartnodesRemoved(false),
   vecDirtyGovernanceObjectHashes(),
   nLastWatchdogVoteTime(0),
+  nListVersion(0),
+  nRankCacheVersion(0),
+  listRankCache(),
+  listSnapshot(),
+  fListSnapshotStale(true),
   mapSeenSmartnodeBroadcast(),
   mapSeenSmartnodePing(),
   nDsqCount(0)
@@ -80,7 +81,10 @@ bool CSmartnodeMan::Add(CSmartnode &mn)
     if (Has(mn.vin.prevout)) return false;
     LogPrint("smartnode", "CSmartnodeMan::Add -- Adding new Smartnode: addr=%s, %i now\n", mn.addr.ToString(), size() + 1);
     mapSmartnodes[mn.vin.prevout] = mn;
+    setLastPaidQueue.insert(std::make_pair(mn.GetLastPaidBlock(), mn.vin.prevout));
     fSmartnodesAdded = true;
+    InvalidateRanks();
+    GetMainSignals().NotifySmartnodeListChanged(mn.vin.prevout, true);
     return true;
 }
 
@@ -90,7 +94,7 @@ void CSmartnodeMan::AskForMN(CNode* pnode, const COutPoint& outpoint, CConnman&
 
     LOCK(cs);
 
-    std::map<COutPoint, std::map<CNetAddr, int64_t> >::iterator it1 = mWeAskedForSmartnodeListEntry.find(outpoint);
+    auto it1 = mWeAskedForSmartnodeListEntry.find(outpoint);
     if (it1 != mWeAskedForSmartnodeListEntry.end()) {
         std::map<CNetAddr, int64_t>::iterator it2 = it1->second.find(pnode->addr);
         if (it2 != it1->second.end()) {
@@ -157,11 +161,50 @@ void CSmartnodeMan::Check()
 
     LogPrint("smartnode", "CSmartnodeMan::Check -- nLastWatchdogVoteTime=%d, IsWatchdogActive()=%d\n", nLastWatchdogVoteTime, IsWatchdogActive());
 
+    // look up the collaterals not checked yet (e.g. after loading the cache) under one cs_main acquisition
+    // instead of one per smartnode in CSmartnode::Check; try only, cs_main is usually taken before cs
+    std::vector<COutPoint> vecOutpoints;
+    for (auto& mnpair : mapSmartnodes) {
+        if(mnpair.second.IsCollateralCheckPending()) vecOutpoints.push_back(mnpair.first);
+    }
+    if(!vecOutpoints.empty()) {
+        std::vector<CSmartnode::CollateralStatus> vecStatus;
+        std::vector<int> vecHeight;
+        {
+            TRY_LOCK(cs_main, lockMain);
+            if(lockMain) CSmartnode::CheckCollaterals(vecOutpoints, vecStatus, vecHeight);
+        }
+        for (size_t i = 0; i < vecStatus.size(); i++) {
+            CSmartnode& mn = mapSmartnodes[vecOutpoints[i]];
+            bool fSpentBefore = mn.IsOutpointSpent();
+            mn.SetCollateralStatus(vecStatus[i]);
+            // the Check below sees no state change for a collateral found spent here
+            if(!fSpentBefore && mn.IsOutpointSpent()) InvalidateRanks();
+        }
+    }
+
     for (auto& mnpair : mapSmartnodes) {
         mnpair.second.Check();
     }
 }
 
+void CSmartnodeMan::CheckSpentCollaterals(const CTransaction& tx)
+{
+    if(tx.IsCoinBase()) return;
+
+    LOCK(cs);
+
+    if(mapSmartnodes.empty()) return;
+
+    for (const auto& txin : tx.vin) {
+        CSmartnode* pmn = Find(txin.prevout);
+        if(pmn == NULL || pmn->IsOutpointSpent()) continue;
+        pmn->SetCollateralSpent();
+        // ranks only count enabled smartnodes
+        InvalidateRanks();
+    }
+}
+
 void CSmartnodeMan::CheckAndRemove(CConnman& connman)
 {
     if(!smartnodeSync.IsSmartnodeListSynced()) return;
@@ -179,7 +222,7 @@ void CSmartnodeMan::CheckAndRemove(CConnman& connman)
         rank_pair_vec_t vecSmartnodeRanks;
         // ask for up to MNB_RECOVERY_MAX_ASK_ENTRIES smartnode entries at a time
         int nAskForMnbRecovery = MNB_RECOVERY_MAX_ASK_ENTRIES;
-        std::map<COutPoint, CSmartnode>::iterator it = mapSmartnodes.begin();
+        auto it = mapSmartnodes.begin();
         while (it != mapSmartnodes.end()) {
             CSmartnodeBroadcast mnb = CSmartnodeBroadcast(it->second);
             uint256 hash = mnb.GetHash();
@@ -193,8 +236,12 @@ void CSmartnodeMan::CheckAndRemove(CConnman& connman)
 
                 // and finally remove it from the list
                 it->second.FlagGovernanceItemsAsDirty();
+                setLastPaidQueue.erase(std::make_pair(it->second.GetLastPaidBlock(), it->first));
+                COutPoint outpoint = it->first;
                 mapSmartnodes.erase(it++);
                 fSmartnodesRemoved = true;
+                InvalidateRanks();
+                GetMainSignals().NotifySmartnodeListChanged(outpoint, false);
             } else {
                 bool fAsk = (nAskForMnbRecovery > 0) &&
                             smartnodeSync.IsSynced() &&
@@ -287,7 +334,7 @@ void CSmartnodeMan::CheckAndRemove(CConnman& connman)
         }
 
         // check which Smartnodes we've asked for
-        std::map<COutPoint, std::map<CNetAddr, int64_t> >::iterator it2 = mWeAskedForSmartnodeListEntry.begin();
+        auto it2 = mWeAskedForSmartnodeListEntry.begin();
         while(it2 != mWeAskedForSmartnodeListEntry.end()){
             std::map<CNetAddr, int64_t>::iterator it3 = it2->second.begin();
             while(it3 != it2->second.end()){
@@ -316,7 +363,7 @@ void CSmartnodeMan::CheckAndRemove(CConnman& connman)
         // NOTE: do not expire mapSeenSmartnodeBroadcast entries here, clean them on mnb updates!
 
         // remove expired mapSeenSmartnodePing
-        std::map<uint256, CSmartnodePing>::iterator it4 = mapSeenSmartnodePing.begin();
+        auto it4 = mapSeenSmartnodePing.begin();
         while(it4 != mapSeenSmartnodePing.end()){
             if((*it4).second.IsExpired()) {
                 LogPrint("smartnode", "CSmartnodeMan::CheckAndRemove -- Removing expired Smartnode ping: hash=%s\n", (*it4).second.GetHash().ToString());
@@ -349,6 +396,9 @@ void CSmartnodeMan::Clear()
 {
     LOCK(cs);
     mapSmartnodes.clear();
+    setLastPaidQueue.clear();
+    InvalidateRanks();
+    fListSnapshotStale = true;
     mAskedUsForSmartnodeList.clear();
     mWeAskedForSmartnodeList.clear();
     mWeAskedForSmartnodeListEntry.clear();
@@ -411,7 +461,7 @@ int CSmartnodeMan::CountByIP(int nNetworkType)
 }
 */
 
-void CSmartnodeMan::DsegUpdate(CNode* pnode, CConnman& connman)
+void CSmartnodeMan::DsegUpdate(CNode* pnode, CConnman& connman, int nPart, int nParts)
 {
     LOCK(cs);
 
@@ -425,11 +475,20 @@ void CSmartnodeMan::DsegUpdate(CNode* pnode, CConnman& connman)
         }
     }
 
-    connman.PushMessage(pnode, NetMsgType::DSEG, CTxIn());
+    if(nParts > 1) {
+        connman.PushMessage(pnode, NetMsgType::DSEG, CTxIn(), nPart, nParts);
+    } else {
+        connman.PushMessage(pnode, NetMsgType::DSEG, CTxIn());
+    }
     int64_t askAgain = GetTime() + DSEG_UPDATE_SECONDS;
     mWeAskedForSmartnodeList[pnode->addr] = askAgain;
 
-    LogPrint("smartnode", "CSmartnodeMan::DsegUpdate -- asked %s for the list\n", pnode->addr.ToString());
+    LogPrint("smartnode", "CSmartnodeMan::DsegUpdate -- asked %s for the list, part %d of %d\n", pnode->addr.ToString(), nPart + 1, nParts);
+}
+
+bool CSmartnodeMan::IsInListPart(const COutPoint& outpoint, int nPart, int nParts)
+{
+    return nParts <= 1 || (int)(outpoint.hash.GetCheapHash() % nParts) == nPart;
 }
 
 CSmartnode* CSmartnodeMan::Find(const COutPoint &outpoint)
@@ -515,62 +574,61 @@ bool CSmartnodeMan::GetNextSmartnodesInQueueForPayment(int nBlockHeight, bool fF
     // Need LOCK2 here to ensure consistent locking order because the GetBlockHash call below locks cs_main
     LOCK2(cs_main,cs);
 
-    std::vector<std::pair<int, CSmartnode*> > vecSmartnodeLastPaid;
+    int nMnCount = CountSmartnodes();
+
+    // Look at 1/10 of the oldest nodes (by last payment), calculate their scores and pay the best one
+    //  -- This doesn't look at who is being paid in the +8-10 blocks, allowing for double payments very rarely
+    //  -- 1/100 payments should be a double payment on mainnet - (1/(3000/10))*2
+    //  -- (chance per block * chances before IsScheduled will fire)
+    int nTenthNetwork = std::max(nMnCount/10, 1);
+    size_t requiredPayees = SmartNodePayments::PayoutsPerBlock(nBlockHeight);
+
+    std::vector<std::pair<arith_uint256, CSmartnode*>> vecTopTenthScores;
 
     /*
-        Make a vector with all of the last paid times
+        Walk the smartnodes from the longest unpaid one on, the first tenth
+        of them that qualifies gets scored, the rest only gets counted
     */
 
-    int nMnCount = CountSmartnodes();
+    for (const auto& entry : setLastPaidQueue) {
+        auto it = mapSmartnodes.find(entry.second);
+        assert(it != mapSmartnodes.end());
+        CSmartnode& mn = it->second;
 
-    for (auto& mnpair : mapSmartnodes) {
-        if(!mnpair.second.IsValidForPayment()) continue;
+        if(!mn.IsValidForPayment()) continue;
 
         //check protocol version
-        if(mnpair.second.nProtocolVersion < mnpayments.GetMinSmartnodePaymentsProto()) continue;
+        if(mn.nProtocolVersion < mnpayments.GetMinSmartnodePaymentsProto()) continue;
 
         //it's in the list (up to 8 entries ahead of current block to allow propagation) -- so let's skip it
-        if(mnpayments.IsScheduled(mnpair.second, nBlockHeight)) continue;
+        if(mnpayments.IsScheduled(mn, nBlockHeight)) continue;
 
         //it's too new, wait for a cycle
-        if(fFilterSigTime && mnpair.second.sigTime + (nMnCount*55) > GetAdjustedTime()) continue;
+        if(fFilterSigTime && mn.sigTime + (nMnCount*55) > GetAdjustedTime()) continue;
 
         //make sure it has at least as many confirmations as there are smartnodes
-        if(GetUTXOConfirmations(mnpair.first) < nMnCount) continue;
+        int nCollateralHeight;
+        if(CSmartnode::CheckCollateral(entry.second, nCollateralHeight) == CSmartnode::COLLATERAL_UTXO_NOT_FOUND ||
+           chainActive.Height() - nCollateralHeight + 1 < nMnCount) continue;
 
-        vecSmartnodeLastPaid.push_back(std::make_pair(mnpair.second.GetLastPaidBlock(), &mnpair.second));
-    }
+        nCountRet++;
 
-    nCountRet = (int)vecSmartnodeLastPaid.size();
+        if((int)vecTopTenthScores.size() < nTenthNetwork)
+            vecTopTenthScores.push_back(std::make_pair(arith_uint256(), &mn));
+    }
 
     //when the network is in the process of upgrading, don't penalize nodes that recently restarted
     if(fFilterSigTime && nCountRet < nMnCount/3)
         return GetNextSmartnodesInQueueForPayment(nBlockHeight, false, nCountRet, mnInfoRet);
 
-    // Sort them low to high
-    sort(vecSmartnodeLastPaid.begin(), vecSmartnodeLastPaid.end(), CompareLastPaidBlock());
-
     uint256 blockHash;
     if(!GetBlockHash(blockHash, nBlockHeight - 101)) {
         LogPrintf("CSmartnode::GetNextSmartnodesInQueueForPayment -- ERROR: GetBlockHash() failed at nBlockHeight %d\n", nBlockHeight - 101);
         return false;
     }
-    // Look at 1/10 of the oldest nodes (by last payment), calculate their scores and pay the best one
-    //  -- This doesn't look at who is being paid in the +8-10 blocks, allowing for double payments very rarely
-    //  -- 1/100 payments should be a double payment on mainnet - (1/(3000/10))*2
-    //  -- (chance per block * chances before IsScheduled will fire)
-    int nTenthNetwork = nMnCount/10;
-    int nCountTenth = 0;
-    size_t requiredPayees = SmartNodePayments::PayoutsPerBlock(nBlockHeight);
 
-    std::vector<std::pair<arith_uint256, CSmartnode*>> vecTopTenthScores;
-
-    for (const auto& s : vecSmartnodeLastPaid) {
-        arith_uint256 nScore = s.second->CalculateScore(blockHash);
-        vecTopTenthScores.push_back(std::make_pair(nScore,s.second));
-        nCountTenth++;
-        if(nCountTenth >= nTenthNetwork) break;
-    }
+    CSmartnode::CalculateScores(vecTopTenthScores, blockHash);
+    TRACE4(smartnode, payment_queue, nBlockHeight, nMnCount, nCountRet, vecTopTenthScores.size());
 
     std::sort(vecTopTenthScores.begin(), vecTopTenthScores.end(), CompareScoreMN());
 
@@ -604,10 +662,12 @@ bool CSmartnodeMan::GetSmartnodeScores(const uint256& nBlockHash, CSmartnodeMan:
     // calculate scores
     for (auto& mnpair : mapSmartnodes) {
         if (mnpair.second.nProtocolVersion >= nMinProtocol) {
-            vecSmartnodeScoresRet.push_back(std::make_pair(mnpair.second.CalculateScore(nBlockHash), &mnpair.second));
+            vecSmartnodeScoresRet.push_back(std::make_pair(arith_uint256(), &mnpair.second));
         }
     }
 
+    CSmartnode::CalculateScores(vecSmartnodeScoresRet, nBlockHash);
+
     sort(vecSmartnodeScoresRet.rbegin(), vecSmartnodeScoresRet.rend(), CompareScoreMN());
     return !vecSmartnodeScoresRet.empty();
 }
@@ -619,22 +679,177 @@ bool CSmartnodeMan::GetSmartnodeRank(const COutPoint& outpoint, int& nRankRet, i
     if (!smartnodeSync.IsSmartnodeListSynced())
         return false;
 
-    CSmartnodeMan::rank_pair_vec_t vecSmartnodeRanks;
-    if (!GetSmartnodeRanks(vecSmartnodeRanks, nBlockHeight, nMinProtocol))
+    LOCK2(cs_main,cs);
+
+    // make sure we know about this block
+    uint256 nBlockHash = uint256();
+    if (!GetBlockHash(nBlockHash, nBlockHeight)) {
+        LogPrintf("CSmartnodeMan::%s -- ERROR: GetBlockHash() failed at nBlockHeight %d\n", __func__, nBlockHeight);
+        return false;
+    }
+
+    const CRankTable* pRanks = GetRankTable(nBlockHash, nMinProtocol);
+    if (!pRanks)
         return false;
 
-    auto hasRank = std::find_if(vecSmartnodeRanks.begin(), vecSmartnodeRanks.end(), [outpoint](const CSmartnodeMan::rank_pair_t &rankPair) -> bool {
-        return outpoint == rankPair.second.vin.prevout;
-    });
+    auto hasRank = pRanks->mapRanks.find(outpoint);
 
-    if( hasRank != vecSmartnodeRanks.end() ){
-        nRankRet = hasRank->first;
+    if( hasRank != pRanks->mapRanks.end() ){
+        nRankRet = hasRank->second;
         return true;
     }
 
     return false;
 }
 
+const CSmartnodeMan::CRankTable* CSmartnodeMan::GetRankTable(const uint256& nBlockHash, int nMinProtocol)
+{
+    AssertLockHeld(cs);
+
+    // read the version before scoring so that changes while scoring drop the new table again
+    int nVersion = nListVersion;
+    if (nVersion != nRankCacheVersion) {
+        listRankCache.clear();
+        nRankCacheVersion = nVersion;
+    }
+
+    for (std::list<CRankTable>::iterator it = listRankCache.begin(); it != listRankCache.end(); ++it) {
+        if (it->nBlockHash == nBlockHash && it->nMinProtocol == nMinProtocol) {
+            listRankCache.splice(listRankCache.begin(), listRankCache, it);
+            return &listRankCache.front();
+        }
+    }
+
+    score_pair_vec_t vecSmartnodeScores;
+    if (!GetSmartnodeScores(nBlockHash, vecSmartnodeScores, nMinProtocol))
+        return NULL;
+
+    listRankCache.push_front(CRankTable());
+    CRankTable& ranks = listRankCache.front();
+    ranks.nBlockHash = nBlockHash;
+    ranks.nMinProtocol = nMinProtocol;
+    ranks.mapRanks.reserve(vecSmartnodeScores.size());
+
+    // same ranks as GetSmartnodeRanks()
+    int nRank = 0;
+    for (auto& scorePair : vecSmartnodeScores) {
+        ranks.mapRanks[scorePair.second->vin.prevout] = scorePair.second->IsEnabled() ? ++nRank : MNPAYMENTS_NO_RANK;
+    }
+
+    TRACE3(smartnode, rank_table, nBlockHash.begin(), nMinProtocol, vecSmartnodeScores.size());
+
+    if (listRankCache.size() > RANK_CACHE_SIZE)
+        listRankCache.pop_back();
+
+    return &ranks;
+}
+
+CSmartnodeListEntry::CSmartnodeListEntry(CSmartnode& mn) :
+    outpoint(mn.vin.prevout),
+    strOutpoint(mn.vin.prevout.ToStringShort()),
+    strStatus(mn.GetStatus()),
+    nProtocolVersion(mn.nProtocolVersion),
+    strPayee(CBitcoinAddress(mn.pubKeyCollateralAddress.GetID()).ToString()),
+    strAddr(mn.addr.ToString()),
+    strPubKey(HexStr(mn.pubKeySmartnode)),
+    nLastSeen(mn.lastPing.sigTime),
+    nActiveSeconds(mn.lastPing.sigTime - mn.sigTime),
+    nLastPaidTime(mn.GetLastPaidTime()),
+    nLastPaidBlock(mn.GetLastPaidBlock()),
+    nChangedHeight(0)
+{
+    std::ostringstream streamFull;
+    streamFull << std::setw(18) <<
+                   strStatus << " " <<
+                   nProtocolVersion << " " <<
+                   strPayee << " " <<
+                   nLastSeen << " " << std::setw(8) <<
+                   nActiveSeconds << " " << std::setw(10) <<
+                   nLastPaidTime << " "  << std::setw(6) <<
+                   nLastPaidBlock << " " <<
+                   strAddr;
+    strFull = streamFull.str();
+
+    std::ostringstream streamInfo;
+    streamInfo << std::setw(18) <<
+                   strStatus << " " <<
+                   nProtocolVersion << " " <<
+                   strPayee << " " <<
+                   nLastSeen << " " << std::setw(8) <<
+                   nActiveSeconds << " " <<
+                   SafeIntVersionToString(mn.lastPing.nSentinelVersion) << " "  <<
+                   (mn.lastPing.fSentinelIsCurrent ? "current" : "expired") << " " <<
+                   strAddr;
+    strInfo = streamInfo.str();
+}
+
+bool CSmartnodeListEntry::IsSameAs(const CSmartnodeListEntry& other) const
+{
+    // The other values are all part of the info or full line
+    return outpoint == other.outpoint && strPubKey == other.strPubKey &&
+           strFull == other.strFull && strInfo == other.strInfo;
+}
+
+std::shared_ptr<const CSmartnodeListSnapshot> CSmartnodeMan::GetListSnapshot(const CBlockIndex* pindex)
+{
+    {
+        LOCK(cs);
+        if (listSnapshot && !fListSnapshotStale)
+            return listSnapshot;
+    }
+
+    UpdateLastPaid(pindex);
+
+    LOCK(cs);
+    if (listSnapshot && !fListSnapshotStale)
+        return listSnapshot;
+
+    std::shared_ptr<const CSmartnodeListSnapshot> prev = listSnapshot;
+    std::shared_ptr<CSmartnodeListSnapshot> snapshot = std::make_shared<CSmartnodeListSnapshot>();
+    snapshot->nHeight = prev ? std::max(nCachedBlockHeight, prev->nHeight) : nCachedBlockHeight;
+
+    snapshot->vEntries.reserve(mapSmartnodes.size());
+    for (auto& mnpair : mapSmartnodes) {
+        snapshot->vEntries.push_back(CSmartnodeListEntry(mnpair.second));
+    }
+    std::sort(snapshot->vEntries.begin(), snapshot->vEntries.end());
+
+    // Carry the heights of unchanged entries over and note the removed ones,
+    // by walking both sorted lists side by side
+    if (prev) {
+        std::vector<CSmartnodeListEntry>::iterator it = snapshot->vEntries.begin();
+        std::vector<CSmartnodeListEntry>::const_iterator itPrev = prev->vEntries.begin();
+        while (it != snapshot->vEntries.end() || itPrev != prev->vEntries.end()) {
+            if (itPrev == prev->vEntries.end() || (it != snapshot->vEntries.end() && *it < *itPrev)) {
+                (it++)->nChangedHeight = snapshot->nHeight;
+            } else if (it == snapshot->vEntries.end() || *itPrev < *it) {
+                snapshot->mapRemoved[(itPrev++)->outpoint] = snapshot->nHeight;
+            } else {
+                it->nChangedHeight = it->IsSameAs(*itPrev) ? itPrev->nChangedHeight : snapshot->nHeight;
+                ++it;
+                ++itPrev;
+            }
+        }
+
+        snapshot->nRemovedSince = std::max(prev->nRemovedSince, snapshot->nHeight - CSmartnodeListSnapshot::REMOVED_DEPTH);
+        for (const auto& removed : prev->mapRemoved) {
+            if (removed.second > snapshot->nRemovedSince && !mapSmartnodes.count(removed.first))
+                snapshot->mapRemoved.insert(removed);
+        }
+    } else {
+        for (CSmartnodeListEntry& entry : snapshot->vEntries)
+            entry.nChangedHeight = snapshot->nHeight;
+        snapshot->nRemovedSince = snapshot->nHeight;
+    }
+
+    LogPrint("smartnode", "CSmartnodeMan::GetListSnapshot -- nHeight=%d, entries=%d, removed=%d\n",
+             snapshot->nHeight, snapshot->vEntries.size(), snapshot->mapRemoved.size());
+
+    listSnapshot = snapshot;
+    fListSnapshotStale = false;
+    return listSnapshot;
+}
+
 bool CSmartnodeMan::GetSmartnodeRanks(CSmartnodeMan::rank_pair_vec_t& vecSmartnodeRanksRet, int nBlockHeight, int nMinProtocol)
 {
     vecSmartnodeRanksRet.clear();
@@ -642,7 +857,7 @@ bool CSmartnodeMan::GetSmartnodeRanks(CSmartnodeMan::rank_pair_vec_t& vecSmartno
     if (!smartnodeSync.IsSmartnodeListSynced())
         return false;
 
-    LOCK2(cs,cs_main);
+    LOCK2(cs_main,cs);
 
     // make sure we know about this block
     uint256 nBlockHash = uint256();
@@ -800,8 +1015,18 @@ void CSmartnodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataS
 
         CTxIn vin;
         vRecv >> vin;
+        // Optional, see DsegUpdate
+        int nPart = 0;
+        int nParts = 1;
+        if (!vRecv.empty()) {
+            vRecv >> nPart >> nParts;
+            if (nParts < 1 || nParts > DSEG_MAX_PARTS || nPart < 0 || nPart >= nParts) {
+                LogPrint("smartnode", "DSEG -- invalid list part %d of %d, peer=%d\n", nPart, nParts, pfrom->id);
+                return;
+            }
+        }
 
-        LogPrint("smartnode", "DSEG -- Smartnode list, smartnode=%s\n", vin.prevout.ToStringShort());
+        LogPrint("smartnode", "DSEG -- Smartnode list, smartnode=%s, part %d of %d\n", vin.prevout.ToStringShort(), nPart + 1, nParts);
 
         if(vin == CTxIn()) { //only should ask for this once
             //local network
@@ -823,6 +1048,7 @@ void CSmartnodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CDataS
 
         for (auto& mnpair : mapSmartnodes) {
             if (vin != CTxIn() && vin != mnpair.second.vin) continue; // asked for specific vin but we are not there yet
+            if (vin == CTxIn() && !IsInListPart(mnpair.first, nPart, nParts)) continue; // another peer sends this one
             if (mnpair.second.addr.IsRFC1918() || mnpair.second.addr.IsLocal()) continue; // do not send local network smartnode
             if (mnpair.second.IsUpdateRequired()) continue; // do not send outdated smartnodes
 
@@ -1015,7 +1241,7 @@ void CSmartnodeMan::CheckSameAddr()
 
 bool CSmartnodeMan::SendVerifyRequest(const CAddress& addr, const std::vector<CSmartnode*>& vSortedByAddr, CConnman& connman)
 {
-    if(netfulfilledman.HasFulfilledRequest(addr, strprintf("%s", NetMsgType::MNVERIFY)+"-request")) {
+    if(netfulfilledman.HasFulfilledRequest(addr, FULFILLED_MNVERIFY_REQUEST)) {
         // we already asked for verification, not a good idea to do this too often, skip it
         LogPrint("smartnode", "CSmartnodeMan::SendVerifyRequest -- too many requests, skipping... addr=%s\n", addr.ToString());
         return false;
@@ -1027,7 +1253,7 @@ bool CSmartnodeMan::SendVerifyRequest(const CAddress& addr, const std::vector<CS
         return false;
     }
 
-    netfulfilledman.AddFulfilledRequest(addr, strprintf("%s", NetMsgType::MNVERIFY)+"-request");
+    netfulfilledman.AddFulfilledRequest(addr, FULFILLED_MNVERIFY_REQUEST);
     // use random nonce, store it and require node to reply with correct one later
     CSmartnodeVerification mnv(addr, GetRandInt(999999), nCachedBlockHeight - 1);
     mWeAskedForVerification[addr] = mnv;
@@ -1046,7 +1272,7 @@ void CSmartnodeMan::SendVerifyReply(CNode* pnode, CSmartnodeVerification& mnv, C
         return;
     }
 
-    if(netfulfilledman.HasFulfilledRequest(pnode->addr, strprintf("%s", NetMsgType::MNVERIFY)+"-reply")) {
+    if(netfulfilledman.HasFulfilledRequest(pnode->addr, FULFILLED_MNVERIFY_REPLY)) {
         // peer should not ask us that often
         LogPrintf("SmartnodeMan::SendVerifyReply -- ERROR: peer already asked me recently, peer=%d\n", pnode->id);
         Misbehaving(pnode->id, 20);
@@ -1074,7 +1300,7 @@ void CSmartnodeMan::SendVerifyReply(CNode* pnode, CSmartnodeVerification& mnv, C
     }
 
     connman.PushMessage(pnode, NetMsgType::MNVERIFY, mnv);
-    netfulfilledman.AddFulfilledRequest(pnode->addr, strprintf("%s", NetMsgType::MNVERIFY)+"-reply");
+    netfulfilledman.AddFulfilledRequest(pnode->addr, FULFILLED_MNVERIFY_REPLY);
 }
 
 void CSmartnodeMan::ProcessVerifyReply(CNode* pnode, CSmartnodeVerification& mnv)
@@ -1082,7 +1308,7 @@ void CSmartnodeMan::ProcessVerifyReply(CNode* pnode, CSmartnodeVerification& mnv
     std::string strError;
 
     // did we even ask for it? if that's the case we should have matching fulfilled request
-    if(!netfulfilledman.HasFulfilledRequest(pnode->addr, strprintf("%s", NetMsgType::MNVERIFY)+"-request")) {
+    if(!netfulfilledman.HasFulfilledRequest(pnode->addr, FULFILLED_MNVERIFY_REQUEST)) {
         LogPrintf("CSmartnodeMan::ProcessVerifyReply -- ERROR: we didn't ask for verification of %s, peer=%d\n", pnode->addr.ToString(), pnode->id);
         Misbehaving(pnode->id, 20);
         return;
@@ -1112,7 +1338,7 @@ void CSmartnodeMan::ProcessVerifyReply(CNode* pnode, CSmartnodeVerification& mnv
     }
 
     // we already verified this address, why node is spamming?
-    if(netfulfilledman.HasFulfilledRequest(pnode->addr, strprintf("%s", NetMsgType::MNVERIFY)+"-done")) {
+    if(netfulfilledman.HasFulfilledRequest(pnode->addr, FULFILLED_MNVERIFY_DONE)) {
         LogPrintf("CSmartnodeMan::ProcessVerifyReply -- ERROR: already verified %s recently\n", pnode->addr.ToString());
         Misbehaving(pnode->id, 20);
         return;
@@ -1132,7 +1358,7 @@ void CSmartnodeMan::ProcessVerifyReply(CNode* pnode, CSmartnodeVerification& mnv
                     if(!mnpair.second.IsPoSeVerified()) {
                         mnpair.second.DecreasePoSeBanScore();
                     }
-                    netfulfilledman.AddFulfilledRequest(pnode->addr, strprintf("%s", NetMsgType::MNVERIFY)+"-done");
+                    netfulfilledman.AddFulfilledRequest(pnode->addr, FULFILLED_MNVERIFY_DONE);
 
                     // we can only broadcast it if we are an activated smartnode
                     if(activeSmartnode.outpoint == COutPoint()) continue;
@@ -1434,7 +1660,13 @@ void CSmartnodeMan::UpdateLastPaid(const CBlockIndex* pindex)
     //                         nCachedBlockHeight, nMaxBlocksToScanBack, IsFirstRun ? "true" : "false");
 
     for (auto& mnpair: mapSmartnodes) {
+        int nBlockLastPaidOld = mnpair.second.GetLastPaidBlock();
         mnpair.second.UpdateLastPaid(pindex, nMaxBlocksToScanBack);
+
+        if (mnpair.second.GetLastPaidBlock() != nBlockLastPaidOld) {
+            setLastPaidQueue.erase(std::make_pair(nBlockLastPaidOld, mnpair.first));
+            setLastPaidQueue.insert(std::make_pair(mnpair.second.GetLastPaidBlock(), mnpair.first));
+        }
     }
 
     IsFirstRun = false;
@@ -1523,6 +1755,11 @@ void CSmartnodeMan::UpdatedBlockTip(const CBlockIndex *pindex)
     nCachedBlockHeight = pindex->nHeight;
     LogPrint("smartnode", "CSmartnodeMan::UpdatedBlockTip -- nCachedBlockHeight=%d\n", nCachedBlockHeight);
 
+    {
+        LOCK(cs);
+        fListSnapshotStale = true;
+    }
+
     CheckSameAddr();
 
     if(fSmartNode) {
@@ -6,8 +6,14 @@
 #define SMARTNODEMAN_H
 
 #include "smartnode.h"
+#include "../coins.h"
 #include "../sync.h"
 
+#include <atomic>
+#include <list>
+#include <memory>
+#include <unordered_map>
+
 using namespace std;
 
 class CSmartnodeMan;
@@ -16,6 +22,49 @@ struct CSmartNodeWinners;
 
 extern CSmartnodeMan mnodeman;
 
+/** One smartnode as listed by smartnodelist, formatted when the snapshot is taken */
+struct CSmartnodeListEntry
+{
+    COutPoint outpoint;
+    std::string strOutpoint;
+    std::string strStatus;
+    int nProtocolVersion;
+    std::string strPayee;
+    std::string strAddr;
+    std::string strPubKey;
+    int64_t nLastSeen;
+    int64_t nActiveSeconds;
+    int64_t nLastPaidTime;
+    int nLastPaidBlock;
+    // 'full' and 'info' lines
+    std::string strFull;
+    std::string strInfo;
+    // height of the first snapshot with these values
+    int nChangedHeight;
+
+    explicit CSmartnodeListEntry(CSmartnode& mn);
+
+    bool operator<(const CSmartnodeListEntry& other) const { return outpoint < other.outpoint; }
+    /// Whether all listed values are the same, regardless of nChangedHeight
+    bool IsSameAs(const CSmartnodeListEntry& other) const;
+};
+
+/** Immutable list of the smartnodes as of one block */
+struct CSmartnodeListSnapshot
+{
+    // number of blocks removals are remembered for, to answer requests for the changes since a height
+    static const int REMOVED_DEPTH = 1440;
+
+    // height of the block it was taken at, never lower than that of the previous snapshot
+    int nHeight;
+    // sorted by outpoint
+    std::vector<CSmartnodeListEntry> vEntries;
+    // smartnodes gone from the list, with the height of the first snapshot missing them
+    std::map<COutPoint, int> mapRemoved;
+    // removals are known for all heights above this one
+    int nRemovedSince;
+};
+
 class CSmartnodeMan
 {
 public:
@@ -28,6 +77,7 @@ private:
     static const std::string SERIALIZATION_VERSION_STRING;
 
     static const int DSEG_UPDATE_SECONDS        = 3 * 60 * 60;
+    static const int DSEG_MAX_PARTS             = 16;
 
     static const int LAST_PAID_SCAN_BLOCKS      = 100;
 
@@ -42,20 +92,32 @@ private:
     static const int MNB_RECOVERY_WAIT_SECONDS      = 60;
     static const int MNB_RECOVERY_RETRY_SECONDS     = 3 * 60 * 60;
 
+    static const int RANK_CACHE_SIZE            = 10;
+
+    // ranks of the smartnodes for one block hash and minimum protocol
+    struct CRankTable
+    {
+        uint256 nBlockHash;
+        int nMinProtocol;
+        std::unordered_map<COutPoint, int, SaltedOutpointHasher> mapRanks;
+    };
+
     // critical section to protect the inner data structures
     mutable CCriticalSection cs;
 
     // Keep track of current block height
     int nCachedBlockHeight;
 
-    // map to hold all MNs
-    std::map<COutPoint, CSmartnode> mapSmartnodes;
+    // map to hold all MNs, nodes don't move so pointers into it stay valid until erased
+    std::unordered_map<COutPoint, CSmartnode, SaltedOutpointHasher> mapSmartnodes;
+    // all MNs ordered by their last paid block, then by outpoint
+    std::set<std::pair<int, COutPoint> > setLastPaidQueue;
     // who's asked for the Smartnode list and the last time
     std::map<CNetAddr, int64_t> mAskedUsForSmartnodeList;
     // who we asked for the Smartnode list and the last time
     std::map<CNetAddr, int64_t> mWeAskedForSmartnodeList;
     // which Smartnodes we've asked for
-    std::map<COutPoint, std::map<CNetAddr, int64_t> > mWeAskedForSmartnodeListEntry;
+    std::unordered_map<COutPoint, std::map<CNetAddr, int64_t>, SaltedOutpointHasher> mWeAskedForSmartnodeListEntry;
     // who we asked for the smartnode verification
     std::map<CNetAddr, CSmartnodeVerification> mWeAskedForVerification;
 
@@ -74,17 +136,30 @@ private:
 
     int64_t nLastWatchdogVoteTime;
 
+    // bumped whenever a smartnode gets added, removed or changes its state
+    std::atomic<int> nListVersion;
+    // nListVersion the cached rank tables belong to
+    int nRankCacheVersion;
+    // most recently used rank table first
+    std::list<CRankTable> listRankCache;
+
+    // list as of the last block it was asked for, and whether a block came in since
+    std::shared_ptr<const CSmartnodeListSnapshot> listSnapshot;
+    bool fListSnapshotStale;
+
     friend class CSmartnodeSync;
     /// Find an entry
     CSmartnode* Find(const COutPoint& outpoint);
 
     bool GetSmartnodeScores(const uint256& nBlockHash, score_pair_vec_t& vecSmartnodeScoresRet, int nMinProtocol = 0);
+    /// Cached ranks for nBlockHash, calculated on a miss
+    const CRankTable* GetRankTable(const uint256& nBlockHash, int nMinProtocol);
 
 public:
     // Keep track of all broadcasts I've seen
-    std::map<uint256, std::pair<int64_t, CSmartnodeBroadcast> > mapSeenSmartnodeBroadcast;
+    std::unordered_map<uint256, std::pair<int64_t, CSmartnodeBroadcast>, SaltedTxidHasher> mapSeenSmartnodeBroadcast;
     // Keep track of all pings I've seen
-    std::map<uint256, CSmartnodePing> mapSeenSmartnodePing;
+    std::unordered_map<uint256, CSmartnodePing, SaltedTxidHasher> mapSeenSmartnodePing;
     // Keep track of all verifications I've seen
     std::map<uint256, CSmartnodeVerification> mapSeenSmartnodeVerification;
     // keep track of dsq count to prevent smartnodes from gaming darksend queue
@@ -116,9 +191,18 @@ public:
 
         READWRITE(mapSeenSmartnodeBroadcast);
         READWRITE(mapSeenSmartnodePing);
+        if(ser_action.ForRead()) {
+            InvalidateRanks();
+        }
         if(ser_action.ForRead() && (strVersion != SERIALIZATION_VERSION_STRING)) {
             Clear();
         }
+        if(ser_action.ForRead()) {
+            setLastPaidQueue.clear();
+            for (auto& mnpair : mapSmartnodes) {
+                setLastPaidQueue.insert(std::make_pair(mnpair.second.GetLastPaidBlock(), mnpair.first));
+            }
+        }
     }
 
     CSmartnodeMan();
@@ -136,6 +220,8 @@ public:
 
     /// Check all Smartnodes
     void Check();
+    /// Mark the smartnodes whose collateral tx spends as spent, for the transactions of connected blocks
+    void CheckSpentCollaterals(const CTransaction& tx);
 
     /// Check all Smartnodes and remove inactive
     void CheckAndRemove(CConnman& connman);
@@ -155,7 +241,11 @@ public:
     /// Count Smartnodes by network type - NET_IPV4, NET_IPV6, NET_TOR
     // int CountByIP(int nNetworkType);
 
-    void DsegUpdate(CNode* pnode, CConnman& connman);
+    /// Ask pnode for the list, or for part nPart of nParts of it to split the work among several peers.
+    /// Peers not knowing about parts ignore them and send the whole list.
+    void DsegUpdate(CNode* pnode, CConnman& connman, int nPart = 0, int nParts = 1);
+    /// Whether the smartnode with this collateral is in part nPart of nParts of the list
+    static bool IsInListPart(const COutPoint& outpoint, int nPart, int nParts);
 
     /// Versions of Find that are safe to use from outside the class
     bool Get(const COutPoint& outpoint, CSmartnode& smartnodeRet);
@@ -170,11 +260,24 @@ public:
     /// Same as above but use current block height
     bool GetNextSmartnodesInQueueForPayment(bool fFilterSigTime, int& nCountRet, CSmartNodeWinners& mnInfoRet);
 
-    /// Find a random entry
-    std::map<COutPoint, CSmartnode> GetFullSmartnodeMap() { return mapSmartnodes; }
+    /// Call func for every smartnode while holding cs, func must not call back into mnodeman
+    template<typename Callable>
+    void ForEachSmartnode(Callable&& func)
+    {
+        LOCK(cs);
+        for (auto& mnpair : mapSmartnodes) {
+            func(mnpair.second);
+        }
+    }
+
+    /// The smartnode list as of the current block, taken on the first call after each block.
+    /// pindex is the current tip, used to update the last paid blocks before.
+    std::shared_ptr<const CSmartnodeListSnapshot> GetListSnapshot(const CBlockIndex* pindex);
 
     bool GetSmartnodeRanks(rank_pair_vec_t& vecSmartnodeRanksRet, int nBlockHeight = -1, int nMinProtocol = 0);
     bool GetSmartnodeRank(const COutPoint &outpoint, int& nRankRet, int nBlockHeight = -1, int nMinProtocol = 0);
+    /// Drop the cached ranks, safe to call without holding cs
+    void InvalidateRanks() { ++nListVersion; }
 
     void ProcessSmartnodeConnections(CConnman& connman);
     std::pair<CService, std::set<uint256> > PopScheduledMnbRequestConnection();
@@ -13,15 +13,15 @@
 #include "spork.h"
 #include "../util.h"
 #include "consensus/consensus.h"
+#include "hash.h"
+#include "random.h"
 
 #include <boost/lexical_cast.hpp>
 
 /** Object for who's going to get paid on which blocks */
 CSmartnodePayments mnpayments;
 
-CCriticalSection cs_vecPayees;
 CCriticalSection cs_mapSmartnodeBlocks;
-CCriticalSection cs_mapSmartnodePaymentVotes;
 
 struct CompareBlockPayees
 {
@@ -100,8 +100,10 @@ CAmount SmartNodePayments::Payment(int nHeight)
     return blockValue/10; // start at 10%
 }
 
-bool SmartNodePayments::IsPaymentValid(const CTransaction& txNew, int nHeight, CAmount blockReward, CAmount& nodeReward)
+bool SmartNodePayments::IsPaymentValid(const CCoinbaseIndex& coinbase, int nHeight, CAmount blockReward, CAmount& nodeReward)
 {
+    const CTransaction& txNew = coinbase.GetTransaction();
+
     nodeReward = SmartNodePayments::Payment(nHeight);
 
     if( MainNet() ){
@@ -128,7 +130,7 @@ bool SmartNodePayments::IsPaymentValid(const CTransaction& txNew, int nHeight, C
         return true;
     }
 
-    if(mnpayments.IsTransactionValid(txNew, nHeight, nodeReward)) {
+    if(mnpayments.IsTransactionValid(coinbase, nHeight, nodeReward)) {
         LogPrint("mnpayments", "SmartNodePayments::IsPaymetValid -- Valid smartnode payment at height %d: %s", nHeight, txNew.ToString());
         return true;
     }
@@ -155,14 +157,13 @@ std::string SmartNodePayments::GetRequiredPaymentsString(int nBlockHeight)
 
 void CSmartnodePayments::Clear()
 {
-    LOCK2(cs_mapSmartnodeBlocks, cs_mapSmartnodePaymentVotes);
-    mapSmartnodeBlocks.clear();
-    mapSmartnodePaymentVotes.clear();
+    LOCK(cs_mapSmartnodeBlocks);
+    store.Clear();
 }
 
 bool CSmartnodePayments::CanVote(COutPoint outSmartnode, int nBlockHeight)
 {
-    LOCK(cs_mapSmartnodePaymentVotes);
+    LOCK(cs_mapSmartnodeBlocks);
 
     if (mapSmartnodesLastVote.count(outSmartnode) && mapSmartnodesLastVote[outSmartnode] == nBlockHeight) {
         return false;
@@ -258,13 +259,13 @@ void CSmartnodePayments::ProcessMessage(CNode* pfrom, std::string& strCommand, C
         int nCountNeeded;
         vRecv >> nCountNeeded;
 
-        if(netfulfilledman.HasFulfilledRequest(pfrom->addr, NetMsgType::SMARTNODEPAYMENTSYNC)) {
+        if(netfulfilledman.HasFulfilledRequest(pfrom->addr, FULFILLED_PAYMENT_VOTES_REQUEST)) {
             // Asking for the payments list multiple times in a short period of time is no good
             LogPrintf("SMARTNODEPAYMENTSYNC -- peer already asked me for the list, peer=%d\n", pfrom->id);
             Misbehaving(pfrom->GetId(), 20);
             return;
         }
-        netfulfilledman.AddFulfilledRequest(pfrom->addr, NetMsgType::SMARTNODEPAYMENTSYNC);
+        netfulfilledman.AddFulfilledRequest(pfrom->addr, FULFILLED_PAYMENT_VOTES_REQUEST);
 
         Sync(pfrom, connman);
         LogPrintf("SMARTNODEPAYMENTSYNC -- Sent Smartnode payment votes to peer %d\n", pfrom->id);
@@ -285,26 +286,28 @@ void CSmartnodePayments::ProcessMessage(CNode* pfrom, std::string& strCommand, C
         // Ignore any payments messages until smartnode list is synced
         if(!smartnodeSync.IsSmartnodeListSynced()) return;
 
+        int nFirstBlock = nCachedBlockHeight - GetStorageLimit();
+        int interval = SmartNodePayments::PayoutInterval(vote.nBlockHeight);
+
         {
-            LOCK(cs_mapSmartnodePaymentVotes);
-            if(mapSmartnodePaymentVotes.count(nHash)) {
+            LOCK(cs_mapSmartnodeBlocks);
+            if(store.GetVote(nHash)) {
                 LogPrint("mnpaymentvote", "SMARTNODEPAYMENTVOTE -- hash=%s, nHeight=%d seen\n", nHash.ToString(), nCachedBlockHeight);
                 return;
             }
 
+            // Votes out of range have no slot in the store, check them before remembering the vote
+            if(vote.nBlockHeight < nFirstBlock || vote.nBlockHeight > nCachedBlockHeight + 20 + interval) {
+                LogPrint("mnpaymentvote", "SMARTNODEPAYMENTVOTE -- vote out of range: nFirstBlock=%d, nBlockHeight=%d, nHeight=%d\n", nFirstBlock, vote.nBlockHeight, nCachedBlockHeight);
+                return;
+            }
+
             // Avoid processing same vote multiple times
-            mapSmartnodePaymentVotes[nHash] = vote;
             // but first mark vote as non-verified,
             // AddPaymentVote() below should take care of it if vote is actually ok
-            mapSmartnodePaymentVotes[nHash].MarkAsNotVerified();
-        }
-
-        int nFirstBlock = nCachedBlockHeight - GetStorageLimit();
-        int interval = SmartNodePayments::PayoutInterval(vote.nBlockHeight);
-
-        if(vote.nBlockHeight < nFirstBlock || vote.nBlockHeight > nCachedBlockHeight + 20 + interval) {
-            LogPrint("mnpaymentvote", "SMARTNODEPAYMENTVOTE -- vote out of range: nFirstBlock=%d, nBlockHeight=%d, nHeight=%d\n", nFirstBlock, vote.nBlockHeight, nCachedBlockHeight);
-            return;
+            CSmartnodePaymentVote voteNotVerified = vote;
+            voteNotVerified.MarkAsNotVerified();
+            store.AddVote(nHash, voteNotVerified);
         }
 
         std::string strError = "";
@@ -360,12 +363,17 @@ void CSmartnodePayments::ProcessMessage(CNode* pfrom, std::string& strCommand, C
     }
 }
 
+std::string CSmartnodePaymentVote::GetSignatureMessage() const
+{
+    return vinSmartnode.prevout.ToStringShort() +
+            boost::lexical_cast<std::string>(nBlockHeight) +
+            payees.ToString();
+}
+
 bool CSmartnodePaymentVote::Sign()
 {
     std::string strError;
-    std::string strMessage = vinSmartnode.prevout.ToStringShort() +
-                boost::lexical_cast<std::string>(nBlockHeight) +
-                payees.ToString();
+    std::string strMessage = GetSignatureMessage();
 
     if(!CMessageSigner::SignMessage(strMessage, vchSig, activeSmartnode.keySmartnode)) {
         LogPrintf("CSmartnodePaymentVote::Sign -- SignMessage() failed\n");
@@ -380,13 +388,52 @@ bool CSmartnodePaymentVote::Sign()
     return true;
 }
 
+bool CSmartnodePayments::HasBlockPayees(int nBlockHeight)
+{
+    LOCK(cs_mapSmartnodeBlocks);
+    return store.GetBlock(nBlockHeight) != NULL;
+}
+
 bool CSmartnodePayments::GetBlockPayees(int nBlockHeight, CScriptVector& payees)
 {
-    if(mapSmartnodeBlocks.count(nBlockHeight)){
-        return mapSmartnodeBlocks[nBlockHeight].GetBestPayees(payees);
+    LOCK(cs_mapSmartnodeBlocks);
+
+    CSmartnodeBlockPayees *pblock = store.GetBlock(nBlockHeight);
+
+    return pblock && pblock->GetBestPayees(payees);
+}
+
+bool CSmartnodePayments::HasPayeeWithVotes(int nBlockHeight, const CScript& payeeIn, int nVotesReq)
+{
+    LOCK(cs_mapSmartnodeBlocks);
+
+    CSmartnodeBlockPayees *pblock = store.GetBlock(nBlockHeight);
+
+    return pblock && pblock->HasPayeeWithVotes(payeeIn, nVotesReq);
+}
+
+bool CSmartnodePayments::GetBlockPaymentVotes(int nBlockHeight, std::vector<CSmartnodePaymentVote>& vecVotesRet)
+{
+    LOCK(cs_mapSmartnodeBlocks);
+
+    vecVotesRet.clear();
+
+    CSmartnodeBlockPayees *pblock = store.GetBlock(nBlockHeight);
+    if(!pblock) return false;
+
+    // a vote for several payees is listed by each of them
+    std::set<uint256> setHashes;
+
+    BOOST_FOREACH(CSmartnodePayee& payee, pblock->vecPayees) {
+        std::vector<uint256> vecVoteHashes = payee.GetVoteHashes();
+        BOOST_FOREACH(uint256& hash, vecVoteHashes) {
+            CSmartnodePaymentVote *pvote = store.GetVote(hash);
+            if(pvote && pvote->IsVerified() && setHashes.insert(hash).second)
+                vecVotesRet.push_back(*pvote);
+        }
     }
 
-    return false;
+    return true;
 }
 
 // Is this smartnode scheduled to get paid soon?
@@ -403,10 +450,11 @@ bool CSmartnodePayments::IsScheduled(CSmartnode& mn, int nNotBlockHeight)
     CScriptVector payees;
     int interval = SmartNodePayments::PayoutInterval(nCachedBlockHeight);
 
-    for(int64_t h = nCachedBlockHeight; h <= nCachedBlockHeight + 8 + interval; h++){
+    for(int h = nCachedBlockHeight; h <= nCachedBlockHeight + 8 + interval; h++){
         if(h == nNotBlockHeight) continue;
-        if(mapSmartnodeBlocks.count(h) &&
-           mapSmartnodeBlocks[h].GetBestPayees(payees) &&
+        CSmartnodeBlockPayees *pblock = store.GetBlock(h);
+        if(pblock &&
+           pblock->GetBestPayees(payees) &&
            std::find(payees.begin(),payees.end(), mnpayee) != payees.end() ) {
             return true;
         }
@@ -422,31 +470,41 @@ bool CSmartnodePayments::AddPaymentVote(const CSmartnodePaymentVote& vote)
 
     if(HasVerifiedPaymentVote(vote.GetHash())) return false;
 
-    LOCK2(cs_mapSmartnodeBlocks, cs_mapSmartnodePaymentVotes);
-
-    mapSmartnodePaymentVotes[vote.GetHash()] = vote;
+    LOCK(cs_mapSmartnodeBlocks);
 
-    if(!mapSmartnodeBlocks.count(vote.nBlockHeight)) {
-       CSmartnodeBlockPayees blockPayees(vote.nBlockHeight);
-       mapSmartnodeBlocks[vote.nBlockHeight] = blockPayees;
-    }
+    if(!store.AddVote(vote.GetHash(), vote)) return false;
 
-    mapSmartnodeBlocks[vote.nBlockHeight].AddPayees(vote);
+    store.GetBlock(vote.nBlockHeight, true)->AddPayees(vote);
 
     return true;
 }
 
+bool CSmartnodePayments::HasPaymentVote(const uint256& hashIn)
+{
+    LOCK(cs_mapSmartnodeBlocks);
+    return store.GetVote(hashIn) != NULL;
+}
+
 bool CSmartnodePayments::HasVerifiedPaymentVote(uint256 hashIn)
 {
-    LOCK(cs_mapSmartnodePaymentVotes);
-    std::map<uint256, CSmartnodePaymentVote>::iterator it = mapSmartnodePaymentVotes.find(hashIn);
-    return it != mapSmartnodePaymentVotes.end() && it->second.IsVerified();
+    LOCK(cs_mapSmartnodeBlocks);
+    CSmartnodePaymentVote *pvote = store.GetVote(hashIn);
+    return pvote && pvote->IsVerified();
 }
 
-void CSmartnodeBlockPayees::AddPayees(const CSmartnodePaymentVote& vote)
+bool CSmartnodePayments::GetPaymentVote(const uint256& hashIn, CSmartnodePaymentVote& voteRet)
 {
-    LOCK(cs_vecPayees);
+    LOCK(cs_mapSmartnodeBlocks);
 
+    CSmartnodePaymentVote *pvote = store.GetVote(hashIn);
+    if(!pvote) return false;
+
+    voteRet = *pvote;
+    return true;
+}
+
+void CSmartnodeBlockPayees::AddPayees(const CSmartnodePaymentVote& vote)
+{
     bool found;
 
     BOOST_FOREACH(const CScript& scriptPubKey, vote.payees)
@@ -471,8 +529,6 @@ void CSmartnodeBlockPayees::AddPayees(const CSmartnodePaymentVote& vote)
 
 bool CSmartnodeBlockPayees::GetBestPayees(CScriptVector& payeesRet)
 {
-    LOCK(cs_vecPayees);
-
     payeesRet.clear();
 
     size_t expectedPayees = SmartNodePayments::PayoutsPerBlock(nBlockHeight);
@@ -499,8 +555,6 @@ bool CSmartnodeBlockPayees::GetBestPayees(CScriptVector& payeesRet)
 
 bool CSmartnodeBlockPayees::HasPayeeWithVotes(const CScript& payeeIn, int nVotesReq)
 {
-    LOCK(cs_vecPayees);
-
     BOOST_FOREACH(CSmartnodePayee& payee, vecPayees) {
         if (payee.GetVoteCount() >= nVotesReq && payee.GetPayee() == payeeIn) {
             return true;
@@ -511,10 +565,8 @@ bool CSmartnodeBlockPayees::HasPayeeWithVotes(const CScript& payeeIn, int nVotes
     return false;
 }
 
-bool CSmartnodeBlockPayees::IsTransactionValid(const CTransaction& txNew, CAmount expectedNodeReward)
+bool CSmartnodeBlockPayees::IsTransactionValid(const CCoinbaseIndex& coinbase, CAmount expectedNodeReward)
 {
-    LOCK(cs_vecPayees);
-
     int found = 0;
     int expectedPayees =  SmartNodePayments::PayoutsPerBlock(nBlockHeight);
     std::string strPayeesPossible = "";
@@ -539,12 +591,9 @@ bool CSmartnodeBlockPayees::IsTransactionValid(const CTransaction& txNew, CAmoun
 
     BOOST_FOREACH(CSmartnodePayee& payee, vecPayees) {
         if (payee.GetVoteCount() >= MNPAYMENTS_SIGNATURES_REQUIRED) {
-            BOOST_FOREACH(CTxOut txout, txNew.vout) {
-                if (txout.scriptPubKey == payee.GetPayee() && txout.nValue == expectedPerNode) {
-                    LogPrint("mnpayments", "CSmartnodeBlockPayees::IsTransactionValid -- Found required payment: %s\n",txout.ToString());
-                    found++;
-                    break;
-                }
+            if (coinbase.Contains(payee.GetPayee(), expectedPerNode)) {
+                LogPrint("mnpayments", "CSmartnodeBlockPayees::IsTransactionValid -- Found required payment: %s\n", CTxOut(expectedPerNode, payee.GetPayee()).ToString());
+                found++;
             }
 
             CTxDestination address1;
@@ -567,8 +616,6 @@ bool CSmartnodeBlockPayees::IsTransactionValid(const CTransaction& txNew, CAmoun
 
 std::string CSmartnodeBlockPayees::GetRequiredPaymentsString()
 {
-    LOCK(cs_vecPayees);
-
     std::string strRequiredPayments = "Unknown";
     int interval = SmartNodePayments::PayoutInterval(nBlockHeight);
 
@@ -590,6 +637,237 @@ std::string CSmartnodeBlockPayees::GetRequiredPaymentsString()
     return strRequiredPayments;
 }
 
+CSmartnodePaymentStore::CSmartnodePaymentStore(int nHeights) :
+    k0(GetRand(std::numeric_limits<uint64_t>::max())),
+    k1(GetRand(std::numeric_limits<uint64_t>::max())),
+    nLowestHeight(INT_MAX),
+    nVotes(0),
+    nBlocks(0)
+{
+    Reserve(nHeights);
+}
+
+size_t CSmartnodePaymentStore::GetBucket(const uint256& hash) const
+{
+    return SipHashUint256(k0, k1, hash) & (vecIndex.size() - 1);
+}
+
+size_t CSmartnodePaymentStore::FindRef(const uint256& hash) const
+{
+    if( vecIndex.empty() ) return EMPTY_REF;
+
+    for( size_t i = GetBucket(hash); vecIndex[i].nPos != EMPTY_REF; i = (i + 1) & (vecIndex.size() - 1) ){
+        if( vecIndex[i].hash == hash ) return i;
+    }
+
+    return EMPTY_REF;
+}
+
+void CSmartnodePaymentStore::InsertRef(const VoteRef& ref)
+{
+    // keep the table at most half full
+    if( (nVotes + 1) * 2 > vecIndex.size() ){
+        std::vector<VoteRef> vecOld;
+        vecOld.swap(vecIndex);
+
+        VoteRef empty;
+        empty.nPos = EMPTY_REF;
+        vecIndex.assign(std::max<size_t>(vecOld.size() * 2, 1024), empty);
+
+        BOOST_FOREACH(const VoteRef& old, vecOld){
+            if( old.nPos == EMPTY_REF ) continue;
+            size_t i = GetBucket(old.hash);
+            while( vecIndex[i].nPos != EMPTY_REF ) i = (i + 1) & (vecIndex.size() - 1);
+            vecIndex[i] = old;
+        }
+    }
+
+    size_t i = GetBucket(ref.hash);
+    while( vecIndex[i].nPos != EMPTY_REF ) i = (i + 1) & (vecIndex.size() - 1);
+    vecIndex[i] = ref;
+}
+
+void CSmartnodePaymentStore::EraseRef(size_t nBucket)
+{
+    size_t nMask = vecIndex.size() - 1;
+
+    // shift the following refs of the probe sequence back instead of leaving a tombstone
+    for( size_t j = (nBucket + 1) & nMask; vecIndex[j].nPos != EMPTY_REF; j = (j + 1) & nMask ){
+        size_t nHome = GetBucket(vecIndex[j].hash);
+        bool fStays = nBucket <= j ? (nBucket < nHome && nHome <= j) : (nBucket < nHome || nHome <= j);
+        if( fStays ) continue;
+        vecIndex[nBucket] = vecIndex[j];
+        nBucket = j;
+    }
+
+    vecIndex[nBucket].nPos = EMPTY_REF;
+}
+
+void CSmartnodePaymentStore::Drop(Slot& slot)
+{
+    if( !slot.fUsed ) return;
+
+    for( size_t i = 0; i < slot.vecVotes.size(); ++i ) EraseRef(FindRef(slot.vecVotes[i].first));
+
+    nVotes -= slot.vecVotes.size();
+    if( slot.fBlock ) --nBlocks;
+
+    slot = Slot();
+}
+
+CSmartnodePaymentStore::Slot *CSmartnodePaymentStore::Claim(int nHeight)
+{
+    Slot& slot = vecSlots[GetSlot(nHeight)];
+
+    if( slot.fUsed ){
+        if( slot.block.nBlockHeight == nHeight ) return &slot;
+        if( slot.block.nBlockHeight > nHeight ) return NULL;
+        Drop(slot);
+    }
+
+    slot.fUsed = true;
+    slot.block.nBlockHeight = nHeight;
+    nLowestHeight = std::min(nLowestHeight, nHeight);
+
+    return &slot;
+}
+
+void CSmartnodePaymentStore::Clear()
+{
+    std::vector<VoteRef>().swap(vecIndex);
+    vecSlots.assign(vecSlots.size(), Slot());
+    nLowestHeight = INT_MAX;
+    nVotes = 0;
+    nBlocks = 0;
+}
+
+void CSmartnodePaymentStore::Reserve(int nHeights)
+{
+    size_t nSize = 1;
+    while( nSize < (size_t)std::max(nHeights, 1) ) nSize <<= 1;
+
+    if( nSize <= vecSlots.size() ) return;
+
+    // heights which differ in their slot bits keep differing in a larger ring
+    std::vector<Slot> vecOld(nSize);
+    vecOld.swap(vecSlots);
+
+    BOOST_FOREACH(Slot& slot, vecOld){
+        if( slot.fUsed ) std::swap(vecSlots[GetSlot(slot.block.nBlockHeight)], slot);
+    }
+}
+
+void CSmartnodePaymentStore::DropBelow(int nHeight)
+{
+    if( nHeight <= nLowestHeight ) return;
+
+    if( (int64_t)nHeight - nLowestHeight >= (int64_t)vecSlots.size() ){
+        BOOST_FOREACH(Slot& slot, vecSlots){
+            if( slot.fUsed && slot.block.nBlockHeight < nHeight ) Drop(slot);
+        }
+    }else{
+        for( int h = nLowestHeight; h < nHeight; ++h ){
+            Slot& slot = vecSlots[GetSlot(h)];
+            if( slot.fUsed && slot.block.nBlockHeight == h ) Drop(slot);
+        }
+    }
+
+    nLowestHeight = nHeight;
+}
+
+bool CSmartnodePaymentStore::AddVote(const uint256& hash, const CSmartnodePaymentVote& vote)
+{
+    size_t nRef = FindRef(hash);
+
+    if( nRef != EMPTY_REF ){
+        Slot& slot = vecSlots[GetSlot(vecIndex[nRef].nBlockHeight)];
+        slot.vecVotes[vecIndex[nRef].nPos].second = vote;
+        return true;
+    }
+
+    Slot *pslot = Claim(vote.nBlockHeight);
+    if( !pslot ) return false;
+
+    VoteRef ref;
+    ref.hash = hash;
+    ref.nBlockHeight = vote.nBlockHeight;
+    ref.nPos = pslot->vecVotes.size();
+
+    InsertRef(ref);
+    pslot->vecVotes.push_back(std::make_pair(hash, vote));
+    ++nVotes;
+
+    return true;
+}
+
+CSmartnodePaymentVote *CSmartnodePaymentStore::GetVote(const uint256& hash)
+{
+    size_t nRef = FindRef(hash);
+    if( nRef == EMPTY_REF ) return NULL;
+
+    return &vecSlots[GetSlot(vecIndex[nRef].nBlockHeight)].vecVotes[vecIndex[nRef].nPos].second;
+}
+
+CSmartnodeBlockPayees *CSmartnodePaymentStore::GetBlock(int nHeight, bool fCreate)
+{
+    Slot& slot = vecSlots[GetSlot(nHeight)];
+
+    if( slot.fUsed && slot.block.nBlockHeight == nHeight && slot.fBlock ) return &slot.block;
+    if( !fCreate ) return NULL;
+
+    Slot *pslot = Claim(nHeight);
+    if( !pslot ) return NULL;
+
+    pslot->fBlock = true;
+    ++nBlocks;
+
+    return &pslot->block;
+}
+
+void CSmartnodePaymentStore::GetBlockHeights(std::vector<int>& vecHeights) const
+{
+    vecHeights.clear();
+    vecHeights.reserve(nBlocks);
+
+    BOOST_FOREACH(const Slot& slot, vecSlots){
+        if( slot.fUsed && slot.fBlock ) vecHeights.push_back(slot.block.nBlockHeight);
+    }
+
+    std::sort(vecHeights.begin(), vecHeights.end());
+}
+
+void CSmartnodePaymentStore::Get(std::map<uint256, CSmartnodePaymentVote>& mapVotes, std::map<int, CSmartnodeBlockPayees>& mapBlocks) const
+{
+    mapVotes.clear();
+    mapBlocks.clear();
+
+    BOOST_FOREACH(const Slot& slot, vecSlots){
+        if( !slot.fUsed ) continue;
+        mapVotes.insert(slot.vecVotes.begin(), slot.vecVotes.end());
+        if( slot.fBlock ) mapBlocks.insert(std::make_pair(slot.block.nBlockHeight, slot.block));
+    }
+}
+
+void CSmartnodePaymentStore::Set(const std::map<uint256, CSmartnodePaymentVote>& mapVotes, const std::map<int, CSmartnodeBlockPayees>& mapBlocks)
+{
+    Clear();
+
+    // ascending heights, newer heights replace older ones sharing their slot
+    std::map<int, CSmartnodeBlockPayees>::const_iterator itBlock;
+    for( itBlock = mapBlocks.begin(); itBlock != mapBlocks.end(); ++itBlock ){
+        CSmartnodeBlockPayees *pblock = GetBlock(itBlock->first, true);
+        if( pblock ){
+            *pblock = itBlock->second;
+            pblock->nBlockHeight = itBlock->first;
+        }
+    }
+
+    std::map<uint256, CSmartnodePaymentVote>::const_iterator itVote;
+    for( itVote = mapVotes.begin(); itVote != mapVotes.end(); ++itVote ){
+        AddVote(itVote->first, itVote->second);
+    }
+}
+
 std::string CSmartnodePayments::GetRequiredPaymentsString(int nHeight)
 {
     int interval = SmartNodePayments::PayoutInterval(nHeight);
@@ -598,19 +876,21 @@ std::string CSmartnodePayments::GetRequiredPaymentsString(int nHeight)
 
     LOCK(cs_mapSmartnodeBlocks);
 
-    if(mapSmartnodeBlocks.count(nHeight)){
-        return mapSmartnodeBlocks[nHeight].GetRequiredPaymentsString();
+    CSmartnodeBlockPayees *pblock = store.GetBlock(nHeight);
+    if(pblock){
+        return pblock->GetRequiredPaymentsString();
     }
 
     return "Unknown";
 }
 
-bool CSmartnodePayments::IsTransactionValid(const CTransaction& txNew, int nBlockHeight, CAmount expectedNodeReward)
+bool CSmartnodePayments::IsTransactionValid(const CCoinbaseIndex& coinbase, int nBlockHeight, CAmount expectedNodeReward)
 {
     LOCK(cs_mapSmartnodeBlocks);
 
-    if(mapSmartnodeBlocks.count(nBlockHeight)){
-        return mapSmartnodeBlocks[nBlockHeight].IsTransactionValid(txNew, expectedNodeReward);
+    CSmartnodeBlockPayees *pblock = store.GetBlock(nBlockHeight);
+    if(pblock){
+        return pblock->IsTransactionValid(coinbase, expectedNodeReward);
     }
 
     return false;
@@ -620,22 +900,16 @@ void CSmartnodePayments::CheckAndRemove()
 {
     if(!smartnodeSync.IsBlockchainSynced()) return;
 
-    LOCK2(cs_mapSmartnodeBlocks, cs_mapSmartnodePaymentVotes);
+    LOCK(cs_mapSmartnodeBlocks);
 
     int nLimit = GetStorageLimit();
 
-    std::map<uint256, CSmartnodePaymentVote>::iterator it = mapSmartnodePaymentVotes.begin();
-    while(it != mapSmartnodePaymentVotes.end()) {
-        CSmartnodePaymentVote vote = (*it).second;
+    // the ring follows the storage limit if the smartnode list grows
+    store.Reserve(nLimit + MNPAYMENTS_FUTURE_BLOCKS);
+
+    LogPrint("mnpayments", "CSmartnodePayments::CheckAndRemove -- Removing old Smartnode payments: nBlockHeight<%d\n", nCachedBlockHeight - nLimit);
+    store.DropBelow(nCachedBlockHeight - nLimit);
 
-        if(nCachedBlockHeight - vote.nBlockHeight > nLimit) {
-            LogPrint("mnpayments", "CSmartnodePayments::CheckAndRemove -- Removing old Smartnode payment: nBlockHeight=%d\n", vote.nBlockHeight);
-            mapSmartnodePaymentVotes.erase(it++);
-            mapSmartnodeBlocks.erase(vote.nBlockHeight);
-        } else {
-            ++it;
-        }
-    }
     LogPrintf("CSmartnodePayments::CheckAndRemove -- %s\n", ToString());
 }
 
@@ -846,10 +1120,7 @@ bool CSmartnodePaymentVote::CheckSignature(const CPubKey& pubKeySmartnode, int n
     // do not ban by default
     nDos = 0;
 
-    std::string strMessage = vinSmartnode.prevout.ToStringShort() +
-                boost::lexical_cast<std::string>(nBlockHeight) +
-                payees.ToString();
-
+    std::string strMessage = GetSignatureMessage();
     std::string strError = "";
     if (!CMessageSigner::VerifyMessage(pubKeySmartnode, vchSig, strMessage, strError)) {
         // Only ban for future block vote when we are already synced.
@@ -886,11 +1157,13 @@ void CSmartnodePayments::Sync(CNode* pnode, CConnman& connman)
     int nInvCount = 0;
 
     for(int h = nCachedBlockHeight; h < nCachedBlockHeight + 100; h++) {
-        if(mapSmartnodeBlocks.count(h)) {
-            BOOST_FOREACH(CSmartnodePayee& payee, mapSmartnodeBlocks[h].vecPayees) {
+        CSmartnodeBlockPayees *pblock = store.GetBlock(h);
+        if(pblock) {
+            BOOST_FOREACH(CSmartnodePayee& payee, pblock->vecPayees) {
                 std::vector<uint256> vecVoteHashes = payee.GetVoteHashes();
                 BOOST_FOREACH(uint256& hash, vecVoteHashes) {
-                    if(!HasVerifiedPaymentVote(hash)) continue;
+                    CSmartnodePaymentVote *pvote = store.GetVote(hash);
+                    if(!pvote || !pvote->IsVerified()) continue;
                     pnode->PushInventory(CInv(MSG_SMARTNODE_PAYMENT_VOTE, hash));
                     nInvCount++;
                 }
@@ -915,7 +1188,7 @@ void CSmartnodePayments::RequestLowDataPaymentBlocks(CNode* pnode, CConnman& con
     const CBlockIndex *pindex = chainActive.Tip();
 
     while(nCachedBlockHeight - pindex->nHeight < nLimit) {
-        if(!mapSmartnodeBlocks.count(pindex->nHeight)) {
+        if(!store.GetBlock(pindex->nHeight)) {
             // We have no idea about this block height, let's ask
             vToFetch.push_back(CInv(MSG_SMARTNODE_PAYMENT_BLOCK, pindex->GetBlockHash()));
             // We should not violate GETDATA rules
@@ -930,13 +1203,15 @@ void CSmartnodePayments::RequestLowDataPaymentBlocks(CNode* pnode, CConnman& con
         pindex = pindex->pprev;
     }
 
-    std::map<int, CSmartnodeBlockPayees>::iterator it = mapSmartnodeBlocks.begin();
+    std::vector<int> vecHeights;
+    store.GetBlockHeights(vecHeights);
 
-    while(it != mapSmartnodeBlocks.end()) {
-        int expectedPayees = SmartNodePayments::PayoutsPerBlock(it->first);
+    BOOST_FOREACH(int nHeight, vecHeights) {
+        CSmartnodeBlockPayees *pblock = store.GetBlock(nHeight);
+        int expectedPayees = SmartNodePayments::PayoutsPerBlock(nHeight);
         int nTotalVotes = 0;
         int fFound = 0;
-        BOOST_FOREACH(CSmartnodePayee& payee, it->second.vecPayees) {
+        BOOST_FOREACH(CSmartnodePayee& payee, pblock->vecPayees) {
             if(payee.GetVoteCount() >= MNPAYMENTS_SIGNATURES_REQUIRED) {
                 if( ++fFound == expectedPayees) break;
             }
@@ -946,24 +1221,23 @@ void CSmartnodePayments::RequestLowDataPaymentBlocks(CNode* pnode, CConnman& con
         // or no clear winner was found but there are at least avg number of votes
         if(fFound == expectedPayees || nTotalVotes >= ( (MNPAYMENTS_SIGNATURES_TOTAL + MNPAYMENTS_SIGNATURES_REQUIRED) * expectedPayees )/2) {
             // so just move to the next block
-            ++it;
             continue;
         }
         // DEBUG
         DBG (
             // Let's see why this failed
-            BOOST_FOREACH(CSmartnodePayee& payee, it->second.vecPayees) {
+            BOOST_FOREACH(CSmartnodePayee& payee, pblock->vecPayees) {
                 CTxDestination address1;
                 ExtractDestination(payee.GetPayee(), address1);
                 CBitcoinAddress address2(address1);
                 printf("payee %s votes %d\n", address2.ToString().c_str(), payee.GetVoteCount());
             }
-            printf("block %d votes total %d\n", it->first, nTotalVotes);
+            printf("block %d votes total %d\n", nHeight, nTotalVotes);
         )
         // END DEBUG
         // Low data block found, let's try to sync it
         uint256 hash;
-        if(GetBlockHash(hash, it->first)) {
+        if(GetBlockHash(hash, nHeight)) {
             vToFetch.push_back(CInv(MSG_SMARTNODE_PAYMENT_BLOCK, hash));
         }
         // We should not violate GETDATA rules
@@ -973,7 +1247,6 @@ void CSmartnodePayments::RequestLowDataPaymentBlocks(CNode* pnode, CConnman& con
             // Start filling new batch
             vToFetch.clear();
         }
-        ++it;
     }
     // Ask for the rest of it
     if(!vToFetch.empty()) {
@@ -986,8 +1259,8 @@ std::string CSmartnodePayments::ToString() const
 {
     std::ostringstream info;
 
-    info << "Votes: " << (int)mapSmartnodePaymentVotes.size() <<
-            ", Blocks: " << (int)mapSmartnodeBlocks.size();
+    info << "Votes: " << (int)store.GetVoteCount() <<
+            ", Blocks: " << (int)store.GetBlockCount();
 
     return info.str();
 }
@@ -10,6 +10,7 @@
 #include "../key.h"
 #include "../net_processing.h"
 #include "smartnode.h"
+#include "../smartmining/coinbaseindex.h"
 #include "../utilstrencodings.h"
 
 class CSmartnodePayments;
@@ -19,6 +20,8 @@ class CSmartnodeBlockPayees;
 static const int MNPAYMENTS_SIGNATURES_REQUIRED         = 6;
 static const int MNPAYMENTS_SIGNATURES_TOTAL            = 10;
 static const int MNPAYMENTS_NO_RANK                    = INT_MAX;
+//! heights above the current tip that votes are kept for
+static const int MNPAYMENTS_FUTURE_BLOCKS              = 100;
 
 //! minimum peer version that can receive and send smartnode payment messages,
 //  vote for smartnode and be elected as a payment winner
@@ -27,9 +30,7 @@ static const int MNPAYMENTS_NO_RANK                    = INT_MAX;
 static const int MIN_SMARTNODE_PAYMENT_PROTO_VERSION_1 = 90025;
 static const int MIN_SMARTNODE_PAYMENT_PROTO_VERSION_2 = 90026;
 
-extern CCriticalSection cs_vecPayees;
 extern CCriticalSection cs_mapSmartnodeBlocks;
-extern CCriticalSection cs_mapSmartnodePayeeVotes;
 
 extern CSmartnodePayments mnpayments;
 
@@ -40,7 +41,7 @@ int PayoutInterval(int nHeight);
 int PayoutsPerBlock(int nHeight);
 
 bool IsBlockValueValid(const CBlock& block, int nBlockHeight, CAmount blockReward, std::string &strErrorRet);
-bool IsPaymentValid(const CTransaction& txNew, int nBlockHeight, CAmount blockReward, CAmount& nodeReward);
+bool IsPaymentValid(const CCoinbaseIndex& coinbase, int nBlockHeight, CAmount blockReward, CAmount& nodeReward);
 void FillPayments(CMutableTransaction& txNew, int nBlockHeight, CAmount blockReward, std::vector<CTxOut>& voutSmartNodes);
 std::string GetRequiredPaymentsString(int nBlockHeight);
 
@@ -55,7 +56,7 @@ struct CScriptVector : public std::vector<CScript>
 
         std::ostringstream info;
 
-        BOOST_FOREACH(CScript scriptPubKey, *this)
+        BOOST_FOREACH(const CScript& scriptPubKey, *this)
         {
             info << ", " << ScriptToAsmStr(scriptPubKey);
         }
@@ -97,7 +98,7 @@ public:
     int GetVoteCount() const { return vecVoteHashes.size(); }
 };
 
-// Keep track of votes for payees from smartnodes
+// Keep track of votes for payees from smartnodes, guarded by cs_mapSmartnodeBlocks
 class CSmartnodeBlockPayees
 {
 public:
@@ -125,7 +126,7 @@ public:
     bool GetBestPayees(CScriptVector& payeeRet);
     bool HasPayeeWithVotes(const CScript& payeeIn, int nVotesReq);
 
-    bool IsTransactionValid(const CTransaction& txNew, CAmount expectedNodeReward);
+    bool IsTransactionValid(const CCoinbaseIndex& coinbase, CAmount expectedNodeReward);
 
     std::string GetRequiredPaymentsString();
 };
@@ -187,6 +188,7 @@ public:
         return ss.GetHash();
     }
 
+    std::string GetSignatureMessage() const;
     bool Sign();
     bool CheckSignature(const CPubKey& pubKeySmartnode, int nValidationHeight, int &nDos);
 
@@ -199,6 +201,78 @@ public:
     std::string ToString() const;
 };
 
+/** Payment votes and the payees they voted for, bucketed by block height.
+ *
+ *  Every height owns the slot of its low bits in a ring with a power of two
+ *  number of slots. A slot holds the height's votes and payees next to each
+ *  other, a newer height simply replaces an older one in its slot and heights
+ *  below a limit get dropped slot by slot. Votes are found by hash through an
+ *  open addressed table with linear probing which points into the slots.
+ */
+class CSmartnodePaymentStore
+{
+private:
+    struct Slot
+    {
+        bool fUsed;
+        bool fBlock;
+        CSmartnodeBlockPayees block;
+        std::vector<std::pair<uint256, CSmartnodePaymentVote> > vecVotes;
+
+        Slot() : fUsed(false), fBlock(false) {}
+    };
+
+    struct VoteRef
+    {
+        uint256 hash;
+        int nBlockHeight;
+        uint32_t nPos;
+    };
+
+    static const uint32_t EMPTY_REF = 0xffffffff;
+
+    const uint64_t k0, k1;
+
+    std::vector<Slot> vecSlots;
+    std::vector<VoteRef> vecIndex;
+    // Lowest height that might still be in vecSlots
+    int nLowestHeight;
+    size_t nVotes;
+    size_t nBlocks;
+
+    size_t GetSlot(int nHeight) const { return (unsigned int)nHeight & (vecSlots.size() - 1); }
+    size_t GetBucket(const uint256& hash) const;
+    size_t FindRef(const uint256& hash) const;
+    void InsertRef(const VoteRef& ref);
+    void EraseRef(size_t nBucket);
+    //! Slot of nHeight, replaces an older height in it, NULL if a newer height holds it.
+    Slot *Claim(int nHeight);
+    void Drop(Slot& slot);
+
+public:
+    CSmartnodePaymentStore(int nHeights);
+
+    void Clear();
+    //! Grow the ring to fit at least nHeights consecutive heights.
+    void Reserve(int nHeights);
+    //! Drop all heights below nHeight.
+    void DropBelow(int nHeight);
+
+    //! Add a vote or replace the vote with the same hash, false if its height is already gone.
+    bool AddVote(const uint256& hash, const CSmartnodePaymentVote& vote);
+    CSmartnodePaymentVote *GetVote(const uint256& hash);
+    //! Payees of nHeight, fCreate adds them if there are none yet.
+    CSmartnodeBlockPayees *GetBlock(int nHeight, bool fCreate = false);
+    //! Heights with payees in ascending order.
+    void GetBlockHeights(std::vector<int>& vecHeights) const;
+
+    void Get(std::map<uint256, CSmartnodePaymentVote>& mapVotes, std::map<int, CSmartnodeBlockPayees>& mapBlocks) const;
+    void Set(const std::map<uint256, CSmartnodePaymentVote>& mapVotes, const std::map<int, CSmartnodeBlockPayees>& mapBlocks);
+
+    size_t GetVoteCount() const { return nVotes; }
+    size_t GetBlockCount() const { return nBlocks; }
+};
+
 //
 // Smartnode Payments Class
 // Keeps track of who should get paid for which blocks
@@ -215,26 +289,35 @@ private:
     // Keep track of current block height
     int nCachedBlockHeight;
 
+    // votes and payees, guarded by cs_mapSmartnodeBlocks
+    CSmartnodePaymentStore store;
+
 public:
-    std::map<uint256, CSmartnodePaymentVote> mapSmartnodePaymentVotes;
-    std::map<int, CSmartnodeBlockPayees> mapSmartnodeBlocks;
     std::map<COutPoint, int> mapSmartnodesLastVote;
     std::map<COutPoint, int> mapSmartnodesDidNotVote;
 
-    CSmartnodePayments() : nStorageCoeff(1.25), nMinBlocksToStore(5000) {}
+    CSmartnodePayments() : nStorageCoeff(1.25), nMinBlocksToStore(5000), store(nMinBlocksToStore + MNPAYMENTS_FUTURE_BLOCKS) {}
 
     ADD_SERIALIZE_METHODS;
 
+    // Stored as the vote and block maps of previous versions
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        LOCK(cs_mapSmartnodeBlocks);
+        std::map<uint256, CSmartnodePaymentVote> mapSmartnodePaymentVotes;
+        std::map<int, CSmartnodeBlockPayees> mapSmartnodeBlocks;
+        if (!ser_action.ForRead()) store.Get(mapSmartnodePaymentVotes, mapSmartnodeBlocks);
         READWRITE(mapSmartnodePaymentVotes);
         READWRITE(mapSmartnodeBlocks);
+        if (ser_action.ForRead()) store.Set(mapSmartnodePaymentVotes, mapSmartnodeBlocks);
     }
 
     void Clear();
 
     bool AddPaymentVote(const CSmartnodePaymentVote& vote);
+    bool HasPaymentVote(const uint256& hashIn);
     bool HasVerifiedPaymentVote(uint256 hashIn);
+    bool GetPaymentVote(const uint256& hashIn, CSmartnodePaymentVote& voteRet);
     bool ProcessBlock(int nBlockHeight, CConnman& connman);
     void CheckPreviousBlockVotes(int nPrevBlockHeight);
 
@@ -242,8 +325,12 @@ public:
     void RequestLowDataPaymentBlocks(CNode* pnode, CConnman& connman);
     void CheckAndRemove();
 
+    bool HasBlockPayees(int nBlockHeight);
     bool GetBlockPayees(int nBlockHeight, CScriptVector& payees);
-    bool IsTransactionValid(const CTransaction& txNew, int nBlockHeight, CAmount expectedNodeReward);
+    bool HasPayeeWithVotes(int nBlockHeight, const CScript& payeeIn, int nVotesReq);
+    //! Verified votes for the payees of nBlockHeight, false if there are no payees.
+    bool GetBlockPaymentVotes(int nBlockHeight, std::vector<CSmartnodePaymentVote>& vecVotesRet);
+    bool IsTransactionValid(const CCoinbaseIndex& coinbase, int nBlockHeight, CAmount expectedNodeReward);
     bool IsScheduled(CSmartnode& mn, int nNotBlockHeight);
 
     bool CanVote(COutPoint outSmartnode, int nBlockHeight);
@@ -254,8 +341,8 @@ public:
     void FillBlockPayee(CMutableTransaction& txNew, int nBlockHeight, CAmount blockReward, std::vector<CTxOut>& voutSmartNodes);
     std::string ToString() const;
 
-    int GetBlockCount() { return mapSmartnodeBlocks.size(); }
-    int GetVoteCount() { return mapSmartnodePaymentVotes.size(); }
+    int GetBlockCount() { LOCK(cs_mapSmartnodeBlocks); return store.GetBlockCount(); }
+    int GetVoteCount() { LOCK(cs_mapSmartnodeBlocks); return store.GetVoteCount(); }
 
     bool IsEnoughData();
     int GetStorageLimit();
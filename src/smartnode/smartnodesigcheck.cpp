@@ -0,0 +1,108 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "smartnodesigcheck.h"
+
+#include "../chainparams.h"
+#include "../messagesigner.h"
+#include "../net.h"
+#include "../util.h"
+#include "../utilstrencodings.h"
+#include "../validation.h"
+#include "instantx.h"
+#include "smartnode.h"
+#include "smartnodeman.h"
+#include "smartnodepayments.h"
+#include "spork.h"
+
+void QueueSmartnodeSignatures(CNode* pfrom)
+{
+    // without worker threads the handlers check them anyway
+    if (fLiteMode || !nScriptCheckThreads) return;
+
+    std::vector<CSmartnodeBroadcast> vecMnb;
+    std::vector<CSmartnodePing> vecMnp;
+    std::vector<CSmartnodePaymentVote> vecMnw;
+    std::vector<CTxLockVote> vecVotes;
+    std::vector<CSporkMessage> vecSporks;
+
+    {
+        LOCK(pfrom->cs_vProcessMsg);
+
+        // messages only get appended, so the ones already looked at are all in front
+        std::list<CNetMessage>::iterator it = pfrom->vProcessMsg.end();
+        while (it != pfrom->vProcessMsg.begin() && !std::prev(it)->fSmartnodeSigsQueued)
+            --it;
+
+        for (; it != pfrom->vProcessMsg.end(); ++it) {
+            it->fSmartnodeSigsQueued = true;
+
+            std::string strCommand = it->hdr.GetCommand();
+            if (strCommand != NetMsgType::MNANNOUNCE && strCommand != NetMsgType::MNPING &&
+                strCommand != NetMsgType::SMARTNODEPAYMENTVOTE && strCommand != NetMsgType::TXLOCKVOTE &&
+                strCommand != NetMsgType::SPORK)
+                continue;
+
+            try {
+                CDataStream vRecv(it->vRecv);
+                vRecv.SetVersion(pfrom->GetRecvVersion());
+                if (strCommand == NetMsgType::MNANNOUNCE) {
+                    CSmartnodeBroadcast mnb;
+                    vRecv >> mnb;
+                    vecMnb.push_back(mnb);
+                } else if (strCommand == NetMsgType::MNPING) {
+                    CSmartnodePing mnp;
+                    vRecv >> mnp;
+                    vecMnp.push_back(mnp);
+                } else if (strCommand == NetMsgType::SMARTNODEPAYMENTVOTE) {
+                    CSmartnodePaymentVote vote;
+                    vRecv >> vote;
+                    vecMnw.push_back(vote);
+                } else if (strCommand == NetMsgType::TXLOCKVOTE) {
+                    CTxLockVote vote;
+                    vRecv >> vote;
+                    vecVotes.push_back(vote);
+                } else {
+                    CSporkMessage spork;
+                    vRecv >> spork;
+                    vecSporks.push_back(spork);
+                }
+            } catch (const std::exception&) {
+                // leave malformed messages to ProcessMessage
+            }
+        }
+    }
+
+    if (vecMnb.empty() && vecMnp.empty() && vecMnw.empty() && vecVotes.empty() && vecSporks.empty()) return;
+
+    // a full queue leaves the rest to the handlers
+    size_t nQueued = 0;
+
+    BOOST_FOREACH(const CSmartnodeBroadcast& mnb, vecMnb) {
+        nQueued += signedMessageVerifier.Add(mnb.pubKeyCollateralAddress, mnb.vchSig, mnb.GetSignatureMessage());
+        nQueued += signedMessageVerifier.Add(mnb.pubKeySmartnode, mnb.lastPing.vchSig, mnb.lastPing.GetSignatureMessage());
+    }
+
+    // the rest is signed by a smartnode key we know, unknown smartnodes are left to the handlers
+    smartnode_info_t mnInfo;
+    BOOST_FOREACH(const CSmartnodePing& mnp, vecMnp) {
+        if (mnodeman.GetSmartnodeInfo(mnp.vin.prevout, mnInfo))
+            nQueued += signedMessageVerifier.Add(mnInfo.pubKeySmartnode, mnp.vchSig, mnp.GetSignatureMessage());
+    }
+    BOOST_FOREACH(const CSmartnodePaymentVote& vote, vecMnw) {
+        if (mnodeman.GetSmartnodeInfo(vote.vinSmartnode.prevout, mnInfo))
+            nQueued += signedMessageVerifier.Add(mnInfo.pubKeySmartnode, vote.vchSig, vote.GetSignatureMessage());
+    }
+    BOOST_FOREACH(const CTxLockVote& vote, vecVotes) {
+        if (mnodeman.GetSmartnodeInfo(vote.GetSmartnodeOutpoint(), mnInfo))
+            nQueued += signedMessageVerifier.Add(mnInfo.pubKeySmartnode, vote.GetSignature(), vote.GetSignatureMessage());
+    }
+    if (!vecSporks.empty()) {
+        CPubKey pubKeySpork(ParseHex(Params().SporkPubKey()));
+        BOOST_FOREACH(const CSporkMessage& spork, vecSporks)
+            nQueued += signedMessageVerifier.Add(pubKeySpork, spork.GetSignature(), spork.GetSignatureMessage());
+    }
+
+    LogPrint("smartnode", "QueueSmartnodeSignatures -- queued %d signatures, peer=%d\n", nQueued, pfrom->id);
+}
@@ -0,0 +1,14 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SMARTNODESIGCHECK_H
+#define SMARTNODESIGCHECK_H
+
+class CNode;
+
+/** Hand the signatures of the mnb, mnp, mnw, txlvote and spork messages queued for pfrom to the
+ *  signedMessageVerifier threads. The handlers find them verified when they get to the messages. */
+void QueueSmartnodeSignatures(CNode* pfrom);
+
+#endif // SMARTNODESIGCHECK_H
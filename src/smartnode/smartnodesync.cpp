@@ -17,19 +17,151 @@
 class CSmartnodeSync;
 CSmartnodeSync smartnodeSync;
 
+UniValue CSmartnodeSyncStats::ToJSON() const
+{
+    int64_t nTime = nTimeSpent + (nTimeStarted ? GetTimeMicros() - nTimeStarted : 0);
+
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("time", 0.000001 * nTime));
+    obj.push_back(Pair("messages", nMessages));
+    obj.push_back(Pair("bytes", nBytes));
+    obj.push_back(Pair("peers", nPeersAsked));
+    obj.push_back(Pair("timeouts", nTimeouts));
+    obj.push_back(Pair("failures", nFailures));
+    return obj;
+}
+
 void CSmartnodeSync::Fail()
 {
+    {
+        LOCK(cs);
+        mapAssetStats[nRequestedSmartnodeAssets].nFailures++;
+    }
+    FinishAssetStats();
     nTimeLastFailure = GetTime();
     nRequestedSmartnodeAssets = SMARTNODE_SYNC_FAILED;
 }
 
 void CSmartnodeSync::Reset()
 {
+    FinishAssetStats();
     nRequestedSmartnodeAssets = SMARTNODE_SYNC_INITIAL;
     nRequestedSmartnodeAttempt = 0;
     nTimeAssetSyncStarted = GetTime();
     nTimeLastBumped = GetTime();
     nTimeLastFailure = 0;
+    StartAssetStats();
+}
+
+void CSmartnodeSync::StartAssetStats()
+{
+    if(IsSynced() || IsFailed()) return;
+
+    LOCK(cs);
+    CSmartnodeSyncStats& stats = mapAssetStats[nRequestedSmartnodeAssets];
+    stats.nTimeStarted = GetTimeMicros();
+    stats.nMessagesAtLastTick = stats.nMessages;
+    stats.nMaxMessagesPerTick = 0;
+}
+
+void CSmartnodeSync::FinishAssetStats()
+{
+    LOCK(cs);
+    auto it = mapAssetStats.find(nRequestedSmartnodeAssets);
+    if(it == mapAssetStats.end() || !it->second.nTimeStarted) return;
+
+    CSmartnodeSyncStats& stats = it->second;
+    int64_t nTime = GetTimeMicros() - stats.nTimeStarted;
+    stats.nTimeSpent += nTime;
+    stats.nTimeStarted = 0;
+    LogPrint("bench", "CSmartnodeSync::FinishAssetStats -- %s: %.2fms [%.2fs], %d messages, %d bytes, %d peers, %d timeouts, %d failures\n",
+            GetAssetName(), 0.001 * nTime, 0.000001 * stats.nTimeSpent, stats.nMessages, stats.nBytes, stats.nPeersAsked, stats.nTimeouts, stats.nFailures);
+}
+
+void CSmartnodeSync::AddAssetPeerAsked()
+{
+    LOCK(cs);
+    mapAssetStats[nRequestedSmartnodeAssets].nPeersAsked++;
+}
+
+void CSmartnodeSync::AddAssetTimeout()
+{
+    LOCK(cs);
+    mapAssetStats[nRequestedSmartnodeAssets].nTimeouts++;
+}
+
+void CSmartnodeSync::AddAssetMessage(const std::string& strCommand, size_t nBytes)
+{
+    int nAsset;
+    if(strCommand == NetMsgType::MNANNOUNCE || strCommand == NetMsgType::MNPING) {
+        nAsset = SMARTNODE_SYNC_LIST;
+    } else if(strCommand == NetMsgType::SMARTNODEPAYMENTVOTE) {
+        nAsset = SMARTNODE_SYNC_MNW;
+    } else {
+        return;
+    }
+
+    // only count what comes in while we are syncing this asset
+    if(nAsset != nRequestedSmartnodeAssets) return;
+
+    LOCK(cs);
+    CSmartnodeSyncStats& stats = mapAssetStats[nAsset];
+    stats.nMessages++;
+    stats.nBytes += nBytes;
+}
+
+bool CSmartnodeSync::IsAssetDataRateCollapsed()
+{
+    LOCK(cs);
+    CSmartnodeSyncStats& stats = mapAssetStats[nRequestedSmartnodeAssets];
+    int nMessagesThisTick = stats.nMessages - stats.nMessagesAtLastTick;
+    stats.nMessagesAtLastTick = stats.nMessages;
+    stats.nMaxMessagesPerTick = std::max(stats.nMaxMessagesPerTick, nMessagesThisTick);
+
+    // give enough peers a chance to answer and wait for the data to actually start flowing
+    if(nRequestedSmartnodeAttempt < SMARTNODE_SYNC_ENOUGH_PEERS || stats.nMaxMessagesPerTick == 0) return false;
+
+    return nMessagesThisTick * SMARTNODE_SYNC_RATE_COLLAPSE < stats.nMaxMessagesPerTick;
+}
+
+bool CSmartnodeSync::CanRequestList(CNode* pnode)
+{
+    if(pnode->fSmartnode || (fSmartNode && pnode->fInbound)) return false;
+    if(netfulfilledman.HasFulfilledRequest(pnode->addr, FULFILLED_FULL_SYNC)) return false;
+    if(netfulfilledman.HasFulfilledRequest(pnode->addr, FULFILLED_SMARTNODE_LIST_SYNC)) return false;
+    return pnode->nVersion >= mnpayments.GetMinSmartnodePaymentsProto();
+}
+
+// Split the list among up to SMARTNODE_SYNC_LIST_PARTS peers asked at once, instead of waiting
+// for one peer to send all of it. Returns the number of peers asked.
+int CSmartnodeSync::RequestListInParts(const std::vector<CNode*>& vNodes, CConnman& connman)
+{
+    std::vector<CNode*> vPeers;
+    BOOST_FOREACH(CNode* pnode, vNodes) {
+        if((int)vPeers.size() == SMARTNODE_SYNC_LIST_PARTS) break;
+        if(CanRequestList(pnode)) vPeers.push_back(pnode);
+    }
+
+    for(size_t i = 0; i < vPeers.size(); i++) {
+        netfulfilledman.AddFulfilledRequest(vPeers[i]->addr, FULFILLED_SMARTNODE_LIST_SYNC);
+        nRequestedSmartnodeAttempt++;
+        AddAssetPeerAsked();
+        mnodeman.DsegUpdate(vPeers[i], connman, i, vPeers.size());
+    }
+    if(!vPeers.empty()) {
+        LogPrintf("CSmartnodeSync::RequestListInParts -- asked %d peers for a part of the list each\n", vPeers.size());
+    }
+    return vPeers.size();
+}
+
+UniValue CSmartnodeSync::GetAssetStatsJSON()
+{
+    LOCK(cs);
+    UniValue obj(UniValue::VOBJ);
+    for (const auto& asset : mapAssetStats) {
+        obj.push_back(Pair(GetAssetName(asset.first), asset.second.ToJSON()));
+    }
+    return obj;
 }
 
 void CSmartnodeSync::BumpAssetLastTime(std::string strFuncName)
@@ -39,9 +171,9 @@ void CSmartnodeSync::BumpAssetLastTime(std::string strFuncName)
     LogPrint("mnsync", "CSmartnodeSync::BumpAssetLastTime -- %s\n", strFuncName);
 }
 
-std::string CSmartnodeSync::GetAssetName()
+std::string CSmartnodeSync::GetAssetName(int nAsset)
 {
-    switch(nRequestedSmartnodeAssets)
+    switch(nAsset)
     {
         case(SMARTNODE_SYNC_INITIAL):      return "SMARTNODE_SYNC_INITIAL";
         case(SMARTNODE_SYNC_WAITING):      return "SMARTNODE_SYNC_WAITING";
@@ -55,6 +187,8 @@ std::string CSmartnodeSync::GetAssetName()
 
 void CSmartnodeSync::SwitchToNextAsset(CConnman& connman)
 {
+    FinishAssetStats();
+
     switch(nRequestedSmartnodeAssets)
     {
         case(SMARTNODE_SYNC_FAILED):
@@ -91,7 +225,7 @@ void CSmartnodeSync::SwitchToNextAsset(CConnman& connman)
             // if(lockRecv) { ... }
 
             connman.ForEachNode(CConnman::AllNodes, [](CNode* pnode) {
-                netfulfilledman.AddFulfilledRequest(pnode->addr, "full-sync");
+                netfulfilledman.AddFulfilledRequest(pnode->addr, FULFILLED_FULL_SYNC);
             });
 
             break;
@@ -99,6 +233,7 @@ void CSmartnodeSync::SwitchToNextAsset(CConnman& connman)
     nRequestedSmartnodeAttempt = 0;
     nTimeAssetSyncStarted = GetTime();
     BumpAssetLastTime("CSmartnodeSync::SwitchToNextAsset");
+    StartAssetStats();
 }
 
 std::string CSmartnodeSync::GetSyncStatus()
@@ -136,10 +271,10 @@ void CSmartnodeSync::ClearFulfilledRequests(CConnman& connman)
 //     if(!lockRecv) return;
 
     connman.ForEachNode(CConnman::AllNodes, [](CNode* pnode) {
-        netfulfilledman.RemoveFulfilledRequest(pnode->addr, "spork-sync");
-        netfulfilledman.RemoveFulfilledRequest(pnode->addr, "smartnode-list-sync");
-        netfulfilledman.RemoveFulfilledRequest(pnode->addr, "smartnode-payment-sync");
-        netfulfilledman.RemoveFulfilledRequest(pnode->addr, "full-sync");
+        netfulfilledman.RemoveFulfilledRequest(pnode->addr, FULFILLED_SPORK_SYNC);
+        netfulfilledman.RemoveFulfilledRequest(pnode->addr, FULFILLED_SMARTNODE_LIST_SYNC);
+        netfulfilledman.RemoveFulfilledRequest(pnode->addr, FULFILLED_SMARTNODE_PAYMENT_SYNC);
+        netfulfilledman.RemoveFulfilledRequest(pnode->addr, FULFILLED_FULL_SYNC);
     });
 }
 
@@ -182,6 +317,15 @@ void CSmartnodeSync::ProcessTick(CConnman& connman)
     LogPrintf("CSmartnodeSync::ProcessTick -- nTick %d nRequestedSmartnodeAssets %d nRequestedSmartnodeAttempt %d nSyncProgress %f\n", nTick, nRequestedSmartnodeAssets, nRequestedSmartnodeAttempt, nSyncProgress);
     uiInterface.NotifyAdditionalDataSyncProgressChanged(nSyncProgress);
 
+    // ADAPTIVE : don't sit out the timeout once peers stopped sending data for the current asset
+    if(nRequestedSmartnodeAssets == SMARTNODE_SYNC_LIST || nRequestedSmartnodeAssets == SMARTNODE_SYNC_MNW) {
+        if(IsAssetDataRateCollapsed() && fAdaptive) {
+            LogPrintf("CSmartnodeSync::ProcessTick -- nTick %d nRequestedSmartnodeAssets %d -- data rate collapsed\n", nTick, nRequestedSmartnodeAssets);
+            SwitchToNextAsset(connman);
+            return;
+        }
+    }
+
     std::vector<CNode*> vNodesCopy = connman.CopyNodeVector();
 
     BOOST_FOREACH(CNode* pnode, vNodesCopy)
@@ -194,7 +338,7 @@ void CSmartnodeSync::ProcessTick(CConnman& connman)
 
         // NORMAL NETWORK MODE - TESTNET/MAINNET
         {
-            if(netfulfilledman.HasFulfilledRequest(pnode->addr, "full-sync")) {
+            if(netfulfilledman.HasFulfilledRequest(pnode->addr, FULFILLED_FULL_SYNC)) {
                 // We already fully synced from this node recently,
                 // disconnect to free this connection slot for another peer.
                 pnode->fDisconnect = true;
@@ -204,9 +348,9 @@ void CSmartnodeSync::ProcessTick(CConnman& connman)
 
             // SPORK : ALWAYS ASK FOR SPORKS AS WE SYNC
 
-            if(!netfulfilledman.HasFulfilledRequest(pnode->addr, "spork-sync")) {
+            if(!netfulfilledman.HasFulfilledRequest(pnode->addr, FULFILLED_SPORK_SYNC)) {
                 // always get sporks first, only request once from each peer
-                netfulfilledman.AddFulfilledRequest(pnode->addr, "spork-sync");
+                netfulfilledman.AddFulfilledRequest(pnode->addr, FULFILLED_SPORK_SYNC);
                 // get current network sporks
                 connman.PushMessageWithVersion(pnode, INIT_PROTO_VERSION, NetMsgType::GETSPORKS);
                 LogPrintf("CSmartnodeSync::ProcessTick -- nTick %d nRequestedSmartnodeAssets %d -- requesting sporks from peer %d\n", nTick, nRequestedSmartnodeAssets, pnode->id);
@@ -235,6 +379,7 @@ void CSmartnodeSync::ProcessTick(CConnman& connman)
                 // check for timeout first
                 if(GetTime() - nTimeLastBumped > SMARTNODE_SYNC_TIMEOUT_SECONDS) {
                     LogPrintf("CSmartnodeSync::ProcessTick -- nTick %d nRequestedSmartnodeAssets %d -- timeout\n", nTick, nRequestedSmartnodeAssets);
+                    AddAssetTimeout();
                     if (nRequestedSmartnodeAttempt == 0) {
                         LogPrintf("CSmartnodeSync::ProcessTick -- ERROR: failed to sync %s\n", GetAssetName());
                         // there is no way we can continue without smartnode list, fail here and try later
@@ -247,12 +392,20 @@ void CSmartnodeSync::ProcessTick(CConnman& connman)
                     return;
                 }
 
+                // the first request is split among several peers, later ones ask a single peer for the whole list
+                // to fill in whatever the first ones left out
+                if(nRequestedSmartnodeAttempt == 0 && RequestListInParts(vNodesCopy, connman) > 0) {
+                    connman.ReleaseNodeVector(vNodesCopy);
+                    return;
+                }
+
                 // only request once from each peer
-                if(netfulfilledman.HasFulfilledRequest(pnode->addr, "smartnode-list-sync")) continue;
-                netfulfilledman.AddFulfilledRequest(pnode->addr, "smartnode-list-sync");
+                if(netfulfilledman.HasFulfilledRequest(pnode->addr, FULFILLED_SMARTNODE_LIST_SYNC)) continue;
+                netfulfilledman.AddFulfilledRequest(pnode->addr, FULFILLED_SMARTNODE_LIST_SYNC);
 
                 if (pnode->nVersion < mnpayments.GetMinSmartnodePaymentsProto()) continue;
                 nRequestedSmartnodeAttempt++;
+                AddAssetPeerAsked();
 
                 mnodeman.DsegUpdate(pnode, connman);
 
@@ -269,6 +422,7 @@ void CSmartnodeSync::ProcessTick(CConnman& connman)
                 // but that should be OK and it should timeout eventually.
                 if(GetTime() - nTimeLastBumped > SMARTNODE_SYNC_TIMEOUT_SECONDS) {
                     LogPrintf("CSmartnodeSync::ProcessTick -- nTick %d nRequestedSmartnodeAssets %d -- timeout\n", nTick, nRequestedSmartnodeAssets);
+                    AddAssetTimeout();
                     if (nRequestedSmartnodeAttempt == 0) {
                         LogPrintf("CSmartnodeSync::ProcessTick -- ERROR: failed to sync %s\n", GetAssetName());
                         // probably not a good idea to proceed without winner list
@@ -292,11 +446,12 @@ void CSmartnodeSync::ProcessTick(CConnman& connman)
                 }
 
                 // only request once from each peer
-                if(netfulfilledman.HasFulfilledRequest(pnode->addr, "smartnode-payment-sync")) continue;
-                netfulfilledman.AddFulfilledRequest(pnode->addr, "smartnode-payment-sync");
+                if(netfulfilledman.HasFulfilledRequest(pnode->addr, FULFILLED_SMARTNODE_PAYMENT_SYNC)) continue;
+                netfulfilledman.AddFulfilledRequest(pnode->addr, FULFILLED_SMARTNODE_PAYMENT_SYNC);
 
                 if(pnode->nVersion < mnpayments.GetMinSmartnodePaymentsProto()) continue;
                 nRequestedSmartnodeAttempt++;
+                AddAssetPeerAsked();
 
                 // ask node for all payment votes it has (new nodes will only return votes for future payments)
                 connman.PushMessage(pnode, NetMsgType::SMARTNODEPAYMENTSYNC, mnpayments.GetStorageLimit());
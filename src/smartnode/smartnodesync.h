@@ -22,9 +22,48 @@ static const int SMARTNODE_SYNC_TICK_SECONDS    = 6;
 static const int SMARTNODE_SYNC_TIMEOUT_SECONDS = 20; // our blocks are 2.5 minutes so 30 seconds should be fine
 
 static const int SMARTNODE_SYNC_ENOUGH_PEERS    = 3;
+// The first request for the list is split among up to this many peers
+static const int SMARTNODE_SYNC_LIST_PARTS      = 4;
+// In adaptive mode an asset is done once a tick brings less than 1/N of the busiest tick's messages
+static const int SMARTNODE_SYNC_RATE_COLLAPSE   = 10;
+
+static const bool DEFAULT_SMARTNODE_SYNC_ADAPTIVE = false;
 
 extern CSmartnodeSync smartnodeSync;
 
+//
+// CSmartnodeSyncStats : What it took to sync one asset, summed up over all attempts
+//
+
+struct CSmartnodeSyncStats
+{
+    int64_t nTimeStarted; // micros, start of the current attempt or 0
+    int64_t nTimeSpent; // micros
+    int nMessages;
+    uint64_t nBytes;
+    int nPeersAsked;
+    int nTimeouts;
+    int nFailures;
+
+    // messages seen at the previous tick and in the busiest tick, used by the adaptive mode
+    int nMessagesAtLastTick;
+    int nMaxMessagesPerTick;
+
+    CSmartnodeSyncStats() :
+        nTimeStarted(0),
+        nTimeSpent(0),
+        nMessages(0),
+        nBytes(0),
+        nPeersAsked(0),
+        nTimeouts(0),
+        nFailures(0),
+        nMessagesAtLastTick(0),
+        nMaxMessagesPerTick(0)
+        {}
+
+    UniValue ToJSON() const;
+};
+
 //
 // CSmartnodeSync : Sync smartnode assets in stages
 //
@@ -44,11 +83,27 @@ private:
     // ... or failed
     int64_t nTimeLastFailure;
 
+    // Move on as soon as the data rate of an asset collapses
+    bool fAdaptive;
+
+    // protects mapAssetStats
+    CCriticalSection cs;
+    std::map<int, CSmartnodeSyncStats> mapAssetStats;
+
     void Fail();
     void ClearFulfilledRequests(CConnman& connman);
 
+    void StartAssetStats();
+    void FinishAssetStats();
+    void AddAssetPeerAsked();
+    void AddAssetTimeout();
+    bool IsAssetDataRateCollapsed();
+
+    bool CanRequestList(CNode* pnode);
+    int RequestListInParts(const std::vector<CNode*>& vNodes, CConnman& connman);
+
 public:
-    CSmartnodeSync() { Reset(); }
+    CSmartnodeSync() : fAdaptive(DEFAULT_SMARTNODE_SYNC_ADAPTIVE) { Reset(); }
 
     bool IsFailed() { return nRequestedSmartnodeAssets == SMARTNODE_SYNC_FAILED; }
     bool IsBlockchainSynced() { return nRequestedSmartnodeAssets > SMARTNODE_SYNC_WAITING; }
@@ -60,9 +115,16 @@ public:
     int GetAttempt() { return nRequestedSmartnodeAttempt; }
     void BumpAssetLastTime(std::string strFuncName);
     int64_t GetAssetStartTime() { return nTimeAssetSyncStarted; }
-    std::string GetAssetName();
+    std::string GetAssetName() { return GetAssetName(nRequestedSmartnodeAssets); }
+    static std::string GetAssetName(int nAsset);
     std::string GetSyncStatus();
 
+    void SetAdaptive(bool fAdaptiveIn) { fAdaptive = fAdaptiveIn; }
+    bool IsAdaptive() { return fAdaptive; }
+    // count a message received for the asset that is currently synced
+    void AddAssetMessage(const std::string& strCommand, size_t nBytes);
+    UniValue GetAssetStatsJSON();
+
     void Reset();
     void SwitchToNextAsset(CConnman& connman);
 
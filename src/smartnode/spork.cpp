@@ -4,12 +4,15 @@
 
 #include "../chainparams.h"
 #include "../validation.h"
+#include "../validationinterface.h"
 #include "../messagesigner.h"
 #include "../net_processing.h"
 #include "spork.h"
 
 #include <boost/lexical_cast.hpp>
 
+#include <limits>
+
 class CSporkMessage;
 class CSporkManager;
 
@@ -17,6 +20,15 @@ CSporkManager sporkManager;
 
 std::map<uint256, CSporkMessage> mapSporks;
 
+// value of sporks that have neither a default nor a message from the network
+static const int64_t SPORK_VALUE_UNKNOWN = std::numeric_limits<int64_t>::min();
+
+CSporkManager::CSporkManager()
+{
+    for (int i = 0; i < SPORK_COUNT; i++)
+        nSporkValues[i] = GetSporkDefaultValue(SPORK_START + i);
+}
+
 void CSporkManager::ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv, CConnman& connman)
 {
     if(fLiteMode) return; // disable all Smartcash specific functionality
@@ -36,15 +48,18 @@ void CSporkManager::ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStr
             strLogMsg = strprintf("SPORK -- hash: %s id: %d value: %10d bestHeight: %d peer=%d", hash.ToString(), spork.nSporkID, spork.nValue, chainActive.Height(), pfrom->id);
         }
 
-        if(mapSporksActive.count(spork.nSporkID)) {
-            if (mapSporksActive[spork.nSporkID].nTimeSigned >= spork.nTimeSigned) {
-                LogPrint("spork", "%s seen\n", strLogMsg);
-                return;
+        {
+            LOCK(cs);
+            if(mapSporksActive.count(spork.nSporkID)) {
+                if (mapSporksActive[spork.nSporkID].nTimeSigned >= spork.nTimeSigned) {
+                    LogPrint("spork", "%s seen\n", strLogMsg);
+                    return;
+                } else {
+                    LogPrintf("%s updated\n", strLogMsg);
+                }
             } else {
-                LogPrintf("%s updated\n", strLogMsg);
+                LogPrintf("%s new\n", strLogMsg);
             }
-        } else {
-            LogPrintf("%s new\n", strLogMsg);
         }
 
         if(!spork.CheckSignature()) {
@@ -54,14 +69,16 @@ void CSporkManager::ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStr
         }
 
         mapSporks[hash] = spork;
-        mapSporksActive[spork.nSporkID] = spork;
+        SetSporkActive(spork);
         spork.Relay(connman);
+        GetMainSignals().NotifySporkChanged(spork);
 
         //does a task if needed
         ExecuteSpork(spork.nSporkID, spork.nValue);
 
     } else if (strCommand == NetMsgType::GETSPORKS) {
 
+        LOCK(cs);
         std::map<int, CSporkMessage>::iterator it = mapSporksActive.begin();
 
         while(it != mapSporksActive.end()) {
@@ -109,47 +126,35 @@ bool CSporkManager::UpdateSpork(int nSporkID, int64_t nValue, CConnman& connman)
     if(spork.Sign(strSmartPrivKey)) {
         spork.Relay(connman);
         mapSporks[spork.GetHash()] = spork;
-        mapSporksActive[nSporkID] = spork;
+        SetSporkActive(spork);
+        GetMainSignals().NotifySporkChanged(spork);
         return true;
     }
 
     return false;
 }
 
-// grab the spork, otherwise say it's off
-bool CSporkManager::IsSporkActive(int nSporkID)
+void CSporkManager::SetSporkActive(const CSporkMessage& spork)
 {
-    int64_t r = -1;
+    LOCK(cs);
+    mapSporksActive[spork.nSporkID] = spork;
+    if(spork.nSporkID >= SPORK_START && spork.nSporkID <= SPORK_END)
+        nSporkValues[spork.nSporkID - SPORK_START] = spork.nValue;
+}
 
-    if(mapSporksActive.count(nSporkID)){
-        r = mapSporksActive[nSporkID].nValue;
-    } else {
-        switch (nSporkID) {
-            case SPORK_2_INSTANTSEND_ENABLED:               r = SPORK_2_INSTANTSEND_ENABLED_DEFAULT; break;
-            case SPORK_3_INSTANTSEND_BLOCK_FILTERING:       r = SPORK_3_INSTANTSEND_BLOCK_FILTERING_DEFAULT; break;
-            case SPORK_5_INSTANTSEND_MAX_VALUE:             r = SPORK_5_INSTANTSEND_MAX_VALUE_DEFAULT; break;
-            case SPORK_8_SMARTNODE_PAYMENT_ENFORCEMENT:    r = SPORK_8_SMARTNODE_PAYMENT_ENFORCEMENT_DEFAULT; break;
-            case SPORK_9_SUPERBLOCKS_ENABLED:               r = SPORK_9_SUPERBLOCKS_ENABLED_DEFAULT; break;
-            case SPORK_10_SMARTNODE_PAY_UPDATED_NODES:     r = SPORK_10_SMARTNODE_PAY_UPDATED_NODES_DEFAULT; break;
-            case SPORK_12_RECONSIDER_BLOCKS:                r = SPORK_12_RECONSIDER_BLOCKS_DEFAULT; break;
-            case SPORK_13_OLD_SUPERBLOCK_FLAG:              r = SPORK_13_OLD_SUPERBLOCK_FLAG_DEFAULT; break;
-            case SPORK_14_REQUIRE_SENTINEL_FLAG:            r = SPORK_14_REQUIRE_SENTINEL_FLAG_DEFAULT; break;
-            default:
-                LogPrint("spork", "CSporkManager::IsSporkActive -- Unknown Spork ID %d\n", nSporkID);
-                r = 4070908800ULL; // 2099-1-1 i.e. off by default
-                break;
-        }
-    }
+int64_t CSporkManager::LoadSporkValue(int nSporkID)
+{
+    if(nSporkID >= SPORK_START && nSporkID <= SPORK_END)
+        return nSporkValues[nSporkID - SPORK_START].load(std::memory_order_relaxed);
 
-    return r < GetAdjustedTime();
+    // ids outside of the table can only be known from the network
+    LOCK(cs);
+    std::map<int, CSporkMessage>::iterator it = mapSporksActive.find(nSporkID);
+    return it == mapSporksActive.end() ? SPORK_VALUE_UNKNOWN : it->second.nValue;
 }
 
-// grab the value of the spork on the network, or the default
-int64_t CSporkManager::GetSporkValue(int nSporkID)
+int64_t CSporkManager::GetSporkDefaultValue(int nSporkID)
 {
-    if (mapSporksActive.count(nSporkID))
-        return mapSporksActive[nSporkID].nValue;
-
     switch (nSporkID) {
         case SPORK_2_INSTANTSEND_ENABLED:               return SPORK_2_INSTANTSEND_ENABLED_DEFAULT;
         case SPORK_3_INSTANTSEND_BLOCK_FILTERING:       return SPORK_3_INSTANTSEND_BLOCK_FILTERING_DEFAULT;
@@ -160,11 +165,34 @@ int64_t CSporkManager::GetSporkValue(int nSporkID)
         case SPORK_12_RECONSIDER_BLOCKS:                return SPORK_12_RECONSIDER_BLOCKS_DEFAULT;
         case SPORK_13_OLD_SUPERBLOCK_FLAG:              return SPORK_13_OLD_SUPERBLOCK_FLAG_DEFAULT;
         case SPORK_14_REQUIRE_SENTINEL_FLAG:            return SPORK_14_REQUIRE_SENTINEL_FLAG_DEFAULT;
-        default:
-            LogPrint("spork", "CSporkManager::GetSporkValue -- Unknown Spork ID %d\n", nSporkID);
-            return -1;
+        default:                                        return SPORK_VALUE_UNKNOWN;
     }
+}
 
+// grab the spork, otherwise say it's off
+bool CSporkManager::IsSporkActive(int nSporkID)
+{
+    int64_t r = LoadSporkValue(nSporkID);
+
+    if(r == SPORK_VALUE_UNKNOWN) {
+        LogPrint("spork", "CSporkManager::IsSporkActive -- Unknown Spork ID %d\n", nSporkID);
+        r = 4070908800ULL; // 2099-1-1 i.e. off by default
+    }
+
+    return r < GetAdjustedTime();
+}
+
+// grab the value of the spork on the network, or the default
+int64_t CSporkManager::GetSporkValue(int nSporkID)
+{
+    int64_t r = LoadSporkValue(nSporkID);
+
+    if(r == SPORK_VALUE_UNKNOWN) {
+        LogPrint("spork", "CSporkManager::GetSporkValue -- Unknown Spork ID %d\n", nSporkID);
+        return -1;
+    }
+
+    return r;
 }
 
 int CSporkManager::GetSporkIDByName(std::string strName)
@@ -217,12 +245,17 @@ bool CSporkManager::SetPrivKey(std::string strPrivKey)
     }
 }
 
+std::string CSporkMessage::GetSignatureMessage() const
+{
+    return boost::lexical_cast<std::string>(nSporkID) + boost::lexical_cast<std::string>(nValue) + boost::lexical_cast<std::string>(nTimeSigned);
+}
+
 bool CSporkMessage::Sign(std::string strSignKey)
 {
     CKey key;
     CPubKey pubkey;
     std::string strError = "";
-    std::string strMessage = boost::lexical_cast<std::string>(nSporkID) + boost::lexical_cast<std::string>(nValue) + boost::lexical_cast<std::string>(nTimeSigned);
+    std::string strMessage = GetSignatureMessage();
 
     if(!CMessageSigner::GetKeysFromSecret(strSignKey, key, pubkey)) {
         LogPrintf("CSporkMessage::Sign -- GetKeysFromSecret() failed, invalid spork key %s\n", strSignKey);
@@ -246,7 +279,7 @@ bool CSporkMessage::CheckSignature()
 {
     //note: need to investigate why this is failing
     std::string strError = "";
-    std::string strMessage = boost::lexical_cast<std::string>(nSporkID) + boost::lexical_cast<std::string>(nValue) + boost::lexical_cast<std::string>(nTimeSigned);
+    std::string strMessage = GetSignatureMessage();
     CPubKey pubkey(ParseHex(Params().SporkPubKey()));
 
     if(!CMessageSigner::VerifyMessage(pubkey, vchSig, strMessage, strError)) {
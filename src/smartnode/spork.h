@@ -9,6 +9,8 @@
 #include "../net.h"
 #include "../utilstrencodings.h"
 
+#include <atomic>
+
 class CSporkMessage;
 class CSporkManager;
 
@@ -18,6 +20,7 @@ class CSporkManager;
 */
 static const int SPORK_START                                            = 10001;
 static const int SPORK_END                                              = 10013;
+static const int SPORK_COUNT                                            = SPORK_END - SPORK_START + 1;
 
 static const int SPORK_2_INSTANTSEND_ENABLED                            = 10001;
 static const int SPORK_3_INSTANTSEND_BLOCK_FILTERING                    = 10002;
@@ -89,6 +92,8 @@ public:
         return ss.GetHash();
     }
 
+    const std::vector<unsigned char>& GetSignature() const { return vchSig; }
+    std::string GetSignatureMessage() const;
     bool Sign(std::string strSignKey);
     bool CheckSignature();
     void Relay(CConnman& connman);
@@ -100,11 +105,20 @@ class CSporkManager
 private:
     std::vector<unsigned char> vchSig;
     std::string strSmartPrivKey;
+    // protects mapSporksActive
+    CCriticalSection cs;
     std::map<int, CSporkMessage> mapSporksActive;
+    // Current value of every spork between SPORK_START and SPORK_END, updated together
+    // with mapSporksActive so the frequent IsSporkActive/GetSporkValue calls need no lock
+    std::atomic<int64_t> nSporkValues[SPORK_COUNT];
+
+    static int64_t GetSporkDefaultValue(int nSporkID);
+    int64_t LoadSporkValue(int nSporkID);
+    void SetSporkActive(const CSporkMessage& spork);
 
 public:
 
-    CSporkManager() {}
+    CSporkManager();
 
     void ProcessSpork(CNode* pfrom, std::string& strCommand, CDataStream& vRecv, CConnman& connman);
     void ExecuteSpork(int nSporkID, int nValue);
@@ -5,16 +5,30 @@
 #include "smartrewards/rewards.h"
 #include "smarthive/hive.h"
 #include "validation.h"
+#include "validationinterface.h"
 #include "init.h"
+#include "metrics.h"
+#include "trace.h"
 #include "ui_interface.h"
+#include "undo.h"
+#include "txdb.h"
+#include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 #include <boost/range/irange.hpp>
 #include <boost/date_time/gregorian/gregorian.hpp>
 
 CSmartRewards *prewards = NULL;
 
-CCriticalSection cs_rewardsdb;
-CCriticalSection cs_rewardrounds;
+boost::shared_mutex cs_rewardsdb;
+// Serializes the block processing of the rewards thread and the direct fallback.
+CCriticalSection cs_rewardsprocessing;
+
+// Connected blocks waiting for the rewards thread.
+static std::deque<CBlockIndex*> queueRewardsBlocks;
+static bool fRewardsThreadRunning = false;
+static bool fRewardsThreadBusy = false;
+static boost::mutex csRewardsQueue;
+static boost::condition_variable condRewardsQueue;
 
 // Used for time conversions.
 boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
@@ -29,6 +43,30 @@ int GetBlockHeight(const CBlockIndex *index)
     return syncDiff > 1200 ? firstTxDiff / 55 : index->nHeight; // If we are 20 minutes near now use the current height.
 }
 
+// Read a confirmed transaction from the txindex. Unlike ::GetTransaction this
+// doesn't need cs_main, which block validation may hold while it waits for the
+// rewards thread.
+static bool ReadIndexedTransaction(const uint256 &hash, CTransaction &tx)
+{
+    CDiskTxPos postx;
+
+    if( !fTxIndex || !pblocktree->ReadTxIndex(hash, postx) ) return false;
+
+    CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+    if( file.IsNull() ) return error("%s: OpenBlockFile failed", __func__);
+
+    try {
+        CBlockHeader header;
+        file >> header;
+        fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+        file >> tx;
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+
+    return tx.GetHash() == hash;
+}
+
 int ParseScript(const CScript &script, std::vector<CSmartAddress> &ids){
 
     std::vector<CTxDestination> addresses;
@@ -47,118 +85,307 @@ int ParseScript(const CScript &script, std::vector<CSmartAddress> &ids){
     return nRequired;
 }
 
-void CalculateRewardRatio(CSmartRewardRound &round)
+// Scripts that don't match the P2PKH or P2SH template need the full
+// ExtractDestinations. Their results are kept for repeated payees.
+static const size_t nAddressCacheSize = 10000;
+
+struct CAddressCacheEntry
+{
+    bool fParsed;
+    CSmartAddress id;
+    std::list<CScript>::iterator itLru;
+};
+
+static CCriticalSection cs_addressCache;
+static std::map<CScript, CAddressCacheEntry> mapAddressCache;
+// Keys of mapAddressCache, the most recently used first.
+static std::list<CScript> listAddressCache;
+
+// Get the single address a script pays to.
+static bool ParseSmartAddress(const CScript &script, CSmartAddress &id)
 {
-    int64_t time = GetTime();
-    int64_t start = round.startBlockHeight;
-    round.rewards = 0;
+    // Read the standard templates directly instead of solving them.
+    if( script.size() == 25 && script[0] == OP_DUP && script[1] == OP_HASH160 && script[2] == 20 &&
+        script[23] == OP_EQUALVERIFY && script[24] == OP_CHECKSIG ){
+        CKeyID keyID;
+        memcpy(keyID.begin(), &script[3], 20);
+        return id.Set(keyID);
+    }
 
-    while( start <= round.endBlockHeight) round.rewards += GetBlockValue(start++,0,time) * 0.15;
+    if( script.IsPayToScriptHash() ){
+        CScriptID scriptID;
+        memcpy(scriptID.begin(), &script[2], 20);
+        return id.Set(scriptID);
+    }
+
+    {
+        LOCK(cs_addressCache);
+
+        auto it = mapAddressCache.find(script);
+
+        if( it != mapAddressCache.end() ){
+            listAddressCache.splice(listAddressCache.begin(), listAddressCache, it->second.itLru);
+            if( it->second.fParsed ) id = it->second.id;
+            return it->second.fParsed;
+        }
+    }
+
+    std::vector<CSmartAddress> ids;
+    int required = ParseScript(script, ids);
+
+    CAddressCacheEntry entry;
+    entry.fParsed = required == 1 && ids.size() == 1;
+    if( entry.fParsed ) entry.id = id = ids.at(0);
+
+    LOCK(cs_addressCache);
+
+    auto inserted = mapAddressCache.insert(std::make_pair(script, entry));
+
+    if( inserted.second ){
+        listAddressCache.push_front(script);
+        inserted.first->second.itLru = listAddressCache.begin();
+
+        if( mapAddressCache.size() > nAddressCacheSize ){
+            mapAddressCache.erase(listAddressCache.back());
+            listAddressCache.pop_back();
+        }
+    }
+
+    return entry.fParsed;
+}
+
+// Block values are multiples of COIN, so 15% of their sum is exactly the sum
+// of 15% of each block.
+CAmount CalculateRewardsForBlockRange(int64_t start, int64_t end)
+{
+    return GetBlockValueRange(start, end) / 20 * 3;
+}
+
+void CalculateRewardRatio(CSmartRewardRound &round)
+{
+    round.rewards = CalculateRewardsForBlockRange(round.startBlockHeight, round.endBlockHeight);
 
     round.percent = double(round.rewards) / ( round.eligibleSmart - round.disqualifiedSmart );
 }
 
 bool CSmartRewards::Verify()
 {
-    LOCK(cs_rewardsdb);
+    boost::shared_lock<boost::shared_mutex> lock(cs_rewardsdb);
     return pdb->Verify(rewardHeight);
 }
 
-bool CSmartRewards::Update(CBlockIndex *pindexNew, const CChainParams& chainparams, CSmartRewardsUpdateResult &result) {
-
-    CSmartRewardEntry *rEntry = nullptr;
+/** A connected block and its undo data, kept until the rewards processing reached it. */
+struct CConnectedRewardsBlock
+{
     CBlock block;
-    ReadBlockFromDisk(block, pindexNew, chainparams.GetConsensus());
+    CBlockUndo blockundo;
+};
 
-    BOOST_FOREACH(const CTransaction &tx, block.vtx) {
+static CCriticalSection cs_connectedBlocks;
+// Blocks connected since the last processed one, see CacheSmartRewardsBlock.
+static std::map<const CBlockIndex*, std::shared_ptr<const CConnectedRewardsBlock>> mapConnectedBlocks;
 
-        CSmartRewardTransaction testTx;
-#ifdef DEBUG_LOCKORDER
-        int nTime1 = GetTimeMicros();
-#endif
-        // First check if the transaction hash did already come up in the past.
-        if( GetTransaction(tx.GetHash(),testTx)){
-            // If yes we want to ignore it!
-            LogPrintf("[%s] Double appearance! First in %d - Now in %d\n",testTx.hash.ToString(), testTx.blockHeight, pindexNew->nHeight);
-            continue;
-        }else{
-            // If not save add it to the database.
-            CSmartRewardTransaction saveTx(pindexNew->nHeight, tx.GetHash());
-            AddTransaction(saveTx);
+void CacheSmartRewardsBlock(const CBlockIndex *pindex, const CBlock &block, const CBlockUndo &blockundo)
+{
+    std::shared_ptr<CConnectedRewardsBlock> connected = std::make_shared<CConnectedRewardsBlock>();
+    connected->block = block;
+    connected->blockundo = blockundo;
+
+    LOCK(cs_connectedBlocks);
+
+    mapConnectedBlocks[pindex] = connected;
+
+    // Blocks further behind than the queue and the confirmations cover are
+    // read from disk again, drop the lowest to stay within that window.
+    while( mapConnectedBlocks.size() > (size_t)(nRewardsConfirmations + nRewardsQueueSize + 1) ){
+        auto itLowest = mapConnectedBlocks.begin();
+        for( auto it = mapConnectedBlocks.begin(); it != mapConnectedBlocks.end(); ++it ){
+            if( it->first->nHeight < itLowest->first->nHeight ) itLowest = it;
         }
+        mapConnectedBlocks.erase(itLowest);
+    }
+}
+
+static std::shared_ptr<const CConnectedRewardsBlock> TakeConnectedBlock(const CBlockIndex *pindex)
+{
+    LOCK(cs_connectedBlocks);
+
+    auto it = mapConnectedBlocks.find(pindex);
+    if( it == mapConnectedBlocks.end() ) return nullptr;
+
+    std::shared_ptr<const CConnectedRewardsBlock> connected = it->second;
+    mapConnectedBlocks.erase(it);
+    return connected;
+}
+
+// Resolve the spent output of each input and the address of each input and
+// output. Blocks connected while running use the block and undo data kept by
+// CacheSmartRewardsBlock, so they don't need to be on disk anymore. Others
+// are read from disk, so this can run ahead of the processing on other threads.
+bool PrepareRewardsBlock(const CBlockIndex *pindex, const Consensus::Params& consensusParams, CSmartRewardsBlockData &data)
+{
+    std::shared_ptr<const CConnectedRewardsBlock> connected = TakeConnectedBlock(pindex);
+
+    if( connected ) return PrepareRewardsBlock(pindex, connected->block, &connected->blockundo, data);
+
+    CBlock block;
+
+    if( !ReadBlockFromDisk(block, pindex, consensusParams) ){
+        data = CSmartRewardsBlockData();
+        data.pindex = pindex;
+        return false;
+    }
+
+    // The outputs spent by this block are in its undo data, use them to avoid
+    // looking up each input's transaction. Only fall back to the txindex when
+    // the undo data is not available.
+    CBlockUndo blockundo;
+    bool fHaveUndo = false;
+    CDiskBlockPos undoPos = pindex->GetUndoPos();
+
+    if( !undoPos.IsNull() && pindex->pprev ){
+        fHaveUndo = UndoReadFromDisk(blockundo, undoPos, pindex->pprev->GetBlockHash());
+    }
+
+    return PrepareRewardsBlock(pindex, block, fHaveUndo ? &blockundo : nullptr, data);
+}
+
+bool PrepareRewardsBlock(const CBlockIndex *pindex, const CBlock &block, const CBlockUndo *pblockundo, CSmartRewardsBlockData &data)
+{
+    data = CSmartRewardsBlockData();
+    data.pindex = pindex;
+
+    data.blockHash = block.GetHash();
+    data.blockTime = block.GetBlockTime();
+
+    bool fHaveUndo = pblockundo && pblockundo->vtxundo.size() + 1 == block.vtx.size();
+
+    data.vtx.resize(block.vtx.size());
+
+    for( size_t nTx = 0; nTx < block.vtx.size(); ++nTx ) {
+
+        const CTransaction &tx = block.vtx[nTx];
+        CSmartRewardsTxData &txData = data.vtx[nTx];
+
+        txData.hash = tx.GetHash();
 
         // No reason to check the input here for new coins.
         if( !tx.IsCoinBase() ){
 
             CTransaction rTx;
-            uint256 rBlockHash;
 
-            BOOST_FOREACH(const CTxIn &in, tx.vin) {
+            const CTxUndo *txundo = fHaveUndo ? &pblockundo->vtxundo[nTx - 1] : nullptr;
+            if( txundo && txundo->vprevout.size() != tx.vin.size() ) txundo = nullptr;
+
+            for( size_t nIn = 0; nIn < tx.vin.size(); ++nIn ) {
+
+                const CTxIn &in = tx.vin[nIn];
 
                 if( in.scriptSig.IsZerocoinSpend() ) continue;
 
-                if(!::GetTransaction(in.prevout.hash,rTx,chainparams.GetConsensus(),rBlockHash)){
-                    return error("%s: GetTransaction - %s\n Input: %s", __func__, tx.ToString(),in.prevout.hash.ToString());
+                if( !txundo && !ReadIndexedTransaction(in.prevout.hash,rTx) ){
+                    txData.strInputError = strprintf("ReadIndexedTransaction - %s\n Input: %s", tx.ToString(),in.prevout.hash.ToString());
+                    break;
                 }
 
-                CTxOut rOut = rTx.vout[in.prevout.n];
+                txData.vin.push_back(CSmartRewardsTxIO());
+                CSmartRewardsTxIO &rIn = txData.vin.back();
 
-                std::vector<CSmartAddress> ids;
+                rIn.out = txundo ? txundo->vprevout[nIn].out : rTx.vout[in.prevout.n];
+                rIn.fParsed = ParseSmartAddress(rIn.out.scriptPubKey, rIn.id);
+            }
+        }
 
-                int required = ParseScript(rOut.scriptPubKey ,ids);
+        BOOST_FOREACH(const CTxOut &out, tx.vout) {
 
-                if( !required || required > 1 || ids.size() > 1 ){
-                    return error("Could't parse CSmartAddress: %s",rOut.ToString());
-                }
+            if(out.scriptPubKey.IsZerocoinMint() ) continue;
+
+            txData.vout.push_back(CSmartRewardsTxIO());
+            CSmartRewardsTxIO &rOut = txData.vout.back();
+
+            rOut.out = out;
+            rOut.fParsed = ParseSmartAddress(out.scriptPubKey, rOut.id);
+        }
+    }
 
-                if(!GetCachedRewardEntry(ids.at(0),rEntry)){
+    return true;
+}
 
-                    rEntry = new CSmartRewardEntry(ids.at(0));
+bool CSmartRewards::Update(const CSmartRewardsBlockData &data, CSmartRewardsUpdateResult &result) {
 
-                    if(!ReadRewardEntry(rEntry->id, *rEntry)){
-                        delete rEntry;
-                        LogPrintf("%s: Spend without previous receive - %s", __func__, tx.ToString());
-                        continue;
-                    }
+    CSmartRewardEntry *rEntry = nullptr;
+    int nHeight = data.pindex->nHeight;
 
-                    rewardEntries.insert(make_pair(ids.at(0), rEntry));
-                }
+    // The cached entries are shared with GetRewardEntry.
+    boost::unique_lock<boost::shared_mutex> lock(cs_rewardsdb);
+
+    BOOST_FOREACH(const CSmartRewardsTxData &tx, data.vtx) {
+
+        CSmartRewardTransaction testTx;
+#ifdef DEBUG_LOCKORDER
+        int nTime1 = GetTimeMicros();
+#endif
+        // First check if the transaction hash did already come up in the past.
+        if( GetTransaction(tx.hash,testTx)){
+            // If yes we want to ignore it!
+            LogPrintf("[%s] Double appearance! First in %d - Now in %d\n",testTx.hash.ToString(), testTx.blockHeight, nHeight);
+            continue;
+        }else{
+            // If not save add it to the database.
+            CSmartRewardTransaction saveTx(nHeight, tx.hash);
+            AddTransaction(saveTx);
+        }
+
+        BOOST_FOREACH(const CSmartRewardsTxIO &in, tx.vin) {
 
-                rEntry->balance -= rOut.nValue;
+            if( !in.fParsed ){
+                return error("Could't parse CSmartAddress: %s",in.out.ToString());
+            }
+
+            if( !(rEntry = rewardEntries.Modify(in.id)) ){
+
+                CSmartRewardEntry entry(in.id);
 
-                if( rEntry->eligible ){
-                    rEntry->eligible = false;
-                    result.disqualifiedEntries++;
-                    result.disqualifiedSmart += rEntry->balanceOnStart;
+                if(!ReadRewardEntry(entry.id, entry)){
+                    LogPrintf("%s: Spend without previous receive - %s\n", __func__, tx.hash.ToString());
+                    continue;
                 }
 
-                if(rEntry->balance < 0 ){
-                    LogPrintf("%s: Negative amount?! - %s", __func__, rEntry->ToString());
-                    rEntry->balance = 0;
-                 }
+                rEntry = rewardEntries.Add(entry);
+            }
+
+            rEntry->balance -= in.out.nValue;
 
+            if( rEntry->eligible ){
+                rEntry->eligible = false;
+                result.disqualifiedEntries++;
+                result.disqualifiedSmart += rEntry->balanceOnStart;
             }
+
+            if(rEntry->balance < 0 ){
+                LogPrintf("%s: Negative amount?! - %s", __func__, rEntry->ToString());
+                rEntry->balance = 0;
+             }
+        }
+
+        if( !tx.strInputError.empty() ){
+            return error("%s: %s", __func__, tx.strInputError);
         }
 #ifdef DEBUG_LOCKORDER
         int nTime2 = GetTimeMicros();
 #endif
 
-        BOOST_FOREACH(const CTxOut &out, tx.vout) {
-
-            if(out.scriptPubKey.IsZerocoinMint() ) continue;
-
-            std::vector<CSmartAddress> ids;
-            int required = ParseScript(out.scriptPubKey ,ids);
+        BOOST_FOREACH(const CSmartRewardsTxIO &out, tx.vout) {
 
-            if( !required || required > 1 || ids.size() > 1 ){
-                return error("Could't parse CSmartAddress: %s",out.ToString());
+            if( !out.fParsed ){
+                return error("Could't parse CSmartAddress: %s",out.out.ToString());
             }else{
-                if(!GetCachedRewardEntry(ids.at(0),rEntry)){
-                    rEntry = new CSmartRewardEntry(ids.at(0));
-                    ReadRewardEntry(rEntry->id, *rEntry);
-                    rewardEntries.insert(make_pair(ids.at(0), rEntry));
+                if( !(rEntry = rewardEntries.Modify(out.id)) ){
+                    CSmartRewardEntry entry(out.id);
+                    ReadRewardEntry(entry.id, entry);
+                    rEntry = rewardEntries.Add(entry);
                 }
-                rEntry->balance += out.nValue;
+                rEntry->balance += out.out.nValue;
             }
         }
 
@@ -167,7 +394,7 @@ bool CSmartRewards::Update(CBlockIndex *pindexNew, const CChainParams& chainpara
         int nTimeTx = nTime3 - nTime1;
 
         if( nTimeTx > 500000){
-            LogPrint("smartrewards", "CSmartRewards::Update TX %s - %.2fms\n",HexStr(tx.GetHash()), nTimeTx * 0.001);
+            LogPrint("smartrewards", "CSmartRewards::Update TX %s - %.2fms\n",tx.hash.ToString(), nTimeTx * 0.001);
             LogPrint("smartrewards", " inputs - %.2fms\n", (nTime2 - nTime1) * 0.001);
             LogPrint("smartrewards", " outputs - %.2fms\n", (nTime3 - nTime2) * 0.001);
         }
@@ -175,59 +402,111 @@ bool CSmartRewards::Update(CBlockIndex *pindexNew, const CChainParams& chainpara
 
     }
 
-    uint256 blockHash = block.GetHash();
-    result.block = CSmartRewardBlock(pindexNew->nHeight, blockHash, block.GetBlockTime());
+    // Syncing takes the lock itself and keeps readers going while it writes.
+    lock.unlock();
+
+    uint256 blockHash = data.blockHash;
+    result.block = CSmartRewardBlock(nHeight, blockHash, data.blockTime);
 
     // Synt the data all nCacheEntires to the db.
-    int preparedEntries = rewardEntries.size() + transactionEntries.size();
+    int preparedEntries = rewardEntries.GetDirtyCount() + transactionEntries.size();
 
     return AddBlock(result.block, preparedEntries > nCacheEntires );
 }
 
-void CSmartRewards::EvaluateRound(CSmartRewardRound &current, CSmartRewardRound &next, CSmartRewardEntryList &entries, CSmartRewardSnapshotList &snapshots)
+void CSmartRewards::SetEntryCacheSize(size_t nEntries)
 {
-    LOCK(cs_rewardsdb);
-    snapshots.clear();
+    boost::unique_lock<boost::shared_mutex> lock(cs_rewardsdb);
+    rewardEntries.SetMaxEntries(nEntries);
+}
 
-    BOOST_FOREACH(CSmartRewardEntry &entry, entries) {
+size_t CSmartRewards::GetEntryCacheUsage()
+{
+    boost::shared_lock<boost::shared_mutex> lock(cs_rewardsdb);
+    return rewardEntries.DynamicMemoryUsage();
+}
 
-        if( current.number ) snapshots.push_back(CSmartRewardSnapshot(entry, current));
+void CSmartRewards::ShrinkEntryCache(size_t nBytes)
+{
+    boost::unique_lock<boost::shared_mutex> lock(cs_rewardsdb);
 
-        entry.balanceOnStart = entry.balance;
-        entry.eligible = entry.balanceOnStart >= SMART_REWARDS_MIN_BALANCE && !SmartHive::IsHive(entry.id);
+    size_t nEntries = rewardEntries.size();
+    if( !nEntries ) return;
 
-        if( entry.eligible ){
-            ++next.eligibleEntries;
-            next.eligibleSmart += entry.balanceOnStart;
-        }
-    }
+    size_t nPerEntry = std::max<size_t>(rewardEntries.DynamicMemoryUsage() / nEntries, 1);
+    size_t nDrop = std::min(nBytes / nPerEntry + 1, nEntries);
+
+    rewardEntries.Trim(nEntries - nDrop);
+}
+
+bool CSmartRewards::EvaluateRound(const CSmartRewardRound &current, CSmartRewardRound &next, CSmartRewardSnapshotList &payouts)
+{
+    // The evaluation updates all entries in the database in chunks, readers
+    // wait for it instead of seeing a half evaluated round.
+    boost::unique_lock<boost::shared_mutex> lock(cs_rewardsdb);
+    rewardEntries.Clear();
+    return pdb->EvaluateRound(current, next, payouts);
 }
 
-bool CSmartRewards::StartFirstRound(const CSmartRewardRound &first, const CSmartRewardEntryList &entries)
+bool CSmartRewards::StartFirstRound(const CSmartRewardRound &first)
 {
-    LOCK(cs_rewardsdb);
-    return pdb->StartFirstRound(first,entries);
+    boost::unique_lock<boost::shared_mutex> lock(cs_rewardsdb);
+    return pdb->StartFirstRound(first);
 }
 
-bool CSmartRewards::FinalizeRound(const CSmartRewardRound &current, const CSmartRewardRound &next, const CSmartRewardEntryList &entries, const CSmartRewardSnapshotList &snapshots)
+bool CSmartRewards::FinalizeRound(const CSmartRewardRound &current, const CSmartRewardRound &next)
 {
-    LOCK(cs_rewardsdb);
-    return pdb->FinalizeRound(current, next, entries, snapshots);
+    boost::unique_lock<boost::shared_mutex> lock(cs_rewardsdb);
+    return pdb->FinalizeRound(current, next);
 }
 
 bool CSmartRewards::GetRewardSnapshots(const int16_t round, CSmartRewardSnapshotList &snapshots)
 {
-    LOCK(cs_rewardsdb);
+    boost::shared_lock<boost::shared_mutex> lock(cs_rewardsdb);
     return pdb->ReadRewardSnapshots(round, snapshots);
 }
 
 bool CSmartRewards::GetRewardPayouts(const int16_t round, CSmartRewardSnapshotList &payouts)
 {
-    LOCK(cs_rewardsdb);
+    boost::shared_lock<boost::shared_mutex> lock(cs_rewardsdb);
     return pdb->ReadRewardPayouts(round, payouts);
 }
 
 
+static boost::filesystem::path GetSnapshotFilePath(const int16_t round)
+{
+    return GetDataDir() / "rewardsnapshots" / strprintf("round%d.dat", round);
+}
+
+static bool WriteSnapshotFile(CSmartRewardsDB *pdb, const int16_t round)
+{
+    boost::filesystem::path path = GetSnapshotFilePath(round);
+    TryCreateDirectory(path.parent_path());
+    return pdb->ExportRewardSnapshots(round, path);
+}
+
+std::shared_ptr<const CSmartRewardSnapshotFile> CSmartRewards::GetSnapshotFile(const int16_t round)
+{
+    LOCK(csSnapshotFiles);
+
+    auto it = snapshotFiles.find(round);
+    if( it != snapshotFiles.end() ) return it->second;
+
+    boost::filesystem::path path = GetSnapshotFilePath(round);
+
+    if( !boost::filesystem::exists(path) ){
+        boost::shared_lock<boost::shared_mutex> lock(cs_rewardsdb);
+        if( !WriteSnapshotFile(pdb, round) ) return nullptr;
+    }
+
+    std::shared_ptr<CSmartRewardSnapshotFile> file = std::make_shared<CSmartRewardSnapshotFile>();
+    if( !file->Open(path, true) || file->GetRound() != (uint32_t)round ) return nullptr;
+
+    snapshotFiles[round] = file;
+
+    return file;
+}
+
 // --- TBD ---
 bool CSmartRewards::RestoreSnapshot(const int16_t round)
 {
@@ -251,56 +530,99 @@ bool CSmartRewards::RestoreSnapshot(const int16_t round)
     return false;
 }
 
-bool CSmartRewards::GetCachedRewardEntry(const CSmartAddress &id, CSmartRewardEntry *&entry)
+CDBIterator *CSmartRewards::NewSyncedIterator(CSmartRewardBlock &last)
 {
-    LOCK(cs_rewardsdb);
+    // The iterator sees the database as it is when it gets created, no block
+    // may get processed in between.
+    LOCK(cs_rewardsprocessing);
 
-    // Return the entry if its already in cache.
-    auto findResult = rewardEntries.find(id);
+    if( !SyncPrepared() ) return nullptr;
 
-    if( findResult != rewardEntries.end() ){
-        entry = findResult->second;
-        return true;
+    boost::shared_lock<boost::shared_mutex> lock(cs_rewardsdb);
+
+    if( !pdb->ReadLastBlock(last) ) last = CSmartRewardBlock();
+
+    return pdb->NewIterator();
+}
+
+bool CSmartRewards::ExportCSV(const int16_t round, const boost::filesystem::path &path, uint64_t &nRecords, int &nHeight)
+{
+    std::unique_ptr<CDBIterator> pcursor;
+
+    if( round ){
+        // Snapshots of finished rounds don't change anymore.
+        boost::shared_lock<boost::shared_mutex> lock(cs_rewardsdb);
+        pcursor.reset(pdb->NewIterator());
+        nHeight = -1;
+    }else{
+        CSmartRewardBlock last;
+        pcursor.reset(NewSyncedIterator(last));
+        if( !pcursor ) return false;
+        nHeight = last.nHeight;
     }
 
-    return false;
+    // The iterator keeps its view of the database, no lock required from here.
+    return CSmartRewardsDB::ExportCSV(*pcursor, round, path, nRecords);
 }
 
+// Only used by the rewards processing which holds cs_rewardsdb already.
 bool CSmartRewards::ReadRewardEntry(const CSmartAddress &id, CSmartRewardEntry &entry)
 {
-    LOCK(cs_rewardsdb);
     return pdb->ReadRewardEntry(id,entry);
 }
 
 bool CSmartRewards::GetRewardEntry(const CSmartAddress &id, CSmartRewardEntry &entry)
 {
-    LOCK(cs_rewardsdb);
+    boost::shared_lock<boost::shared_mutex> lock(cs_rewardsdb);
 
-    CSmartRewardEntry * pReadEntry;
+    // Return the entry if its already in cache.
+    const CSmartRewardEntry *pReadEntry = rewardEntries.Peek(id);
 
-    if( GetCachedRewardEntry(id,pReadEntry) ){
+    if( pReadEntry ){
         entry = *pReadEntry;
+        return true;
     }
 
-    return ReadRewardEntry(id,entry);
+    return pdb->ReadRewardEntry(id,entry);
 }
 
-bool CSmartRewards::GetRewardEntries(CSmartRewardEntryList &entries)
+bool CSmartRewards::GetRewardEntries(const std::vector<CSmartAddress> &ids, std::map<CSmartAddress, CSmartRewardEntry> &entries)
 {
-    LOCK(cs_rewardsdb);
-    return pdb->ReadRewardEntries(entries);
+    boost::shared_lock<boost::shared_mutex> lock(cs_rewardsdb);
+
+    std::vector<CSmartAddress> missing;
+
+    // Cached entries can be newer than the ones in the database.
+    BOOST_FOREACH(const CSmartAddress &id, ids) {
+        const CSmartRewardEntry *pReadEntry = rewardEntries.Peek(id);
+
+        if( pReadEntry ) entries[id] = *pReadEntry;
+        else missing.push_back(id);
+    }
+
+    return pdb->ReadRewardEntries(missing, entries);
 }
 
+// The batch gets written while readers still have access to the cache, its
+// dirty entries are the same as the written ones. Only marking them flushed
+// needs the readers to wait.
 bool CSmartRewards::SyncPrepared()
 {
-    LOCK2(cs_rewardsdb, cs_rewardrounds);
+    boost::upgrade_lock<boost::shared_mutex> lock(cs_rewardsdb);
+
+    std::vector<const CSmartRewardEntry*> dirtyEntries;
+    rewardEntries.GetDirty(dirtyEntries);
+
+    bool ret =  pdb->SyncBlocks(blockEntries, currentRound, dirtyEntries, transactionEntries);
+    TRACE4(smartrewards, sync_prepared, currentRound.number, blockEntries.size(), dirtyEntries.size(), transactionEntries.size());
 
-    bool ret =  pdb->SyncBlocks(blockEntries,currentRound, rewardEntries, transactionEntries);
+    boost::upgrade_to_unique_lock<boost::shared_mutex> uniqueLock(lock);
 
-    // Destructor of the elements is called in the pdb->SyncBlocks.
-    rewardEntries.clear();
+    // Unmodified entries stay cached for the next blocks.
+    if( ret ) rewardEntries.Flushed();
     blockEntries.clear();
     transactionEntries.clear();
+    transactionIndex.clear();
 
     return ret;
 }
@@ -343,13 +665,14 @@ bool CSmartRewards::AddBlock(const CSmartRewardBlock &block, bool sync)
 
 void CSmartRewards::AddTransaction(const CSmartRewardTransaction &transaction)
 {
-    LOCK(cs_rewardsdb);
+    transactionIndex[transaction.hash] = transactionEntries.size();
     transactionEntries.push_back(transaction);
+    transactionFilter.Insert(transaction.hash);
 }
 
-CSmartRewards::CSmartRewards(CSmartRewardsDB *prewardsdb)  : pdb(prewardsdb)
+CSmartRewards::CSmartRewards(CSmartRewardsDB *prewardsdb)  : pdb(prewardsdb), rewardEntries(nRewardsEntryCacheSize)
 {
-    LOCK(cs_rewardsdb);
+    boost::unique_lock<boost::shared_mutex> lock(cs_rewardsdb);
 
     // Get the last written block of the rewards database.
     if(!pdb->ReadLastBlock(currentBlock)){
@@ -360,43 +683,169 @@ CSmartRewards::CSmartRewards(CSmartRewardsDB *prewardsdb)  : pdb(prewardsdb)
         currentBlock.blockTime = 0;
     }
 
-    pdb->ReadRounds(finishedRounds);
+    std::shared_ptr<CSmartRewardRounds> loaded = std::make_shared<CSmartRewardRounds>();
+    std::shared_ptr<CSmartRewardRoundList> finished = std::make_shared<CSmartRewardRoundList>();
+
+    pdb->ReadRounds(*finished);
+
+    if( finished->size() ){
+        loaded->last = finished->back();
 
-    if( finishedRounds.size() ){
-        lastRound = finishedRounds.back();
+        std::shared_ptr<CSmartRewardSnapshotList> payouts = std::make_shared<CSmartRewardSnapshotList>();
+        if( pdb->ReadRewardPayouts(loaded->last.number, *payouts) ) std::sort(payouts->begin(), payouts->end());
+        else payouts->clear();
+        loaded->lastPayouts = payouts;
     }
 
     pdb->ReadCurrentRound(currentRound);
-}
 
-void CSmartRewards::Lock()
-{
-    LOCK(cs_rewardsdb);
-    pdb->Lock();
+    loaded->finished = finished;
+    loaded->current = currentRound;
+    rounds = loaded;
 }
 
 bool CSmartRewards::IsLocked()
 {
-    LOCK(cs_rewardsdb);
+    boost::shared_lock<boost::shared_mutex> lock(cs_rewardsdb);
     return pdb->IsLocked();
 }
 
+// Everything but the evaluation of a round gets written in one batch with the
+// last processed block, so after a crash only the blocks since the last sync
+// get processed again. The evaluation is written in chunks, it gets completed
+// here before any further block is processed.
+bool CSmartRewards::FinishInterruptedRound()
+{
+    CSmartRewardRound current, next;
+
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_rewardsdb);
+        if( !pdb->ReadEvaluatingRound(current, next) ) return true;
+    }
+
+    LogPrintf("CSmartRewards::FinishInterruptedRound - Continue the evaluation of round %d\n", current.number);
+
+    CSmartRewardSnapshotList payouts;
+
+    if( !EvaluateRound(current, next, payouts) ) return false;
+
+    CalculateRewardRatio(next);
+
+    if( !current.number ){
+        if( !StartFirstRound(next) ) return false;
+        currentRound = next;
+        PublishCurrentRound();
+        return true;
+    }
+
+    if( !FinalizeRound(current, next) ) return false;
+
+    SetFinalizedRound(current, next, payouts);
+
+    return true;
+}
+
+/** Reads and parses the blocks CatchUp processes next on a few threads.
+ *  At most nRewardsPrefetchBlocks blocks are held ahead of the one processed. */
+class CSmartRewardsPrefetcher
+{
+    const std::vector<CBlockIndex*> &vIndexes;
+    const Consensus::Params &consensusParams;
+
+    std::vector<CSmartRewardsBlockData> vData;
+    std::vector<bool> vReady;
+    size_t nNextPrepare;
+    size_t nNextProcess;
+    bool fStop;
+
+    boost::mutex cs;
+    boost::condition_variable cond;
+    boost::thread_group threads;
+
+    void Thread()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+
+        while( true ){
+
+            while( !fStop && nNextPrepare < vIndexes.size() && nNextPrepare >= nNextProcess + vData.size() ) cond.wait(lock);
+
+            if( fStop || nNextPrepare >= vIndexes.size() ) return;
+
+            size_t n = nNextPrepare++;
+            CSmartRewardsBlockData data;
+
+            lock.unlock();
+            // A failed read gets repeated and reported by ProcessBlock.
+            if( !PrepareRewardsBlock(vIndexes[n], consensusParams, data) ) data = CSmartRewardsBlockData();
+            lock.lock();
+
+            std::swap(vData[n % vData.size()], data);
+            vReady[n % vData.size()] = true;
+            cond.notify_all();
+        }
+    }
+
+public:
+    CSmartRewardsPrefetcher(const std::vector<CBlockIndex*> &vIndexesIn, const Consensus::Params &params) :
+        vIndexes(vIndexesIn), consensusParams(params),
+        vData(nRewardsPrefetchBlocks), vReady(nRewardsPrefetchBlocks, false),
+        nNextPrepare(0), nNextProcess(0), fStop(false)
+    {
+        int nThreads = std::max(1, std::min(GetNumCores() - 1, nRewardsPrefetchThreads));
+
+        for( int i = 0; i < nThreads; ++i ) threads.create_thread(boost::bind(&CSmartRewardsPrefetcher::Thread, this));
+    }
+
+    ~CSmartRewardsPrefetcher()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            fStop = true;
+        }
+        cond.notify_all();
+        threads.join_all();
+    }
+
+    //! Wait for the n-th block, blocks have to be taken in order.
+    void Get(size_t n, CSmartRewardsBlockData &data)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        assert(n == nNextProcess);
+
+        while( !vReady[n % vData.size()] ) cond.wait(lock);
+
+        std::swap(data, vData[n % vData.size()]);
+        vData[n % vData.size()] = CSmartRewardsBlockData();
+        vReady[n % vData.size()] = false;
+        ++nNextProcess;
+        cond.notify_all();
+    }
+};
+
 void CSmartRewards::CatchUp()
 {
     const CChainParams& chainparams = Params();
     CBlockIndex* pHighestIndex = chainActive.Tip();
-    CBlockIndex* pLastIndex = pHighestIndex;
-    if( !pLastIndex ) return;
+    if( !pHighestIndex ) return;
     // If the rewards db is higher than the chain.
-    if( pLastIndex->nHeight <= currentBlock.nHeight ) return;
+    if( pHighestIndex->nHeight <= currentBlock.nHeight ) return;
+
+    // Collect the missing blocks in the rewards database which have
+    // enough confirmations to get processed.
+    std::vector<CBlockIndex*> vIndexes;
 
-    // Search the index of the next missing bock in the
-    // rewards database.
-    while( pLastIndex->nHeight != currentBlock.nHeight + 1){
-        pLastIndex = pLastIndex->pprev;
+    for( CBlockIndex* pindex = pHighestIndex; pindex && pindex->nHeight > currentBlock.nHeight; pindex = pindex->pprev ){
+        if( pHighestIndex->nHeight - pindex->nHeight >= nRewardsConfirmations ) vIndexes.push_back(pindex);
     }
 
-    while( pLastIndex && ( currentBlock.nHeight - pLastIndex->nHeight ) < nRewardsConfirmations)
+    std::reverse(vIndexes.begin(), vIndexes.end());
+
+    // Reading and parsing the blocks runs ahead on other threads, the
+    // processing itself stays in order on this one.
+    CSmartRewardsPrefetcher prefetcher(vIndexes, chainparams.GetConsensus());
+
+    for( size_t n = 0; n < vIndexes.size(); ++n )
     {
         if( ShutdownRequested() ){
             SyncPrepared();
@@ -407,10 +856,10 @@ void CSmartRewards::CatchUp()
             uiInterface.InitMessage(_("Creating SmartRewards database: ") + strprintf("%d/%d",currentBlock.nHeight, pHighestIndex->nHeight));
         }
 
-        ProcessBlock(pLastIndex, chainparams);
-
-        pLastIndex = chainActive.Next(pLastIndex);
+        CSmartRewardsBlockData data;
+        prefetcher.Get(n, data);
 
+        ProcessBlock(pHighestIndex->GetAncestor(vIndexes[n]->nHeight + nRewardsConfirmations), chainparams, &data);
     }
 
     prewards->UpdateHeights(GetBlockHeight(pHighestIndex), currentBlock.nHeight);
@@ -418,46 +867,96 @@ void CSmartRewards::CatchUp()
 
 bool CSmartRewards::GetLastBlock(CSmartRewardBlock &block)
 {
-    LOCK(cs_rewardsdb);
+    boost::shared_lock<boost::shared_mutex> lock(cs_rewardsdb);
     // Read the last block stored in the rewards database.
     return pdb->ReadLastBlock(block);
 }
 
+// Only used by the rewards processing, the prepared transactions and the
+// filter are never touched by readers.
 bool CSmartRewards::GetTransaction(const uint256 hash, CSmartRewardTransaction &transaction)
 {
     // If the transaction is already in the cache use this one.
-    BOOST_FOREACH(CSmartRewardTransaction t, transactionEntries) {
-        if(t.hash == hash){
-            transaction = t;
-            return true;
+    auto findResult = transactionIndex.find(hash);
+
+    if( findResult != transactionIndex.end() ){
+        transaction = transactionEntries[findResult->second];
+        return true;
+    }
+
+    // (Re)build the filter from the database on first use or once it is overfilled.
+    if( transactionFilter.NeedsRebuild() ){
+
+        if( !pdb->ReadTransactionFilter(transactionFilter, nTransactionFilterHeadroom) ){
+            transactionFilter = CSmartRewardTransactionFilter();
+            return pdb->ReadTransaction(hash, transaction);
+        }
+
+        BOOST_FOREACH(const CSmartRewardTransaction &t, transactionEntries) {
+            transactionFilter.Insert(t.hash);
         }
+
+        LogPrint("smartrewards", "CSmartRewards::GetTransaction - Transaction filter built with %d hashes\n", transactionFilter.GetElements());
     }
 
+    // Hashes never seen before don't need a database lookup.
+    if( !transactionFilter.MayContain(hash) ) return false;
+
     return pdb->ReadTransaction(hash, transaction);
 }
 
-const CSmartRewardRound& CSmartRewards::GetCurrentRound()
+void CSmartRewards::PublishCurrentRound()
 {
-    return currentRound;
+    std::shared_ptr<CSmartRewardRounds> published = std::make_shared<CSmartRewardRounds>(*GetRounds());
+    published->current = currentRound;
+    std::atomic_store(&rounds, std::shared_ptr<const CSmartRewardRounds>(published));
 }
 
-const CSmartRewardRound& CSmartRewards::GetLastRound()
+void CSmartRewards::SetFinalizedRound(const CSmartRewardRound &current, const CSmartRewardRound &next, CSmartRewardSnapshotList &payouts)
 {
-    return lastRound;
-}
+    // Sort the payouts once here instead of on every payout block.
+    std::sort(payouts.begin(), payouts.end());
 
-const CSmartRewardRoundList& CSmartRewards::GetRewardRounds()
-{
-    return finishedRounds;
+    {
+        LOCK(csSnapshotFiles);
+
+        // Replace a file left from before a database reset.
+        if( !WriteSnapshotFile(pdb, current.number) ){
+            LogPrintf("CSmartRewards::SetFinalizedRound - Failed to write the snapshot file of round %d\n", current.number);
+        }
+
+        snapshotFiles.erase(current.number);
+    }
+
+    // Readers holding the previous state keep it, the history is copied once per round.
+    std::shared_ptr<const CSmartRewardRounds> prev = GetRounds();
+    std::shared_ptr<CSmartRewardRoundList> finished = std::make_shared<CSmartRewardRoundList>(*prev->finished);
+    finished->push_back(current);
+
+    std::shared_ptr<CSmartRewardSnapshotList> lastPayouts = std::make_shared<CSmartRewardSnapshotList>();
+    lastPayouts->swap(payouts);
+
+    currentRound = next;
+
+    std::shared_ptr<CSmartRewardRounds> published = std::make_shared<CSmartRewardRounds>();
+    published->current = currentRound;
+    published->last = current;
+    published->lastPayouts = lastPayouts;
+    published->finished = finished;
+    std::atomic_store(&rounds, std::shared_ptr<const CSmartRewardRounds>(published));
+
+    GetMainSignals().NotifyRewardsRoundFinalized(current);
 }
 
 void CSmartRewards::UpdateHeights(const int nHeight, const int nRewardHeight)
 {
     chainHeight = nHeight;
     rewardHeight = nRewardHeight;
+    metricRewardsHeight.Set(nRewardHeight);
+    metricRewardsLag.Set(nHeight - nRewardHeight);
 }
 
-void CSmartRewards::ProcessBlock(CBlockIndex* pLastIndex, const CChainParams& chainparams)
+void CSmartRewards::ProcessBlock(CBlockIndex* pLastIndex, const CChainParams& chainparams, CSmartRewardsBlockData *pPrepared)
 {
     int64_t nTime1 = 0, nTime2 = 0, nTime3 = 0;
     static int64_t nTimeTotal = 0;
@@ -474,10 +973,19 @@ void CSmartRewards::ProcessBlock(CBlockIndex* pLastIndex, const CChainParams& ch
 
         nTime1 = GetTimeMicros();
 
+        CSmartRewardsBlockData data;
+
+        // Use the prepared block if it is the one we need.
+        if( pPrepared && pPrepared->pindex == pNextIndex ){
+            std::swap(data, *pPrepared);
+        }else if( !PrepareRewardsBlock(pNextIndex, chainparams.GetConsensus(), data) ){
+            throw runtime_error(std::string(__func__) + ": Could't read block from disk");
+        }
+
         // Result of the block processing.
         CSmartRewardsUpdateResult result;
         // Process the block!
-        if(!Update(pNextIndex, chainparams, result)) throw runtime_error(std::string(__func__) + ": rewards update failed");
+        if(!Update(data, result)) throw runtime_error(std::string(__func__) + ": rewards update failed");
 
         // Update the current block to the processed one
         currentBlock = result.block;
@@ -504,20 +1012,17 @@ void CSmartRewards::ProcessBlock(CBlockIndex* pLastIndex, const CChainParams& ch
                 // Estimate the block, gets updated on the end of the round to the real one.
                 first.endBlockHeight = MainNet() ? nFirstRoundEndBlock : nFirstRoundEndBlock_Testnet;
 
-                CSmartRewardEntryList entries;
-                CSmartRewardSnapshotList snapshots;
-
-                // Get the current entries
-                if( !GetRewardEntries(entries) ) throw runtime_error("Could't read all reward entries!");
+                CSmartRewardSnapshotList payouts;
 
                 // Evaluate the round and update the next rounds parameter.
-                EvaluateRound(currentRound, first, entries, snapshots );
+                if( !EvaluateRound(currentRound, first, payouts) ) throw runtime_error("Could't evaluate round!");
 
                 CalculateRewardRatio(first);
 
-                if( !StartFirstRound(first, entries) ) throw runtime_error("Could't finalize round!");
+                if( !StartFirstRound(first) ) throw runtime_error("Could't finalize round!");
 
                 currentRound = first;
+                PublishCurrentRound();
             }
 
         }else if( result.disqualifiedEntries || result.disqualifiedSmart ){
@@ -529,6 +1034,7 @@ void CSmartRewards::ProcessBlock(CBlockIndex* pLastIndex, const CChainParams& ch
             currentRound.disqualifiedSmart += result.disqualifiedSmart;
 
             CalculateRewardRatio(currentRound);
+            PublishCurrentRound();
         }
 
         // If just hit the next round threshold
@@ -541,8 +1047,7 @@ void CSmartRewards::ProcessBlock(CBlockIndex* pLastIndex, const CChainParams& ch
             currentRound.endBlockHeight = pNextIndex->nHeight;
             currentRound.endBlockTime = pNextIndex->GetBlockTime();
 
-            CSmartRewardEntryList entries;
-            CSmartRewardSnapshotList snapshots;
+            CSmartRewardSnapshotList payouts;
 
             // Create the next round.
             CSmartRewardRound next;
@@ -566,28 +1071,23 @@ void CSmartRewards::ProcessBlock(CBlockIndex* pLastIndex, const CChainParams& ch
 
             if( !SyncPrepared() ) throw runtime_error("Could't sync current prepared entries!");
 
-            // Get the current entries
-            if( !GetRewardEntries(entries) ) throw runtime_error("Could not read all reward entries!");
-
             CalculateRewardRatio(currentRound);
 
             // Evaluate the round and update the next rounds parameter.
-            EvaluateRound(currentRound, next, entries, snapshots);
+            if( !EvaluateRound(currentRound, next, payouts) ) throw runtime_error("Could't evaluate round!");
 
             CalculateRewardRatio(next);
 
-            if( !FinalizeRound(currentRound, next, entries, snapshots) ) throw runtime_error("Could't finalize round!");
+            if( !FinalizeRound(currentRound, next) ) throw runtime_error("Could't finalize round!");
+            TRACE3(smartrewards, round_finalized, currentRound.number, currentRound.endBlockHeight, payouts.size());
 
-            LOCK(cs_rewardrounds);
-
-            finishedRounds.push_back(currentRound);
-            lastRound = currentRound;
-            currentRound = next;
+            SetFinalizedRound(CSmartRewardRound(currentRound), next, payouts);
         }
 
         prewards->UpdateHeights(GetBlockHeight(pLastIndex), currentBlock.nHeight);
 
         nTime3 = GetTimeMicros(); nTimeTotal += nTime3 - nTime1;
+        TRACE4(smartrewards, process_block, currentBlock.nHeight, currentRound.number, nTime2 - nTime1, nTime3 - nTime2);
         int nTimeUpdateMean = nTimeUpdateRewardsTotal/nCountUpdateRewards;
         int nTimeUpdate = nTime2 - nTime1;
 
@@ -605,3 +1105,102 @@ void CSmartRewards::ProcessBlock(CBlockIndex* pLastIndex, const CChainParams& ch
     }
 }
 
+void ThreadSmartRewards()
+{
+    RenameThread("smartcash-rewards");
+
+    const CChainParams& chainparams = Params();
+
+    {
+        boost::unique_lock<boost::mutex> lock(csRewardsQueue);
+        fRewardsThreadRunning = true;
+    }
+
+    try {
+
+        while( true ){
+
+            CBlockIndex *pindex;
+
+            {
+                boost::unique_lock<boost::mutex> lock(csRewardsQueue);
+
+                while( queueRewardsBlocks.empty() ) condRewardsQueue.wait(lock);
+
+                pindex = queueRewardsBlocks.front();
+                queueRewardsBlocks.pop_front();
+                fRewardsThreadBusy = true;
+            }
+
+            try {
+                LOCK(cs_rewardsprocessing);
+                prewards->ProcessBlock(pindex, chainparams);
+            } catch (const std::exception& e) {
+                // Same as an exception in ConnectTip used to, don't stop the
+                // node. The next block retries from the last processed one.
+                PrintExceptionContinue(&e, "ThreadSmartRewards()");
+            }
+
+            {
+                boost::unique_lock<boost::mutex> lock(csRewardsQueue);
+                fRewardsThreadBusy = false;
+            }
+
+            condRewardsQueue.notify_all();
+        }
+
+    } catch (const boost::thread_interrupted&) {
+        LogPrintf("ThreadSmartRewards -- thread interrupted\n");
+    }
+
+    // Blocks left in the queue get processed by CatchUp on the next start.
+    {
+        boost::unique_lock<boost::mutex> lock(csRewardsQueue);
+        fRewardsThreadRunning = false;
+        fRewardsThreadBusy = false;
+        queueRewardsBlocks.clear();
+    }
+
+    condRewardsQueue.notify_all();
+}
+
+void QueueSmartRewardsBlock(CBlockIndex *pindex)
+{
+    // Called with cs_main held, an interruption here would leave the tip half connected.
+    boost::this_thread::disable_interruption di;
+
+    {
+        boost::unique_lock<boost::mutex> lock(csRewardsQueue);
+
+        // Let block connection wait if the rewards thread falls too far behind.
+        while( fRewardsThreadRunning && queueRewardsBlocks.size() >= (size_t)nRewardsQueueSize ) condRewardsQueue.wait(lock);
+
+        if( fRewardsThreadRunning ){
+            queueRewardsBlocks.push_back(pindex);
+            condRewardsQueue.notify_all();
+            return;
+        }
+    }
+
+    LOCK(cs_rewardsprocessing);
+    prewards->ProcessBlock(pindex, Params());
+}
+
+void WaitForSmartRewards(const int nHeight)
+{
+    std::shared_ptr<const CSmartRewardRounds> rounds = prewards->GetRounds();
+    const CSmartRewardRound &current = rounds->current;
+
+    // The payouts only depend on the last finished round. Unless one of the
+    // queued blocks (at most nHeight - 1 - nRewardsConfirmations) can finish the
+    // current round there is nothing to wait for. Time based rounds can end at
+    // any height.
+    bool fTimeBased = MainNet() && current.number < nRewardsFirstAutomatedRound;
+
+    if( !fTimeBased && nHeight - 1 - nRewardsConfirmations < current.endBlockHeight ) return;
+
+    boost::this_thread::disable_interruption di;
+    boost::unique_lock<boost::mutex> lock(csRewardsQueue);
+
+    while( fRewardsThreadRunning && ( fRewardsThreadBusy || !queueRewardsBlocks.empty() ) ) condRewardsQueue.wait(lock);
+}
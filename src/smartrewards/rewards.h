@@ -6,17 +6,37 @@
 #define REWARDS_H
 
 #include "sync.h"
+#include "txmempool.h"
 
 #include <smartrewards/rewardsdb.h>
+#include <smartrewards/rewardssnapshotfile.h>
 #include "consensus/consensus.h"
 
+#include <memory>
+#include <unordered_map>
+#include <boost/thread/shared_mutex.hpp>
+
 using namespace std;
 
-static const CAmount SMART_REWARDS_MIN_BALANCE = 1000 * COIN;
+class CBlock;
+class CBlockUndo;
+
 // Cache max. n prepared entries before the sync (leveldb batch write).
 const int64_t nCacheEntires = 8000;
+// Number of blocks CatchUp reads and parses ahead of their processing.
+const int64_t nRewardsPrefetchBlocks = 500;
+// Max. number of threads reading blocks ahead in CatchUp.
+const int nRewardsPrefetchThreads = 4;
+// Max. number of reward entries kept in memory, modified entries are always kept until the next sync.
+const int64_t nRewardsEntryCacheSize = 100000;
+// Minimum number of new transaction hashes the transaction filter has room for before it gets rebuilt.
+const int64_t nTransactionFilterHeadroom = 1000000;
 // Minimum number of confirmations to process a block for the reward database.
 const int64_t nRewardsConfirmations = 15;
+// Max. number of connected blocks queued for the rewards thread before block connection waits for it.
+const int64_t nRewardsQueueSize = 100;
+// Default for -rewardsobserver, a node following the chain only for the SmartRewards.
+const bool DEFAULT_REWARDS_OBSERVER = false;
 // Minimum distance of the last processed block compared to the current chain
 // height to assume the rewards are synced.
 const int64_t nRewardsSyncDistance = 20;
@@ -41,11 +61,53 @@ const int64_t nFirstRoundStartBlock_Testnet = TESTNET_V1_2_PAYMENTS_HEIGHT;
 const int64_t nFirstRoundEndBlock_Testnet = nFirstRoundStartBlock_Testnet + nRewardsBlocksPerRound_Testnet;
 
 
-void ThreadSmartRewards(bool fRecreate = false);
+void ThreadSmartRewards();
+// Hand a connected block to the rewards thread, processes it directly if the thread isn't running.
+void QueueSmartRewardsBlock(CBlockIndex *pindex);
+// Keep a block connected to the chain with its undo data until the rewards
+// processing reached it, so it doesn't need to be read from disk again.
+void CacheSmartRewardsBlock(const CBlockIndex *pindex, const CBlock &block, const CBlockUndo &blockundo);
+// Wait until the rewards thread has processed all blocks the payouts at nHeight may depend on.
+void WaitForSmartRewards(const int nHeight);
 CAmount CalculateRewardsForBlockRange(int64_t start, int64_t end);
 
-extern CCriticalSection cs_rewardsdb;
-extern CCriticalSection cs_rewardrounds;
+// Shared by readers of the rewards database and the entry cache. The rewards
+// processing only holds it exclusively while it changes the cache.
+extern boost::shared_mutex cs_rewardsdb;
+extern CCriticalSection cs_rewardsprocessing;
+
+/** Spent or created output of a transaction and the address it belongs to. */
+struct CSmartRewardsTxIO
+{
+    CTxOut out;
+    CSmartAddress id;
+    // False if the script doesn't resolve to exactly one address.
+    bool fParsed;
+    CSmartRewardsTxIO() : fParsed(false) {}
+};
+
+struct CSmartRewardsTxData
+{
+    uint256 hash;
+    std::vector<CSmartRewardsTxIO> vin;
+    std::vector<CSmartRewardsTxIO> vout;
+    // Set if a spent output couldn't be found, vin ends before that input.
+    std::string strInputError;
+};
+
+/** A block read from disk with all inputs and outputs resolved, ready to get processed. */
+struct CSmartRewardsBlockData
+{
+    const CBlockIndex *pindex;
+    uint256 blockHash;
+    int64_t blockTime;
+    std::vector<CSmartRewardsTxData> vtx;
+    CSmartRewardsBlockData() : pindex(nullptr), blockTime(0) {}
+};
+
+bool PrepareRewardsBlock(const CBlockIndex *pindex, const Consensus::Params& consensusParams, CSmartRewardsBlockData &data);
+// Without undo data the spent outputs are looked up in the txindex.
+bool PrepareRewardsBlock(const CBlockIndex *pindex, const CBlock &block, const CBlockUndo *pblockundo, CSmartRewardsBlockData &data);
 
 struct CSmartRewardsUpdateResult
 {
@@ -55,12 +117,26 @@ struct CSmartRewardsUpdateResult
     CSmartRewardsUpdateResult() : disqualifiedEntries(0), disqualifiedSmart(0),block() {}
 };
 
+/** Round state published by the rewards processing, never modified once published. */
+struct CSmartRewardRounds
+{
+    CSmartRewardRound current;
+    CSmartRewardRound last;
+    // Payouts of last, sorted the way the payout blocks slice them.
+    std::shared_ptr<const CSmartRewardSnapshotList> lastPayouts;
+    // All finished rounds, last included.
+    std::shared_ptr<const CSmartRewardRoundList> finished;
+
+    CSmartRewardRounds() : lastPayouts(std::make_shared<CSmartRewardSnapshotList>()), finished(std::make_shared<CSmartRewardRoundList>()) {}
+};
+
 class CSmartRewards
 {
     CSmartRewardsDB * pdb;
-    CSmartRewardRoundList finishedRounds;
+    // Round being processed, only used by the rewards processing (cs_rewardsprocessing).
     CSmartRewardRound currentRound;
-    CSmartRewardRound lastRound;
+    // Swapped atomically whenever a round changes, readers take no lock.
+    std::shared_ptr<const CSmartRewardRounds> rounds;
     CSmartRewardBlock currentBlock;
     CSmartRewardBlock lastBlock;
 
@@ -69,29 +145,40 @@ class CSmartRewards
 
     CSmartRewardBlockList blockEntries;
     CSmartRewardTransactionList transactionEntries;
-    CSmartRewardEntryMap rewardEntries;
+    // Position of each hash in transactionEntries
+    std::unordered_map<uint256, size_t, SaltedTxidHasher> transactionIndex;
+    // All transaction hashes in the database and in transactionEntries
+    CSmartRewardTransactionFilter transactionFilter;
+    CSmartRewardEntryCache rewardEntries;
+
+    // Mapped snapshot files of finished rounds, opened on first use.
+    std::map<int16_t, std::shared_ptr<const CSmartRewardSnapshotFile>> snapshotFiles;
 
     mutable CCriticalSection csRounds;
+    // Guards snapshotFiles and the files on disk.
+    CCriticalSection csSnapshotFiles;
 
-    bool GetCachedRewardEntry(const CSmartAddress &id, CSmartRewardEntry *&entry);
     bool ReadRewardEntry(const CSmartAddress &id, CSmartRewardEntry &entry);
-    bool GetRewardEntries(CSmartRewardEntryList &entries);
     bool AddBlock(const CSmartRewardBlock &block, bool sync);
     void AddTransaction(const CSmartRewardTransaction &transaction);
+    //! Make the round finalized in the database the last one in memory and next the current one.
+    void SetFinalizedRound(const CSmartRewardRound &current, const CSmartRewardRound &next, CSmartRewardSnapshotList &payouts);
+    //! Publish currentRound to the readers of GetRounds().
+    void PublishCurrentRound();
 public:
 
     CSmartRewards(CSmartRewardsDB *prewardsdb);
     ~CSmartRewards() { SyncPrepared(); delete pdb; }
-    void Lock();
     bool IsLocked();
+    //! Complete a round evaluation a crash interrupted, the blocks after it get processed as usual.
+    bool FinishInterruptedRound();
 
     void CatchUp();
 
     bool GetLastBlock(CSmartRewardBlock &block);
     bool GetTransaction(const uint256 hash, CSmartRewardTransaction &transaction);
-    const CSmartRewardRound& GetCurrentRound();
-    const CSmartRewardRound &GetLastRound();
-    const CSmartRewardRoundList& GetRewardRounds();
+    //! Current, last and finished rounds, all from the same state.
+    std::shared_ptr<const CSmartRewardRounds> GetRounds() const { return std::atomic_load(&rounds); }
 
     void UpdateHeights(const int nHeight, const int nRewardHeight);
     bool Verify();
@@ -100,21 +187,36 @@ public:
     double GetProgress();
     int GetLastHeight();
 
-    bool Update(CBlockIndex *pindexNew, const CChainParams& chainparams, CSmartRewardsUpdateResult &result);
+    bool Update(const CSmartRewardsBlockData &data, CSmartRewardsUpdateResult &result);
     bool UpdateRound(const CSmartRewardRound &round);
 
-    void ProcessBlock(CBlockIndex* pLastIndex,const CChainParams& chainparams);
+    void ProcessBlock(CBlockIndex* pLastIndex,const CChainParams& chainparams, CSmartRewardsBlockData *pPrepared = nullptr);
 
     bool GetRewardEntry(const CSmartAddress &id, CSmartRewardEntry &entry);
-
-    void EvaluateRound(CSmartRewardRound &current, CSmartRewardRound &next, CSmartRewardEntryList &entries, CSmartRewardSnapshotList &snapshots);
-    bool StartFirstRound(const CSmartRewardRound &next, const CSmartRewardEntryList &entries);
-    bool FinalizeRound(const CSmartRewardRound &current, const CSmartRewardRound &next, const CSmartRewardEntryList &entries, const CSmartRewardSnapshotList &snapshots);
+    //! Look up many entries at once, ids that are neither cached nor in the database are missing in entries.
+    bool GetRewardEntries(const std::vector<CSmartAddress> &ids, std::map<CSmartAddress, CSmartRewardEntry> &entries);
+    //! Change the number of reward entries kept in memory.
+    void SetEntryCacheSize(size_t nEntries);
+    //! Memory used by the cached reward entries.
+    size_t GetEntryCacheUsage();
+    //! Drop about nBytes of clean entries from the cache, its size setting stays.
+    void ShrinkEntryCache(size_t nBytes);
+
+    bool EvaluateRound(const CSmartRewardRound &current, CSmartRewardRound &next, CSmartRewardSnapshotList &payouts);
+    bool StartFirstRound(const CSmartRewardRound &first);
+    bool FinalizeRound(const CSmartRewardRound &current, const CSmartRewardRound &next);
 
     bool GetRewardSnapshots(const int16_t round, CSmartRewardSnapshotList &snapshots);
     bool GetRewardPayouts(const int16_t round, CSmartRewardSnapshotList &payouts);
+    //! Snapshot file of the finished round, written from the database if it doesn't exist yet.
+    std::shared_ptr<const CSmartRewardSnapshotFile> GetSnapshotFile(const int16_t round);
 
     bool RestoreSnapshot(const int16_t round);
+
+    //! Write the prepared blocks and iterate over the database as of the last processed one, which ends up in last.
+    CDBIterator *NewSyncedIterator(CSmartRewardBlock &last);
+    //! Write the snapshots of a finished round, or with round 0 the reward entries as of nHeight, to path as CSV.
+    bool ExportCSV(const int16_t round, const boost::filesystem::path &path, uint64_t &nRecords, int &nHeight);
 };
 
 /** Global variable that points to the active rewards object (protected by cs_main) */
@@ -7,13 +7,20 @@
 #include "chainparams.h"
 #include "hash.h"
 #include "pow.h"
+#include "random.h"
 #include "uint256.h"
 #include "ui_interface.h"
 #include "init.h"
+#include "memusage.h"
 #include "rewardsdb.h"
+#include "smartrewards/rewardssnapshotfile.h"
+#include "utilmoneystr.h"
 
 #include <stdint.h>
+#include <memory>
+#include <thread>
 
+#include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 #include "leveldb/include/leveldb/db.h"
 
@@ -21,6 +28,7 @@ using namespace std;
 
 static const char DB_ROUND_CURRENT = 'R';
 static const char DB_ROUND = 'r';
+static const char DB_ROUND_EVALUATING = 'e';
 static const char DB_ROUND_SNAPSHOT = 's';
 
 static const char DB_REWARD_ENTRY = 'E';
@@ -33,8 +41,6 @@ static const char DB_LOCK = 'L';
 
 CSmartRewardsDB::CSmartRewardsDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "rewards", nCacheSize, fMemory, fWipe) {
 
-    locked = false;
-
     if( !Exists(DB_VERSION) ){
         Write(DB_VERSION, REWARDS_DB_VERSION);
     }
@@ -99,21 +105,6 @@ bool CSmartRewardsDB::Verify(int& lastBlockHeight)
     return true;
 }
 
-void CSmartRewardsDB::Lock()
-{
-    locked = true;
-    Write(DB_LOCK, 1, true);
-    Sync();
-}
-
-void CSmartRewardsDB::Unlock()
-{
-    if(locked){
-        Erase(DB_LOCK,true);
-        Sync();
-    }
-}
-
 bool CSmartRewardsDB::IsLocked()
 {
     return Exists(DB_LOCK);
@@ -176,6 +167,36 @@ bool CSmartRewardsDB::ReadTransaction(const uint256 hash, CSmartRewardTransactio
     return Read(make_pair(DB_TX_HASH,hash), transaction);
 }
 
+bool CSmartRewardsDB::ReadTransactionFilter(CSmartRewardTransactionFilter &filter, uint64_t nMinHeadroom)
+{
+    uint64_t nCount = 0;
+
+    // Count first so the filter can be sized before it gets filled. Leave room
+    // for at least half as many new hashes before it needs to be rebuilt.
+    for( int pass = 0; pass < 2; ++pass ){
+
+        boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+        if( pass ) filter.Reset(nCount + std::max(nCount / 2, nMinHeadroom));
+
+        pcursor->Seek(make_pair(DB_TX_HASH, uint256()));
+
+        while (pcursor->Valid()) {
+            boost::this_thread::interruption_point();
+            std::pair<char,uint256> key;
+            if (pcursor->GetKey(key) && key.first == DB_TX_HASH) {
+                if( pass ) filter.Insert(key.second);
+                else ++nCount;
+                pcursor->Next();
+            } else {
+                break;
+            }
+        }
+    }
+
+    return true;
+}
+
 bool CSmartRewardsDB::ReadRound(const int16_t number, CSmartRewardRound &round)
 {
     return Read(make_pair(DB_ROUND,number), round);
@@ -211,25 +232,62 @@ bool CSmartRewardsDB::ReadCurrentRound(CSmartRewardRound &round)
     return Read(DB_ROUND_CURRENT, round);
 }
 
+bool CSmartRewardsDB::ReadEvaluatingRound(CSmartRewardRound &current, CSmartRewardRound &next)
+{
+    std::pair<CSmartRewardRound, CSmartRewardRound> rounds;
+    if( !Read(DB_ROUND_EVALUATING, rounds) ) return false;
+    current = rounds.first;
+    next = rounds.second;
+    return true;
+}
+
 bool CSmartRewardsDB::ReadRewardEntry(const CSmartAddress &id, CSmartRewardEntry &entry)
 {
     return Read(make_pair(DB_REWARD_ENTRY,id), entry);
 }
 
-bool CSmartRewardsDB::SyncBlocks(const CSmartRewardBlockList &blocks, const CSmartRewardRound& current, const CSmartRewardEntryMap &rewards, const CSmartRewardTransactionList &transactions)
+// Seek the ids in key order so the iterator only ever moves forward through
+// the reward entries instead of starting a new lookup for every address.
+bool CSmartRewardsDB::ReadRewardEntries(std::vector<CSmartAddress> &ids, std::map<CSmartAddress, CSmartRewardEntry> &entries)
+{
+    if( ids.empty() ) return true;
+
+    std::sort(ids.begin(), ids.end());
+
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    BOOST_FOREACH(const CSmartAddress &id, ids) {
+
+        pcursor->Seek(make_pair(DB_REWARD_ENTRY, id));
+
+        if (!pcursor->Valid()) break;
+
+        std::pair<char,CSmartAddress> key;
+        if (!pcursor->GetKey(key) || key.first != DB_REWARD_ENTRY) break;
+        if (!(key.second == id)) continue;
+
+        CSmartRewardEntry entry;
+        if (!pcursor->GetValue(entry)) return error("failed to get reward entry");
+
+        entries[id] = entry;
+    }
+
+    return true;
+}
+
+bool CSmartRewardsDB::SyncBlocks(const CSmartRewardBlockList &blocks, const CSmartRewardRound& current, const std::vector<const CSmartRewardEntry*> &rewards, const CSmartRewardTransactionList &transactions)
 {
 
     CDBBatch batch(*this);
 
     if(!blocks.size()) return true;
 
-    BOOST_FOREACH(const PAIRTYPE(CSmartAddress, CSmartRewardEntry*)& r, rewards) {
-        if( r.second->balance <= 0 ){
-            batch.Erase(make_pair(DB_REWARD_ENTRY,r.first));
+    BOOST_FOREACH(const CSmartRewardEntry *r, rewards) {
+        if( r->balance <= 0 ){
+            batch.Erase(make_pair(DB_REWARD_ENTRY,r->id));
         }else{
-            batch.Write(make_pair(DB_REWARD_ENTRY,r.first), *r.second);
+            batch.Write(make_pair(DB_REWARD_ENTRY,r->id), *r);
         }
-        delete r.second;
     }
 
     BOOST_FOREACH(const CSmartRewardTransaction &t, transactions) {
@@ -249,35 +307,302 @@ bool CSmartRewardsDB::SyncBlocks(const CSmartRewardBlockList &blocks, const CSma
     return WriteBatch(batch, true);
 }
 
-bool CSmartRewardsDB::StartFirstRound(const CSmartRewardRound &start, const CSmartRewardEntryList &entries)
+// A reward entry of the chunk EvaluateRound works on.
+struct CSmartRewardEvaluation
 {
-    CDBBatch batch(*this);
+    CSmartRewardEntry entry;
+    CSmartRewardSnapshot snapshot;
+    // The snapshot was written before the evaluation got interrupted.
+    bool fDone;
+};
+
+// Eligible entries and balance of one part of a chunk.
+struct CSmartRewardEvaluationSums
+{
+    int64_t eligibleEntries;
+    CAmount eligibleSmart;
+};
+
+static void EvaluateRoundRange(std::vector<CSmartRewardEvaluation> &vEvaluations, size_t nBegin, size_t nEnd, const CSmartRewardRound &current, CSmartRewardEvaluationSums &sums)
+{
+    CSmartRewardEvaluationSums part = {0, 0};
+
+    for( size_t i = nBegin; i < nEnd; ++i ){
+        CSmartRewardEvaluation &evaluation = vEvaluations[i];
+        CSmartRewardEntry &entry = evaluation.entry;
+
+        if( !evaluation.fDone ){
+            if( current.number ) evaluation.snapshot = CSmartRewardSnapshot(entry, current);
+
+            entry.balanceOnStart = entry.balance;
+            entry.eligible = entry.balanceOnStart >= SMART_REWARDS_MIN_BALANCE && !SmartHive::IsHive(entry.id);
+        }
 
-    BOOST_FOREACH(const CSmartRewardEntry &e, entries) {
-        batch.Write(make_pair(DB_REWARD_ENTRY,e.id), e);
+        if( entry.eligible ){
+            ++part.eligibleEntries;
+            part.eligibleSmart += entry.balanceOnStart;
+        }
     }
 
+    sums = part;
+}
+
+// Walk all reward entries once without loading them into memory. Snapshots of
+// the finished round and the entries updated for the next one are written in
+// chunks of nRewardsEvaluateBatchSize. Both rounds get recorded up front and
+// stay recorded until FinalizeRound or StartFirstRound, an interrupted
+// evaluation continues from that record on the next start. The snapshot of an
+// entry is written in the same batch as the entry, so the entries with one
+// are done already.
+//
+// The entries are read in chunks of nRewardsEvaluateChunkSize which get
+// evaluated on several threads. Each thread sums up its part of the chunk,
+// the integer sums are added up afterwards so the result doesn't depend on
+// the number of threads. The batches get written in key order by a separate
+// thread while the next chunks are read and evaluated.
+bool CSmartRewardsDB::EvaluateRound(const CSmartRewardRound &current, CSmartRewardRound &next, CSmartRewardSnapshotList &payouts)
+{
+    bool fResume = Exists(DB_ROUND_EVALUATING);
+
+    if( !fResume && !Write(DB_ROUND_EVALUATING, make_pair(current, next), true) ) return false;
+
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    // One batch gets filled while the other one is written.
+    std::unique_ptr<CDBBatch> batch(new CDBBatch(*this));
+    std::unique_ptr<CDBBatch> batchWriting(new CDBBatch(*this));
+    bool fWriteOk = true;
+    std::thread threadWrite;
+
+    // Don't leave the write thread running if anything below throws.
+    struct CWriteJoiner {
+        std::thread &thread;
+        ~CWriteJoiner() { if( thread.joinable() ) thread.join(); }
+    } joiner = {threadWrite};
+
+    std::vector<CSmartRewardEvaluation> vEvaluations;
+    bool fEnd = false;
+
+    payouts.clear();
+
+    pcursor->Seek(DB_REWARD_ENTRY);
+
+    while( !fEnd ){
+
+        vEvaluations.clear();
+
+        while( vEvaluations.size() < nRewardsEvaluateChunkSize ){
+            std::pair<char,CSmartAddress> key;
+            if( !pcursor->Valid() || !pcursor->GetKey(key) || key.first != DB_REWARD_ENTRY ){
+                fEnd = true;
+                break;
+            }
+
+            vEvaluations.push_back(CSmartRewardEvaluation());
+            CSmartRewardEvaluation &evaluation = vEvaluations.back();
+
+            if( !pcursor->GetValue(evaluation.entry) ) return error("failed to get reward entry");
+
+            evaluation.fDone = fResume && current.number &&
+                               Read(make_pair(DB_ROUND_SNAPSHOT, make_pair(current.number, evaluation.entry.id)), evaluation.snapshot);
+
+            pcursor->Next();
+        }
+
+        size_t nThreads = std::max<size_t>(std::min<size_t>(std::max(GetNumCores(), 1), vEvaluations.size() / nRewardsEvaluatePerThread), 1);
+        size_t nChunk = (vEvaluations.size() + nThreads - 1) / nThreads;
+        std::vector<CSmartRewardEvaluationSums> vSums(nThreads);
+        std::vector<std::thread> vecThreads;
+
+        for( size_t n = 1; n < nThreads; ++n ){
+            size_t nBegin = std::min(n * nChunk, vEvaluations.size());
+            size_t nEnd = std::min(nBegin + nChunk, vEvaluations.size());
+            vecThreads.push_back(std::thread(EvaluateRoundRange, std::ref(vEvaluations), nBegin, nEnd, std::cref(current), std::ref(vSums[n])));
+        }
+
+        EvaluateRoundRange(vEvaluations, 0, std::min(nChunk, vEvaluations.size()), current, vSums[0]);
+
+        for( auto& thread : vecThreads ) thread.join();
+
+        BOOST_FOREACH(const CSmartRewardEvaluationSums &sums, vSums) {
+            next.eligibleEntries += sums.eligibleEntries;
+            next.eligibleSmart += sums.eligibleSmart;
+        }
+
+        BOOST_FOREACH(const CSmartRewardEvaluation &evaluation, vEvaluations) {
+            const CSmartRewardEntry &entry = evaluation.entry;
+
+            if( current.number && evaluation.snapshot.reward ) payouts.push_back(evaluation.snapshot);
+
+            if( evaluation.fDone ) continue;
+
+            if( current.number ) batch->Write(make_pair(DB_ROUND_SNAPSHOT, make_pair(current.number, entry.id)), evaluation.snapshot);
+
+            batch->Write(make_pair(DB_REWARD_ENTRY, entry.id), entry);
+        }
+
+        if( !fEnd && batch->SizeEstimate() > nRewardsEvaluateBatchSize ){
+            if( threadWrite.joinable() ) threadWrite.join();
+            if( !fWriteOk ) return false;
+
+            batch.swap(batchWriting);
+            batch->Clear();
+
+            CDBBatch *pbatch = batchWriting.get();
+            threadWrite = std::thread([this, pbatch, &fWriteOk]() {
+                try {
+                    fWriteOk = WriteBatch(*pbatch);
+                } catch (const std::exception& e) {
+                    fWriteOk = error("CSmartRewardsDB::EvaluateRound: %s", e.what());
+                }
+            });
+        }
+    }
+
+    if( threadWrite.joinable() ) threadWrite.join();
+    if( !fWriteOk ) return false;
+
+    return WriteBatch(*batch);
+}
+
+bool CSmartRewardsDB::StartFirstRound(const CSmartRewardRound &start)
+{
+    CDBBatch batch(*this);
+
     batch.Write(DB_ROUND_CURRENT, start);
+    batch.Erase(DB_ROUND_EVALUATING);
 
     return WriteBatch(batch, true);
 }
 
-bool CSmartRewardsDB::FinalizeRound(const CSmartRewardRound &current, const CSmartRewardRound &next, const CSmartRewardEntryList &entries, const CSmartRewardSnapshotList &snapshots)
+bool CSmartRewardsDB::FinalizeRound(const CSmartRewardRound &current, const CSmartRewardRound &next)
 {
     CDBBatch batch(*this);
 
-    BOOST_FOREACH(const CSmartRewardSnapshot &s, snapshots) {
-        batch.Write(make_pair(DB_ROUND_SNAPSHOT, make_pair(current.number, s.id)), s);
+    batch.Write(make_pair(DB_ROUND,current.number), current);
+    batch.Write(DB_ROUND_CURRENT, next);
+    batch.Erase(DB_ROUND_EVALUATING);
+
+    return WriteBatch(batch, true);
+}
+
+// Each record gets written as its key, starting with the record type, followed by its value.
+template <typename K, typename V>
+static bool DumpRecord(CDBIterator &pcursor, CAutoFile &file)
+{
+    std::pair<char, K> key;
+    V value;
+    if( !pcursor.GetKey(key) || !pcursor.GetValue(value) ) return false;
+    file << key << value;
+    return true;
+}
+
+// Same for the records the type is the whole key of.
+template <typename V>
+static bool DumpSingleRecord(CDBIterator &pcursor, CAutoFile &file)
+{
+    char type;
+    V value;
+    if( !pcursor.GetKey(type) || !pcursor.GetValue(value) ) return false;
+    file << type << value;
+    return true;
+}
+
+template <typename K, typename V>
+static void LoadRecord(const char type, CAutoFile &file, CDBBatch &batch)
+{
+    K key;
+    V value;
+    file >> key >> value;
+    batch.Write(make_pair(type, key), value);
+}
+
+template <typename V>
+static void LoadSingleRecord(const char type, CAutoFile &file, CDBBatch &batch)
+{
+    V value;
+    file >> value;
+    batch.Write(type, value);
+}
+
+bool CSmartRewardsDB::DumpRecords(CDBIterator &pcursor, CAutoFile &file, uint64_t &nRecords)
+{
+    nRecords = 0;
+
+    for( pcursor.SeekToFirst(); pcursor.Valid(); pcursor.Next() ){
+        boost::this_thread::interruption_point();
+
+        char type;
+        if( !pcursor.GetKey(type) ) return error("%s: failed to read key", __func__);
+
+        bool fOk;
+
+        switch( type ){
+        case DB_VERSION:
+        case DB_LOCK:
+            continue;
+        case DB_ROUND_EVALUATING:
+            return error("%s: the evaluation of a round is unfinished", __func__);
+        case DB_ROUND_CURRENT: fOk = DumpSingleRecord<CSmartRewardRound>(pcursor, file); break;
+        case DB_ROUND: fOk = DumpRecord<uint16_t, CSmartRewardRound>(pcursor, file); break;
+        case DB_ROUND_SNAPSHOT: fOk = DumpRecord<std::pair<uint16_t, CSmartAddress>, CSmartRewardSnapshot>(pcursor, file); break;
+        case DB_REWARD_ENTRY: fOk = DumpRecord<CSmartAddress, CSmartRewardEntry>(pcursor, file); break;
+        case DB_BLOCK: fOk = DumpRecord<int, CSmartRewardBlock>(pcursor, file); break;
+        case DB_BLOCK_LAST: fOk = DumpSingleRecord<CSmartRewardBlock>(pcursor, file); break;
+        case DB_TX_HASH: fOk = DumpRecord<uint256, CSmartRewardTransaction>(pcursor, file); break;
+        default:
+            return error("%s: unknown record type %d", __func__, type);
+        }
+
+        if( !fOk ) return error("%s: failed to read record of type %c", __func__, type);
+
+        ++nRecords;
     }
 
-    BOOST_FOREACH(const CSmartRewardEntry &e, entries) {
-        batch.Write(make_pair(DB_REWARD_ENTRY,e.id), e);
+    file << char(0);
+
+    return true;
+}
+
+bool CSmartRewardsDB::LoadRecords(CAutoFile &file, uint64_t &nRecords)
+{
+    CDBBatch batch(*this);
+
+    nRecords = 0;
+
+    // An interrupted load gets detected on the next start.
+    Write(DB_LOCK, 1, true);
+
+    while( true ){
+        boost::this_thread::interruption_point();
+
+        char type;
+        file >> type;
+
+        if( !type ) break;
+
+        switch( type ){
+        case DB_ROUND_CURRENT: LoadSingleRecord<CSmartRewardRound>(type, file, batch); break;
+        case DB_ROUND: LoadRecord<uint16_t, CSmartRewardRound>(type, file, batch); break;
+        case DB_ROUND_SNAPSHOT: LoadRecord<std::pair<uint16_t, CSmartAddress>, CSmartRewardSnapshot>(type, file, batch); break;
+        case DB_REWARD_ENTRY: LoadRecord<CSmartAddress, CSmartRewardEntry>(type, file, batch); break;
+        case DB_BLOCK: LoadRecord<int, CSmartRewardBlock>(type, file, batch); break;
+        case DB_BLOCK_LAST: LoadSingleRecord<CSmartRewardBlock>(type, file, batch); break;
+        case DB_TX_HASH: LoadRecord<uint256, CSmartRewardTransaction>(type, file, batch); break;
+        default:
+            return error("%s: unknown record type %d", __func__, type);
+        }
+
+        ++nRecords;
+
+        if( batch.SizeEstimate() > nRewardsEvaluateBatchSize ){
+            if( !WriteBatch(batch) ) return false;
+            batch.Clear();
+        }
     }
 
-    batch.Write(make_pair(DB_ROUND,current.number), current);
-    batch.Write(DB_ROUND_CURRENT, next);
+    if( !WriteBatch(batch, true) ) return false;
 
-    return WriteBatch(batch, true);
+    return Erase(DB_LOCK, true);
 }
 
 bool CSmartRewardsDB::ReadRewardEntries(CSmartRewardEntryList &entries) {
@@ -361,6 +686,340 @@ bool CSmartRewardsDB::ReadRewardPayouts(const int16_t round, CSmartRewardSnapsho
     return true;
 }
 
+bool CSmartRewardsDB::ExportRewardSnapshots(const int16_t round, const boost::filesystem::path &path)
+{
+    std::vector<CSmartRewardSnapshotFile::Record> records;
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(make_pair(DB_ROUND_SNAPSHOT,round));
+
+    while (pcursor->Valid()) {
+        std::pair<char,std::pair<int16_t, CSmartAddress>> key;
+        if (!pcursor->GetKey(key) || key.first != DB_ROUND_SNAPSHOT || key.second.first != round) break;
+
+        CSmartRewardSnapshot snapshot;
+        if (!pcursor->GetValue(snapshot)) return error("failed to get reward snapshot");
+
+        CSmartRewardSnapshotFile::Record record;
+        if( !CSmartRewardSnapshotFile::GetKey(snapshot.id, record.key) ) return error("%s: Unsupported address %s", __func__, snapshot.id.ToString());
+        record.balance = snapshot.balance;
+        record.reward = snapshot.reward;
+
+        records.push_back(record);
+        pcursor->Next();
+    }
+
+    return CSmartRewardSnapshotFile::Write(path, round, records);
+}
+
+// Lines of the records nBegin to nEnd of an ExportCSV chunk. Snapshots have their
+// reward in the entry's reward field.
+static void FormatExportRange(const CSmartRewardEntryList &vRecords, size_t nBegin, size_t nEnd, bool fSnapshots, std::string &strLines)
+{
+    for( size_t i = nBegin; i < nEnd; ++i ){
+        const CSmartRewardEntry &record = vRecords[i];
+
+        if( fSnapshots )
+            strLines += strprintf("%s,%s,%s\n", record.id.ToString(), FormatMoney(record.balance), FormatMoney(record.reward));
+        else
+            strLines += strprintf("%s,%s,%s,%d\n", record.id.ToString(), FormatMoney(record.balance), FormatMoney(record.balanceOnStart), record.eligible);
+    }
+}
+
+// Read the records in chunks like EvaluateRound, the addresses of a chunk get
+// encoded on several threads and the lines written in key order.
+static bool WriteExportCSV(CDBIterator &pcursor, const int16_t round, FILE *file, uint64_t &nRecords)
+{
+    if( round ){
+        pcursor.Seek(make_pair(DB_ROUND_SNAPSHOT, round));
+        fputs("address,balance,reward\n", file);
+    }else{
+        pcursor.Seek(DB_REWARD_ENTRY);
+        fputs("address,balance,balance_on_start,eligible\n", file);
+    }
+
+    CSmartRewardEntryList vRecords;
+    vRecords.reserve(nRewardsEvaluateChunkSize);
+    bool fEnd = false;
+
+    while( !fEnd ){
+        boost::this_thread::interruption_point();
+
+        vRecords.clear();
+
+        while( vRecords.size() < nRewardsEvaluateChunkSize ){
+            if( !pcursor.Valid() ){
+                fEnd = true;
+                break;
+            }
+
+            if( round ){
+                std::pair<char,std::pair<int16_t, CSmartAddress>> key;
+                if( !pcursor.GetKey(key) || key.first != DB_ROUND_SNAPSHOT || key.second.first != round ){
+                    fEnd = true;
+                    break;
+                }
+
+                CSmartRewardSnapshot snapshot;
+                if( !pcursor.GetValue(snapshot) ) return error("%s: failed to read reward snapshot", __func__);
+
+                vRecords.push_back(CSmartRewardEntry(snapshot.id));
+                vRecords.back().balance = snapshot.balance;
+                vRecords.back().reward = snapshot.reward;
+            }else{
+                std::pair<char,CSmartAddress> key;
+                if( !pcursor.GetKey(key) || key.first != DB_REWARD_ENTRY ){
+                    fEnd = true;
+                    break;
+                }
+
+                vRecords.push_back(CSmartRewardEntry());
+                if( !pcursor.GetValue(vRecords.back()) ) return error("%s: failed to read reward entry", __func__);
+            }
+
+            pcursor.Next();
+        }
+
+        size_t nThreads = std::max<size_t>(std::min<size_t>(std::max(GetNumCores(), 1), vRecords.size() / nRewardsEvaluatePerThread), 1);
+        size_t nChunk = (vRecords.size() + nThreads - 1) / nThreads;
+        std::vector<std::string> vLines(nThreads);
+        std::vector<std::thread> vecThreads;
+
+        for( size_t n = 1; n < nThreads; ++n ){
+            size_t nBegin = std::min(n * nChunk, vRecords.size());
+            size_t nEnd = std::min(nBegin + nChunk, vRecords.size());
+            vecThreads.push_back(std::thread(FormatExportRange, std::cref(vRecords), nBegin, nEnd, round != 0, std::ref(vLines[n])));
+        }
+
+        FormatExportRange(vRecords, 0, std::min(nChunk, vRecords.size()), round != 0, vLines[0]);
+
+        for( auto& thread : vecThreads ) thread.join();
+
+        for( const std::string &strLines : vLines ){
+            if( fwrite(strLines.data(), 1, strLines.size(), file) != strLines.size() )
+                return error("%s: failed to write", __func__);
+        }
+
+        nRecords += vRecords.size();
+    }
+
+    return true;
+}
+
+bool CSmartRewardsDB::ExportCSV(CDBIterator &pcursor, const int16_t round, const boost::filesystem::path &path, uint64_t &nRecords)
+{
+    nRecords = 0;
+
+    // Nobody should pick up a file that isn't complete yet
+    boost::filesystem::path pathTemp = path;
+    pathTemp += ".incomplete";
+
+    FILE *file = fopen(pathTemp.string().c_str(), "w");
+    if( !file ) return error("%s: Unable to open %s for writing", __func__, pathTemp.string());
+
+    bool fOk = WriteExportCSV(pcursor, round, file, nRecords);
+
+    if( fOk ) FileCommit(file);
+    if( fclose(file) != 0 ) fOk = false;
+
+    if( fOk && !RenameOver(pathTemp, path) ) fOk = error("%s: Unable to rename %s to %s", __func__, pathTemp.string(), path.string());
+
+    if( !fOk ){
+        boost::system::error_code ec;
+        boost::filesystem::remove(pathTemp, ec);
+    }
+
+    return fOk;
+}
+
+void CSmartRewardEntryCache::Release(size_t nSlot)
+{
+    mapIndex.erase(vSlots[nSlot].entry.id);
+    vSlots[nSlot].entry = CSmartRewardEntry();
+    vFree.push_back(nSlot);
+}
+
+void CSmartRewardEntryCache::Evict()
+{
+    while( mapIndex.size() > nMaxEntries && !listLru.empty() ){
+        Release(listLru.back());
+        listLru.pop_back();
+    }
+}
+
+void CSmartRewardEntryCache::Trim(size_t nEntries)
+{
+    while( mapIndex.size() > nEntries && !listLru.empty() ){
+        Release(listLru.back());
+        listLru.pop_back();
+    }
+
+    // The arena doesn't shrink by itself, move the entries left into a new one.
+    std::deque<Slot> vSlotsNew;
+    std::vector<size_t> vMoved(vSlots.size());
+
+    for( auto &it : mapIndex ){
+        vMoved[it.second] = vSlotsNew.size();
+        vSlotsNew.push_back(vSlots[it.second]);
+        it.second = vMoved[it.second];
+    }
+
+    for( size_t &nSlot : listLru ) nSlot = vMoved[nSlot];
+    for( size_t &nSlot : vDirty ) nSlot = vMoved[nSlot];
+
+    vSlots.swap(vSlotsNew);
+    std::vector<size_t>().swap(vFree);
+}
+
+size_t CSmartRewardEntryCache::DynamicMemoryUsage() const
+{
+    // Every entry holds its address twice, in its slot and as key of the index.
+    return vSlots.size() * (sizeof(Slot) + memusage::MallocUsage(sizeof(uint160))) +
+           mapIndex.size() * memusage::MallocUsage(sizeof(uint160)) +
+           memusage::DynamicUsage(mapIndex) + memusage::DynamicUsage(listLru) +
+           memusage::DynamicUsage(vFree) + memusage::DynamicUsage(vDirty);
+}
+
+CSmartRewardEntry *CSmartRewardEntryCache::Find(const CSmartAddress &id)
+{
+    auto it = mapIndex.find(id);
+    if( it == mapIndex.end() ) return nullptr;
+
+    Slot &slot = vSlots[it->second];
+    if( !slot.fDirty ) listLru.splice(listLru.begin(), listLru, slot.itLru);
+
+    return &slot.entry;
+}
+
+const CSmartRewardEntry *CSmartRewardEntryCache::Peek(const CSmartAddress &id) const
+{
+    auto it = mapIndex.find(id);
+    if( it == mapIndex.end() ) return nullptr;
+
+    return &vSlots[it->second].entry;
+}
+
+CSmartRewardEntry *CSmartRewardEntryCache::Modify(const CSmartAddress &id)
+{
+    auto it = mapIndex.find(id);
+    if( it == mapIndex.end() ) return nullptr;
+
+    Slot &slot = vSlots[it->second];
+    if( !slot.fDirty ){
+        listLru.erase(slot.itLru);
+        slot.fDirty = true;
+        vDirty.push_back(it->second);
+    }
+
+    return &slot.entry;
+}
+
+CSmartRewardEntry *CSmartRewardEntryCache::Add(const CSmartRewardEntry &entry)
+{
+    size_t nSlot;
+
+    if( vFree.size() ){
+        nSlot = vFree.back();
+        vFree.pop_back();
+    }else{
+        nSlot = vSlots.size();
+        vSlots.push_back(Slot());
+    }
+
+    Slot &slot = vSlots[nSlot];
+    slot.entry = entry;
+    slot.fDirty = true;
+    vDirty.push_back(nSlot);
+
+    mapIndex.insert(std::make_pair(entry.id, nSlot));
+
+    Evict();
+
+    return &slot.entry;
+}
+
+void CSmartRewardEntryCache::GetDirty(std::vector<const CSmartRewardEntry*> &entries) const
+{
+    entries.reserve(entries.size() + vDirty.size());
+
+    BOOST_FOREACH(size_t nSlot, vDirty) {
+        entries.push_back(&vSlots[nSlot].entry);
+    }
+}
+
+void CSmartRewardEntryCache::Flushed()
+{
+    BOOST_FOREACH(size_t nSlot, vDirty) {
+        Slot &slot = vSlots[nSlot];
+        slot.fDirty = false;
+
+        if( slot.entry.balance <= 0 ){
+            Release(nSlot);
+        }else{
+            listLru.push_front(nSlot);
+            slot.itLru = listLru.begin();
+        }
+    }
+
+    vDirty.clear();
+
+    Evict();
+}
+
+void CSmartRewardEntryCache::Clear()
+{
+    vSlots.clear();
+    vFree.clear();
+    mapIndex.clear();
+    listLru.clear();
+    vDirty.clear();
+}
+
+// 10 bits and 7 hash functions per element keep the false positive rate below 1%
+static const uint64_t TX_FILTER_BITS_PER_ELEMENT = 10;
+static const int TX_FILTER_HASH_FUNCS = 7;
+
+void CSmartRewardTransactionFilter::Reset(uint64_t nCapacityIn)
+{
+    nCapacity = std::max<uint64_t>(nCapacityIn, 1);
+    nElements = 0;
+    nTweak0 = GetRand(std::numeric_limits<uint64_t>::max());
+    nTweak1 = GetRand(std::numeric_limits<uint64_t>::max());
+    vData.assign((nCapacity * TX_FILTER_BITS_PER_ELEMENT + 63) / 64, 0);
+}
+
+void CSmartRewardTransactionFilter::Insert(const uint256 &hash)
+{
+    if( vData.empty() ) return;
+
+    uint64_t nHash = SipHashUint256(nTweak0, nTweak1, hash);
+    uint64_t nBits = vData.size() * 64;
+    uint32_t h1 = nHash, h2 = nHash >> 32;
+
+    for( int i = 0; i < TX_FILTER_HASH_FUNCS; ++i ){
+        uint64_t nBit = (h1 + (uint64_t)i * h2) % nBits;
+        vData[nBit >> 6] |= (uint64_t)1 << (nBit & 63);
+    }
+
+    ++nElements;
+}
+
+bool CSmartRewardTransactionFilter::MayContain(const uint256 &hash) const
+{
+    if( vData.empty() ) return true;
+
+    uint64_t nHash = SipHashUint256(nTweak0, nTweak1, hash);
+    uint64_t nBits = vData.size() * 64;
+    uint32_t h1 = nHash, h2 = nHash >> 32;
+
+    for( int i = 0; i < TX_FILTER_HASH_FUNCS; ++i ){
+        uint64_t nBit = (h1 + (uint64_t)i * h2) % nBits;
+        if( !(vData[nBit >> 6] & ((uint64_t)1 << (nBit & 63))) ) return false;
+    }
+
+    return true;
+}
+
 string CSmartRewardEntry::GetAddress() const
 {
     return id.ToString();
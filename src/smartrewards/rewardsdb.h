@@ -12,14 +12,28 @@
 #include "base58.h"
 #include "smarthive/hive.h"
 
+#include <deque>
+#include <boost/filesystem/path.hpp>
+#include <list>
+
 static constexpr uint8_t REWARDS_DB_VERSION = 0x01;
 
+static const CAmount SMART_REWARDS_MIN_BALANCE = 1000 * COIN;
+
 //! Compensate for extra memory peak (x1.5-x1.9) at flush time.
 static constexpr int REWARDS_DB_PEAK_USAGE_FACTOR = 2;
 //! -rewardsdbcache default (MiB)
 static const int64_t nRewardsDefaultDbCache = 80;
+//! -dbcache set by -rewardsobserver (MiB)
+static const int64_t nRewardsObserverDbCache = 50;
 //! max. -rewardsdbcache (MiB)
 static const int64_t nRewardsMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
+//! Max. size of a single batch written while a round gets evaluated (bytes)
+static const size_t nRewardsEvaluateBatchSize = 16 << 20;
+//! Reward entries read from the database at once while a round gets evaluated
+static const size_t nRewardsEvaluateChunkSize = 50000;
+//! Min. reward entries per thread evaluating a chunk
+static const size_t nRewardsEvaluatePerThread = 5000;
 
 class CSmartRewardBlock;
 class CSmartRewardEntry;
@@ -33,7 +47,28 @@ typedef std::vector<CSmartRewardRound> CSmartRewardRoundList;
 typedef std::vector<CSmartRewardSnapshot> CSmartRewardSnapshotList;
 typedef std::vector<CSmartRewardTransaction> CSmartRewardTransactionList;
 
-typedef std::map<CSmartAddress, CSmartRewardEntry*> CSmartRewardEntryMap;
+
+/** Salted bloom filter over the transaction hashes in the rewards database.
+ *  It has no false negatives, so a hash it does not contain is not in the database. */
+class CSmartRewardTransactionFilter
+{
+    std::vector<uint64_t> vData;
+    uint64_t nTweak0, nTweak1;
+    uint64_t nElements;
+    uint64_t nCapacity;
+
+public:
+    CSmartRewardTransactionFilter() : nTweak0(0), nTweak1(0), nElements(0), nCapacity(0) {}
+
+    //! Clear the filter and size it for nCapacityIn hashes.
+    void Reset(uint64_t nCapacityIn);
+    void Insert(const uint256 &hash);
+    bool MayContain(const uint256 &hash) const;
+
+    //! True if the filter was never sized or holds more hashes than it was sized for.
+    bool NeedsRebuild() const { return vData.empty() || nElements > nCapacity; }
+    uint64_t GetElements() const { return nElements; }
+};
 
 class CSmartRewardTransaction
 {
@@ -74,7 +109,7 @@ public:
     CSmartRewardBlock(){nHeight = 0; blockHash = uint256(); blockTime = 0;}
     CSmartRewardBlock(int height, uint256 &hash, int64_t time) : nHeight(height), blockHash(hash), blockTime(time) {}
 
-    ADD_SERIALIZE_METHODS
+    ADD_SERIALIZE_METHODS_FIXED_SIZE(44)
 
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
@@ -195,6 +230,56 @@ public:
     std::string ToString() const;
 };
 
+/** Pooled cache of reward entries.
+ *  Entries live in one arena and evicted slots get reused. Modified entries
+ *  are pinned as dirty until the next flush, clean ones stay cached across
+ *  flushes and get evicted in least recently used order. */
+class CSmartRewardEntryCache
+{
+    struct Slot
+    {
+        CSmartRewardEntry entry;
+        bool fDirty;
+        std::list<size_t>::iterator itLru;
+    };
+
+    std::deque<Slot> vSlots;
+    std::vector<size_t> vFree;
+    std::map<CSmartAddress, size_t> mapIndex;
+    // Clean entries, the most recently used first.
+    std::list<size_t> listLru;
+    std::vector<size_t> vDirty;
+    size_t nMaxEntries;
+
+    void Release(size_t nSlot);
+    void Evict();
+
+public:
+    explicit CSmartRewardEntryCache(size_t nMaxEntriesIn) : nMaxEntries(nMaxEntriesIn) {}
+
+    //! Cached entry for id or nullptr, the pointer is valid until the next flush or insert.
+    CSmartRewardEntry *Find(const CSmartAddress &id);
+    //! Like Find, but leaves the LRU order alone so it can run next to other readers.
+    const CSmartRewardEntry *Peek(const CSmartAddress &id) const;
+    //! Like Find, but marks the entry as modified.
+    CSmartRewardEntry *Modify(const CSmartAddress &id);
+    //! Add an entry that is not cached yet, it starts as modified.
+    CSmartRewardEntry *Add(const CSmartRewardEntry &entry);
+
+    void GetDirty(std::vector<const CSmartRewardEntry*> &entries) const;
+    //! Mark all entries as written. Entries without balance were erased from the database and are dropped.
+    void Flushed();
+    void Clear();
+
+    size_t GetDirtyCount() const { return vDirty.size(); }
+    size_t size() const { return mapIndex.size(); }
+    //! Change the number of entries kept, clean entries above it get dropped.
+    void SetMaxEntries(size_t nMaxEntriesIn) { nMaxEntries = nMaxEntriesIn; Evict(); }
+    //! Drop clean entries until at most nEntries are left and give the unused slots back, the maximum stays.
+    void Trim(size_t nEntries);
+    size_t DynamicMemoryUsage() const;
+};
+
 class CSmartRewardSnapshot
 {
 
@@ -248,18 +333,14 @@ class CSmartRewardsDB : public CDBWrapper
 {
 public:
     CSmartRewardsDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
-    ~CSmartRewardsDB() { Unlock(); }
 private:
     CSmartRewardsDB(const CSmartRewardsDB&);
     void operator=(const CSmartRewardsDB&);
-
-    bool locked;
-    void Unlock();
 public:
 
     bool Verify(int& lastBlockHeight);
 
-    void Lock();
+    //! True if a LoadRecords didn't finish, or a node of an older version didn't shut down cleanly.
     bool IsLocked();
 
     bool ResetToRound(const int16_t number, const CSmartRewardRound &round, const CSmartRewardEntryList &entries);
@@ -268,21 +349,35 @@ public:
     bool ReadLastBlock(CSmartRewardBlock &block);
 
     bool ReadTransaction(const uint256 hash, CSmartRewardTransaction &transaction);
+    bool ReadTransactionFilter(CSmartRewardTransactionFilter &filter, uint64_t nMinHeadroom);
 
     bool ReadRound(const int16_t number, CSmartRewardRound &round);
     bool ReadRounds(CSmartRewardRoundList &vect);
 
     bool ReadCurrentRound(CSmartRewardRound &round);
+    //! The rounds of an EvaluateRound that got interrupted, false if there is none.
+    bool ReadEvaluatingRound(CSmartRewardRound &current, CSmartRewardRound &next);
 
     bool ReadRewardEntry(const CSmartAddress &id, CSmartRewardEntry &entry);
     bool ReadRewardEntries(CSmartRewardEntryList &vect);
+    //! Read the entries of ids with one iterator, ids get sorted. Missing ids are not added to entries.
+    bool ReadRewardEntries(std::vector<CSmartAddress> &ids, std::map<CSmartAddress, CSmartRewardEntry> &entries);
 
     bool ReadRewardSnapshots(const int16_t round, CSmartRewardSnapshotList &snapshots);
     bool ReadRewardPayouts(const int16_t round, CSmartRewardSnapshotList &payouts);
-
-    bool SyncBlocks(const CSmartRewardBlockList &blocks, const CSmartRewardRound& current, const CSmartRewardEntryMap &rewards, const CSmartRewardTransactionList &transactions);
-    bool StartFirstRound(const CSmartRewardRound &start, const CSmartRewardEntryList &entries);
-    bool FinalizeRound(const CSmartRewardRound &current, const CSmartRewardRound &next, const CSmartRewardEntryList &entries, const CSmartRewardSnapshotList &snapshot);
+    bool ExportRewardSnapshots(const int16_t round, const boost::filesystem::path &path);
+
+    bool SyncBlocks(const CSmartRewardBlockList &blocks, const CSmartRewardRound& current, const std::vector<const CSmartRewardEntry*> &rewards, const CSmartRewardTransactionList &transactions);
+    bool EvaluateRound(const CSmartRewardRound &current, CSmartRewardRound &next, CSmartRewardSnapshotList &payouts);
+    bool StartFirstRound(const CSmartRewardRound &start);
+    bool FinalizeRound(const CSmartRewardRound &current, const CSmartRewardRound &next);
+
+    //! Write the records pcursor iterates over to file, all but the lock and the version. See dumptxoutset.
+    static bool DumpRecords(CDBIterator &pcursor, CAutoFile &file, uint64_t &nRecords);
+    //! Add the records of DumpRecords, the database stays locked until all of them are written.
+    bool LoadRecords(CAutoFile &file, uint64_t &nRecords);
+    //! Write the snapshots of round, or the reward entries with round 0, pcursor iterates over to path as CSV.
+    static bool ExportCSV(CDBIterator &pcursor, const int16_t round, const boost::filesystem::path &path, uint64_t &nRecords);
 
 };
 
@@ -26,13 +26,10 @@ CSmartRewardSnapshotList SmartRewardPayments::GetPaymentsForBlock(const int nHei
         return CSmartRewardSnapshotList();
     }
 
-    CSmartRewardRound round;
-    CSmartRewardSnapshotList roundPayments;
+    // The round and its payouts are taken from the same state.
+    std::shared_ptr<const CSmartRewardRounds> rounds = prewards->GetRounds();
 
-    {
-        LOCK(cs_rewardrounds);
-        round = prewards->GetLastRound();
-    }
+    const CSmartRewardRound &round = rounds->last;
 
     // If there are no rounds yet or the database has an issue.
     if( !round.number ){
@@ -56,15 +53,15 @@ CSmartRewardSnapshotList SmartRewardPayments::GetPaymentsForBlock(const int nHei
         if( nHeight <= lastRoundBlock && !(( lastRoundBlock - nHeight ) % nRewardPayoutBlockInterval) ){
             // We have a reward block! Now try to create the payments vector.
 
-            if( !prewards->GetRewardPayouts( round.number, roundPayments ) ||
-                roundPayments.size() != eligibleEntries ){
+            // The payouts of the last round are kept sorted to make sure the
+            // slices are the same network wide.
+            const CSmartRewardSnapshotList &roundPayments = *rounds->lastPayouts;
+
+            if( roundPayments.size() != eligibleEntries ){
                 result = SmartRewardPayments::DatabaseError;
                 return CSmartRewardSnapshotList();
             }
 
-            // Sort it to make sure the slices are the same network wide.
-            std::sort(roundPayments.begin(), roundPayments.end());
-
             // Index of the current payout block for this round.
             int rewardBlock = rewardBlocks - ( (lastRoundBlock - nHeight) / nRewardPayoutBlockInterval );
             int blockPayees = nRewardPayoutsPerBlock;
@@ -102,6 +99,9 @@ void SmartRewardPayments::FillPayments(CMutableTransaction &coinbaseTx, int nHei
 {
 
     SmartRewardPayments::Result result;
+
+    WaitForSmartRewards(nHeight);
+
     CSmartRewardSnapshotList rewards =  SmartRewardPayments::GetPaymentsForBlock(nHeight, prevBlockTime, result);
 
     // only create rewardblocks if a rewardblock is actually required at the current height.
@@ -118,15 +118,15 @@ void SmartRewardPayments::FillPayments(CMutableTransaction &coinbaseTx, int nHei
 }
 
 
-SmartRewardPayments::Result SmartRewardPayments::Validate(const CBlock& block, int nHeight, CAmount &smartReward)
+SmartRewardPayments::Result SmartRewardPayments::Validate(const CCoinbaseIndex& coinbase, int nHeight, int64_t blockTime, CAmount &smartReward)
 {
     SmartRewardPayments::Result result;
 
     smartReward = 0;
 
-    const CTransaction &txCoinbase = block.vtx[0];
+    WaitForSmartRewards(nHeight);
 
-    CSmartRewardSnapshotList rewards =  SmartRewardPayments::GetPaymentsForBlock(nHeight, block.GetBlockTime(), result);
+    CSmartRewardSnapshotList rewards =  SmartRewardPayments::GetPaymentsForBlock(nHeight, blockTime, result);
 
     if( result == SmartRewardPayments::Valid && rewards.size() ) {
 
@@ -135,13 +135,8 @@ SmartRewardPayments::Result SmartRewardPayments::Validate(const CBlock& block, i
             BOOST_FOREACH(const CSmartRewardSnapshot &payout, rewards)
             {
 
-                // Search for the reward payment in the transactions outputs.
-                auto isInOutputs = std::find_if(txCoinbase.vout.begin(), txCoinbase.vout.end(), [payout](const CTxOut &txout) -> bool {
-                    return payout.id.GetScript() == txout.scriptPubKey && payout.reward == txout.nValue;
-                });
-
                 // If the payout is not in the list?
-                if( isInOutputs == txCoinbase.vout.end() ){
+                if( !coinbase.Contains(payout.id.GetScript(), payout.reward) ){
                     LogPrintf("ValidateRewardPayments -- missing payment %s",payout.ToString() );
                     result = SmartRewardPayments::InvalidRewardList;
                     // We could return here..But lets print which payments else are missing.
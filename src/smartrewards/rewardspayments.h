@@ -6,6 +6,7 @@
 #define REWARDSPAYMENTS_H
 
 #include "smartrewards/rewardsdb.h"
+#include "smartmining/coinbaseindex.h"
 #include "dbwrapper.h"
 #include "amount.h"
 #include "chain.h"
@@ -35,7 +36,7 @@ typedef enum{
 } Result;
 
 CSmartRewardSnapshotList GetPaymentsForBlock(const int nHeight, int64_t blockTime, SmartRewardPayments::Result &result);
-SmartRewardPayments::Result Validate(const CBlock& block, const int nHeight, CAmount& smartReward);
+SmartRewardPayments::Result Validate(const CCoinbaseIndex& coinbase, const int nHeight, int64_t blockTime, CAmount& smartReward);
 void FillPayments(CMutableTransaction& txNew, int nHeight, int64_t prevBlockTime, std::vector<CTxOut>& voutSmartRewards);
 
 }
@@ -0,0 +1,231 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "smartrewards/rewardssnapshotfile.h"
+
+#include "chainparams.h"
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "util.h"
+
+#include <algorithm>
+
+#include <boost/filesystem.hpp>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const unsigned char SNAPSHOT_FILE_MAGIC[4] = {'S', 'R', 'S', 'F'};
+static const uint32_t SNAPSHOT_FILE_VERSION = 1;
+// magic, version, round, reserved, count
+static const size_t SNAPSHOT_FILE_HEADER_SIZE = 24;
+
+static size_t GetFileSize(uint64_t nCount)
+{
+    return SNAPSHOT_FILE_HEADER_SIZE + nCount * (SNAPSHOT_FILE_KEY_SIZE + 16) + (nCount + 7) / 8 + CSHA256::OUTPUT_SIZE;
+}
+
+bool CSmartRewardSnapshotFile::GetKey(const CSmartAddress &id, unsigned char key[SNAPSHOT_FILE_KEY_SIZE])
+{
+    CTxDestination dest = id.Get();
+    const std::vector<unsigned char> *pVersion;
+
+    if( const CKeyID *keyID = boost::get<CKeyID>(&dest) ){
+        pVersion = &Params().Base58Prefix(CChainParams::PUBKEY_ADDRESS);
+        memcpy(key + 1, keyID->begin(), 20);
+    }else if( const CScriptID *scriptID = boost::get<CScriptID>(&dest) ){
+        pVersion = &Params().Base58Prefix(CChainParams::SCRIPT_ADDRESS);
+        memcpy(key + 1, scriptID->begin(), 20);
+    }else{
+        return false;
+    }
+
+    if( pVersion->size() != 1 ) return false;
+
+    key[0] = pVersion->front();
+
+    return true;
+}
+
+bool CSmartRewardSnapshotFile::Write(const boost::filesystem::path &path, uint32_t nRound, std::vector<Record> &records)
+{
+    std::sort(records.begin(), records.end());
+
+    boost::filesystem::path pathTmp = path;
+    pathTmp += ".new";
+
+    FILE *file = fopen(pathTmp.string().c_str(), "wb");
+    if( !file ) return error("%s: Failed to open %s", __func__, pathTmp.string());
+
+    CSHA256 hasher;
+    bool fSuccess = true;
+
+    auto write = [&](const unsigned char *pch, size_t nLen) {
+        hasher.Write(pch, nLen);
+        fSuccess = fSuccess && fwrite(pch, 1, nLen, file) == nLen;
+    };
+
+    unsigned char header[SNAPSHOT_FILE_HEADER_SIZE] = {};
+    memcpy(header, SNAPSHOT_FILE_MAGIC, sizeof(SNAPSHOT_FILE_MAGIC));
+    WriteLE32(header + 4, SNAPSHOT_FILE_VERSION);
+    WriteLE32(header + 8, nRound);
+    WriteLE64(header + 16, records.size());
+    write(header, sizeof(header));
+
+    BOOST_FOREACH(const Record &r, records) write(r.key, SNAPSHOT_FILE_KEY_SIZE);
+
+    unsigned char buf[8];
+    BOOST_FOREACH(const Record &r, records) { WriteLE64(buf, r.balance); write(buf, 8); }
+    BOOST_FOREACH(const Record &r, records) { WriteLE64(buf, r.reward); write(buf, 8); }
+
+    std::vector<unsigned char> vPaid((records.size() + 7) / 8, 0);
+    for( size_t i = 0; i < records.size(); ++i ){
+        if( records[i].reward ) vPaid[i / 8] |= 1 << (i % 8);
+    }
+    if( vPaid.size() ) write(vPaid.data(), vPaid.size());
+
+    unsigned char hash[CSHA256::OUTPUT_SIZE];
+    hasher.Finalize(hash);
+    fSuccess = fSuccess && fwrite(hash, 1, sizeof(hash), file) == sizeof(hash);
+
+    if( fSuccess ) FileCommit(file);
+    fclose(file);
+
+    if( !fSuccess || !RenameOver(pathTmp, path) ){
+        boost::filesystem::remove(pathTmp);
+        return error("%s: Failed to write %s", __func__, path.string());
+    }
+
+    return true;
+}
+
+bool CSmartRewardSnapshotFile::Open(const boost::filesystem::path &path, bool fVerify)
+{
+    Close();
+
+#ifndef WIN32
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if( fd < 0 ) return false;
+
+    struct stat st;
+    if( fstat(fd, &st) != 0 || st.st_size < (off_t)GetFileSize(0) ){
+        close(fd);
+        return false;
+    }
+
+    void *pMapped = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if( pMapped == MAP_FAILED ) return false;
+
+    pData = (const unsigned char*)pMapped;
+    nSize = st.st_size;
+#else
+    FILE *file = fopen(path.string().c_str(), "rb");
+    if( !file ) return false;
+
+    uint64_t nFileSize = boost::filesystem::file_size(path);
+    vData.resize(nFileSize);
+    bool fRead = nFileSize >= GetFileSize(0) && fread(vData.data(), 1, nFileSize, file) == nFileSize;
+    fclose(file);
+
+    if( !fRead ){
+        vData.clear();
+        return false;
+    }
+
+    pData = vData.data();
+    nSize = vData.size();
+#endif
+
+    nRound = ReadLE32(pData + 8);
+    nCount = ReadLE64(pData + 16);
+
+    if( memcmp(pData, SNAPSHOT_FILE_MAGIC, sizeof(SNAPSHOT_FILE_MAGIC)) ||
+        ReadLE32(pData + 4) != SNAPSHOT_FILE_VERSION ||
+        nCount > nSize || GetFileSize(nCount) != nSize ){
+        Close();
+        return error("%s: Invalid snapshot file %s", __func__, path.string());
+    }
+
+    if( fVerify ){
+        unsigned char hash[CSHA256::OUTPUT_SIZE];
+        CSHA256().Write(pData, nSize - sizeof(hash)).Finalize(hash);
+
+        if( memcmp(hash, pData + nSize - sizeof(hash), sizeof(hash)) ){
+            Close();
+            return error("%s: Checksum mismatch in %s", __func__, path.string());
+        }
+    }
+
+    return true;
+}
+
+void CSmartRewardSnapshotFile::Close()
+{
+#ifndef WIN32
+    if( pData ) munmap((void*)pData, nSize);
+#else
+    vData.clear();
+#endif
+    pData = nullptr;
+    nSize = 0;
+    nCount = 0;
+    nRound = 0;
+}
+
+void CSmartRewardSnapshotFile::Get(uint64_t n, CSmartRewardSnapshot &snapshot) const
+{
+    assert(n < nCount);
+
+    const unsigned char *pKey = pData + SNAPSHOT_FILE_HEADER_SIZE + n * SNAPSHOT_FILE_KEY_SIZE;
+    const unsigned char *pBalances = pData + SNAPSHOT_FILE_HEADER_SIZE + nCount * SNAPSHOT_FILE_KEY_SIZE;
+    const unsigned char *pRewards = pBalances + nCount * 8;
+
+    uint160 hash;
+    memcpy(hash.begin(), pKey + 1, 20);
+
+    if( pKey[0] == Params().Base58Prefix(CChainParams::SCRIPT_ADDRESS).front() ) snapshot.id.Set(CScriptID(hash));
+    else snapshot.id.Set(CKeyID(hash));
+
+    snapshot.balance = ReadLE64(pBalances + n * 8);
+    snapshot.reward = ReadLE64(pRewards + n * 8);
+}
+
+bool CSmartRewardSnapshotFile::IsPaid(uint64_t n) const
+{
+    assert(n < nCount);
+
+    const unsigned char *pPaid = pData + SNAPSHOT_FILE_HEADER_SIZE + nCount * (SNAPSHOT_FILE_KEY_SIZE + 16);
+
+    return pPaid[n / 8] & (1 << (n % 8));
+}
+
+bool CSmartRewardSnapshotFile::Find(const CSmartAddress &id, CSmartRewardSnapshot &snapshot) const
+{
+    unsigned char key[SNAPSHOT_FILE_KEY_SIZE];
+    if( !pData || !GetKey(id, key) ) return false;
+
+    const unsigned char *pKeys = pData + SNAPSHOT_FILE_HEADER_SIZE;
+    uint64_t nLow = 0, nHigh = nCount;
+
+    while( nLow < nHigh ){
+        uint64_t nMid = nLow + (nHigh - nLow) / 2;
+        int cmp = memcmp(pKeys + nMid * SNAPSHOT_FILE_KEY_SIZE, key, SNAPSHOT_FILE_KEY_SIZE);
+
+        if( cmp == 0 ){
+            Get(nMid, snapshot);
+            return true;
+        }
+
+        if( cmp < 0 ) nLow = nMid + 1;
+        else nHigh = nMid;
+    }
+
+    return false;
+}
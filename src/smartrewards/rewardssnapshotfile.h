@@ -0,0 +1,75 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef REWARDSSNAPSHOTFILE_H
+#define REWARDSSNAPSHOTFILE_H
+
+#include "amount.h"
+#include "smartrewards/rewardsdb.h"
+
+#include <boost/filesystem/path.hpp>
+
+//! Size of an address in the snapshot file: base58 version byte + hash160
+static const size_t SNAPSHOT_FILE_KEY_SIZE = 21;
+
+/** Snapshot of a finished rewards round in a flat, read-only file.
+ *
+ *  The file holds a header followed by one column per field. The columns are
+ *  the addresses sorted by key, their balances and rewards as little endian
+ *  int64 and a bitset of the paid addresses. A SHA256 of everything before it
+ *  closes the file. The file gets mapped into memory and an address lookup is
+ *  a binary search over the address column.
+ */
+class CSmartRewardSnapshotFile
+{
+public:
+    struct Record
+    {
+        unsigned char key[SNAPSHOT_FILE_KEY_SIZE];
+        CAmount balance;
+        CAmount reward;
+
+        friend bool operator<(const Record& a, const Record& b)
+        {
+            return memcmp(a.key, b.key, SNAPSHOT_FILE_KEY_SIZE) < 0;
+        }
+    };
+
+private:
+    const unsigned char *pData;
+    size_t nSize;
+    uint64_t nCount;
+    uint32_t nRound;
+#ifdef WIN32
+    std::vector<unsigned char> vData;
+#endif
+
+    CSmartRewardSnapshotFile(const CSmartRewardSnapshotFile&);
+    void operator=(const CSmartRewardSnapshotFile&);
+
+public:
+    CSmartRewardSnapshotFile() : pData(nullptr), nSize(0), nCount(0), nRound(0) {}
+    ~CSmartRewardSnapshotFile() { Close(); }
+
+    //! Get the key of an address, false if it can't be stored in a snapshot file.
+    static bool GetKey(const CSmartAddress &id, unsigned char key[SNAPSHOT_FILE_KEY_SIZE]);
+    //! Sort the records and write them to path, replaces an existing file only once complete.
+    static bool Write(const boost::filesystem::path &path, uint32_t nRound, std::vector<Record> &records);
+
+    //! Map the file at path, fVerify checks the file's hash.
+    bool Open(const boost::filesystem::path &path, bool fVerify);
+    void Close();
+
+    bool IsOpen() const { return pData != nullptr; }
+    uint32_t GetRound() const { return nRound; }
+    uint64_t size() const { return nCount; }
+
+    //! Snapshot at position n in address order.
+    void Get(uint64_t n, CSmartRewardSnapshot &snapshot) const;
+    //! True if the address at position n got a reward payout.
+    bool IsPaid(uint64_t n) const;
+    bool Find(const CSmartAddress &id, CSmartRewardSnapshot &snapshot) const;
+};
+
+#endif // REWARDSSNAPSHOTFILE_H
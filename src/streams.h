@@ -55,6 +55,54 @@ OverrideStream<S> WithOrVersion(S* s, int nVersionFlag)
     return OverrideStream<S>(s, s->GetType(), s->GetVersion() | nVersionFlag);
 }
 
+/** Deserialize objects straight from a range of memory that outlives the reader,
+ * e.g. a mapped block file, a received message or a LevelDB slice, without
+ * copying it into the zero-after-free buffer of a CDataStream first.
+ */
+class CSpanReader
+{
+private:
+    const unsigned char* pCur;
+    const unsigned char* pEnd;
+    int nType;
+    int nVersion;
+
+public:
+    CSpanReader(const unsigned char* pBegin, size_t nSize, int nTypeIn, int nVersionIn) :
+        pCur(pBegin), pEnd(pBegin + nSize), nType(nTypeIn), nVersion(nVersionIn) {}
+    CSpanReader(const char* pBegin, size_t nSize, int nTypeIn, int nVersionIn) :
+        pCur((const unsigned char*)pBegin), pEnd((const unsigned char*)pBegin + nSize), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    int GetType() const { return nType; }
+    int GetVersion() const { return nVersion; }
+    size_t size() const { return pEnd - pCur; }
+    bool empty() const { return pCur == pEnd; }
+
+    CSpanReader& read(char* pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::read(): end of data");
+        memcpy(pch, pCur, nSize);
+        pCur += nSize;
+        return *this;
+    }
+
+    CSpanReader& ignore(size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::ignore(): end of data");
+        pCur += nSize;
+        return *this;
+    }
+
+    template<typename T>
+    CSpanReader& operator>>(T& obj)
+    {
+        ::Unserialize(*this, obj, nType, nVersion);
+        return *this;
+    }
+};
+
 /** Double ended buffer combining vector and stream-like interfaces.
  *
  * >> and << read and write unformatted data using the above serialization templates.
@@ -154,6 +202,7 @@ public:
     bool empty() const                               { return vch.size() == nReadPos; }
     void resize(size_type n, value_type c=0)         { vch.resize(n + nReadPos, c); }
     void reserve(size_type n)                        { vch.reserve(n + nReadPos); }
+    size_type capacity() const                       { return vch.capacity() - nReadPos; }
     const_reference operator[](size_type pos) const  { return vch[pos + nReadPos]; }
     reference operator[](size_type pos)              { return vch[pos + nReadPos]; }
     void clear()                                     { vch.clear(); nReadPos = 0; }
@@ -341,6 +390,12 @@ public:
         clear();
     }
 
+    /** Exchange the underlying buffer with data and rewind, without copying either */
+    void SwapBuffer(CSerializeData &data) {
+        vch.swap(data);
+        nReadPos = 0;
+    }
+
     /**
      * XOR the contents of this stream with a certain key.
      *
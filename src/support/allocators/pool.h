@@ -0,0 +1,182 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SMARTCASH_SUPPORT_ALLOCATORS_POOL_H
+#define SMARTCASH_SUPPORT_ALLOCATORS_POOL_H
+
+#include <assert.h>
+
+#include <array>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+/**
+ * A memory resource for many small allocations of similar size, like the nodes of a node based
+ * container. Blocks of up to MAX_BLOCK_SIZE_BYTES are carved out of big chunks and freed blocks are
+ * kept in a free list per size to be handed out again, so allocating and freeing a block never
+ * calls into malloc once the chunks exist. The chunks are only released, all at once, when the
+ * resource gets destroyed. Bigger blocks, or blocks with a stricter alignment than ALIGN_BYTES,
+ * are passed on to operator new. Not thread safe.
+ */
+template <size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+class PoolResource
+{
+private:
+    struct ListNode {
+        ListNode *pNext;
+    };
+
+    //! Blocks are multiples of ELEM_ALIGN_BYTES, big enough to hold a free list node.
+    static const size_t ELEM_ALIGN_BYTES = ALIGN_BYTES > alignof(ListNode) ? ALIGN_BYTES : alignof(ListNode);
+    static_assert((ELEM_ALIGN_BYTES & (ELEM_ALIGN_BYTES - 1)) == 0, "ELEM_ALIGN_BYTES must be a power of two");
+    static_assert(sizeof(ListNode) <= ELEM_ALIGN_BYTES, "Units of ELEM_ALIGN_BYTES must fit a free list node");
+    static_assert(ELEM_ALIGN_BYTES <= alignof(std::max_align_t), "Chunks from operator new are only aligned to max_align_t");
+    static_assert(MAX_BLOCK_SIZE_BYTES >= ELEM_ALIGN_BYTES, "MAX_BLOCK_SIZE_BYTES must hold at least one unit");
+
+    //! Free lists of the blocks of each size, indexed by their number of ELEM_ALIGN_BYTES units.
+    std::array<ListNode*, (MAX_BLOCK_SIZE_BYTES + ELEM_ALIGN_BYTES - 1) / ELEM_ALIGN_BYTES + 1> vFreeLists;
+    std::vector<char*> vChunks;
+    const size_t nChunkSizeBytes;
+    //! Part of the newest chunk that has not been handed out yet.
+    char *pAvailable;
+    char *pAvailableEnd;
+
+    PoolResource(const PoolResource&);
+    void operator=(const PoolResource&);
+
+    static size_t NumElemAlignBytes(size_t nBytes)
+    {
+        return (nBytes + ELEM_ALIGN_BYTES - 1) / ELEM_ALIGN_BYTES + (nBytes == 0);
+    }
+
+    static bool IsFreeListUsable(size_t nBytes, size_t nAlignment)
+    {
+        return nAlignment <= ELEM_ALIGN_BYTES && nBytes <= MAX_BLOCK_SIZE_BYTES;
+    }
+
+    void AddToFreeList(void *p, ListNode *&pHead)
+    {
+        ListNode *pNode = static_cast<ListNode*>(p);
+        pNode->pNext = pHead;
+        pHead = pNode;
+    }
+
+    void AllocateChunk()
+    {
+        // whatever is left of the previous chunk can still be used for blocks of that size
+        size_t nRemaining = pAvailableEnd - pAvailable;
+        if( nRemaining ) AddToFreeList(pAvailable, vFreeLists[nRemaining / ELEM_ALIGN_BYTES]);
+
+        char *pChunk = static_cast<char*>(::operator new(nChunkSizeBytes));
+        vChunks.push_back(pChunk);
+        pAvailable = pChunk;
+        pAvailableEnd = pChunk + nChunkSizeBytes;
+    }
+
+public:
+    //! Default size of the chunks blocks are carved out of.
+    static const size_t DEFAULT_CHUNK_SIZE_BYTES = 262144;
+
+    explicit PoolResource(size_t nChunkSizeBytesIn = DEFAULT_CHUNK_SIZE_BYTES) :
+        nChunkSizeBytes(nChunkSizeBytesIn), pAvailable(nullptr), pAvailableEnd(nullptr)
+    {
+        assert(nChunkSizeBytes >= MAX_BLOCK_SIZE_BYTES && nChunkSizeBytes % ELEM_ALIGN_BYTES == 0);
+        vFreeLists.fill(nullptr);
+    }
+
+    ~PoolResource()
+    {
+        for( char *pChunk : vChunks ) ::operator delete(pChunk);
+    }
+
+    void* Allocate(size_t nBytes, size_t nAlignment)
+    {
+        if( !IsFreeListUsable(nBytes, nAlignment) ) return ::operator new(nBytes);
+
+        const size_t nUnits = NumElemAlignBytes(nBytes);
+        ListNode *&pHead = vFreeLists[nUnits];
+        if( pHead ){
+            ListNode *pNode = pHead;
+            pHead = pNode->pNext;
+            return pNode;
+        }
+
+        const size_t nBlockBytes = nUnits * ELEM_ALIGN_BYTES;
+        if( (size_t)(pAvailableEnd - pAvailable) < nBlockBytes ) AllocateChunk();
+
+        void *p = pAvailable;
+        pAvailable += nBlockBytes;
+        return p;
+    }
+
+    void Deallocate(void *p, size_t nBytes, size_t nAlignment)
+    {
+        if( !IsFreeListUsable(nBytes, nAlignment) ){
+            ::operator delete(p);
+            return;
+        }
+
+        AddToFreeList(p, vFreeLists[NumElemAlignBytes(nBytes)]);
+    }
+
+    size_t NumAllocatedChunks() const { return vChunks.size(); }
+    size_t ChunkSizeBytes() const { return nChunkSizeBytes; }
+
+    //! Capacity of the list of chunks, for memory accounting.
+    size_t ChunksCapacity() const { return vChunks.capacity(); }
+};
+
+/**
+ * Allocator handing out memory of a PoolResource, to be used by node based containers. All
+ * copies of the allocator, also rebound ones, share the same resource, which must outlive them.
+ */
+template <class T, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES = alignof(T)>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+    typedef PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> ResourceType;
+
+    template <class U>
+    struct rebind {
+        typedef PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> other;
+    };
+
+    PoolAllocator(ResourceType *pResourceIn) noexcept : pResource(pResourceIn) {}
+    PoolAllocator(const PoolAllocator& other) noexcept : pResource(other.resource()) {}
+
+    template <class U>
+    PoolAllocator(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) noexcept : pResource(other.resource()) {}
+
+    T* allocate(size_t n)
+    {
+        if( n > (size_t)-1 / sizeof(T) ) throw std::bad_alloc();
+        return static_cast<T*>(pResource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *p, size_t n) noexcept
+    {
+        pResource->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    ResourceType* resource() const noexcept { return pResource; }
+
+private:
+    ResourceType *pResource;
+};
+
+template <class T1, class T2, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+bool operator==(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a, const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return a.resource() == b.resource();
+}
+
+template <class T1, class T2, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+bool operator!=(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a, const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return !(a == b);
+}
+
+#endif // SMARTCASH_SUPPORT_ALLOCATORS_POOL_H
@@ -6,7 +6,10 @@
 #ifndef BITCOIN_SUPPORT_ALLOCATORS_SECURE_H
 #define BITCOIN_SUPPORT_ALLOCATORS_SECURE_H
 
-#include "support/pagelocker.h"
+#include "support/cleanse.h"
+#include "support/lockedpool.h"
+
+#include <new>
 
 #include <string>
 #include <vector>
@@ -14,6 +17,8 @@
 //
 // Allocator that locks its contents from being paged
 // out of memory and clears its contents before deletion.
+// Allocations are served from the arenas of the LockedPoolManager,
+// which locks its pages once per arena rather than per allocation.
 //
 template <typename T>
 struct secure_allocator : public std::allocator<T> {
@@ -40,20 +45,17 @@ struct secure_allocator : public std::allocator<T> {
 
     T* allocate(std::size_t n, const void* hint = 0)
     {
-        T* p;
-        p = std::allocator<T>::allocate(n, hint);
-        if (p != NULL)
-            LockedPageManager::Instance().LockRange(p, sizeof(T) * n);
+        T* p = static_cast<T*>(LockedPoolManager::Instance().alloc(sizeof(T) * n));
+        if (!p)
+            throw std::bad_alloc();
         return p;
     }
 
     void deallocate(T* p, std::size_t n)
     {
-        if (p != NULL) {
+        if (p != NULL)
             memory_cleanse(p, sizeof(T) * n);
-            LockedPageManager::Instance().UnlockRange(p, sizeof(T) * n);
-        }
-        std::allocator<T>::deallocate(p, n);
+        LockedPoolManager::Instance().free(p);
     }
 };
 
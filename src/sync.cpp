@@ -7,7 +7,11 @@
 #include "util.h"
 #include "utilstrencodings.h"
 
+#include <algorithm>
+#include <map>
+#include <mutex>
 #include <stdio.h>
+#include <string.h>
 
 #include <boost/foreach.hpp>
 #include <boost/thread.hpp>
@@ -20,6 +24,106 @@ void PrintLockContention(const char* pszName, const char* pszFile, int nLine)
 }
 #endif /* DEBUG_LOCKCONTENTION */
 
+static void NoCleanup(CLockWaitStats*) {}
+static boost::thread_specific_ptr<CLockWaitStats> lockwaitstats(NoCleanup);
+
+void CLockWaitStats::Add(const char* pszName, int64_t nMicros)
+{
+    // The names are the expressions passed to LOCK, e.g. pwalletMain->cs_wallet
+    if (strstr(pszName, "cs_main"))
+        nWaitMain += nMicros;
+    else if (strstr(pszName, "cs_wallet"))
+        nWaitWallet += nMicros;
+    else
+        nWaitOther += nMicros;
+}
+
+CLockWaitStats* GetLockWaitStats()
+{
+    return lockwaitstats.get();
+}
+
+CLockWaitScope::CLockWaitScope(CLockWaitStats& stats) : pprev(lockwaitstats.get())
+{
+    lockwaitstats.reset(&stats);
+}
+
+CLockWaitScope::~CLockWaitScope()
+{
+    lockwaitstats.reset(pprev);
+}
+
+std::atomic<int> nLockStatsRate(0);
+
+/** A sampled lock site, file and name point to the literals LOCK was passed */
+struct CLockSiteSamples
+{
+    const char* pszName;
+    CLockStats stats;
+};
+
+// A plain mutex, taking a CCriticalSection here would sample it as well
+static std::mutex csLockStats;
+static std::map<std::pair<const char*, int>, CLockSiteSamples> mapLockSites;
+
+void CLockStats::Add(const CLockStats& other)
+{
+    nSamples += other.nSamples;
+    nContended += other.nContended;
+    nWaitTotal += other.nWaitTotal;
+    nWaitMax = std::max(nWaitMax, other.nWaitMax);
+    nHoldTotal += other.nHoldTotal;
+    nHoldMax = std::max(nHoldMax, other.nHoldMax);
+}
+
+bool SampleNextLockSlow(int nRate)
+{
+    // Counted per thread, so threads don't share a counter on every lock
+    static thread_local int nCountdown = 0;
+    if (--nCountdown > 0)
+        return false;
+    nCountdown = nRate;
+    return true;
+}
+
+void RecordLockSample(const CLockSample& sample)
+{
+    int64_t nHold = GetTimeMicros() - sample.nLocked;
+
+    std::lock_guard<std::mutex> lock(csLockStats);
+    CLockSiteSamples& site = mapLockSites[std::make_pair(sample.pszFile, sample.nLine)];
+    site.pszName = sample.pszName;
+    CLockStats& stats = site.stats;
+    stats.nSamples++;
+    stats.nContended += sample.fContended;
+    stats.nWaitTotal += sample.nWait;
+    stats.nWaitMax = std::max(stats.nWaitMax, sample.nWait);
+    stats.nHoldTotal += nHold;
+    stats.nHoldMax = std::max(stats.nHoldMax, nHold);
+}
+
+void SetLockStatsRate(int nRate)
+{
+    nLockStatsRate = std::max(nRate, 0);
+}
+
+void GetLockStats(std::vector<CLockSiteStats>& vSites, bool fReset)
+{
+    std::lock_guard<std::mutex> lock(csLockStats);
+    vSites.clear();
+    vSites.reserve(mapLockSites.size());
+    for (const auto& entry : mapLockSites) {
+        CLockSiteStats site;
+        site.strName = entry.second.pszName;
+        site.strFile = entry.first.first;
+        site.nLine = entry.first.second;
+        site.stats = entry.second.stats;
+        vSites.push_back(site);
+    }
+    if (fReset)
+        mapLockSites.clear();
+}
+
 #ifdef DEBUG_LOCKORDER
 //
 // Early deadlock detection.
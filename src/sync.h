@@ -7,6 +7,11 @@
 #define BITCOIN_SYNC_H
 
 #include "threadsafety.h"
+#include "utiltime.h"
+
+#include <atomic>
+#include <string>
+#include <vector>
 
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
@@ -108,24 +113,122 @@ typedef boost::condition_variable CConditionVariable;
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
+/** Microseconds a thread waited for contended locks */
+struct CLockWaitStats
+{
+    int64_t nWaitMain;
+    int64_t nWaitWallet;
+    int64_t nWaitOther;
+
+    CLockWaitStats() : nWaitMain(0), nWaitWallet(0), nWaitOther(0) {}
+    void Add(const char* pszName, int64_t nMicros);
+};
+
+/** The stats the current thread records its lock waits in, if any */
+CLockWaitStats* GetLockWaitStats();
+
+/** Records the lock waits of the current thread in stats while in scope */
+class CLockWaitScope
+{
+private:
+    CLockWaitStats* pprev;
+
+public:
+    explicit CLockWaitScope(CLockWaitStats& stats);
+    ~CLockWaitScope();
+};
+
+/** Wait and hold times of the sampled acquisitions of a lock, in microseconds */
+struct CLockStats
+{
+    uint64_t nSamples;
+    uint64_t nContended;
+    int64_t nWaitTotal;
+    int64_t nWaitMax;
+    int64_t nHoldTotal;
+    int64_t nHoldMax;
+
+    CLockStats() : nSamples(0), nContended(0), nWaitTotal(0), nWaitMax(0), nHoldTotal(0), nHoldMax(0) {}
+    void Add(const CLockStats& other);
+};
+
+/** The statistics of one place a lock is taken at */
+struct CLockSiteStats
+{
+    std::string strName;
+    std::string strFile;
+    int nLine;
+    CLockStats stats;
+};
+
+/** A lock acquisition sampled for the lock statistics, pszName is NULL for the others */
+struct CLockSample
+{
+    const char* pszName;
+    const char* pszFile;
+    int nLine;
+    bool fContended;
+    int64_t nWait;
+    int64_t nLocked;
+
+    CLockSample() : pszName(NULL) {}
+};
+
+//! -lockstatsrate default
+static const int DEFAULT_LOCK_STATS_RATE = 0;
+
+//! One in how many lock acquisitions of a thread get sampled, 0 if none
+extern std::atomic<int> nLockStatsRate;
+
+bool SampleNextLockSlow(int nRate);
+void RecordLockSample(const CLockSample& sample);
+
+/** Whether to sample the next lock acquisition, a single relaxed load while sampling is off */
+inline bool SampleNextLock()
+{
+    int nRate = nLockStatsRate.load(std::memory_order_relaxed);
+    return nRate > 0 && SampleNextLockSlow(nRate);
+}
+
+/** Sample one in nRate lock acquisitions from now on, 0 to stop sampling */
+void SetLockStatsRate(int nRate);
+
+/** The statistics of all lock sites sampled since startup or the last reset */
+void GetLockStats(std::vector<CLockSiteStats>& vSites, bool fReset);
+
 /** Wrapper around boost::unique_lock<Mutex> */
 template <typename Mutex>
 class SCOPED_LOCKABLE CMutexLock
 {
 private:
     boost::unique_lock<Mutex> lock;
+    CLockSample sample;
 
     void Enter(const char* pszName, const char* pszFile, int nLine)
     {
         EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()));
+        bool fSample = SampleNextLock();
+        int64_t nStart = fSample ? GetTimeMicros() : 0;
+        bool fContended = !lock.try_lock();
+        if (fContended) {
 #ifdef DEBUG_LOCKCONTENTION
-        if (!lock.try_lock()) {
             PrintLockContention(pszName, pszFile, nLine);
 #endif
+            CLockWaitStats* pstats = GetLockWaitStats();
+            if (pstats && !fSample)
+                nStart = GetTimeMicros();
             lock.lock();
-#ifdef DEBUG_LOCKCONTENTION
+            if (pstats)
+                pstats->Add(pszName, GetTimeMicros() - nStart);
+        }
+        if (fSample) {
+            sample.pszName = pszName;
+            sample.pszFile = pszFile;
+            sample.nLine = nLine;
+            sample.fContended = fContended;
+            sample.nLocked = GetTimeMicros();
+            sample.nWait = sample.nLocked - nStart;
         }
-#endif
     }
 
     bool TryEnter(const char* pszName, const char* pszFile, int nLine)
@@ -159,8 +262,11 @@ public:
 
     ~CMutexLock() UNLOCK_FUNCTION()
     {
-        if (lock.owns_lock())
+        if (lock.owns_lock()) {
+            if (sample.pszName)
+                RecordLockSample(sample);
             LeaveCritical();
+        }
     }
 
     operator bool()
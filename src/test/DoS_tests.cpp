@@ -25,13 +25,16 @@
 // Tests this internal-to-validation.cpp method:
 extern bool AddOrphanTx(const CTransaction& tx, NodeId peer);
 extern void EraseOrphansFor(NodeId peer);
-extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans);
+extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans, size_t nMaxBytes);
 struct COrphanTx {
-    CTransaction tx;
+    CTransactionRef tx;
     NodeId fromPeer;
+    size_t nListPos;
 };
-extern std::map<uint256, COrphanTx> mapOrphanTransactions;
-extern std::map<uint256, std::set<uint256> > mapOrphanTransactionsByPrev;
+extern std::unordered_map<uint256, COrphanTx, SaltedTxidHasher> mapOrphanTransactions;
+extern std::unordered_map<uint256, std::set<uint256>, SaltedTxidHasher> mapOrphanTransactionsByPrev;
+extern std::vector<uint256> vOrphanList;
+extern size_t nOrphanTxSize;
 
 CService ip(uint32_t i)
 {
@@ -107,11 +110,19 @@ BOOST_AUTO_TEST_CASE(DoS_bantime)
 
 CTransaction RandomOrphan()
 {
-    std::map<uint256, COrphanTx>::iterator it;
-    it = mapOrphanTransactions.lower_bound(GetRandHash());
-    if (it == mapOrphanTransactions.end())
-        it = mapOrphanTransactions.begin();
-    return it->second.tx;
+    return *mapOrphanTransactions.at(vOrphanList[GetRand(vOrphanList.size())]).tx;
+}
+
+static void CheckOrphanIndexes()
+{
+    BOOST_CHECK_EQUAL(vOrphanList.size(), mapOrphanTransactions.size());
+    size_t nSize = 0;
+    for (size_t i = 0; i < vOrphanList.size(); i++) {
+        const COrphanTx& orphan = mapOrphanTransactions.at(vOrphanList[i]);
+        BOOST_CHECK_EQUAL(orphan.nListPos, i);
+        nSize += orphan.tx->GetTotalSize();
+    }
+    BOOST_CHECK_EQUAL(nSize, nOrphanTxSize);
 }
 
 BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
@@ -177,22 +188,36 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         BOOST_CHECK(!AddOrphanTx(tx, i));
     }
 
+    CheckOrphanIndexes();
+
     // Test EraseOrphansFor:
     for (NodeId i = 0; i < 3; i++)
     {
         size_t sizeBefore = mapOrphanTransactions.size();
         EraseOrphansFor(i);
         BOOST_CHECK(mapOrphanTransactions.size() < sizeBefore);
+        for (const auto& entry : mapOrphanTransactions)
+            BOOST_CHECK(entry.second.fromPeer != i);
     }
+    CheckOrphanIndexes();
 
     // Test LimitOrphanTxSize() function:
-    LimitOrphanTxSize(40);
+    LimitOrphanTxSize(40, std::numeric_limits<size_t>::max());
     BOOST_CHECK(mapOrphanTransactions.size() <= 40);
-    LimitOrphanTxSize(10);
+    // Orphans differ in size, only the bytes are bounded
+    size_t nMaxOrphanTxSize = nOrphanTxSize / 2;
+    LimitOrphanTxSize(40, nMaxOrphanTxSize);
+    BOOST_CHECK(nOrphanTxSize <= nMaxOrphanTxSize);
+    BOOST_CHECK(mapOrphanTransactions.size() < 40);
+    CheckOrphanIndexes();
+    LimitOrphanTxSize(10, std::numeric_limits<size_t>::max());
     BOOST_CHECK(mapOrphanTransactions.size() <= 10);
-    LimitOrphanTxSize(0);
+    CheckOrphanIndexes();
+    LimitOrphanTxSize(0, std::numeric_limits<size_t>::max());
     BOOST_CHECK(mapOrphanTransactions.empty());
     BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
+    BOOST_CHECK(vOrphanList.empty());
+    BOOST_CHECK_EQUAL(nOrphanTxSize, 0U);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
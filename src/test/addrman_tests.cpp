@@ -4,10 +4,14 @@
 #include "addrman.h"
 #include "test/test_bitcoin.h"
 #include <string>
+#include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
 
+#include "clientversion.h"
 #include "hash.h"
+#include "netbase.h"
 #include "random.h"
+#include "streams.h"
 
 using namespace std;
 
@@ -395,6 +399,55 @@ BOOST_AUTO_TEST_CASE(addrman_getaddr)
     BOOST_CHECK(addrman.size() == 2007);
 }
 
+BOOST_AUTO_TEST_CASE(addrman_batch)
+{
+    CAddrManTest addrmanSingle;
+    CAddrManTest addrmanBatch;
+    addrmanSingle.MakeDeterministic();
+    addrmanBatch.MakeDeterministic();
+    BOOST_CHECK(!addrmanBatch.IsDirty());
+
+    // A batch is placed like the same addresses added one by one, other ports of known IPs included
+    CNetAddr source = LookupNumeric("250.1.2.1");
+    vector<CAddress> vAddr;
+    for (unsigned int i = 1; i < (4 * 256); i++) {
+        string strAddr = boost::to_string(i % 256) + "." + boost::to_string(i / 256) + ".3.4";
+        CAddress addr = CAddress(LookupNumeric(strAddr.c_str(), i % 3 ? 8333 : 9999), NODE_NONE);
+        addr.nTime = GetAdjustedTime() - (i % 5) * 60 * 60;
+        vAddr.push_back(addr);
+        addr.nTime += 3 * 24 * 60 * 60;
+        addr.SetPort(8334);
+        vAddr.push_back(addr);
+    }
+    BOOST_FOREACH(const CAddress& addr, vAddr)
+        addrmanSingle.Add(addr, source);
+    BOOST_CHECK(addrmanBatch.Add(vAddr, source));
+    BOOST_CHECK(addrmanBatch.IsDirty());
+    BOOST_CHECK_EQUAL(addrmanBatch.size(), addrmanSingle.size());
+
+    CDataStream ssSingle(SER_DISK, CLIENT_VERSION);
+    CDataStream ssBatch(SER_DISK, CLIENT_VERSION);
+    ssSingle << addrmanSingle;
+    ssBatch << addrmanBatch;
+    BOOST_CHECK(ssSingle.str() == ssBatch.str());
+
+    // Nothing new, nothing to write out
+    addrmanBatch.SetDirty(false);
+    BOOST_CHECK(!addrmanBatch.Add(vector<CAddress>(1, CAddress(LookupNumeric("10.1.1.1", 8333), NODE_NONE)), source));
+    BOOST_CHECK(!addrmanBatch.IsDirty());
+    addrmanBatch.Good(vAddr[0]);
+    BOOST_CHECK(addrmanBatch.IsDirty());
+
+    vector<CAddrInfo> vSelected = addrmanBatch.SelectMany(10);
+    BOOST_CHECK_EQUAL(vSelected.size(), 10U);
+    BOOST_FOREACH(const CAddrInfo& addr, vSelected)
+        BOOST_CHECK(addr.IsValid());
+
+    addrmanBatch.Clear();
+    vSelected = addrmanBatch.SelectMany(3);
+    BOOST_CHECK_EQUAL(vSelected.size(), 3U);
+    BOOST_CHECK(!vSelected[0].IsValid());
+}
 
 BOOST_AUTO_TEST_CASE(caddrinfo_get_tried_bucket)
 {
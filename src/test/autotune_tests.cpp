@@ -0,0 +1,69 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "autotune.h"
+
+#include "dbwrapper.h"
+#include "policy/policy.h"
+#include "smartrewards/rewards.h"
+#include "smartrewards/rewardsdb.h"
+#include "test/test_bitcoin.h"
+#include "txdb.h"
+#include "validation.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(autotune_tests, BasicTestingSetup)
+
+static CHardwareInfo MakeHardwareInfo(int64_t nMemoryMiB, int nCores, int64_t nSyncLatency)
+{
+    CHardwareInfo hw;
+    hw.nMemory = nMemoryMiB << 20;
+    hw.nCores = nCores;
+    hw.nSyncLatency = nSyncLatency;
+    return hw;
+}
+
+BOOST_AUTO_TEST_CASE(autotune_unknown_memory)
+{
+    CAutotuneProfile profile = GetAutotuneProfile(MakeHardwareInfo(0, 4, -1));
+    BOOST_CHECK_EQUAL(profile.strName, "default");
+    BOOST_CHECK_EQUAL(profile.nDbCache, nDefaultDbCache);
+    BOOST_CHECK_EQUAL(profile.nRewardsDbCache, nRewardsDefaultDbCache);
+    BOOST_CHECK_EQUAL(profile.nMaxMempool, DEFAULT_MAX_MEMPOOL_SIZE);
+    BOOST_CHECK_EQUAL(profile.nCoinCachePercentAfterIBD, 100);
+    BOOST_CHECK_EQUAL(profile.strDBProfile, DEFAULT_DB_PROFILE);
+}
+
+BOOST_AUTO_TEST_CASE(autotune_low_memory)
+{
+    CAutotuneProfile profile = GetAutotuneProfile(MakeHardwareInfo(1024, 8, 100));
+    BOOST_CHECK_EQUAL(profile.strName, "lowmem");
+    BOOST_CHECK_EQUAL(profile.nScriptCheckThreads, 2);
+    BOOST_CHECK(profile.nDbCache + profile.nRewardsDbCache + profile.nMaxMempool <= 1024 / 4);
+    BOOST_CHECK_EQUAL(profile.strDBProfile, "lowmem");
+    BOOST_CHECK_EQUAL(profile.strDBProfileAfterIBD, "lowmem");
+    BOOST_CHECK(SetDBProfile(profile.strDBProfile));
+    BOOST_CHECK(SetDBProfile(DEFAULT_DB_PROFILE));
+}
+
+BOOST_AUTO_TEST_CASE(autotune_storage_latency)
+{
+    CAutotuneProfile ssd = GetAutotuneProfile(MakeHardwareInfo(16384, 64, 100));
+    CAutotuneProfile hdd = GetAutotuneProfile(MakeHardwareInfo(16384, 64, 10000));
+    BOOST_CHECK_EQUAL(ssd.strName, "ssd");
+    BOOST_CHECK_EQUAL(hdd.strName, "hdd");
+    BOOST_CHECK(hdd.nDbCache > ssd.nDbCache);
+    BOOST_CHECK(ssd.nDbCache + ssd.nRewardsDbCache <= 16384 / 4);
+    BOOST_CHECK_EQUAL(ssd.nScriptCheckThreads, MAX_SCRIPTCHECK_THREADS);
+
+    // The coins cache shrinks once the initial block download is done, the rest gains
+    BOOST_CHECK_EQUAL(ssd.strDBProfile, "ibd");
+    BOOST_CHECK_EQUAL(ssd.strDBProfileAfterIBD, DEFAULT_DB_PROFILE);
+    BOOST_CHECK(ssd.nCoinCachePercentAfterIBD < 100);
+    BOOST_CHECK(ssd.nMaxMempool >= DEFAULT_MAX_MEMPOOL_SIZE);
+    BOOST_CHECK(ssd.nRewardsEntryCacheAfterIBD > (size_t)nRewardsEntryCacheSize);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,135 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilecache.h"
+
+#include "streams.h"
+#include "tinyformat.h"
+#include "uint256.h"
+#include "clientversion.h"
+#include "test/test_bitcoin.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilecache_tests, TestingSetup)
+
+static void AppendToFile(const boost::filesystem::path &path, const CDataStream &ss)
+{
+    FILE *file = fopen(path.string().c_str(), "ab");
+    BOOST_REQUIRE(file);
+    BOOST_CHECK_EQUAL(fwrite(&ss[0], 1, ss.size(), file), ss.size());
+    fclose(file);
+}
+
+BOOST_AUTO_TEST_CASE(span_reader)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    std::vector<unsigned char> vch(100, 0x42);
+    ss << 1234 << std::string("span") << vch;
+
+    CSpanReader reader((const unsigned char*)&ss[0], ss.size(), SER_DISK, CLIENT_VERSION);
+    int n;
+    std::string str;
+    std::vector<unsigned char> vchRead;
+    reader >> n >> str >> vchRead;
+    BOOST_CHECK_EQUAL(n, 1234);
+    BOOST_CHECK_EQUAL(str, "span");
+    BOOST_CHECK(vchRead == vch);
+    BOOST_CHECK_EQUAL(reader.size(), 0U);
+
+    // reading past the end throws like a file at its end does
+    BOOST_CHECK_THROW(reader >> n, std::ios_base::failure);
+    CSpanReader reader2((const unsigned char*)&ss[0], 2, SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK_THROW(reader2 >> n, std::ios_base::failure);
+}
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(cache_remap_and_evict)
+{
+    CBlockFileCache cache(2);
+    boost::filesystem::path path = pathTemp / "blk00000.dat";
+
+    BOOST_CHECK(!cache.Get(path, 0));
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << uint256S("0x01");
+    AppendToFile(path, ss);
+
+    std::shared_ptr<const CMappedBlockFile> file = cache.Get(path, 32);
+    BOOST_REQUIRE(file);
+    BOOST_CHECK_EQUAL(file->size(), 32U);
+    BOOST_CHECK(cache.Get(path, 32) == file);
+    // more than the file has
+    BOOST_CHECK(!cache.Get(path, 64));
+
+    // grown files get mapped again, the old mapping stays valid as long as it is used
+    AppendToFile(path, ss);
+    std::shared_ptr<const CMappedBlockFile> fileGrown = cache.Get(path, 64);
+    BOOST_REQUIRE(fileGrown);
+    BOOST_CHECK(fileGrown != file);
+    BOOST_CHECK_EQUAL(fileGrown->size(), 64U);
+    BOOST_CHECK(!memcmp(file->data(), fileGrown->data() + 32, 32));
+    BOOST_CHECK_EQUAL(cache.size(), 1U);
+
+    for (int i = 1; i <= 3; i++) {
+        boost::filesystem::path pathOther = pathTemp / strprintf("blk%05u.dat", i);
+        AppendToFile(pathOther, ss);
+        BOOST_CHECK(cache.Get(pathOther, 32));
+    }
+    BOOST_CHECK_EQUAL(cache.size(), 2U);
+
+    cache.Erase(pathTemp / "blk00003.dat");
+    BOOST_CHECK_EQUAL(cache.size(), 1U);
+    cache.Clear();
+    BOOST_CHECK_EQUAL(cache.size(), 0U);
+}
+#endif
+
+static std::string ReadFile(const boost::filesystem::path &path)
+{
+    std::string str;
+    FILE *file = fopen(path.string().c_str(), "rb");
+    BOOST_REQUIRE(file);
+    char buf[256];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0)
+        str.append(buf, n);
+    fclose(file);
+    return str;
+}
+
+BOOST_AUTO_TEST_CASE(writer_buffers_until_flush)
+{
+    CBlockFileWriter writer;
+    boost::filesystem::path path = pathTemp / "blocks" / "rev00000.dat";
+    boost::filesystem::path pathOther = pathTemp / "blocks" / "rev00001.dat";
+
+    // records stay in the buffer until the file gets read
+    BOOST_CHECK(writer.Write(path, 0, "abc", 3));
+    BOOST_CHECK(writer.Write(path, 3, "def", 3));
+    BOOST_CHECK_EQUAL(ReadFile(path), "");
+    writer.Flush(pathOther);
+    BOOST_CHECK_EQUAL(ReadFile(path), "");
+    writer.Flush(path);
+    BOOST_CHECK_EQUAL(ReadFile(path), "abcdef");
+
+    // writes elsewhere in the file seek there
+    BOOST_CHECK(writer.Write(path, 1, "X", 1));
+    BOOST_CHECK(writer.Write(path, 6, "gh", 2));
+    writer.Commit();
+    BOOST_CHECK_EQUAL(ReadFile(path), "aXcdefgh");
+
+    // another file closes the one written before
+    BOOST_CHECK(writer.Write(pathOther, 0, "xyz", 3));
+    BOOST_CHECK(writer.Write(path, 8, "i", 1));
+    BOOST_CHECK_EQUAL(ReadFile(pathOther), "xyz");
+    writer.Close();
+    BOOST_CHECK_EQUAL(ReadFile(path), "aXcdefghi");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "blocksizecalculator.h"
+#include "chainparams.h"
 #include "test/test_bitcoin.h"
 #include "script/sign.h"
 #include "keystore.h"
@@ -93,12 +94,67 @@ BOOST_AUTO_TEST_CASE(ComputeBlockSizeWithSmallBlocks)
 	BOOST_CHECK(size == 1E6);
 }
 
+BOOST_AUTO_TEST_CASE(BlockIndexRecordsBlockSize)
+{
+	//The serialized size is kept in the block index so the median window needs no file reads
+	CBlockIndex* pindex = chainActive.Tip();
+	BOOST_CHECK(pindex->nStatus & BLOCK_HAVE_SIZE);
+
+	CBlock block;
+	BOOST_CHECK(ReadBlockFromDisk(block, pindex, Params().GetConsensus()));
+	BOOST_CHECK_EQUAL(pindex->nSize, ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION));
+
+	CDataStream ss(SER_DISK, CLIENT_VERSION);
+	ss << CDiskBlockIndex(pindex);
+	CDiskBlockIndex diskindex;
+	ss >> diskindex;
+	BOOST_CHECK_EQUAL(diskindex.nSize, pindex->nSize);
+}
+
+BOOST_AUTO_TEST_CASE(ComputeBlockSizeIsCachedPerBlockIndex)
+{
+	CBlockIndex* pindex = chainActive.Tip();
+	unsigned int size = BlockSizeCalculator::ComputeBlockSize(pindex);
+	BOOST_CHECK_EQUAL(pindex->nMaxBlockSize, size);
+
+	//A template on top of the tip has no hash and gets the limit of its parent
+	CBlockIndex indexDummy;
+	indexDummy.pprev = pindex;
+	indexDummy.nHeight = pindex->nHeight + 1;
+	BOOST_CHECK_EQUAL(BlockSizeCalculator::ComputeBlockSize(&indexDummy), size);
+	BOOST_CHECK_EQUAL(indexDummy.nMaxBlockSize, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(WindowStatsAndForecast)
+{
+	CBlockIndex* pindex = chainActive.Tip();
+	BlockSizeCalculator::WindowStats stats = BlockSizeCalculator::GetWindowStats(pindex);
+	BOOST_CHECK_EQUAL(stats.nHeight, pindex->nHeight);
+	BOOST_CHECK(stats.nBlocks > 0 && stats.nBlocks <= (unsigned int)pindex->nHeight + 1);
+	BOOST_CHECK(stats.nLargest > 0 && stats.nLargest <= stats.nTotalSize);
+
+	//The window is not full yet, so there is no median and the limit is the old one
+	BOOST_CHECK_EQUAL(stats.nMedian, 0U);
+	BOOST_CHECK_EQUAL(stats.nMaxBlockSize, OLD_MAX_BLOCK_SIZE);
+	BOOST_CHECK_EQUAL(BlockSizeCalculator::ForecastBlockSize(pindex, 1, 2000000), OLD_MAX_BLOCK_SIZE);
+
+	//A full window of larger blocks doubles their size
+	BOOST_CHECK_EQUAL(BlockSizeCalculator::ForecastBlockSize(pindex, NUM_BLOCKS_FOR_MEDIAN_BLOCK, 2000000), 4000000U);
+	BOOST_CHECK_EQUAL(BlockSizeCalculator::ForecastBlockSize(pindex, 2 * NUM_BLOCKS_FOR_MEDIAN_BLOCK, 100), OLD_MAX_BLOCK_SIZE);
+}
+
 BOOST_AUTO_TEST_CASE(ComputeBlockSizeWithEverIncreasingBlockSizes)
 {
 	//Testing that we can compute a median over 10 blocks
 	TestChainForComputingMediansSetup::BuildBlocks();
 	unsigned int size = BlockSizeCalculator::ComputeBlockSize(chainActive.Tip(), 10);
 	BOOST_CHECK(size == 1276610 || size == 1276612); //the signatures could yield different lengths on different runs
+
+	//Rewinding the window (as on DisconnectTip) must match a rebuild from scratch
+	unsigned int sizePrev = BlockSizeCalculator::ComputeBlockSize(chainActive.Tip()->pprev, 10);
+	BlockSizeCalculator::Clear();
+	BOOST_CHECK_EQUAL(BlockSizeCalculator::ComputeBlockSize(chainActive.Tip()->pprev, 10), sizePrev);
+	BOOST_CHECK_EQUAL(BlockSizeCalculator::ComputeBlockSize(chainActive.Tip(), 10), size);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
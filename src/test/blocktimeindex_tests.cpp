@@ -0,0 +1,95 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blocktimeindex.h"
+
+#include "chain.h"
+#include "random.h"
+#include "test/test_bitcoin.h"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blocktimeindex_tests, BasicTestingSetup)
+
+/** Extend the chain ending at pprev by the blocks of vBlocks, with times that are not always increasing */
+static void BuildChain(std::vector<CBlockIndex>& vBlocks, CBlockIndex* pprev)
+{
+    for (size_t i = 0; i < vBlocks.size(); i++) {
+        CBlockIndex& block = vBlocks[i];
+        block.pprev = i ? &vBlocks[i - 1] : pprev;
+        block.nHeight = block.pprev ? block.pprev->nHeight + 1 : 0;
+        block.nTime = 1500000000 + block.nHeight * 60 + insecure_rand() % 600;
+        block.BuildSkip();
+    }
+}
+
+/** The heights FindRange should return, by looking at every block */
+static std::vector<int> FindRangeSlow(const CBlockIndex* pindexTip, unsigned int nLow, unsigned int nHigh)
+{
+    std::vector<std::pair<uint32_t, int> > vEntries;
+    for (const CBlockIndex* pindex = pindexTip; pindex; pindex = pindex->pprev)
+        if (pindex->nTime >= nLow && pindex->nTime <= nHigh)
+            vEntries.push_back(std::make_pair(pindex->nTime, pindex->nHeight));
+    std::sort(vEntries.begin(), vEntries.end());
+
+    std::vector<int> vHeights;
+    for (const std::pair<uint32_t, int>& entry : vEntries)
+        vHeights.push_back(entry.second);
+    return vHeights;
+}
+
+static void CheckRanges(const CBlockTimeIndex& index, const CBlockIndex* pindexTip)
+{
+    BOOST_CHECK_EQUAL(index.size(), (size_t)pindexTip->nHeight + 1);
+    for (int i = 0; i < 20; i++) {
+        unsigned int nLow = 1500000000 + insecure_rand() % (pindexTip->nHeight * 60 + 600);
+        unsigned int nHigh = nLow + insecure_rand() % 3600;
+        std::vector<int> vHeights;
+        index.FindRange(nLow, nHigh, vHeights);
+        std::vector<int> vExpected = FindRangeSlow(pindexTip, nLow, nHigh);
+        BOOST_CHECK(vHeights == vExpected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(blocktimeindex_follows_tip)
+{
+    std::vector<CBlockIndex> vMain(1000);
+    BuildChain(vMain, NULL);
+
+    // A branch off block 899
+    std::vector<CBlockIndex> vFork(150);
+    BuildChain(vFork, &vMain[899]);
+
+    CBlockTimeIndex index;
+    index.SetTip(&vMain[499]);
+    CheckRanges(index, &vMain[499]);
+
+    // One block at a time, as connected
+    for (size_t i = 500; i < vMain.size(); i++)
+        index.SetTip(&vMain[i]);
+    BOOST_CHECK(index.Tip() == &vMain.back());
+    CheckRanges(index, &vMain.back());
+
+    // Reorganisation to the longer branch and back again
+    index.SetTip(&vFork.back());
+    CheckRanges(index, &vFork.back());
+    index.SetTip(&vMain.back());
+    CheckRanges(index, &vMain.back());
+
+    // Disconnecting blocks
+    index.SetTip(&vMain[10]);
+    CheckRanges(index, &vMain[10]);
+
+    index.SetTip(NULL);
+    BOOST_CHECK_EQUAL(index.size(), 0U);
+    std::vector<int> vHeights;
+    index.FindRange(0, std::numeric_limits<unsigned int>::max(), vHeights);
+    BOOST_CHECK(vHeights.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,7 @@
 #include "key.h"
 #include "merkleblock.h"
 #include "random.h"
+#include "script/standard.h"
 #include "serialize.h"
 #include "streams.h"
 #include "uint256.h"
@@ -471,6 +472,71 @@ static std::vector<unsigned char> RandomData()
     return std::vector<unsigned char>(r.begin(), r.end());
 }
 
+BOOST_AUTO_TEST_CASE(merkle_block_filter_elements)
+{
+    CKey key[4];
+    for (int i = 0; i < 4; i++)
+        key[i].MakeNewKey(true);
+
+    // A pay-to-pubkey and a pay-to-pubkeyhash output, spent by a chain of transactions
+    CMutableTransaction tx0;
+    tx0.vin.resize(1);
+    tx0.vin[0].scriptSig = CScript() << OP_0 << OP_0;
+    tx0.vout.resize(2);
+    tx0.vout[0].scriptPubKey = CScript() << ToByteVector(key[0].GetPubKey()) << OP_CHECKSIG;
+    tx0.vout[1].scriptPubKey = GetScriptForDestination(key[1].GetPubKey().GetID());
+
+    CMutableTransaction tx1;
+    tx1.vin.resize(2);
+    tx1.vin[0].prevout = COutPoint(tx0.GetHash(), 0);
+    tx1.vin[0].scriptSig = CScript() << RandomData();
+    tx1.vin[1].prevout = COutPoint(tx0.GetHash(), 1);
+    tx1.vin[1].scriptSig = CScript() << RandomData() << ToByteVector(key[1].GetPubKey());
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = GetScriptForDestination(key[2].GetPubKey().GetID());
+
+    CMutableTransaction tx2;
+    tx2.vin.resize(1);
+    tx2.vin[0].prevout = COutPoint(tx1.GetHash(), 0);
+    tx2.vin[0].scriptSig = CScript() << RandomData() << ToByteVector(key[2].GetPubKey());
+    tx2.vout.resize(2);
+    tx2.vout[0].scriptPubKey = GetScriptForMultisig(1, std::vector<CPubKey>{key[3].GetPubKey(), key[0].GetPubKey()});
+    tx2.vout[1].scriptPubKey = CScript() << OP_RETURN << RandomData();
+
+    std::vector<CTransaction> vtx = {tx0, tx1, tx2};
+    CBlockFilterElements elements(vtx);
+    BOOST_CHECK_EQUAL(elements.GetTransactionCount(), vtx.size());
+
+    std::vector<std::vector<unsigned char> > vKeys = {
+        ToByteVector(key[0].GetPubKey()), ToByteVector(key[1].GetPubKey().GetID()),
+        ToByteVector(key[2].GetPubKey().GetID()), ToByteVector(key[3].GetPubKey())};
+
+    // Matching the extracted elements finds and adds the same as matching the transactions
+    for (unsigned char nFlags : {BLOOM_UPDATE_NONE, BLOOM_UPDATE_ALL, BLOOM_UPDATE_P2PUBKEY_ONLY}) {
+        for (const std::vector<unsigned char>& vKey : vKeys) {
+            CBloomFilter filterTx(10, 0.000001, 0, nFlags);
+            filterTx.insert(vKey);
+            CBloomFilter filterElements = filterTx;
+
+            for (unsigned int i = 0; i < vtx.size(); i++)
+                BOOST_CHECK_EQUAL(filterTx.IsRelevantAndUpdate(vtx[i]), filterElements.IsRelevantAndUpdate(elements, i));
+
+            CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION), ssElements(SER_NETWORK, PROTOCOL_VERSION);
+            ssTx << filterTx;
+            ssElements << filterElements;
+            BOOST_CHECK(ssTx.str() == ssElements.str());
+        }
+    }
+
+    // The pay-to-pubkey output is spent by the next transaction unless the filter isn't updated
+    CBloomFilter filter(10, 0.000001, 0, BLOOM_UPDATE_P2PUBKEY_ONLY);
+    filter.insert(vKeys[0]);
+    CBlock block;
+    block.vtx = vtx;
+    CMerkleBlock merkleBlock(block.GetBlockHeader(), elements, filter);
+    BOOST_CHECK_EQUAL(merkleBlock.vMatchedTxn.size(), 3U);
+}
+
 BOOST_AUTO_TEST_CASE(rolling_bloom)
 {
     // last-100-entry, 1% false positive:
@@ -0,0 +1,64 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+
+#include "test/test_bitcoin.h"
+
+#include <atomic>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(checkqueue_tests, BasicTestingSetup)
+
+static std::atomic<unsigned int> nChecksDone;
+
+struct FakeCheck {
+    bool fOk;
+    FakeCheck() : fOk(true) {}
+    explicit FakeCheck(bool fOkIn) : fOk(fOkIn) {}
+    bool operator()() { nChecksDone++; return fOk; }
+    void swap(FakeCheck& other) { std::swap(fOk, other.fOk); }
+};
+
+static bool RunChecks(CCheckQueue<FakeCheck>& queue, unsigned int nFlushSize, unsigned int nChecks, unsigned int nFailing)
+{
+    CCheckQueueControl<FakeCheck> control(&queue, nFlushSize);
+    for (unsigned int i = 0; i < nChecks; i++) {
+        std::vector<FakeCheck> vChecks(1, FakeCheck(i != nFailing));
+        control.Add(vChecks);
+        BOOST_CHECK(vChecks.size() == 1);
+    }
+    return control.Wait();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_batched_control)
+{
+    CCheckQueue<FakeCheck> queue(16);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 3; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<FakeCheck>::Thread, boost::ref(queue)));
+
+    // every check runs, whether or not the controller batches them
+    for (unsigned int nFlushSize : {1, 7, 32, 1000}) {
+        nChecksDone = 0;
+        BOOST_CHECK(RunChecks(queue, nFlushSize, 100, 100));
+        BOOST_CHECK_EQUAL(nChecksDone, 100U);
+        BOOST_CHECK(queue.IsIdle());
+    }
+
+    // a failing check fails the whole run, also while it is still pending in the controller
+    BOOST_CHECK(!RunChecks(queue, 1, 100, 50));
+    BOOST_CHECK(!RunChecks(queue, 1000, 100, 99));
+    BOOST_CHECK(queue.IsIdle());
+    BOOST_CHECK(RunChecks(queue, 32, 10, 10));
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,12 +3,17 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "crypto/aes.h"
+#include "crypto/ctaes/ctaes.h"
+#include "crypto/keccak256.h"
+#include "crypto/muhash.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
 #include "crypto/sha512.h"
+#include "crypto/sph_keccak.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "hash.h"
 #include "random.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
@@ -54,6 +59,7 @@ void TestVector(const Hasher &h, const In &in, const Out &out) {
 void TestSHA1(const std::string &in, const std::string &hexout) { TestVector(CSHA1(), in, ParseHex(hexout));}
 void TestSHA256(const std::string &in, const std::string &hexout) { TestVector(CSHA256(), in, ParseHex(hexout));}
 void TestSHA512(const std::string &in, const std::string &hexout) { TestVector(CSHA512(), in, ParseHex(hexout));}
+void TestKeccak256(const std::string &in, const std::string &hexout) { TestVector(CKeccak256(), in, ParseHex(hexout));}
 void TestRIPEMD160(const std::string &in, const std::string &hexout) { TestVector(CRIPEMD160(), in, ParseHex(hexout));}
 
 void TestHMACSHA256(const std::string &hexkey, const std::string &hexin, const std::string &hexout) {
@@ -255,6 +261,65 @@ BOOST_AUTO_TEST_CASE(sha256_testvectors) {
     TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
 }
 
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    // Batch sizes around the 4 and 8 way transforms, checked against hashing each blob on its own
+    for (int i = 0; i <= 32; ++i) {
+        unsigned char in[64 * 32];
+        unsigned char out1[32 * 32], out2[32 * 32];
+        for (int j = 0; j < 64 * i; ++j) {
+            in[j] = insecure_rand();
+        }
+        for (int j = 0; j < i; ++j) {
+            CHash256().Write(in + 64 * j, 64).Finalize(out1 + 32 * j);
+        }
+        SHA256D64(out2, in, i);
+        BOOST_CHECK(memcmp(out1, out2, 32 * i) == 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(keccak256_testvectors)
+{
+    // The original Keccak padding, not the SHA-3 one
+    TestKeccak256("", "c5d2460186f7233c927e7db2dcc703c0e500b653ca82273b7bfad8045d85a470");
+    TestKeccak256("abc", "4e03657aea45a94fc7d47ba826c8d667c0d1e6e33a64a036ec44f58fa12d6c45");
+
+    // Lengths around the 136 byte rate, against the sph implementation
+    std::vector<unsigned char> in(400);
+    for (size_t i = 0; i < in.size(); i++)
+        in[i] = insecure_rand();
+    for (size_t len = 0; len <= in.size(); len++) {
+        unsigned char expected[32], out[32];
+        sph_keccak256_context ctx;
+        sph_keccak256_init(&ctx);
+        sph_keccak256(&ctx, in.data(), len);
+        sph_keccak256_close(&ctx, expected);
+        CKeccak256().Write(in.data(), len).Finalize(out);
+        BOOST_CHECK(memcmp(out, expected, 32) == 0);
+        if (len == 80) {
+            Keccak256_80(out, in.data());
+            BOOST_CHECK(memcmp(out, expected, 32) == 0);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(keccak256_80many)
+{
+    // Batch sizes around the 4 way transform, checked against hashing each header on its own
+    for (int i = 0; i <= 17; ++i) {
+        unsigned char in[80 * 17];
+        unsigned char out1[32 * 17], out2[32 * 17];
+        for (int j = 0; j < 80 * i; ++j) {
+            in[j] = insecure_rand();
+        }
+        for (int j = 0; j < i; ++j) {
+            CKeccak256().Write(in + 80 * j, 80).Finalize(out1 + 32 * j);
+        }
+        Keccak256_80Many(out2, in, i);
+        BOOST_CHECK(memcmp(out1, out2, 32 * i) == 0);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(sha512_testvectors) {
     TestSHA512("",
                "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
@@ -388,6 +453,33 @@ BOOST_AUTO_TEST_CASE(aes_testvectors) {
     TestAES256("603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4", "f69f2445df4f9b17ad2b417be66c3710", "23304b7a39f9f3ff067d8d8f9e24ecc7");
 }
 
+BOOST_AUTO_TEST_CASE(aes_hardware_matches_ctaes) {
+    // Whichever implementation AESAutoDetect picked must agree with plain ctaes
+    for (int i = 0; i < 1000; i++) {
+        unsigned char key[32], in[AES_BLOCKSIZE], out[AES_BLOCKSIZE], ref[AES_BLOCKSIZE], back[AES_BLOCKSIZE];
+        for (int j = 0; j < 32; j++)
+            key[j] = insecure_rand();
+        for (int j = 0; j < AES_BLOCKSIZE; j++)
+            in[j] = insecure_rand();
+
+        AES128_ctx ctx128;
+        AES128_init(&ctx128, key);
+        AES128_encrypt(&ctx128, 1, ref, in);
+        AES128Encrypt(key).Encrypt(out, in);
+        BOOST_CHECK(memcmp(out, ref, AES_BLOCKSIZE) == 0);
+        AES128Decrypt(key).Decrypt(back, out);
+        BOOST_CHECK(memcmp(back, in, AES_BLOCKSIZE) == 0);
+
+        AES256_ctx ctx256;
+        AES256_init(&ctx256, key);
+        AES256_encrypt(&ctx256, 1, ref, in);
+        AES256Encrypt(key).Encrypt(out, in);
+        BOOST_CHECK(memcmp(out, ref, AES_BLOCKSIZE) == 0);
+        AES256Decrypt(key).Decrypt(back, out);
+        BOOST_CHECK(memcmp(back, in, AES_BLOCKSIZE) == 0);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(aes_cbc_testvectors) {
 
     // NIST AES CBC 128-bit encryption test-vectors
@@ -439,4 +531,71 @@ BOOST_AUTO_TEST_CASE(aes_cbc_testvectors) {
                   "b2eb05e2c39be9fcda6c19078c6a9d1b3f461796d6b0d6b2e0c2a72b4d80e644");
 }
 
+static uint256 MuHashFinalize(MuHash3072 muhash)
+{
+    uint256 hash;
+    muhash.Finalize(hash.begin());
+    return hash;
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests)
+{
+    const unsigned char a[] = "a", b[] = "b", c[] = "c";
+
+    // the hash only depends on the set, not on the order things happened in
+    MuHash3072 ab;
+    ab.Insert(a, 1).Insert(b, 1);
+    MuHash3072 abc;
+    abc.Insert(b, 1).Insert(c, 1).Insert(a, 1);
+    MuHash3072 bca;
+    bca.Insert(c, 1).Insert(a, 1).Insert(b, 1);
+    BOOST_CHECK(MuHashFinalize(abc) == MuHashFinalize(bca));
+    BOOST_CHECK(MuHashFinalize(abc) != MuHashFinalize(ab));
+
+    MuHash3072 removed(abc);
+    removed.Remove(c, 1);
+    BOOST_CHECK(MuHashFinalize(removed) == MuHashFinalize(ab));
+    removed.Remove(a, 1).Remove(b, 1);
+    BOOST_CHECK(MuHashFinalize(removed) == MuHashFinalize(MuHash3072()));
+
+    MuHash3072 onlyc;
+    onlyc.Insert(c, 1);
+    MuHash3072 product(ab);
+    product *= onlyc;
+    BOOST_CHECK(MuHashFinalize(product) == MuHashFinalize(abc));
+    product /= ab;
+    BOOST_CHECK(MuHashFinalize(product) == MuHashFinalize(onlyc));
+
+    // an element that is removed before it is added
+    MuHash3072 early;
+    early.Remove(c, 1).Insert(a, 1).Insert(c, 1).Insert(b, 1);
+    BOOST_CHECK(MuHashFinalize(early) == MuHashFinalize(ab));
+
+    // the state survives a round trip with pending removals
+    unsigned char state[MuHash3072::STATE_SIZE];
+    abc.Remove(b, 1);
+    abc.GetState(state);
+    MuHash3072 restored;
+    restored.SetState(state);
+    restored.Insert(b, 1);
+    BOOST_CHECK(MuHashFinalize(restored) == MuHashFinalize(bca));
+}
+
+BOOST_AUTO_TEST_CASE(num3072_inverse)
+{
+    for (int i = 0; i < 4; i++) {
+        unsigned char bytes[Num3072::BYTE_SIZE];
+        GetRandBytes(bytes, sizeof(bytes));
+        // values right below 2^3072 are reduced modulo the prime
+        if (i == 0)
+            memset(bytes, 0xff, sizeof(bytes));
+        Num3072 x(bytes);
+        Num3072 product = x.GetInverse();
+        product.Multiply(x);
+        BOOST_CHECK(product.limbs[0] == 1);
+        for (int j = 1; j < Num3072::LIMBS; j++)
+            BOOST_CHECK(product.limbs[j] == 0);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,89 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cuckoocache.h"
+
+#include "crypto/sha256.h"
+#include "script/sigcache.h"
+#include "uint256.h"
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(cuckoocache_tests, BasicTestingSetup)
+
+typedef CuckooCache::cache<uint256, SignatureCacheHasher> TestCache;
+
+//! Distinct well distributed entries, alike the nonced hashes the caches hold
+static uint256 GetEntry(uint32_t n, uint32_t nSalt)
+{
+    uint256 entry;
+    CSHA256().Write((unsigned char*)&n, sizeof(n)).Write((unsigned char*)&nSalt, sizeof(nSalt)).Finalize(entry.begin());
+    return entry;
+}
+
+static double HitRate(const TestCache& cache, uint32_t nBegin, uint32_t nEnd, uint32_t nSalt)
+{
+    uint32_t nHits = 0;
+    for (uint32_t i = nBegin; i < nEnd; i++)
+        nHits += cache.contains(GetEntry(i, nSalt), false);
+    return (double)nHits / (nEnd - nBegin);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_no_fakes)
+{
+    TestCache cache;
+    uint32_t nSize = cache.setup_bytes(1 << 20);
+    BOOST_CHECK_EQUAL(nSize, (1U << 20) / sizeof(uint256));
+
+    for (uint32_t i = 0; i < 2 * nSize; i++)
+        cache.insert(GetEntry(i, 1));
+    for (uint32_t i = 0; i < 2 * nSize; i++)
+        BOOST_CHECK(!cache.contains(GetEntry(i, 2), false));
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_hit_rate)
+{
+    TestCache cache;
+    uint32_t nSize = cache.setup_bytes(1 << 20);
+
+    // filled up to 90% nearly everything stays
+    uint32_t nInserted = nSize * 9 / 10;
+    for (uint32_t i = 0; i < nInserted; i++)
+        cache.insert(GetEntry(i, 1));
+    BOOST_CHECK(HitRate(cache, 0, nInserted, 1) > 0.95);
+
+    // with more inserted than fits the recent entries are kept
+    for (uint32_t i = nInserted; i < 3 * nSize; i++)
+        cache.insert(GetEntry(i, 1));
+    BOOST_CHECK(HitRate(cache, 3 * nSize - nSize / 4, 3 * nSize, 1) > 0.95);
+    BOOST_CHECK(HitRate(cache, 0, nSize / 4, 1) < 0.5);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_erase)
+{
+    TestCache cache;
+    uint32_t nSize = cache.setup_bytes(1 << 20);
+    uint32_t nPart = nSize * 4 / 10;
+
+    for (uint32_t i = 0; i < nPart; i++)
+        cache.insert(GetEntry(i, 1));
+
+    // erased entries are only dropped once their space is needed
+    for (uint32_t i = 0; i < nPart; i++)
+        BOOST_CHECK(cache.contains(GetEntry(i, 1), true));
+    BOOST_CHECK(HitRate(cache, 0, nPart, 1) > 0.95);
+
+    // and they make room for new entries before anything else gets evicted
+    for (uint32_t i = 0; i < nPart; i++)
+        cache.insert(GetEntry(i, 2));
+    for (uint32_t i = 0; i < nPart; i++)
+        cache.insert(GetEntry(i, 3));
+    BOOST_CHECK(HitRate(cache, 0, nPart, 2) > 0.95);
+    BOOST_CHECK(HitRate(cache, 0, nPart, 3) > 0.95);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
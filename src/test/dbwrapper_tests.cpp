@@ -204,6 +204,36 @@ BOOST_AUTO_TEST_CASE(existing_data_reindex)
     BOOST_CHECK_EQUAL(res3.ToString(), in2.ToString());
 }
 
+BOOST_AUTO_TEST_CASE(dbwrapper_profiles)
+{
+    BOOST_CHECK(!SetDBProfile("nosuchprofile"));
+    BOOST_CHECK_EQUAL(GetDBProfile().strName, DEFAULT_DB_PROFILE);
+
+    // Two databases sharing a block cache, one of them without bloom filters
+    InitSharedBlockCache(1 << 20);
+    CDBWrapper dbw1(temp_directory_path() / unique_path(), (1 << 20), true, false, false);
+    CDBWrapper dbw2(temp_directory_path() / unique_path(), (1 << 20), true, false, false, 0);
+    ReleaseSharedBlockCache();
+
+    uint256 in1 = GetRandHash();
+    uint256 in2 = GetRandHash();
+    uint256 res;
+    BOOST_CHECK(dbw1.Write('k', in1));
+    BOOST_CHECK(dbw2.Write('k', in2));
+
+    // Reads give the same results whatever the profile
+    BOOST_CHECK(SetDBProfile("ibd"));
+    BOOST_CHECK_EQUAL(GetDBProfile().strName, "ibd");
+    BOOST_CHECK(dbw1.Read('k', res));
+    BOOST_CHECK_EQUAL(res.ToString(), in1.ToString());
+    BOOST_CHECK(SetDBProfile("lowmem"));
+    BOOST_CHECK(dbw2.Read('k', res));
+    BOOST_CHECK_EQUAL(res.ToString(), in2.ToString());
+    BOOST_CHECK(!dbw2.Exists('x'));
+
+    BOOST_CHECK(SetDBProfile(DEFAULT_DB_PROFILE));
+}
+
 BOOST_AUTO_TEST_CASE(iterator_ordering)
 {
     path ph = temp_directory_path() / unique_path();
@@ -0,0 +1,103 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "smartnode/flat-database.h"
+
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+struct CTestCache
+{
+    std::vector<int> vecEntries;
+    int nCleaned;
+
+    CTestCache() : nCleaned(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(vecEntries);
+    }
+
+    void Clear() { vecEntries.clear(); }
+    void CheckAndRemove() { nCleaned++; }
+    std::string ToString() const { return strprintf("Entries: %d", vecEntries.size()); }
+};
+
+BOOST_FIXTURE_TEST_SUITE(flatdatabase_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(flatdatabase_roundtrip)
+{
+    boost::filesystem::path path = GetDataDir() / "testcache.dat";
+
+    CTestCache cache;
+    for (int i = 0; i < 1000; i++)
+        cache.vecEntries.push_back(i * 7);
+
+    CFlatDB<CTestCache> flatdb("testcache.dat", "magicTestCache");
+    BOOST_CHECK(flatdb.Dump(cache));
+    BOOST_CHECK(!boost::filesystem::exists(path.string() + ".new"));
+
+    CTestCache cacheLoaded;
+    BOOST_CHECK(flatdb.Load(cacheLoaded));
+    BOOST_CHECK(cacheLoaded.vecEntries == cache.vecEntries);
+    BOOST_CHECK_EQUAL(cacheLoaded.nCleaned, 1);
+
+    // another cache must neither read nor overwrite the file
+    CFlatDB<CTestCache> flatdbOther("testcache.dat", "magicOtherCache");
+    BOOST_CHECK(!flatdbOther.Load(cacheLoaded));
+    BOOST_CHECK(!flatdbOther.Dump(cache));
+
+    // a damaged data section is detected by its checksum
+    FILE* f = fopen(path.string().c_str(), "r+b");
+    BOOST_CHECK(f);
+    fseek(f, -40, SEEK_END);
+    fputc(0xff, f);
+    fclose(f);
+    BOOST_CHECK(!flatdb.Load(cacheLoaded));
+
+    // but it gets replaced by the next dump as the header is fine
+    BOOST_CHECK(flatdb.Dump(cache));
+    BOOST_CHECK(flatdb.Load(cacheLoaded));
+
+    boost::filesystem::resize_file(path, boost::filesystem::file_size(path) - 1);
+    BOOST_CHECK(!flatdb.Load(cacheLoaded));
+}
+
+BOOST_AUTO_TEST_CASE(flatdatabase_legacy)
+{
+    CTestCache cache;
+    cache.vecEntries.push_back(42);
+
+    // files of the unversioned format are still read
+    CDataStream ssObj(SER_DISK, CLIENT_VERSION);
+    ssObj << std::string("magicTestCache");
+    ssObj << FLATDATA(Params().MessageStart());
+    ssObj << cache;
+    ssObj << Hash(ssObj.begin(), ssObj.end());
+
+    boost::filesystem::path path = GetDataDir() / "legacycache.dat";
+    CAutoFile fileout(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    fileout << ssObj;
+    fileout.fclose();
+
+    CFlatDB<CTestCache> flatdb("legacycache.dat", "magicTestCache");
+    CTestCache cacheLoaded;
+    BOOST_CHECK(flatdb.Load(cacheLoaded));
+    BOOST_CHECK(cacheLoaded.vecEntries == cache.vecEntries);
+
+    // and replaced by the versioned format on the next dump
+    BOOST_CHECK(flatdb.Dump(cacheLoaded));
+    CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    unsigned char pchFileMagic[4];
+    filein >> FLATDATA(pchFileMagic);
+    BOOST_CHECK(memcmp(pchFileMagic, FLATDB_FILE_MAGIC, sizeof(pchFileMagic)) == 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
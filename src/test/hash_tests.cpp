@@ -3,7 +3,11 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "hash.h"
+#include "net.h"
+#include "primitives/block.h"
+#include "random.h"
 #include "utilstrencodings.h"
+#include "validation.h"
 #include "test/test_bitcoin.h"
 
 #include <vector>
@@ -128,4 +132,55 @@ BOOST_AUTO_TEST_CASE(siphash)
     BOOST_CHECK_EQUAL(SipHashUint256(1, 2, ss.GetHash()), 0x79751e980c2a0a35ULL);
 }
 
+BOOST_AUTO_TEST_CASE(block_hash_cache)
+{
+    CBlock block;
+    block.nVersion = 2;
+    block.hashPrevBlock = GetRandHash();
+    block.hashMerkleRoot = GetRandHash();
+    block.nTime = 1500000000;
+    block.nBits = 0x1e0ffff0;
+    block.nNonce = 1;
+    const CBlockHeader& header = block;
+    BOOST_CHECK(block.GetHash() == header.GetHash());
+    BOOST_CHECK(block.GetHash() == block.GetBlockHeader().GetHash());
+
+    // Changing any header field is picked up without explicit invalidation
+    uint256 hashOld = block.GetHash();
+    block.nNonce++;
+    BOOST_CHECK(block.GetHash() != hashOld);
+    BOOST_CHECK(block.GetHash() == header.GetHash());
+    block.hashMerkleRoot = GetRandHash();
+    BOOST_CHECK(block.GetHash() == header.GetHash());
+
+    // Copies carry the cache along, and stay correct once they diverge
+    CBlock copy(block);
+    BOOST_CHECK(copy.GetHash() == block.GetHash());
+    copy.nTime++;
+    BOOST_CHECK(copy.GetHash() == ((const CBlockHeader&)copy).GetHash());
+    BOOST_CHECK(copy.GetHash() != block.GetHash());
+    copy = block;
+    BOOST_CHECK(copy.GetHash() == block.GetHash());
+
+    block.SetNull();
+    BOOST_CHECK(block.GetHash() == header.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(salted_hashers)
+{
+    // Each instance draws its own salt but hashes consistently
+    uint256 hash = GetRandHash();
+    BlockHasher hasherBlock1, hasherBlock2;
+    BOOST_CHECK_EQUAL(hasherBlock1(hash), hasherBlock1(hash));
+    BOOST_CHECK(hasherBlock1(hash) != hasherBlock2(hash));
+    BOOST_CHECK(hasherBlock1(hash) != hash.GetCheapHash());
+
+    // The inventory type is part of the key
+    SaltedInvHasher hasherInv;
+    BOOST_CHECK_EQUAL(hasherInv(CInv(MSG_TX, hash)), hasherInv(CInv(MSG_TX, hash)));
+    BOOST_CHECK(hasherInv(CInv(MSG_TX, hash)) != hasherInv(CInv(MSG_BLOCK, hash)));
+    BOOST_CHECK(CInv(MSG_TX, hash) == CInv(MSG_TX, hash));
+    BOOST_CHECK(!(CInv(MSG_TX, hash) == CInv(MSG_BLOCK, hash)));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
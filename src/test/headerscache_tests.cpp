@@ -0,0 +1,83 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "headerscache.h"
+
+#include "chain.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "test/test_bitcoin.h"
+
+#include <string.h>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(headerscache_tests, BasicTestingSetup)
+
+static std::vector<CBlock> DecodeHeaders(const CRelayMessage& msg)
+{
+    CDataStream ss(msg.vchMsg.begin() + CMessageHeader::HEADER_SIZE, msg.vchMsg.end(), SER_NETWORK, PROTOCOL_VERSION);
+    std::vector<CBlock> vHeaders;
+    ss >> vHeaders;
+    BOOST_CHECK(ss.empty());
+
+    unsigned char pchChecksum[CMessageHeader::CHECKSUM_SIZE];
+    CConnman::GetMessageChecksum(&msg.vchMsg[0] + CMessageHeader::HEADER_SIZE, &msg.vchMsg[0] + msg.vchMsg.size(), pchChecksum);
+    BOOST_CHECK(memcmp(pchChecksum, msg.pchChecksum, CMessageHeader::CHECKSUM_SIZE) == 0);
+    return vHeaders;
+}
+
+static void CheckHeaders(const CRelayMessage& msg, const std::vector<CBlockIndex>& vBlocks, int nLast, int nCount)
+{
+    std::vector<CBlock> vHeaders = DecodeHeaders(msg);
+    BOOST_CHECK_EQUAL(vHeaders.size(), (size_t)nCount);
+    for (int i = 0; i < (int)vHeaders.size(); i++) {
+        const CBlockIndex& block = vBlocks[nLast - nCount + 1 + i];
+        BOOST_CHECK(vHeaders[i].vtx.empty());
+        BOOST_CHECK_EQUAL(vHeaders[i].nTime, block.nTime);
+        BOOST_CHECK(vHeaders[i].hashPrevBlock == (block.pprev ? block.pprev->GetBlockHash() : uint256()));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(headerscache_encode_and_reuse)
+{
+    std::vector<uint256> vHashes(100);
+    std::vector<CBlockIndex> vBlocks(100);
+    for (size_t i = 0; i < vBlocks.size(); i++) {
+        vHashes[i] = GetRandHash();
+        vBlocks[i].phashBlock = &vHashes[i];
+        vBlocks[i].pprev = i ? &vBlocks[i - 1] : NULL;
+        vBlocks[i].nHeight = i;
+        vBlocks[i].nTime = 1500000000 + i * 60;
+    }
+
+    CHeadersCache cache(10, 2);
+
+    // Full replies are kept
+    std::shared_ptr<const CRelayMessage> msg = cache.Get(&vBlocks[19], 10);
+    CheckHeaders(*msg, vBlocks, 19, 10);
+    BOOST_CHECK_EQUAL(cache.size(), 1U);
+    BOOST_CHECK(cache.Get(&vBlocks[19], 10) == msg);
+
+    // Shorter ones are not
+    CheckHeaders(*cache.Get(&vBlocks[99], 5), vBlocks, 99, 5);
+    BOOST_CHECK_EQUAL(cache.size(), 1U);
+
+    // An empty reply
+    BOOST_CHECK(DecodeHeaders(*cache.Get(NULL, 0)).empty());
+
+    // The least recently used reply is dropped
+    CheckHeaders(*cache.Get(&vBlocks[9], 10), vBlocks, 9, 10);
+    BOOST_CHECK(cache.Get(&vBlocks[19], 10) == msg);
+    CheckHeaders(*cache.Get(&vBlocks[29], 10), vBlocks, 29, 10);
+    BOOST_CHECK_EQUAL(cache.size(), 2U);
+    BOOST_CHECK(cache.Get(&vBlocks[19], 10) == msg);
+
+    cache.Clear();
+    BOOST_CHECK_EQUAL(cache.size(), 0U);
+    BOOST_CHECK(cache.Get(&vBlocks[19], 10) != msg);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
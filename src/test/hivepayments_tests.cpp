@@ -0,0 +1,90 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "smarthive/hive.h"
+#include "smarthive/hivepayments.h"
+
+#include "consensus/consensus.h"
+#include "primitives/transaction.h"
+#include "validation.h"
+#include "test/test_bitcoin.h"
+
+#include <climits>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(hivepayments_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(hivepayments_fill_validate)
+{
+    SmartHive::Init();
+    SmartHivePayments::Init();
+
+    // Classic, rotation, the accepted range without payments, v1.1 and the
+    // batch split on and off its trigger height
+    const int vHeights[] = {50000, 100000, 100001, 230000, 400000, 526500, 526501, HF_CHAIN_REWARD_END_HEIGHT};
+    const size_t vExpected[] = {5, 1, 1, 0, 1, 7, 0, 0};
+
+    for (size_t i = 0; i < sizeof(vHeights) / sizeof(vHeights[0]); i++) {
+        int nHeight = vHeights[i];
+        CAmount blockReward = GetBlockValue(nHeight, 0, INT_MAX);
+
+        CMutableTransaction tx;
+        std::vector<CTxOut> voutSmartHives;
+        SmartHivePayments::FillPayments(tx, nHeight, 0, blockReward, voutSmartHives);
+        BOOST_CHECK_EQUAL(voutSmartHives.size(), vExpected[i]);
+        BOOST_CHECK_EQUAL(tx.vout.size(), vExpected[i]);
+
+        CAmount hiveReward = -1;
+        CTransaction txCoinbase(tx);
+        BOOST_CHECK(SmartHivePayments::Validate(CCoinbaseIndex(txCoinbase), nHeight, INT_MAX, hiveReward) == SmartHivePayments::Valid);
+
+        CAmount nPaid = 0;
+        BOOST_FOREACH(const CTxOut& out, tx.vout)
+            nPaid += out.nValue;
+        if (vExpected[i])
+            BOOST_CHECK_EQUAL(hiveReward, nPaid);
+
+        // A missing payment gets rejected
+        if (vExpected[i]) {
+            tx.vout.pop_back();
+            CTransaction txMissing(tx);
+            BOOST_CHECK(SmartHivePayments::Validate(CCoinbaseIndex(txMissing), nHeight, INT_MAX, hiveReward) == SmartHivePayments::HiveAddressMissing);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(hive_lookup)
+{
+    SmartHive::Init();
+
+    const SmartHive::Payee vPayees[] = {SmartHive::Development, SmartHive::Outreach, SmartHive::Support, SmartHive::SmartRewards,
+                                        SmartHive::ProjectTreasury, SmartHive::Outreach2, SmartHive::Web, SmartHive::Quality};
+
+    BOOST_FOREACH(SmartHive::Payee payee, vPayees) {
+        BOOST_CHECK(SmartHive::IsHive(SmartHive::Address(payee)));
+        BOOST_CHECK(SmartHive::IsHive(SmartHive::Script(payee)));
+
+        // The same hash as the other address type or an extra opcode isn't a hive
+        unsigned char version;
+        uint160 hash;
+        BOOST_CHECK(SmartHive::Address(payee).GetRaw(version, hash));
+
+        CTxDestination dest = SmartHive::Address(payee).Get();
+        CTxDestination other = boost::get<CKeyID>(&dest) ? CTxDestination(CScriptID(hash)) : CTxDestination(CKeyID(hash));
+        BOOST_CHECK(!SmartHive::IsHive(CSmartAddress(other)));
+        BOOST_CHECK(!SmartHive::IsHive(GetScriptForDestination(other)));
+
+        CScript script = SmartHive::Script(payee);
+        script << OP_NOP;
+        BOOST_CHECK(!SmartHive::IsHive(script));
+    }
+
+    BOOST_CHECK(!SmartHive::IsHive(CScript()));
+    BOOST_CHECK(!SmartHive::IsHive(CSmartAddress()));
+    BOOST_CHECK(!SmartHive::IsHive(CSmartAddress(CKeyID(uint160()))));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -188,4 +188,33 @@ BOOST_AUTO_TEST_CASE(key_test1)
     BOOST_CHECK(detsigc == ParseHex("2052d8a32079c11e79db95af63bb9600c5b04f21a9ca33dc129c2bfa8ac9dc1cd561d8ae5e0f6c1a16bde3719c64c2fd70e404b6428ab9a69566962e8771b5944d"));
 }
 
+BOOST_AUTO_TEST_CASE(key_verify_parsed_cache)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    std::string strMsg = "Message for the parsed key cache";
+    uint256 hashMsg = Hash(strMsg.begin(), strMsg.end());
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(key.Sign(hashMsg, vchSig));
+
+    // the parsed key gets reused for the next verification
+    BOOST_CHECK(pubkey.Verify(hashMsg, vchSig));
+    BOOST_CHECK(pubkey.Verify(hashMsg, vchSig));
+
+    // a key sharing the start of the x coordinate goes to the same slot but isn't taken for the cached one
+    std::vector<unsigned char> vchOther(pubkey.begin(), pubkey.end());
+    vchOther.back() ^= 1;
+    CPubKey pubkeyOther(vchOther);
+    BOOST_CHECK(!pubkeyOther.Verify(hashMsg, vchSig));
+    BOOST_CHECK(!pubkeyOther.Verify(hashMsg, vchSig));
+    BOOST_CHECK(pubkey.Verify(hashMsg, vchSig));
+
+    // the uncompressed form of the same point is a key of its own
+    pubkeyOther = pubkey;
+    BOOST_CHECK(pubkeyOther.Decompress());
+    BOOST_CHECK(pubkeyOther.Verify(hashMsg, vchSig));
+    BOOST_CHECK(pubkey.Verify(hashMsg, vchSig));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -3,6 +3,9 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "chainparams.h"
+#include "consensus/consensus.h"
+#include "consensus/validation.h"
+#include "streams.h"
 #include "validation.h"
 
 #include "test/test_bitcoin.h"
@@ -56,6 +59,23 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
     BOOST_CHECK_EQUAL(nSum, 2099999997690000ULL);
 }
 
+BOOST_AUTO_TEST_CASE(block_value_range_test)
+{
+    BOOST_CHECK_EQUAL(GetBlockValueRange(10, 9), 0);
+    BOOST_CHECK_EQUAL(GetBlockValueRange(0, 0), GetBlockValue(0, 0, INT_MAX));
+
+    // Compare against summing up every block, around the start of the taper and
+    // the end of the block rewards.
+    const int vStart[] = {0, 1, 143400, 143499, 1000000, HF_CHAIN_REWARD_END_HEIGHT - 100};
+    BOOST_FOREACH(int nStart, vStart) {
+        CAmount nSum = 0;
+        for (int nHeight = nStart; nHeight < nStart + 1000; nHeight++) {
+            nSum += GetBlockValue(nHeight, 0, INT_MAX);
+            BOOST_CHECK_EQUAL(GetBlockValueRange(nStart, nHeight), nSum);
+        }
+    }
+}
+
 bool ReturnFalse() { return false; }
 bool ReturnTrue() { return true; }
 
@@ -72,4 +92,84 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     Test.disconnect(&ReturnTrue);
     BOOST_CHECK(Test());
 }
+
+BOOST_FIXTURE_TEST_CASE(read_block_from_disk, TestChain100Setup)
+{
+    const CBlockIndex* pindex = chainActive.Tip();
+
+    CBlock block;
+    BOOST_CHECK(ReadBlockFromDisk(block, pindex, Params().GetConsensus()));
+    BOOST_CHECK(block.GetHash() == pindex->GetBlockHash());
+
+    // the raw block is exactly the serialized block
+    CSerializeData vchBlock;
+    BOOST_CHECK(ReadRawBlockFromDisk(vchBlock, pindex, Params().MessageStart()));
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    BOOST_CHECK(CSerializeData(ss.begin(), ss.end()) == vchBlock);
+
+    // and gets appended to what is in the buffer already, e.g. room for a message header
+    CSerializeData vchMsg(CMessageHeader::HEADER_SIZE, 0);
+    BOOST_CHECK(ReadRawBlockFromDisk(vchMsg, pindex, Params().MessageStart()));
+    BOOST_CHECK(CSerializeData(vchMsg.begin() + CMessageHeader::HEADER_SIZE, vchMsg.end()) == vchBlock);
+
+    // a different network magic doesn't match the block file
+    CMessageHeader::MessageStartChars messageStart;
+    memcpy(messageStart, Params().MessageStart(), sizeof(messageStart));
+    messageStart[0] ^= 0xff;
+    BOOST_CHECK(!ReadRawBlockFromDisk(vchBlock, pindex, messageStart));
+}
+
+BOOST_FIXTURE_TEST_CASE(chain_tip_snapshot, TestChain100Setup)
+{
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    BOOST_CHECK(tip);
+
+    LOCK(cs_main);
+    const CBlockIndex* pindex = chainActive.Tip();
+    BOOST_CHECK(tip->pindex == pindex);
+    BOOST_CHECK_EQUAL(tip->nHeight, chainActive.Height());
+    BOOST_CHECK(tip->hashBlock == pindex->GetBlockHash());
+    BOOST_CHECK_EQUAL(tip->nTime, pindex->GetBlockTime());
+    BOOST_CHECK_EQUAL(tip->nMedianTimePast, pindex->GetMedianTimePast());
+    BOOST_CHECK_EQUAL(tip->nBits, pindex->nBits);
+}
+
+BOOST_AUTO_TEST_CASE(check_block_parallel_transactions)
+{
+    // a block big enough to have its transactions checked on the block tx check threads
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << 1 << OP_0;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 1;
+    block.vtx.push_back(coinbase);
+    for (unsigned int i = 1; i < 4 * BLOCK_TXCHECK_CHUNK; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        tx.vout.resize(1);
+        tx.vout[0].nValue = 1;
+        tx.vout[0].scriptPubKey = CScript() << OP_CHECKSIG;
+        block.vtx.push_back(tx);
+    }
+
+    CValidationState state;
+    BOOST_CHECK(CheckBlock(block, state, false, false, 1));
+    BOOST_CHECK(state.IsValid());
+
+    // the first failing transaction is reported, whichever chunk fails first
+    CMutableTransaction txDuplicate(block.vtx[3 * BLOCK_TXCHECK_CHUNK + 1]);
+    txDuplicate.vin.push_back(txDuplicate.vin[0]);
+    block.vtx[3 * BLOCK_TXCHECK_CHUNK + 1] = txDuplicate;
+    CMutableTransaction txNegative(block.vtx[BLOCK_TXCHECK_CHUNK + 5]);
+    txNegative.vout[0].nValue = -1;
+    block.vtx[BLOCK_TXCHECK_CHUNK + 5] = txNegative;
+
+    CValidationState stateInvalid;
+    BOOST_CHECK(!CheckBlock(block, stateInvalid, false, false, 1));
+    BOOST_CHECK_EQUAL(stateInvalid.GetRejectReason(), "bad-txns-vout-negative");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
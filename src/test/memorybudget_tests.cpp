@@ -0,0 +1,89 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "memorybudget.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(memorybudget_tests, BasicTestingSetup)
+
+/** A cache that frees what it gets asked for, down to nMin */
+struct TestCache
+{
+    size_t nUsage;
+    size_t nMin;
+    int nShrinks;
+
+    TestCache(size_t nUsageIn, size_t nMinIn = 0) : nUsage(nUsageIn), nMin(nMinIn), nShrinks(0) {}
+
+    size_t Usage() const { return nUsage; }
+    void Shrink(size_t nBytes)
+    {
+        nShrinks++;
+        nUsage = nUsage - nMin > nBytes ? nUsage - nBytes : nMin;
+    }
+};
+
+static void Register(CMemoryBudget& budget, const std::string& strName, TestCache& cache)
+{
+    budget.Register(strName, [&cache]() { return cache.Usage(); }, [&cache](size_t nBytes) { cache.Shrink(nBytes); });
+}
+
+BOOST_AUTO_TEST_CASE(memorybudget_usage)
+{
+    CMemoryBudget budget;
+    TestCache a(100), b(200);
+    Register(budget, "a", a);
+    budget.Register("b", [&b]() { return b.Usage(); });
+
+    std::map<std::string, size_t> mapUsage = budget.GetUsage();
+    BOOST_CHECK_EQUAL(mapUsage.size(), 2);
+    BOOST_CHECK_EQUAL(mapUsage["a"], 100);
+    BOOST_CHECK_EQUAL(mapUsage["b"], 200);
+
+    // Without a limit nothing gets shrunk
+    BOOST_CHECK_EQUAL(budget.Check(), 0);
+    BOOST_CHECK_EQUAL(a.nShrinks, 0);
+
+    budget.Unregister("a");
+    BOOST_CHECK_EQUAL(budget.GetUsage().size(), 1);
+    budget.UnregisterAll();
+    BOOST_CHECK(budget.GetUsage().empty());
+}
+
+BOOST_AUTO_TEST_CASE(memorybudget_shrink_largest_first)
+{
+    CMemoryBudget budget;
+    TestCache small(100), large(1000), fixed(500);
+    Register(budget, "small", small);
+    Register(budget, "large", large);
+    budget.Register("fixed", [&fixed]() { return fixed.Usage(); });
+
+    // Below the limit
+    budget.SetLimit(2000);
+    BOOST_CHECK_EQUAL(budget.Check(), 0);
+    BOOST_CHECK_EQUAL(large.nShrinks, 0);
+
+    // The largest cache covers the excess alone, the cache without shrink still counts
+    budget.SetLimit(1300);
+    BOOST_CHECK_EQUAL(budget.Check(), 300);
+    BOOST_CHECK_EQUAL(large.nUsage, 700);
+    BOOST_CHECK_EQUAL(small.nShrinks, 0);
+    BOOST_CHECK_EQUAL(fixed.nShrinks, 0);
+
+    // Neither can free the excess of 650, both go down as far as they can
+    large.nMin = 600;
+    small.nMin = 50;
+    budget.SetLimit(650);
+    BOOST_CHECK_EQUAL(budget.Check(), 150);
+    BOOST_CHECK_EQUAL(large.nUsage, 600);
+    BOOST_CHECK_EQUAL(small.nUsage, 50);
+
+    // Nothing left to free
+    BOOST_CHECK_EQUAL(budget.Check(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "policy/policy.h"
+#include "random.h"
 #include "txmempool.h"
 #include "util.h"
 
@@ -578,4 +579,82 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolAddressIndexTest)
+{
+    TestMemPoolEntryHelper entry;
+    CTxMemPool pool(CFeeRate(0));
+
+    uint160 addrA(std::vector<unsigned char>(20, 0xaa));
+    uint160 addrB(std::vector<unsigned char>(20, 0xbb));
+    CScript scriptA = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(addrA.begin(), addrA.end()) << OP_EQUALVERIFY << OP_CHECKSIG;
+    CScript scriptB = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(addrB.begin(), addrB.end()) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    // A confirmed coin paying A
+    CCoinsView base;
+    CCoinsViewCache view(&base);
+    COutPoint prevout(GetRandHash(), 0);
+    view.AddCoin(prevout, Coin(CTxOut(5000, scriptA), 1, false), false);
+
+    // tx1 spends it to B and back to A, tx2 pays B again
+    CMutableTransaction tx1;
+    tx1.vin.resize(1);
+    tx1.vin[0].prevout = prevout;
+    tx1.vout.resize(2);
+    tx1.vout[0] = CTxOut(3000, scriptB);
+    tx1.vout[1] = CTxOut(1000, scriptA);
+    CMutableTransaction tx2;
+    tx2.vin.resize(1);
+    tx2.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx2.vout.resize(1);
+    tx2.vout[0] = CTxOut(500, scriptB);
+
+    pool.addAddressIndex(entry.FromTx(tx1), view);
+    pool.addAddressIndex(entry.FromTx(tx2), view);
+    pool.addSpentIndex(entry.FromTx(tx1), view);
+
+    std::vector<std::pair<uint160, int> > addressesA(1, std::make_pair(addrA, 1));
+    std::vector<std::pair<uint160, int> > addressesB(1, std::make_pair(addrB, 1));
+    std::vector<std::pair<uint160, int> > addressesP2SH(1, std::make_pair(addrA, 2));
+    std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> > results;
+
+    BOOST_CHECK(pool.getAddressIndex(addressesA, results));
+    BOOST_CHECK_EQUAL(results.size(), 2);
+    CAmount balance = 0;
+    for (unsigned int i = 0; i < results.size(); i++) {
+        BOOST_CHECK(results[i].first.txhash == tx1.GetHash());
+        balance += results[i].second.amount;
+    }
+    BOOST_CHECK_EQUAL(balance, -4000);
+
+    results.clear();
+    BOOST_CHECK(pool.getAddressIndex(addressesB, results));
+    BOOST_CHECK_EQUAL(results.size(), 2);
+
+    results.clear();
+    BOOST_CHECK(pool.getAddressIndex(addressesP2SH, results));
+    BOOST_CHECK(results.empty());
+
+    CSpentIndexKey spentKey(prevout.hash, prevout.n);
+    CSpentIndexValue spentValue;
+    BOOST_CHECK(pool.getSpentIndex(spentKey, spentValue));
+    BOOST_CHECK(spentValue.txid == tx1.GetHash());
+    BOOST_CHECK(spentValue.addressHash == addrA);
+
+    // Removing tx1 leaves only tx2's delta behind
+    pool.removeAddressIndex(tx1.GetHash());
+    pool.removeSpentIndex(tx1.GetHash());
+
+    results.clear();
+    BOOST_CHECK(pool.getAddressIndex(addressesA, results));
+    BOOST_CHECK(results.empty());
+
+    results.clear();
+    BOOST_CHECK(pool.getAddressIndex(addressesB, results));
+    BOOST_CHECK_EQUAL(results.size(), 1);
+    BOOST_CHECK(results[0].first.txhash == tx2.GetHash());
+    BOOST_CHECK_EQUAL(results[0].second.amount, 500);
+
+    BOOST_CHECK(!pool.getSpentIndex(spentKey, spentValue));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -133,4 +133,36 @@ BOOST_AUTO_TEST_CASE(merkle_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(merkle_tree_levels)
+{
+    // Small trees, and ones with levels big enough to be hashed on several threads
+    const int sizes[] = {0, 1, 2, 3, 5, 8, 17, 16385, 40001};
+    for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        std::vector<uint256> leaves(sizes[i]);
+        for (size_t j = 0; j < leaves.size(); j++) {
+            leaves[j] = GetRandHash();
+        }
+        std::vector<std::vector<uint256> > tree = ComputeMerkleTree(leaves);
+        uint256 root = ComputeMerkleRoot(leaves);
+        BOOST_CHECK(tree[0] == leaves);
+        for (size_t h = 1; h < tree.size(); h++) {
+            BOOST_CHECK_EQUAL(tree[h].size(), (tree[h - 1].size() + 1) / 2);
+        }
+        BOOST_CHECK(tree.back().size() <= 1);
+        BOOST_CHECK(tree.back().empty() ? root.IsNull() : tree.back()[0] == root);
+
+        // The branches are the siblings along the path, each level's last node paired with itself
+        for (int loop = 0; loop < std::min(sizes[i], 8); loop++) {
+            uint32_t pos = insecure_rand() % leaves.size();
+            std::vector<uint256> branch = ComputeMerkleBranch(leaves, pos);
+            BOOST_REQUIRE_EQUAL(branch.size(), tree.size() - 1);
+            for (size_t h = 0; h < branch.size(); h++) {
+                uint32_t sibling = std::min<uint32_t>((pos >> h) ^ 1, tree[h].size() - 1);
+                BOOST_CHECK(branch[h] == tree[h][sibling]);
+            }
+            BOOST_CHECK(ComputeMerkleRootFromBranch(leaves[pos], branch, pos) == root);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
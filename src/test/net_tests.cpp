@@ -4,6 +4,7 @@
 #include "addrman.h"
 #include "test/test_bitcoin.h"
 #include <string>
+#include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
 #include "hash.h"
 #include "serialize.h"
@@ -164,4 +165,67 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+static void ReceiveMessage(CNetMessage& msg, const std::vector<char>& vchMsg, unsigned int nChunkSize)
+{
+    const char* pch = vchMsg.data();
+    unsigned int nBytes = vchMsg.size();
+    while (nBytes > 0) {
+        int nHandled = msg.in_data ? msg.readData(pch, std::min(nBytes, nChunkSize)) : msg.readHeader(pch, std::min(nBytes, nChunkSize));
+        BOOST_REQUIRE(nHandled > 0);
+        pch += nHandled;
+        nBytes -= nHandled;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(cnetmessage_receive)
+{
+    CMessageHeader::MessageStartChars pchMessageStart = {0x5c, 0xa1, 0xab, 0x1e};
+    BOOST_FOREACH(unsigned int nSize, std::vector<unsigned int>({0, 1, 400, RECV_BUFFER_AHEAD, RECV_BUFFER_AHEAD + 1, 1000 * 1000})) {
+        std::vector<char> vchPayload(nSize);
+        for (unsigned int i = 0; i < nSize; i++)
+            vchPayload[i] = (char)(i * 7);
+        CDataStream ssMsg(SER_NETWORK, PROTOCOL_VERSION);
+        ssMsg << CMessageHeader(pchMessageStart, "block", nSize);
+        ssMsg.write(vchPayload.data(), nSize);
+        std::vector<char> vchMsg(ssMsg.begin(), ssMsg.end());
+
+        // Twice, the second time with buffers from the pool
+        for (int nPass = 0; nPass < 2; nPass++) {
+            CNetMessage msg(pchMessageStart, SER_NETWORK, PROTOCOL_VERSION);
+            ReceiveMessage(msg, vchMsg, 1000 + 7919 * nPass);
+            BOOST_CHECK(msg.complete());
+            BOOST_CHECK_EQUAL(msg.hdr.GetCommand(), "block");
+            BOOST_CHECK(std::vector<char>(msg.vRecv.begin(), msg.vRecv.end()) == vchPayload);
+        }
+    }
+
+    // Returned buffers are kept up to the pool's limit, the message sizes above are well within it
+    BOOST_CHECK(recvBufferPool.GetPooledBytes() > 1000 * 1000);
+    BOOST_CHECK(recvBufferPool.GetPooledBytes() <= 16 * 1024 * 1024);
+}
+
+BOOST_AUTO_TEST_CASE(upload_bucket)
+{
+    CUploadBucket bucket;
+    // Unlimited until a rate is set
+    bucket.Consume(1000000, 0);
+    BOOST_CHECK(bucket.Allowed(0));
+
+    bucket.SetRate(1000, 0);
+    BOOST_CHECK(bucket.Allowed(0));
+    bucket.Consume(600, 0);
+    BOOST_CHECK(bucket.Allowed(0));
+    // A message larger than what's left still goes out and is paid off afterwards
+    bucket.Consume(1400, 0);
+    BOOST_CHECK_EQUAL(bucket.nTokens, -1000);
+    BOOST_CHECK(!bucket.Allowed(500000));
+    BOOST_CHECK(!bucket.Allowed(1000000));
+    BOOST_CHECK(bucket.Allowed(1500000));
+    BOOST_CHECK_EQUAL(bucket.nTokens, 500);
+    // Idle time refills one second's worth at most
+    BOOST_CHECK(bucket.Allowed(60000000));
+    BOOST_CHECK_EQUAL(bucket.nTokens, 1000);
+    BOOST_CHECK_EQUAL(bucket.nBytesSent, 1002000U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
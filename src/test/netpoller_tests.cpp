@@ -0,0 +1,81 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "netpoller.h"
+#include "test/test_bitcoin.h"
+
+#include <memory>
+
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+
+#ifndef WIN32
+#include <sys/socket.h>
+#include <unistd.h>
+
+BOOST_FIXTURE_TEST_SUITE(netpoller_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(netpoller_modes)
+{
+    std::vector<std::string> vModes = GetSocketPollerModes();
+    BOOST_CHECK_EQUAL(vModes.front(), GetDefaultSocketPollerMode());
+    BOOST_CHECK_EQUAL(vModes.back(), "select");
+    BOOST_CHECK(CreateSocketPoller("unknown") == NULL);
+}
+
+BOOST_AUTO_TEST_CASE(netpoller_events)
+{
+    BOOST_FOREACH(const std::string& strMode, GetSocketPollerModes()) {
+        std::unique_ptr<CSocketPoller> poller(CreateSocketPoller(strMode));
+        BOOST_REQUIRE(poller);
+        BOOST_CHECK_EQUAL(poller->GetName(), strMode);
+
+        int fds[2];
+        BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+        CSocketPoller::InterestMap mapInterest;
+        CSocketPoller::ReadyMap mapReady;
+        mapInterest[fds[0]] = CSocketPoller::Interest(1, CSocketPoller::EVENT_RECV);
+
+        // Nothing to receive yet
+        BOOST_CHECK(poller->Wait(mapInterest, 0, mapReady));
+        BOOST_CHECK_EQUAL(CSocketPoller::GetReadyEvents(mapReady, fds[0]), 0U);
+
+        // Reported until drained
+        char ch = 'x';
+        BOOST_REQUIRE(write(fds[1], &ch, 1) == 1);
+        BOOST_CHECK(poller->Wait(mapInterest, 1000, mapReady));
+        BOOST_CHECK(CSocketPoller::GetReadyEvents(mapReady, fds[0]) & CSocketPoller::EVENT_RECV);
+        BOOST_CHECK(poller->Wait(mapInterest, 1000, mapReady));
+        BOOST_CHECK(CSocketPoller::GetReadyEvents(mapReady, fds[0]) & CSocketPoller::EVENT_RECV);
+        BOOST_REQUIRE(read(fds[0], &ch, 1) == 1);
+        BOOST_CHECK(poller->Wait(mapInterest, 0, mapReady));
+        BOOST_CHECK_EQUAL(CSocketPoller::GetReadyEvents(mapReady, fds[0]), 0U);
+
+        // Switching to sending, which an empty socket is ready for
+        mapInterest[fds[0]].nEvents = CSocketPoller::EVENT_SEND;
+        BOOST_CHECK(poller->Wait(mapInterest, 1000, mapReady));
+        BOOST_CHECK_EQUAL(CSocketPoller::GetReadyEvents(mapReady, fds[0]), (unsigned int)CSocketPoller::EVENT_SEND);
+
+        // A new socket getting the descriptor of a closed one gets waited for under its new owner
+        close(fds[0]);
+        close(fds[1]);
+        int fdsNew[2];
+        BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fdsNew) == 0);
+        mapInterest.clear();
+        mapInterest[fdsNew[0]] = CSocketPoller::Interest(2, CSocketPoller::EVENT_RECV);
+        BOOST_REQUIRE(write(fdsNew[1], &ch, 1) == 1);
+        BOOST_CHECK(poller->Wait(mapInterest, 1000, mapReady));
+        BOOST_CHECK(CSocketPoller::GetReadyEvents(mapReady, fdsNew[0]) & CSocketPoller::EVENT_RECV);
+
+        // Sockets no longer of interest aren't reported
+        mapInterest.clear();
+        BOOST_CHECK(poller->Wait(mapInterest, 0, mapReady));
+        BOOST_CHECK(mapReady.empty());
+        close(fdsNew[0]);
+        close(fdsNew[1]);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+#endif
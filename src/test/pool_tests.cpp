@@ -0,0 +1,89 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "support/allocators/pool.h"
+
+#include "coins.h"
+#include "memusage.h"
+#include "test/test_bitcoin.h"
+
+#include <unordered_map>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(pool_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(pool_resource_reuse)
+{
+    PoolResource<64, 8> resource(1024);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 0U);
+
+    void *a = resource.Allocate(24, 8);
+    void *b = resource.Allocate(24, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+    BOOST_CHECK_EQUAL((char*)b - (char*)a, 24);
+
+    // freed blocks are handed out again for the same size only
+    resource.Deallocate(a, 24, 8);
+    BOOST_CHECK(resource.Allocate(32, 8) != a);
+    BOOST_CHECK(resource.Allocate(20, 8) == a);
+
+    // a full chunk makes room in a new one
+    for (int i = 0; i < 1024 / 64; i++)
+        resource.Allocate(64, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+
+    // too big or too strictly aligned requests don't come from the chunks
+    void *big = resource.Allocate(65, 8);
+    void *aligned = resource.Allocate(8, 16);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+    resource.Deallocate(big, 65, 8);
+    resource.Deallocate(aligned, 8, 16);
+}
+
+BOOST_AUTO_TEST_CASE(pool_allocator_map)
+{
+    typedef PoolAllocator<std::pair<const int, int>, sizeof(std::pair<const int, int>) + sizeof(void*) * 4, alignof(void*)> Allocator;
+    Allocator::ResourceType resource(4096);
+    std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, Allocator> map(0, std::hash<int>(), std::equal_to<int>(), Allocator(&resource));
+
+    for (int i = 0; i < 1000; i++)
+        map[i] = i * 2;
+    for (int i = 0; i < 1000; i += 2)
+        map.erase(i);
+    BOOST_CHECK_EQUAL(map.size(), 500U);
+    for (int i = 1; i < 1000; i += 2)
+        BOOST_CHECK_EQUAL(map[i], i * 2);
+
+    // erased nodes are reused instead of growing the pool
+    size_t nChunks = resource.NumAllocatedChunks();
+    BOOST_CHECK(nChunks > 1);
+    for (int i = 0; i < 1000; i += 2)
+        map[i] = i;
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), nChunks);
+
+    BOOST_CHECK(memusage::DynamicUsage(map) >= nChunks * 4096 + map.bucket_count() * sizeof(void*));
+}
+
+BOOST_AUTO_TEST_CASE(pool_coins_cache_flush)
+{
+    CCoinsView viewDummy;
+    CCoinsViewCache base(&viewDummy);
+    size_t nEmptyUsage = base.DynamicMemoryUsage();
+    {
+        CCoinsViewCache cache(&base);
+        for (uint32_t i = 0; i < 1000; i++)
+            cache.AddCoin(COutPoint(uint256(), i), Coin(CTxOut(1, CScript()), 1, false), false);
+        BOOST_CHECK(cache.DynamicMemoryUsage() > nEmptyUsage);
+        BOOST_CHECK(cache.Flush());
+        // the flushed cache gave back all its memory
+        BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), nEmptyUsage);
+        BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    }
+    BOOST_CHECK_EQUAL(base.GetCacheSize(), 1000U);
+    BOOST_CHECK(base.HaveCoinInCache(COutPoint(uint256(), 999)));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,7 @@
 
 #include "chain.h"
 #include "chainparams.h"
+#include "libzerocoin/bitcoin_bignum/bignum.h"
 #include "pow.h"
 #include "random.h"
 #include "util.h"
@@ -11,6 +12,8 @@
 
 #include <boost/test/unit_test.hpp>
 
+#include <vector>
+
 using namespace std;
 
 BOOST_FIXTURE_TEST_SUITE(pow_tests, BasicTestingSetup)
@@ -95,4 +98,89 @@ BOOST_AUTO_TEST_CASE(GetBlockProofEquivalentTime_test)
     }
 }
 
+// Chain of n blocks from nFirstHeight on with random block times and targets.
+static std::vector<CBlockIndex> CreateRetargetChain(int nFirstHeight, int n, std::vector<uint256>& vHashes)
+{
+    std::vector<CBlockIndex> blocks(n);
+    vHashes.resize(n);
+    arith_uint256 powLimit = ~arith_uint256(0) >> 20;
+    int64_t nTime = 1500000000;
+    for (int i = 0; i < n; i++) {
+        vHashes[i] = GetRandHash();
+        blocks[i].phashBlock = &vHashes[i];
+        blocks[i].pprev = i ? &blocks[i - 1] : NULL;
+        blocks[i].nHeight = nFirstHeight + i;
+        nTime += (int64_t)GetRand(300) - 50;
+        blocks[i].nTime = nTime;
+        arith_uint256 target = (powLimit >> GetRand(30)) - arith_uint256(GetRand(1000000));
+        blocks[i].nBits = target.GetCompact();
+    }
+    return blocks;
+}
+
+// The retarget as it was computed with signed OpenSSL bignums, without the
+// block time limits of the window.
+static unsigned int ReferenceRetarget(const CBlockIndex* pindexLast, int32_t nSpacing, uint32_t nPastBlocksMax)
+{
+    const CBlockIndex* pindex = pindexLast;
+    CBigNum bnAverage, bnAveragePrev;
+    int32_t nActualSeconds = 0, nTargetSeconds = 0;
+    for (unsigned int i = 1; pindex && pindex->nHeight > 0 && i <= nPastBlocksMax; i++) {
+        if (i == 1)
+            bnAverage.SetCompact(pindex->nBits);
+        else
+            bnAverage = ((CBigNum().SetCompact(pindex->nBits) - bnAveragePrev) / i) + bnAveragePrev;
+        bnAveragePrev = bnAverage;
+        nActualSeconds = std::max<int32_t>(pindexLast->GetBlockTime() - pindex->GetBlockTime(), 1);
+        nTargetSeconds = nSpacing * i;
+        pindex = pindex->pprev;
+    }
+
+    CBigNum bnLast = CBigNum().SetCompact(pindexLast->nBits);
+    if (bnAverage < bnLast / 2) bnAverage = bnLast / 2;
+    if (bnAverage > bnLast * 2) bnAverage = bnLast * 2;
+
+    nActualSeconds = std::min(nActualSeconds, 3 * nTargetSeconds);
+    nActualSeconds = std::max(nActualSeconds, nTargetSeconds / 3);
+    CBigNum bnNew = bnAverage * nActualSeconds / nTargetSeconds;
+    CBigNum bnLimit(ArithToUint256(~arith_uint256(0) >> 20));
+    if (bnNew > bnLimit)
+        bnNew = bnLimit;
+    return bnNew.GetCompact();
+}
+
+/* Test the retarget against the bignum computation it replaced */
+BOOST_AUTO_TEST_CASE(retarget_bignum_equivalence)
+{
+    SelectParams(CBaseChainParams::MAIN);
+
+    std::vector<uint256> vHashes;
+    std::vector<CBlockIndex> blocks = CreateRetargetChain(1, 2000, vHashes);
+
+    // A min. window larger than the max. one leaves out the block time limits.
+    for (int i = 1; i < 2000; i += 3) {
+        for (uint32_t nPastBlocksMax : {2u, 15u, 785u}) {
+            BOOST_CHECK_EQUAL(BorisRidiculouslyNamedDifficultyFunction(&blocks[i], 55, nPastBlocksMax + 1, nPastBlocksMax),
+                              ReferenceRetarget(&blocks[i], 55, nPastBlocksMax));
+        }
+    }
+}
+
+/* Test the work of repeatedly asked retarget blocks */
+BOOST_AUTO_TEST_CASE(get_next_work_cached)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = Params().GetConsensus();
+
+    std::vector<uint256> vHashes;
+    std::vector<CBlockIndex> blocks = CreateRetargetChain(100000, 1000, vHashes);
+
+    for (int i = 0; i < 1000; i++) {
+        CBlockIndex* pindex = &blocks[i];
+        unsigned int nBits = (pindex->nHeight + 1) % 10 ? pindex->nBits : BorisRidiculouslyNamedDifficultyFunction(pindex, 55, 2, 785);
+        BOOST_CHECK_EQUAL(GetNextWorkRequired(pindex, NULL, params), nBits);
+        BOOST_CHECK_EQUAL(GetNextWorkRequired(pindex, NULL, params), nBits);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -40,6 +40,10 @@ class prevector_tester {
         // BOOST_CHECK(realtype(pre_vector) == real_vector);
         BOOST_CHECK(pretype(real_vector.begin(), real_vector.end()) == pre_vector);
         BOOST_CHECK(pretype(pre_vector.begin(), pre_vector.end()) == pre_vector);
+        pretype copied(pre_vector);
+        pretype moved(std::move(copied));
+        BOOST_CHECK(moved == pre_vector);
+        BOOST_CHECK(copied.empty());
         size_t pos = 0;
         BOOST_FOREACH(const T& v, pre_vector) {
              BOOST_CHECK(v == real_vector[pos++]);
@@ -157,6 +161,20 @@ public:
         pre_vector.swap(pre_vector_alt);
         test();
     }
+
+    void move() {
+        real_vector = std::move(real_vector_alt);
+        real_vector_alt.clear();
+        pre_vector = std::move(pre_vector_alt);
+        pre_vector_alt.clear();
+        test();
+    }
+
+    void copy() {
+        real_vector = real_vector_alt;
+        pre_vector = pre_vector_alt;
+        test();
+    }
 };
 
 BOOST_AUTO_TEST_CASE(PrevectorTestInt)
@@ -221,6 +239,12 @@ BOOST_AUTO_TEST_CASE(PrevectorTestInt)
             if (((r >> 15) % 64) == 3) {
                 test.swap();
             }
+            if (((r >> 15) % 64) == 4) {
+                test.move();
+            }
+            if (((r >> 15) % 64) == 5) {
+                test.copy();
+            }
         }
     }
 }
@@ -0,0 +1,90 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "recenttxcache.h"
+
+#include "primitives/block.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(recenttxcache_tests, BasicTestingSetup)
+
+static CBlock MakeBlock(uint32_t nNonce, int nTxs)
+{
+    CBlock block;
+    block.nNonce = nNonce;
+    for (int i = 0; i < nTxs; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.n = nNonce;
+        tx.vout.resize(1);
+        tx.vout[0].nValue = i;
+        block.vtx.push_back(tx);
+    }
+    return block;
+}
+
+static void AddBlock(CRecentTxCache& cache, const CBlock& block)
+{
+    std::vector<CTransactionRef> vtx;
+    for (const CTransaction& tx : block.vtx)
+        vtx.push_back(MakeTransactionRef(tx));
+    cache.AddBlock(block.GetHash(), vtx);
+}
+
+BOOST_AUTO_TEST_CASE(recenttxcache_lookup_and_eviction)
+{
+    CRecentTxCache cache(2);
+    CBlock block1 = MakeBlock(1, 3), block2 = MakeBlock(2, 2), block3 = MakeBlock(3, 1);
+    uint256 hashBlock;
+
+    AddBlock(cache, block1);
+    AddBlock(cache, block2);
+    BOOST_CHECK_EQUAL(cache.size(), 2U);
+
+    CTransactionRef ptx = cache.Get(block1.vtx[2].GetHash(), hashBlock);
+    BOOST_CHECK(ptx && *ptx == block1.vtx[2]);
+    BOOST_CHECK(hashBlock == block1.GetHash());
+    BOOST_CHECK(!cache.Get(block3.vtx[0].GetHash(), hashBlock));
+
+    // block1 was used last, block2 gets evicted
+    AddBlock(cache, block3);
+    BOOST_CHECK_EQUAL(cache.size(), 2U);
+    BOOST_CHECK(!cache.Get(block2.vtx[0].GetHash(), hashBlock));
+    BOOST_CHECK(cache.Get(block1.vtx[0].GetHash(), hashBlock));
+    BOOST_CHECK(cache.Get(block3.vtx[0].GetHash(), hashBlock));
+    BOOST_CHECK(hashBlock == block3.GetHash());
+
+    // Disconnected blocks are gone, transactions handed out stay valid
+    ptx = cache.Get(block3.vtx[0].GetHash(), hashBlock);
+    cache.EraseBlock(block3.GetHash());
+    BOOST_CHECK_EQUAL(cache.size(), 1U);
+    BOOST_CHECK(!cache.Get(block3.vtx[0].GetHash(), hashBlock));
+    BOOST_CHECK(*ptx == block3.vtx[0]);
+
+    cache.Clear();
+    BOOST_CHECK_EQUAL(cache.size(), 0U);
+    BOOST_CHECK(!cache.Get(block1.vtx[0].GetHash(), hashBlock));
+}
+
+BOOST_AUTO_TEST_CASE(recenttxcache_duplicate_txid)
+{
+    CRecentTxCache cache(4);
+    CBlock block1 = MakeBlock(1, 1), block2 = MakeBlock(1, 1);
+    block2.nNonce = 2;
+    uint256 hashBlock;
+
+    AddBlock(cache, block1);
+    AddBlock(cache, block2);
+    BOOST_CHECK(cache.Get(block1.vtx[0].GetHash(), hashBlock));
+    BOOST_CHECK(hashBlock == block2.GetHash());
+
+    // Evicting the older block keeps the entry of the newer one
+    cache.EraseBlock(block1.GetHash());
+    BOOST_CHECK(cache.Get(block1.vtx[0].GetHash(), hashBlock));
+    BOOST_CHECK(hashBlock == block2.GetHash());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
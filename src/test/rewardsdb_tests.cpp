@@ -0,0 +1,259 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "smartrewards/rewardsdb.h"
+
+#include "random.h"
+#include "test/test_bitcoin.h"
+#include "utilmoneystr.h"
+
+#include <algorithm>
+#include <fstream>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(rewardsdb_tests, TestingSetup)
+
+static void FillRewardsDB(CSmartRewardsDB &db, const CSmartRewardEntryList &entries, const CSmartRewardRound &round)
+{
+    std::vector<const CSmartRewardEntry*> vEntries;
+    for (const CSmartRewardEntry &entry : entries)
+        vEntries.push_back(&entry);
+
+    uint256 hash = GetRandHash();
+    CSmartRewardBlockList blocks(1, CSmartRewardBlock(1, hash, 0));
+    BOOST_CHECK(db.SyncBlocks(blocks, round, vEntries, CSmartRewardTransactionList()));
+}
+
+BOOST_AUTO_TEST_CASE(rewardsdb_evaluate_round_resume)
+{
+    CSmartRewardEntryList entries;
+    for (int i = 0; i < 50; i++) {
+        uint256 hash = GetRandHash();
+        CSmartRewardEntry entry(CSmartAddress(CKeyID(uint160(std::vector<unsigned char>(hash.begin(), hash.begin() + 20)))));
+        entry.balanceOnStart = (i + 1) * 100 * COIN;
+        entry.balance = entry.balanceOnStart + (i % 3) * 500 * COIN;
+        entry.eligible = entry.balanceOnStart >= SMART_REWARDS_MIN_BALANCE && i % 5;
+        entries.push_back(entry);
+    }
+
+    CSmartRewardRound current;
+    current.number = 1;
+    current.percent = 0.01;
+
+    CSmartRewardRound next;
+    next.number = 2;
+
+    // Evaluated without interruption
+    CSmartRewardsDB dbComplete(1 << 20, true, true);
+    FillRewardsDB(dbComplete, entries, current);
+    CSmartRewardRound nextComplete = next;
+    CSmartRewardSnapshotList payoutsComplete;
+    BOOST_CHECK(dbComplete.EvaluateRound(current, nextComplete, payoutsComplete));
+    BOOST_CHECK(nextComplete.eligibleEntries > 0);
+    BOOST_CHECK(!payoutsComplete.empty());
+
+    // Interrupted once all entries were written but before the round got finalized
+    CSmartRewardsDB db(1 << 20, true, true);
+    FillRewardsDB(db, entries, current);
+    CSmartRewardRound currentRead, nextRead;
+    BOOST_CHECK(!db.ReadEvaluatingRound(currentRead, nextRead));
+
+    CSmartRewardRound nextInterrupted = next;
+    CSmartRewardSnapshotList payouts;
+    BOOST_CHECK(db.EvaluateRound(current, nextInterrupted, payouts));
+    BOOST_CHECK(db.ReadEvaluatingRound(currentRead, nextRead));
+    BOOST_CHECK_EQUAL(currentRead.number, current.number);
+    BOOST_CHECK_EQUAL(nextRead.number, next.number);
+    BOOST_CHECK_EQUAL(nextRead.eligibleEntries, 0);
+
+    // Continuing from the record doesn't evaluate the entries again
+    payouts.clear();
+    BOOST_CHECK(db.EvaluateRound(currentRead, nextRead, payouts));
+    BOOST_CHECK_EQUAL(nextRead.eligibleEntries, nextComplete.eligibleEntries);
+    BOOST_CHECK_EQUAL(nextRead.eligibleSmart, nextComplete.eligibleSmart);
+
+    std::sort(payouts.begin(), payouts.end());
+    std::sort(payoutsComplete.begin(), payoutsComplete.end());
+    BOOST_CHECK_EQUAL(payouts.size(), payoutsComplete.size());
+    for (size_t i = 0; i < std::min(payouts.size(), payoutsComplete.size()); i++) {
+        BOOST_CHECK(payouts[i].id == payoutsComplete[i].id);
+        BOOST_CHECK_EQUAL(payouts[i].reward, payoutsComplete[i].reward);
+    }
+
+    BOOST_CHECK(db.FinalizeRound(currentRead, nextRead));
+    BOOST_CHECK(!db.ReadEvaluatingRound(currentRead, nextRead));
+}
+
+BOOST_AUTO_TEST_CASE(rewardsdb_evaluate_round_parallel)
+{
+    // Enough entries for a chunk to get evaluated on several threads
+    CSmartRewardEntryList entries;
+    int64_t nEligible = 0;
+    CAmount nEligibleSmart = 0;
+    for (size_t i = 0; i < 3 * nRewardsEvaluatePerThread; i++) {
+        uint256 hash = GetRandHash();
+        CSmartRewardEntry entry(CSmartAddress(CKeyID(uint160(std::vector<unsigned char>(hash.begin(), hash.begin() + 20)))));
+        entry.balanceOnStart = (i % 7) * 500 * COIN;
+        entry.balance = (i % 11) * 300 * COIN + 1;
+        entry.eligible = entry.balanceOnStart >= SMART_REWARDS_MIN_BALANCE;
+        entries.push_back(entry);
+        if (entry.balance >= SMART_REWARDS_MIN_BALANCE) {
+            nEligible++;
+            nEligibleSmart += entry.balance;
+        }
+    }
+
+    CSmartRewardRound current;
+    current.number = 1;
+    current.percent = 0.01;
+
+    CSmartRewardRound next;
+    next.number = 2;
+
+    CSmartRewardsDB db(1 << 20, true, true);
+    FillRewardsDB(db, entries, current);
+    CSmartRewardSnapshotList payouts;
+    BOOST_CHECK(db.EvaluateRound(current, next, payouts));
+    BOOST_CHECK_EQUAL(next.eligibleEntries, nEligible);
+    BOOST_CHECK_EQUAL(next.eligibleSmart, nEligibleSmart);
+
+    // Every entry eligible in the evaluated round gets paid
+    size_t nPaid = 0;
+    for (const CSmartRewardEntry &entry : entries)
+        if (entry.eligible)
+            nPaid++;
+    BOOST_CHECK_EQUAL(payouts.size(), nPaid);
+
+    // The entries carry their balance over to the start of the next round
+    CSmartRewardEntry entry;
+    BOOST_CHECK(db.ReadRewardEntry(entries[0].id, entry));
+    BOOST_CHECK_EQUAL(entry.balanceOnStart, entries[0].balance);
+}
+
+BOOST_AUTO_TEST_CASE(rewardsdb_entry_cache_trim)
+{
+    CSmartRewardEntryCache cache(1000);
+    std::vector<CSmartAddress> ids;
+    for (int i = 0; i < 100; i++) {
+        uint256 hash = GetRandHash();
+        CSmartRewardEntry entry(CSmartAddress(CKeyID(uint160(std::vector<unsigned char>(hash.begin(), hash.begin() + 20)))));
+        entry.balance = (i + 1) * COIN;
+        ids.push_back(entry.id);
+        BOOST_CHECK(cache.Add(entry));
+    }
+    cache.Flushed();
+
+    // The first ten were used last
+    for (int i = 9; i >= 0; i--)
+        BOOST_CHECK(cache.Find(ids[i]));
+
+    // One dirty entry stays whatever the trim asks for
+    CSmartRewardEntry *pentry = cache.Modify(ids[50]);
+    BOOST_CHECK(pentry);
+    pentry->balance = 1000 * COIN;
+
+    size_t nUsage = cache.DynamicMemoryUsage();
+    cache.Trim(11);
+    BOOST_CHECK_EQUAL(cache.size(), 11);
+    BOOST_CHECK(cache.DynamicMemoryUsage() < nUsage / 5);
+    for (int i = 0; i < 10; i++) {
+        const CSmartRewardEntry *pfound = cache.Peek(ids[i]);
+        BOOST_CHECK(pfound && pfound->balance == (i + 1) * COIN);
+    }
+    BOOST_CHECK_EQUAL(cache.GetDirtyCount(), 1);
+    BOOST_CHECK(cache.Peek(ids[50]) && cache.Peek(ids[50])->balance == 1000 * COIN);
+
+    cache.Trim(0);
+    BOOST_CHECK_EQUAL(cache.size(), 1);
+
+    // The moved slots still work with the LRU order and the flush
+    cache.Flushed();
+    BOOST_CHECK(cache.Find(ids[50]));
+    cache.SetMaxEntries(0);
+    BOOST_CHECK_EQUAL(cache.size(), 0);
+}
+
+static std::vector<std::string> ReadLines(const boost::filesystem::path &path)
+{
+    std::vector<std::string> vLines;
+    std::ifstream file(path.string().c_str());
+    std::string strLine;
+    while (std::getline(file, strLine))
+        vLines.push_back(strLine);
+    return vLines;
+}
+
+BOOST_AUTO_TEST_CASE(rewardsdb_export_csv)
+{
+    // Enough entries for the lines of a chunk to get formatted on several threads
+    CSmartRewardEntryList entries;
+    for (size_t i = 0; i < 3 * nRewardsEvaluatePerThread; i++) {
+        uint256 hash = GetRandHash();
+        CSmartRewardEntry entry(CSmartAddress(CKeyID(uint160(std::vector<unsigned char>(hash.begin(), hash.begin() + 20)))));
+        entry.balanceOnStart = (i % 7) * 500 * COIN;
+        entry.balance = (i % 11) * 300 * COIN + 1;
+        entry.eligible = entry.balanceOnStart >= SMART_REWARDS_MIN_BALANCE;
+        entries.push_back(entry);
+    }
+
+    CSmartRewardRound current;
+    current.number = 1;
+    current.percent = 0.01;
+
+    CSmartRewardsDB db(1 << 20, true, true);
+    FillRewardsDB(db, entries, current);
+
+    boost::filesystem::path path = pathTemp / "entries.csv";
+    uint64_t nRecords = 0;
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    BOOST_CHECK(CSmartRewardsDB::ExportCSV(*pcursor, 0, path, nRecords));
+    BOOST_CHECK_EQUAL(nRecords, entries.size());
+    BOOST_CHECK(!boost::filesystem::exists(path.string() + ".incomplete"));
+
+    // One line per entry in key order, the order of the addresses doesn't matter here
+    std::vector<std::string> vLines = ReadLines(path);
+    BOOST_CHECK_EQUAL(vLines.size(), entries.size() + 1);
+    BOOST_CHECK_EQUAL(vLines[0], "address,balance,balance_on_start,eligible");
+    std::sort(vLines.begin() + 1, vLines.end());
+    for (const CSmartRewardEntry &entry : entries) {
+        std::string strLine = strprintf("%s,%s,%s,%d", entry.id.ToString(), FormatMoney(entry.balance), FormatMoney(entry.balanceOnStart), entry.eligible);
+        BOOST_CHECK(std::binary_search(vLines.begin() + 1, vLines.end(), strLine));
+    }
+
+    // The snapshots of the evaluated round
+    CSmartRewardRound next;
+    next.number = 2;
+    CSmartRewardSnapshotList payouts;
+    BOOST_CHECK(db.EvaluateRound(current, next, payouts));
+
+    path = pathTemp / "round1.csv";
+    pcursor.reset(db.NewIterator());
+    BOOST_CHECK(CSmartRewardsDB::ExportCSV(*pcursor, 1, path, nRecords));
+    BOOST_CHECK_EQUAL(nRecords, entries.size());
+
+    vLines = ReadLines(path);
+    BOOST_CHECK_EQUAL(vLines.size(), entries.size() + 1);
+    BOOST_CHECK_EQUAL(vLines[0], "address,balance,reward");
+    std::sort(vLines.begin() + 1, vLines.end());
+    for (const CSmartRewardSnapshot &payout : payouts) {
+        std::string strPrefix = payout.id.ToString() + ",";
+        std::vector<std::string>::const_iterator it = std::lower_bound(vLines.begin() + 1, vLines.end(), strPrefix);
+        BOOST_CHECK(it != vLines.end() && it->compare(0, strPrefix.size(), strPrefix) == 0);
+        if (it != vLines.end())
+            BOOST_CHECK(it->substr(it->rfind(',') + 1) == FormatMoney(payout.reward));
+    }
+
+    // A round without snapshots gives just the header
+    path = pathTemp / "round2.csv";
+    pcursor.reset(db.NewIterator());
+    BOOST_CHECK(CSmartRewardsDB::ExportCSV(*pcursor, 2, path, nRecords));
+    BOOST_CHECK_EQUAL(nRecords, 0);
+    BOOST_CHECK_EQUAL(ReadLines(path).size(), 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,90 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "smartrewards/rewardssnapshotfile.h"
+
+#include "random.h"
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(rewardssnapshotfile_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(rewardssnapshotfile_roundtrip)
+{
+    boost::filesystem::path path = pathTemp / "round1.dat";
+
+    std::vector<CSmartAddress> vAddresses;
+    std::vector<CSmartRewardSnapshotFile::Record> vRecords;
+
+    for (int i = 0; i < 100; i++) {
+        uint256 hash = GetRandHash();
+        uint160 hash160(std::vector<unsigned char>(hash.begin(), hash.begin() + 20));
+
+        CSmartAddress id;
+        if (i % 4 == 0)
+            id.Set(CScriptID(hash160));
+        else
+            id.Set(CKeyID(hash160));
+
+        CSmartRewardSnapshotFile::Record record;
+        BOOST_CHECK(CSmartRewardSnapshotFile::GetKey(id, record.key));
+        record.balance = (i + 1) * COIN;
+        record.reward = i % 3 ? i * COIN / 10 : 0;
+
+        vAddresses.push_back(id);
+        vRecords.push_back(record);
+    }
+
+    std::vector<CSmartRewardSnapshotFile::Record> vWrite = vRecords;
+    BOOST_CHECK(CSmartRewardSnapshotFile::Write(path, 1, vWrite));
+    BOOST_CHECK(!boost::filesystem::exists(path.string() + ".new"));
+
+    CSmartRewardSnapshotFile file;
+    BOOST_CHECK(file.Open(path, true));
+    BOOST_CHECK_EQUAL(file.GetRound(), 1U);
+    BOOST_CHECK_EQUAL(file.size(), vRecords.size());
+
+    for (size_t i = 0; i < vAddresses.size(); i++) {
+        CSmartRewardSnapshot snapshot;
+        BOOST_CHECK(file.Find(vAddresses[i], snapshot));
+        BOOST_CHECK(snapshot.id == vAddresses[i]);
+        BOOST_CHECK_EQUAL(snapshot.balance, vRecords[i].balance);
+        BOOST_CHECK_EQUAL(snapshot.reward, vRecords[i].reward);
+    }
+
+    // positions follow address order and the paid bits follow the rewards
+    for (uint64_t n = 0; n < file.size(); n++) {
+        CSmartRewardSnapshot snapshot;
+        file.Get(n, snapshot);
+        BOOST_CHECK_EQUAL(file.IsPaid(n), snapshot.reward != 0);
+    }
+
+    CSmartAddress unknown;
+    unknown.Set(CKeyID(uint160()));
+    CSmartRewardSnapshot snapshot;
+    BOOST_CHECK(!file.Find(unknown, snapshot));
+
+    file.Close();
+    BOOST_CHECK(!file.IsOpen());
+
+    // flip a byte in the balance column, only a verified open notices
+    FILE* f = fopen(path.string().c_str(), "r+b");
+    BOOST_CHECK(f);
+    fseek(f, 24 + vRecords.size() * SNAPSHOT_FILE_KEY_SIZE, SEEK_SET);
+    fputc(0xff, f);
+    fclose(f);
+
+    BOOST_CHECK(file.Open(path, false));
+    BOOST_CHECK(!file.Open(path, true));
+
+    // truncated files are rejected by their size
+    boost::filesystem::resize_file(path, boost::filesystem::file_size(path) - 1);
+    BOOST_CHECK(!file.Open(path, false));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -7,6 +7,9 @@
 
 #include "base58.h"
 #include "netbase.h"
+#include "sync.h"
+#include "validation.h"
+#include "utiltime.h"
 
 #include "test/test_bitcoin.h"
 
@@ -16,6 +19,9 @@
 
 #include <univalue.h>
 
+#include <atomic>
+#include <thread>
+
 using namespace std;
 
 UniValue
@@ -309,6 +315,59 @@ BOOST_AUTO_TEST_CASE(rpc_ban)
     BOOST_CHECK_EQUAL(adr.get_str(), "2001:4d48:ac57:400:cacf:e9ff:fe1d:9c63/128");
 }
 
+static std::atomic<int> nBatchRunning(0);
+static std::atomic<int> nBatchMaxRunning(0);
+
+static UniValue batchecho(const UniValue& params, bool fHelp)
+{
+    int nRunning = ++nBatchRunning;
+    int nMax = nBatchMaxRunning;
+    while (nRunning > nMax && !nBatchMaxRunning.compare_exchange_weak(nMax, nRunning)) {}
+    MilliSleep(params[0].get_int() % 3);
+    nBatchRunning--;
+    return params[0];
+}
+
+static const CRPCCommand vBatchTestCommands[] =
+{ //  category              name                      actor (function)         okSafeMode okParallelBatch
+  //  --------------------- ------------------------  -----------------------  ---------- ---------------
+    { "test",               "batchecho",              &batchecho,              true,      true  },
+    { "test",               "batchechoserial",        &batchecho,              true,      false },
+};
+
+BOOST_AUTO_TEST_CASE(rpc_batch_order)
+{
+    SetRPCWarmupFinished();
+    for (const CRPCCommand& cmd : vBatchTestCommands)
+        tableRPC.appendCommand(cmd.name, &cmd);
+
+    // Runs of parallel items split by a serial item and by one that fails
+    UniValue vReq(UniValue::VARR);
+    for (int i = 0; i < 40; i++) {
+        UniValue params(UniValue::VARR);
+        params.push_back(i);
+        UniValue req(UniValue::VOBJ);
+        req.push_back(Pair("id", i));
+        req.push_back(Pair("method", i == 20 ? "nosuchmethod" : i == 30 ? "batchechoserial" : "batchecho"));
+        req.push_back(Pair("params", params));
+        vReq.push_back(req);
+    }
+
+    UniValue ret;
+    BOOST_CHECK(ret.read(JSONRPCExecBatch(vReq)));
+    BOOST_CHECK_EQUAL(ret.size(), vReq.size());
+    for (int i = 0; i < 40; i++) {
+        BOOST_CHECK_EQUAL(find_value(ret[i], "id").get_int(), i);
+        if (i == 20) {
+            BOOST_CHECK_EQUAL(find_value(find_value(ret[i], "error"), "code").get_int(), RPC_METHOD_NOT_FOUND);
+        } else {
+            BOOST_CHECK(find_value(ret[i], "error").isNull());
+            BOOST_CHECK_EQUAL(find_value(ret[i], "result").get_int(), i);
+        }
+    }
+    BOOST_CHECK(nBatchMaxRunning <= DEFAULT_RPC_BATCH_THREADS);
+}
+
 BOOST_AUTO_TEST_CASE(rpc_convert_values_generatetoaddress)
 {
     UniValue result;
@@ -332,4 +391,100 @@ BOOST_AUTO_TEST_CASE(rpc_convert_values_generatetoaddress)
     BOOST_CHECK_EQUAL(result[2].get_int(), 9);
 }
 
+BOOST_AUTO_TEST_CASE(rpc_stats)
+{
+    if (RPCIsInWarmup(NULL))
+        SetRPCWarmupFinished();
+
+    UniValue reset(UniValue::VARR);
+    reset.push_back(true);
+    tableRPC.execute("getrpcstats", reset);
+
+    // Two calls and one failing with too many parameters
+    UniValue none(UniValue::VARR);
+    tableRPC.execute("getrpcstats", none);
+    tableRPC.execute("getrpcstats", none);
+    UniValue tooMany(UniValue::VARR);
+    tooMany.push_back(false);
+    tooMany.push_back(false);
+    BOOST_CHECK_THROW(tableRPC.execute("getrpcstats", tooMany), UniValue);
+    RPCRecordResponseSize("getrpcstats", 100);
+    RPCRecordResponseSize("nosuchmethod", 100);
+
+    UniValue stats = tableRPC.execute("getrpcstats", none);
+    BOOST_CHECK(find_value(stats, "nosuchmethod").isNull());
+    const UniValue& method = find_value(stats, "getrpcstats");
+    BOOST_CHECK_EQUAL(find_value(method, "calls").get_int(), 4);
+    BOOST_CHECK_EQUAL(find_value(method, "errors").get_int(), 1);
+    BOOST_CHECK_EQUAL(find_value(method, "response_max_bytes").get_int(), 100);
+    BOOST_CHECK(find_value(method, "p50_ms").get_real() <= find_value(method, "p99_ms").get_real());
+    BOOST_CHECK(find_value(method, "p99_ms").get_real() <= find_value(method, "max_ms").get_real());
+}
+
+BOOST_AUTO_TEST_CASE(rpc_lockwait)
+{
+    // A lock held by another thread is waited for, and the wait is counted
+    CLockWaitStats stats;
+    std::atomic<bool> fLocked(false);
+    std::thread holder([&fLocked] {
+        LOCK(cs_main);
+        fLocked = true;
+        MilliSleep(50);
+    });
+    while (!fLocked)
+        MilliSleep(1);
+    {
+        CLockWaitScope scope(stats);
+        BOOST_CHECK(GetLockWaitStats() == &stats);
+        LOCK(cs_main);
+    }
+    holder.join();
+    BOOST_CHECK(GetLockWaitStats() == NULL);
+    BOOST_CHECK(stats.nWaitMain > 0);
+    BOOST_CHECK_EQUAL(stats.nWaitWallet, 0);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_lockstats)
+{
+    if (RPCIsInWarmup(NULL))
+        SetRPCWarmupFinished();
+
+    UniValue reset(UniValue::VARR);
+    reset.push_back(true);
+    reset.push_back(1);
+    tableRPC.execute("getlockstats", reset);
+
+    // Every acquisition gets sampled at a rate of 1, a recursive one as well
+    CCriticalSection csLockStatsTest;
+    {
+        LOCK(csLockStatsTest);
+        LOCK(csLockStatsTest);
+        MilliSleep(2);
+    }
+
+    UniValue stop(UniValue::VARR);
+    stop.push_back(true);
+    stop.push_back(0);
+    UniValue stats = tableRPC.execute("getlockstats", stop);
+    BOOST_CHECK_EQUAL(find_value(stats, "rate").get_int(), 0);
+    const UniValue& lock = find_value(find_value(stats, "locks"), "csLockStatsTest");
+    BOOST_CHECK_EQUAL(find_value(lock, "samples").get_int(), 2);
+    BOOST_CHECK_EQUAL(find_value(lock, "contended").get_int(), 0);
+    BOOST_CHECK(find_value(lock, "max_hold_ms").get_real() >= 2);
+    BOOST_CHECK(find_value(lock, "hold_ms").get_real() >= find_value(lock, "max_hold_ms").get_real());
+
+    // Sampling stopped and the statistics were cleared
+    {
+        LOCK(csLockStatsTest);
+    }
+    UniValue none(UniValue::VARR);
+    stats = tableRPC.execute("getlockstats", none);
+    BOOST_CHECK(find_value(find_value(stats, "locks"), "csLockStatsTest").isNull());
+
+    UniValue negative(UniValue::VARR);
+    negative.push_back(false);
+    negative.push_back(-1);
+    BOOST_CHECK_THROW(tableRPC.execute("getlockstats", negative), UniValue);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
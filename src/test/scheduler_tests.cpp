@@ -116,4 +116,75 @@ BOOST_AUTO_TEST_CASE(manythreads)
     BOOST_CHECK_EQUAL(counterSum, 200);
 }
 
+static void pushTask(std::vector<std::string>& vOrder, const std::string& strName)
+{
+    vOrder.push_back(strName);
+}
+
+static void countTask(CScheduler& s, int& counter, const CScheduler::TaskId& id, int nCancelAt)
+{
+    if (++counter == nCancelAt)
+        BOOST_CHECK(s.cancel(id));
+}
+
+BOOST_AUTO_TEST_CASE(scheduler_priorities)
+{
+    CScheduler scheduler;
+    std::vector<std::string> vOrder;
+
+    // All of them are due once the thread starts, the earliest one has the lowest priority
+    boost::chrono::system_clock::time_point past = boost::chrono::system_clock::now() - boost::chrono::seconds(10);
+    scheduler.schedule(boost::bind(&pushTask, boost::ref(vOrder), "low"), past, "low", CScheduler::PRIORITY_LOW);
+    scheduler.schedule(boost::bind(&pushTask, boost::ref(vOrder), "normal1"), past + boost::chrono::seconds(1), "normal");
+    scheduler.schedule(boost::bind(&pushTask, boost::ref(vOrder), "high"), past + boost::chrono::seconds(2), "high", CScheduler::PRIORITY_HIGH);
+    scheduler.schedule(boost::bind(&pushTask, boost::ref(vOrder), "normal2"), past + boost::chrono::seconds(3), "normal");
+
+    scheduler.stop(true);
+    boost::thread thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+    thread.join();
+
+    BOOST_CHECK_EQUAL(vOrder.size(), 4U);
+    BOOST_CHECK_EQUAL(vOrder[0], "high");
+    BOOST_CHECK_EQUAL(vOrder[1], "normal1");
+    BOOST_CHECK_EQUAL(vOrder[2], "normal2");
+    BOOST_CHECK_EQUAL(vOrder[3], "low");
+
+    std::map<std::string, CScheduler::TaskStats> mapStats;
+    BOOST_CHECK_EQUAL(scheduler.getTaskStats(mapStats), 0);
+    BOOST_CHECK_EQUAL(mapStats.size(), 3U);
+    BOOST_CHECK_EQUAL(mapStats["normal"].nRuns, 2U);
+    BOOST_CHECK_EQUAL(mapStats["high"].nRuns, 1U);
+    BOOST_CHECK(mapStats["low"].nMaxLateMicros >= 10000000);
+}
+
+BOOST_AUTO_TEST_CASE(scheduler_cancel)
+{
+    CScheduler scheduler;
+    std::vector<std::string> vOrder;
+
+    CScheduler::TaskId id1 = scheduler.scheduleFromNow(boost::bind(&pushTask, boost::ref(vOrder), "first"), 0);
+    CScheduler::TaskId id2 = scheduler.scheduleFromNow(boost::bind(&pushTask, boost::ref(vOrder), "second"), 0);
+    BOOST_CHECK(id1 != id2);
+    BOOST_CHECK(scheduler.cancel(id1));
+    BOOST_CHECK(!scheduler.cancel(id1));
+
+    // A repeating task that cancels itself on its third run isn't scheduled again
+    int counter = 0;
+    CScheduler::TaskId idEvery = 0;
+    idEvery = scheduler.scheduleEvery(boost::bind(&countTask, boost::ref(scheduler), boost::ref(counter), boost::cref(idEvery), 3), 0);
+
+    boost::chrono::system_clock::time_point first, last;
+    BOOST_CHECK_EQUAL(scheduler.getQueueInfo(first, last), 2U);
+
+    scheduler.stop(true);
+    boost::thread thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+    thread.join();
+
+    BOOST_CHECK_EQUAL(vOrder.size(), 1U);
+    BOOST_CHECK_EQUAL(vOrder[0], "second");
+    BOOST_CHECK_EQUAL(counter, 3);
+    BOOST_CHECK_EQUAL(scheduler.getQueueInfo(first, last), 0U);
+    BOOST_CHECK(!scheduler.cancel(idEvery));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
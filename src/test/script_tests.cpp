@@ -1443,4 +1443,50 @@ BOOST_AUTO_TEST_CASE(script_FindAndDelete)
     BOOST_CHECK(s == expect);
 }
 
+#if defined(HAVE_CONSENSUS_LIB)
+BOOST_AUTO_TEST_CASE(script_consensus_verify_transaction)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(5);
+    tx.vout.resize(1);
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        tx.vin[i].prevout = COutPoint(GetRandHash(), i);
+        tx.vin[i].scriptSig = CScript() << OP_1;
+    }
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << tx;
+
+    // every input leaves OP_1 on the stack, the fourth output drops it again
+    CScript scriptTrue, scriptFalse = CScript() << OP_DROP << OP_0;
+    std::vector<smartcashconsensus_spent_output> vOutputs(tx.vin.size());
+    for (unsigned int i = 0; i < vOutputs.size(); i++) {
+        const CScript& script = i == 3 ? scriptFalse : scriptTrue;
+        vOutputs[i].scriptPubKey = begin_ptr(script);
+        vOutputs[i].scriptPubKeyLen = script.size();
+        vOutputs[i].amount = 0;
+    }
+
+    for (unsigned int nThreads : {0, 1, 2, 8}) {
+        std::vector<int> vResults(tx.vin.size(), -1);
+        smartcashconsensus_error err;
+        BOOST_CHECK_EQUAL(smartcashconsensus_verify_transaction((const unsigned char*)&stream[0], stream.size(), &vOutputs[0], vOutputs.size(),
+                                                                0, nThreads, &vResults[0], &err), 0);
+        BOOST_CHECK_EQUAL(err, smartcashconsensus_ERR_OK);
+        for (unsigned int i = 0; i < vResults.size(); i++)
+            BOOST_CHECK_EQUAL(vResults[i], i == 3 ? 0 : 1);
+    }
+
+    vOutputs[3].scriptPubKey = begin_ptr(scriptTrue);
+    vOutputs[3].scriptPubKeyLen = scriptTrue.size();
+    BOOST_CHECK_EQUAL(smartcashconsensus_verify_transaction((const unsigned char*)&stream[0], stream.size(), &vOutputs[0], vOutputs.size(),
+                                                            0, 2, NULL, NULL), 1);
+
+    // one spent output per input is required
+    smartcashconsensus_error err;
+    BOOST_CHECK_EQUAL(smartcashconsensus_verify_transaction((const unsigned char*)&stream[0], stream.size(), &vOutputs[0], vOutputs.size() - 1,
+                                                            0, 2, NULL, &err), 0);
+    BOOST_CHECK_EQUAL(err, smartcashconsensus_ERR_SPENT_OUTPUTS_MISMATCH);
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -5,6 +5,9 @@
 #include "serialize.h"
 #include "streams.h"
 #include "hash.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "smartrewards/rewardsdb.h"
 #include "test/test_bitcoin.h"
 
 #include <stdint.h>
@@ -297,4 +300,59 @@ BOOST_AUTO_TEST_CASE(insert_delete)
     BOOST_CHECK_EQUAL(ss.size(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(fixed_size_types)
+{
+    CBlockHeader header;
+    header.nVersion = 0x01020304;
+    header.hashPrevBlock = GetRandHash();
+    header.hashMerkleRoot = GetRandHash();
+    header.nTime = 0x05060708;
+    header.nBits = 0x1d00ffff;
+    header.nNonce = 0xdeadbeef;
+
+    // The header in one go serializes as its fields one by one do
+    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+    ssHeader << header;
+    CDataStream ssFields(SER_NETWORK, PROTOCOL_VERSION);
+    ssFields << header.nVersion << header.hashPrevBlock << header.hashMerkleRoot << header.nTime << header.nBits << header.nNonce;
+    BOOST_CHECK(ssHeader.str() == ssFields.str());
+    BOOST_CHECK(ssHeader.size() == CBlockHeader::SERIALIZED_SIZE);
+    BOOST_CHECK(GetSerializeSize(header, SER_NETWORK, PROTOCOL_VERSION) == ssHeader.size());
+
+    CHashWriter hwHeader(SER_GETHASH, PROTOCOL_VERSION), hwFields(SER_GETHASH, PROTOCOL_VERSION);
+    hwHeader << header;
+    hwFields << header.nVersion << header.hashPrevBlock << header.hashMerkleRoot << header.nTime << header.nBits << header.nNonce;
+    BOOST_CHECK(hwHeader.GetHash() == hwFields.GetHash());
+
+    CBlockHeader headerRead;
+    ssHeader >> headerRead;
+    BOOST_CHECK(headerRead.GetHash() == header.GetHash());
+    BOOST_CHECK_EQUAL(headerRead.nNonce, header.nNonce);
+
+    COutPoint outpoint(GetRandHash(), 0x11223344);
+    CDataStream ssOutPoint(SER_DISK, CLIENT_VERSION);
+    ssOutPoint << outpoint;
+    ssFields.clear();
+    ssFields << outpoint.hash << outpoint.n;
+    BOOST_CHECK(ssOutPoint.str() == ssFields.str());
+    BOOST_CHECK(ssOutPoint.size() == COutPoint::SERIALIZED_SIZE);
+    BOOST_CHECK(GetSerializeSize(outpoint, SER_DISK, CLIENT_VERSION) == ssOutPoint.size());
+    COutPoint outpointRead;
+    ssOutPoint >> outpointRead;
+    BOOST_CHECK(outpointRead == outpoint);
+
+    uint256 hash = GetRandHash();
+    CSmartRewardBlock block(12345, hash, 1500000000);
+    CDataStream ssBlock(SER_DISK, CLIENT_VERSION);
+    ssBlock << block;
+    BOOST_CHECK(ssBlock.size() == CSmartRewardBlock::SERIALIZED_SIZE);
+    BOOST_CHECK(GetSerializeSize(block, SER_DISK, CLIENT_VERSION) == ssBlock.size());
+
+    // Truncated data throws rather than reading past the end
+    ssFields.clear();
+    ssFields << header;
+    CDataStream ssShort(ssFields.begin(), ssFields.end() - 1, SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK_THROW(ssShort >> headerRead, std::ios_base::failure);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
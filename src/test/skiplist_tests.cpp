@@ -7,6 +7,7 @@
 #include "util.h"
 #include "test/test_bitcoin.h"
 
+#include <algorithm>
 #include <vector>
 
 #include <boost/test/unit_test.hpp>
@@ -44,6 +45,34 @@ BOOST_AUTO_TEST_CASE(skiplist_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(versioncount_test)
+{
+    std::vector<CBlockIndex> vIndex(5000);
+
+    for (unsigned int i=0; i<vIndex.size(); i++) {
+        vIndex[i].nHeight = i;
+        vIndex[i].nVersion = (i < 1000) ? 1 + insecure_rand() % 4 : (insecure_rand() % 2 ? 4 : 0x20000000 + insecure_rand() % 8);
+        vIndex[i].pprev = (i == 0) ? NULL : &vIndex[i - 1];
+        vIndex[i].BuildSkip();
+        vIndex[i].BuildVersionCounts();
+    }
+
+    const int32_t versions[] = { 1, 2, 3, 4, 5, 0x20000000, 0x20000004 };
+    for (int i=0; i < 1000; i++) {
+        const CBlockIndex* pindex = &vIndex[insecure_rand() % vIndex.size()];
+        int32_t nMinVersion = versions[insecure_rand() % 7];
+        int nWindow = 1 + insecure_rand() % 1500;
+
+        int nExpected = 0;
+        const CBlockIndex* pwalk = pindex;
+        for (int j = 0; j < nWindow && pwalk != NULL; j++, pwalk = pwalk->pprev) {
+            if (pwalk->nVersion >= nMinVersion)
+                nExpected++;
+        }
+        BOOST_CHECK_EQUAL(CountBlocksAtVersion(pindex, nMinVersion, nWindow), nExpected);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(getlocator_test)
 {
     // Build a main chain 100000 blocks long.
@@ -98,6 +127,68 @@ BOOST_AUTO_TEST_CASE(getlocator_test)
             dist *= 2;
         }
     }
+
+    // The fork found with skips is the one a walk back block by block finds.
+    for (int n=0; n<100; n++) {
+        int r = insecure_rand() % 150000;
+        CBlockIndex* tip = (r < 100000) ? &vBlocksMain[r] : &vBlocksSide[r - 100000];
+        const CBlockIndex* pindexWalk = tip;
+        while (!chain.Contains(pindexWalk))
+            pindexWalk = pindexWalk->pprev;
+        BOOST_CHECK(chain.FindFork(tip) == pindexWalk);
+    }
+
+    // The tip locator is shared until the tip changes.
+    std::shared_ptr<const CBlockLocator> tipLocator = chain.GetTipLocator();
+    BOOST_CHECK(chain.GetTipLocator() == tipLocator);
+    BOOST_CHECK(chain.GetLocator().vHave == tipLocator->vHave);
+    BOOST_CHECK(tipLocator->vHave.front() == vBlocksMain.back().GetBlockHash());
+    chain.SetTip(&vBlocksSide.back());
+    BOOST_CHECK(chain.GetTipLocator() != tipLocator);
+    BOOST_CHECK(chain.GetLocator().vHave.front() == vBlocksSide.back().GetBlockHash());
+    BOOST_CHECK(chain.GetLocator().vHave.back() == vBlocksMain[0].GetBlockHash());
+}
+
+BOOST_AUTO_TEST_CASE(blockindexstore_test)
+{
+    CBlockIndexStore store;
+    const int nChain = 3 * CBlockIndexStore::HEIGHT_CHUNK_SIZE + 10;
+
+    // A chain allocated in random order still ends up in height order
+    std::vector<int> vOrder(nChain);
+    for (int i = 0; i < nChain; i++)
+        vOrder[i] = i;
+    std::random_shuffle(vOrder.begin(), vOrder.end(), [](int n) { return insecure_rand() % n; });
+    std::vector<CBlockIndex*> vChain(nChain);
+    for (int nHeight : vOrder) {
+        vChain[nHeight] = store.Allocate(nHeight);
+        BOOST_CHECK(vChain[nHeight]->pprev == NULL && vChain[nHeight]->nHeight == 0);
+        vChain[nHeight]->nHeight = nHeight;
+    }
+    for (int i = 1; i < nChain; i++) {
+        if (i % CBlockIndexStore::HEIGHT_CHUNK_SIZE)
+            BOOST_CHECK(vChain[i] == vChain[i - 1] + 1);
+    }
+
+    // Forks get entries of their own
+    std::vector<CBlockIndex*> vFork;
+    for (int i = 0; i < CBlockIndexStore::OVERFLOW_CHUNK_SIZE + 1; i++) {
+        vFork.push_back(store.Allocate(nChain / 2));
+        vFork.back()->nHeight = -1;
+    }
+    vFork.push_back(store.Allocate(-5));
+    for (int i = 0; i < nChain; i++)
+        BOOST_CHECK_EQUAL(vChain[i]->nHeight, i);
+    std::sort(vFork.begin(), vFork.end());
+    BOOST_CHECK(std::unique(vFork.begin(), vFork.end()) == vFork.end());
+    BOOST_CHECK(std::find(vFork.begin(), vFork.end(), vChain[nChain / 2]) == vFork.end());
+    BOOST_CHECK_EQUAL(store.size(), nChain + vFork.size());
+    BOOST_CHECK(store.DynamicMemoryUsage() >= store.size() * sizeof(CBlockIndex));
+
+    store.Clear();
+    BOOST_CHECK_EQUAL(store.size(), 0U);
+    CBlockIndex* pindex = store.Allocate(7);
+    BOOST_CHECK(pindex->phashBlock == NULL && pindex->nHeight == 0);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
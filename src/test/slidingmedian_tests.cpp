@@ -0,0 +1,96 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "slidingmedian.h"
+
+#include "random.h"
+#include "test/test_bitcoin.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(slidingmedian_tests, BasicTestingSetup)
+
+static void CheckMedian(const CSlidingMedian<int, unsigned int>& window)
+{
+    std::vector<unsigned int> vSorted;
+    for (CSlidingMedian<int, unsigned int>::const_iterator it = window.begin(); it != window.end(); ++it)
+        vSorted.push_back(it->second);
+    std::sort(vSorted.begin(), vSorted.end());
+
+    size_t nSize = vSorted.size();
+    BOOST_CHECK_EQUAL(window.LowerMedian(), vSorted[(nSize - 1) / 2]);
+    BOOST_CHECK_EQUAL(window.UpperMedian(), vSorted[nSize / 2]);
+}
+
+BOOST_AUTO_TEST_CASE(slidingmedian_basic)
+{
+    CSlidingMedian<int, unsigned int> window;
+    BOOST_CHECK(window.empty());
+
+    BOOST_CHECK(window.Insert(1, 5));
+    BOOST_CHECK_EQUAL(window.LowerMedian(), 5U);
+    BOOST_CHECK_EQUAL(window.UpperMedian(), 5U);
+
+    // duplicate keys are rejected
+    BOOST_CHECK(!window.Insert(1, 7));
+    BOOST_CHECK_EQUAL(window.size(), 1U);
+
+    BOOST_CHECK(window.Insert(2, 1));
+    BOOST_CHECK_EQUAL(window.LowerMedian(), 1U);
+    BOOST_CHECK_EQUAL(window.UpperMedian(), 5U);
+
+    BOOST_CHECK(window.Insert(3, 3));
+    BOOST_CHECK_EQUAL(window.LowerMedian(), 3U);
+    BOOST_CHECK_EQUAL(window.UpperMedian(), 3U);
+    BOOST_CHECK_EQUAL(window.FrontKey(), 1);
+    BOOST_CHECK_EQUAL(window.BackKey(), 3);
+
+    window.PopFront();
+    BOOST_CHECK_EQUAL(window.FrontKey(), 2);
+    BOOST_CHECK_EQUAL(window.LowerMedian(), 1U);
+    BOOST_CHECK_EQUAL(window.UpperMedian(), 3U);
+
+    window.PopBack();
+    BOOST_CHECK_EQUAL(window.BackKey(), 2);
+    BOOST_CHECK_EQUAL(window.LowerMedian(), 1U);
+
+    BOOST_CHECK(!window.Erase(3));
+    BOOST_CHECK(window.Erase(2));
+    BOOST_CHECK(window.empty());
+}
+
+BOOST_AUTO_TEST_CASE(slidingmedian_random_window)
+{
+    // Slide a window over random values with plenty of duplicates, rewinding
+    // now and then, and compare against a freshly sorted copy each step
+    CSlidingMedian<int, unsigned int> window;
+    std::vector<unsigned int> vValues;
+    const int nWindow = 25;
+
+    for (int nHeight = 0; nHeight < 2000; nHeight++) {
+        vValues.push_back(insecure_rand() % 100);
+        window.Insert(nHeight, vValues.back());
+        if ((int)window.size() > nWindow)
+            window.PopFront();
+
+        if (insecure_rand() % 10 == 0) {
+            int nTip = window.BackKey();
+            window.PopBack();
+            if (nTip - nWindow >= 0)
+                window.Insert(nTip - nWindow, vValues[nTip - nWindow]);
+            CheckMedian(window);
+            BOOST_CHECK(window.Insert(nTip, vValues[nTip]));
+            window.Erase(nTip - nWindow);
+        }
+        CheckMedian(window);
+    }
+
+    window.clear();
+    BOOST_CHECK(window.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,202 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "messagesigner.h"
+#include "smartnode/instantx.h"
+#include "smartnode/netfulfilledman.h"
+#include "smartnode/smartnode.h"
+#include "smartnode/spork.h"
+#include "streams.h"
+
+#include "random.h"
+#include "test/test_bitcoin.h"
+#include "utiltime.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(smartnode_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(smartnode_batch_scores)
+{
+    uint256 blockHash = GetRandHash();
+
+    // below and above the size that gets split over threads
+    for (size_t nCount : {size_t(10), 3 * SMARTNODE_SCORES_PER_THREAD + 7}) {
+        std::vector<CSmartnode> vecSmartnodes(nCount);
+        std::vector<std::pair<arith_uint256, CSmartnode*> > vecScores;
+
+        for (auto& mn : vecSmartnodes) {
+            mn.vin = CTxIn(COutPoint(GetRandHash(), insecure_rand()));
+            mn.nCollateralMinConfBlockHash = GetRandHash();
+            vecScores.push_back(std::make_pair(arith_uint256(), &mn));
+        }
+
+        CSmartnode::CalculateScores(vecScores, blockHash);
+
+        for (auto& score : vecScores)
+            BOOST_CHECK(score.first == score.second->CalculateScore(blockHash));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(smartnode_queued_signatures)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubKey = key.GetPubKey();
+
+    CSmartnodePing mnp;
+    mnp.vin = CTxIn(COutPoint(GetRandHash(), 1));
+    mnp.blockHash = GetRandHash();
+    BOOST_CHECK(mnp.Sign(key, pubKey));
+    CSmartnodePing mnpBad = mnp;
+    mnpBad.sigTime++;
+
+    boost::thread worker(&ThreadSignedMessageVerifier);
+    BOOST_CHECK(signedMessageVerifier.Add(pubKey, mnp.vchSig, mnp.GetSignatureMessage()));
+    BOOST_CHECK(signedMessageVerifier.Add(pubKey, mnpBad.vchSig, mnpBad.GetSignatureMessage()));
+    while (signedMessageVerifier.GetQueueSize())
+        MilliSleep(1);
+
+    // whether the worker is still on them or done, the handlers get the right result
+    int nDos = 0;
+    BOOST_CHECK(mnp.CheckSignature(pubKey, nDos));
+    BOOST_CHECK(mnp.CheckSignature(pubKey, nDos));
+    BOOST_CHECK(!mnpBad.CheckSignature(pubKey, nDos));
+    BOOST_CHECK_EQUAL(nDos, 33);
+
+    worker.interrupt();
+    worker.join();
+}
+
+BOOST_AUTO_TEST_CASE(message_signature_cache)
+{
+    CKey key, keyOther;
+    key.MakeNewKey(true);
+    keyOther.MakeNewKey(true);
+    uint256 hash = GetRandHash();
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(CHashSigner::SignHash(hash, key, vchSig));
+
+    // cached once good, which must not let the signature pass for another key or hash
+    std::string strError;
+    BOOST_CHECK(CHashSigner::VerifyHash(hash, key.GetPubKey(), vchSig, strError));
+    BOOST_CHECK(CHashSigner::VerifyHash(hash, key.GetPubKey(), vchSig, strError));
+    BOOST_CHECK(!CHashSigner::VerifyHash(hash, keyOther.GetPubKey(), vchSig, strError));
+    BOOST_CHECK(!CHashSigner::VerifyHash(GetRandHash(), key.GetPubKey(), vchSig, strError));
+
+    // nor a tampered signature
+    std::vector<unsigned char> vchSigBad(vchSig);
+    vchSigBad[10] ^= 1;
+    BOOST_CHECK(!CHashSigner::VerifyHash(hash, key.GetPubKey(), vchSigBad, strError));
+    BOOST_CHECK(CHashSigner::VerifyHash(hash, key.GetPubKey(), vchSig, strError));
+}
+
+BOOST_AUTO_TEST_CASE(netfulfilled_requests)
+{
+    CNetFulfilledRequestManager fulfilled;
+    CNetAddr addr1, addr2;
+    BOOST_CHECK(LookupHost("1.2.3.4", addr1, false));
+    BOOST_CHECK(LookupHost("5.6.7.8", addr2, false));
+
+    SetMockTime(1000000);
+    fulfilled.AddFulfilledRequest(addr1, FULFILLED_FULL_SYNC);
+    fulfilled.AddFulfilledRequest(addr1, FULFILLED_SPORK_SYNC);
+    BOOST_CHECK(fulfilled.HasFulfilledRequest(addr1, FULFILLED_FULL_SYNC));
+    BOOST_CHECK(!fulfilled.HasFulfilledRequest(addr1, FULFILLED_MNVERIFY_DONE));
+    BOOST_CHECK(!fulfilled.HasFulfilledRequest(addr2, FULFILLED_FULL_SYNC));
+
+    fulfilled.RemoveFulfilledRequest(addr1, FULFILLED_SPORK_SYNC);
+    BOOST_CHECK(!fulfilled.HasFulfilledRequest(addr1, FULFILLED_SPORK_SYNC));
+
+    // Stored by name and read back
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << fulfilled;
+    CNetFulfilledRequestManager loaded;
+    ss >> loaded;
+    BOOST_CHECK(loaded.HasFulfilledRequest(addr1, FULFILLED_FULL_SYNC));
+    BOOST_CHECK(!loaded.HasFulfilledRequest(addr1, FULFILLED_SPORK_SYNC));
+    BOOST_CHECK_EQUAL(loaded.ToString(), "Nodes with fulfilled requests: 1");
+
+    // Requests expire, and the peers without any left are dropped
+    SetMockTime(1000000 + Params().FulfilledRequestExpireTime() / 2);
+    fulfilled.AddFulfilledRequest(addr2, FULFILLED_FULL_SYNC);
+    SetMockTime(1000000 + Params().FulfilledRequestExpireTime() + 120);
+    BOOST_CHECK(!fulfilled.HasFulfilledRequest(addr1, FULFILLED_FULL_SYNC));
+    BOOST_CHECK(fulfilled.HasFulfilledRequest(addr2, FULFILLED_FULL_SYNC));
+    fulfilled.CheckAndRemove();
+    BOOST_CHECK_EQUAL(fulfilled.ToString(), "Nodes with fulfilled requests: 1");
+
+    // The number of peers is capped, the ones added to longest ago go first
+    for (int i = 0; i < 11000; i++) {
+        CNetAddr addr;
+        BOOST_CHECK(LookupHost(strprintf("10.0.%d.%d", i / 256, i % 256).c_str(), addr, false));
+        fulfilled.AddFulfilledRequest(addr, FULFILLED_SPORK_SYNC);
+    }
+    BOOST_CHECK_EQUAL(fulfilled.ToString(), "Nodes with fulfilled requests: 10000");
+    BOOST_CHECK(!fulfilled.HasFulfilledRequest(addr2, FULFILLED_FULL_SYNC));
+
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_CASE(spork_default_values)
+{
+    CSporkManager sporks;
+
+    BOOST_CHECK_EQUAL(sporks.GetSporkValue(SPORK_5_INSTANTSEND_MAX_VALUE), SPORK_5_INSTANTSEND_MAX_VALUE_DEFAULT);
+    BOOST_CHECK_EQUAL(sporks.GetSporkValue(SPORK_14_REQUIRE_SENTINEL_FLAG), SPORK_14_REQUIRE_SENTINEL_FLAG_DEFAULT);
+    BOOST_CHECK(sporks.IsSporkActive(SPORK_2_INSTANTSEND_ENABLED));
+    BOOST_CHECK(!sporks.IsSporkActive(SPORK_9_SUPERBLOCKS_ENABLED));
+
+    // unused ids inside the table and ids outside of it are unknown
+    BOOST_CHECK_EQUAL(sporks.GetSporkValue(SPORK_START + 2), -1);
+    BOOST_CHECK_EQUAL(sporks.GetSporkValue(SPORK_END + 1), -1);
+    BOOST_CHECK(!sporks.IsSporkActive(SPORK_START + 2));
+    BOOST_CHECK(!sporks.IsSporkActive(SPORK_END + 1));
+}
+
+BOOST_AUTO_TEST_CASE(txlock_candidate_vote_counters)
+{
+    COutPoint outpoint1(GetRandHash(), 0);
+    COutPoint outpoint2(GetRandHash(), 1);
+    uint256 txHash = GetRandHash();
+
+    CTxLockCandidate txLockCandidate((CTxLockRequest()));
+    BOOST_CHECK(!txLockCandidate.IsAllOutPointsReady());
+    txLockCandidate.AddOutPointLock(outpoint1);
+    txLockCandidate.AddOutPointLock(outpoint2);
+
+    std::vector<COutPoint> vecSmartnodes;
+    for (int i = 0; i < COutPointLock::SIGNATURES_REQUIRED; i++)
+        vecSmartnodes.push_back(COutPoint(GetRandHash(), i));
+
+    for (const COutPoint& outpointSmartnode : vecSmartnodes) {
+        BOOST_CHECK(txLockCandidate.AddVote(CTxLockVote(txHash, outpoint1, outpointSmartnode)));
+        // a second vote of the same smartnode is not counted
+        BOOST_CHECK(!txLockCandidate.AddVote(CTxLockVote(txHash, outpoint1, outpointSmartnode)));
+    }
+    BOOST_CHECK_EQUAL(txLockCandidate.CountVotes(), COutPointLock::SIGNATURES_REQUIRED);
+    BOOST_CHECK(!txLockCandidate.IsAllOutPointsReady());
+
+    // votes for outpoints the candidate doesn't spend are refused
+    BOOST_CHECK(!txLockCandidate.AddVote(CTxLockVote(txHash, COutPoint(GetRandHash(), 0), vecSmartnodes[0])));
+
+    for (const COutPoint& outpointSmartnode : vecSmartnodes)
+        BOOST_CHECK(txLockCandidate.AddVote(CTxLockVote(txHash, outpoint2, outpointSmartnode)));
+    BOOST_CHECK_EQUAL(txLockCandidate.CountVotes(), 2 * COutPointLock::SIGNATURES_REQUIRED);
+    BOOST_CHECK(txLockCandidate.IsAllOutPointsReady());
+
+    // an attacked outpoint loses its votes and readiness
+    txLockCandidate.MarkOutpointAsAttacked(outpoint2);
+    BOOST_CHECK_EQUAL(txLockCandidate.CountVotes(), COutPointLock::SIGNATURES_REQUIRED);
+    BOOST_CHECK(!txLockCandidate.IsAllOutPointsReady());
+    BOOST_CHECK(txLockCandidate.AddVote(CTxLockVote(txHash, outpoint2, COutPoint(GetRandHash(), 0))));
+    BOOST_CHECK_EQUAL(txLockCandidate.CountVotes(), COutPointLock::SIGNATURES_REQUIRED);
+    BOOST_CHECK(!txLockCandidate.IsAllOutPointsReady());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
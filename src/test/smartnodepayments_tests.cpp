@@ -0,0 +1,126 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "smartnode/smartnodepayments.h"
+
+#include "random.h"
+#include "test/test_bitcoin.h"
+
+#include <map>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(smartnodepayments_tests, BasicTestingSetup)
+
+static CSmartnodePaymentVote RandomVote(int nHeight)
+{
+    CScriptVector payees;
+    payees.push_back(CScript() << OP_DUP << OP_HASH160 << ToByteVector(GetRandHash()) << OP_EQUALVERIFY << OP_CHECKSIG);
+
+    CSmartnodePaymentVote vote(COutPoint(GetRandHash(), insecure_rand() % 10), nHeight, payees);
+    vote.vchSig.push_back(1);
+
+    return vote;
+}
+
+BOOST_AUTO_TEST_CASE(smartnodepayments_store_basic)
+{
+    CSmartnodePaymentStore store(16);
+
+    CSmartnodePaymentVote vote = RandomVote(100);
+    uint256 hash = vote.GetHash();
+
+    BOOST_CHECK(!store.GetVote(hash));
+    BOOST_CHECK(store.AddVote(hash, vote));
+    BOOST_CHECK(store.GetVote(hash)->IsVerified());
+    BOOST_CHECK(!store.GetBlock(100));
+
+    // the same hash replaces the vote
+    vote.MarkAsNotVerified();
+    BOOST_CHECK(store.AddVote(hash, vote));
+    BOOST_CHECK(!store.GetVote(hash)->IsVerified());
+    BOOST_CHECK_EQUAL(store.GetVoteCount(), 1U);
+
+    store.GetBlock(100, true)->AddPayees(vote);
+    BOOST_CHECK_EQUAL(store.GetBlock(100)->nBlockHeight, 100);
+    BOOST_CHECK(store.GetBlock(100)->HasPayeeWithVotes(vote.payees[0], 1));
+    BOOST_CHECK_EQUAL(store.GetBlockCount(), 1U);
+
+    // 116 shares the slot of 100 and replaces it, 100 can't come back
+    CSmartnodePaymentVote voteNewer = RandomVote(116);
+    BOOST_CHECK(store.AddVote(voteNewer.GetHash(), voteNewer));
+    BOOST_CHECK(!store.GetVote(hash));
+    BOOST_CHECK(!store.GetBlock(100));
+    BOOST_CHECK(!store.AddVote(hash, vote));
+    BOOST_CHECK(!store.GetBlock(100, true));
+    BOOST_CHECK_EQUAL(store.GetVoteCount(), 1U);
+    BOOST_CHECK_EQUAL(store.GetBlockCount(), 0U);
+
+    store.Clear();
+    BOOST_CHECK(!store.GetVote(voteNewer.GetHash()));
+    BOOST_CHECK_EQUAL(store.GetVoteCount(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(smartnodepayments_store_window)
+{
+    CSmartnodePaymentStore store(64);
+    std::map<uint256, int> mapVotes;
+    std::map<int, int> mapBlocks;
+
+    // slide a window of 50 heights along, with a larger ring halfway and the
+    // same checks against a map after every drop
+    for (int nTip = 1000; nTip < 1400; nTip++) {
+        for (int i = 0; i < 10; i++) {
+            CSmartnodePaymentVote vote = RandomVote(nTip - insecure_rand() % 10);
+            uint256 hash = vote.GetHash();
+            BOOST_CHECK(store.AddVote(hash, vote));
+            mapVotes[hash] = vote.nBlockHeight;
+            if (insecure_rand() % 2) {
+                store.GetBlock(vote.nBlockHeight, true)->AddPayees(vote);
+                mapBlocks[vote.nBlockHeight]++;
+            }
+        }
+
+        if (nTip == 1200) store.Reserve(200);
+
+        if (nTip % 7 == 0) {
+            store.DropBelow(nTip - 50);
+            for (std::map<uint256, int>::iterator it = mapVotes.begin(); it != mapVotes.end();)
+                it->second < nTip - 50 ? mapVotes.erase(it++) : ++it;
+            for (std::map<int, int>::iterator it = mapBlocks.begin(); it != mapBlocks.end();)
+                it->first < nTip - 50 ? mapBlocks.erase(it++) : ++it;
+
+            BOOST_CHECK_EQUAL(store.GetVoteCount(), mapVotes.size());
+            BOOST_CHECK_EQUAL(store.GetBlockCount(), mapBlocks.size());
+            for (std::map<uint256, int>::iterator it = mapVotes.begin(); it != mapVotes.end(); ++it) {
+                CSmartnodePaymentVote *pvote = store.GetVote(it->first);
+                BOOST_CHECK(pvote && pvote->nBlockHeight == it->second);
+            }
+            std::vector<int> vecHeights;
+            store.GetBlockHeights(vecHeights);
+            BOOST_CHECK_EQUAL(vecHeights.size(), mapBlocks.size());
+            for (size_t i = 0; i < vecHeights.size(); i++) {
+                BOOST_CHECK(mapBlocks.count(vecHeights[i]));
+                BOOST_CHECK_EQUAL(store.GetBlock(vecHeights[i])->vecPayees.size(), (size_t)mapBlocks[vecHeights[i]]);
+            }
+        }
+    }
+
+    // the map form used on disk restores the same contents
+    std::map<uint256, CSmartnodePaymentVote> mapVotesOut;
+    std::map<int, CSmartnodeBlockPayees> mapBlocksOut;
+    store.Get(mapVotesOut, mapBlocksOut);
+    BOOST_CHECK_EQUAL(mapVotesOut.size(), store.GetVoteCount());
+    BOOST_CHECK_EQUAL(mapBlocksOut.size(), store.GetBlockCount());
+
+    CSmartnodePaymentStore storeLoaded(64);
+    storeLoaded.Set(mapVotesOut, mapBlocksOut);
+    BOOST_CHECK_EQUAL(storeLoaded.GetVoteCount(), store.GetVoteCount());
+    BOOST_CHECK_EQUAL(storeLoaded.GetBlockCount(), store.GetBlockCount());
+    for (std::map<uint256, CSmartnodePaymentVote>::iterator it = mapVotesOut.begin(); it != mapVotesOut.end(); ++it)
+        BOOST_CHECK(storeLoaded.GetVote(it->first));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -2,6 +2,8 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "primitives/transaction.h"
+#include "random.h"
 #include "streams.h"
 #include "support/allocators/zeroafterfree.h"
 #include "test/test_bitcoin.h"
@@ -64,4 +66,33 @@ BOOST_AUTO_TEST_CASE(streams_serializedata_xor)
             std::string(ds.begin(), ds.end()));  
 }         
 
+BOOST_AUTO_TEST_CASE(streams_span_reader_transaction)
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(2);
+    mtx.vin[0].prevout = COutPoint(GetRandHash(), 1);
+    mtx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(72, 0x30);
+    mtx.vin[1].prevout = COutPoint(GetRandHash(), 0);
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 42;
+    mtx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    CTransaction tx(mtx);
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << tx << 7;
+
+    // Reading from the buffer gives what reading from the stream does
+    CTransaction txSpan;
+    int n;
+    CSpanReader reader(&ss[0], ss.size(), SER_NETWORK, PROTOCOL_VERSION);
+    reader >> txSpan >> n;
+    BOOST_CHECK(txSpan.GetHash() == tx.GetHash());
+    BOOST_CHECK_EQUAL(n, 7);
+    BOOST_CHECK(reader.empty());
+
+    // A truncated transaction throws rather than reading past the span
+    CSpanReader truncated(&ss[0], ss.size() - 5, SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK_THROW(truncated >> txSpan, std::ios_base::failure);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -771,4 +771,66 @@ BOOST_AUTO_TEST_CASE(test_IsStandard)
     BOOST_CHECK(!IsStandardTx(t, reason));
 }
 
+BOOST_AUTO_TEST_CASE(test_cached_sizes)
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(2);
+    mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    mtx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(72, 1);
+    mtx.vin[1].prevout = COutPoint(GetRandHash(), 1);
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 1000;
+    mtx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+
+    CTransaction tx(mtx);
+    BOOST_CHECK_EQUAL(tx.GetBaseSize(), ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS));
+    BOOST_CHECK_EQUAL(tx.GetTotalSize(), ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION));
+    BOOST_CHECK_EQUAL(CTransaction().GetBaseSize(), ::GetSerializeSize(CTransaction(), SER_NETWORK, PROTOCOL_VERSION));
+
+    // deserializing and assigning keep the sizes along with the hash
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << tx;
+    CTransaction txRead;
+    ss >> txRead;
+    BOOST_CHECK_EQUAL(txRead.GetBaseSize(), tx.GetBaseSize());
+    CTransaction txAssigned;
+    txAssigned = tx;
+    BOOST_CHECK_EQUAL(txAssigned.GetBaseSize(), tx.GetBaseSize());
+
+    // the witness isn't covered by the cached size
+    txAssigned.wit.vtxinwit.resize(1);
+    txAssigned.wit.vtxinwit[0].scriptWitness.stack.push_back(std::vector<unsigned char>(10, 2));
+    BOOST_CHECK_EQUAL(txAssigned.GetBaseSize(), tx.GetBaseSize());
+    BOOST_CHECK_EQUAL(txAssigned.GetTotalSize(), ::GetSerializeSize(txAssigned, SER_NETWORK, PROTOCOL_VERSION));
+    BOOST_CHECK(txAssigned.GetTotalSize() > tx.GetTotalSize());
+}
+
+BOOST_AUTO_TEST_CASE(test_transaction_ref_serialization)
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    mtx.vout.resize(2);
+    mtx.vout[0].nValue = 1000;
+    mtx.vout[1].nValue = 2000;
+    CTransactionRef ptx = MakeTransactionRef(mtx);
+
+    // A shared transaction serializes like the transaction itself, also inside containers
+    std::vector<CTransactionRef> vtx(2, ptx);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << vtx;
+    BOOST_CHECK_EQUAL(ss.size(), ::GetSerializeSize(vtx, SER_NETWORK, PROTOCOL_VERSION));
+    BOOST_CHECK_EQUAL(::GetSerializeSize(ptx, SER_NETWORK, PROTOCOL_VERSION), ptx->GetTotalSize());
+
+    std::vector<CTransaction> vtxRead;
+    CDataStream ssCopy(ss);
+    ssCopy >> vtxRead;
+    BOOST_CHECK(vtxRead.size() == 2 && vtxRead[1] == *ptx);
+
+    std::vector<CTransactionRef> vtxRefRead;
+    ss >> vtxRefRead;
+    BOOST_CHECK_EQUAL(vtxRefRead.size(), 2U);
+    BOOST_CHECK(vtxRefRead[0] != vtxRefRead[1] && *vtxRefRead[0] == *ptx && *vtxRefRead[1] == *ptx);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
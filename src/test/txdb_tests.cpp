@@ -0,0 +1,316 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txdb.h"
+
+#include "coins.h"
+#include "random.h"
+#include "utxostats.h"
+#include "test/test_bitcoin.h"
+
+#include <set>
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txdb_tests, TestingSetup)
+
+static COutPoint TestOutPoint(uint32_t n)
+{
+    return COutPoint(uint256S("0xabcdef"), n);
+}
+
+BOOST_AUTO_TEST_CASE(coinsviewdb_background_writes)
+{
+    CCoinsViewDB view(1 << 20, true);
+    view.SetBackgroundWrites(true);
+    CCoinsViewCache cache(&view);
+
+    for (uint32_t i = 0; i < 100; i++)
+        cache.AddCoin(TestOutPoint(i), Coin(CTxOut(i + 1, CScript()), 1, false), false);
+    cache.SetBestBlock(uint256S("0x01"));
+    BOOST_CHECK(cache.Flush());
+
+    // the coins are visible right away, whether they are written already or not
+    Coin coin;
+    BOOST_CHECK(view.GetCoin(TestOutPoint(5), coin));
+    BOOST_CHECK_EQUAL(coin.out.nValue, 6);
+    BOOST_CHECK(view.HaveCoin(TestOutPoint(99)));
+    BOOST_CHECK(!view.HaveCoin(TestOutPoint(100)));
+    BOOST_CHECK(view.GetBestBlock() == uint256S("0x01"));
+
+    // the next flush waits for the previous one
+    BOOST_CHECK(cache.SpendCoin(TestOutPoint(5)));
+    cache.SetBestBlock(uint256S("0x02"));
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(!view.GetCoin(TestOutPoint(5), coin));
+    BOOST_CHECK(!view.HaveCoin(TestOutPoint(5)));
+    BOOST_CHECK(view.GetBestBlock() == uint256S("0x02"));
+
+    BOOST_CHECK(view.Sync());
+    BOOST_CHECK(!view.HaveCoin(TestOutPoint(5)));
+    BOOST_CHECK(view.HaveCoin(TestOutPoint(6)));
+    BOOST_CHECK(view.GetBestBlock() == uint256S("0x02"));
+
+    size_t nCoins = 0;
+    boost::scoped_ptr<CCoinsViewCursor> pcursor(view.Cursor());
+    for (; pcursor->Valid(); pcursor->Next())
+        nCoins++;
+    BOOST_CHECK_EQUAL(nCoins, 99U);
+}
+
+BOOST_AUTO_TEST_CASE(coinsviewdb_prefetch)
+{
+    CCoinsViewDB view(1 << 20, true);
+    {
+        CCoinsViewCache cache(&view);
+        for (uint32_t i = 0; i < 10; i++)
+            cache.AddCoin(TestOutPoint(i), Coin(CTxOut(i + 1, CScript()), 1, false), false);
+        BOOST_CHECK(cache.Flush());
+    }
+
+    std::vector<COutPoint> vOutPoints;
+    for (uint32_t i = 0; i < 20; i++)
+        vOutPoints.push_back(TestOutPoint(i));
+    view.Prefetch(vOutPoints);
+
+    Coin coin;
+    BOOST_CHECK(view.HaveCoin(TestOutPoint(3)));
+    BOOST_CHECK(view.GetCoin(TestOutPoint(3), coin));
+    BOOST_CHECK_EQUAL(coin.out.nValue, 4);
+    BOOST_CHECK(!view.HaveCoin(TestOutPoint(15)));
+
+    // prefetched coins don't outlive a write that changes them
+    CCoinsViewCache cache(&view);
+    BOOST_CHECK(cache.SpendCoin(TestOutPoint(7)));
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(!view.HaveCoin(TestOutPoint(7)));
+    BOOST_CHECK(!view.GetCoin(TestOutPoint(7), coin));
+    BOOST_CHECK(view.GetCoin(TestOutPoint(8), coin));
+}
+
+BOOST_AUTO_TEST_CASE(coinsviewdb_utxo_stats)
+{
+    CCoinsViewDB view(1 << 20, true);
+    CUTXOStats stats;
+    BOOST_CHECK(!view.ReadUTXOStats(stats));
+
+    CCoinsViewCache cache(&view);
+    for (uint32_t i = 0; i < 10; i++) {
+        Coin coin(CTxOut(i + 1, CScript() << OP_TRUE), 1, false);
+        stats.AddCoin(TestOutPoint(i), coin);
+        cache.AddCoin(TestOutPoint(i), std::move(coin), false);
+    }
+    stats.hashBlock = uint256S("0x01");
+    cache.SetBestBlock(stats.hashBlock);
+    view.SetUTXOStats(&stats);
+    BOOST_CHECK(cache.Flush());
+
+    CUTXOStats statsRead;
+    BOOST_CHECK(view.ReadUTXOStats(statsRead));
+    BOOST_CHECK(statsRead.hashBlock == stats.hashBlock);
+    BOOST_CHECK_EQUAL(statsRead.nTransactionOutputs, 10U);
+    BOOST_CHECK_EQUAL(statsRead.nTotalAmount, 55);
+    BOOST_CHECK_EQUAL(statsRead.nBogoSize, 10 * (50 + 1U));
+    BOOST_CHECK(statsRead.GetHash() == stats.GetHash());
+
+    // the running hash is the one of the set, however it got there
+    CUTXOStats statsScan;
+    boost::scoped_ptr<CCoinsViewCursor> pcursor(view.Cursor());
+    for (; pcursor->Valid(); pcursor->Next()) {
+        COutPoint outpoint;
+        Coin coin;
+        BOOST_CHECK(pcursor->GetKey(outpoint) && pcursor->GetValue(coin));
+        statsScan.AddCoin(outpoint, coin);
+    }
+    BOOST_CHECK(statsScan.GetHash() == stats.GetHash());
+
+    // statistics of another block, or none at all, don't survive a write
+    BOOST_CHECK(cache.SpendCoin(TestOutPoint(0)));
+    cache.SetBestBlock(uint256S("0x02"));
+    view.SetUTXOStats(&stats);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(!view.ReadUTXOStats(statsRead));
+}
+
+BOOST_AUTO_TEST_CASE(coinsviewdb_range_cursors)
+{
+    CCoinsViewDB view(1 << 20, true);
+    CCoinsViewCache cache(&view);
+    CAmount nTotal = 0;
+    for (uint32_t i = 0; i < 300; i++) {
+        uint256 txid = GetRandHash();
+        cache.AddCoin(COutPoint(txid, i % 3), Coin(CTxOut(i + 1, CScript()), 1, false), false);
+        nTotal += i + 1;
+    }
+    cache.SetBestBlock(uint256S("0x01"));
+    BOOST_CHECK(cache.Flush());
+
+    std::vector<std::unique_ptr<CCoinsViewCursor> > vCursors = view.RangeCursors(3);
+    BOOST_REQUIRE_EQUAL(vCursors.size(), 3U);
+
+    // coins written after the cursors were created are not seen by any of them
+    cache.AddCoin(TestOutPoint(0), Coin(CTxOut(1000, CScript()), 2, false), false);
+    cache.SetBestBlock(uint256S("0x02"));
+    BOOST_CHECK(cache.Flush());
+
+    // the ranges are disjoint, in order and cover all coins
+    std::set<COutPoint> setSeen;
+    COutPoint last;
+    for (size_t i = 0; i < vCursors.size(); i++) {
+        BOOST_CHECK(vCursors[i]->GetBestBlock() == uint256S("0x01"));
+        for (; vCursors[i]->Valid(); vCursors[i]->Next()) {
+            COutPoint key;
+            BOOST_CHECK(vCursors[i]->GetKey(key));
+            BOOST_CHECK(setSeen.empty() || last.hash < key.hash || (last.hash == key.hash && last.n < key.n));
+            BOOST_CHECK(setSeen.insert(key).second);
+            last = key;
+        }
+    }
+    BOOST_CHECK_EQUAL(setSeen.size(), 300U);
+
+    std::vector<CAmount> vTotals(4, 0);
+    BOOST_CHECK(ParallelCoinsScan(view, vTotals, [](CCoinsViewCursor &cursor, CAmount &nPart) {
+        for (; cursor.Valid(); cursor.Next()) {
+            Coin coin;
+            if (!cursor.GetValue(coin))
+                return false;
+            nPart += coin.out.nValue;
+        }
+        return true;
+    }));
+    BOOST_CHECK_EQUAL(vTotals[0] + vTotals[1] + vTotals[2] + vTotals[3], nTotal + 1000);
+}
+
+BOOST_AUTO_TEST_CASE(indexdb_queued_index_updates)
+{
+    CIndexDB db(1 << 20, true);
+    uint160 address(std::vector<unsigned char>(20, 0x12));
+    uint256 txid = GetRandHash();
+
+    for (int nHeight = 1; nHeight <= 10; nHeight++) {
+        CIndexUpdates updates;
+        updates.vAddressIndex.push_back(std::make_pair(CAddressIndexKey(1, address, nHeight, 0, txid, nHeight, false), nHeight * 100));
+        updates.vSpentIndex.push_back(std::make_pair(CSpentIndexKey(txid, nHeight), CSpentIndexValue(txid, 0, nHeight, nHeight * 100, 1, address)));
+        updates.vTimestampIndex.push_back(CTimestampIndexKey(1000 + nHeight, uint256S(strprintf("%x", nHeight))));
+        BOOST_CHECK(db.QueueIndexUpdates(std::move(updates)));
+    }
+    // updates queued later win over earlier ones
+    CIndexUpdates updates;
+    updates.vAddressIndexErase.push_back(std::make_pair(CAddressIndexKey(1, address, 10, 0, txid, 10, false), 1000));
+    updates.vSpentIndex.push_back(std::make_pair(CSpentIndexKey(txid, 10), CSpentIndexValue()));
+    BOOST_CHECK(db.QueueIndexUpdates(std::move(updates)));
+
+    // reads see everything queued before them
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    BOOST_CHECK(db.ReadAddressIndex(address, 1, addressIndex));
+    BOOST_CHECK_EQUAL(addressIndex.size(), 9U);
+    CSpentIndexKey key(txid, 9);
+    CSpentIndexValue value;
+    BOOST_CHECK(db.ReadSpentIndex(key, value));
+    BOOST_CHECK_EQUAL(value.satoshis, 900);
+    key = CSpentIndexKey(txid, 10);
+    BOOST_CHECK(!db.ReadSpentIndex(key, value));
+    std::vector<uint256> vHashes;
+    BOOST_CHECK(db.ReadTimestampIndex(1005, 1001, vHashes));
+    BOOST_CHECK_EQUAL(vHashes.size(), 5U);
+
+    BOOST_CHECK(db.SyncIndexUpdates());
+}
+
+BOOST_AUTO_TEST_CASE(indexdb_address_index_pages)
+{
+    CIndexDB db(1 << 20, true);
+    uint160 address(std::vector<unsigned char>(20, 0x56));
+    uint160 addressOther(std::vector<unsigned char>(20, 0x57));
+    uint256 txid = GetRandHash();
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vAddressIndex;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    for (int nHeight = 1; nHeight <= 25; nHeight++) {
+        vAddressIndex.push_back(std::make_pair(CAddressIndexKey(1, address, nHeight, 0, txid, nHeight, false), nHeight));
+        vAddressIndex.push_back(std::make_pair(CAddressIndexKey(1, addressOther, nHeight, 0, txid, nHeight, false), nHeight));
+        vUnspent.push_back(std::make_pair(CAddressUnspentKey(1, address, txid, nHeight), CAddressUnspentValue(nHeight, CScript() << OP_TRUE, nHeight)));
+    }
+    BOOST_CHECK(db.WriteAddressIndex(vAddressIndex));
+    BOOST_CHECK(db.UpdateAddressUnspentIndex(vUnspent));
+
+    // pages of 10 go through all entries of the address once, in order
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    std::vector<std::pair<CAddressIndexKey, CAmount> > page;
+    BOOST_CHECK(db.ReadAddressIndex(address, 1, page, 0, 0, 10));
+    while (!page.empty()) {
+        BOOST_CHECK(page.size() <= 10);
+        addressIndex.insert(addressIndex.end(), page.begin(), page.end());
+        CAddressIndexKey keyAfter = page.back().first;
+        page.clear();
+        BOOST_CHECK(db.ReadAddressIndex(address, 1, page, 0, 0, 10, &keyAfter));
+    }
+    BOOST_CHECK_EQUAL(addressIndex.size(), 25U);
+    for (size_t i = 0; i < addressIndex.size(); i++) {
+        BOOST_CHECK_EQUAL(addressIndex[i].first.blockHeight, (int)i + 1);
+        BOOST_CHECK(addressIndex[i].first.hashBytes == address);
+    }
+
+    // the height range still applies to the pages after the first
+    page.clear();
+    BOOST_CHECK(db.ReadAddressIndex(address, 1, page, 5, 12, 0, &addressIndex[7].first));
+    BOOST_CHECK_EQUAL(page.size(), 4U);
+    BOOST_CHECK_EQUAL(page.front().first.blockHeight, 9);
+
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
+    BOOST_CHECK(db.ReadAddressUnspentIndex(address, 1, unspentOutputs, 20));
+    BOOST_CHECK_EQUAL(unspentOutputs.size(), 20U);
+    CAddressUnspentKey keyAfter = unspentOutputs.back().first;
+    BOOST_CHECK(db.ReadAddressUnspentIndex(address, 1, unspentOutputs, 20, &keyAfter));
+    BOOST_CHECK_EQUAL(unspentOutputs.size(), 25U);
+    std::set<size_t> setIndexes;
+    for (size_t i = 0; i < unspentOutputs.size(); i++)
+        setIndexes.insert(unspentOutputs[i].first.index);
+    BOOST_CHECK_EQUAL(setIndexes.size(), 25U);
+}
+
+BOOST_AUTO_TEST_CASE(indexdb_move_from_blocktree)
+{
+    CBlockTreeDB blocktree(1 << 20, true);
+    CIndexDB db(1 << 20, true);
+    uint160 address(std::vector<unsigned char>(20, 0x34));
+    uint256 txid = GetRandHash();
+
+    // entries as older versions wrote them to the block index database
+    for (int nHeight = 1; nHeight <= 10; nHeight++) {
+        BOOST_CHECK(blocktree.Write(std::make_pair('a', CAddressIndexKey(1, address, nHeight, 0, txid, nHeight, false)), (CAmount)nHeight));
+        BOOST_CHECK(blocktree.Write(std::make_pair('u', CAddressUnspentKey(1, address, txid, nHeight)), CAddressUnspentValue(nHeight, CScript() << OP_TRUE, nHeight)));
+        BOOST_CHECK(blocktree.Write(std::make_pair('p', CSpentIndexKey(txid, nHeight)), CSpentIndexValue(txid, 0, nHeight, nHeight, 1, address)));
+        BOOST_CHECK(blocktree.Write(std::make_pair('s', CTimestampIndexKey(1000 + nHeight, txid)), 0));
+    }
+    BOOST_CHECK(blocktree.WriteFlag("addressindex", true));
+
+    BOOST_CHECK(db.MoveFromBlockTree(blocktree));
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    BOOST_CHECK(db.ReadAddressIndex(address, 1, addressIndex));
+    BOOST_CHECK_EQUAL(addressIndex.size(), 10U);
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
+    BOOST_CHECK(db.ReadAddressUnspentIndex(address, 1, unspentOutputs));
+    BOOST_CHECK_EQUAL(unspentOutputs.size(), 10U);
+    CSpentIndexKey key(txid, 7);
+    CSpentIndexValue value;
+    BOOST_CHECK(db.ReadSpentIndex(key, value));
+    BOOST_CHECK_EQUAL(value.satoshis, 7);
+    std::vector<uint256> vHashes;
+    BOOST_CHECK(db.ReadTimestampIndex(2000, 0, vHashes));
+    BOOST_CHECK_EQUAL(vHashes.size(), 10U);
+
+    // nothing is left behind but the flags, and moving again is a no-op
+    BOOST_CHECK(!blocktree.Exists(std::make_pair('a', addressIndex[0].first)));
+    BOOST_CHECK(!blocktree.Exists(std::make_pair('p', key)));
+    bool fValue = false;
+    BOOST_CHECK(blocktree.ReadFlag("addressindex", fValue) && fValue);
+    BOOST_CHECK(db.MoveFromBlockTree(blocktree));
+    addressIndex.clear();
+    BOOST_CHECK(db.ReadAddressIndex(address, 1, addressIndex));
+    BOOST_CHECK_EQUAL(addressIndex.size(), 10U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -332,5 +332,27 @@ BOOST_AUTO_TEST_CASE(univalue_readwrite)
     BOOST_CHECK(!v.read("{} 42"));
 }
 
+BOOST_AUTO_TEST_CASE(univalue_move_write)
+{
+    UniValue inner(UniValue::VOBJ);
+    inner.push_back(Pair("a\"b", "x\ny"));
+    inner.push_back(Pair("n", 5));
+    UniValue arr(UniValue::VARR);
+    arr.push_back(std::move(inner));
+    arr.push_back(UniValue(true));
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("arr", std::move(arr)));
+    BOOST_CHECK(obj.pushKV("null", UniValue()));
+    BOOST_CHECK(!obj.push_back(UniValue(1)));
+
+    BOOST_CHECK_EQUAL(obj.write(), "{\"arr\":[{\"a\\\"b\":\"x\\ny\",\"n\":5},true],\"null\":null}");
+    BOOST_CHECK_EQUAL(obj.write(1),
+        "{\n \"arr\": [\n  {\n   \"a\\\"b\": \"x\\ny\",\n   \"n\": 5\n  }, \n  true\n ],\n \"null\": null\n}");
+
+    UniValue v;
+    BOOST_CHECK(v.read(obj.write()));
+    BOOST_CHECK_EQUAL(v["arr"][0]["a\"b"].get_str(), "x\ny");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
@@ -0,0 +1,93 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "validationinterface.h"
+
+#include "primitives/block.h"
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(validationinterface_tests, BasicTestingSetup)
+
+class CTestListener : public CValidationInterface
+{
+public:
+    std::vector<uint256> vHashes;
+    std::vector<boost::thread::id> vThreads;
+
+protected:
+    void BlockConnected(const CBlock &block, const CBlockIndex *pindex)
+    {
+        vHashes.push_back(block.GetHash());
+        vThreads.push_back(boost::this_thread::get_id());
+    }
+
+    void SyncTransaction(const CTransaction &tx, const CBlock *pblock)
+    {
+        vHashes.push_back(tx.GetHash());
+        vThreads.push_back(boost::this_thread::get_id());
+    }
+};
+
+static CMutableTransaction CreateTransaction(int n)
+{
+    CMutableTransaction tx;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = n;
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(validationinterface_queue_order)
+{
+    CTestListener listener;
+    RegisterValidationInterface(&listener);
+
+    CBlock block;
+    block.vtx.push_back(CreateTransaction(1));
+    block.vtx.push_back(CreateTransaction(2));
+    CTransaction tx = CreateTransaction(3);
+
+    std::vector<uint256> vExpected;
+    vExpected.push_back(tx.GetHash());
+    vExpected.push_back(block.GetHash());
+    vExpected.push_back(block.vtx[0].GetHash());
+    vExpected.push_back(block.vtx[1].GetHash());
+
+    // Without the queue the signals fire on the caller's thread
+    GetMainSignals().QueueSyncTransaction(tx, NULL);
+    GetMainSignals().QueueBlockConnected(block, NULL);
+    BOOST_CHECK(listener.vHashes == vExpected);
+    for (const boost::thread::id& id : listener.vThreads)
+        BOOST_CHECK(id == boost::this_thread::get_id());
+
+    // With it they fire in the same order on another thread, the block and
+    // transaction may be gone by then.
+    listener.vHashes.clear();
+    listener.vThreads.clear();
+    StartValidationInterfaceQueue();
+    {
+        CBlock blockCopy(block);
+        CTransaction txCopy(tx);
+        GetMainSignals().QueueSyncTransaction(txCopy, NULL);
+        GetMainSignals().QueueBlockConnected(blockCopy, NULL);
+    }
+    SyncWithValidationInterfaceQueue();
+    BOOST_CHECK(listener.vHashes == vExpected);
+    for (const boost::thread::id& id : listener.vThreads)
+        BOOST_CHECK(id != boost::this_thread::get_id());
+
+    // Stopping fires what is still queued
+    listener.vHashes.clear();
+    GetMainSignals().QueueSyncTransaction(tx, NULL);
+    StopValidationInterfaceQueue();
+    BOOST_CHECK_EQUAL(listener.vHashes.size(), 1U);
+
+    UnregisterValidationInterface(&listener);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -11,6 +11,8 @@
 #include "uint256.h"
 #include "ui_interface.h"
 #include "init.h"
+#include "util.h"
+#include "utiltime.h"
 
 #include <stdint.h>
 
@@ -29,6 +31,7 @@ static const char DB_SPENTINDEX = 'p';
 static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_BEST_BLOCK = 'B';
+static const char DB_UTXO_STATS = 'U';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
@@ -57,30 +60,120 @@ struct CoinEntry {
 
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) :
+    db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true),
+    fBackgroundWrites(false), fSnapshot(false),
+    mapSnapshot(0, SaltedOutpointHasher(), CCoinsMap::key_equal(), CCoinsMap::allocator_type(&snapshotMemoryResource)),
+    fWriteFailed(false), nPrefetchGeneration(0), fStatsPending(false), fStatsSnapshot(false)
 {
 }
 
+CCoinsViewDB::~CCoinsViewDB()
+{
+    WaitForWrite();
+}
+
+bool CCoinsViewDB::GetSnapshotCoin(const COutPoint &outpoint, Coin *pcoin, bool &fSpent) const
+{
+    // The writer frees the snapshot right after resetting fSnapshot, copy what we need
+    // before releasing the lock.
+    std::lock_guard<std::mutex> lock(csSnapshot);
+    if( !fSnapshot ) return false;
+    CCoinsMap::const_iterator it = mapSnapshot.find(outpoint);
+    if (it == mapSnapshot.end())
+        return false;
+    fSpent = it->second.coin.IsSpent();
+    if (pcoin && !fSpent)
+        *pcoin = it->second.coin;
+    return true;
+}
+
 bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    bool fSpent;
+    if (GetSnapshotCoin(outpoint, &coin, fSpent))
+        return !fSpent;
+    {
+        // The caller caches the coin, it is fetched once
+        std::lock_guard<std::mutex> lock(csPrefetch);
+        std::unordered_map<COutPoint, Coin, SaltedOutpointHasher>::iterator it = mapPrefetched.find(outpoint);
+        if (it != mapPrefetched.end()) {
+            coin = std::move(it->second);
+            mapPrefetched.erase(it);
+            return true;
+        }
+    }
     return db.Read(CoinEntry(&outpoint), coin);
 }
 
 bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    bool fSpent;
+    if (GetSnapshotCoin(outpoint, NULL, fSpent))
+        return !fSpent;
+    {
+        std::lock_guard<std::mutex> lock(csPrefetch);
+        if (mapPrefetched.count(outpoint))
+            return true;
+    }
     return db.Exists(CoinEntry(&outpoint));
 }
 
+void CCoinsViewDB::Prefetch(const std::vector<COutPoint> &vOutPoints)
+{
+    uint64_t nGeneration;
+    {
+        std::lock_guard<std::mutex> lock(csPrefetch);
+        if (mapPrefetched.size() >= MAX_PREFETCHED_COINS)
+            return;
+        nGeneration = nPrefetchGeneration;
+    }
+
+    std::vector<std::pair<COutPoint, Coin> > vCoins;
+    vCoins.reserve(vOutPoints.size());
+    for (const COutPoint &outpoint : vOutPoints) {
+        // Coins of the snapshot are in memory already
+        bool fSpent;
+        if (GetSnapshotCoin(outpoint, NULL, fSpent))
+            continue;
+        Coin coin;
+        if (db.Read(CoinEntry(&outpoint), coin))
+            vCoins.push_back(std::make_pair(outpoint, std::move(coin)));
+    }
+
+    std::lock_guard<std::mutex> lock(csPrefetch);
+    // A BatchWrite since we started may have changed the coins we read
+    if (nGeneration != nPrefetchGeneration)
+        return;
+    for (std::pair<COutPoint, Coin> &entry : vCoins) {
+        if (mapPrefetched.size() >= MAX_PREFETCHED_COINS)
+            break;
+        mapPrefetched.insert(std::move(entry));
+    }
+}
+
+void CCoinsViewDB::ResetPrefetched()
+{
+    std::lock_guard<std::mutex> lock(csPrefetch);
+    nPrefetchGeneration++;
+    mapPrefetched.clear();
+}
+
 uint256 CCoinsViewDB::GetBestBlock() const {
+    {
+        std::lock_guard<std::mutex> lock(csSnapshot);
+        if (fSnapshot && !hashSnapshot.IsNull())
+            return hashSnapshot;
+    }
     uint256 hashBestChain;
     if (!db.Read(DB_BEST_BLOCK, hashBestChain))
         return uint256();
     return hashBestChain;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+bool CCoinsViewDB::WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock, const CUTXOStats *pstats) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
             CoinEntry entry(&it->first);
             if (it->second.coin.IsSpent())
@@ -90,17 +183,127 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
     }
-    if (!hashBlock.IsNull())
+    if (!hashBlock.IsNull()) {
         batch.Write(DB_BEST_BLOCK, hashBlock);
+        // Statistics of another block than the best one are of no use
+        if (pstats && pstats->hashBlock == hashBlock)
+            batch.Write(DB_UTXO_STATS, *pstats);
+        else
+            batch.Erase(DB_UTXO_STATS);
+    }
 
     bool ret = db.WriteBatch(batch);
     LogPrint("coindb", "Committed %u changed transaction outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
     return ret;
 }
 
+bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    if (!fBackgroundWrites) {
+        if (!Sync())
+            return false;
+        bool ret = WriteCoins(mapCoins, hashBlock, fStatsPending ? &statsPending : NULL);
+        fStatsPending = false;
+        ResetPrefetched();
+        mapCoins.clear();
+        return ret;
+    }
+
+    // Wait for the previous snapshot to be written before taking the next one.
+    if (!Sync())
+        return false;
+
+    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY)
+            mapSnapshot.emplace(it->first, std::move(it->second));
+        CCoinsMap::iterator itOld = it++;
+        mapCoins.erase(itOld);
+    }
+    if (mapSnapshot.empty() && hashBlock.IsNull())
+        return true;
+
+    {
+        std::lock_guard<std::mutex> lock(csSnapshot);
+        hashSnapshot = hashBlock;
+        fSnapshot = true;
+    }
+    fStatsSnapshot = fStatsPending;
+    if (fStatsSnapshot)
+        statsSnapshot = statsPending;
+    fStatsPending = false;
+    ResetPrefetched();
+    {
+        std::lock_guard<std::mutex> lock(csWrite);
+        threadWrite = std::thread(&CCoinsViewDB::ThreadWriteSnapshot, this);
+    }
+    return true;
+}
+
+void CCoinsViewDB::ThreadWriteSnapshot()
+{
+    RenameThread("smartcash-coinsflush");
+
+    int64_t nStart = GetTimeMicros();
+    bool fOk = false;
+    try {
+        fOk = WriteCoins(mapSnapshot, hashSnapshot, fStatsSnapshot ? &statsSnapshot : NULL);
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+    if (!fOk) {
+        // Keep answering reads from the snapshot, the database lacks its changes.
+        LogPrintf("%s: failed to write %u coins to the coin database\n", __func__, mapSnapshot.size());
+        fWriteFailed = true;
+        return;
+    }
+    LogPrint("bench", "    - Background coins write: %.2fms (%u coins)\n", (GetTimeMicros() - nStart) * 0.001, mapSnapshot.size());
+
+    {
+        std::lock_guard<std::mutex> lock(csSnapshot);
+        fSnapshot = false;
+    }
+    // Nobody looks at the snapshot anymore, release its memory at once.
+    SaltedOutpointHasher hasher = mapSnapshot.hash_function();
+    mapSnapshot.~CCoinsMap();
+    snapshotMemoryResource.~CCoinsMapMemoryResource();
+    ::new (&snapshotMemoryResource) CCoinsMapMemoryResource();
+    ::new (&mapSnapshot) CCoinsMap(0, hasher, CCoinsMap::key_equal(), CCoinsMap::allocator_type(&snapshotMemoryResource));
+    hashSnapshot.SetNull();
+}
+
+void CCoinsViewDB::WaitForWrite() const
+{
+    // Cursor() waits from RPC threads, next to the validation thread in BatchWrite
+    std::lock_guard<std::mutex> lock(csWrite);
+    if (threadWrite.joinable())
+        threadWrite.join();
+}
+
+bool CCoinsViewDB::Sync()
+{
+    WaitForWrite();
+    return !fWriteFailed;
+}
+
+void CCoinsViewDB::SetUTXOStats(const CUTXOStats *pstats)
+{
+    fStatsPending = pstats != NULL;
+    if (pstats)
+        statsPending = *pstats;
+}
+
+bool CCoinsViewDB::ReadUTXOStats(CUTXOStats &stats) const
+{
+    WaitForWrite();
+    return db.Read(DB_UTXO_STATS, stats) && stats.hashBlock == GetBestBlock();
+}
+
+void CCoinsViewDB::SetBackgroundWrites(bool fBackgroundWritesIn)
+{
+    Sync();
+    fBackgroundWrites = fBackgroundWritesIn;
+}
+
 size_t CCoinsViewDB::EstimateSize() const
 {
     return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
@@ -113,6 +316,10 @@ bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
     return Read(make_pair(DB_BLOCK_FILES, nFile), info);
 }
 
+bool CBlockTreeDB::ReadDiskBlockIndex(const uint256 &hash, CDiskBlockIndex &index) {
+    return Read(make_pair(DB_BLOCK_INDEX, hash), index);
+}
+
 bool CBlockTreeDB::WriteReindexing(bool fReindexing) {
     if (fReindexing)
         return Write(DB_REINDEX_FLAG, '1');
@@ -131,6 +338,8 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
 
 CCoinsViewCursor *CCoinsViewDB::Cursor() const
 {
+    // The cursor iterates over the database only, so it has to contain the last BatchWrite.
+    WaitForWrite();
     CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper*>(&db)->NewIterator(), GetBestBlock());
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
@@ -147,6 +356,43 @@ CCoinsViewCursor *CCoinsViewDB::Cursor() const
     return i;
 }
 
+std::vector<std::unique_ptr<CCoinsViewCursor> > CCoinsViewDB::RangeCursors(int nParts) const
+{
+    nParts = std::max(1, std::min(nParts, 65536));
+    WaitForWrite();
+    std::shared_ptr<const leveldb::Snapshot> psnapshot = db.GetSnapshot();
+    CDBWrapper &dbIter = const_cast<CDBWrapper&>(db);
+
+    // The best block of the snapshot, not the one of the database by the time we read it
+    uint256 hashBestChain;
+    {
+        boost::scoped_ptr<CDBIterator> pcursor(dbIter.NewIterator(psnapshot));
+        pcursor->Seek(DB_BEST_BLOCK);
+        char chKey;
+        if (!pcursor->Valid() || !pcursor->GetKey(chKey) || chKey != DB_BEST_BLOCK || !pcursor->GetValue(hashBestChain))
+            hashBestChain.SetNull();
+    }
+
+    // Split the txids by their first two bytes, which is the order the keys are sorted in.
+    std::vector<std::unique_ptr<CCoinsViewCursor> > vCursors;
+    for (int i = 0; i < nParts; i++) {
+        CCoinsViewDBCursor *pcursor = new CCoinsViewDBCursor(dbIter.NewIterator(psnapshot), hashBestChain);
+        vCursors.emplace_back(pcursor);
+        uint256 hashStart;
+        unsigned int nPrefixStart = i * 65536 / nParts;
+        hashStart.begin()[0] = nPrefixStart >> 8;
+        hashStart.begin()[1] = nPrefixStart & 0xff;
+        if (i + 1 < nParts) {
+            unsigned int nPrefixEnd = (i + 1) * 65536 / nParts;
+            pcursor->fEnd = true;
+            pcursor->hashEnd.begin()[0] = nPrefixEnd >> 8;
+            pcursor->hashEnd.begin()[1] = nPrefixEnd & 0xff;
+        }
+        pcursor->Seek(hashStart);
+    }
+    return vCursors;
+}
+
 bool CCoinsViewDBCursor::GetKey(COutPoint &key) const
 {
     // Return cached key
@@ -175,8 +421,20 @@ bool CCoinsViewDBCursor::Valid() const
 void CCoinsViewDBCursor::Next()
 {
     pcursor->Next();
+    CacheKey();
+}
+
+void CCoinsViewDBCursor::Seek(const uint256 &hashStart)
+{
+    COutPoint start(hashStart, 0);
+    pcursor->Seek(CoinEntry(&start));
+    CacheKey();
+}
+
+void CCoinsViewDBCursor::CacheKey()
+{
     CoinEntry entry(&keyTmp.second);
-    if (!pcursor->Valid() || !pcursor->GetKey(entry)) {
+    if (!pcursor->Valid() || !pcursor->GetKey(entry) || (fEnd && !(keyTmp.second.hash < hashEnd))) {
         keyTmp.first = 0; // Invalidate cached key after last record so that Valid() and GetKey() return false
     } else {
         keyTmp.first = entry.key;
@@ -206,12 +464,121 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value) {
-    return Read(make_pair(DB_SPENTINDEX, key), value);
+bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
+    return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
 
-bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect) {
-    CDBBatch batch(*this);
+bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
+    char ch;
+    if (!Read(std::make_pair(DB_FLAG, name), ch))
+        return false;
+    fValue = ch == '1';
+    return true;
+}
+
+/** Block index records read before they are hashed and added to the index */
+static const size_t BLOCK_INDEX_LOAD_BATCH = 50000;
+/** Records hashed per thread while loading the block index, below that fewer threads are used */
+static const size_t BLOCK_INDEX_HASHES_PER_THREAD = 2000;
+
+/** Compute the block hashes of a batch of block index records and check their proof of work */
+static void HashDiskBlockIndexes(const std::vector<CDiskBlockIndex>& vDiskIndex, std::vector<uint256>& vHashes, std::vector<char>& vValid)
+{
+    vHashes.resize(vDiskIndex.size());
+    vValid.resize(vDiskIndex.size());
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    auto hash = [&vDiskIndex, &vHashes, &vValid, &consensusParams](int n, int nThreads) {
+        for (size_t i = n; i < vDiskIndex.size(); i += nThreads) {
+            vHashes[i] = vDiskIndex[i].GetBlockHash();
+            vValid[i] = CheckProofOfWork(vDiskIndex[i].nHeight, vHashes[i], vDiskIndex[i].nBits, consensusParams);
+        }
+    };
+
+    int nThreads = std::max(1, std::min(GetNumCores(), (int) (vDiskIndex.size() / BLOCK_INDEX_HASHES_PER_THREAD)));
+    if (nThreads == 1) {
+        hash(0, 1);
+        return;
+    }
+    boost::thread_group hashers;
+    for (int n = 0; n < nThreads; n++)
+        hashers.create_thread(boost::bind<void>(hash, n, nThreads));
+    hashers.join_all();
+}
+
+bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&, int)> insertBlockIndex)
+{
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(make_pair(DB_BLOCK_INDEX, uint256()));
+
+    // Load mapBlockIndex. The records are read in batches and their hashes,
+    // the bulk of the work, are computed on several threads.
+    std::vector<CDiskBlockIndex> vDiskIndex;
+    std::vector<uint256> vHashes;
+    std::vector<char> vValid;
+    bool fDone = false;
+    while (!fDone) {
+        vDiskIndex.clear();
+        while (vDiskIndex.size() < BLOCK_INDEX_LOAD_BATCH) {
+            boost::this_thread::interruption_point();
+            std::pair<char, uint256> key;
+            if (!pcursor->Valid() || !pcursor->GetKey(key) || key.first != DB_BLOCK_INDEX) {
+                fDone = true;
+                break;
+            }
+            vDiskIndex.push_back(CDiskBlockIndex());
+            if (!pcursor->GetValue(vDiskIndex.back()))
+                return error("%s: failed to read value", __func__);
+            pcursor->Next();
+        }
+
+        HashDiskBlockIndexes(vDiskIndex, vHashes, vValid);
+
+        for (size_t i = 0; i < vDiskIndex.size(); i++) {
+            const CDiskBlockIndex& diskindex = vDiskIndex[i];
+
+            // Construct block index object, the heights place it and its parent in the block index store
+            CBlockIndex* pindexNew = insertBlockIndex(vHashes[i], diskindex.nHeight);
+            pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev, diskindex.nHeight - 1);
+            pindexNew->nHeight        = diskindex.nHeight;
+            pindexNew->nFile          = diskindex.nFile;
+            pindexNew->nDataPos       = diskindex.nDataPos;
+            pindexNew->nUndoPos       = diskindex.nUndoPos;
+            pindexNew->nVersion       = diskindex.nVersion;
+            pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+            pindexNew->nTime          = diskindex.nTime;
+            pindexNew->nBits          = diskindex.nBits;
+            pindexNew->nNonce         = diskindex.nNonce;
+            pindexNew->nStatus        = diskindex.nStatus;
+            pindexNew->nTx            = diskindex.nTx;
+            pindexNew->nSize          = diskindex.nSize;
+
+            if (!vValid[i])
+                return error("%s: CheckProofOfWork failed: %s", __func__, pindexNew->ToString());
+        }
+    }
+
+    return true;
+}
+
+CIndexDB::CIndexDB(size_t nCacheSize, bool fMemory, bool fWipe, int nFilterBits) : CDBWrapper(GetDataDir() / "indexes", nCacheSize, fMemory, fWipe, false, nFilterBits),
+    nQueuedIndexEntries(0), fIndexWriting(false), fIndexWriteFailed(false), fIndexWriterStop(false) {
+}
+
+CIndexDB::~CIndexDB()
+{
+    // The writer empties the queue before it stops
+    {
+        std::lock_guard<std::mutex> lock(csIndexQueue);
+        fIndexWriterStop = true;
+    }
+    condIndexQueue.notify_all();
+    if (threadIndexWriter.joinable())
+        threadIndexWriter.join();
+}
+
+static void BatchSpentIndex(CDBBatch &batch, const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > &vect)
+{
     for (std::vector<std::pair<CSpentIndexKey,CSpentIndexValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
         if (it->second.IsNull()) {
             batch.Erase(make_pair(DB_SPENTINDEX, it->first));
@@ -219,11 +586,10 @@ bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey,
             batch.Write(make_pair(DB_SPENTINDEX, it->first), it->second);
         }
     }
-    return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect) {
-    CDBBatch batch(*this);
+static void BatchAddressUnspentIndex(CDBBatch &batch, const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect)
+{
     for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
         if (it->second.IsNull()) {
             batch.Erase(make_pair(DB_ADDRESSUNSPENTINDEX, it->first));
@@ -231,23 +597,145 @@ bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddres
             batch.Write(make_pair(DB_ADDRESSUNSPENTINDEX, it->first), it->second);
         }
     }
+}
+
+static void BatchAddressIndex(CDBBatch &batch, const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect, bool fErase)
+{
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
+        if (fErase)
+            batch.Erase(make_pair(DB_ADDRESSINDEX, it->first));
+        else
+            batch.Write(make_pair(DB_ADDRESSINDEX, it->first), it->second);
+    }
+}
+
+static void BatchTimestampIndex(CDBBatch &batch, const CTimestampIndexKey &timestampIndex)
+{
+    batch.Write(make_pair(DB_TIMESTAMPINDEX, timestampIndex), 0);
+}
+
+bool CIndexDB::QueueIndexUpdates(CIndexUpdates &&updates)
+{
+    size_t nEntries = updates.size();
+    if (nEntries == 0)
+        return true;
+    {
+        std::unique_lock<std::mutex> lock(csIndexQueue);
+        if (!threadIndexWriter.joinable())
+            threadIndexWriter = std::thread(&CIndexDB::ThreadIndexWriter, this);
+        // Don't let the writer fall behind without bounds
+        condIndexQueue.wait(lock, [this]() { return nQueuedIndexEntries < MAX_QUEUED_INDEX_ENTRIES || fIndexWriteFailed; });
+        if (fIndexWriteFailed)
+            return false;
+        queueIndexUpdates.push_back(std::move(updates));
+        nQueuedIndexEntries += nEntries;
+    }
+    condIndexQueue.notify_all();
+    return true;
+}
+
+bool CIndexDB::SyncIndexUpdates()
+{
+    std::unique_lock<std::mutex> lock(csIndexQueue);
+    condIndexQueue.wait(lock, [this]() { return (queueIndexUpdates.empty() && !fIndexWriting) || fIndexWriteFailed; });
+    return !fIndexWriteFailed;
+}
+
+void CIndexDB::ThreadIndexWriter()
+{
+    RenameThread("smartcash-indexwriter");
+
+    std::unique_lock<std::mutex> lock(csIndexQueue);
+    while (true) {
+        condIndexQueue.wait(lock, [this]() { return !queueIndexUpdates.empty() || fIndexWriterStop; });
+        if (queueIndexUpdates.empty())
+            return;
+
+        std::deque<CIndexUpdates> queueWrite;
+        queueWrite.swap(queueIndexUpdates);
+        size_t nEntries = nQueuedIndexEntries;
+        nQueuedIndexEntries = 0;
+        fIndexWriting = true;
+        lock.unlock();
+        condIndexQueue.notify_all();
+
+        int64_t nStart = GetTimeMicros();
+        CDBBatch batch(*this);
+        for (const CIndexUpdates &updates : queueWrite) {
+            BatchAddressIndex(batch, updates.vAddressIndexErase, true);
+            BatchAddressIndex(batch, updates.vAddressIndex, false);
+            BatchAddressUnspentIndex(batch, updates.vAddressUnspentIndex);
+            BatchSpentIndex(batch, updates.vSpentIndex);
+            for (const CTimestampIndexKey &timestampIndex : updates.vTimestampIndex)
+                BatchTimestampIndex(batch, timestampIndex);
+        }
+        bool fOk = false;
+        try {
+            fOk = WriteBatch(batch);
+        } catch (const std::exception& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+        }
+        if (fOk)
+            LogPrint("bench", "    - Background index write: %.2fms (%u entries of %u blocks)\n", (GetTimeMicros() - nStart) * 0.001, nEntries, queueWrite.size());
+        else
+            LogPrintf("%s: failed to write %u index entries\n", __func__, nEntries);
+
+        lock.lock();
+        fIndexWriting = false;
+        fIndexWriteFailed |= !fOk;
+        condIndexQueue.notify_all();
+    }
+}
+
+bool CIndexDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value) {
+    SyncIndexUpdates();
+    return Read(make_pair(DB_SPENTINDEX, key), value);
+}
+
+bool CIndexDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect) {
+    CDBBatch batch(*this);
+    BatchSpentIndex(batch, vect);
     return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type,
-                                           std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs) {
+bool CIndexDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect) {
+    CDBBatch batch(*this);
+    BatchAddressUnspentIndex(batch, vect);
+    return WriteBatch(batch);
+}
 
+/**
+ * Seek to the first key after key. The keys of an index all have the same size, so key with
+ * any byte appended sorts right after it and before the next key of the index.
+ */
+template <typename K>
+static void SeekAfter(CDBIterator &cursor, const K &key)
+{
+    cursor.Seek(make_pair(key, (unsigned char)0));
+}
+
+bool CIndexDB::ReadAddressUnspentIndex(uint160 addressHash, int type,
+                                       std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs,
+                                       size_t nLimit, const CAddressUnspentKey *pkeyAfter) {
+
+    SyncIndexUpdates();
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
-    pcursor->Seek(make_pair(DB_ADDRESSUNSPENTINDEX, CAddressIndexIteratorKey(type, addressHash)));
+    if (pkeyAfter) {
+        SeekAfter(*pcursor, make_pair(DB_ADDRESSUNSPENTINDEX, *pkeyAfter));
+    } else {
+        pcursor->Seek(make_pair(DB_ADDRESSUNSPENTINDEX, CAddressIndexIteratorKey(type, addressHash)));
+    }
 
-    while (pcursor->Valid()) {
+    size_t nRead = 0;
+    while (pcursor->Valid() && (nLimit == 0 || nRead < nLimit)) {
         boost::this_thread::interruption_point();
         std::pair<char,CAddressUnspentKey> key;
         if (pcursor->GetKey(key) && key.first == DB_ADDRESSUNSPENTINDEX && key.second.hashBytes == addressHash) {
             CAddressUnspentValue nValue;
             if (pcursor->GetValue(nValue)) {
                 unspentOutputs.push_back(make_pair(key.second, nValue));
+                nRead++;
                 pcursor->Next();
             } else {
                 return error("failed to get address unspent value");
@@ -260,33 +748,36 @@ bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type,
     return true;
 }
 
-bool CBlockTreeDB::WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
+bool CIndexDB::WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
     CDBBatch batch(*this);
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
-        batch.Write(make_pair(DB_ADDRESSINDEX, it->first), it->second);
+    BatchAddressIndex(batch, vect, false);
     return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
+bool CIndexDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount > >&vect) {
     CDBBatch batch(*this);
-    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
-        batch.Erase(make_pair(DB_ADDRESSINDEX, it->first));
+    BatchAddressIndex(batch, vect, true);
     return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type,
-                                    std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
-                                    int start, int end) {
+bool CIndexDB::ReadAddressIndex(uint160 addressHash, int type,
+                                std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+                                int start, int end,
+                                size_t nLimit, const CAddressIndexKey *pkeyAfter) {
 
+    SyncIndexUpdates();
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
-    if (start > 0 && end > 0) {
+    if (pkeyAfter) {
+        SeekAfter(*pcursor, make_pair(DB_ADDRESSINDEX, *pkeyAfter));
+    } else if (start > 0 && end > 0) {
         pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, start)));
     } else {
         pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(type, addressHash)));
     }
 
-    while (pcursor->Valid()) {
+    size_t nRead = 0;
+    while (pcursor->Valid() && (nLimit == 0 || nRead < nLimit)) {
         boost::this_thread::interruption_point();
         std::pair<char,CAddressIndexKey> key;
         if (pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX && key.second.hashBytes == addressHash) {
@@ -296,6 +787,7 @@ bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type,
             CAmount nValue;
             if (pcursor->GetValue(nValue)) {
                 addressIndex.push_back(make_pair(key.second, nValue));
+                nRead++;
                 pcursor->Next();
             } else {
                 return error("failed to get address index value");
@@ -308,14 +800,15 @@ bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type,
     return true;
 }
 
-bool CBlockTreeDB::WriteTimestampIndex(const CTimestampIndexKey &timestampIndex) {
+bool CIndexDB::WriteTimestampIndex(const CTimestampIndexKey &timestampIndex) {
     CDBBatch batch(*this);
-    batch.Write(make_pair(DB_TIMESTAMPINDEX, timestampIndex), 0);
+    BatchTimestampIndex(batch, timestampIndex);
     return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &hashes) {
+bool CIndexDB::ReadTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &hashes) {
 
+    SyncIndexUpdates();
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
     pcursor->Seek(make_pair(DB_TIMESTAMPINDEX, CTimestampIndexIteratorKey(low)));
@@ -334,61 +827,61 @@ bool CBlockTreeDB::ReadTimestampIndex(const unsigned int &high, const unsigned i
     return true;
 }
 
-bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
-    return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
-}
-
-bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
-    char ch;
-    if (!Read(std::make_pair(DB_FLAG, name), ch))
-        return false;
-    fValue = ch == '1';
-    return true;
-}
+//! Size at which MoveFromBlockTree writes out what it moved so far
+static const size_t MOVE_INDEX_BATCH_SIZE = 16 << 20;
 
-bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex)
+/** Move the entries of one index from dbFrom to dbTo, see CIndexDB::MoveFromBlockTree. */
+template <typename K, typename V>
+static bool MoveIndexEntries(CDBWrapper &dbFrom, CDBWrapper &dbTo, char chPrefix, size_t &nMoved)
 {
-    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
-
-    pcursor->Seek(make_pair(DB_BLOCK_INDEX, uint256()));
+    boost::scoped_ptr<CDBIterator> pcursor(dbFrom.NewIterator());
+    pcursor->Seek(chPrefix);
 
-    // Load mapBlockIndex
+    CDBBatch batchTo(dbTo);
+    CDBBatch batchFrom(dbFrom);
+    size_t nEntries = 0;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
-        std::pair<char, uint256> key;
-        if (pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX) {
-            CDiskBlockIndex diskindex;
-            if (pcursor->GetValue(diskindex)) {
-                // Construct block index object
-                CBlockIndex* pindexNew = insertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
-                pindexNew->nHeight        = diskindex.nHeight;
-                pindexNew->nFile          = diskindex.nFile;
-                pindexNew->nDataPos       = diskindex.nDataPos;
-                pindexNew->nUndoPos       = diskindex.nUndoPos;
-                pindexNew->nVersion       = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->nTime          = diskindex.nTime;
-                pindexNew->nBits          = diskindex.nBits;
-                pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nStatus        = diskindex.nStatus;
-                pindexNew->nTx            = diskindex.nTx;
-
-                if (!CheckProofOfWork(pindexNew->nHeight, pindexNew->GetBlockHash(), pindexNew->nBits, Params().GetConsensus()))
-                    return error("%s: CheckProofOfWork failed: %s", __func__, pindexNew->ToString());
-
-                pcursor->Next();
-            } else {
-                return error("%s: failed to read value", __func__);
-            }
-        } else {
+        std::pair<char, K> key;
+        if (!pcursor->GetKey(key) || key.first != chPrefix)
             break;
+        V value;
+        if (!pcursor->GetValue(value))
+            return error("%s: failed to read index entry", __func__);
+        batchTo.Write(key, value);
+        batchFrom.Erase(key);
+        nEntries++;
+        if (batchTo.SizeEstimate() > MOVE_INDEX_BATCH_SIZE) {
+            if (!dbTo.WriteBatch(batchTo, true) || !dbFrom.WriteBatch(batchFrom))
+                return false;
+            batchTo.Clear();
+            batchFrom.Clear();
+            LogPrintf("[%u entries]...", nMoved + nEntries);
         }
+        pcursor->Next();
     }
-
+    if (!dbTo.WriteBatch(batchTo, true) || !dbFrom.WriteBatch(batchFrom))
+        return false;
+    if (nEntries > 0) {
+        // Hand the space of the erased entries back now rather than whenever leveldb gets to it
+        dbFrom.CompactRange(chPrefix, (char)(chPrefix + 1));
+    }
+    nMoved += nEntries;
     return true;
 }
 
+bool CIndexDB::MoveFromBlockTree(CBlockTreeDB &blocktree)
+{
+    size_t nMoved = 0;
+    bool fOk = MoveIndexEntries<CAddressIndexKey, CAmount>(blocktree, *this, DB_ADDRESSINDEX, nMoved) &&
+               MoveIndexEntries<CAddressUnspentKey, CAddressUnspentValue>(blocktree, *this, DB_ADDRESSUNSPENTINDEX, nMoved) &&
+               MoveIndexEntries<CSpentIndexKey, CSpentIndexValue>(blocktree, *this, DB_SPENTINDEX, nMoved) &&
+               MoveIndexEntries<CTimestampIndexKey, int>(blocktree, *this, DB_TIMESTAMPINDEX, nMoved);
+    if (nMoved > 0)
+        LogPrintf("Moved %u entries of the address, spent and timestamp indexes out of the block index database\n", nMoved);
+    return fOk;
+}
+
 namespace {
 
 //! Legacy class to deserialize pre-pertxout database entries without reindex.
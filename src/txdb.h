@@ -10,9 +10,18 @@
 #include "dbwrapper.h"
 #include "chain.h"
 #include "spentindex.h"
+#include "utxostats.h"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -38,8 +47,18 @@ static const int64_t nMaxBlockDBCache = 2;
 // Unlike for the UTXO database, for the txindex scenario the leveldb cache make
 // a meaningful difference: https://github.com/bitcoin/bitcoin/pull/8273#issuecomment-229601991
 static const int64_t nMaxBlockDBAndTxIndexCache = 1024;
+//! Max memory allocated to the address, spent and timestamp index DB cache, if any of them is enabled (MiB)
+static const int64_t nMaxIndexDBCache = 1024;
+//! Max memory allocated to the address, spent and timestamp index DB cache, if none of them is enabled (MiB)
+static const int64_t nMaxUnusedIndexDBCache = 1;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
+//! -backgroundflush default
+static const bool DEFAULT_BACKGROUND_FLUSH = true;
+//! Maximum number of coins read ahead by CCoinsViewDB::Prefetch that wait to be fetched
+static const size_t MAX_PREFETCHED_COINS = 200000;
+//! Maximum number of index entries queued for CIndexDB's index writer before blocks wait for it
+static const size_t MAX_QUEUED_INDEX_ENTRIES = 500000;
 
 struct CDiskTxPos : public CDiskBlockPos
 {
@@ -66,23 +85,81 @@ struct CDiskTxPos : public CDiskBlockPos
     }
 };
 
-/** CCoinsView backed by the coin database (chainstate/) */
+/** CCoinsView backed by the coin database (chainstate/)
+ *
+ *  With background writes enabled BatchWrite only moves the dirty entries into a snapshot, a
+ *  background thread writes the snapshot to the database in one batch. Until that is done the
+ *  snapshot is consulted before the database, so the view always shows the state of the last
+ *  BatchWrite. At most one write is in progress, the next BatchWrite waits for it to finish.
+ *
+ *  Prefetch reads coins from any thread ahead of their use. They are kept until GetCoin asks for
+ *  them or the next BatchWrite invalidates them.
+ */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CDBWrapper db;
+
+private:
+    bool fBackgroundWrites;
+    //! Protects fSnapshot against the background writer, which resets it once the snapshot is written
+    mutable std::mutex csSnapshot;
+    bool fSnapshot;
+    CCoinsMapMemoryResource snapshotMemoryResource;
+    CCoinsMap mapSnapshot;
+    uint256 hashSnapshot;
+    //! Protects threadWrite, it gets joined from any thread that waits for the write
+    mutable std::mutex csWrite;
+    mutable std::thread threadWrite;
+    std::atomic<bool> fWriteFailed;
+    //! Coins read by Prefetch, and the number of BatchWrites they were read after
+    mutable std::mutex csPrefetch;
+    mutable std::unordered_map<COutPoint, Coin, SaltedOutpointHasher> mapPrefetched;
+    uint64_t nPrefetchGeneration;
+    //! Statistics of the UTXO set to write along with the next BatchWrite, and with the snapshot
+    bool fStatsPending;
+    CUTXOStats statsPending;
+    bool fStatsSnapshot;
+    CUTXOStats statsSnapshot;
+
+    bool WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock, const CUTXOStats *pstats);
+    void ThreadWriteSnapshot();
+    void WaitForWrite() const;
+    //! Whether outpoint is in the snapshot not yet written, if so copies its coin to pcoin unless it is spent.
+    bool GetSnapshotCoin(const COutPoint &outpoint, Coin *pcoin, bool &fSpent) const;
+    //! Drop the prefetched coins and those being read, they may predate a BatchWrite.
+    void ResetPrefetched();
+
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CCoinsViewDB();
 
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
+    /**
+     * Cursors over nParts ranges of txids which together cover the whole set. They all read the same
+     * snapshot of the database, so they can be used from different threads and see the same best
+     * block. See ParallelCoinsScan.
+     */
+    std::vector<std::unique_ptr<CCoinsViewCursor> > RangeCursors(int nParts) const;
 
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
     size_t EstimateSize() const override;
+
+    //! Let BatchWrite return before its changes are written, see above.
+    void SetBackgroundWrites(bool fBackgroundWritesIn);
+    //! Wait until the changes of the last BatchWrite are in the database, false if a background write failed.
+    bool Sync();
+    //! Read the coins of vOutPoints into memory for a later GetCoin. Thread safe.
+    void Prefetch(const std::vector<COutPoint> &vOutPoints);
+    //! Statistics of the UTXO set the next BatchWrite leaves behind, NULL if they are not known.
+    void SetUTXOStats(const CUTXOStats *pstats);
+    //! Read the statistics written with the best block, false if there are none for it.
+    bool ReadUTXOStats(CUTXOStats &stats) const;
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -100,13 +177,60 @@ public:
 
 private:
     CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn):
-        CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn) {}
+        CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn), fEnd(false) {}
     boost::scoped_ptr<CDBIterator> pcursor;
     std::pair<char, COutPoint> keyTmp;
+    //! Txid the cursor stops at, if it covers a range only
+    bool fEnd;
+    uint256 hashEnd;
+
+    //! Start at the first coin of hashStart or after
+    void Seek(const uint256 &hashStart);
+    void CacheKey();
 
     friend class CCoinsViewDB;
 };
 
+/**
+ * Read all coins of view with a thread for each of vResults: fn(cursor, result) gets called in each
+ * of them with a cursor over a part of the coins and the result to fill in for it. Merging the
+ * results is up to the caller. Returns false if any of the calls did or threw.
+ */
+template <typename T, typename Fn>
+bool ParallelCoinsScan(const CCoinsViewDB &view, std::vector<T> &vResults, Fn fn)
+{
+    std::vector<std::unique_ptr<CCoinsViewCursor> > vCursors = view.RangeCursors(vResults.size());
+    std::vector<char> vOk(vResults.size(), false);
+    std::vector<std::thread> vThreads;
+    for (size_t i = 0; i < vResults.size(); i++) {
+        vThreads.emplace_back([&, i]() {
+            try {
+                vOk[i] = fn(*vCursors[i], vResults[i]);
+            } catch (...) {
+                vOk[i] = false;
+            }
+        });
+    }
+    for (std::thread &thread : vThreads)
+        thread.join();
+    return std::find(vOk.begin(), vOk.end(), false) == vOk.end();
+}
+
+/** The changes a block makes to the address, spent and timestamp indexes. */
+struct CIndexUpdates
+{
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vAddressIndex;
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vAddressIndexErase;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vAddressUnspentIndex;
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > vSpentIndex;
+    std::vector<CTimestampIndexKey> vTimestampIndex;
+
+    size_t size() const
+    {
+        return vAddressIndex.size() + vAddressIndexErase.size() + vAddressUnspentIndex.size() + vSpentIndex.size() + vTimestampIndex.size();
+    }
+};
+
 /** Access to the block database (blocks/index/) */
 class CBlockTreeDB : public CDBWrapper
 {
@@ -123,21 +247,76 @@ public:
     bool ReadReindexing(bool &fReindex);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    bool WriteFlag(const std::string &name, bool fValue);
+    bool ReadFlag(const std::string &name, bool &fValue);
+    //! Read the record of one block, without loading the block index.
+    bool ReadDiskBlockIndex(const uint256 &hash, CDiskBlockIndex &index);
+    bool LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&, int)> insertBlockIndex);
+};
+
+/**
+ * Access to the address, spent and timestamp indexes (indexes/)
+ *
+ * They are kept apart from the block index, which stays small and mostly in the cache, while
+ * these grow with every transaction and get scanned by address and time range: a database of
+ * their own gets its own cache share and compactions that don't hold up block index writes.
+ * Whether an index is enabled is still recorded with the flags of the block index.
+ */
+class CIndexDB : public CDBWrapper
+{
+public:
+    CIndexDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, int nFilterBits = DEFAULT_DB_FILTER_BITS);
+    ~CIndexDB();
+private:
+    CIndexDB(const CIndexDB&);
+    void operator=(const CIndexDB&);
+
+    //! Index updates waiting for the index writer, which writes all of them with one batch
+    std::mutex csIndexQueue;
+    std::condition_variable condIndexQueue;
+    std::deque<CIndexUpdates> queueIndexUpdates;
+    size_t nQueuedIndexEntries;
+    bool fIndexWriting;
+    bool fIndexWriteFailed;
+    bool fIndexWriterStop;
+    std::thread threadIndexWriter;
+
+    void ThreadIndexWriter();
+public:
+    /**
+     * Write the updates from a thread of its own, together with the others queued by then.
+     * Updates get written in the order they were queued in. Returns false if a previous write failed.
+     */
+    bool QueueIndexUpdates(CIndexUpdates &&updates);
+    //! Wait until the queued index updates are written, false if writing one of them failed.
+    bool SyncIndexUpdates();
+
     bool ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
     bool UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >&vect);
     bool UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue > >&vect);
+    /**
+     * The address reads append the entries of an address in the order of their keys. They read
+     * at most nLimit entries if it isn't 0, and only the ones after *pkeyAfter if that is set,
+     * so that a caller can go through the entries page by page.
+     */
     bool ReadAddressUnspentIndex(uint160 addressHash, int type,
-                                 std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect);
+                                 std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect,
+                                 size_t nLimit = 0, const CAddressUnspentKey *pkeyAfter = NULL);
     bool WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
     bool EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
     bool ReadAddressIndex(uint160 addressHash, int type,
                           std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
-                          int start = 0, int end = 0);
+                          int start = 0, int end = 0,
+                          size_t nLimit = 0, const CAddressIndexKey *pkeyAfter = NULL);
     bool WriteTimestampIndex(const CTimestampIndexKey &timestampIndex);
     bool ReadTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &vect);
-    bool WriteFlag(const std::string &name, bool fValue);
-    bool ReadFlag(const std::string &name, bool &fValue);
-    bool LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex);
+
+    /**
+     * Move the index entries older versions kept in the block index database over to this one.
+     * Entries are written here before they get erased there, so an interrupted move just
+     * continues on the next start.
+     */
+    bool MoveFromBlockTree(CBlockTreeDB &blocktree);
 };
 
 #endif // BITCOIN_TXDB_H
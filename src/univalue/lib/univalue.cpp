@@ -182,6 +182,15 @@ bool UniValue::push_back(const UniValue& val)
     return true;
 }
 
+bool UniValue::push_back(UniValue&& val)
+{
+    if (typ != VARR)
+        return false;
+
+    values.push_back(std::move(val));
+    return true;
+}
+
 bool UniValue::push_backV(const std::vector<UniValue>& vec)
 {
     if (typ != VARR)
@@ -202,6 +211,16 @@ bool UniValue::pushKV(const std::string& key, const UniValue& val)
     return true;
 }
 
+bool UniValue::pushKV(const std::string& key, UniValue&& val)
+{
+    if (typ != VOBJ)
+        return false;
+
+    keys.push_back(key);
+    values.push_back(std::move(val));
+    return true;
+}
+
 bool UniValue::pushKVs(const UniValue& obj)
 {
     if (typ != VOBJ || obj.typ != VOBJ)
@@ -0,0 +1,190 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "utxosnapshot.h"
+
+#include "chain.h"
+#include "clientversion.h"
+#include "coins.h"
+#include "smartrewards/rewardsdb.h"
+#include "streams.h"
+#include "tinyformat.h"
+#include "txdb.h"
+#include "util.h"
+
+#include <memory>
+
+#include <boost/filesystem.hpp>
+#include <boost/thread/thread.hpp>
+
+CUTXOSnapshotHeader::CUTXOSnapshotHeader() :
+    nMagic(SNAPSHOT_MAGIC), nSnapshotVersion(CURRENT_VERSION), nHeight(0), nRewardsVersion(REWARDS_DB_VERSION)
+{
+}
+
+static bool WriteSnapshotFile(CAutoFile &file, const CUTXOSnapshotHeader &header, CCoinsViewCursor &cursor,
+                              CDBIterator &rewardsCursor, CUTXOStats &stats, uint64_t &nRewardsRecords, std::string &strError)
+{
+    file << header;
+
+    stats = CUTXOStats();
+    stats.hashBlock = header.hashBlock;
+
+    for (; cursor.Valid(); cursor.Next()) {
+        boost::this_thread::interruption_point();
+        COutPoint outpoint;
+        Coin coin;
+        if (!cursor.GetKey(outpoint) || !cursor.GetValue(coin)) {
+            strError = "Unable to read the UTXO set";
+            return false;
+        }
+        stats.AddCoin(outpoint, coin);
+        file << (uint8_t)1 << outpoint << coin;
+    }
+    file << (uint8_t)0 << stats;
+
+    if (!CSmartRewardsDB::DumpRecords(rewardsCursor, file, nRewardsRecords)) {
+        strError = "Unable to read the rewards database";
+        return false;
+    }
+
+    FileCommit(file.Get());
+    return true;
+}
+
+bool WriteUTXOSnapshot(const boost::filesystem::path &path, const CUTXOSnapshotHeader &header, CCoinsViewCursor &cursor,
+                       CDBIterator &rewardsCursor, CUTXOStats &stats, uint64_t &nRewardsRecords, std::string &strError)
+{
+    // Nobody should pick up a file that isn't complete yet
+    boost::filesystem::path pathTemp = path;
+    pathTemp += ".incomplete";
+
+    CAutoFile file(fopen(pathTemp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        strError = strprintf("Unable to open %s for writing", pathTemp.string());
+        return false;
+    }
+
+    bool fOk = false;
+    try {
+        fOk = WriteSnapshotFile(file, header, cursor, rewardsCursor, stats, nRewardsRecords, strError);
+    } catch (const std::exception &e) {
+        strError = strprintf("Unable to write %s: %s", pathTemp.string(), e.what());
+    }
+    file.fclose();
+
+    if (fOk && !RenameOver(pathTemp, path)) {
+        strError = strprintf("Unable to rename %s to %s", pathTemp.string(), path.string());
+        fOk = false;
+    }
+    if (!fOk)
+        boost::filesystem::remove(pathTemp);
+    return fOk;
+}
+
+static bool LoadSnapshotFile(CAutoFile &file, CCoinsViewDB &view, CBlockTreeDB &blocktree, size_t nCacheSize,
+                             size_t nRewardsCacheSize, CUTXOSnapshotHeader &header, std::string &strError)
+{
+    file >> header;
+    if (header.nMagic != CUTXOSnapshotHeader::SNAPSHOT_MAGIC || header.nSnapshotVersion != CUTXOSnapshotHeader::CURRENT_VERSION) {
+        strError = "Not a UTXO snapshot, or one of an unknown version";
+        return false;
+    }
+    if (header.nRewardsVersion != REWARDS_DB_VERSION) {
+        strError = strprintf("The snapshot holds a version %d rewards database, expected version %d", header.nRewardsVersion, REWARDS_DB_VERSION);
+        return false;
+    }
+
+    // The chainstate continues from the base block, so the block index has to know it already
+    CDiskBlockIndex index;
+    if (!blocktree.ReadDiskBlockIndex(header.hashBlock, index) || index.nHeight != header.nHeight ||
+        !(index.nStatus & BLOCK_HAVE_DATA) || (index.nStatus & BLOCK_FAILED_MASK)) {
+        strError = strprintf("Block %s at height %d the snapshot was taken at is not stored", header.hashBlock.ToString(), header.nHeight);
+        return false;
+    }
+
+    LogPrintf("%s: Loading the coins as of block %s at height %d\n", __func__, header.hashBlock.ToString(), header.nHeight);
+
+    // Without a best block the coins written in between don't count as a chainstate yet,
+    // HasIncompleteUTXOSnapshot finds them if the load doesn't get to the end.
+    CCoinsViewCache cache(&view);
+    CUTXOStats stats;
+    stats.hashBlock = header.hashBlock;
+
+    uint8_t fMore;
+    for (file >> fMore; fMore; file >> fMore) {
+        boost::this_thread::interruption_point();
+        COutPoint outpoint;
+        Coin coin;
+        file >> outpoint >> coin;
+        if (coin.IsSpent()) {
+            strError = strprintf("The snapshot holds a spent coin %s", outpoint.ToString());
+            return false;
+        }
+        stats.AddCoin(outpoint, coin);
+        cache.AddCoin(outpoint, std::move(coin), false);
+        if (cache.DynamicMemoryUsage() > nCacheSize && !cache.Flush()) {
+            strError = "Unable to write to the coin database";
+            return false;
+        }
+    }
+
+    CUTXOStats statsFile;
+    file >> statsFile;
+    if (statsFile.hashBlock != stats.hashBlock || statsFile.nTransactionOutputs != stats.nTransactionOutputs ||
+        statsFile.nTotalAmount != stats.nTotalAmount || statsFile.GetHash() != stats.GetHash()) {
+        strError = "The coins of the snapshot don't match its hash";
+        return false;
+    }
+
+    cache.SetBestBlock(header.hashBlock);
+    view.SetUTXOStats(&stats);
+    if (!cache.Flush() || !view.Sync()) {
+        strError = "Unable to write to the coin database";
+        return false;
+    }
+
+    LogPrintf("%s: Loaded %u coins, UTXO set hash %s\n", __func__, stats.nTransactionOutputs, stats.GetHash().ToString());
+
+    // Picked up by CSmartRewards as usual, which processes the blocks above its last one
+    uint64_t nRewardsRecords;
+    std::unique_ptr<CSmartRewardsDB> prewardsdb(new CSmartRewardsDB(nRewardsCacheSize, false, true));
+    if (!prewardsdb->LoadRecords(file, nRewardsRecords)) {
+        strError = "Unable to write to the rewards database";
+        return false;
+    }
+
+    LogPrintf("%s: Loaded %u records of the rewards database\n", __func__, nRewardsRecords);
+    return true;
+}
+
+bool LoadUTXOSnapshot(const boost::filesystem::path &path, CCoinsViewDB &view, CBlockTreeDB &blocktree,
+                      size_t nCacheSize, size_t nRewardsCacheSize, CUTXOSnapshotHeader &header, std::string &strError)
+{
+    if (!view.GetBestBlock().IsNull() || HasIncompleteUTXOSnapshot(view)) {
+        strError = "The chainstate is not empty";
+        return false;
+    }
+
+    CAutoFile file(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        strError = strprintf("Unable to open %s", path.string());
+        return false;
+    }
+
+    try {
+        return LoadSnapshotFile(file, view, blocktree, nCacheSize, nRewardsCacheSize, header, strError);
+    } catch (const std::exception &e) {
+        strError = strprintf("Unable to read %s: %s", path.string(), e.what());
+    }
+    return false;
+}
+
+bool HasIncompleteUTXOSnapshot(const CCoinsViewDB &view)
+{
+    if (!view.GetBestBlock().IsNull())
+        return false;
+    std::unique_ptr<CCoinsViewCursor> pcursor(view.Cursor());
+    return pcursor->Valid();
+}
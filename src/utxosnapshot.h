@@ -0,0 +1,73 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SMARTCASH_UTXOSNAPSHOT_H
+#define SMARTCASH_UTXOSNAPSHOT_H
+
+#include "serialize.h"
+#include "uint256.h"
+#include "utxostats.h"
+
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+
+class CBlockTreeDB;
+class CCoinsViewCursor;
+class CCoinsViewDB;
+class CDBIterator;
+
+/**
+ * Header of a file written by dumptxoutset, which lets a node start from the UTXO set and the
+ * rewards database of another one instead of connecting all blocks again. The header is followed by
+ *
+ * - the coins as of hashBlock, each one preceded by a 1, the last one followed by a 0,
+ * - their statistics, the hash of the set among them,
+ * - the records of the rewards database as of its own last block, some blocks below hashBlock.
+ */
+class CUTXOSnapshotHeader
+{
+public:
+    static const uint32_t SNAPSHOT_MAGIC = 0x75747873;
+    static const uint32_t CURRENT_VERSION = 1;
+
+    uint32_t nMagic;
+    uint32_t nSnapshotVersion;
+    uint256 hashBlock;
+    int nHeight;
+    uint8_t nRewardsVersion;
+
+    CUTXOSnapshotHeader();
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(nMagic);
+        READWRITE(nSnapshotVersion);
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+        READWRITE(nRewardsVersion);
+    }
+};
+
+/**
+ * Write the coins of cursor and the rewards records of rewardsCursor to path, which gets replaced
+ * once all of it is written. The statistics of the coins end up in stats.
+ */
+bool WriteUTXOSnapshot(const boost::filesystem::path &path, const CUTXOSnapshotHeader &header, CCoinsViewCursor &cursor,
+                       CDBIterator &rewardsCursor, CUTXOStats &stats, uint64_t &nRewardsRecords, std::string &strError);
+
+/**
+ * Load the snapshot at path into the empty chainstate of view and replace the rewards database by
+ * the one of the snapshot. Its base block has to be in blocktree with its data, the chainstate
+ * continues from there. The coins get written whenever nCacheSize bytes of them are in memory.
+ */
+bool LoadUTXOSnapshot(const boost::filesystem::path &path, CCoinsViewDB &view, CBlockTreeDB &blocktree,
+                      size_t nCacheSize, size_t nRewardsCacheSize, CUTXOSnapshotHeader &header, std::string &strError);
+
+/** Whether view holds coins without a best block, which only an interrupted LoadUTXOSnapshot leaves behind. */
+bool HasIncompleteUTXOSnapshot(const CCoinsViewDB &view);
+
+#endif // SMARTCASH_UTXOSNAPSHOT_H
@@ -0,0 +1,63 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "utxostats.h"
+
+#include "coins.h"
+#include "streams.h"
+#include "version.h"
+
+/** The serialization of a coin that goes into the hash of the set. */
+static CDataStream SerializeCoin(const COutPoint &outpoint, const Coin &coin)
+{
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << outpoint;
+    ss << (uint32_t)(coin.nHeight * 2 + coin.fCoinBase);
+    ss << coin.out;
+    return ss;
+}
+
+uint64_t GetBogoSize(const Coin &coin)
+{
+    return 32 /* txid */ +
+           4 /* vout index */ +
+           4 /* height + coinbase */ +
+           8 /* amount */ +
+           2 /* scriptPubKey len */ +
+           coin.out.scriptPubKey.size() /* scriptPubKey */;
+}
+
+void CUTXOStats::AddCoin(const COutPoint &outpoint, const Coin &coin)
+{
+    CDataStream ss = SerializeCoin(outpoint, coin);
+    muhash.Insert((const unsigned char*)&ss[0], ss.size());
+    nTransactionOutputs++;
+    nBogoSize += GetBogoSize(coin);
+    nTotalAmount += coin.out.nValue;
+}
+
+void CUTXOStats::RemoveCoin(const COutPoint &outpoint, const Coin &coin)
+{
+    CDataStream ss = SerializeCoin(outpoint, coin);
+    muhash.Remove((const unsigned char*)&ss[0], ss.size());
+    nTransactionOutputs--;
+    nBogoSize -= GetBogoSize(coin);
+    nTotalAmount -= coin.out.nValue;
+}
+
+void CUTXOStats::Add(const CUTXOStats &other)
+{
+    muhash *= other.muhash;
+    nTransactionOutputs += other.nTransactionOutputs;
+    nBogoSize += other.nBogoSize;
+    nTotalAmount += other.nTotalAmount;
+}
+
+uint256 CUTXOStats::GetHash() const
+{
+    MuHash3072 muhashFinal(muhash);
+    uint256 hash;
+    muhashFinal.Finalize(hash.begin());
+    return hash;
+}
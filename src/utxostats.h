@@ -0,0 +1,61 @@
+// Copyright (c) 2018 The SmartCash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef SMARTCASH_UTXOSTATS_H
+#define SMARTCASH_UTXOSTATS_H
+
+#include "amount.h"
+#include "crypto/muhash.h"
+#include "serialize.h"
+#include "uint256.h"
+
+class COutPoint;
+class Coin;
+
+/**
+ * Statistics about the unspent transaction output set as of hashBlock, kept up to date while
+ * blocks get connected and disconnected instead of being computed by scanning the chainstate.
+ * The hash of the set is a MuHash3072 of the serialized coins, so it doesn't depend on the
+ * order the coins were added and removed in.
+ */
+class CUTXOStats
+{
+public:
+    uint256 hashBlock;
+    uint64_t nTransactionOutputs;
+    uint64_t nBogoSize;
+    CAmount nTotalAmount;
+    MuHash3072 muhash;
+
+    CUTXOStats() : nTransactionOutputs(0), nBogoSize(0), nTotalAmount(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(hashBlock);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nBogoSize);
+        READWRITE(nTotalAmount);
+        unsigned char state[MuHash3072::STATE_SIZE];
+        if (!ser_action.ForRead())
+            muhash.GetState(state);
+        READWRITE(FLATDATA(state));
+        if (ser_action.ForRead())
+            muhash.SetState(state);
+    }
+
+    void AddCoin(const COutPoint &outpoint, const Coin &coin);
+    void RemoveCoin(const COutPoint &outpoint, const Coin &coin);
+    //! Add the statistics of another set of coins, disjoint from this one.
+    void Add(const CUTXOStats &other);
+
+    /** The hash of the set, which takes a modular inversion: don't call it for every block. */
+    uint256 GetHash() const;
+};
+
+/** The size a coin adds to the bogosize, a rough measure of the size of the set independent of the database format. */
+uint64_t GetBogoSize(const Coin &coin);
+
+#endif // SMARTCASH_UTXOSTATS_H
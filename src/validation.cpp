@@ -7,23 +7,30 @@
 
 #include "alert.h"
 #include "arith_uint256.h"
+#include "blockfilecache.h"
+#include "blocktimeindex.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "crypto/common.h"
+#include "cuckoocache.h"
 #include "hash.h"
 #include "init.h"
+#include "metrics.h"
 #include "policy/policy.h"
 #include "pow.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
+#include "recenttxcache.h"
 #include "script/script.h"
 #include "script/sigcache.h"
 #include "script/standard.h"
 #include "timedata.h"
 #include "tinyformat.h"
+#include "trace.h"
 #include "txdb.h"
 #include "txmempool.h"
 #include "ui_interface.h"
@@ -31,13 +38,18 @@
 #include "util.h"
 #include "utilmoneystr.h"
 #include "utilstrencodings.h"
+#include "utxostats.h"
 #include "validationinterface.h"
 #include "versionbits.h"
 #include "wallet/wallet.h"
 #include "warnings.h"
 #include "blocksizecalculator.h"
 
+#include <atomic>
+#include <deque>
+#include <memory>
 #include <sstream>
+#include <unordered_set>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
@@ -67,6 +79,10 @@ using namespace std;
 
 CCriticalSection cs_main;
 
+BlockHasher::BlockHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+/** Owns the entries of mapBlockIndex. Guarded by cs_main like the map. */
+static CBlockIndexStore blockIndexStore;
 BlockMap mapBlockIndex;
 CChain chainActive;
 CBlockIndex *pindexBestHeader = NULL;
@@ -87,6 +103,7 @@ unsigned int nBytesPerSigOp = DEFAULT_BYTES_PER_SIGOP;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
 size_t nCoinCacheUsage = 5000 * 300;
+int64_t nCoinsSyncInterval = DEFAULT_DB_SYNC_INTERVAL * 60;
 uint64_t nPruneTarget = 0;
 bool fAlerts = DEFAULT_ALERTS;
 bool fEnableReplacement = DEFAULT_ENABLE_REPLACEMENT;
@@ -94,6 +111,11 @@ bool fEnableReplacement = DEFAULT_ENABLE_REPLACEMENT;
 uint256 hashAssumeValid;
 
 CFeeRate minRelayTxFee = CFeeRate(DEFAULT_MIN_RELAY_TX_FEE);
+
+unsigned int maxBlockSize = OLD_MAX_BLOCK_SIZE;
+unsigned int maxBlockSigops = OLD_MAX_BLOCK_SIZE / 50;
+unsigned int maxStandardTxSigops = OLD_MAX_BLOCK_SIZE / 50 / 5;
+
 CAmount maxTxFee = DEFAULT_TRANSACTION_MAXFEE;
 
 CTxMemPool mempool(::minRelayTxFee);
@@ -235,7 +257,7 @@ namespace {
     //int nPeersWithValidatedDownloads = 0;
 
     /** Relay map, protected by cs_main. */
-    typedef std::map<uint256, std::shared_ptr<const CTransaction>> MapRelay;
+    typedef std::map<uint256, CTransactionRef> MapRelay;
     MapRelay mapRelay;
     /** Expiration-time ordered list of (expire time, relay map entry) pairs, protected by cs_main). */
     std::deque<std::pair<int64_t, MapRelay::iterator>> vRelayExpiration;
@@ -360,285 +382,6 @@ enum FlushStateMode {
 // See definition for documentation
 bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode);
 
-// int GetHeight()
-// {
-//     LOCK(cs_main);
-//     return chainActive.Height();
-// }
-
-// void UpdatePreferredDownload(CNode* node, CNodeState* state)
-// {
-//     nPreferredDownload -= state->fPreferredDownload;
-
-//     // Whether this node should be marked as a preferred download node.
-//     state->fPreferredDownload = (!node->fInbound || node->fWhitelisted) && !node->fOneShot && !node->fClient;
-
-//     nPreferredDownload += state->fPreferredDownload;
-// }
-
-// void InitializeNode(CNode *pnode, CConnman& connman) {
-//     CAddress addr = pnode->addr;
-//     std::string addrName = pnode->addrName;
-//     NodeId nodeid = pnode->GetId();
-//     {
-//         LOCK(cs_main);
-//         mapNodeState.emplace_hint(mapNodeState.end(), std::piecewise_construct, std::forward_as_tuple(nodeid), std::forward_as_tuple(addr, std::move(addrName)));
-//     }
-//     if(!pnode->fInbound)
-//         PushNodeVersion(pnode, connman, GetTime());
-// }
-
-// void FinalizeNode(NodeId nodeid) {
-//     LOCK(cs_main);
-//     CNodeState *state = State(nodeid);
-
-//     if (state->fSyncStarted)
-//         nSyncStarted--;
-
-//     if (state->nMisbehavior == 0 && state->fCurrentlyConnected) {
-//     //    AddressCurrentlyConnected(state->address);
-//     }
-
-//     BOOST_FOREACH(const QueuedBlock& entry, state->vBlocksInFlight) {
-//         mapBlocksInFlight.erase(entry.hash);
-//     }
-//     EraseOrphansFor(nodeid);
-//     nPreferredDownload -= state->fPreferredDownload;
-//     nPeersWithValidatedDownloads -= (state->nBlocksInFlightValidHeaders != 0);
-//     assert(nPeersWithValidatedDownloads >= 0);
-
-//     mapNodeState.erase(nodeid);
-
-//     if (mapNodeState.empty()) {
-//         // Do a consistency check after the last peer is removed.
-//         assert(mapBlocksInFlight.empty());
-//         assert(nPreferredDownload == 0);
-//         assert(nPeersWithValidatedDownloads == 0);
-//     }
-// }
-
-// Requires cs_main.
-// returns false, still setting pit, if the block was already in flight from the same peer
-// pit will only be valid as long as the same cs_main lock is being held
-// bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Params& consensusParams, CBlockIndex *pindex = NULL, list<QueuedBlock>::iterator **pit = NULL) {
-//     CNodeState *state = State(nodeid);
-//     assert(state != NULL);
-
-//     // Short-circuit most stuff in case its from the same node
-//     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
-//     if (itInFlight != mapBlocksInFlight.end() && itInFlight->second.first == nodeid) {
-//         *pit = &itInFlight->second.second;
-//         return false;
-//     }
-
-//     // Make sure it's not listed somewhere already.
-//     MarkBlockAsReceived(hash);
-
-//     list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(),
-//             {hash, pindex, pindex != NULL, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : NULL)});
-//     state->nBlocksInFlight++;
-//     state->nBlocksInFlightValidHeaders += it->fValidatedHeaders;
-//     if (state->nBlocksInFlight == 1) {
-//         // We're starting a block download (batch) from this peer.
-//         state->nDownloadingSince = GetTimeMicros();
-//     }
-//     if (state->nBlocksInFlightValidHeaders == 1 && pindex != NULL) {
-//         nPeersWithValidatedDownloads++;
-//     }
-//     itInFlight = mapBlocksInFlight.insert(std::make_pair(hash, std::make_pair(nodeid, it))).first;
-//     if (pit)
-//         *pit = &itInFlight->second.second;
-//     return true;
-// }
-
-/** Check whether the last unknown block a peer advertised is not yet known. */
-// void ProcessBlockAvailability(NodeId nodeid) {
-//     CNodeState *state = State(nodeid);
-//     assert(state != NULL);
-
-//     if (!state->hashLastUnknownBlock.IsNull()) {
-//         BlockMap::iterator itOld = mapBlockIndex.find(state->hashLastUnknownBlock);
-//         if (itOld != mapBlockIndex.end() && itOld->second->nChainWork > 0) {
-//             if (state->pindexBestKnownBlock == NULL || itOld->second->nChainWork >= state->pindexBestKnownBlock->nChainWork)
-//                 state->pindexBestKnownBlock = itOld->second;
-//             state->hashLastUnknownBlock.SetNull();
-//         }
-//     }
-// }
-
-/** Update tracking information about which blocks a peer is assumed to have. */
-// void UpdateBlockAvailability(NodeId nodeid, const uint256 &hash) {
-//     CNodeState *state = State(nodeid);
-//     assert(state != NULL);
-
-//     ProcessBlockAvailability(nodeid);
-
-//     BlockMap::iterator it = mapBlockIndex.find(hash);
-//     if (it != mapBlockIndex.end() && it->second->nChainWork > 0) {
-//         // An actually better block was announced.
-//         if (state->pindexBestKnownBlock == NULL || it->second->nChainWork >= state->pindexBestKnownBlock->nChainWork)
-//             state->pindexBestKnownBlock = it->second;
-//     } else {
-//         // An unknown block was announced; just assume that the latest one is the best one.
-//         state->hashLastUnknownBlock = hash;
-//     }
-// }
-
-// void MaybeSetPeerAsAnnouncingHeaderAndIDs(const CNodeState* nodestate, CNode* pfrom) {
-//     if (!nodestate->fSupportsDesiredCmpctVersion) {
-//         // Never ask from peers who can't provide witnesses.
-//         return;
-//     }
-//     if (nodestate->fProvidesHeaderAndIDs) {
-//         for (std::list<NodeId>::iterator it = lNodesAnnouncingHeaderAndIDs.begin(); it != lNodesAnnouncingHeaderAndIDs.end(); it++) {
-//             if (*it == pfrom->GetId()) {
-//                 lNodesAnnouncingHeaderAndIDs.erase(it);
-//                 lNodesAnnouncingHeaderAndIDs.push_back(pfrom->GetId());
-//                 return;
-//             }
-//         }
-//         bool fAnnounceUsingCMPCTBLOCK = false;
-//         uint64_t nCMPCTBLOCKVersion = (nLocalServices & NODE_WITNESS) ? 2 : 1;
-//         if (lNodesAnnouncingHeaderAndIDs.size() >= 3) {
-//             // As per BIP152, we only get 3 of our peers to announce
-//             // blocks using compact encodings.
-//             CNode* pnodeStop = FindNode(lNodesAnnouncingHeaderAndIDs.front());
-//             if (pnodeStop) {
-//                 pnodeStop->PushMessage(NetMsgType::SENDCMPCT, fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion);
-//             }
-//             lNodesAnnouncingHeaderAndIDs.pop_front();
-//         }
-//         fAnnounceUsingCMPCTBLOCK = true;
-//         pfrom->PushMessage(NetMsgType::SENDCMPCT, fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion);
-//         lNodesAnnouncingHeaderAndIDs.push_back(pfrom->GetId());
-//     }
-// }
-
-// Requires cs_main
-// bool CanDirectFetch(const Consensus::Params &consensusParams)
-// {
-//     return chainActive.Tip()->GetBlockTime() > GetAdjustedTime() - consensusParams.nPowTargetSpacing * 20;
-// }
-
-// Requires cs_main
-// bool PeerHasHeader(CNodeState *state, CBlockIndex *pindex)
-// {
-//     if (state->pindexBestKnownBlock && pindex == state->pindexBestKnownBlock->GetAncestor(pindex->nHeight))
-//         return true;
-//     if (state->pindexBestHeaderSent && pindex == state->pindexBestHeaderSent->GetAncestor(pindex->nHeight))
-//         return true;
-//     return false;
-// }
-
-/** Find the last common ancestor two blocks have.
- *  Both pa and pb must be non-NULL. */
-// CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb) {
-//     if (pa->nHeight > pb->nHeight) {
-//         pa = pa->GetAncestor(pb->nHeight);
-//     } else if (pb->nHeight > pa->nHeight) {
-//         pb = pb->GetAncestor(pa->nHeight);
-//     }
-
-//     while (pa != pb && pa && pb) {
-//         pa = pa->pprev;
-//         pb = pb->pprev;
-//     }
-
-//     // Eventually all chain branches meet at the genesis block.
-//     assert(pa == pb);
-//     return pa;
-// }
-
-/** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
- *  at most count entries. */
-// void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller, const Consensus::Params& consensusParams) {
-//     if (count == 0)
-//         return;
-
-//     vBlocks.reserve(vBlocks.size() + count);
-//     CNodeState *state = State(nodeid);
-//     assert(state != NULL);
-
-//     // Make sure pindexBestKnownBlock is up to date, we'll need it.
-//     ProcessBlockAvailability(nodeid);
-
-//     if (state->pindexBestKnownBlock == NULL || state->pindexBestKnownBlock->nChainWork < chainActive.Tip()->nChainWork) {
-//         // This peer has nothing interesting.
-//         return;
-//     }
-
-//     if (state->pindexLastCommonBlock == NULL) {
-//         // Bootstrap quickly by guessing a parent of our best tip is the forking point.
-//         // Guessing wrong in either direction is not a problem.
-//         state->pindexLastCommonBlock = chainActive[std::min(state->pindexBestKnownBlock->nHeight, chainActive.Height())];
-//     }
-
-//     // If the peer reorganized, our previous pindexLastCommonBlock may not be an ancestor
-//     // of its current tip anymore. Go back enough to fix that.
-//     state->pindexLastCommonBlock = LastCommonAncestor(state->pindexLastCommonBlock, state->pindexBestKnownBlock);
-//     if (state->pindexLastCommonBlock == state->pindexBestKnownBlock)
-//         return;
-
-//     std::vector<CBlockIndex*> vToFetch;
-//     CBlockIndex *pindexWalk = state->pindexLastCommonBlock;
-//     // Never fetch further than the best block we know the peer has, or more than BLOCK_DOWNLOAD_WINDOW + 1 beyond the last
-//     // linked block we have in common with this peer. The +1 is so we can detect stalling, namely if we would be able to
-//     // download that next block if the window were 1 larger.
-//     int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
-//     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
-//     NodeId waitingfor = -1;
-//     while (pindexWalk->nHeight < nMaxHeight) {
-//         // Read up to 128 (or more, if more blocks than that are needed) successors of pindexWalk (towards
-//         // pindexBestKnownBlock) into vToFetch. We fetch 128, because CBlockIndex::GetAncestor may be as expensive
-//         // as iterating over ~100 CBlockIndex* entries anyway.
-//         int nToFetch = std::min(nMaxHeight - pindexWalk->nHeight, std::max<int>(count - vBlocks.size(), 128));
-//         vToFetch.resize(nToFetch);
-//         pindexWalk = state->pindexBestKnownBlock->GetAncestor(pindexWalk->nHeight + nToFetch);
-//         vToFetch[nToFetch - 1] = pindexWalk;
-//         for (unsigned int i = nToFetch - 1; i > 0; i--) {
-//             vToFetch[i - 1] = vToFetch[i]->pprev;
-//         }
-
-//         // Iterate over those blocks in vToFetch (in forward direction), adding the ones that
-//         // are not yet downloaded and not in flight to vBlocks. In the mean time, update
-//         // pindexLastCommonBlock as long as all ancestors are already downloaded, or if it's
-//         // already part of our chain (and therefore don't need it even if pruned).
-//         BOOST_FOREACH(CBlockIndex* pindex, vToFetch) {
-//             if (!pindex->IsValid(BLOCK_VALID_TREE)) {
-//                 // We consider the chain that this peer is on invalid.
-//                 return;
-//             }
-//             if (!State(nodeid)->fHaveWitness && IsWitnessEnabled(pindex->pprev, consensusParams)) {
-//                 // We wouldn't download this block or its descendants from this peer.
-//                 return;
-//             }
-//             if (pindex->nStatus & BLOCK_HAVE_DATA || chainActive.Contains(pindex)) {
-//                 if (pindex->nChainTx)
-//                     state->pindexLastCommonBlock = pindex;
-//             } else if (mapBlocksInFlight.count(pindex->GetBlockHash()) == 0) {
-//                 // The block is not already downloaded, and not yet in flight.
-//                 if (pindex->nHeight > nWindowEnd) {
-//                     // We reached the end of the window.
-//                     if (vBlocks.size() == 0 && waitingfor != nodeid) {
-//                         // We aren't able to fetch anything, but we would be if the download window was one larger.
-//                         nodeStaller = waitingfor;
-//                     }
-//                     return;
-//                 }
-//                 vBlocks.push_back(pindex);
-//                 if (vBlocks.size() == count) {
-//                     return;
-//                 }
-//             } else if (waitingfor == -1) {
-//                 // This is the first already-in-flight block.
-//                 waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
-//             }
-//         }
-//     }
-// }
-
-
-
 bool GetBlockHash(uint256& hashRet, int nBlockHeight)
 {
     LOCK(cs_main);
@@ -688,6 +431,10 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 CCoinsViewDB *pcoinsdbview = NULL;
 CCoinsViewCache *pcoinsTip = NULL;
 CBlockTreeDB *pblocktree = NULL;
+CIndexDB *pindexdb = NULL;
+/** Statistics of the UTXO set as of the best block of pcoinsTip, unless fUTXOStatsValid is false. */
+static CUTXOStats utxoStats;
+static bool fUTXOStatsValid = true;
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -1082,7 +829,83 @@ int64_t GetBlockValue(int nHeight, int64_t nFees, unsigned int nTime)
     return value;
 }
 
+/** Heights from which on GetBlockValue stays the same and the sum of all block values below them. */
+struct CBlockValueRun
+{
+    int64_t nStartHeight;
+    int64_t nValue;
+    int64_t nSumBefore;
+};
+
+// The block value never increases after the genesis block and only takes a
+// few thousand different values, so the whole schedule fits into a small
+// table of runs. Each run's end is found with a binary search.
+static std::vector<CBlockValueRun> BuildBlockValueRuns()
+{
+    std::vector<CBlockValueRun> vRuns;
+    int64_t nSum = 0;
+
+    vRuns.push_back(CBlockValueRun{0, GetBlockValue(0, 0, INT_MAX), 0});
+    nSum += vRuns.back().nValue;
+
+    int nHeight = 1;
+
+    while (nHeight <= HF_CHAIN_REWARD_END_HEIGHT) {
+        int64_t nValue = GetBlockValue(nHeight, 0, INT_MAX);
+        int nLow = nHeight, nHigh = HF_CHAIN_REWARD_END_HEIGHT;
+
+        while (nLow < nHigh) {
+            int nMid = nLow + (nHigh - nLow + 1) / 2;
+            if (GetBlockValue(nMid, 0, INT_MAX) == nValue)
+                nLow = nMid;
+            else
+                nHigh = nMid - 1;
+        }
+
+        vRuns.push_back(CBlockValueRun{nHeight, nValue, nSum});
+        nSum += nValue * (nLow - nHeight + 1);
+        nHeight = nLow + 1;
+    }
+
+    vRuns.push_back(CBlockValueRun{(int64_t)HF_CHAIN_REWARD_END_HEIGHT + 1, GetBlockValue(HF_CHAIN_REWARD_END_HEIGHT + 1, 0, INT_MAX), nSum});
+
+    return vRuns;
+}
+
+// Sum of the block values of all heights below nHeight.
+static int64_t GetBlockValueSumBelow(int64_t nHeight)
+{
+    static const std::vector<CBlockValueRun> vRuns = BuildBlockValueRuns();
+
+    auto it = std::upper_bound(vRuns.begin(), vRuns.end(), nHeight,
+                               [](int64_t nHeight, const CBlockValueRun& run) { return nHeight < run.nStartHeight; });
+    if (it == vRuns.begin())
+        return 0;
+    --it;
+
+    return it->nSumBefore + it->nValue * (nHeight - it->nStartHeight);
+}
+
+int64_t GetBlockValueRange(int nStartHeight, int nEndHeight)
+{
+    if (nEndHeight < nStartHeight)
+        return 0;
+
+    return GetBlockValueSumBelow((int64_t)nEndHeight + 1) - GetBlockValueSumBelow(std::max(nStartHeight, 0));
+}
+
+CTxCheckContext::CTxCheckContext(int nHeightIn) :
+    nHeight(nHeightIn),
+    fZerocoinDisabled(nHeightIn > HF_ZEROCOIN_DISABLE)
+{
+}
+
 bool CheckTransaction(const CTransaction& tx, CValidationState& state, uint256 hashTx, bool isVerifyDB, int nHeight){
+    CTxCheckContext context(nHeight);
+    return CheckTransaction(tx, state, hashTx, isVerifyDB, context);
+}
+
+bool CheckTransaction(const CTransaction& tx, CValidationState& state, uint256 hashTx, bool isVerifyDB, CTxCheckContext& context){
 
     // Basic checks that don't depend on any context
     if (tx.vin.empty())
@@ -1090,7 +913,7 @@ bool CheckTransaction(const CTransaction& tx, CValidationState& state, uint256 h
     if (tx.vout.empty())
         return state.DoS(10, false, REJECT_INVALID, "bad-txns-vout-empty");
     // Size limits (this doesn't take the witness into account, as that hasn't been checked for malleability)
-    if (::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS) > maxBlockSize)
+    if (tx.GetBaseSize() > maxBlockSize)
         return state.DoS(100, false, REJECT_INVALID, "bad-txns-oversize");
 
     // Check for negative or overflow output values
@@ -1104,18 +927,18 @@ bool CheckTransaction(const CTransaction& tx, CValidationState& state, uint256 h
         nValueOut += txout.nValue;
         if (!MoneyRange(nValueOut))
             return state.DoS(100, false, REJECT_INVALID, "bad-txns-txouttotal-toolarge");
-        if (nHeight > HF_ZEROCOIN_DISABLE && (txout.scriptPubKey.IsZerocoinMint() || txout.scriptPubKey.IsZerocoinSpend()))
+        if (context.fZerocoinDisabled && (txout.scriptPubKey.IsZerocoinMint() || txout.scriptPubKey.IsZerocoinSpend()))
             return state.DoS(100, false, REJECT_INVALID, "bad-txns-vout-zerocoin");
     }
 
     // Check for duplicate inputs
-    set <COutPoint> vInOutPoints;
+    std::vector<COutPoint>& vInputs = context.vInputs;
+    vInputs.clear();
     BOOST_FOREACH(const CTxIn &txin, tx.vin)
-    {
-        if (vInOutPoints.count(txin.prevout))
-            return state.DoS(100, false, REJECT_INVALID, "bad-txns-inputs-duplicate");
-        vInOutPoints.insert(txin.prevout);
-    }
+        vInputs.push_back(txin.prevout);
+    std::sort(vInputs.begin(), vInputs.end());
+    if (std::adjacent_find(vInputs.begin(), vInputs.end()) != vInputs.end())
+        return state.DoS(100, false, REJECT_INVALID, "bad-txns-inputs-duplicate");
 
     if (tx.IsCoinBase()) {
         if (tx.vin[0].scriptSig.size() < 2 || tx.vin[0].scriptSig.size() > 100)
@@ -1126,7 +949,7 @@ bool CheckTransaction(const CTransaction& tx, CValidationState& state, uint256 h
             if (txin.prevout.IsNull() && !txin.scriptSig.IsZerocoinSpend() ) {
                 return state.DoS(10, false, REJECT_INVALID, "bad-txns-prevout-null");
             }
-            if (nHeight > HF_ZEROCOIN_DISABLE && ( txin.scriptSig.IsZerocoinMint() || txin.scriptSig.IsZerocoinSpend()) )
+            if (context.fZerocoinDisabled && ( txin.scriptSig.IsZerocoinMint() || txin.scriptSig.IsZerocoinSpend()) )
                 return state.DoS(100, false, REJECT_INVALID, "bad-txns-vout-zerocoin");
         }
 
@@ -1135,7 +958,12 @@ bool CheckTransaction(const CTransaction& tx, CValidationState& state, uint256 h
 }
 
 void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age) {
-    int expired = pool.Expire(GetTime() - age);
+    // Expire whole buckets of entry time at once, so a busy pool removes old
+    // transactions in one batch every few minutes instead of a few on every
+    // accepted transaction.
+    int64_t nExpireBefore = GetTime() - age;
+    nExpireBefore -= nExpireBefore % MEMPOOL_EXPIRY_BUCKET;
+    int expired = pool.Expire(nExpireBefore);
     if (expired != 0)
         LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
 
@@ -1154,13 +982,107 @@ std::string FormatStateMessage(const CValidationState &state)
         state.GetRejectCode());
 }
 
+static bool CheckInputsMempool(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, unsigned int flags);
+static unsigned int GetBlockScriptFlags(const CBlockIndex* pindex, const Consensus::Params& consensusparams);
+
+void CMempoolStageStats::SetNull()
+{
+    nCount = 0;
+    nTotalMicros = 0;
+    nMaxMicros = 0;
+    std::fill(vHistogram, vHistogram + MEMPOOL_STATS_BUCKETS, 0);
+}
+
+void CMempoolStageStats::Add(int64_t nMicros)
+{
+    nCount++;
+    nTotalMicros += nMicros;
+    nMaxMicros = std::max(nMaxMicros, nMicros);
+    int nBucket = 0;
+    while (nBucket < MEMPOOL_STATS_BUCKETS - 1 && nMicros >= ((int64_t)1 << nBucket))
+        nBucket++;
+    vHistogram[nBucket]++;
+}
+
+static const char* const mempoolAcceptStageNames[MEMPOOL_STAGE_COUNT] = {
+    "prechecks", "instantsend", "conflicts", "coins", "policy", "ancestors",
+    "replacement", "scripts", "insert", "index", "trim", "notify"
+};
+
+const char* GetMempoolAcceptStageName(int nStage)
+{
+    assert(nStage >= 0 && nStage < MEMPOOL_STAGE_COUNT);
+    return mempoolAcceptStageNames[nStage];
+}
+
+// Protected by cs_main
+static CMempoolStageStats mempoolStageStats[MEMPOOL_STAGE_COUNT];
+static CMempoolStageStats mempoolAcceptStats;
+static uint64_t nMempoolAccepted = 0;
+static uint64_t nMempoolRejected = 0;
+
+void GetMempoolAcceptStats(std::vector<CMempoolStageStats>& vStages, CMempoolStageStats& total,
+                           uint64_t& nAccepted, uint64_t& nRejected, bool fReset)
+{
+    LOCK(cs_main);
+    vStages.assign(mempoolStageStats, mempoolStageStats + MEMPOOL_STAGE_COUNT);
+    total = mempoolAcceptStats;
+    nAccepted = nMempoolAccepted;
+    nRejected = nMempoolRejected;
+    if (fReset) {
+        for (int i = 0; i < MEMPOOL_STAGE_COUNT; i++)
+            mempoolStageStats[i].SetNull();
+        mempoolAcceptStats.SetNull();
+        nMempoolAccepted = nMempoolRejected = 0;
+    }
+}
+
+/** Times the stages of one AcceptToMemoryPoolWorker call. The stage running when the call returns
+ *  gets its time recorded as well, so rejected transactions count towards the stage rejecting them. */
+class CMempoolAcceptTimer
+{
+private:
+    int nStage;
+    int64_t nTimeStart;
+    int64_t nTimeStage;
+    bool fAccepted;
+
+public:
+    CMempoolAcceptTimer() : nStage(MEMPOOL_STAGE_PRECHECKS), fAccepted(false)
+    {
+        nTimeStart = nTimeStage = GetTimeMicros();
+    }
+
+    void Stage(int nNext)
+    {
+        int64_t nNow = GetTimeMicros();
+        mempoolStageStats[nStage].Add(nNow - nTimeStage);
+        nStage = nNext;
+        nTimeStage = nNow;
+    }
+
+    void Accepted() { fAccepted = true; }
+
+    ~CMempoolAcceptTimer()
+    {
+        int64_t nNow = GetTimeMicros();
+        mempoolStageStats[nStage].Add(nNow - nTimeStage);
+        mempoolAcceptStats.Add(nNow - nTimeStart);
+        if (fAccepted)
+            nMempoolAccepted++;
+        else
+            nMempoolRejected++;
+    }
+};
+
 bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                              bool* pfMissingInputs, bool fOverrideMempoolLimit, bool fRejectAbsurdFee,
+                              bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit, bool fRejectAbsurdFee,
                               std::vector<COutPoint>& coins_to_uncache, bool fDryRun){
 
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
         *pfMissingInputs = false;
+    CMempoolAcceptTimer timer;
 
     uint256 hash = tx.GetHash();
     if (!CheckTransaction(tx, state, hash, false)) {
@@ -1194,8 +1116,10 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
     if (pool.exists(hash))
         return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-in-mempool");
 
+    timer.Stage(MEMPOOL_STAGE_INSTANTSEND);
+
     // If this is a Transaction Lock Request check to see if it's valid
-    if(instantsend.HasTxLockRequest(hash) && !CTxLockRequest(tx).IsValid())
+    if(!instantsend.CheckTxLockRequest(tx))
         return state.DoS(10, error("AcceptToMemoryPool : CTxLockRequest %s is invalid", hash.ToString()),
                             REJECT_INVALID, "bad-txlockrequest");
 
@@ -1209,6 +1133,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
                             REJECT_INVALID, "tx-txlock-conflict");
     }
 
+    timer.Stage(MEMPOOL_STAGE_CONFLICTS);
+
     // Check for conflicts with in-memory transactions
     set <uint256> setConflicts;
      //btzc
@@ -1257,6 +1183,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
         }
     }
 
+    timer.Stage(MEMPOOL_STAGE_COINS);
+
     {
         CCoinsView dummy;
         CCoinsViewCache view(&dummy);
@@ -1282,7 +1210,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
             // do all inputs exist?
             // Note that this does not check for the presence of actual outputs (see the next check for that),
             // and only helps with filling in pfMissingInputs (to determine missing vs spent).
-            BOOST_FOREACH(const CTxIn txin, tx.vin) {
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
                 if (!pcoinsTip->HaveCoinInCache(txin.prevout)) {
                     coins_to_uncache.push_back(txin.prevout);
                 }
@@ -1319,6 +1247,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
             }
         } //LOCK
 
+    timer.Stage(MEMPOOL_STAGE_POLICY);
+
     if (!tx.IsZerocoinSpend()) {
         // Check for non-standard pay-to-script-hash in inputs
         if (MainNet() && fRequireStandard && !AreInputsStandard(tx, view)) {
@@ -1350,7 +1280,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
             }
         }
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), pool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbase, nSigOps, lp);
+        CTxMemPoolEntry entry(tx, nFees, nAcceptTime, dPriority, chainActive.Height(), pool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbase, nSigOps, lp);
 
         // Don't accept it if it can't get into a block
         int64_t txMinFee = tx.GetMinFee(1000, true, GMF_RELAY);
@@ -1413,6 +1343,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
                 REJECT_HIGHFEE, "absurdly-high-fee",
                 strprintf("%d > %d", nFees, ::minRelayTxFee.GetFee(nSize) * 10000));
 
+        timer.Stage(MEMPOOL_STAGE_ANCESTORS);
+
         // Calculate in-mempool ancestors, up to a limit.
         CTxMemPool::setEntries setAncestors;
         size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
@@ -1443,6 +1375,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
             }
         }
 
+        timer.Stage(MEMPOOL_STAGE_REPLACEMENT);
+
         // Check if it's economically rational to mine this transaction rather
         // than the ones it replaces.
         CAmount nConflictingFees = 0;
@@ -1584,9 +1518,11 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
         // If we aren't going to actually accept it but just were verifying it, we are fine already
         if(fDryRun) return true;
 
+        timer.Stage(MEMPOOL_STAGE_SCRIPTS);
+
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true))
+        if (!CheckInputsMempool(tx, state, view, STANDARD_SCRIPT_VERIFY_FLAGS))
             return false;
 
         // Check again against just the consensus-critical mandatory script
@@ -1598,12 +1534,26 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
         // There is a similar check in CreateNewBlock() to prevent creating
         // invalid blocks, however allowing such transactions into the mempool
         // can be exploited as a DoS attack.
-        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
+        if (!CheckInputsMempool(tx, state, view, MANDATORY_SCRIPT_VERIFY_FLAGS))
         {
             return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s, %s",
                 __func__, hash.ToString(), FormatStateMessage(state));
         }
 
+        // Check again against the script flags of the current tip, which the next block most
+        // likely gets connected with, so ConnectBlock finds the transaction in the script
+        // execution cache. The signatures are in the signature cache by now, so this is cheap.
+        // If the next block has different flags the cache entry just misses.
+        unsigned int currentBlockScriptVerifyFlags = GetBlockScriptFlags(chainActive.Tip(), Params().GetConsensus());
+        if (currentBlockScriptVerifyFlags != MANDATORY_SCRIPT_VERIFY_FLAGS &&
+            !CheckInputsMempool(tx, state, view, currentBlockScriptVerifyFlags))
+        {
+            return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against the block script flags but not STANDARD flags %s, %s",
+                __func__, hash.ToString(), FormatStateMessage(state));
+        }
+
+        timer.Stage(MEMPOOL_STAGE_INSERT);
+
         // Remove conflicting transactions from the mempool
         BOOST_FOREACH(const CTxMemPool::txiter it, allConflicting)
         {
@@ -1613,10 +1563,13 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
                     FormatMoney(nModifiedFees - nConflictingFees),
                     (int)nSize - (int)nConflictingSize);
         }
-        pool.RemoveStaged(allConflicting);
+        pool.RemoveStaged(allConflicting, false);
 
         // Store transaction in memory
         pool.addUnchecked(hash, entry, setAncestors, !IsInitialBlockDownload());
+        TRACE3(mempool, added, hash.begin(), nSize, nFees);
+
+        timer.Stage(MEMPOOL_STAGE_INDEX);
 
         // Add memory address index
         if (fAddressIndex) {
@@ -1628,6 +1581,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
             pool.addSpentIndex(entry, view);
         }
 
+        timer.Stage(MEMPOOL_STAGE_TRIM);
+
         // trim mempool and check if tx was trimmed
         if (!fOverrideMempoolLimit) {
             LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
@@ -1638,19 +1593,30 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
       }
     }
 
+    timer.Stage(MEMPOOL_STAGE_NOTIFY);
+
     if(!fDryRun)
-        GetMainSignals().SyncTransaction(tx, NULL);
+        GetMainSignals().QueueSyncTransaction(tx, NULL);
 
+    timer.Accepted();
     return true;
 }
 
+/** The blocks of chainActive sorted by time, follows SetChainTip (protected by cs_main) */
+static CBlockTimeIndex blockTimeIndex;
+
 bool GetTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &hashes)
 {
-    if (!fTimestampIndex)
-        return error("Timestamp index not enabled");
+    LOCK(cs_main);
+
+    // Catch up with tips not set by SetChainTip, like the ones of the benchmarks
+    blockTimeIndex.SetTip(chainActive.Tip());
 
-    if (!pblocktree->ReadTimestampIndex(high, low, hashes))
-        return error("Unable to get hashes for timestamps");
+    std::vector<int> vHeights;
+    blockTimeIndex.FindRange(low, high, vHeights);
+
+    for (int nHeight : vHeights)
+        hashes.push_back(chainActive[nHeight]->GetBlockHash());
 
     return true;
 }
@@ -1663,43 +1629,49 @@ bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
     if (mempool.getSpentIndex(key, value))
         return true;
 
-    if (!pblocktree->ReadSpentIndex(key, value))
+    if (!pindexdb->ReadSpentIndex(key, value))
         return false;
 
     return true;
 }
 
 bool GetAddressIndex(uint160 addressHash, int type,
-                     std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex, int start, int end)
+                     std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex, int start, int end,
+                     size_t nLimit, const CAddressIndexKey *pkeyAfter)
 {
     if (!fAddressIndex)
         return error("address index not enabled");
 
-    if (!pblocktree->ReadAddressIndex(addressHash, type, addressIndex, start, end))
+    if (!pindexdb->ReadAddressIndex(addressHash, type, addressIndex, start, end, nLimit, pkeyAfter))
         return error("unable to get txids for address");
 
     return true;
 }
 
 bool GetAddressUnspent(uint160 addressHash, int type,
-                       std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs)
+                       std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs,
+                       size_t nLimit, const CAddressUnspentKey *pkeyAfter)
 {
     if (!fAddressIndex)
         return error("address index not enabled");
 
-    if (!pblocktree->ReadAddressUnspentIndex(addressHash, type, unspentOutputs))
+    if (!pindexdb->ReadAddressUnspentIndex(addressHash, type, unspentOutputs, nLimit, pkeyAfter))
         return error("unable to get txids for address");
 
     return true;
 }
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fOverrideMempoolLimit, bool fRejectAbsurdFee, bool fDryRun)
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                                bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit,
+                                bool fRejectAbsurdFee, bool fDryRun)
 {
     std::vector<COutPoint> coins_to_uncache;
-    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, fOverrideMempoolLimit, fRejectAbsurdFee, coins_to_uncache, fDryRun);
+    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, fOverrideMempoolLimit, fRejectAbsurdFee, coins_to_uncache, fDryRun);
     if (!res || fDryRun) {
-        if(!res) LogPrint("mempool", "%s: %s %s\n", __func__, tx.GetHash().ToString(), state.GetRejectReason());
+        if(!res) {
+            LogPrint("mempool", "%s: %s %s\n", __func__, tx.GetHash().ToString(), state.GetRejectReason());
+            TRACE2(mempool, rejected, tx.GetHash().begin(), state.GetRejectReason().c_str());
+        }
         BOOST_FOREACH(const COutPoint& hashTx, coins_to_uncache)
             pcoinsTip->Uncache(hashTx);
     }
@@ -1709,6 +1681,54 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     return res;
 }
 
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                        bool* pfMissingInputs, bool fOverrideMempoolLimit, bool fRejectAbsurdFee, bool fDryRun)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), fOverrideMempoolLimit, fRejectAbsurdFee, fDryRun);
+}
+
+static CBlockFileCache blockFileCache;
+//! Transactions of the last connected blocks, consulted by GetTransaction before the transaction index
+static CRecentTxCache recentTxCache;
+static CBlockFileWriter blockFileWriter;
+static CBlockFileWriter undoFileWriter;
+
+static CBlockFileWriter& GetBlockFileWriter(const char* prefix)
+{
+    return strcmp(prefix, "rev") ? blockFileWriter : undoFileWriter;
+}
+
+/** Find the record WriteBlockToDisk or UndoWriteToDisk stored at pos in a mapped block or undo file.
+ *  nTrailer bytes following the record belong to it as well (the undo checksum). Returns the mapping
+ *  the record points into, which has to be kept while the record is used, or NULL if the file can't
+ *  be mapped and has to be read with stdio instead. */
+static std::shared_ptr<const CMappedBlockFile> GetMappedBlockRecord(const CDiskBlockPos& pos, const char* prefix, size_t nTrailer,
+                                                                    const unsigned char*& pRecordRet, size_t& nSizeRet)
+{
+    if (pos.IsNull() || pos.nPos < 8)
+        return NULL;
+
+    // the magic and size written in front of the record tell how much of the file is needed
+    boost::filesystem::path path = GetBlockPosFilename(pos, prefix);
+    GetBlockFileWriter(prefix).Flush(path);
+    std::shared_ptr<const CMappedBlockFile> file = blockFileCache.Get(path, pos.nPos);
+    if (!file)
+        return NULL;
+
+    const unsigned char* pHeader = file->data() + pos.nPos - 8;
+    if (memcmp(pHeader, Params().MessageStart(), MESSAGE_START_SIZE))
+        return NULL;
+
+    nSizeRet = ReadLE32(pHeader + 4);
+    size_t nEnd = (size_t)pos.nPos + nSizeRet + nTrailer;
+    if (file->size() < nEnd && !(file = blockFileCache.Get(path, nEnd)))
+        return NULL;
+
+    pRecordRet = file->data() + pos.nPos;
+    nSizeRet += nTrailer;
+    return file;
+}
+
 /** Return transaction in txOut, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::Params& consensusParams, uint256 &hashBlock, bool fAllowSlow)
 {
@@ -1721,19 +1741,39 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
         return true;
     }
 
+    CTransactionRef ptx = recentTxCache.Get(hash, hashBlock);
+    if (ptx) {
+        txOut = *ptx;
+        return true;
+    }
+
     if (fTxIndex) {
         CDiskTxPos postx;
         if (pblocktree->ReadTxIndex(hash, postx)) {
-            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-            if (file.IsNull())
-                return error("%s: OpenBlockFile failed", __func__);
             CBlockHeader header;
-            try {
-                file >> header;
-                fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                file >> txOut;
-            } catch (const std::exception& e) {
-                return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+            const unsigned char* pBlock;
+            size_t nBlockSize;
+            std::shared_ptr<const CMappedBlockFile> mapped = GetMappedBlockRecord(postx, "blk", 0, pBlock, nBlockSize);
+            if (mapped) {
+                try {
+                    CSpanReader reader(pBlock, nBlockSize, SER_DISK, CLIENT_VERSION);
+                    reader >> header;
+                    reader.ignore(postx.nTxOffset);
+                    reader >> txOut;
+                } catch (const std::exception& e) {
+                    return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+                }
+            } else {
+                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+                if (file.IsNull())
+                    return error("%s: OpenBlockFile failed", __func__);
+                try {
+                    file >> header;
+                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+                    file >> txOut;
+                } catch (const std::exception& e) {
+                    return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+                }
             }
             hashBlock = header.GetHash();
             if (txOut.GetHash() != hash)
@@ -1786,29 +1826,36 @@ int getNHeight(const CBlockHeader &block) {
 
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
 {
-    // Open history file to append
-    CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("WriteBlockToDisk: OpenBlockFile failed");
-
-    // Write index header
-    unsigned int nSize = fileout.GetSerializeSize(block);
-    fileout << FLATDATA(messageStart) << nSize;
-
-    // Write block
-    long fileOutPos = ftell(fileout.Get());
-    if (fileOutPos < 0)
-        return error("WriteBlockToDisk: ftell failed");
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << block;
+    // Index header and block, appended to the history file in one go
+    unsigned int nSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss.reserve(MESSAGE_START_SIZE + sizeof(nSize) + nSize);
+    ss << FLATDATA(messageStart) << nSize << block;
+
+    if (!blockFileWriter.Write(GetBlockPosFilename(pos, "blk"), pos.nPos, &ss[0], ss.size()))
+        return error("WriteBlockToDisk: write to block file failed");
+    pos.nPos += MESSAGE_START_SIZE + sizeof(nSize);
 
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+static bool ReadBlockFromDiskUnchecked(CBlock& block, const CDiskBlockPos& pos)
 {
     block.SetNull();
 
+    const unsigned char* pBlock;
+    size_t nBlockSize;
+    std::shared_ptr<const CMappedBlockFile> mapped = GetMappedBlockRecord(pos, "blk", 0, pBlock, nBlockSize);
+    if (mapped) {
+        try {
+            CSpanReader(pBlock, nBlockSize, SER_DISK, CLIENT_VERSION) >> block;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+        return true;
+    }
+
     // Open history file to read
     CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
@@ -1822,6 +1869,14 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
     }
 
+    return true;
+}
+
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+{
+    if (!ReadBlockFromDiskUnchecked(block, pos))
+        return false;
+
     // Check the header
     int nHeight = getNHeight(block);
     if (!CheckProofOfWork(nHeight, block.GetHash(), block.nBits, consensusParams))
@@ -1830,9 +1885,19 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
     return true;
 }
 
+void SetBlockIndexSize(CBlockIndex* pindex, unsigned int nSize)
+{
+    AssertLockHeld(cs_main);
+    pindex->nSize = nSize;
+    pindex->nStatus |= BLOCK_HAVE_SIZE;
+    setDirtyBlockIndex.insert(pindex);
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams))
+    // The proof of work of indexed blocks was checked when their header got accepted,
+    // matching the stored hash is enough and saves a second header hash and index lookup
+    if (!ReadBlockFromDiskUnchecked(block, pindex->GetBlockPos()))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
@@ -1840,6 +1905,49 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool ReadRawBlockFromDisk(CSerializeData& vchBlock, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart)
+{
+    CDiskBlockPos pos = pindex->GetBlockPos();
+    if (pos.nPos < 8)
+        return error("%s: Invalid block position %s", __func__, pos.ToString());
+
+    const unsigned char* pBlock;
+    size_t nBlockSize;
+    std::shared_ptr<const CMappedBlockFile> mapped = GetMappedBlockRecord(pos, "blk", 0, pBlock, nBlockSize);
+    if (mapped && !memcmp(Params().MessageStart(), messageStart, MESSAGE_START_SIZE)) {
+        if (nBlockSize > MAX_PROTOCOL_MESSAGE_LENGTH)
+            return error("%s: Block size %u too large for %s at %s", __func__, nBlockSize, pindex->ToString(), pos.ToString());
+        vchBlock.insert(vchBlock.end(), (const char*)pBlock, (const char*)pBlock + nBlockSize);
+        return true;
+    }
+
+    // Start at the index header WriteBlockToDisk puts in front of the block
+    pos.nPos -= 8;
+    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+
+    try {
+        CMessageHeader::MessageStartChars blockStart;
+        unsigned int nSize;
+        filein >> FLATDATA(blockStart) >> nSize;
+
+        if (memcmp(blockStart, messageStart, sizeof(blockStart)))
+            return error("%s: Block magic mismatch for %s at %s", __func__, pindex->ToString(), pos.ToString());
+        if (nSize > MAX_PROTOCOL_MESSAGE_LENGTH)
+            return error("%s: Block size %u too large for %s at %s", __func__, nSize, pindex->ToString(), pos.ToString());
+
+        size_t nOffset = vchBlock.size();
+        vchBlock.resize(nOffset + nSize);
+        filein.read(&vchBlock[nOffset], nSize);
+    }
+    catch (const std::exception& e) {
+        return error("%s: Read from block file failed - %s at %s", __func__, e.what(), pos.ToString());
+    }
+
+    return true;
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     if (nHeight == 0)
@@ -2111,6 +2219,29 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
 }
 }// namespace Consensus
 
+static CuckooCache::cache<uint256, SignatureCacheHasher> scriptExecutionCache;
+static uint256 scriptExecutionCacheNonce(GetRandHash());
+
+void InitScriptExecutionCache() {
+    // nMaxCacheSize is unsigned. If -maxsigcachesize is set to zero,
+    // setup_bytes creates the minimum possible cache (2 elements).
+    size_t nMaxCacheSize = std::min(std::max((int64_t)0, GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) / 2), MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
+    size_t nElems = scriptExecutionCache.setup_bytes(nMaxCacheSize);
+    LogPrintf("Using %zu MiB out of %zu/2 requested for script execution cache, able to store %zu elements\n",
+            (nElems*sizeof(uint256)) >>20, GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE), nElems);
+}
+
+/** Entry of the script execution cache for the scripts of tx verified with flags. This assumes the
+ *  inputs are the ones the transaction commits to, the txids of the prevouts commit to their scripts. */
+static uint256 GetScriptExecutionCacheEntry(const CTransaction& tx, unsigned int flags)
+{
+    uint256 hashCacheEntry;
+    // We only use the first 19 bytes of nonce to avoid a second SHA round - giving us 19 + 32 + 4 = 55 bytes (+ 8 + 1 = 64)
+    static_assert(55 - sizeof(flags) - 32 >= 128/8, "Want at least 128 bits of nonce for script execution cache");
+    CSHA256().Write(scriptExecutionCacheNonce.begin(), 55 - sizeof(flags) - 32).Write(tx.GetHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(hashCacheEntry.begin());
+    return hashCacheEntry;
+}
+
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks)
 {
     if (!tx.IsCoinBase() && !tx.IsZerocoinSpend())
@@ -2131,6 +2262,14 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         // Of course, if an assumed valid block is invalid due to false scriptSigs
         // this optimization would allow an invalid chain to be accepted.
         if (fScriptChecks) {
+            // Skip the scripts if they were executed with the same flags already, e.g. when the
+            // transaction got accepted to the mempool. Entries are dropped once used unless the
+            // result is to be cached.
+            uint256 hashCacheEntry = GetScriptExecutionCacheEntry(tx, flags);
+            AssertLockHeld(cs_main); // the script execution cache is protected by cs_main
+            if (scriptExecutionCache.contains(hashCacheEntry, !cacheStore))
+                return true;
+
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
                 const Coin& coin = inputs.AccessCoin(prevout);
@@ -2172,64 +2311,76 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                     return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
                 }
             }
+
+            if (cacheStore && !pvChecks) {
+                // We executed all of the provided scripts, and were told to
+                // cache the result. Do so now.
+                scriptExecutionCache.insert(hashCacheEntry);
+            }
         }
     }
 
     return true;
 }
 
-namespace {
-
-bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
-    // Open history file to append
-    CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s: OpenUndoFile failed", __func__);
-
-    // Write index header
-    unsigned int nSize = fileout.GetSerializeSize(blockundo);
-    fileout << FLATDATA(messageStart) << nSize;
-
-    // Write undo data
-    long fileOutPos = ftell(fileout.Get());
-    if (fileOutPos < 0)
-        return error("%s: ftell failed", __func__);
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << blockundo;
+    uint256 hashChecksum;
+    const unsigned char* pUndo;
+    size_t nUndoSize;
+    std::shared_ptr<const CMappedBlockFile> mapped = GetMappedBlockRecord(pos, "rev", sizeof(hashChecksum), pUndo, nUndoSize);
+    if (mapped) {
+        try {
+            CSpanReader(pUndo, nUndoSize, SER_DISK, CLIENT_VERSION) >> blockundo >> hashChecksum;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s", __func__, e.what());
+        }
+    } else {
+        // Open history file to read
+        CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("%s: OpenUndoFile failed", __func__);
 
-    // calculate & write checksum
+        // Read block
+        try {
+            filein >> blockundo;
+            filein >> hashChecksum;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+
+    // Verify checksum
     CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
     hasher << hashBlock;
     hasher << blockundo;
-    fileout << hasher.GetHash();
+    if (hashChecksum != hasher.GetHash())
+        return error("%s: Checksum mismatch", __func__);
 
     return true;
 }
 
-bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
-{
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("%s: OpenUndoFile failed", __func__);
+namespace {
 
-    // Read block
-    uint256 hashChecksum;
-    try {
-        filein >> blockundo;
-        filein >> hashChecksum;
-    }
-    catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
-    }
+bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
+{
+    // Index header, undo data and checksum, appended to the history file in one go
+    unsigned int nSize = ::GetSerializeSize(blockundo, SER_DISK, CLIENT_VERSION);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss.reserve(MESSAGE_START_SIZE + sizeof(nSize) + nSize + sizeof(uint256));
+    ss << FLATDATA(messageStart) << nSize << blockundo;
 
-    // Verify checksum
+    // calculate & write checksum
     CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
     hasher << hashBlock;
     hasher << blockundo;
-    if (hashChecksum != hasher.GetHash())
-        return error("%s: Checksum mismatch", __func__);
+    ss << hasher.GetHash();
+
+    if (!undoFileWriter.Write(GetBlockPosFilename(pos, "rev"), pos.nPos, &ss[0], ss.size()))
+        return error("%s: write to undo file failed", __func__);
+    pos.nPos += MESSAGE_START_SIZE + sizeof(nSize);
 
     return true;
 }
@@ -2293,7 +2444,7 @@ int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
 
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  When UNCLEAN or FAILED is returned, view is left in an indeterminate state. */
-static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view)
+static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, CUTXOStats* pstats = NULL)
 {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
 
@@ -2366,6 +2517,8 @@ static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& s
                 if (!is_spent || tx.vout[o] != coin.out || pindex->nHeight != coin.nHeight || is_coinbase != coin.fCoinBase) {
                     fClean = false; // transaction output mismatch
                 }
+                if (is_spent && pstats)
+                    pstats->RemoveCoin(out, coin);
             }
         }
 
@@ -2382,8 +2535,10 @@ static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& s
                 int res = ApplyTxInUndo(std::move(txundo.vprevout[j]), view, out);
                 if (res == DISCONNECT_FAILED) return DISCONNECT_FAILED;
                 fClean = fClean && res != DISCONNECT_UNCLEAN;
+                if (pstats)
+                    pstats->AddCoin(out, view.AccessCoin(out));
 
-                const CTxIn input = tx.vin[j];
+                const CTxIn &input = tx.vin[j];
 
                 if (fSpentIndex) {
                     // undo and delete the spent index
@@ -2427,12 +2582,11 @@ static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& s
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
     if (fAddressIndex) {
-        if (!pblocktree->EraseAddressIndex(addressIndex)) {
-            AbortNode(state, "Failed to delete address index");
-            return DISCONNECT_FAILED;
-        }
-        if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex)) {
-            AbortNode(state, "Failed to write address unspent index");
+        CIndexUpdates updates;
+        updates.vAddressIndexErase = std::move(addressIndex);
+        updates.vAddressUnspentIndex = std::move(addressUnspentIndex);
+        if (!pindexdb->QueueIndexUpdates(std::move(updates))) {
+            AbortNode(state, "Failed to write address index");
             return DISCONNECT_FAILED;
         }
     }
@@ -2444,20 +2598,27 @@ void static FlushBlockFile(bool fFinalize = false)
 {
     LOCK(cs_LastBlockFile);
 
+    // The records appended since the last flush, usually to the last block file
+    if (!fFinalize) {
+        blockFileWriter.Commit();
+        undoFileWriter.Commit();
+        return;
+    }
+    blockFileWriter.Close();
+    undoFileWriter.Close();
+
     CDiskBlockPos posOld(nLastBlockFile, 0);
 
     FILE *fileOld = OpenBlockFile(posOld);
     if (fileOld) {
-        if (fFinalize)
-            TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nSize);
+        TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nSize);
         FileCommit(fileOld);
         fclose(fileOld);
     }
 
     fileOld = OpenUndoFile(posOld);
     if (fileOld) {
-        if (fFinalize)
-            TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nUndoSize);
+        TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nUndoSize);
         FileCommit(fileOld);
         fclose(fileOld);
     }
@@ -2472,9 +2633,154 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+/** Check the inputs of a transaction for the mempool. The scripts of transactions spending many
+ *  inputs are verified by the script-checking threads, which are idle while no block gets connected.
+ *  Failing transactions get checked once more inline to tell why they're invalid. */
+static bool CheckInputsMempool(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, unsigned int flags)
+{
+    AssertLockHeld(cs_main);
+
+    if (nScriptCheckThreads && tx.vin.size() >= MEMPOOL_SCRIPTCHECK_PARALLEL_INPUTS) {
+        std::vector<CScriptCheck> vChecks;
+        if (!CheckInputs(tx, state, view, true, flags, true, &vChecks))
+            return false;
+        CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+        control.Add(vChecks);
+        if (control.Wait()) {
+            scriptExecutionCache.insert(GetScriptExecutionCacheEntry(tx, flags));
+            return true;
+        }
+    }
+
+    return CheckInputs(tx, state, view, true, flags, true);
+}
+
+unsigned int AcceptToMemoryPoolBatch(CTxMemPool& pool, const std::vector<CTransaction>& vtx, std::vector<CValidationState>& vStates,
+                                     std::vector<bool>& vfAccepted, std::vector<bool>& vfMissingInputs, bool fRejectAbsurdFee)
+{
+    vStates.assign(vtx.size(), CValidationState());
+    vfAccepted.assign(vtx.size(), false);
+    vfMissingInputs.assign(vtx.size(), false);
+
+    LOCK2(cs_main, pool.cs);
+
+    // Order the batch so that transactions spending outputs of others in the batch come after them.
+    std::map<uint256, size_t> mapBatchIndex;
+    for (size_t i = 0; i < vtx.size(); i++)
+        mapBatchIndex.insert(std::make_pair(vtx[i].GetHash(), i));
+
+    std::vector<size_t> vOrder;
+    vOrder.reserve(vtx.size());
+    std::vector<bool> vfQueued(vtx.size(), false);
+    std::vector<std::pair<size_t, size_t> > vStack; // batch index, next input to look at
+    for (size_t i = 0; i < vtx.size(); i++) {
+        if (vfQueued[i])
+            continue;
+        vfQueued[i] = true;
+        vStack.push_back(std::make_pair(i, 0));
+        while (!vStack.empty()) {
+            const size_t nTx = vStack.back().first;
+            const size_t nIn = vStack.back().second++;
+            if (nIn < vtx[nTx].vin.size()) {
+                std::map<uint256, size_t>::const_iterator it = mapBatchIndex.find(vtx[nTx].vin[nIn].prevout.hash);
+                if (it != mapBatchIndex.end() && !vfQueued[it->second]) {
+                    vfQueued[it->second] = true;
+                    vStack.push_back(std::make_pair(it->second, 0));
+                }
+            } else {
+                vOrder.push_back(nTx);
+                vStack.pop_back();
+            }
+        }
+    }
+
+    // Verify the signatures of the whole batch on the script-checking threads first. The results land
+    // in the signature cache, which is what the serial acceptance below gets to skip. Failures only
+    // end the warm-up early, the acceptance finds and reports them itself.
+    if (nScriptCheckThreads && vtx.size() > 1) {
+        std::vector<COutPoint> vCoinsToUncache;
+        std::vector<CScriptCheck> vChecks;
+        {
+            CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
+            CCoinsViewCache view(&viewMemPool);
+            BOOST_FOREACH(size_t i, vOrder) {
+                const CTransaction& tx = vtx[i];
+                if (tx.IsCoinBase() || tx.IsZerocoinSpend() || pool.exists(tx.GetHash()))
+                    continue;
+                bool fHaveInputs = true;
+                BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                    if (!pcoinsTip->HaveCoinInCache(txin.prevout))
+                        vCoinsToUncache.push_back(txin.prevout);
+                    if (!view.HaveCoin(txin.prevout)) {
+                        fHaveInputs = false;
+                        break;
+                    }
+                }
+                if (!fHaveInputs)
+                    continue;
+                for (unsigned int n = 0; n < tx.vin.size(); n++) {
+                    const Coin& coin = view.AccessCoin(tx.vin[n].prevout);
+                    CScriptCheck check(coin.out.scriptPubKey, coin.out.nValue, tx, n, STANDARD_SCRIPT_VERIFY_FLAGS, true);
+                    vChecks.push_back(CScriptCheck());
+                    check.swap(vChecks.back());
+                }
+                AddCoins(view, tx, MEMPOOL_HEIGHT);
+            }
+        }
+        // Leave the coins cache the way the acceptance expects to find it
+        BOOST_FOREACH(const COutPoint& outpoint, vCoinsToUncache)
+            pcoinsTip->Uncache(outpoint);
+
+        CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+        control.Add(vChecks);
+        control.Wait();
+    }
+
+    unsigned int nAccepted = 0;
+    BOOST_FOREACH(size_t i, vOrder) {
+        bool fMissingInputs = false;
+        vfAccepted[i] = AcceptToMemoryPool(pool, vStates[i], vtx[i], false, &fMissingInputs, false, fRejectAbsurdFee);
+        vfMissingInputs[i] = fMissingInputs;
+        if (vfAccepted[i])
+            nAccepted++;
+    }
+    return nAccepted;
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
+/** Script verification flags the block at pindex is connected with */
+static unsigned int GetBlockScriptFlags(const CBlockIndex* pindex, const Consensus::Params& consensusparams)
+{
+    AssertLockHeld(cs_main);
+
+    // BIP16 didn't become active until Apr 1 2012
+    int64_t nBIP16SwitchTime = 1333238400;
+    bool fStrictPayToScriptHash = (pindex->GetBlockTime() >= nBIP16SwitchTime);
+
+    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
+
+    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=3 blocks,
+    // when 75% of the network has upgraded:
+    if (pindex->nVersion >= 3 && IsSuperMajority(3, pindex->pprev, consensusparams.nMajorityEnforceBlockUpgrade, consensusparams)) {
+        flags |= SCRIPT_VERIFY_DERSIG;
+    }
+
+    // Start enforcing CHECKLOCKTIMEVERIFY, (BIP65) for block.nVersion=4
+    // blocks, when 75% of the network has upgraded:
+    if (pindex->nVersion >= 4 && IsSuperMajority(4, pindex->pprev, consensusparams.nMajorityEnforceBlockUpgrade, consensusparams)) {
+        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
+    }
+
+    // Start enforcing BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
+    if (VersionBitsState(pindex->pprev, consensusparams, Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE) {
+        flags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
+    }
+
+    return flags;
+}
+
 int32_t ComputeBlockVersion(const CBlockIndex* pindexPrev, const Consensus::Params& params, bool fAssumeSmartnodeIsUpgraded)
 {
     LOCK(cs_main);
@@ -2546,16 +2852,21 @@ static int64_t nTimeTotal = 0;
 
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins.
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
- *  can fail if those validity checks fail (among other reasons). */
-static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck = false)
+ *  can fail if those validity checks fail (among other reasons).
+ *  fJustCheck is the TestBlockValidity mode: nothing is written, no index
+ *  entries are built and scripts are looked up in the execution cache the
+ *  mempool filled, but the coinbase payments and limits are fully checked. */
+static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck = false, CUTXOStats* pstats = NULL)
 {
     const CChainParams& chainparams = Params();
     AssertLockHeld(cs_main);
 
     int64_t nTimeStart = GetTimeMicros();
 
-    // Check it again in case a previous version let a bad block in
-    if (!CheckBlock(block, state, !fJustCheck, !fJustCheck))
+    // Check it again in case a previous version let a bad block in. With
+    // fJustCheck the block is a template that TestBlockValidity has just
+    // run through CheckBlock.
+    if (!fJustCheck && !CheckBlock(block, state, true, true, pindex->nHeight))
         return false;
 
     // verify that the view's current state corresponds to the previous block
@@ -2636,24 +2947,8 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
         }
     }
 
-    // BIP16 didn't become active until Apr 1 2012
-    int64_t nBIP16SwitchTime = 1333238400;
-    bool fStrictPayToScriptHash = (pindex->GetBlockTime() >= nBIP16SwitchTime);
-
-    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
-
-    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=3 blocks,
-    // when 75% of the network has upgraded:
-    if (block.nVersion >= 3 && IsSuperMajority(3, pindex->pprev, chainparams.GetConsensus().nMajorityEnforceBlockUpgrade, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_DERSIG;
-    }
+    unsigned int flags = GetBlockScriptFlags(pindex, chainparams.GetConsensus());
 
-    // Start enforcing CHECKLOCKTIMEVERIFY, (BIP65) for block.nVersion=4
-    // blocks, when 75% of the network has upgraded:
-    if (block.nVersion >= 4 && IsSuperMajority(4, pindex->pprev, chainparams.GetConsensus().nMajorityEnforceBlockUpgrade, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
-    }
-    
     // Start enforcing ADAPTIVEBLOCKSIZE
     if (IsSuperMajority(block.nVersion, pindex->pprev, chainparams.GetConsensus().nMajorityEnforceBlockUpgrade, chainparams.GetConsensus())) {
     	maxBlockSize = BlockSizeCalculator::ComputeBlockSize(pindex);
@@ -2664,7 +2959,6 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     // Start enforcing BIP68 (sequence locks) and BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
     int nLockTimeFlags = 0;
     if (VersionBitsState(pindex->pprev, chainparams.GetConsensus(), Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE) {
-        flags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
         nLockTimeFlags |= LOCKTIME_VERIFY_SEQUENCE;
     }
 
@@ -2673,7 +2967,7 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
 
     CBlockUndo blockundo;
 
-    CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL, SCRIPTCHECK_BLOCK_BATCH);
 
     std::vector<int> prevheights;
     CAmount nFees = 0;
@@ -2719,10 +3013,10 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
                                  REJECT_INVALID, "bad-txns-nonfinal");
             }
 
-            if (fAddressIndex || fSpentIndex)
+            if (!fJustCheck && (fAddressIndex || fSpentIndex))
             {
                 for (size_t j = 0; j < tx.vin.size(); j++) {
-                    const CTxIn input = tx.vin[j];
+                    const CTxIn &input = tx.vin[j];
                     const Coin& coin = view.AccessCoin(tx.vin[j].prevout);
                     const CTxOut &prevout = coin.out;
                     uint160 hashBytes;
@@ -2756,7 +3050,7 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
 
             }
 
-            if (fStrictPayToScriptHash)
+            if (flags & SCRIPT_VERIFY_P2SH)
             {
                 // Add in sigops done by pay-to-script-hash inputs;
                 // this is to prevent a "rogue miner" from creating
@@ -2777,7 +3071,7 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
             control.Add(vChecks);
         }
 
-        if (fAddressIndex) {
+        if (!fJustCheck && fAddressIndex) {
             for (unsigned int k = 0; k < tx.vout.size(); k++) {
                 const CTxOut &out = tx.vout[k];
 
@@ -2811,9 +3105,20 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
             blockundo.vtxundo.push_back(CTxUndo());
         }
         UpdateCoins(tx, state, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
+        if (pstats) {
+            if (i > 0) {
+                const CTxUndo &txundo = blockundo.vtxundo.back();
+                for (size_t j = 0; j < txundo.vprevout.size(); j++)
+                    pstats->RemoveCoin(tx.vin[j].prevout, txundo.vprevout[j]);
+            }
+            for (size_t o = 0; o < tx.vout.size(); o++) {
+                if (!tx.vout[o].scriptPubKey.IsUnspendable())
+                    pstats->AddCoin(COutPoint(txhash, o), Coin(tx.vout[o], pindex->nHeight, tx.IsCoinBase()));
+            }
+        }
 
         vPos.push_back(std::make_pair(tx.GetHash(), pos));
-        pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+        pos.nTxOffset += tx.GetTotalSize();
     }
     int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
     LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime3 - nTime2), 0.001 * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * 0.000001);
@@ -2828,7 +3133,8 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     // TODO: resync data (both ways?) and try to reprocess this block later.
 
     if( !SmartMining::Validate(block, pindex, state, nFees) ){
-        mapRejectedBlocks.insert(make_pair(block.GetHash(), GetTime()));
+        if (!fJustCheck)
+            mapRejectedBlocks.insert(make_pair(block.GetHash(), GetTime()));
         return false;
     }
 
@@ -2861,28 +3167,30 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
         setDirtyBlockIndex.insert(pindex);
     }
 
+    // The rewards processing runs some blocks behind, keep what it needs of
+    // this one in memory instead of reading it from disk again.
+    CacheSmartRewardsBlock(pindex, block, blockundo);
+
     if (fTxIndex)
         if (!pblocktree->WriteTxIndex(vPos))
             return AbortNode(state, "Failed to write transaction index");
 
-    if (fAddressIndex) {
-        if (!pblocktree->WriteAddressIndex(addressIndex)) {
-            return AbortNode(state, "Failed to write address index");
-        }
-
-        if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex)) {
-            return AbortNode(state, "Failed to write address unspent index");
+    // The optional indexes are written in the background, FlushStateToDisk waits for them
+    // before the chainstate says the block is connected.
+    if (fAddressIndex || fSpentIndex || fTimestampIndex) {
+        CIndexUpdates updates;
+        if (fAddressIndex) {
+            updates.vAddressIndex = std::move(addressIndex);
+            updates.vAddressUnspentIndex = std::move(addressUnspentIndex);
         }
+        if (fSpentIndex)
+            updates.vSpentIndex = std::move(spentIndex);
+        if (fTimestampIndex)
+            updates.vTimestampIndex.push_back(CTimestampIndexKey(pindex->nTime, pindex->GetBlockHash()));
+        if (!pindexdb->QueueIndexUpdates(std::move(updates)))
+            return AbortNode(state, "Failed to write address, spent or timestamp index");
     }
 
-    if (fSpentIndex)
-        if (!pblocktree->UpdateSpentIndex(spentIndex))
-            return AbortNode(state, "Failed to write transaction index");
-
-    if (fTimestampIndex)
-        if (!pblocktree->WriteTimestampIndex(CTimestampIndexKey(pindex->nTime, pindex->GetBlockHash())))
-            return AbortNode(state, "Failed to write timestamp index");
-
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
@@ -2897,6 +3205,8 @@ static bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockInd
     int64_t nTime6 = GetTimeMicros(); nTimeCallbacks += nTime6 - nTime5;
     LogPrint("bench", "    - Callbacks: %.2fms [%.2fs]\n", 0.001 * (nTime6 - nTime5), nTimeCallbacks * 0.000001);
 
+    TRACE6(validation, block_connected, pindex->phashBlock->begin(), pindex->nHeight, block.vtx.size(), nInputs, nSigOps, nTime6 - nTimeStart);
+
     return true;
 }
 
@@ -2912,6 +3222,7 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     static int64_t nLastWrite = 0;
     static int64_t nLastFlush = 0;
     static int64_t nLastSetChain = 0;
+    static int64_t nLastSync = 0;
     std::set<int> setFilesToPrune;
     bool fFlushForPrune = false;
     try {
@@ -2937,7 +3248,11 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     if (nLastSetChain == 0) {
         nLastSetChain = nNow;
     }
+    if (nLastSync == 0) {
+        nLastSync = nNow;
+    }
     size_t cacheSize = pcoinsTip->DynamicMemoryUsage();
+    metricCoinsCacheUsage.Set(cacheSize);
     // The cache is large and close to the limit, but we have time now (not in the middle of a block processing).
     bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize * (10.0/9) > nCoinCacheUsage;
     // The cache is over the limit, we have to write now.
@@ -2948,11 +3263,19 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     bool fPeriodicFlush = mode == FLUSH_STATE_PERIODIC && nNow > nLastFlush + (int64_t)DATABASE_FLUSH_INTERVAL * 1000000;
     // Combine all conditions that result in a full cache flush.
     bool fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush || fFlushForPrune;
+    // At the tip, write the few coins changed since the last time but keep the cache, so there is little left
+    // to write at shutdown and little to replay after a crash. During the initial block download most of the
+    // cache is changed, it only gets written when it's full.
+    bool fPeriodicSync = !fDoFullFlush && mode == FLUSH_STATE_PERIODIC && nCoinsSyncInterval > 0 &&
+                         nNow > nLastSync + nCoinsSyncInterval * 1000000 && !IsInitialBlockDownload();
     // Write blocks and block index to disk.
-    if (fDoFullFlush || fPeriodicWrite) {
+    if (fDoFullFlush || fPeriodicWrite || fPeriodicSync) {
         // Depend on nMinDiskSpace to ensure we can write block index
         if (!CheckDiskSpace(0))
             return state.Error("out of disk space");
+        // The address, spent and timestamp indexes have to be as far as the chainstate we write.
+        if (!pindexdb->SyncIndexUpdates())
+            return AbortNode(state, "Failed to write to index database");
         // First make sure all block and undo data is flushed to disk.
         FlushBlockFile();
         // Then update all block file information (which may refer to block and undo files).
@@ -2988,9 +3311,26 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
         // Flush the chainstate (which may refer to block index entries).
+        pcoinsdbview->SetUTXOStats(fUTXOStatsValid ? &utxoStats : NULL);
+        TRACE3(utxocache, flush, (int)mode, pcoinsTip->GetCacheSize(), pcoinsTip->DynamicMemoryUsage());
         if (!pcoinsTip->Flush())
             return AbortNode(state, "Failed to write to coin database");
+        TRACE1(utxocache, flushed, (int)mode);
+        // With background flushing the coins may still be on their way to disk. Wait for them when
+        // the caller relies on the chainstate being on disk, e.g. at shutdown or before pruning.
+        if ((mode == FLUSH_STATE_ALWAYS || fFlushForPrune) && !pcoinsdbview->Sync())
+            return AbortNode(state, "Failed to write to coin database");
         nLastFlush = nNow;
+        nLastSync = nNow;
+    } else if (fPeriodicSync) {
+        if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
+            return state.Error("out of disk space");
+        int64_t nStart = GetTimeMicros();
+        pcoinsdbview->SetUTXOStats(fUTXOStatsValid ? &utxoStats : NULL);
+        if (!pcoinsTip->FlushDirty())
+            return AbortNode(state, "Failed to write to coin database");
+        LogPrint("bench", "    - Write changed coins: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
+        nLastSync = nNow;
     }
     if (fDoFullFlush || ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000)) {
         // Update best block in wallet (so we can detect restored wallets).
@@ -3014,13 +3354,57 @@ void PruneAndFlush() {
     FlushStateToDisk(state, FLUSH_STATE_NONE);
 }
 
+bool GetTipUTXOStats(CUTXOStats &stats) {
+    LOCK(cs_main);
+    if (!fUTXOStatsValid)
+        return false;
+    stats = utxoStats;
+    return true;
+}
+
+void SetTipUTXOStats(const CUTXOStats &stats) {
+    LOCK(cs_main);
+    if (fUTXOStatsValid || stats.hashBlock != pcoinsTip->GetBestBlock())
+        return;
+    utxoStats = stats;
+    fUTXOStatsValid = true;
+}
+
 /** Update chainActive and related internal data structures. */
+static std::shared_ptr<const CChainTipSnapshot> pchainTipSnapshot;
+
+CChainTipSnapshot::CChainTipSnapshot(const CBlockIndex* pindexIn) :
+    pindex(pindexIn),
+    nHeight(pindexIn->nHeight),
+    hashBlock(pindexIn->GetBlockHash()),
+    nTime(pindexIn->GetBlockTime()),
+    nMedianTimePast(pindexIn->GetMedianTimePast()),
+    nBits(pindexIn->nBits)
+{}
+
+std::shared_ptr<const CChainTipSnapshot> GetChainTipSnapshot()
+{
+    return std::atomic_load(&pchainTipSnapshot);
+}
+
+/** Move chainActive to pindexNew and publish its snapshot */
+static void SetChainTip(CBlockIndex* pindexNew)
+{
+    chainActive.SetTip(pindexNew);
+    blockTimeIndex.SetTip(pindexNew);
+    std::shared_ptr<const CChainTipSnapshot> snapshot;
+    if (pindexNew)
+        snapshot = std::make_shared<const CChainTipSnapshot>(pindexNew);
+    std::atomic_store(&pchainTipSnapshot, snapshot);
+}
+
 void static UpdateTip(CBlockIndex *pindexNew) {
     const CChainParams& chainParams = Params();
-    chainActive.SetTip(pindexNew);
+    SetChainTip(pindexNew);
 
     // New best block
     mempool.AddTransactionsUpdated(1);
+    metricTipHeight.Set(pindexNew->nHeight);
 
     if(fDebug || !(pindexNew->nHeight % 1000) ){
         LogPrintf("%s: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%.1fMiB(%utxo)\n", __func__,
@@ -3086,71 +3470,78 @@ bool static DisconnectTip(CValidationState& state, const Consensus::Params& cons
     int64_t nStart = GetTimeMicros();
     {
         CCoinsViewCache view(pcoinsTip);
-        if (DisconnectBlock(block, state, pindexDelete, view) != DISCONNECT_OK)
+        CUTXOStats statsNew(utxoStats);
+        if (DisconnectBlock(block, state, pindexDelete, view, fUTXOStatsValid ? &statsNew : NULL) != DISCONNECT_OK)
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         assert(view.Flush());
+        if (fUTXOStatsValid) {
+            statsNew.hashBlock = pindexDelete->pprev->GetBlockHash();
+            utxoStats = statsNew;
+        }
     }
     LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
 
-    // Zerocoin reorg, set mint to height -1, id -1
-    list <CZerocoinEntry> listPubCoin = list<CZerocoinEntry>();
+    // Zerocoin reorg, set mint to height -1, id -1. The spends and mints are
+    // looked up in the wallet's zerocoin index rather than matched over lists.
     CWalletDB walletdb(pwalletMain->strWalletFile);
-    walletdb.ListPubCoin(listPubCoin);
 
-    list <CZerocoinSpendEntry> listCoinSpendSerial;
-    walletdb.ListCoinSpendSerial(listCoinSpendSerial);
+    // Resetting a mint goes over all the others as they were before the block was disconnected
+    list <CZerocoinEntry> listPubCoin;
+    bool fHasMint = false;
+    for (unsigned int i = 0; i < block.vtx.size() && !fHasMint; i++)
+        BOOST_FOREACH(const CTxOut& txout, block.vtx[i].vout)
+            fHasMint |= !txout.scriptPubKey.empty() && txout.scriptPubKey.IsZerocoinMint();
+    if (fHasMint)
+        walletdb.ListPubCoin(listPubCoin);
 
     BOOST_FOREACH(const CTransaction &tx, block.vtx){
         // Check Spend Zerocoin Transaction
         if (tx.IsZerocoinSpend()) {
+            list <CZerocoinSpendEntry> listCoinSpendSerial;
+            walletdb.ListCoinSpendSerial(tx.GetHash(), listCoinSpendSerial);
             BOOST_FOREACH(const CZerocoinSpendEntry &item, listCoinSpendSerial) {
-                if (item.hashTx == tx.GetHash()) {
-                    BOOST_FOREACH(const CZerocoinEntry &pubCoinItem, listPubCoin) {
-                        if (pubCoinItem.value == item.pubCoin) {
-                            CZerocoinEntry pubCoinTx;
-                            pubCoinTx.nHeight = pubCoinItem.nHeight;
-                            pubCoinTx.denomination = pubCoinItem.denomination;
-                            // UPDATE FOR INDICATE IT HAS BEEN RESET
-                            pubCoinTx.IsUsed = false;
-                            pubCoinTx.randomness = pubCoinItem.randomness;
-                            pubCoinTx.serialNumber = pubCoinItem.serialNumber;
-                            pubCoinTx.value = pubCoinItem.value;
-                            pubCoinTx.id = pubCoinItem.id;
-                            walletdb.WriteZerocoinEntry(pubCoinTx);
-                            LogPrintf("DisconnectTip() -> NotifyZerocoinChanged\n");
-                            LogPrintf("pubcoin=%s, isUsed=New\n", pubCoinItem.value.GetHex());
-                            pwalletMain->NotifyZerocoinChanged(pwalletMain, pubCoinItem.value.GetHex(), "New", CT_UPDATED);
-                            walletdb.EraseCoinSpendSerialEntry(item);
-                            pwalletMain->EraseFromWallet(item.hashTx);
-                        }
-                    }
+                CZerocoinEntry pubCoinItem;
+                if (walletdb.ReadZerocoinEntry(item.pubCoin, pubCoinItem)) {
+                    CZerocoinEntry pubCoinTx;
+                    pubCoinTx.nHeight = pubCoinItem.nHeight;
+                    pubCoinTx.denomination = pubCoinItem.denomination;
+                    // UPDATE FOR INDICATE IT HAS BEEN RESET
+                    pubCoinTx.IsUsed = false;
+                    pubCoinTx.randomness = pubCoinItem.randomness;
+                    pubCoinTx.serialNumber = pubCoinItem.serialNumber;
+                    pubCoinTx.value = pubCoinItem.value;
+                    pubCoinTx.id = pubCoinItem.id;
+                    walletdb.WriteZerocoinEntry(pubCoinTx);
+                    LogPrintf("DisconnectTip() -> NotifyZerocoinChanged\n");
+                    LogPrintf("pubcoin=%s, isUsed=New\n", pubCoinItem.value.GetHex());
+                    pwalletMain->NotifyZerocoinChanged(pwalletMain, pubCoinItem.value.GetHex(), "New", CT_UPDATED);
+                    walletdb.EraseCoinSpendSerialEntry(item);
+                    pwalletMain->EraseFromWallet(item.hashTx);
                 }
             }
         }
 
         // Check Mint Zerocoin Transaction
-        BOOST_FOREACH(const CTxOut txout, tx.vout) {
+        BOOST_FOREACH(const CTxOut& txout, tx.vout) {
             if (!txout.scriptPubKey.empty() && txout.scriptPubKey.IsZerocoinMint()) {
                 vector<unsigned char> vchZeroMint;
                 vchZeroMint.insert(vchZeroMint.end(), txout.scriptPubKey.begin() + 6, txout.scriptPubKey.begin() + txout.scriptPubKey.size());
                 CBigNum pubCoin;
                 pubCoin.setvch(vchZeroMint);
                 int zerocoinMintHeight = -1;
-                BOOST_FOREACH(const CZerocoinEntry &pubCoinItem, listPubCoin) {
-                    if (pubCoinItem.value == pubCoin) {
-                        zerocoinMintHeight = pubCoinItem.nHeight;
-                        CZerocoinEntry pubCoinTx;
-                        pubCoinTx.id = -1;
-                        pubCoinTx.IsUsed = pubCoinItem.IsUsed;
-                        pubCoinTx.randomness = pubCoinItem.randomness;
-                        pubCoinTx.denomination = pubCoinItem.denomination;
-                        pubCoinTx.serialNumber = pubCoinItem.serialNumber;
-                        pubCoinTx.value = pubCoin;
-                        pubCoinTx.nHeight = -1;
-                        LogPrintf("- Pubcoin Disconnect Reset Pubcoin Id: %d Height: %d\n", pubCoinTx.id, pindexDelete->nHeight);
-                        walletdb.WriteZerocoinEntry(pubCoinTx);
-                    }
-
+                CZerocoinEntry pubCoinItem;
+                if (walletdb.ReadZerocoinEntry(pubCoin, pubCoinItem)) {
+                    zerocoinMintHeight = pubCoinItem.nHeight;
+                    CZerocoinEntry pubCoinTx;
+                    pubCoinTx.id = -1;
+                    pubCoinTx.IsUsed = pubCoinItem.IsUsed;
+                    pubCoinTx.randomness = pubCoinItem.randomness;
+                    pubCoinTx.denomination = pubCoinItem.denomination;
+                    pubCoinTx.serialNumber = pubCoinItem.serialNumber;
+                    pubCoinTx.value = pubCoin;
+                    pubCoinTx.nHeight = -1;
+                    LogPrintf("- Pubcoin Disconnect Reset Pubcoin Id: %d Height: %d\n", pubCoinTx.id, pindexDelete->nHeight);
+                    walletdb.WriteZerocoinEntry(pubCoinTx);
                 }
 
                 BOOST_FOREACH(const CZerocoinEntry &pubCoinItem, listPubCoin) {
@@ -3195,10 +3586,11 @@ bool static DisconnectTip(CValidationState& state, const Consensus::Params& cons
     mempool.UpdateTransactionsFromBlock(vHashUpdate);
     // Update chainActive and related variables.
     UpdateTip(pindexDelete->pprev);
+    recentTxCache.EraseBlock(pindexDelete->GetBlockHash());
     // Let wallets know transactions went from 1-confirmed to
     // 0-confirmed or conflicted:
     BOOST_FOREACH(const CTransaction &tx, block.vtx) {
-        GetMainSignals().SyncTransaction(tx, NULL);
+        GetMainSignals().QueueSyncTransaction(tx, NULL);
     }
     return true;
 }
@@ -3230,7 +3622,9 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
     {
         CCoinsViewCache view(pcoinsTip);
-        bool rv = ConnectBlock(*pblock, state, pindexNew, view);
+        // The statistics only take the changes of the block once it is connected
+        CUTXOStats statsNew(utxoStats);
+        bool rv = ConnectBlock(*pblock, state, pindexNew, view, false, fUTXOStatsValid ? &statsNew : NULL);
         GetMainSignals().BlockChecked(*pblock, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -3240,6 +3634,10 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
         nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
         LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
         assert(view.Flush());
+        if (fUTXOStatsValid) {
+            statsNew.hashBlock = pindexNew->GetBlockHash();
+            utxoStats = statsNew;
+        }
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
     LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
@@ -3248,27 +3646,35 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
         return false;
     int64_t nTime5 = GetTimeMicros(); nTimeChainState += nTime5 - nTime4;
     LogPrint("bench", "  - Writing chainstate: %.2fms [%.2fs]\n", (nTime5 - nTime4) * 0.001, nTimeChainState * 0.000001);
+    // The recent transaction cache shares the transactions the mempool already holds
+    std::vector<CTransactionRef> vtxRef;
+    vtxRef.reserve(pblock->vtx.size());
+    BOOST_FOREACH(const CTransaction &tx, pblock->vtx) {
+        CTransactionRef ptx = mempool.get(tx.GetHash());
+        vtxRef.push_back(ptx ? ptx : MakeTransactionRef(tx));
+    }
     // Remove conflicting transactions from the mempool.
     list<CTransaction> txConflicted;
     mempool.removeForBlock(pblock->vtx, pindexNew->nHeight, txConflicted, !IsInitialBlockDownload());
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
+    recentTxCache.AddBlock(pindexNew->GetBlockHash(), vtxRef);
     // Tell wallet about transactions that went from mempool
     // to conflicted:
     BOOST_FOREACH(const CTransaction &tx, txConflicted) {
-        GetMainSignals().SyncTransaction(tx, NULL);
-    }
-    // ... and about transactions that got confirmed:
-    BOOST_FOREACH(const CTransaction &tx, pblock->vtx) {
-        GetMainSignals().SyncTransaction(tx, pblock);
+        GetMainSignals().QueueSyncTransaction(tx, NULL);
     }
+    // ... and about the block and the transactions that got confirmed:
+    GetMainSignals().QueueBlockConnected(*pblock, pindexNew);
 
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5; nTimeTotal += nTime6 - nTime1;
     LogPrint("bench", "  - Connect postprocess: %.2fms [%.2fs]\n", (nTime6 - nTime5) * 0.001, nTimePostConnect * 0.000001);
     LogPrint("bench", "- Connect block: %.2fms [%.2fs]\n", (nTime6 - nTime1) * 0.001, nTimeTotal * 0.000001);
+    metricConnectBlock.Observe(nTime6 - nTime1);
+    TRACE6(validation, block_connect_stages, pindexNew->nHeight, nTime2 - nTime1, nTime3 - nTime2, nTime4 - nTime3, nTime5 - nTime4, nTime6 - nTime5);
 
     //### SMARTCASH START
-    if(pindexNew->nHeight > 0) prewards->ProcessBlock(pindexNew, chainparams);
+    if(pindexNew->nHeight > 0) QueueSmartRewardsBlock(pindexNew);
     //### SMARTCASH END
 
     return true;
@@ -3316,26 +3722,30 @@ bool DisconnectBlocks(int blocks) {
 }
 
 void ReprocessBlocks(int nBlocks) {
-    LOCK(cs_main);
+    {
+        LOCK(cs_main);
 
-    std::map<uint256, int64_t>::iterator it = mapRejectedBlocks.begin();
-    while (it != mapRejectedBlocks.end()) {
-        //use a window twice as large as is usual for the nBlocks we want to reset
-        if ((*it).second > GetTime() - (nBlocks * 60 * 5)) {
-            BlockMap::iterator mi = mapBlockIndex.find((*it).first);
-            if (mi != mapBlockIndex.end() && (*mi).second) {
+        std::map<uint256, int64_t>::iterator it = mapRejectedBlocks.begin();
+        while (it != mapRejectedBlocks.end()) {
+            //use a window twice as large as is usual for the nBlocks we want to reset
+            if ((*it).second > GetTime() - (nBlocks * 60 * 5)) {
+                BlockMap::iterator mi = mapBlockIndex.find((*it).first);
+                if (mi != mapBlockIndex.end() && (*mi).second) {
 
-                CBlockIndex *pindex = (*mi).second;
-                LogPrintf("ReprocessBlocks -- %s\n", (*it).first.ToString());
+                    CBlockIndex *pindex = (*mi).second;
+                    LogPrintf("ReprocessBlocks -- %s\n", (*it).first.ToString());
 
-                CValidationState state;
-                ReconsiderBlock(state, pindex);
+                    CValidationState state;
+                    ReconsiderBlock(state, pindex);
+                }
             }
+            ++it;
         }
-        ++it;
+
+        DisconnectBlocks(nBlocks);
     }
 
-    DisconnectBlocks(nBlocks);
+    // ActivateBestChain takes cs_main itself and may wait for the validation signals.
 
     CValidationState state;
     ActivateBestChain(state, Params());
@@ -3597,6 +4007,9 @@ bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams,
         if (ShutdownRequested())
             break;
 
+        // Queued notifications keep a copy of their block, don't let them pile up.
+        LimitValidationInterfaceQueue();
+
         const CBlockIndex *pindexFork;
         bool fInitialDownload;
         {
@@ -3627,7 +4040,7 @@ bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams,
         // Notifications/callbacks that can run without cs_main
 
         // Notify external listeners about the new tip.
-        GetMainSignals().UpdatedBlockTip(pindexNewTip, pindexFork, fInitialDownload);
+        GetMainSignals().QueueUpdatedBlockTip(pindexNewTip, pindexFork, fInitialDownload);
 
         // Always notify the UI if a new block tip was connected
         if (pindexFork != pindexNewTip) {
@@ -3717,31 +4130,33 @@ bool ReconsiderBlock(CValidationState &state, CBlockIndex *pindex) {
     return true;
 }
 
-CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
+CBlockIndex* AddToBlockIndex(const CBlockHeader& block, const uint256* phash = NULL)
 {
     // Check for duplicate
-    uint256 hash = block.GetHash();
+    uint256 hash = phash ? *phash : block.GetHash();
     BlockMap::iterator it = mapBlockIndex.find(hash);
     if (it != mapBlockIndex.end())
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
+    BlockMap::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
+    CBlockIndex* pindexPrev = miPrev != mapBlockIndex.end() ? miPrev->second : NULL;
+    CBlockIndex* pindexNew = blockIndexStore.Allocate(pindexPrev ? pindexPrev->nHeight + 1 : 0);
+    *pindexNew = CBlockIndex(block);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
     pindexNew->nSequenceId = 0;
     BlockMap::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
-    BlockMap::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
-    if (miPrev != mapBlockIndex.end())
+    if (pindexPrev)
     {
-        pindexNew->pprev = (*miPrev).second;
+        pindexNew->pprev = pindexPrev;
         pindexNew->nHeight = pindexNew->pprev->nHeight + 1;
         pindexNew->BuildSkip();
     }
     pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + GetBlockProof(*pindexNew);
+    pindexNew->BuildVersionCounts();
     pindexNew->RaiseValidity(BLOCK_VALID_TREE);
     if (pindexBestHeader == NULL || pindexBestHeader->nChainWork < pindexNew->nChainWork)
         pindexBestHeader = pindexNew;
@@ -3759,7 +4174,8 @@ bool ReceivedBlockTransactions(const CBlock &block, CValidationState& state, CBl
     pindexNew->nFile = pos.nFile;
     pindexNew->nDataPos = pos.nPos;
     pindexNew->nUndoPos = 0;
-    pindexNew->nStatus |= BLOCK_HAVE_DATA;
+    pindexNew->nSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+    pindexNew->nStatus |= BLOCK_HAVE_DATA | BLOCK_HAVE_SIZE;
     pindexNew->RaiseValidity(BLOCK_VALID_TRANSACTIONS);
     setDirtyBlockIndex.insert(pindexNew);
 
@@ -3878,24 +4294,107 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
                 fclose(file);
             }
         }
-        else
-            return state.Error("out of disk space");
+        else
+            return state.Error("out of disk space");
+    }
+
+    return true;
+}
+
+static bool CheckBlockHeader(const CBlockHeader& block, const uint256& hash, CValidationState& state, bool fCheckPOW)
+{
+    // Check proof of work matches claimed amount
+    int nHeight = getNHeight(block);
+    if (fCheckPOW && !CheckProofOfWork(nHeight, hash, block.nBits, Params().GetConsensus()))
+        return state.DoS(50, false, REJECT_INVALID, "high-hash", false, "proof of work failed");
+
+    return true;
+}
+
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW)
+{
+    return CheckBlockHeader(block, block.GetHash(), state, fCheckPOW);
+}
+
+/** Closure running the context-free checks of a range of transactions of a block */
+class CBlockTxCheck
+{
+private:
+    const CBlock* pblock;
+    unsigned int nBegin;
+    unsigned int nEnd;
+    int nHeight;
+    unsigned int* pnSigOps;
+
+public:
+    CBlockTxCheck() : pblock(NULL), nBegin(0), nEnd(0), nHeight(0), pnSigOps(NULL) {}
+    CBlockTxCheck(const CBlock& blockIn, unsigned int nBeginIn, unsigned int nEndIn, int nHeightIn, unsigned int* pnSigOpsIn) :
+        pblock(&blockIn), nBegin(nBeginIn), nEnd(nEndIn), nHeight(nHeightIn), pnSigOps(pnSigOpsIn) {}
+
+    bool operator()()
+    {
+        CValidationState state;
+        CTxCheckContext context(nHeight);
+        unsigned int nSigOps = 0;
+        for (unsigned int i = nBegin; i < nEnd; i++) {
+            const CTransaction& tx = pblock->vtx[i];
+            if (!CheckTransaction(tx, state, tx.GetHash(), false, context))
+                return false;
+            nSigOps += GetLegacySigOpCount(tx);
+        }
+        *pnSigOps = nSigOps;
+        return true;
     }
 
-    return true;
+    void swap(CBlockTxCheck& check)
+    {
+        std::swap(pblock, check.pblock);
+        std::swap(nBegin, check.nBegin);
+        std::swap(nEnd, check.nEnd);
+        std::swap(nHeight, check.nHeight);
+        std::swap(pnSigOps, check.pnSigOps);
+    }
+};
+
+static CCheckQueue<CBlockTxCheck> blocktxcheckqueue(4);
+//! CheckBlock may run on several threads at once, only one of them uses the queue at a time
+static boost::mutex cs_blocktxcheckqueue;
+
+void ThreadBlockTxCheck() {
+    RenameThread("smartcash-blocktxch");
+    blocktxcheckqueue.Thread();
 }
 
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW)
+/** Run the transaction checks of CheckBlock on the block tx check threads. Returns false if any
+ *  transaction fails, the caller checks them in order again to report the first failure the way
+ *  the serial checks do. Also false if the threads are busy with another block. */
+static bool CheckBlockTransactionsParallel(const CBlock& block, int nHeight, unsigned int& nSigOpsRet)
 {
-    // Check proof of work matches claimed amount
-    int nHeight = getNHeight(block);
-    if (fCheckPOW && !CheckProofOfWork(nHeight, block.GetHash(), block.nBits, Params().GetConsensus()))
-        return state.DoS(50, false, REJECT_INVALID, "high-hash", false, "proof of work failed");
+    boost::unique_lock<boost::mutex> lock(cs_blocktxcheckqueue, boost::try_to_lock);
+    if (!lock.owns_lock())
+        return false;
+
+    unsigned int nChunks = (block.vtx.size() + BLOCK_TXCHECK_CHUNK - 1) / BLOCK_TXCHECK_CHUNK;
+    std::vector<unsigned int> vChunkSigOps(nChunks, 0);
+    std::vector<CBlockTxCheck> vChecks;
+    vChecks.reserve(nChunks);
+    for (unsigned int i = 0; i < nChunks; i++) {
+        unsigned int nEnd = std::min((unsigned int)block.vtx.size(), (i + 1) * BLOCK_TXCHECK_CHUNK);
+        vChecks.push_back(CBlockTxCheck(block, i * BLOCK_TXCHECK_CHUNK, nEnd, nHeight, &vChunkSigOps[i]));
+    }
+
+    CCheckQueueControl<CBlockTxCheck> control(&blocktxcheckqueue);
+    control.Add(vChecks);
+    if (!control.Wait())
+        return false;
 
+    nSigOpsRet = 0;
+    BOOST_FOREACH(unsigned int nChunkSigOps, vChunkSigOps)
+        nSigOpsRet += nChunkSigOps;
     return true;
 }
 
-bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot)
+bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot, int nHeight)
 {
      // These are checks that are independent of context.
 
@@ -3904,7 +4403,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
 
     // Check that the header is valid (particularly PoW).  This is mostly
     // redundant with the call in AcceptBlockHeader.
-    if (!CheckBlockHeader(block, state, fCheckPOW))
+    if (!CheckBlockHeader(block, block.GetHash(), state, fCheckPOW))
         return false;
 
     // Check the merkle root.
@@ -3971,16 +4470,25 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
 
     // END SMART
 
-    // Check transactions
-    BOOST_FOREACH(const CTransaction& tx, block.vtx)
-        if (!CheckTransaction(tx, state, tx.GetHash(), false, getNHeight(block)))
-            return state.Invalid(false, state.GetRejectCode(), state.GetRejectReason(),
-                                 strprintf("Transaction check failed (tx hash %s) %s", tx.GetHash().ToString(), state.GetDebugMessage()));
-
+    // Check transactions, big blocks in parallel. If that fails the serial checks find the
+    // first failing transaction, so the result doesn't depend on how the work got split.
+    if (nHeight < 0)
+        nHeight = getNHeight(block);
     unsigned int nSigOps = 0;
-    BOOST_FOREACH(const CTransaction& tx, block.vtx)
-    {
-        nSigOps += GetLegacySigOpCount(tx);
+    bool fChecked = nScriptCheckThreads && block.vtx.size() >= 2 * BLOCK_TXCHECK_CHUNK &&
+                    CheckBlockTransactionsParallel(block, nHeight, nSigOps);
+    if (!fChecked) {
+        CTxCheckContext context(nHeight);
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+            if (!CheckTransaction(tx, state, tx.GetHash(), false, context))
+                return state.Invalid(false, state.GetRejectCode(), state.GetRejectReason(),
+                                     strprintf("Transaction check failed (tx hash %s) %s", tx.GetHash().ToString(), state.GetDebugMessage()));
+
+        nSigOps = 0;
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        {
+            nSigOps += GetLegacySigOpCount(tx);
+        }
     }
     if (nSigOps * WITNESS_SCALE_FACTOR > MAX_BLOCK_SIGOPS_COST)
         return state.DoS(100, false, REJECT_INVALID, "bad-blk-sigops", false, "out-of-bounds SigOpCount");
@@ -4173,11 +4681,12 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL)
+/** phash, when given, is block's hash computed beforehand */
+static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL, const uint256* phash=NULL)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
-    uint256 hash = block.GetHash();
+    uint256 hash = phash ? *phash : block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex *pindex = NULL;
 
@@ -4194,7 +4703,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return true;
         }
 
-        if (!CheckBlockHeader(block, state))
+        if (!CheckBlockHeader(block, hash, state, true))
             return false;
 
         // Get prev block index
@@ -4214,7 +4723,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return false;
     }
     if (pindex == NULL)
-        pindex = AddToBlockIndex(block);
+        pindex = AddToBlockIndex(block, &hash);
 
     if (ppindex)
         *ppindex = pindex;
@@ -4229,10 +4738,12 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
 
 bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
 {
+    // Hash the whole message in batches before taking cs_main, the checks below are sequential
+    std::vector<uint256> vHashes = GetBlockHeaderHashes(headers);
     {
         LOCK(cs_main);
-        for (const CBlockHeader& header : headers) {
-            if (!AcceptBlockHeader(header, state, chainparams, ppindex)) {
+        for (size_t i = 0; i < headers.size(); i++) {
+            if (!AcceptBlockHeader(headers[i], state, chainparams, ppindex, &vHashes[i])) {
                 return false;
             }
         }
@@ -4250,7 +4761,8 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
     CBlockIndex *pindexDummy = NULL;
     CBlockIndex *&pindex = ppindex ? *ppindex : pindexDummy;
 
-    if (!AcceptBlockHeader(block, state, chainparams, &pindex))
+    const uint256 hash = block.GetHash();
+    if (!AcceptBlockHeader(block, state, chainparams, &pindex, &hash))
         return false;
 
     // Try to process all requested blocks that we don't have, but only
@@ -4280,7 +4792,7 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
     }
     if (fNewBlock) *fNewBlock = true;
 
-    if ((!CheckBlock(block, state)) || !ContextualCheckBlock(block, state, pindex->pprev)) {
+    if ((!CheckBlock(block, state, true, true, pindex->nHeight)) || !ContextualCheckBlock(block, state, pindex->pprev)) {
         if (state.IsInvalid() && !state.CorruptionPossible()) {
             pindex->nStatus |= BLOCK_FAILED_VALID;
             setDirtyBlockIndex.insert(pindex);
@@ -4315,16 +4827,84 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
 
 static bool IsSuperMajority(int minVersion, const CBlockIndex* pstart, unsigned nRequired, const Consensus::Params& consensusParams)
 {
-    unsigned int nFound = 0;
-    for (int i = 0; i < consensusParams.nMajorityWindow && nFound < nRequired && pstart != NULL; i++)
+    return ((unsigned)CountBlocksAtVersion(pstart, minVersion, consensusParams.nMajorityWindow) >= nRequired);
+}
+
+
+//! Prevouts of received blocks waiting for a prefetch thread, and the number of those threads
+static boost::mutex cs_coinsprefetch;
+static boost::condition_variable cond_coinsprefetch;
+static std::deque<std::vector<COutPoint> > queueCoinsPrefetch;
+static int nCoinsPrefetchThreads = 0;
+
+void ThreadCoinsPrefetch() {
+    RenameThread("smartcash-prefetch");
     {
-        if (pstart->nVersion >= minVersion)
-            ++nFound;
-        pstart = pstart->pprev;
+        boost::unique_lock<boost::mutex> lock(cs_coinsprefetch);
+        nCoinsPrefetchThreads++;
+    }
+    try {
+        while (true) {
+            std::vector<COutPoint> vPrevouts;
+            {
+                boost::unique_lock<boost::mutex> lock(cs_coinsprefetch);
+                while (queueCoinsPrefetch.empty())
+                    cond_coinsprefetch.wait(lock);
+                vPrevouts.swap(queueCoinsPrefetch.front());
+                queueCoinsPrefetch.pop_front();
+            }
+            // pcoinsdbview only goes away after the threads got stopped
+            if (pcoinsdbview)
+                pcoinsdbview->Prefetch(vPrevouts);
+        }
+    } catch (const boost::thread_interrupted&) {
+        boost::unique_lock<boost::mutex> lock(cs_coinsprefetch);
+        nCoinsPrefetchThreads--;
+        queueCoinsPrefetch.clear();
+        throw;
     }
-    return (nFound >= nRequired);
 }
 
+/** Have the prefetch threads read the coins a received block spends from the coin
+ *  database, so connecting it later finds them in memory instead of reading them one
+ *  after the other. Coins in the cache already or created by the block are skipped. */
+static void PrefetchBlockCoins(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    {
+        boost::unique_lock<boost::mutex> lock(cs_coinsprefetch);
+        if (nCoinsPrefetchThreads == 0)
+            return;
+    }
+
+    std::unordered_set<uint256, BlockHasher> setBlockTxids;
+    setBlockTxids.reserve(block.vtx.size());
+    for (const CTransaction& tx : block.vtx)
+        setBlockTxids.insert(tx.GetHash());
+
+    std::vector<std::vector<COutPoint> > vTasks(1);
+    for (const CTransaction& tx : block.vtx) {
+        if (tx.IsCoinBase())
+            continue;
+        for (const CTxIn& txin : tx.vin) {
+            if (setBlockTxids.count(txin.prevout.hash) || pcoinsTip->HaveCoinInCache(txin.prevout))
+                continue;
+            if (vTasks.back().size() == COINS_PREFETCH_BATCH)
+                vTasks.push_back(std::vector<COutPoint>());
+            vTasks.back().push_back(txin.prevout);
+        }
+    }
+    if (vTasks.back().empty())
+        return;
+
+    boost::unique_lock<boost::mutex> lock(cs_coinsprefetch);
+    for (std::vector<COutPoint>& vPrevouts : vTasks) {
+        if (queueCoinsPrefetch.size() >= MAX_COINS_PREFETCH_QUEUE)
+            break;
+        queueCoinsPrefetch.push_back(std::move(vPrevouts));
+    }
+    cond_coinsprefetch.notify_all();
+}
 
 bool ProcessNewBlock(const CChainParams& chainparams, const CBlock* pblock, bool fForceProcessing, const CDiskBlockPos* dbp, bool *fNewBlock)
 {
@@ -4341,6 +4921,7 @@ bool ProcessNewBlock(const CChainParams& chainparams, const CBlock* pblock, bool
             GetMainSignals().BlockChecked(*pblock, state);
             return error("%s: AcceptBlock FAILED", __func__);
         }
+        PrefetchBlockCoins(*pblock);
     }
 
     NotifyHeaderTip();
@@ -4367,7 +4948,7 @@ bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams,
     // NOTE: CheckBlockHeader is called by CheckBlock
     if (!ContextualCheckBlockHeader(block, state, pindexPrev))
         return false;
-    if (!CheckBlock(block, state, fCheckPOW, fCheckMerkleRoot))
+    if (!CheckBlock(block, state, fCheckPOW, fCheckMerkleRoot, indexDummy.nHeight))
         return false;
     if (!ContextualCheckBlock(block, state, pindexPrev))
         return false;
@@ -4427,8 +5008,12 @@ void PruneOneBlockFile(const int fileNumber)
 
 void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
 {
+    blockFileWriter.Close();
+    undoFileWriter.Close();
     for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        blockFileCache.Erase(GetBlockPosFilename(pos, "blk"));
+        blockFileCache.Erase(GetBlockPosFilename(pos, "rev"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -4447,6 +5032,9 @@ void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight
     }
 
     unsigned int nLastBlockWeCanPrune = chainActive.Tip()->nHeight - MIN_BLOCKS_TO_KEEP;
+    // Blocks not yet processed by the rewards database are read again after a restart.
+    if (prewards)
+        nLastBlockWeCanPrune = std::min<unsigned int>(nLastBlockWeCanPrune, std::max(prewards->GetLastHeight(), 0));
     uint64_t nCurrentUsage = CalculateCurrentUsage();
     // We don't check to prune until after we've allocated new space for files
     // So we should leave a buffer under our target to account for another allocation
@@ -4500,6 +5088,7 @@ FILE* OpenDiskFile(const CDiskBlockPos &pos, const char *prefix, bool fReadOnly)
         return NULL;
     boost::filesystem::path path = GetBlockPosFilename(pos, prefix);
     boost::filesystem::create_directories(path.parent_path());
+    GetBlockFileWriter(prefix).Flush(path);
     FILE* file = fopen(path.string().c_str(), "rb+");
     if (!file && !fReadOnly)
         file = fopen(path.string().c_str(), "wb+");
@@ -4530,7 +5119,7 @@ boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos &pos, const char
     return GetDataDir() / "blocks" / strprintf("%s%05u.dat", prefix, pos.nFile);
 }
 
-CBlockIndex * InsertBlockIndex(uint256 hash)
+CBlockIndex * InsertBlockIndex(const uint256& hash, int nHeight)
 {
     if (hash.IsNull())
         return NULL;
@@ -4541,9 +5130,7 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error(std::string(__func__) + ": new CBlockIndex failed");
+    CBlockIndex* pindexNew = blockIndexStore.Allocate(nHeight);
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
@@ -4558,19 +5145,23 @@ bool static LoadBlockIndexDB()
 
     boost::this_thread::interruption_point();
 
-    // Calculate nChainWork
-    vector<pair<int, CBlockIndex*> > vSortedByHeight;
-    vSortedByHeight.reserve(mapBlockIndex.size());
+    // Calculate nChainWork, parents first. Heights are dense, so the entries
+    // are bucketed by height instead of sorted.
+    int nMaxHeight = 0;
     BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        nMaxHeight = std::max(nMaxHeight, item.second->nHeight);
+    vector<size_t> vHeightStart(nMaxHeight + 2, 0);
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        vHeightStart[item.second->nHeight + 1]++;
+    for (int nHeight = 1; nHeight <= nMaxHeight + 1; nHeight++)
+        vHeightStart[nHeight] += vHeightStart[nHeight - 1];
+    vector<CBlockIndex*> vSortedByHeight(mapBlockIndex.size());
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        vSortedByHeight[vHeightStart[item.second->nHeight]++] = item.second;
+    BOOST_FOREACH(CBlockIndex* pindex, vSortedByHeight)
     {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
-    }
-    sort(vSortedByHeight.begin(), vSortedByHeight.end());
-    BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
-    {
-        CBlockIndex* pindex = item.second;
         pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
+        pindex->BuildVersionCounts();
         // We can link the chain of blocks for which we've received transactions at some point.
         // Pruned nodes may have deleted the block.
         if (pindex->nTx > 0) {
@@ -4644,11 +5235,21 @@ bool static LoadBlockIndexDB()
     pblocktree->ReadFlag("txindex", fTxIndex);
     LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
 
+    // Pick up the statistics of the UTXO set where the last flush left them, an empty
+    // chainstate starts out with empty ones
+    if (pcoinsTip->GetBestBlock().IsNull()) {
+        utxoStats = CUTXOStats();
+        fUTXOStatsValid = true;
+    } else {
+        fUTXOStatsValid = pcoinsdbview->ReadUTXOStats(utxoStats);
+    }
+    LogPrintf("%s: UTXO set statistics %s\n", __func__, fUTXOStatsValid ? "loaded" : "unavailable");
+
     // Load pointer to end of best chain
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
         return true;
-    chainActive.SetTip(it->second);
+    SetChainTip(it->second);
 
     PruneBlockIndexCandidates();
 
@@ -4670,6 +5271,28 @@ CVerifyDB::~CVerifyDB()
     uiInterface.ShowProgress("", 100);
 }
 
+/** Read a block of the active chain and run the checks of levels 0 to 2 on it */
+static bool VerifyBlockData(const CChainParams& chainparams, const CBlockIndex* pindex, int nCheckLevel, CBlock& block)
+{
+    CValidationState state;
+    // check level 0: read from disk
+    if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
+        return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+    // check level 1: verify block validity
+    if (nCheckLevel >= 1 && !CheckBlock(block, state, true, true, pindex->nHeight))
+        return error("VerifyDB(): *** found bad block at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+    // check level 2: verify undo validity
+    if (nCheckLevel >= 2) {
+        CBlockUndo undo;
+        CDiskBlockPos pos = pindex->GetUndoPos();
+        if (!pos.IsNull()) {
+            if (!UndoReadFromDisk(undo, pos, pindex->pprev->GetBlockHash()))
+                return error("VerifyDB(): *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+        }
+    }
+    return true;
+}
+
 bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview, int nCheckLevel, int nCheckDepth)
 {
     LOCK(cs_main);
@@ -4695,21 +5318,8 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         if (pindex->nHeight < chainActive.Height()-nCheckDepth)
             break;
         CBlock block;
-        // check level 0: read from disk
-        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
-            return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-        // check level 1: verify block validity
-        if (nCheckLevel >= 1 && !CheckBlock(block, state))
-            return error("VerifyDB(): *** found bad block at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-        // check level 2: verify undo validity
-        if (nCheckLevel >= 2 && pindex) {
-            CBlockUndo undo;
-            CDiskBlockPos pos = pindex->GetUndoPos();
-            if (!pos.IsNull()) {
-                if (!UndoReadFromDisk(undo, pos, pindex->pprev->GetBlockHash()))
-                    return error("VerifyDB(): *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-            }
-        }
+        if (!VerifyBlockData(chainparams, pindex, nCheckLevel, block))
+            return false;
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
         if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             DisconnectResult res = DisconnectBlock(block, state, pindex, coins);
@@ -4750,6 +5360,129 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
     return true;
 }
 
+/** Times the background verification starts over because new blocks were connected */
+static const int BACKGROUND_VERIFYDB_ATTEMPTS = 10;
+
+enum VerifyDBPass
+{
+    VERIFYDB_PASS_OK,
+    VERIFYDB_PASS_FAILED,
+    VERIFYDB_PASS_TIP_CHANGED
+};
+
+/**
+ * VerifyDB for a running node. cs_main is only held for the steps that need
+ * the coins of the tip, the disconnect of level 3 and the reconnect of level 4,
+ * and the pass is abandoned when the tip moved in between.
+ */
+static VerifyDBPass VerifyDBPassInBackground(const CChainParams& chainparams, int nCheckLevel, int nCheckDepth)
+{
+    CBlockIndex* pindexTip;
+    {
+        LOCK(cs_main);
+        pindexTip = chainActive.Tip();
+    }
+    if (pindexTip == NULL || pindexTip->pprev == NULL)
+        return VERIFYDB_PASS_OK;
+
+    if (nCheckDepth <= 0 || nCheckDepth > pindexTip->nHeight)
+        nCheckDepth = pindexTip->nHeight;
+    LogPrintf("Verifying last %i blocks at level %i in the background\n", nCheckDepth, nCheckLevel);
+    CCoinsViewCache coins(pcoinsTip);
+    CBlockIndex* pindexState = pindexTip;
+    CBlockIndex* pindexFailure = NULL;
+    int nGoodTransactions = 0;
+    int nReportedPercent = 0;
+    CValidationState state;
+    for (CBlockIndex* pindex = pindexTip; pindex && pindex->pprev && pindex->nHeight >= pindexTip->nHeight - nCheckDepth; pindex = pindex->pprev)
+    {
+        boost::this_thread::interruption_point();
+        int nPercent = (pindexTip->nHeight - pindex->nHeight) * (nCheckLevel >= 4 ? 50 : 100) / nCheckDepth;
+        if (nPercent >= nReportedPercent + 10) {
+            nReportedPercent = nPercent - nPercent % 10;
+            LogPrintf("Background block verification %d%% done\n", nReportedPercent);
+        }
+        CBlock block;
+        if (!VerifyBlockData(chainparams, pindex, nCheckLevel, block)) {
+            LOCK(cs_main);
+            // Blocks pruned since the pass started are no sign of corruption
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+                break;
+            return VERIFYDB_PASS_FAILED;
+        }
+        if (nCheckLevel >= 3 && pindex == pindexState) {
+            LOCK(cs_main);
+            if (chainActive.Tip() != pindexTip)
+                return VERIFYDB_PASS_TIP_CHANGED;
+            if (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage() <= nCoinCacheUsage) {
+                DisconnectResult res = DisconnectBlock(block, state, pindex, coins);
+                if (res == DISCONNECT_FAILED) {
+                    error("VerifyDB(): *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+                    return VERIFYDB_PASS_FAILED;
+                }
+                pindexState = pindex->pprev;
+                if (res == DISCONNECT_UNCLEAN) {
+                    nGoodTransactions = 0;
+                    pindexFailure = pindex;
+                } else {
+                    nGoodTransactions += block.vtx.size();
+                }
+            }
+        }
+    }
+    if (pindexFailure) {
+        error("VerifyDB(): *** coin database inconsistencies found (last %i blocks, %i good transactions before that)\n", pindexTip->nHeight - pindexFailure->nHeight + 1, nGoodTransactions);
+        return VERIFYDB_PASS_FAILED;
+    }
+
+    // check level 4: try reconnecting blocks
+    if (nCheckLevel >= 4) {
+        CBlockIndex* pindex = pindexState;
+        while (pindex != pindexTip) {
+            boost::this_thread::interruption_point();
+            pindex = pindexTip->GetAncestor(pindex->nHeight + 1);
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus())) {
+                error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+                return VERIFYDB_PASS_FAILED;
+            }
+            LOCK(cs_main);
+            if (chainActive.Tip() != pindexTip)
+                return VERIFYDB_PASS_TIP_CHANGED;
+            if (!ConnectBlock(block, state, pindex, coins)) {
+                error("VerifyDB(): *** found unconnectable block at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+                return VERIFYDB_PASS_FAILED;
+            }
+        }
+    }
+
+    LogPrintf("No coin database inconsistencies in last %i blocks (%i transactions)\n", pindexTip->nHeight - pindexState->nHeight, nGoodTransactions);
+    return VERIFYDB_PASS_OK;
+}
+
+void ThreadVerifyDB(int nCheckLevel, int nCheckDepth)
+{
+    RenameThread("smartcash-verifydb");
+    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+    const CChainParams& chainparams = Params();
+    nCheckLevel = std::max(0, std::min(4, nCheckLevel));
+
+    for (int nAttempt = 1; nAttempt <= BACKGROUND_VERIFYDB_ATTEMPTS; nAttempt++) {
+        switch (VerifyDBPassInBackground(chainparams, nCheckLevel, nCheckDepth)) {
+        case VERIFYDB_PASS_OK:
+            return;
+        case VERIFYDB_PASS_FAILED:
+            AbortNode("Background block verification found a corrupted block database",
+                      _("Corrupted block database detected. Please restart with -reindex or -reindex-chainstate to recover."));
+            return;
+        case VERIFYDB_PASS_TIP_CHANGED:
+            LogPrintf("Background block verification restarts, the tip changed\n");
+            break;
+        }
+    }
+    LogPrintf("Background block verification given up after %d attempts, the tip kept changing\n", BACKGROUND_VERIFYDB_ATTEMPTS);
+}
+
 // bool RewindBlockIndex(const CChainParams& params)
 // {
 //     LOCK(cs_main);
@@ -4838,7 +5571,7 @@ void UnloadBlockIndex()
 {
     LOCK(cs_main);
     setBlockIndexCandidates.clear();
-    chainActive.SetTip(NULL);
+    SetChainTip(NULL);
     pindexBestInvalid = NULL;
     pindexBestHeader = NULL;
     mempool.clear();
@@ -4852,11 +5585,13 @@ void UnloadBlockIndex()
     for (int b = 0; b < VERSIONBITS_NUM_BITS; b++) {
         warningcache[b].clear();
     }
+    BlockSizeCalculator::Clear();
+    recentTxCache.Clear();
+    utxoStats = CUTXOStats();
+    fUTXOStatsValid = true;
 
-    BOOST_FOREACH(BlockMap::value_type& entry, mapBlockIndex) {
-        delete entry.second;
-    }
     mapBlockIndex.clear();
+    blockIndexStore.Clear();
     fHavePruned = false;
 }
 
@@ -4920,21 +5655,78 @@ bool InitBlockIndex(const CChainParams& chainparams)
     return true;
 }
 
-bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
+/** Block records of an external file read and checked ahead of the one being accepted */
+static const unsigned int MAX_IMPORT_BLOCKS_AHEAD = 64;
+/** Heights of the most recently read blocks, kept to know the height of their successors */
+static const unsigned int MAX_IMPORT_HEIGHTS = 1024;
+
+/** A block record of an external block file on its way through the import */
+struct CImportBlock
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
-    int64_t nStart = GetTimeMillis();
+    uint64_t nPos;      //!< Position of the serialized block in the file
+    int nHeight;        //!< Height from the blocks before it, -1 if the parent isn't known yet
+    CDataStream ssData; //!< The serialized block, until it got deserialized
+    CBlock block;
+    bool fDone;         //!< Deserialized, and checked if the height is known
+    std::string strError;
 
-    int nLoaded = 0;
-    try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        unsigned int blocksize = maxBlockSize;
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
-            boost::this_thread::interruption_point();
+    CImportBlock(uint64_t nPosIn, int nHeightIn) : nPos(nPosIn), nHeight(nHeightIn), ssData(SER_DISK, CLIENT_VERSION), fDone(false) {}
+};
+
+/**
+ * Import of an external block file in three stages: a reader thread locates the block records
+ * and slices them off, a pool of threads deserializes them and runs CheckBlock, and the thread
+ * calling Next() gets them back in file order to accept them.
+ */
+class CBlockFileImport
+{
+private:
+    const CChainParams& chainparams;
+    CBufferedFile blkdat;
+
+    boost::mutex mutex;
+    boost::condition_variable condReader;
+    boost::condition_variable condWorker;
+    boost::condition_variable condAccept;
+    //! Blocks in file order, the ones before nNextCheck are deserialized or being deserialized
+    std::deque<std::shared_ptr<CImportBlock> > queue;
+    size_t nNextCheck;
+    bool fReadDone;
+    std::atomic<bool> fStop;
+    std::string strAbort;
+    boost::thread_group threads;
+
+    // Only used by the reader thread
+    std::map<uint256, int> mapHeights;
+    std::deque<uint256> queueHeights;
+
+    int GetHeight(const CBlockHeader& header, const uint256& hash)
+    {
+        if (hash == chainparams.GetConsensus().hashGenesisBlock)
+            return 0;
+        std::map<uint256, int>::const_iterator it = mapHeights.find(header.hashPrevBlock);
+        if (it != mapHeights.end())
+            return it->second + 1;
+        LOCK(cs_main);
+        BlockMap::const_iterator mi = mapBlockIndex.find(header.hashPrevBlock);
+        return mi != mapBlockIndex.end() ? mi->second->nHeight + 1 : -1;
+    }
+
+    void AddHeight(const uint256& hash, int nHeight)
+    {
+        if (!mapHeights.insert(std::make_pair(hash, nHeight)).second)
+            return;
+        queueHeights.push_back(hash);
+        if (queueHeights.size() > MAX_IMPORT_HEIGHTS) {
+            mapHeights.erase(queueHeights.front());
+            queueHeights.pop_front();
+        }
+    }
 
+    std::shared_ptr<CImportBlock> ReadBlock()
+    {
+        uint64_t nRewind = blkdat.GetPos();
+        while (!blkdat.eof() && !fStop) {
             blkdat.SetPos(nRewind);
             nRewind++; // start one byte further next time, in case of failure
             blkdat.SetLimit(); // remove former limit
@@ -4956,15 +5748,151 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                 break;
             }
             try {
-                // read block
+                // slice off the block, its header tells where it belongs
                 uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
                 blkdat.SetLimit(nBlockPos + nSize);
+                CBlockHeader header;
+                blkdat >> header;
                 blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
+                uint256 hash = header.GetHash();
+                int nHeight = GetHeight(header, hash);
+                std::shared_ptr<CImportBlock> pblock = std::make_shared<CImportBlock>(nBlockPos, nHeight);
+                pblock->ssData.resize(nSize);
+                blkdat.read(&pblock->ssData[0], nSize);
+                if (nHeight >= 0)
+                    AddHeight(hash, nHeight);
+                return pblock;
+            } catch (const std::exception& e) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+            }
+        }
+        return std::shared_ptr<CImportBlock>();
+    }
+
+    void ThreadRead()
+    {
+        RenameThread("smartcash-impread");
+        try {
+            while (true) {
+                std::shared_ptr<CImportBlock> pblock = ReadBlock();
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fStop && queue.size() >= MAX_IMPORT_BLOCKS_AHEAD)
+                    condReader.wait(lock);
+                if (fStop || !pblock)
+                    break;
+                queue.push_back(pblock);
+                condWorker.notify_one();
+            }
+        } catch (const std::runtime_error& e) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            strAbort = e.what();
+        }
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fReadDone = true;
+        condAccept.notify_all();
+    }
+
+    void ThreadCheck()
+    {
+        RenameThread("smartcash-impcheck");
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (true) {
+            while (!fStop && nNextCheck == queue.size())
+                condWorker.wait(lock);
+            if (fStop)
+                return;
+            std::shared_ptr<CImportBlock> pblock = queue[nNextCheck++];
+            lock.unlock();
+
+            try {
+                pblock->ssData >> pblock->block;
+                // The block is known to be checked for its height when it gets accepted, blocks
+                // failing the checks are left to AcceptBlock to find and report
+                if (pblock->nHeight >= 0) {
+                    CValidationState state;
+                    CheckBlock(pblock->block, state, true, true, pblock->nHeight);
+                }
+            } catch (const std::exception& e) {
+                pblock->strError = e.what();
+            }
+            pblock->ssData = CDataStream(SER_DISK, CLIENT_VERSION);
+
+            lock.lock();
+            pblock->fDone = true;
+            condAccept.notify_one();
+        }
+    }
+
+public:
+    CBlockFileImport(const CChainParams& chainparamsIn, FILE* fileIn) :
+        chainparams(chainparamsIn),
+        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
+        blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION),
+        nNextCheck(0), fReadDone(false), fStop(false)
+    {
+        threads.create_thread(boost::bind(&CBlockFileImport::ThreadRead, this));
+        for (int i = 0; i < std::max(GetNumCores(), 1); i++)
+            threads.create_thread(boost::bind(&CBlockFileImport::ThreadCheck, this));
+    }
+
+    ~CBlockFileImport()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+        }
+        condReader.notify_all();
+        condWorker.notify_all();
+        threads.join_all();
+    }
+
+    //! The next block of the file, null at the end. Interruptible.
+    std::shared_ptr<CImportBlock> Next()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!(!queue.empty() && queue.front()->fDone) && !(fReadDone && queue.empty()))
+            condAccept.wait(lock);
+        if (queue.empty())
+            return std::shared_ptr<CImportBlock>();
+        std::shared_ptr<CImportBlock> pblock = queue.front();
+        queue.pop_front();
+        nNextCheck--;
+        condReader.notify_one();
+        return pblock;
+    }
+
+    //! Error that stopped the reader, empty if it read to the end of the file
+    std::string GetAbortReason()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return strAbort;
+    }
+};
+
+bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
+{
+    // Map of disk positions for blocks with unknown parent (only used for reindex)
+    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+    int64_t nStart = GetTimeMillis();
+
+    int nLoaded = 0;
+    std::string strAbort;
+    {
+        CBlockFileImport import(chainparams, fileIn);
+        while (true) {
+            boost::this_thread::interruption_point();
+
+            std::shared_ptr<CImportBlock> pimport = import.Next();
+            if (!pimport)
+                break;
+            if (!pimport->strError.empty()) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, pimport->strError);
+                continue;
+            }
+            try {
+                CBlock& block = pimport->block;
+                if (dbp)
+                    dbp->nPos = pimport->nPos;
 
                 // detect out of order blocks, and store them for later
                 uint256 hash = block.GetHash();
@@ -5028,9 +5956,10 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                 LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
             }
         }
-    } catch (const std::runtime_error& e) {
-        AbortNode(std::string("System error: ") + e.what());
+        strAbort = import.GetAbortReason();
     }
+    if (!strAbort.empty())
+        AbortNode(std::string("System error: ") + strAbort);
     if (nLoaded > 0)
         LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
     return nLoaded > 0;
@@ -7364,6 +8293,134 @@ ThresholdState VersionBitsTipState(const Consensus::Params& params, Consensus::D
     return VersionBitsState(chainActive.Tip(), params, pos, versionbitscache);
 }
 
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+
+bool LoadMempool()
+{
+    int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    FILE* filestr = fopen((GetDataDir() / "mempool.dat").string().c_str(), "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    int64_t nStart = GetTimeMillis();
+    int64_t count = 0;
+    int64_t skipped = 0;
+    int64_t failed = 0;
+    int64_t nNow = GetTime();
+
+    try {
+        uint64_t version;
+        file >> version;
+        if (version != MEMPOOL_DUMP_VERSION) {
+            return false;
+        }
+
+        // The deltas go in first, so the transactions they belong to are
+        // accepted with their modified fees.
+        std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+        file >> mapDeltas;
+        for (std::map<uint256, std::pair<double, CAmount> >::const_iterator it = mapDeltas.begin(); it != mapDeltas.end(); ++it) {
+            mempool.PrioritiseTransaction(it->first, it->first.ToString(), it->second.first, it->second.second);
+        }
+
+        uint64_t num;
+        file >> num;
+        std::vector<std::pair<CTransaction, int64_t> > vBatch;
+        while (num) {
+            // Read a batch outside of cs_main, then accept it under one lock,
+            // so block processing and peers are not held up for the whole file.
+            vBatch.clear();
+            while (num && vBatch.size() < MEMPOOL_LOAD_BATCH_SIZE) {
+                vBatch.push_back(std::make_pair(CTransaction(), 0));
+                file >> vBatch.back().first;
+                file >> vBatch.back().second;
+                --num;
+            }
+
+            LOCK(cs_main);
+            for (size_t i = 0; i < vBatch.size(); i++) {
+                const CTransaction& tx = vBatch[i].first;
+                int64_t nTime = vBatch[i].second;
+                if (nTime + nExpiryTimeout > nNow) {
+                    CValidationState state;
+                    if (AcceptToMemoryPoolWithTime(mempool, state, tx, true, NULL, nTime))
+                        ++count;
+                    else
+                        ++failed;
+                } else {
+                    ++skipped;
+                }
+            }
+            if (ShutdownRequested())
+                return false;
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired (%dms)\n", count, failed, skipped, GetTimeMillis() - nStart);
+    return true;
+}
+
+bool DumpMempool()
+{
+    int64_t nStart = GetTimeMicros();
+
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    std::vector<const CTxMemPoolEntry*> vEntries;
+    std::vector<std::pair<CTransaction, int64_t> > vInfo;
+    {
+        LOCK(mempool.cs);
+        mapDeltas = mempool.mapDeltas;
+        vEntries.reserve(mempool.mapTx.size());
+        BOOST_FOREACH(const CTxMemPoolEntry& entry, mempool.mapTx) {
+            vEntries.push_back(&entry);
+        }
+        // A transaction always has more in-mempool ancestors than any of
+        // its parents, so this order lets every parent load before its children.
+        std::stable_sort(vEntries.begin(), vEntries.end(), [](const CTxMemPoolEntry* a, const CTxMemPoolEntry* b) {
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        });
+        vInfo.reserve(vEntries.size());
+        BOOST_FOREACH(const CTxMemPoolEntry* entry, vEntries) {
+            vInfo.push_back(std::make_pair(entry->GetTx(), entry->GetTime()));
+        }
+    }
+
+    int64_t nMid = GetTimeMicros();
+
+    try {
+        FILE* filestr = fopen((GetDataDir() / "mempool.dat.new").string().c_str(), "wb");
+        if (!filestr) {
+            return false;
+        }
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+        uint64_t version = MEMPOOL_DUMP_VERSION;
+        file << version;
+        file << mapDeltas;
+        file << (uint64_t)vInfo.size();
+        for (size_t i = 0; i < vInfo.size(); i++) {
+            file << vInfo[i].first;
+            file << vInfo[i].second;
+        }
+        FileCommit(file.Get());
+        file.fclose();
+        RenameOver(GetDataDir() / "mempool.dat.new", GetDataDir() / "mempool.dat");
+        int64_t nLast = GetTimeMicros();
+        LogPrintf("Dumped mempool: %gs to copy, %gs to dump\n", (nMid-nStart)*0.000001, (nLast-nMid)*0.000001);
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump mempool: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+    return true;
+}
+
 class CMainCleanup
 {
 public:
@@ -24,6 +24,7 @@
 #include <algorithm>
 #include <exception>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -34,7 +35,9 @@
 #include <boost/filesystem/path.hpp>
 
 class CBlockIndex;
+class CBlockUndo;
 class CBlockTreeDB;
+class CIndexDB;
 class CBloomFilter;
 class CChainParams;
 class CCoinsViewDB;
@@ -42,6 +45,7 @@ class CInv;
 class CConnman;
 class CScriptCheck;
 class CTxMemPool;
+class CUTXOStats;
 class CValidationInterface;
 class CValidationState;
 
@@ -66,6 +70,8 @@ static const CAmount HIGH_TX_FEE_PER_KB = .01 * CENT;
 static const CAmount HIGH_MAX_TX_FEE = 1000 * DEFAULT_MIN_RELAY_TX_FEE;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+/** Default for -maxorphantxsize, maximum size of the orphan transactions kept in memory in kilobytes */
+static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS_SIZE = 500;
 /** Expiration time for orphan transactions in seconds */
 static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
 /** Minimum time between orphan transactions expire time checks in seconds */
@@ -80,6 +86,12 @@ static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
 static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
 /** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
 static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Granularity in seconds of mempool expiry; transactions may outlive -mempoolexpiry by up to this much */
+static const int64_t MEMPOOL_EXPIRY_BUCKET = 10 * 60;
+/** Default for -persistmempool */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Number of saved mempool transactions accepted per cs_main lock while loading */
+static const unsigned int MEMPOOL_LOAD_BATCH_SIZE = 100;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
@@ -92,8 +104,26 @@ static const int64_t DUST_HARD_LIMIT = 1000;   // 0.00001 SMART mininput
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
-/** Number of blocks that can be requested at any given time from a single peer. */
+/** Number of script checks of a block collected before they are handed to the script-checking threads */
+static const unsigned int SCRIPTCHECK_BLOCK_BATCH = 32;
+/** Mempool transactions with at least this many inputs get their scripts checked by the script-checking threads */
+static const unsigned int MEMPOOL_SCRIPTCHECK_PARALLEL_INPUTS = 16;
+/** Number of transactions of a block CheckBlock checks per task when checking them in parallel */
+static const unsigned int BLOCK_TXCHECK_CHUNK = 32;
+/** Number of threads reading the coins spent by received blocks from the coin database ahead of ConnectBlock */
+static const int COINS_PREFETCH_THREADS = 4;
+/** Number of prevouts a prefetch thread reads per task */
+static const unsigned int COINS_PREFETCH_BATCH = 128;
+/** Maximum number of prefetch tasks waiting for a thread, later ones are dropped */
+static const size_t MAX_COINS_PREFETCH_QUEUE = 4096;
+/** Number of blocks that can be requested at any given time from a single peer we have no
+ *  download history of yet. Afterwards the limit adapts to how fast the peer delivers blocks. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Bounds of the adaptive number of blocks in transit per peer. */
+static const int MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 4;
+static const int MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 32;
+/** Time in seconds worth of blocks we try to keep in transit from a peer, given its average block delivery time. */
+static const unsigned int BLOCK_DOWNLOAD_TARGET_TIME = 4;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
@@ -107,12 +137,15 @@ static const int MAX_BLOCKTXN_DEPTH = 10;
 /** Size of the "block download window": how far ahead of our current height do we fetch?
  *  Larger windows tolerate larger download speed differences between peer, but increase the potential
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
- *  harder). We'll probably want to make this a per-peer adaptive value at some point. */
+ *  harder). This is the window of a peer at MAX_BLOCKS_IN_TRANSIT_PER_PEER, the window of each peer
+ *  scales with its adaptive number of blocks in transit. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
 /** Time to wait (in seconds) between writing blocks/block index to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
 static const unsigned int DATABASE_FLUSH_INTERVAL = 24 * 60 * 60;
+/** Default for -dbsyncinterval, minutes between writing the changes of the coins cache without dropping it. */
+static const int64_t DEFAULT_DB_SYNC_INTERVAL = 15;
 /** Maximum length of reject messages. */
 static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 /** Average delay between local address broadcasts in seconds. */
@@ -169,9 +202,19 @@ static const bool DEFAULT_PEERBLOOMFILTERS = true;
 
 static const int64_t nStartRewardTime = 1499789471; // 07/11/2017 @ 11:11am (CST)
 
-struct BlockHasher
+/** Salted like SaltedTxidHasher, so peers can't pick block hashes that pile up in one bucket */
+class BlockHasher
 {
-    size_t operator()(const uint256& hash) const { return hash.GetCheapHash(); }
+private:
+    /** Salt */
+    const uint64_t k0, k1;
+
+public:
+    BlockHasher();
+
+    size_t operator()(const uint256& hash) const {
+        return SipHashUint256(k0, k1, hash);
+    }
 };
 
 extern CScript COINBASE_FLAGS;
@@ -195,6 +238,8 @@ extern unsigned int nBytesPerSigOp;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
 extern size_t nCoinCacheUsage;
+/** Seconds between writing the changes of the coins cache outside of initial block download, 0 to not do so */
+extern int64_t nCoinsSyncInterval;
 extern int64_t nMinimumInputValue;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
 extern CFeeRate minRelayTxFee;
@@ -226,6 +271,7 @@ static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
 
 static const signed int DEFAULT_CHECKBLOCKS = 6;
 static const unsigned int DEFAULT_CHECKLEVEL = 3;
+static const bool DEFAULT_CHECKBLOCKS_BACKGROUND = false;
 
 static const int SYNC_TRANSACTION_NOT_IN_BLOCK = -1;
 
@@ -285,6 +331,10 @@ bool LoadBlockIndex();
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the thread checking the transactions of blocks in CheckBlock */
+void ThreadBlockTxCheck();
+/** Run an instance of the thread reading the coins of received blocks ahead of their connection */
+void ThreadCoinsPrefetch();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core.
@@ -322,8 +372,8 @@ void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight
  */
 void UnlinkPrunedFiles(std::set<int>& setFilesToPrune);
 
-/** Create a new block index entry for a given block hash */
-CBlockIndex * InsertBlockIndex(uint256 hash);
+/** Create a new block index entry for a given block hash, to be at nHeight, or return the existing one */
+CBlockIndex * InsertBlockIndex(const uint256& hash, int nHeight);
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 /** Increase a node's misbehavior score. */
@@ -332,13 +382,81 @@ void Misbehaving(NodeId nodeid, int howmuch);
 void FlushStateToDisk();
 /** Prune block files and flush state to disk. */
 void PruneAndFlush();
+/** Copy the running statistics of the UTXO set at the tip, false if they are not known. */
+bool GetTipUTXOStats(CUTXOStats &stats);
+/** Take over statistics computed by scanning the UTXO set, if the tip is still at their block. */
+void SetTipUTXOStats(const CUTXOStats &stats);
 
 int64_t GetBlockValue(int nHeight, int64_t nFees, unsigned int nTime);
+/** Sum of GetBlockValue without fees over all heights from nStartHeight up to and including nEndHeight. */
+int64_t GetBlockValueRange(int nStartHeight, int nEndHeight);
+
+/** Expire transactions older than age seconds and trim the pool to limit bytes, uncaching the coins only they spent */
+void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age);
 
 /** (try to) add transaction to memory pool **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fOverrideMempoolLimit=false, bool fRejectAbsurdFee=false, bool fDryRun=false);
 
+/** (try to) add transaction to memory pool with a specified acceptance time **/
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                                bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit=false,
+                                bool fRejectAbsurdFee=false, bool fDryRun=false);
+
+/** Add a batch of transactions to the memory pool under one lock, parents within the batch ahead of
+ *  their children. With script-checking threads the signatures of the batch get verified in parallel
+ *  first. The result of each transaction is returned at its index in vtx; returns the number accepted. */
+unsigned int AcceptToMemoryPoolBatch(CTxMemPool& pool, const std::vector<CTransaction>& vtx, std::vector<CValidationState>& vStates,
+                                     std::vector<bool>& vfAccepted, std::vector<bool>& vfMissingInputs, bool fRejectAbsurdFee=false);
+
+/** Stages of AcceptToMemoryPoolWorker, timed for getmempoolstats */
+enum MempoolAcceptStage {
+    MEMPOOL_STAGE_PRECHECKS,    //!< context free checks, finality and standardness
+    MEMPOOL_STAGE_INSTANTSEND,  //!< lock request validity and conflicts with completed locks
+    MEMPOOL_STAGE_CONFLICTS,    //!< conflicts with mempool transactions
+    MEMPOOL_STAGE_COINS,        //!< coin lookups and sequence locks
+    MEMPOOL_STAGE_POLICY,       //!< input standardness, sigops, fees and free relay limits
+    MEMPOOL_STAGE_ANCESTORS,    //!< CalculateMemPoolAncestors
+    MEMPOOL_STAGE_REPLACEMENT,  //!< fee checks against replaced transactions
+    MEMPOOL_STAGE_SCRIPTS,      //!< script verification
+    MEMPOOL_STAGE_INSERT,       //!< removing replaced transactions and adding the entry
+    MEMPOOL_STAGE_INDEX,        //!< address and spent index
+    MEMPOOL_STAGE_TRIM,         //!< LimitMempoolSize
+    MEMPOOL_STAGE_NOTIFY,       //!< SyncTransaction callbacks
+    MEMPOOL_STAGE_COUNT
+};
+
+/** Number of histogram buckets of CMempoolStageStats: bucket i counts durations below 2^i microseconds,
+ *  the last one everything longer */
+static const int MEMPOOL_STATS_BUCKETS = 24;
+
+/** Cumulative timings of a stage of AcceptToMemoryPoolWorker */
+struct CMempoolStageStats
+{
+    uint64_t nCount;
+    int64_t nTotalMicros;
+    int64_t nMaxMicros;
+    uint64_t vHistogram[MEMPOOL_STATS_BUCKETS];
+
+    CMempoolStageStats() { SetNull(); }
+    void SetNull();
+    void Add(int64_t nMicros);
+};
+
+/** Name of a MempoolAcceptStage as shown by getmempoolstats */
+const char* GetMempoolAcceptStageName(int nStage);
+
+/** Get the timings of every stage of AcceptToMemoryPoolWorker as well as of the whole calls, and the
+ *  number of transactions accepted and rejected since startup or the last reset */
+void GetMempoolAcceptStats(std::vector<CMempoolStageStats>& vStages, CMempoolStageStats& total,
+                           uint64_t& nAccepted, uint64_t& nRejected, bool fReset=false);
+
+/** Dump the mempool to mempool.dat in the data directory */
+bool DumpMempool();
+
+/** Load the mempool from mempool.dat, returns false if it could not be read completely */
+bool LoadMempool();
+
 bool GetUTXOCoin(const COutPoint& outpoint, Coin& coin);
 int GetUTXOHeight(const COutPoint& outpoint);
 int GetUTXOConfirmations(const COutPoint& outpoint);
@@ -379,15 +497,32 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& ma
 /**
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set. If pvChecks is not NULL, script checks are pushed onto it
- * instead of being performed inline.
+ * instead of being performed inline. Transactions whose scripts passed with the same flags
+ * before are looked up in the script execution cache and not executed again.
  */
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, bool fScriptChecks,
                  unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks = NULL);
 
+/** Initializes the script-execution cache */
+void InitScriptExecutionCache();
+
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCache &inputs, int nHeight);
 
+/** What CheckTransaction needs to know about the block a transaction is in, resolved once per block */
+struct CTxCheckContext
+{
+    int nHeight;
+    //! zerocoin mints and spends are rejected above HF_ZEROCOIN_DISABLE
+    bool fZerocoinDisabled;
+    //! scratch space for the duplicate input check, reused between transactions
+    std::vector<COutPoint> vInputs;
+
+    explicit CTxCheckContext(int nHeightIn);
+};
+
 /** Context-independent validity checks */
+bool CheckTransaction(const CTransaction& tx, CValidationState& state, uint256 hashTx, bool isVerifyDB, CTxCheckContext& context);
 bool CheckTransaction(const CTransaction& tx, CValidationState& state, uint256 hashTx, bool isVerifyDB, int nHeight = INT_MAX);
 
 /**
@@ -475,22 +610,33 @@ public:
 
 bool GetTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &hashes);
 bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
+/** See CIndexDB::ReadAddressIndex and CIndexDB::ReadAddressUnspentIndex for reading page by page. */
 bool GetAddressIndex(uint160 addressHash, int type,
                      std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
-                     int start = 0, int end = 0);
+                     int start = 0, int end = 0,
+                     size_t nLimit = 0, const CAddressIndexKey *pkeyAfter = NULL);
 bool GetAddressUnspent(uint160 addressHash, int type,
-                       std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs);
+                       std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs,
+                       size_t nLimit = 0, const CAddressUnspentKey *pkeyAfter = NULL);
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
+/** Read the block at pindex, its header is checked against the hash in the index only */
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Read the serialized block at pindex as stored on disk, for passing it on without deserializing it.
+ *  The block is appended to vchBlock, so it can go right behind the header of a network message. */
+bool ReadRawBlockFromDisk(CSerializeData& vchBlock, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart);
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock);
+/** Record the serialized size of a block in its index entry and schedule it to be written to the block tree db */
+void SetBlockIndexSize(CBlockIndex* pindex, unsigned int nSize);
 
 /** Functions for validating blocks and updating the block tree */
 
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
-bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
+/** nHeight is the height of the block if the caller knows it, otherwise it is looked up from the previous block */
+bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true, int nHeight = -1);
 
 /** Context-dependent validity checks */
 bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex *pindexPrev);
@@ -527,6 +673,9 @@ public:
     bool VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview, int nCheckLevel, int nCheckDepth);
 };
 
+/** Run the checks of VerifyDB on the running node, shutting it down if the block database is corrupted */
+void ThreadVerifyDB(int nCheckLevel, int nCheckDepth);
+
 /** Find the last common block between the parameter chain and a locator. */
 CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& locator);
 
@@ -542,6 +691,24 @@ bool ResetBlockFailureFlags(CBlockIndex *pindex);
 /** The currently-connected chain of blocks (protected by cs_main). */
 extern CChain chainActive;
 
+/** The tip of chainActive as of its last change. Snapshots are immutable and replaced as a
+ *  whole, so queries that only need the tip don't have to wait for cs_main. */
+struct CChainTipSnapshot
+{
+    //! Block indexes are never freed, but the tip may have moved on by the time this is used
+    const CBlockIndex* pindex;
+    int nHeight;
+    uint256 hashBlock;
+    int64_t nTime;
+    int64_t nMedianTimePast;
+    uint32_t nBits;
+
+    explicit CChainTipSnapshot(const CBlockIndex* pindexIn);
+};
+
+/** The latest tip snapshot, NULL while there is no chain */
+std::shared_ptr<const CChainTipSnapshot> GetChainTipSnapshot();
+
 /** Global variable that points to the coins database (protected by cs_main) */
 extern CCoinsViewDB *pcoinsdbview;
 
@@ -551,6 +718,9 @@ extern CCoinsViewCache *pcoinsTip;
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
+/** Global variable that points to the address, spent and timestamp indexes */
+extern CIndexDB *pindexdb;
+
 /**
  * Return the spend height, which is one more than the inputs.GetBestBlock().
  * While checking, GetBestBlock() refers to the parent block. (protected by cs_main)
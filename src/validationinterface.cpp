@@ -5,6 +5,15 @@
 
 #include "validationinterface.h"
 
+#include "primitives/block.h"
+#include "util.h"
+
+#include <deque>
+#include <memory>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
 static CMainSignals g_signals;
 
 CMainSignals& GetMainSignals()
@@ -12,12 +21,177 @@ CMainSignals& GetMainSignals()
     return g_signals;
 }
 
+static boost::mutex csSignalsQueue;
+static boost::condition_variable condSignalsQueue;
+static std::deque<std::function<void()>> queueSignals;
+static std::unique_ptr<boost::thread> pthreadSignals;
+static boost::thread::id idThreadSignals;
+static bool fSignalsQueueRunning = false;
+static bool fSignalsQueueStopping = false;
+static bool fSignalsQueueBusy = false;
+
+static void ThreadValidationSignals()
+{
+    RenameThread("smartcash-signals");
+
+    while (true) {
+        std::function<void()> func;
+
+        {
+            boost::unique_lock<boost::mutex> lock(csSignalsQueue);
+
+            while (queueSignals.empty() && !fSignalsQueueStopping) condSignalsQueue.wait(lock);
+
+            // Stopping only ends the thread once everything queued was fired.
+            if (queueSignals.empty())
+                break;
+
+            func = std::move(queueSignals.front());
+            queueSignals.pop_front();
+            fSignalsQueueBusy = true;
+        }
+
+        try {
+            func();
+        } catch (const std::exception& e) {
+            PrintExceptionContinue(&e, "ThreadValidationSignals()");
+        } catch (...) {
+            PrintExceptionContinue(NULL, "ThreadValidationSignals()");
+        }
+
+        {
+            boost::unique_lock<boost::mutex> lock(csSignalsQueue);
+            fSignalsQueueBusy = false;
+        }
+
+        condSignalsQueue.notify_all();
+    }
+}
+
+void StartValidationInterfaceQueue()
+{
+    boost::unique_lock<boost::mutex> lock(csSignalsQueue);
+
+    if (fSignalsQueueRunning)
+        return;
+
+    fSignalsQueueRunning = true;
+    fSignalsQueueStopping = false;
+    pthreadSignals.reset(new boost::thread(&ThreadValidationSignals));
+    idThreadSignals = pthreadSignals->get_id();
+}
+
+void StopValidationInterfaceQueue()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(csSignalsQueue);
+
+        if (!fSignalsQueueRunning)
+            return;
+
+        fSignalsQueueStopping = true;
+    }
+
+    condSignalsQueue.notify_all();
+    pthreadSignals->join();
+
+    boost::unique_lock<boost::mutex> lock(csSignalsQueue);
+    pthreadSignals.reset();
+    idThreadSignals = boost::thread::id();
+    fSignalsQueueRunning = false;
+}
+
+void SyncWithValidationInterfaceQueue()
+{
+    boost::unique_lock<boost::mutex> lock(csSignalsQueue);
+
+    // A listener waiting for itself would never return.
+    if (boost::this_thread::get_id() == idThreadSignals)
+        return;
+
+    while (!queueSignals.empty() || fSignalsQueueBusy) condSignalsQueue.wait(lock);
+}
+
+void LimitValidationInterfaceQueue()
+{
+    boost::unique_lock<boost::mutex> lock(csSignalsQueue);
+
+    if (boost::this_thread::get_id() == idThreadSignals)
+        return;
+
+    while (queueSignals.size() >= MAX_QUEUED_VALIDATION_SIGNALS) condSignalsQueue.wait(lock);
+}
+
+// Queue func if the queue is running, returns false if the caller has to fire the signal itself.
+static bool QueueSignal(std::function<void()> func)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(csSignalsQueue);
+
+        if (!fSignalsQueueRunning || fSignalsQueueStopping)
+            return false;
+
+        queueSignals.push_back(std::move(func));
+    }
+
+    condSignalsQueue.notify_all();
+    return true;
+}
+
+static bool IsSignalsQueueRunning()
+{
+    boost::unique_lock<boost::mutex> lock(csSignalsQueue);
+    return fSignalsQueueRunning && !fSignalsQueueStopping;
+}
+
+void CMainSignals::QueueUpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+{
+    // Block index entries are never deleted, the pointers stay valid.
+    if (!QueueSignal([this, pindexNew, pindexFork, fInitialDownload] { UpdatedBlockTip(pindexNew, pindexFork, fInitialDownload); }))
+        UpdatedBlockTip(pindexNew, pindexFork, fInitialDownload);
+}
+
+void CMainSignals::QueueBlockConnected(const CBlock &block, const CBlockIndex *pindex)
+{
+    if (IsSignalsQueueRunning()) {
+        std::shared_ptr<const CBlock> pblock = std::make_shared<const CBlock>(block);
+        bool fQueued = QueueSignal([this, pblock, pindex] {
+            BlockConnected(*pblock, pindex);
+            for (const CTransaction &tx : pblock->vtx)
+                SyncTransaction(tx, pblock.get());
+        });
+        if (fQueued)
+            return;
+    }
+
+    BlockConnected(block, pindex);
+    for (const CTransaction &tx : block.vtx)
+        SyncTransaction(tx, &block);
+}
+
+void CMainSignals::QueueSyncTransaction(const CTransaction &tx, const CBlock *pblock)
+{
+    if (IsSignalsQueueRunning()) {
+        // The transactions of a block are queued with it by QueueBlockConnected.
+        std::shared_ptr<const CBlock> pblockCopy = pblock ? std::make_shared<const CBlock>(*pblock) : nullptr;
+        CTransactionRef ptx = MakeTransactionRef(tx);
+        if (QueueSignal([this, ptx, pblockCopy] { SyncTransaction(*ptx, pblockCopy.get()); }))
+            return;
+    }
+
+    SyncTransaction(tx, pblock);
+}
+
 void RegisterValidationInterface(CValidationInterface* pwalletIn) {
     g_signals.AcceptedBlockHeader.connect(boost::bind(&CValidationInterface::AcceptedBlockHeader, pwalletIn, _1));
     g_signals.NotifyHeaderTip.connect(boost::bind(&CValidationInterface::NotifyHeaderTip, pwalletIn, _1, _2));
     g_signals.UpdatedBlockTip.connect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1, _2, _3));
+    g_signals.BlockConnected.connect(boost::bind(&CValidationInterface::BlockConnected, pwalletIn, _1, _2));
     g_signals.SyncTransaction.connect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2));
     g_signals.NotifyTransactionLock.connect(boost::bind(&CValidationInterface::NotifyTransactionLock, pwalletIn, _1));
+    g_signals.NotifySmartnodeListChanged.connect(boost::bind(&CValidationInterface::NotifySmartnodeListChanged, pwalletIn, _1, _2));
+    g_signals.NotifyRewardsRoundFinalized.connect(boost::bind(&CValidationInterface::NotifyRewardsRoundFinalized, pwalletIn, _1));
+    g_signals.NotifySporkChanged.connect(boost::bind(&CValidationInterface::NotifySporkChanged, pwalletIn, _1));
     g_signals.UpdatedTransaction.connect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
     g_signals.SetBestChain.connect(boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
     g_signals.Inventory.connect(boost::bind(&CValidationInterface::Inventory, pwalletIn, _1));
@@ -35,8 +209,12 @@ void UnregisterValidationInterface(CValidationInterface* pwalletIn) {
     g_signals.Inventory.disconnect(boost::bind(&CValidationInterface::Inventory, pwalletIn, _1));
     g_signals.SetBestChain.disconnect(boost::bind(&CValidationInterface::SetBestChain, pwalletIn, _1));
     g_signals.UpdatedTransaction.disconnect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
+    g_signals.NotifySporkChanged.disconnect(boost::bind(&CValidationInterface::NotifySporkChanged, pwalletIn, _1));
+    g_signals.NotifyRewardsRoundFinalized.disconnect(boost::bind(&CValidationInterface::NotifyRewardsRoundFinalized, pwalletIn, _1));
+    g_signals.NotifySmartnodeListChanged.disconnect(boost::bind(&CValidationInterface::NotifySmartnodeListChanged, pwalletIn, _1, _2));
     g_signals.NotifyTransactionLock.disconnect(boost::bind(&CValidationInterface::NotifyTransactionLock, pwalletIn, _1));
     g_signals.SyncTransaction.disconnect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2));
+    g_signals.BlockConnected.disconnect(boost::bind(&CValidationInterface::BlockConnected, pwalletIn, _1, _2));
     g_signals.UpdatedBlockTip.disconnect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1, _2, _3));
     g_signals.NotifyHeaderTip.disconnect(boost::bind(&CValidationInterface::NotifyHeaderTip, pwalletIn, _1, _2));
     g_signals.AcceptedBlockHeader.disconnect(boost::bind(&CValidationInterface::AcceptedBlockHeader, pwalletIn, _1));
@@ -50,8 +228,12 @@ void UnregisterAllValidationInterfaces() {
     g_signals.Inventory.disconnect_all_slots();
     g_signals.SetBestChain.disconnect_all_slots();
     g_signals.UpdatedTransaction.disconnect_all_slots();
+    g_signals.NotifySporkChanged.disconnect_all_slots();
+    g_signals.NotifyRewardsRoundFinalized.disconnect_all_slots();
+    g_signals.NotifySmartnodeListChanged.disconnect_all_slots();
     g_signals.NotifyTransactionLock.disconnect_all_slots();
     g_signals.SyncTransaction.disconnect_all_slots();
+    g_signals.BlockConnected.disconnect_all_slots();
     g_signals.UpdatedBlockTip.disconnect_all_slots();
     g_signals.NotifyHeaderTip.disconnect_all_slots();
     g_signals.AcceptedBlockHeader.disconnect_all_slots();
@@ -9,16 +9,26 @@
 #include <boost/signals2/signal.hpp>
 #include <boost/shared_ptr.hpp>
 
+#include <stddef.h>
+
 class CBlock;
 struct CBlockLocator;
 class CBlockIndex;
 class CConnman;
+class COutPoint;
 class CReserveScript;
+class CSmartRewardRound;
+class CSporkMessage;
 class CTransaction;
 class CValidationInterface;
 class CValidationState;
 class uint256;
 
+/** Default for -asyncvalidationsignals */
+static const bool DEFAULT_ASYNC_VALIDATION_SIGNALS = false;
+/** Max. number of queued notifications before block connection waits for the listeners */
+static const size_t MAX_QUEUED_VALIDATION_SIGNALS = 100;
+
 // These functions dispatch to one or all registered wallets
 
 /** Register a wallet to receive updates from core */
@@ -28,13 +38,35 @@ void UnregisterValidationInterface(CValidationInterface* pwalletIn);
 /** Unregister all wallets from core */
 void UnregisterAllValidationInterfaces();
 
+/**
+ * Fire the block and transaction notifications (UpdatedBlockTip, BlockConnected
+ * and SyncTransaction) in order on a thread of their own instead of the
+ * validation thread. The queued notifications keep a copy of their block or
+ * transaction.
+ */
+void StartValidationInterfaceQueue();
+/** Fire the notifications still queued and fire them on the caller's thread again */
+void StopValidationInterfaceQueue();
+/**
+ * Wait until the notifications queued so far were fired. The listeners take
+ * cs_main, so neither this nor LimitValidationInterfaceQueue may be called
+ * with it held.
+ */
+void SyncWithValidationInterfaceQueue();
+/** Wait until less than MAX_QUEUED_VALIDATION_SIGNALS notifications are queued */
+void LimitValidationInterfaceQueue();
+
 class CValidationInterface {
 protected:
     virtual void AcceptedBlockHeader(const CBlockIndex *pindexNew) {}
     virtual void NotifyHeaderTip(const CBlockIndex *pindexNew, bool fInitialDownload) {}
     virtual void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) {}
+    virtual void BlockConnected(const CBlock &block, const CBlockIndex *pindex) {}
     virtual void SyncTransaction(const CTransaction &tx, const CBlock *pblock) {}
     virtual void NotifyTransactionLock(const CTransaction &tx) {}
+    virtual void NotifySmartnodeListChanged(const COutPoint &outpoint, bool fAdded) {}
+    virtual void NotifyRewardsRoundFinalized(const CSmartRewardRound &round) {}
+    virtual void NotifySporkChanged(const CSporkMessage &spork) {}
     virtual void SetBestChain(const CBlockLocator &locator) {}
     virtual bool UpdatedTransaction(const uint256 &hash) { return false;}
     virtual void Inventory(const uint256 &hash) {}
@@ -54,10 +86,18 @@ struct CMainSignals {
     boost::signals2::signal<void (const CBlockIndex *, bool fInitialDownload)> NotifyHeaderTip;
     /** Notifies listeners of updated block chain tip */
     boost::signals2::signal<void (const CBlockIndex *, const CBlockIndex *, bool fInitialDownload)> UpdatedBlockTip;
+    /** Notifies listeners of a block connected to the active chain, before the SyncTransaction calls for its transactions */
+    boost::signals2::signal<void (const CBlock &, const CBlockIndex *)> BlockConnected;
     /** Notifies listeners of updated transaction data (transaction, and optionally the block it is found in. */
     boost::signals2::signal<void (const CTransaction &, const CBlock *)> SyncTransaction;
     /** Notifies listeners of an updated transaction lock without new data. */
     boost::signals2::signal<void (const CTransaction &)> NotifyTransactionLock;
+    /** Notifies listeners of a smartnode added to or removed from the list. */
+    boost::signals2::signal<void (const COutPoint &, bool fAdded)> NotifySmartnodeListChanged;
+    /** Notifies listeners of a SmartRewards round that was finalized. */
+    boost::signals2::signal<void (const CSmartRewardRound &)> NotifyRewardsRoundFinalized;
+    /** Notifies listeners of a new or updated spork. */
+    boost::signals2::signal<void (const CSporkMessage &)> NotifySporkChanged;
     /** Notifies listeners of an updated transaction without new data (for now: a coinbase potentially becoming visible). */
     boost::signals2::signal<bool (const uint256 &)> UpdatedTransaction;
     /** Notifies listeners of a new active block chain. */
@@ -72,6 +112,13 @@ struct CMainSignals {
     boost::signals2::signal<void (boost::shared_ptr<CReserveScript>&)> ScriptForMining;
     /** Notifies listeners that a block has been successfully mined */
     boost::signals2::signal<void (const uint256 &)> BlockFound;
+
+    /** Fire UpdatedBlockTip, on the queue if it is running */
+    void QueueUpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload);
+    /** Fire BlockConnected followed by SyncTransaction for each transaction of the block, on the queue if it is running */
+    void QueueBlockConnected(const CBlock &block, const CBlockIndex *pindex);
+    /** Fire SyncTransaction, on the queue if it is running */
+    void QueueSyncTransaction(const CTransaction &tx, const CBlock *pblock);
 };
 
 CMainSignals& GetMainSignals();
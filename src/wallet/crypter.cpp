@@ -10,7 +10,9 @@
 #include "script/standard.h"
 #include "util.h"
 
+#include <atomic>
 #include <string>
+#include <thread>
 #include <vector>
 #include <boost/foreach.hpp>
 
@@ -168,6 +170,20 @@ bool CCryptoKeyStore::Lock()
     return true;
 }
 
+/** Minimum number of keys each thread checks when a whole wallet is decrypted on first unlock */
+static const size_t UNLOCK_KEYS_PER_THREAD = 256;
+
+typedef std::vector<const std::pair<CPubKey, std::vector<unsigned char> >*> CryptedKeyList;
+
+static void DecryptKeyRange(const CKeyingMaterial& vMasterKey, const CryptedKeyList& vKeys, size_t nBegin, size_t nEnd, std::atomic<bool>& fFail)
+{
+    for (size_t i = nBegin; i < nEnd && !fFail; i++) {
+        CKey key;
+        if (!DecryptKey(vMasterKey, vKeys[i]->second, vKeys[i]->first, key))
+            fFail = true;
+    }
+}
+
 bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
 {
     {
@@ -175,30 +191,41 @@ bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
         if (!SetCrypted())
             return false;
 
-        bool keyPass = false;
-        bool keyFail = false;
+        // A wrong passphrase shows on the first key, so only that one is checked up front
         CryptedKeyMap::const_iterator mi = mapCryptedKeys.begin();
-        for (; mi != mapCryptedKeys.end(); ++mi)
+        if (mi == mapCryptedKeys.end())
+            return false;
+        CKey key;
+        if (!DecryptKey(vMasterKeyIn, (*mi).second.second, (*mi).second.first, key))
+            return false;
+
+        if (!fDecryptionThoroughlyChecked)
         {
-            const CPubKey &vchPubKey = (*mi).second.first;
-            const std::vector<unsigned char> &vchCryptedSecret = (*mi).second.second;
-            CKey key;
-            if (!DecryptKey(vMasterKeyIn, vchCryptedSecret, vchPubKey, key))
+            // Every other key has to decrypt too; they are independent, so large wallets
+            // check them across all cores
+            CryptedKeyList vKeys;
+            vKeys.reserve(mapCryptedKeys.size() - 1);
+            for (++mi; mi != mapCryptedKeys.end(); ++mi)
+                vKeys.push_back(&(*mi).second);
+
+            std::atomic<bool> fFail(false);
+            size_t nThreads = std::min<size_t>(std::max(GetNumCores(), 1), vKeys.size() / UNLOCK_KEYS_PER_THREAD);
+            if (nThreads <= 1) {
+                DecryptKeyRange(vMasterKeyIn, vKeys, 0, vKeys.size(), fFail);
+            } else {
+                size_t nChunk = (vKeys.size() + nThreads - 1) / nThreads;
+                std::vector<std::thread> vThreads;
+                for (size_t nBegin = 0; nBegin < vKeys.size(); nBegin += nChunk)
+                    vThreads.push_back(std::thread(DecryptKeyRange, std::cref(vMasterKeyIn), std::cref(vKeys), nBegin, std::min(nBegin + nChunk, vKeys.size()), std::ref(fFail)));
+                for (std::thread& thread : vThreads)
+                    thread.join();
+            }
+            if (fFail)
             {
-                keyFail = true;
-                break;
+                LogPrintf("The wallet is probably corrupted: Some keys decrypt but not all.\n");
+                assert(false);
             }
-            keyPass = true;
-            if (fDecryptionThoroughlyChecked)
-                break;
         }
-        if (keyPass && keyFail)
-        {
-            LogPrintf("The wallet is probably corrupted: Some keys decrypt but not all.\n");
-            assert(false);
-        }
-        if (keyFail || !keyPass)
-            return false;
         vMasterKey = vMasterKeyIn;
         fDecryptionThoroughlyChecked = true;
     }
@@ -8,6 +8,7 @@
 #include "keystore.h"
 #include "serialize.h"
 #include "support/allocators/secure.h"
+#include "support/pagelocker.h"
 
 class uint256;
 
@@ -301,7 +301,8 @@ CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnClose
 
 void CDB::Flush()
 {
-    if (activeTxn)
+    // A batch is flushed once, when it ends
+    if (activeTxn || CDBBatchScope::GetTxn(strFile))
         return;
 
     // Flush database activity from memory pool to disk log
@@ -330,6 +331,56 @@ void CDB::Close()
     }
 }
 
+//! Batch transactions the current thread has open, by file
+static boost::thread_specific_ptr<std::map<std::string, DbTxn*> > batchtxns;
+
+DbTxn* CDBBatchScope::GetTxn(const std::string& strFile)
+{
+    std::map<std::string, DbTxn*>* pmap = batchtxns.get();
+    if (!pmap || pmap->empty())
+        return NULL;
+    std::map<std::string, DbTxn*>::const_iterator it = pmap->find(strFile);
+    return it != pmap->end() ? it->second : NULL;
+}
+
+CDBBatchScope::CDBBatchScope(const std::string& strFilename) : ptxn(NULL)
+{
+    if (strFilename.empty() || GetTxn(strFilename))
+        return;
+
+    {
+        LOCK(bitdb.cs_db);
+        if (!bitdb.Open(GetDataDir()))
+            return;
+        ptxn = bitdb.TxnBegin();
+        if (!ptxn)
+            return;
+        // Keeps the file from being flushed and closed under the transaction
+        ++bitdb.mapFileUseCount[strFilename];
+    }
+
+    strFile = strFilename;
+    if (!batchtxns.get())
+        batchtxns.reset(new std::map<std::string, DbTxn*>());
+    (*batchtxns)[strFile] = ptxn;
+}
+
+CDBBatchScope::~CDBBatchScope()
+{
+    if (!ptxn)
+        return;
+
+    batchtxns->erase(strFile);
+    if (ptxn->commit(0) != 0)
+        LogPrintf("CDBBatchScope: committing the batched writes to %s failed\n", strFile);
+    bitdb.dbenv->txn_checkpoint(0, 0, 0);
+
+    {
+        LOCK(bitdb.cs_db);
+        --bitdb.mapFileUseCount[strFile];
+    }
+}
+
 void CDBEnv::CloseDb(const string& strFile)
 {
     {
@@ -77,10 +77,10 @@ public:
     void CloseDb(const std::string& strFile);
     bool RemoveDb(const std::string& strFile);
 
-    DbTxn* TxnBegin(int flags = DB_TXN_WRITE_NOSYNC)
+    DbTxn* TxnBegin(int flags = DB_TXN_WRITE_NOSYNC, DbTxn* ptxnParent = NULL)
     {
         DbTxn* ptxn = NULL;
-        int ret = dbenv->txn_begin(NULL, &ptxn, flags);
+        int ret = dbenv->txn_begin(ptxnParent, &ptxn, flags);
         if (!ptxn || ret != 0)
             return NULL;
         return ptxn;
@@ -89,6 +89,29 @@ public:
 
 extern CDBEnv bitdb;
 
+/**
+ * Makes everything the current thread reads and writes in a database file,
+ * through any CDB opened on it, one transaction until the scope ends. The
+ * records are then logged and checkpointed once instead of once each. A scope
+ * opened while the thread already batches the file joins that batch.
+ */
+class CDBBatchScope
+{
+private:
+    std::string strFile;
+    DbTxn* ptxn;
+
+    CDBBatchScope(const CDBBatchScope&);
+    void operator=(const CDBBatchScope&);
+
+public:
+    explicit CDBBatchScope(const std::string& strFilename);
+    ~CDBBatchScope();
+
+    //! The batch transaction the current thread has open on a file, if any
+    static DbTxn* GetTxn(const std::string& strFile);
+};
+
 
 /** RAII class that provides access to a Berkeley database */
 class CDB
@@ -103,6 +126,8 @@ protected:
     explicit CDB(const std::string& strFilename, const char* pszMode = "r+", bool fFlushOnCloseIn=true);
     ~CDB() { Close(); }
 
+    DbTxn* GetTxn() const { return activeTxn ? activeTxn : CDBBatchScope::GetTxn(strFile); }
+
 public:
     void Flush();
     void Close();
@@ -127,7 +152,7 @@ protected:
         // Read
         Dbt datValue;
         datValue.set_flags(DB_DBT_MALLOC);
-        int ret = pdb->get(activeTxn, &datKey, &datValue, 0);
+        int ret = pdb->get(GetTxn(), &datKey, &datValue, 0);
         memset(datKey.get_data(), 0, datKey.get_size());
         if (datValue.get_data() == NULL)
             return false;
@@ -167,7 +192,7 @@ protected:
         Dbt datValue(&ssValue[0], ssValue.size());
 
         // Write
-        int ret = pdb->put(activeTxn, &datKey, &datValue, (fOverwrite ? 0 : DB_NOOVERWRITE));
+        int ret = pdb->put(GetTxn(), &datKey, &datValue, (fOverwrite ? 0 : DB_NOOVERWRITE));
 
         // Clear memory in case it was a private key
         memset(datKey.get_data(), 0, datKey.get_size());
@@ -190,7 +215,7 @@ protected:
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Erase
-        int ret = pdb->del(activeTxn, &datKey, 0);
+        int ret = pdb->del(GetTxn(), &datKey, 0);
 
         // Clear memory
         memset(datKey.get_data(), 0, datKey.get_size());
@@ -210,7 +235,7 @@ protected:
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Exists
-        int ret = pdb->exists(activeTxn, &datKey, 0);
+        int ret = pdb->exists(GetTxn(), &datKey, 0);
 
         // Clear memory
         memset(datKey.get_data(), 0, datKey.get_size());
@@ -222,7 +247,7 @@ protected:
         if (!pdb)
             return NULL;
         Dbc* pcursor = NULL;
-        int ret = pdb->cursor(NULL, &pcursor, 0);
+        int ret = pdb->cursor(GetTxn(), &pcursor, 0);
         if (ret != 0)
             return NULL;
         return pcursor;
@@ -270,7 +295,7 @@ public:
     {
         if (!pdb || activeTxn)
             return false;
-        DbTxn* ptxn = bitdb.TxnBegin();
+        DbTxn* ptxn = bitdb.TxnBegin(DB_TXN_WRITE_NOSYNC, CDBBatchScope::GetTxn(strFile));
         if (!ptxn)
             return false;
         activeTxn = ptxn;
@@ -17,6 +17,7 @@
 #include "timedata.h"
 #include "util.h"
 #include "utilmoneystr.h"
+#include "validationinterface.h"
 #include "wallet.h"
 #include "walletdb.h"
 
@@ -47,6 +48,8 @@ bool EnsureWalletIsAvailable(bool avoidException)
         else
             return false;
     }
+    // Wallet commands see the blocks and transactions validated before them.
+    SyncWithValidationInterfaceQueue();
     return true;
 }
 
@@ -1647,7 +1650,8 @@ UniValue listtransactions(const UniValue& params, bool fHelp)
 
     UniValue ret(UniValue::VARR);
 
-    const CWallet::TxItems & txOrdered = pwalletMain->wtxOrdered;
+    // A single account only walks the entries that may belong to it
+    const CWallet::TxItems & txOrdered = strAccount == "*" ? pwalletMain->wtxOrdered : pwalletMain->GetAccountOrderedTxItems(strAccount);
 
     // iterate backwards until we have nCount items to return:
     for (CWallet::TxItems::const_reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
@@ -10,6 +10,9 @@
 #include <vector>
 
 #include "wallet/test/wallet_test_fixture.h"
+#include "random.h"
+#include "txmempool.h"
+#include "validation.h"
 
 #include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
@@ -44,10 +47,7 @@ static void add_coin(const CAmount& nValue, int nAge = 6*24, bool fIsFromMe = fa
     }
     CWalletTx* wtx = new CWalletTx(&wallet, tx);
     if (fIsFromMe)
-    {
-        wtx->fDebitCached = true;
-        wtx->nDebitCached = 1;
-    }
+        wtx->amountCache.Set(CWalletTxCache::DEBIT, 1);
     COutput output(wtx, nInput, nAge, true, true);
     vCoins.push_back(output);
 }
@@ -270,7 +270,11 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
              for (uint16_t j = 0; j < 676; j++)
                  add_coin(amt);
              BOOST_CHECK(wallet.SelectCoinsMinConf(2000, 1, 1, 0, vCoins, setCoinsRet, nValueRet));
-             if (amt - 2000 < MIN_CHANGE) {
+             if (amt > CWallet::GetRequiredFee(148) && amt - 2000 <= CWallet::GetChangeCost()) {
+                 // one input leaves less change than it is worth, so no change is needed:
+                 BOOST_CHECK_EQUAL(nValueRet, amt);
+                 BOOST_CHECK_EQUAL(setCoinsRet.size(), 1U);
+             } else if (amt - 2000 < MIN_CHANGE) {
                  // needs more than one input:
                  uint16_t returnSize = std::ceil((2000.0 + MIN_CHANGE)/amt);
                  CAmount returnValue = amt * returnSize;
@@ -332,6 +336,42 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+BOOST_AUTO_TEST_CASE(coin_selection_bnb)
+{
+    CoinSet setCoinsRet;
+    CAmount nValueRet;
+
+    LOCK(wallet.cs_wallet);
+
+    empty_wallet();
+    add_coin(7 * CENT);
+    add_coin(5 * CENT);
+    add_coin(4 * CENT);
+    add_coin(3 * CENT);
+    add_coin(1 * CENT);
+
+    // An exact 5 + 4 is found every time, not only when the shuffle is lucky
+    for (int i = 0; i < RUN_TESTS; i++) {
+        BOOST_CHECK(wallet.SelectCoinsMinConf(9 * CENT, 1, 1, 0, vCoins, setCoinsRet, nValueRet));
+        BOOST_CHECK_EQUAL(nValueRet, 9 * CENT);
+    }
+
+    // A coin too small to pay for its own input is never needed for an exact match
+    empty_wallet();
+    add_coin(CWallet::GetRequiredFee(148) / 2);
+    add_coin(2 * CENT);
+    add_coin(3 * CENT);
+    BOOST_CHECK(wallet.SelectCoinsMinConf(5 * CENT, 1, 1, 0, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 5 * CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
+
+    // Excess below the cost of change is accepted
+    BOOST_CHECK(wallet.SelectCoinsMinConf(5 * CENT - CWallet::GetChangeCost(), 1, 1, 0, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 5 * CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
+    empty_wallet();
+}
+
 BOOST_AUTO_TEST_CASE(ApproximateBestSubset)
 {
     CoinSet setCoinsRet;
@@ -351,4 +391,312 @@ BOOST_AUTO_TEST_CASE(ApproximateBestSubset)
     BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
 }
 
+BOOST_AUTO_TEST_CASE(incremental_balances)
+{
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    CKey key;
+    key.MakeNewKey(true);
+    BOOST_CHECK(pwalletMain->AddKey(key));
+    CAmount nUnconfirmed = pwalletMain->GetUnconfirmedBalance();
+
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = 5 * COIN;
+    mtx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+    CTransaction tx(mtx);
+    BOOST_CHECK(pwalletMain->AddToWallet(CWalletTx(pwalletMain, tx), false, NULL));
+
+    // Neither confirmed nor in the mempool: not counted anywhere
+    BOOST_CHECK_EQUAL(pwalletMain->GetUnconfirmedBalance(), nUnconfirmed);
+
+    // Entering and leaving the mempool is picked up without a notification
+    TestMemPoolEntryHelper entry;
+    mempool.addUnchecked(tx.GetHash(), entry.FromTx(tx));
+    BOOST_CHECK_EQUAL(pwalletMain->GetUnconfirmedBalance(), nUnconfirmed + 5 * COIN);
+
+    std::list<CTransaction> removed;
+    mempool.remove(tx, removed);
+    BOOST_CHECK_EQUAL(pwalletMain->GetUnconfirmedBalance(), nUnconfirmed);
+
+    // A full recomputation agrees with the running totals
+    mempool.addUnchecked(tx.GetHash(), entry.FromTx(tx));
+    CWalletBalances balances = pwalletMain->GetBalances();
+    pwalletMain->MarkDirty();
+    const CWalletBalances& rescanned = pwalletMain->GetBalances();
+    BOOST_CHECK_EQUAL(balances.nTrusted, rescanned.nTrusted);
+    BOOST_CHECK_EQUAL(balances.nUntrustedPending, rescanned.nUntrustedPending);
+    BOOST_CHECK_EQUAL(balances.nImmature, rescanned.nImmature);
+    BOOST_CHECK_EQUAL(balances.nUntrustedPending, nUnconfirmed + 5 * COIN);
+    mempool.remove(tx, removed);
+}
+
+BOOST_AUTO_TEST_CASE(ismine_script_filter)
+{
+    LOCK(pwalletMain->cs_wallet);
+
+    CKey key;
+    key.MakeNewKey(true);
+    CScript p2pkh = GetScriptForDestination(key.GetPubKey().GetID());
+    CScript p2sh = GetScriptForDestination(CScriptID(p2pkh));
+    BOOST_CHECK(!pwalletMain->MaybeMine(p2pkh));
+    BOOST_CHECK(!pwalletMain->MaybeMine(p2sh));
+    BOOST_CHECK_EQUAL(pwalletMain->IsMine(CTxOut(COIN, p2pkh)), ISMINE_NO);
+
+    BOOST_CHECK(pwalletMain->AddKey(key));
+    BOOST_CHECK(pwalletMain->MaybeMine(p2pkh));
+    BOOST_CHECK_EQUAL(pwalletMain->IsMine(CTxOut(COIN, p2pkh)), ISMINE_SPENDABLE);
+    BOOST_CHECK(!pwalletMain->MaybeMine(p2sh));
+
+    BOOST_CHECK(pwalletMain->AddCScript(p2pkh));
+    BOOST_CHECK(pwalletMain->MaybeMine(p2sh));
+    BOOST_CHECK_EQUAL(pwalletMain->IsMine(CTxOut(COIN, p2sh)), ISMINE_SPENDABLE);
+
+    // Watched scripts pass until they are removed again
+    CKey other;
+    other.MakeNewKey(true);
+    CScript watched = GetScriptForDestination(other.GetPubKey().GetID());
+    BOOST_CHECK(pwalletMain->AddWatchOnly(watched));
+    BOOST_CHECK(pwalletMain->MaybeMine(watched));
+    BOOST_CHECK(pwalletMain->IsMine(CTxOut(COIN, watched)) & ISMINE_WATCH_ONLY);
+    BOOST_CHECK(pwalletMain->RemoveWatchOnly(watched));
+    BOOST_CHECK(!pwalletMain->MaybeMine(watched));
+
+    // Other script forms are left to IsMine()
+    BOOST_CHECK(pwalletMain->MaybeMine(GetScriptForRawPubKey(other.GetPubKey())));
+}
+
+BOOST_AUTO_TEST_CASE(wallet_db_batch)
+{
+    const std::string& strFile = pwalletMain->strWalletFile;
+    CKey key;
+    key.MakeNewKey(true);
+    CKeyPool keypool(key.GetPubKey(), false);
+    CKeyPool keypoolRead;
+
+    {
+        CDBBatchScope batch(strFile);
+        BOOST_CHECK(CDBBatchScope::GetTxn(strFile) != NULL);
+        // Nested scopes join the outer batch
+        {
+            CDBBatchScope nested(strFile);
+            BOOST_CHECK(CWalletDB(strFile).WritePool(1000000, keypool));
+        }
+        BOOST_CHECK(CDBBatchScope::GetTxn(strFile) != NULL);
+
+        // Other handles on the file see the batched writes instead of waiting for them
+        CWalletDB walletdb(strFile);
+        BOOST_CHECK(walletdb.ReadPool(1000000, keypoolRead));
+        BOOST_CHECK(keypoolRead.vchPubKey == keypool.vchPubKey);
+        BOOST_CHECK(walletdb.TxnBegin());
+        BOOST_CHECK(walletdb.WritePool(1000001, keypool));
+        BOOST_CHECK(walletdb.TxnCommit());
+    }
+    BOOST_CHECK(CDBBatchScope::GetTxn(strFile) == NULL);
+
+    CWalletDB walletdb(strFile);
+    BOOST_CHECK(walletdb.ReadPool(1000000, keypoolRead));
+    BOOST_CHECK(walletdb.ReadPool(1000001, keypoolRead));
+    BOOST_CHECK(walletdb.ErasePool(1000000));
+    BOOST_CHECK(walletdb.ErasePool(1000001));
+}
+
+BOOST_AUTO_TEST_CASE(hd_keypool_derivation)
+{
+    LOCK(pwalletMain->cs_wallet);
+    mapArgs["-hdseed"] = "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f";
+    pwalletMain->GenerateNewHDChain();
+    BOOST_CHECK(pwalletMain->IsHDEnabled());
+
+    // A child the wallet already has is skipped
+    CHDChain hdChain;
+    BOOST_CHECK(pwalletMain->GetHDChain(hdChain));
+    CExtKey extKey;
+    hdChain.DeriveChildExtKey(0, false, 2, extKey);
+    BOOST_CHECK(pwalletMain->AddKey(extKey.key));
+
+    // Enough keys to be derived on several threads, in chain order
+    std::vector<CPubKey> vPubKeys;
+    pwalletMain->GenerateNewKeys(vPubKeys, 300, 0, false);
+    BOOST_CHECK_EQUAL(vPubKeys.size(), 300U);
+    for (uint32_t i = 0, nChild = 0; i < vPubKeys.size(); i++, nChild++) {
+        if (nChild == 2)
+            nChild++;
+        hdChain.DeriveChildExtKey(0, false, nChild, extKey);
+        BOOST_CHECK(vPubKeys[i] == extKey.key.GetPubKey());
+        BOOST_CHECK(pwalletMain->HaveKey(vPubKeys[i].GetID()));
+    }
+
+    CHDAccount acc;
+    BOOST_CHECK(pwalletMain->GetHDChain(hdChain));
+    BOOST_CHECK(hdChain.GetAccount(0, acc));
+    BOOST_CHECK_EQUAL(acc.nExternalChainCounter, 301U);
+    BOOST_CHECK_EQUAL(acc.nInternalChainCounter, 0U);
+
+    // Single keys continue from there
+    hdChain.DeriveChildExtKey(0, false, 301, extKey);
+    BOOST_CHECK(pwalletMain->GenerateNewKey(0, false) == extKey.key.GetPubKey());
+}
+
+BOOST_AUTO_TEST_CASE(zerocoin_index)
+{
+    CWalletDB walletdb(pwalletMain->strWalletFile);
+    walletdb.LoadZerocoinIndex();
+
+    CZerocoinEntry mint;
+    mint.value = CBigNum(1000);
+    mint.denomination = 1;
+    mint.nHeight = 10;
+    BOOST_CHECK(walletdb.WriteZerocoinEntry(mint));
+    mint.value = CBigNum(7);
+    BOOST_CHECK(walletdb.WriteZerocoinEntry(mint));
+
+    CZerocoinSpendEntry spend;
+    spend.coinSerial = CBigNum(42);
+    spend.hashTx = GetRandHash();
+    spend.pubCoin = CBigNum(1000);
+    BOOST_CHECK(walletdb.WriteCoinSpendSerialEntry(spend));
+
+    CZerocoinEntry mintRead;
+    BOOST_CHECK(walletdb.ReadZerocoinEntry(CBigNum(1000), mintRead));
+    BOOST_CHECK_EQUAL(mintRead.nHeight, 10);
+    BOOST_CHECK(!walletdb.ReadZerocoinEntry(CBigNum(8), mintRead));
+
+    std::list<CZerocoinSpendEntry> listSpends;
+    walletdb.ListCoinSpendSerial(spend.hashTx, listSpends);
+    BOOST_CHECK_EQUAL(listSpends.size(), 1U);
+    listSpends.clear();
+    walletdb.ListCoinSpendSerial(GetRandHash(), listSpends);
+    BOOST_CHECK(listSpends.empty());
+
+    // Overwriting a spend moves it to its new transaction
+    uint256 hashTxOld = spend.hashTx;
+    spend.hashTx = GetRandHash();
+    BOOST_CHECK(walletdb.WriteCoinSpendSerialEntry(spend));
+    walletdb.ListCoinSpendSerial(hashTxOld, listSpends);
+    BOOST_CHECK(listSpends.empty());
+    walletdb.ListCoinSpendSerial(spend.hashTx, listSpends);
+    BOOST_CHECK_EQUAL(listSpends.size(), 1U);
+
+    // The index lists what a fresh read of the database finds, in the same order
+    BOOST_CHECK(walletdb.EarseZerocoinEntry(mint));
+    std::list<CZerocoinEntry> listIndexed, listRead;
+    walletdb.ListPubCoin(listIndexed);
+    walletdb.LoadZerocoinIndex();
+    walletdb.ListPubCoin(listRead);
+    BOOST_CHECK_EQUAL(listIndexed.size(), 1U);
+    BOOST_CHECK_EQUAL(listRead.size(), 1U);
+    BOOST_CHECK(listRead.front().value == CBigNum(1000));
+
+    BOOST_CHECK(walletdb.EraseCoinSpendSerialEntry(spend));
+    listSpends.clear();
+    walletdb.ListCoinSpendSerial(spend.hashTx, listSpends);
+    BOOST_CHECK(listSpends.empty());
+}
+
+BOOST_AUTO_TEST_CASE(load_wallet_txs)
+{
+    // More transactions than one thread decodes, added in the order they are stored
+    std::vector<uint256> vHashes;
+    {
+        CWalletDB walletdb(pwalletMain->strWalletFile);
+        for (int i = 0; i < 1200; i++) {
+            CMutableTransaction mtx;
+            mtx.vin.resize(1);
+            mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+            mtx.vout.resize(1);
+            mtx.vout[0].nValue = COIN;
+            CWalletTx wtx(pwalletMain, mtx);
+            wtx.nOrderPos = i;
+            BOOST_CHECK(walletdb.WriteTx(wtx.GetHash(), wtx));
+            vHashes.push_back(wtx.GetHash());
+        }
+    }
+
+    CWallet wallet(pwalletMain->strWalletFile);
+    bool fFirstRun;
+    BOOST_CHECK(wallet.LoadWallet(fFirstRun) == DB_LOAD_OK);
+    LOCK(wallet.cs_wallet);
+    BOOST_CHECK_EQUAL(wallet.mapWallet.size(), vHashes.size());
+    for (unsigned int i = 0; i < vHashes.size(); i++) {
+        std::map<uint256, CWalletTx>::const_iterator it = wallet.mapWallet.find(vHashes[i]);
+        BOOST_CHECK(it != wallet.mapWallet.end() && it->second.nOrderPos == i);
+    }
+    BOOST_CHECK_EQUAL(wallet.wtxOrdered.size(), vHashes.size());
+}
+
+static CWalletTx AccountTestTx(CWallet& wallet, const CTxDestination& dest, const std::string& strFromAccount, int64_t nOrderPos)
+{
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    mtx.vout.resize(1);
+    mtx.vout[0].nValue = COIN;
+    mtx.vout[0].scriptPubKey = GetScriptForDestination(dest);
+    CWalletTx wtx(&wallet, mtx);
+    wtx.strFromAccount = strFromAccount;
+    wtx.nOrderPos = nOrderPos;
+    return wtx;
+}
+
+BOOST_AUTO_TEST_CASE(account_ordered_tx_items)
+{
+    CWallet wallet;
+    LOCK(wallet.cs_wallet);
+
+    CKey keyA, keyB;
+    keyA.MakeNewKey(true);
+    keyB.MakeNewKey(true);
+    wallet.SetAddressBook(keyA.GetPubKey().GetID(), "a", "receive");
+
+    wallet.AddToWallet(AccountTestTx(wallet, keyA.GetPubKey().GetID(), "", 0), true, NULL);
+    wallet.AddToWallet(AccountTestTx(wallet, keyB.GetPubKey().GetID(), "b", 1), true, NULL);
+    wallet.AddToWallet(AccountTestTx(wallet, keyB.GetPubKey().GetID(), "", 2), true, NULL);
+    BOOST_CHECK_EQUAL(wallet.wtxOrdered.size(), 3U);
+    BOOST_CHECK_EQUAL(wallet.GetAccountOrderedTxItems("a").size(), 1U);
+    BOOST_CHECK_EQUAL(wallet.GetAccountOrderedTxItems("b").size(), 1U);
+    BOOST_CHECK_EQUAL(wallet.GetAccountOrderedTxItems("").size(), 3U);
+    BOOST_CHECK(wallet.GetAccountOrderedTxItems("c").empty());
+
+    // Built views follow new transactions and accounting entries
+    wallet.AddToWallet(AccountTestTx(wallet, keyA.GetPubKey().GetID(), "", 3), true, NULL);
+    CAccountingEntry entry;
+    entry.strAccount = "a";
+    entry.nOrderPos = 4;
+    wallet.laccentries.push_back(entry);
+    wallet.AddToOrderedTxItems(entry.nOrderPos, CWallet::TxPair((CWalletTx*)0, &wallet.laccentries.back()));
+    const CWallet::TxItems& txItemsA = wallet.GetAccountOrderedTxItems("a");
+    BOOST_CHECK_EQUAL(txItemsA.size(), 3U);
+    BOOST_CHECK_EQUAL(txItemsA.rbegin()->first, 4);
+    BOOST_CHECK(txItemsA.rbegin()->second.second == &wallet.laccentries.back());
+
+    // Labelling an address moves its transactions into the account
+    wallet.SetAddressBook(keyB.GetPubKey().GetID(), "a", "receive");
+    BOOST_CHECK_EQUAL(wallet.GetAccountOrderedTxItems("a").size(), 5U);
+    BOOST_CHECK_EQUAL(wallet.GetAccountOrderedTxItems("b").size(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(wallet_tx_amount_cache)
+{
+    CWalletTxCache cache;
+    BOOST_CHECK(!cache.IsCached(CWalletTxCache::DEBIT));
+    BOOST_CHECK_EQUAL(cache.Set(CWalletTxCache::CHANGE, 5 * COIN), 5 * COIN);
+    BOOST_CHECK(cache.IsCached(CWalletTxCache::CHANGE));
+    BOOST_CHECK_EQUAL(cache.Get(CWalletTxCache::CHANGE), 5 * COIN);
+    BOOST_CHECK(!cache.IsCached(CWalletTxCache::AVAILABLE_WATCH_CREDIT));
+    cache.Set(CWalletTxCache::AVAILABLE_WATCH_CREDIT, 0);
+    BOOST_CHECK(cache.IsCached(CWalletTxCache::AVAILABLE_WATCH_CREDIT));
+
+    // Marking a transaction dirty forgets every amount
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    CWalletTx wtx(NULL, mtx);
+    wtx.amountCache.Set(CWalletTxCache::DEBIT, COIN);
+    BOOST_CHECK_EQUAL(wtx.GetDebit(ISMINE_SPENDABLE), COIN);
+    wtx.MarkDirty();
+    BOOST_CHECK(!wtx.amountCache.IsCached(CWalletTxCache::DEBIT));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -98,8 +98,9 @@ CPubKey CWallet::GenerateNewKey(uint32_t nAccountIndex, bool fInternal) {
     CPubKey pubkey;
     // use HD key derivation if HD was enabled during wallet creation
     if (IsHDEnabled()) {
-        DeriveNewChildKey(metadata, secret, nAccountIndex, fInternal);
-        pubkey = secret.GetPubKey();
+        std::vector<CPubKey> vPubKeys;
+        DeriveNewChildKeys(metadata, vPubKeys, 1, nAccountIndex, fInternal);
+        pubkey = vPubKeys[0];
     } else {
         secret.MakeNewKey(fCompressed);
 
@@ -121,7 +122,47 @@ CPubKey CWallet::GenerateNewKey(uint32_t nAccountIndex, bool fInternal) {
     return pubkey;
 }
 
-void CWallet::DeriveNewChildKey(const CKeyMetadata& metadata, CKey& secretRet, uint32_t nAccountIndex, bool fInternal)
+void CWallet::GenerateNewKeys(std::vector<CPubKey>& vPubKeysRet, size_t nCount, uint32_t nAccountIndex, bool fInternal)
+{
+    AssertLockHeld(cs_wallet);
+    vPubKeysRet.clear();
+    if (nCount == 0)
+        return;
+    if (IsHDEnabled()) {
+        DeriveNewChildKeys(CKeyMetadata(GetTime()), vPubKeysRet, nCount, nAccountIndex, fInternal);
+        return;
+    }
+    while (vPubKeysRet.size() < nCount)
+        vPubKeysRet.push_back(GenerateNewKey(nAccountIndex, fInternal));
+}
+
+/** Keys derived per thread when topping up the keypool, below that fewer threads are used */
+static const size_t HD_DERIVE_KEYS_PER_THREAD = 50;
+
+/** Derive the children of a chain key with indexes [nFirst, nFirst + vExtPubKeys.size()), split over a few threads */
+static void DeriveChildExtPubKeys(const CExtKey& chainKey, uint32_t nFirst, std::vector<CExtPubKey>& vExtPubKeys)
+{
+    auto derive = [&chainKey, &vExtPubKeys, nFirst](int n, int nThreads) {
+        for (size_t i = n; i < vExtPubKeys.size(); i += nThreads) {
+            CExtKey childKey;
+            chainKey.Derive(childKey, nFirst + i);
+            vExtPubKeys[i] = childKey.Neuter();
+            assert(childKey.key.VerifyPubKey(vExtPubKeys[i].pubkey));
+        }
+    };
+
+    int nThreads = std::max(1, std::min(GetNumCores(), (int) (vExtPubKeys.size() / HD_DERIVE_KEYS_PER_THREAD)));
+    if (nThreads == 1) {
+        derive(0, 1);
+        return;
+    }
+    boost::thread_group derivers;
+    for (int n = 0; n < nThreads; n++)
+        derivers.create_thread(boost::bind<void>(derive, n, nThreads));
+    derivers.join_all();
+}
+
+void CWallet::DeriveNewChildKeys(const CKeyMetadata& metadata, std::vector<CPubKey>& vPubKeysRet, size_t nCount, uint32_t nAccountIndex, bool fInternal)
 {
     CHDChain hdChainTmp;
     if (!GetHDChain(hdChainTmp)) {
@@ -138,25 +179,35 @@ void CWallet::DeriveNewChildKey(const CKeyMetadata& metadata, CKey& secretRet, u
     if (!hdChainTmp.GetAccount(nAccountIndex, acc))
         throw std::runtime_error(std::string(__func__) + ": Wrong HD account!");
 
-    // derive child key at next index, skip keys already known to the wallet
-    CExtKey childKey;
+    // The hardened part of the path is the same for all children, only the
+    // last step is done per key
+    CExtKey chainKey;
+    hdChainTmp.DeriveChangeExtKey(nAccountIndex, fInternal, chainKey);
+
+    // derive child keys from the next index on, skip keys already known to the wallet
     uint32_t nChildIndex = fInternal ? acc.nInternalChainCounter : acc.nExternalChainCounter;
-    do {
-        hdChainTmp.DeriveChildExtKey(nAccountIndex, fInternal, nChildIndex, childKey);
-        // increment childkey index
-        nChildIndex++;
-    } while (HaveKey(childKey.key.GetPubKey().GetID()));
-    secretRet = childKey.key;
-
-    CPubKey pubkey = secretRet.GetPubKey();
-    assert(secretRet.VerifyPubKey(pubkey));
-
-    // store metadata
-    mapKeyMetadata[pubkey.GetID()] = metadata;
-    if (!nTimeFirstKey || metadata.nCreateTime < nTimeFirstKey)
-        nTimeFirstKey = metadata.nCreateTime;
-
-    // update the chain model in the database
+    while (vPubKeysRet.size() < nCount) {
+        std::vector<CExtPubKey> vExtPubKeys(nCount - vPubKeysRet.size());
+        DeriveChildExtPubKeys(chainKey, nChildIndex, vExtPubKeys);
+        nChildIndex += vExtPubKeys.size();
+
+        BOOST_FOREACH(const CExtPubKey& extPubKey, vExtPubKeys) {
+            const CPubKey& pubkey = extPubKey.pubkey;
+            if (HaveKey(pubkey.GetID()))
+                continue;
+
+            // store metadata
+            mapKeyMetadata[pubkey.GetID()] = metadata;
+            if (!nTimeFirstKey || metadata.nCreateTime < nTimeFirstKey)
+                nTimeFirstKey = metadata.nCreateTime;
+
+            if (!AddHDPubKey(extPubKey, fInternal))
+                throw std::runtime_error(std::string(__func__) + ": AddHDPubKey failed");
+            vPubKeysRet.push_back(pubkey);
+        }
+    }
+
+    // update the chain model in the database, once for all keys
     CHDChain hdChainCurrent;
     GetHDChain(hdChainCurrent);
 
@@ -178,9 +229,6 @@ void CWallet::DeriveNewChildKey(const CKeyMetadata& metadata, CKey& secretRet, u
         if (!SetHDChain(hdChainCurrent, false))
             throw std::runtime_error(std::string(__func__) + ": SetHDChain failed");
     }
-
-    if (!AddHDPubKey(childKey.Neuter(), fInternal))
-        throw std::runtime_error(std::string(__func__) + ": AddHDPubKey failed");
 }
 
 bool CWallet::GetPubKey(const CKeyID &address, CPubKey& vchPubKeyOut) const
@@ -238,6 +286,8 @@ bool CWallet::LoadHDPubKey(const CHDPubKey &hdPubKey)
     AssertLockHeld(cs_wallet);
 
     mapHdPubKeys[hdPubKey.extPubKey.pubkey.GetID()] = hdPubKey;
+    LOCK(cs_KeyStore);
+    scriptFilter.AddHash(hdPubKey.extPubKey.pubkey.GetID());
     return true;
 }
 
@@ -253,6 +303,10 @@ bool CWallet::AddHDPubKey(const CExtPubKey &extPubKey, bool fInternal)
     hdPubKey.hdchainID = hdChainCurrent.GetID();
     hdPubKey.nChangeIndex = fInternal ? 1 : 0;
     mapHdPubKeys[extPubKey.pubkey.GetID()] = hdPubKey;
+    {
+        LOCK(cs_KeyStore);
+        scriptFilter.AddHash(extPubKey.pubkey.GetID());
+    }
 
     // check if we need to remove from watch-only
     CScript script;
@@ -271,7 +325,7 @@ bool CWallet::AddHDPubKey(const CExtPubKey &extPubKey, bool fInternal)
 
 bool CWallet::AddKeyPubKey(const CKey &secret, const CPubKey &pubkey) {
     AssertLockHeld(cs_wallet); // mapKeyMetadata
-    if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
+    if (!LoadKey(secret, pubkey))
         return false;
 
     // check if we need to remove from watch-only
@@ -295,7 +349,7 @@ bool CWallet::AddKeyPubKey(const CKey &secret, const CPubKey &pubkey) {
 
 bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
                             const vector<unsigned char> &vchCryptedSecret) {
-    if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
+    if (!LoadCryptedKey(vchPubKey, vchCryptedSecret))
         return false;
     if (!fFileBacked)
         return true;
@@ -322,13 +376,29 @@ bool CWallet::LoadKeyMetadata(const CPubKey &pubkey, const CKeyMetadata &meta) {
     return true;
 }
 
+bool CWallet::LoadKey(const CKey &key, const CPubKey &pubkey) {
+    LOCK(cs_KeyStore);
+    if (!CCryptoKeyStore::AddKeyPubKey(key, pubkey))
+        return false;
+    scriptFilter.AddHash(pubkey.GetID());
+    return true;
+}
+
 bool CWallet::LoadCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret) {
-    return CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret);
+    LOCK(cs_KeyStore);
+    if (!CCryptoKeyStore::AddCryptedKey(vchPubKey, vchCryptedSecret))
+        return false;
+    scriptFilter.AddHash(vchPubKey.GetID());
+    return true;
 }
 
 bool CWallet::AddCScript(const CScript &redeemScript) {
-    if (!CCryptoKeyStore::AddCScript(redeemScript))
-        return false;
+    {
+        LOCK(cs_KeyStore);
+        if (!CCryptoKeyStore::AddCScript(redeemScript))
+            return false;
+        scriptFilter.AddHash(CScriptID(redeemScript));
+    }
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
@@ -346,11 +416,15 @@ bool CWallet::LoadCScript(const CScript &redeemScript) {
         return true;
     }
 
-    return CCryptoKeyStore::AddCScript(redeemScript);
+    LOCK(cs_KeyStore);
+    if (!CCryptoKeyStore::AddCScript(redeemScript))
+        return false;
+    scriptFilter.AddHash(CScriptID(redeemScript));
+    return true;
 }
 
 bool CWallet::AddWatchOnly(const CScript &dest) {
-    if (!CCryptoKeyStore::AddWatchOnly(dest))
+    if (!LoadWatchOnly(dest))
         return false;
     nTimeFirstKey = 1; // No birthday information for watch-only keys.
     NotifyWatchonlyChanged(true);
@@ -361,8 +435,12 @@ bool CWallet::AddWatchOnly(const CScript &dest) {
 
 bool CWallet::RemoveWatchOnly(const CScript &dest) {
     AssertLockHeld(cs_wallet);
-    if (!CCryptoKeyStore::RemoveWatchOnly(dest))
-        return false;
+    {
+        LOCK(cs_KeyStore);
+        if (!CCryptoKeyStore::RemoveWatchOnly(dest))
+            return false;
+        scriptFilter.RemoveWatchOnly(dest);
+    }
     if (!HaveWatchOnly())
         NotifyWatchonlyChanged(false);
     if (fFileBacked)
@@ -373,7 +451,31 @@ bool CWallet::RemoveWatchOnly(const CScript &dest) {
 }
 
 bool CWallet::LoadWatchOnly(const CScript &dest) {
-    return CCryptoKeyStore::AddWatchOnly(dest);
+    LOCK(cs_KeyStore);
+    if (!CCryptoKeyStore::AddWatchOnly(dest))
+        return false;
+    scriptFilter.AddWatchOnly(dest);
+    return true;
+}
+
+bool CWallet::MaybeMine(const CScript &script) const {
+    LOCK(cs_KeyStore);
+    return scriptFilter.MaybeMine(script);
+}
+
+bool CWalletScriptFilter::MaybeMine(const CScript &script) const {
+    if (!setWatchOnly.empty() && setWatchOnly.count(script))
+        return true;
+    uint160 hash;
+    if (script.IsPayToPublicKeyHash()) {
+        memcpy(hash.begin(), &script[3], 20);
+        return setHashes.count(hash) != 0;
+    }
+    if (script.IsPayToScriptHash()) {
+        memcpy(hash.begin(), &script[2], 20);
+        return setHashes.count(hash) != 0;
+    }
+    return true;
 }
 
 bool CWallet::Unlock(const SecureString &strWalletPassphrase) {
@@ -626,6 +728,7 @@ bool CWallet::IsSpent(const uint256 &hash, unsigned int n) const {
 
 void CWallet::AddToSpends(const COutPoint &outpoint, const uint256 &wtxid) {
     mapTxSpends.insert(make_pair(outpoint, wtxid));
+    MarkBalanceDirty(outpoint.hash);
 
     pair <TxSpends::iterator, TxSpends::iterator> range;
     range = mapTxSpends.equal_range(outpoint);
@@ -780,6 +883,62 @@ int64_t CWallet::IncOrderPosNext(CWalletDB *pwalletdb) {
     return nRet;
 }
 
+/** Whether listtransactions for strAccount may show entries of this transaction or accounting entry */
+static bool IsAccountTxItem(const CWallet& wallet, const CWallet::TxPair& txPair, const std::string& strAccount)
+{
+    if (txPair.second)
+        return txPair.second->strAccount == strAccount;
+    const CWalletTx& wtx = *txPair.first;
+    if (wtx.strFromAccount == strAccount)
+        return true;
+    // Received entries take the label of their address, the default account if there is none
+    BOOST_FOREACH(const CTxOut& txout, wtx.vout) {
+        CTxDestination address;
+        if (!ExtractDestination(txout.scriptPubKey, address))
+            address = CNoDestination();
+        std::map<CTxDestination, CAddressBookData>::const_iterator mi = wallet.mapAddressBook.find(address);
+        if ((mi != wallet.mapAddressBook.end() ? mi->second.name : std::string()) == strAccount)
+            return true;
+    }
+    return false;
+}
+
+void CWallet::AddToOrderedTxItems(int64_t nOrderPos, const TxPair& txPair)
+{
+    AssertLockHeld(cs_wallet);
+    wtxOrdered.insert(make_pair(nOrderPos, txPair));
+    for (std::map<std::string, TxItems>::iterator it = mapAccountOrdered.begin(); it != mapAccountOrdered.end(); ++it) {
+        if (IsAccountTxItem(*this, txPair, it->first))
+            it->second.insert(make_pair(nOrderPos, txPair));
+    }
+}
+
+void CWallet::RebuildOrderedTxItems()
+{
+    AssertLockHeld(cs_wallet);
+    wtxOrdered.clear();
+    mapAccountOrdered.clear();
+    for (std::map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        wtxOrdered.insert(make_pair(it->second.nOrderPos, TxPair(&it->second, (CAccountingEntry *) 0)));
+    BOOST_FOREACH(CAccountingEntry& entry, laccentries)
+        wtxOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx *) 0, &entry)));
+}
+
+const CWallet::TxItems& CWallet::GetAccountOrderedTxItems(const std::string& strAccount)
+{
+    AssertLockHeld(cs_wallet);
+    std::map<std::string, TxItems>::iterator it = mapAccountOrdered.find(strAccount);
+    if (it != mapAccountOrdered.end())
+        return it->second;
+
+    TxItems& txItems = mapAccountOrdered[strAccount];
+    for (TxItems::const_iterator itOrdered = wtxOrdered.begin(); itOrdered != wtxOrdered.end(); ++itOrdered) {
+        if (IsAccountTxItem(*this, itOrdered->second, strAccount))
+            txItems.insert(txItems.end(), *itOrdered);
+    }
+    return txItems;
+}
+
 bool CWallet::AccountMove(std::string strFrom, std::string strTo, CAmount nAmount, std::string strComment) {
     CWalletDB walletdb(strWalletFile);
     if (!walletdb.TxnBegin())
@@ -857,9 +1016,20 @@ void CWallet::MarkDirty() {
         BOOST_FOREACH(PAIRTYPE(
         const uint256, CWalletTx)&item, mapWallet)
         item.second.MarkDirty();
+        // Ownership may have changed for any transaction, e.g. after a key import
+        fBalanceRescan = true;
+        fUTXORescan = true;
     }
 }
 
+void CWallet::MarkBalanceDirty(const uint256& hash) const {
+    LOCK(cs_wallet);
+    if (!fBalanceRescan)
+        setBalanceDirty.insert(hash);
+    if (!fUTXORescan)
+        setUTXODirty.insert(hash);
+}
+
 bool CWallet::AddToWallet(const CWalletTx &wtxIn, bool fFromLoadWallet, CWalletDB *pwalletdb) {
     LogPrint("selectcoins", "CWallet::AddToWallet\n");
     uint256 hash = wtxIn.GetHash();
@@ -869,7 +1039,7 @@ bool CWallet::AddToWallet(const CWalletTx &wtxIn, bool fFromLoadWallet, CWalletD
         CWalletTx &wtx = mapWallet[hash];
         wtx.BindWallet(this);
 //        if (!wtx.IsZerocoinSpend()) {
-        wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry *) 0)));
+        AddToOrderedTxItems(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry *) 0));
         AddToSpends(hash);
 //            BOOST_FOREACH(const CTxIn &txin, wtx.vin) {
 //                LogPrintf("txin.prevout.hash=%s\n", txin.prevout.hash.ToString());
@@ -893,7 +1063,7 @@ bool CWallet::AddToWallet(const CWalletTx &wtxIn, bool fFromLoadWallet, CWalletD
         if (fInsertedNew) {
             wtx.nTimeReceived = GetAdjustedTime();
             wtx.nOrderPos = IncOrderPosNext(pwalletdb);
-            wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry *) 0)));
+            AddToOrderedTxItems(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry *) 0));
             wtx.nTimeSmart = wtx.nTimeReceived;
             if (!wtxIn.hashUnset()) {
                 if (mapBlockIndex.count(wtxIn.hashBlock)) {
@@ -1192,6 +1362,8 @@ CAmount CWallet::GetDebit(const CTxIn &txin, const isminefilter &filter) const {
 }
 
 isminetype CWallet::IsMine(const CTxOut &txout) const {
+    if (!MaybeMine(txout.scriptPubKey))
+        return ISMINE_NO;
     return ::IsMine(*this, txout.scriptPubKey);
 }
 
@@ -1504,12 +1676,38 @@ bool CWalletTx::WriteToDisk(CWalletDB *pwalletdb)
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
  */
+/** Blocks read and scanned at a time by a rescan */
+static const size_t RESCAN_BATCH_BLOCKS = 100;
+/** Threads reading the next batch of blocks during a rescan */
+static const int RESCAN_READ_THREADS = 4;
+
+/** Read a batch of blocks, split over a few threads */
+static void ReadRescanBlocks(const std::vector<std::pair<CBlockIndex*, CDiskBlockPos> >& vBatch, std::vector<CBlock>& vBlocks)
+{
+    vBlocks.assign(vBatch.size(), CBlock());
+    int nThreads = std::max(1, std::min(GetNumCores(), RESCAN_READ_THREADS));
+    boost::thread_group readers;
+    for (int n = 0; n < nThreads; n++) {
+        readers.create_thread([&vBatch, &vBlocks, n, nThreads] {
+            for (size_t i = n; i < vBatch.size(); i += nThreads) {
+                CBlock& block = vBlocks[i];
+                if (vBatch[i].second.IsNull() ||
+                    !ReadBlockFromDisk(block, vBatch[i].second, Params().GetConsensus()) ||
+                    block.GetHash() != vBatch[i].first->GetBlockHash())
+                    block.SetNull();
+            }
+        });
+    }
+    readers.join_all();
+}
+
 int CWallet::ScanForWalletTransactions(CBlockIndex *pindexStart, bool fUpdate) {
     int ret = 0;
     int64_t nNow = GetTime();
     const CChainParams &chainParams = Params();
 
     CBlockIndex *pindex = pindexStart;
+    double dProgressStart, dProgressTip;
     {
         LOCK2(cs_main, cs_wallet);
 
@@ -1518,35 +1716,73 @@ int CWallet::ScanForWalletTransactions(CBlockIndex *pindexStart, bool fUpdate) {
         while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)))
             pindex = chainActive.Next(pindex);
 
-        ShowProgress(_("Rescanning..."),
-                     0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(),
-                                                                     false);
-        while (pindex) {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99,
-                                                                      (int) ((Checkpoints::GuessVerificationProgress(
-                                                                              chainParams.Checkpoints(), pindex,
-                                                                              false) - dProgressStart) /
-                                                                             (dProgressTip - dProgressStart) * 100))));
-
-            CBlock block;
-            ReadBlockFromDisk(block, pindex, Params().GetConsensus());
-            BOOST_FOREACH(CTransaction & tx, block.vtx)
-            {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
-                    ret++;
-            }
-            pindex = chainActive.Next(pindex);
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight,
-                          Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+        dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
+    }
+    ShowProgress(_("Rescanning..."),
+                 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
+
+    // The next batch of blocks is read from disk while the current one is
+    // scanned, and the locks are only taken once per batch
+    std::vector<std::pair<CBlockIndex*, CDiskBlockPos> > vBatch, vNextBatch;
+    std::vector<CBlock> vBlocks, vNextBlocks;
+    boost::thread prefetch;
+    while (pindex || !vNextBatch.empty()) {
+        if (prefetch.joinable())
+            prefetch.join();
+        vBatch.swap(vNextBatch);
+        vBlocks.swap(vNextBlocks);
+        vNextBatch.clear();
+
+        {
+            LOCK(cs_main);
+            // Continue from the fork point should the chain have been reorganized meanwhile
+            if (pindex && !chainActive.Contains(pindex))
+                pindex = chainActive.Next(chainActive.FindFork(pindex));
+            for (; pindex && vNextBatch.size() < RESCAN_BATCH_BLOCKS; pindex = chainActive.Next(pindex))
+                vNextBatch.push_back(std::make_pair(pindex, (pindex->nStatus & BLOCK_HAVE_DATA) ? pindex->GetBlockPos() : CDiskBlockPos()));
+        }
+        if (!vNextBatch.empty())
+            prefetch = boost::thread(boost::bind(&ReadRescanBlocks, boost::cref(vNextBatch), boost::ref(vNextBlocks)));
+        if (vBatch.empty())
+            continue;
+
+        {
+            LOCK2(cs_main, cs_wallet);
+            CDBBatchScope batch(strWalletFile);
+            for (size_t i = 0; i < vBatch.size(); i++) {
+                const CBlockIndex* pindexBlock = vBatch[i].first;
+                if (!chainActive.Contains(pindexBlock))
+                    continue;
+                const CBlock& block = vBlocks[i];
+                BOOST_FOREACH(const CTransaction& tx, block.vtx)
+                {
+                    // Transactions neither paying to nor spending from us are skipped cheaply
+                    bool fCandidate = mapWallet.count(tx.GetHash()) != 0;
+                    for (unsigned int n = 0; n < tx.vout.size() && !fCandidate; n++)
+                        fCandidate = MaybeMine(tx.vout[n].scriptPubKey);
+                    for (unsigned int n = 0; n < tx.vin.size() && !fCandidate; n++)
+                        fCandidate = mapWallet.count(tx.vin[n].prevout.hash) != 0;
+                    if (fCandidate && AddToWalletIfInvolvingMe(tx, &block, fUpdate))
+                        ret++;
+                }
             }
         }
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+
+        CBlockIndex* pindexLast = vBatch.back().first;
+        if (dProgressTip - dProgressStart > 0.0)
+            ShowProgress(_("Rescanning..."), std::max(1, std::min(99,
+                                                                  (int) ((Checkpoints::GuessVerificationProgress(
+                                                                          chainParams.Checkpoints(), pindexLast,
+                                                                          false) - dProgressStart) /
+                                                                         (dProgressTip - dProgressStart) * 100))));
+        if (GetTime() >= nNow + 60) {
+            nNow = GetTime();
+            LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindexLast->nHeight,
+                      Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindexLast));
+        }
     }
+    ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     return ret;
 }
 
@@ -1622,22 +1858,16 @@ CAmount CWalletTx::GetDebit(const isminefilter &filter) const {
 
     CAmount debit = 0;
     if (filter & ISMINE_SPENDABLE) {
-        if (fDebitCached)
-            debit += nDebitCached;
-        else {
-            nDebitCached = pwallet->GetDebit(*this, ISMINE_SPENDABLE);
-            fDebitCached = true;
-            debit += nDebitCached;
-        }
+        if (amountCache.IsCached(CWalletTxCache::DEBIT))
+            debit += amountCache.Get(CWalletTxCache::DEBIT);
+        else
+            debit += amountCache.Set(CWalletTxCache::DEBIT, pwallet->GetDebit(*this, ISMINE_SPENDABLE));
     }
     if (filter & ISMINE_WATCH_ONLY) {
-        if (fWatchDebitCached)
-            debit += nWatchDebitCached;
-        else {
-            nWatchDebitCached = pwallet->GetDebit(*this, ISMINE_WATCH_ONLY);
-            fWatchDebitCached = true;
-            debit += nWatchDebitCached;
-        }
+        if (amountCache.IsCached(CWalletTxCache::WATCH_DEBIT))
+            debit += amountCache.Get(CWalletTxCache::WATCH_DEBIT);
+        else
+            debit += amountCache.Set(CWalletTxCache::WATCH_DEBIT, pwallet->GetDebit(*this, ISMINE_WATCH_ONLY));
     }
     return debit;
 }
@@ -1650,38 +1880,37 @@ CAmount CWalletTx::GetCredit(const isminefilter &filter) const {
     int64_t credit = 0;
     if (filter & ISMINE_SPENDABLE) {
         // GetBalance can assume transactions in mapWallet won't change
-        if (fCreditCached)
-            credit += nCreditCached;
-        else {
-            nCreditCached = pwallet->GetCredit(*this, ISMINE_SPENDABLE);
-            fCreditCached = true;
-            credit += nCreditCached;
-        }
+        if (amountCache.IsCached(CWalletTxCache::CREDIT))
+            credit += amountCache.Get(CWalletTxCache::CREDIT);
+        else
+            credit += amountCache.Set(CWalletTxCache::CREDIT, pwallet->GetCredit(*this, ISMINE_SPENDABLE));
     }
     if (filter & ISMINE_WATCH_ONLY) {
-        if (fWatchCreditCached)
-            credit += nWatchCreditCached;
-        else {
-            nWatchCreditCached = pwallet->GetCredit(*this, ISMINE_WATCH_ONLY);
-            fWatchCreditCached = true;
-            credit += nWatchCreditCached;
-        }
+        if (amountCache.IsCached(CWalletTxCache::WATCH_CREDIT))
+            credit += amountCache.Get(CWalletTxCache::WATCH_CREDIT);
+        else
+            credit += amountCache.Set(CWalletTxCache::WATCH_CREDIT, pwallet->GetCredit(*this, ISMINE_WATCH_ONLY));
     }
     return credit;
 }
 
 CAmount CWalletTx::GetImmatureCredit(bool fUseCache) const {
     if (IsCoinBase() && GetBlocksToMaturity() > 0 && IsInMainChain()) {
-        if (fUseCache && fImmatureCreditCached)
-            return nImmatureCreditCached;
-        nImmatureCreditCached = pwallet->GetCredit(*this, ISMINE_SPENDABLE);
-        fImmatureCreditCached = true;
-        return nImmatureCreditCached;
+        if (fUseCache && amountCache.IsCached(CWalletTxCache::IMMATURE_CREDIT))
+            return amountCache.Get(CWalletTxCache::IMMATURE_CREDIT);
+        return amountCache.Set(CWalletTxCache::IMMATURE_CREDIT, pwallet->GetCredit(*this, ISMINE_SPENDABLE));
     }
 
     return 0;
 }
 
+void CWalletTx::MarkDirty()
+{
+    amountCache.Clear();
+    if (pwallet)
+        pwallet->MarkBalanceDirty(GetHash());
+}
+
 CAmount CWalletTx::GetAvailableCredit(bool fUseCache) const {
     if (pwallet == 0)
         return 0;
@@ -1690,8 +1919,8 @@ CAmount CWalletTx::GetAvailableCredit(bool fUseCache) const {
     if (IsCoinBase() && GetBlocksToMaturity() > 0)
         return 0;
 
-    if (fUseCache && fAvailableCreditCached)
-        return nAvailableCreditCached;
+    if (fUseCache && amountCache.IsCached(CWalletTxCache::AVAILABLE_CREDIT))
+        return amountCache.Get(CWalletTxCache::AVAILABLE_CREDIT);
 
     CAmount nCredit = 0;
     uint256 hashTx = GetHash();
@@ -1704,18 +1933,14 @@ CAmount CWalletTx::GetAvailableCredit(bool fUseCache) const {
         }
     }
 
-    nAvailableCreditCached = nCredit;
-    fAvailableCreditCached = true;
-    return nCredit;
+    return amountCache.Set(CWalletTxCache::AVAILABLE_CREDIT, nCredit);
 }
 
 CAmount CWalletTx::GetImmatureWatchOnlyCredit(const bool &fUseCache) const {
     if (IsCoinBase() && GetBlocksToMaturity() > 0 && IsInMainChain()) {
-        if (fUseCache && fImmatureWatchCreditCached)
-            return nImmatureWatchCreditCached;
-        nImmatureWatchCreditCached = pwallet->GetCredit(*this, ISMINE_WATCH_ONLY);
-        fImmatureWatchCreditCached = true;
-        return nImmatureWatchCreditCached;
+        if (fUseCache && amountCache.IsCached(CWalletTxCache::IMMATURE_WATCH_CREDIT))
+            return amountCache.Get(CWalletTxCache::IMMATURE_WATCH_CREDIT);
+        return amountCache.Set(CWalletTxCache::IMMATURE_WATCH_CREDIT, pwallet->GetCredit(*this, ISMINE_WATCH_ONLY));
     }
 
     return 0;
@@ -1729,8 +1954,8 @@ CAmount CWalletTx::GetAvailableWatchOnlyCredit(const bool &fUseCache) const {
     if (IsCoinBase() && GetBlocksToMaturity() > 0)
         return 0;
 
-    if (fUseCache && fAvailableWatchCreditCached)
-        return nAvailableWatchCreditCached;
+    if (fUseCache && amountCache.IsCached(CWalletTxCache::AVAILABLE_WATCH_CREDIT))
+        return amountCache.Get(CWalletTxCache::AVAILABLE_WATCH_CREDIT);
 
     CAmount nCredit = 0;
     for (unsigned int i = 0; i < vout.size(); i++) {
@@ -1742,17 +1967,13 @@ CAmount CWalletTx::GetAvailableWatchOnlyCredit(const bool &fUseCache) const {
         }
     }
 
-    nAvailableWatchCreditCached = nCredit;
-    fAvailableWatchCreditCached = true;
-    return nCredit;
+    return amountCache.Set(CWalletTxCache::AVAILABLE_WATCH_CREDIT, nCredit);
 }
 
 CAmount CWalletTx::GetChange() const {
-    if (fChangeCached)
-        return nChangeCached;
-    nChangeCached = pwallet->GetChange(*this);
-    fChangeCached = true;
-    return nChangeCached;
+    if (amountCache.IsCached(CWalletTxCache::CHANGE))
+        return amountCache.Get(CWalletTxCache::CHANGE);
+    return amountCache.Set(CWalletTxCache::CHANGE, pwallet->GetChange(*this));
 }
 
 bool CWalletTx::InMempool() const {
@@ -1860,18 +2081,68 @@ void CWallet::ResendWalletTransactions(int64_t nBestBlockTime, CConnman* connman
  */
 
 
-CAmount CWallet::GetBalance() const {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx *pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableCredit();
-        }
+void CWallet::UpdateBalanceShare(const uint256& hash) const {
+    std::map<uint256, CWalletBalances>::iterator itShare = mapBalanceShares.find(hash);
+    if (itShare != mapBalanceShares.end()) {
+        balancesCached -= itShare->second;
+        mapBalanceShares.erase(itShare);
     }
+    setBalanceVolatile.erase(hash);
 
-    return nTotal;
+    map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+    if (it == mapWallet.end())
+        return;
+    const CWalletTx *pcoin = &(*it).second;
+
+    CWalletBalances share;
+    int nDepth = pcoin->GetDepthInMainChain();
+    if (pcoin->IsTrusted()) {
+        share.nTrusted = pcoin->GetAvailableCredit();
+        share.nWatchTrusted = pcoin->GetAvailableWatchOnlyCredit();
+    } else if (nDepth == 0 && pcoin->InMempool()) {
+        share.nUntrustedPending = pcoin->GetAvailableCredit();
+        share.nWatchUntrustedPending = pcoin->GetAvailableWatchOnlyCredit();
+    }
+    share.nImmature = pcoin->GetImmatureCredit();
+    share.nWatchImmature = pcoin->GetImmatureWatchOnlyCredit();
+
+    // Depth, maturity and mempool membership of these change without the
+    // wallet being told about it
+    if (nDepth < 1 || (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0))
+        setBalanceVolatile.insert(hash);
+
+    if (!share.IsNull()) {
+        balancesCached += share;
+        mapBalanceShares.insert(make_pair(hash, share));
+    }
+}
+
+const CWalletBalances& CWallet::GetBalances() const {
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    if (fBalanceRescan) {
+        balancesCached = CWalletBalances();
+        mapBalanceShares.clear();
+        setBalanceVolatile.clear();
+        setBalanceDirty.clear();
+        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+            UpdateBalanceShare(it->first);
+        fBalanceRescan = false;
+        return balancesCached;
+    }
+
+    std::set<uint256> setUpdate;
+    setUpdate.swap(setBalanceDirty);
+    setUpdate.insert(setBalanceVolatile.begin(), setBalanceVolatile.end());
+    BOOST_FOREACH(const uint256& hash, setUpdate)
+        UpdateBalanceShare(hash);
+    return balancesCached;
+}
+
+CAmount CWallet::GetBalance() const {
+    LOCK2(cs_main, cs_wallet);
+    return GetBalances().nTrusted;
 }
 
 // CAmount CWallet::GetAnonymizableBalance(bool fSkipDenominated, bool fSkipUnconfirmed) const
@@ -1998,55 +2269,23 @@ CAmount CWallet::GetBalance() const {
 // } 
 
 CAmount CWallet::GetUnconfirmedBalance() const {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx *pcoin = &(*it).second;
-            if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
-                nTotal += pcoin->GetAvailableCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetBalances().nUntrustedPending;
 }
 
 CAmount CWallet::GetImmatureBalance() const {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx *pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetBalances().nImmature;
 }
 
 CAmount CWallet::GetWatchOnlyBalance() const {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx *pcoin = &(*it).second;
-            if (pcoin->IsTrusted())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetBalances().nWatchTrusted;
 }
 
 CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx *pcoin = &(*it).second;
-            if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
-                nTotal += pcoin->GetAvailableWatchOnlyCredit();
-        }
-    }
-    return nTotal;
+    LOCK2(cs_main, cs_wallet);
+    return GetBalances().nWatchUntrustedPending;
 }
 
 // bool CWallet::IsDenominated(const CTxIn &txin) const 
@@ -2090,15 +2329,38 @@ CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const {
 // } 
 
 CAmount CWallet::GetImmatureWatchOnlyBalance() const {
-    CAmount nTotal = 0;
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const CWalletTx *pcoin = &(*it).second;
-            nTotal += pcoin->GetImmatureWatchOnlyCredit();
+    LOCK2(cs_main, cs_wallet);
+    return GetBalances().nWatchImmature;
+}
+
+void CWallet::UpdateUTXOIndex() const {
+    AssertLockHeld(cs_wallet);
+
+    std::set<uint256> setUpdate;
+    if (fUTXORescan) {
+        setWalletUTXO.clear();
+        setUTXODirty.clear();
+        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+            setUpdate.insert(it->first);
+        fUTXORescan = false;
+    } else {
+        setUpdate.swap(setUTXODirty);
+    }
+
+    BOOST_FOREACH(const uint256& hash, setUpdate) {
+        map<uint256, CWalletTx>::const_iterator it = mapWallet.find(hash);
+        if (it == mapWallet.end()) {
+            std::set<COutPoint>::iterator itUTXO = setWalletUTXO.lower_bound(COutPoint(hash, 0));
+            while (itUTXO != setWalletUTXO.end() && itUTXO->hash == hash)
+                setWalletUTXO.erase(itUTXO++);
+            continue;
+        }
+        const CWalletTx *pcoin = &(*it).second;
+        for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
+            if (IsMine(pcoin->vout[i]) != ISMINE_NO)
+                setWalletUTXO.insert(COutPoint(hash, i));
         }
     }
-    return nTotal;
 }
 
 void CWallet::AvailableCoins(vector <COutput> &vCoins, bool fOnlyConfirmed, const CCoinControl *coinControl,
@@ -2107,30 +2369,48 @@ void CWallet::AvailableCoins(vector <COutput> &vCoins, bool fOnlyConfirmed, cons
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
-            const uint256 &wtxid = it->first;
-            const CWalletTx *pcoin = &(*it).second;
+        UpdateUTXOIndex();
 
-            if (!CheckFinalTx(*pcoin))
-                continue;
+        std::set<COutPoint>::iterator itUTXO = setWalletUTXO.begin();
+        while (itUTXO != setWalletUTXO.end()) {
+            const uint256 wtxid = itUTXO->hash;
+            map<uint256, CWalletTx>::const_iterator it = mapWallet.find(wtxid);
+            const CWalletTx *pcoin = it != mapWallet.end() ? &(*it).second : NULL;
 
-            if (fOnlyConfirmed && !pcoin->IsTrusted())
-                continue;
+            // Checks on the transaction itself are done once for all its outputs
+            bool fSkip = pcoin == NULL;
 
-            if (pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
-                continue;
+            if (!fSkip && !CheckFinalTx(*pcoin))
+                fSkip = true;
+
+            if (!fSkip && fOnlyConfirmed && !pcoin->IsTrusted())
+                fSkip = true;
+
+            if (!fSkip && pcoin->IsCoinBase() && pcoin->GetBlocksToMaturity() > 0)
+                fSkip = true;
 
-            int nDepth = pcoin->GetDepthInMainChain(false);
+            int nDepth = fSkip ? 0 : pcoin->GetDepthInMainChain(false);
             // do not use IX for inputs that have less then INSTANTSEND_CONFIRMATIONS_REQUIRED blockchain confirmations
             if (fUseInstantSend && nDepth < INSTANTSEND_CONFIRMATIONS_REQUIRED)
-                continue;
+                fSkip = true;
 
             // We should not consider coins which aren't at least in our mempool
             // It's possible for these to be conflicted via ancestors which we may never be able to detect
-            if (nDepth == 0 && !pcoin->InMempool())
-                continue;
+            if (!fSkip && nDepth == 0 && !pcoin->InMempool())
+                fSkip = true;
+
+            while (itUTXO != setWalletUTXO.end() && itUTXO->hash == wtxid) {
+                unsigned int i = itUTXO->n;
+                // Forget outputs that have been spent, they come back through
+                // MarkBalanceDirty() should the spend be abandoned or disconnected
+                if (pcoin == NULL || IsSpent(wtxid, i)) {
+                    setWalletUTXO.erase(itUTXO++);
+                    continue;
+                }
+                ++itUTXO;
+                if (fSkip)
+                    continue;
 
-            for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
                 bool found = false;
                 if(nCoinType == ONLY_DENOMINATED) {
                     //found = CPrivateSend::IsDenominatedAmount(pcoin->vout[i].nValue);
@@ -2147,10 +2427,10 @@ void CWallet::AvailableCoins(vector <COutput> &vCoins, bool fOnlyConfirmed, cons
                 if(!found) continue;
 
                 isminetype mine = IsMine(pcoin->vout[i]);
-                if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
-                    (!IsLockedCoin((*it).first, i) || nCoinType == ONLY_10000) &&
+                if (mine != ISMINE_NO &&
+                    (!IsLockedCoin(wtxid, i) || nCoinType == ONLY_10000) &&
                     (pcoin->vout[i].nValue > 0 || fIncludeZeroValue) &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected(COutPoint((*it).first, i))))
+                    (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected(COutPoint(wtxid, i))))
                         vCoins.push_back(COutput(pcoin, i, nDepth,
                                                  ((mine & ISMINE_SPENDABLE) != ISMINE_NO) ||
                                                   (coinControl && coinControl->fAllowWatchOnly && (mine & ISMINE_WATCH_SOLVABLE) != ISMINE_NO),
@@ -2159,18 +2439,15 @@ void CWallet::AvailableCoins(vector <COutput> &vCoins, bool fOnlyConfirmed, cons
             }
         }
     }
-}
- 
+} 
  
 bool CWallet::SelectCoinsDark(CAmount nValueMin, CAmount nValueMax, std::vector<CTxIn>& vecTxInRet, CAmount& nValueRet, int nPrivateSendRoundsMin, int nPrivateSendRoundsMax) const 
 { 
-    //CCoinControl *coinControl=NULL; 
- 
     vecTxInRet.clear(); 
     nValueRet = 0; 
  
     vector<COutput> vCoins; 
-    //AvailableCoins(vCoins, true, coinControl, false, nPrivateSendRoundsMin < 0 ? ONLY_NONDENOMINATED_NOT1000IFMN : ONLY_DENOMINATED);
+    AvailableCoins(vCoins, true, NULL, false, nPrivateSendRoundsMin < 0 ? ONLY_NONDENOMINATED : ONLY_DENOMINATED);
  
     //order the array so largest nondenom are first, then denominations, then very small inputs. 
 //    sort(vCoins.rbegin(), vCoins.rend(), CompareByPriority()); 
@@ -2316,6 +2593,69 @@ static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,uns
     }
 }
 
+/**
+ * Depth first search for the subset with the least value in
+ * [nTargetValue, nTargetValue + nCostOfChange], i.e. one that needs no change
+ * output. vValue must be sorted by descending value. Branches that overshoot
+ * the window or cannot reach the target with the remaining coins are cut off.
+ */
+static bool SelectCoinsBnB(const vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >& vValue, const CAmount& nTargetValue,
+                           const CAmount& nCostOfChange, vector<char>& vfBest, CAmount& nBest)
+{
+    static const int BNB_MAX_TRIES = 100000;
+
+    CAmount nRemaining = 0;
+    for (unsigned int i = 0; i < vValue.size(); i++)
+        nRemaining += vValue[i].first;
+    if (nRemaining < nTargetValue)
+        return false;
+
+    // vfIncluded holds the decisions taken so far, nRemaining the value of the coins not decided on yet
+    vector<char> vfIncluded;
+    CAmount nTotal = 0;
+    bool fFound = false;
+    nBest = std::numeric_limits<CAmount>::max();
+
+    for (int nTries = 0; nTries < BNB_MAX_TRIES; nTries++)
+    {
+        bool fBacktrack = false;
+        if (nTotal + nRemaining < nTargetValue || nTotal > nTargetValue + nCostOfChange) {
+            fBacktrack = true;
+        } else if (nTotal >= nTargetValue) {
+            if (nTotal < nBest) {
+                nBest = nTotal;
+                vfBest = vfIncluded;
+                fFound = true;
+                if (nBest == nTargetValue)
+                    break;
+            }
+            // Adding more coins only adds to the excess
+            fBacktrack = true;
+        }
+
+        if (fBacktrack) {
+            // Undo the trailing exclusions, then exclude the last included coin instead
+            while (!vfIncluded.empty() && !vfIncluded.back()) {
+                vfIncluded.pop_back();
+                nRemaining += vValue[vfIncluded.size()].first;
+            }
+            if (vfIncluded.empty())
+                break;
+            vfIncluded.back() = false;
+            nTotal -= vValue[vfIncluded.size() - 1].first;
+        } else {
+            const CAmount nValue = vValue[vfIncluded.size()].first;
+            nRemaining -= nValue;
+            nTotal += nValue;
+            vfIncluded.push_back(true);
+        }
+    }
+
+    if (fFound)
+        vfBest.resize(vValue.size(), false);
+    return fFound;
+}
+
 bool less_then_denom (const COutput& out1, const COutput& out2)
 {
     // const CWalletTx *pcoin1 = out1.tx;
@@ -2332,10 +2672,10 @@ bool less_then_denom (const COutput& out1, const COutput& out2)
     return false;
 }
 
-bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, const uint64_t nMaxAncestors, vector<COutput> vCoins,
+bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, const uint64_t nMaxAncestors, const vector<COutput>& vCoinsIn,
                                  set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, bool fUseInstantSend) const
 {
-        setCoinsRet.clear();
+    setCoinsRet.clear();
     nValueRet = 0;
 
     // List of values less than target
@@ -2347,10 +2687,16 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
     vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > > vValue;
     CAmount nTotalLower = 0;
 
-    random_shuffle(vCoins.begin(), vCoins.end(), GetRandInt);
+    // Only coins deep enough are shuffled, not the whole wallet
+    vector<const COutput*> vCoins;
+    vCoins.reserve(vCoinsIn.size());
+    BOOST_FOREACH(const COutput &output, vCoinsIn)
+    {
+        if (output.fSpendable && output.nDepth >= (output.tx->IsFromMe(ISMINE_ALL) ? nConfMine : nConfTheirs))
+            vCoins.push_back(&output);
+    }
 
-    // move denoms down on the list
-    sort(vCoins.begin(), vCoins.end(), less_then_denom);
+    random_shuffle(vCoins.begin(), vCoins.end(), GetRandInt);
 
     // try to find nondenom first to prevent unneeded spending of mixed coins
     for (unsigned int tryDenom = 0; tryDenom < 2; tryDenom++)
@@ -2358,17 +2704,11 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
         LogPrint("selectcoins", "tryDenom: %d\n", tryDenom);
         vValue.clear();
         nTotalLower = 0;
-        BOOST_FOREACH(const COutput &output, vCoins)
+        BOOST_FOREACH(const COutput *poutput, vCoins)
         {
-            if (!output.fSpendable)
-                continue;
-
+            const COutput &output = *poutput;
             const CWalletTx *pcoin = output.tx;
 
-//            if (fDebug) LogPrint("selectcoins", "value %s confirms %d\n", FormatMoney(pcoin->vout[output.i].nValue), output.nDepth);
-            if (output.nDepth < (pcoin->IsFromMe(ISMINE_ALL) ? nConfMine : nConfTheirs))
-                continue;
-
             int i = output.i;
             CAmount n = pcoin->vout[i].nValue;
             //if (tryDenom == 0 && CPrivateSend::IsDenominatedAmount(n)) continue; // we don't want denom values on first run
@@ -2423,19 +2763,38 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
 
     }
 
-    // Solve subset sum by stochastic approximation
     sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
     vector<char> vfBest;
     CAmount nBest;
 
-    ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, fUseInstantSend);
-    if (nBest != nTargetValue && nTotalLower >= nTargetValue + MIN_CHANGE)
-        ApproximateBestSubset(vValue, nTotalLower, nTargetValue + MIN_CHANGE, vfBest, nBest, fUseInstantSend);
+    // First look for a subset that needs no change, leaving out coins that
+    // cost more to spend than they are worth
+    vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > > vValueBnB;
+    vector<size_t> vBnBIndex;
+    const CAmount nInputFee = GetRequiredFee(148);
+    for (unsigned int i = 0; i < vValue.size(); i++) {
+        if (vValue[i].first > nInputFee) {
+            vValueBnB.push_back(vValue[i]);
+            vBnBIndex.push_back(i);
+        }
+    }
+    vector<char> vfBnB;
+    bool fBnB = SelectCoinsBnB(vValueBnB, nTargetValue, GetChangeCost(), vfBnB, nBest);
+    if (fBnB) {
+        vfBest.assign(vValue.size(), false);
+        for (unsigned int i = 0; i < vfBnB.size(); i++)
+            vfBest[vBnBIndex[i]] = vfBnB[i];
+    } else {
+        // Solve subset sum by stochastic approximation
+        ApproximateBestSubset(vValue, nTotalLower, nTargetValue, vfBest, nBest, fUseInstantSend);
+        if (nBest != nTargetValue && nTotalLower >= nTargetValue + MIN_CHANGE)
+            ApproximateBestSubset(vValue, nTotalLower, nTargetValue + MIN_CHANGE, vfBest, nBest, fUseInstantSend);
+    }
 
     // If we have a bigger coin and (either the stochastic approximation didn't find a good solution,
     //                                   or the next bigger coin is closer), return the bigger coin
     if (coinLowestLarger.second.first &&
-        ((nBest != nTargetValue && nBest < nTargetValue + MIN_CHANGE) || coinLowestLarger.first <= nBest))
+        ((!fBnB && nBest != nTargetValue && nBest < nTargetValue + MIN_CHANGE) || coinLowestLarger.first <= nBest))
     {
         setCoinsRet.insert(coinLowestLarger.second);
         nValueRet += coinLowestLarger.first;
@@ -2457,15 +2816,12 @@ bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int
     return true;
 }
 
-bool CWallet::SelectCoins(const CAmount& nTargetValue, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl, AvailableCoinsType nCoinType, bool fUseInstantSend) const
+bool CWallet::SelectCoins(const vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl* coinControl, bool fUseInstantSend) const
 {
-    vector<COutput> vCoins;
-    AvailableCoins(vCoins, true, coinControl, false, nCoinType, fUseInstantSend);
-
     // coin control -> return all selected outputs (we want all selected to go into the transaction for sure)
     if (coinControl && coinControl->HasSelected() && !coinControl->fAllowOtherInputs) {
         BOOST_FOREACH(
-        const COutput &out, vCoins)
+        const COutput &out, vAvailableCoins)
         {
             if (!out.fSpendable)
                 continue;
@@ -2497,14 +2853,16 @@ bool CWallet::SelectCoins(const CAmount& nTargetValue, set<pair<const CWalletTx*
             return false; // TODO: Allow non-wallet inputs
     }
 
-    // remove preset inputs from vCoins
-    for (vector<COutput>::iterator it = vCoins.begin();
-         it != vCoins.end() && coinControl && coinControl->HasSelected();) {
-        if (setPresetCoins.count(make_pair(it->tx, it->i)))
-            it = vCoins.erase(it);
-        else
-            ++it;
+    // remove preset inputs from the coins to select from
+    vector<COutput> vCoinsNotPreset;
+    if (coinControl && coinControl->HasSelected()) {
+        BOOST_FOREACH(const COutput &out, vAvailableCoins)
+        {
+            if (!setPresetCoins.count(make_pair(out.tx, out.i)))
+                vCoinsNotPreset.push_back(out);
+        }
     }
+    const vector<COutput>& vCoins = (coinControl && coinControl->HasSelected()) ? vCoinsNotPreset : vAvailableCoins;
 
     size_t nMaxChainLength = std::min(GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT),
                                       GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT));
@@ -2944,7 +3302,7 @@ bool CWallet::GetBudgetSystemCollateralTX(CWalletTx& tx, uint256 hash, CAmount a
 
 bool CWallet::ConvertList(std::vector<CTxIn> vecTxIn, std::vector<CAmount>& vecAmounts) 
 { 
-    BOOST_FOREACH(CTxIn txin, vecTxIn) { 
+    BOOST_FOREACH(const CTxIn& txin, vecTxIn) { 
         if (mapWallet.count(txin.prevout.hash)) { 
             CWalletTx& wtx = mapWallet[txin.prevout.hash]; 
             if(txin.prevout.n < wtx.vout.size()){ 
@@ -3021,8 +3379,9 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
     {
         LOCK2(cs_main, cs_wallet);
         {
+            // Looked up once, every round of the fee loop below selects from it
             std::vector <COutput> vAvailableCoins;
-            AvailableCoins(vAvailableCoins, true, coinControl);
+            AvailableCoins(vAvailableCoins, true, coinControl, false, nCoinType, fUseInstantSend);
 
             nFeeRet = payTxFee.GetFeePerK();
             // Start with no fee and loop until there is enough fee
@@ -3071,7 +3430,7 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                 // Choose coins to use
                 set <pair<const CWalletTx *, unsigned int>> setCoins;
                 CAmount nValueIn = 0;
-                if (!SelectCoins(nValueToSelect, setCoins, nValueIn, coinControl, nCoinType, fUseInstantSend))
+                if (!SelectCoins(vAvailableCoins, nValueToSelect, setCoins, nValueIn, coinControl, fUseInstantSend))
                 {
                     if (nValueIn < nValueToSelect) {
                         strFailReason = _("Insufficient funds.");
@@ -3156,9 +3515,11 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                         }
                     }
 
-                    // Never create dust outputs; if we would, just
-                    // add the dust to the fee.
-                    if (newTxOut.IsDust(::minRelayTxFee)) {
+                    // Never create dust outputs, nor change that costs more to
+                    // create and spend than it is worth; if we would, just
+                    // add it to the fee.
+                    if (newTxOut.IsDust(::minRelayTxFee) ||
+                        (nSubtractFeeFromAmount == 0 && newTxOut.nValue < GetChangeCost())) {
                         nChangePosInOut = -1;
                         nFeeRet += nChange;
                         reservekey.ReturnKey();
@@ -3291,6 +3652,9 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey, CCon
         LOCK2(cs_main, cs_wallet);
         LogPrintf("CommitTransaction:\n%s", wtxNew.ToString());
         {
+            // The transaction, the spent coins and the used key are written in one go
+            CDBBatchScope batch(strWalletFile);
+
             // This is only to keep the database open to defeat the auto-flush for the
             // duration of this scope.  This is the only place where this optimization
             // maybe makes sense; please don't do it anywhere else.
@@ -3337,14 +3701,33 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey, CCon
     return true;
 }
 
+static void EraseOrderedTxItem(CWallet::TxItems& txItems, const CWalletTx& wtx)
+{
+    std::pair<CWallet::TxItems::iterator, CWallet::TxItems::iterator> range = txItems.equal_range(wtx.nOrderPos);
+    for (CWallet::TxItems::iterator it = range.first; it != range.second; ) {
+        if (it->second.first == &wtx)
+            txItems.erase(it++);
+        else
+            ++it;
+    }
+}
+
 bool CWallet::EraseFromWallet(uint256 hash)
 {
     if (!fFileBacked)
         return false;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
+        std::map<uint256, CWalletTx>::iterator it = mapWallet.find(hash);
+        if (it != mapWallet.end()) {
+            // Drop the ordered index entries before the transaction they point to
+            EraseOrderedTxItem(wtxOrdered, it->second);
+            for (std::map<std::string, TxItems>::iterator mi = mapAccountOrdered.begin(); mi != mapAccountOrdered.end(); ++mi)
+                EraseOrderedTxItem(mi->second, it->second);
+            mapWallet.erase(it);
             CWalletDB(strWalletFile).EraseTx(hash);
+        }
+        MarkBalanceDirty(hash);
     }
     return true;
 }
@@ -3355,7 +3738,7 @@ bool CWallet::AddAccountingEntry(const CAccountingEntry &acentry, CWalletDB &pwa
 
     laccentries.push_back(acentry);
     CAccountingEntry &entry = laccentries.back();
-    wtxOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx *) 0, &entry)));
+    AddToOrderedTxItems(entry.nOrderPos, TxPair((CWalletTx *) 0, &entry));
 
     return true;
 }
@@ -3364,6 +3747,11 @@ CAmount CWallet::GetRequiredFee(unsigned int nTxBytes) {
     return std::max(minTxFee.GetFee(nTxBytes), ::minRelayTxFee.GetFee(nTxBytes));
 }
 
+CAmount CWallet::GetChangeCost() {
+    // A P2PKH output of 34 bytes and the 148 byte input spending it
+    return GetRequiredFee(34 + 148);
+}
+
 CAmount CWallet::GetMinimumFee(unsigned int nTxBytes, unsigned int nConfirmTarget, const CTxMemPool &pool) {
     // payTxFee is user-set "I want to pay this much"
     CAmount nFeeNeeded = payTxFee.GetFee(nTxBytes);
@@ -3404,17 +3792,6 @@ DBErrors CWallet::LoadWallet(bool& fFirstRunRet)
         }
     }
 
-    {
-        LOCK2(cs_main, cs_wallet);
-        for (auto& pair : mapWallet) {
-            for(unsigned int i = 0; i < pair.second.vout.size(); ++i) {
-                if (IsMine(pair.second.vout[i]) && !IsSpent(pair.first, i)) {
-                    setWalletUTXO.insert(COutPoint(pair.first, i));
-                }
-            }
-        }
-    }
-
     if (nLoadWalletRet != DB_LOAD_OK)
         return nLoadWalletRet;
     fFirstRunRet = !vchDefaultKey.IsValid();
@@ -3456,6 +3833,8 @@ bool CWallet::SetAddressBook(const CTxDestination &address, const string &strNam
         mapAddressBook[address].name = strName;
         if (!strPurpose.empty()) /* update purpose only if requested */
             mapAddressBook[address].purpose = strPurpose;
+        // A new label can move transactions between accounts
+        mapAccountOrdered.clear();
     }
     NotifyAddressBookChanged(this, address, strName, ::IsMine(*this, address) != ISMINE_NO,
                              strPurpose, (fUpdated ? CT_UPDATED : CT_NEW));
@@ -3480,6 +3859,7 @@ bool CWallet::DelAddressBook(const CTxDestination &address) {
             }
         }
         mapAddressBook.erase(address);
+        mapAccountOrdered.clear();
     }
 
     NotifyAddressBookChanged(this, address, "", ::IsMine(*this, address) != ISMINE_NO, "", CT_DELETED);
@@ -3507,6 +3887,7 @@ bool CWallet::NewKeyPool()
 {
     {
         LOCK(cs_wallet);
+        CDBBatchScope batch(strWalletFile);
         CWalletDB walletdb(strWalletFile);
         BOOST_FOREACH(int64_t nIndex, setInternalKeyPool) {
             walletdb.ErasePool(nIndex);
@@ -3568,7 +3949,13 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize) {
             nTargetSize *= 2;
         }
         bool fInternal = false;
+        // The keys, their metadata and the pool entries are written in one go
+        CDBBatchScope batch(strWalletFile);
         CWalletDB walletdb(strWalletFile);
+        // TODO: implement keypools for all accounts?
+        std::vector<CPubKey> vExternalKeys, vInternalKeys;
+        GenerateNewKeys(vExternalKeys, missingExternal, 0, false);
+        GenerateNewKeys(vInternalKeys, missingInternal, 0, true);
         for (int64_t i = missingInternal + missingExternal; i--;)
         {
             int64_t nEnd = 1;
@@ -3581,8 +3968,8 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize) {
             if (!setExternalKeyPool.empty()) {
                 nEnd = std::max(nEnd, *(--setExternalKeyPool.end()) + 1);
             }
-            // TODO: implement keypools for all accounts?
-            if (!walletdb.WritePool(nEnd, CKeyPool(GenerateNewKey(0, fInternal), fInternal)))
+            const CPubKey& pubkey = fInternal ? vInternalKeys[missingInternal - 1 - i] : vExternalKeys[missingInternal + missingExternal - 1 - i];
+            if (!walletdb.WritePool(nEnd, CKeyPool(pubkey, fInternal)))
                 throw runtime_error("TopUpKeyPool(): writing generated key failed");
 
             if (fInternal) {
@@ -4173,6 +4560,7 @@ void ReIndexZerocoin(std::string strWalletFile) {
     //btzc: add zercoin wallet init
     // Zerocoin reorg, calculate new height and id
     list <CZerocoinEntry> listPubCoin = list<CZerocoinEntry>();
+    CDBBatchScope batch(strWalletFile);
     CWalletDB walletdb(strWalletFile);
     int lastCalculatedZCBlock = 0;
     walletdb.ReadCalculatedZCBlock(lastCalculatedZCBlock);
@@ -4258,7 +4646,7 @@ void ReIndexZerocoin(std::string strWalletFile) {
                     walletdbInLoop.ListPubCoin(listPubCoinInLoop);
                     BOOST_FOREACH(const CTransaction &tx, blockRecur.vtx){
                         // Check Mint Zerocoin Transaction
-                        BOOST_FOREACH(const CTxOut txout, tx.vout) {
+                        BOOST_FOREACH(const CTxOut& txout, tx.vout) {
                             if (!txout.scriptPubKey.empty() && txout.scriptPubKey.IsZerocoinMint()) {
                                 vector<unsigned char> vchZeroMint;
                                 vchZeroMint.insert(vchZeroMint.end(), txout.scriptPubKey.begin() + 6,
@@ -8,6 +8,7 @@
 
 #include "amount.h"
 #include "../base58.h"
+#include "crypto/common.h"
 #include "../libzerocoin/bitcoin_bignum/bignum.h"
 #include "streams.h"
 #include "tinyformat.h"
@@ -25,6 +26,7 @@
 #include <stdexcept>
 #include <stdint.h>
 #include <string>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -78,6 +80,73 @@ class CScript;
 class CTxMemPool;
 class CWalletTx;
 
+/** What a transaction, or the whole wallet, adds to each balance shown to the user */
+struct CWalletBalances
+{
+    CAmount nTrusted;
+    CAmount nUntrustedPending;
+    CAmount nImmature;
+    CAmount nWatchTrusted;
+    CAmount nWatchUntrustedPending;
+    CAmount nWatchImmature;
+
+    CWalletBalances() : nTrusted(0), nUntrustedPending(0), nImmature(0),
+                        nWatchTrusted(0), nWatchUntrustedPending(0), nWatchImmature(0) {}
+
+    bool IsNull() const
+    {
+        return !nTrusted && !nUntrustedPending && !nImmature &&
+               !nWatchTrusted && !nWatchUntrustedPending && !nWatchImmature;
+    }
+
+    CWalletBalances& operator+=(const CWalletBalances& b)
+    {
+        nTrusted += b.nTrusted;
+        nUntrustedPending += b.nUntrustedPending;
+        nImmature += b.nImmature;
+        nWatchTrusted += b.nWatchTrusted;
+        nWatchUntrustedPending += b.nWatchUntrustedPending;
+        nWatchImmature += b.nWatchImmature;
+        return *this;
+    }
+
+    CWalletBalances& operator-=(const CWalletBalances& b)
+    {
+        nTrusted -= b.nTrusted;
+        nUntrustedPending -= b.nUntrustedPending;
+        nImmature -= b.nImmature;
+        nWatchTrusted -= b.nWatchTrusted;
+        nWatchUntrustedPending -= b.nWatchUntrustedPending;
+        nWatchImmature -= b.nWatchImmature;
+        return *this;
+    }
+};
+
+/**
+ * Key and script hashes and watch-only scripts of a wallet, kept up to date as
+ * they are added, so most outputs paying someone else are ruled out with one
+ * lookup instead of going through IsMine(). Only the common P2PKH and P2SH
+ * forms are ruled out, anything else may be ours.
+ */
+class CWalletScriptFilter
+{
+private:
+    struct HashHasher
+    {
+        size_t operator()(const uint160& hash) const { return ReadLE64(hash.begin()); }
+    };
+
+    std::unordered_set<uint160, HashHasher> setHashes;
+    std::set<CScript> setWatchOnly;
+
+public:
+    void AddHash(const uint160& hash) { setHashes.insert(hash); }
+    void AddWatchOnly(const CScript& script) { setWatchOnly.insert(script); }
+    void RemoveWatchOnly(const CScript& script) { setWatchOnly.erase(script); }
+
+    bool MaybeMine(const CScript& script) const;
+};
+
 /** (client) version numbers for particular wallet features */
 enum WalletFeature
 {
@@ -267,6 +336,46 @@ public:
  * A transaction with a bunch of additional info that only the owner cares about.
  * It includes any unrecorded transactions needed to link it back to the block chain.
  */
+/**
+ * Amounts of a wallet transaction that are computed on first use. They are
+ * kept in one array with a bit per amount instead of a flag next to each, as
+ * there is one of these for every transaction in the wallet.
+ */
+class CWalletTxCache
+{
+public:
+    enum Amount
+    {
+        DEBIT,
+        CREDIT,
+        IMMATURE_CREDIT,
+        AVAILABLE_CREDIT,
+        WATCH_DEBIT,
+        WATCH_CREDIT,
+        IMMATURE_WATCH_CREDIT,
+        AVAILABLE_WATCH_CREDIT,
+        CHANGE,
+        AMOUNT_COUNT
+    };
+
+private:
+    CAmount nAmounts[AMOUNT_COUNT];
+    uint16_t nCachedBits;
+
+public:
+    CWalletTxCache() : nCachedBits(0) {}
+
+    bool IsCached(Amount amount) const { return (nCachedBits >> amount) & 1; }
+    CAmount Get(Amount amount) const { return nAmounts[amount]; }
+    CAmount Set(Amount amount, CAmount nAmount)
+    {
+        nAmounts[amount] = nAmount;
+        nCachedBits |= 1 << amount;
+        return nAmount;
+    }
+    void Clear() { nCachedBits = 0; }
+};
+
 class CWalletTx : public CMerkleTx
 {
 private:
@@ -283,24 +392,7 @@ public:
     int64_t nOrderPos; //!< position in ordered transaction list
 
     // memory only
-    mutable bool fDebitCached;
-    mutable bool fCreditCached;
-    mutable bool fImmatureCreditCached;
-    mutable bool fAvailableCreditCached;
-    mutable bool fWatchDebitCached;
-    mutable bool fWatchCreditCached;
-    mutable bool fImmatureWatchCreditCached;
-    mutable bool fAvailableWatchCreditCached;
-    mutable bool fChangeCached;
-    mutable CAmount nDebitCached;
-    mutable CAmount nCreditCached;
-    mutable CAmount nImmatureCreditCached;
-    mutable CAmount nAvailableCreditCached;
-    mutable CAmount nWatchDebitCached;
-    mutable CAmount nWatchCreditCached;
-    mutable CAmount nImmatureWatchCreditCached;
-    mutable CAmount nAvailableWatchCreditCached;
-    mutable CAmount nChangeCached;
+    mutable CWalletTxCache amountCache;
 
     CWalletTx()
     {
@@ -332,24 +424,7 @@ public:
         nTimeSmart = 0;
         fFromMe = false;
         strFromAccount.clear();
-        fDebitCached = false;
-        fCreditCached = false;
-        fImmatureCreditCached = false;
-        fAvailableCreditCached = false;
-        fWatchDebitCached = false;
-        fWatchCreditCached = false;
-        fImmatureWatchCreditCached = false;
-        fAvailableWatchCreditCached = false;
-        fChangeCached = false;
-        nDebitCached = 0;
-        nCreditCached = 0;
-        nImmatureCreditCached = 0;
-        nAvailableCreditCached = 0;
-        nWatchDebitCached = 0;
-        nWatchCreditCached = 0;
-        nAvailableWatchCreditCached = 0;
-        nImmatureWatchCreditCached = 0;
-        nChangeCached = 0;
+        amountCache.Clear();
         nOrderPos = -1;
     }
 
@@ -398,17 +473,7 @@ public:
     }
 
     //! make sure balances are recalculated
-    void MarkDirty()
-    {
-        fCreditCached = false;
-        fAvailableCreditCached = false;
-        fWatchDebitCached = false;
-        fWatchCreditCached = false;
-        fAvailableWatchCreditCached = false;
-        fImmatureWatchCreditCached = false;
-        fDebitCached = false;
-        fChangeCached = false;
-    }
+    void MarkDirty();
 
     void BindWallet(CWallet *pwalletIn)
     {
@@ -596,7 +661,7 @@ private:
      * all coins from coinControl are selected; Never select unconfirmed coins
      * if they are not ours
      */
-    bool SelectCoins(const CAmount& nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl *coinControl = NULL, AvailableCoinsType nCoinType=ALL_COINS, bool fUseInstantSend = false) const;
+    bool SelectCoins(const std::vector<COutput>& vAvailableCoins, const CAmount& nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, const CCoinControl *coinControl = NULL, bool fUseInstantSend = false) const;
 
     CWalletDB *pwalletdbEncryption;
 
@@ -615,6 +680,21 @@ private:
     mutable bool fAnonymizableTallyCachedNonDenom;
     mutable std::vector<CompactTallyItem> vecAnonymizableTallyCachedNonDenom;
 
+    /**
+     * Running balance totals. Each transaction's share is remembered (only when
+     * non-zero) so it can be taken out again when the transaction changes.
+     * Transactions whose share depends on the chain tip or the mempool
+     * (unconfirmed, conflicted or immature ones) are re-evaluated on every
+     * query, everything else only after MarkDirty(). Guarded by cs_wallet.
+     */
+    mutable CWalletBalances balancesCached;
+    mutable std::map<uint256, CWalletBalances> mapBalanceShares;
+    mutable std::set<uint256> setBalanceDirty;
+    mutable std::set<uint256> setBalanceVolatile;
+    mutable bool fBalanceRescan;
+
+    void UpdateBalanceShare(const uint256& hash) const;
+
     /**
      * Used to keep track of spent outpoints, and
      * detect and report conflicts (double-spends or
@@ -625,15 +705,28 @@ private:
     void AddToSpends(const COutPoint& outpoint, const uint256& wtxid);
     void AddToSpends(const uint256& wtxid);
 
-    std::set<COutPoint> setWalletUTXO;
+    /**
+     * Outputs paying to us that are not known to be spent. AvailableCoins()
+     * walks this instead of mapWallet and drops outputs it finds spent;
+     * transactions passed to MarkBalanceDirty() get their outputs re-added,
+     * which covers spends that are abandoned or disconnected again.
+     */
+    mutable std::set<COutPoint> setWalletUTXO;
+    mutable std::set<uint256> setUTXODirty;
+    mutable bool fUTXORescan;
+
+    void UpdateUTXOIndex() const;
+
+    //! Hashes of all keys (HD and keypool ones included) and scripts, guarded by cs_KeyStore
+    CWalletScriptFilter scriptFilter;
 
     /* Mark a transaction (and its in-wallet descendants) as conflicting with a particular block. */
     void MarkConflicted(const uint256& hashBlock, const uint256& hashTx);
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
-    /* HD derive new child key (on internal or external chain) */
-    void DeriveNewChildKey(const CKeyMetadata& metadata, CKey& secretRet, uint32_t nAccountIndex, bool fInternal /*= false*/);
+    /* HD derive nCount new child keys (on internal or external chain), in parallel */
+    void DeriveNewChildKeys(const CKeyMetadata& metadata, std::vector<CPubKey>& vPubKeysRet, size_t nCount, uint32_t nAccountIndex, bool fInternal /*= false*/);
 
 public:
     /*
@@ -707,6 +800,8 @@ public:
         fAnonymizableTallyCachedNonDenom = false;
         vecAnonymizableTallyCached.clear();
         vecAnonymizableTallyCachedNonDenom.clear();
+        fBalanceRescan = true;
+        fUTXORescan = true;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -715,6 +810,8 @@ public:
     typedef std::pair<CWalletTx*, CAccountingEntry*> TxPair;
     typedef std::multimap<int64_t, TxPair > TxItems;
     TxItems wtxOrdered;
+    //! Subsets of wtxOrdered per account, built on first use and kept up to date after
+    std::map<std::string, TxItems> mapAccountOrdered;
 
     int64_t nOrderPosNext;
     std::map<uint256, int> mapRequestCount;
@@ -741,11 +838,12 @@ public:
     void AvailableCoins(std::vector<COutput>& vCoins, bool fOnlyConfirmed=true, const CCoinControl *coinControl = NULL, bool fIncludeZeroValue=false, AvailableCoinsType nCoinType=ALL_COINS, bool fUseInstantSend = false) const;
     /**
      * Shuffle and select coins until nTargetValue is reached while avoiding
-     * small change; This method is stochastic for some inputs and upon
-     * completion the coin set and corresponding actual target value is
+     * small change; An exact match that needs no change output is searched
+     * by branch and bound first, then the stochastic approximation is used.
+     * Upon completion the coin set and corresponding actual target value is
      * assembled
      */
-    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, uint64_t nMaxAncestors, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, bool fUseInstantSend = false) const;
+    bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, uint64_t nMaxAncestors, const std::vector<COutput>& vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, bool fUseInstantSend = false) const;
     bool SelectCoinsByDenominations(int nDenom, CAmount nValueMin, CAmount nValueMax, std::vector<CTxIn>& vecTxInRet, std::vector<COutput>& vCoinsRet, CAmount& nValueRet, int nPrivateSendRoundsMin, int nPrivateSendRoundsMax); 
     bool SelectCoinsDark(CAmount nValueMin, CAmount nValueMax, std::vector<CTxIn>& vecTxInRet, CAmount& nValueRet, int nPrivateSendRoundsMin, int nPrivateSendRoundsMax) const; 
     bool SelectCoinsGrouppedByAddresses(std::vector<CompactTallyItem>& vecTallyRet, bool fSkipDenominated = true, bool fAnonymizable = true) const;
@@ -778,6 +876,8 @@ public:
      * Generate a new key
      */
     CPubKey GenerateNewKey(uint32_t nAccountIndex, bool fInternal /*= false*/);
+    //! Generates nCount new keys at once, with the HD ones derived in parallel
+    void GenerateNewKeys(std::vector<CPubKey>& vPubKeysRet, size_t nCount, uint32_t nAccountIndex, bool fInternal);
     //! HaveKey implementation that also checks the mapHdPubKeys
     bool HaveKey(const CKeyID &address) const;
     //! GetPubKey implementation that also checks the mapHdPubKeys
@@ -791,7 +891,7 @@ public:
     //! Adds a key to the store, and saves it to disk.
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey);
     //! Adds a key to the store, without saving it to disk (used by LoadWallet)
-    bool LoadKey(const CKey& key, const CPubKey &pubkey) { return CCryptoKeyStore::AddKeyPubKey(key, pubkey); }
+    bool LoadKey(const CKey& key, const CPubKey &pubkey);
     //! Load metadata (used by LoadWallet)
     bool LoadKeyMetadata(const CPubKey &pubkey, const CKeyMetadata &metadata);
 
@@ -818,6 +918,8 @@ public:
     bool RemoveWatchOnly(const CScript &dest);
     //! Adds a watch-only address to the store, without saving it to disk (used by LoadWallet)
     bool LoadWatchOnly(const CScript &dest);
+    //! False if the script certainly pays neither to our keys nor to a watched script
+    bool MaybeMine(const CScript& script) const;
 
     bool Unlock(const SecureString& strWalletPassphrase);
     bool ChangeWalletPassphrase(const SecureString& strOldWalletPassphrase, const SecureString& strNewWalletPassphrase);
@@ -830,10 +932,25 @@ public:
      * @return next transaction order id
      */
     int64_t IncOrderPosNext(CWalletDB *pwalletdb = NULL);
+
+    /** Add a transaction or accounting entry to wtxOrdered and the account views it belongs to */
+    void AddToOrderedTxItems(int64_t nOrderPos, const TxPair& txPair);
+    /** Index wtxOrdered again, e.g. after the order positions were rewritten */
+    void RebuildOrderedTxItems();
+    /**
+     * The wallet transactions and accounting entries an account's history may show, ordered like
+     * wtxOrdered. Transactions are included if they were sent from the account or pay an address
+     * labelled with it, so callers still filter each entry.
+     */
+    const TxItems& GetAccountOrderedTxItems(const std::string& strAccount);
     bool AccountMove(std::string strFrom, std::string strTo, CAmount nAmount, std::string strComment = "");
     bool GetAccountPubkey(CPubKey &pubKey, std::string strAccount, bool bForceNew = false);
 
     void MarkDirty();
+    //! Re-evaluate the balance share and the unspent outputs of a transaction when next needed
+    void MarkBalanceDirty(const uint256& hash) const;
+    //! All balances at once, updated incrementally. Requires cs_main and cs_wallet.
+    const CWalletBalances& GetBalances() const;
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
@@ -892,6 +1009,11 @@ public:
      * floating relay fee and user set minimum transaction fee
      */
     static CAmount GetRequiredFee(unsigned int nTxBytes);
+    /**
+     * What a change output costs to create and to spend later at the
+     * required fee rate. Less change than this goes to the fee instead.
+     */
+    static CAmount GetChangeCost();
 
     bool NewKeyPool();
     size_t KeypoolCountExternalKeys();
@@ -252,14 +252,91 @@ void CWalletDB::ListAccountCreditDebit(const string& strAccount, list<CAccountin
     pcursor->close();
 }
 
+/**
+ * Zerocoin mints by pubcoin value and spends by serial number, of each wallet
+ * file, in the order of their database keys. Read once when the wallet is
+ * opened and kept in step with the writes and erases below, so that lookups
+ * and listings do not scan the database.
+ */
+struct CZerocoinIndex
+{
+    std::map<std::vector<unsigned char>, CZerocoinEntry> mapMints;
+    std::map<std::vector<unsigned char>, CZerocoinSpendEntry> mapSpends;
+    std::multimap<uint256, std::vector<unsigned char> > mapSpendsByTx;
+
+    void AddSpend(const std::vector<unsigned char>& key, const CZerocoinSpendEntry& zerocoinSpend)
+    {
+        EraseSpend(key);
+        mapSpends[key] = zerocoinSpend;
+        mapSpendsByTx.insert(std::make_pair(zerocoinSpend.hashTx, key));
+    }
+
+    void EraseSpend(const std::vector<unsigned char>& key)
+    {
+        std::map<std::vector<unsigned char>, CZerocoinSpendEntry>::iterator it = mapSpends.find(key);
+        if (it == mapSpends.end())
+            return;
+        std::pair<std::multimap<uint256, std::vector<unsigned char> >::iterator, std::multimap<uint256, std::vector<unsigned char> >::iterator> range = mapSpendsByTx.equal_range(it->second.hashTx);
+        for (std::multimap<uint256, std::vector<unsigned char> >::iterator itTx = range.first; itTx != range.second; ++itTx) {
+            if (itTx->second == key) {
+                mapSpendsByTx.erase(itTx);
+                break;
+            }
+        }
+        mapSpends.erase(it);
+    }
+};
+
+static CCriticalSection cs_zerocoinIndex;
+static std::map<std::string, CZerocoinIndex> mapZerocoinIndex;
+
+/** The index key of a pubcoin value or serial number, ordered like the database keys */
+static std::vector<unsigned char> ZerocoinIndexKey(const CBigNum& bn)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << bn;
+    return std::vector<unsigned char>(ss.begin(), ss.end());
+}
+
+CZerocoinIndex& CWalletDB::GetZerocoinIndex()
+{
+    AssertLockHeld(cs_zerocoinIndex);
+    std::map<std::string, CZerocoinIndex>::iterator it = mapZerocoinIndex.find(strFile);
+    if (it == mapZerocoinIndex.end()) {
+        CZerocoinIndex index;
+        ReadZerocoinIndex(index);
+        it = mapZerocoinIndex.insert(std::make_pair(strFile, index)).first;
+    }
+    return it->second;
+}
+
+void CWalletDB::LoadZerocoinIndex()
+{
+    LOCK(cs_zerocoinIndex);
+    CZerocoinIndex index;
+    ReadZerocoinIndex(index);
+    mapZerocoinIndex[strFile] = index;
+    LogPrintf("Zerocoin index: %u mints, %u spends\n", index.mapMints.size(), index.mapSpends.size());
+}
+
 bool CWalletDB::WriteCoinSpendSerialEntry(const CZerocoinSpendEntry& zerocoinSpend)
 {
-    return Write(make_pair(string("zcserial"), zerocoinSpend.coinSerial), zerocoinSpend, true);
+    LOCK(cs_zerocoinIndex);
+    CZerocoinIndex& index = GetZerocoinIndex();
+    if (!Write(make_pair(string("zcserial"), zerocoinSpend.coinSerial), zerocoinSpend, true))
+        return false;
+    index.AddSpend(ZerocoinIndexKey(zerocoinSpend.coinSerial), zerocoinSpend);
+    return true;
 }
 
 bool CWalletDB::EraseCoinSpendSerialEntry(const CZerocoinSpendEntry& zerocoinSpend)
 {
-    return Erase(make_pair(string("zcserial"), zerocoinSpend.coinSerial));
+    LOCK(cs_zerocoinIndex);
+    CZerocoinIndex& index = GetZerocoinIndex();
+    if (!Erase(make_pair(string("zcserial"), zerocoinSpend.coinSerial)))
+        return false;
+    index.EraseSpend(ZerocoinIndexKey(zerocoinSpend.coinSerial));
+    return true;
 }
 
 bool CWalletDB::WriteZerocoinAccumulator(libzerocoin::Accumulator accumulator, libzerocoin::CoinDenomination denomination, int pubcoinid)
@@ -274,12 +351,33 @@ bool CWalletDB::ReadZerocoinAccumulator(libzerocoin::Accumulator& accumulator, l
 
 bool CWalletDB::WriteZerocoinEntry(const CZerocoinEntry& zerocoin)
 {
-    return Write(make_pair(string("zerocoin"), zerocoin.value), zerocoin, true);
+    LOCK(cs_zerocoinIndex);
+    CZerocoinIndex& index = GetZerocoinIndex();
+    if (!Write(make_pair(string("zerocoin"), zerocoin.value), zerocoin, true))
+        return false;
+    index.mapMints[ZerocoinIndexKey(zerocoin.value)] = zerocoin;
+    return true;
 }
 
 bool CWalletDB::EarseZerocoinEntry(const CZerocoinEntry& zerocoin)
 {
-    return Erase(make_pair(string("zerocoin"), zerocoin.value));
+    LOCK(cs_zerocoinIndex);
+    CZerocoinIndex& index = GetZerocoinIndex();
+    if (!Erase(make_pair(string("zerocoin"), zerocoin.value)))
+        return false;
+    index.mapMints.erase(ZerocoinIndexKey(zerocoin.value));
+    return true;
+}
+
+bool CWalletDB::ReadZerocoinEntry(const CBigNum& value, CZerocoinEntry& zerocoin)
+{
+    LOCK(cs_zerocoinIndex);
+    const CZerocoinIndex& index = GetZerocoinIndex();
+    std::map<std::vector<unsigned char>, CZerocoinEntry>::const_iterator it = index.mapMints.find(ZerocoinIndexKey(value));
+    if (it == index.mapMints.end())
+        return false;
+    zerocoin = it->second;
+    return true;
 }
 // Check Calculated Blocked for Zerocoin
 bool CWalletDB::ReadCalculatedZCBlock(int& height)
@@ -294,6 +392,31 @@ bool CWalletDB::WriteCalculatedZCBlock(int height)
 }
 
 void CWalletDB::ListPubCoin(std::list<CZerocoinEntry>& listPubCoin)
+{
+    LOCK(cs_zerocoinIndex);
+    const CZerocoinIndex& index = GetZerocoinIndex();
+    for (std::map<std::vector<unsigned char>, CZerocoinEntry>::const_iterator it = index.mapMints.begin(); it != index.mapMints.end(); ++it)
+        listPubCoin.push_back(it->second);
+}
+
+void CWalletDB::ListCoinSpendSerial(std::list<CZerocoinSpendEntry>& listCoinSpendSerial)
+{
+    LOCK(cs_zerocoinIndex);
+    const CZerocoinIndex& index = GetZerocoinIndex();
+    for (std::map<std::vector<unsigned char>, CZerocoinSpendEntry>::const_iterator it = index.mapSpends.begin(); it != index.mapSpends.end(); ++it)
+        listCoinSpendSerial.push_back(it->second);
+}
+
+void CWalletDB::ListCoinSpendSerial(const uint256& hashTx, std::list<CZerocoinSpendEntry>& listCoinSpendSerial)
+{
+    LOCK(cs_zerocoinIndex);
+    const CZerocoinIndex& index = GetZerocoinIndex();
+    std::pair<std::multimap<uint256, std::vector<unsigned char> >::const_iterator, std::multimap<uint256, std::vector<unsigned char> >::const_iterator> range = index.mapSpendsByTx.equal_range(hashTx);
+    for (std::multimap<uint256, std::vector<unsigned char> >::const_iterator it = range.first; it != range.second; ++it)
+        listCoinSpendSerial.push_back(index.mapSpends.find(it->second)->second);
+}
+
+void CWalletDB::ReadZerocoinIndex(CZerocoinIndex& index)
 {
     Dbc* pcursor = GetCursor();
     if (!pcursor)
@@ -323,17 +446,14 @@ void CWalletDB::ListPubCoin(std::list<CZerocoinEntry>& listPubCoin)
         ssKey >> value;
         CZerocoinEntry zerocoinItem;
         ssValue >> zerocoinItem;
-        listPubCoin.push_back(zerocoinItem);
+        index.mapMints[ZerocoinIndexKey(value)] = zerocoinItem;
     }
     pcursor->close();
-}
 
-void CWalletDB::ListCoinSpendSerial(std::list<CZerocoinSpendEntry>& listCoinSpendSerial)
-{
-    Dbc* pcursor = GetCursor();
+    pcursor = GetCursor();
     if (!pcursor)
         throw runtime_error("CWalletDB::ListCoinSpendSerial() : cannot create DB cursor");
-    unsigned int fFlags = DB_SET_RANGE;
+    fFlags = DB_SET_RANGE;
     while (true)
     {
         // Read next record
@@ -360,7 +480,7 @@ void CWalletDB::ListCoinSpendSerial(std::list<CZerocoinSpendEntry>& listCoinSpen
         ssKey >> value;
         CZerocoinSpendEntry zerocoinSpendItem;
         ssValue >> zerocoinSpendItem;
-        listCoinSpendSerial.push_back(zerocoinSpendItem);
+        index.AddSpend(ZerocoinIndexKey(value), zerocoinSpendItem);
     }
 
     pcursor->close();
@@ -460,6 +580,52 @@ public:
     }
 };
 
+/**
+ * Decode a "tx" record (after its type) and check it. This does not touch the
+ * wallet, so that records can be decoded on several threads.
+ */
+static bool DecodeWalletTx(CDataStream& ssKey, CDataStream& ssValue, CWalletTx& wtx, bool& fUpgraded, string& strErr)
+{
+    uint256 hash;
+    ssKey >> hash;
+    ssValue >> wtx;
+    CValidationState state;
+    if (!(CheckTransaction(wtx, state, wtx.GetHash(), false) && (wtx.GetHash() == hash) && state.IsValid()))
+        return false;
+
+    // Undo serialize changes in 31600
+    if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
+    {
+        if (!ssValue.empty())
+        {
+            char fTmp;
+            char fUnused;
+            ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
+            strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
+                               wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = fTmp;
+        }
+        else
+        {
+            strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = 0;
+        }
+        fUpgraded = true;
+    }
+    return true;
+}
+
+static void LoadWalletTx(CWallet* pwallet, const CWalletTx& wtx, bool fUpgraded, CWalletScanState& wss)
+{
+    if (fUpgraded)
+        wss.vWalletUpgrade.push_back(wtx.GetHash());
+
+    if (wtx.nOrderPos == -1)
+        wss.fAnyUnordered = true;
+
+    pwallet->AddToWallet(wtx, true, NULL);
+}
+
 bool
 ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
              CWalletScanState &wss, string& strType, string& strErr)
@@ -483,38 +649,11 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         }
         else if (strType == "tx")
         {
-            uint256 hash;
-            ssKey >> hash;
             CWalletTx wtx;
-            ssValue >> wtx;
-            CValidationState state;
-            if (!(CheckTransaction(wtx, state, wtx.GetHash(), false) && (wtx.GetHash() == hash) && state.IsValid()))
+            bool fUpgraded = false;
+            if (!DecodeWalletTx(ssKey, ssValue, wtx, fUpgraded, strErr))
                 return false;
-
-            // Undo serialize changes in 31600
-            if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
-            {
-                if (!ssValue.empty())
-                {
-                    char fTmp;
-                    char fUnused;
-                    ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
-                    strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
-                                       wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = fTmp;
-                }
-                else
-                {
-                    strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = 0;
-                }
-                wss.vWalletUpgrade.push_back(hash);
-            }
-
-            if (wtx.nOrderPos == -1)
-                wss.fAnyUnordered = true;
-
-            pwallet->AddToWallet(wtx, true, NULL);
+            LoadWalletTx(pwallet, wtx, fUpgraded, wss);
         }
         else if (strType == "acentry")
         {
@@ -749,6 +888,74 @@ static bool IsKeyType(string strType)
             strType == "hdchain" || strType == "chdchain");
 }
 
+/** Transaction records read before they are decoded, in parallel, and added to the wallet */
+static const size_t WALLET_LOAD_TX_BATCH = 10000;
+/** Transaction records decoded per thread, below that fewer threads are used */
+static const size_t WALLET_LOAD_TXS_PER_THREAD = 500;
+
+/** A "tx" record read from the database, and what decoding it gave */
+struct CWalletTxRecord
+{
+    CDataStream ssKey;
+    CDataStream ssValue;
+    CWalletTx wtx;
+    bool fValid;
+    bool fUpgraded;
+    string strErr;
+
+    CWalletTxRecord(CDataStream&& ssKeyIn, CDataStream&& ssValueIn) :
+        ssKey(std::move(ssKeyIn)), ssValue(std::move(ssValueIn)), fValid(false), fUpgraded(false) {}
+};
+
+static bool IsTxRecord(const CDataStream& ssKey)
+{
+    return ssKey.size() > 3 && ssKey[0] == 2 && ssKey[1] == 't' && ssKey[2] == 'x';
+}
+
+/**
+ * Decode a batch of transaction records over a few threads, then add them to
+ * the wallet in the order they were read, as ReadKeyValue() would have.
+ */
+static void LoadWalletTxBatch(CWallet* pwallet, std::vector<CWalletTxRecord>& vRecords, CWalletScanState& wss, bool& fNoncriticalErrors)
+{
+    auto decode = [&vRecords](int n, int nThreads) {
+        for (size_t i = n; i < vRecords.size(); i += nThreads) {
+            CWalletTxRecord& record = vRecords[i];
+            try {
+                string strType;
+                record.ssKey >> strType;
+                record.fValid = DecodeWalletTx(record.ssKey, record.ssValue, record.wtx, record.fUpgraded, record.strErr);
+            } catch (...) {
+                record.fValid = false;
+            }
+        }
+    };
+
+    int nThreads = std::max(1, std::min(GetNumCores(), (int) (vRecords.size() / WALLET_LOAD_TXS_PER_THREAD)));
+    if (nThreads == 1) {
+        decode(0, 1);
+    } else {
+        boost::thread_group decoders;
+        for (int n = 0; n < nThreads; n++)
+            decoders.create_thread(boost::bind<void>(decode, n, nThreads));
+        decoders.join_all();
+    }
+
+    BOOST_FOREACH(const CWalletTxRecord& record, vRecords) {
+        if (record.fValid) {
+            LoadWalletTx(pwallet, record.wtx, record.fUpgraded, wss);
+        } else {
+            LogPrintf("type %s\n", "tx");
+            // Rescan if there is a bad transaction record:
+            fNoncriticalErrors = true;
+            SoftSetBoolArg("-rescan", true);
+        }
+        if (!record.strErr.empty())
+            LogPrintf("%s\n", record.strErr);
+    }
+    vRecords.clear();
+}
+
 DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
 {
     pwallet->vchDefaultKey = CPubKey();
@@ -774,6 +981,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             return DB_CORRUPT;
         }
 
+        std::vector<CWalletTxRecord> vTxRecords;
         while (true)
         {
             // Read next record
@@ -788,6 +996,16 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
                 return DB_CORRUPT;
             }
 
+            // Transactions, by far the most records in a busy wallet, are decoded in batches
+            if (IsTxRecord(ssKey)) {
+                vTxRecords.emplace_back(std::move(ssKey), std::move(ssValue));
+                if (vTxRecords.size() >= WALLET_LOAD_TX_BATCH)
+                    LoadWalletTxBatch(pwallet, vTxRecords, wss, fNoncriticalErrors);
+                continue;
+            }
+            if (!vTxRecords.empty())
+                LoadWalletTxBatch(pwallet, vTxRecords, wss, fNoncriticalErrors);
+
             // Try to be tolerant of single corrupt records:
             string strType, strErr;
             if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr))
@@ -810,6 +1028,7 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
                 LogPrintf("%s\n", strErr);
         }
         pcursor->close();
+        LoadWalletTxBatch(pwallet, vTxRecords, wss, fNoncriticalErrors);
 
         // Store initial external keypool size since we mostly use external keys in mixing
         pwallet->nKeysLeftSinceAutoBackup = pwallet->KeypoolCountExternalKeys();
@@ -852,10 +1071,14 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
     if (wss.fAnyUnordered)
         result = ReorderTransactions(pwallet);
 
-    pwallet->laccentries.clear();
-    ListAccountCreditDebit("*", pwallet->laccentries);
-    BOOST_FOREACH(CAccountingEntry& entry, pwallet->laccentries) {
-        pwallet->wtxOrdered.insert(make_pair(entry.nOrderPos, CWallet::TxPair((CWalletTx*)0, &entry)));
+    LoadZerocoinIndex();
+
+    // Index the transactions again as reordering changed their positions
+    {
+        LOCK(pwallet->cs_wallet);
+        pwallet->laccentries.clear();
+        ListAccountCreditDebit("*", pwallet->laccentries);
+        pwallet->RebuildOrderedTxItems();
     }
 
     return result;
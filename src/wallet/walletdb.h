@@ -34,6 +34,7 @@ class uint256;
 
 class CZerocoinEntry;
 class CZerocoinSpendEntry;
+struct CZerocoinIndex;
 
 /** Error statuses for the wallet database */
 enum DBErrors
@@ -145,8 +146,13 @@ public:
 
     bool WriteZerocoinEntry(const CZerocoinEntry& zerocoin);
     bool EarseZerocoinEntry(const CZerocoinEntry& zerocoin);
+    bool ReadZerocoinEntry(const CBigNum& value, CZerocoinEntry& zerocoin);
     void ListPubCoin(std::list<CZerocoinEntry>& listPubCoin);
     void ListCoinSpendSerial(std::list<CZerocoinSpendEntry>& listCoinSpendSerial);
+    //! The spends recorded for one transaction
+    void ListCoinSpendSerial(const uint256& hashTx, std::list<CZerocoinSpendEntry>& listCoinSpendSerial);
+    //! (Re)reads the zerocoin mints and spends the calls above are served from
+    void LoadZerocoinIndex();
     bool WriteCoinSpendSerialEntry(const CZerocoinSpendEntry& zerocoinSpend);
     bool EraseCoinSpendSerialEntry(const CZerocoinSpendEntry& zerocoinSpend);
     bool WriteZerocoinAccumulator(libzerocoin::Accumulator accumulator, libzerocoin::CoinDenomination denomination, int pubcoinid);
@@ -173,6 +179,10 @@ private:
     void operator=(const CWalletDB&);
 
     bool WriteAccountingEntry(const uint64_t nAccEntryNum, const CAccountingEntry& acentry);
+
+    //! The zerocoin index of this file, read on first use; requires cs_zerocoinIndex
+    CZerocoinIndex& GetZerocoinIndex();
+    void ReadZerocoinIndex(CZerocoinIndex& index);
 };
 
 void ThreadFlushWalletDB(const std::string& strFile);
@@ -4,7 +4,13 @@
 
 #include "zmqabstractnotifier.h"
 #include "util.h"
+#include "version.h"
 
+CZMQPayload::CZMQPayload(const void* pch, size_t nSizeIn) : nOffset(0), nSize(nSizeIn)
+{
+    const char* p = static_cast<const char*>(pch);
+    data = std::make_shared<const CDataStream>(p, p + nSizeIn, SER_NETWORK, PROTOCOL_VERSION);
+}
 
 CZMQAbstractNotifier::~CZMQAbstractNotifier()
 {
@@ -16,7 +22,32 @@ bool CZMQAbstractNotifier::NotifyBlock(const CBlockIndex * /*CBlockIndex*/)
     return true;
 }
 
-bool CZMQAbstractNotifier::NotifyTransaction(const CTransaction &/*transaction*/)
+bool CZMQAbstractNotifier::NotifyBlockConnected(const CBlockIndex * /*pindex*/, const CZMQPayload &/*block*/)
+{
+    return true;
+}
+
+bool CZMQAbstractNotifier::NotifyTransaction(const CTransaction &/*transaction*/, const CZMQPayload * /*raw*/)
+{
+    return true;
+}
+
+bool CZMQAbstractNotifier::NotifyTransactionLock(const CTransaction &/*transaction*/)
+{
+    return true;
+}
+
+bool CZMQAbstractNotifier::NotifySmartnodeListChanged(const COutPoint &/*outpoint*/, bool /*fAdded*/)
+{
+    return true;
+}
+
+bool CZMQAbstractNotifier::NotifyRewardsRoundFinalized(const CSmartRewardRound &/*round*/)
+{
+    return true;
+}
+
+bool CZMQAbstractNotifier::NotifySporkChanged(const CSporkMessage &/*spork*/)
 {
     return true;
 }
@@ -6,10 +6,33 @@
 #define BITCOIN_ZMQ_ZMQABSTRACTNOTIFIER_H
 
 #include "zmqconfig.h"
+#include "streams.h"
+
+#include <memory>
 
 class CBlockIndex;
+class COutPoint;
+class CSmartRewardRound;
+class CSporkMessage;
 class CZMQAbstractNotifier;
 
+/** A serialized message body, or a slice of one, shared by the notifiers and the send queue */
+struct CZMQPayload
+{
+    std::shared_ptr<const CDataStream> data;
+    size_t nOffset;
+    size_t nSize;
+
+    CZMQPayload() : nOffset(0), nSize(0) { }
+    CZMQPayload(const std::shared_ptr<const CDataStream>& dataIn, size_t nOffsetIn, size_t nSizeIn) : data(dataIn), nOffset(nOffsetIn), nSize(nSizeIn) { }
+    /** Copies a small body, such as a hash */
+    CZMQPayload(const void* pch, size_t nSizeIn);
+
+    bool IsNull() const { return !data; }
+    const char* begin() const { return &(*data->begin()) + nOffset; }
+    size_t size() const { return nSize; }
+};
+
 typedef CZMQAbstractNotifier* (*CZMQNotifierFactory)();
 
 class CZMQAbstractNotifier
@@ -33,7 +56,14 @@ public:
     virtual void Shutdown() = 0;
 
     virtual bool NotifyBlock(const CBlockIndex *pindex);
-    virtual bool NotifyTransaction(const CTransaction &transaction);
+    /** A block was connected; block is its serialization, made once for all notifiers */
+    virtual bool NotifyBlockConnected(const CBlockIndex *pindex, const CZMQPayload &block);
+    /** raw is the transaction's slice of the connected block's serialization, if it is from one */
+    virtual bool NotifyTransaction(const CTransaction &transaction, const CZMQPayload *raw);
+    virtual bool NotifyTransactionLock(const CTransaction &transaction);
+    virtual bool NotifySmartnodeListChanged(const COutPoint &outpoint, bool fAdded);
+    virtual bool NotifyRewardsRoundFinalized(const CSmartRewardRound &round);
+    virtual bool NotifySporkChanged(const CSporkMessage &spork);
 
 protected:
     void *psocket;
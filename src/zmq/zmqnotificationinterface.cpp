@@ -9,13 +9,14 @@
 #include "validation.h"
 #include "streams.h"
 #include "util.h"
+#include "rpc/server.h"
 
 void zmqError(const char *str)
 {
     LogPrint("zmq", "zmq: Error: %s, errno=%s\n", str, zmq_strerror(errno));
 }
 
-CZMQNotificationInterface::CZMQNotificationInterface() : pcontext(NULL)
+CZMQNotificationInterface::CZMQNotificationInterface() : pcontext(NULL), fSerializeBlocks(false), pblockConnected(NULL)
 {
 }
 
@@ -39,6 +40,12 @@ CZMQNotificationInterface* CZMQNotificationInterface::CreateWithArguments(const
     factories["pubhashtx"] = CZMQAbstractNotifier::Create<CZMQPublishHashTransactionNotifier>;
     factories["pubrawblock"] = CZMQAbstractNotifier::Create<CZMQPublishRawBlockNotifier>;
     factories["pubrawtx"] = CZMQAbstractNotifier::Create<CZMQPublishRawTransactionNotifier>;
+    factories["pubmempoolstats"] = CZMQAbstractNotifier::Create<CZMQPublishMempoolStatsNotifier>;
+    factories["pubhashtxlock"] = CZMQAbstractNotifier::Create<CZMQPublishHashTransactionLockNotifier>;
+    factories["pubrawtxlock"] = CZMQAbstractNotifier::Create<CZMQPublishRawTransactionLockNotifier>;
+    factories["pubsmartnodelist"] = CZMQAbstractNotifier::Create<CZMQPublishSmartnodeListNotifier>;
+    factories["pubrewardsround"] = CZMQAbstractNotifier::Create<CZMQPublishRewardsRoundNotifier>;
+    factories["pubspork"] = CZMQAbstractNotifier::Create<CZMQPublishSporkNotifier>;
 
     for (std::map<std::string, CZMQNotifierFactory>::const_iterator i=factories.begin(); i!=factories.end(); ++i)
     {
@@ -103,6 +110,14 @@ bool CZMQNotificationInterface::Initialize()
         return false;
     }
 
+    for (i=notifiers.begin(); i!=notifiers.end(); ++i)
+    {
+        if ((*i)->GetType() == "pubrawblock" || (*i)->GetType() == "pubrawtx")
+            fSerializeBlocks = true;
+    }
+
+    StartZMQSendThread();
+
     return true;
 }
 
@@ -112,6 +127,7 @@ void CZMQNotificationInterface::Shutdown()
     LogPrint("zmq", "zmq: Shutdown notification interface\n");
     if (pcontext)
     {
+        StopZMQSendThread();
         for (std::list<CZMQAbstractNotifier*>::iterator i=notifiers.begin(); i!=notifiers.end(); ++i)
         {
             CZMQAbstractNotifier *notifier = *i;
@@ -124,8 +140,12 @@ void CZMQNotificationInterface::Shutdown()
     }
 }
 
-void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindex)
+void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindex, const CBlockIndex *pindexFork, bool fInitialDownload)
 {
+    // The transactions of the connected blocks have all been synced by now
+    pblockConnected = NULL;
+    blockConnected = CZMQPayload();
+
     for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
     {
         CZMQAbstractNotifier *notifier = *i;
@@ -141,12 +161,124 @@ void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindex)
     }
 }
 
-void CZMQNotificationInterface::SyncTransaction(const CTransaction& tx, const CBlockIndex* pindex, const CBlock* pblock)
+void CZMQNotificationInterface::BlockConnected(const CBlock& block, const CBlockIndex *pindex)
+{
+    if (!fSerializeBlocks)
+        return;
+
+    // Serialize the block once, as CBlock does, remembering where each transaction is so
+    // rawtx can publish slices of the same buffer
+    std::shared_ptr<CDataStream> ss = std::make_shared<CDataStream>(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
+    ss->reserve(::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags()));
+    *ss << block.GetBlockHeader();
+    WriteCompactSize(*ss, block.vtx.size());
+    vTxSpans.clear();
+    vTxSpans.reserve(block.vtx.size());
+    for (const CTransaction& tx : block.vtx) {
+        size_t nBegin = ss->size();
+        *ss << tx;
+        vTxSpans.push_back(std::make_pair(nBegin, ss->size() - nBegin));
+    }
+    pblockConnected = &block;
+    blockConnected = CZMQPayload(ss, 0, ss->size());
+
+    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
+    {
+        CZMQAbstractNotifier *notifier = *i;
+        if (notifier->NotifyBlockConnected(pindex, blockConnected))
+        {
+            i++;
+        }
+        else
+        {
+            notifier->Shutdown();
+            i = notifiers.erase(i);
+        }
+    }
+}
+
+void CZMQNotificationInterface::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
+{
+    // A transaction of the block just connected is published from that block's serialization
+    CZMQPayload raw;
+    if (pblock && pblock == pblockConnected && !pblock->vtx.empty()) {
+        size_t nPos = &tx - &pblock->vtx[0];
+        if (nPos < pblock->vtx.size() && &pblock->vtx[nPos] == &tx)
+            raw = CZMQPayload(blockConnected.data, vTxSpans[nPos].first, vTxSpans[nPos].second);
+    }
+
+    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
+    {
+        CZMQAbstractNotifier *notifier = *i;
+        if (notifier->NotifyTransaction(tx, raw.IsNull() ? NULL : &raw))
+        {
+            i++;
+        }
+        else
+        {
+            notifier->Shutdown();
+            i = notifiers.erase(i);
+        }
+    }
+}
+
+void CZMQNotificationInterface::NotifyTransactionLock(const CTransaction &tx)
+{
+    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
+    {
+        CZMQAbstractNotifier *notifier = *i;
+        if (notifier->NotifyTransactionLock(tx))
+        {
+            i++;
+        }
+        else
+        {
+            notifier->Shutdown();
+            i = notifiers.erase(i);
+        }
+    }
+}
+
+void CZMQNotificationInterface::NotifySmartnodeListChanged(const COutPoint &outpoint, bool fAdded)
+{
+    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
+    {
+        CZMQAbstractNotifier *notifier = *i;
+        if (notifier->NotifySmartnodeListChanged(outpoint, fAdded))
+        {
+            i++;
+        }
+        else
+        {
+            notifier->Shutdown();
+            i = notifiers.erase(i);
+        }
+    }
+}
+
+void CZMQNotificationInterface::NotifyRewardsRoundFinalized(const CSmartRewardRound &round)
+{
+    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
+    {
+        CZMQAbstractNotifier *notifier = *i;
+        if (notifier->NotifyRewardsRoundFinalized(round))
+        {
+            i++;
+        }
+        else
+        {
+            notifier->Shutdown();
+            i = notifiers.erase(i);
+        }
+    }
+}
+
+void CZMQNotificationInterface::NotifySporkChanged(const CSporkMessage &spork)
 {
     for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
     {
         CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyTransaction(tx))
+        if (notifier->NotifySporkChanged(spork))
         {
             i++;
         }
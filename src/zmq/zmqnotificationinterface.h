@@ -6,11 +6,12 @@
 #define BITCOIN_ZMQ_ZMQNOTIFICATIONINTERFACE_H
 
 #include "validationinterface.h"
+#include "zmqabstractnotifier.h"
 #include <string>
 #include <map>
+#include <vector>
 
 class CBlockIndex;
-class CZMQAbstractNotifier;
 
 class CZMQNotificationInterface : public CValidationInterface
 {
@@ -24,14 +25,25 @@ protected:
     void Shutdown();
 
     // CValidationInterface
-    void SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex, const CBlock* pblock);
-    void UpdatedBlockTip(const CBlockIndex *pindex);
+    void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload);
+    void BlockConnected(const CBlock& block, const CBlockIndex *pindex);
+    void NotifyTransactionLock(const CTransaction &tx);
+    void NotifySmartnodeListChanged(const COutPoint &outpoint, bool fAdded);
+    void NotifyRewardsRoundFinalized(const CSmartRewardRound &round);
+    void NotifySporkChanged(const CSporkMessage &spork);
 
 private:
     CZMQNotificationInterface();
 
     void *pcontext;
     std::list<CZMQAbstractNotifier*> notifiers;
+    /** Some notifier publishes raw blocks or transactions, so connected blocks are serialized */
+    bool fSerializeBlocks;
+    /** The block last connected, its serialization and the span of each of its transactions in it */
+    const CBlock* pblockConnected;
+    CZMQPayload blockConnected;
+    std::vector<std::pair<size_t, size_t> > vTxSpans;
 };
 
 #endif // BITCOIN_ZMQ_ZMQNOTIFICATIONINTERFACE_H
@@ -2,11 +2,16 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
-#include "chainparams.h"
 #include "zmqpublishnotifier.h"
 #include "validation.h"
 #include "util.h"
 #include "rpc/server.h"
+#include "smartnode/spork.h"
+#include "smartrewards/rewardsdb.h"
+#include "sync.h"
+
+#include <deque>
+#include <thread>
 
 static std::multimap<std::string, CZMQAbstractPublishNotifier*> mapPublishNotifiers;
 
@@ -14,6 +19,14 @@ static const char *MSG_HASHBLOCK = "hashblock";
 static const char *MSG_HASHTX    = "hashtx";
 static const char *MSG_RAWBLOCK  = "rawblock";
 static const char *MSG_RAWTX     = "rawtx";
+static const char *MSG_MEMPOOLSTATS = "mempoolstats";
+static const char *MSG_HASHTXLOCK = "hashtxlock";
+static const char *MSG_RAWTXLOCK  = "rawtxlock";
+static const char *MSG_SMARTNODELIST = "smartnodelist";
+static const char *MSG_REWARDSROUND = "rewardsround";
+static const char *MSG_SPORKCHANGE = "spork";
+
+extern UniValue mempoolStatsToJSON(bool fReset);
 
 // Internal function to send multipart message
 static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
@@ -55,6 +68,63 @@ static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
     return 0;
 }
 
+/** A message waiting for the send thread */
+struct CZMQQueuedMessage
+{
+    void *psocket;
+    const char *command;
+    CZMQPayload payload;
+    uint32_t nSequence;
+};
+
+static CWaitableCriticalSection csZMQSend;
+static CConditionVariable condZMQSend;
+static std::deque<CZMQQueuedMessage> queueZMQSend;
+static bool fZMQSendRunning = false;
+static std::thread threadZMQSend;
+
+static void ThreadZMQSend()
+{
+    RenameThread("smartcash-zmqsend");
+    while (true) {
+        CZMQQueuedMessage msg;
+        {
+            boost::unique_lock<boost::mutex> lock(csZMQSend);
+            while (fZMQSendRunning && queueZMQSend.empty())
+                condZMQSend.wait(lock);
+            if (queueZMQSend.empty())
+                break;
+            msg = std::move(queueZMQSend.front());
+            queueZMQSend.pop_front();
+        }
+
+        /* send three parts, command & data & a LE 4byte sequence number */
+        unsigned char msgseq[sizeof(uint32_t)];
+        WriteLE32(&msgseq[0], msg.nSequence);
+        zmq_send_multipart(msg.psocket, msg.command, strlen(msg.command), msg.payload.begin(), msg.payload.size(), msgseq, (size_t)sizeof(uint32_t), (void*)0);
+    }
+}
+
+void StartZMQSendThread()
+{
+    boost::unique_lock<boost::mutex> lock(csZMQSend);
+    assert(!fZMQSendRunning);
+    fZMQSendRunning = true;
+    threadZMQSend = std::thread(ThreadZMQSend);
+}
+
+void StopZMQSendThread()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(csZMQSend);
+        if (!fZMQSendRunning)
+            return;
+        fZMQSendRunning = false;
+    }
+    condZMQSend.notify_all();
+    threadZMQSend.join();
+}
+
 bool CZMQAbstractPublishNotifier::Initialize(void *pcontext)
 {
     assert(!psocket);
@@ -71,7 +141,16 @@ bool CZMQAbstractPublishNotifier::Initialize(void *pcontext)
             return false;
         }
 
-        int rc = zmq_bind(psocket, address.c_str());
+        int hwm = GetArg("-zmqpubhwm", DEFAULT_ZMQ_SNDHWM);
+        int rc = zmq_setsockopt(psocket, ZMQ_SNDHWM, &hwm, sizeof(hwm));
+        if (rc!=0)
+        {
+            zmqError("Failed to set outbound message high water mark");
+            zmq_close(psocket);
+            return false;
+        }
+
+        rc = zmq_bind(psocket, address.c_str());
         if (rc!=0)
         {
             zmqError("Failed to bind address");
@@ -124,20 +203,22 @@ void CZMQAbstractPublishNotifier::Shutdown()
     psocket = 0;
 }
 
-bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const void* data, size_t size)
+bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const CZMQPayload &payload)
 {
     assert(psocket);
 
-    /* send three parts, command & data & a LE 4byte sequence number */
-    unsigned char msgseq[sizeof(uint32_t)];
-    WriteLE32(&msgseq[0], nSequence);
-    int rc = zmq_send_multipart(psocket, command, strlen(command), data, size, msgseq, (size_t)sizeof(uint32_t), (void*)0);
-    if (rc == -1)
-        return false;
-
-    /* increment memory only sequence number after sending */
-    nSequence++;
-
+    // Notifications come from several threads. The sequence number is taken even if the
+    // message is dropped, so subscribers see the gap
+    {
+        boost::unique_lock<boost::mutex> lock(csZMQSend);
+        CZMQQueuedMessage msg{psocket, command, payload, nSequence++};
+        if (queueZMQSend.size() >= MAX_ZMQ_SEND_QUEUE) {
+            LogPrint("zmq", "zmq: Send queue full, dropping %s message %u\n", command, msg.nSequence);
+            return true;
+        }
+        queueZMQSend.push_back(std::move(msg));
+    }
+    condZMQSend.notify_one();
     return true;
 }
 
@@ -148,45 +229,93 @@ bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
     char data[32];
     for (unsigned int i = 0; i < 32; i++)
         data[31 - i] = hash.begin()[i];
-    return SendMessage(MSG_HASHBLOCK, data, 32);
+    return SendMessage(MSG_HASHBLOCK, CZMQPayload(data, 32));
 }
 
-bool CZMQPublishHashTransactionNotifier::NotifyTransaction(const CTransaction &transaction)
+bool CZMQPublishHashTransactionNotifier::NotifyTransaction(const CTransaction &transaction, const CZMQPayload * /*raw*/)
 {
     uint256 hash = transaction.GetHash();
     LogPrint("zmq", "zmq: Publish hashtx %s\n", hash.GetHex());
     char data[32];
     for (unsigned int i = 0; i < 32; i++)
         data[31 - i] = hash.begin()[i];
-    return SendMessage(MSG_HASHTX, data, 32);
+    return SendMessage(MSG_HASHTX, CZMQPayload(data, 32));
 }
 
-bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
+bool CZMQPublishRawBlockNotifier::NotifyBlockConnected(const CBlockIndex *pindex, const CZMQPayload &block)
 {
     LogPrint("zmq", "zmq: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
+    return SendMessage(MSG_RAWBLOCK, block);
+}
 
-    const Consensus::Params& consensusParams = Params().GetConsensus();
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
-    {
-        LOCK(cs_main);
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex, consensusParams))
-        {
-            zmqError("Can't read block from disk");
-            return false;
-        }
+bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &transaction, const CZMQPayload *raw)
+{
+    uint256 hash = transaction.GetHash();
+    LogPrint("zmq", "zmq: Publish rawtx %s\n", hash.GetHex());
+    if (raw)
+        return SendMessage(MSG_RAWTX, *raw);
+    std::shared_ptr<CDataStream> ss = std::make_shared<CDataStream>(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
+    *ss << transaction;
+    return SendMessage(MSG_RAWTX, CZMQPayload(ss, 0, ss->size()));
+}
 
-        ss << block;
-    }
+bool CZMQPublishMempoolStatsNotifier::NotifyBlock(const CBlockIndex *pindex)
+{
+    LogPrint("zmq", "zmq: Publish mempoolstats at %s\n", pindex->GetBlockHash().GetHex());
+    std::string strJSON = mempoolStatsToJSON(false).write();
+    return SendMessage(MSG_MEMPOOLSTATS, CZMQPayload(strJSON.data(), strJSON.size()));
+}
 
-    return SendMessage(MSG_RAWBLOCK, &(*ss.begin()), ss.size());
+bool CZMQPublishHashTransactionLockNotifier::NotifyTransactionLock(const CTransaction &transaction)
+{
+    uint256 hash = transaction.GetHash();
+    LogPrint("zmq", "zmq: Publish hashtxlock %s\n", hash.GetHex());
+    char data[32];
+    for (unsigned int i = 0; i < 32; i++)
+        data[31 - i] = hash.begin()[i];
+    return SendMessage(MSG_HASHTXLOCK, CZMQPayload(data, 32));
 }
 
-bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &transaction)
+bool CZMQPublishRawTransactionLockNotifier::NotifyTransactionLock(const CTransaction &transaction)
 {
     uint256 hash = transaction.GetHash();
-    LogPrint("zmq", "zmq: Publish rawtx %s\n", hash.GetHex());
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
-    ss << transaction;
-    return SendMessage(MSG_RAWTX, &(*ss.begin()), ss.size());
+    LogPrint("zmq", "zmq: Publish rawtxlock %s\n", hash.GetHex());
+    std::shared_ptr<CDataStream> ss = std::make_shared<CDataStream>(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
+    *ss << transaction;
+    return SendMessage(MSG_RAWTXLOCK, CZMQPayload(ss, 0, ss->size()));
+}
+
+bool CZMQPublishSmartnodeListNotifier::NotifySmartnodeListChanged(const COutPoint &outpoint, bool fAdded)
+{
+    LogPrint("zmq", "zmq: Publish smartnodelist %s %s\n", outpoint.ToStringShort(), fAdded ? "added" : "removed");
+    std::shared_ptr<CDataStream> ss = std::make_shared<CDataStream>(SER_NETWORK, PROTOCOL_VERSION);
+    *ss << outpoint << (unsigned char)(fAdded ? 1 : 0);
+    return SendMessage(MSG_SMARTNODELIST, CZMQPayload(ss, 0, ss->size()));
+}
+
+bool CZMQPublishRewardsRoundNotifier::NotifyRewardsRoundFinalized(const CSmartRewardRound &round)
+{
+    LogPrint("zmq", "zmq: Publish rewardsround %d\n", round.number);
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("rewards_cycle", round.number));
+    obj.push_back(Pair("start_blockheight", round.startBlockHeight));
+    obj.push_back(Pair("start_blocktime", round.startBlockTime));
+    obj.push_back(Pair("end_blockheight", round.endBlockHeight));
+    obj.push_back(Pair("end_blocktime", round.endBlockTime));
+    obj.push_back(Pair("eligible_addresses", round.eligibleEntries - round.disqualifiedEntries));
+    obj.push_back(Pair("eligible_smart", ValueFromAmount(round.eligibleSmart - round.disqualifiedSmart)));
+    obj.push_back(Pair("disqualified_addresses", round.disqualifiedEntries));
+    obj.push_back(Pair("disqualified_smart", ValueFromAmount(round.disqualifiedSmart)));
+    obj.push_back(Pair("rewards", ValueFromAmount(round.rewards)));
+    obj.push_back(Pair("percent", round.percent));
+    std::string strJSON = obj.write();
+    return SendMessage(MSG_REWARDSROUND, CZMQPayload(strJSON.data(), strJSON.size()));
+}
+
+bool CZMQPublishSporkNotifier::NotifySporkChanged(const CSporkMessage &spork)
+{
+    LogPrint("zmq", "zmq: Publish spork %d = %d\n", spork.nSporkID, spork.nValue);
+    std::shared_ptr<CDataStream> ss = std::make_shared<CDataStream>(SER_NETWORK, PROTOCOL_VERSION);
+    *ss << spork;
+    return SendMessage(MSG_SPORKCHANGE, CZMQPayload(ss, 0, ss->size()));
 }
@@ -9,20 +9,31 @@
 
 class CBlockIndex;
 
+/** Default for -zmqpubhwm, the send high water mark of each publish socket */
+static const int DEFAULT_ZMQ_SNDHWM = 1000;
+/** Messages waiting for the send thread before new ones are dropped */
+static const size_t MAX_ZMQ_SEND_QUEUE = 1000;
+
+/** Start the thread all publish notifiers send on, after they are initialized */
+void StartZMQSendThread();
+/** Send what is still queued and stop the thread, before the notifiers are shut down */
+void StopZMQSendThread();
+
 class CZMQAbstractPublishNotifier : public CZMQAbstractNotifier
 {
 private:
-    uint32_t nSequence; //!< upcounting per message sequence number
+    uint32_t nSequence; //!< upcounting per message sequence number, a gap means dropped messages
 
 public:
+    CZMQAbstractPublishNotifier() : nSequence(0) { }
 
-    /* send zmq multipart message
+    /* queue zmq multipart message for the send thread
        parts:
           * command
           * data
           * message sequence number
     */
-    bool SendMessage(const char *command, const void* data, size_t size);
+    bool SendMessage(const char *command, const CZMQPayload &payload);
 
     bool Initialize(void *pcontext);
     void Shutdown();
@@ -37,19 +48,58 @@ public:
 class CZMQPublishHashTransactionNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyTransaction(const CTransaction &transaction);
+    bool NotifyTransaction(const CTransaction &transaction, const CZMQPayload *raw);
 };
 
 class CZMQPublishRawBlockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyBlock(const CBlockIndex *pindex);
+    bool NotifyBlockConnected(const CBlockIndex *pindex, const CZMQPayload &block);
 };
 
 class CZMQPublishRawTransactionNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyTransaction(const CTransaction &transaction);
+    bool NotifyTransaction(const CTransaction &transaction, const CZMQPayload *raw);
+};
+
+class CZMQPublishHashTransactionLockNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyTransactionLock(const CTransaction &transaction);
+};
+
+class CZMQPublishRawTransactionLockNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyTransactionLock(const CTransaction &transaction);
+};
+
+/** Publishes the collateral outpoint of each smartnode added to or removed from the list */
+class CZMQPublishSmartnodeListNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifySmartnodeListChanged(const COutPoint &outpoint, bool fAdded);
+};
+
+/** Publishes each finalized SmartRewards round as JSON */
+class CZMQPublishRewardsRoundNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyRewardsRoundFinalized(const CSmartRewardRound &round);
+};
+
+class CZMQPublishSporkNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifySporkChanged(const CSporkMessage &spork);
+};
+
+/** Publishes the getmempoolstats timings as JSON whenever the tip changes */
+class CZMQPublishMempoolStatsNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyBlock(const CBlockIndex *pindex);
 };
 
 #endif // BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H